@@ -0,0 +1,39 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The C sources which aren't also valid C++, as one translation unit. The
+ * rest of the library is in olm.cpp. */
+
+/* src/pool.c asks for MAP_ANONYMOUS and madvise, which has to happen before
+ * the first system header */
+#define _DEFAULT_SOURCE 1
+
+#include "src/attachment.c"
+#include "src/curve25519_mb.c"
+#include "src/inbound_group_session.c"
+#include "src/iovec.c"
+
+#undef PICKLE_VERSION
+#define raw_pickle_length outbound_raw_pickle_length
+#define write_pickle outbound_write_pickle
+#define read_pickle outbound_read_pickle
+#include "src/outbound_group_session.c"
+#undef raw_pickle_length
+#undef write_pickle
+#undef read_pickle
+
+#include "src/pickle_encoding.c"
+#include "src/pool.c"
+#include "src/random.c"
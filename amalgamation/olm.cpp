@@ -0,0 +1,149 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The library as one C++ translation unit, so that the compiler can inline
+ * the crypto code into its callers across what are otherwise separate files.
+ * The C sources which aren't also valid C++ are in olm.c. Where two files
+ * use the same name for their own things, it is renamed around one of them,
+ * as src/ed25519.c does for the ed25519 sources. make amalgamation checks
+ * that every source is in one or the other. */
+
+/* not every file uses all of the helpers it shares with the others */
+#pragma GCC diagnostic ignored "-Wunused-function"
+
+#include "src/account.cpp"
+#include "src/base64.cpp"
+#include "src/canonical_json.cpp"
+#include "src/cipher.cpp"
+#include "src/crypto.cpp"
+
+#define from_c executor_from_c
+#include "src/executor.cpp"
+#undef from_c
+
+#include "src/memory.cpp"
+#include "src/message.cpp"
+#include "src/olm.cpp"
+#include "src/pickle.cpp"
+#include "src/ratchet.cpp"
+
+#define PROTOCOL_VERSION SESSION_PROTOCOL_VERSION
+#include "src/session.cpp"
+#undef PROTOCOL_VERSION
+
+#define from_c session_index_from_c
+#include "src/session_index.cpp"
+#undef from_c
+
+#define from_c session_handle_from_c
+#include "src/session_handle.cpp"
+#undef from_c
+
+#define SessionIndex GroupSessionIndex
+#define aligned group_session_store_aligned
+#include "src/group_session_store.cpp"
+#undef SessionIndex
+#undef aligned
+
+#define aligned ratchet_key_pool_aligned
+#define from_c ratchet_key_pool_from_c
+#include "src/ratchet_key_pool.cpp"
+#undef aligned
+#undef from_c
+
+#define aligned journal_aligned
+#define to_c journal_to_c
+#define from_c journal_from_c
+#include "src/journal.cpp"
+#undef aligned
+#undef to_c
+#undef from_c
+
+#include "src/utility.cpp"
+
+#include "src/aes_ct.c"
+#include "src/aes_hw.c"
+#include "src/base64_simd.c"
+#include "src/cpu.c"
+#include "src/dispatch.c"
+#include "src/curve25519.c"
+#include "src/ed25519.c"
+#define slide ed25519_batch_slide
+#include "src/ed25519_batch.c"
+#undef slide
+#include "src/error.c"
+#include "src/megolm.c"
+#include "src/sha256_hw.c"
+#include "src/sha256_mb.c"
+/* src/sha256_hw.c and src/sha256_mb.c call their round constants K too */
+#undef K
+#include "src/sha512_hw.c"
+#undef K
+/* C++ compilers already ask for POSIX, which src/stats.c does for C */
+#undef _POSIX_C_SOURCE
+#include "src/stats.c"
+#include "src/trace.c"
+
+/* these are also defined by src/sha256_mb.c */
+#undef CH
+#undef MAJ
+#undef EP0
+#undef EP1
+#undef SIG0
+#undef SIG1
+#include "lib/crypto-algorithms/sha256.c"
+#include "lib/crypto-algorithms/aes.c"
+/* src/curve25519.c has already included the 64-bit version of these */
+#define limb donna32_limb
+#define fsum donna32_fsum
+#define fdifference donna32_fdifference
+#define fscalar_product donna32_fscalar_product
+#define fproduct donna32_fproduct
+#define freduce_degree donna32_freduce_degree
+#define freduce_coefficients donna32_freduce_coefficients
+#define div_by_2_26 donna32_div_by_2_26
+#define div_by_2_25 donna32_div_by_2_25
+#define fsquare_inner donna32_fsquare_inner
+#define fsquare donna32_fsquare
+#define fmul donna32_fmul
+#define fexpand donna32_fexpand
+#define fcontract donna32_fcontract
+#define fmonty donna32_fmonty
+#define swap_conditional donna32_swap_conditional
+#define cmult donna32_cmult
+#define crecip donna32_crecip
+#define s32_eq donna32_s32_eq
+#define s32_gte donna32_s32_gte
+#include "lib/curve25519-donna/curve25519-donna.c"
+#undef limb
+#undef fsum
+#undef fdifference
+#undef fscalar_product
+#undef fproduct
+#undef freduce_degree
+#undef freduce_coefficients
+#undef div_by_2_26
+#undef div_by_2_25
+#undef fsquare_inner
+#undef fsquare
+#undef fmul
+#undef fexpand
+#undef fcontract
+#undef fmonty
+#undef swap_conditional
+#undef cmult
+#undef crecip
+#undef s32_eq
+#undef s32_gte
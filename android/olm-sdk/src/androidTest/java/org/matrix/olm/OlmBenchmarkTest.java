@@ -0,0 +1,189 @@
+/*
+ * Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.matrix.olm;
+
+import android.support.test.runner.AndroidJUnit4;
+import android.util.Log;
+
+import org.junit.BeforeClass;
+import org.junit.FixMethodOrder;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.MethodSorters;
+
+import java.io.ByteArrayInputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.ObjectInputStream;
+import java.io.ObjectOutputStream;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Locale;
+
+import static org.junit.Assert.assertNotNull;
+
+/**
+ * Times the calls that benchmarks/bench_bindings.cpp makes straight to the C API, with the same
+ * names and in the same order, so that the difference is what the JNI layer adds to each call:
+ * array copies, string conversions and the JNI transitions themselves.<br>
+ * The results are logged with the tag below, one line for each operation. Sessions are pickled
+ * with Java serialization, as applications store them, so that includes generating a pickle key.
+ */
+@RunWith(AndroidJUnit4.class)
+@FixMethodOrder(MethodSorters.NAME_ASCENDING)
+public class OlmBenchmarkTest {
+    private static final String LOG_TAG = "OlmBenchmarkTest";
+    private static final int ITERATIONS = 1000;
+    private static final String CLEAR_MESSAGE = "Hello, World";
+
+    private static OlmManager mOlmManager;
+
+    /**
+     * An operation to time, given the number of the call.
+     */
+    private interface Operation {
+        void run(int aIteration) throws Exception;
+    }
+
+    @BeforeClass
+    public static void setUpClass(){
+        // load native lib
+        mOlmManager = new OlmManager();
+
+        String version = mOlmManager.getOlmLibVersion();
+        assertNotNull(version);
+        Log.d(LOG_TAG, "## setUpClass(): lib version="+version);
+    }
+
+    /**
+     * Call the operation ITERATIONS times and log the mean time per call.
+     * @param aName the name of the operation, as in the native benchmark
+     * @param aOperation the operation
+     * @throws Exception the operation's failure
+     */
+    private static void time(String aName, Operation aOperation) throws Exception {
+        long start = System.nanoTime();
+        for (int i = 0; i < ITERATIONS; i++) {
+            aOperation.run(i);
+        }
+        double nsPerOp = (System.nanoTime() - start) / (double) ITERATIONS;
+        Log.i(LOG_TAG, String.format(Locale.US, "%-40s%12.1f ns/op", aName, nsPerOp));
+    }
+
+    private static byte[] serialize(Object aObject) throws Exception {
+        ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+        ObjectOutputStream objectOutput = new ObjectOutputStream(bytes);
+        objectOutput.writeObject(aObject);
+        objectOutput.flush();
+        objectOutput.close();
+        return bytes.toByteArray();
+    }
+
+    private static Object deserialize(byte[] aBytes) throws Exception {
+        ObjectInputStream objectInput = new ObjectInputStream(new ByteArrayInputStream(aBytes));
+        Object object = objectInput.readObject();
+        objectInput.close();
+        return object;
+    }
+
+    @Test
+    public void test01Group() throws Exception {
+        final OlmOutboundGroupSession outboundSession = new OlmOutboundGroupSession();
+        final OlmInboundGroupSession inboundSession = new OlmInboundGroupSession(outboundSession.sessionKey());
+        final List<String> messages = new ArrayList<>();
+
+        time("group encrypt", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                messages.add(outboundSession.encryptMessage(CLEAR_MESSAGE));
+            }
+        });
+        time("group decrypt", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                inboundSession.decryptMessage(messages.get(aIteration));
+            }
+        });
+        time("group pickle", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                serialize(inboundSession);
+            }
+        });
+
+        outboundSession.releaseSession();
+        inboundSession.releaseSession();
+    }
+
+    @Test
+    public void test02OneToOne() throws Exception {
+        time("account create", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                new OlmAccount().releaseAccount();
+            }
+        });
+
+        OlmAccount aliceAccount = new OlmAccount();
+        OlmAccount bobAccount = new OlmAccount();
+        bobAccount.generateOneTimeKeys(1);
+        String bobIdentityKey = TestHelper.getIdentityKey(bobAccount.identityKeys());
+        String bobOneTimeKey = TestHelper.getOneTimeKey(bobAccount.oneTimeKeys(), 1);
+
+        final OlmSession aliceSession = new OlmSession();
+        final OlmSession bobSession = new OlmSession();
+        aliceSession.initOutboundSession(aliceAccount, bobIdentityKey, bobOneTimeKey);
+        OlmMessage first = aliceSession.encryptMessage(CLEAR_MESSAGE);
+        bobSession.initInboundSession(bobAccount, first.mCipherText);
+        bobSession.decryptMessage(first);
+
+        // bob replies so that alice stops sending pre-key messages
+        OlmMessage reply = bobSession.encryptMessage(CLEAR_MESSAGE);
+        aliceSession.decryptMessage(reply);
+
+        final List<OlmMessage> messages = new ArrayList<>();
+        time("one-to-one encrypt", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                messages.add(aliceSession.encryptMessage(CLEAR_MESSAGE));
+            }
+        });
+        time("one-to-one decrypt", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                bobSession.decryptMessage(messages.get(aIteration));
+            }
+        });
+        time("session pickle", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                serialize(bobSession);
+            }
+        });
+        final byte[] pickled = serialize(bobSession);
+        time("session unpickle", new Operation() {
+            @Override
+            public void run(int aIteration) throws Exception {
+                ((OlmSession) deserialize(pickled)).releaseSession();
+            }
+        });
+
+        aliceSession.releaseSession();
+        bobSession.releaseSession();
+        aliceAccount.releaseAccount();
+        bobAccount.releaseAccount();
+    }
+}
@@ -35,6 +35,9 @@ import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.ObjectInputStream;
 import java.io.ObjectOutputStream;
+import java.nio.ByteBuffer;
+import java.util.Arrays;
+import java.util.List;
 
 import static android.support.test.InstrumentationRegistry.getInstrumentation;
 import static org.junit.Assert.assertFalse;
@@ -521,5 +524,112 @@ public class OlmGroupSessionTest {
         assertTrue(0!=EXPECTED_ERROR_MESSAGE.length());
         assertTrue(EXPECTED_ERROR_MESSAGE.equals(exceptionMessage));
     }
-}
 
+    /**
+     * Decrypt a message given in a direct ByteBuffer into another one.
+     */
+    @Test
+    public void test20InboundDecryptDirectBuffers() {
+        OlmOutboundGroupSession aliceOutboundGroupSession = null;
+        OlmInboundGroupSession bobInboundGroupSession = null;
+        String encryptedMsg = null;
+        byte[] clearMsg = "Hello, World".getBytes();
+
+        try {
+            aliceOutboundGroupSession = new OlmOutboundGroupSession();
+            bobInboundGroupSession = new OlmInboundGroupSession(aliceOutboundGroupSession.sessionKey());
+            encryptedMsg = aliceOutboundGroupSession.encryptMessage(new String(clearMsg, "UTF-8"));
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        byte[] encryptedBytes = encryptedMsg.getBytes();
+        ByteBuffer encryptedBuffer = ByteBuffer.allocateDirect(encryptedBytes.length);
+        encryptedBuffer.put(encryptedBytes);
+        encryptedBuffer.flip();
+
+        ByteBuffer plainTextBuffer = null;
+        long index = -1;
+        try {
+            plainTextBuffer = ByteBuffer.allocateDirect(bobInboundGroupSession.maxPlaintextLength(encryptedBuffer));
+            index = bobInboundGroupSession.decryptMessage(encryptedBuffer, plainTextBuffer);
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        assertTrue(0 == index);
+        plainTextBuffer.flip();
+        byte[] decryptedMsg = new byte[plainTextBuffer.remaining()];
+        plainTextBuffer.get(decryptedMsg);
+        assertTrue(Arrays.equals(clearMsg, decryptedMsg));
+
+        aliceOutboundGroupSession.releaseSession();
+        bobInboundGroupSession.releaseSession();
+    }
+
+    /**
+     * Decrypt a batch of messages, one of which is corrupted.
+     */
+    @Test
+    public void test21InboundDecryptMessages() {
+        OlmOutboundGroupSession aliceOutboundGroupSession = null;
+        OlmInboundGroupSession bobInboundGroupSession = null;
+        List<String> encryptedMsgs = new java.util.ArrayList<>();
+
+        try {
+            aliceOutboundGroupSession = new OlmOutboundGroupSession();
+            bobInboundGroupSession = new OlmInboundGroupSession(aliceOutboundGroupSession.sessionKey());
+            encryptedMsgs.add(aliceOutboundGroupSession.encryptMessage("first"));
+            encryptedMsgs.add("AwgANYTHINGf87ge45ge7gr*/rg5ganything4gr41rrgr4re55tanythingmcsXUkhDv0UePj922kgf+");
+            encryptedMsgs.add(aliceOutboundGroupSession.encryptMessage("second"));
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        OlmInboundGroupSession.DecryptMessageResult[] results = null;
+        try {
+            results = bobInboundGroupSession.decryptMessages(encryptedMsgs);
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        assertTrue(3 == results.length);
+        assertTrue("first".equals(results[0].mDecryptedMessage));
+        assertTrue(0 == results[0].mIndex);
+        assertTrue(null == results[0].mErrorMessage);
+        assertTrue(null == results[1].mDecryptedMessage);
+        assertTrue("INVALID_BASE64".equals(results[1].mErrorMessage));
+        assertTrue("second".equals(results[2].mDecryptedMessage));
+        assertTrue(1 == results[2].mIndex);
+
+        aliceOutboundGroupSession.releaseSession();
+        bobInboundGroupSession.releaseSession();
+    }
+
+    /**
+     * The index getters, which are called without most of the JNI transition.
+     */
+    @Test
+    public void test22FirstKnownAndMessageIndex() {
+        OlmOutboundGroupSession aliceOutboundGroupSession = null;
+        OlmInboundGroupSession bobInboundGroupSession = null;
+
+        try {
+            aliceOutboundGroupSession = new OlmOutboundGroupSession();
+            aliceOutboundGroupSession.encryptMessage("first");
+            bobInboundGroupSession = new OlmInboundGroupSession(aliceOutboundGroupSession.sessionKey());
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        assertTrue(1 == aliceOutboundGroupSession.messageIndex());
+        assertTrue(1 == bobInboundGroupSession.firstKnownIndex());
+
+        aliceOutboundGroupSession.releaseSession();
+        bobInboundGroupSession.releaseSession();
+
+        // released sessions have nothing to look at
+        assertTrue(0 == aliceOutboundGroupSession.messageIndex());
+        assertTrue(0 == bobInboundGroupSession.firstKnownIndex());
+    }
+}
@@ -35,6 +35,8 @@ import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.ObjectInputStream;
 import java.io.ObjectOutputStream;
+import java.nio.ByteBuffer;
+import java.util.Arrays;
 import java.util.Map;
 
 import static android.support.test.InstrumentationRegistry.getInstrumentation;
@@ -1011,4 +1013,89 @@ public class OlmSessionTest {
         assertTrue(bobSession.isReleased());
     }
 
+    /**
+     * Encrypt and decrypt with direct ByteBuffers:
+     * - alice encrypts a message into a direct buffer
+     * - bob creates an inbound session from it and decrypts it into another direct buffer
+     */
+    @Test
+    public void test07DirectBuffers() {
+        OlmAccount aliceAccount = null;
+        OlmAccount bobAccount = null;
+        OlmSession aliceSession = null;
+        OlmSession bobSession = null;
+
+        try {
+            aliceAccount = new OlmAccount();
+            bobAccount = new OlmAccount();
+            bobAccount.generateOneTimeKeys(1);
+            String bobIdentityKey = TestHelper.getIdentityKey(bobAccount.identityKeys());
+            String bobOneTimeKey = TestHelper.getOneTimeKey(bobAccount.oneTimeKeys(), 1);
+
+            aliceSession = new OlmSession();
+            aliceSession.initOutboundSession(aliceAccount, bobIdentityKey, bobOneTimeKey);
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        byte[] clearMsg = "Heloo bob , this is alice!".getBytes();
+        ByteBuffer clearBuffer = ByteBuffer.allocateDirect(clearMsg.length);
+        clearBuffer.put(clearMsg);
+        clearBuffer.flip();
+
+        ByteBuffer encryptedBuffer = null;
+        long messageType = -1;
+        try {
+            encryptedBuffer = ByteBuffer.allocateDirect(aliceSession.encryptedMessageLength(clearMsg.length));
+            messageType = aliceSession.encryptMessage(clearBuffer, encryptedBuffer);
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+        assertTrue(OlmMessage.MESSAGE_TYPE_PRE_KEY == messageType);
+        assertFalse(clearBuffer.hasRemaining());
+        encryptedBuffer.flip();
+
+        byte[] encryptedMsg = new byte[encryptedBuffer.remaining()];
+        encryptedBuffer.duplicate().get(encryptedMsg);
+
+        // non direct buffers are refused
+        try {
+            aliceSession.encryptMessage(ByteBuffer.wrap(clearMsg), ByteBuffer.allocate(encryptedMsg.length));
+            assertTrue("a heap buffer was accepted", false);
+        } catch (OlmException e) {
+            assertTrue(OlmException.EXCEPTION_CODE_SESSION_ENCRYPT_MESSAGE == e.getExceptionCode());
+        }
+
+        try {
+            bobSession = new OlmSession();
+            bobSession.initInboundSession(bobAccount, new String(encryptedMsg, "UTF-8"));
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        ByteBuffer plainTextBuffer = null;
+        int plainTextLength = 0;
+        try {
+            plainTextBuffer = ByteBuffer.allocateDirect(bobSession.maxPlaintextLength(messageType, encryptedBuffer));
+            plainTextLength = bobSession.decryptMessage(messageType, encryptedBuffer, plainTextBuffer);
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+        assertTrue(clearMsg.length == plainTextLength);
+        plainTextBuffer.flip();
+        byte[] decryptedMsg = new byte[plainTextBuffer.remaining()];
+        plainTextBuffer.get(decryptedMsg);
+        assertTrue(Arrays.equals(clearMsg, decryptedMsg));
+
+        try {
+            bobAccount.removeOneTimeKeys(bobSession);
+        } catch (Exception e) {
+            assertTrue(e.getMessage(), false);
+        }
+
+        aliceAccount.releaseAccount();
+        bobAccount.releaseAccount();
+        aliceSession.releaseSession();
+        bobSession.releaseSession();
+    }
 }
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2016 OpenMarket Ltd
+ * Copyright 2016 Vector Creations Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package dalvik.annotation.optimization;
+
+import java.lang.annotation.ElementType;
+import java.lang.annotation.Retention;
+import java.lang.annotation.RetentionPolicy;
+import java.lang.annotation.Target;
+
+/**
+ * Marks a static native method, taking and returning only primitive types, which is called
+ * without a JNIEnv or class. The method can't use JNI at all, and the garbage collector can't
+ * suspend the thread while it runs, so it must be quick and must not block. Until API 31 such
+ * methods have to be registered with RegisterNatives().
+ * <p>
+ * This is a copy of the platform's annotation, which is only public in recent SDKs. The runtime
+ * looks the annotation up by name in the dex file from API 26, and earlier versions ignore it.
+ */
+@Retention(RetentionPolicy.CLASS)
+@Target(ElementType.METHOD)
+public @interface CriticalNative {
+}
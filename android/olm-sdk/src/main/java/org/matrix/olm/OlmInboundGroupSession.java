@@ -20,10 +20,15 @@ package org.matrix.olm;
 import android.text.TextUtils;
 import android.util.Log;
 
+import dalvik.annotation.optimization.CriticalNative;
+import dalvik.annotation.optimization.FastNative;
+
 import java.io.IOException;
 import java.io.ObjectInputStream;
 import java.io.ObjectOutputStream;
 import java.io.Serializable;
+import java.nio.ByteBuffer;
+import java.util.List;
 
 /**
  * Class used to create an inbound <a href="http://matrix.org/docs/guides/e2e_implementation.html#handling-an-m-room-key-event">Megolm session</a>.<br>
@@ -49,6 +54,9 @@ public class OlmInboundGroupSession extends CommonSerializeUtils implements Seri
 
         /** decrypt index **/
         public long mIndex;
+
+        /** why the message couldn't be decrypted, set by {@link #decryptMessages(List)} instead of throwing **/
+        public String mErrorMessage;
     }
 
     /**
@@ -126,8 +134,25 @@ public class OlmInboundGroupSession extends CommonSerializeUtils implements Seri
      * An exception is thrown if the operation fails.
      * @return the base64-encoded identifier
      */
+    @FastNative
     private native byte[] sessionIdentifierJni();
 
+    /**
+     * Get the first message index this session can decrypt.
+     * @return the first known index
+     */
+    public long firstKnownIndex() {
+        return firstKnownIndexJni(mNativeId);
+    }
+
+    /**
+     * Get the first message index a session can decrypt.
+     * @param aNativeId the native session, or 0 if it has been released
+     * @return the first known index, or 0 if the session has been released
+     */
+    @CriticalNative
+    private static native long firstKnownIndexJni(long aNativeId);
+
     /**
      * Decrypt the message passed in parameter.<br>
      * In case of error, null is returned and an error message description is provided in aErrorMsg.
@@ -161,6 +186,116 @@ public class OlmInboundGroupSession extends CommonSerializeUtils implements Seri
      */
     private native byte[] decryptMessageJni(byte[] aEncryptedMsg, DecryptMessageResult aDecryptMessageResult);
 
+    /**
+     * Get the maximum length of the plain text a message could decrypt to.<br>
+     * The message is read from the remaining bytes of aEncryptedMsg, which aren't changed.
+     * @param aEncryptedMsg direct buffer holding the message to decrypt
+     * @return the maximum plain text length in bytes
+     * @exception OlmException the failure reason
+     */
+    public int maxPlaintextLength(ByteBuffer aEncryptedMsg) throws OlmException {
+        if ((null == aEncryptedMsg) || !aEncryptedMsg.isDirect()) {
+            Log.e(LOG_TAG, "## maxPlaintextLength(): invalid input parameters");
+            throw new OlmException(OlmException.EXCEPTION_CODE_INBOUND_GROUP_SESSION_DECRYPT_SESSION, "invalid input parameters");
+        }
+
+        try {
+            return maxPlaintextLengthDirectJni(aEncryptedMsg, aEncryptedMsg.position(), aEncryptedMsg.remaining());
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## maxPlaintextLength() failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_INBOUND_GROUP_SESSION_DECRYPT_SESSION, e.getMessage());
+        }
+    }
+
+    /**
+     * Decrypt a message without copying it in or out of the native heap.<br>
+     * The message is read from the remaining bytes of aEncryptedMsg, which are overwritten, and the plain text
+     * is written from the position of aPlainText, which must have {@link #maxPlaintextLength(ByteBuffer)}
+     * bytes remaining. Both positions are moved past the bytes read and written.
+     * @param aEncryptedMsg direct buffer holding the message to decrypt
+     * @param aPlainText direct buffer to write the plain text into
+     * @return the message index
+     * @exception OlmException the failure reason
+     */
+    public long decryptMessage(ByteBuffer aEncryptedMsg, ByteBuffer aPlainText) throws OlmException {
+        if ((null == aEncryptedMsg) || !aEncryptedMsg.isDirect() || (null == aPlainText) || !aPlainText.isDirect()) {
+            Log.e(LOG_TAG, "## decryptMessage(): invalid input parameters");
+            throw new OlmException(OlmException.EXCEPTION_CODE_INBOUND_GROUP_SESSION_DECRYPT_SESSION, "invalid input parameters");
+        }
+
+        try {
+            // the index and the length come back together, to save an object per message
+            long result = decryptMessageDirectJni(aEncryptedMsg, aEncryptedMsg.position(), aEncryptedMsg.remaining(),
+                    aPlainText, aPlainText.position(), aPlainText.remaining());
+
+            aEncryptedMsg.position(aEncryptedMsg.limit());
+            aPlainText.position(aPlainText.position() + (int) (result & 0xffffffffL));
+            return result >>> 32;
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## decryptMessage() failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_INBOUND_GROUP_SESSION_DECRYPT_SESSION, e.getMessage());
+        }
+    }
+
+    /**
+     * Decrypt several messages with one call into the native library.<br>
+     * The messages are decrypted in order of message index, so this is faster than calling
+     * {@link #decryptMessage(String)} for each message. A message which can't be decrypted doesn't stop the others: its result has
+     * mErrorMessage set and mDecryptedMessage null.
+     * @param aEncryptedMsgs the messages to decrypt
+     * @return a result for each message, in the same order
+     * @exception OlmException the failure reason, if the batch couldn't be decrypted at all
+     */
+    public DecryptMessageResult[] decryptMessages(List<String> aEncryptedMsgs) throws OlmException {
+        if (null == aEncryptedMsgs) {
+            Log.e(LOG_TAG, "## decryptMessages(): invalid input parameters");
+            throw new OlmException(OlmException.EXCEPTION_CODE_INBOUND_GROUP_SESSION_DECRYPT_SESSION, "invalid input parameters");
+        }
+
+        int count = aEncryptedMsgs.size();
+        DecryptMessageResult[] results = new DecryptMessageResult[count];
+
+        try {
+            byte[][] encryptedMsgs = new byte[count][];
+            for (int i = 0; i < count; i++) {
+                String encryptedMsg = aEncryptedMsgs.get(i);
+                encryptedMsgs[i] = (null == encryptedMsg) ? new byte[0] : encryptedMsg.getBytes("UTF-8");
+            }
+
+            long[] indexes = new long[count];
+            String[] errors = new String[count];
+            byte[][] decryptedMsgs = decryptMessagesJni(encryptedMsgs, indexes, errors);
+
+            for (int i = 0; i < count; i++) {
+                DecryptMessageResult result = new DecryptMessageResult();
+                result.mIndex = indexes[i];
+                result.mErrorMessage = errors[i];
+                if (null != decryptedMsgs[i]) {
+                    result.mDecryptedMessage = new String(decryptedMsgs[i], "UTF-8");
+                }
+                results[i] = result;
+            }
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## decryptMessages() failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_INBOUND_GROUP_SESSION_DECRYPT_SESSION, e.getMessage());
+        }
+
+        return results;
+    }
+
+    /**
+     * Decrypt several messages.
+     * An exception is thrown if the batch couldn't be decrypted at all.
+     * @param aEncryptedMsgs the encrypted messages
+     * @param aIndexes the message index of each message
+     * @param aErrors the error message for each message which couldn't be decrypted
+     * @return the decrypted messages, null for those which couldn't be decrypted
+     */
+    private native byte[][] decryptMessagesJni(byte[][] aEncryptedMsgs, long[] aIndexes, String[] aErrors);
+
+    private native int maxPlaintextLengthDirectJni(ByteBuffer aEncryptedMsg, int aEncryptedMsgOffset, int aEncryptedMsgLength);
+    private native long decryptMessageDirectJni(ByteBuffer aEncryptedMsg, int aEncryptedMsgOffset, int aEncryptedMsgLength, ByteBuffer aPlainText, int aPlainTextOffset, int aPlainTextLength);
+
     //==============================================================================================================
     // Serialization management
     //==============================================================================================================
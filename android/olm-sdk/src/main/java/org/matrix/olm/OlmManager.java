@@ -60,5 +60,34 @@ public class OlmManager {
         return getOlmLibVersionJni();
     }
     public native String getOlmLibVersionJni();
+
+    /**
+     * Tell whether the native library keeps the counters returned by {@link #getStats()}.
+     * @return true if it was built with OLM_STATS
+     */
+    public boolean isStatsEnabled() {
+        return isStatsEnabledJni();
+    }
+    native boolean isStatsEnabledJni();
+
+    /**
+     * Take a snapshot of the native library's counters for the calling thread,
+     * to see which operations the time goes on.
+     * @return the counters
+     */
+    public OlmStats getStats() {
+        long[] counters = new long[OlmStats.COUNTER_COUNT];
+        getStatsJni(counters);
+        return new OlmStats(counters);
+    }
+    native void getStatsJni(long[] aCounters);
+
+    /**
+     * Set the native library's counters for the calling thread back to zero.
+     */
+    public void resetStats() {
+        resetStatsJni();
+    }
+    native void resetStatsJni();
 }
 
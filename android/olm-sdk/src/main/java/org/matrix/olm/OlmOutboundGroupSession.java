@@ -21,6 +21,9 @@ package org.matrix.olm;
 import android.text.TextUtils;
 import android.util.Log;
 
+import dalvik.annotation.optimization.CriticalNative;
+import dalvik.annotation.optimization.FastNative;
+
 import java.io.IOException;
 import java.io.ObjectInputStream;
 import java.io.ObjectOutputStream;
@@ -110,6 +113,7 @@ public class OlmOutboundGroupSession extends CommonSerializeUtils implements Ser
      * An exception is thrown if the operation fails.
      * @return the session identifier
      */
+    @FastNative
     private native byte[] sessionIdentifierJni();
 
     /**
@@ -119,17 +123,18 @@ public class OlmOutboundGroupSession extends CommonSerializeUtils implements Ser
      * @return current session index
      */
     public int messageIndex() {
-        return messageIndexJni();
+        return messageIndexJni(mNativeId);
     }
 
     /**
-     * Get the current message index for this session.<br>
+     * Get the current message index for a session.<br>
      * Each message is sent with an increasing index, this
      * method returns the index for the next message.
-     * An exception is thrown if the operation fails.
-     * @return current session index
+     * @param aNativeId the native session, or 0 if it has been released
+     * @return current session index, or 0 if the session has been released
      */
-    private native int messageIndexJni();
+    @CriticalNative
+    private static native int messageIndexJni(long aNativeId);
 
     /**
      * Get the base64-encoded current ratchet key for this session.<br>
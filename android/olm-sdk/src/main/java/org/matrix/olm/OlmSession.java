@@ -20,10 +20,14 @@ package org.matrix.olm;
 import android.text.TextUtils;
 import android.util.Log;
 
+import dalvik.annotation.optimization.FastNative;
+
 import java.io.IOException;
 import java.io.ObjectInputStream;
 import java.io.ObjectOutputStream;
 import java.io.Serializable;
+import java.nio.ByteBuffer;
+import java.util.List;
 
 /**
  * Session class used to create Olm sessions in conjunction with {@link OlmAccount} class.<br>
@@ -219,6 +223,7 @@ public class OlmSession extends CommonSerializeUtils implements Serializable {
      * An exception is thrown if the operation fails.
      * @return the session identifier
      */
+    @FastNative
     private native byte[] getSessionIdentifierJni();
 
     /**
@@ -344,6 +349,158 @@ public class OlmSession extends CommonSerializeUtils implements Serializable {
      */
     private native byte[] decryptMessageJni(OlmMessage aEncryptedMsg);
 
+    /**
+     * Get the length of the message {@link #encryptMessage(ByteBuffer, ByteBuffer)} will write next.
+     * @param aClearMsgLength length in bytes of the clear text message
+     * @return the length in bytes of the encrypted message
+     * @exception OlmException the failure reason
+     */
+    public int encryptedMessageLength(int aClearMsgLength) throws OlmException {
+        try {
+            return encryptMessageLengthJni(aClearMsgLength);
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## encryptedMessageLength(): failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_ENCRYPT_MESSAGE, e.getMessage());
+        }
+    }
+
+    /**
+     * Encrypt a message using the session, without copying it in or out of the native heap.<br>
+     * The clear text is read from the remaining bytes of aClearMsg, and the encrypted message is written
+     * from the position of aEncryptedMsg, which must have {@link #encryptedMessageLength(int)} bytes remaining.
+     * Both positions are moved past the bytes read and written.
+     * @param aClearMsg direct buffer holding the message to encrypt
+     * @param aEncryptedMsg direct buffer to write the encrypted message into
+     * @return the message type: {@link OlmMessage#MESSAGE_TYPE_PRE_KEY} or {@link OlmMessage#MESSAGE_TYPE_MESSAGE}
+     * @exception OlmException the failure reason
+     */
+    public long encryptMessage(ByteBuffer aClearMsg, ByteBuffer aEncryptedMsg) throws OlmException {
+        if ((null == aClearMsg) || !aClearMsg.isDirect() || (null == aEncryptedMsg) || !aEncryptedMsg.isDirect()) {
+            Log.e(LOG_TAG, "## encryptMessage(): invalid input parameters");
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_ENCRYPT_MESSAGE, "invalid input parameters");
+        }
+
+        try {
+            long messageType = encryptMessageTypeJni();
+            int encryptedMsgLength = encryptMessageDirectJni(aClearMsg, aClearMsg.position(), aClearMsg.remaining(),
+                    aEncryptedMsg, aEncryptedMsg.position(), aEncryptedMsg.remaining());
+
+            aClearMsg.position(aClearMsg.limit());
+            aEncryptedMsg.position(aEncryptedMsg.position() + encryptedMsgLength);
+            return messageType;
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## encryptMessage(): failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_ENCRYPT_MESSAGE, e.getMessage());
+        }
+    }
+
+    /**
+     * Get the maximum length of the plain text a message could decrypt to.<br>
+     * The message is read from the remaining bytes of aEncryptedMsg, which aren't changed.
+     * @param aMsgType the message type
+     * @param aEncryptedMsg direct buffer holding the message to decrypt
+     * @return the maximum plain text length in bytes
+     * @exception OlmException the failure reason
+     */
+    public int maxPlaintextLength(long aMsgType, ByteBuffer aEncryptedMsg) throws OlmException {
+        if ((null == aEncryptedMsg) || !aEncryptedMsg.isDirect()) {
+            Log.e(LOG_TAG, "## maxPlaintextLength(): invalid input parameters");
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_DECRYPT_MESSAGE, "invalid input parameters");
+        }
+
+        try {
+            return maxPlaintextLengthDirectJni(aMsgType, aEncryptedMsg, aEncryptedMsg.position(), aEncryptedMsg.remaining());
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## maxPlaintextLength(): failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_DECRYPT_MESSAGE, e.getMessage());
+        }
+    }
+
+    /**
+     * Decrypt a message using the session, without copying it in or out of the native heap.<br>
+     * The message is read from the remaining bytes of aEncryptedMsg, which are overwritten, and the plain text
+     * is written from the position of aPlainText, which must have {@link #maxPlaintextLength(long, ByteBuffer)}
+     * bytes remaining. Both positions are moved past the bytes read and written.
+     * @param aMsgType the message type
+     * @param aEncryptedMsg direct buffer holding the message to decrypt
+     * @param aPlainText direct buffer to write the plain text into
+     * @return the length in bytes of the plain text
+     * @exception OlmException the failure reason
+     */
+    public int decryptMessage(long aMsgType, ByteBuffer aEncryptedMsg, ByteBuffer aPlainText) throws OlmException {
+        if ((null == aEncryptedMsg) || !aEncryptedMsg.isDirect() || (null == aPlainText) || !aPlainText.isDirect()) {
+            Log.e(LOG_TAG, "## decryptMessage(): invalid input parameters");
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_DECRYPT_MESSAGE, "invalid input parameters");
+        }
+
+        try {
+            int plainTextLength = decryptMessageDirectJni(aMsgType, aEncryptedMsg, aEncryptedMsg.position(), aEncryptedMsg.remaining(),
+                    aPlainText, aPlainText.position(), aPlainText.remaining());
+
+            aEncryptedMsg.position(aEncryptedMsg.limit());
+            aPlainText.position(aPlainText.position() + plainTextLength);
+            return plainTextLength;
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## decryptMessage(): failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_DECRYPT_MESSAGE, e.getMessage());
+        }
+    }
+
+    /**
+     * Decrypt several messages with one call into the native library, in the order they are given.<br>
+     * A message which can't be decrypted doesn't stop the others: its entry in aErrors is set to the reason,
+     * and its entry in the result is null.
+     * @param aEncryptedMsgs the messages to decrypt
+     * @param aErrors filled in with the reason each message couldn't be decrypted, or null; it must be as long as aEncryptedMsgs
+     * @return the decrypted messages, in the same order
+     * @exception OlmException the failure reason, if the batch couldn't be decrypted at all
+     */
+    public String[] decryptMessages(List<OlmMessage> aEncryptedMsgs, String[] aErrors) throws OlmException {
+        if ((null == aEncryptedMsgs) || (null == aErrors) || (aErrors.length != aEncryptedMsgs.size())) {
+            Log.e(LOG_TAG, "## decryptMessages(): invalid input parameters");
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_DECRYPT_MESSAGE, "invalid input parameters");
+        }
+
+        int count = aEncryptedMsgs.size();
+        String[] decryptedMsgs = new String[count];
+
+        try {
+            long[] msgTypes = new long[count];
+            byte[][] encryptedMsgs = new byte[count][];
+            for (int i = 0; i < count; i++) {
+                OlmMessage encryptedMsg = aEncryptedMsgs.get(i);
+                if ((null == encryptedMsg) || (null == encryptedMsg.mCipherText)) {
+                    encryptedMsgs[i] = new byte[0];
+                } else {
+                    msgTypes[i] = encryptedMsg.mType;
+                    encryptedMsgs[i] = encryptedMsg.mCipherText.getBytes("UTF-8");
+                }
+                aErrors[i] = null;
+            }
+
+            byte[][] decryptedBuffers = decryptMessagesJni(msgTypes, encryptedMsgs, aErrors);
+
+            for (int i = 0; i < count; i++) {
+                if (null != decryptedBuffers[i]) {
+                    decryptedMsgs[i] = new String(decryptedBuffers[i], "UTF-8");
+                }
+            }
+        } catch (Exception e) {
+            Log.e(LOG_TAG, "## decryptMessages(): failed " + e.getMessage());
+            throw new OlmException(OlmException.EXCEPTION_CODE_SESSION_DECRYPT_MESSAGE, e.getMessage());
+        }
+
+        return decryptedMsgs;
+    }
+
+    private native byte[][] decryptMessagesJni(long[] aMsgTypes, byte[][] aEncryptedMsgs, String[] aErrors);
+
+    private native long encryptMessageTypeJni();
+    private native int encryptMessageLengthJni(int aClearMsgLength);
+    private native int encryptMessageDirectJni(ByteBuffer aClearMsg, int aClearMsgOffset, int aClearMsgLength, ByteBuffer aEncryptedMsg, int aEncryptedMsgOffset, int aEncryptedMsgLength);
+    private native int maxPlaintextLengthDirectJni(long aMsgType, ByteBuffer aEncryptedMsg, int aEncryptedMsgOffset, int aEncryptedMsgLength);
+    private native int decryptMessageDirectJni(long aMsgType, ByteBuffer aEncryptedMsg, int aEncryptedMsgOffset, int aEncryptedMsgLength, ByteBuffer aPlainText, int aPlainTextOffset, int aPlainTextLength);
+
     //==============================================================================================================
     // Serialization management
     //==============================================================================================================
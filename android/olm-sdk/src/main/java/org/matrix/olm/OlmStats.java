@@ -0,0 +1,76 @@
+/*
+ * Copyright 2016 OpenMarket Ltd
+ * Copyright 2016 Vector Creations Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.matrix.olm;
+
+/**
+ * A snapshot of the native library's counters of the work it has done, and of the time spent in its main calls,
+ * on the calling thread.<br>
+ * See {@link OlmManager#getStats()}. The counters are only kept if the native library was built with OLM_STATS,
+ * see {@link OlmManager#isStatsEnabled()}; otherwise they are all zero.
+ */
+public class OlmStats {
+    /** indexes into {@link #mCalls} and {@link #mNanoseconds} **/
+    public final static int OPERATION_CREATE_OUTBOUND_SESSION = 0;
+    public final static int OPERATION_CREATE_INBOUND_SESSION = 1;
+    public final static int OPERATION_ENCRYPT = 2;
+    public final static int OPERATION_DECRYPT = 3;
+    public final static int OPERATION_GROUP_ENCRYPT = 4;
+    public final static int OPERATION_GROUP_DECRYPT = 5;
+    public final static int OPERATION_PICKLE = 6;
+    public final static int OPERATION_UNPICKLE = 7;
+    public final static int OPERATION_COUNT = 8;
+
+    /** the number of counters read by {@link OlmManager#getStatsJni(long[])} **/
+    final static int COUNTER_COUNT = 10 + 2 * OPERATION_COUNT;
+
+    /** SHA-256 compression function calls, one per 64 byte block **/
+    public long mSha256Blocks;
+    /** HMAC-SHA-256s, including those inside HKDFs **/
+    public long mHmacSha256;
+    public long mHkdfSha256;
+    /** AES-256 blocks encrypted or decrypted **/
+    public long mAesBlocks;
+    /** X25519 key pairs generated, and shared secrets computed **/
+    public long mCurve25519Keys;
+    public long mCurve25519SharedSecrets;
+    public long mEd25519Signs;
+    public long mEd25519Verifies;
+    /** parts of a Megolm ratchet rehashed **/
+    public long mMegolmRehashes;
+    /** steps along an Olm ratchet's chain **/
+    public long mChainKeyAdvances;
+    /** how many times each operation was called, indexed by the OPERATION_* constants **/
+    public long[] mCalls = new long[OPERATION_COUNT];
+    /** the total time spent in each operation, in nanoseconds **/
+    public long[] mNanoseconds = new long[OPERATION_COUNT];
+
+    OlmStats(long[] aCounters) {
+        mSha256Blocks = aCounters[0];
+        mHmacSha256 = aCounters[1];
+        mHkdfSha256 = aCounters[2];
+        mAesBlocks = aCounters[3];
+        mCurve25519Keys = aCounters[4];
+        mCurve25519SharedSecrets = aCounters[5];
+        mEd25519Signs = aCounters[6];
+        mEd25519Verifies = aCounters[7];
+        mMegolmRehashes = aCounters[8];
+        mChainKeyAdvances = aCounters[9];
+        System.arraycopy(aCounters, 10, mCalls, 0, OPERATION_COUNT);
+        System.arraycopy(aCounters, 10 + OPERATION_COUNT, mNanoseconds, 0, OPERATION_COUNT);
+    }
+}
@@ -71,6 +71,19 @@ public class OlmUtility {
     }
     private native void releaseUtilityJni();
 
+    /**
+     * Give back memory when the system is short of it, by wiping the signing keys
+     * kept decoded for {@link #verifyEd25519Signature(String, String, String)}.<br>
+     * To be called from {@link android.content.ComponentCallbacks2#onTrimMemory(int)},
+     * but not while the utility is in use on another thread.
+     */
+    public void trimMemory() {
+        if (0 != mNativeId) {
+            trimMemoryJni();
+        }
+    }
+    private native void trimMemoryJni();
+
     /**
      * Verify an ed25519 signature.<br>
      * An exception is thrown if the operation fails.
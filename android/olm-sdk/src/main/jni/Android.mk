@@ -27,21 +27,43 @@ $(info LOCAL_C_INCLUDES=$(LOCAL_C_INCLUDES))
 
 LOCAL_SRC_FILES := $(SRC_ROOT_DIR)/src/account.cpp \
 $(SRC_ROOT_DIR)/src/base64.cpp \
+$(SRC_ROOT_DIR)/src/canonical_json.cpp \
+$(SRC_ROOT_DIR)/src/base64_simd.c \
 $(SRC_ROOT_DIR)/src/cipher.cpp \
 $(SRC_ROOT_DIR)/src/crypto.cpp \
+$(SRC_ROOT_DIR)/src/executor.cpp \
+$(SRC_ROOT_DIR)/src/group_session_store.cpp \
 $(SRC_ROOT_DIR)/src/memory.cpp \
 $(SRC_ROOT_DIR)/src/message.cpp \
 $(SRC_ROOT_DIR)/src/olm.cpp \
 $(SRC_ROOT_DIR)/src/pickle.cpp \
 $(SRC_ROOT_DIR)/src/ratchet.cpp \
 $(SRC_ROOT_DIR)/src/session.cpp \
+$(SRC_ROOT_DIR)/src/session_index.cpp \
+$(SRC_ROOT_DIR)/src/ratchet_key_pool.cpp \
+$(SRC_ROOT_DIR)/src/journal.cpp \
 $(SRC_ROOT_DIR)/src/utility.cpp \
+$(SRC_ROOT_DIR)/src/aes_ct.c \
+$(SRC_ROOT_DIR)/src/aes_hw.c \
+$(SRC_ROOT_DIR)/src/attachment.c \
+$(SRC_ROOT_DIR)/src/cpu.c \
+$(SRC_ROOT_DIR)/src/dispatch.c \
+$(SRC_ROOT_DIR)/src/curve25519.c \
+$(SRC_ROOT_DIR)/src/ed25519_batch.c \
+$(SRC_ROOT_DIR)/src/sha256_hw.c \
+$(SRC_ROOT_DIR)/src/sha256_mb.c \
+$(SRC_ROOT_DIR)/src/sha512_hw.c \
 $(SRC_ROOT_DIR)/src/ed25519.c \
 $(SRC_ROOT_DIR)/src/error.c \
 $(SRC_ROOT_DIR)/src/inbound_group_session.c \
+$(SRC_ROOT_DIR)/src/iovec.c \
 $(SRC_ROOT_DIR)/src/megolm.c \
 $(SRC_ROOT_DIR)/src/outbound_group_session.c \
 $(SRC_ROOT_DIR)/src/pickle_encoding.c \
+$(SRC_ROOT_DIR)/src/pool.c \
+$(SRC_ROOT_DIR)/src/random.c \
+$(SRC_ROOT_DIR)/src/stats.c \
+$(SRC_ROOT_DIR)/src/trace.c \
 $(SRC_ROOT_DIR)/lib/crypto-algorithms/sha256.c \
 $(SRC_ROOT_DIR)/lib/crypto-algorithms/aes.c \
 $(SRC_ROOT_DIR)/lib/curve25519-donna/curve25519-donna.c \
@@ -53,7 +75,18 @@ olm_outbound_group_session.cpp \
 olm_utility.cpp \
 olm_manager.cpp
 
+# NEON is optional on armeabi-v7a: build the vector X25519 kernel with it
+# enabled, and let cpu.c check for it at run time before it is used
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_SRC_FILES += $(SRC_ROOT_DIR)/src/curve25519_mb.c.neon
+else
+LOCAL_SRC_FILES += $(SRC_ROOT_DIR)/src/curve25519_mb.c
+endif
+
 LOCAL_LDLIBS := -llog
+LOCAL_STATIC_LIBRARIES := cpufeatures
 
 include $(BUILD_SHARED_LIBRARY)
 
+$(call import-module,android/cpufeatures)
+
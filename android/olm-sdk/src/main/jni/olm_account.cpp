@@ -105,7 +105,7 @@ JNIEXPORT jlong OLM_ACCOUNT_FUNC_DEF(createNewAccountJni)(JNIEnv *env, jobject t
             olm_clear_account(accountPtr);
             free(accountPtr);
         }
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return (jlong)(intptr_t)accountPtr;
@@ -202,7 +202,7 @@ JNIEXPORT jbyteArray OLM_ACCOUNT_FUNC_DEF(identityKeysJni)(JNIEnv *env, jobject
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return byteArrayRetValue;
@@ -294,7 +294,7 @@ JNIEXPORT void OLM_ACCOUNT_FUNC_DEF(generateOneTimeKeysJni)(JNIEnv *env, jobject
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 }
 
@@ -359,7 +359,7 @@ JNIEXPORT jbyteArray OLM_ACCOUNT_FUNC_DEF(oneTimeKeysJni)(JNIEnv *env, jobject t
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return byteArrayRetValue;
@@ -403,7 +403,7 @@ JNIEXPORT void OLM_ACCOUNT_FUNC_DEF(removeOneTimeKeysJni)(JNIEnv *env, jobject t
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 }
 
@@ -438,7 +438,7 @@ JNIEXPORT void OLM_ACCOUNT_FUNC_DEF(markOneTimeKeysAsPublishedJni)(JNIEnv *env,
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 }
 
@@ -512,7 +512,7 @@ JNIEXPORT jbyteArray OLM_ACCOUNT_FUNC_DEF(signMessageJni)(JNIEnv *env, jobject t
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return signedMsgRetValueBuffer;
@@ -591,7 +591,7 @@ JNIEXPORT jbyteArray OLM_ACCOUNT_FUNC_DEF(serializeJni)(JNIEnv *env, jobject thi
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return pickledDataRetValue;
@@ -680,7 +680,7 @@ JNIEXPORT jlong OLM_ACCOUNT_FUNC_DEF(deserializeJni)(JNIEnv *env, jobject thiz,
             olm_clear_account(accountPtr);
             free(accountPtr);
         }
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return (jlong)(intptr_t)accountPtr;
@@ -36,16 +36,7 @@ JNIEXPORT void OLM_INBOUND_GROUP_SESSION_FUNC_DEF(releaseSessionJni)(JNIEnv *env
     else
     {
         LOGD(" ## releaseSessionJni(): sessionPtr=%p", sessionPtr);
-#ifdef ENABLE_JNI_LOG
-        size_t retCode = olm_clear_inbound_group_session(sessionPtr);
-        LOGD(" ## releaseSessionJni(): clear_inbound_group_session=%lu",static_cast<long unsigned int>(retCode));
-#else
-        olm_clear_inbound_group_session(sessionPtr);
-#endif
-
-        LOGD(" ## releaseSessionJni(): free IN");
-        free(sessionPtr);
-        LOGD(" ## releaseSessionJni(): free OUT");
+        olm_release_inbound_group_session(getInboundGroupSessionAllocator(), sessionPtr);
     }
 }
 
@@ -61,16 +52,10 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(createNewSessionJni)(JNIEnv *
     const char* errorMessage = NULL;
     OlmInboundGroupSession* sessionPtr = NULL;
     jbyte* sessionKeyPtr = NULL;
-    size_t sessionSize = olm_inbound_group_session_size();
 
     LOGD("## createNewSessionJni(): inbound group session IN");
 
-    if (!sessionSize)
-    {
-        LOGE(" ## createNewSessionJni(): failure - inbound group session size = 0");
-        errorMessage = "inbound group session size = 0";
-    }
-    else if (!(sessionPtr = (OlmInboundGroupSession*)malloc(sessionSize)))
+    if (!(sessionPtr = olm_allocate_inbound_group_session(getInboundGroupSessionAllocator())))
     {
         LOGE(" ## createNewSessionJni(): failure - inbound group session OOM");
         errorMessage = "inbound group session OOM";
@@ -87,8 +72,6 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(createNewSessionJni)(JNIEnv *
     }
     else
     {
-        sessionPtr = olm_inbound_group_session(sessionPtr);
-
         size_t sessionKeyLength = (size_t)env->GetArrayLength(aSessionKeyBuffer);
         LOGD(" ## createNewSessionJni(): sessionKeyLength=%lu", static_cast<long unsigned int>(sessionKeyLength));
 
@@ -112,7 +95,7 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(createNewSessionJni)(JNIEnv *
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     if (errorMessage)
@@ -120,11 +103,10 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(createNewSessionJni)(JNIEnv *
         // release the allocated session
         if (sessionPtr)
         {
-            olm_clear_inbound_group_session(sessionPtr);
-            free(sessionPtr);
+            olm_release_inbound_group_session(getInboundGroupSessionAllocator(), sessionPtr);
         }
 
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return (jlong)(intptr_t)sessionPtr;
@@ -184,7 +166,7 @@ JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(sessionIdentifierJni)(JN
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return returnValue;
@@ -243,9 +225,11 @@ JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessageJni)(JNIEn
     {
         // get encrypted message length
         size_t encryptedMsgLength = (size_t)env->GetArrayLength(aEncryptedMsgBuffer);
-        uint8_t *tempEncryptedPtr = static_cast<uint8_t*>(malloc(encryptedMsgLength*sizeof(uint8_t)));
+        // the temp copy used in next Olm API calls and the decrypted message share the
+        // thread's scratch buffer: the plaintext is never longer than the message
+        size_t scratchLength = 2*encryptedMsgLength*sizeof(uint8_t);
+        uint8_t *tempEncryptedPtr = getThreadScratchBuffer(scratchLength);
 
-        // create a dedicated temp buffer to be used in next Olm API calls
         if (!tempEncryptedPtr)
         {
             LOGE(" ## decryptMessageJni(): failure - tempEncryptedPtr allocation OOM");
@@ -257,13 +241,18 @@ JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessageJni)(JNIEn
             LOGD(" ## decryptMessageJni(): encryptedMsgLength=%lu encryptedMsg=%.*s",static_cast<long unsigned int>(encryptedMsgLength), static_cast<int>(encryptedMsgLength), encryptedMsgPtr);
 
             // get max plaintext length
-            size_t maxPlainTextLength = olm_group_decrypt_max_plaintext_length(sessionPtr,
-                                                                               tempEncryptedPtr,
-                                                                               encryptedMsgLength);
+            size_t maxPlainTextLength = olm_group_peek_max_plaintext_length(sessionPtr,
+                                                                            tempEncryptedPtr,
+                                                                            encryptedMsgLength);
             if (maxPlainTextLength == olm_error())
             {
                 errorMessage = olm_inbound_group_session_last_error(sessionPtr);
-                LOGE(" ## decryptMessageJni(): failure - olm_group_decrypt_max_plaintext_length Msg=%s", errorMessage);
+                LOGE(" ## decryptMessageJni(): failure - olm_group_peek_max_plaintext_length Msg=%s", errorMessage);
+            }
+            else if (maxPlainTextLength > encryptedMsgLength)
+            {
+                LOGE(" ## decryptMessageJni(): failure - maxPlaintextLength=%lu too long",static_cast<long unsigned int>(maxPlainTextLength));
+                errorMessage = "invalid max plaintext length";
             }
             else
             {
@@ -271,11 +260,10 @@ JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessageJni)(JNIEn
 
                 uint32_t messageIndex = 0;
 
-                // allocate output decrypted message
-                uint8_t *plainTextMsgPtr = static_cast<uint8_t*>(malloc(maxPlainTextLength*sizeof(uint8_t)));
+                // the output decrypted message follows the temp copy
+                uint8_t *plainTextMsgPtr = tempEncryptedPtr + encryptedMsgLength;
 
-                // decrypt, but before reload encrypted buffer (previous one was destroyed)
-                memcpy(tempEncryptedPtr, encryptedMsgPtr, encryptedMsgLength);
+                // decrypt
                 size_t plaintextLength = olm_group_decrypt(sessionPtr,
                                                            tempEncryptedPtr,
                                                            encryptedMsgLength,
@@ -297,33 +285,290 @@ JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessageJni)(JNIEn
 
                     LOGD(" ## decryptMessageJni(): UTF-8 Conversion - decrypted returnedLg=%lu OK",static_cast<long unsigned int>(plaintextLength));
                 }
+            }
+
+            wipeThreadScratchBuffer();
+        }
+    }
+
+    // free alloc
+    if (encryptedMsgPtr)
+    {
+        env->ReleaseByteArrayElements(aEncryptedMsgBuffer, encryptedMsgPtr, JNI_ABORT);
+    }
+
+    if (errorMessage)
+    {
+        env->ThrowNew(getExceptionClass(env), errorMessage);
+    }
+
+    return decryptedMsgBuffer;
+}
+
+/**
+ * Get the maximum length of the plain text an encrypted message in a direct ByteBuffer could decrypt to.
+ * The message isn't changed.<br>
+ * An exception is thrown if the operation fails.
+ * @param aEncryptedMsg direct buffer holding the encrypted message
+ * @param aEncryptedMsgOffset start of the encrypted message in aEncryptedMsg
+ * @param aEncryptedMsgLength length of the encrypted message
+ * @return the maximum plain text length
+ */
+JNIEXPORT jint OLM_INBOUND_GROUP_SESSION_FUNC_DEF(maxPlaintextLengthDirectJni)(JNIEnv *env, jobject thiz, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength)
+{
+    jint maxPlainTextLengthRet = 0;
+    const char* errorMessage = NULL;
+
+    OlmInboundGroupSession *sessionPtr = getInboundGroupSessionInstanceId(env, thiz);
+    uint8_t *encryptedMsgPtr = NULL;
+
+    if (!sessionPtr)
+    {
+        LOGE(" ## maxPlaintextLengthDirectJni(): failure - invalid inbound group session ptr=NULL");
+        errorMessage = "invalid inbound group session ptr=NULL";
+    }
+    else if (!(encryptedMsgPtr = getDirectBufferRange(env, aEncryptedMsg, aEncryptedMsgOffset, aEncryptedMsgLength)))
+    {
+        LOGE(" ## maxPlaintextLengthDirectJni(): failure - invalid encrypted message buffer");
+        errorMessage = "invalid encrypted message buffer";
+    }
+    else
+    {
+        size_t maxPlainTextLength = olm_group_peek_max_plaintext_length(sessionPtr,
+                                                                        encryptedMsgPtr,
+                                                                        (size_t)aEncryptedMsgLength);
+        if (maxPlainTextLength == olm_error())
+        {
+            errorMessage = olm_inbound_group_session_last_error(sessionPtr);
+            LOGE(" ## maxPlaintextLengthDirectJni(): failure - Msg=%s", errorMessage);
+        }
+        else
+        {
+            maxPlainTextLengthRet = (jint)maxPlainTextLength;
+        }
+    }
+
+    if (errorMessage)
+    {
+        env->ThrowNew(getExceptionClass(env), errorMessage);
+    }
+
+    return maxPlainTextLengthRet;
+}
+
+/**
+ * Decrypt a message in a direct ByteBuffer into another one, without copying either.
+ * The encrypted message is destroyed.<br>
+ * An exception is thrown if the operation fails.
+ * @param aEncryptedMsg direct buffer holding the encrypted message
+ * @param aEncryptedMsgOffset start of the encrypted message in aEncryptedMsg
+ * @param aEncryptedMsgLength length of the encrypted message
+ * @param aPlainTextMsg direct buffer to write the plain text into
+ * @param aPlainTextMsgOffset where to write the plain text in aPlainTextMsg
+ * @param aPlainTextMsgLength room for the plain text
+ * @return the message index in the upper 32 bits and the plain text length in the lower 32 bits
+ */
+JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessageDirectJni)(JNIEnv *env, jobject thiz, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength, jobject aPlainTextMsg, jint aPlainTextMsgOffset, jint aPlainTextMsgLength)
+{
+    jlong resultRet = 0;
+    const char* errorMessage = NULL;
+
+    OlmInboundGroupSession *sessionPtr = getInboundGroupSessionInstanceId(env, thiz);
+    uint8_t *encryptedMsgPtr = NULL;
+    uint8_t *plainTextMsgPtr = NULL;
+
+    LOGD("## decryptMessageDirectJni(): inbound group session IN");
+
+    if (!sessionPtr)
+    {
+        LOGE(" ## decryptMessageDirectJni(): failure - invalid inbound group session ptr=NULL");
+        errorMessage = "invalid inbound group session ptr=NULL";
+    }
+    else if (!(encryptedMsgPtr = getDirectBufferRange(env, aEncryptedMsg, aEncryptedMsgOffset, aEncryptedMsgLength)))
+    {
+        LOGE(" ## decryptMessageDirectJni(): failure - invalid encrypted message buffer");
+        errorMessage = "invalid encrypted message buffer";
+    }
+    else if (!(plainTextMsgPtr = getDirectBufferRange(env, aPlainTextMsg, aPlainTextMsgOffset, aPlainTextMsgLength)))
+    {
+        LOGE(" ## decryptMessageDirectJni(): failure - invalid plain text buffer");
+        errorMessage = "invalid plain text buffer";
+    }
+    else
+    {
+        uint32_t messageIndex = 0;
+        size_t plaintextLength = olm_group_decrypt(sessionPtr,
+                                                   encryptedMsgPtr,
+                                                   (size_t)aEncryptedMsgLength,
+                                                   plainTextMsgPtr,
+                                                   (size_t)aPlainTextMsgLength,
+                                                   &messageIndex);
+        if (plaintextLength == olm_error())
+        {
+            errorMessage = olm_inbound_group_session_last_error(sessionPtr);
+            LOGE(" ## decryptMessageDirectJni(): failure - olm_group_decrypt Msg=%s", errorMessage);
+        }
+        else
+        {
+            resultRet = ((jlong)messageIndex << 32) | (jlong)plaintextLength;
+            LOGD(" ## decryptMessageDirectJni(): success - plaintextLength=%lu", static_cast<long unsigned int>(plaintextLength));
+        }
+    }
 
-                if (plainTextMsgPtr)
+    if (errorMessage)
+    {
+        env->ThrowNew(getExceptionClass(env), errorMessage);
+    }
+
+    return resultRet;
+}
+
+/**
+ * Decrypt several messages in one go, with olm_group_decrypt_batch().<br>
+ * The messages are copied into one native buffer, which also holds the plain texts,
+ * so the whole batch costs one allocation and one JNI transition.
+ * An exception is thrown only if the batch couldn't be decrypted at all.
+ * @param aEncryptedMsgs the encrypted messages
+ * @param [out] aIndexes the message index of each message
+ * @param [out] aErrors the error message for each message which couldn't be decrypted, NULL for the others
+ * @return the decrypted messages, NULL for those which couldn't be decrypted
+ */
+JNIEXPORT jobjectArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessagesJni)(JNIEnv *env, jobject thiz, jobjectArray aEncryptedMsgs, jlongArray aIndexes, jobjectArray aErrors)
+{
+    jobjectArray decryptedMsgsRet = 0;
+    const char* errorMessage = NULL;
+
+    OlmInboundGroupSession *sessionPtr = getInboundGroupSessionInstanceId(env, thiz);
+    jclass byteArrayJClass = 0;
+    size_t count = 0;
+    uint8_t *scratchPtr = NULL;
+
+    LOGD("## decryptMessagesJni(): inbound group session IN");
+
+    if (!sessionPtr)
+    {
+        LOGE(" ## decryptMessagesJni(): failure - invalid inbound group session ptr=NULL");
+        errorMessage = "invalid inbound group session ptr=NULL";
+    }
+    else if (!aEncryptedMsgs || !aIndexes || !aErrors)
+    {
+        LOGE(" ## decryptMessagesJni(): failure - invalid parameters");
+        errorMessage = "invalid parameters";
+    }
+    else if ((count = (size_t)env->GetArrayLength(aEncryptedMsgs)) != (size_t)env->GetArrayLength(aIndexes)
+             || count != (size_t)env->GetArrayLength(aErrors))
+    {
+        LOGE(" ## decryptMessagesJni(): failure - array lengths differ");
+        errorMessage = "array lengths differ";
+    }
+    else if (!(byteArrayJClass = env->FindClass("[B")))
+    {
+        LOGE(" ## decryptMessagesJni(): failure - unable to get byte array class");
+        errorMessage = "unable to get byte array class";
+    }
+    else
+    {
+        // the plain texts are shorter than the base64 messages, so each
+        // gets as much room as its message
+        size_t totalLength = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            jbyteArray msg = (jbyteArray)env->GetObjectArrayElement(aEncryptedMsgs, i);
+            if (msg)
+            {
+                totalLength += (size_t)env->GetArrayLength(msg);
+                env->DeleteLocalRef(msg);
+            }
+        }
+
+        size_t scratchLength = count * (2 * sizeof(uint8_t *) + 3 * sizeof(size_t) + sizeof(const char *) + sizeof(uint32_t))
+                               + 2 * totalLength;
+
+        if (!(scratchPtr = getThreadScratchBuffer(scratchLength)))
+        {
+            LOGE(" ## decryptMessagesJni(): failure - scratch buffer allocation OOM");
+            errorMessage = "scratch buffer allocation OOM";
+        }
+        else if (!(decryptedMsgsRet = env->NewObjectArray(count, byteArrayJClass, NULL)))
+        {
+            LOGE(" ## decryptMessagesJni(): failure - result array allocation OOM");
+            errorMessage = "result array allocation OOM";
+        }
+        else
+        {
+            uint8_t **messages = reinterpret_cast<uint8_t **>(scratchPtr);
+            uint8_t **plaintexts = messages + count;
+            size_t *messageLengths = reinterpret_cast<size_t *>(plaintexts + count);
+            size_t *maxPlaintextLengths = messageLengths + count;
+            size_t *plaintextLengths = maxPlaintextLengths + count;
+            const char **errors = reinterpret_cast<const char **>(plaintextLengths + count);
+            uint32_t *messageIndexes = reinterpret_cast<uint32_t *>(errors + count);
+            uint8_t *messagePos = reinterpret_cast<uint8_t *>(messageIndexes + count);
+            uint8_t *plaintextPos = messagePos + totalLength;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                jbyteArray msg = (jbyteArray)env->GetObjectArrayElement(aEncryptedMsgs, i);
+                size_t msgLength = msg ? (size_t)env->GetArrayLength(msg) : 0;
+
+                if (msg)
                 {
-                    memset(plainTextMsgPtr, 0, maxPlainTextLength*sizeof(uint8_t));
-                    free(plainTextMsgPtr);
+                    env->GetByteArrayRegion(msg, 0, msgLength, (jbyte*)messagePos);
+                    env->DeleteLocalRef(msg);
                 }
+
+                messages[i] = messagePos;
+                messageLengths[i] = msgLength;
+                plaintexts[i] = plaintextPos;
+                maxPlaintextLengths[i] = msgLength;
+                messageIndexes[i] = 0;
+                messagePos += msgLength;
+                plaintextPos += msgLength;
             }
 
-            if (tempEncryptedPtr)
+            size_t failures = olm_group_decrypt_batch(sessionPtr, count,
+                                                      messages, messageLengths,
+                                                      plaintexts, maxPlaintextLengths,
+                                                      plaintextLengths, messageIndexes,
+                                                      errors);
+            LOGD(" ## decryptMessagesJni(): count=%lu failures=%lu", static_cast<long unsigned int>(count), static_cast<long unsigned int>(failures));
+
+            for (size_t i = 0; i < count; i++)
             {
-                free(tempEncryptedPtr);
+                jlong index = (jlong)messageIndexes[i];
+                env->SetLongArrayRegion(aIndexes, i, 1, &index);
+
+                if (plaintextLengths[i] == olm_error())
+                {
+                    jstring error = env->NewStringUTF(errors[i]);
+                    env->SetObjectArrayElement(aErrors, i, error);
+                    env->DeleteLocalRef(error);
+                }
+                else
+                {
+                    jbyteArray decryptedMsg = env->NewByteArray(plaintextLengths[i]);
+                    env->SetByteArrayRegion(decryptedMsg, 0, plaintextLengths[i], (jbyte*)plaintexts[i]);
+                    env->SetObjectArrayElement(decryptedMsgsRet, i, decryptedMsg);
+                    env->DeleteLocalRef(decryptedMsg);
+                }
             }
+
+            // wipe the plain texts
+            memset(plaintextPos - totalLength, 0, totalLength);
         }
     }
 
-    // free alloc
-    if (encryptedMsgPtr)
+    if (scratchPtr)
     {
-        env->ReleaseByteArrayElements(aEncryptedMsgBuffer, encryptedMsgPtr, JNI_ABORT);
+        wipeThreadScratchBuffer();
     }
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
-    return decryptedMsgBuffer;
+    return decryptedMsgsRet;
 }
 
 
@@ -403,7 +648,7 @@ JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(serializeJni)(JNIEnv *en
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return pickledDataRet;
@@ -421,18 +666,12 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(deserializeJni)(JNIEnv *env,
     const char* errorMessage = NULL;
 
     OlmInboundGroupSession* sessionPtr = NULL;
-    size_t sessionSize = olm_inbound_group_session_size();
     jbyte* keyPtr = NULL;
     jbyte* pickledPtr = NULL;
 
     LOGD("## deserializeJni(): IN");
 
-    if (!sessionSize)
-    {
-        LOGE(" ## deserializeJni(): failure - inbound group session size = 0");
-        errorMessage = "inbound group session size = 0";
-    }
-    else if (!(sessionPtr = (OlmInboundGroupSession*)malloc(sessionSize)))
+    if (!(sessionPtr = olm_allocate_inbound_group_session(getInboundGroupSessionAllocator())))
     {
         LOGE(" ## deserializeJni(): failure - session failure OOM");
         errorMessage = "session failure OOM";
@@ -459,8 +698,6 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(deserializeJni)(JNIEnv *env,
     }
     else
     {
-        sessionPtr = olm_inbound_group_session(sessionPtr);
-
         size_t pickledLength = (size_t)env->GetArrayLength(aSerializedDataBuffer);
         size_t keyLength = (size_t)env->GetArrayLength(aKeyBuffer);
         LOGD(" ## deserializeJni(): pickledLength=%lu keyLength=%lu",static_cast<long unsigned int>(pickledLength), static_cast<long unsigned int>(keyLength));
@@ -497,11 +734,60 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(deserializeJni)(JNIEnv *env,
     {
         if (sessionPtr)
         {
-            olm_clear_inbound_group_session(sessionPtr);
-            free(sessionPtr);
+            olm_release_inbound_group_session(getInboundGroupSessionAllocator(), sessionPtr);
         }
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return (jlong)(intptr_t)sessionPtr;
 }
+
+namespace {
+
+/**
+ * Get the first message index the session can decrypt.<br>
+ * This is registered as the @CriticalNative firstKnownIndexJni() from
+ * API 26, so it is called without a JNIEnv or class.
+ * @param aNativeId the native session, or 0 if it has been released
+ * @return the first known index, or 0 if the session has been released
+ */
+jlong firstKnownIndexCriticalJni(jlong aNativeId)
+{
+    OlmInboundGroupSession *sessionPtr = (OlmInboundGroupSession*)(intptr_t)aNativeId;
+
+    if (!sessionPtr)
+    {
+        LOGE(" ## firstKnownIndexJni(): failure - invalid inbound group session instance");
+        return 0;
+    }
+
+    return static_cast<jlong>(olm_inbound_group_session_first_known_index(sessionPtr));
+}
+
+/**
+ * firstKnownIndexJni() for the API levels which ignore @CriticalNative.
+ */
+jlong firstKnownIndexJni(JNIEnv *env, jclass clazz, jlong aNativeId)
+{
+    return firstKnownIndexCriticalJni(aNativeId);
+}
+
+} // namespace
+
+/**
+ * Register the natives of OlmInboundGroupSession which are annotated
+ * @FastNative or @CriticalNative.
+ * @param aClass OlmInboundGroupSession
+ * @param aCriticalNatives true if the runtime calls @CriticalNative methods without a JNIEnv or class
+ * @return true if the natives were registered
+ */
+bool registerInboundGroupSessionNatives(JNIEnv *env, jclass aClass, bool aCriticalNatives)
+{
+    const JNINativeMethod methods[] =
+    {
+        {"sessionIdentifierJni", "()[B", reinterpret_cast<void*>(Java_org_matrix_olm_OlmInboundGroupSession_sessionIdentifierJni)},
+        {"firstKnownIndexJni", "(J)J", aCriticalNatives ? reinterpret_cast<void*>(firstKnownIndexCriticalJni) : reinterpret_cast<void*>(firstKnownIndexJni)}
+    };
+
+    return env->RegisterNatives(aClass, methods, sizeof(methods) / sizeof(methods[0])) == JNI_OK;
+}
@@ -34,6 +34,9 @@ JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(createNewSessionJni)(JNIEnv *
 
 JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(sessionIdentifierJni)(JNIEnv *env, jobject thiz);
 JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessageJni)(JNIEnv *env, jobject thiz, jbyteArray aEncryptedMsg, jobject aDecryptIndex);
+JNIEXPORT jint OLM_INBOUND_GROUP_SESSION_FUNC_DEF(maxPlaintextLengthDirectJni)(JNIEnv *env, jobject thiz, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength);
+JNIEXPORT jlong OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessageDirectJni)(JNIEnv *env, jobject thiz, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength, jobject aPlainTextMsg, jint aPlainTextMsgOffset, jint aPlainTextMsgLength);
+JNIEXPORT jobjectArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(decryptMessagesJni)(JNIEnv *env, jobject thiz, jobjectArray aEncryptedMsgs, jlongArray aIndexes, jobjectArray aErrors);
 
 // serialization
 JNIEXPORT jbyteArray OLM_INBOUND_GROUP_SESSION_FUNC_DEF(serializeJni)(JNIEnv *env, jobject thiz, jbyteArray aKey);
@@ -63,6 +63,12 @@ extern "C" {
 
 // internal helper functions
 bool setRandomInBuffer(JNIEnv *env, uint8_t **aBuffer2Ptr, size_t aRandomSize);
+uint8_t* getDirectBufferRange(JNIEnv* aJniEnv, jobject aBuffer, jint aOffset, jint aLength);
+jclass getExceptionClass(JNIEnv* aJniEnv);
+uint8_t* getThreadScratchBuffer(size_t aLength);
+void wipeThreadScratchBuffer();
+const struct OlmAllocator* getSessionAllocator();
+const struct OlmAllocator* getInboundGroupSessionAllocator();
 
 struct OlmSession* getSessionInstanceId(JNIEnv* aJniEnv, jobject aJavaObject);
 struct OlmAccount* getAccountInstanceId(JNIEnv* aJniEnv, jobject aJavaObject);
@@ -70,6 +76,11 @@ struct OlmInboundGroupSession* getInboundGroupSessionInstanceId(JNIEnv* aJniEnv,
 struct OlmOutboundGroupSession* getOutboundGroupSessionInstanceId(JNIEnv* aJniEnv, jobject aJavaObject);
 struct OlmUtility* getUtilityInstanceId(JNIEnv* aJniEnv, jobject aJavaObject);
 
+// registration of the natives annotated @FastNative or @CriticalNative, from JNI_OnLoad()
+bool registerSessionNatives(JNIEnv* aJniEnv, jclass aClass);
+bool registerInboundGroupSessionNatives(JNIEnv* aJniEnv, jclass aClass, bool aCriticalNatives);
+bool registerOutboundGroupSessionNatives(JNIEnv* aJniEnv, jclass aClass, bool aCriticalNatives);
+
 #ifdef __cplusplus
 }
 #endif
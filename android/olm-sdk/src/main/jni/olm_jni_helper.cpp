@@ -17,10 +17,217 @@
 
 #include "olm_jni_helper.h"
 #include "olm/olm.h"
+#include <sys/system_properties.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 using namespace AndroidOlmSdk;
 
+namespace {
+
+// the classes whose instances hold a native pointer in mNativeId
+enum InstanceClass
+{
+    INSTANCE_ACCOUNT = 0,
+    INSTANCE_SESSION,
+    INSTANCE_INBOUND_GROUP_SESSION,
+    INSTANCE_OUTBOUND_GROUP_SESSION,
+    INSTANCE_UTILITY,
+    INSTANCE_CLASS_COUNT
+};
+
+const char *instanceClassNames[INSTANCE_CLASS_COUNT] =
+{
+    CLASS_OLM_ACCOUNT,
+    CLASS_OLM_SESSION,
+    CLASS_OLM_INBOUND_GROUP_SESSION,
+    CLASS_OLM_OUTBOUND_GROUP_SESSION,
+    CLASS_OLM_UTILITY
+};
+
+// looked up once in JNI_OnLoad(); the helpers fall back to looking them up
+// on each call if they are missing
+jclass instanceClasses[INSTANCE_CLASS_COUNT];
+jfieldID nativeIdFields[INSTANCE_CLASS_COUNT];
+jclass exceptionClass;
+jobject secureRandom;
+jmethodID secureRandomNextBytes;
+
+// the scratch arena of each thread, kept between calls so that the
+// encrypt and decrypt paths don't allocate for each message
+struct ScratchBuffer
+{
+    OlmArena *arena;
+    uint8_t *memory;
+    size_t capacity;
+};
+
+pthread_key_t scratchKey;
+pthread_once_t scratchKeyOnce = PTHREAD_ONCE_INIT;
+
+void releaseScratchBuffer(void *aScratch)
+{
+    ScratchBuffer *scratch = static_cast<ScratchBuffer*>(aScratch);
+
+    if (scratch->arena)
+    {
+        olm_arena_reset(scratch->arena);
+    }
+
+    free(scratch->memory);
+    free(scratch);
+}
+
+// the sessions and inbound group sessions are taken from chains of slabs of
+// this many slots, another slab being mapped when the others are full
+const size_t SLAB_SLOTS = 64;
+
+struct SlabChain
+{
+    explicit SlabChain(size_t aSlotSize)
+        : slotSize(aSlotSize), slabs(NULL), count(0)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        allocator.allocate = allocate;
+        allocator.release = release;
+        allocator.context = this;
+    }
+
+    static void* allocate(void *aContext, size_t aLength);
+    static void release(void *aContext, void *aMemory, size_t aLength);
+
+    pthread_mutex_t mutex;
+    size_t slotSize;
+    OlmSlab **slabs;
+    size_t count;
+    OlmAllocator allocator;
+};
+
+void* SlabChain::allocate(void *aContext, size_t aLength)
+{
+    SlabChain *chain = static_cast<SlabChain*>(aContext);
+    void *slot = NULL;
+
+    if (aLength > chain->slotSize)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&chain->mutex);
+
+    for (size_t i = 0; i < chain->count && !slot; ++i)
+    {
+        if (olm_slab_slots_in_use(chain->slabs[i]) < SLAB_SLOTS)
+        {
+            slot = olm_slab_allocate(chain->slabs[i]);
+        }
+    }
+
+    if (!slot)
+    {
+        OlmSlab **slabs = static_cast<OlmSlab**>(realloc(chain->slabs, (chain->count + 1) * sizeof(OlmSlab*)));
+
+        if (!slabs)
+        {
+            LOGE("## SlabChain::allocate(): failure - alloc mem OOM");
+        }
+        else
+        {
+            chain->slabs = slabs;
+
+            if (!(slabs[chain->count] = olm_slab_map(chain->slotSize, SLAB_SLOTS, 0)))
+            {
+                LOGE("## SlabChain::allocate(): failure - slab map failed");
+            }
+            else
+            {
+                slot = olm_slab_allocate(slabs[chain->count++]);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&chain->mutex);
+
+    return slot;
+}
+
+void SlabChain::release(void *aContext, void *aMemory, size_t /*aLength*/)
+{
+    SlabChain *chain = static_cast<SlabChain*>(aContext);
+
+    pthread_mutex_lock(&chain->mutex);
+
+    for (size_t i = 0; i < chain->count; ++i)
+    {
+        if (olm_slab_release(chain->slabs[i], aMemory) != (size_t)-1)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&chain->mutex);
+}
+
+void createScratchKey()
+{
+    pthread_key_create(&scratchKey, releaseScratchBuffer);
+}
+
+jclass findGlobalClass(JNIEnv *env, const char *aClassName)
+{
+    jclass globalClass = 0;
+    jclass localClass = env->FindClass(aClassName);
+
+    if (!localClass)
+    {
+        LOGE("## findGlobalClass(): failure - class %s not found", aClassName);
+        env->ExceptionClear();
+    }
+    else
+    {
+        globalClass = (jclass)env->NewGlobalRef(localClass);
+        env->DeleteLocalRef(localClass);
+    }
+
+    return globalClass;
+}
+
+/**
+* Get the API level of the device.
+* @return the API level, or 0 if it isn't known
+**/
+int getDeviceApiLevel()
+{
+    char value[PROP_VALUE_MAX];
+
+    if (__system_property_get("ro.build.version.sdk", value) <= 0)
+    {
+        return 0;
+    }
+
+    return atoi(value);
+}
+
+/**
+* Register the natives annotated @FastNative or @CriticalNative. From API 26 the runtime calls
+* @CriticalNative methods without a JNIEnv or class, so they are registered with functions
+* which don't take them; until API 31 such methods can't be looked up by name at all.
+* @return true if every class's natives were registered
+**/
+bool registerNatives(JNIEnv *env)
+{
+    bool criticalNatives = getDeviceApiLevel() >= 26;
+    jclass sessionClass = instanceClasses[INSTANCE_SESSION];
+    jclass inboundClass = instanceClasses[INSTANCE_INBOUND_GROUP_SESSION];
+    jclass outboundClass = instanceClasses[INSTANCE_OUTBOUND_GROUP_SESSION];
+
+    return sessionClass && registerSessionNatives(env, sessionClass)
+        && inboundClass && registerInboundGroupSessionNatives(env, inboundClass, criticalNatives)
+        && outboundClass && registerOutboundGroupSessionNatives(env, outboundClass, criticalNatives);
+}
+
+} // namespace
+
 /**
 * Init a buffer with a given number of random values.
 * @param aBuffer2Ptr the buffer to be initialized
@@ -48,10 +255,37 @@ bool setRandomInBuffer(JNIEnv *env, uint8_t **aBuffer2Ptr, size_t aRandomSize)
     {
         LOGD("## setRandomInBuffer(): randomSize=%lu",static_cast<long unsigned int>(aRandomSize));
 
-        // use the secureRandom class
-        jclass cls = env->FindClass("java/security/SecureRandom");
+        jclass cls = 0;
 
-        if (cls)
+        if (secureRandom)
+        {
+            // use the instance created in JNI_OnLoad()
+            jbyteArray tempByteArray = env->NewByteArray(bufferLen);
+
+            if (tempByteArray)
+            {
+                env->CallVoidMethod(secureRandom, secureRandomNextBytes, tempByteArray);
+
+                if (!env->ExceptionOccurred())
+                {
+                    env->GetByteArrayRegion(tempByteArray, 0, bufferLen, (jbyte*)*aBuffer2Ptr);
+                    retCode = true;
+
+                    // clear tempByteArray to hide sensitive data.
+                    jbyte* buffer = env->GetByteArrayElements(tempByteArray, NULL);
+
+                    if (buffer)
+                    {
+                        memset(buffer, 0, bufferLen);
+                        env->ReleaseByteArrayElements(tempByteArray, buffer, 0);
+                    }
+                }
+
+                env->DeleteLocalRef(tempByteArray);
+            }
+        }
+        // use the secureRandom class
+        else if ((cls = env->FindClass("java/security/SecureRandom")))
         {
             jobject newObj = 0;
             jmethodID constructor = env->GetMethodID(cls, "<init>", "()V");
@@ -111,16 +345,28 @@ bool setRandomInBuffer(JNIEnv *env, uint8_t **aBuffer2Ptr, size_t aRandomSize)
 * Read the instance ID of the calling object.
 * @param aJniEnv pointer pointing on the JNI function table
 * @param aJavaObject reference to the object on which the method is invoked
-* @param aCallingClass java calling class name
+* @param aCallingClass java calling class
 * @return the related instance ID
 **/
-jlong getInstanceId(JNIEnv* aJniEnv, jobject aJavaObject, const char *aCallingClass)
+static jlong getInstanceId(JNIEnv* aJniEnv, jobject aJavaObject, InstanceClass aCallingClass)
 {
     jlong instanceId = 0;
 
-    if (aJniEnv)
+    if (aJniEnv && instanceClasses[aCallingClass] && nativeIdFields[aCallingClass])
+    {
+        // use the class and field looked up in JNI_OnLoad()
+        if (JNI_TRUE != aJniEnv->IsInstanceOf(aJavaObject, instanceClasses[aCallingClass]))
+        {
+            LOGE("## getInstanceId() failure - invalid instance of");
+        }
+        else
+        {
+            instanceId = aJniEnv->GetLongField(aJavaObject, nativeIdFields[aCallingClass]);
+        }
+    }
+    else if (aJniEnv)
     {
-        jclass requiredClass = aJniEnv->FindClass(aCallingClass);
+        jclass requiredClass = aJniEnv->FindClass(instanceClassNames[aCallingClass]);
         jclass loaderClass = 0;
 
         if (requiredClass && (JNI_TRUE != aJniEnv->IsInstanceOf(aJavaObject, requiredClass)))
@@ -166,7 +412,7 @@ jlong getInstanceId(JNIEnv* aJniEnv, jobject aJavaObject, const char *aCallingCl
 **/
 struct OlmAccount* getAccountInstanceId(JNIEnv* aJniEnv, jobject aJavaObject)
 {
-    return (struct OlmAccount*)getInstanceId(aJniEnv, aJavaObject, CLASS_OLM_ACCOUNT);
+    return (struct OlmAccount*)getInstanceId(aJniEnv, aJavaObject, INSTANCE_ACCOUNT);
 }
 
 /**
@@ -177,7 +423,7 @@ struct OlmAccount* getAccountInstanceId(JNIEnv* aJniEnv, jobject aJavaObject)
 **/
 struct OlmSession* getSessionInstanceId(JNIEnv* aJniEnv, jobject aJavaObject)
 {
-    return (struct OlmSession*)getInstanceId(aJniEnv, aJavaObject, CLASS_OLM_SESSION);
+    return (struct OlmSession*)getInstanceId(aJniEnv, aJavaObject, INSTANCE_SESSION);
 }
 
 /**
@@ -188,7 +434,7 @@ struct OlmSession* getSessionInstanceId(JNIEnv* aJniEnv, jobject aJavaObject)
 **/
 struct OlmInboundGroupSession* getInboundGroupSessionInstanceId(JNIEnv* aJniEnv, jobject aJavaObject)
 {
-    return (struct OlmInboundGroupSession*)getInstanceId(aJniEnv, aJavaObject, CLASS_OLM_INBOUND_GROUP_SESSION);
+    return (struct OlmInboundGroupSession*)getInstanceId(aJniEnv, aJavaObject, INSTANCE_INBOUND_GROUP_SESSION);
 }
 
 /**
@@ -199,7 +445,7 @@ struct OlmInboundGroupSession* getInboundGroupSessionInstanceId(JNIEnv* aJniEnv,
 **/
 struct OlmOutboundGroupSession* getOutboundGroupSessionInstanceId(JNIEnv* aJniEnv, jobject aJavaObject)
 {
-    return (struct OlmOutboundGroupSession*)getInstanceId(aJniEnv, aJavaObject, CLASS_OLM_OUTBOUND_GROUP_SESSION);
+    return (struct OlmOutboundGroupSession*)getInstanceId(aJniEnv, aJavaObject, INSTANCE_OUTBOUND_GROUP_SESSION);
 }
 
 /**
@@ -210,5 +456,207 @@ struct OlmOutboundGroupSession* getOutboundGroupSessionInstanceId(JNIEnv* aJniEn
 **/
 struct OlmUtility* getUtilityInstanceId(JNIEnv* aJniEnv, jobject aJavaObject)
 {
-    return (struct OlmUtility*)getInstanceId(aJniEnv, aJavaObject, CLASS_OLM_UTILITY);
+    return (struct OlmUtility*)getInstanceId(aJniEnv, aJavaObject, INSTANCE_UTILITY);
+}
+
+/**
+* Get the address of a range of a direct ByteBuffer, without copying it.<br>
+* @param aJniEnv pointer pointing on the JNI function table
+* @param aBuffer the direct ByteBuffer
+* @param aOffset the start of the range in the buffer
+* @param aLength the length of the range
+* @return the address of the range, or NULL if the buffer isn't a direct buffer or the range isn't inside it
+**/
+uint8_t* getDirectBufferRange(JNIEnv* aJniEnv, jobject aBuffer, jint aOffset, jint aLength)
+{
+    uint8_t *bufferPtr = NULL;
+    jlong capacity;
+
+    if (!aBuffer)
+    {
+        LOGE("## getDirectBufferRange(): failure - buffer=NULL");
+    }
+    else if (!(bufferPtr = (uint8_t*)aJniEnv->GetDirectBufferAddress(aBuffer)))
+    {
+        LOGE("## getDirectBufferRange(): failure - not a direct buffer");
+    }
+    else if ((aOffset < 0) || (aLength < 0)
+             || ((capacity = aJniEnv->GetDirectBufferCapacity(aBuffer)) < (jlong)aOffset + aLength))
+    {
+        LOGE("## getDirectBufferRange(): failure - invalid range offset=%d length=%d", aOffset, aLength);
+        bufferPtr = NULL;
+    }
+    else
+    {
+        bufferPtr += aOffset;
+    }
+
+    return bufferPtr;
+}
+
+//==============================================================================================================
+// Cached JNI references and per-thread scratch space
+//==============================================================================================================
+
+
+/**
+* Cache the classes, field IDs and objects the helpers use on every call, and register the
+* natives which can't be looked up by name.
+**/
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* aVm, void* aReserved)
+{
+    JNIEnv *env = NULL;
+
+    if (aVm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK)
+    {
+        LOGE("## JNI_OnLoad(): failure - GetEnv");
+        return JNI_ERR;
+    }
+
+    for (int i = 0; i < INSTANCE_CLASS_COUNT; i++)
+    {
+        if ((instanceClasses[i] = findGlobalClass(env, instanceClassNames[i])))
+        {
+            if (!(nativeIdFields[i] = env->GetFieldID(instanceClasses[i], "mNativeId", "J")))
+            {
+                env->ExceptionClear();
+            }
+        }
+    }
+
+    if (!registerNatives(env))
+    {
+        LOGE("## JNI_OnLoad(): failure - unable to register natives");
+        env->ExceptionClear();
+        return JNI_ERR;
+    }
+
+    exceptionClass = findGlobalClass(env, "java/lang/Exception");
+
+    jclass secureRandomClass = env->FindClass("java/security/SecureRandom");
+    if (!secureRandomClass)
+    {
+        env->ExceptionClear();
+    }
+    else
+    {
+        jmethodID constructor = env->GetMethodID(secureRandomClass, "<init>", "()V");
+        secureRandomNextBytes = env->GetMethodID(secureRandomClass, "nextBytes", "([B)V");
+
+        if (constructor && secureRandomNextBytes)
+        {
+            jobject localSecureRandom = env->NewObject(secureRandomClass, constructor);
+
+            if (localSecureRandom)
+            {
+                secureRandom = env->NewGlobalRef(localSecureRandom);
+                env->DeleteLocalRef(localSecureRandom);
+            }
+        }
+
+        if (!secureRandom)
+        {
+            LOGE("## JNI_OnLoad(): failure - unable to create a SecureRandom");
+            env->ExceptionClear();
+        }
+
+        env->DeleteLocalRef(secureRandomClass);
+    }
+
+    pthread_once(&scratchKeyOnce, createScratchKey);
+
+    return JNI_VERSION_1_6;
+}
+
+/**
+* Get the class of the exceptions thrown to Java.
+* @param aJniEnv pointer pointing on the JNI function table
+* @return java.lang.Exception
+**/
+jclass getExceptionClass(JNIEnv* aJniEnv)
+{
+    return exceptionClass ? exceptionClass : aJniEnv->FindClass("java/lang/Exception");
+}
+
+/**
+* Get scratch space for the calling thread, which stays valid until the thread's next call.
+* The space is taken from an arena kept for the next call and grown to the largest size asked
+* for. Whatever the previous call took is wiped first; callers should also wipe what they used
+* with wipeThreadScratchBuffer() once they are done with it.
+* @param aLength the number of bytes needed
+* @return the scratch space, or NULL if it couldn't be allocated
+**/
+uint8_t* getThreadScratchBuffer(size_t aLength)
+{
+    pthread_once(&scratchKeyOnce, createScratchKey);
+
+    ScratchBuffer *scratch = static_cast<ScratchBuffer*>(pthread_getspecific(scratchKey));
+
+    if (!scratch)
+    {
+        if (!(scratch = static_cast<ScratchBuffer*>(calloc(1, sizeof(ScratchBuffer)))))
+        {
+            LOGE("## getThreadScratchBuffer(): failure - alloc mem OOM");
+            return NULL;
+        }
+        pthread_setspecific(scratchKey, scratch);
+    }
+
+    if (scratch->arena)
+    {
+        olm_arena_reset(scratch->arena);
+    }
+
+    if (!scratch->arena || scratch->capacity < aLength)
+    {
+        uint8_t *memory = static_cast<uint8_t*>(malloc(olm_arena_size(aLength)));
+
+        if (!memory)
+        {
+            LOGE("## getThreadScratchBuffer(): failure - alloc mem OOM");
+            return NULL;
+        }
+
+        // the old arena was wiped by the reset above
+        free(scratch->memory);
+        scratch->memory = memory;
+        scratch->arena = olm_arena(memory, aLength);
+        scratch->capacity = aLength;
+    }
+
+    return static_cast<uint8_t*>(olm_arena_allocate(scratch->arena, aLength));
+}
+
+/**
+* Wipe the calling thread's scratch space.
+**/
+void wipeThreadScratchBuffer()
+{
+    ScratchBuffer *scratch = static_cast<ScratchBuffer*>(pthread_getspecific(scratchKey));
+
+    if (scratch && scratch->arena)
+    {
+        olm_arena_reset(scratch->arena);
+    }
+}
+
+/**
+* Get the allocator of the sessions, which takes them from slabs.
+* @return the allocator to give to olm_allocate_session() and olm_release_session()
+**/
+const OlmAllocator* getSessionAllocator()
+{
+    static SlabChain chain(olm_session_size());
+    return &chain.allocator;
+}
+
+/**
+* Get the allocator of the inbound group sessions, which takes them from slabs.
+* @return the allocator to give to olm_allocate_inbound_group_session() and
+* olm_release_inbound_group_session()
+**/
+const OlmAllocator* getInboundGroupSessionAllocator()
+{
+    static SlabChain chain(olm_inbound_group_session_size());
+    return &chain.allocator;
 }
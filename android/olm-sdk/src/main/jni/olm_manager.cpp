@@ -32,4 +32,36 @@ JNIEXPORT jstring OLM_MANAGER_FUNC_DEF(getOlmLibVersionJni)(JNIEnv* env, jobject
     returnValueStr = env->NewStringUTF((const char*)buff);
 
     return returnValueStr;
-}
\ No newline at end of file
+}
+
+JNIEXPORT jboolean OLM_MANAGER_FUNC_DEF(isStatsEnabledJni)(JNIEnv* env, jobject thiz)
+{
+    return olm_stats_enabled() ? JNI_TRUE : JNI_FALSE;
+}
+
+/**
+ * Copy the calling thread's counters into aCounters, in the order OlmStats is laid out in.
+ * @param [out] aCounters the counters, OlmStats.COUNTER_COUNT of them
+ */
+JNIEXPORT void OLM_MANAGER_FUNC_DEF(getStatsJni)(JNIEnv* env, jobject thiz, jlongArray aCounters)
+{
+    OlmStats stats;
+    const size_t count = sizeof(stats) / sizeof(uint64_t);
+
+    if (!aCounters || (size_t)env->GetArrayLength(aCounters) < count)
+    {
+        LOGE("## getStatsJni(): failure - invalid parameters");
+        return;
+    }
+
+    olm_stats_get(&stats);
+
+    jlong counters[count];
+    memcpy(counters, &stats, sizeof(stats));
+    env->SetLongArrayRegion(aCounters, 0, count, counters);
+}
+
+JNIEXPORT void OLM_MANAGER_FUNC_DEF(resetStatsJni)(JNIEnv* env, jobject thiz)
+{
+    olm_stats_reset();
+}
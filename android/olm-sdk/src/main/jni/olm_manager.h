@@ -20,6 +20,7 @@
 
 #include "olm_jni.h"
 #include "olm/olm.h"
+#include "olm/stats.h"
 
 #define OLM_MANAGER_FUNC_DEF(func_name) FUNC_DEF(OlmManager,func_name)
 
@@ -28,6 +29,9 @@ extern "C" {
 #endif
 
 JNIEXPORT jstring OLM_MANAGER_FUNC_DEF(getOlmLibVersionJni)(JNIEnv *env, jobject thiz);
+JNIEXPORT jboolean OLM_MANAGER_FUNC_DEF(isStatsEnabledJni)(JNIEnv *env, jobject thiz);
+JNIEXPORT void OLM_MANAGER_FUNC_DEF(getStatsJni)(JNIEnv *env, jobject thiz, jlongArray aCounters);
+JNIEXPORT void OLM_MANAGER_FUNC_DEF(resetStatsJni)(JNIEnv *env, jobject thiz);
 
 #ifdef __cplusplus
 }
@@ -125,7 +125,7 @@ JNIEXPORT jlong OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(createNewSessionJni)(JNIEnv
             free(sessionPtr);
         }
 
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return (jlong)(intptr_t)sessionPtr;
@@ -186,41 +186,13 @@ JNIEXPORT jbyteArray OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(sessionIdentifierJni)(J
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return returnValue;
 }
 
 
-/**
- * Get the current message index for this session.<br>
- * Each message is sent with an increasing index, this
- * method returns the index for the next message.
- * An exception is thrown if the operation fails.
- * @return current session index
- */
-JNIEXPORT jint OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(messageIndexJni)(JNIEnv *env, jobject thiz)
-{
-    OlmOutboundGroupSession *sessionPtr = NULL;
-    jint indexRetValue = 0;
-
-    LOGD("## messageIndexJni(): IN");
-
-    if (!(sessionPtr = (OlmOutboundGroupSession*)getOutboundGroupSessionInstanceId(env,thiz)))
-    {
-        LOGE(" ## messageIndexJni(): failure - invalid outbound group session instance");
-    }
-    else
-    {
-        indexRetValue = static_cast<jint>(olm_outbound_group_session_message_index(sessionPtr));
-    }
-
-    LOGD(" ## messageIndexJni(): success - index=%d",indexRetValue);
-
-    return indexRetValue;
-}
-
 /**
  * Return the session key.
  * An exception is thrown if the operation fails.
@@ -276,7 +248,7 @@ JNIEXPORT jbyteArray OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(sessionKeyJni)(JNIEnv *
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return returnValue;
@@ -321,7 +293,7 @@ JNIEXPORT jbyteArray OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(encryptMessageJni)(JNIE
 
         // compute max encrypted length
         size_t encryptedMsgLength = olm_group_encrypt_message_length(sessionPtr,clearMsgLength);
-        uint8_t *encryptedMsgPtr = (uint8_t*)malloc(encryptedMsgLength*sizeof(uint8_t));
+        uint8_t *encryptedMsgPtr = getThreadScratchBuffer(encryptedMsgLength*sizeof(uint8_t));
 
         if (!encryptedMsgPtr)
         {
@@ -352,7 +324,7 @@ JNIEXPORT jbyteArray OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(encryptMessageJni)(JNIE
                 env->SetByteArrayRegion(encryptedMsgRet, 0 , encryptedLength, (jbyte*)encryptedMsgPtr);
             }
 
-            free(encryptedMsgPtr);
+            wipeThreadScratchBuffer();
          }
     }
 
@@ -364,7 +336,7 @@ JNIEXPORT jbyteArray OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(encryptMessageJni)(JNIE
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return encryptedMsgRet;
@@ -446,7 +418,7 @@ JNIEXPORT jbyteArray OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(serializeJni)(JNIEnv *e
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return returnValue;
@@ -542,9 +514,60 @@ JNIEXPORT jlong OLM_OUTBOUND_GROUP_SESSION_FUNC_DEF(deserializeJni)(JNIEnv *env,
             olm_clear_outbound_group_session(sessionPtr);
             free(sessionPtr);
         }
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return (jlong)(intptr_t)sessionPtr;
 }
 
+namespace {
+
+/**
+ * Get the current message index for a session.<br>
+ * Each message is sent with an increasing index, this
+ * method returns the index for the next message.
+ * This is registered as the @CriticalNative messageIndexJni() from API 26,
+ * so it is called without a JNIEnv or class.
+ * @param aNativeId the native session, or 0 if it has been released
+ * @return current session index, or 0 if the session has been released
+ */
+jint messageIndexCriticalJni(jlong aNativeId)
+{
+    OlmOutboundGroupSession *sessionPtr = (OlmOutboundGroupSession*)(intptr_t)aNativeId;
+
+    if (!sessionPtr)
+    {
+        LOGE(" ## messageIndexJni(): failure - invalid outbound group session instance");
+        return 0;
+    }
+
+    return static_cast<jint>(olm_outbound_group_session_message_index(sessionPtr));
+}
+
+/**
+ * messageIndexJni() for the API levels which ignore @CriticalNative.
+ */
+jint messageIndexJni(JNIEnv *env, jclass clazz, jlong aNativeId)
+{
+    return messageIndexCriticalJni(aNativeId);
+}
+
+} // namespace
+
+/**
+ * Register the natives of OlmOutboundGroupSession which are annotated
+ * @FastNative or @CriticalNative.
+ * @param aClass OlmOutboundGroupSession
+ * @param aCriticalNatives true if the runtime calls @CriticalNative methods without a JNIEnv or class
+ * @return true if the natives were registered
+ */
+bool registerOutboundGroupSessionNatives(JNIEnv *env, jclass aClass, bool aCriticalNatives)
+{
+    const JNINativeMethod methods[] =
+    {
+        {"sessionIdentifierJni", "()[B", reinterpret_cast<void*>(Java_org_matrix_olm_OlmOutboundGroupSession_sessionIdentifierJni)},
+        {"messageIndexJni", "(J)I", aCriticalNatives ? reinterpret_cast<void*>(messageIndexCriticalJni) : reinterpret_cast<void*>(messageIndexJni)}
+    };
+
+    return env->RegisterNatives(aClass, methods, sizeof(methods) / sizeof(methods[0])) == JNI_OK;
+}
@@ -21,19 +21,17 @@ using namespace AndroidOlmSdk;
 
 /**
 * Init memory allocation for a session creation.<br>
+* The session is taken from the slabs of getSessionAllocator().
 * Make sure releaseSessionJni() is called when one is done with the session instance.
 * @return valid memory allocation, NULL otherwise
 **/
 OlmSession* initializeSessionMemory()
 {
-    size_t sessionSize = olm_session_size();
-    OlmSession* sessionPtr = (OlmSession*)malloc(sessionSize);
+    OlmSession* sessionPtr = olm_allocate_session(getSessionAllocator());
 
     if (sessionPtr)
     {
-        // init session object
-        sessionPtr = olm_session(sessionPtr);
-        LOGD("## initializeSessionMemory(): success - OLM session size=%lu",static_cast<long unsigned int>(sessionSize));
+        LOGD("## initializeSessionMemory(): success - OLM session size=%lu",static_cast<long unsigned int>(olm_session_size()));
     }
     else
     {
@@ -51,7 +49,7 @@ JNIEXPORT jlong OLM_SESSION_FUNC_DEF(createNewSessionJni)(JNIEnv *env, jobject t
     if (!accountPtr)
     {
         LOGE("## initNewAccount(): failure - init session OOM");
-        env->ThrowNew(env->FindClass("java/lang/Exception"), "init session OOM");
+        env->ThrowNew(getExceptionClass(env), "init session OOM");
     }
     else
     {
@@ -72,10 +70,7 @@ JNIEXPORT void OLM_SESSION_FUNC_DEF(releaseSessionJni)(JNIEnv *env, jobject thiz
     }
     else
     {
-        olm_clear_session(sessionPtr);
-
-        // even if free(NULL) does not crash, logs are performed for debug purpose
-        free(sessionPtr);
+        olm_release_session(getSessionAllocator(), sessionPtr);
     }
 }
 
@@ -183,7 +178,7 @@ JNIEXPORT void OLM_SESSION_FUNC_DEF(initOutboundSessionJni)(JNIEnv *env, jobject
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 }
 
@@ -253,7 +248,7 @@ JNIEXPORT void OLM_SESSION_FUNC_DEF(initInboundSessionJni)(JNIEnv *env, jobject
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 }
 
@@ -337,7 +332,7 @@ JNIEXPORT void OLM_SESSION_FUNC_DEF(initInboundSessionFromIdKeyJni)(JNIEnv *env,
 
      if (errorMessage)
      {
-         env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+         env->ThrowNew(getExceptionClass(env), errorMessage);
      }
 }
 
@@ -530,7 +525,7 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(encryptMessageJni)(JNIEnv *env, jobjec
             size_t clearMsgLength = (size_t)env->GetArrayLength(aClearMsgBuffer);
             size_t encryptedMsgLength = olm_encrypt_message_length(sessionPtr, clearMsgLength);
 
-            void *encryptedMsgPtr = malloc(encryptedMsgLength*sizeof(uint8_t));
+            void *encryptedMsgPtr = getThreadScratchBuffer(encryptedMsgLength*sizeof(uint8_t));
 
             if (!encryptedMsgPtr)
             {
@@ -569,7 +564,7 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(encryptMessageJni)(JNIEnv *env, jobjec
                     LOGD("## encryptMessageJni(): success - result=%lu Type=%lu encryptedMsg=%.*s", static_cast<long unsigned int>(result), static_cast<unsigned long int>(messageType), static_cast<int>(result), (const char*)encryptedMsgPtr);
                 }
 
-                free(encryptedMsgPtr);
+                wipeThreadScratchBuffer();
             }
 
             memset(randomBuffPtr, 0, randomLength);
@@ -585,7 +580,7 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(encryptMessageJni)(JNIEnv *env, jobjec
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return encryptedMsgRet;
@@ -611,8 +606,8 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(decryptMessageJni)(JNIEnv *env, jobjec
     // ptrs
     OlmSession *sessionPtr = getSessionInstanceId(env, thiz);
     const char *encryptedMsgPtr = NULL; // <= obtained from encryptedMsgJstring
-    uint8_t *plainTextMsgPtr = NULL;
     char *tempEncryptedPtr = NULL;
+    size_t scratchLength = 0;
 
     LOGD("## decryptMessageJni(): IN - OlmSession");
 
@@ -658,49 +653,62 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(decryptMessageJni)(JNIEnv *env, jobjec
         // get encrypted message length
         size_t encryptedMsgLength = (size_t)env->GetStringUTFLength(encryptedMsgJstring);
 
-        // create a dedicated temp buffer to be used in next Olm API calls
-        tempEncryptedPtr = static_cast<char*>(malloc(encryptedMsgLength*sizeof(uint8_t)));
-        memcpy(tempEncryptedPtr, encryptedMsgPtr, encryptedMsgLength);
-        LOGD("## decryptMessageJni(): MsgType=%lu encryptedMsgLength=%lu encryptedMsg=%.*s",static_cast<long unsigned int>(encryptedMsgType),static_cast<long unsigned int>(encryptedMsgLength), static_cast<int>(encryptedMsgLength), encryptedMsgPtr);
+        // the temp copy used in next Olm API calls and the decrypted message share the
+        // thread's scratch buffer: the plaintext is never longer than the message
+        scratchLength = 2*encryptedMsgLength*sizeof(uint8_t);
 
-        // get max plaintext length
-        size_t maxPlainTextLength = olm_decrypt_max_plaintext_length(sessionPtr,
-                                                                     static_cast<size_t>(encryptedMsgType),
-                                                                     static_cast<void*>(tempEncryptedPtr),
-                                                                     encryptedMsgLength);
-        // Note: tempEncryptedPtr is destroyed by olm_decrypt_max_plaintext_length()
-
-        if (maxPlainTextLength == olm_error())
+        if (!(tempEncryptedPtr = reinterpret_cast<char*>(getThreadScratchBuffer(scratchLength))))
         {
-            errorMessage = (const char *)olm_session_last_error(sessionPtr);
-            LOGE("## decryptMessageJni(): failure - olm_decrypt_max_plaintext_length Msg=%s", errorMessage);
+            LOGE("## decryptMessageJni(): failure - scratch buffer OOM");
+            errorMessage = "scratch buffer OOM";
         }
         else
         {
-            LOGD("## decryptMessageJni(): maxPlaintextLength=%lu",static_cast<long unsigned int>(maxPlainTextLength));
+            memcpy(tempEncryptedPtr, encryptedMsgPtr, encryptedMsgLength);
+            LOGD("## decryptMessageJni(): MsgType=%lu encryptedMsgLength=%lu encryptedMsg=%.*s",static_cast<long unsigned int>(encryptedMsgType),static_cast<long unsigned int>(encryptedMsgLength), static_cast<int>(encryptedMsgLength), encryptedMsgPtr);
 
-            // allocate output decrypted message
-            plainTextMsgPtr = static_cast<uint8_t*>(malloc(maxPlainTextLength*sizeof(uint8_t)));
+            // get max plaintext length
+            size_t maxPlainTextLength = olm_peek_max_plaintext_length(sessionPtr,
+                                                                      static_cast<size_t>(encryptedMsgType),
+                                                                      static_cast<void*>(tempEncryptedPtr),
+                                                                      encryptedMsgLength);
 
-            // decrypt, but before reload encrypted buffer (previous one was destroyed)
-            memcpy(tempEncryptedPtr, encryptedMsgPtr, encryptedMsgLength);
-            size_t plaintextLength = olm_decrypt(sessionPtr,
-                                                 encryptedMsgType,
-                                                 (void*)tempEncryptedPtr,
-                                                 encryptedMsgLength,
-                                                 plainTextMsgPtr,
-                                                 maxPlainTextLength);
-            if (plaintextLength == olm_error())
+            if (maxPlainTextLength == olm_error())
             {
                 errorMessage = (const char *)olm_session_last_error(sessionPtr);
-                LOGE("## decryptMessageJni(): failure - olm_decrypt Msg=%s", errorMessage);
+                LOGE("## decryptMessageJni(): failure - olm_peek_max_plaintext_length Msg=%s", errorMessage);
+            }
+            else if (maxPlainTextLength > encryptedMsgLength)
+            {
+                LOGE("## decryptMessageJni(): failure - maxPlaintextLength=%lu too long",static_cast<long unsigned int>(maxPlainTextLength));
+                errorMessage = "invalid max plaintext length";
             }
             else
             {
-                decryptedMsgRet = env->NewByteArray(plaintextLength);
-                env->SetByteArrayRegion(decryptedMsgRet, 0 , plaintextLength, (jbyte*)plainTextMsgPtr);
+                LOGD("## decryptMessageJni(): maxPlaintextLength=%lu",static_cast<long unsigned int>(maxPlainTextLength));
+
+                // the output decrypted message follows the temp copy
+                uint8_t *plainTextMsgPtr = reinterpret_cast<uint8_t*>(tempEncryptedPtr) + encryptedMsgLength;
+
+                // decrypt
+                size_t plaintextLength = olm_decrypt(sessionPtr,
+                                                     encryptedMsgType,
+                                                     (void*)tempEncryptedPtr,
+                                                     encryptedMsgLength,
+                                                     plainTextMsgPtr,
+                                                     maxPlainTextLength);
+                if (plaintextLength == olm_error())
+                {
+                    errorMessage = (const char *)olm_session_last_error(sessionPtr);
+                    LOGE("## decryptMessageJni(): failure - olm_decrypt Msg=%s", errorMessage);
+                }
+                else
+                {
+                    decryptedMsgRet = env->NewByteArray(plaintextLength);
+                    env->SetByteArrayRegion(decryptedMsgRet, 0 , plaintextLength, (jbyte*)plainTextMsgPtr);
 
-                LOGD(" ## decryptMessageJni(): UTF-8 Conversion - decrypted returnedLg=%lu OK",static_cast<long unsigned int>(plaintextLength));
+                    LOGD(" ## decryptMessageJni(): UTF-8 Conversion - decrypted returnedLg=%lu OK",static_cast<long unsigned int>(plaintextLength));
+                }
             }
         }
     }
@@ -713,20 +721,419 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(decryptMessageJni)(JNIEnv *env, jobjec
 
     if (tempEncryptedPtr)
     {
-        free(tempEncryptedPtr);
+        wipeThreadScratchBuffer();
+    }
+
+    if (errorMessage)
+    {
+        env->ThrowNew(getExceptionClass(env), errorMessage);
+    }
+
+    return decryptedMsgRet;
+}
+
+/**
+ * Get the type of the next message the session will encrypt.
+ * @return the message type: PRE KEY or normal
+ */
+JNIEXPORT jlong OLM_SESSION_FUNC_DEF(encryptMessageTypeJni)(JNIEnv *env, jobject thiz)
+{
+    jlong messageType = 0;
+    OlmSession *sessionPtr = getSessionInstanceId(env, thiz);
+
+    if (!sessionPtr)
+    {
+        LOGE("## encryptMessageTypeJni(): failure - invalid Session ptr=NULL");
+        env->ThrowNew(getExceptionClass(env), "invalid Session ptr=NULL");
+    }
+    else
+    {
+        messageType = (jlong)olm_encrypt_message_type(sessionPtr);
+    }
+
+    return messageType;
+}
+
+/**
+ * Get the length of the next message the session will encrypt.
+ * @param aClearMsgLength the length of the clear text message
+ * @return the length of the encrypted message
+ */
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(encryptMessageLengthJni)(JNIEnv *env, jobject thiz, jint aClearMsgLength)
+{
+    jint encryptedMsgLength = 0;
+    OlmSession *sessionPtr = getSessionInstanceId(env, thiz);
+
+    if (!sessionPtr)
+    {
+        LOGE("## encryptMessageLengthJni(): failure - invalid Session ptr=NULL");
+        env->ThrowNew(getExceptionClass(env), "invalid Session ptr=NULL");
     }
+    else
+    {
+        encryptedMsgLength = (jint)olm_encrypt_message_length(sessionPtr, (size_t)aClearMsgLength);
+    }
+
+    return encryptedMsgLength;
+}
+
+/**
+ * Encrypt a message from a direct ByteBuffer into another one, without copying either.<br>
+ * An exception is thrown if the operation fails.
+ * @param aClearMsg direct buffer holding the clear text message
+ * @param aClearMsgOffset start of the clear text message in aClearMsg
+ * @param aClearMsgLength length of the clear text message
+ * @param aEncryptedMsg direct buffer to write the encrypted message into
+ * @param aEncryptedMsgOffset where to write the encrypted message in aEncryptedMsg
+ * @param aEncryptedMsgLength room for the encrypted message
+ * @return the length of the encrypted message
+ */
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(encryptMessageDirectJni)(JNIEnv *env, jobject thiz, jobject aClearMsg, jint aClearMsgOffset, jint aClearMsgLength, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength)
+{
+    jint encryptedMsgRet = 0;
+    const char* errorMessage = NULL;
 
-    if (plainTextMsgPtr)
+    OlmSession *sessionPtr = getSessionInstanceId(env, thiz);
+    uint8_t *clearMsgPtr = NULL;
+    uint8_t *encryptedMsgPtr = NULL;
+
+    LOGD("## encryptMessageDirectJni(): IN ");
+
+    if (!sessionPtr)
+    {
+        LOGE("## encryptMessageDirectJni(): failure - invalid Session ptr=NULL");
+        errorMessage = "invalid Session ptr=NULL";
+    }
+    else if (!(clearMsgPtr = getDirectBufferRange(env, aClearMsg, aClearMsgOffset, aClearMsgLength)))
     {
-        free(plainTextMsgPtr);
+        LOGE("## encryptMessageDirectJni(): failure - invalid clear message buffer");
+        errorMessage = "invalid clear message buffer";
+    }
+    else if (!(encryptedMsgPtr = getDirectBufferRange(env, aEncryptedMsg, aEncryptedMsgOffset, aEncryptedMsgLength)))
+    {
+        LOGE("## encryptMessageDirectJni(): failure - invalid encrypted message buffer");
+        errorMessage = "invalid encrypted message buffer";
+    }
+    else
+    {
+        uint8_t *randomBuffPtr = NULL;
+        size_t randomLength = olm_encrypt_random_length(sessionPtr);
+
+        if ((0 != randomLength) && !setRandomInBuffer(env, &randomBuffPtr, randomLength))
+        {
+            LOGE("## encryptMessageDirectJni(): failure - random buffer init");
+            errorMessage = "random buffer init";
+        }
+        else
+        {
+            // olm_encrypt() checks that the message fits
+            size_t result = olm_encrypt(sessionPtr,
+                                        clearMsgPtr,
+                                        (size_t)aClearMsgLength,
+                                        randomBuffPtr,
+                                        randomLength,
+                                        encryptedMsgPtr,
+                                        (size_t)aEncryptedMsgLength);
+            if (result == olm_error())
+            {
+                errorMessage = (const char *)olm_session_last_error(sessionPtr);
+                LOGE("## encryptMessageDirectJni(): failure - Msg=%s", errorMessage);
+            }
+            else
+            {
+                encryptedMsgRet = (jint)result;
+                LOGD("## encryptMessageDirectJni(): success - result=%lu", static_cast<long unsigned int>(result));
+            }
+
+            if (randomBuffPtr)
+            {
+                memset(randomBuffPtr, 0, randomLength);
+                free(randomBuffPtr);
+            }
+        }
     }
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
-    return decryptedMsgRet;
+    return encryptedMsgRet;
+}
+
+/**
+ * Get the maximum length of the plain text an encrypted message in a direct ByteBuffer could decrypt to.
+ * The message isn't changed.<br>
+ * An exception is thrown if the operation fails.
+ * @param aMsgType the message type
+ * @param aEncryptedMsg direct buffer holding the encrypted message
+ * @param aEncryptedMsgOffset start of the encrypted message in aEncryptedMsg
+ * @param aEncryptedMsgLength length of the encrypted message
+ * @return the maximum plain text length
+ */
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(maxPlaintextLengthDirectJni)(JNIEnv *env, jobject thiz, jlong aMsgType, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength)
+{
+    jint maxPlainTextLengthRet = 0;
+    const char* errorMessage = NULL;
+
+    OlmSession *sessionPtr = getSessionInstanceId(env, thiz);
+    uint8_t *encryptedMsgPtr = NULL;
+
+    if (!sessionPtr)
+    {
+        LOGE("## maxPlaintextLengthDirectJni(): failure - invalid Session ptr=NULL");
+        errorMessage = "invalid Session ptr=NULL";
+    }
+    else if (!(encryptedMsgPtr = getDirectBufferRange(env, aEncryptedMsg, aEncryptedMsgOffset, aEncryptedMsgLength)))
+    {
+        LOGE("## maxPlaintextLengthDirectJni(): failure - invalid encrypted message buffer");
+        errorMessage = "invalid encrypted message buffer";
+    }
+    else
+    {
+        size_t maxPlainTextLength = olm_peek_max_plaintext_length(sessionPtr,
+                                                                  (size_t)aMsgType,
+                                                                  encryptedMsgPtr,
+                                                                  (size_t)aEncryptedMsgLength);
+        if (maxPlainTextLength == olm_error())
+        {
+            errorMessage = (const char *)olm_session_last_error(sessionPtr);
+            LOGE("## maxPlaintextLengthDirectJni(): failure - Msg=%s", errorMessage);
+        }
+        else
+        {
+            maxPlainTextLengthRet = (jint)maxPlainTextLength;
+        }
+    }
+
+    if (errorMessage)
+    {
+        env->ThrowNew(getExceptionClass(env), errorMessage);
+    }
+
+    return maxPlainTextLengthRet;
+}
+
+/**
+ * Decrypt a message in a direct ByteBuffer into another one, without copying either.
+ * The encrypted message is destroyed.<br>
+ * An exception is thrown if the operation fails.
+ * @param aMsgType the message type
+ * @param aEncryptedMsg direct buffer holding the encrypted message
+ * @param aEncryptedMsgOffset start of the encrypted message in aEncryptedMsg
+ * @param aEncryptedMsgLength length of the encrypted message
+ * @param aPlainTextMsg direct buffer to write the plain text into
+ * @param aPlainTextMsgOffset where to write the plain text in aPlainTextMsg
+ * @param aPlainTextMsgLength room for the plain text
+ * @return the length of the plain text
+ */
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(decryptMessageDirectJni)(JNIEnv *env, jobject thiz, jlong aMsgType, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength, jobject aPlainTextMsg, jint aPlainTextMsgOffset, jint aPlainTextMsgLength)
+{
+    jint plainTextLengthRet = 0;
+    const char* errorMessage = NULL;
+
+    OlmSession *sessionPtr = getSessionInstanceId(env, thiz);
+    uint8_t *encryptedMsgPtr = NULL;
+    uint8_t *plainTextMsgPtr = NULL;
+
+    LOGD("## decryptMessageDirectJni(): IN - OlmSession");
+
+    if (!sessionPtr)
+    {
+        LOGE("## decryptMessageDirectJni(): failure - invalid Session ptr=NULL");
+        errorMessage = "invalid Session ptr=NULL";
+    }
+    else if (!(encryptedMsgPtr = getDirectBufferRange(env, aEncryptedMsg, aEncryptedMsgOffset, aEncryptedMsgLength)))
+    {
+        LOGE("## decryptMessageDirectJni(): failure - invalid encrypted message buffer");
+        errorMessage = "invalid encrypted message buffer";
+    }
+    else if (!(plainTextMsgPtr = getDirectBufferRange(env, aPlainTextMsg, aPlainTextMsgOffset, aPlainTextMsgLength)))
+    {
+        LOGE("## decryptMessageDirectJni(): failure - invalid plain text buffer");
+        errorMessage = "invalid plain text buffer";
+    }
+    else
+    {
+        size_t plaintextLength = olm_decrypt(sessionPtr,
+                                             (size_t)aMsgType,
+                                             encryptedMsgPtr,
+                                             (size_t)aEncryptedMsgLength,
+                                             plainTextMsgPtr,
+                                             (size_t)aPlainTextMsgLength);
+        if (plaintextLength == olm_error())
+        {
+            errorMessage = (const char *)olm_session_last_error(sessionPtr);
+            LOGE("## decryptMessageDirectJni(): failure - olm_decrypt Msg=%s", errorMessage);
+        }
+        else
+        {
+            plainTextLengthRet = (jint)plaintextLength;
+            LOGD("## decryptMessageDirectJni(): success - plaintextLength=%lu", static_cast<long unsigned int>(plaintextLength));
+        }
+    }
+
+    if (errorMessage)
+    {
+        env->ThrowNew(getExceptionClass(env), errorMessage);
+    }
+
+    return plainTextLengthRet;
+}
+
+/**
+ * Decrypt several messages in one go, with olm_decrypt_batch(), in the order they are given.<br>
+ * The messages are copied into one native buffer, which also holds the plain texts,
+ * so the whole batch costs one allocation and one JNI transition.
+ * An exception is thrown only if the batch couldn't be decrypted at all.
+ * @param aMsgTypes the type of each message
+ * @param aEncryptedMsgs the encrypted messages
+ * @param [out] aErrors the error message for each message which couldn't be decrypted, NULL for the others
+ * @return the decrypted messages, NULL for those which couldn't be decrypted
+ */
+JNIEXPORT jobjectArray OLM_SESSION_FUNC_DEF(decryptMessagesJni)(JNIEnv *env, jobject thiz, jlongArray aMsgTypes, jobjectArray aEncryptedMsgs, jobjectArray aErrors)
+{
+    jobjectArray decryptedMsgsRet = 0;
+    const char* errorMessage = NULL;
+
+    OlmSession *sessionPtr = getSessionInstanceId(env, thiz);
+    jclass byteArrayJClass = 0;
+    size_t count = 0;
+    uint8_t *scratchPtr = NULL;
+
+    LOGD("## decryptMessagesJni(): IN - OlmSession");
+
+    if (!sessionPtr)
+    {
+        LOGE("## decryptMessagesJni(): failure - invalid Session ptr=NULL");
+        errorMessage = "invalid Session ptr=NULL";
+    }
+    else if (!aMsgTypes || !aEncryptedMsgs || !aErrors)
+    {
+        LOGE("## decryptMessagesJni(): failure - invalid parameters");
+        errorMessage = "invalid parameters";
+    }
+    else if ((count = (size_t)env->GetArrayLength(aEncryptedMsgs)) != (size_t)env->GetArrayLength(aMsgTypes)
+             || count != (size_t)env->GetArrayLength(aErrors))
+    {
+        LOGE("## decryptMessagesJni(): failure - array lengths differ");
+        errorMessage = "array lengths differ";
+    }
+    else if (!(byteArrayJClass = env->FindClass("[B")))
+    {
+        LOGE("## decryptMessagesJni(): failure - unable to get byte array class");
+        errorMessage = "unable to get byte array class";
+    }
+    else
+    {
+        // the plain texts are shorter than the base64 messages, so each
+        // gets as much room as its message
+        size_t totalLength = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            jbyteArray msg = (jbyteArray)env->GetObjectArrayElement(aEncryptedMsgs, i);
+            if (msg)
+            {
+                totalLength += (size_t)env->GetArrayLength(msg);
+                env->DeleteLocalRef(msg);
+            }
+        }
+
+        size_t batchScratchLength = olm_decrypt_batch_scratch_length(count);
+        size_t scratchLength = count * (sizeof(OlmSession *) + 3 * sizeof(void *) + 4 * sizeof(size_t))
+                               + batchScratchLength * sizeof(size_t)
+                               + 2 * totalLength;
+
+        if (!(scratchPtr = getThreadScratchBuffer(scratchLength)))
+        {
+            LOGE("## decryptMessagesJni(): failure - scratch buffer allocation OOM");
+            errorMessage = "scratch buffer allocation OOM";
+        }
+        else if (!(decryptedMsgsRet = env->NewObjectArray(count, byteArrayJClass, NULL)))
+        {
+            LOGE("## decryptMessagesJni(): failure - result array allocation OOM");
+            errorMessage = "result array allocation OOM";
+        }
+        else
+        {
+            OlmSession **sessions = reinterpret_cast<OlmSession **>(scratchPtr);
+            void **messages = reinterpret_cast<void **>(sessions + count);
+            void **plaintexts = messages + count;
+            const char **errors = reinterpret_cast<const char **>(plaintexts + count);
+            size_t *msgTypes = reinterpret_cast<size_t *>(errors + count);
+            size_t *messageLengths = msgTypes + count;
+            size_t *maxPlaintextLengths = messageLengths + count;
+            size_t *plaintextLengths = maxPlaintextLengths + count;
+            size_t *batchScratch = plaintextLengths + count;
+            uint8_t *messagePos = reinterpret_cast<uint8_t *>(batchScratch + batchScratchLength);
+            uint8_t *plaintextPos = messagePos + totalLength;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                jbyteArray msg = (jbyteArray)env->GetObjectArrayElement(aEncryptedMsgs, i);
+                size_t msgLength = msg ? (size_t)env->GetArrayLength(msg) : 0;
+                jlong msgType = 0;
+
+                if (msg)
+                {
+                    env->GetByteArrayRegion(msg, 0, msgLength, (jbyte*)messagePos);
+                    env->DeleteLocalRef(msg);
+                }
+                env->GetLongArrayRegion(aMsgTypes, i, 1, &msgType);
+
+                sessions[i] = sessionPtr;
+                msgTypes[i] = (size_t)msgType;
+                messages[i] = messagePos;
+                messageLengths[i] = msgLength;
+                plaintexts[i] = plaintextPos;
+                maxPlaintextLengths[i] = msgLength;
+                messagePos += msgLength;
+                plaintextPos += msgLength;
+            }
+
+            // all the messages are for this session, so they make one job,
+            // run on this thread
+            size_t failures = olm_decrypt_batch(sessions, count, msgTypes,
+                                                messages, messageLengths,
+                                                plaintexts, maxPlaintextLengths,
+                                                plaintextLengths, errors,
+                                                batchScratch, batchScratchLength,
+                                                NULL, NULL);
+            LOGD("## decryptMessagesJni(): count=%lu failures=%lu", static_cast<long unsigned int>(count), static_cast<long unsigned int>(failures));
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (plaintextLengths[i] == olm_error())
+                {
+                    jstring error = env->NewStringUTF(errors[i]);
+                    env->SetObjectArrayElement(aErrors, i, error);
+                    env->DeleteLocalRef(error);
+                }
+                else
+                {
+                    jbyteArray decryptedMsg = env->NewByteArray(plaintextLengths[i]);
+                    env->SetByteArrayRegion(decryptedMsg, 0, plaintextLengths[i], (jbyte*)plaintexts[i]);
+                    env->SetObjectArrayElement(decryptedMsgsRet, i, decryptedMsg);
+                    env->DeleteLocalRef(decryptedMsg);
+                }
+            }
+
+            // wipe the plain texts
+            memset(plaintextPos - totalLength, 0, totalLength);
+        }
+    }
+
+    if (scratchPtr)
+    {
+        wipeThreadScratchBuffer();
+    }
+
+    if (errorMessage)
+    {
+        env->ThrowNew(getExceptionClass(env), errorMessage);
+    }
+
+    return decryptedMsgsRet;
 }
 
 /**
@@ -784,7 +1191,7 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(getSessionIdentifierJni)(JNIEnv *env,
 
      if (errorMessage)
      {
-         env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+         env->ThrowNew(getExceptionClass(env), errorMessage);
      }
 
      return returnValue;
@@ -866,7 +1273,7 @@ JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(serializeJni)(JNIEnv *env, jobject thi
 
     if (errorMessage)
     {
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return returnValue;
@@ -951,11 +1358,25 @@ JNIEXPORT jlong OLM_SESSION_FUNC_DEF(deserializeJni)(JNIEnv *env, jobject thiz,
     {
         if (sessionPtr)
         {
-            olm_clear_session(sessionPtr);
-            free(sessionPtr);
+            olm_release_session(getSessionAllocator(), sessionPtr);
         }
-        env->ThrowNew(env->FindClass("java/lang/Exception"), errorMessage);
+        env->ThrowNew(getExceptionClass(env), errorMessage);
     }
 
     return (jlong)(intptr_t)sessionPtr;
-}
\ No newline at end of file
+}
+
+/**
+ * Register the natives of OlmSession which are annotated @FastNative.
+ * @param aClass OlmSession
+ * @return true if the natives were registered
+ */
+bool registerSessionNatives(JNIEnv *env, jclass aClass)
+{
+    const JNINativeMethod methods[] =
+    {
+        {"getSessionIdentifierJni", "()[B", reinterpret_cast<void*>(Java_org_matrix_olm_OlmSession_getSessionIdentifierJni)}
+    };
+
+    return env->RegisterNatives(aClass, methods, sizeof(methods) / sizeof(methods[0])) == JNI_OK;
+}
@@ -46,6 +46,14 @@ JNIEXPORT jboolean OLM_SESSION_FUNC_DEF(matchesInboundSessionFromIdKeyJni)(JNIEn
 JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(encryptMessageJni)(JNIEnv *env, jobject thiz, jbyteArray aClearMsg, jobject aEncryptedMsg);
 JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(decryptMessageJni)(JNIEnv *env, jobject thiz, jobject aEncryptedMsg);
 
+// encrypt/decrypt with direct ByteBuffers
+JNIEXPORT jlong OLM_SESSION_FUNC_DEF(encryptMessageTypeJni)(JNIEnv *env, jobject thiz);
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(encryptMessageLengthJni)(JNIEnv *env, jobject thiz, jint aClearMsgLength);
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(encryptMessageDirectJni)(JNIEnv *env, jobject thiz, jobject aClearMsg, jint aClearMsgOffset, jint aClearMsgLength, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength);
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(maxPlaintextLengthDirectJni)(JNIEnv *env, jobject thiz, jlong aMsgType, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength);
+JNIEXPORT jint OLM_SESSION_FUNC_DEF(decryptMessageDirectJni)(JNIEnv *env, jobject thiz, jlong aMsgType, jobject aEncryptedMsg, jint aEncryptedMsgOffset, jint aEncryptedMsgLength, jobject aPlainTextMsg, jint aPlainTextMsgOffset, jint aPlainTextMsgLength);
+JNIEXPORT jobjectArray OLM_SESSION_FUNC_DEF(decryptMessagesJni)(JNIEnv *env, jobject thiz, jlongArray aMsgTypes, jobjectArray aEncryptedMsgs, jobjectArray aErrors);
+
 JNIEXPORT jbyteArray OLM_SESSION_FUNC_DEF(getSessionIdentifierJni)(JNIEnv *env, jobject thiz);
 
 // serialization
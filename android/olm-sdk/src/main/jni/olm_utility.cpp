@@ -47,7 +47,7 @@ JNIEXPORT jlong OLM_UTILITY_FUNC_DEF(createUtilityJni)(JNIEnv *env, jobject thiz
     if (!utilityPtr)
     {
         LOGE(" ## createUtilityJni(): failure - init OOM");
-        env->ThrowNew(env->FindClass("java/lang/Exception"), "init OOM");
+        env->ThrowNew(getExceptionClass(env), "init OOM");
     }
     else
     {
@@ -75,6 +75,25 @@ JNIEXPORT void OLM_UTILITY_FUNC_DEF(releaseUtilityJni)(JNIEnv *env, jobject thiz
     }
 }
 
+/**
+ * Wipe the signing keys the utility keeps decoded.
+ */
+JNIEXPORT void OLM_UTILITY_FUNC_DEF(trimMemoryJni)(JNIEnv *env, jobject thiz)
+{
+    OlmUtility* utilityPtr = getUtilityInstanceId(env, thiz);
+
+    LOGD("## trimMemoryJni(): IN");
+
+    if (!utilityPtr)
+    {
+        LOGE("## trimMemoryJni(): failure - utility ptr=NULL");
+    }
+    else
+    {
+        olm_utility_trim_memory(utilityPtr, OLM_TRIM_MEMORY_CACHES);
+    }
+}
+
 
 /**
  * Verify an ed25519 signature.
@@ -0,0 +1,74 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/attachment.h"
+
+#include "benchmark.hh"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/* Encrypting and decrypting an attachment in place, in the pieces a client
+ * reads a file in. */
+
+static std::vector<std::uint8_t> attachment_memory;
+static OlmAttachment * attachment;
+static std::vector<std::uint8_t> file;
+static std::size_t piece_length;
+static std::uint8_t const key[32] = {1, 2, 3};
+static std::uint8_t const iv[16] = {4, 5, 6};
+static std::uint8_t hash[43];
+
+static void update_in_pieces() {
+    for (std::size_t offset = 0; offset < file.size(); offset += piece_length) {
+        std::size_t length = std::min(piece_length, file.size() - offset);
+        olm_attachment_update(
+            attachment, file.data() + offset, length,
+            file.data() + offset, length
+        );
+    }
+}
+
+static void run(std::size_t length, std::size_t piece) {
+    file.assign(length, 'x');
+    piece_length = piece;
+    std::string suffix =
+        " " + std::to_string(length) + " in " + std::to_string(piece);
+    benchmark(("attachment encrypt" + suffix).c_str(), length, [] {
+        olm_attachment_encrypt_init(
+            attachment, key, sizeof(key), iv, sizeof(iv)
+        );
+        update_in_pieces();
+        olm_attachment_encrypt_final(attachment, hash, sizeof(hash));
+    });
+    benchmark(("attachment decrypt" + suffix).c_str(), length, [] {
+        olm_attachment_decrypt_init(
+            attachment, key, sizeof(key), iv, sizeof(iv)
+        );
+        update_in_pieces();
+        olm_attachment_decrypt_final(attachment, hash, sizeof(hash));
+    });
+}
+
+int main() {
+    attachment_memory.resize(olm_attachment_size());
+    attachment = olm_attachment(attachment_memory.data());
+    run(4096, 4096);
+    run(1 << 20, 65536);
+    /* pieces which don't line up with the AES blocks */
+    run(1 << 20, 1000);
+    run(64 << 20, 1 << 20);
+    olm_clear_attachment(attachment);
+}
@@ -0,0 +1,57 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/base64.hh"
+#include "olm/base64_simd.h"
+#include "olm/cpu.h"
+
+#include "benchmark.hh"
+
+#include <string>
+
+static std::uint8_t raw[49152];
+static std::uint8_t encoded[65536];
+
+static void run(char const * backend) {
+    /* a key, a typical message, and pickles of a busy session or account */
+    static const std::size_t lengths[] = {32, 1024, 16384, 49152};
+    for (std::size_t length : lengths) {
+        std::string name = std::string("encode_base64/") + std::to_string(length)
+            + " " + backend;
+        benchmark(name.c_str(), length, [length] {
+            olm::encode_base64(raw, length, encoded);
+        });
+        std::size_t encoded_length = olm::encode_base64_length(length);
+        name = std::string("decode_base64/") + std::to_string(length)
+            + " " + backend;
+        benchmark(name.c_str(), length, [encoded_length] {
+            olm::decode_base64(encoded, encoded_length, raw);
+        });
+    }
+}
+
+int main() {
+    for (std::size_t i = 0; i < sizeof(raw); ++i) {
+        raw[i] = std::uint8_t(i * 31 + (i >> 8));
+    }
+    if (_olm_base64_simd_available()) {
+        if (_olm_cpu_features() & OLM_CPU_FEATURE_AVX2) {
+            run("avx2");
+            _olm_cpu_set_feature_mask(~OLM_CPU_FEATURE_AVX2);
+        }
+        run("simd128");
+    }
+    _olm_cpu_set_feature_mask(0);
+    run("table");
+}
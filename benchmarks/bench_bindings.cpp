@@ -0,0 +1,234 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/olm.h"
+#include "olm/outbound_group_session.h"
+
+#include "benchmark.hh"
+
+#include <random>
+#include <string>
+#include <vector>
+
+/* The calls that the binding benchmarks time, made straight to the C API,
+ * so that the difference is what each binding adds to a call: copying
+ * arrays, converting strings, marshalling arguments and copying in and out
+ * of the Emscripten heap. They are, with the same names and in the same
+ * order:
+ *
+ *  - python/benchmark.py
+ *  - javascript/benchmark_node.js, and javascript/demo/benchmark.html
+ *  - OlmBenchmarkTest in android/olm-sdk/src/androidTest
+ *  - OLMKitBenchmarkTests in xcode/OLMKitTests
+ *
+ * Each operation is called OLM_BENCH_ITERATIONS times, 1000 by default,
+ * encrypting "Hello, World" and decrypting the messages in the order they
+ * were encrypted, as the bindings do. The random bytes come from a fast
+ * generator here, where the bindings use the system's, so the time that
+ * takes is part of what the bindings add. */
+
+static const std::size_t ITERATIONS = [] {
+    char const * value = std::getenv("OLM_BENCH_ITERATIONS");
+    return value ? std::size_t(std::strtoull(value, NULL, 10)) : 1000;
+}();
+
+static std::uint8_t const plaintext[] = "Hello, World";
+static std::size_t const plaintext_length = sizeof(plaintext) - 1;
+static char const pickle_key[] = "secret_key";
+
+static std::mt19937 rng(1);
+static std::vector<std::uint8_t> random_buffer;
+
+static std::uint8_t * random_bytes(std::size_t length) {
+    random_buffer.resize(length);
+    for (auto & byte : random_buffer) {
+        byte = std::uint8_t(rng());
+    }
+    return random_buffer.data();
+}
+
+static std::vector<std::vector<std::uint8_t>> messages;
+static std::vector<std::size_t> message_types;
+static std::uint8_t output[100];
+
+static std::vector<std::uint8_t> outbound_buffer, inbound_buffer;
+static OlmOutboundGroupSession * outbound;
+static OlmInboundGroupSession * inbound;
+
+static std::vector<std::uint8_t> alice_buffer, bob_buffer;
+static OlmAccount * alice, * bob;
+static std::vector<std::uint8_t> alice_session_buffer, bob_session_buffer;
+static OlmSession * alice_session, * bob_session;
+static std::vector<std::uint8_t> account_buffer;
+static std::vector<std::uint8_t> pickled;
+static std::vector<std::uint8_t> session_buffer;
+
+
+static void benchmark_group() {
+    outbound_buffer.resize(olm_outbound_group_session_size());
+    outbound = olm_outbound_group_session(outbound_buffer.data());
+    std::size_t random_length =
+        olm_init_outbound_group_session_random_length(outbound);
+    olm_init_outbound_group_session(
+        outbound, random_bytes(random_length), random_length
+    );
+    std::vector<std::uint8_t> session_key(
+        olm_outbound_group_session_key_length(outbound)
+    );
+    olm_outbound_group_session_key(
+        outbound, session_key.data(), session_key.size()
+    );
+    inbound_buffer.resize(olm_inbound_group_session_size());
+    inbound = olm_inbound_group_session(inbound_buffer.data());
+    olm_init_inbound_group_session(
+        inbound, session_key.data(), session_key.size()
+    );
+
+    messages.assign(ITERATIONS, std::vector<std::uint8_t>());
+    benchmark_calls("group encrypt", ITERATIONS, [](std::size_t i) {
+        messages[i].resize(
+            olm_group_encrypt_message_length(outbound, plaintext_length)
+        );
+        olm_group_encrypt(
+            outbound, plaintext, plaintext_length,
+            messages[i].data(), messages[i].size()
+        );
+    });
+    benchmark_calls("group decrypt", ITERATIONS, [](std::size_t i) {
+        std::uint32_t message_index;
+        olm_group_decrypt(
+            inbound, messages[i].data(), messages[i].size(),
+            output, sizeof(output), &message_index
+        );
+    });
+    benchmark_calls("group pickle", ITERATIONS, [](std::size_t) {
+        pickled.resize(olm_pickle_inbound_group_session_length(inbound));
+        olm_pickle_inbound_group_session(
+            inbound, pickle_key, sizeof(pickle_key) - 1,
+            pickled.data(), pickled.size()
+        );
+    });
+}
+
+static void benchmark_one_to_one() {
+    account_buffer.resize(olm_account_size());
+    benchmark_calls("account create", ITERATIONS, [](std::size_t) {
+        OlmAccount * account = olm_account(account_buffer.data());
+        std::size_t length = olm_create_account_random_length(account);
+        olm_create_account(account, random_bytes(length), length);
+    });
+
+    alice_buffer.resize(olm_account_size());
+    alice = olm_account(alice_buffer.data());
+    std::size_t length = olm_create_account_random_length(alice);
+    olm_create_account(alice, random_bytes(length), length);
+    bob_buffer.resize(olm_account_size());
+    bob = olm_account(bob_buffer.data());
+    olm_create_account(bob, random_bytes(length), length);
+    length = olm_account_generate_one_time_keys_random_length(bob, 1);
+    olm_account_generate_one_time_keys(bob, 1, random_bytes(length), length);
+
+    std::vector<std::uint8_t> bob_id_keys(
+        olm_account_identity_keys_length(bob)
+    );
+    olm_account_identity_keys(bob, bob_id_keys.data(), bob_id_keys.size());
+    std::vector<std::uint8_t> bob_ot_keys(
+        olm_account_one_time_keys_length(bob)
+    );
+    olm_account_one_time_keys(bob, bob_ot_keys.data(), bob_ot_keys.size());
+
+    alice_session_buffer.resize(olm_session_size());
+    alice_session = olm_session(alice_session_buffer.data());
+    length = olm_create_outbound_session_random_length(alice_session);
+    olm_create_outbound_session(
+        alice_session, alice,
+        bob_id_keys.data() + 15, 43, bob_ot_keys.data() + 25, 43,
+        random_bytes(length), length
+    );
+    std::vector<std::uint8_t> first(
+        olm_encrypt_message_length(alice_session, plaintext_length)
+    );
+    length = olm_encrypt_random_length(alice_session);
+    olm_encrypt(
+        alice_session, plaintext, plaintext_length,
+        random_bytes(length), length, first.data(), first.size()
+    );
+    bob_session_buffer.resize(olm_session_size());
+    bob_session = olm_session(bob_session_buffer.data());
+    std::vector<std::uint8_t> tmp(first);
+    olm_create_inbound_session(bob_session, bob, tmp.data(), tmp.size());
+    olm_decrypt(
+        bob_session, OLM_MESSAGE_TYPE_PRE_KEY, first.data(), first.size(),
+        output, sizeof(output)
+    );
+
+    /* bob replies so that alice stops sending pre-key messages */
+    std::vector<std::uint8_t> reply(
+        olm_encrypt_message_length(bob_session, plaintext_length)
+    );
+    std::size_t reply_type = olm_encrypt_message_type(bob_session);
+    length = olm_encrypt_random_length(bob_session);
+    olm_encrypt(
+        bob_session, plaintext, plaintext_length,
+        random_bytes(length), length, reply.data(), reply.size()
+    );
+    olm_decrypt(
+        alice_session, reply_type, reply.data(), reply.size(),
+        output, sizeof(output)
+    );
+
+    messages.assign(ITERATIONS, std::vector<std::uint8_t>());
+    message_types.assign(ITERATIONS, 0);
+    benchmark_calls("one-to-one encrypt", ITERATIONS, [](std::size_t i) {
+        message_types[i] = olm_encrypt_message_type(alice_session);
+        messages[i].resize(
+            olm_encrypt_message_length(alice_session, plaintext_length)
+        );
+        std::size_t length = olm_encrypt_random_length(alice_session);
+        olm_encrypt(
+            alice_session, plaintext, plaintext_length,
+            random_bytes(length), length,
+            messages[i].data(), messages[i].size()
+        );
+    });
+    benchmark_calls("one-to-one decrypt", ITERATIONS, [](std::size_t i) {
+        olm_decrypt(
+            bob_session, message_types[i],
+            messages[i].data(), messages[i].size(), output, sizeof(output)
+        );
+    });
+    benchmark_calls("session pickle", ITERATIONS, [](std::size_t) {
+        pickled.resize(olm_pickle_session_length(bob_session));
+        olm_pickle_session(
+            bob_session, pickle_key, sizeof(pickle_key) - 1,
+            pickled.data(), pickled.size()
+        );
+    });
+    std::vector<std::uint8_t> saved(pickled);
+    session_buffer.resize(olm_session_size());
+    benchmark_calls("session unpickle", ITERATIONS, [&](std::size_t) {
+        pickled = saved;
+        OlmSession * session = olm_session(session_buffer.data());
+        olm_unpickle_session(
+            session, pickle_key, sizeof(pickle_key) - 1,
+            pickled.data(), pickled.size()
+        );
+    });
+}
+
+int main() {
+    benchmark_group();
+    benchmark_one_to_one();
+}
@@ -0,0 +1,88 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/cipher.h"
+#include "olm/crypto.h"
+
+#include "benchmark.hh"
+
+#include <string>
+#include <vector>
+
+static _olm_cipher_aes_sha_256 cipher = OLM_CIPHER_INIT_AES_SHA_256("Bench");
+static _olm_cipher_aes_sha_256_context context;
+static std::vector<std::uint8_t> plaintext, output, decrypted;
+static std::size_t ciphertext_length;
+static _olm_aes256_key aes_key = {{1, 2, 3}};
+
+static void run(std::size_t length) {
+    plaintext.assign(length, 'x');
+    ciphertext_length = _olm_crypto_aes_encrypt_cbc_length(length);
+    output.resize(ciphertext_length + 8);
+    decrypted.resize(ciphertext_length);
+
+    std::string name = "encrypt then MAC " + std::to_string(length);
+    benchmark(name.c_str(), length, [] {
+        _olm_cipher_aes_sha_256_context_encrypt(
+            &context, plaintext.data(), plaintext.size(),
+            output.data(), ciphertext_length, output.data(), output.size()
+        );
+    });
+    name = "MAC then decrypt " + std::to_string(length);
+    benchmark(name.c_str(), length, [] {
+        _olm_cipher_aes_sha_256_context_decrypt(
+            &context, output.data(), output.size(),
+            output.data(), ciphertext_length,
+            decrypted.data(), decrypted.size()
+        );
+    });
+    /* the same work in two passes, for comparison */
+    name = "separate AES and HMAC " + std::to_string(length);
+    benchmark(name.c_str(), length, [] {
+        std::uint8_t mac[SHA256_OUTPUT_LENGTH];
+        _olm_crypto_hmac_sha256_with_key(
+            &context.mac_key, output.data(), ciphertext_length, mac
+        );
+        _olm_crypto_aes_decrypt_cbc_with_schedule(
+            &context.aes_key_schedule, &context.aes_iv,
+            output.data(), ciphertext_length, decrypted.data()
+        );
+    });
+    /* the AES alone, expanding the key on each call as the plain
+     * functions do */
+    name = "aes_encrypt_cbc " + std::to_string(length);
+    benchmark(name.c_str(), length, [] {
+        _olm_crypto_aes_encrypt_cbc(
+            &aes_key, &context.aes_iv, plaintext.data(), plaintext.size(),
+            output.data()
+        );
+    });
+    name = "aes_decrypt_cbc " + std::to_string(length);
+    benchmark(name.c_str(), length, [] {
+        _olm_crypto_aes_decrypt_cbc(
+            &aes_key, &context.aes_iv, output.data(), ciphertext_length,
+            decrypted.data()
+        );
+    });
+}
+
+int main() {
+    std::uint8_t key[32] = {1, 2, 3};
+    _olm_cipher_aes_sha_256_init_context(&cipher, key, sizeof(key), &context);
+    run(200);
+    run(4096);
+    run(65536);
+    run(1 << 20);
+    _olm_cipher_aes_sha_256_clear_context(&context);
+}
@@ -0,0 +1,100 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/crypto.h"
+#include "olm/curve25519.h"
+
+#include "benchmark.hh"
+
+#include <string>
+
+static void run(char const * backend) {
+    static std::uint8_t random[CURVE25519_RANDOM_LENGTH] = {1, 2, 3};
+    static _olm_curve25519_key_pair our_key, their_key;
+    static std::uint8_t shared_secret[CURVE25519_SHARED_SECRET_LENGTH];
+    _olm_crypto_curve25519_generate_key(random, &their_key);
+
+    std::string name = std::string("curve25519_generate_key ") + backend;
+    benchmark(name.c_str(), 0, [] {
+        _olm_crypto_curve25519_generate_key(random, &our_key);
+    });
+    name = std::string("curve25519_shared_secret ") + backend;
+    benchmark(name.c_str(), 0, [] {
+        _olm_crypto_curve25519_shared_secret(
+            &our_key, &their_key.public_key, shared_secret
+        );
+    });
+
+    /* the triple DH of a session, and of a batch of eight sessions */
+    static _olm_curve25519_key_pair const * our_keys[24];
+    static _olm_curve25519_public_key const * their_keys[24];
+    static std::uint8_t shared_secrets[24 * CURVE25519_SHARED_SECRET_LENGTH];
+    for (unsigned i = 0; i < 24; ++i) {
+        our_keys[i] = &our_key;
+        their_keys[i] = &their_key.public_key;
+    }
+    name = std::string("curve25519_shared_secrets 3 ") + backend;
+    benchmark(name.c_str(), 0, [] {
+        _olm_crypto_curve25519_shared_secrets(
+            3, our_keys, their_keys, shared_secrets
+        );
+    });
+    name = std::string("curve25519_shared_secrets 24 ") + backend;
+    benchmark(name.c_str(), 0, [] {
+        _olm_crypto_curve25519_shared_secrets(
+            24, our_keys, their_keys, shared_secrets
+        );
+    });
+}
+
+int main() {
+    if (_olm_curve25519_set_backend(OLM_CURVE25519_DONNA_C64)) {
+        run("donna-c64");
+    }
+    if (_olm_curve25519_set_backend(OLM_CURVE25519_PAIRED)) {
+        run("paired");
+    }
+    _olm_curve25519_set_backend(OLM_CURVE25519_DONNA);
+    run("donna");
+
+    static std::uint8_t const base_point[32] = {9};
+    static std::uint8_t secret[32] = {1, 2, 3};
+    static std::uint8_t public_key[32];
+    benchmark("curve25519_scalarmult_base", 0, [] {
+        _olm_curve25519_scalarmult_base(public_key, secret);
+    });
+    benchmark("curve25519_scalarmult base point", 0, [] {
+        _olm_curve25519_scalarmult(public_key, secret, base_point);
+    });
+
+    /* one-time keys are generated 100 at a time, and Account batches them */
+    static std::uint8_t randoms[100 * CURVE25519_RANDOM_LENGTH] = {1, 2, 3};
+    static _olm_curve25519_key_pair key_pairs[100];
+    double single_ns = benchmark("curve25519_generate_key x100", 0, [] {
+        for (unsigned i = 0; i < 100; ++i) {
+            _olm_crypto_curve25519_generate_key(
+                randoms + i * CURVE25519_RANDOM_LENGTH, &key_pairs[i]
+            );
+        }
+    });
+    double batch_ns = benchmark("curve25519_generate_keys 100", 0, [] {
+        _olm_crypto_curve25519_generate_keys(100, randoms, key_pairs);
+    });
+    if (!benchmark_json()) {
+        std::cout << std::fixed << std::setprecision(0)
+            << "one-time keys/s: " << 100 * 1e9 / single_ns
+            << " one at a time, " << 100 * 1e9 / batch_ns << " batched"
+            << std::endl;
+    }
+}
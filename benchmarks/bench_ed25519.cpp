@@ -0,0 +1,181 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/base64.hh"
+#include "olm/crypto.h"
+#include "olm/olm.h"
+
+#include "benchmark.hh"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* the number of signatures checked by each call */
+static const std::size_t COUNT = 64;
+
+static _olm_ed25519_public_key public_keys[COUNT];
+static std::uint8_t messages[COUNT][128];
+static std::uint8_t signatures[COUNT][ED25519_SIGNATURE_LENGTH];
+static std::uint8_t const * message_ptrs[COUNT];
+static std::size_t message_lengths[COUNT];
+static std::uint8_t const * signature_ptrs[COUNT];
+static std::uint8_t results[COUNT];
+
+static std::string b64(std::uint8_t const * input, std::size_t length) {
+    std::string output(olm::encode_base64_length(length), '\0');
+    olm::encode_base64(input, length, (std::uint8_t *)&output[0]);
+    return output;
+}
+
+/** A device's keys as in a /keys/query response, signed with the key pair */
+static std::string signed_device_keys(
+    _olm_ed25519_key_pair const & key_pair, std::size_t i
+) {
+    std::string device_id = "DEVICE" + std::to_string(i);
+    std::string key = b64(
+        key_pair.public_key.public_key, ED25519_PUBLIC_KEY_LENGTH
+    );
+    std::string canonical =
+        "{\"algorithms\":[\"m.olm.v1.curve25519-aes-sha2\","
+        "\"m.megolm.v1.aes-sha2\"],\"device_id\":\"" + device_id + "\","
+        "\"keys\":{\"curve25519:" + device_id + "\":\"" + key + "\","
+        "\"ed25519:" + device_id + "\":\"" + key + "\"},"
+        "\"user_id\":\"@alice:example.com\"}";
+    std::uint8_t signature[ED25519_SIGNATURE_LENGTH];
+    _olm_crypto_ed25519_sign(
+        &key_pair, (std::uint8_t const *)canonical.data(), canonical.size(),
+        signature
+    );
+    /* as a server sends it, members out of order and with spaces */
+    return "{\"user_id\": \"@alice:example.com\", \"device_id\": \""
+        + device_id + "\", \"algorithms\": [\"m.olm.v1.curve25519-aes-sha2\", "
+        "\"m.megolm.v1.aes-sha2\"], \"keys\": {\"ed25519:" + device_id
+        + "\": \""
+        + key + "\", \"curve25519:" + device_id + "\": \"" + key + "\"}, "
+        "\"signatures\": {\"@alice:example.com\": {\"ed25519:" + device_id
+        + "\": \"" + b64(signature, sizeof(signature)) + "\"}}, "
+        "\"unsigned\": {\"device_display_name\": \"Alice's phone\"}}";
+}
+
+static std::string json_keys[COUNT];
+static std::string json_key_ids[COUNT];
+static std::string jsons[COUNT];
+static std::string json_copies[COUNT];
+
+int main() {
+    for (std::size_t i = 0; i < COUNT; ++i) {
+        std::uint8_t seed[ED25519_RANDOM_LENGTH];
+        _olm_ed25519_key_pair key_pair;
+        std::memset(seed, int(i), sizeof(seed));
+        _olm_crypto_ed25519_generate_key(seed, &key_pair);
+        public_keys[i] = key_pair.public_key;
+        std::memset(messages[i], int(i), sizeof(messages[i]));
+        message_ptrs[i] = messages[i];
+        message_lengths[i] = sizeof(messages[i]);
+        _olm_crypto_ed25519_sign(
+            &key_pair, messages[i], message_lengths[i], signatures[i]
+        );
+        signature_ptrs[i] = signatures[i];
+        json_keys[i] = b64(
+            key_pair.public_key.public_key, ED25519_PUBLIC_KEY_LENGTH
+        );
+        json_key_ids[i] = "ed25519:DEVICE" + std::to_string(i);
+        jsons[i] = signed_device_keys(key_pair, i);
+    }
+
+    benchmark("ed25519_verify x64", 0, [] {
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            _olm_crypto_ed25519_verify(
+                &public_keys[i], messages[i], message_lengths[i],
+                signatures[i]
+            );
+        }
+    });
+    static _olm_ed25519_prepared_key prepared_keys[COUNT];
+    for (std::size_t i = 0; i < COUNT; ++i) {
+        _olm_crypto_ed25519_prepare_key(&public_keys[i], &prepared_keys[i]);
+    }
+    benchmark("ed25519_verify_prepared x64", 0, [] {
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            _olm_crypto_ed25519_verify_prepared(
+                &prepared_keys[i], messages[i], message_lengths[i],
+                signatures[i]
+            );
+        }
+    });
+    benchmark("ed25519_verify_batch x64", 0, [] {
+        _olm_crypto_ed25519_verify_batch(
+            COUNT, public_keys, message_ptrs, message_lengths,
+            signature_ptrs, results
+        );
+    });
+    /* one bad signature costs a few extra batches to find */
+    signatures[COUNT / 2][40] ^= 1;
+    benchmark("ed25519_verify_batch x64, one bad", 0, [] {
+        _olm_crypto_ed25519_verify_batch(
+            COUNT, public_keys, message_ptrs, message_lengths,
+            signature_ptrs, results
+        );
+    });
+
+    std::vector<std::uint8_t> utility_buffer(olm_utility_size());
+    static OlmUtility * utility = olm_utility(utility_buffer.data());
+    static std::string const user_id("@alice:example.com");
+    /* the objects are rewritten in place, so each run checks copies */
+    benchmark("olm_canonical_json x64", 0, [] {
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            json_copies[i] = jsons[i];
+            olm_canonical_json(
+                utility, &json_copies[i][0], json_copies[i].size()
+            );
+        }
+    });
+    benchmark("olm_ed25519_verify_json x64", 0, [] {
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            json_copies[i] = jsons[i];
+            olm_ed25519_verify_json(
+                utility, json_keys[i].data(), json_keys[i].size(),
+                user_id.data(), user_id.size(),
+                json_key_ids[i].data(), json_key_ids[i].size(),
+                &json_copies[i][0], json_copies[i].size()
+            );
+        }
+    });
+    benchmark("olm_ed25519_verify_json_batch x64", 0, [] {
+        static void const * keys[COUNT];
+        static std::size_t key_lengths[COUNT];
+        static void const * user_ids[COUNT];
+        static std::size_t user_id_lengths[COUNT];
+        static void const * key_ids[COUNT];
+        static std::size_t key_id_lengths[COUNT];
+        static void * json_ptrs[COUNT];
+        static std::size_t json_lengths[COUNT];
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            json_copies[i] = jsons[i];
+            keys[i] = json_keys[i].data();
+            key_lengths[i] = json_keys[i].size();
+            user_ids[i] = user_id.data();
+            user_id_lengths[i] = user_id.size();
+            key_ids[i] = json_key_ids[i].data();
+            key_id_lengths[i] = json_key_ids[i].size();
+            json_ptrs[i] = &json_copies[i][0];
+            json_lengths[i] = json_copies[i].size();
+        }
+        olm_ed25519_verify_json_batch(
+            utility, COUNT, keys, key_lengths, user_ids, user_id_lengths,
+            key_ids, key_id_lengths, json_ptrs, json_lengths, results
+        );
+    });
+}
@@ -0,0 +1,255 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/outbound_group_session.h"
+#include "olm/crypto.h"
+
+#include "benchmark.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/* A sender encrypting a stream of short messages, and how much of the cost
+ * of each message is the signature. Then a receiver catching up on a batch of
+ * those messages, delivered newest first, one at a time, all together, and
+ * one at a time in a history scan.
+ * Then a store loading that receiver's sessions, one pickle at a time and
+ * as a batch under one pickle key. Finally a key backup exporting them, and
+ * a flood of room keys starting them, one at a time and as a batch. */
+
+static std::vector<std::uint8_t> session_buffer;
+static OlmOutboundGroupSession * session;
+static std::uint8_t plaintext[100];
+static std::vector<std::uint8_t> message;
+
+static _olm_ed25519_key_pair signing_key;
+static std::uint8_t signed_message[200];
+static std::uint8_t signature[ED25519_SIGNATURE_LENGTH];
+
+static const std::size_t BATCH = 64;
+static std::vector<std::uint8_t> session_key;
+static std::vector<std::uint8_t> inbound_buffer;
+static OlmInboundGroupSession * inbound;
+static std::vector<std::uint8_t> received[BATCH];
+static std::vector<std::uint8_t> work[BATCH];
+static std::uint8_t * work_ptrs[BATCH];
+static std::size_t work_lengths[BATCH];
+static std::uint8_t output[BATCH][200];
+static std::uint8_t * output_ptrs[BATCH];
+static std::size_t output_lengths[BATCH];
+static std::size_t plaintext_lengths[BATCH];
+
+static OlmInboundGroupSession * loaded[BATCH];
+static std::vector<std::uint8_t> loaded_buffers[BATCH];
+static std::vector<std::uint8_t> pickle;
+static std::vector<std::uint8_t> batch;
+static std::vector<std::uint8_t> scratch;
+static std::vector<std::uint8_t> pickle_key_buffer;
+static OlmPickleKey * pickle_key;
+static std::uint32_t export_indices[BATCH];
+static std::vector<std::uint8_t> exported;
+static std::uint8_t const * key_ptrs[BATCH];
+static std::size_t key_lengths[BATCH];
+static std::uint8_t const * plaintext_ptrs[BATCH];
+static std::size_t encrypt_lengths[BATCH];
+static std::vector<std::uint8_t> encrypted;
+static std::size_t encrypted_lengths[BATCH];
+
+/* a fresh receiver, and fresh copies of the messages to decrypt */
+static void reset_receiver() {
+    olm_init_inbound_group_session(
+        inbound, session_key.data(), session_key.size()
+    );
+    for (std::size_t i = 0; i < BATCH; ++i) {
+        work[i] = received[i];
+        work_ptrs[i] = work[i].data();
+        work_lengths[i] = work[i].size();
+    }
+}
+
+int main() {
+    session_buffer.resize(olm_outbound_group_session_size());
+    session = olm_outbound_group_session(session_buffer.data());
+    std::vector<std::uint8_t> random(
+        olm_init_outbound_group_session_random_length(session), 0x42
+    );
+    olm_init_outbound_group_session(session, random.data(), random.size());
+    std::memset(plaintext, 'x', sizeof(plaintext));
+
+    benchmark("olm_group_encrypt 100 bytes", sizeof(plaintext), [] {
+        /* the message index grows as we go */
+        message.resize(
+            olm_group_encrypt_message_length(session, sizeof(plaintext))
+        );
+        olm_group_encrypt(
+            session, plaintext, sizeof(plaintext),
+            message.data(), message.size()
+        );
+    });
+
+    for (std::size_t i = 0; i < BATCH; ++i) {
+        plaintext_ptrs[i] = plaintext;
+        encrypt_lengths[i] = sizeof(plaintext);
+    }
+    benchmark("olm_group_encrypt x64", BATCH * sizeof(plaintext), [] {
+        for (std::size_t i = 0; i < BATCH; ++i) {
+            message.resize(
+                olm_group_encrypt_message_length(session, sizeof(plaintext))
+            );
+            olm_group_encrypt(
+                session, plaintext, sizeof(plaintext),
+                message.data(), message.size()
+            );
+        }
+    });
+    benchmark("olm_group_encrypt_batch x64", BATCH * sizeof(plaintext), [] {
+        encrypted.resize(
+            olm_group_encrypt_batch_length(session, BATCH, encrypt_lengths)
+        );
+        olm_group_encrypt_batch(
+            session, BATCH, plaintext_ptrs, encrypt_lengths,
+            encrypted.data(), encrypted.size(), encrypted_lengths,
+            nullptr, nullptr
+        );
+    });
+
+    std::uint8_t seed[ED25519_RANDOM_LENGTH] = {1, 2, 3};
+    _olm_crypto_ed25519_generate_key(seed, &signing_key);
+    std::memset(signed_message, 'x', sizeof(signed_message));
+    benchmark("ed25519_sign 200 bytes", sizeof(signed_message), [] {
+        _olm_crypto_ed25519_sign(
+            &signing_key, signed_message, sizeof(signed_message), signature
+        );
+    });
+
+    session_key.resize(olm_outbound_group_session_key_length(session));
+    olm_outbound_group_session_key(
+        session, session_key.data(), session_key.size()
+    );
+    for (std::size_t i = 0; i < BATCH; ++i) {
+        std::vector<std::uint8_t> & m = received[BATCH - 1 - i];
+        m.resize(olm_group_encrypt_message_length(session, sizeof(plaintext)));
+        olm_group_encrypt(
+            session, plaintext, sizeof(plaintext), m.data(), m.size()
+        );
+        output_ptrs[i] = output[i];
+        output_lengths[i] = sizeof(output[i]);
+    }
+    inbound_buffer.resize(olm_inbound_group_session_size());
+    inbound = olm_inbound_group_session(inbound_buffer.data());
+
+    benchmark("olm_group_decrypt x64", BATCH * sizeof(plaintext), [] {
+        reset_receiver();
+        for (std::size_t i = 0; i < BATCH; ++i) {
+            olm_group_decrypt(
+                inbound, work_ptrs[i], work_lengths[i],
+                output_ptrs[i], output_lengths[i], nullptr
+            );
+        }
+    });
+    benchmark("olm_group_decrypt_batch x64", BATCH * sizeof(plaintext), [] {
+        reset_receiver();
+        olm_group_decrypt_batch(
+            inbound, BATCH, work_ptrs, work_lengths,
+            output_ptrs, output_lengths, plaintext_lengths, nullptr, nullptr
+        );
+    });
+    std::vector<std::uint8_t> scan(olm_inbound_group_session_scan_size());
+    olm_inbound_group_session_begin_scan(inbound, scan.data(), scan.size());
+    benchmark("olm_group_decrypt x64 scanning", BATCH * sizeof(plaintext), [] {
+        reset_receiver();
+        for (std::size_t i = 0; i < BATCH; ++i) {
+            olm_group_decrypt(
+                inbound, work_ptrs[i], work_lengths[i],
+                output_ptrs[i], output_lengths[i], nullptr
+            );
+        }
+    });
+    olm_inbound_group_session_end_scan(inbound);
+
+    for (std::size_t i = 0; i < BATCH; ++i) {
+        loaded_buffers[i].resize(olm_inbound_group_session_size());
+        loaded[i] = olm_inbound_group_session(loaded_buffers[i].data());
+        olm_init_inbound_group_session(
+            loaded[i], session_key.data(), session_key.size()
+        );
+    }
+    pickle.resize(olm_pickle_inbound_group_session_binary_length(inbound));
+    olm_pickle_inbound_group_session_binary(
+        inbound, "secret_key", 10, pickle.data(), pickle.size()
+    );
+    benchmark("unpickle_inbound_group_session x64", 0, [] {
+        for (std::size_t i = 0; i < BATCH; ++i) {
+            scratch = pickle;
+            olm_unpickle_inbound_group_session_binary(
+                loaded[i], "secret_key", 10, scratch.data(), scratch.size()
+            );
+        }
+    });
+
+    pickle_key_buffer.resize(olm_pickle_key_size());
+    pickle_key = olm_pickle_key(pickle_key_buffer.data(), "secret_key", 10);
+    batch.resize(olm_pickle_inbound_group_session_batch_length(loaded, BATCH));
+    olm_pickle_inbound_group_session_batch(
+        pickle_key, loaded, BATCH, batch.data(), batch.size()
+    );
+    benchmark("unpickle_inbound_group_session_batch x64", 0, [] {
+        scratch = batch;
+        olm_unpickle_inbound_group_session_batch(
+            pickle_key, scratch.data(), scratch.size(), 0, loaded, BATCH
+        );
+    });
+    olm_clear_pickle_key(pickle_key);
+
+    for (std::size_t i = 0; i < BATCH; ++i) {
+        export_indices[i] = olm_inbound_group_session_first_known_index(
+            loaded[i]
+        );
+    }
+    exported.resize(olm_export_inbound_group_session_batch_length(BATCH));
+    benchmark("export_inbound_group_session x64", 0, [] {
+        std::size_t length = olm_export_inbound_group_session_length(loaded[0]);
+        for (std::size_t i = 0; i < BATCH; ++i) {
+            olm_export_inbound_group_session(
+                loaded[i], exported.data() + i * length, length,
+                export_indices[i]
+            );
+        }
+    });
+    benchmark("export_inbound_group_session_batch x64", 0, [] {
+        olm_export_inbound_group_session_batch(
+            loaded, export_indices, BATCH,
+            exported.data(), exported.size(), nullptr
+        );
+    });
+
+    for (std::size_t i = 0; i < BATCH; ++i) {
+        key_ptrs[i] = session_key.data();
+        key_lengths[i] = session_key.size();
+    }
+    benchmark("init_inbound_group_session x64", 0, [] {
+        for (std::size_t i = 0; i < BATCH; ++i) {
+            olm_init_inbound_group_session(
+                loaded[i], key_ptrs[i], key_lengths[i]
+            );
+        }
+    });
+    benchmark("init_inbound_group_session_batch x64", 0, [] {
+        olm_init_inbound_group_session_batch(
+            loaded, BATCH, key_ptrs, key_lengths, nullptr, nullptr, nullptr
+        );
+    });
+}
@@ -0,0 +1,110 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/outbound_group_session.h"
+#include "olm/pool.h"
+
+#include "benchmark.hh"
+
+#include <cstdio>
+#include <vector>
+
+/* The memory a million inbound group sessions take, full and compact, with
+ * some of the compact ones having moved on from their first known index and
+ * so keeping a second ratchet out of line. Then what the compact layout
+ * costs each decrypt, which checks the signature without a decoded key. */
+
+static const std::size_t SESSION_COUNT = 1000000;
+static const std::size_t MOVED_ON[] = {0, 100000, 1000000};
+
+static std::vector<std::uint8_t> message;
+static std::uint8_t output[200];
+
+static void time_decrypt(char const * name, OlmInboundGroupSession * session) {
+    std::vector<std::uint8_t> tmp;
+    benchmark(name, 0, [&] {
+        tmp = message;
+        std::uint32_t message_index;
+        olm_group_decrypt(
+            session, tmp.data(), tmp.size(), output, sizeof(output),
+            &message_index
+        );
+    });
+}
+
+int main() {
+    std::size_t full = olm_inbound_group_session_size();
+    std::size_t compact = olm_compact_inbound_group_session_size();
+    std::size_t ratchet = olm_compact_inbound_group_session_ratchet_size();
+
+    benchmark_size("olm_inbound_group_session_size", full);
+    benchmark_size("olm_compact_inbound_group_session_size", compact);
+    benchmark_size("olm_compact_..._ratchet_size", ratchet);
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "%zu sessions", SESSION_COUNT);
+    benchmark_size(name, SESSION_COUNT * full);
+    for (std::size_t moved_on : MOVED_ON) {
+        std::snprintf(
+            name, sizeof(name), "%zu compact, %zu moved on",
+            SESSION_COUNT, moved_on
+        );
+        benchmark_size(
+            name, SESSION_COUNT * compact + olm_slab_size(ratchet, moved_on)
+        );
+    }
+
+    std::vector<std::uint8_t> outbound_buffer(
+        olm_outbound_group_session_size()
+    );
+    OlmOutboundGroupSession * outbound =
+        olm_outbound_group_session(outbound_buffer.data());
+    std::vector<std::uint8_t> random(
+        olm_init_outbound_group_session_random_length(outbound), 0x42
+    );
+    olm_init_outbound_group_session(outbound, random.data(), random.size());
+    std::vector<std::uint8_t> session_key(
+        olm_outbound_group_session_key_length(outbound)
+    );
+    olm_outbound_group_session_key(
+        outbound, session_key.data(), session_key.size()
+    );
+    std::uint8_t plaintext[100] = {0};
+    message.resize(olm_group_encrypt_message_length(outbound, 100));
+    olm_group_encrypt(outbound, plaintext, 100, message.data(), message.size());
+
+    std::vector<std::uint8_t> slab_memory(olm_slab_size(ratchet, 1));
+    OlmSlab * slab = olm_slab(slab_memory.data(), ratchet, 1);
+    OlmAllocator allocator;
+    olm_slab_allocator(slab, &allocator);
+
+    std::vector<std::uint8_t> full_buffer(full);
+    OlmInboundGroupSession * full_session =
+        olm_inbound_group_session(full_buffer.data());
+    std::vector<std::uint8_t> compact_buffer(compact);
+    OlmInboundGroupSession * compact_session =
+        olm_compact_inbound_group_session(compact_buffer.data(), &allocator);
+    for (OlmInboundGroupSession * session : {full_session, compact_session}) {
+        std::vector<std::uint8_t> key(session_key);
+        olm_init_inbound_group_session(session, key.data(), key.size());
+    }
+
+    time_decrypt("olm_group_decrypt", full_session);
+    time_decrypt("olm_group_decrypt compact", compact_session);
+
+    olm_clear_inbound_group_session(compact_session);
+    olm_clear_inbound_group_session(full_session);
+    olm_clear_outbound_group_session(outbound);
+}
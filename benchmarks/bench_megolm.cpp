@@ -0,0 +1,87 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/cpu.h"
+#include "olm/megolm.h"
+
+#include "benchmark.hh"
+
+#include <cstdio>
+#include <vector>
+
+/* The Megolm ratchet on its own: one step at a time, as a sender moves it,
+ * and jumps of various distances, as a receiver catching up moves it. Each
+ * jump starts from a fresh ratchet at counter zero. */
+
+static Megolm megolm;
+static Megolm start;
+
+/* a backfill advancing many sessions by different amounts at once */
+static const std::size_t BATCH_LENGTH = 64;
+static std::vector<Megolm> batch(BATCH_LENGTH);
+static std::vector<Megolm *> batch_pointers(BATCH_LENGTH);
+static std::vector<std::uint32_t> batch_targets(BATCH_LENGTH);
+
+static void run_batch(char const * kernel) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "megolm_advance_to x%zu/%s",
+        BATCH_LENGTH, kernel);
+    benchmark(name, 0, [] {
+        for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+            batch[i] = start;
+            megolm_advance_to(&batch[i], batch_targets[i]);
+        }
+    });
+    std::snprintf(name, sizeof(name), "megolm_advance_to_batch x%zu/%s",
+        BATCH_LENGTH, kernel);
+    benchmark(name, 0, [] {
+        for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+            batch[i] = start;
+        }
+        megolm_advance_to_batch(
+            batch_pointers.data(), batch_targets.data(), BATCH_LENGTH
+        );
+    });
+}
+
+int main() {
+    static std::uint8_t random[MEGOLM_RATCHET_LENGTH] = {1, 2, 3};
+    megolm_init(&start, random, 0);
+    megolm = start;
+
+    benchmark("megolm_advance", 0, [] {
+        megolm_advance(&megolm);
+    });
+
+    static const std::uint32_t distances[] = {
+        1, 255, 256, 65535, 65536, 1u << 24, 0xffffffffu
+    };
+    for (std::uint32_t distance : distances) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "megolm_advance_to +%lu",
+            (unsigned long)distance);
+        benchmark(name, 0, [distance] {
+            megolm = start;
+            megolm_advance_to(&megolm, distance);
+        });
+    }
+
+    for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+        batch_pointers[i] = &batch[i];
+        batch_targets[i] = (i * 2654435761u) % 0x20000;
+    }
+    run_batch("native");
+    _olm_cpu_set_feature_mask(~OLM_CPU_FEATURE_SHA256);
+    run_batch("no sha instructions");
+}
@@ -0,0 +1,72 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/memory.hh"
+#include "olm/olm.h"
+
+#include "benchmark.hh"
+
+#include <string>
+
+/* olm::unset and olm::is_equal against the byte at a time volatile loops
+ * they replaced, for the size of a MAC or key, a few chain keys, and a whole
+ * session. */
+
+static std::uint8_t buffer[8192];
+static std::uint8_t other[8192];
+static bool volatile equal;
+
+static void byte_loop_unset(void volatile * buffer, std::size_t length) {
+    char volatile * pos = reinterpret_cast<char volatile *>(buffer);
+    char volatile * end = pos + length;
+    while (pos != end) {
+        *(pos++) = 0;
+    }
+}
+
+static bool byte_loop_is_equal(
+    std::uint8_t const * buffer_a, std::uint8_t const * buffer_b,
+    std::size_t length
+) {
+    std::uint8_t volatile result = 0;
+    while (length--) {
+        result |= (*(buffer_a++)) ^ (*(buffer_b++));
+    }
+    return result == 0;
+}
+
+int main() {
+    std::size_t const lengths[] = {32, 256, olm_session_size()};
+    for (std::size_t length : lengths) {
+        std::string name = "unset/" + std::to_string(length);
+        benchmark(name.c_str(), length, [length] {
+            olm::unset(buffer, length);
+        });
+        name = "byte loop/" + std::to_string(length);
+        benchmark(name.c_str(), length, [length] {
+            byte_loop_unset(buffer, length);
+        });
+    }
+    std::size_t const compare_lengths[] = {8, 32, 256};
+    for (std::size_t length : compare_lengths) {
+        std::string name = "is_equal/" + std::to_string(length);
+        benchmark(name.c_str(), length, [length] {
+            equal = olm::is_equal(buffer, other, length);
+        });
+        name = "byte loop is_equal/" + std::to_string(length);
+        benchmark(name.c_str(), length, [length] {
+            equal = byte_loop_is_equal(buffer, other, length);
+        });
+    }
+}
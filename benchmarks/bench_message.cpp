@@ -0,0 +1,70 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/message.hh"
+
+#include "benchmark.hh"
+
+/* the message from tests/test_message.cpp, with one-byte varints */
+static std::uint8_t short_message[36] =
+    "\x03\x10\x01\n\nratchetkey\"\nciphertexthmacsha2";
+
+static std::uint8_t message[512];
+static std::size_t message_length;
+static std::uint8_t pre_key_message[1024];
+static std::size_t pre_key_message_length;
+static std::uint8_t group_message[512];
+static std::size_t group_message_length;
+
+int main() {
+    /* a message part way down a chain, with a two-byte counter and
+     * ciphertext length */
+    olm::MessageWriter writer;
+    message_length = olm::encode_message_length(300, 33, 160, 8);
+    olm::encode_message(writer, 3, 300, 33, 160, message);
+
+    olm::PreKeyMessageWriter pre_key_writer;
+    pre_key_message_length = olm::encode_one_time_key_message_length(
+        33, 33, 33, message_length
+    );
+    olm::encode_one_time_key_message(
+        pre_key_writer, 3, 33, 33, 33, message_length, pre_key_message
+    );
+
+    std::uint8_t * ciphertext;
+    group_message_length = _olm_encode_group_message_length(20000, 160, 8, 64);
+    _olm_encode_group_message(3, 20000, 160, group_message, &ciphertext);
+
+    olm::MessageReader reader;
+    benchmark("decode_message/short", 0, [&reader] {
+        olm::decode_message(reader, short_message, 35, 8);
+    }, 0.5);
+    benchmark("decode_message", 0, [&reader] {
+        olm::decode_message(reader, message, message_length, 8);
+    }, 0.5);
+
+    olm::PreKeyMessageReader pre_key_reader;
+    benchmark("decode_one_time_key_message", 0, [&pre_key_reader] {
+        olm::decode_one_time_key_message(
+            pre_key_reader, pre_key_message, pre_key_message_length
+        );
+    }, 0.5);
+
+    _OlmDecodeGroupMessageResults results;
+    benchmark("decode_group_message", 0, [&results] {
+        _olm_decode_group_message(
+            group_message, group_message_length, 8, 64, &results
+        );
+    }, 0.5);
+}
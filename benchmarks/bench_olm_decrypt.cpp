@@ -0,0 +1,105 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+
+#include "benchmark.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/* A receiver getting a message some way ahead of the last one it decrypted,
+ * so it has to walk the chain up to it and keep the keys it skipped over.
+ * The receiver is put back to the same state before every decrypt. */
+
+static const std::size_t GAPS[] = {0, 10, 100, 1000, 2000};
+static const std::size_t MAX_GAP = 2000;
+
+static std::vector<std::uint8_t> b_session_buffer;
+static std::vector<std::uint8_t> b_session_saved;
+static OlmSession * b_session;
+static std::vector<std::vector<std::uint8_t>> messages(MAX_GAP + 2);
+static std::vector<std::uint8_t> message;
+static std::size_t gap;
+static std::uint8_t output[200];
+
+int main() {
+    std::vector<std::uint8_t> a_account_buffer(olm_account_size());
+    OlmAccount * a_account = olm_account(a_account_buffer.data());
+    std::vector<std::uint8_t> random(olm_create_account_random_length(a_account), 1);
+    olm_create_account(a_account, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_account_buffer(olm_account_size());
+    OlmAccount * b_account = olm_account(b_account_buffer.data());
+    random.assign(olm_create_account_random_length(b_account), 2);
+    olm_create_account(b_account, random.data(), random.size());
+    random.assign(olm_account_generate_one_time_keys_random_length(b_account, 1), 3);
+    olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(b_account));
+    olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+    std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(b_account));
+    olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+    std::vector<std::uint8_t> a_session_buffer(olm_session_size());
+    OlmSession * a_session = olm_session(a_session_buffer.data());
+    random.assign(olm_create_outbound_session_random_length(a_session), 4);
+    olm_create_outbound_session(
+        a_session, a_account,
+        b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+        random.data(), random.size()
+    );
+
+    std::uint8_t plaintext[100];
+    std::memset(plaintext, 'x', sizeof(plaintext));
+    for (auto & m : messages) {
+        m.resize(olm_encrypt_message_length(a_session, sizeof(plaintext)));
+        olm_encrypt(
+            a_session, plaintext, sizeof(plaintext), NULL, 0,
+            m.data(), m.size()
+        );
+    }
+
+    b_session_buffer.resize(olm_session_size());
+    b_session = olm_session(b_session_buffer.data());
+    message = messages[0];
+    olm_create_inbound_session(
+        b_session, b_account, message.data(), message.size()
+    );
+    message = messages[0];
+    olm_decrypt(
+        b_session, 0, message.data(), message.size(), output, sizeof(output)
+    );
+    /* the session only points into its own buffer, so copying the bytes
+     * back into the same buffer restores it */
+    b_session_saved = b_session_buffer;
+
+    for (std::size_t g : GAPS) {
+        gap = g;
+        char name[64];
+        std::snprintf(name, sizeof(name), "olm_decrypt gap %zu", gap);
+        benchmark(name, 0, [] {
+            std::memcpy(
+                b_session_buffer.data(), b_session_saved.data(),
+                b_session_saved.size()
+            );
+            message = messages[gap + 1];
+            olm_decrypt(
+                b_session, 0, message.data(), message.size(),
+                output, sizeof(output)
+            );
+        });
+    }
+}
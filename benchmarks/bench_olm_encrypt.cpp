@@ -0,0 +1,96 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+
+#include "benchmark.hh"
+
+#include <cstring>
+#include <vector>
+
+/* Sharing a group session key with every device in a large room: the same
+ * short plain-text encrypted with a couple of thousand Olm sessions. */
+
+static const std::size_t RECIPIENTS = 2000;
+
+static std::vector<std::vector<std::uint8_t>> session_buffers(RECIPIENTS);
+static std::vector<OlmSession *> sessions(RECIPIENTS);
+static std::uint8_t plaintext[200];
+static std::vector<std::uint8_t> random_buffer;
+static std::vector<std::uint8_t> messages;
+static std::vector<std::size_t> message_types(RECIPIENTS);
+static std::vector<std::size_t> message_lengths(RECIPIENTS);
+
+int main() {
+    std::vector<std::uint8_t> a_account_buffer(olm_account_size());
+    OlmAccount * a_account = olm_account(a_account_buffer.data());
+    std::vector<std::uint8_t> random(olm_create_account_random_length(a_account), 1);
+    olm_create_account(a_account, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_account_buffer(olm_account_size());
+    OlmAccount * b_account = olm_account(b_account_buffer.data());
+    random.assign(olm_create_account_random_length(b_account), 2);
+    olm_create_account(b_account, random.data(), random.size());
+    random.assign(olm_account_generate_one_time_keys_random_length(b_account, 1), 3);
+    olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(b_account));
+    olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+    std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(b_account));
+    olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+    /* the recipients all look the same, which doesn't matter for the cost */
+    for (std::size_t i = 0; i < RECIPIENTS; ++i) {
+        session_buffers[i].resize(olm_session_size());
+        sessions[i] = olm_session(session_buffers[i].data());
+        random.assign(olm_create_outbound_session_random_length(sessions[i]), 0);
+        std::memcpy(random.data(), &i, sizeof(i));
+        olm_create_outbound_session(
+            sessions[i], a_account,
+            b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+            random.data(), random.size()
+        );
+    }
+    std::memset(plaintext, 'x', sizeof(plaintext));
+    messages.resize(olm_encrypt_many_message_length(
+        sessions.data(), RECIPIENTS, sizeof(plaintext)
+    ) * 2);
+
+    benchmark("olm_encrypt x2000", RECIPIENTS * sizeof(plaintext), [] {
+        std::uint8_t * pos = messages.data();
+        for (std::size_t i = 0; i < RECIPIENTS; ++i) {
+            std::size_t length = olm_encrypt_message_length(
+                sessions[i], sizeof(plaintext)
+            );
+            random_buffer.assign(olm_encrypt_random_length(sessions[i]), 4);
+            olm_encrypt(
+                sessions[i], plaintext, sizeof(plaintext),
+                random_buffer.data(), random_buffer.size(), pos, length
+            );
+            pos += length;
+        }
+    });
+
+    benchmark("olm_encrypt_many x2000", RECIPIENTS * sizeof(plaintext), [] {
+        random_buffer.assign(
+            olm_encrypt_many_random_length(sessions.data(), RECIPIENTS), 4
+        );
+        olm_encrypt_many(
+            sessions.data(), RECIPIENTS, plaintext, sizeof(plaintext),
+            random_buffer.data(), random_buffer.size(),
+            messages.data(), messages.size(),
+            message_types.data(), message_lengths.data()
+        );
+    });
+}
@@ -0,0 +1,241 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "olm/pool.h"
+
+#include "benchmark.hh"
+
+#include <cstring>
+#include <vector>
+
+/* Setting up an Olm session from each end, then a conversation in which the
+ * two sides take turns, so that every message starts a new ratchet chain and
+ * costs a Diffie-Hellman on each side. */
+
+static std::vector<std::uint8_t> a_account_buffer, b_account_buffer;
+static OlmAccount * a_account;
+static OlmAccount * b_account;
+static std::vector<std::uint8_t> b_id_keys, b_ot_keys;
+static std::vector<std::uint8_t> a_id_keys;
+
+static std::vector<std::uint8_t> a_session_buffer, b_session_buffer;
+static OlmSession * a_session;
+static OlmSession * b_session;
+static std::vector<std::uint8_t> random_buffer;
+static std::vector<std::uint8_t> pre_key_message;
+static std::vector<std::uint8_t> message;
+static std::uint8_t plaintext[100];
+
+/* a device-onboarding storm: many sessions to the same device keys */
+static std::size_t const BATCH_LENGTH = 32;
+static std::vector<std::vector<std::uint8_t>> batch_buffers(BATCH_LENGTH);
+static std::vector<OlmSession *> batch_sessions(BATCH_LENGTH);
+static std::vector<void const *> batch_id_keys(BATCH_LENGTH);
+static std::vector<void const *> batch_ot_keys(BATCH_LENGTH);
+static std::vector<std::size_t> batch_key_lengths(BATCH_LENGTH, 43);
+static std::vector<std::uint8_t> batch_messages;
+static std::vector<std::size_t> batch_message_lengths(BATCH_LENGTH);
+static std::vector<std::uint8_t> slab_memory;
+static OlmAllocator allocator;
+static std::uint8_t output[200];
+
+static void create_outbound() {
+    a_session = olm_session(a_session_buffer.data());
+    olm_create_outbound_session(
+        a_session, a_account,
+        b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+        random_buffer.data(), random_buffer.size()
+    );
+}
+
+static void create_outbound_batch() {
+    for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+        batch_sessions[i] = olm_session(batch_buffers[i].data());
+    }
+    olm_create_outbound_sessions(
+        batch_sessions.data(), BATCH_LENGTH, a_account,
+        batch_id_keys.data(), batch_key_lengths.data(),
+        batch_ot_keys.data(), batch_key_lengths.data(),
+        random_buffer.data(), random_buffer.size()
+    );
+}
+
+/* a room key to each device, one at a time and then in one pass */
+static void create_and_encrypt_each() {
+    for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+        batch_sessions[i] = olm_allocate_session(&allocator);
+        olm_create_outbound_session(
+            batch_sessions[i], a_account,
+            batch_id_keys[i], 43, batch_ot_keys[i], 43,
+            random_buffer.data(),
+            olm_create_outbound_session_random_length(batch_sessions[i])
+        );
+        message.resize(olm_encrypt_message_length(
+            batch_sessions[i], sizeof(plaintext)
+        ));
+        olm_encrypt(
+            batch_sessions[i], plaintext, sizeof(plaintext), NULL, 0,
+            message.data(), message.size()
+        );
+    }
+    for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+        olm_release_session(&allocator, batch_sessions[i]);
+    }
+}
+
+static void create_and_encrypt_batch() {
+    olm_create_outbound_sessions_and_encrypt(
+        a_account, BATCH_LENGTH,
+        batch_id_keys.data(), batch_key_lengths.data(),
+        batch_ot_keys.data(), batch_key_lengths.data(),
+        plaintext, sizeof(plaintext),
+        random_buffer.data(), random_buffer.size(),
+        &allocator, batch_sessions.data(),
+        batch_messages.data(), batch_messages.size(),
+        batch_message_lengths.data(), NULL, NULL, NULL
+    );
+    for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+        olm_release_session(&allocator, batch_sessions[i]);
+    }
+}
+
+static void create_inbound() {
+    b_session = olm_session(b_session_buffer.data());
+    message = pre_key_message;
+    olm_create_inbound_session(
+        b_session, b_account, message.data(), message.size()
+    );
+}
+
+/* encrypt a message with one session and decrypt it with the other */
+static void send(OlmSession * from, OlmSession * to) {
+    /* each new ratchet key must differ from the earlier ones, or the
+     * receiver takes its message for one on an old chain */
+    static std::uint64_t counter;
+    ++counter;
+    std::memcpy(random_buffer.data() + 8, &counter, sizeof(counter));
+    std::size_t type = olm_encrypt_message_type(from);
+    message.resize(olm_encrypt_message_length(from, sizeof(plaintext)));
+    olm_encrypt(
+        from, plaintext, sizeof(plaintext),
+        random_buffer.data(), olm_encrypt_random_length(from),
+        message.data(), message.size()
+    );
+    olm_decrypt(
+        to, type, message.data(), message.size(), output, sizeof(output)
+    );
+}
+
+int main() {
+    a_account_buffer.resize(olm_account_size());
+    a_account = olm_account(a_account_buffer.data());
+    random_buffer.assign(olm_create_account_random_length(a_account), 1);
+    olm_create_account(a_account, random_buffer.data(), random_buffer.size());
+
+    b_account_buffer.resize(olm_account_size());
+    b_account = olm_account(b_account_buffer.data());
+    random_buffer.assign(olm_create_account_random_length(b_account), 2);
+    olm_create_account(b_account, random_buffer.data(), random_buffer.size());
+    random_buffer.assign(
+        olm_account_generate_one_time_keys_random_length(b_account, 1), 3
+    );
+    olm_account_generate_one_time_keys(
+        b_account, 1, random_buffer.data(), random_buffer.size()
+    );
+
+    b_id_keys.resize(olm_account_identity_keys_length(b_account));
+    olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+    b_ot_keys.resize(olm_account_one_time_keys_length(b_account));
+    olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+    a_session_buffer.resize(olm_session_size());
+    b_session_buffer.resize(olm_session_size());
+    random_buffer.assign(olm_create_outbound_session_random_length(
+        olm_session(a_session_buffer.data())
+    ), 4);
+    std::memset(plaintext, 'x', sizeof(plaintext));
+
+    double single_ns = benchmark(
+        "olm_create_outbound_session", 0, create_outbound
+    );
+
+    std::vector<std::uint8_t> single_random(random_buffer);
+    random_buffer.assign(BATCH_LENGTH * single_random.size(), 4);
+    for (std::size_t i = 0; i < BATCH_LENGTH; ++i) {
+        batch_buffers[i].resize(olm_session_size());
+        batch_id_keys[i] = b_id_keys.data() + 15;
+        batch_ot_keys[i] = b_ot_keys.data() + 25;
+    }
+    double batch_ns = benchmark(
+        "olm_create_outbound_sessions 32", 0, create_outbound_batch
+    );
+    if (!benchmark_json()) {
+        std::cout << std::fixed << std::setprecision(0)
+            << "outbound sessions/s: " << 1e9 / single_ns
+            << " one at a time, " << BATCH_LENGTH * 1e9 / batch_ns
+            << " batched" << std::endl;
+    }
+
+    slab_memory.resize(olm_slab_size(olm_session_size(), BATCH_LENGTH));
+    olm_slab_allocator(
+        olm_slab(slab_memory.data(), olm_session_size(), BATCH_LENGTH),
+        &allocator
+    );
+    batch_messages.resize(
+        BATCH_LENGTH * olm_create_outbound_sessions_and_encrypt_message_length(
+            sizeof(plaintext)
+        )
+    );
+    single_ns = benchmark(
+        "create and encrypt, 32 one at a time", 0, create_and_encrypt_each
+    );
+    batch_ns = benchmark(
+        "olm_create_outbound_sessions_and_encrypt 32", 0,
+        create_and_encrypt_batch
+    );
+    if (!benchmark_json()) {
+        std::cout << std::fixed << std::setprecision(0)
+            << "pre-key messages/s: " << BATCH_LENGTH * 1e9 / single_ns
+            << " one at a time, " << BATCH_LENGTH * 1e9 / batch_ns
+            << " batched" << std::endl;
+    }
+    random_buffer = single_random;
+
+    pre_key_message.resize(olm_encrypt_message_length(
+        a_session, sizeof(plaintext)
+    ));
+    olm_encrypt(
+        a_session, plaintext, sizeof(plaintext), NULL, 0,
+        pre_key_message.data(), pre_key_message.size()
+    );
+    benchmark("olm_create_inbound_session", 0, create_inbound);
+
+    /* the reply and its answer get the sessions out of the pre-key stage */
+    message = pre_key_message;
+    olm_decrypt(
+        b_session, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size(),
+        output, sizeof(output)
+    );
+    send(b_session, a_session);
+    send(a_session, b_session);
+
+    benchmark("olm_encrypt and decrypt, taking turns", 2 * sizeof(plaintext), [] {
+        send(a_session, b_session);
+        send(b_session, a_session);
+    });
+    benchmark("olm_encrypt and decrypt, one way", sizeof(plaintext), [] {
+        send(a_session, b_session);
+    });
+}
@@ -0,0 +1,260 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/olm.h"
+#include "olm/outbound_group_session.h"
+
+#include "benchmark.hh"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/* Pickling and unpickling each kind of object, as a client does when it
+ * saves its state and loads it again. The account has a full set of
+ * one-time keys. Each unpickle is of a fresh copy of the pickle into a
+ * freshly initialised object. */
+
+static char const KEY[] = "benchmark pickle key";
+static const std::size_t KEY_LENGTH = sizeof(KEY) - 1;
+
+static std::vector<std::uint8_t> object_buffer;
+static std::vector<std::uint8_t> pickled, work;
+
+static std::vector<std::uint8_t> account_buffer;
+static OlmAccount * account;
+static std::vector<std::uint8_t> session_buffer;
+static OlmSession * session;
+static std::vector<std::uint8_t> outbound_buffer;
+static OlmOutboundGroupSession * outbound;
+static std::vector<std::uint8_t> inbound_buffer;
+static OlmInboundGroupSession * inbound;
+
+static OlmSession * make_session() {
+    std::vector<std::uint8_t> a_buffer(olm_account_size());
+    OlmAccount * a_account = olm_account(a_buffer.data());
+    std::vector<std::uint8_t> random(olm_create_account_random_length(a_account), 1);
+    olm_create_account(a_account, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(account));
+    olm_account_identity_keys(account, b_id_keys.data(), b_id_keys.size());
+    std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(account));
+    olm_account_one_time_keys(account, b_ot_keys.data(), b_ot_keys.size());
+
+    session_buffer.resize(olm_session_size());
+    OlmSession * a_session = olm_session(session_buffer.data());
+    random.assign(olm_create_outbound_session_random_length(a_session), 2);
+    olm_create_outbound_session(
+        a_session, a_account,
+        b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+        random.data(), random.size()
+    );
+    olm_clear_account(a_account);
+    return a_session;
+}
+
+int main() {
+    account_buffer.resize(olm_account_size());
+    account = olm_account(account_buffer.data());
+    std::vector<std::uint8_t> random(olm_create_account_random_length(account), 3);
+    olm_create_account(account, random.data(), random.size());
+    std::size_t one_time_keys = olm_account_max_number_of_one_time_keys(account);
+    random.assign(
+        olm_account_generate_one_time_keys_random_length(account, one_time_keys), 4
+    );
+    olm_account_generate_one_time_keys(
+        account, one_time_keys, random.data(), random.size()
+    );
+    session = make_session();
+
+    outbound_buffer.resize(olm_outbound_group_session_size());
+    outbound = olm_outbound_group_session(outbound_buffer.data());
+    random.assign(olm_init_outbound_group_session_random_length(outbound), 5);
+    olm_init_outbound_group_session(outbound, random.data(), random.size());
+    std::vector<std::uint8_t> session_key(
+        olm_outbound_group_session_key_length(outbound)
+    );
+    olm_outbound_group_session_key(
+        outbound, session_key.data(), session_key.size()
+    );
+    inbound_buffer.resize(olm_inbound_group_session_size());
+    inbound = olm_inbound_group_session(inbound_buffer.data());
+    olm_init_inbound_group_session(
+        inbound, session_key.data(), session_key.size()
+    );
+
+    pickled.resize(olm_pickle_account_length(account));
+    benchmark("olm_pickle_account", 0, [] {
+        olm_pickle_account(
+            account, KEY, KEY_LENGTH, pickled.data(), pickled.size()
+        );
+    });
+    object_buffer.resize(olm_account_size());
+    benchmark("olm_unpickle_account", 0, [] {
+        work = pickled;
+        olm_unpickle_account(
+            olm_account(object_buffer.data()), KEY, KEY_LENGTH,
+            work.data(), work.size()
+        );
+    });
+    /* for a client that only needs to give out or sign with its identity
+     * keys, into an account with no room for one time keys */
+    object_buffer.resize(olm_account_size_with_limits(0));
+    benchmark("olm_unpickle_account_identity_keys", 0, [] {
+        work = pickled;
+        olm_unpickle_account_identity_keys(
+            olm_account_with_limits(object_buffer.data(), 0), KEY, KEY_LENGTH,
+            work.data(), work.size()
+        );
+    });
+
+    pickled.resize(olm_pickle_session_length(session));
+    benchmark("olm_pickle_session", 0, [] {
+        olm_pickle_session(
+            session, KEY, KEY_LENGTH, pickled.data(), pickled.size()
+        );
+    });
+    object_buffer.resize(olm_session_size());
+    benchmark("olm_unpickle_session", 0, [] {
+        work = pickled;
+        olm_unpickle_session(
+            olm_session(object_buffer.data()), KEY, KEY_LENGTH,
+            work.data(), work.size()
+        );
+    });
+    /* with the keys derived once, in each of the pickle ciphers */
+    static std::vector<std::uint8_t> key_buffer(olm_pickle_key_size());
+    static OlmPickleKey * key =
+        olm_pickle_key(key_buffer.data(), KEY, KEY_LENGTH);
+    pickled.resize(olm_pickle_session_with_key_length(
+        session, OLM_PICKLE_CIPHER_AES_SHA_256
+    ));
+    benchmark("olm_pickle_session_with_key, AES-SHA-256", 0, [] {
+        olm_pickle_session_with_key(
+            session, key, OLM_PICKLE_CIPHER_AES_SHA_256,
+            pickled.data(), pickled.size()
+        );
+    });
+    benchmark("olm_unpickle_session_with_key, AES-SHA-256", 0, [] {
+        work = pickled;
+        olm_unpickle_session_with_key(
+            olm_session(object_buffer.data()), key, work.data(), work.size()
+        );
+    });
+    /* checking a stored pickle for damage without loading it */
+    benchmark("olm_pickle_verify, AES-SHA-256", 0, [] {
+        olm_pickle_verify(key, pickled.data(), pickled.size());
+    });
+    pickled.resize(olm_pickle_session_with_key_length(
+        session, OLM_PICKLE_CIPHER_AES_GCM
+    ));
+    benchmark("olm_pickle_session_with_key, AES-GCM", 0, [] {
+        olm_pickle_session_with_key(
+            session, key, OLM_PICKLE_CIPHER_AES_GCM,
+            pickled.data(), pickled.size()
+        );
+    });
+    benchmark("olm_unpickle_session_with_key, AES-GCM", 0, [] {
+        work = pickled;
+        olm_unpickle_session_with_key(
+            olm_session(object_buffer.data()), key, work.data(), work.size()
+        );
+    });
+    benchmark("olm_pickle_verify, AES-GCM", 0, [] {
+        olm_pickle_verify(key, pickled.data(), pickled.size());
+    });
+    /* moving to a new pickle key, against unpickling and pickling again */
+    static std::vector<std::uint8_t> new_key_buffer(olm_pickle_key_size());
+    static OlmPickleKey * new_key =
+        olm_pickle_key(new_key_buffer.data(), "new key", 7);
+    benchmark("olm_pickle_rekey_batch, AES-GCM", 0, [] {
+        void * pickle = pickled.data();
+        std::size_t length = pickled.size();
+        const char * error;
+        olm_pickle_rekey_batch(
+            key, new_key, 1, &pickle, &length, &error, NULL, NULL
+        );
+        std::swap(key, new_key);
+    });
+    olm_clear_pickle_key(new_key);
+    olm_clear_pickle_key(key);
+    pickled.resize(olm_pickle_session_length(session));
+    olm_pickle_session(
+        session, KEY, KEY_LENGTH, pickled.data(), pickled.size()
+    );
+    /* a copy for trying something out, against a pickle round trip */
+    benchmark("olm_session_copy", 0, [] {
+        olm_session_copy(object_buffer.data(), object_buffer.size(), session);
+    });
+
+    pickled.resize(olm_pickle_outbound_group_session_length(outbound));
+    benchmark("olm_pickle_outbound_group_session", 0, [] {
+        olm_pickle_outbound_group_session(
+            outbound, KEY, KEY_LENGTH, pickled.data(), pickled.size()
+        );
+    });
+    object_buffer.resize(olm_outbound_group_session_size());
+    benchmark("olm_unpickle_outbound_group_session", 0, [] {
+        work = pickled;
+        olm_unpickle_outbound_group_session(
+            olm_outbound_group_session(object_buffer.data()), KEY, KEY_LENGTH,
+            work.data(), work.size()
+        );
+    });
+
+    pickled.resize(olm_pickle_inbound_group_session_length(inbound));
+    benchmark("olm_pickle_inbound_group_session", 0, [] {
+        olm_pickle_inbound_group_session(
+            inbound, KEY, KEY_LENGTH, pickled.data(), pickled.size()
+        );
+    });
+    object_buffer.resize(olm_inbound_group_session_size());
+    benchmark("olm_unpickle_inbound_group_session", 0, [] {
+        work = pickled;
+        olm_unpickle_inbound_group_session(
+            olm_inbound_group_session(object_buffer.data()), KEY, KEY_LENGTH,
+            work.data(), work.size()
+        );
+    });
+    benchmark("olm_inbound_group_session_copy", 0, [] {
+        olm_inbound_group_session_copy(object_buffer.data(), inbound);
+    });
+
+    /* what a storage scan needs: the session ID and first known index */
+    static std::uint8_t id[64];
+    benchmark("unpickle for the session ID and first known index", 0, [] {
+        work = pickled;
+        OlmInboundGroupSession * session =
+            olm_inbound_group_session(object_buffer.data());
+        olm_unpickle_inbound_group_session(
+            session, KEY, KEY_LENGTH, work.data(), work.size()
+        );
+        olm_inbound_group_session_id(session, id, sizeof(id));
+        olm_inbound_group_session_first_known_index(session);
+    });
+    pickled.resize(
+        olm_pickle_inbound_group_session_with_header_length(inbound)
+    );
+    olm_pickle_inbound_group_session_with_header(
+        inbound, KEY, KEY_LENGTH, pickled.data(), pickled.size()
+    );
+    benchmark("olm_pickle_peek_header", 0, [] {
+        std::uint32_t version, first_known_index;
+        olm_pickle_peek_header(
+            pickled.data(), pickled.size(), &version, &first_known_index,
+            id, sizeof(id)
+        );
+    });
+}
@@ -0,0 +1,648 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/olm.h"
+#include "olm/outbound_group_session.h"
+#include "olm/trace.h"
+
+#include "benchmark.hh"
+
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Replays the shape of a workload, as the recorder in olm/trace.h sees it,
+ * against fresh keys: the same calls on the same number of sessions, with
+ * the same plain-text lengths and group message indices, so the same gaps
+ * and backfills. Only the calls the log records are timed; whatever the
+ * other ends of the sessions have to do to make them possible isn't.
+ *
+ * The log is read from the file named by OLM_REPLAY_FILE, one call on each
+ * line as the numbers of an OlmRecordEvent:
+ *
+ *   operation session plaintext_length message_length message_index
+ *   message_type failed
+ *
+ * where session is any number which tells the sessions apart. Lines
+ * starting with # are skipped. A library built with OLM_TRACE writes one
+ * with a recorder such as:
+ *
+ *   static void record(void * file, const struct OlmRecordEvent * event) {
+ *       fprintf(file, "%d %zu %zu %zu %u %u %d\n",
+ *           event->operation, (size_t)event->session,
+ *           event->plaintext_length, event->message_length,
+ *           event->message_index, event->message_type, event->failed);
+ *   }
+ *
+ * Calls which failed are counted but not replayed. Without a log it
+ * replays a built-in one: backfilling the history of a few rooms, then
+ * bursts of to-device messages over many Olm sessions between the messages
+ * of a busy room.
+ */
+
+/** A call from the log, with the sessions numbered as the replay uses them */
+struct Call {
+    unsigned operation;
+    std::size_t slot;
+    std::size_t plaintext_length;
+    std::uint32_t message_index;
+    bool failed;
+    /** for creating an inbound session, the plain-text length of the
+     * session's next decrypt */
+    std::size_t next_plaintext_length;
+};
+
+/** One session the log was for, and whatever its other end needs */
+struct Slot {
+    std::vector<std::uint8_t> memory;
+    OlmSession * session = NULL;
+    std::vector<std::uint8_t> peer_memory;
+    OlmSession * peer = NULL;
+    /** the pre-key message an inbound session was created from, to be
+     * decrypted next */
+    std::vector<std::uint8_t> pending;
+
+    OlmOutboundGroupSession * outbound = NULL;
+    OlmInboundGroupSession * inbound = NULL;
+    /** the session key for an inbound session, at its first index */
+    std::vector<std::uint8_t> session_key;
+    bool has_first_index = false;
+    std::uint32_t first_index = 0;
+    /** the plain-text length of the message at each index decrypted */
+    std::map<std::uint32_t, std::size_t> needed;
+    std::map<std::uint32_t, std::vector<std::uint8_t>> messages;
+};
+
+static const std::size_t OPERATIONS = 14;
+
+static char const * const NAMES[OPERATIONS] = {
+    "replay olm_create_outbound_session",
+    "replay olm_create_inbound_session",
+    "replay olm_encrypt",
+    "replay olm_decrypt",
+    "replay olm_group_encrypt",
+    "replay olm_group_decrypt",
+    NULL, NULL, NULL, NULL, NULL, NULL,
+    "replay olm_init_outbound_group_session",
+    "replay olm_init_inbound_group_session",
+};
+
+static std::mt19937_64 rng(1);
+
+static std::vector<std::uint8_t> random_bytes(std::size_t length) {
+    std::vector<std::uint8_t> bytes(length);
+    for (auto & byte : bytes) {
+        byte = std::uint8_t(rng());
+    }
+    return bytes;
+}
+
+static std::vector<double> times[OPERATIONS];
+/** calls which failed in the replay, though they didn't in the log */
+static std::size_t replay_failures;
+
+template<typename Operation>
+static std::size_t timed(unsigned operation, Operation run) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    std::size_t result = run();
+    times[operation].push_back(std::chrono::duration<double, std::nano>(
+        clock::now() - start
+    ).count());
+    if (result == olm_error()) {
+        ++replay_failures;
+    }
+    return result;
+}
+
+
+/** The log before the sessions are numbered */
+struct Recorded {
+    unsigned operation;
+    std::uint64_t session;
+    std::size_t plaintext_length;
+    std::uint32_t message_index;
+    bool failed;
+};
+
+static std::vector<Recorded> read_log(char const * path) {
+    std::vector<Recorded> log;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        Recorded call;
+        std::size_t message_length;
+        unsigned message_type;
+        int failed;
+        if (fields >> call.operation >> call.session
+                >> call.plaintext_length >> message_length
+                >> call.message_index >> message_type >> failed
+                && call.operation < OPERATIONS && NAMES[call.operation]) {
+            call.failed = failed != 0;
+            log.push_back(call);
+        }
+    }
+    return log;
+}
+
+static std::vector<Recorded> builtin_log() {
+    std::vector<Recorded> log;
+    std::uint64_t next_session = 1;
+
+    /* open a few rooms and page back through their history */
+    for (unsigned room = 0; room < 3; ++room) {
+        std::uint64_t session = next_session++;
+        log.push_back({OLM_TRACE_INIT_INBOUND_GROUP_SESSION, session, 0, 0});
+        for (std::uint32_t page = 6; page-- > 0;) {
+            for (std::uint32_t i = 0; i < 50; ++i) {
+                log.push_back(
+                    {OLM_TRACE_GROUP_DECRYPT, session, 300, page * 50 + i}
+                );
+            }
+        }
+    }
+
+    /* a busy room, between bursts of room keys shared over Olm */
+    std::uint64_t room_out = next_session++;
+    std::uint64_t room_in = next_session++;
+    std::uint64_t first_device = next_session;
+    const unsigned devices = 30;
+    next_session += devices;
+    log.push_back({OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION, room_out, 0, 0});
+    log.push_back({OLM_TRACE_INIT_INBOUND_GROUP_SESSION, room_in, 0, 0});
+    for (unsigned device = 0; device < devices; ++device) {
+        log.push_back({
+            OLM_TRACE_CREATE_INBOUND_SESSION, first_device + device, 0, 0
+        });
+        log.push_back({OLM_TRACE_DECRYPT, first_device + device, 250, 0});
+    }
+    std::uint32_t room_index = 0;
+    for (unsigned burst = 0; burst < 20; ++burst) {
+        for (unsigned i = 0; i < 25; ++i) {
+            log.push_back({
+                OLM_TRACE_DECRYPT, first_device + rng() % devices, 250, 0
+            });
+        }
+        for (unsigned i = 0; i < 5; ++i) {
+            log.push_back({
+                OLM_TRACE_ENCRYPT, first_device + rng() % devices, 250, 0
+            });
+        }
+        for (unsigned i = 0; i < 20; ++i) {
+            log.push_back({OLM_TRACE_GROUP_ENCRYPT, room_out, 200, 0});
+            /* now and then a message isn't delivered */
+            room_index += rng() % 10 ? 1 : 1 + rng() % 5;
+            log.push_back({OLM_TRACE_GROUP_DECRYPT, room_in, 200, room_index});
+        }
+    }
+    return log;
+}
+
+/** Number the sessions: a call which creates or initialises a session
+ * starts a new one, even at the address of an old one */
+static std::vector<Call> number_sessions(
+    std::vector<Recorded> const & log, std::size_t & slots
+) {
+    std::vector<Call> calls;
+    std::map<std::uint64_t, std::size_t> current;
+    slots = 0;
+    for (Recorded const & recorded : log) {
+        bool starts = recorded.operation == OLM_TRACE_CREATE_OUTBOUND_SESSION
+            || recorded.operation == OLM_TRACE_CREATE_INBOUND_SESSION
+            || recorded.operation == OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION
+            || recorded.operation == OLM_TRACE_INIT_INBOUND_GROUP_SESSION;
+        if (!current.count(recorded.session)
+                || (starts && !recorded.failed)) {
+            current[recorded.session] = slots++;
+        }
+        calls.push_back({
+            recorded.operation, current[recorded.session],
+            recorded.plaintext_length,
+            recorded.message_index, recorded.failed, 0
+        });
+    }
+
+    std::map<std::size_t, std::size_t> next_plaintext_length;
+    for (std::size_t i = calls.size(); i-- > 0;) {
+        Call & call = calls[i];
+        if (call.failed) {
+            continue;
+        }
+        if (call.operation == OLM_TRACE_DECRYPT) {
+            next_plaintext_length[call.slot] = call.plaintext_length;
+        } else if (call.operation == OLM_TRACE_CREATE_INBOUND_SESSION) {
+            call.next_plaintext_length = next_plaintext_length[call.slot];
+        }
+    }
+    return calls;
+}
+
+
+/* The Olm sessions are all between our account and theirs */
+
+struct Account {
+    std::vector<std::uint8_t> memory;
+    OlmAccount * account;
+    std::string identity_key;
+};
+
+static Account us, them;
+
+static void create_account(Account & account) {
+    account.memory.resize(olm_account_size());
+    account.account = olm_account(account.memory.data());
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_create_account_random_length(account.account)
+    );
+    olm_create_account(account.account, random.data(), random.size());
+    std::vector<std::uint8_t> keys(
+        olm_account_identity_keys_length(account.account)
+    );
+    olm_account_identity_keys(account.account, keys.data(), keys.size());
+    account.identity_key.assign(keys.begin() + 15, keys.begin() + 15 + 43);
+}
+
+static std::string claim_one_time_key(Account & account) {
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_account_generate_one_time_keys_random_length(account.account, 1)
+    );
+    olm_account_generate_one_time_keys(
+        account.account, 1, random.data(), random.size()
+    );
+    std::vector<std::uint8_t> keys(
+        olm_account_one_time_keys_length(account.account)
+    );
+    olm_account_one_time_keys(account.account, keys.data(), keys.size());
+    olm_account_mark_keys_as_published(account.account);
+    std::string json(keys.begin(), keys.end());
+    return json.substr(json.find("\":\"") + 3, 43);
+}
+
+static OlmSession * new_session(std::vector<std::uint8_t> & memory) {
+    memory.assign(olm_session_size(), 0);
+    return olm_session(memory.data());
+}
+
+/** Create an outbound session from one account to the other */
+static std::size_t create_outbound(
+    OlmSession * session, Account & from, Account & to
+) {
+    std::string one_time_key = claim_one_time_key(to);
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_create_outbound_session_random_length(session)
+    );
+    return olm_create_outbound_session(
+        session, from.account,
+        to.identity_key.data(), to.identity_key.size(),
+        one_time_key.data(), one_time_key.size(),
+        random.data(), random.size()
+    );
+}
+
+static std::vector<std::uint8_t> encrypt(
+    OlmSession * session, std::size_t plaintext_length,
+    std::size_t & message_type, unsigned operation = OPERATIONS
+) {
+    std::vector<std::uint8_t> plaintext = random_bytes(plaintext_length);
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_encrypt_random_length(session)
+    );
+    message_type = olm_encrypt_message_type(session);
+    std::vector<std::uint8_t> message(
+        olm_encrypt_message_length(session, plaintext_length)
+    );
+    auto run = [&] {
+        return olm_encrypt(
+            session, plaintext.data(), plaintext.size(),
+            random.data(), random.size(), message.data(), message.size()
+        );
+    };
+    if (operation < OPERATIONS) {
+        timed(operation, run);
+    } else {
+        run();
+    }
+    return message;
+}
+
+static std::size_t decrypt(
+    OlmSession * session, std::size_t message_type,
+    std::vector<std::uint8_t> message, unsigned operation = OPERATIONS
+) {
+    std::vector<std::uint8_t> copy(message);
+    std::size_t max_length = olm_decrypt_max_plaintext_length(
+        session, message_type, copy.data(), copy.size()
+    );
+    std::vector<std::uint8_t> plaintext(max_length);
+    auto run = [&] {
+        return olm_decrypt(
+            session, message_type, message.data(), message.size(),
+            plaintext.data(), plaintext.size()
+        );
+    };
+    return operation < OPERATIONS ? timed(operation, run) : run();
+}
+
+/** Deliver one of our messages to the other end, starting its session if
+ * need be */
+static void peer_receive(
+    Slot & slot, std::size_t message_type,
+    std::vector<std::uint8_t> const & message
+) {
+    if (!slot.peer) {
+        slot.peer = new_session(slot.peer_memory);
+        std::vector<std::uint8_t> copy(message);
+        olm_create_inbound_session(
+            slot.peer, them.account, copy.data(), copy.size()
+        );
+        olm_remove_one_time_keys(them.account, slot.peer);
+    }
+    decrypt(slot.peer, message_type, message);
+}
+
+/** Set up a session with a message each way, for one which the log uses
+ * before creating it */
+static void establish(Slot & slot) {
+    slot.session = new_session(slot.memory);
+    create_outbound(slot.session, us, them);
+    std::size_t message_type;
+    std::vector<std::uint8_t> message = encrypt(slot.session, 1, message_type);
+    peer_receive(slot, message_type, message);
+    message = encrypt(slot.peer, 1, message_type);
+    decrypt(slot.session, message_type, message);
+}
+
+static void replay_olm(Call const & call, Slot & slot) {
+    std::size_t message_type;
+    std::vector<std::uint8_t> message;
+    switch (call.operation) {
+    case OLM_TRACE_CREATE_OUTBOUND_SESSION: {
+        slot.peer = NULL;
+        slot.pending.clear();
+        slot.session = new_session(slot.memory);
+        std::string one_time_key = claim_one_time_key(them);
+        std::vector<std::uint8_t> random = random_bytes(
+            olm_create_outbound_session_random_length(slot.session)
+        );
+        timed(call.operation, [&] {
+            return olm_create_outbound_session(
+                slot.session, us.account,
+                them.identity_key.data(), them.identity_key.size(),
+                one_time_key.data(), one_time_key.size(),
+                random.data(), random.size()
+            );
+        });
+        break;
+    }
+    case OLM_TRACE_CREATE_INBOUND_SESSION: {
+        slot.peer = new_session(slot.peer_memory);
+        create_outbound(slot.peer, them, us);
+        slot.pending = encrypt(
+            slot.peer, call.next_plaintext_length, message_type
+        );
+        slot.session = new_session(slot.memory);
+        std::vector<std::uint8_t> copy(slot.pending);
+        timed(call.operation, [&] {
+            return olm_create_inbound_session(
+                slot.session, us.account, copy.data(), copy.size()
+            );
+        });
+        olm_remove_one_time_keys(us.account, slot.session);
+        break;
+    }
+    case OLM_TRACE_ENCRYPT:
+        if (!slot.session) {
+            establish(slot);
+        }
+        message = encrypt(
+            slot.session, call.plaintext_length, message_type, call.operation
+        );
+        peer_receive(slot, message_type, message);
+        break;
+    case OLM_TRACE_DECRYPT:
+        if (!slot.session) {
+            establish(slot);
+        }
+        if (!slot.pending.empty()) {
+            message.swap(slot.pending);
+            message_type = OLM_MESSAGE_TYPE_PRE_KEY;
+        } else {
+            if (!slot.peer) {
+                /* they can't answer until they have heard from us */
+                message = encrypt(slot.session, 1, message_type);
+                peer_receive(slot, message_type, message);
+            }
+            message = encrypt(slot.peer, call.plaintext_length, message_type);
+        }
+        decrypt(slot.session, message_type, message, call.operation);
+        break;
+    }
+}
+
+
+static std::vector<std::uint8_t> group_encrypt(
+    OlmOutboundGroupSession * session, std::size_t plaintext_length
+) {
+    std::vector<std::uint8_t> plaintext = random_bytes(plaintext_length);
+    std::vector<std::uint8_t> message(
+        olm_group_encrypt_message_length(session, plaintext_length)
+    );
+    olm_group_encrypt(
+        session, plaintext.data(), plaintext.size(),
+        message.data(), message.size()
+    );
+    return message;
+}
+
+static OlmOutboundGroupSession * new_outbound(
+    std::vector<std::uint8_t> & memory
+) {
+    memory.resize(olm_outbound_group_session_size());
+    OlmOutboundGroupSession * session = olm_outbound_group_session(
+        memory.data()
+    );
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_init_outbound_group_session_random_length(session)
+    );
+    olm_init_outbound_group_session(session, random.data(), random.size());
+    return session;
+}
+
+/** Encrypt the messages an inbound session will decrypt, and take the
+ * session key at its first index. The sender has to go through every index
+ * up to the last, so long gaps take a while to set up. */
+static void prepare_inbound(Slot & slot) {
+    if (slot.needed.empty() && !slot.has_first_index) {
+        return;
+    }
+    std::uint32_t first = slot.has_first_index
+        ? slot.first_index : slot.needed.begin()->first;
+    std::uint32_t last = std::max(
+        first, slot.needed.empty() ? 0 : slot.needed.rbegin()->first
+    );
+    std::vector<std::uint8_t> memory;
+    OlmOutboundGroupSession * sender = new_outbound(memory);
+    for (std::uint32_t index = 0;; ++index) {
+        if (index == first) {
+            slot.session_key.resize(
+                olm_outbound_group_session_key_length(sender)
+            );
+            olm_outbound_group_session_key(
+                sender, slot.session_key.data(), slot.session_key.size()
+            );
+        }
+        auto found = slot.needed.find(index);
+        std::vector<std::uint8_t> message = group_encrypt(
+            sender, found == slot.needed.end() ? 1 : found->second
+        );
+        if (found != slot.needed.end()) {
+            slot.messages[index].swap(message);
+        }
+        if (index == last) {
+            break;
+        }
+    }
+    olm_clear_outbound_group_session(sender);
+}
+
+static void replay_group(Call const & call, Slot & slot) {
+    switch (call.operation) {
+    case OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION: {
+        slot.memory.resize(olm_outbound_group_session_size());
+        slot.outbound = olm_outbound_group_session(slot.memory.data());
+        std::vector<std::uint8_t> random = random_bytes(
+            olm_init_outbound_group_session_random_length(slot.outbound)
+        );
+        timed(call.operation, [&] {
+            return olm_init_outbound_group_session(
+                slot.outbound, random.data(), random.size()
+            );
+        });
+        break;
+    }
+    case OLM_TRACE_GROUP_ENCRYPT: {
+        if (!slot.outbound) {
+            slot.outbound = new_outbound(slot.memory);
+        }
+        std::vector<std::uint8_t> plaintext = random_bytes(
+            call.plaintext_length
+        );
+        std::vector<std::uint8_t> message(olm_group_encrypt_message_length(
+            slot.outbound, call.plaintext_length
+        ));
+        timed(call.operation, [&] {
+            return olm_group_encrypt(
+                slot.outbound, plaintext.data(), plaintext.size(),
+                message.data(), message.size()
+            );
+        });
+        break;
+    }
+    case OLM_TRACE_INIT_INBOUND_GROUP_SESSION:
+    case OLM_TRACE_GROUP_DECRYPT: {
+        bool init = call.operation == OLM_TRACE_INIT_INBOUND_GROUP_SESSION;
+        if (init || !slot.inbound) {
+            slot.memory.resize(olm_inbound_group_session_size());
+            slot.inbound = olm_inbound_group_session(slot.memory.data());
+            std::vector<std::uint8_t> key(slot.session_key);
+            auto run = [&] {
+                return olm_init_inbound_group_session(
+                    slot.inbound, key.data(), key.size()
+                );
+            };
+            if (init) {
+                timed(call.operation, run);
+                break;
+            }
+            run();
+        }
+        std::vector<std::uint8_t> message(slot.messages[call.message_index]);
+        std::vector<std::uint8_t> plaintext(message.size());
+        std::uint32_t message_index;
+        timed(call.operation, [&] {
+            return olm_group_decrypt(
+                slot.inbound, message.data(), message.size(),
+                plaintext.data(), plaintext.size(), &message_index
+            );
+        });
+        break;
+    }
+    }
+}
+
+
+int main() {
+    char const * path = std::getenv("OLM_REPLAY_FILE");
+    std::vector<Recorded> log = path ? read_log(path) : builtin_log();
+    std::size_t slot_count;
+    std::vector<Call> calls = number_sessions(log, slot_count);
+    std::vector<Slot> slots(slot_count);
+
+    std::size_t failed = 0;
+    for (Call const & call : calls) {
+        Slot & slot = slots[call.slot];
+        if (call.failed) {
+            ++failed;
+        } else if (call.operation == OLM_TRACE_GROUP_DECRYPT) {
+            slot.needed.insert(
+                std::make_pair(call.message_index, call.plaintext_length)
+            );
+        } else if (call.operation == OLM_TRACE_INIT_INBOUND_GROUP_SESSION) {
+            slot.has_first_index = true;
+            slot.first_index = call.message_index;
+        }
+    }
+    for (Slot & slot : slots) {
+        prepare_inbound(slot);
+    }
+    create_account(us);
+    create_account(them);
+
+    for (Call const & call : calls) {
+        if (call.failed) {
+            continue;
+        }
+        if (call.operation <= OLM_TRACE_DECRYPT) {
+            replay_olm(call, slots[call.slot]);
+        } else {
+            replay_group(call, slots[call.slot]);
+        }
+    }
+
+    double seconds = 0;
+    std::size_t replayed = 0;
+    for (auto const & samples : times) {
+        for (double time : samples) {
+            seconds += time * 1e-9;
+        }
+        replayed += samples.size();
+    }
+    benchmark_count("replay sessions", slot_count);
+    benchmark_count("replay failed calls skipped", failed);
+    benchmark_count("replay calls which failed", replay_failures);
+    benchmark_rate("replay calls", replayed, seconds);
+    for (std::size_t operation = 0; operation < OPERATIONS; ++operation) {
+        if (!times[operation].empty()) {
+            benchmark_percentiles(NAMES[operation], times[operation]);
+        }
+    }
+}
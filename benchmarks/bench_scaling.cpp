@@ -0,0 +1,530 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/executor.h"
+#include "olm/inbound_group_session.h"
+#include "olm/olm.h"
+#include "olm/outbound_group_session.h"
+#include "olm/pool.h"
+
+#include "benchmark.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+/* How the functions that hand their work to an executor scale with the
+ * threads behind it: decrypting the messages of many group sessions,
+ * loading a batch of pickled sessions, sending a room key to many devices
+ * and generating one time keys for many accounts. Each is run with 1, 2, 4
+ * ... threads up to the number the machine has, on the library's work pool
+ * and on an executor of the kind an application brings, and reports the
+ * throughput, the efficiency against one thread of the same executor, and
+ * how the jobs were shared out. OLM_BENCH_MAX_THREADS sets a different
+ * number of threads to go up to. */
+
+static const std::size_t GROUP_SESSIONS = 64;
+static const std::size_t MESSAGES_PER_SESSION = 16;
+static const std::size_t GROUP_MESSAGES =
+    GROUP_SESSIONS * MESSAGES_PER_SESSION;
+static const std::size_t PICKLED_SESSIONS = 1024;
+static const std::size_t SESSIONS_PER_JOB = 64;
+static const std::size_t DEVICES = 256;
+static const std::size_t ACCOUNTS = 64;
+static const std::size_t KEYS_PER_ACCOUNT = 16;
+
+/**
+ * A fixed set of threads taking jobs with an atomic counter rather than
+ * under a lock, as an application's own pool might. Only one batch runs at a
+ * time; the thread that starts it runs jobs too.
+ */
+struct ExternalPool {
+    struct Batch {
+        OlmBatchJob job;
+        void * job_context;
+        std::size_t job_count;
+        std::atomic<std::size_t> next_job;
+        std::atomic<std::size_t> finished_jobs;
+        /** the workers still in the batch, changed with the lock held */
+        std::size_t helpers;
+    };
+
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable finished;
+    Batch * batch = nullptr;
+    std::uint64_t generation = 0;
+    bool stopped = false;
+    std::vector<std::thread> threads;
+
+    std::atomic<std::uint64_t> jobs{0};
+    std::atomic<std::uint64_t> jobs_run_by_workers{0};
+    std::atomic<std::uint64_t> finish_waits{0};
+
+    explicit ExternalPool(std::size_t worker_count) {
+        for (std::size_t i = 0; i < worker_count; ++i) {
+            threads.emplace_back([this] { run_worker(); });
+        }
+    }
+
+    ~ExternalPool() {
+        {
+            std::lock_guard<std::mutex> held(lock);
+            stopped = true;
+        }
+        work.notify_all();
+        for (std::thread & thread : threads) {
+            thread.join();
+        }
+    }
+
+    void run_jobs(Batch & batch, bool worker) {
+        std::size_t job;
+        while ((job = batch.next_job++) < batch.job_count) {
+            batch.job(batch.job_context, job);
+            batch.finished_jobs++;
+            if (worker) {
+                jobs_run_by_workers++;
+            }
+        }
+    }
+
+    void run_worker() {
+        std::uint64_t seen = 0;
+        std::unique_lock<std::mutex> held(lock);
+        for (;;) {
+            work.wait(held, [&] {
+                return stopped || (batch && generation != seen);
+            });
+            if (stopped) {
+                return;
+            }
+            seen = generation;
+            Batch & current = *batch;
+            current.helpers++;
+            held.unlock();
+            run_jobs(current, true);
+            held.lock();
+            if (--current.helpers == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+
+    static void executor(
+        void * context,
+        OlmBatchJob job, void * job_context, std::size_t job_count
+    ) {
+        ExternalPool & pool = *static_cast<ExternalPool *>(context);
+        Batch batch;
+        batch.job = job;
+        batch.job_context = job_context;
+        batch.job_count = job_count;
+        batch.next_job = 0;
+        batch.finished_jobs = 0;
+        batch.helpers = 0;
+        pool.jobs += job_count;
+
+        {
+            std::lock_guard<std::mutex> held(pool.lock);
+            pool.batch = &batch;
+            pool.generation++;
+        }
+        pool.work.notify_all();
+        pool.run_jobs(batch, false);
+
+        std::unique_lock<std::mutex> held(pool.lock);
+        if (batch.finished_jobs < job_count || batch.helpers) {
+            pool.finish_waits++;
+        }
+        pool.finished.wait(held, [&] {
+            return batch.finished_jobs == job_count && batch.helpers == 0;
+        });
+        pool.batch = nullptr;
+    }
+};
+
+/** The library's work pool, with worker_count threads working for it */
+struct LibraryPool {
+    std::vector<std::uint8_t> memory;
+    OlmWorkPool * pool;
+    std::vector<std::thread> threads;
+
+    explicit LibraryPool(std::size_t worker_count)
+        : memory(olm_work_pool_size()), pool(olm_work_pool(memory.data())) {
+        for (std::size_t i = 0; i < worker_count; ++i) {
+            threads.emplace_back(olm_work_pool_work, pool);
+        }
+    }
+
+    ~LibraryPool() {
+        olm_work_pool_stop(pool);
+        for (std::thread & thread : threads) {
+            thread.join();
+        }
+        olm_clear_work_pool(pool);
+    }
+};
+
+/* batch group decryption */
+static std::vector<std::vector<std::uint8_t>> pristine_buffers(GROUP_SESSIONS);
+static std::vector<std::vector<std::uint8_t>> inbound_buffers(GROUP_SESSIONS);
+static std::vector<OlmInboundGroupSession *> pristine(GROUP_SESSIONS);
+static std::vector<OlmInboundGroupSession *> message_sessions(GROUP_MESSAGES);
+static std::vector<std::vector<std::uint8_t>> group_messages(GROUP_MESSAGES);
+static std::vector<std::vector<std::uint8_t>> work(GROUP_MESSAGES);
+static std::vector<std::uint8_t *> work_ptrs(GROUP_MESSAGES);
+static std::vector<std::size_t> work_lengths(GROUP_MESSAGES);
+static std::vector<std::vector<std::uint8_t>> outputs(GROUP_MESSAGES);
+static std::vector<std::uint8_t *> output_ptrs(GROUP_MESSAGES);
+static std::vector<std::size_t> output_lengths(GROUP_MESSAGES);
+static std::vector<std::size_t> plaintext_lengths(GROUP_MESSAGES);
+static std::vector<std::size_t> decrypt_scratch;
+
+/* bulk unpickling */
+static std::vector<std::vector<std::uint8_t>> loaded_buffers(PICKLED_SESSIONS);
+static std::vector<OlmInboundGroupSession *> loaded(PICKLED_SESSIONS);
+static std::vector<std::uint8_t> pickled_batch;
+static std::vector<std::uint8_t> unpickle_scratch;
+static std::vector<std::uint8_t> pickle_key_buffer;
+static OlmPickleKey * pickle_key;
+
+/* fan-out encryption */
+static std::vector<std::uint8_t> sender_buffer;
+static OlmAccount * sender;
+static std::vector<std::uint8_t> device_id_keys, device_ot_keys;
+static std::vector<void const *> id_key_ptrs(DEVICES);
+static std::vector<void const *> ot_key_ptrs(DEVICES);
+static std::vector<std::size_t> key_lengths(DEVICES, 43);
+static std::uint8_t room_key[100];
+static std::vector<std::uint8_t> fan_out_random;
+static std::vector<std::uint8_t> slab_memory;
+static OlmAllocator allocator;
+static std::vector<OlmSession *> device_sessions(DEVICES);
+static std::vector<std::uint8_t> device_messages;
+static std::vector<std::size_t> device_message_lengths(DEVICES);
+
+/* key generation */
+static std::vector<std::vector<std::uint8_t>> account_buffers(ACCOUNTS);
+static std::vector<OlmAccount *> accounts(ACCOUNTS);
+static std::vector<std::vector<std::uint8_t>> key_randoms(ACCOUNTS);
+
+static void decrypt_group_messages(OlmBatchExecutor executor, void * context) {
+    std::vector<OlmInboundGroupSession *> sessions(GROUP_SESSIONS);
+    for (std::size_t i = 0; i < GROUP_SESSIONS; ++i) {
+        sessions[i] = olm_inbound_group_session_copy(
+            inbound_buffers[i].data(), pristine[i]
+        );
+    }
+    for (std::size_t i = 0; i < GROUP_MESSAGES; ++i) {
+        std::memcpy(work[i].data(), group_messages[i].data(), work[i].size());
+    }
+    olm_group_decrypt_across_sessions(
+        message_sessions.data(), GROUP_MESSAGES,
+        work_ptrs.data(), work_lengths.data(),
+        output_ptrs.data(), output_lengths.data(), plaintext_lengths.data(),
+        nullptr, nullptr, decrypt_scratch.data(), decrypt_scratch.size(),
+        executor, context
+    );
+}
+
+static void unpickle_job(void *, std::size_t job) {
+    olm_unpickle_inbound_group_session_batch(
+        pickle_key, unpickle_scratch.data(), unpickle_scratch.size(),
+        job * SESSIONS_PER_JOB, &loaded[job * SESSIONS_PER_JOB],
+        SESSIONS_PER_JOB
+    );
+}
+
+static void unpickle_sessions(OlmBatchExecutor executor, void * context) {
+    unpickle_scratch = pickled_batch;
+    executor(
+        context, unpickle_job, nullptr, PICKLED_SESSIONS / SESSIONS_PER_JOB
+    );
+}
+
+static void send_room_key(OlmBatchExecutor executor, void * context) {
+    olm_create_outbound_sessions_and_encrypt(
+        sender, DEVICES,
+        id_key_ptrs.data(), key_lengths.data(),
+        ot_key_ptrs.data(), key_lengths.data(),
+        room_key, sizeof(room_key),
+        fan_out_random.data(), fan_out_random.size(),
+        &allocator, device_sessions.data(),
+        device_messages.data(), device_messages.size(),
+        device_message_lengths.data(), nullptr, executor, context
+    );
+    for (std::size_t i = 0; i < DEVICES; ++i) {
+        olm_release_session(&allocator, device_sessions[i]);
+    }
+}
+
+static void generate_keys_job(void *, std::size_t job) {
+    olm_account_generate_one_time_keys(
+        accounts[job], KEYS_PER_ACCOUNT,
+        key_randoms[job].data(), key_randoms[job].size()
+    );
+}
+
+static void generate_keys(OlmBatchExecutor executor, void * context) {
+    executor(context, generate_keys_job, nullptr, ACCOUNTS);
+}
+
+static void setup_group_sessions() {
+    std::vector<std::uint8_t> outbound_buffer(
+        olm_outbound_group_session_size()
+    );
+    std::uint8_t plaintext[100];
+    std::memset(plaintext, 'x', sizeof(plaintext));
+    for (std::size_t i = 0; i < GROUP_SESSIONS; ++i) {
+        OlmOutboundGroupSession * outbound =
+            olm_outbound_group_session(outbound_buffer.data());
+        std::vector<std::uint8_t> random(
+            olm_init_outbound_group_session_random_length(outbound)
+        );
+        for (std::size_t j = 0; j < random.size(); ++j) {
+            random[j] = std::uint8_t(i * 13 + j);
+        }
+        olm_init_outbound_group_session(
+            outbound, random.data(), random.size()
+        );
+        std::vector<std::uint8_t> session_key(
+            olm_outbound_group_session_key_length(outbound)
+        );
+        olm_outbound_group_session_key(
+            outbound, session_key.data(), session_key.size()
+        );
+        pristine_buffers[i].resize(olm_inbound_group_session_size());
+        inbound_buffers[i].resize(olm_inbound_group_session_size());
+        pristine[i] = olm_inbound_group_session(pristine_buffers[i].data());
+        olm_init_inbound_group_session(
+            pristine[i], session_key.data(), session_key.size()
+        );
+        /* the messages of each room are interleaved, as in a sync */
+        for (std::size_t j = 0; j < MESSAGES_PER_SESSION; ++j) {
+            std::size_t m = j * GROUP_SESSIONS + i;
+            group_messages[m].resize(olm_group_encrypt_message_length(
+                outbound, sizeof(plaintext)
+            ));
+            olm_group_encrypt(
+                outbound, plaintext, sizeof(plaintext),
+                group_messages[m].data(), group_messages[m].size()
+            );
+            message_sessions[m] = reinterpret_cast<OlmInboundGroupSession *>(
+                inbound_buffers[i].data()
+            );
+            work[m].resize(group_messages[m].size());
+            work_ptrs[m] = work[m].data();
+            work_lengths[m] = work[m].size();
+            outputs[m].resize(group_messages[m].size());
+            output_ptrs[m] = outputs[m].data();
+            output_lengths[m] = outputs[m].size();
+        }
+        olm_clear_outbound_group_session(outbound);
+    }
+    decrypt_scratch.resize(
+        olm_group_decrypt_across_sessions_scratch_length(GROUP_MESSAGES)
+    );
+
+    /* the same sessions, sixteen times over, as a pickled batch */
+    for (std::size_t i = 0; i < PICKLED_SESSIONS; ++i) {
+        loaded_buffers[i].resize(olm_inbound_group_session_size());
+        loaded[i] = olm_inbound_group_session_copy(
+            loaded_buffers[i].data(), pristine[i % GROUP_SESSIONS]
+        );
+    }
+    pickle_key_buffer.resize(olm_pickle_key_size());
+    pickle_key = olm_pickle_key(pickle_key_buffer.data(), "secret_key", 10);
+    pickled_batch.resize(olm_pickle_inbound_group_session_batch_length(
+        loaded.data(), PICKLED_SESSIONS
+    ));
+    olm_pickle_inbound_group_session_batch(
+        pickle_key, loaded.data(), PICKLED_SESSIONS,
+        pickled_batch.data(), pickled_batch.size()
+    );
+}
+
+static OlmAccount * create_account(
+    std::vector<std::uint8_t> & buffer, std::uint8_t seed
+) {
+    buffer.resize(olm_account_size());
+    OlmAccount * account = olm_account(buffer.data());
+    std::vector<std::uint8_t> random(
+        olm_create_account_random_length(account), seed
+    );
+    olm_create_account(account, random.data(), random.size());
+    return account;
+}
+
+static void setup_accounts() {
+    sender = create_account(sender_buffer, 1);
+    std::vector<std::uint8_t> device_buffer;
+    OlmAccount * device = create_account(device_buffer, 2);
+    std::vector<std::uint8_t> random(
+        olm_account_generate_one_time_keys_random_length(device, 1), 3
+    );
+    olm_account_generate_one_time_keys(
+        device, 1, random.data(), random.size()
+    );
+    device_id_keys.resize(olm_account_identity_keys_length(device));
+    olm_account_identity_keys(
+        device, device_id_keys.data(), device_id_keys.size()
+    );
+    device_ot_keys.resize(olm_account_one_time_keys_length(device));
+    olm_account_one_time_keys(
+        device, device_ot_keys.data(), device_ot_keys.size()
+    );
+    /* every device has the same keys, which costs the sender the same */
+    for (std::size_t i = 0; i < DEVICES; ++i) {
+        id_key_ptrs[i] = device_id_keys.data() + 15;
+        ot_key_ptrs[i] = device_ot_keys.data() + 25;
+    }
+    std::memset(room_key, 'k', sizeof(room_key));
+    fan_out_random.assign(
+        olm_create_outbound_sessions_and_encrypt_random_length(DEVICES), 4
+    );
+    slab_memory.resize(olm_slab_size(olm_session_size(), DEVICES));
+    olm_slab_allocator(
+        olm_slab(slab_memory.data(), olm_session_size(), DEVICES), &allocator
+    );
+    device_messages.resize(
+        DEVICES * olm_create_outbound_sessions_and_encrypt_message_length(
+            sizeof(room_key)
+        )
+    );
+
+    for (std::size_t i = 0; i < ACCOUNTS; ++i) {
+        accounts[i] = create_account(account_buffers[i], std::uint8_t(i));
+        key_randoms[i].assign(
+            olm_account_generate_one_time_keys_random_length(
+                accounts[i], KEYS_PER_ACCOUNT
+            ),
+            std::uint8_t(i)
+        );
+    }
+}
+
+/** How a run's jobs were shared out */
+struct JobCounts {
+    std::uint64_t jobs;
+    std::uint64_t jobs_run_by_workers;
+    std::uint64_t lock_contentions;
+    std::uint64_t finish_waits;
+};
+
+static void print_scaling(
+    char const * name, double ops_per_s, double efficiency,
+    JobCounts const & counts
+) {
+    if (benchmark_json()) {
+        benchmark_print_json_name(name);
+        std::cout << std::fixed << std::setprecision(3)
+            << ", \"ops_per_s\": " << ops_per_s
+            << ", \"efficiency\": " << efficiency
+            << ", \"jobs\": " << counts.jobs
+            << ", \"jobs_run_by_workers\": " << counts.jobs_run_by_workers
+            << ", \"lock_contentions\": " << counts.lock_contentions
+            << ", \"finish_waits\": " << counts.finish_waits
+            << "}" << std::endl;
+        return;
+    }
+    double shared = counts.jobs
+        ? 100.0 * counts.jobs_run_by_workers / counts.jobs : 0;
+    std::cout << std::left << std::setw(40) << name << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << ops_per_s << " ops/s"
+        << std::setw(7) << efficiency * 100 << "% eff"
+        << std::setw(7) << shared << "% on workers"
+        << std::setw(8) << counts.lock_contentions << " contended"
+        << std::setw(8) << counts.finish_waits << " waits" << std::endl;
+}
+
+struct Scenario {
+    char const * name;
+    /** the operations each call does, for the throughput */
+    std::size_t operations;
+    void (*run)(OlmBatchExecutor executor, void * context);
+};
+
+int main() {
+    setup_group_sessions();
+    setup_accounts();
+
+    Scenario const scenarios[] = {
+        {"group decrypt", GROUP_MESSAGES, decrypt_group_messages},
+        {"unpickle", PICKLED_SESSIONS, unpickle_sessions},
+        {"fan-out encrypt", DEVICES, send_room_key},
+        {"key generation", ACCOUNTS * KEYS_PER_ACCOUNT, generate_keys},
+    };
+    std::vector<std::size_t> thread_counts;
+    std::size_t max_threads = std::thread::hardware_concurrency();
+    if (char const * max = std::getenv("OLM_BENCH_MAX_THREADS")) {
+        max_threads = std::strtoul(max, nullptr, 10);
+    }
+    max_threads = std::max(max_threads, std::size_t(1));
+    for (std::size_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    for (Scenario const & scenario : scenarios) {
+        double single[2] = {0, 0};
+        for (std::size_t threads : thread_counts) {
+            for (int external = 0; external < 2; ++external) {
+                char name[64];
+                std::snprintf(
+                    name, sizeof(name), "%s, %zu threads, %s",
+                    scenario.name, threads, external ? "external" : "pool"
+                );
+                /* the thread running the benchmark is one of them */
+                JobCounts counts;
+                double ns_per_op;
+                if (external) {
+                    ExternalPool pool(threads - 1);
+                    ns_per_op = benchmark_ns([&] {
+                        scenario.run(ExternalPool::executor, &pool);
+                    });
+                    counts.jobs = pool.jobs;
+                    counts.jobs_run_by_workers = pool.jobs_run_by_workers;
+                    counts.lock_contentions = 0;
+                    counts.finish_waits = pool.finish_waits;
+                } else {
+                    LibraryPool pool(threads - 1);
+                    ns_per_op = benchmark_ns([&] {
+                        scenario.run(olm_work_pool_executor, pool.pool);
+                    });
+                    OlmWorkPoolStats stats;
+                    olm_work_pool_stats(pool.pool, &stats);
+                    counts.jobs = stats.jobs;
+                    counts.jobs_run_by_workers = stats.jobs_run_by_workers;
+                    counts.lock_contentions = stats.lock_contentions;
+                    counts.finish_waits = stats.finish_waits;
+                }
+                double ops_per_s = scenario.operations * 1e9 / ns_per_op;
+                if (threads == 1) {
+                    single[external] = ops_per_s;
+                }
+                print_scaling(
+                    name, ops_per_s, ops_per_s / (threads * single[external]),
+                    counts
+                );
+            }
+        }
+    }
+
+    olm_clear_pickle_key(pickle_key);
+    return 0;
+}
@@ -0,0 +1,110 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+
+#include "benchmark.hh"
+
+#include <cstring>
+#include <vector>
+
+/* Reviving an idle session from a base64 pickle, which derives the pickle
+ * keys and decodes the base64 each time, against waking it from a
+ * hibernated blob under a pickle key derived once. The receiver has a few
+ * skipped message keys so that the session isn't trivially small. */
+
+static std::vector<std::uint8_t> session_buffer;
+static OlmSession * session;
+static std::vector<std::uint8_t> pickled;
+static std::vector<std::uint8_t> sealed;
+static std::vector<std::uint8_t> input;
+static std::vector<std::uint8_t> key_buffer;
+static OlmPickleKey * pickle_key;
+
+int main() {
+    std::vector<std::uint8_t> a_account_buffer(olm_account_size());
+    OlmAccount * a_account = olm_account(a_account_buffer.data());
+    std::vector<std::uint8_t> random(olm_create_account_random_length(a_account), 1);
+    olm_create_account(a_account, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_account_buffer(olm_account_size());
+    OlmAccount * b_account = olm_account(b_account_buffer.data());
+    random.assign(olm_create_account_random_length(b_account), 2);
+    olm_create_account(b_account, random.data(), random.size());
+    random.assign(olm_account_generate_one_time_keys_random_length(b_account, 1), 3);
+    olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(b_account));
+    olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+    std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(b_account));
+    olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+    std::vector<std::uint8_t> a_session_buffer(olm_session_size());
+    OlmSession * a_session = olm_session(a_session_buffer.data());
+    random.assign(olm_create_outbound_session_random_length(a_session), 4);
+    olm_create_outbound_session(
+        a_session, a_account,
+        b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+        random.data(), random.size()
+    );
+
+    std::uint8_t plaintext[100];
+    std::memset(plaintext, 'x', sizeof(plaintext));
+    std::vector<std::vector<std::uint8_t>> messages(10);
+    for (auto & m : messages) {
+        m.resize(olm_encrypt_message_length(a_session, sizeof(plaintext)));
+        olm_encrypt(
+            a_session, plaintext, sizeof(plaintext), NULL, 0,
+            m.data(), m.size()
+        );
+    }
+
+    session_buffer.resize(olm_session_size());
+    session = olm_session(session_buffer.data());
+    input = messages[0];
+    olm_create_inbound_session(
+        session, b_account, input.data(), input.size()
+    );
+    std::uint8_t output[200];
+    input = messages.back();
+    olm_decrypt(session, 0, input.data(), input.size(), output, sizeof(output));
+
+    pickled.resize(olm_pickle_session_length(session));
+    olm_pickle_session(session, "secret_key", 10, pickled.data(), pickled.size());
+
+    key_buffer.resize(olm_pickle_key_size());
+    pickle_key = olm_pickle_key(key_buffer.data(), "secret_key", 10);
+    sealed.resize(olm_session_hibernate_length(session));
+    olm_session_hibernate(session, pickle_key, sealed.data(), sealed.size());
+
+    /* each is loaded into a freshly cleared session */
+    benchmark("olm_unpickle_session", 0, [] {
+        olm_clear_session(session);
+        input = pickled;
+        olm_unpickle_session(
+            session, "secret_key", 10, input.data(), input.size()
+        );
+    });
+    benchmark("olm_session_wake", 0, [] {
+        olm_clear_session(session);
+        input = sealed;
+        olm_session_wake(session, pickle_key, input.data(), input.size());
+    });
+    benchmark("olm_session_hibernate then wake", 0, [] {
+        olm_session_hibernate(
+            session, pickle_key, input.data(), input.size()
+        );
+        olm_session_wake(session, pickle_key, input.data(), input.size());
+    });
+}
@@ -0,0 +1,58 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "olm/pool.h"
+
+#include "benchmark.hh"
+
+#include <cstdio>
+
+/* The memory a large number of idle sessions takes, with and without their
+ * skipped message keys kept out of line. Most sessions have no skipped
+ * keys, so the compact ones only need room for the few that do. */
+
+static const std::size_t SESSION_COUNT = 100000;
+static const std::size_t WITH_SKIPPED_KEYS[] = {0, 1000, 10000};
+
+int main() {
+    std::size_t session = olm_session_size();
+    std::size_t compact = olm_compact_session_size();
+    std::size_t skipped = olm_compact_session_skipped_key_size();
+
+    benchmark_size("olm_session_size", session);
+    benchmark_size("olm_compact_session_size", compact);
+    benchmark_size("olm_compact_session_skipped_key_size", skipped);
+    benchmark_size(
+        "olm_session_size_with_limits(5, 0)",
+        olm_session_size_with_limits(5, 0)
+    );
+
+    for (std::size_t with_keys : WITH_SKIPPED_KEYS) {
+        char name[64];
+        std::snprintf(
+            name, sizeof(name), "%zu sessions, %zu with keys",
+            SESSION_COUNT, with_keys
+        );
+        benchmark_size(name, SESSION_COUNT * session);
+        std::snprintf(
+            name, sizeof(name), "%zu compact sessions, %zu with keys",
+            SESSION_COUNT, with_keys
+        );
+        benchmark_size(
+            name,
+            SESSION_COUNT * compact + olm_slab_size(skipped, with_keys)
+        );
+    }
+}
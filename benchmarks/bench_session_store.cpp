@@ -0,0 +1,154 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/outbound_group_session.h"
+
+#include "benchmark.hh"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+/* Many threads looking sessions up in one group session store while another
+ * keeps replacing sessions, as decrypt workers sharing a registry do, with
+ * the lock-free lookup and with every call behind one mutex. */
+
+static const std::size_t SESSION_COUNT = 4096;
+static const std::size_t LOOKUPS_PER_THREAD = 200000;
+
+static OlmGroupSessionStore * store;
+static std::vector<std::vector<std::uint8_t>> ids;
+static std::vector<std::vector<std::uint8_t>> session_keys;
+static std::mutex store_mutex;
+
+static OlmInboundGroupSession * add_session(std::size_t i) {
+    OlmInboundGroupSession * session = olm_group_session_store_add(store);
+    if (!session) {
+        /* the room of the sessions replaced last is still being read */
+        return nullptr;
+    }
+    olm_init_inbound_group_session(
+        session, session_keys[i].data(), session_keys[i].size()
+    );
+    olm_group_session_store_commit(store, session);
+    return session;
+}
+
+/** The time per lookup over all the threads, in nanoseconds */
+static double run(std::size_t thread_count, bool locked) {
+    std::atomic<bool> done(false);
+    std::atomic<std::size_t> found(0);
+    std::thread writer([&] {
+        /* replace a session every so often, as new room keys arrive */
+        for (std::size_t i = 0; !done.load(); i = (i + 1) % SESSION_COUNT) {
+            std::lock_guard<std::mutex> guard(store_mutex);
+            add_session(i);
+        }
+    });
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    std::vector<std::thread> readers;
+    for (std::size_t t = 0; t < thread_count; ++t) {
+        readers.emplace_back([&, t] {
+            std::size_t hits = 0;
+            std::size_t i = t * 977;
+            for (std::size_t n = 0; n < LOOKUPS_PER_THREAD; ++n) {
+                i = (i + 2654435761u) % SESSION_COUNT;
+                if (locked) {
+                    std::lock_guard<std::mutex> guard(store_mutex);
+                    hits += olm_group_session_store_find(
+                        store, ids[i].data(), ids[i].size()
+                    ) != nullptr;
+                } else {
+                    std::size_t ticket =
+                        olm_group_session_store_read_begin(store);
+                    hits += olm_group_session_store_lookup(
+                        store, ids[i].data(), ids[i].size()
+                    ) != nullptr;
+                    olm_group_session_store_read_end(store, ticket);
+                }
+            }
+            found += hits;
+        });
+    }
+    for (std::thread & reader : readers) {
+        reader.join();
+    }
+    double elapsed =
+        std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    done = true;
+    writer.join();
+    return elapsed / (thread_count * LOOKUPS_PER_THREAD);
+}
+
+int main() {
+    /* room for a few replacements that are still being read */
+    std::size_t capacity = SESSION_COUNT + 64;
+    std::vector<std::uint8_t> memory(olm_group_session_store_size(capacity));
+    store = olm_group_session_store(memory.data(), capacity);
+    std::vector<std::uint8_t> outbound_memory(
+        olm_outbound_group_session_size()
+    );
+    ids.resize(SESSION_COUNT);
+    session_keys.resize(SESSION_COUNT);
+    for (std::size_t i = 0; i < SESSION_COUNT; ++i) {
+        OlmOutboundGroupSession * outbound =
+            olm_outbound_group_session(outbound_memory.data());
+        std::vector<std::uint8_t> random(
+            olm_init_outbound_group_session_random_length(outbound)
+        );
+        for (std::size_t j = 0; j < random.size(); ++j) {
+            random[j] = std::uint8_t(i * 31 + j * 7 + (i >> 8));
+        }
+        olm_init_outbound_group_session(
+            outbound, random.data(), random.size()
+        );
+        session_keys[i].resize(
+            olm_outbound_group_session_key_length(outbound)
+        );
+        olm_outbound_group_session_key(
+            outbound, session_keys[i].data(), session_keys[i].size()
+        );
+        ids[i].resize(32);
+        olm_inbound_group_session_id_binary(
+            add_session(i), ids[i].data(), ids[i].size()
+        );
+    }
+
+    std::size_t const thread_counts[] = {1, 4, 32};
+    for (std::size_t thread_count : thread_counts) {
+        for (bool locked : {false, true}) {
+            char name[64];
+            std::snprintf(
+                name, sizeof(name), "lookup, %zu threads%s",
+                thread_count, locked ? ", mutex" : ""
+            );
+            double ns_per_op = run(thread_count, locked);
+            if (benchmark_json()) {
+                benchmark_print_json_name(name);
+                std::cout << std::fixed << std::setprecision(1)
+                    << ", \"ns_per_op\": " << ns_per_op << "}" << std::endl;
+            } else {
+                std::cout << std::left << std::setw(40) << name << std::right
+                    << std::fixed << std::setprecision(1)
+                    << std::setw(12) << ns_per_op << " ns/op" << std::endl;
+            }
+        }
+    }
+    olm_clear_group_session_store(store);
+    return 0;
+}
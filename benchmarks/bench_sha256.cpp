@@ -0,0 +1,100 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/cpu.h"
+#include "olm/crypto.h"
+#include "olm/sha256_hw.h"
+
+#include "benchmark.hh"
+
+#include <string>
+
+static std::uint8_t input[16384];
+static std::uint8_t output[SHA256_OUTPUT_LENGTH];
+
+static void run(char const * backend) {
+    static const std::size_t lengths[] = {32, 64, 1024, 16384};
+    for (std::size_t length : lengths) {
+        std::string name = std::string("sha256/") + std::to_string(length)
+            + " " + backend;
+        benchmark(name.c_str(), length, [length] {
+            _olm_crypto_sha256(input, length, output);
+        });
+    }
+    std::string name = std::string("hmac_sha256/32 ") + backend;
+    benchmark(name.c_str(), 32, [] {
+        _olm_crypto_hmac_sha256(input, 32, input + 32, 32, output);
+    });
+
+    /* the shape of a Megolm rehash: four one byte seeds under one key */
+    static _olm_hmac_sha256_key hmac_key;
+    _olm_crypto_hmac_sha256_init_key(&hmac_key, input, 32);
+    name = std::string("hmac_sha256_multi/4x1 ") + backend;
+    benchmark(name.c_str(), 0, [] {
+        static std::uint8_t outputs[4][SHA256_OUTPUT_LENGTH];
+        static std::uint8_t const * input_ptrs[4] = {
+            input, input + 1, input + 2, input + 3
+        };
+        static std::uint8_t * output_ptrs[4] = {
+            outputs[0], outputs[1], outputs[2], outputs[3]
+        };
+        _olm_crypto_hmac_sha256_with_key_multi(
+            &hmac_key, input_ptrs, 1, output_ptrs, 4
+        );
+    });
+
+    /* event IDs: sixteen hashes of a few hundred bytes each */
+    static std::uint8_t const * batch_inputs[16];
+    static std::size_t batch_lengths[16];
+    static std::uint8_t batch_outputs[16][SHA256_OUTPUT_LENGTH];
+    static std::uint8_t * batch_output_ptrs[16];
+    for (std::size_t i = 0; i < 16; ++i) {
+        batch_inputs[i] = input + 512 * i;
+        batch_lengths[i] = 300;
+        batch_output_ptrs[i] = batch_outputs[i];
+    }
+    name = std::string("sha256/300 x16 one at a time ") + backend;
+    benchmark(name.c_str(), 16 * 300, [] {
+        for (std::size_t i = 0; i < 16; ++i) {
+            _olm_crypto_sha256(
+                batch_inputs[i], batch_lengths[i], batch_output_ptrs[i]
+            );
+        }
+    });
+    name = std::string("sha256_multi/300 x16 ") + backend;
+    benchmark(name.c_str(), 16 * 300, [] {
+        _olm_crypto_sha256_multi(
+            batch_inputs, batch_lengths, batch_output_ptrs, 16
+        );
+    });
+
+    /* the shape of a ratchet step's derivation: 32 bytes of secret into a
+     * root key and a chain key */
+    name = std::string("hkdf_sha256/32 to 64 ") + backend;
+    benchmark(name.c_str(), 0, [] {
+        static std::uint8_t derived[64];
+        _olm_crypto_hkdf_sha256(
+            input, 32, input + 64, 11, input + 32, 32,
+            derived, sizeof(derived)
+        );
+    });
+}
+
+int main() {
+    if (_olm_sha256_hw_available()) {
+        run("hardware");
+    }
+    _olm_cpu_set_feature_mask(~OLM_CPU_FEATURE_SHA256);
+    run("portable");
+}
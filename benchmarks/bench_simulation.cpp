@@ -0,0 +1,595 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/olm.h"
+#include "olm/outbound_group_session.h"
+
+#include "benchmark.hh"
+
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+/* A load simulation, using only the public API: devices in rooms send
+ * Megolm messages to each other, sharing each room key over Olm to every
+ * other device in the room when they start a session and whenever they
+ * rotate it. Messages are delivered after a delay, in ticks, and some are
+ * delayed further, so arrive out of order, or lost. Each device pickles the
+ * objects that have changed every so often, as a client saving its state
+ * would.
+ *
+ * It prints the throughput of the whole run, the time each operation took,
+ * the bytes of pickles written and how the memory in use grew. The defaults
+ * take a fraction of a second; set these to model other loads:
+ *
+ *  OLM_SIM_DEVICES    the number of devices                        (20)
+ *  OLM_SIM_ROOMS      the number of rooms                          (5)
+ *  OLM_SIM_ROOM_SIZE  the number of devices in each room           (8)
+ *  OLM_SIM_MESSAGES   the number of room messages sent, one a tick (1000)
+ *  OLM_SIM_LOSS       the chance that a message is lost            (0.01)
+ *  OLM_SIM_REORDER    the chance that a message is delayed further (0.1)
+ *  OLM_SIM_DELAY      the most ticks a message is delayed further  (20)
+ *  OLM_SIM_ROTATE     the messages sent before a room key rotates  (20)
+ *  OLM_SIM_PERSIST    the ticks between pickling what has changed  (50)
+ *  OLM_SIM_SEED       the seed of the simulation's randomness      (1)
+ */
+
+static std::size_t env_size(char const * name, std::size_t fallback) {
+    char const * value = std::getenv(name);
+    return value ? std::strtoull(value, NULL, 10) : fallback;
+}
+
+static double env_double(char const * name, double fallback) {
+    char const * value = std::getenv(name);
+    return value ? std::strtod(value, NULL) : fallback;
+}
+
+static const std::size_t DEVICES = env_size("OLM_SIM_DEVICES", 20);
+static const std::size_t ROOMS = env_size("OLM_SIM_ROOMS", 5);
+static const std::size_t ROOM_SIZE = std::min(
+    env_size("OLM_SIM_ROOM_SIZE", 8), DEVICES
+);
+static const std::size_t MESSAGES = env_size("OLM_SIM_MESSAGES", 1000);
+static const double LOSS = env_double("OLM_SIM_LOSS", 0.01);
+static const double REORDER = env_double("OLM_SIM_REORDER", 0.1);
+static const std::size_t DELAY = env_size("OLM_SIM_DELAY", 20);
+static const std::size_t ROTATE = env_size("OLM_SIM_ROTATE", 20);
+static const std::size_t PERSIST = env_size("OLM_SIM_PERSIST", 50);
+
+static const std::size_t PLAINTEXT_LENGTH = 200;
+static const char PICKLE_KEY[] = "simulation";
+
+static std::mt19937_64 rng(env_size("OLM_SIM_SEED", 1));
+
+static std::vector<std::uint8_t> random_bytes(std::size_t length) {
+    std::vector<std::uint8_t> bytes(length);
+    for (auto & byte : bytes) {
+        byte = std::uint8_t(rng());
+    }
+    return bytes;
+}
+
+static bool chance(double probability) {
+    return std::uniform_real_distribution<double>()(rng) < probability;
+}
+
+
+/** An Olm session with another device */
+struct Channel {
+    std::vector<std::uint8_t> memory;
+    OlmSession * session;
+    bool dirty;
+};
+
+struct InboundRoomKey {
+    std::vector<std::uint8_t> memory;
+    OlmInboundGroupSession * session;
+    bool dirty;
+};
+
+struct OutboundRoomKey {
+    std::vector<std::uint8_t> memory;
+    OlmOutboundGroupSession * session = NULL;
+    std::string id;
+    std::size_t sent;
+    bool dirty;
+};
+
+struct Device {
+    std::vector<std::uint8_t> account_memory;
+    OlmAccount * account;
+    std::string identity_key;
+    bool account_dirty;
+    /** by the other device, the first being the one sent with */
+    std::map<std::size_t, std::vector<Channel>> channels;
+    /** by session ID */
+    std::map<std::string, InboundRoomKey> room_keys;
+    /** by room */
+    std::map<std::size_t, OutboundRoomKey> outbound;
+};
+
+enum class EventKind { TO_DEVICE, ROOM };
+
+struct Event {
+    std::uint64_t deliver_at;
+    std::uint64_t sequence;
+    EventKind kind;
+    std::size_t from, to;
+    std::size_t message_type;
+    std::string session_id;
+    std::vector<std::uint8_t> payload;
+
+    bool operator>(Event const & other) const {
+        return deliver_at != other.deliver_at
+            ? deliver_at > other.deliver_at : sequence > other.sequence;
+    }
+};
+
+static std::vector<Device> devices;
+static std::vector<std::vector<std::size_t>> rooms;
+static std::priority_queue<
+    Event, std::vector<Event>, std::greater<Event>
+> network;
+static std::uint64_t now, sequence;
+
+static std::vector<double> olm_encrypt_times, olm_decrypt_times;
+static std::vector<double> group_encrypt_times, group_decrypt_times;
+static std::vector<double> pickle_times;
+static std::size_t to_device_delivered, room_delivered;
+static std::size_t lost, undecryptable, pickle_bytes;
+
+
+template<typename Operation>
+static std::size_t timed(std::vector<double> & times, Operation operation) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    std::size_t result = operation();
+    times.push_back(std::chrono::duration<double, std::nano>(
+        clock::now() - start
+    ).count());
+    return result;
+}
+
+static void send(Event event) {
+    if (chance(LOSS)) {
+        ++lost;
+        return;
+    }
+    event.deliver_at = now + 1;
+    if (DELAY && chance(REORDER)) {
+        event.deliver_at += rng() % (DELAY + 1);
+    }
+    event.sequence = sequence++;
+    network.push(std::move(event));
+}
+
+
+static void create_device(Device & device) {
+    device.account_memory.resize(olm_account_size());
+    device.account = olm_account(device.account_memory.data());
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_create_account_random_length(device.account)
+    );
+    olm_create_account(device.account, random.data(), random.size());
+    std::vector<std::uint8_t> keys(
+        olm_account_identity_keys_length(device.account)
+    );
+    olm_account_identity_keys(device.account, keys.data(), keys.size());
+    device.identity_key.assign(keys.begin() + 15, keys.begin() + 15 + 43);
+    device.account_dirty = true;
+}
+
+/** Take a one time key from a device, as a claim from the server would */
+static std::string claim_one_time_key(Device & device) {
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_account_generate_one_time_keys_random_length(device.account, 1)
+    );
+    olm_account_generate_one_time_keys(
+        device.account, 1, random.data(), random.size()
+    );
+    std::vector<std::uint8_t> keys(
+        olm_account_one_time_keys_length(device.account)
+    );
+    olm_account_one_time_keys(device.account, keys.data(), keys.size());
+    olm_account_mark_keys_as_published(device.account);
+    device.account_dirty = true;
+    std::string json(keys.begin(), keys.end());
+    return json.substr(json.find("\":\"") + 3, 43);
+}
+
+static Channel & channel_to(std::size_t from, std::size_t to) {
+    std::vector<Channel> & channels = devices[from].channels[to];
+    if (channels.empty()) {
+        std::string one_time_key = claim_one_time_key(devices[to]);
+        channels.emplace_back();
+        Channel & channel = channels.back();
+        channel.memory.resize(olm_session_size());
+        channel.session = olm_session(channel.memory.data());
+        std::vector<std::uint8_t> random = random_bytes(
+            olm_create_outbound_session_random_length(channel.session)
+        );
+        olm_create_outbound_session(
+            channel.session, devices[from].account,
+            devices[to].identity_key.data(), devices[to].identity_key.size(),
+            one_time_key.data(), one_time_key.size(),
+            random.data(), random.size()
+        );
+    }
+    return channels.front();
+}
+
+static void send_to_device(
+    std::size_t from, std::size_t to, std::vector<std::uint8_t> const & body
+) {
+    Channel & channel = channel_to(from, to);
+    Event event;
+    event.kind = EventKind::TO_DEVICE;
+    event.from = from;
+    event.to = to;
+    event.message_type = olm_encrypt_message_type(channel.session);
+    event.payload.resize(
+        olm_encrypt_message_length(channel.session, body.size())
+    );
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_encrypt_random_length(channel.session)
+    );
+    timed(olm_encrypt_times, [&] {
+        return olm_encrypt(
+            channel.session, body.data(), body.size(),
+            random.data(), random.size(),
+            event.payload.data(), event.payload.size()
+        );
+    });
+    channel.dirty = true;
+    send(std::move(event));
+}
+
+/** Find the session a message is for, starting one for a new PRE_KEY
+ * message. Returns NULL if there isn't one. */
+static Channel * channel_for(Event const & event) {
+    Device & device = devices[event.to];
+    std::vector<Channel> & channels = device.channels[event.from];
+    std::vector<std::uint8_t> tmp;
+    if (event.message_type == OLM_MESSAGE_TYPE_PRE_KEY) {
+        for (Channel & channel : channels) {
+            tmp = event.payload;
+            if (olm_matches_inbound_session(
+                channel.session, tmp.data(), tmp.size()
+            ) == 1) {
+                return &channel;
+            }
+        }
+        Channel channel;
+        channel.memory.resize(olm_session_size());
+        channel.session = olm_session(channel.memory.data());
+        tmp = event.payload;
+        if (olm_create_inbound_session(
+            channel.session, device.account, tmp.data(), tmp.size()
+        ) == olm_error()) {
+            return NULL;
+        }
+        olm_remove_one_time_keys(device.account, channel.session);
+        device.account_dirty = true;
+        channels.push_back(std::move(channel));
+        return &channels.back();
+    }
+    /* the first session that decrypts a normal message is the one for it,
+     * so they are tried in turn when the message is delivered */
+    return channels.empty() ? NULL : &channels.front();
+}
+
+static void deliver_to_device(Event const & event) {
+    Device & device = devices[event.to];
+    Channel * first = channel_for(event);
+    if (!first) {
+        ++undecryptable;
+        return;
+    }
+    std::vector<Channel> & channels = device.channels[event.from];
+    std::vector<std::uint8_t> tmp, plaintext;
+    std::size_t length = olm_error();
+    for (Channel & channel : channels) {
+        if (event.message_type == OLM_MESSAGE_TYPE_PRE_KEY
+                && &channel != first) {
+            continue;
+        }
+        tmp = event.payload;
+        plaintext.resize(olm_decrypt_max_plaintext_length(
+            channel.session, event.message_type, tmp.data(), tmp.size()
+        ));
+        tmp = event.payload;
+        length = timed(olm_decrypt_times, [&] {
+            return olm_decrypt(
+                channel.session, event.message_type, tmp.data(), tmp.size(),
+                plaintext.data(), plaintext.size()
+            );
+        });
+        if (length != olm_error()) {
+            channel.dirty = true;
+            break;
+        }
+    }
+    if (length == olm_error()) {
+        ++undecryptable;
+        return;
+    }
+    ++to_device_delivered;
+
+    /* the plaintext is a room key */
+    InboundRoomKey key;
+    key.memory.resize(olm_inbound_group_session_size());
+    key.session = olm_inbound_group_session(key.memory.data());
+    if (olm_init_inbound_group_session(
+        key.session, plaintext.data(), length
+    ) == olm_error()) {
+        ++undecryptable;
+        return;
+    }
+    std::string id(olm_inbound_group_session_id_length(key.session), '\0');
+    olm_inbound_group_session_id(
+        key.session, reinterpret_cast<std::uint8_t *>(&id[0]), id.size()
+    );
+    key.dirty = true;
+    device.room_keys.emplace(id, std::move(key));
+}
+
+/** Start a new room key, and send it to everyone else in the room */
+static OutboundRoomKey & rotate_room_key(std::size_t room, std::size_t from) {
+    OutboundRoomKey & key = devices[from].outbound[room];
+    if (key.session) {
+        olm_clear_outbound_group_session(key.session);
+    }
+    key.memory.resize(olm_outbound_group_session_size());
+    key.session = olm_outbound_group_session(key.memory.data());
+    std::vector<std::uint8_t> random = random_bytes(
+        olm_init_outbound_group_session_random_length(key.session)
+    );
+    olm_init_outbound_group_session(key.session, random.data(), random.size());
+    key.id.resize(olm_outbound_group_session_id_length(key.session));
+    olm_outbound_group_session_id(
+        key.session, reinterpret_cast<std::uint8_t *>(&key.id[0]),
+        key.id.size()
+    );
+    key.sent = 0;
+    key.dirty = true;
+
+    std::vector<std::uint8_t> session_key(
+        olm_outbound_group_session_key_length(key.session)
+    );
+    olm_outbound_group_session_key(
+        key.session, session_key.data(), session_key.size()
+    );
+    for (std::size_t member : rooms[room]) {
+        if (member != from) {
+            send_to_device(from, member, session_key);
+        }
+    }
+    return key;
+}
+
+static void send_room_message(std::size_t room, std::size_t from) {
+    auto found = devices[from].outbound.find(room);
+    OutboundRoomKey & key = found == devices[from].outbound.end()
+            || found->second.sent >= ROTATE
+        ? rotate_room_key(room, from) : found->second;
+
+    std::vector<std::uint8_t> plaintext = random_bytes(PLAINTEXT_LENGTH);
+    Event event;
+    event.kind = EventKind::ROOM;
+    event.from = from;
+    event.message_type = 0;
+    event.session_id = key.id;
+    event.payload.resize(
+        olm_group_encrypt_message_length(key.session, plaintext.size())
+    );
+    timed(group_encrypt_times, [&] {
+        return olm_group_encrypt(
+            key.session, plaintext.data(), plaintext.size(),
+            event.payload.data(), event.payload.size()
+        );
+    });
+    key.sent++;
+    key.dirty = true;
+    for (std::size_t member : rooms[room]) {
+        if (member != from) {
+            event.to = member;
+            send(event);
+        }
+    }
+}
+
+static void deliver_room_message(Event const & event) {
+    Device & device = devices[event.to];
+    auto found = device.room_keys.find(event.session_id);
+    if (found == device.room_keys.end()) {
+        /* the key was lost, or hasn't arrived yet */
+        ++undecryptable;
+        return;
+    }
+    std::vector<std::uint8_t> tmp(event.payload);
+    std::vector<std::uint8_t> plaintext(tmp.size());
+    std::uint32_t message_index;
+    std::size_t length = timed(group_decrypt_times, [&] {
+        return olm_group_decrypt(
+            found->second.session, tmp.data(), tmp.size(),
+            plaintext.data(), plaintext.size(), &message_index
+        );
+    });
+    if (length == olm_error()) {
+        ++undecryptable;
+        return;
+    }
+    ++room_delivered;
+}
+
+
+/** Pickle an object, adding the time and bytes to the totals */
+template<typename Length, typename Pickle>
+static void persist_one(bool & dirty, Length length, Pickle pickle) {
+    if (!dirty) {
+        return;
+    }
+    std::vector<std::uint8_t> pickled(length());
+    timed(pickle_times, [&] {
+        return pickle(pickled.data(), pickled.size());
+    });
+    pickle_bytes += pickled.size();
+    dirty = false;
+}
+
+static void persist() {
+    for (Device & device : devices) {
+        persist_one(device.account_dirty, [&] {
+            return olm_pickle_account_length(device.account);
+        }, [&](std::uint8_t * pickled, std::size_t length) {
+            return olm_pickle_account(
+                device.account, PICKLE_KEY, sizeof(PICKLE_KEY) - 1,
+                pickled, length
+            );
+        });
+        for (auto & peer : device.channels) {
+            for (Channel & channel : peer.second) {
+                persist_one(channel.dirty, [&] {
+                    return olm_pickle_session_length(channel.session);
+                }, [&](std::uint8_t * pickled, std::size_t length) {
+                    return olm_pickle_session(
+                        channel.session, PICKLE_KEY, sizeof(PICKLE_KEY) - 1,
+                        pickled, length
+                    );
+                });
+            }
+        }
+        for (auto & entry : device.room_keys) {
+            InboundRoomKey & key = entry.second;
+            persist_one(key.dirty, [&] {
+                return olm_pickle_inbound_group_session_length(key.session);
+            }, [&](std::uint8_t * pickled, std::size_t length) {
+                return olm_pickle_inbound_group_session(
+                    key.session, PICKLE_KEY, sizeof(PICKLE_KEY) - 1,
+                    pickled, length
+                );
+            });
+        }
+        for (auto & entry : device.outbound) {
+            OutboundRoomKey & key = entry.second;
+            persist_one(key.dirty, [&] {
+                return olm_pickle_outbound_group_session_length(key.session);
+            }, [&](std::uint8_t * pickled, std::size_t length) {
+                return olm_pickle_outbound_group_session(
+                    key.session, PICKLE_KEY, sizeof(PICKLE_KEY) - 1,
+                    pickled, length
+                );
+            });
+        }
+    }
+}
+
+static void print_memory(char const * when) {
+    OlmMemoryStats stats = {};
+    for (Device const & device : devices) {
+        olm_account_memory_stats(device.account, &stats);
+        for (auto const & peer : device.channels) {
+            for (Channel const & channel : peer.second) {
+                olm_session_memory_stats(channel.session, &stats);
+            }
+        }
+        for (auto const & entry : device.room_keys) {
+            olm_inbound_group_session_memory_stats(
+                entry.second.session, &stats
+            );
+        }
+        for (auto const & entry : device.outbound) {
+            olm_outbound_group_session_memory_stats(
+                entry.second.session, &stats
+            );
+        }
+    }
+    std::string name = std::string("simulation live bytes at ") + when;
+    benchmark_size(name.c_str(), stats.live_bytes);
+    name = std::string("simulation reserved bytes at ") + when;
+    benchmark_size(name.c_str(), stats.reserved_bytes);
+    name = std::string("simulation objects at ") + when;
+    benchmark_count(name.c_str(), stats.objects);
+}
+
+
+int main() {
+    devices.resize(DEVICES);
+    for (Device & device : devices) {
+        create_device(device);
+    }
+    std::vector<std::size_t> everyone(DEVICES);
+    for (std::size_t i = 0; i < DEVICES; ++i) {
+        everyone[i] = i;
+    }
+    rooms.resize(ROOMS);
+    for (auto & members : rooms) {
+        std::shuffle(everyone.begin(), everyone.end(), rng);
+        members.assign(everyone.begin(), everyone.begin() + ROOM_SIZE);
+    }
+
+    char const * quarters[] = {"25%", "50%", "75%", "100%"};
+    std::size_t sent = 0, quarter = 0;
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    for (now = 0; sent < MESSAGES || !network.empty(); ++now) {
+        while (!network.empty() && network.top().deliver_at <= now) {
+            Event event = network.top();
+            network.pop();
+            if (event.kind == EventKind::TO_DEVICE) {
+                deliver_to_device(event);
+            } else {
+                deliver_room_message(event);
+            }
+        }
+        if (sent < MESSAGES && ROOMS && ROOM_SIZE) {
+            std::size_t room = rng() % ROOMS;
+            send_room_message(room, rooms[room][rng() % ROOM_SIZE]);
+            ++sent;
+        }
+        if (PERSIST && now % PERSIST == 0) {
+            persist();
+        }
+        /* the memory isn't counted in the time taken */
+        if (quarter < 4 && sent >= MESSAGES * (quarter + 1) / 4) {
+            clock::time_point paused = clock::now();
+            print_memory(quarters[quarter++]);
+            start += clock::now() - paused;
+        }
+    }
+    persist();
+    double seconds = std::chrono::duration<double>(
+        clock::now() - start
+    ).count();
+
+    benchmark_rate(
+        "simulation messages delivered",
+        to_device_delivered + room_delivered, seconds
+    );
+    benchmark_count("simulation room messages delivered", room_delivered);
+    benchmark_count(
+        "simulation to-device messages delivered", to_device_delivered
+    );
+    benchmark_count("simulation messages lost", lost);
+    benchmark_count("simulation messages undecryptable", undecryptable);
+    benchmark_percentiles("simulation olm_encrypt", olm_encrypt_times);
+    benchmark_percentiles("simulation olm_decrypt", olm_decrypt_times);
+    benchmark_percentiles("simulation olm_group_encrypt", group_encrypt_times);
+    benchmark_percentiles("simulation olm_group_decrypt", group_decrypt_times);
+    benchmark_percentiles("simulation pickle", pickle_times);
+    benchmark_size("simulation pickle bytes written", pickle_bytes);
+}
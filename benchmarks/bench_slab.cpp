@@ -0,0 +1,79 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/pool.h"
+
+#include "benchmark.hh"
+
+#include <cstdio>
+#include <vector>
+
+/* Looking up group sessions at random in a slab far bigger than the TLB
+ * covers with ordinary pages, as a server does when sync touches whichever
+ * rooms have new messages, with and without huge pages. */
+
+static const std::size_t SESSION_COUNT = 100000;
+
+static std::vector<OlmInboundGroupSession *> sessions;
+static std::uint32_t state = 1;
+static std::uint32_t volatile sink;
+
+/* a cheap generator, so that the lookups and not it are what is timed */
+static std::uint32_t next_random() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+int main() {
+    static char const * const names[] = {
+        "caller", "normal pages", "transparent huge pages",
+        "reserved huge pages"
+    };
+    unsigned const flag_sets[] = {0, OLM_SLAB_HUGE_PAGES};
+    for (unsigned flags : flag_sets) {
+        OlmSlab * slab = olm_slab_map(
+            olm_inbound_group_session_size(), SESSION_COUNT, flags
+        );
+        if (!slab) {
+            std::printf("couldn't map a slab with flags %u\n", flags);
+            continue;
+        }
+        OlmAllocator allocator;
+        olm_slab_allocator(slab, &allocator);
+        sessions.clear();
+        for (std::size_t i = 0; i < SESSION_COUNT; ++i) {
+            sessions.push_back(olm_allocate_inbound_group_session(&allocator));
+        }
+        OlmSlabStats stats;
+        olm_slab_stats(slab, &stats);
+
+        char name[64];
+        std::snprintf(
+            name, sizeof(name), "random lookup/%s", names[stats.backing]
+        );
+        benchmark(name, 0, [] {
+            sink = olm_inbound_group_session_first_known_index(
+                sessions[next_random() % SESSION_COUNT]
+            );
+        });
+
+        for (OlmInboundGroupSession * session : sessions) {
+            olm_release_inbound_group_session(&allocator, session);
+        }
+        olm_slab_unmap(slab);
+    }
+}
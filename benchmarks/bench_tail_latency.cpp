@@ -0,0 +1,205 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/megolm.h"
+#include "olm/olm.h"
+#include "olm/ratchet.hh"
+
+#include "benchmark.hh"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+/* The slowest inputs that are still legal, for setting latency targets:
+ *
+ *  - Megolm ratchet jumps to random indices, and to the index just before
+ *    the current one, which wraps the ratchet round. The worst wrap, from
+ *    0x01ffffff to 0x01fffffe, costs over a thousand HMACs.
+ *  - An Olm message as far ahead of the last one as MAX_MESSAGE_GAP allows.
+ *  - Olm messages decrypted with the skipped message keys full, both using
+ *    a skipped key and skipping another MAX_MESSAGE_GAP messages past them.
+ *  - The first Olm reply to a message, which needs a new ratchet key,
+ *    with the key generated then and taken from a ratchet key pool.
+ *
+ * Each call is timed on its own, from the same starting state, and the
+ * median, 99th percentile and worst times are printed. */
+
+static const std::size_t SAMPLES = 1000;
+static const std::size_t FULL = olm::MAX_SKIPPED_MESSAGE_KEYS;
+static const std::size_t GAP = olm::MAX_MESSAGE_GAP;
+
+static Megolm megolm;
+static std::vector<Megolm> starts(SAMPLES);
+static std::vector<std::uint32_t> targets(SAMPLES);
+static std::uint32_t target;
+
+static std::vector<std::uint8_t> session_buffer;
+static std::vector<std::uint8_t> after_first, with_full_keys;
+static OlmSession * session;
+static std::vector<std::vector<std::uint8_t>> messages(FULL + GAP + 3);
+static std::vector<std::uint8_t> message;
+static std::uint8_t output[200];
+static std::vector<std::uint8_t> pool_buffer;
+static OlmRatchetKeyPool * pool;
+static std::uint8_t reply_random[32] = {5};
+static std::uint8_t reply[300];
+
+static void decrypt() {
+    olm_decrypt(
+        session, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size(),
+        output, sizeof(output)
+    );
+}
+
+/* put the session back in a saved state, ready to decrypt message i */
+static void restore(std::vector<std::uint8_t> const & saved, std::size_t i) {
+    /* the session only points into its own buffer, so copying the bytes
+     * back into the same buffer restores it */
+    std::memcpy(session_buffer.data(), saved.data(), saved.size());
+    message = messages[i];
+}
+
+static void megolm_scenarios() {
+    std::mt19937 random(1);
+    static std::uint8_t data[MEGOLM_RATCHET_LENGTH] = {1, 2, 3};
+    for (std::size_t i = 0; i < SAMPLES; ++i) {
+        megolm_init(&starts[i], data, random());
+        targets[i] = random();
+    }
+    /* ratchets only move forward, so a target below the start wraps */
+    benchmark_latency("megolm_advance_to random", SAMPLES, [](std::size_t i) {
+        megolm = starts[i];
+        target = targets[i];
+    }, [] {
+        megolm_advance_to(&megolm, target);
+    });
+    benchmark_latency("megolm_advance_to start - 1", SAMPLES, [](std::size_t i) {
+        megolm = starts[i];
+        target = starts[i].counter - 1;
+    }, [] {
+        megolm_advance_to(&megolm, target);
+    });
+    benchmark_latency("megolm_advance_to worst wrap", SAMPLES,
+        [](std::size_t i) {
+            megolm = starts[i];
+            megolm.counter = 0x01ffffff;
+        }, [] {
+            megolm_advance_to(&megolm, 0x01fffffe);
+        }
+    );
+}
+
+static void olm_scenarios() {
+    std::vector<std::uint8_t> a_account_buffer(olm_account_size());
+    OlmAccount * a_account = olm_account(a_account_buffer.data());
+    std::vector<std::uint8_t> random(olm_create_account_random_length(a_account), 1);
+    olm_create_account(a_account, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_account_buffer(olm_account_size());
+    OlmAccount * b_account = olm_account(b_account_buffer.data());
+    random.assign(olm_create_account_random_length(b_account), 2);
+    olm_create_account(b_account, random.data(), random.size());
+    random.assign(olm_account_generate_one_time_keys_random_length(b_account, 1), 3);
+    olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+    std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(b_account));
+    olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+    std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(b_account));
+    olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+    std::vector<std::uint8_t> a_session_buffer(olm_session_size());
+    OlmSession * a_session = olm_session(a_session_buffer.data());
+    random.assign(olm_create_outbound_session_random_length(a_session), 4);
+    olm_create_outbound_session(
+        a_session, a_account,
+        b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+        random.data(), random.size()
+    );
+
+    /* every message is on the same chain, and they are all pre-key
+     * messages since nothing is sent back */
+    std::uint8_t plaintext[100];
+    std::memset(plaintext, 'x', sizeof(plaintext));
+    for (auto & m : messages) {
+        m.resize(olm_encrypt_message_length(a_session, sizeof(plaintext)));
+        olm_encrypt(
+            a_session, plaintext, sizeof(plaintext), NULL, 0,
+            m.data(), m.size()
+        );
+    }
+
+    session_buffer.resize(olm_session_size());
+    session = olm_session(session_buffer.data());
+    message = messages[0];
+    olm_create_inbound_session(
+        session, b_account, message.data(), message.size()
+    );
+    message = messages[0];
+    olm_decrypt(
+        session, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size(),
+        output, sizeof(output)
+    );
+    after_first = session_buffer;
+    /* skipping messages 1 to FULL fills the skipped message keys */
+    message = messages[FULL + 1];
+    olm_decrypt(
+        session, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size(),
+        output, sizeof(output)
+    );
+    with_full_keys = session_buffer;
+
+    benchmark_latency("olm_decrypt gap MAX_MESSAGE_GAP", SAMPLES,
+        [](std::size_t) { restore(after_first, GAP + 1); }, decrypt
+    );
+    benchmark_latency("olm_decrypt oldest skipped key, full", SAMPLES,
+        [](std::size_t) { restore(with_full_keys, 1); }, decrypt
+    );
+    benchmark_latency("olm_decrypt newest skipped key, full", SAMPLES,
+        [](std::size_t) { restore(with_full_keys, FULL); }, decrypt
+    );
+    benchmark_latency("olm_decrypt gap MAX_MESSAGE_GAP, full", SAMPLES,
+        [](std::size_t) { restore(with_full_keys, FULL + GAP + 2); }, decrypt
+    );
+
+    pool_buffer.resize(olm_ratchet_key_pool_size(1));
+    pool = olm_ratchet_key_pool(pool_buffer.data(), 1);
+    benchmark_latency("olm_encrypt first reply", SAMPLES,
+        [](std::size_t) { restore(after_first, 0); }, [] {
+            std::uint8_t random[32];
+            std::memcpy(random, reply_random, sizeof(random));
+            olm_encrypt(
+                session, output, 100, random, sizeof(random),
+                reply, sizeof(reply)
+            );
+        }
+    );
+    benchmark_latency("olm_encrypt_with_key_pool first reply", SAMPLES,
+        [](std::size_t) {
+            restore(after_first, 0);
+            std::uint8_t random[32];
+            std::memcpy(random, reply_random, sizeof(random));
+            olm_ratchet_key_pool_fill(pool, random, sizeof(random));
+        }, [] {
+            olm_encrypt_with_key_pool(
+                session, pool, output, 100, reply, sizeof(reply)
+            );
+        }
+    );
+}
+
+int main() {
+    megolm_scenarios();
+    olm_scenarios();
+}
@@ -0,0 +1,258 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+/** Whether to print the results as JSON, one object per line, rather than as
+ * a table. Set by running with OLM_BENCH_FORMAT=json. */
+inline bool benchmark_json() {
+    static const bool json = [] {
+        char const * format = std::getenv("OLM_BENCH_FORMAT");
+        return format && std::strcmp(format, "json") == 0;
+    }();
+    return json;
+}
+
+inline void benchmark_print_json_string(char const * value) {
+    std::cout << '"';
+    for (; *value; ++value) {
+        if (*value == '"' || *value == '\\') {
+            std::cout << '\\';
+        }
+        std::cout << *value;
+    }
+    std::cout << '"';
+}
+
+/** Start a JSON result, up to the name. OLM_BENCH_SUITE is set by
+ * make bench_json to the benchmark binary's name. */
+inline void benchmark_print_json_name(char const * name) {
+    char const * suite = std::getenv("OLM_BENCH_SUITE");
+    std::cout << "{\"suite\": ";
+    benchmark_print_json_string(suite ? suite : "");
+    std::cout << ", \"name\": ";
+    benchmark_print_json_string(name);
+}
+
+
+/** Print the mean time per call of an operation that was called iterations
+ * times, and the throughput if bytes is non-zero. */
+inline void benchmark_print(
+    char const * name, std::uint64_t iterations, double ns_per_op,
+    std::size_t bytes
+) {
+    if (benchmark_json()) {
+        benchmark_print_json_name(name);
+        std::cout << std::fixed << std::setprecision(1)
+            << ", \"iterations\": " << iterations
+            << ", \"ns_per_op\": " << ns_per_op
+            << ", \"bytes\": " << bytes;
+        if (bytes) {
+            std::cout << ", \"mb_per_s\": " << bytes * 1e3 / ns_per_op;
+        }
+        std::cout << "}" << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(40) << name << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << ns_per_op << " ns/op";
+    if (bytes) {
+        std::cout << std::setw(10) << bytes * 1e3 / ns_per_op << " MB/s";
+    }
+    std::cout << std::endl;
+}
+
+
+/** Run the operation repeatedly for at least min_seconds, and return the
+ * mean time per call in nanoseconds without printing it, for benchmarks
+ * which report something else, such as a rate. The number of calls is
+ * stored in iterations if it isn't NULL. */
+template<typename Operation>
+double benchmark_ns(
+    Operation operation, double min_seconds = 0.2,
+    std::uint64_t * iterations = nullptr
+) {
+    typedef std::chrono::steady_clock clock;
+    std::uint64_t calls = 0;
+    std::uint64_t batch = 1;
+    clock::time_point start = clock::now();
+    double elapsed;
+    do {
+        for (std::uint64_t i = 0; i < batch; ++i) {
+            operation();
+        }
+        calls += batch;
+        batch *= 2;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < min_seconds);
+    if (iterations) {
+        *iterations = calls;
+    }
+    return elapsed * 1e9 / calls;
+}
+
+
+/**
+ * Run the operation repeatedly for at least min_seconds, and print the mean
+ * time per call. If bytes is non-zero it is the amount of data processed by
+ * each call, and the throughput is printed too. Returns the time per call in
+ * nanoseconds.
+ *
+ * With OLM_BENCH_FORMAT=json each result is printed as a JSON object on a
+ * line of its own instead, for tracking regressions between builds.
+ */
+template<typename Operation>
+double benchmark(
+    char const * name, std::size_t bytes, Operation operation,
+    double min_seconds = 0.2
+) {
+    std::uint64_t iterations;
+    double ns_per_op = benchmark_ns(operation, min_seconds, &iterations);
+    benchmark_print(name, iterations, ns_per_op, bytes);
+    return ns_per_op;
+}
+
+
+/**
+ * Call the operation a fixed number of times, passing it the number of the
+ * call, and print the mean time per call as benchmark() does. This is for
+ * operations that can't be repeated on the same input, such as decrypting
+ * the next message, and is how the binding benchmarks time their calls.
+ * Returns the time per call in nanoseconds.
+ */
+template<typename Operation>
+double benchmark_calls(
+    char const * name, std::size_t iterations, Operation operation
+) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        operation(i);
+    }
+    double elapsed = std::chrono::duration<double>(
+        clock::now() - start
+    ).count();
+    double ns_per_op = iterations ? elapsed * 1e9 / iterations : 0;
+    benchmark_print(name, iterations, ns_per_op, 0);
+    return ns_per_op;
+}
+
+
+/** Print the size of something, such as an object, in bytes, in the same
+ * format as the timings. */
+inline void benchmark_size(char const * name, std::size_t size) {
+    if (benchmark_json()) {
+        benchmark_print_json_name(name);
+        std::cout << ", \"size_bytes\": " << size << "}" << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(40) << name << std::right
+        << std::setw(12) << size << " bytes" << std::endl;
+}
+
+
+/** Print the median, 99th percentile and worst of some times, in
+ * nanoseconds, in the same format as the timings. Returns the worst. */
+inline double benchmark_percentiles(
+    char const * name, std::vector<double> times
+) {
+    if (times.empty()) {
+        times.push_back(0);
+    }
+    std::sort(times.begin(), times.end());
+    std::size_t samples = times.size();
+    double p50 = times[samples / 2];
+    double p99 = times[samples * 99 / 100];
+    double max = times[samples - 1];
+
+    if (benchmark_json()) {
+        benchmark_print_json_name(name);
+        std::cout << std::fixed << std::setprecision(1)
+            << ", \"samples\": " << samples
+            << ", \"p50_ns\": " << p50
+            << ", \"p99_ns\": " << p99
+            << ", \"max_ns\": " << max << "}" << std::endl;
+        return max;
+    }
+    std::cout << std::left << std::setw(40) << name << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << p50 << " p50"
+        << std::setw(12) << p99 << " p99"
+        << std::setw(12) << max << " max ns" << std::endl;
+    return max;
+}
+
+
+/** Print a count of something, such as failures, in the same format as the
+ * timings. */
+inline void benchmark_count(char const * name, std::size_t count) {
+    if (benchmark_json()) {
+        benchmark_print_json_name(name);
+        std::cout << ", \"count\": " << count << "}" << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(40) << name << std::right
+        << std::setw(12) << count << std::endl;
+}
+
+
+/** Print how many operations were done a second, given how many there were
+ * and how long they took, in the same format as the timings. */
+inline void benchmark_rate(
+    char const * name, std::size_t operations, double seconds
+) {
+    double per_second = seconds > 0 ? operations / seconds : 0;
+    if (benchmark_json()) {
+        benchmark_print_json_name(name);
+        std::cout << std::fixed << std::setprecision(1)
+            << ", \"operations\": " << operations
+            << ", \"ops_per_s\": " << per_second << "}" << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(40) << name << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << per_second << " ops/s" << std::endl;
+}
+
+
+/**
+ * Time samples separate calls of the operation, each after an untimed call
+ * of setup, and print the median, 99th percentile and worst time per call.
+ * This is for operations whose cost depends on their input, where the tail
+ * matters more than the mean. Returns the worst time in nanoseconds.
+ */
+template<typename Setup, typename Operation>
+double benchmark_latency(
+    char const * name, std::size_t samples, Setup setup, Operation operation
+) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<double> times(samples);
+    for (std::size_t i = 0; i < samples; ++i) {
+        setup(i);
+        clock::time_point start = clock::now();
+        operation();
+        times[i] = std::chrono::duration<double, std::nano>(
+            clock::now() - start
+        ).count();
+    }
+    return benchmark_percentiles(name, times);
+}
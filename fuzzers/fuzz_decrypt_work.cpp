@@ -0,0 +1,108 @@
+#include "olm/olm.hh"
+
+#include "fuzzing.hh"
+
+/* Decrypts the input as a binary normal message to a session made here, and
+ * reports how much work that took, so that the fuzzer looks for messages
+ * which are cheap to send but expensive to reject, such as ones far along a
+ * new chain. With --seed, writes a real message for the session instead,
+ * to start the fuzzer from. */
+
+static void fill(uint8_t * random, size_t length, uint8_t tag) {
+    for (size_t i = 0; i < length; ++i) {
+        random[i] = uint8_t(tag + i * 7);
+    }
+}
+
+static OlmAccount * make_account(uint8_t * memory, uint8_t tag) {
+    OlmAccount * account = olm_account(memory);
+    uint8_t random[olm_create_account_random_length(account)];
+    fill(random, sizeof(random), tag);
+    olm_create_account(account, random, sizeof(random));
+    return account;
+}
+
+int main(int argc, const char *argv[]) {
+    size_t ignored;
+    bool seed = argc > 1 && !strcmp(argv[1], "--seed");
+
+    /* Alice sends Bob a pre-key message, and Bob replies, so that Alice's
+     * session is receiving normal messages on Bob's chain */
+    uint8_t a_account_memory[olm_account_size()];
+    OlmAccount * a_account = make_account(a_account_memory, 'A');
+    uint8_t b_account_memory[olm_account_size()];
+    OlmAccount * b_account = make_account(b_account_memory, 'B');
+    uint8_t ot_random[
+        olm_account_generate_one_time_keys_random_length(b_account, 1)
+    ];
+    fill(ot_random, sizeof(ot_random), 'O');
+    olm_account_generate_one_time_keys(
+        b_account, 1, ot_random, sizeof(ot_random)
+    );
+    uint8_t b_id_keys[olm_account_identity_keys_length(b_account)];
+    uint8_t b_ot_keys[olm_account_one_time_keys_length(b_account)];
+    olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+    olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+    uint8_t a_session_memory[olm_session_size()];
+    OlmSession * a_session = olm_session(a_session_memory);
+    uint8_t a_random[olm_create_outbound_session_random_length(a_session)];
+    fill(a_random, sizeof(a_random), 'a');
+    check_session(a_session, "Error creating session", olm_create_outbound_session(
+        a_session, a_account, b_id_keys + 15, 43, b_ot_keys + 25, 43,
+        a_random, sizeof(a_random)
+    ));
+
+    uint8_t plaintext[] = "Hello, World";
+    uint8_t message[olm_encrypt_message_length(a_session, 12)];
+    check_session(a_session, "Error encrypting", olm_encrypt(
+        a_session, plaintext, 12, NULL, 0, message, sizeof(message)
+    ));
+    uint8_t b_session_memory[olm_session_size()];
+    OlmSession * b_session = olm_session(b_session_memory);
+    uint8_t tmp[sizeof(message)];
+    memcpy(tmp, message, sizeof(message));
+    check_session(b_session, "Error creating session", olm_create_inbound_session(
+        b_session, b_account, tmp, sizeof(tmp)
+    ));
+    uint8_t output[64];
+    check_session(b_session, "Error decrypting", olm_decrypt(
+        b_session, OLM_MESSAGE_TYPE_PRE_KEY, message, sizeof(message),
+        output, sizeof(output)
+    ));
+
+    uint8_t reply_random[olm_encrypt_random_length(b_session)];
+    fill(reply_random, sizeof(reply_random), 'r');
+    uint8_t reply[olm_encrypt_raw_message_length(b_session, 12)];
+    size_t reply_length = check_session(
+        b_session, "Error encrypting", olm_encrypt_raw(
+            b_session, plaintext, 12, reply_random, sizeof(reply_random),
+            reply, sizeof(reply)
+        )
+    );
+    if (seed) {
+        ignored = write(STDOUT_FILENO, reply, reply_length);
+        return ignored == size_t(-1);
+    }
+
+    uint8_t * message_buffer;
+    ssize_t message_length = check_errno(
+        "Error reading message file", read_file(STDIN_FILENO, &message_buffer)
+    );
+
+    olm_stats_reset();
+    size_t max_length = olm_decrypt_raw_max_plaintext_length(
+        a_session, OLM_MESSAGE_TYPE_MESSAGE, message_buffer, message_length
+    );
+    if (max_length != olm_error()) {
+        uint8_t * decrypted = (uint8_t *) malloc(max_length + 1);
+        olm_decrypt_raw(
+            a_session, OLM_MESSAGE_TYPE_MESSAGE,
+            message_buffer, message_length, decrypted, max_length
+        );
+        free(decrypted);
+    }
+    report_work_per_byte(message_length);
+    free(message_buffer);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "olm/olm.hh"
+#include "olm/base64.hh"
+#include "olm/crypto.h"
+#include "olm/inbound_group_session.h"
+#include "olm/message.h"
+
+#include "fuzzing.hh"
+
+/* Signs the input as the body of a binary group message, decrypts it with a
+ * group session made here, and reports how much work the decrypt took, so
+ * that the fuzzer looks for messages which are expensive to reject, such as
+ * ones at far message indices. Signing the input here lets the fuzzer get
+ * past the signature check, which a sender with the session's signing key
+ * could always do. With --seed, writes a message body to start from. */
+
+/* the version, message index, ratchet and signing key of an exported
+ * session */
+static const size_t EXPORT_LENGTH = 1 + 4 + 128 + 32;
+
+int main(int argc, const char *argv[]) {
+    size_t ignored;
+    if (argc > 1 && !strcmp(argv[1], "--seed")) {
+        uint8_t body[64];
+        uint8_t * ciphertext;
+        size_t length = _olm_encode_group_message(
+            3, 1000, 32, body, &ciphertext
+        );
+        memset(ciphertext, 'c', 32);
+        /* room for the MAC, which the decrypt checks after the ratchet */
+        memset(body + length, 'm', 8);
+        ignored = write(STDOUT_FILENO, body, length + 8);
+        return ignored == size_t(-1);
+    }
+
+    /* the account's Ed25519 key signs for the session */
+    uint8_t account_memory[olm_account_size()];
+    OlmAccount * account = olm_account(account_memory);
+    uint8_t random[olm_create_account_random_length(account)];
+    memset(random, 'S', sizeof(random));
+    olm_create_account(account, random, sizeof(random));
+    uint8_t id_keys[olm_account_identity_keys_length(account)];
+    olm_account_identity_keys(account, id_keys, sizeof(id_keys));
+
+    uint8_t exported[EXPORT_LENGTH];
+    memset(exported, 'R', sizeof(exported));
+    exported[0] = 1;
+    memset(exported + 1, 0, 4);
+    olm::decode_base64(id_keys + 71, 43, exported + EXPORT_LENGTH - 32);
+    uint8_t session_key[olm::encode_base64_length(EXPORT_LENGTH)];
+    olm::encode_base64(exported, EXPORT_LENGTH, session_key);
+
+    uint8_t session_memory[olm_inbound_group_session_size()];
+    OlmInboundGroupSession * session =
+        olm_inbound_group_session(session_memory);
+    check_error(
+        olm_inbound_group_session_last_error, session,
+        "Error importing session",
+        olm_import_inbound_group_session(
+            session, session_key, sizeof(session_key)
+        )
+    );
+
+    uint8_t * body;
+    ssize_t body_length = check_errno(
+        "Error reading message file", read_file(STDIN_FILENO, &body)
+    );
+    size_t message_length = body_length + ED25519_SIGNATURE_LENGTH;
+    uint8_t * message = (uint8_t *) malloc(message_length);
+    memcpy(message, body, body_length);
+    uint8_t signature[olm_account_signature_length(account)];
+    olm_account_sign(account, body, body_length, signature, sizeof(signature));
+    olm::decode_base64(
+        signature, sizeof(signature), message + body_length
+    );
+
+    olm_stats_reset();
+    size_t max_length = olm_group_decrypt_raw_max_plaintext_length(
+        session, message, message_length
+    );
+    if (max_length != olm_error()) {
+        uint8_t * plaintext = (uint8_t *) malloc(max_length + 1);
+        uint32_t message_index;
+        olm_group_decrypt_raw(
+            session, message, message_length,
+            plaintext, max_length, &message_index
+        );
+        free(plaintext);
+    }
+    report_work_per_byte(body_length);
+    free(message);
+    free(body);
+    return 0;
+}
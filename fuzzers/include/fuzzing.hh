@@ -1,4 +1,5 @@
 #include "olm/olm.hh"
+#include "olm/stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -80,3 +81,88 @@ size_t check_session(
 ) {
     return check_error(olm_session_last_error, session, message, value);
 }
+
+/* Costs in SHA-256 blocks, roughly as benchmarks/bench_curve25519,
+ * bench_ed25519 and bench_sha256 measure them, so that one measure of work
+ * covers both the hashing and the public key operations. */
+static const uint64_t WORK_PER_CURVE25519 = 512;
+static const uint64_t WORK_PER_ED25519_SIGN = 512;
+static const uint64_t WORK_PER_ED25519_VERIFY = 1536;
+
+/** The work the library has done on this thread since olm_stats_reset(),
+ * in SHA-256 blocks */
+uint64_t work_done() {
+    OlmStats stats;
+    olm_stats_get(&stats);
+    /* the HMACs and HKDFs, and so the Megolm and Olm ratchets, are all
+     * counted in sha256_blocks */
+    return stats.sha256_blocks
+        + WORK_PER_CURVE25519
+            * (stats.curve25519_keys + stats.curve25519_shared_secrets)
+        + WORK_PER_ED25519_SIGN * stats.ed25519_signs
+        + WORK_PER_ED25519_VERIFY * stats.ed25519_verifies;
+}
+
+/* Written by report_work_per_byte() so that the compiler keeps each of its
+ * branches. */
+volatile unsigned work_level_reached;
+
+#define WORK_LEVEL(n) if (level > (n)) work_level_reached = (n);
+#define WORK_LEVELS_4(n) \
+    WORK_LEVEL(n) WORK_LEVEL(n + 1) WORK_LEVEL(n + 2) WORK_LEVEL(n + 3)
+#define WORK_LEVELS_16(n) WORK_LEVELS_4(n) WORK_LEVELS_4(n + 4) \
+    WORK_LEVELS_4(n + 8) WORK_LEVELS_4(n + 12)
+
+/**
+ * Report the work done since olm_stats_reset() for an input of the given
+ * length, as the fitness signal for a coverage guided fuzzer such as AFL.
+ * The work per byte is turned into a level, two to each doubling, and each
+ * level below it takes a branch of its own, so an input that makes the
+ * library do more work per byte than any before it reaches new coverage and
+ * is kept. The fuzzer then climbs towards the most expensive inputs it can
+ * find, as PerfFuzz does with its own counters.
+ *
+ * The work is also written to stderr. If OLM_FUZZ_MAX_WORK_PER_BYTE is set,
+ * an input costing more than that aborts, so that the fuzzer saves it as a
+ * crash.
+ *
+ * The counters are only kept when the library is built with OLM_STATS, as
+ * the fuzzers are; debug_* builds need make OLM_STATS=1 for this.
+ */
+void report_work_per_byte(size_t input_length) {
+    if (!olm_stats_enabled()) {
+        const char * message = "The library doesn't count its work; "
+            "build with OLM_STATS=1\n";
+        ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+        (void)ignored;
+        return;
+    }
+    uint64_t work = work_done();
+    uint64_t per_byte = work / (input_length ? input_length : 1);
+    fprintf(
+        stderr, "work: %llu SHA-256 blocks, %llu per input byte\n",
+        (unsigned long long)work, (unsigned long long)per_byte
+    );
+
+    /* the level is 1 + 2 * log2(16 * per_byte), counting half steps */
+    uint64_t scaled = 16 * per_byte;
+    unsigned level = 0;
+    if (scaled) {
+        unsigned bits = 0;
+        while (scaled >> (bits + 1)) {
+            bits++;
+        }
+        level = 1 + 2 * bits + (bits ? (scaled >> (bits - 1)) & 1 : 0);
+    }
+    WORK_LEVELS_16(0) WORK_LEVELS_16(16) WORK_LEVELS_16(32)
+    WORK_LEVELS_16(48) WORK_LEVELS_16(64) WORK_LEVELS_16(80)
+
+    const char * limit = getenv("OLM_FUZZ_MAX_WORK_PER_BYTE");
+    if (limit && per_byte > strtoull(limit, NULL, 10)) {
+        abort();
+    }
+}
+
+#undef WORK_LEVEL
+#undef WORK_LEVELS_4
+#undef WORK_LEVELS_16
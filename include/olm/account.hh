@@ -16,6 +16,7 @@
 #define OLM_ACCOUNT_HH_
 
 #include "olm/list.hh"
+#include "olm/indexed_list.hh"
 #include "olm/crypto.h"
 #include "olm/error.h"
 
@@ -36,15 +37,61 @@ struct OneTimeKey {
 };
 
 
+/** The number of one time keys an account keeps unless it is created with
+ * room for more or fewer. */
 static std::size_t const MAX_ONE_TIME_KEYS = 100;
 
 
+struct OneTimeKeyTraits {
+    /** The public keys are curve25519 keys, so their first few bytes are
+     * already well mixed. */
+    static std::uint32_t hash(_olm_curve25519_public_key const & key) {
+        return std::uint32_t(key.public_key[0])
+            | std::uint32_t(key.public_key[1]) << 8
+            | std::uint32_t(key.public_key[2]) << 16
+            | std::uint32_t(key.public_key[3]) << 24;
+    }
+
+    static std::uint32_t hash(OneTimeKey const & value) {
+        return hash(value.key.public_key);
+    }
+};
+
+/** The number of bytes get_one_time_keys_binary() writes for each key: the
+ * key id, as 4 big-endian bytes, then the public key. */
+static std::size_t const ONE_TIME_KEY_BINARY_LENGTH =
+    4 + CURVE25519_KEY_LENGTH;
+
+/** Receives the output of write_one_time_keys_json() a piece at a time. */
+typedef void (*OutputCallback)(
+    void * context, void const * data, std::size_t length
+);
+
+/** The one time keys, newest first, indexed on their public keys. */
+typedef IndexedList<OneTimeKey, OneTimeKeyTraits> OneTimeKeys;
+
+
 struct Account {
-    Account();
+    /** Create an account keeping its one time keys in storage, which must be
+     * at least storage_length(max_one_time_keys) bytes and aligned for a
+     * OneTimeKey. max_one_time_keys must be at most INDEXED_LIST_LIMIT. */
+    Account(std::size_t max_one_time_keys, std::uint8_t * storage);
+
+    /** The number of bytes of storage an account with room for
+     * max_one_time_keys one time keys needs. */
+    static std::size_t storage_length(std::size_t max_one_time_keys);
+
     IdentityKeys identity_keys;
-    List<OneTimeKey, MAX_ONE_TIME_KEYS> one_time_keys;
+    OneTimeKeys one_time_keys;
     std::uint32_t next_one_time_key_id;
     OlmErrorCode last_error;
+    /** Set when only the identity keys were unpickled. The account can give
+     * its identity keys and sign, but has no one time keys, so using them,
+     * making more or pickling it again fails with PARTIAL_ACCOUNT. */
+    bool identity_keys_only;
+    /** Set whenever anything the account pickles changes, and cleared only
+     * by unpickling or by the caller once the pickle has been stored. */
+    bool dirty;
 
     /** Number of random bytes needed to create a new account */
     std::size_t new_account_random_length();
@@ -85,6 +132,17 @@ struct Account {
         std::uint8_t * signature, std::size_t signature_length
     );
 
+    /**
+     * Signs count messages with the ed25519 key for this account, writing
+     * the signature for message i at signatures + i * signature_length().
+     */
+    void sign_batch(
+        std::size_t count,
+        std::uint8_t const * const * messages,
+        std::size_t const * message_lengths,
+        std::uint8_t * signatures
+    );
+
     /** Number of bytes needed to output the one time keys for this account */
     std::size_t get_one_time_keys_json_length();
 
@@ -104,6 +162,26 @@ struct Account {
         std::uint8_t * one_time_json, std::size_t one_time_json_length
     );
 
+    /** As get_one_time_keys_json() but passing the JSON to write a piece
+     * at a time, so it needs no buffer and no get_one_time_keys_json_length()
+     * pass. Returns the total size of the JSON. */
+    std::size_t write_one_time_keys_json(
+        OutputCallback write, void * context
+    );
+
+    /** Number of bytes needed to output the one time keys for this account
+     * with get_one_time_keys_binary() */
+    std::size_t get_one_time_keys_binary_length();
+
+    /** Output the one time keys that haven't been published yet, newest
+     * first, as ONE_TIME_KEY_BINARY_LENGTH bytes each with no base64 or
+     * separators. Returns the number of bytes written or std::size_t(-1) on
+     * error. If the buffer is too small last_error will be
+     * OUTPUT_BUFFER_TOO_SMALL. */
+    std::size_t get_one_time_keys_binary(
+        std::uint8_t * output, std::size_t output_length
+    );
+
     /** Mark the current list of one_time_keys as being published. They
      * will no longer be returned by get_one_time_keys_json_length(). */
     std::size_t mark_keys_as_published();
@@ -143,6 +221,13 @@ std::size_t pickle_length(
 );
 
 
+/** The longest pickle_length() can be for this account, with as many one
+ * time keys as it has room for. */
+std::size_t max_pickle_length(
+    Account const & value
+);
+
+
 std::uint8_t * pickle(
     std::uint8_t * pos,
     Account const & value
@@ -155,6 +240,20 @@ std::uint8_t const * unpickle(
 );
 
 
+/** The most bytes at the start of an account pickle that
+ * unpickle_identity_keys() reads. */
+std::size_t identity_keys_pickle_length();
+
+
+/** Unpickle the identity keys at the start of an account pickle, leaving
+ * the account with no one time keys and identity_keys_only set. Returns
+ * where the one time keys start. */
+std::uint8_t const * unpickle_identity_keys(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    Account & value
+);
+
+
 } // namespace olm
 
 #endif /* OLM_ACCOUNT_HH_ */
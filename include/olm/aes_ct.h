@@ -0,0 +1,94 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* AES-256 in portable C without lookup tables, for when the CPU has no AES
+ * instructions. The state of four blocks is bitsliced across eight 64-bit
+ * words, so that the S-box is a fixed sequence of logic operations rather
+ * than a table lookup indexed by secret data, and the time taken doesn't
+ * depend on the key or the data. Modes which can work on several blocks at
+ * once (CBC decryption and counter mode) do four blocks for the price of
+ * one; CBC encryption is done a block at a time.
+ */
+
+#ifndef OLM_AES_CT_H_
+#define OLM_AES_CT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/crypto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Expand a 32 byte AES-256 key into AES256_CT_ROUND_KEYS_WORDS words of
+ * bitsliced round keys, which serve for both encryption and decryption.
+ */
+void _olm_aes_ct_expand_key(
+    uint8_t const * key,
+    uint64_t * round_keys
+);
+
+/**
+ * Encrypt whole blocks on their own, without chaining them together. The
+ * input and output may be the same buffer.
+ */
+void _olm_aes_ct_encrypt_blocks(
+    uint64_t const * round_keys,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+/**
+ * CBC-encrypt whole blocks. iv is updated to the last output block so that
+ * further blocks can be chained on with another call.
+ */
+void _olm_aes_ct_encrypt_cbc(
+    uint64_t const * round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+/**
+ * CBC-decrypt whole blocks. iv is updated to the last input block so that
+ * further blocks can be chained on with another call. The input and output
+ * may be the same buffer.
+ */
+void _olm_aes_ct_decrypt_cbc(
+    uint64_t const * round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+/**
+ * Encrypt or decrypt whole blocks in counter mode, as
+ * _olm_aes_hw_encrypt_ctr. The input and output may be the same buffer.
+ */
+void _olm_aes_ct_encrypt_ctr(
+    uint64_t const * round_keys,
+    uint8_t * counter,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_AES_CT_H_ */
@@ -0,0 +1,133 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* AES-256-CBC using the AES instructions of the CPU (AES-NI on x86, the
+ * Crypto Extensions on ARMv8). These functions must only be called when
+ * _olm_aes_hw_available() returns true; crypto.cpp falls back to the
+ * reference implementation from lib/crypto-algorithms otherwise.
+ *
+ * The AES-256-GCM kernels also need the carry-less multiply, and must only
+ * be called when _olm_aes_hw_gcm_available() returns true.
+ */
+
+#ifndef OLM_AES_HW_H_
+#define OLM_AES_HW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/crypto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** returns non-zero if this build and this CPU support the hardware path */
+int _olm_aes_hw_available(void);
+
+/**
+ * Expand a 32 byte AES-256 key into the encryption round keys, and
+ * optionally (if decrypt_round_keys is non-NULL) into the decryption round
+ * keys for the equivalent inverse cipher.
+ */
+void _olm_aes_hw_expand_key(
+    uint8_t const * key,
+    uint8_t * encrypt_round_keys,
+    uint8_t * decrypt_round_keys
+);
+
+/**
+ * CBC-encrypt whole blocks. iv is updated to the last output block so that
+ * further blocks can be chained on with another call.
+ */
+void _olm_aes_hw_encrypt_cbc(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+/**
+ * CBC-decrypt whole blocks. iv is updated to the last input block so that
+ * further blocks can be chained on with another call. The input and output
+ * may be the same buffer.
+ */
+void _olm_aes_hw_decrypt_cbc(
+    uint8_t const * decrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+/**
+ * Encrypt or decrypt whole blocks in counter mode. The last 8 bytes of the
+ * counter block are a big-endian counter, which wraps round without
+ * carrying into the first 8. counter is updated to the block after the last
+ * one. The input and output may be the same buffer.
+ */
+void _olm_aes_hw_encrypt_ctr(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * counter,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+/** returns non-zero if this build and this CPU support the GCM kernels */
+int _olm_aes_hw_gcm_available(void);
+
+/**
+ * GHASH whole blocks: for each block, state = (state ^ block) * hash_key in
+ * GF(2^128). The state and the hash key are 16 byte blocks in the byte order
+ * of the GCM specification.
+ */
+void _olm_aes_hw_ghash(
+    uint8_t const * hash_key,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks
+);
+
+/**
+ * Encrypt whole blocks in the counter mode of GCM, and GHASH the ciphertext
+ * into state. counter is the counter block for the first block, and is
+ * updated to the one after the last block.
+ */
+void _olm_aes_hw_gcm_encrypt(
+    uint8_t const * encrypt_round_keys,
+    uint8_t const * hash_key,
+    uint8_t * counter,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+/**
+ * As _olm_aes_hw_gcm_encrypt, but GHASHing the input, which is the
+ * ciphertext, before decrypting it. The input and output may be the same
+ * buffer.
+ */
+void _olm_aes_hw_gcm_decrypt(
+    uint8_t const * encrypt_round_keys,
+    uint8_t const * hash_key,
+    uint8_t * counter,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_AES_HW_H_ */
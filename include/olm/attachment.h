@@ -0,0 +1,143 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The cipher of Matrix encrypted attachments: AES-256 in counter mode, with
+ * a SHA-256 of the ciphertext, given the file a piece at a time so that it
+ * never needs to be held in memory at once. The key and IV go in the
+ * attachment's "key" and "iv", and the hash in its "hashes" as "sha256".
+ *
+ * The last 8 bytes of the IV are a big-endian counter, which wraps round
+ * without carrying into the first 8, as for WebCrypto's AES-CTR with a
+ * length of 64. New attachments should be given a random key and 8 random
+ * bytes followed by 8 zero bytes as the IV, so that the counter never
+ * wraps. */
+
+#ifndef OLM_ATTACHMENT_H_
+#define OLM_ATTACHMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct OlmAttachment OlmAttachment;
+
+/** The size of an attachment cipher object in bytes */
+size_t olm_attachment_size(void);
+
+/** Initialise an attachment cipher object using the supplied memory.
+ * The supplied memory must be at least olm_attachment_size() bytes */
+OlmAttachment * olm_attachment(
+    void *memory
+);
+
+/** A null terminated string describing the most recent error to happen to
+ * an attachment cipher */
+const char *olm_attachment_last_error(
+    const OlmAttachment *attachment
+);
+
+/** Clears the memory used to back this attachment cipher */
+size_t olm_clear_attachment(
+    OlmAttachment *attachment
+);
+
+/** The length of the key of an attachment */
+size_t olm_attachment_key_length(void);
+
+/** The length of the IV of an attachment */
+size_t olm_attachment_iv_length(void);
+
+/** The length of the hash of an attachment, which is unpadded base64 */
+size_t olm_attachment_hash_length(void);
+
+/**
+ * Start encrypting an attachment with the key and IV given.
+ *
+ * Returns olm_error() on failure. If the key or IV isn't the right length
+ * then olm_attachment_last_error() will be "BAD_ATTACHMENT_KEY".
+ */
+size_t olm_attachment_encrypt_init(
+    OlmAttachment *attachment,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * iv, size_t iv_length
+);
+
+/**
+ * Start decrypting an attachment with the key and IV given.
+ *
+ * Returns olm_error() on failure. If the key or IV isn't the right length
+ * then olm_attachment_last_error() will be "BAD_ATTACHMENT_KEY".
+ */
+size_t olm_attachment_decrypt_init(
+    OlmAttachment *attachment,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * iv, size_t iv_length
+);
+
+/**
+ * Encrypt or decrypt the next length bytes of the attachment, writing as
+ * many bytes to the output, which may be the same buffer as the input. The
+ * pieces can be any length, and give the same output however the
+ * attachment is split up. Returns length on success.
+ *
+ * Returns olm_error() on failure. If the attachment wasn't started, or has
+ * been finished, then olm_attachment_last_error() will be
+ * "BAD_STREAM_STATE". If the output buffer is smaller than length then it
+ * will be "OUTPUT_BUFFER_TOO_SMALL".
+ */
+size_t olm_attachment_update(
+    OlmAttachment *attachment,
+    uint8_t const * input, size_t length,
+    uint8_t * output, size_t output_length
+);
+
+/**
+ * Finish encrypting an attachment, writing the hash of its ciphertext to
+ * the hash buffer. Returns the length of the hash on success. The cipher
+ * must be started again before it can be used for another attachment.
+ *
+ * Returns olm_error() on failure. If the attachment wasn't started for
+ * encryption then olm_attachment_last_error() will be "BAD_STREAM_STATE".
+ * If the hash buffer is smaller than olm_attachment_hash_length() then it
+ * will be "OUTPUT_BUFFER_TOO_SMALL".
+ */
+size_t olm_attachment_encrypt_final(
+    OlmAttachment *attachment,
+    uint8_t * hash, size_t hash_length
+);
+
+/**
+ * Finish decrypting an attachment, checking the hash of its ciphertext
+ * against the hash given. The plaintext shouldn't be used unless this
+ * succeeds. Returns 0 on success. The cipher must be started again before
+ * it can be used for another attachment.
+ *
+ * Returns olm_error() on failure. If the attachment wasn't started for
+ * decryption then olm_attachment_last_error() will be "BAD_STREAM_STATE".
+ * If the hash doesn't match then it will be "BAD_MESSAGE_MAC".
+ */
+size_t olm_attachment_decrypt_final(
+    OlmAttachment *attachment,
+    uint8_t const * hash, size_t hash_length
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_ATTACHMENT_H_ */
@@ -61,7 +61,8 @@ size_t _olm_decode_base64_length(
  * The output can overlap with the first three quarters of the input buffer.
  * That is, the input pointers and output pointer may be the same.
  *
- * Returns number of bytes decoded
+ * Returns number of bytes decoded, or size_t(-1) if the input isn't valid
+ * base64, in which case the output may have been partly written.
  */
 size_t _olm_decode_base64(
     uint8_t const * input, size_t input_length,
@@ -57,6 +57,19 @@ std::uint8_t const * decode_base64(
     std::uint8_t * output
 );
 
+/**
+ * As decode_base64, but checks that the input is valid base64 as it decodes
+ * it. Returns the number of bytes decoded, or std::size_t(-1) if the input
+ * contains a character outside the base64 alphabet or has an impossible
+ * length. On failure error_position is set to the offset of the first bad
+ * character, or of the final character if the length is wrong, and the
+ * output may have been partly written.
+ */
+std::size_t decode_base64_strict(
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output, std::size_t & error_position
+);
+
 } // namespace olm
 
 
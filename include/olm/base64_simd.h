@@ -0,0 +1,62 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Vector kernels for the bulk of a base64 encode or decode (SSSE3 and AVX2 on
+ * x86, NEON on ARMv8). They handle whole blocks from the start of the input
+ * and leave the tail to the table loops in base64.cpp, which produce the same
+ * output. They must only be called when _olm_base64_simd_available() returns
+ * true.
+ */
+
+#ifndef OLM_BASE64_SIMD_H_
+#define OLM_BASE64_SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** returns non-zero if this build and this CPU support the vector kernels */
+int _olm_base64_simd_available(void);
+
+/**
+ * Encode as much of the start of the input as the kernels can, writing 4
+ * characters for every 3 bytes. Returns the number of input bytes encoded,
+ * which is a multiple of 3 and may be 0.
+ */
+size_t _olm_base64_simd_encode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+);
+
+/**
+ * Decode as much of the start of the input as the kernels can, writing 3
+ * bytes for every 4 characters. Stops before any block containing a
+ * character outside the base64 alphabet, so that the table loop decodes it
+ * as it always has. Returns the number of characters decoded, which is a
+ * multiple of 4 and may be 0.
+ */
+size_t _olm_base64_simd_decode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_BASE64_SIMD_H_ */
@@ -0,0 +1,59 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef OLM_CANONICAL_JSON_HH_
+#define OLM_CANONICAL_JSON_HH_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace olm {
+
+/**
+ * Rewrites the JSON object in the buffer as canonical JSON, the form that
+ * Matrix signs: no whitespace, the members of each object sorted by key,
+ * strings as UTF-8 with only the escapes they need, and integers of at most
+ * 2^53 - 1 as the only numbers. The canonical form is never longer than the
+ * input, so it is written in place. Returns its length, or std::size_t(-1)
+ * if the input isn't a JSON object that has a canonical form, in which case
+ * the buffer is left in an unspecified state.
+ */
+std::size_t canonical_json(
+    std::uint8_t * json, std::size_t json_length
+);
+
+/**
+ * Finds the string signatures[user_id][key_id] in canonical JSON and writes
+ * it, unescaped, to the output. Returns its length, or std::size_t(-1) if
+ * there is no such string or it is longer than output_length.
+ */
+std::size_t find_json_signature(
+    std::uint8_t const * json, std::size_t json_length,
+    std::uint8_t const * user_id, std::size_t user_id_length,
+    std::uint8_t const * key_id, std::size_t key_id_length,
+    std::uint8_t * output, std::size_t output_length
+);
+
+/**
+ * Removes the top level "signatures" and "unsigned" members from canonical
+ * JSON, which are left out of what is signed. Returns the new length.
+ */
+std::size_t strip_json_signatures(
+    std::uint8_t * json, std::size_t json_length
+);
+
+} // namespace olm
+
+
+#endif /* OLM_CANONICAL_JSON_HH_ */
@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "olm/crypto.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -131,6 +133,335 @@ extern const struct _olm_cipher_ops _olm_cipher_aes_sha_256_ops;
     (&((CIPHER)->base_cipher))
 
 
+/** length of the HMAC key derived by the aes_sha_256 cipher */
+#define OLM_CIPHER_AES_SHA_256_MAC_KEY_LENGTH 32
+
+/** length of the truncated MAC appended by the aes_sha_256 cipher */
+#define OLM_CIPHER_AES_SHA_256_MAC_LENGTH 8
+
+/** length of the blocks the aes_sha_256 cipher pads the plain-text to */
+#define OLM_CIPHER_AES_SHA_256_BLOCK_LENGTH 16
+
+/*
+ * The aes_sha_256 cipher's operations, for code that knows which cipher it
+ * uses. They do the same as calling through _olm_cipher_aes_sha_256_ops, but
+ * the lengths are inlined and encrypt and decrypt are called directly. The
+ * ops table stays the way to plug in other ciphers.
+ */
+
+/** As _olm_cipher_ops.mac_length for the aes_sha_256 cipher */
+static inline size_t _olm_cipher_aes_sha_256_mac_length(void) {
+    return OLM_CIPHER_AES_SHA_256_MAC_LENGTH;
+}
+
+/** As _olm_cipher_ops.encrypt_ciphertext_length for the aes_sha_256
+ * cipher: the plain-text padded to a whole number of AES blocks */
+static inline size_t _olm_cipher_aes_sha_256_ciphertext_length(
+    size_t plaintext_length
+) {
+    return plaintext_length + OLM_CIPHER_AES_SHA_256_BLOCK_LENGTH
+        - plaintext_length % OLM_CIPHER_AES_SHA_256_BLOCK_LENGTH;
+}
+
+/** As _olm_cipher_ops.decrypt_max_plaintext_length for the aes_sha_256
+ * cipher */
+static inline size_t _olm_cipher_aes_sha_256_max_plaintext_length(
+    size_t ciphertext_length
+) {
+    return ciphertext_length;
+}
+
+/** As _olm_cipher_ops.encrypt for the aes_sha_256 cipher */
+size_t _olm_cipher_aes_sha_256_encrypt(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * ciphertext, size_t ciphertext_length,
+    uint8_t * output, size_t output_length
+);
+
+/** As _olm_cipher_ops.decrypt for the aes_sha_256 cipher */
+size_t _olm_cipher_aes_sha_256_decrypt(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t input_length,
+    uint8_t const * ciphertext, size_t ciphertext_length,
+    uint8_t * plaintext, size_t max_plaintext_length
+);
+
+/** The cipher as an aes_sha_256 cipher if it is one, or NULL if it isn't */
+static inline const struct _olm_cipher_aes_sha_256 * _olm_cipher_as_aes_sha_256(
+    const struct _olm_cipher *cipher
+) {
+    return cipher->ops == &_olm_cipher_aes_sha_256_ops
+        ? (const struct _olm_cipher_aes_sha_256 *)cipher : NULL;
+}
+
+/*
+ * The cipher's operations for code that is given a cipher, taking the direct
+ * path if it is the aes_sha_256 cipher and calling through its ops table if
+ * it isn't.
+ */
+
+static inline size_t _olm_cipher_mac_length(
+    const struct _olm_cipher *cipher
+) {
+    return _olm_cipher_as_aes_sha_256(cipher)
+        ? _olm_cipher_aes_sha_256_mac_length()
+        : cipher->ops->mac_length(cipher);
+}
+
+static inline size_t _olm_cipher_encrypt_ciphertext_length(
+    const struct _olm_cipher *cipher,
+    size_t plaintext_length
+) {
+    return _olm_cipher_as_aes_sha_256(cipher)
+        ? _olm_cipher_aes_sha_256_ciphertext_length(plaintext_length)
+        : cipher->ops->encrypt_ciphertext_length(cipher, plaintext_length);
+}
+
+static inline size_t _olm_cipher_decrypt_max_plaintext_length(
+    const struct _olm_cipher *cipher,
+    size_t ciphertext_length
+) {
+    return _olm_cipher_as_aes_sha_256(cipher)
+        ? _olm_cipher_aes_sha_256_max_plaintext_length(ciphertext_length)
+        : cipher->ops->decrypt_max_plaintext_length(cipher, ciphertext_length);
+}
+
+static inline size_t _olm_cipher_encrypt(
+    const struct _olm_cipher *cipher,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * ciphertext, size_t ciphertext_length,
+    uint8_t * output, size_t output_length
+) {
+    const struct _olm_cipher_aes_sha_256 *aes_sha_256 =
+        _olm_cipher_as_aes_sha_256(cipher);
+    if (aes_sha_256) {
+        return _olm_cipher_aes_sha_256_encrypt(
+            aes_sha_256, key, key_length, plaintext, plaintext_length,
+            ciphertext, ciphertext_length, output, output_length
+        );
+    }
+    return cipher->ops->encrypt(
+        cipher, key, key_length, plaintext, plaintext_length,
+        ciphertext, ciphertext_length, output, output_length
+    );
+}
+
+static inline size_t _olm_cipher_decrypt(
+    const struct _olm_cipher *cipher,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t input_length,
+    uint8_t const * ciphertext, size_t ciphertext_length,
+    uint8_t * plaintext, size_t max_plaintext_length
+) {
+    const struct _olm_cipher_aes_sha_256 *aes_sha_256 =
+        _olm_cipher_as_aes_sha_256(cipher);
+    if (aes_sha_256) {
+        return _olm_cipher_aes_sha_256_decrypt(
+            aes_sha_256, key, key_length, input, input_length,
+            ciphertext, ciphertext_length, plaintext, max_plaintext_length
+        );
+    }
+    return cipher->ops->decrypt(
+        cipher, key, key_length, input, input_length,
+        ciphertext, ciphertext_length, plaintext, max_plaintext_length
+    );
+}
+
+/**
+ * The keys derived by an aes_sha_256 cipher from a given key. Keeping hold
+ * of a context saves repeating the HKDF and the AES key setup when many
+ * things are encrypted or decrypted under the same key, as when pickling a
+ * whole store of objects under one pickle key.
+ */
+struct _olm_cipher_aes_sha_256_context {
+    struct _olm_aes256_key_schedule aes_key_schedule;
+    struct _olm_hmac_sha256_key mac_key;
+    struct _olm_aes256_iv aes_iv;
+};
+
+/**
+ * Derive the keys used by the cipher from the key material. The context
+ * holds secret keys, so should be cleared with
+ * _olm_cipher_aes_sha_256_clear_context after use.
+ */
+void _olm_cipher_aes_sha_256_init_context(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * key, size_t key_length,
+    struct _olm_cipher_aes_sha_256_context *context
+);
+
+/**
+ * Derive the keys for count contexts at once, as if by
+ * _olm_cipher_aes_sha_256_init_context on each, from key material of the
+ * same length. The derivations run side by side where the CPU allows it.
+ */
+void _olm_cipher_aes_sha_256_init_context_multi(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * const * keys, size_t key_length,
+    struct _olm_cipher_aes_sha_256_context * const * contexts,
+    size_t count
+);
+
+/** Wipe the keys held in the context */
+void _olm_cipher_aes_sha_256_clear_context(
+    struct _olm_cipher_aes_sha_256_context *context
+);
+
+/**
+ * As _olm_cipher_ops.encrypt, but using the keys held in the context rather
+ * than deriving them from the key material.
+ */
+size_t _olm_cipher_aes_sha_256_context_encrypt(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * ciphertext, size_t ciphertext_length,
+    uint8_t * output, size_t output_length
+);
+
+/**
+ * As _olm_cipher_ops.decrypt, but using the keys held in the context rather
+ * than deriving them from the key material.
+ */
+size_t _olm_cipher_aes_sha_256_context_decrypt(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    uint8_t const * input, size_t input_length,
+    uint8_t const * ciphertext, size_t ciphertext_length,
+    uint8_t * plaintext, size_t max_plaintext_length
+);
+
+
+/**
+ * An aes_sha_256 encryption or decryption which is given its input a piece
+ * at a time, so that neither the whole plaintext nor the whole ciphertext
+ * has to be in memory at once. It holds secret keys, so is wiped when it is
+ * ended, and should be wiped with _olm_unset if it is abandoned.
+ */
+struct _olm_cipher_aes_sha_256_stream {
+    struct _olm_cipher_aes_sha_256_context keys;
+    struct _olm_hmac_sha256_context mac;
+    uint8_t chain[AES256_IV_LENGTH];
+    /* the plaintext not yet encrypted, when encrypting */
+    uint8_t block[AES256_IV_LENGTH];
+    size_t block_length;
+};
+
+/**
+ * Start encrypting with the keys held in the context. mac_prefix is the
+ * part of the message before the ciphertext, which the MAC covers too.
+ */
+void _olm_cipher_aes_sha_256_encrypt_stream_begin(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * mac_prefix, size_t mac_prefix_length
+);
+
+/**
+ * Encrypt some more plaintext, writing whole blocks of ciphertext to the
+ * output. Returns the number of bytes written, which is a multiple of the
+ * block size and at most plaintext_length + 15.
+ */
+size_t _olm_cipher_aes_sha_256_encrypt_stream_update(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * ciphertext
+);
+
+/**
+ * Pad and encrypt the rest of the plaintext, writing the last block of the
+ * ciphertext, and write the MAC, which is
+ * _olm_cipher_aes_sha_256_mac_length() bytes. Wipes the stream. Returns the
+ * number of bytes of ciphertext written.
+ */
+size_t _olm_cipher_aes_sha_256_encrypt_stream_end(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t * ciphertext, uint8_t * mac
+);
+
+/**
+ * Check the MAC at the end of the input, without decrypting anything.
+ * Returns 0 if it is right, or std::size_t(-1) if it isn't or the
+ * ciphertext isn't a whole number of blocks.
+ */
+size_t _olm_cipher_aes_sha_256_context_verify(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    uint8_t const * input, size_t input_length,
+    size_t ciphertext_length
+);
+
+/**
+ * As _olm_cipher_aes_sha_256_context_verify, for an input held in segments:
+ * the first input_length bytes of the segment_count segments.
+ */
+size_t _olm_cipher_aes_sha_256_context_verify_segments(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    const OlmIovec * segments, size_t segment_count, size_t input_length,
+    size_t ciphertext_length
+);
+
+/**
+ * Start decrypting with the keys held in the context, once the MAC has been
+ * checked with _olm_cipher_aes_sha_256_context_verify.
+ */
+void _olm_cipher_aes_sha_256_decrypt_stream_begin(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    struct _olm_cipher_aes_sha_256_stream *stream
+);
+
+/**
+ * As _olm_cipher_aes_sha_256_decrypt_stream_begin, but for input which can
+ * only be read once, so that the MAC has to be worked out as the ciphertext
+ * goes by. Every block of ciphertext, including the last, must be passed to
+ * _olm_cipher_aes_sha_256_decrypt_stream_mac, and the plaintext mustn't be
+ * used until _olm_cipher_aes_sha_256_decrypt_stream_verify has checked the
+ * MAC.
+ */
+void _olm_cipher_aes_sha_256_decrypt_stream_begin_with_mac(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    struct _olm_cipher_aes_sha_256_stream *stream
+);
+
+/** Add some more ciphertext to the MAC being worked out by the stream */
+void _olm_cipher_aes_sha_256_decrypt_stream_mac(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * ciphertext, size_t ciphertext_length
+);
+
+/**
+ * Check the MAC worked out by the stream against the
+ * _olm_cipher_aes_sha_256_mac_length() bytes given, before the last block is
+ * decrypted. Returns 0 if it is right, or std::size_t(-1) if it isn't.
+ */
+size_t _olm_cipher_aes_sha_256_decrypt_stream_verify(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * mac
+);
+
+/**
+ * Decrypt whole blocks of ciphertext which aren't the last block into the
+ * output, which may be the same buffer.
+ */
+void _olm_cipher_aes_sha_256_decrypt_stream_update(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * ciphertext, size_t block_count,
+    uint8_t * output
+);
+
+/**
+ * Decrypt the last block of ciphertext into the AES256_IV_LENGTH (16) byte
+ * output, and wipe the stream. Returns the number of bytes of plaintext in
+ * the block once the padding is stripped, or std::size_t(-1) if the padding
+ * is longer than a block.
+ */
+size_t _olm_cipher_aes_sha_256_decrypt_stream_end(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * ciphertext, uint8_t * output
+);
+
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,66 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Runtime detection of the CPU features used by the accelerated crypto
+ * backends.
+ */
+
+#ifndef OLM_CPU_H_
+#define OLM_CPU_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** AES round instructions: AES-NI on x86, the Crypto Extensions on ARMv8 */
+#define OLM_CPU_FEATURE_AES (1u << 0)
+
+/** SHA-256 instructions: the SHA extensions on x86, SHA2 on ARMv8 */
+#define OLM_CPU_FEATURE_SHA256 (1u << 1)
+
+/** 128-bit byte shuffles: SSSE3 on x86, NEON on ARM (always present on
+ * ARMv8), SIMD128 on WebAssembly */
+#define OLM_CPU_FEATURE_SIMD128 (1u << 2)
+
+/** 256-bit integer vectors: AVX2 on x86, with OS support for the registers */
+#define OLM_CPU_FEATURE_AVX2 (1u << 3)
+
+/** 64-bit carry-less multiplication: PCLMULQDQ on x86, PMULL on ARMv8 */
+#define OLM_CPU_FEATURE_CLMUL (1u << 4)
+
+/** SHA-512 instructions: SHA512 (ARMv8.2) on ARM */
+#define OLM_CPU_FEATURE_SHA512 (1u << 5)
+
+/**
+ * Get the set of OLM_CPU_FEATURE_* flags supported by the CPU we are running
+ * on, restricted by the mask set with _olm_cpu_set_feature_mask. The CPU is
+ * only probed on the first call.
+ */
+uint32_t _olm_cpu_features(void);
+
+/**
+ * Restrict the features reported by _olm_cpu_features to those in the mask.
+ * Used by the tests to exercise the portable code on machines which support
+ * the accelerated paths.
+ */
+void _olm_cpu_set_feature_mask(uint32_t mask);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_CPU_H_ */
@@ -23,6 +23,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "olm/iovec.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -65,6 +67,52 @@ struct _olm_aes256_iv {
     uint8_t iv[AES256_IV_LENGTH];
 };
 
+/** number of rounds for AES-256 */
+#define AES256_ROUNDS 14
+
+/** length of an expanded AES-256 key schedule in bytes: one 16 byte key per
+ * round plus the initial whitening key */
+#define AES256_ROUND_KEYS_LENGTH (16 * (AES256_ROUNDS + 1))
+
+/** number of 64-bit words in an AES-256 key schedule for the bitsliced
+ * implementation: two per round key */
+#define AES256_CT_ROUND_KEYS_WORDS (2 * (AES256_ROUNDS + 1))
+
+/** An expanded AES-256 key, so that the key setup can be shared by several
+ * encryptions or decryptions under the same key. */
+struct _olm_aes256_key_schedule {
+    /** non-zero if the hardware round keys are in use */
+    int hardware;
+    /** round keys for the bitsliced implementation, when there are no AES
+     * instructions */
+    uint64_t ct_round_keys[AES256_CT_ROUND_KEYS_WORDS];
+    /** round keys for the AES instructions of the CPU */
+    uint8_t encrypt_round_keys[AES256_ROUND_KEYS_LENGTH];
+    uint8_t decrypt_round_keys[AES256_ROUND_KEYS_LENGTH];
+    /** non-zero if the crypto provider's AES-256-CBC should be used, when
+     * it is given the key itself. The bitsliced round keys are set up too,
+     * for if the provider goes away. */
+    int provider;
+    uint8_t key[AES256_KEY_LENGTH];
+};
+
+
+/** length of an AES-GCM nonce */
+#define AES_GCM_NONCE_LENGTH 12
+
+/** length of an AES-GCM authentication tag */
+#define AES_GCM_TAG_LENGTH 16
+
+/** An AES-256-GCM key, expanded for the AES rounds and with the GHASH key
+ * worked out, so that both can be shared by many encryptions. */
+struct _olm_aes_gcm_key {
+    struct _olm_aes256_key_schedule schedule;
+    /** non-zero if the GHASH and counter mode use the kernels of the CPU */
+    int hardware;
+    /** the GHASH key, the encryption of the zero block */
+    uint8_t hash_key[16];
+};
+
 
 struct _olm_curve25519_public_key {
     uint8_t public_key[CURVE25519_KEY_LENGTH];
@@ -87,6 +135,19 @@ struct _olm_ed25519_private_key {
     uint8_t private_key[ED25519_PRIVATE_KEY_LENGTH];
 };
 
+/** An ed25519 public key decoded ahead of time, for checking many signatures
+ * by the same key. */
+struct _olm_ed25519_prepared_key {
+    struct _olm_ed25519_public_key public_key;
+    /** non-zero if public_key decoded to a point on the curve */
+    int valid;
+    /** the odd multiples A, 3A, ..., 15A of the negated key, as the limbs of
+     * the ge_cached points used by lib/ed25519. These are 40 32-bit or 20
+     * 64-bit limbs per point depending on the field representation, the same
+     * size either way. */
+    uint64_t table[8][20];
+};
+
 struct _olm_ed25519_key_pair {
     struct _olm_ed25519_public_key public_key;
     struct _olm_ed25519_private_key private_key;
@@ -119,6 +180,133 @@ size_t _olm_crypto_aes_decrypt_cbc(
 );
 
 
+/** Expands an AES256 key for use with the *_with_schedule functions below.
+ * The schedule should be cleared with _olm_unset when it is no longer
+ * needed. */
+void _olm_crypto_aes_key_setup(
+    const struct _olm_aes256_key *key,
+    struct _olm_aes256_key_schedule *schedule
+);
+
+/** As _olm_crypto_aes_encrypt_cbc, but using an expanded key. */
+void _olm_crypto_aes_encrypt_cbc_with_schedule(
+    const struct _olm_aes256_key_schedule *schedule,
+    const struct _olm_aes256_iv *iv,
+    const uint8_t * input, size_t input_length,
+    uint8_t * output
+);
+
+/** As _olm_crypto_aes_decrypt_cbc, but using an expanded key. */
+size_t _olm_crypto_aes_decrypt_cbc_with_schedule(
+    const struct _olm_aes256_key_schedule *schedule,
+    const struct _olm_aes256_iv *iv,
+    const uint8_t * input, size_t input_length,
+    uint8_t * output
+);
+
+/** CBC-encrypt whole blocks of input, without padding. chain holds the IV,
+ * and is updated to the last output block so that more blocks can be
+ * chained on by another call. */
+void _olm_crypto_aes_encrypt_cbc_blocks(
+    const struct _olm_aes256_key_schedule *schedule,
+    uint8_t chain[AES256_IV_LENGTH],
+    const uint8_t * input, size_t block_count,
+    uint8_t * output
+);
+
+/** CBC-decrypt whole blocks of input, leaving any padding in place. chain
+ * holds the IV, and is updated to the last input block so that more blocks
+ * can be chained on by another call. The input and output may be the same
+ * buffer. */
+void _olm_crypto_aes_decrypt_cbc_blocks(
+    const struct _olm_aes256_key_schedule *schedule,
+    uint8_t chain[AES256_IV_LENGTH],
+    const uint8_t * input, size_t block_count,
+    uint8_t * output
+);
+
+/** Encrypts or decrypts whole blocks of input with AES-256 in counter mode.
+ * The last 8 bytes of the counter block are a big-endian counter, which
+ * wraps round without carrying into the first 8, as for WebCrypto's AES-CTR
+ * with a length of 64. counter is updated to the block after the last one,
+ * so that more blocks can follow with another call. The input and output
+ * may be the same buffer. */
+void _olm_crypto_aes_ctr_blocks(
+    const struct _olm_aes256_key_schedule *schedule,
+    uint8_t counter[AES256_IV_LENGTH],
+    const uint8_t * input, size_t block_count,
+    uint8_t * output
+);
+
+
+/** Expands an AES256 key for use with the AES-GCM functions below. The key
+ * should be cleared with _olm_unset when it is no longer needed. */
+void _olm_crypto_aes_gcm_key_setup(
+    const struct _olm_aes256_key *key,
+    struct _olm_aes_gcm_key *gcm_key
+);
+
+/** Encrypts the input with AES-256-GCM, writing input_length bytes of
+ * ciphertext and an AES_GCM_TAG_LENGTH byte tag which also authenticates the
+ * associated data. The nonce must never be used twice with the same key. The
+ * input and output may be the same buffer. */
+void _olm_crypto_aes_gcm_encrypt(
+    const struct _olm_aes_gcm_key *key,
+    const uint8_t nonce[AES_GCM_NONCE_LENGTH],
+    const uint8_t * associated_data, size_t associated_data_length,
+    const uint8_t * input, size_t input_length,
+    uint8_t * output,
+    uint8_t tag[AES_GCM_TAG_LENGTH]
+);
+
+/** Checks the tag and decrypts the input with AES-256-GCM, in a single pass.
+ * Returns input_length on success or std::size_t(-1) if the tag doesn't
+ * match, in which case the output is wiped. The input and output may be the
+ * same buffer. */
+size_t _olm_crypto_aes_gcm_decrypt(
+    const struct _olm_aes_gcm_key *key,
+    const uint8_t nonce[AES_GCM_NONCE_LENGTH],
+    const uint8_t * associated_data, size_t associated_data_length,
+    const uint8_t * input, size_t input_length,
+    const uint8_t tag[AES_GCM_TAG_LENGTH],
+    uint8_t * output
+);
+
+/** A check of an AES-256-GCM tag which is given the ciphertext a piece at a
+ * time, and only hashes it, without decrypting it. */
+struct _olm_aes_gcm_verify_context {
+    uint8_t state[16];
+    /** the ciphertext not yet hashed, less than a block of it */
+    uint8_t block[16];
+    size_t block_length;
+    uint64_t associated_data_length;
+    uint64_t ciphertext_length;
+};
+
+/** Start checking a tag, over the associated data and ciphertext to come */
+void _olm_crypto_aes_gcm_verify_begin(
+    const struct _olm_aes_gcm_key *key,
+    struct _olm_aes_gcm_verify_context *context,
+    const uint8_t * associated_data, size_t associated_data_length
+);
+
+/** Add some more ciphertext to the tag being checked */
+void _olm_crypto_aes_gcm_verify_update(
+    const struct _olm_aes_gcm_key *key,
+    struct _olm_aes_gcm_verify_context *context,
+    const uint8_t * ciphertext, size_t ciphertext_length
+);
+
+/** Finish checking the tag, and wipe the context. Returns 0 if the tag
+ * matches, or std::size_t(-1) if it doesn't. */
+size_t _olm_crypto_aes_gcm_verify_end(
+    const struct _olm_aes_gcm_key *key,
+    struct _olm_aes_gcm_verify_context *context,
+    const uint8_t nonce[AES_GCM_NONCE_LENGTH],
+    const uint8_t tag[AES_GCM_TAG_LENGTH]
+);
+
+
 /** Computes SHA-256 of the input. The output buffer must be a least
  * SHA256_OUTPUT_LENGTH (32) bytes long. */
 void _olm_crypto_sha256(
@@ -126,6 +314,42 @@ void _olm_crypto_sha256(
     uint8_t * output
 );
 
+/** A SHA-256 which is given its input a piece at a time. The fields are
+ * those of the SHA-256 context it wraps. */
+struct _olm_sha256_context {
+    uint8_t data[64];
+    uint32_t datalen;
+    unsigned long long bitlen;
+    uint32_t state[8];
+};
+
+/** Start a SHA-256 */
+void _olm_crypto_sha256_begin(
+    struct _olm_sha256_context *context
+);
+
+/** Add some more input to a SHA-256 */
+void _olm_crypto_sha256_update(
+    struct _olm_sha256_context *context,
+    uint8_t const * input, size_t input_length
+);
+
+/** Finish a SHA-256, writing the SHA256_OUTPUT_LENGTH (32) byte hash to
+ * output, and wipe the context */
+void _olm_crypto_sha256_end(
+    struct _olm_sha256_context *context,
+    uint8_t * output
+);
+
+/** Computes SHA-256 of count independent inputs, writing each hash to the
+ * corresponding output. Where the CPU has a multi-buffer kernel but no SHA
+ * instructions the inputs are hashed four or eight at a time, which works
+ * best when neighbouring inputs are about the same length. */
+void _olm_crypto_sha256_multi(
+    uint8_t const * const * inputs, size_t const * input_lengths,
+    uint8_t * const * outputs, size_t count
+);
+
 /** HMAC: Keyed-Hashing for Message Authentication
  * http://tools.ietf.org/html/rfc2104
  * Computes HMAC-SHA-256 of the input for the key. The output buffer must
@@ -136,6 +360,138 @@ void _olm_crypto_hmac_sha256(
     uint8_t * output
 );
 
+/** An HMAC-SHA-256 key, stored as the SHA-256 states after compressing the
+ * inner and outer padded keys. Computing an HMAC from a prepared key saves
+ * two of the four SHA-256 compressions needed for a short message, which
+ * adds up when one key is used for several HMACs in a row. */
+struct _olm_hmac_sha256_key {
+    uint32_t inner_state[8];
+    uint32_t outer_state[8];
+};
+
+/** Prepare an HMAC-SHA-256 key. The prepared key should be cleared with
+ * _olm_unset when it is no longer needed. */
+void _olm_crypto_hmac_sha256_init_key(
+    struct _olm_hmac_sha256_key *hmac_key,
+    uint8_t const * key, size_t key_length
+);
+
+/** Computes HMAC-SHA-256 of the input with a prepared key. The output buffer
+ * must be at least SHA256_OUTPUT_LENGTH (32) bytes long. */
+void _olm_crypto_hmac_sha256_with_key(
+    const struct _olm_hmac_sha256_key *hmac_key,
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+);
+
+/** Computes HMAC-SHA-256 of several inputs of the same length with the same
+ * prepared key, writing each result to the corresponding output. Short
+ * inputs are hashed in parallel where the CPU allows it. The inputs must not
+ * overlap the outputs. */
+void _olm_crypto_hmac_sha256_with_key_multi(
+    const struct _olm_hmac_sha256_key *hmac_key,
+    uint8_t const * const * inputs, size_t input_length,
+    uint8_t * const * outputs, size_t count
+);
+
+/** The most lanes _olm_crypto_hmac_sha256_lanes() can return */
+#define OLM_CRYPTO_SHA256_MAX_LANES 8
+
+/** The number of HMAC-SHA-256s with different keys that
+ * _olm_crypto_hmac_sha256_many_keys computes side by side: eight or four
+ * where a multi-buffer kernel beats hashing them one at a time, otherwise
+ * 1. */
+size_t _olm_crypto_hmac_sha256_lanes(void);
+
+/** Computes HMAC-SHA-256 of up to _olm_crypto_hmac_sha256_lanes() inputs at
+ * once, each under its own key. The keys are key_length bytes, at most 64,
+ * and the inputs input_length bytes, at most 55. Each output may be the key
+ * it is made with. */
+void _olm_crypto_hmac_sha256_many_keys(
+    uint8_t const * const * keys, size_t key_length,
+    uint8_t const * const * inputs, size_t input_length,
+    uint8_t * const * outputs, size_t count
+);
+
+/** Prepares count HMAC-SHA-256 keys, as if by
+ * _olm_crypto_hmac_sha256_init_key on each, side by side where the CPU
+ * allows it. The keys are key_length bytes, at most 64. */
+void _olm_crypto_hmac_sha256_init_key_multi(
+    struct _olm_hmac_sha256_key * const * hmac_keys,
+    uint8_t const * const * keys, size_t key_length,
+    size_t count
+);
+
+/** Computes HMAC-SHA-256 of count inputs of the same length, each with its
+ * own prepared key, writing each result to the corresponding output. Short
+ * inputs are hashed in parallel where the CPU allows it. */
+void _olm_crypto_hmac_sha256_with_keys_multi(
+    const struct _olm_hmac_sha256_key * const * hmac_keys,
+    uint8_t const * const * inputs, size_t input_length,
+    uint8_t * const * outputs, size_t count
+);
+
+/** An HMAC-SHA-256 which is given its input a piece at a time. The fields
+ * are those of the SHA-256 context it wraps. */
+struct _olm_hmac_sha256_context {
+    uint8_t data[64];
+    uint32_t datalen;
+    unsigned long long bitlen;
+    uint32_t state[8];
+};
+
+/** Start an HMAC-SHA-256 with a prepared key */
+void _olm_crypto_hmac_sha256_begin(
+    const struct _olm_hmac_sha256_key *hmac_key,
+    struct _olm_hmac_sha256_context *context
+);
+
+/** Add some more input to an HMAC-SHA-256 */
+void _olm_crypto_hmac_sha256_update(
+    struct _olm_hmac_sha256_context *context,
+    uint8_t const * input, size_t input_length
+);
+
+/** Finish an HMAC-SHA-256 started with the same key, writing the
+ * SHA256_OUTPUT_LENGTH (32) byte result to output, and wipe the context */
+void _olm_crypto_hmac_sha256_end(
+    const struct _olm_hmac_sha256_key *hmac_key,
+    struct _olm_hmac_sha256_context *context,
+    uint8_t * output
+);
+
+
+/** Encrypt the input with AES-256-CBC and PKCS#7 padding into ciphertext, and
+ * compute HMAC-SHA-256 of mac_input, which must contain the ciphertext
+ * buffer, into the 32 byte mac buffer. This makes one pass over the data in
+ * chunks small enough to still be in cache when they are hashed. The bytes of
+ * mac_input either side of the ciphertext must already be filled in. Returns
+ * the length of the ciphertext. */
+size_t _olm_crypto_aes_encrypt_cbc_then_hmac_sha256(
+    const struct _olm_aes256_key_schedule *schedule,
+    const struct _olm_aes256_iv *iv,
+    const struct _olm_hmac_sha256_key *hmac_key,
+    const uint8_t * input, size_t input_length,
+    const uint8_t * mac_input, size_t mac_input_length,
+    uint8_t * ciphertext,
+    uint8_t * mac
+);
+
+/** Check that HMAC-SHA-256 of mac_input starts with expected_mac, and decrypt
+ * the AES-256-CBC ciphertext within mac_input into output, in one pass over
+ * the data. The output is written as the ciphertext is authenticated, and is
+ * wiped again if the MAC or the padding turn out to be wrong, in which case
+ * this returns std::size_t(-1). Otherwise returns the length of the
+ * plaintext. */
+size_t _olm_crypto_hmac_sha256_then_aes_decrypt_cbc(
+    const struct _olm_aes256_key_schedule *schedule,
+    const struct _olm_aes256_iv *iv,
+    const struct _olm_hmac_sha256_key *hmac_key,
+    const uint8_t * mac_input, size_t mac_input_length,
+    const uint8_t * ciphertext, size_t ciphertext_length,
+    const uint8_t * expected_mac, size_t expected_mac_length,
+    uint8_t * output
+);
 
 /** HMAC-based Key Derivation Function (HKDF)
  * https://tools.ietf.org/html/rfc5869
@@ -147,6 +503,28 @@ void _olm_crypto_hkdf_sha256(
     uint8_t * output, size_t output_length
 );
 
+/** Derives output_length bytes from each of count inputs of the same
+ * length, as if by _olm_crypto_hkdf_sha256 on each with the same salt and
+ * info. Inputs of up to 55 bytes with an info of up to 22 bytes are derived
+ * side by side where the CPU allows it. */
+void _olm_crypto_hkdf_sha256_multi(
+    uint8_t const * const * inputs, size_t input_length,
+    uint8_t const * salt, size_t salt_length,
+    uint8_t const * info, size_t info_length,
+    uint8_t * const * outputs, size_t output_length,
+    size_t count
+);
+
+/** As _olm_crypto_hkdf_sha256, but with the salt already prepared as an
+ * HMAC key. This saves compressing the padded salt each time when the same
+ * salt is used for many derivations. */
+void _olm_crypto_hkdf_sha256_with_salt_key(
+    const struct _olm_hmac_sha256_key *salt_key,
+    uint8_t const * input, size_t input_length,
+    uint8_t const * info, size_t info_length,
+    uint8_t * output, size_t output_length
+);
+
 
 /** Generate a curve25519 key pair
  * random_32_bytes should be CURVE25519_RANDOM_LENGTH (32) bytes long.
@@ -156,6 +534,16 @@ void _olm_crypto_curve25519_generate_key(
     struct _olm_curve25519_key_pair *output
 );
 
+/** Generate count curve25519 key pairs, the same as calling
+ * _olm_crypto_curve25519_generate_key for each in turn but faster.
+ * random should be count * CURVE25519_RANDOM_LENGTH bytes long. Different
+ * ranges of keys can be generated on different threads.
+ */
+void _olm_crypto_curve25519_generate_keys(
+    size_t count, uint8_t const * random,
+    struct _olm_curve25519_key_pair *key_pairs
+);
+
 
 /** Create a shared secret using our private key and their public key.
  * The output buffer must be at least CURVE25519_SHARED_SECRET_LENGTH (32) bytes long.
@@ -166,6 +554,19 @@ void _olm_crypto_curve25519_shared_secret(
     uint8_t * output
 );
 
+/** Create count independent shared secrets, the same as calling
+ * _olm_crypto_curve25519_shared_secret for each of our_keys[i] and
+ * their_keys[i] in turn, but running the ladders side by side where the CPU
+ * can. The secrets are written one after another to outputs, which must be
+ * count * CURVE25519_SHARED_SECRET_LENGTH bytes long.
+ */
+void _olm_crypto_curve25519_shared_secrets(
+    size_t count,
+    const struct _olm_curve25519_key_pair * const * our_keys,
+    const struct _olm_curve25519_public_key * const * their_keys,
+    uint8_t * outputs
+);
+
 /** Generate an ed25519 key pair
  * random_32_bytes should be ED25519_RANDOM_LENGTH (32) bytes long.
  */
@@ -193,6 +594,62 @@ int _olm_crypto_ed25519_verify(
     const uint8_t * signature
 );
 
+/** Decode an ed25519 public key for _olm_crypto_ed25519_verify_prepared() */
+void _olm_crypto_ed25519_prepare_key(
+    const struct _olm_ed25519_public_key *their_key,
+    struct _olm_ed25519_prepared_key *prepared_key
+);
+
+/** Verify an ed25519 signature using a prepared key. This gives the same
+ * result as _olm_crypto_ed25519_verify() but skips decoding the key.
+ * The signature input buffer must be ED25519_SIGNATURE_LENGTH (64) bytes long.
+ * Returns non-zero if the signature is valid. */
+int _olm_crypto_ed25519_verify_prepared(
+    const struct _olm_ed25519_prepared_key *their_key,
+    const uint8_t * message, size_t message_length,
+    const uint8_t * signature
+);
+
+/** As _olm_crypto_ed25519_sign(), but for a message held in segments: the
+ * first message_length bytes of the segment_count segments. */
+void _olm_crypto_ed25519_sign_segments(
+    const struct _olm_ed25519_key_pair *our_key,
+    const OlmIovec * segments, size_t segment_count, size_t message_length,
+    uint8_t * output
+);
+
+/** As _olm_crypto_ed25519_verify_prepared(), but for a message held in
+ * segments: the first message_length bytes of the segment_count segments. */
+int _olm_crypto_ed25519_verify_prepared_segments(
+    const struct _olm_ed25519_prepared_key *their_key,
+    const OlmIovec * segments, size_t segment_count, size_t message_length,
+    const uint8_t * signature
+);
+
+/** Verify a number of ed25519 signatures at once, with the same results as
+ * _olm_crypto_ed25519_verify() on each. A key is only decoded once for a run
+ * of signatures by it. Each signature input buffer must be
+ * ED25519_SIGNATURE_LENGTH (64) bytes long; a NULL signature counts as
+ * invalid. Sets results[i] to 1 if the i-th signature is valid and to 0 if it
+ * isn't. Returns the number of signatures that were invalid. */
+size_t _olm_crypto_ed25519_verify_batch(
+    size_t count,
+    const struct _olm_ed25519_public_key *their_keys,
+    const uint8_t * const * messages, const size_t * message_lengths,
+    const uint8_t * const * signatures,
+    uint8_t * results
+);
+
+/** Sign count messages with the same key, giving the same signatures as
+ * calling _olm_crypto_ed25519_sign() for each. The signature for message i is
+ * written at outputs + i * ED25519_SIGNATURE_LENGTH. */
+void _olm_crypto_ed25519_sign_batch(
+    const struct _olm_ed25519_key_pair *our_key,
+    size_t count,
+    const uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * outputs
+);
+
 
 
 #ifdef __cplusplus
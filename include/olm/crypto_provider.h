@@ -0,0 +1,100 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Primitives from another crypto library, such as OpenSSL, BoringSSL or the
+ * platform's, for the library to use in place of its own kernels.
+ *
+ * The provider is asked for the primitives the rest of the library is built
+ * from rather than for whole operations, so that it is used everywhere: the
+ * SHA-256 compression function is behind every SHA-256, HMAC-SHA-256 and
+ * HKDF, AES-256-CBC is behind every AES mode the library uses, including
+ * the counter mode of attachments and the block cipher of AES-GCM, X25519 is
+ * behind key generation and every shared secret, and Ed25519 verification
+ * is behind every signature check of a contiguous message.
+ *
+ * Any of the functions may be NULL, when the library uses its own kernel for
+ * that primitive. Ed25519 signing always uses the library's own code, as
+ * its keys are kept expanded and the other libraries want the seed. */
+
+#ifndef OLM_CRYPTO_PROVIDER_H_
+#define OLM_CRYPTO_PROVIDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct OlmCryptoProvider {
+    /** passed as the first argument to each of the functions */
+    void * context;
+
+    /**
+     * Run the SHA-256 compression function over block_count 64 byte blocks,
+     * updating the eight word state in place. This is SHA256_Transform in
+     * OpenSSL and BoringSSL, given a context holding the state.
+     */
+    void (*sha256_transform)(
+        void * context, uint32_t state[8],
+        uint8_t const * blocks, size_t block_count
+    );
+
+    /**
+     * Encrypt, if encrypt is non-zero, or decrypt length bytes, a multiple
+     * of 16, with AES-256 in CBC mode and no padding. iv is updated to the
+     * last block of ciphertext so that calls can be chained, as by
+     * AES_cbc_encrypt. The input and output may be the same buffer.
+     */
+    void (*aes256_cbc)(
+        void * context, uint8_t const key[32], uint8_t iv[16],
+        uint8_t const * input, size_t length, uint8_t * output,
+        int encrypt
+    );
+
+    /** Compute the X25519 function of the scalar and the point into
+     * output, clamping the scalar as RFC 7748 describes. */
+    void (*x25519)(
+        void * context, uint8_t output[32],
+        uint8_t const scalar[32], uint8_t const point[32]
+    );
+
+    /** Check an Ed25519 signature, returning non-zero if it is valid */
+    int (*ed25519_verify)(
+        void * context, uint8_t const public_key[32],
+        uint8_t const * message, size_t message_length,
+        uint8_t const signature[64]
+    );
+};
+
+/**
+ * Use the provider's primitives from now on, or the library's own if
+ * provider is NULL. The table is copied, but the context must stay valid
+ * until the provider is replaced. The functions must be able to run on any
+ * thread that uses the library. The provider should be set once, before the
+ * library is used from other threads; olm_get_crypto_backend() then
+ * includes which primitives it covers.
+ *
+ * Objects keep working when the provider changes. Keys already set up for
+ * AES go on using the provider's AES-256-CBC while there is one, and the
+ * library's own otherwise.
+ */
+void olm_set_crypto_provider(const struct OlmCryptoProvider * provider);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_CRYPTO_PROVIDER_H_ */
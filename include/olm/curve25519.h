@@ -0,0 +1,101 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The Curve25519 scalar multiplication behind the _olm_crypto_curve25519_*
+ * functions. There is more than one implementation of it in lib/; this
+ * picks the fastest one available for the target.
+ */
+
+#ifndef OLM_CURVE25519_H_
+#define OLM_CURVE25519_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum _olm_curve25519_backend {
+    /** curve25519-donna.c: 10 limbs of 25.5 bits, for 32-bit machines */
+    OLM_CURVE25519_DONNA = 0,
+    /** curve25519-donna-c64.c: 5 limbs of 51 bits with 128-bit products, for
+     * 64-bit machines */
+    OLM_CURVE25519_DONNA_C64 = 1,
+    /** _olm_curve25519_scalarmult_paired from curve25519_mb.h: the vector
+     * kernel's 10 limb arithmetic two field operations at a time, for 32-bit
+     * ARM with NEON. Where the CPU lacks the vector unit this falls back to
+     * OLM_CURVE25519_DONNA. */
+    OLM_CURVE25519_PAIRED = 2,
+};
+
+/**
+ * Compute the Curve25519 function of the 32 byte secret and point, writing
+ * the 32 byte result to output, using the selected backend.
+ */
+void _olm_curve25519_scalarmult(
+    uint8_t * output, uint8_t const * secret, uint8_t const * point
+);
+
+/**
+ * Compute the public key for a 32 byte secret, i.e. the Curve25519 function
+ * of the secret and the base point, writing the 32 byte result to output.
+ *
+ * Rather than running the Montgomery ladder this multiplies the Ed25519 base
+ * point using the precomputed tables from lib/ed25519, and maps the result
+ * from Edwards to Montgomery form, which is several times faster.
+ */
+void _olm_curve25519_scalarmult_base(
+    uint8_t * output, uint8_t const * secret
+);
+
+/**
+ * As _olm_curve25519_scalarmult_base, for count secrets, 32 bytes each, one
+ * after another. The count 32 byte results are written one after another to
+ * outputs. The keys share the expensive field inversion, which makes each
+ * cheaper than computing it alone.
+ */
+void _olm_curve25519_scalarmult_base_batch(
+    size_t count, uint8_t * outputs, uint8_t const * secrets
+);
+
+/**
+ * As _olm_curve25519_scalarmult, for count independent secrets and points.
+ * Where there is a multi-lane kernel (see curve25519_mb.h) the ladders run
+ * side by side, enough at a time to fill its lanes, and any left over that
+ * would run faster alone run with the selected backend.
+ */
+void _olm_curve25519_scalarmult_many(
+    size_t count,
+    uint8_t * const * outputs,
+    uint8_t const * const * secrets,
+    uint8_t const * const * points
+);
+
+/** Get the backend that _olm_curve25519_scalarmult is using */
+enum _olm_curve25519_backend _olm_curve25519_get_backend(void);
+
+/**
+ * Switch backend. Returns zero (and leaves the backend unchanged) if the
+ * backend isn't built for this target. Used by the tests and benchmarks to
+ * compare the implementations.
+ */
+int _olm_curve25519_set_backend(enum _olm_curve25519_backend backend);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_CURVE25519_H_ */
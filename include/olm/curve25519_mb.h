@@ -0,0 +1,75 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Multi-lane X25519: the Montgomery ladder run for several independent
+ * secrets and points at once, one per 64-bit lane of a SIMD register (four
+ * with AVX2 on x86, two with NEON on ARM). A single ladder is a long chain
+ * of dependent multiplies, so this is how we speed up the three or four
+ * Diffie-Hellmans of a session setup, which don't depend on each other.
+ *
+ * The same field arithmetic also runs a single ladder with the two halves
+ * of each step in a pair of lanes, which on 32-bit ARM is faster than the
+ * scalar code.
+ */
+
+#ifndef OLM_CURVE25519_MB_H_
+#define OLM_CURVE25519_MB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** the number of ladders _olm_curve25519_scalarmult_mb runs at once on this
+ * CPU, or 1 if there is no vector kernel, when it mustn't be called */
+size_t _olm_curve25519_mb_lanes(void);
+
+/** the name of the vector kernel, for olm_get_crypto_backend, or "none" */
+const char * _olm_curve25519_mb_name(void);
+
+/**
+ * Compute the Curve25519 function of each of count 32 byte secrets and
+ * points, writing the 32 byte results to outputs, with the vector kernel.
+ * The results are the same as _olm_curve25519_scalarmult's. Running fewer
+ * than _olm_curve25519_mb_lanes() at a time costs the same as a full set.
+ */
+void _olm_curve25519_scalarmult_mb(
+    size_t count,
+    uint8_t * const * outputs,
+    uint8_t const * const * secrets,
+    uint8_t const * const * points
+);
+
+/** non-zero if _olm_curve25519_scalarmult_paired can be used: there is a
+ * vector kernel and the CPU has it */
+int _olm_curve25519_paired_available(void);
+
+/**
+ * Compute the Curve25519 function of one 32 byte secret and point with the
+ * vector kernel, running the independent multiplies within each step of a
+ * single ladder side by side in two lanes, rather than a ladder per lane.
+ * This is the OLM_CURVE25519_PAIRED backend of _olm_curve25519_scalarmult.
+ */
+void _olm_curve25519_scalarmult_paired(
+    uint8_t * output, uint8_t const * secret, uint8_t const * point
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_CURVE25519_MB_H_ */
@@ -0,0 +1,114 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The crypto kernels in use. Each accelerated backend tells us if it can run
+ * here; this picks between them and the portable code once, so that the hot
+ * loops make one indirect call rather than each asking the CPU feature layer
+ * for themselves.
+ */
+
+#ifndef OLM_DISPATCH_H_
+#define OLM_DISPATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/crypto_provider.h"
+#include "olm/curve25519.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _olm_dispatch_table {
+    /** the OLM_CPU_FEATURE_* flags the table was filled for */
+    uint32_t features;
+
+    /** Run the SHA-256 compression function over block_count 64 byte
+     * blocks, updating the 8 word state. Never NULL. */
+    void (*sha256_transform)(
+        uint32_t * state,
+        uint8_t const * blocks, size_t block_count
+    );
+
+    /** non-zero if sha256_transform uses the CPU's SHA instructions */
+    int sha256_hardware;
+
+    /** non-zero if _olm_sha256_x4_transform runs the lanes in parallel */
+    int sha256_x4;
+
+    /** non-zero if _olm_sha256_x8_transform runs the lanes in parallel */
+    int sha256_x8;
+
+    /** Run the SHA-512 compression function of Ed25519 over block_count
+     * 128 byte blocks, updating the 8 word state. Never NULL. */
+    void (*sha512_transform)(
+        uint64_t * state,
+        uint8_t const * blocks, size_t block_count
+    );
+
+    /** non-zero if sha512_transform is one of the _olm_sha512_hw kernels */
+    int sha512_hardware;
+
+    /** non-zero if new AES key schedules should use the _olm_aes_hw_*
+     * kernels. A schedule remembers which kernels it was expanded for. */
+    int aes_hardware;
+
+    /** non-zero if new AES-GCM keys should use the _olm_aes_hw_gcm_*
+     * kernels for the GHASH and counter mode */
+    int aes_gcm_hardware;
+
+    /** The vector kernels for the bulk of a base64 encode and decode, as
+     * described in base64_simd.h, or NULL if there are none. */
+    size_t (*base64_encode)(
+        uint8_t const * input, size_t input_length,
+        uint8_t * output
+    );
+    size_t (*base64_decode)(
+        uint8_t const * input, size_t input_length,
+        uint8_t * output
+    );
+
+    /** the implementation behind _olm_curve25519_scalarmult */
+    enum _olm_curve25519_backend curve25519;
+
+    /** the number of ladders _olm_curve25519_scalarmult_mb runs at once, or
+     * 1 if _olm_curve25519_scalarmult_many should do one at a time */
+    size_t curve25519_lanes;
+
+    /** the provider set with olm_set_crypto_provider, or NULL. Its
+     * sha256_transform is already behind the one above, and the vector
+     * kernels are turned off for whatever it provides. */
+    const struct OlmCryptoProvider * provider;
+
+    /** how many times the provider had been set when the table was filled */
+    unsigned provider_generation;
+
+    /** a description of the above, as returned by olm_get_crypto_backend */
+    char description[192];
+};
+
+/**
+ * Get the kernels to use. The table is filled on the first call, and again
+ * whenever the CPU feature mask, the Curve25519 backend or the crypto
+ * provider has been changed since, which is only done while single threaded.
+ */
+const struct _olm_dispatch_table * _olm_crypto_dispatch(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_DISPATCH_H_ */
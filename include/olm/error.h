@@ -51,6 +51,106 @@ enum OlmErrorCode {
      */
     OLM_BAD_SIGNATURE = 14,
 
+    /**
+     * Attempt to unpickle a session into memory created with smaller limits
+     * than the pickled session
+     */
+    OLM_SESSION_TOO_SMALL = 15,
+
+    /**
+     * Attempt to unpickle an account into memory created with room for fewer
+     * one time keys than the pickled account
+     */
+    OLM_ACCOUNT_TOO_SMALL = 16,
+
+    /**
+     * Attempt to apply a session delta pickle to a session that isn't in the
+     * state the delta was taken from
+     */
+    OLM_SESSION_DELTA_MISMATCH = 17,
+
+    /**
+     * Attempt to load a group session from a store which doesn't hold it
+     */
+    OLM_UNKNOWN_SESSION_ID = 18,
+
+    /**
+     * Attempt to add to a store, index or ledger which has no room for it
+     */
+    OLM_STORE_FULL = 19,
+
+    /**
+     * A compact session's allocator had no room for its skipped message keys
+     */
+    OLM_ALLOCATION_FAILED = 20,
+
+    /**
+     * A group session with replay detection has already decrypted a message
+     * at this index
+     */
+    OLM_DUPLICATE_MESSAGE_INDEX = 21,
+
+    /**
+     * Decrypting the message would take the group session ratchet further
+     * than the session's limit
+     */
+    OLM_RATCHET_DISTANCE_EXCEEDED = 22,
+
+    /**
+     * A stream was used before it was started, or given more or less input
+     * than it was started with
+     */
+    OLM_BAD_STREAM_STATE = 23,
+
+    /**
+     * The library has no source of random bytes on this platform, or the
+     * operating system failed to supply them
+     */
+    OLM_RANDOM_UNAVAILABLE = 24,
+
+    /**
+     * The input wasn't a JSON object that has a canonical form
+     */
+    OLM_INVALID_JSON = 25,
+
+    /**
+     * The account was loaded with only its identity keys, so doesn't have
+     * its one time keys
+     */
+    OLM_PARTIAL_ACCOUNT = 26,
+
+    /**
+     * The session changed between trying to decrypt a message and
+     * committing it, so the trial no longer applies
+     */
+    OLM_SESSION_CHANGED = 27,
+
+    /**
+     * The key or IV given for an attachment wasn't the right length
+     */
+    OLM_BAD_ATTACHMENT_KEY = 28,
+
+    /**
+     * A journal's buffer has no room for the record until it is committed
+     */
+    OLM_JOURNAL_FULL = 29,
+
+    /**
+     * A journal couldn't write a batch of records to its log
+     */
+    OLM_JOURNAL_WRITE_FAILED = 30,
+
+    /**
+     * A batch decrypt left the message for later because it would have cost
+     * more than the batch had left to spend
+     */
+    OLM_DECRYPTION_DEFERRED = 31,
+
+    /**
+     * The writer or reader of a streamed pickle failed
+     */
+    OLM_PICKLE_STREAM_FAILED = 32,
+
     /* remember to update the list of string constants in error.c when updating
      * this list. */
 };
@@ -0,0 +1,128 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* How the batch functions spread their work over threads. The library never
+ * starts any threads itself; instead the caller passes an executor which
+ * runs the independent jobs a batch is split into however it likes. Every
+ * function which can spread its work takes the same executor, so an
+ * application with its own thread pool, such as a Java executor, libuv or
+ * GCD, can send all of the library's work there.
+ *
+ * For applications without one, a work pool is an executor whose jobs are
+ * run by whichever threads the caller gives to it.
+ */
+
+#ifndef OLM_EXECUTOR_H_
+#define OLM_EXECUTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A piece of work handed to an OlmBatchExecutor: runs job number job */
+typedef void (*OlmBatchJob)(void * job_context, size_t job);
+
+/** Runs job(job_context, j) for each j below job_count, in any order and on
+ * any threads, and returns once they have all finished. The jobs are
+ * independent of each other. */
+typedef void (*OlmBatchExecutor)(
+    void * context,
+    OlmBatchJob job, void * job_context, size_t job_count
+);
+
+/** Run jobs on any node */
+#define OLM_ANY_NUMA_NODE (-1)
+
+/** As OlmBatchExecutor, but job j works on memory on NUMA node
+ * job_nodes[j], or on no particular node if it is OLM_ANY_NUMA_NODE, so that
+ * the executor can run it on a thread pinned to that node. */
+typedef void (*OlmNodeBatchExecutor)(
+    void * context,
+    OlmBatchJob job, void * job_context,
+    const int * job_nodes, size_t job_count
+);
+
+typedef struct OlmWorkPool OlmWorkPool;
+
+/** The number of bytes needed for a work pool */
+size_t olm_work_pool_size(void);
+
+/** Initialise a work pool in the supplied memory, which must be at least
+ * olm_work_pool_size() bytes */
+OlmWorkPool * olm_work_pool(void * memory);
+
+/** Clears the memory used to back the pool. Every thread working for the
+ * pool must have returned from olm_work_pool_work() first. */
+size_t olm_clear_work_pool(OlmWorkPool * pool);
+
+/** Runs jobs from the pool on the calling thread, waiting for more when
+ * there are none, until olm_work_pool_stop() is called. Any number of
+ * threads can work for a pool. */
+void olm_work_pool_work(OlmWorkPool * pool);
+
+/** Makes every olm_work_pool_work() for the pool return once it has
+ * finished the job it is running. Batches can still be run on the pool
+ * afterwards, but only by the threads which start them. */
+void olm_work_pool_stop(OlmWorkPool * pool);
+
+/** An OlmBatchExecutor which runs the jobs on the threads working for the
+ * work pool given as context. The calling thread runs jobs too, so the batch
+ * finishes even if nothing else is working for the pool. Any number of
+ * threads can run batches on one pool at once. */
+void olm_work_pool_executor(
+    void * context,
+    OlmBatchJob job, void * job_context, size_t job_count
+);
+
+/** As olm_work_pool_executor(), for the functions which take an
+ * OlmNodeBatchExecutor. The jobs' nodes are ignored. */
+void olm_work_pool_node_executor(
+    void * context,
+    OlmBatchJob job, void * job_context,
+    const int * job_nodes, size_t job_count
+);
+
+/** How a work pool's jobs have been shared out, for seeing how well a
+ * batch function's work spreads over the pool's threads */
+typedef struct OlmWorkPoolStats {
+    /** The batches run on the pool, and the jobs in them */
+    uint64_t batches;
+    uint64_t jobs;
+    /** The jobs run by threads in olm_work_pool_work(), rather than by the
+     * thread that started their batch */
+    uint64_t jobs_run_by_workers;
+    /** The times a thread found the pool's lock taken and had to wait */
+    uint64_t lock_contentions;
+    /** The times a worker found no jobs and went to sleep */
+    uint64_t idle_waits;
+    /** The times the thread that started a batch had run out of its jobs to
+     * take and waited for others to finish theirs */
+    uint64_t finish_waits;
+} OlmWorkPoolStats;
+
+/** Copy the pool's counters into stats */
+void olm_work_pool_stats(OlmWorkPool * pool, OlmWorkPoolStats * stats);
+
+/** Set the pool's counters back to zero */
+void olm_work_pool_reset_stats(OlmWorkPool * pool);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_EXECUTOR_H_ */
@@ -18,11 +18,22 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "olm/error.h"
+#include "olm/executor.h"
+#include "olm/iovec.h"
+#include "olm/memory_stats.h"
+#include "olm/pickle_key.h"
+#include "olm/pool.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct OlmInboundGroupSession OlmInboundGroupSession;
+typedef struct OlmGroupDecryptScratch OlmGroupDecryptScratch;
+typedef struct OlmGroupSessionStore OlmGroupSessionStore;
+typedef struct OlmShardedGroupSessionStore OlmShardedGroupSessionStore;
+typedef struct OlmSharedGroupSessionStore OlmSharedGroupSessionStore;
 
 /** get the size of an inbound group session, in bytes. */
 size_t olm_inbound_group_session_size();
@@ -36,6 +47,65 @@ OlmInboundGroupSession * olm_inbound_group_session(
     void *memory
 );
 
+/** The size in bytes of a group session created with
+ * olm_compact_inbound_group_session(). It has only one ratchet until the
+ * session moves on from its first known index, and no decoded copy of the
+ * signing key, so many sessions that are rarely decrypted take several times
+ * less memory. */
+size_t olm_compact_inbound_group_session_size(void);
+
+/** The number of bytes a compact group session takes from its allocator for
+ * its latest ratchet once that has moved on from the first known index. */
+size_t olm_compact_inbound_group_session_ratchet_size(void);
+
+/**
+ * Initialise a group session in the supplied memory, which must be at least
+ * olm_compact_inbound_group_session_size() bytes. The session works as one
+ * from olm_inbound_group_session() and its pickles are the same, but it
+ * takes olm_compact_inbound_group_session_ratchet_size() bytes from the
+ * allocator the first time decrypting or exporting moves it on from its
+ * first known index, and gives them back when it is initialised, unpickled
+ * or cleared. If the allocator has no memory then that fails with
+ * ALLOCATION_FAILED, leaving the session as it was. Checking a message's
+ * signature decodes the signing key each time, which makes decrypting a
+ * little slower than with a full session. The allocator must outlive the
+ * session and can be shared by any number of sessions. Clear the session
+ * with olm_clear_inbound_group_session() so that its ratchet is given back.
+ * A group session store holds full sessions, not compact ones.
+ */
+OlmInboundGroupSession * olm_compact_inbound_group_session(
+    void *memory, const OlmAllocator *allocator
+);
+
+/**
+ * Copy a group session into the supplied memory, which should be at least
+ * olm_inbound_group_session_size() bytes, for example to decrypt with a copy
+ * while the original is kept as it was. The two sessions are independent
+ * afterwards. The copy has no checkpoints, message key cache or history
+ * scan, since those buffers belong to the original; give it its own with
+ * olm_inbound_group_session_set_checkpoints() or
+ * olm_inbound_group_session_set_message_key_cache(). A copy of a compact
+ * session is compact, needs only olm_compact_inbound_group_session_size()
+ * bytes, and takes its own ratchet from the same allocator if the session
+ * has one out of line; if the allocator has no memory the copy fails and
+ * NULL is returned.
+ */
+OlmInboundGroupSession * olm_inbound_group_session_copy(
+    void *memory, const OlmInboundGroupSession *session
+);
+
+/**
+ * Move a group session into the supplied memory, which must be as big as the
+ * session and not overlap it, and wipe the old copy. The session keeps its
+ * checkpoints, message key cache and history scan, whose buffers stay where
+ * they are. A session finds those buffers from their distance from it, so a
+ * session given any can't be moved with a plain memcpy; one given none can.
+ * Returns the session in its new place.
+ */
+OlmInboundGroupSession * olm_inbound_group_session_move(
+    void *memory, OlmInboundGroupSession *session
+);
+
 /**
  * A null terminated string describing the most recent error to happen to a
  * group session */
@@ -43,11 +113,258 @@ const char *olm_inbound_group_session_last_error(
     const OlmInboundGroupSession *session
 );
 
-/** Clears the memory used to back this group session */
+/** The most recent error to happen to a group session */
+enum OlmErrorCode olm_inbound_group_session_last_error_code(
+    const OlmInboundGroupSession *session
+);
+
+/** Clears the memory used to back this group session, including any
+ * checkpoint buffer */
 size_t olm_clear_inbound_group_session(
     OlmInboundGroupSession *session
 );
 
+/** Takes olm_inbound_group_session_size() bytes from the allocator and
+ * initialises a group session in them. Returns NULL if the allocator has no
+ * memory. */
+OlmInboundGroupSession * olm_allocate_inbound_group_session(
+    const OlmAllocator *allocator
+);
+
+/** Clears a group session from olm_allocate_inbound_group_session() and
+ * gives its memory back to the allocator */
+void olm_release_inbound_group_session(
+    const OlmAllocator *allocator,
+    OlmInboundGroupSession *session
+);
+
+/** The number of bytes of checkpoint buffer used by each checkpoint */
+size_t olm_inbound_group_session_checkpoint_size(void);
+
+/**
+ * Give the session a buffer to keep checkpoints of the ratchet in. Decrypting
+ * a message older than the newest one seen normally advances a copy of the
+ * ratchet all the way from the earliest known index; with checkpoints it
+ * starts from the closest earlier checkpoint instead, so paging back through
+ * history gets much cheaper.
+ *
+ * A checkpoint is taken at multiples of 2^spacing_log2 message indices, such
+ * as 2^8 or 2^16, as old messages are decrypted. The buffer holds
+ * buffer_length / olm_inbound_group_session_checkpoint_size() of them, after
+ * which the oldest is replaced. It must stay valid until it is replaced by
+ * another call, or the session is cleared. It should be aligned as for
+ * malloc(). Pass a NULL buffer to stop using checkpoints.
+ *
+ * The checkpoints aren't pickled, and are forgotten when the session is
+ * initialised, imported or unpickled. They hold key material, so the
+ * buffer is wiped when it is replaced and by
+ * olm_clear_inbound_group_session().
+ *
+ * Returns the number of checkpoints the buffer can hold.
+ */
+size_t olm_inbound_group_session_set_checkpoints(
+    OlmInboundGroupSession *session,
+    void *buffer, size_t buffer_length,
+    unsigned int spacing_log2
+);
+
+/** The number of bytes of memory a history scan needs */
+size_t olm_inbound_group_session_scan_size(void);
+
+/**
+ * Start a history scan, for decrypting messages one after another going
+ * back through history, such as when paginating backwards. Without one, each
+ * message before the latest one decrypted replays the ratchet from the first
+ * known index or the closest earlier checkpoint. During a scan, the first
+ * such message in a block of 256 message indices works out the ratchet at
+ * every index of its block at once, which costs about as much as replaying
+ * the whole block once, and the other messages in the block then need no
+ * ratchet work at all. Only one block is held at a time.
+ *
+ * The buffer must be at least olm_inbound_group_session_scan_size() bytes,
+ * should be aligned as for malloc(), and must stay valid until
+ * olm_inbound_group_session_end_scan() or the session is cleared. It holds
+ * key material for every message of the block, and is wiped when the scan
+ * ends, when the session is initialised, imported or unpickled, and when
+ * olm_inbound_group_session_prune_before() moves the first known index on.
+ * A session that is already scanning ends that scan first.
+ *
+ * Returns olm_error() if the buffer is too small. The last error will be
+ * "OUTPUT_BUFFER_TOO_SMALL".
+ */
+size_t olm_inbound_group_session_begin_scan(
+    OlmInboundGroupSession *session, void *buffer, size_t buffer_length
+);
+
+/** End a history scan, wiping its buffer, after which the session no longer
+ * uses it. Does nothing if the session isn't scanning. Always returns 0. */
+size_t olm_inbound_group_session_end_scan(
+    OlmInboundGroupSession *session
+);
+
+/**
+ * The number of hash operations needed to get the ratchet to message_index,
+ * which is most of the cost of decrypting a message at that index beyond
+ * the signature check and the key derivation. Reaching an index at or after
+ * the latest one decrypted carries on from there, and costs up to about a
+ * thousand operations if it is far ahead. An earlier index is replayed from
+ * the first known index, or from the closest earlier checkpoint, or during a
+ * history scan costs nothing if its block is held and otherwise the cost of
+ * working out the block. The message key cache isn't taken into account.
+ *
+ * Returns olm_error() if the index is before the first known index. The last
+ * error will be "UNKNOWN_MESSAGE_INDEX".
+ */
+size_t olm_inbound_group_session_seek_cost(
+    OlmInboundGroupSession *session, uint32_t message_index
+);
+
+/**
+ * Do the work of getting the ratchet to message_index ahead of time, so that
+ * decrypting a message there is cheap. For an index at or after the latest
+ * one decrypted, this advances the ratchet, after which earlier indices have
+ * to be replayed as usual. For an earlier index it only helps if the session
+ * has checkpoints, and records the one that decrypting at the index would.
+ *
+ * Returns olm_error() if the index is before the first known index. The last
+ * error will be "UNKNOWN_MESSAGE_INDEX".
+ */
+size_t olm_inbound_group_session_advance_to(
+    OlmInboundGroupSession *session, uint32_t message_index
+);
+
+/**
+ * Forget how to decrypt messages before message_index, for a reader which
+ * will never need older history, such as a bot. The first known index moves
+ * on to message_index, so a stale or forged message at an earlier index
+ * fails with "UNKNOWN_MESSAGE_INDEX" rather than being replayed from where
+ * the session started, and decrypting an old message never costs more than
+ * going back to message_index. If message_index is after the latest one
+ * decrypted, the latest ratchet moves on to it too. Checkpoints and cached
+ * message keys from before message_index are wiped. Pickles and exports of
+ * the session start from message_index from then on.
+ *
+ * Does nothing if message_index is at or before the first known index.
+ * Always returns 0.
+ */
+size_t olm_inbound_group_session_prune_before(
+    OlmInboundGroupSession *session, uint32_t message_index
+);
+
+/**
+ * Turn rejecting replayed messages on or off; it is off for a new session.
+ * While it is on, the session remembers which of the last 256 message
+ * indices up to the latest one it has decrypted, and decrypting another
+ * message at one of those indices returns olm_error() with the last error
+ * "DUPLICATE_MESSAGE_INDEX". Messages more than 256 indices before the latest
+ * one are not checked. Only messages that decrypt successfully are
+ * remembered, so a forged message can't block the real one.
+ *
+ * The remembered indices are pickled while it is on. Turning it off forgets
+ * them. Always returns 0.
+ */
+size_t olm_inbound_group_session_set_replay_detection(
+    OlmInboundGroupSession *session, int enabled
+);
+
+/**
+ * Whether replay detection remembers decrypting a message at message_index,
+ * for callers who would rather flag a replayed message than have it
+ * rejected: turn replay detection on, and check the index before
+ * decrypting. Returns 1 or 0.
+ */
+int olm_inbound_group_session_index_seen(
+    const OlmInboundGroupSession *session, uint32_t message_index
+);
+
+/**
+ * Limit how much ratchet work decrypting one message may do, as counted by
+ * olm_inbound_group_session_seek_cost(), or 0 for no limit, which is the
+ * default. A message which would need more fails to decrypt with the last
+ * error "RATCHET_DISTANCE_EXCEEDED", leaving the session as it was, so a
+ * caller on a latency sensitive path can pass far away messages to a
+ * background queue which decrypts them without a limit. The check comes
+ * after the signature check, so a forged message fails with
+ * "BAD_SIGNATURE" instead; messages in the message key cache are never
+ * limited. In a batch, each message is counted from where the batch's
+ * ratchet has got to. The limit is not pickled. Always returns 0.
+ */
+size_t olm_inbound_group_session_set_max_ratchet_distance(
+    OlmInboundGroupSession *session, size_t max_distance
+);
+
+/**
+ * Check the MAC of a message before its signature when its ratchet can be
+ * had for at most max_distance of work, as counted by
+ * olm_inbound_group_session_seek_cost(), or always check the signature first
+ * if max_distance is 0, which is the default. The MAC costs an HMAC where
+ * the signature costs an Ed25519 verification, so a flood of garbage aimed
+ * at the session's latest messages is turned away cheaply.
+ *
+ * A message checked this way fails with "BAD_MESSAGE_MAC" if its MAC is
+ * wrong, whatever its signature, and with "BAD_SIGNATURE" if only its
+ * signature is, when the plain-text buffer is wiped. Either way the session
+ * is left as it was: the ratchet is worked out on a copy, which is only kept
+ * once both checks have passed. Messages further away, and those in a batch,
+ * have their signature checked first as usual. The setting is not pickled.
+ * Always returns 0.
+ */
+size_t olm_inbound_group_session_set_mac_first_distance(
+    OlmInboundGroupSession *session, size_t max_distance
+);
+
+/** The number of bytes of message key cache buffer used for each message */
+size_t olm_inbound_group_session_message_key_cache_entry_size(void);
+
+/**
+ * Give the session a buffer to remember the keys of recently decrypted
+ * messages in. Decrypting a message which is byte for byte the same as one in
+ * the cache then skips the signature check, the ratchet and the key
+ * derivation; the MAC is still checked. The buffer holds
+ * buffer_length / olm_inbound_group_session_message_key_cache_entry_size()
+ * messages, after which the least recently used is replaced. It must stay
+ * valid until replaced by another call or the session is cleared, and should
+ * be aligned as for malloc(). Pass a NULL buffer to stop using the cache.
+ *
+ * The cache isn't pickled. It holds key material, so the buffer is wiped when
+ * it is replaced, when the session is initialised, imported, unpickled or
+ * cleared, and by olm_inbound_group_session_flush_message_key_cache().
+ *
+ * Returns the number of messages the buffer can hold.
+ */
+size_t olm_inbound_group_session_set_message_key_cache(
+    OlmInboundGroupSession *session,
+    void *buffer, size_t buffer_length
+);
+
+/** Wipe all the keys in the message key cache, keeping the buffer for new
+ * ones. Always returns 0. */
+size_t olm_inbound_group_session_flush_message_key_cache(
+    OlmInboundGroupSession *session
+);
+
+/**
+ * Give back memory when the system is short of it, as far as level, one of
+ * the OLM_TRIM_MEMORY_* levels in olm/memory_stats.h: the message key cache
+ * is wiped from OLM_TRIM_MEMORY_CACHES, the checkpoints and the block of a
+ * history scan from OLM_TRIM_MEMORY_PRECOMPUTED, and from
+ * OLM_TRIM_MEMORY_BUFFERS the session stops using all three buffers, ending
+ * the scan, so that they can be freed.
+ *
+ * Returns the number of bytes of cache entries wiped.
+ */
+size_t olm_inbound_group_session_trim_memory(
+    OlmInboundGroupSession *session, int level
+);
+
+/** Adds the memory the session is using to stats, as described in
+ * olm/memory_stats.h, including its checkpoint and message key cache
+ * buffers */
+void olm_inbound_group_session_memory_stats(
+    const OlmInboundGroupSession *session,
+    OlmMemoryStats *stats
+);
+
 /** Returns the number of bytes needed to store an inbound group session */
 size_t olm_pickle_inbound_group_session_length(
     const OlmInboundGroupSession *session
@@ -74,8 +391,9 @@ size_t olm_pickle_inbound_group_session(
  * Returns olm_error() on failure. If the key doesn't match the one used to
  * encrypt the account then olm_inbound_group_session_last_error() will be
  * "BAD_ACCOUNT_KEY". If the base64 couldn't be decoded then
- * olm_inbound_group_session_last_error() will be "INVALID_BASE64". The input
- * pickled buffer is destroyed
+ * olm_inbound_group_session_last_error() will be "INVALID_BASE64". Pickles
+ * written by olm_pickle_inbound_group_session_with_header() are loaded too.
+ * The input pickled buffer is destroyed
  */
 size_t olm_unpickle_inbound_group_session(
     OlmInboundGroupSession *session,
@@ -83,6 +401,266 @@ size_t olm_unpickle_inbound_group_session(
     void * pickled, size_t pickled_length
 );
 
+/**
+ * Loads a group session from a pickle without changing it, so that it can be
+ * read straight from read-only memory such as a memory mapped file. The
+ * pickle is decoded and decrypted into the scratch memory instead, which
+ * must be at least pickled_length bytes and is wiped afterwards.
+ *
+ * Fails in the same ways as olm_unpickle_inbound_group_session(), and with
+ * "OUTPUT_BUFFER_TOO_SMALL" if the scratch memory is too small.
+ */
+size_t olm_unpickle_inbound_group_session_const(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
+);
+
+/**
+ * Returns the number of bytes needed to store an inbound group session with
+ * a header by olm_pickle_inbound_group_session_with_header()
+ */
+size_t olm_pickle_inbound_group_session_with_header_length(
+    const OlmInboundGroupSession *session
+);
+
+/**
+ * Stores a group session as a base64 string like
+ * olm_pickle_inbound_group_session(), with a header in front holding the
+ * session ID, the first known index and the pickle version. The header isn't
+ * encrypted, so olm_pickle_peek_header() can read it without the key, for
+ * example to index stored sessions, but it is authenticated along with the
+ * rest of the pickle when the session is unpickled. The pickle can be loaded
+ * by olm_unpickle_inbound_group_session() and
+ * olm_unpickle_inbound_group_session_with_key(), but not by versions of the
+ * library older than this function.
+ *
+ * Returns olm_error() on failure. If the pickle output buffer is smaller
+ * than olm_pickle_inbound_group_session_with_header_length() then
+ * olm_inbound_group_session_last_error() will be "OUTPUT_BUFFER_TOO_SMALL"
+ */
+size_t olm_pickle_inbound_group_session_with_header(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/**
+ * Reads the header of a pickle written by
+ * olm_pickle_inbound_group_session_with_header() without the key, or doing
+ * any decryption. Writes the session ID, as base64 like
+ * olm_inbound_group_session_id(), and sets first_known_index and
+ * pickle_version. The pickle is left as it is.
+ *
+ * Returns the length of the session ID, or olm_error() if the pickle has no
+ * header or session_id_length is smaller than
+ * olm_inbound_group_session_id_length(). The header is only checked against
+ * the rest of the pickle when the session is unpickled, so until then it
+ * shouldn't be trusted any more than where the pickle was stored.
+ */
+size_t olm_pickle_peek_header(
+    void const * pickled, size_t pickled_length,
+    uint32_t * pickle_version, uint32_t * first_known_index,
+    void * session_id, size_t session_id_length
+);
+
+/**
+ * Returns the number of bytes needed to store an inbound group session as a
+ * binary pickle
+ */
+size_t olm_pickle_inbound_group_session_binary_length(
+    const OlmInboundGroupSession *session
+);
+
+/**
+ * Stores a group session as binary. Like
+ * olm_pickle_inbound_group_session() the session is encrypted and
+ * authenticated using the supplied key, but the result isn't base64 encoded.
+ * Returns the length of the session on success.
+ *
+ * Returns olm_error() on failure. If the pickle output buffer is smaller
+ * than olm_pickle_inbound_group_session_binary_length() then
+ * olm_inbound_group_session_last_error() will be "OUTPUT_BUFFER_TOO_SMALL"
+ */
+size_t olm_pickle_inbound_group_session_binary(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/**
+ * Loads a group session from a binary pickle made by
+ * olm_pickle_inbound_group_session_binary(). Fails in the same ways as
+ * olm_unpickle_inbound_group_session(), except that there is no base64 to
+ * decode. The input pickled buffer is destroyed
+ */
+size_t olm_unpickle_inbound_group_session_binary(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/**
+ * Returns the number of bytes needed to store a group session with
+ * olm_pickle_inbound_group_session_with_key() and the OLM_PICKLE_CIPHER_*
+ * given
+ */
+size_t olm_pickle_inbound_group_session_with_key_length(
+    const OlmInboundGroupSession *session, uint32_t cipher
+);
+
+/**
+ * Stores a group session as a base64 string like
+ * olm_pickle_inbound_group_session(), but encrypted under the keys held by
+ * pickle_key with the OLM_PICKLE_CIPHER_* given, which saves deriving the
+ * keys each time. Returns the length of the session on success.
+ *
+ * Returns olm_error() on failure. If the pickle output buffer is smaller
+ * than olm_pickle_inbound_group_session_with_key_length() then
+ * olm_inbound_group_session_last_error() will be "OUTPUT_BUFFER_TOO_SMALL".
+ * If the cipher isn't known then it will be "UNKNOWN_PICKLE_VERSION", and if
+ * there were no random bytes for an AES-GCM nonce then it will be
+ * "RANDOM_UNAVAILABLE".
+ */
+size_t olm_pickle_inbound_group_session_with_key(
+    OlmInboundGroupSession *session,
+    const OlmPickleKey * pickle_key, uint32_t cipher,
+    void * pickled, size_t pickled_length
+);
+
+/**
+ * Loads a group session from a pickle written by
+ * olm_pickle_inbound_group_session() or
+ * olm_pickle_inbound_group_session_with_key(), using the keys held by
+ * pickle_key,
+ * which must have been made from the key the pickle was written with. This
+ * saves deriving the keys again for every pickle when loading many written
+ * under the same key. Returns pickled_length on success.
+ *
+ * Returns olm_error() on failure, with the same errors as
+ * olm_unpickle_inbound_group_session(). The input pickled buffer is
+ * destroyed.
+ */
+size_t olm_unpickle_inbound_group_session_with_key(
+    OlmInboundGroupSession *session,
+    const OlmPickleKey * pickle_key,
+    void * pickled, size_t pickled_length
+);
+
+/**
+ * Returns the number of bytes needed to store count group sessions as a
+ * batch
+ */
+size_t olm_pickle_inbound_group_session_batch_length(
+    OlmInboundGroupSession * const * sessions, size_t count
+);
+
+/**
+ * Stores count group sessions as one batch, each as a binary pickle
+ * encrypted under the keys held by pickle_key. This saves deriving the keys
+ * for every session. Returns the length of the batch on success.
+ *
+ * Returns olm_error() on failure. If the output buffer is smaller than
+ * olm_pickle_inbound_group_session_batch_length() then
+ * olm_inbound_group_session_last_error() for the first session will be
+ * "OUTPUT_BUFFER_TOO_SMALL"
+ */
+size_t olm_pickle_inbound_group_session_batch(
+    const OlmPickleKey * pickle_key,
+    OlmInboundGroupSession * const * sessions, size_t count,
+    void * pickled, size_t pickled_length
+);
+
+/**
+ * Loads count group sessions, starting from the first'th one, from a batch
+ * made by olm_pickle_inbound_group_session_batch(). Returns count on
+ * success.
+ *
+ * Only the entries for the sessions being loaded are decrypted in place, so
+ * separate threads can load separate ranges of the same batch at once under
+ * the same pickle key.
+ *
+ * Returns olm_error() on failure, with the error set on the session that
+ * couldn't be loaded, or on the first session if the batch itself couldn't
+ * be read. The sessions before it have been loaded, and those after it are
+ * unchanged. The error will be "CORRUPTED_PICKLE" if the batch is truncated
+ * or has fewer than first + count sessions, "UNKNOWN_PICKLE_VERSION" if it
+ * isn't a batch, and otherwise as for
+ * olm_unpickle_inbound_group_session_binary().
+ */
+size_t olm_unpickle_inbound_group_session_batch(
+    const OlmPickleKey * pickle_key,
+    void * pickled, size_t pickled_length,
+    size_t first,
+    OlmInboundGroupSession * const * sessions, size_t count
+);
+
+
+/**
+ * Returns the number of bytes needed for a store of count group sessions
+ */
+size_t olm_inbound_group_session_store_length(
+    OlmInboundGroupSession * const * sessions, size_t count
+);
+
+/**
+ * Writes count group sessions as a store, from which any one of them can be
+ * loaded by its session ID without reading or decrypting the others. The
+ * store starts with an index sorted by session ID, followed by each
+ * session's binary pickle encrypted under the keys held by pickle_key. It is
+ * meant to be written to a file and memory mapped, so that opening it takes
+ * no time and only the parts used are read into memory. The session IDs in
+ * the index aren't encrypted.
+ *
+ * Each session ID should only be in the store once; if it is there more than
+ * once, which one is loaded is unspecified.
+ *
+ * Returns the length of the store on success. Returns olm_error() on
+ * failure. If the output buffer is smaller than
+ * olm_inbound_group_session_store_length() then
+ * olm_inbound_group_session_last_error() for the first session will be
+ * "OUTPUT_BUFFER_TOO_SMALL"
+ */
+size_t olm_write_inbound_group_session_store(
+    const OlmPickleKey *pickle_key,
+    OlmInboundGroupSession * const * sessions, size_t count,
+    void *store, size_t store_length
+);
+
+/**
+ * The number of group sessions in a store written by
+ * olm_write_inbound_group_session_store(). Only the header is checked, so
+ * this takes the same time however large the store is. Returns olm_error()
+ * if it isn't a store or is too short for its index.
+ */
+size_t olm_inbound_group_session_store_count(
+    const void *store, size_t store_length
+);
+
+/**
+ * Loads the group session with the given ID, as returned by
+ * olm_inbound_group_session_id(), from a store. The store isn't changed, so
+ * it may be mapped read-only and shared between threads. Returns 0 on
+ * success.
+ *
+ * Returns olm_error() on failure. On failure last_error will be set with an
+ * error code. The last_error will be:
+ *
+ *  * OLM_INVALID_BASE64 if the session_id isn't a valid session ID
+ *  * OLM_UNKNOWN_SESSION_ID if the store doesn't have the session
+ *  * OLM_UNKNOWN_PICKLE_VERSION if it isn't a store
+ *  * OLM_CORRUPTED_PICKLE if the store is truncated or its entry for the
+ *    session is bad
+ *  * OLM_BAD_ACCOUNT_KEY if the store wasn't written under pickle_key
+ */
+size_t olm_load_inbound_group_session_from_store(
+    const OlmPickleKey *pickle_key,
+    const void *store, size_t store_length,
+    const uint8_t *session_id, size_t session_id_length,
+    OlmInboundGroupSession *session
+);
+
 
 /**
  * Start a new inbound group session, from a key exported from
@@ -116,6 +694,40 @@ size_t olm_import_inbound_group_session(
     uint8_t const * session_key, size_t session_key_length
 );
 
+/**
+ * Start count sessions from session keys, as if by calling
+ * olm_init_inbound_group_session() on each, for example when a flood of room
+ * keys arrives after logging in.
+ *
+ * The sessions are set up in groups of 64, each group one job for the
+ * executor, so that they can be spread over several threads. If executor is
+ * NULL the jobs are run one after another on the calling thread. A session
+ * must only appear once.
+ *
+ * For each session, errors[i] is set to the error
+ * olm_init_inbound_group_session() would have left in last_error, or to
+ * "SUCCESS". errors may be NULL. Returns the number of sessions which
+ * couldn't be started.
+ */
+size_t olm_init_inbound_group_session_batch(
+    OlmInboundGroupSession * const * sessions, size_t count,
+    uint8_t const * const * session_keys, const size_t * session_key_lengths,
+    const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+);
+
+/**
+ * Import count sessions, as if by calling olm_import_inbound_group_session()
+ * on each, for example when restoring a key backup. The jobs and errors are
+ * as for olm_init_inbound_group_session_batch().
+ */
+size_t olm_import_inbound_group_session_batch(
+    OlmInboundGroupSession * const * sessions, size_t count,
+    uint8_t const * const * session_keys, const size_t * session_key_lengths,
+    const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+);
+
 
 /**
  * Get an upper bound on the number of bytes of plain-text the decrypt method
@@ -162,6 +774,393 @@ size_t olm_group_decrypt(
     uint32_t * message_index
 );
 
+/** The length of the tokens of olm_group_decrypt_with_token() */
+size_t olm_group_decrypt_token_length(void);
+
+/**
+ * Like olm_group_decrypt(), but with a token saying that the message's
+ * signature has already been checked, so that decrypting a stored message
+ * again, for example to show history after a cache was emptied, costs only
+ * the key derivation and AES.
+ *
+ * The token is an HMAC-SHA-256 under token_key of the session's signing key
+ * and the whole message, signature included. token_key should be a secret
+ * kept with the key the sessions are pickled under, since anyone with it can
+ * make tokens for forged messages; a room member who has the session key
+ * can't.
+ *
+ * If token is olm_group_decrypt_token_length() bytes and matches the
+ * message, the signature isn't checked. Otherwise, or if token is NULL, it is
+ * checked as usual. If token_out isn't NULL then once the message has been
+ * decrypted the token for it is written there, to be stored alongside the
+ * message. Returns the length of the plain-text, or olm_error() with the
+ * same errors as olm_group_decrypt(); the last_error is
+ * OUTPUT_BUFFER_TOO_SMALL, without anything being done, if token_out_length
+ * is less than olm_group_decrypt_token_length().
+ */
+size_t olm_group_decrypt_with_token(
+    OlmInboundGroupSession *session,
+    uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index,
+    const uint8_t * token_key, size_t token_key_length,
+    const uint8_t * token, size_t token_length,
+    uint8_t * token_out, size_t token_out_length
+);
+
+/**
+ * The same as olm_group_decrypt_max_plaintext_length(), but found by decoding
+ * only the message headers, so the message isn't changed and can be passed
+ * straight to olm_group_decrypt() afterwards. Returns olm_error() on failure,
+ * with the same errors as olm_group_decrypt_max_plaintext_length(); the
+ * last_error is INVALID_BASE64 only if the length isn't valid for base64.
+ */
+size_t olm_group_peek_max_plaintext_length(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length
+);
+
+/**
+ * Reads the version and index of a group message from its headers, without
+ * a session or any crypto, for example to sort messages or find repeats
+ * before decrypting them. Only the bytes of the headers are base64-decoded,
+ * and the message is left as it is. version may be NULL; it is set whenever
+ * the message has one, even if it is for an unsupported version of the
+ * protocol.
+ *
+ * Returns 0, or olm_error() if the length isn't valid for base64, the
+ * version is unsupported or the message has no index. Nothing is checked
+ * but the headers, so the index shouldn't be trusted until the message has
+ * been decrypted.
+ */
+size_t olm_group_message_peek(
+    const uint8_t * message, size_t message_length,
+    uint32_t * message_index, uint8_t * version
+);
+
+/**
+ * Like olm_group_message_peek(), but for a message which has already been
+ * base64-decoded, or was never encoded, such as the output of
+ * olm_group_encrypt_raw().
+ */
+size_t olm_group_message_peek_raw(
+    const uint8_t * message, size_t message_length,
+    uint32_t * message_index, uint8_t * version
+);
+
+/**
+ * Like olm_group_decrypt_max_plaintext_length(), but for a message which has
+ * already been base64-decoded, or was never encoded. The message isn't
+ * changed.
+ */
+size_t olm_group_decrypt_raw_max_plaintext_length(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length
+);
+
+/**
+ * Like olm_group_decrypt(), but for a message which has already been
+ * base64-decoded, or was never encoded, such as the output of
+ * olm_group_encrypt_raw(). The message isn't changed, so it needn't be copied
+ * to call this and olm_group_decrypt_raw_max_plaintext_length() in turn.
+ * The errors are the same, except that there is no INVALID_BASE64.
+ */
+size_t olm_group_decrypt_raw(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+);
+
+/**
+ * Like olm_group_decrypt(), but writing the plain-text over the message,
+ * from the start of the buffer, so no second buffer is needed. Returns the
+ * length of the plain-text, or olm_error() with the same errors as
+ * olm_group_decrypt(). The message is destroyed either way.
+ */
+size_t olm_group_decrypt_inplace(
+    OlmInboundGroupSession *session,
+    uint8_t * buffer, size_t message_length,
+    uint32_t * message_index
+);
+
+/**
+ * Like olm_group_decrypt(), but writing the plain-text into a buffer which
+ * takes memory from the allocator when it hasn't room. The message is only
+ * decoded once, rather than once for
+ * olm_group_decrypt_max_plaintext_length() and again to decrypt it, and a
+ * buffer kept across calls only grows for the longest plain-text. Returns
+ * the length of the plain-text, which is also left in plaintext->length, or
+ * olm_error() with the same errors as olm_group_decrypt(), or
+ * ALLOCATION_FAILED if the allocator has no memory. The message is
+ * destroyed either way.
+ */
+size_t olm_group_decrypt_to_buffer(
+    OlmInboundGroupSession *session,
+    uint8_t * message, size_t message_length,
+    const OlmAllocator *allocator, OlmBuffer *plaintext,
+    uint32_t * message_index
+);
+
+/**
+ * Like olm_group_decrypt_raw(), but reading the message from message_count
+ * segments, one after another, such as the buffers of a network read, and
+ * writing the plain-text across plaintext_count segments. The plain-text
+ * segments must hold at least olm_group_decrypt_raw_max_plaintext_length()
+ * bytes between them, which is always less than the length of the message,
+ * and mustn't overlap the message. The signature and the MAC are checked
+ * over the segments before any of the plain-text is written, and the
+ * ciphertext is decrypted straight into the plain-text segments, with only
+ * the blocks which straddle two segments going through a copy.
+ *
+ * Returns the length of the plain-text, or olm_error() on failure, with the
+ * same errors as olm_group_decrypt_raw().
+ */
+size_t olm_group_decrypt_raw_iov(
+    OlmInboundGroupSession *session,
+    const OlmIovec * message, size_t message_count,
+    const OlmIovec * plaintext, size_t plaintext_count,
+    uint32_t * message_index
+);
+
+/**
+ * A group message being decrypted a piece at a time, for messages too big to
+ * want a second copy of. The message is in binary, as for
+ * olm_group_decrypt_raw(), and is read from the caller's memory, such as a
+ * memory mapped file, which must stay valid and unchanged until the stream
+ * has been read to the end or cleared. The plain-text is handed out in
+ * pieces of whatever size the caller asks for.
+ *
+ * The signature and the MAC are both checked over the whole message before
+ * any plain-text is handed out.
+ */
+typedef struct OlmGroupDecryptStream OlmGroupDecryptStream;
+
+/** The size of a group decrypt stream object in bytes */
+size_t olm_group_decrypt_stream_size(void);
+
+/** Initialise a group decrypt stream object using the supplied memory, which
+ * must be at least olm_group_decrypt_stream_size() bytes */
+OlmGroupDecryptStream * olm_group_decrypt_stream(void * memory);
+
+/** A null terminated string describing the most recent error to happen to a
+ * group decrypt stream */
+const char *olm_group_decrypt_stream_last_error(
+    const OlmGroupDecryptStream *stream
+);
+
+/** Clears the memory used to back this stream, including the keys it holds
+ * if it hasn't been read to the end */
+size_t olm_clear_group_decrypt_stream(OlmGroupDecryptStream *stream);
+
+/**
+ * Check a message's signature and MAC, and start decrypting it. The session
+ * is updated as olm_group_decrypt_raw() would, and message_index, if not
+ * NULL, is set to the message's index.
+ *
+ * Returns an upper bound on the length of the plain-text, or olm_error() on
+ * failure, when the stream's last error is set to whatever
+ * olm_group_decrypt_raw() would have failed with, such as
+ * "BAD_MESSAGE_MAC".
+ */
+size_t olm_group_decrypt_stream_begin(
+    OlmGroupDecryptStream *stream,
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length,
+    uint32_t * message_index
+);
+
+/**
+ * Decrypt up to max_plaintext_length bytes of the next piece of the
+ * plain-text. Returns the number of bytes written, which is less than
+ * max_plaintext_length only at the end of the plain-text, and is 0 once all
+ * of it has been read. Returns olm_error() with the last error
+ * BAD_STREAM_STATE if the stream hasn't been started.
+ */
+size_t olm_group_decrypt_stream_read(
+    OlmGroupDecryptStream *stream,
+    uint8_t * plaintext, size_t max_plaintext_length
+);
+
+/**
+ * Decrypt count messages for this session in one go. This gives the same
+ * results as calling olm_group_decrypt() on each message in turn, but decodes
+ * the signing key once for all of the signatures, and decrypts the messages
+ * in order of message index, so that the ratchet only has to be advanced once
+ * for each run of messages from before the latest one we have seen. Messages
+ * are sorted and verified in groups of 64.
+ *
+ * The input message buffers are destroyed.
+ *
+ * For each message, plaintext_lengths[i] is set to the length of the
+ * decrypted plain-text, or olm_error() if it couldn't be decrypted, in which
+ * case errors[i] is set to one of the strings olm_group_decrypt() would have
+ * left in last_error ("SUCCESS" for the others). message_indices[i] is set
+ * for every message whose headers could be decoded. Either of message_indices
+ * and errors may be NULL.
+ *
+ * Returns the number of messages which couldn't be decrypted. last_error is
+ * left as the error for one of them.
+ */
+size_t olm_group_decrypt_batch(
+    OlmInboundGroupSession *session, size_t count,
+
+    /* input; note that these will be overwritten with the base64-decoded
+       messages. */
+    uint8_t * const * messages, const size_t * message_lengths,
+
+    /* output */
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors
+);
+
+/**
+ * Decrypt the cheapest of count messages for this session within a budget,
+ * leaving the rest for later, so that what can be shown quickly, such as the
+ * latest messages of a timeline after a sync, isn't held up by messages far
+ * back in the session's history.
+ *
+ * Each message is costed as olm_inbound_group_session_seek_cost() of its
+ * index, which is set in costs[i]; a message whose index can't be read costs
+ * 0, since it will fail straight away. The messages are
+ * then decrypted with olm_group_decrypt_batch(), cheapest first, for as long
+ * as their costs add up to no more than budget. Messages that cost nothing
+ * are always decrypted.
+ *
+ * The messages left over are deferred: plaintext_lengths[i] is set to
+ * olm_error() and errors[i] to "DECRYPTION_DEFERRED", and their input buffers
+ * are left as they were, so that they can be passed to another call later
+ * with a larger budget, or to olm_group_decrypt_batch(). The input buffers of
+ * the other messages are destroyed. message_indices[i] is set for every
+ * message whose index could be read.
+ *
+ * Returns the number of messages which weren't decrypted, including those
+ * deferred.
+ */
+size_t olm_group_decrypt_batch_within_budget(
+    OlmInboundGroupSession *session, size_t count,
+
+    /* input; note that these will be overwritten with the base64-decoded
+       messages, except for those deferred. */
+    uint8_t * const * messages, const size_t * message_lengths,
+
+    /* output */
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors,
+
+    size_t budget, size_t * costs
+);
+
+/** The number of size_t entries of scratch space
+ * olm_group_decrypt_across_sessions() needs for count messages */
+size_t olm_group_decrypt_across_sessions_scratch_length(size_t count);
+
+/**
+ * Decrypt count messages for any number of group sessions, message i with
+ * sessions[i], as if by calling olm_group_decrypt() on each, for example for
+ * the messages of every room in a sync response. A session may appear any
+ * number of times.
+ *
+ * The signatures of all the messages are checked together, whichever
+ * session they are for, in jobs of 64 messages. The messages are then
+ * grouped by session and sorted by index, and each session's messages are
+ * one job, decrypted in one pass along its ratchet as with
+ * olm_group_decrypt_batch(). The jobs are run by the executor, so that they
+ * can be spread over several threads; if it is NULL they are run one after
+ * another on the calling thread. Only one job works on a session at a time,
+ * and the sessions must not be used by anything else until this returns.
+ *
+ * The input message buffers are destroyed. For each message,
+ * plaintext_lengths[i] is set to the length of the plain-text and
+ * message_indices[i] to its index, or plaintext_lengths[i] is set to
+ * olm_error() if it couldn't be decrypted, in which case errors[i] is set to
+ * why, as olm_group_decrypt() would have left it in the session's
+ * last_error ("SUCCESS" for the others). message_indices and errors may be
+ * NULL.
+ *
+ * Returns the number of messages which couldn't be decrypted. Returns
+ * olm_error() without doing anything if scratch_length is less than
+ * olm_group_decrypt_across_sessions_scratch_length().
+ */
+size_t olm_group_decrypt_across_sessions(
+    OlmInboundGroupSession * const * sessions, size_t count,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors,
+    size_t * scratch, size_t scratch_length,
+    OlmBatchExecutor executor, void * executor_context
+);
+
+
+/** get the size of the scratch space for olm_group_decrypt_readonly() */
+size_t olm_group_decrypt_scratch_size(void);
+
+/** initialise scratch space for olm_group_decrypt_readonly() using the
+ * supplied memory. The supplied memory must be at least
+ * olm_group_decrypt_scratch_size() bytes */
+OlmGroupDecryptScratch * olm_group_decrypt_scratch(
+    void *memory
+);
+
+/** wipe the scratch space, which holds a ratchet value */
+size_t olm_clear_group_decrypt_scratch(
+    OlmGroupDecryptScratch *scratch
+);
+
+/**
+ * A null terminated string describing the most recent error from
+ * olm_group_decrypt_readonly() using this scratch space.
+ */
+const char *olm_group_decrypt_scratch_last_error(
+    const OlmGroupDecryptScratch *scratch
+);
+
+/**
+ * Decrypt a message without changing the session, so that several threads
+ * can decrypt messages for one session at once, each with its own scratch
+ * space. Nothing may change the session while they do so: with a
+ * reader-writer lock, olm_group_decrypt() and
+ * olm_inbound_group_session_commit_ratchet() take the write side.
+ *
+ * The scratch space keeps the ratchet for the last message, so a thread
+ * working through messages in order only advances it from there; it is
+ * reset when it is used with a different session. The session's checkpoints
+ * are used but not added to, and the message key cache isn't used.
+ *
+ * The input message buffer is destroyed.
+ *
+ * Returns the length of the decrypted plain-text, or olm_error() on failure,
+ * with the same errors as olm_group_decrypt() available from
+ * olm_group_decrypt_scratch_last_error().
+ */
+size_t olm_group_decrypt_readonly(
+    const OlmInboundGroupSession *session,
+    OlmGroupDecryptScratch *scratch,
+
+    /* input; note that it will be overwritten with the base64-decoded
+       message. */
+    uint8_t * message, size_t message_length,
+
+    /* output */
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+);
+
+/**
+ * Bring the session up to date with what olm_group_decrypt_readonly() has
+ * seen using this scratch space: move latest_ratchet on to the scratch
+ * ratchet if that is later, and mark the session verified if a message was
+ * decrypted. Does nothing if the scratch space was last used with a
+ * different session. Returns 0, or olm_error() with last_error
+ * ALLOCATION_FAILED if a compact session has no room for its latest ratchet.
+ */
+size_t olm_inbound_group_session_commit_ratchet(
+    OlmInboundGroupSession *session,
+    const OlmGroupDecryptScratch *scratch
+);
 
 /**
  * Get the number of bytes returned by olm_inbound_group_session_id()
@@ -183,6 +1182,20 @@ size_t olm_inbound_group_session_id(
     uint8_t * id, size_t id_length
 );
 
+/**
+ * Get the identifier for this session as 32 bytes, without base64 encoding
+ * it. This is the base64-decoded session ID.
+ *
+ * Returns the length of the session id on success or olm_error() on
+ * failure. On failure last_error will be set with an error code. The
+ * last_error will be OUTPUT_BUFFER_TOO_SMALL if the id buffer was too
+ * small.
+ */
+size_t olm_inbound_group_session_id_binary(
+    OlmInboundGroupSession *session,
+    uint8_t * id, size_t id_length
+);
+
 /**
  * Get the first message index we know how to decrypt.
  */
@@ -203,6 +1216,23 @@ int olm_inbound_group_session_is_verified(
     const OlmInboundGroupSession *session
 );
 
+/**
+ * Whether anything the session pickles has changed since it was created,
+ * imported or unpickled, or since olm_inbound_group_session_clear_dirty(),
+ * so that a caller need only pickle sessions which return 1. Decrypting a
+ * message before the latest ratchet changes nothing, unless it verifies the
+ * session or is recorded for replay detection. Pickling doesn't clear it.
+ */
+int olm_inbound_group_session_is_dirty(
+    const OlmInboundGroupSession *session
+);
+
+/** Note that the session has been saved, for
+ * olm_inbound_group_session_is_dirty() */
+void olm_inbound_group_session_clear_dirty(
+    OlmInboundGroupSession *session
+);
+
 /**
  * Get the number of bytes returned by olm_export_inbound_group_session()
  */
@@ -227,6 +1257,463 @@ size_t olm_export_inbound_group_session(
     uint8_t * key, size_t key_length, uint32_t message_index
 );
 
+/**
+ * Get the number of bytes returned by
+ * olm_export_inbound_group_session_batch() for count sessions
+ */
+size_t olm_export_inbound_group_session_batch_length(
+    size_t count
+);
+
+/**
+ * Export count sessions, each at the corresponding index of
+ * message_indices, one after another into keys. Export i takes the
+ * olm_export_inbound_group_session_length() bytes from
+ * i * olm_export_inbound_group_session_length(), and is the same as
+ * olm_export_inbound_group_session() would write for that session and index.
+ * Exports of the same session next to each other in order of message index
+ * carry on advancing the ratchet from one to the next rather than each
+ * replaying it from the start.
+ *
+ * Sessions are changed in the same way as by
+ * olm_export_inbound_group_session(), so separate threads can export
+ * separate sessions at once, but not the same session.
+ *
+ * For each session whose export fails, errors[i] is set to the error
+ * olm_export_inbound_group_session() would have left in last_error, and the
+ * export is zeroed. errors[i] is "SUCCESS" for the others. errors may be
+ * NULL.
+ *
+ * Returns the number of sessions which couldn't be exported, or olm_error()
+ * if the output buffer is smaller than
+ * olm_export_inbound_group_session_batch_length(), in which case
+ * olm_inbound_group_session_last_error() for the first session will be
+ * "OUTPUT_BUFFER_TOO_SMALL".
+ */
+size_t olm_export_inbound_group_session_batch(
+    OlmInboundGroupSession * const * sessions,
+    const uint32_t * message_indices, size_t count,
+    uint8_t * keys, size_t keys_length,
+    const char ** errors
+);
+
+
+/**
+ * A set of inbound group sessions indexed by their binary session IDs, in
+ * memory supplied by the caller. The sessions themselves are kept in the
+ * same memory, so that a message can be decrypted given just the ID of the
+ * session it was sent with.
+ *
+ * Only one thread at a time may change the store or call the functions that
+ * take a non-const store. Any number of other threads can look sessions up
+ * at the same time with olm_group_session_store_lookup(), which never waits
+ * for anything, between olm_group_session_store_read_begin() and
+ * olm_group_session_store_read_end().
+ */
+
+/** The number of bytes needed for a store with room for capacity sessions.
+ * The capacity must be at most 32767. */
+size_t olm_group_session_store_size(
+    size_t capacity
+);
+
+/** Initialise a group session store in the supplied memory, which must be at
+ * least olm_group_session_store_size(capacity) bytes */
+OlmGroupSessionStore * olm_group_session_store(
+    void * memory, size_t capacity
+);
+
+/** A null terminated string describing the most recent error to happen to a
+ * group session store */
+const char * olm_group_session_store_last_error(
+    const OlmGroupSessionStore * store
+);
+
+/** Clears the memory used to back the store, including all of its sessions
+ * but not any checkpoint or key cache buffers they were given */
+size_t olm_clear_group_session_store(
+    OlmGroupSessionStore * store
+);
+
+/** The number of sessions in the store */
+size_t olm_group_session_store_count(
+    const OlmGroupSessionStore * store
+);
+
+/** Adds the memory the store is using to stats, as described in
+ * olm/memory_stats.h: the store itself, and each session in it as one of
+ * the objects, along with the checkpoint and message key cache buffers it
+ * was given. The store must not be changed during the call. */
+void olm_group_session_store_memory_stats(
+    const OlmGroupSessionStore * store,
+    OlmMemoryStats * stats
+);
+
+/** Trims the memory of each session in the store, as
+ * olm_inbound_group_session_trim_memory() does, including sessions which
+ * have been removed but not yet cleared, so that from
+ * OLM_TRIM_MEMORY_BUFFERS none of the store's sessions use the buffers they
+ * were given. Returns the total number of bytes wiped. */
+size_t olm_group_session_store_trim_memory(
+    OlmGroupSessionStore * store, int level
+);
+
+/** Take room for a new session from the store, returning the empty session,
+ * or NULL if the store is full, in which case
+ * olm_group_session_store_last_error() will be "STORE_FULL". Set the session
+ * up with olm_init_inbound_group_session(),
+ * olm_import_inbound_group_session() or by unpickling it, and then either
+ * pass it to olm_group_session_store_commit() or give it back with
+ * olm_group_session_store_remove(). */
+OlmInboundGroupSession * olm_group_session_store_add(
+    OlmGroupSessionStore * store
+);
+
+/** Index a session from olm_group_session_store_add() under its ID. If the
+ * store already has a session with that ID, the new session replaces it and
+ * the old one is cleared. Returns olm_error() if the session didn't come
+ * from olm_group_session_store_add() or is already indexed, in which case
+ * olm_group_session_store_last_error() will be "UNKNOWN_SESSION_ID" */
+size_t olm_group_session_store_commit(
+    OlmGroupSessionStore * store,
+    OlmInboundGroupSession * session
+);
+
+/** Take a session out of the store and clear it. If another thread is
+ * reading the store, clearing the session and reusing its room waits until
+ * every read that began before it was taken out has ended. */
+size_t olm_group_session_store_remove(
+    OlmGroupSessionStore * store,
+    OlmInboundGroupSession * session
+);
+
+/** Find the session with the given binary ID, as written by
+ * olm_inbound_group_session_id_binary(). Returns NULL if there isn't one, in
+ * which case olm_group_session_store_last_error() will be
+ * "UNKNOWN_SESSION_ID" */
+OlmInboundGroupSession * olm_group_session_store_find(
+    OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+);
+
+/** Start reading the store on this thread, so that sessions found with
+ * olm_group_session_store_lookup() aren't cleared or replaced in memory
+ * until olm_group_session_store_read_end() is called with the ticket this
+ * returns. Reads should be short, as removed sessions are kept until they
+ * end. */
+size_t olm_group_session_store_read_begin(
+    const OlmGroupSessionStore * store
+);
+
+/** End a read started by olm_group_session_store_read_begin() */
+void olm_group_session_store_read_end(
+    const OlmGroupSessionStore * store, size_t ticket
+);
+
+/** Find the session with the given binary ID while another thread may be
+ * changing the store, from inside a read. Returns NULL if there isn't one.
+ * Nothing is written to the store, so the session can only be used in ways
+ * that don't change it, such as olm_group_decrypt_readonly(). */
+const OlmInboundGroupSession * olm_group_session_store_lookup(
+    const OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+);
+
+/** Write pointers to each of the sessions in the store to sessions, for
+ * instance to pickle them all with olm_pickle_inbound_group_session_batch().
+ * Returns the number of sessions. If there are more than max_sessions then
+ * returns olm_error() and olm_group_session_store_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_group_session_store_sessions(
+    OlmGroupSessionStore * store,
+    OlmInboundGroupSession ** sessions, size_t max_sessions
+);
+
+/** As olm_group_decrypt_max_plaintext_length() for the session with the
+ * given binary ID. Errors are reported by
+ * olm_group_session_store_last_error(). */
+size_t olm_group_session_store_decrypt_max_plaintext_length(
+    OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length,
+    uint8_t * message, size_t message_length
+);
+
+/** As olm_group_decrypt() for the session with the given binary ID. Returns
+ * olm_error() if there is no such session, or the session failed to decrypt
+ * the message, with the reason given by
+ * olm_group_session_store_last_error(). */
+size_t olm_group_session_store_decrypt(
+    OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length,
+    uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+);
+
+
+/**
+ * A group session store split into shards by session ID, so that on a
+ * machine with several NUMA nodes each shard's sessions can be kept on one
+ * node and decrypted by threads on that node. Each shard is an ordinary
+ * group session store, in memory the caller places, for instance with
+ * olm_map_memory() from olm/pool.h. The sharded store only holds the list
+ * of shards.
+ */
+
+/** The number of bytes needed for a sharded store of shard_count shards,
+ * which must be at least 1 */
+size_t olm_sharded_group_session_store_size(
+    size_t shard_count
+);
+
+/** Initialise a sharded store in the supplied memory, which must be at least
+ * olm_sharded_group_session_store_size(shard_count) bytes. shards are the
+ * stores for each shard, which should start out empty, and nodes[i] is the
+ * NUMA node shards[i] is on, or OLM_ANY_NUMA_NODE. */
+OlmShardedGroupSessionStore * olm_sharded_group_session_store(
+    void * memory,
+    OlmGroupSessionStore * const * shards, const int * nodes,
+    size_t shard_count
+);
+
+/** A null terminated string describing the most recent error to happen to a
+ * sharded store */
+const char * olm_sharded_group_session_store_last_error(
+    const OlmShardedGroupSessionStore * store
+);
+
+/** Clears the memory used to back the sharded store. The shards are left
+ * alone, to be cleared with olm_clear_group_session_store(). */
+size_t olm_clear_sharded_group_session_store(
+    OlmShardedGroupSessionStore * store
+);
+
+/** The number of sessions in all the shards */
+size_t olm_sharded_group_session_store_count(
+    const OlmShardedGroupSessionStore * store
+);
+
+/** Adds the memory the sharded store and all of its shards are using to
+ * stats, as olm_group_session_store_memory_stats() does for each shard */
+void olm_sharded_group_session_store_memory_stats(
+    const OlmShardedGroupSessionStore * store,
+    OlmMemoryStats * stats
+);
+
+/** The index of the shard which keeps the session with the given binary ID.
+ * Returns olm_error() if the ID isn't the length of a session ID. */
+size_t olm_sharded_group_session_store_shard_index(
+    const OlmShardedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+);
+
+/** Shard number shard, which is less than the shard count */
+OlmGroupSessionStore * olm_sharded_group_session_store_shard(
+    OlmShardedGroupSessionStore * store, size_t shard
+);
+
+/** Index a session taken from olm_group_session_store_add() on any of the
+ * shards, such as one on the node of the thread setting it up, in the shard
+ * for its ID. If that is another shard, the session is moved there; either
+ * way the session's new address is returned. Returns NULL if the session
+ * didn't come from one of the shards or is already indexed, in which case
+ * olm_sharded_group_session_store_last_error() will be
+ * "UNKNOWN_SESSION_ID", or if the shard for its ID is full, in which case it
+ * will be "STORE_FULL" and the session is left where it was. */
+OlmInboundGroupSession * olm_sharded_group_session_store_commit(
+    OlmShardedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+);
+
+/** Take a session out of whichever shard has it, and clear it */
+size_t olm_sharded_group_session_store_remove(
+    OlmShardedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+);
+
+/** As olm_group_session_store_find(), looking only in the shard for the
+ * ID */
+OlmInboundGroupSession * olm_sharded_group_session_store_find(
+    OlmShardedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+);
+
+/** The number of size_t entries of scratch space
+ * olm_sharded_group_session_store_decrypt_batch() needs for count
+ * messages */
+size_t olm_sharded_group_session_store_decrypt_batch_scratch_length(
+    const OlmShardedGroupSessionStore * store, size_t count
+);
+
+/**
+ * Decrypts count messages, as if by calling olm_group_session_store_decrypt()
+ * on each with the shard for its session ID. A session may appear any number
+ * of times; its messages are decrypted in the order they are given.
+ *
+ * The messages are grouped by shard, and each shard's messages are one job
+ * for the executor, which is told the node of each job's shard so that it
+ * can run the job on a thread pinned to that node. If executor is NULL the
+ * jobs are run one after another on the calling thread.
+ *
+ * The input message buffers are destroyed. For each message,
+ * plaintext_lengths[i] is set to the length of the plain-text and
+ * message_indices[i] to its index, or plaintext_lengths[i] is set to
+ * olm_error() if it couldn't be decrypted, in which case errors[i] is set to
+ * why, as olm_group_session_store_last_error() would give it ("SUCCESS" for
+ * the others). errors may be NULL.
+ *
+ * Returns the number of messages which couldn't be decrypted. Returns
+ * olm_error() without doing anything if scratch_length is less than
+ * olm_sharded_group_session_store_decrypt_batch_scratch_length(), in which
+ * case olm_sharded_group_session_store_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL".
+ */
+size_t olm_sharded_group_session_store_decrypt_batch(
+    OlmShardedGroupSessionStore * store, size_t count,
+    uint8_t const * const * session_ids, const size_t * session_id_lengths,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors,
+    size_t * scratch, size_t scratch_length,
+    OlmNodeBatchExecutor executor, void * executor_context
+);
+
+
+/**
+ * A group session store in memory shared between processes, for instance
+ * the prefork workers of a server, so that they can all decrypt with one
+ * copy of each session. The shared memory, from mmap() with MAP_SHARED or
+ * the like, holds no pointers, so it may be mapped at a different address
+ * in each process. Each process uses the store through its own handle.
+ *
+ * Any number of threads in any number of processes may use the store at
+ * once. Finding a session is lock free; using it takes a lock on the
+ * session, so that only one thread at a time advances its ratchet, and
+ * adding and removing sessions takes a lock on the store. The locks are
+ * spin locks in the shared memory: a process that dies holding one leaves
+ * it held, so the store should be set up afresh if that happens.
+ *
+ * Sessions in the store may only be given checkpoint, message key cache or
+ * history scan buffers in the same shared mapping, for instance after the
+ * store's part of it. A session finds its buffers from their distance from
+ * it, which is the same in every process, whereas a buffer in one process's
+ * own memory means nothing to the others.
+ */
+
+/** The number of bytes needed for a process's handle on a shared store */
+size_t olm_shared_group_session_store_size(void);
+
+/** The number of bytes of shared memory needed for a shared store with room
+ * for capacity sessions. The capacity must be at most 32767. */
+size_t olm_shared_group_session_store_shared_length(
+    size_t capacity
+);
+
+/** Set up an empty shared store in shared_memory, which must be at least
+ * olm_shared_group_session_store_shared_length(capacity) bytes, and a handle
+ * on it in memory, which must be olm_shared_group_session_store_size()
+ * bytes. Only one process should do this; the others attach. */
+OlmSharedGroupSessionStore * olm_shared_group_session_store(
+    void * memory, void * shared_memory, size_t capacity
+);
+
+/** Set up a handle in memory on a shared store that another process set up
+ * in shared_memory. Returns NULL if shared_memory doesn't hold a shared
+ * store, or holds one set up by a build of the library with sessions of a
+ * different size, or is shorter than the store. */
+OlmSharedGroupSessionStore * olm_shared_group_session_store_attach(
+    void * memory, void * shared_memory, size_t shared_length
+);
+
+/** A null terminated string describing the most recent error to happen to
+ * this handle on a shared store */
+const char * olm_shared_group_session_store_last_error(
+    const OlmSharedGroupSessionStore * store
+);
+
+/** Clears the shared memory, including all of the sessions, and the handle.
+ * No other process may be using the store. A handle holds nothing else, so
+ * a process which is done with a store that others still use can simply
+ * forget its handle. Returns the length of the shared memory. */
+size_t olm_clear_shared_group_session_store(
+    OlmSharedGroupSessionStore * store
+);
+
+/** The number of sessions in the shared store */
+size_t olm_shared_group_session_store_count(
+    const OlmSharedGroupSessionStore * store
+);
+
+/** Take room for a new session from the shared store, returning the empty
+ * session, or NULL if the store is full, in which case
+ * olm_shared_group_session_store_last_error() will be "STORE_FULL". Only
+ * this process can reach the session until it is committed, so it can be
+ * set up without a lock, with olm_init_inbound_group_session(),
+ * olm_import_inbound_group_session() or by unpickling it. Then pass it to
+ * olm_shared_group_session_store_commit() or give it back with
+ * olm_shared_group_session_store_discard(). */
+OlmInboundGroupSession * olm_shared_group_session_store_add(
+    OlmSharedGroupSessionStore * store
+);
+
+/** Index a session from olm_shared_group_session_store_add() under its ID.
+ * If the store already has a session with that ID, the new session replaces
+ * it and the old one is cleared once nobody has it locked. Returns
+ * olm_error() if the session didn't come from
+ * olm_shared_group_session_store_add() or is already indexed, in which case
+ * olm_shared_group_session_store_last_error() will be
+ * "UNKNOWN_SESSION_ID" */
+size_t olm_shared_group_session_store_commit(
+    OlmSharedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+);
+
+/** Give back a session from olm_shared_group_session_store_add() which
+ * hasn't been committed, clearing it */
+size_t olm_shared_group_session_store_discard(
+    OlmSharedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+);
+
+/** Take the session with the given binary ID out of the shared store and
+ * clear it once nobody has it locked. Returns olm_error() if there isn't
+ * one, in which case olm_shared_group_session_store_last_error() will be
+ * "UNKNOWN_SESSION_ID" */
+size_t olm_shared_group_session_store_remove(
+    OlmSharedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+);
+
+/** Find the session with the given binary ID and lock it, so that it can be
+ * used in any way until it is passed to
+ * olm_shared_group_session_store_unlock(). Returns NULL if there isn't
+ * one, in which case olm_shared_group_session_store_last_error() will be
+ * "UNKNOWN_SESSION_ID". Keep the lock briefly, as others wanting the
+ * session spin while it is held. Lock one session at a time, and don't add,
+ * commit, discard or remove sessions while holding it. */
+OlmInboundGroupSession * olm_shared_group_session_store_lock(
+    OlmSharedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+);
+
+/** Unlock a session from olm_shared_group_session_store_lock() */
+void olm_shared_group_session_store_unlock(
+    OlmSharedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+);
+
+/** As olm_group_decrypt() for the session with the given binary ID, with the
+ * session locked. Returns olm_error() if there is no such session, or the
+ * session failed to decrypt the message, with the reason given by
+ * olm_shared_group_session_store_last_error(). */
+size_t olm_shared_group_session_store_decrypt(
+    OlmSharedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length,
+    uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+);
 
 #ifdef __cplusplus
 } // extern "C"
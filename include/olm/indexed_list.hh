@@ -0,0 +1,363 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef OLM_INDEXED_LIST_HH_
+#define OLM_INDEXED_LIST_HH_
+
+#include "olm/memory.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace olm {
+
+/** The most items an IndexedList can hold, so that slot numbers fit in the
+ * index. */
+static std::size_t const INDEXED_LIST_LIMIT = 0x7fff;
+
+/**
+ * A list of items, newest first, with an open-addressed hash index so that
+ * items can be found, removed and the oldest discarded without scanning or
+ * shifting the list. The items, their links and the index live in a buffer
+ * supplied by the caller, sized with storage_length() and aligned for a T.
+ * A buffer in the same block of memory as the list is found from its offset
+ * from the list, so that the block can be moved with memcpy; one elsewhere
+ * is pointed to, so that the list can be moved without it.
+ *
+ * Traits::hash(item) gives the 32-bit hash the item is indexed under; the
+ * caller of find() passes the same hash for what it is looking for, along
+ * with a test for whether an item is the one it wants.
+ */
+template<typename T, typename Traits>
+class IndexedList {
+public:
+    /** A list with no room for any items. */
+    IndexedList()
+        : _items_at(0), _index_mask(0), _capacity(0),
+          _newest(0), _oldest(0), _size(0), _in_block(false) {}
+
+    /** A list with room for capacity items in storage. The capacity must be
+     * at most INDEXED_LIST_LIMIT. Set in_block if the storage is in the same
+     * block of memory as the list and moves with it. */
+    IndexedList(
+        std::uint8_t * storage, std::size_t capacity, bool in_block = true
+    ) : _items_at(
+            reinterpret_cast<std::intptr_t>(storage)
+                - (in_block ? reinterpret_cast<std::intptr_t>(this) : 0)
+        ),
+        _index_mask(index_size(capacity) - 1), _capacity(capacity),
+        _newest(0), _oldest(0), _size(0), _in_block(in_block) {
+        std::memset(
+            _index(), 0, index_size(capacity) * sizeof(std::uint16_t)
+        );
+    }
+
+    /* Copying the list would leave two lists sharing the same items */
+    IndexedList(IndexedList const &) = delete;
+    IndexedList & operator=(IndexedList const &) = delete;
+
+    /** The number of bytes of storage needed for capacity items. */
+    static constexpr std::size_t storage_length(std::size_t capacity) {
+        return capacity * sizeof(T)
+            + 2 * capacity * sizeof(std::uint16_t)
+            + index_size(capacity) * sizeof(std::uint16_t);
+    }
+
+    /** Walks the list from the newest item to the oldest. */
+    template<typename Item, typename List>
+    class basic_iterator {
+    public:
+        basic_iterator(List * list, Item * item) : _list(list), _item(item) {}
+        Item & operator*() const { return *_item; }
+        Item * operator->() const { return _item; }
+        basic_iterator & operator++() {
+            _item = _list->older(_item);
+            return *this;
+        }
+        bool operator!=(basic_iterator const & other) const {
+            return _item != other._item;
+        }
+    private:
+        List * _list;
+        Item * _item;
+    };
+
+    typedef basic_iterator<T, IndexedList> iterator;
+    typedef basic_iterator<T const, IndexedList const> const_iterator;
+
+    iterator begin() { return iterator(this, newest()); }
+    iterator end() { return iterator(this, nullptr); }
+    const_iterator begin() const { return const_iterator(this, newest()); }
+    const_iterator end() const { return const_iterator(this, nullptr); }
+
+    /** The number of items in the list. */
+    std::size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+    /** The number of items the list has room for. */
+    std::size_t capacity() const { return _capacity; }
+
+    /** The storage the list was created with. */
+    std::uint8_t * storage() const {
+        return reinterpret_cast<std::uint8_t *>(_items());
+    }
+
+    /** Find an item indexed under hash for which match(item) is true. cursor
+     * holds the position in the index to continue from and should be 0 for
+     * the first call; call again with the same cursor for any further
+     * matches. Returns nullptr when there are no more matches. */
+    template<typename Match>
+    T * find(std::uint32_t hash, Match const & match, std::size_t & cursor) {
+        IndexedList const & list = *this;
+        return const_cast<T *>(list.find(hash, match, cursor));
+    }
+
+    template<typename Match>
+    T const * find(
+        std::uint32_t hash, Match const & match, std::size_t & cursor
+    ) const {
+        if (_size == 0) {
+            return nullptr;
+        }
+        std::size_t start = home(hash);
+        /* The index is never full, so every probe sequence ends at a gap. */
+        while (cursor <= _index_mask) {
+            std::uint16_t entry = _index()[(start + cursor++) & _index_mask];
+            if (!entry) {
+                break;
+            }
+            if (match(_items()[entry - 1])) {
+                return &_items()[entry - 1];
+            }
+        }
+        cursor = _index_mask + 1;
+        return nullptr;
+    }
+
+    /** Add an item as the newest in the list. If the list is full the oldest
+     * item is discarded. */
+    void insert(T const & value) {
+        if (_capacity == 0) {
+            return;
+        }
+        if (_size == _capacity) {
+            remove(_oldest - 1);
+        }
+        _items()[_size] = value;
+        link(_size++, true);
+    }
+
+    /** Add an item as the oldest in the list. If the list is full the oldest
+     * item is replaced. This is used to load a list from a pickle, which
+     * lists the items newest first. */
+    void append(T const & value) {
+        if (_capacity == 0) {
+            return;
+        }
+        if (_size == _capacity) {
+            remove(_oldest - 1);
+        }
+        _items()[_size] = value;
+        link(_size++, false);
+    }
+
+    /** Replace the items with copies of another list's, keeping this list's
+     * own storage. The lists must have the same capacity. */
+    void copy_from(IndexedList const & other) {
+        std::memcpy(storage(), other.storage(), storage_length(_capacity));
+        _newest = other._newest;
+        _oldest = other._oldest;
+        _size = other._size;
+    }
+
+    /** Remove an item from the list, wiping it. */
+    void erase(T * item) {
+        remove(item - _items());
+    }
+
+    /** The newest item in the list, or nullptr if it is empty. */
+    T * newest() { return _newest ? &_items()[_newest - 1] : nullptr; }
+    T const * newest() const {
+        return _newest ? &_items()[_newest - 1] : nullptr;
+    }
+
+    /** The oldest item in the list, or nullptr if it is empty. */
+    T * oldest() { return _oldest ? &_items()[_oldest - 1] : nullptr; }
+    T const * oldest() const {
+        return _oldest ? &_items()[_oldest - 1] : nullptr;
+    }
+
+    /** The next newer item after item, or nullptr if it was the newest. */
+    T * newer(T const * item) {
+        std::uint16_t entry = _newer()[item - _items()];
+        return entry ? &_items()[entry - 1] : nullptr;
+    }
+    T const * newer(T const * item) const {
+        std::uint16_t entry = _newer()[item - _items()];
+        return entry ? &_items()[entry - 1] : nullptr;
+    }
+
+    /** The next older item after item, or nullptr if it was the oldest. */
+    T * older(T const * item) {
+        std::uint16_t entry = _older()[item - _items()];
+        return entry ? &_items()[entry - 1] : nullptr;
+    }
+    T const * older(T const * item) const {
+        std::uint16_t entry = _older()[item - _items()];
+        return entry ? &_items()[entry - 1] : nullptr;
+    }
+
+private:
+    /** The index has at least twice as many positions as there are slots so
+     * that the probe sequences stay short, and is a power of two so a mask
+     * wraps them. */
+    static constexpr std::size_t index_size(
+        std::size_t capacity, std::size_t size = 1
+    ) {
+        return size >= 2 * capacity ? size : index_size(capacity, 2 * size);
+    }
+
+    std::size_t home(std::uint32_t hash) const {
+        hash ^= hash >> 16;
+        return hash & _index_mask;
+    }
+
+    /** Add the item in slot to the order and to the index. */
+    void link(std::size_t slot, bool as_newest) {
+        std::uint16_t entry = slot + 1;
+        if (as_newest) {
+            _newer()[slot] = 0;
+            _older()[slot] = _newest;
+            if (_newest) {
+                _newer()[_newest - 1] = entry;
+            } else {
+                _oldest = entry;
+            }
+            _newest = entry;
+        } else {
+            _older()[slot] = 0;
+            _newer()[slot] = _oldest;
+            if (_oldest) {
+                _older()[_oldest - 1] = entry;
+            } else {
+                _newest = entry;
+            }
+            _oldest = entry;
+        }
+
+        std::size_t pos = home(Traits::hash(_items()[slot]));
+        while (_index()[pos]) {
+            pos = (pos + 1) & _index_mask;
+        }
+        _index()[pos] = entry;
+    }
+
+    /** Take the item in slot out of the order and the index, and wipe it. */
+    void remove(std::size_t slot) {
+        std::size_t const mask = _index_mask;
+        std::uint16_t entry = slot + 1;
+        T & item = _items()[slot];
+
+        if (_newer()[slot]) {
+            _older()[_newer()[slot] - 1] = _older()[slot];
+        } else {
+            _newest = _older()[slot];
+        }
+        if (_older()[slot]) {
+            _newer()[_older()[slot] - 1] = _newer()[slot];
+        } else {
+            _oldest = _newer()[slot];
+        }
+
+        /* Take the entry out of the index, shifting any later entries in the
+         * same run back into the gap so that no probe sequence is broken. */
+        std::size_t hole = home(Traits::hash(item));
+        while (_index()[hole] != entry) {
+            hole = (hole + 1) & mask;
+        }
+        std::size_t pos = hole;
+        for (;;) {
+            pos = (pos + 1) & mask;
+            if (!_index()[pos]) {
+                break;
+            }
+            std::size_t other_home =
+                home(Traits::hash(_items()[_index()[pos] - 1]));
+            if (((pos - other_home) & mask) >= ((pos - hole) & mask)) {
+                _index()[hole] = _index()[pos];
+                hole = pos;
+            }
+        }
+        _index()[hole] = 0;
+
+        /* Move the item in the last slot into the free one so the slots in
+         * use stay contiguous. */
+        std::size_t last = --_size;
+        if (slot != last) {
+            std::uint16_t last_entry = last + 1;
+            item = _items()[last];
+            _newer()[slot] = _newer()[last];
+            _older()[slot] = _older()[last];
+            if (_newer()[slot]) {
+                _older()[_newer()[slot] - 1] = entry;
+            } else {
+                _newest = entry;
+            }
+            if (_older()[slot]) {
+                _newer()[_older()[slot] - 1] = entry;
+            } else {
+                _oldest = entry;
+            }
+            pos = home(Traits::hash(item));
+            while (_index()[pos] != last_entry) {
+                pos = (pos + 1) & mask;
+            }
+            _index()[pos] = entry;
+        }
+        olm::unset(_items()[last]);
+        _newer()[last] = 0;
+        _older()[last] = 0;
+    }
+
+    /* The links and the index follow the items in the storage, so only
+     * where the items are is kept and the rest found from the capacity. */
+    T * _items() const {
+        return reinterpret_cast<T *>(
+            (_in_block ? reinterpret_cast<std::intptr_t>(this) : 0)
+                + _items_at
+        );
+    }
+    std::uint16_t * _newer() const {
+        return reinterpret_cast<std::uint16_t *>(_items() + _capacity);
+    }
+    std::uint16_t * _older() const { return _newer() + _capacity; }
+    std::uint16_t * _index() const { return _older() + _capacity; }
+
+    /* Items are kept in slots [0, _size). Links and index entries hold a
+     * slot number plus one, with 0 meaning none. */
+    /** the items' offset from the list if _in_block, else their address */
+    std::intptr_t _items_at;
+    std::uint16_t _index_mask;
+    std::uint16_t _capacity;
+    std::uint16_t _newest;
+    std::uint16_t _oldest;
+    std::uint16_t _size;
+    bool _in_block;
+};
+
+} // namespace olm
+
+#endif /* OLM_INDEXED_LIST_HH_ */
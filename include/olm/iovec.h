@@ -0,0 +1,42 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Buffers held in several pieces, for the scatter-gather variants of the
+ * encrypt and decrypt functions. A list of segments is read or written as if
+ * the segments were one buffer, one after another.
+ */
+
+#ifndef OLM_IOVEC_H_
+#define OLM_IOVEC_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** One segment of a buffer: length bytes starting at base. This has the
+ * same members, in the same order, as the POSIX struct iovec. The library
+ * only reads from the segments of an input. */
+typedef struct OlmIovec {
+    void * base;
+    size_t length;
+} OlmIovec;
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_IOVEC_H_ */
@@ -0,0 +1,82 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Walking the lists of segments in olm/iovec.h. None of these check that
+ * the segments are long enough; the callers check the total length first. */
+
+#ifndef OLM_IOVEC_INTERNAL_H_
+#define OLM_IOVEC_INTERNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/iovec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A position in a list of segments */
+struct _olm_iovec_cursor {
+    /* the segment the position is in, and those after it */
+    const OlmIovec *segments;
+    size_t count;
+    /* how far into segments[0] the position is */
+    size_t offset;
+};
+
+/** The total length of count segments */
+size_t _olm_iovec_length(const OlmIovec * segments, size_t count);
+
+/** Start a cursor at the beginning of count segments */
+void _olm_iovec_cursor_init(
+    struct _olm_iovec_cursor *cursor,
+    const OlmIovec * segments, size_t count
+);
+
+/**
+ * The bytes from the cursor to the end of its segment, skipping any empty
+ * segments first. Sets *length to the number of bytes, which is 0 only at
+ * the end of the list. The cursor isn't moved.
+ */
+uint8_t * _olm_iovec_cursor_peek(
+    struct _olm_iovec_cursor *cursor, size_t *length
+);
+
+/** Move the cursor on by length bytes */
+void _olm_iovec_cursor_skip(struct _olm_iovec_cursor *cursor, size_t length);
+
+/** Copy length bytes from the segments at the cursor, moving it on */
+void _olm_iovec_cursor_read(
+    struct _olm_iovec_cursor *cursor,
+    uint8_t * output, size_t length
+);
+
+/** Copy length bytes into the segments at the cursor, moving it on */
+void _olm_iovec_cursor_write(
+    struct _olm_iovec_cursor *cursor,
+    uint8_t const * input, size_t length
+);
+
+/** Wipe the first length bytes of count segments */
+void _olm_iovec_unset(
+    const OlmIovec * segments, size_t count, size_t length
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_IOVEC_INTERNAL_H_ */
@@ -0,0 +1,206 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A journal gathers the changes to many sessions into one authenticated
+ * log, so that they can be made durable with one write and sync per batch
+ * rather than one per session. The records are whatever the caller stores
+ * for its sessions: usually a delta pickle after each message, from
+ * olm_pickle_session_delta(), and now and then a full pickle. The library
+ * still does no I/O of its own; the caller supplies the function which
+ * appends a batch to the log and syncs it.
+ *
+ * Each record is authenticated with a key derived from the caller's key,
+ * along with the log's generation and where in the log the record is, so
+ * records can't be changed, moved or copied into another log. A log grows
+ * until it is compacted into a new generation, which keeps only each
+ * session's last full pickle and the deltas since.
+ */
+
+#ifndef OLM_JOURNAL_H_
+#define OLM_JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct OlmJournal OlmJournal;
+
+/** The kinds of record in a journal */
+
+/** A change to the session, to be applied over the records before it */
+#define OLM_JOURNAL_DELTA 0
+/** The whole session, which replaces the records before it */
+#define OLM_JOURNAL_SNAPSHOT 1
+/** The session is gone, along with the records before it */
+#define OLM_JOURNAL_REMOVE 2
+
+/** Appends length bytes to the end of the log and makes them durable, for
+ * instance with write() then fsync(). Returns 0 on success, or non-zero if
+ * they couldn't be written. */
+typedef int (*OlmJournalWriter)(
+    void * context, void const * data, size_t length
+);
+
+/** Called by olm_journal_replay() for each record in the log, in order */
+typedef void (*OlmJournalVisitor)(
+    void * context, unsigned type,
+    void const * id, size_t id_length,
+    void const * data, size_t data_length
+);
+
+/** The number of bytes a record takes in the log */
+size_t olm_journal_record_length(
+    size_t id_length, size_t data_length
+);
+
+/** The number of bytes needed for a journal which can hold buffer_length
+ * bytes of records between commits */
+size_t olm_journal_size(
+    size_t buffer_length
+);
+
+/** Initialise a journal in the supplied memory, which must be at least
+ * olm_journal_size(buffer_length) bytes. The records are authenticated
+ * with a key derived from the key_length bytes of key. They are added to a
+ * log of the given generation which already holds position bytes, as
+ * returned by olm_journal_replay() or olm_journal_compact(), or 0 for a new
+ * log. Batches of records are appended to the log by calling
+ * writer(writer_context, ...). */
+OlmJournal * olm_journal(
+    void * memory, size_t buffer_length,
+    void const * key, size_t key_length,
+    uint64_t generation, size_t position,
+    OlmJournalWriter writer, void * writer_context
+);
+
+/** A null terminated string describing the most recent error to happen to a
+ * journal */
+const char * olm_journal_last_error(
+    const OlmJournal * journal
+);
+
+/** Clears the memory used to back the journal, dropping any records which
+ * haven't been committed */
+size_t olm_clear_journal(
+    OlmJournal * journal
+);
+
+/** Adds a record of the given type for the session with the given ID. The
+ * record is written by the next olm_journal_commit(). Any number of threads
+ * may append at once, and while another thread commits.
+ *
+ * Returns the position of the record in the log, which is durable once a
+ * commit has returned a position past it. Returns olm_error() on failure,
+ * when olm_journal_last_error() will be:
+ *  * OUTPUT_BUFFER_TOO_SMALL if the record is larger than the buffer
+ *  * JOURNAL_FULL if the buffer has no room left for it until it is
+ *    committed
+ *  * JOURNAL_WRITE_FAILED if a commit has failed
+ */
+size_t olm_journal_append(
+    OlmJournal * journal, unsigned type,
+    void const * id, size_t id_length,
+    void const * data, size_t data_length
+);
+
+/** The number of bytes of records waiting for the next commit */
+size_t olm_journal_pending(
+    const OlmJournal * journal
+);
+
+/** Writes all the records appended so far with one call to the writer.
+ * Records appended while the writer runs go in the next batch. Only one
+ * thread may commit at a time.
+ *
+ * Returns the length of the log, all of which is now durable. Returns
+ * olm_error() if the writer failed, when olm_journal_last_error() will be
+ * JOURNAL_WRITE_FAILED. The log might then end anywhere in the batch, so
+ * every later append and commit fails too; the log should be replayed to
+ * find where it ends and a new journal started from there. */
+size_t olm_journal_commit(
+    OlmJournal * journal
+);
+
+/** Moves the journal on to a new log of the given generation which already
+ * holds position bytes, such as one written by olm_journal_compact(), with a
+ * new writer. Records appended but not yet committed go to the new log,
+ * and a journal whose commit failed can append again. Nothing may append
+ * to or commit the journal while this runs. Returns the number of bytes of
+ * records waiting for the next commit. */
+size_t olm_journal_restart(
+    OlmJournal * journal,
+    uint64_t generation, size_t position,
+    OlmJournalWriter writer, void * writer_context
+);
+
+/** Checks the records of a log and passes each to visitor(context, ...),
+ * in order, stopping at the first record which is incomplete or fails to
+ * authenticate. log holds log_length bytes from position in a log of the
+ * given generation; position is 0 to replay the whole log.
+ *
+ * Returns the position of the end of the last good record. A log normally
+ * only ends early after a crash during a commit, in which case it should be
+ * cut back to that length before a journal appends to it again. A log which
+ * was cut short by someone else can't be told apart from one which wasn't,
+ * so a caller that needs to know should keep the position returned by its
+ * last commit somewhere else. */
+size_t olm_journal_replay(
+    void const * key, size_t key_length,
+    uint64_t generation, size_t position,
+    void const * log, size_t log_length,
+    OlmJournalVisitor visitor, void * context
+);
+
+/** The number of bytes of scratch space olm_journal_compact() needs for a
+ * log */
+size_t olm_journal_compact_scratch_length(
+    void const * log, size_t log_length
+);
+
+/**
+ * Writes the good records of a log, as olm_journal_replay() finds them, to
+ * output as a log of new_generation starting at new_position. Only the
+ * records since each session's last snapshot are kept, and none for
+ * sessions which were removed, other than the remove record itself when
+ * new_position isn't 0 and so other records come before it. Records of
+ * the same session stay in order; those of different sessions may not.
+ * This only reads the log, so it can run on any thread while the journal
+ * goes on appending to it.
+ *
+ * To move the journal on to the compacted log, compact the log up to the
+ * position of a commit, then compact what was committed since onto the end
+ * of that, and olm_journal_restart() the journal at the end of both.
+ *
+ * output must be at least log_length bytes and apart from the log, and
+ * scratch at least olm_journal_compact_scratch_length() bytes. Returns the
+ * length written to output, or olm_error() if either is too small.
+ */
+size_t olm_journal_compact(
+    void const * key, size_t key_length,
+    uint64_t generation, size_t position,
+    void const * log, size_t log_length,
+    uint64_t new_generation, size_t new_position,
+    void * output, size_t output_length,
+    void * scratch, size_t scratch_length
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_JOURNAL_H_ */
@@ -16,31 +16,32 @@
 #define OLM_LIST_HH_
 
 #include <cstddef>
+#include <cstdint>
 
 namespace olm {
 
 template<typename T, std::size_t max_size>
 class List {
 public:
-    List() : _end(_data) {}
+    List() : _size(0) {}
 
     typedef T * iterator;
     typedef T const * const_iterator;
 
     T * begin() { return _data; }
-    T * end() { return _end; }
+    T * end() { return _data + _size; }
     T const * begin() const { return _data; }
-    T const * end() const { return _end; }
+    T const * end() const { return _data + _size; }
 
     /**
      * Is the list empty?
      */
-    bool empty() const { return _end == _data; }
+    bool empty() const { return _size == 0; }
 
     /**
      * The number of items in the list.
      */
-    std::size_t size() const { return _end - _data; }
+    std::size_t size() const { return _size; }
 
     T & operator[](std::size_t index) { return _data[index]; }
 
@@ -50,8 +51,8 @@ public:
      * Erase the item from the list at the given position.
      */
     void erase(T * pos) {
-        --_end;
-        while (pos != _end) {
+        T * last = _data + --_size;
+        while (pos != last) {
             *pos = *(pos + 1);
             ++pos;
         }
@@ -64,12 +65,12 @@ public:
      * Returns the where the item is inserted.
      */
     T * insert(T * pos) {
-        if (_end != _data + max_size) {
-            ++_end;
-        } else if (pos == _end) {
+        if (_size != max_size) {
+            ++_size;
+        } else if (pos == end()) {
             --pos;
         }
-        T * tmp = _end - 1;
+        T * tmp = end() - 1;
         while (tmp != pos) {
             *tmp = *(tmp - 1);
             --tmp;
@@ -98,22 +99,135 @@ public:
         if (this == &other) {
             return *this;
         }
-        T * this_pos = _data;
-        T * const other_pos = other._data;
-        while (other_pos != other._end) {
-            *this_pos = *other;
-            ++this_pos;
-            ++other_pos;
+        for (std::size_t i = 0; i < other._size; ++i) {
+            _data[i] = other._data[i];
         }
-        _end = this_pos;
+        _size = other._size;
         return *this;
     }
 
 private:
-    T * _end;
+    /* A count rather than a pointer to the end, so that the list can be
+     * moved with memcpy along with whatever holds it */
+    std::size_t _size;
     T _data[max_size];
 };
 
+/**
+ * A list like List, but holding its items in an array supplied by the caller
+ * so that its capacity can be chosen at run time. The capacity must be at
+ * least one.
+ *
+ * The array is found from its offset from the list rather than pointed to,
+ * so a list and its array can be moved together with memcpy, or mapped at
+ * a different address in another process, as long as they stay the same
+ * distance apart.
+ */
+template<typename T>
+class BufferList {
+public:
+    BufferList() : _offset(0), _size(0), _capacity(0) {}
+
+    BufferList(T * data, std::size_t capacity)
+        : _offset(offset_to(data)), _size(0), _capacity(capacity) {}
+
+    /* Copying the list would leave two lists sharing the same items */
+    BufferList(BufferList<T> const &) = delete;
+    BufferList<T> & operator=(BufferList<T> const &) = delete;
+
+    typedef T * iterator;
+    typedef T const * const_iterator;
+
+    T * begin() { return data(); }
+    T * end() { return data() + _size; }
+    T const * begin() const { return data(); }
+    T const * end() const { return data() + _size; }
+
+    /**
+     * Is the list empty?
+     */
+    bool empty() const { return _size == 0; }
+
+    /**
+     * The number of items in the list.
+     */
+    std::size_t size() const { return _size; }
+
+    /**
+     * The number of items the list has room for.
+     */
+    std::size_t capacity() const { return _capacity; }
+
+    T & operator[](std::size_t index) { return data()[index]; }
+
+    T const & operator[](std::size_t index) const { return data()[index]; }
+
+    /**
+     * Erase the item from the list at the given position.
+     */
+    void erase(T * pos) {
+        T * last = data() + --_size;
+        while (pos != last) {
+            *pos = *(pos + 1);
+            ++pos;
+        }
+    }
+
+    /**
+     * Make space for an item in the list at a given position.
+     * If inserting the item makes the list longer than its capacity then
+     * the end of the list is discarded.
+     * Returns the where the item is inserted.
+     */
+    T * insert(T * pos) {
+        if (_size != _capacity) {
+            ++_size;
+        } else if (pos == end()) {
+            --pos;
+        }
+        T * tmp = end() - 1;
+        while (tmp != pos) {
+            *tmp = *(tmp - 1);
+            --tmp;
+        }
+        return pos;
+    }
+
+    /**
+     * Make space for an item in the list at the start of the list
+     */
+    T * insert() { return insert(begin()); }
+
+    /**
+     * Replace the items with copies of another list's, keeping this list's
+     * own array. The other list must have no more items than this one has
+     * room for.
+     */
+    void copy_from(BufferList<T> const & other) {
+        T * this_pos = data();
+        for (T const & item : other) {
+            *this_pos++ = item;
+        }
+        _size = other._size;
+    }
+
+private:
+    std::ptrdiff_t offset_to(T const * data) const {
+        return reinterpret_cast<std::intptr_t>(data)
+            - reinterpret_cast<std::intptr_t>(this);
+    }
+
+    T * data() const {
+        return reinterpret_cast<T *>(
+            reinterpret_cast<std::intptr_t>(this) + _offset
+        );
+    }
+
+    std::ptrdiff_t _offset;
+    std::size_t _size;
+    std::size_t _capacity;
+};
+
 } // namespace olm
 
 #endif /* OLM_LIST_HH_ */
@@ -55,6 +55,11 @@ typedef struct Megolm {
  */
 extern const struct _olm_cipher *megolm_cipher;
 
+/**
+ * The same cipher, for use with the _olm_cipher_aes_sha_256_context functions
+ */
+extern const struct _olm_cipher_aes_sha_256 *megolm_cipher_aes_sha_256;
+
 /**
  * initialize the megolm ratchet. random_data should be at least
  * MEGOLM_RATCHET_LENGTH bytes of randomness.
@@ -88,6 +93,24 @@ void megolm_advance(Megolm *megolm);
 /** advance the ratchet to a given count */
 void megolm_advance_to(Megolm *megolm, uint32_t advance_to);
 
+/**
+ * advance each of count ratchets to the corresponding count, as
+ * megolm_advance_to would. The ratchets' hashes are computed side by side
+ * where the CPU allows it, each lane moving on to the next ratchet as soon as
+ * its own is done, so ratchets of very different distances can share a
+ * batch. The ratchets must all be different.
+ */
+void megolm_advance_to_batch(
+    Megolm * const *megolms, const uint32_t *advance_to, size_t count
+);
+
+/**
+ * The number of HMAC-SHA-256 operations megolm_advance_to would take to
+ * advance a ratchet from counter to advance_to. If advance_to is before the
+ * counter then the ratchet has to wrap round, which is very expensive.
+ */
+size_t megolm_advance_cost(uint32_t counter, uint32_t advance_to);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
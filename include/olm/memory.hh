@@ -12,6 +12,9 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#ifndef OLM_MEMORY_HH_
+#define OLM_MEMORY_HH_
+
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -88,3 +91,5 @@ std::uint8_t * store_array(
 }
 
 } // namespace olm
+
+#endif /* OLM_MEMORY_HH_ */
@@ -0,0 +1,94 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* How much memory olm objects are using, for capacity planning and for
+ * deciding what to evict. The *_memory_stats functions, such as
+ * olm_session_memory_stats(), add an object's figures to an OlmMemoryStats,
+ * so that one can total any number of objects; zero it before the first.
+ *
+ * Reserved bytes are all the memory an object has: its own, what it has
+ * taken from an allocator, and the buffers it was given. Live bytes are
+ * the part of that holding state, leaving out the room for chains, keys,
+ * checkpoints and cache entries that aren't in use. Each entry in use
+ * counts for its share of the room, along with its share of any index. */
+
+#ifndef OLM_MEMORY_STATS_H_
+#define OLM_MEMORY_STATS_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct OlmMemoryStats {
+    /** The number of objects counted */
+    size_t objects;
+    size_t reserved_bytes;
+    size_t live_bytes;
+
+    /** The parts of reserved_bytes and live_bytes which are the checkpoint,
+     * message key cache and key stream buffers given to group sessions */
+    size_t cache_reserved_bytes;
+    size_t cache_live_bytes;
+
+    /** Olm sessions' receiver chains and skipped message keys, and the room
+     * for them */
+    size_t receiver_chains;
+    size_t max_receiver_chains;
+    size_t skipped_message_keys;
+    size_t max_skipped_message_keys;
+
+    /** Accounts' one time keys, and the room for them */
+    size_t one_time_keys;
+    size_t max_one_time_keys;
+
+    /** Inbound group sessions' checkpoints and cached message keys, and
+     * outbound group sessions' prepared message keys, and the room for
+     * them */
+    size_t checkpoints;
+    size_t max_checkpoints;
+    size_t cached_message_keys;
+    size_t max_cached_message_keys;
+    size_t prepared_message_keys;
+    size_t max_prepared_message_keys;
+} OlmMemoryStats;
+
+/* How much the *_trim_memory functions, such as
+ * olm_inbound_group_session_trim_memory(), give back when the system is
+ * short of memory. Each level also does everything the ones before it do,
+ * so that what is cheapest to build again goes first. None of them loses
+ * anything needed to encrypt or decrypt; it only makes it slower until the
+ * memory is filled again. */
+
+/** Wipe caches of recently used keys: inbound group sessions' message key
+ * caches and the verification keys a utility keeps decoded */
+#define OLM_TRIM_MEMORY_CACHES 1
+
+/** Also wipe work done ahead of time: inbound group sessions' checkpoints,
+ * outbound group sessions' prepared message keys, and the keys in a ratchet
+ * key pool */
+#define OLM_TRIM_MEMORY_PRECOMPUTED 2
+
+/** Also stop using the checkpoint, message key cache and key stream buffers
+ * given to group sessions, as if NULL had been passed for each, so that the
+ * caller can free them */
+#define OLM_TRIM_MEMORY_BUFFERS 3
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_MEMORY_STATS_H_ */
@@ -27,6 +27,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "olm/iovec.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,6 +43,24 @@ size_t _olm_encode_group_message_length(
     size_t signature_length
 );
 
+/**
+ * Writes the message headers, up to the start of the ciphertext, into the
+ * output buffer, which should be at least
+ * OLM_GROUP_MESSAGE_HEADER_MAX_LENGTH bytes long. Returns the number of
+ * bytes written; the ciphertext, the MAC and the signature follow.
+ */
+size_t _olm_encode_group_message_header(
+    uint8_t version,
+    uint32_t message_index,
+    size_t ciphertext_length,
+    uint8_t *output
+);
+
+/** The longest the headers written by _olm_encode_group_message_header()
+ * can be: the version, and the tags and varints of the index and of the
+ * ciphertext length */
+#define OLM_GROUP_MESSAGE_HEADER_MAX_LENGTH (1 + 1 + 5 + 1 + 10)
+
 /**
  * Writes the message headers into the output buffer.
  *
@@ -85,6 +105,54 @@ void _olm_decode_group_message(
 );
 
 
+struct _OlmDecodeGroupMessageSegmentsResults {
+    uint8_t version;
+    uint32_t message_index;
+    int has_message_index;
+    int has_ciphertext;
+    /* where the ciphertext starts in the message */
+    size_t ciphertext_offset;
+    size_t ciphertext_length;
+};
+
+
+/**
+ * Reads the message headers from a message held in segments, as
+ * _olm_decode_group_message() does, reading only the bytes of the headers.
+ */
+void _olm_decode_group_message_segments(
+    const OlmIovec *segments, size_t segment_count,
+    size_t mac_length, size_t signature_length,
+
+    /* output structure: updated with results */
+    struct _OlmDecodeGroupMessageSegmentsResults *results
+);
+
+
+struct _OlmPeekMessageResults {
+    uint8_t version;
+    int has_ciphertext;
+    size_t ciphertext_length;
+    /* only set by _olm_peek_group_message() */
+    int has_message_index;
+    uint32_t message_index;
+};
+
+
+/**
+ * Reads the message headers from a base64-encoded message, decoding only the
+ * bytes of the headers and leaving the input unchanged. The input length
+ * must be a valid length for unpadded base64.
+ */
+void _olm_peek_group_message(
+    const uint8_t *input, size_t input_length,
+    size_t mac_length, size_t signature_length,
+
+    /* output structure: updated with results */
+    struct _OlmPeekMessageResults *results
+);
+
+
 
 #ifdef __cplusplus
 } // extern "C"
@@ -22,6 +22,9 @@
  * converted to plain C and moved to message.h.
  */
 
+#ifndef OLM_MESSAGE_HH_
+#define OLM_MESSAGE_HH_
+
 #include "message.h"
 
 #include <cstddef>
@@ -135,4 +138,30 @@ void decode_one_time_key_message(
 );
 
 
+/**
+ * Reads the headers of a base64-encoded message, like decode_message() but
+ * decoding only the bytes of the headers and leaving the input unchanged.
+ * The input length must be a valid length for unpadded base64.
+ */
+void peek_message(
+    _OlmPeekMessageResults & results,
+    std::uint8_t const * input, std::size_t input_length,
+    std::size_t mac_length
+);
+
+
+/**
+ * Reads the headers of the message inside a base64-encoded pre-key message,
+ * in the same way as peek_message(). results.has_ciphertext is false if
+ * there isn't a message inside.
+ */
+void peek_one_time_key_message(
+    _OlmPeekMessageResults & results,
+    std::uint8_t const * input, std::size_t input_length,
+    std::size_t mac_length
+);
+
+
 } // namespace olm
+
+#endif /* OLM_MESSAGE_HH_ */
@@ -19,8 +19,14 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "olm/attachment.h"
+#include "olm/executor.h"
 #include "olm/inbound_group_session.h"
+#include "olm/memory_stats.h"
 #include "olm/outbound_group_session.h"
+#include "olm/pickle_key.h"
+#include "olm/pool.h"
+#include "olm/random.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,18 +38,59 @@ static const size_t OLM_MESSAGE_TYPE_MESSAGE = 1;
 typedef struct OlmAccount OlmAccount;
 typedef struct OlmSession OlmSession;
 typedef struct OlmUtility OlmUtility;
+typedef struct OlmMessageView OlmMessageView;
+typedef struct OlmDecryptTrial OlmDecryptTrial;
+typedef struct OlmSessionIndex OlmSessionIndex;
+typedef struct OlmRatchetKeyPool OlmRatchetKeyPool;
+typedef struct OlmSha256 OlmSha256;
+
+/** Receives output a piece at a time. Called with the context the caller
+ * passed in and length bytes of data, which are only valid during the call. */
+typedef void (*OlmOutputCallback)(
+    void * context, void const * data, size_t length
+);
 
 /** Get the version number of the library.
  * Arguments will be updated if non-null.
  */
 void olm_get_library_version(uint8_t *major, uint8_t *minor, uint8_t *patch);
 
+/** A description of the crypto kernels in use on this machine, for example
+ * "aes=aes-ni gcm=pclmul sha256=sha-ni sha256x4=sse2 sha256x8=avx2
+ * sha512=avx2 base64=avx2 curve25519=donna-c64 curve25519mb=avx2".
+ * Each kernel is "portable" where the CPU or the build can't accelerate it.
+ * The string is owned by the library. */
+const char * olm_get_crypto_backend(void);
+
 /** The size of an account object in bytes */
 size_t olm_account_size();
 
+/** The size in bytes of an account object created with
+ * olm_account_with_limits(). Returns olm_error() if max_one_time_keys is
+ * more than 32767. */
+size_t olm_account_size_with_limits(
+    size_t max_one_time_keys
+);
+
 /** The size of a session object in bytes */
 size_t olm_session_size();
 
+/** The size in bytes of a session object created with
+ * olm_session_with_limits(). Returns olm_error() if max_receiver_chains is
+ * zero or max_skipped_message_keys is more than 32767. */
+size_t olm_session_size_with_limits(
+    size_t max_receiver_chains, size_t max_skipped_message_keys
+);
+
+/** The size in bytes of a session object created with olm_compact_session().
+ * It holds the same as olm_session() but keeps its skipped message keys out
+ * of line, so most sessions, which have none, are several times smaller. */
+size_t olm_compact_session_size();
+
+/** The number of bytes a session created with olm_compact_session() takes
+ * from its allocator for its skipped message keys while it has some. */
+size_t olm_compact_session_skipped_key_size();
+
 /** The size of a utility object in bytes */
 size_t olm_utility_size();
 
@@ -53,12 +100,70 @@ OlmAccount * olm_account(
     void * memory
 );
 
+/** Initialise an account object using the supplied memory, with room for
+ * max_one_time_keys one time keys instead of the 100 that olm_account()
+ * gives. The supplied memory must be at least
+ * olm_account_size_with_limits(max_one_time_keys) bytes, and that must not
+ * have returned olm_error(). The room is kept in the account's pickle, and
+ * unpickling fails with ACCOUNT_TOO_SMALL if the account being unpickled
+ * into has room for fewer keys than the pickled one. */
+OlmAccount * olm_account_with_limits(
+    void * memory, size_t max_one_time_keys
+);
+
+/** Move an account into new memory with room for a different number of one
+ * time keys, for example to grow it when it runs short. The supplied memory
+ * must be at least olm_account_size_with_limits(max_one_time_keys) bytes and
+ * must not overlap the account's memory. If there isn't room for all the
+ * account's one time keys the newest are kept. The old account is cleared.
+ * Returns the account in the new memory. */
+OlmAccount * olm_account_resize(
+    OlmAccount * account, void * memory, size_t max_one_time_keys
+);
+
 /** Initialise a session object using the supplied memory
  *  The supplied memory must be at least olm_session_size() bytes */
 OlmSession * olm_session(
     void * memory
 );
 
+/** Initialise a session object using the supplied memory, with room for a
+ * different number of out of order messages than olm_session() gives.
+ *
+ * max_receiver_chains is how many of the remote's ratchet keys the session
+ * remembers, max_skipped_message_keys how many keys it keeps for messages
+ * that haven't arrived yet, and max_message_gap how far ahead of the last
+ * message received a message can be. olm_session() uses 5, 40 and 2000.
+ * Smaller limits make a smaller session; larger ones tolerate more
+ * reordering and loss.
+ *
+ * The supplied memory must be at least
+ * olm_session_size_with_limits(max_receiver_chains, max_skipped_message_keys)
+ * bytes, and that must not have returned olm_error(). The limits are kept in
+ * the session's pickle, and unpickling fails with SESSION_TOO_SMALL if the
+ * session being unpickled into has smaller limits than the pickled one. */
+OlmSession * olm_session_with_limits(
+    void * memory,
+    size_t max_receiver_chains, size_t max_skipped_message_keys,
+    size_t max_message_gap
+);
+
+/** Initialise a session object using the supplied memory, which must be at
+ * least olm_compact_session_size() bytes. The session has the same limits
+ * as one from olm_session(), and its pickles are the same, but it takes
+ * olm_compact_session_skipped_key_size() bytes from the allocator when it
+ * first needs to keep a key for a message that hasn't arrived yet and gives
+ * them back once it has none. If the allocator has no memory then
+ * decrypting fails with ALLOCATION_FAILED, leaving the session as it was,
+ * and so does unpickling. The allocator must outlive the session and can be
+ * shared by any number of sessions. Clear the session with
+ * olm_clear_session() so that the memory for its skipped keys is given
+ * back. */
+OlmSession * olm_compact_session(
+    void * memory,
+    const OlmAllocator * allocator
+);
+
 /** Initialise a utility object using the supplied memory
  *  The supplied memory must be at least olm_utility_size() bytes */
 OlmUtility * olm_utility(
@@ -96,11 +201,100 @@ size_t olm_clear_session(
     OlmSession * session
 );
 
+/** Takes olm_session_size() bytes from the allocator and initialises a
+ * session in them. Returns NULL if the allocator has no memory. */
+OlmSession * olm_allocate_session(
+    const OlmAllocator * allocator
+);
+
+/** Clears a session from olm_allocate_session() and gives its memory back
+ * to the allocator */
+void olm_release_session(
+    const OlmAllocator * allocator,
+    OlmSession * session
+);
+
+/** The number of bytes needed for a copy of the session, which is
+ * olm_session_size() for a session from olm_session(), and otherwise the
+ * size for the limits the session was created with */
+size_t olm_session_copy_size(
+    OlmSession * session
+);
+
+/** Copies a session into the supplied memory, which must be at least
+ * olm_session_copy_size() bytes, for example to try decrypting a message
+ * without committing to the result. This is much cheaper than pickling and
+ * unpickling, and the two sessions are independent afterwards. A copy of a
+ * compact session is compact and uses the same allocator, taking memory for
+ * skipped message keys if the session has any. Returns NULL on failure. If
+ * the memory is too small then olm_session_last_error() on the session will
+ * be "OUTPUT_BUFFER_TOO_SMALL". If the allocator has no room then it will be
+ * "ALLOCATION_FAILED". */
+OlmSession * olm_session_copy(
+    void * memory, size_t memory_length,
+    OlmSession * session
+);
+
+/** Adds the memory the account is using to stats, as described in
+ * olm/memory_stats.h */
+void olm_account_memory_stats(
+    const OlmAccount * account,
+    OlmMemoryStats * stats
+);
+
+/** Adds the memory the session is using to stats, as described in
+ * olm/memory_stats.h. The skipped message keys of a session from
+ * olm_compact_session() are only reserved while it has taken memory for
+ * them from its allocator. */
+void olm_session_memory_stats(
+    const OlmSession * session,
+    OlmMemoryStats * stats
+);
+
+/**
+ * Throw away keys for skipped messages that are unlikely to arrive, rather
+ * than keeping them until they are pushed out by newer ones. Keys are kept
+ * only for the messages skipped on the newest max_age of the remote's
+ * ratchet keys, so 1 keeps those of the current one, and only the newest
+ * max_count of them. Zero leaves either unbounded, which is the default.
+ * This is done now and after each message is decrypted, and the session's
+ * pickles shrink with it. The setting isn't pickled. Always returns 0.
+ */
+size_t olm_session_set_skipped_key_eviction(
+    OlmSession * session,
+    size_t max_age, size_t max_count
+);
+
+/**
+ * Keep the messages skipped over by a gap of at least min_gap messages as a
+ * range, holding the chain key for the first of them, rather than as a key
+ * for each. A key is only derived when a message from the range arrives,
+ * by walking the chain from the start of the range, so a large gap costs
+ * nothing up front and any message up to max_message_gap behind can still
+ * be decrypted, however many keys max_skipped_message_keys allows. The four
+ * newest ranges are kept, and max_age in
+ * olm_session_set_skipped_key_eviction() applies to them too. Zero, the
+ * default, keeps a key for each skipped message. The setting isn't pickled,
+ * but the ranges are, and older versions of the library can't unpickle a
+ * session that has some. Always returns 0.
+ */
+size_t olm_session_set_skipped_key_ranges(
+    OlmSession * session,
+    size_t min_gap
+);
+
 /** Clears the memory used to back this utility */
 size_t olm_clear_utility(
     OlmUtility * utility
 );
 
+/** Wipes the verification keys the utility keeps decoded, from
+ * OLM_TRIM_MEMORY_CACHES in olm/memory_stats.h, so that the next signature
+ * checked with each decodes it again. Returns the number of bytes wiped. */
+size_t olm_utility_trim_memory(
+    OlmUtility * utility, int level
+);
+
 /** Returns the number of bytes needed to store an account */
 size_t olm_pickle_account_length(
     OlmAccount * account
@@ -134,10 +328,14 @@ size_t olm_pickle_session(
 );
 
 /** Loads an account from a pickled base64 string. Decrypts the account using
- * the supplied key. Returns olm_error() on failure. If the key doesn't
- * match the one used to encrypt the account then olm_account_last_error()
- * will be "BAD_ACCOUNT_KEY". If the base64 couldn't be decoded then
- * olm_account_last_error() will be "INVALID_BASE64". The input pickled
+ * the supplied key. Pickles written with olm_pickle_account_with_key() are
+ * loaded too, whichever cipher they use. Returns olm_error() on failure. If
+ * the key doesn't match the one used to encrypt the account then
+ * olm_account_last_error() will be "BAD_ACCOUNT_KEY". If the base64
+ * couldn't be decoded then olm_account_last_error() will be
+ * "INVALID_BASE64". If the account was
+ * created with room for fewer one time keys than the pickled account then
+ * olm_account_last_error() will be "ACCOUNT_TOO_SMALL". The input pickled
  * buffer is destroyed */
 size_t olm_unpickle_account(
     OlmAccount * account,
@@ -145,11 +343,31 @@ size_t olm_unpickle_account(
     void * pickled, size_t pickled_length
 );
 
+/** Loads only the identity keys of an account from a pickle made by
+ * olm_pickle_account(), for when all that is needed is to give them out or
+ * sign with them. The whole pickle is still authenticated, but the one time
+ * keys are neither decrypted nor loaded, so the account can be made with
+ * olm_account_with_limits(memory, 0) to keep it small. Such an account has
+ * no one time keys: trying to give them out, generate more, start an
+ * inbound session with it or pickle it again fails, and
+ * olm_account_last_error() will be "PARTIAL_ACCOUNT". Load it with
+ * olm_unpickle_account() to use those. Otherwise fails in the same ways as
+ * olm_unpickle_account(). The input pickled buffer is destroyed */
+size_t olm_unpickle_account_identity_keys(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
 /** Loads a session from a pickled base64 string. Decrypts the session using
- * the supplied key. Returns olm_error() on failure. If the key doesn't
- * match the one used to encrypt the account then olm_session_last_error()
- * will be "BAD_ACCOUNT_KEY". If the base64 couldn't be decoded then
- * olm_session_last_error() will be "INVALID_BASE64". The input pickled
+ * the supplied key. Pickles written with olm_pickle_session_with_key() are
+ * loaded too, whichever cipher they use. Returns olm_error() on failure. If
+ * the key doesn't match the one used to encrypt the account then
+ * olm_session_last_error() will be "BAD_ACCOUNT_KEY". If the base64
+ * couldn't be decoded then olm_session_last_error() will be
+ * "INVALID_BASE64". If the session was
+ * created with smaller limits than the pickled session then
+ * olm_session_last_error() will be "SESSION_TOO_SMALL". The input pickled
  * buffer is destroyed */
 size_t olm_unpickle_session(
     OlmSession * session,
@@ -157,6 +375,410 @@ size_t olm_unpickle_session(
     void * pickled, size_t pickled_length
 );
 
+/** The number of bytes needed to store an account as a binary pickle */
+size_t olm_pickle_account_binary_length(
+    OlmAccount * account
+);
+
+/** The number of bytes needed to store a session as a binary pickle */
+size_t olm_pickle_session_binary_length(
+    OlmSession * session
+);
+
+/** Stores an account as binary. Like olm_pickle_account() the account is
+ * encrypted and authenticated using the supplied key, but the result isn't
+ * base64 encoded, so it is a quarter smaller and quicker to load. Returns
+ * the length of the pickled account on success. Returns olm_error() on
+ * failure. If the pickle output buffer is smaller than
+ * olm_pickle_account_binary_length() then olm_account_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_pickle_account_binary(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Stores a session as binary, as olm_pickle_account_binary() does for an
+ * account. Returns the length of the pickled session on success. Returns
+ * olm_error() on failure. If the pickle output buffer is smaller than
+ * olm_pickle_session_binary_length() then olm_session_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_pickle_session_binary(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads an account from a binary pickle made by olm_pickle_account_binary().
+ * Fails in the same ways as olm_unpickle_account(), except that there is no
+ * base64 to decode. The input pickled buffer is destroyed */
+size_t olm_unpickle_account_binary(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads a session from a binary pickle made by olm_pickle_session_binary().
+ * Fails in the same ways as olm_unpickle_session(), except that there is no
+ * base64 to decode. The input pickled buffer is destroyed */
+size_t olm_unpickle_session_binary(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads an account from a pickle without changing it, so that it can be
+ * read straight from read-only memory such as a memory mapped file. The
+ * pickle is decoded and decrypted into the scratch memory instead, which
+ * must be at least pickled_length bytes and is wiped afterwards. Otherwise
+ * the same as olm_unpickle_account(), except that if the scratch memory is
+ * too small then olm_account_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_unpickle_account_const(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
+);
+
+/** Loads a session from a pickle without changing it, as
+ * olm_unpickle_account_const() does for an account. */
+size_t olm_unpickle_session_const(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
+);
+
+/** Loads an account from a binary pickle without changing it, decrypting it
+ * into the scratch memory, as olm_unpickle_account_const() does for a
+ * base64 one. */
+size_t olm_unpickle_account_binary_const(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
+);
+
+/** Loads a session from a binary pickle without changing it, as
+ * olm_unpickle_account_binary_const() does for an account. */
+size_t olm_unpickle_session_binary_const(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
+);
+
+/** The number of bytes of scratch memory the streamed picklers and
+ * unpicklers need for the account, which is about the size of its raw
+ * pickle and depends only on how many one time keys it has room for */
+size_t olm_pickle_account_stream_scratch_length(
+    OlmAccount * account
+);
+
+/** The number of bytes of scratch memory the streamed picklers and
+ * unpicklers need for the session, which depends only on its limits */
+size_t olm_pickle_session_stream_scratch_length(
+    OlmSession * session
+);
+
+/** Writes the same binary pickle as olm_pickle_account_binary() by passing
+ * it to the write callback a piece at a time, so that it can go straight to
+ * a file or a socket. The account is pickled into the scratch memory, which
+ * must be at least olm_pickle_account_stream_scratch_length() bytes and is
+ * wiped afterwards, and is encrypted from there a few hundred bytes at a
+ * time, so the encrypted pickle is never held in memory. Returns the length
+ * of the pickle on success. Returns olm_error() on failure. If the scratch
+ * memory is too small then olm_account_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL", and if write fails then it will be
+ * "PICKLE_STREAM_FAILED", with some of the pickle perhaps written. */
+size_t olm_pickle_account_stream(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    OlmPickleWriter write, void * write_context,
+    void * scratch, size_t scratch_length
+);
+
+/** Writes the same binary pickle as olm_pickle_session_binary() a piece at a
+ * time, as olm_pickle_account_stream() does for an account. */
+size_t olm_pickle_session_stream(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    OlmPickleWriter write, void * write_context,
+    void * scratch, size_t scratch_length
+);
+
+/** Loads an account from a binary pickle, such as one written by
+ * olm_pickle_account_stream() or olm_pickle_account_binary(), which is read
+ * from the read callback a piece at a time until it reports the end. The
+ * pickle is decrypted into the scratch memory as it is read, and its MAC
+ * checked at the end, so the encrypted pickle is never held in memory. The
+ * scratch memory must be at least olm_pickle_account_stream_scratch_length()
+ * bytes and is wiped afterwards. Returns the number of bytes read on
+ * success. Fails in the same ways as olm_unpickle_account_binary(), and if
+ * read fails then olm_account_last_error() will be "PICKLE_STREAM_FAILED".
+ */
+size_t olm_unpickle_account_stream(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    OlmPickleReader read, void * read_context,
+    void * scratch, size_t scratch_length
+);
+
+/** Loads a session from a binary pickle read a piece at a time, as
+ * olm_unpickle_account_stream() does for an account. */
+size_t olm_unpickle_session_stream(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    OlmPickleReader read, void * read_context,
+    void * scratch, size_t scratch_length
+);
+
+/** The length of a fixed-size pickle of the account, rounded up to a whole
+ * number of record_size bytes if record_size isn't 0. It depends only on how
+ * many one time keys the account has room for, so every pickle of the
+ * account can overwrite the last in place. */
+size_t olm_pickle_account_fixed_length(
+    OlmAccount * account, size_t record_size
+);
+
+/** The length of a fixed-size pickle of the session, rounded up to a whole
+ * number of record_size bytes if record_size isn't 0. It depends only on the
+ * session's limits. */
+size_t olm_pickle_session_fixed_length(
+    OlmSession * session, size_t record_size
+);
+
+/** Stores an account as a binary pickle padded to fill all pickled_length
+ * bytes. The padding is encrypted along with the account, so the pickle
+ * doesn't show how many one time keys it holds. Returns pickled_length on
+ * success. Returns olm_error() on failure. If pickled_length is less than
+ * olm_pickle_account_fixed_length(account, 0) then olm_account_last_error()
+ * will be "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_pickle_account_fixed(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Stores a session as a binary pickle padded to fill all pickled_length
+ * bytes, as olm_pickle_account_fixed() does for an account. Returns
+ * pickled_length on success. Returns olm_error() on failure. If
+ * pickled_length is less than olm_pickle_session_fixed_length(session, 0)
+ * then olm_session_last_error() will be "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_pickle_session_fixed(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads an account from a pickle made by olm_pickle_account_fixed(), which
+ * must be passed whole. Fails in the same ways as
+ * olm_unpickle_account_binary(). The input pickled buffer is destroyed */
+size_t olm_unpickle_account_fixed(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads a session from a pickle made by olm_pickle_session_fixed(), which
+ * must be passed whole. Fails in the same ways as
+ * olm_unpickle_session_binary(). The input pickled buffer is destroyed */
+size_t olm_unpickle_session_fixed(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** The number of bytes needed to store an account with
+ * olm_pickle_account_with_key() and the OLM_PICKLE_CIPHER_* given */
+size_t olm_pickle_account_with_key_length(
+    OlmAccount * account, uint32_t cipher
+);
+
+/** The number of bytes needed to store a session with
+ * olm_pickle_session_with_key() and the OLM_PICKLE_CIPHER_* given */
+size_t olm_pickle_session_with_key_length(
+    OlmSession * session, uint32_t cipher
+);
+
+/** Stores an account as a base64 string like olm_pickle_account(), but
+ * encrypted under the keys held by pickle_key with the OLM_PICKLE_CIPHER_*
+ * given, which saves deriving the keys each time. Returns the length of the
+ * pickled account on success. Returns olm_error() on failure. If the pickle
+ * output buffer is smaller than olm_pickle_account_with_key_length() then
+ * olm_account_last_error() will be "OUTPUT_BUFFER_TOO_SMALL". If the cipher
+ * isn't known then it will be "UNKNOWN_PICKLE_VERSION", and if there were no
+ * random bytes for an AES-GCM nonce then it will be "RANDOM_UNAVAILABLE" */
+size_t olm_pickle_account_with_key(
+    OlmAccount * account,
+    OlmPickleKey const * pickle_key, uint32_t cipher,
+    void * pickled, size_t pickled_length
+);
+
+/** Stores a session as a base64 string like olm_pickle_session(), but
+ * encrypted under the keys held by pickle_key with the OLM_PICKLE_CIPHER_*
+ * given. Fails in the same ways as olm_pickle_account_with_key(), with the
+ * error in olm_session_last_error() */
+size_t olm_pickle_session_with_key(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key, uint32_t cipher,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads an account from a pickle made by olm_pickle_account() or
+ * olm_pickle_account_with_key(), using the keys held by pickle_key, which
+ * must have been made from the key the pickle was written with. Fails in the
+ * same ways as olm_unpickle_account(). The input pickled buffer is
+ * destroyed */
+size_t olm_unpickle_account_with_key(
+    OlmAccount * account,
+    OlmPickleKey const * pickle_key,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads a session from a pickle made by olm_pickle_session() or
+ * olm_pickle_session_with_key(), using the keys held by pickle_key. Fails in
+ * the same ways as olm_unpickle_session(). The input pickled buffer is
+ * destroyed */
+size_t olm_unpickle_session_with_key(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key,
+    void * pickled, size_t pickled_length
+);
+
+/** The number of bytes needed to store count sessions as a batch */
+size_t olm_pickle_session_batch_length(
+    OlmSession * const * sessions, size_t count
+);
+
+/** Stores count sessions as one batch, each as a binary pickle encrypted
+ * under the keys held by pickle_key, which saves deriving the keys for
+ * every session. Returns the length of the batch on success. Returns
+ * olm_error() on failure. If the output buffer is smaller than
+ * olm_pickle_session_batch_length() then olm_session_last_error() for the
+ * first session will be "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_pickle_session_batch(
+    OlmPickleKey const * pickle_key,
+    OlmSession * const * sessions, size_t count,
+    void * pickled, size_t pickled_length
+);
+
+/** Loads count sessions, starting from the first'th one, from a batch made
+ * by olm_pickle_session_batch(). Returns count on success. Only the entries
+ * for the sessions being loaded are decrypted in place, so separate threads
+ * can load separate ranges of the same batch at once. Fails in the same ways
+ * as olm_unpickle_inbound_group_session_batch() */
+size_t olm_unpickle_session_batch(
+    OlmPickleKey const * pickle_key,
+    void * pickled, size_t pickled_length,
+    size_t first,
+    OlmSession * const * sessions, size_t count
+);
+
+/** Writes the same batch as olm_pickle_session_batch() by passing it to the
+ * write callback a piece at a time. The sessions are pickled one at a time
+ * into the scratch memory, which only has to be big enough for the largest
+ * of them, as given by olm_pickle_session_stream_scratch_length(), so a
+ * store of any number of sessions can be written out in bounded memory.
+ * Returns the length of the batch on success. Returns olm_error() on
+ * failure, when olm_session_last_error() for the session being written, or
+ * for the first session if it was the batch header, will be
+ * "OUTPUT_BUFFER_TOO_SMALL" or "PICKLE_STREAM_FAILED". */
+size_t olm_pickle_session_batch_stream(
+    OlmPickleKey const * pickle_key,
+    OlmSession * const * sessions, size_t count,
+    OlmPickleWriter write, void * write_context,
+    void * scratch, size_t scratch_length
+);
+
+/** Loads the first count sessions of a batch, such as one written by
+ * olm_pickle_session_batch_stream() or olm_pickle_session_batch(), which is
+ * read from the read callback a piece at a time. Nothing is read after the
+ * count'th session. Each session is decrypted into the scratch memory, which
+ * must be big enough for any of them, as for
+ * olm_pickle_session_batch_stream(). Returns count on success. Returns
+ * olm_error() on failure, when olm_session_last_error() for the session
+ * being loaded, or for the first session if it was the batch header, says
+ * why; "CORRUPTED_PICKLE" if the batch has fewer than count sessions, and
+ * "PICKLE_STREAM_FAILED" if read fails. */
+size_t olm_unpickle_session_batch_stream(
+    OlmPickleKey const * pickle_key,
+    OlmPickleReader read, void * read_context,
+    void * scratch, size_t scratch_length,
+    OlmSession * const * sessions, size_t count
+);
+
+/** The number of bytes needed to hibernate a session */
+size_t olm_session_hibernate_length(
+    OlmSession * session
+);
+
+/** Seals a session into a binary blob encrypted under the keys held by
+ * pickle_key, and clears the session so that its memory can be used for
+ * another. Reviving a hibernated session costs no base64 decoding and no
+ * key derivation, so a cache can hibernate idle sessions instead of keeping
+ * them resident. Returns the length of the sealed session on success.
+ * Returns olm_error() on failure, leaving the session as it was. If the
+ * output buffer is smaller than olm_session_hibernate_length() then
+ * olm_session_last_error() will be "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_session_hibernate(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key,
+    void * sealed, size_t sealed_length
+);
+
+/** Restores a session sealed by olm_session_hibernate() into an initialised
+ * session object. The sealed buffer is decrypted in place, so it is
+ * destroyed. Returns sealed_length on success. Returns olm_error() on
+ * failure. If the key doesn't match the one the session was sealed with
+ * then olm_session_last_error() will be "BAD_ACCOUNT_KEY". If the sealed
+ * session couldn't be decoded then olm_session_last_error() will be
+ * "CORRUPTED_PICKLE" */
+size_t olm_session_wake(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key,
+    void * sealed, size_t sealed_length
+);
+
+/** The number of bytes needed to store the changes to a session since it was
+ * last pickled, unpickled or had a delta applied, as a delta pickle */
+size_t olm_pickle_session_delta_length(
+    OlmSession * session
+);
+
+/** Stores the changes to a session since it was last pickled, unpickled or
+ * had a delta applied as a base64 string, encrypted with the supplied key
+ * like olm_pickle_session(). This is usually much shorter than a full pickle
+ * since it holds only the chain keys that changed and the skipped message
+ * keys that were added or removed. Loading the last full pickle and then
+ * applying each delta taken since, in order, with
+ * olm_unpickle_session_delta() gives the session as it is now. To compact
+ * the chain, store a full pickle with olm_pickle_session() and drop the
+ * deltas before it; like the delta functions, that starts tracking changes
+ * afresh. Returns the length of the delta on success. Returns olm_error()
+ * on failure. If the pickle output buffer is smaller than
+ * olm_pickle_session_delta_length() then olm_session_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL" */
+size_t olm_pickle_session_delta(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/** Applies a delta pickle made by olm_pickle_session_delta() to a session.
+ * Returns olm_error() on failure. If the session isn't in the state the
+ * delta was taken from, for instance because an earlier delta was missed,
+ * then olm_session_last_error() will be "SESSION_DELTA_MISMATCH" and the
+ * session is unchanged. Otherwise it fails in the same ways as
+ * olm_unpickle_session(), after which the session should be discarded. The
+ * input pickled buffer is destroyed */
+size_t olm_unpickle_session_delta(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
 /** The number of random bytes needed to create an account.*/
 size_t olm_create_account_random_length(
     OlmAccount * account
@@ -170,6 +792,13 @@ size_t olm_create_account(
     void * random, size_t random_length
 );
 
+/** Like olm_create_account(), but taking the random bytes from the
+ * library's generator (see olm/random.h). If it has none then
+ * olm_account_last_error() will be "RANDOM_UNAVAILABLE" */
+size_t olm_create_account_auto_random(
+    OlmAccount * account
+);
+
 /** The size of the output buffer needed to hold the identity keys */
 size_t olm_account_identity_keys_length(
     OlmAccount * account
@@ -199,6 +828,26 @@ size_t olm_account_sign(
     void * signature, size_t signature_length
 );
 
+/** Signs count messages with the ed25519 key for this account, giving the
+ * same signatures as calling olm_account_sign() for each but sharing some of
+ * the work between them. The signature for message i is written at
+ * i * olm_account_signature_length() into the signatures buffer, which must
+ * be count times that long; the signatures aren't nul terminated.
+ *
+ * The signing is split into jobs of a few messages each, which the executor
+ * may run on other threads; if it is NULL they are run one after another on
+ * the calling thread.
+ *
+ * Returns count. Returns olm_error() without signing anything if the
+ * signatures buffer was too small, in which case olm_account_last_error()
+ * will be "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_account_sign_batch(
+    OlmAccount * account, size_t count,
+    void const * const * messages, size_t const * message_lengths,
+    void * signatures, size_t signatures_length,
+    OlmBatchExecutor executor, void * executor_context
+);
+
 /** The size of the output buffer needed to hold the one time keys */
 size_t olm_account_one_time_keys_length(
     OlmAccount * account
@@ -227,6 +876,34 @@ size_t olm_account_one_time_keys(
     void * one_time_keys, size_t one_time_keys_length
 );
 
+/** Writes the same JSON as olm_account_one_time_keys() by passing it to the
+ * write callback a piece at a time, so that it can be appended straight to
+ * the caller's own string or stream without working out its length first.
+ * Returns the total length of the JSON. */
+size_t olm_account_write_one_time_keys(
+    OlmAccount * account,
+    OlmOutputCallback write, void * context
+);
+
+/** The size of the output buffer needed by olm_account_one_time_keys_binary:
+ * 36 bytes for each unpublished one time key. */
+size_t olm_account_one_time_keys_binary_length(
+    OlmAccount * account
+);
+
+/** Writes the unpublished one time keys for the account into the output
+ * buffer as raw binary, for callers that do their own serialisation. Each
+ * key is 36 bytes: the key id as 4 big-endian bytes, then the 32 byte
+ * Curve25519 public key. The base64 encoding of the 4 id bytes is the key id
+ * in the JSON. Returns the number of bytes written or olm_error() on failure.
+ * <p>
+ * If the output buffer was too small then olm_account_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_account_one_time_keys_binary(
+    OlmAccount * account,
+    void * output, size_t output_length
+);
+
 /** Marks the current set of one time keys as being published. */
 size_t olm_account_mark_keys_as_published(
     OlmAccount * account
@@ -237,6 +914,20 @@ size_t olm_account_max_number_of_one_time_keys(
     OlmAccount * account
 );
 
+/** Whether anything the account pickles has changed since it was unpickled
+ * or since olm_account_clear_dirty(): creating it, making or publishing one
+ * time keys, or using one up for a new session. A caller that saves the
+ * account only when this returns 1 doesn't have to pickle it after every
+ * call. Pickling doesn't clear it. */
+int olm_account_is_dirty(
+    OlmAccount const * account
+);
+
+/** Note that the account has been saved, for olm_account_is_dirty() */
+void olm_account_clear_dirty(
+    OlmAccount * account
+);
+
 /** The number of random bytes needed to generate a given number of new one
  * time keys. */
 size_t olm_account_generate_one_time_keys_random_length(
@@ -254,6 +945,14 @@ size_t olm_account_generate_one_time_keys(
     void * random, size_t random_length
 );
 
+/** Like olm_account_generate_one_time_keys(), but taking the random bytes
+ * from the library's generator. If it has none then
+ * olm_account_last_error() will be "RANDOM_UNAVAILABLE" */
+size_t olm_account_generate_one_time_keys_auto_random(
+    OlmAccount * account,
+    size_t number_of_keys
+);
+
 /** The number of random bytes needed to create an outbound session */
 size_t olm_create_outbound_session_random_length(
     OlmSession * session
@@ -272,6 +971,92 @@ size_t olm_create_outbound_session(
     void * random, size_t random_length
 );
 
+/** Like olm_create_outbound_session(), but taking the random bytes from the
+ * library's generator. If it has none then olm_session_last_error() will be
+ * "RANDOM_UNAVAILABLE" */
+size_t olm_create_outbound_session_auto_random(
+    OlmSession * session,
+    OlmAccount * account,
+    void const * their_identity_key, size_t their_identity_key_length,
+    void const * their_one_time_key, size_t their_one_time_key_length
+);
+
+/** Creates count out-bound sessions from the same account, as if by calling
+ * olm_create_outbound_session() for each in turn, for example to open a
+ * session with each of the devices of a user who has just logged in.
+ * Session i is for their_identity_keys[i] and their_one_time_keys[i], whose
+ * lengths are their_identity_key_lengths[i] and
+ * their_one_time_key_lengths[i]. The random buffer supplies each session's
+ * olm_create_outbound_session_random_length() bytes in turn, and is wiped.
+ *
+ * The triple Diffie-Hellmans of several sessions are run side by side where
+ * the CPU can, so this is faster than creating the sessions one at a time.
+ * A session which can't be created is left as it was, with
+ * olm_session_last_error() set as by olm_create_outbound_session(). Returns
+ * the number of sessions which failed. */
+size_t olm_create_outbound_sessions(
+    OlmSession * const * sessions, size_t count,
+    OlmAccount * account,
+    void const * const * their_identity_keys,
+    size_t const * their_identity_key_lengths,
+    void const * const * their_one_time_keys,
+    size_t const * their_one_time_key_lengths,
+    void * random, size_t random_length
+);
+
+/** The number of random bytes olm_create_outbound_sessions_and_encrypt()
+ * needs for count sessions */
+size_t olm_create_outbound_sessions_and_encrypt_random_length(
+    size_t count
+);
+
+/** The length of each of the base64 pre-key messages
+ * olm_create_outbound_sessions_and_encrypt() writes for the given number of
+ * plain-text bytes. Every new session's first message is the same length. */
+size_t olm_create_outbound_sessions_and_encrypt_message_length(
+    size_t plaintext_length
+);
+
+/** Creates count out-bound sessions in memory from the allocator and
+ * encrypts the same plain-text with each, as if by calling
+ * olm_allocate_session(), olm_create_outbound_session() and olm_encrypt()
+ * for each in turn, for example to send a room key to every device whose
+ * one-time key has just been claimed. The keys are given as for
+ * olm_create_outbound_sessions(), and the random buffer supplies each
+ * session's olm_create_outbound_session_random_length() bytes in turn. It is
+ * wiped.
+ *
+ * Message i is written at i * the message length into the messages buffer,
+ * which must be count times
+ * olm_create_outbound_sessions_and_encrypt_message_length() long. On
+ * success sessions[i] is set to the new session and message_lengths[i] to
+ * the length of its message. Otherwise sessions[i] is set to NULL,
+ * message_lengths[i] to olm_error(), and errors[i] (when errors isn't NULL)
+ * to "INVALID_BASE64" or "ALLOCATION_FAILED"; it is "SUCCESS" for the
+ * others.
+ *
+ * The sessions are allocated on the calling thread, so the allocator needn't
+ * be thread safe. The key exchanges and encryption are split into jobs of a
+ * few sessions each, which the executor may run on other threads; if it is
+ * NULL they are run one after another on the calling thread.
+ *
+ * Returns the number of sessions which failed. Returns olm_error() without
+ * doing anything if the random or messages buffers are too small. */
+size_t olm_create_outbound_sessions_and_encrypt(
+    OlmAccount * account, size_t count,
+    void const * const * their_identity_keys,
+    size_t const * their_identity_key_lengths,
+    void const * const * their_one_time_keys,
+    size_t const * their_one_time_key_lengths,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    const OlmAllocator * allocator,
+    OlmSession ** sessions,
+    void * messages, size_t messages_length,
+    size_t * message_lengths, const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+);
+
 /** Create a new in-bound session for sending/receiving messages from an
  * incoming PRE_KEY message. Returns olm_error() on failure. If the base64
  * couldn't be decoded then olm_session_last_error will be "INVALID_BASE64".
@@ -301,6 +1086,28 @@ size_t olm_create_inbound_session_from(
     void * one_time_key_message, size_t message_length
 );
 
+/**
+ * Create a new in-bound session from an incoming PRE_KEY message and decrypt
+ * the message with it, as olm_create_inbound_session_from(), olm_decrypt()
+ * and olm_remove_one_time_keys() would, but decoding the message only once.
+ * their_identity_key may be NULL, as for olm_create_inbound_session(). The
+ * message buffer is destroyed. A max_plaintext_length of message_length is
+ * always enough.
+ *
+ * Returns the length of the plain-text on success, or olm_error() on
+ * failure, with olm_session_last_error() as for those functions. The one
+ * time key is only removed from the account once the message has decrypted,
+ * so a forged message can't use it up; if it fails the session should be
+ * thrown away.
+ */
+size_t olm_create_inbound_session_and_decrypt(
+    OlmSession * session,
+    OlmAccount * account,
+    void const * their_identity_key, size_t their_identity_key_length,
+    void * one_time_key_message, size_t message_length,
+    void * plaintext, size_t max_plaintext_length
+);
+
 /** The length of the buffer needed to return the id for this session. */
 size_t olm_session_id_length(
     OlmSession * session
@@ -314,10 +1121,34 @@ size_t olm_session_id(
     void * id, size_t id_length
 );
 
+/** The identifier for this session as 32 bytes, without base64 encoding it,
+ * for keying maps of sessions. This is the base64-decoded session ID. It is
+ * worked out once and remembered until the session is created or unpickled
+ * again, so this, like olm_session_id(), is cheap to call for every message.
+ * Returns the length of the id. If the id buffer is too small then
+ * olm_session_last_error() will be "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_session_id_binary(
+    OlmSession * session,
+    void * id, size_t id_length
+);
+
 int olm_session_has_received_message(
     OlmSession *session
 );
 
+/** Whether anything the session pickles has changed since it was unpickled,
+ * from a whole pickle or a delta, or since olm_session_clear_dirty(). A new
+ * session is dirty, as is one that has encrypted or decrypted a message.
+ * Pickling doesn't clear it. */
+int olm_session_is_dirty(
+    OlmSession const * session
+);
+
+/** Note that the session has been saved, for olm_session_is_dirty() */
+void olm_session_clear_dirty(
+    OlmSession * session
+);
+
 /** Checks if the PRE_KEY message is for this in-bound session. This can happen
  * if multiple messages are sent to this account before this account sends a
  * message in reply. Returns 1 if the session matches. Returns 0 if the session
@@ -388,6 +1219,120 @@ size_t olm_encrypt(
     void * message, size_t message_length
 );
 
+/** Does the work of the ratchet turn which the next olm_encrypt() would
+ * otherwise do, generating a new ratchet key from the random bytes and
+ * deriving the new sending chain, so that the next message only needs a
+ * message key. This can be called from an idle or background context after
+ * decrypting a message with a new ratchet key, and does nothing if
+ * olm_encrypt_random_length() is already 0. The random buffer must be at
+ * least olm_encrypt_random_length() bytes, and is wiped. Returns 0, or
+ * olm_error() on failure, when olm_session_last_error() will be
+ * "NOT_ENOUGH_RANDOM". */
+size_t olm_session_prepare_send(
+    OlmSession * session,
+    void * random, size_t random_length
+);
+
+/** Like olm_encrypt(), but taking any random bytes it needs from the
+ * library's generator. If it has none then olm_session_last_error() will be
+ * "RANDOM_UNAVAILABLE" */
+size_t olm_encrypt_auto_random(
+    OlmSession * session,
+    void const * plaintext, size_t plaintext_length,
+    void * message, size_t message_length
+);
+
+/** Like olm_encrypt(), but with the plain-text and the message in the same
+ * buffer: the first plaintext_length bytes of the buffer are encrypted, and
+ * the message written over them. The buffer must be at least
+ * olm_encrypt_message_length() bytes. On failure the buffer is wiped. */
+size_t olm_encrypt_inplace(
+    OlmSession * session,
+    size_t plaintext_length,
+    void * random, size_t random_length,
+    void * buffer, size_t buffer_length
+);
+
+/** Like olm_encrypt(), but writing the message into a buffer which takes
+ * memory from the allocator when it hasn't room, so there is no need to ask
+ * olm_encrypt_message_length() first. Returns the length of the message,
+ * which is also left in message->length, or olm_error() on failure, with the
+ * same errors as olm_encrypt(), or "ALLOCATION_FAILED" if the allocator has
+ * no memory. */
+size_t olm_encrypt_to_buffer(
+    OlmSession * session,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    const OlmAllocator * allocator, OlmBuffer * message
+);
+
+/** The total number of random bytes olm_encrypt_many() needs to encrypt a
+ * message with each of the sessions. */
+size_t olm_encrypt_many_random_length(
+    OlmSession * const * sessions, size_t count
+);
+
+/** The total size of the messages olm_encrypt_many() will write for the
+ * given number of plain-text bytes. */
+size_t olm_encrypt_many_message_length(
+    OlmSession * const * sessions, size_t count,
+    size_t plaintext_length
+);
+
+/** Encrypts the same plain-text with each of count sessions, as if by calling
+ * olm_encrypt() on each in turn, for example to share a group session key
+ * with every device in a room. The random buffer supplies each session's
+ * olm_encrypt_random_length() bytes in turn, and the base64 messages are
+ * written one after another into the messages buffer, so that message i
+ * starts at the sum of the earlier message_lengths.
+ *
+ * message_types[i] is set to the message type, and message_lengths[i] to the
+ * length of the message, or olm_error() if it couldn't be encrypted, in which
+ * case olm_session_last_error() for that session will be "NOT_ENOUGH_RANDOM"
+ * or "OUTPUT_BUFFER_TOO_SMALL" and nothing is written for it. Returns the
+ * number of sessions which failed.
+ *
+ * The sessions are independent, so to spread the work over several threads
+ * split the arrays into ranges and call this for each range. */
+size_t olm_encrypt_many(
+    OlmSession * const * sessions, size_t count,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    void * messages, size_t messages_length,
+    size_t * message_types, size_t * message_lengths
+);
+
+/** The total size of the messages olm_encrypt_batch() will write for count
+ * plain-texts of the given lengths, which is more than count times
+ * olm_encrypt_message_length() if the message counter grows a byte on the
+ * way. */
+size_t olm_encrypt_batch_message_length(
+    OlmSession * session, size_t count,
+    size_t const * plaintext_lengths
+);
+
+/** Encrypts count plain-texts with the session, one after another, as if by
+ * calling olm_encrypt() on each in turn, for example to send a device
+ * several queued messages at once. If the session needs a new ratchet key,
+ * the random buffer supplies olm_encrypt_random_length() bytes for it once,
+ * for all of the messages; it is wiped. The base64 messages are written one
+ * after another into the messages buffer, so that message i starts at the
+ * sum of the earlier message_lengths. Every message is of the type
+ * olm_encrypt_message_type() gave before the call.
+ *
+ * Returns count on success. Returns olm_error() on failure, having encrypted
+ * nothing, if there weren't enough random bytes, when
+ * olm_session_last_error() will be "NOT_ENOUGH_RANDOM", or if the messages
+ * buffer is smaller than olm_encrypt_batch_message_length(), when it will
+ * be "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_encrypt_batch(
+    OlmSession * session, size_t count,
+    void const * const * plaintexts, size_t const * plaintext_lengths,
+    void * random, size_t random_length,
+    void * messages, size_t messages_length,
+    size_t * message_lengths
+);
+
 /** The maximum number of bytes of plain-text a given message could decode to.
  * The actual size could be different due to padding. The input message buffer
  * is destroyed. Returns olm_error() on failure. If the message base64
@@ -402,6 +1347,20 @@ size_t olm_decrypt_max_plaintext_length(
     void * message, size_t message_length
 );
 
+/** The same as olm_decrypt_max_plaintext_length(), but found by decoding
+ * only the message headers, so the input message buffer isn't changed and
+ * can be passed straight to olm_decrypt() afterwards. Returns olm_error() on
+ * failure. If the message length isn't valid for base64 then
+ * olm_session_last_error() will be "INVALID_BASE64". If the message is for
+ * an unsupported version of the protocol then olm_session_last_error() will
+ * be "BAD_MESSAGE_VERSION". If the message couldn't be decoded then
+ * olm_session_last_error() will be "BAD_MESSAGE_FORMAT". */
+size_t olm_peek_max_plaintext_length(
+    OlmSession * session,
+    size_t message_type,
+    void const * message, size_t message_length
+);
+
 /** Decrypts a message using the session. The input message buffer is destroyed.
  * Returns the length of the plain-text on success. Returns olm_error() on
  * failure. If the plain-text buffer is smaller than
@@ -420,6 +1379,399 @@ size_t olm_decrypt(
     void * plaintext, size_t max_plaintext_length
 );
 
+/** Like olm_decrypt(), but writing the plain-text over the message, from
+ * the start of the buffer, so no second buffer is needed. Returns the length
+ * of the plain-text on success, or olm_error() on failure, with the same
+ * errors as olm_decrypt(). The message is destroyed either way. */
+size_t olm_decrypt_inplace(
+    OlmSession * session,
+    size_t message_type,
+    void * buffer, size_t message_length
+);
+
+/** Like olm_decrypt(), but writing the plain-text into a buffer which takes
+ * memory from the allocator when it hasn't room. The message is only decoded
+ * once, rather than once for olm_decrypt_max_plaintext_length() and again
+ * from a copy to decrypt it, and a buffer kept across calls only grows for
+ * the longest plain-text. Returns the length of the plain-text, which is also
+ * left in plaintext->length, or olm_error() with the same errors as
+ * olm_decrypt(), or "ALLOCATION_FAILED" if the allocator has no memory. The
+ * message is destroyed either way. */
+size_t olm_decrypt_to_buffer(
+    OlmSession * session,
+    size_t message_type,
+    void * message, size_t message_length,
+    const OlmAllocator * allocator, OlmBuffer * plaintext
+);
+
+/** The number of size_t entries of scratch space olm_decrypt_batch() needs
+ * for count messages */
+size_t olm_decrypt_batch_scratch_length(
+    size_t count
+);
+
+/** Decrypts count messages, as if by calling olm_decrypt() on each message
+ * with its session, for example to catch up on the to-device messages sent
+ * while a client was offline. A session may appear any number of times; its
+ * messages are decrypted in the order they are given.
+ *
+ * The messages are grouped by session, and each session's messages are one
+ * job for the executor, so that different sessions can be decrypted on
+ * different threads. If executor is NULL the jobs are run one after another
+ * on the calling thread. The library never starts any threads itself.
+ *
+ * The input message buffers are destroyed. For each message,
+ * plaintext_lengths[i] is set to the length of the plain-text, or
+ * olm_error() if it couldn't be decrypted, in which case errors[i] is set to
+ * one of the strings olm_decrypt() would have left in
+ * olm_session_last_error() ("SUCCESS" for the others). errors may be NULL.
+ *
+ * Returns the number of messages which couldn't be decrypted. Returns
+ * olm_error() without doing anything if scratch_length is less than
+ * olm_decrypt_batch_scratch_length(count). */
+size_t olm_decrypt_batch(
+    OlmSession * const * sessions, size_t count,
+    const size_t * message_types,
+    void * const * messages, const size_t * message_lengths,
+    void * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, const char ** errors,
+    size_t * scratch, size_t scratch_length,
+    OlmBatchExecutor executor, void * executor_context
+);
+
+/** The size of the next message in bytes for the given number of plain-text
+ * bytes, as written by olm_encrypt_raw(). */
+size_t olm_encrypt_raw_message_length(
+    OlmSession * session,
+    size_t plaintext_length
+);
+
+/** Encrypts a message using the session, like olm_encrypt(), but writes the
+ * message in binary rather than base64. Returns the length of the message in
+ * bytes on success. Returns olm_error() on failure, with the same errors as
+ * olm_encrypt(). */
+size_t olm_encrypt_raw(
+    OlmSession * session,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    void * message, size_t message_length
+);
+
+/** The maximum number of bytes of plain-text a given binary message could
+ * decode to, like olm_decrypt_max_plaintext_length(). The message isn't
+ * changed. */
+size_t olm_decrypt_raw_max_plaintext_length(
+    OlmSession * session,
+    size_t message_type,
+    void const * message, size_t message_length
+);
+
+/** Decrypts a binary message, such as one written by olm_encrypt_raw(),
+ * using the session. The message isn't changed. Returns the length of the
+ * plain-text on success. Returns olm_error() on failure, with the same errors
+ * as olm_decrypt() apart from "INVALID_BASE64". */
+size_t olm_decrypt_raw(
+    OlmSession * session,
+    size_t message_type,
+    void const * message, size_t message_length,
+    void * plaintext, size_t max_plaintext_length
+);
+
+/** The size of a message view object in bytes */
+size_t olm_message_view_size(void);
+
+/** Initialise a message view object using the supplied memory, which must be
+ * at least olm_message_view_size() bytes. A message view holds a message
+ * with its headers decoded so that it can be passed to
+ * olm_matches_inbound_session_with_view(), olm_create_inbound_session_with_view(),
+ * olm_decrypt_max_plaintext_length_with_view() and olm_decrypt_with_view()
+ * in turn without each of them decoding it again. */
+OlmMessageView * olm_message_view(
+    void * memory
+);
+
+/** A null terminated string describing the most recent error to happen to a
+ * message view */
+const char * olm_message_view_last_error(
+    OlmMessageView * view
+);
+
+/** Decodes a base64 message of the given type into the view. The message
+ * buffer is decoded in place, and the view points into it, so the buffer
+ * must not be changed or freed while the view is in use. Returns olm_error()
+ * on failure. If the base64 couldn't be decoded then
+ * olm_message_view_last_error() will be "INVALID_BASE64". Problems with the
+ * message headers are reported by the functions the view is passed to, as
+ * they would be for the message itself. */
+size_t olm_message_view_decode(
+    OlmMessageView * view,
+    size_t message_type,
+    void * message, size_t message_length
+);
+
+/** As olm_message_view_decode() for a binary message, such as one written by
+ * olm_encrypt_raw(). The message isn't changed, and must outlive the view.
+ * Always returns 0. */
+size_t olm_message_view_decode_raw(
+    OlmMessageView * view,
+    size_t message_type,
+    void const * message, size_t message_length
+);
+
+/** As olm_create_inbound_session() for a PRE_KEY message decoded into a
+ * message view. */
+size_t olm_create_inbound_session_with_view(
+    OlmSession * session,
+    OlmAccount * account,
+    OlmMessageView const * view
+);
+
+/** As olm_matches_inbound_session() for a message decoded into a message
+ * view. Returns 0 if it isn't a PRE_KEY message. */
+size_t olm_matches_inbound_session_with_view(
+    OlmSession * session,
+    OlmMessageView const * view
+);
+
+/** As olm_decrypt_max_plaintext_length() for a message decoded into a
+ * message view. */
+size_t olm_decrypt_max_plaintext_length_with_view(
+    OlmSession * session,
+    OlmMessageView const * view
+);
+
+/** As olm_decrypt() for a message decoded into a message view. The message
+ * isn't changed, so the view can be passed to another session if this one
+ * can't decrypt it. */
+size_t olm_decrypt_with_view(
+    OlmSession * session,
+    OlmMessageView const * view,
+    void * plaintext, size_t max_plaintext_length
+);
+
+/** The size of a decrypt trial object in bytes */
+size_t olm_decrypt_trial_size(void);
+
+/** Initialise a decrypt trial object using the supplied memory, which must
+ * be at least olm_decrypt_trial_size() bytes. A decrypt trial holds what
+ * decrypting a message with olm_decrypt_peek() would change in a session,
+ * until olm_decrypt_commit() makes the change. */
+OlmDecryptTrial * olm_decrypt_trial(
+    void * memory
+);
+
+/** A null terminated string describing the most recent error from
+ * olm_decrypt_peek() using this trial */
+const char * olm_decrypt_trial_last_error(
+    OlmDecryptTrial const * trial
+);
+
+/** Clears the memory used to back this decrypt trial, which holds keys for
+ * the message it was last used for */
+size_t olm_clear_decrypt_trial(
+    OlmDecryptTrial * trial
+);
+
+/** As olm_decrypt_with_view(), but without changing the session, so that a
+ * message that could belong to any of several sessions can be tried against
+ * each in turn. Returns the length of the plain-text if the session can
+ * decrypt the message, or olm_error() with the errors olm_decrypt() would
+ * give available from olm_decrypt_trial_last_error(). On success the trial
+ * holds what the message would change in the session, so that
+ * olm_decrypt_commit() can make the change without doing the work again. */
+size_t olm_decrypt_peek(
+    OlmSession const * session,
+    OlmMessageView const * view,
+    OlmDecryptTrial * trial,
+    void * plaintext, size_t max_plaintext_length
+);
+
+/** Makes the change that olm_decrypt_peek() found decrypting a message
+ * would make to the session, as olm_decrypt() would have done, and wipes
+ * the trial. Returns 0 on success, or olm_error() on failure, leaving the
+ * session as it was. If the trial wasn't from a successful peek with this
+ * session, or the session has since changed in a way the trial no longer
+ * fits, such as by decrypting the same message, then
+ * olm_session_last_error() will be "SESSION_CHANGED". If a compact
+ * session's allocator has no room for the keys of skipped messages then it
+ * will be "ALLOCATION_FAILED", and the commit can be tried again. */
+size_t olm_decrypt_commit(
+    OlmSession * session,
+    OlmDecryptTrial * trial
+);
+
+/** The length of a session route in bytes. A route is the sender's identity
+ * key, their base key and our one-time key, which together pick out the
+ * inbound session a pre-key message belongs to. */
+size_t olm_session_route_length(void);
+
+/** Writes the route of a PRE_KEY message decoded into a message view.
+ * Returns the length of the route on success, or olm_error() on failure. If
+ * the route buffer is too small then olm_message_view_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL". If it isn't a PRE_KEY message, or its headers
+ * or the sender's identity key are missing, then it will be
+ * "BAD_MESSAGE_FORMAT". */
+size_t olm_message_view_route(
+    OlmMessageView * view,
+    void * route, size_t route_length
+);
+
+/** Writes the route of a session. An inbound session has the same route as
+ * the PRE_KEY messages olm_matches_inbound_session() would accept for it.
+ * Returns the length of the route on success, or olm_error() on failure. If
+ * the route buffer is too small then olm_session_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_session_route(
+    OlmSession * session,
+    void * route, size_t route_length
+);
+
+/**
+ * An index of inbound sessions by route, in memory supplied by the caller,
+ * so that the session for a PRE_KEY message is found with one lookup rather
+ * than by trying the message against each session from its sender. The
+ * index only holds pointers: the sessions stay where the caller keeps them,
+ * and must be removed from the index before they are freed or moved.
+ */
+
+/** The number of bytes needed for an index with room for capacity sessions.
+ * The capacity must be at most 32767. */
+size_t olm_session_index_size(
+    size_t capacity
+);
+
+/** Initialise a session index in the supplied memory, which must be at least
+ * olm_session_index_size(capacity) bytes */
+OlmSessionIndex * olm_session_index(
+    void * memory, size_t capacity
+);
+
+/** A null terminated string describing the most recent error to happen to a
+ * session index */
+const char * olm_session_index_last_error(
+    const OlmSessionIndex * index
+);
+
+/** Clears the memory used to back the index. The sessions aren't changed. */
+size_t olm_clear_session_index(
+    OlmSessionIndex * index
+);
+
+/** The number of sessions in the index */
+size_t olm_session_index_count(
+    const OlmSessionIndex * index
+);
+
+/** Adds a session to the index under its route, replacing any session
+ * already there with the same route. Returns olm_error() on failure, in which
+ * case olm_session_index_last_error() will be "STORE_FULL" if the index
+ * has no room left. */
+size_t olm_session_index_add(
+    OlmSessionIndex * index,
+    OlmSession * session
+);
+
+/** Removes a session from the index. Returns olm_error() on failure, in which
+ * case olm_session_index_last_error() will be "UNKNOWN_SESSION_ID" if the
+ * session isn't in the index. */
+size_t olm_session_index_remove(
+    OlmSessionIndex * index,
+    OlmSession * session
+);
+
+/** Finds the session with the given route. Returns NULL if there isn't one,
+ * in which case olm_session_index_last_error() will be "UNKNOWN_SESSION_ID"
+ * and a new inbound session should be created for the message. */
+OlmSession * olm_session_index_find(
+    OlmSessionIndex * index,
+    void const * route, size_t route_length
+);
+
+/**
+ * A pool of Curve25519 key pairs generated ahead of time, in memory supplied
+ * by the caller, for the ratchet keys sessions need when they reply to a
+ * message. Generating a ratchet key is half of the work of the first
+ * message after a reply, so filling the pool when idle, or on another
+ * thread, takes that off the send path. One pool can serve any number of
+ * sessions. One thread may fill the pool while another takes keys from it;
+ * more than one of either must be serialised by the caller.
+ */
+
+/** The number of bytes needed for a pool with room for capacity keys */
+size_t olm_ratchet_key_pool_size(
+    size_t capacity
+);
+
+/** Initialise an empty key pool in the supplied memory, which must be at
+ * least olm_ratchet_key_pool_size(capacity) bytes */
+OlmRatchetKeyPool * olm_ratchet_key_pool(
+    void * memory, size_t capacity
+);
+
+/** A null terminated string describing the most recent error to happen to a
+ * key pool */
+const char * olm_ratchet_key_pool_last_error(
+    const OlmRatchetKeyPool * pool
+);
+
+/** Clears the memory used to back the pool, wiping any keys left in it */
+size_t olm_clear_ratchet_key_pool(
+    OlmRatchetKeyPool * pool
+);
+
+/** The number of keys in the pool */
+size_t olm_ratchet_key_pool_count(
+    const OlmRatchetKeyPool * pool
+);
+
+/** Takes every key out of the pool and wipes it, from
+ * OLM_TRIM_MEMORY_PRECOMPUTED in olm/memory_stats.h, so that they are
+ * generated again when the pool is next filled. This takes keys like a
+ * session does, so must be serialised with them. Returns the number of
+ * bytes wiped. */
+size_t olm_ratchet_key_pool_trim_memory(
+    OlmRatchetKeyPool * pool, int level
+);
+
+/** The number of random bytes needed to fill the pool */
+size_t olm_ratchet_key_pool_fill_random_length(
+    const OlmRatchetKeyPool * pool
+);
+
+/** Adds a key to the pool for each CURVE25519_RANDOM_LENGTH (32) bytes of
+ * random, as many as there is room for. Returns the number of keys added. */
+size_t olm_ratchet_key_pool_fill(
+    OlmRatchetKeyPool * pool,
+    void * random, size_t random_length
+);
+
+/** Fills the pool with random bytes from the library's generator (see
+ * olm/random.h). Returns the number of keys added, or olm_error() if the
+ * generator has none, when olm_ratchet_key_pool_last_error() will be
+ * "RANDOM_UNAVAILABLE". */
+size_t olm_ratchet_key_pool_fill_auto_random(
+    OlmRatchetKeyPool * pool
+);
+
+/** Like olm_encrypt(), but if the session needs a new ratchet key it is
+ * taken from the pool rather than generated. The session's last error will
+ * be "NOT_ENOUGH_RANDOM" if it needs a key and the pool is empty, in which
+ * case olm_encrypt() can be used instead. */
+size_t olm_encrypt_with_key_pool(
+    OlmSession * session,
+    OlmRatchetKeyPool * pool,
+    void const * plaintext, size_t plaintext_length,
+    void * message, size_t message_length
+);
+
+/** Like olm_session_prepare_send(), but with the new ratchet key taken from
+ * the pool rather than generated. The session's last error will be
+ * "NOT_ENOUGH_RANDOM" if it needs a key and the pool is empty. */
+size_t olm_session_prepare_send_with_key_pool(
+    OlmSession * session,
+    OlmRatchetKeyPool * pool
+);
+
 /** The length of the buffer needed to hold the SHA-256 hash. */
 size_t olm_sha256_length(
    OlmUtility * utility
@@ -434,6 +1786,62 @@ size_t olm_sha256(
     void * output, size_t output_length
 );
 
+/** Calculates the SHA-256 hash of the input, like olm_sha256(), but writes
+ * the 32 byte hash as it is rather than as base64. If the output buffer is
+ * smaller than 32 bytes then olm_utility_last_error() will be
+ * "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_sha256_raw(
+    OlmUtility * utility,
+    void const * input, size_t input_length,
+    void * output, size_t output_length
+);
+
+/** Calculates the SHA-256 hashes of count independent inputs, for example
+ * event IDs, writing the 32 byte hashes one after another to the output
+ * buffer. Where the CPU has no SHA instructions several inputs are hashed at
+ * once, which works best when neighbouring inputs are about the same length.
+ * Returns 32 * count on success. If the output buffer is smaller than that
+ * then olm_utility_last_error() will be "OUTPUT_BUFFER_TOO_SMALL". */
+size_t olm_sha256_batch(
+    OlmUtility * utility,
+    size_t count,
+    void const * const * inputs, size_t const * input_lengths,
+    void * output, size_t output_length
+);
+
+/** The size of a streaming SHA-256 context in bytes */
+size_t olm_sha256_context_size(void);
+
+/** Starts a SHA-256 hash which is given its input a piece at a time, for
+ * example an attachment as it is downloaded, in the memory supplied, which
+ * must be at least olm_sha256_context_size() bytes. */
+OlmSha256 * olm_sha256_init(
+    void * memory
+);
+
+/** Adds the next piece of input to the hash */
+void olm_sha256_update(
+    OlmSha256 * context,
+    void const * input, size_t input_length
+);
+
+/** Finishes the hash, writing it as base64 like olm_sha256(), and wipes the
+ * context. Returns the length of the base64. Returns olm_error(), leaving
+ * the context as it was, if the output buffer is smaller than
+ * olm_sha256_length(). */
+size_t olm_sha256_final(
+    OlmSha256 * context,
+    void * output, size_t output_length
+);
+
+/** Finishes the hash like olm_sha256_final(), but writes the 32 byte hash as
+ * it is. Returns olm_error(), leaving the context as it was, if the output
+ * buffer is smaller than 32 bytes. */
+size_t olm_sha256_final_raw(
+    OlmSha256 * context,
+    void * output, size_t output_length
+);
+
 /** Verify an ed25519 signature. If the key was too small then
  * olm_session_last_error will be "INVALID_BASE64". If the signature was invalid
  * then olm_session_last_error() will be "BAD_MESSAGE_MAC". */
@@ -444,6 +1852,82 @@ size_t olm_ed25519_verify(
     void * signature, size_t signature_length
 );
 
+/** Verify an ed25519 signature like olm_ed25519_verify(), but with the 32
+ * byte key and the 64 byte signature as they are rather than as base64.
+ * Nothing is written to, so the buffers can be passed as they are. If the
+ * signature was invalid then olm_utility_last_error() will be
+ * "BAD_MESSAGE_MAC". */
+size_t olm_ed25519_verify_raw(
+    OlmUtility * utility,
+    void const * key,
+    void const * message, size_t message_length,
+    void const * signature
+);
+
+/** Verify a number of ed25519 signatures at once, with the same results as
+ * calling olm_ed25519_verify() for each of them. The i-th signature is checked
+ * against the i-th message and key, and results[i] is set to 1 if it is valid
+ * or to 0 if it isn't, or if its key or signature isn't valid base64 of the
+ * right length. The signatures are base64 decoded in place, as for
+ * olm_ed25519_verify(). Returns the number of signatures that were
+ * invalid, so 0 if every signature was valid. */
+size_t olm_ed25519_verify_batch(
+    OlmUtility * utility,
+    size_t count,
+    void const * const * keys, size_t const * key_lengths,
+    void const * const * messages, size_t const * message_lengths,
+    void * const * signatures, size_t const * signature_lengths,
+    uint8_t * results
+);
+
+/** Rewrites a JSON object in place as the canonical JSON that is signed, as
+ * described in docs/signing.rst: without whitespace, with the members of each
+ * object sorted by key, and without the top level "signatures" and
+ * "unsigned" members. Strings have only the escapes they need, and the only
+ * numbers allowed are integers of at most 2^53 - 1. The canonical form is
+ * never longer than the input. Returns its length. If the input isn't a JSON
+ * object with a canonical form then olm_utility_last_error() will be
+ * "INVALID_JSON", and the buffer will have been partly rewritten. */
+size_t olm_canonical_json(
+    OlmUtility * utility,
+    void * json, size_t json_length
+);
+
+/** Verify the ed25519 signature of a signed JSON object, such as a device's
+ * keys. The signature is the one at signatures[user_id][key_id], for example
+ * signatures["@alice:example.com"]["ed25519:JLAFKJWSCS"], and is checked with
+ * the base64 key given against the canonical JSON of the object. The object
+ * is rewritten in place as its canonical JSON, as by olm_canonical_json().
+ * If the key wasn't valid base64 of the right length or the signature
+ * wasn't valid base64 then olm_utility_last_error() will be
+ * "INVALID_BASE64". If the object wasn't valid JSON then it will be
+ * "INVALID_JSON". If there was no such signature or it was invalid then it
+ * will be "BAD_MESSAGE_MAC". */
+size_t olm_ed25519_verify_json(
+    OlmUtility * utility,
+    void const * key, size_t key_length,
+    void const * user_id, size_t user_id_length,
+    void const * key_id, size_t key_id_length,
+    void * json, size_t json_length
+);
+
+/** Verify the signatures of a number of signed JSON objects at once, for
+ * example the devices in a /keys/query response. The i-th object is
+ * checked as by olm_ed25519_verify_json() with the i-th key, user ID and key
+ * ID, and results[i] is set to 1 if its signature is valid or to 0 if it
+ * isn't for any reason. Each object is rewritten in place as its canonical
+ * JSON. Returns the number of objects whose signatures were invalid, so 0 if
+ * every signature was valid. */
+size_t olm_ed25519_verify_json_batch(
+    OlmUtility * utility,
+    size_t count,
+    void const * const * keys, size_t const * key_lengths,
+    void const * const * user_ids, size_t const * user_id_lengths,
+    void const * const * key_ids, size_t const * key_id_lengths,
+    void * const * jsons, size_t const * json_lengths,
+    uint8_t * results
+);
+
 #ifdef __cplusplus
 }
 #endif
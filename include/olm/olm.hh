@@ -1,4 +1,650 @@
-/* this file exists only for compatibility with existing applications.
- * You should use "#include <olm/olm.h>" instead.
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
  */
+
+/* A thin C++ interface over the C API in olm/olm.h, which it includes, so
+ * applications which included this file for the C API still work.
+ *
+ * Everything here is inline and only forwards to the C functions. Inputs and
+ * outputs are views of the caller's buffers, and results carry the error
+ * string instead of throwing, so nothing is allocated or copied beyond what
+ * the C API does. The one allocation is the memory of each object, which a
+ * handle takes from operator new unless it is given memory to use.
+ */
+
+#ifndef OLM_OLM_HH_
+#define OLM_OLM_HH_
+
 #include "olm/olm.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+namespace olm {
+/* the library's own classes are in namespace olm, so these are kept apart */
+namespace api {
+
+/** A view of size elements of T starting at data. Bytes and MutableBytes can
+ * be made from any container of bytes with data() and size(). */
+template<typename T>
+class Span {
+public:
+    Span() : data_(nullptr), size_(0) {}
+    Span(T * data, std::size_t size) : data_(data), size_(size) {}
+
+    template<std::size_t N>
+    Span(T (&array)[N]) : data_(array), size_(N) {}
+
+    template<
+        typename Container,
+        typename Element = typename std::remove_pointer<
+            decltype(std::declval<Container &>().data())
+        >::type,
+        typename = typename std::enable_if<
+            sizeof(Element) == sizeof(T)
+                && (std::is_const<T>::value || !std::is_const<Element>::value)
+        >::type
+    >
+    Span(Container & container)
+        : data_(reinterpret_cast<T *>(container.data())),
+          size_(container.size()) {}
+
+    /** a view of the same memory, read-only */
+    operator Span<T const>() const {
+        return Span<T const>(data_, size_);
+    }
+
+    T * data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T & operator[](std::size_t i) const { return data_[i]; }
+    T * begin() const { return data_; }
+    T * end() const { return data_ + size_; }
+
+    /** the count elements starting at offset */
+    Span subspan(std::size_t offset, std::size_t count) const {
+        assert(offset <= size_ && count <= size_ - offset);
+        return Span(data_ + offset, count);
+    }
+
+private:
+    T * data_;
+    std::size_t size_;
+};
+
+typedef Span<std::uint8_t const> Bytes;
+typedef Span<std::uint8_t> MutableBytes;
+
+/** The failure of a call, as the string the C API's last_error gives */
+struct Error {
+    const char * message;
+};
+
+/** Either a value or an Error, like std::expected */
+template<typename T>
+class Result {
+public:
+    Result(T value) : value_(value), error_(nullptr) {}
+    Result(Error error) : value_(), error_(error.message) {}
+
+    bool has_value() const { return error_ == nullptr; }
+    explicit operator bool() const { return has_value(); }
+
+    const T & value() const {
+        assert(has_value());
+        return value_;
+    }
+    const T & operator*() const { return value(); }
+    const T * operator->() const { return &value(); }
+    T value_or(T other) const { return has_value() ? value_ : other; }
+
+    /** the error string, or nullptr if there is a value */
+    const char * error() const { return error_; }
+
+private:
+    T value_;
+    const char * error_;
+};
+
+/** What a call which only succeeds or fails returns */
+struct Done {};
+typedef Result<Done> Status;
+
+enum class MessageType : std::size_t {
+    PreKey = OLM_MESSAGE_TYPE_PRE_KEY,
+    Message = OLM_MESSAGE_TYPE_MESSAGE,
+};
+
+/** A message written by Session::encrypt() */
+struct EncryptedMessage {
+    MessageType type;
+    std::size_t length;
+};
+
+/** A plain-text written by InboundGroupSession::decrypt() */
+struct GroupPlaintext {
+    std::size_t length;
+    std::uint32_t message_index;
+};
+
+namespace detail {
+
+/**
+ * The memory behind a handle, and the object in it. The memory is either
+ * the handle's own, from operator new, or the caller's. Either way the
+ * object is cleared when the handle is destroyed.
+ */
+template<typename T, typename Traits>
+class Handle {
+public:
+    Handle(Handle && other)
+        : object_(other.object_), memory_(other.memory_), owned_(other.owned_) {
+        other.object_ = nullptr;
+        other.memory_ = nullptr;
+        other.owned_ = false;
+    }
+
+    Handle & operator=(Handle && other) {
+        if (this != &other) {
+            reset();
+            object_ = other.object_;
+            memory_ = other.memory_;
+            owned_ = other.owned_;
+            other.object_ = nullptr;
+            other.memory_ = nullptr;
+            other.owned_ = false;
+        }
+        return *this;
+    }
+
+    Handle(const Handle &) = delete;
+    Handle & operator=(const Handle &) = delete;
+
+    ~Handle() {
+        reset();
+    }
+
+    /** The number of bytes of memory the object needs */
+    static std::size_t size() {
+        return Traits::size();
+    }
+
+    /** false if the handle has been moved from, or its memory couldn't be
+     * allocated */
+    explicit operator bool() const { return object_ != nullptr; }
+
+    T * get() const { return object_; }
+
+    const char * last_error() const {
+        return Traits::last_error(object_);
+    }
+
+protected:
+    Handle() : memory_(::operator new(Traits::size(), std::nothrow)),
+               owned_(true) {
+        object_ = memory_ ? Traits::init(memory_) : nullptr;
+    }
+
+    explicit Handle(void * memory)
+        : object_(Traits::init(memory)), memory_(memory), owned_(false) {}
+
+    /** turn the result of a C call into a Result */
+    Result<std::size_t> check(std::size_t result) const {
+        if (result == olm_error()) {
+            return Error{last_error()};
+        }
+        return result;
+    }
+
+    Status check_status(std::size_t result) const {
+        if (result == olm_error()) {
+            return Error{last_error()};
+        }
+        return Done();
+    }
+
+private:
+    void reset() {
+        if (object_) {
+            Traits::clear(object_);
+        }
+        if (owned_) {
+            ::operator delete(memory_);
+        }
+        object_ = nullptr;
+        memory_ = nullptr;
+        owned_ = false;
+    }
+
+    T * object_;
+    void * memory_;
+    bool owned_;
+};
+
+struct AccountTraits {
+    static std::size_t size() { return olm_account_size(); }
+    static OlmAccount * init(void * memory) { return olm_account(memory); }
+    static void clear(OlmAccount * account) { olm_clear_account(account); }
+    static const char * last_error(OlmAccount * account) {
+        return olm_account_last_error(account);
+    }
+};
+
+struct SessionTraits {
+    static std::size_t size() { return olm_session_size(); }
+    static OlmSession * init(void * memory) { return olm_session(memory); }
+    static void clear(OlmSession * session) { olm_clear_session(session); }
+    static const char * last_error(OlmSession * session) {
+        return olm_session_last_error(session);
+    }
+};
+
+struct OutboundGroupSessionTraits {
+    static std::size_t size() { return olm_outbound_group_session_size(); }
+    static OlmOutboundGroupSession * init(void * memory) {
+        return olm_outbound_group_session(memory);
+    }
+    static void clear(OlmOutboundGroupSession * session) {
+        olm_clear_outbound_group_session(session);
+    }
+    static const char * last_error(OlmOutboundGroupSession * session) {
+        return olm_outbound_group_session_last_error(session);
+    }
+};
+
+struct InboundGroupSessionTraits {
+    static std::size_t size() { return olm_inbound_group_session_size(); }
+    static OlmInboundGroupSession * init(void * memory) {
+        return olm_inbound_group_session(memory);
+    }
+    static void clear(OlmInboundGroupSession * session) {
+        olm_clear_inbound_group_session(session);
+    }
+    static const char * last_error(OlmInboundGroupSession * session) {
+        return olm_inbound_group_session_last_error(session);
+    }
+};
+
+} // namespace detail
+
+class Session;
+
+/** An OlmAccount. The random and pickled inputs are wiped or overwritten,
+ * as by the C functions, so are taken as MutableBytes. */
+class Account : public detail::Handle<OlmAccount, detail::AccountTraits> {
+public:
+    /** An account in memory of its own */
+    Account() {}
+    /** An account in the caller's memory, of at least size() bytes, which
+     * must outlive the handle */
+    explicit Account(void * memory) : Handle(memory) {}
+
+    std::size_t create_random_length() const {
+        return olm_create_account_random_length(get());
+    }
+    Status create(MutableBytes random) {
+        return check_status(
+            olm_create_account(get(), random.data(), random.size())
+        );
+    }
+
+    std::size_t identity_keys_length() const {
+        return olm_account_identity_keys_length(get());
+    }
+    Result<std::size_t> identity_keys(MutableBytes output) const {
+        return check(olm_account_identity_keys(
+            get(), output.data(), output.size()
+        ));
+    }
+
+    std::size_t signature_length() const {
+        return olm_account_signature_length(get());
+    }
+    Result<std::size_t> sign(Bytes message, MutableBytes signature) const {
+        return check(olm_account_sign(
+            get(), message.data(), message.size(),
+            signature.data(), signature.size()
+        ));
+    }
+
+    std::size_t one_time_keys_length() const {
+        return olm_account_one_time_keys_length(get());
+    }
+    Result<std::size_t> one_time_keys(MutableBytes output) const {
+        return check(olm_account_one_time_keys(
+            get(), output.data(), output.size()
+        ));
+    }
+    std::size_t max_number_of_one_time_keys() const {
+        return olm_account_max_number_of_one_time_keys(get());
+    }
+    std::size_t generate_one_time_keys_random_length(std::size_t count) const {
+        return olm_account_generate_one_time_keys_random_length(get(), count);
+    }
+    Result<std::size_t> generate_one_time_keys(
+        std::size_t count, MutableBytes random
+    ) {
+        return check(olm_account_generate_one_time_keys(
+            get(), count, random.data(), random.size()
+        ));
+    }
+    Result<std::size_t> mark_keys_as_published() {
+        return check(olm_account_mark_keys_as_published(get()));
+    }
+    inline Status remove_one_time_keys(Session & session);
+
+    std::size_t pickle_length() const {
+        return olm_pickle_account_length(get());
+    }
+    Result<std::size_t> pickle(Bytes key, MutableBytes output) const {
+        return check(olm_pickle_account(
+            get(), key.data(), key.size(), output.data(), output.size()
+        ));
+    }
+    Status unpickle(Bytes key, MutableBytes pickled) {
+        return check_status(olm_unpickle_account(
+            get(), key.data(), key.size(), pickled.data(), pickled.size()
+        ));
+    }
+};
+
+/** An OlmSession. Messages given to create_inbound() and decrypt() are
+ * destroyed, as by the C functions. */
+class Session : public detail::Handle<OlmSession, detail::SessionTraits> {
+public:
+    /** A session in memory of its own */
+    Session() {}
+    /** A session in the caller's memory, of at least size() bytes, which
+     * must outlive the handle */
+    explicit Session(void * memory) : Handle(memory) {}
+
+    std::size_t create_outbound_random_length() const {
+        return olm_create_outbound_session_random_length(get());
+    }
+    Status create_outbound(
+        Account & account, Bytes their_identity_key,
+        Bytes their_one_time_key, MutableBytes random
+    ) {
+        return check_status(olm_create_outbound_session(
+            get(), account.get(),
+            their_identity_key.data(), their_identity_key.size(),
+            their_one_time_key.data(), their_one_time_key.size(),
+            random.data(), random.size()
+        ));
+    }
+    Status create_inbound(Account & account, MutableBytes message) {
+        return check_status(olm_create_inbound_session(
+            get(), account.get(), message.data(), message.size()
+        ));
+    }
+    Status create_inbound_from(
+        Account & account, Bytes their_identity_key, MutableBytes message
+    ) {
+        return check_status(olm_create_inbound_session_from(
+            get(), account.get(),
+            their_identity_key.data(), their_identity_key.size(),
+            message.data(), message.size()
+        ));
+    }
+
+    std::size_t id_length() const {
+        return olm_session_id_length(get());
+    }
+    Result<std::size_t> id(MutableBytes output) const {
+        return check(olm_session_id(get(), output.data(), output.size()));
+    }
+    bool has_received_message() const {
+        return olm_session_has_received_message(get()) != 0;
+    }
+
+    /** Whether a pre-key message was sent with this session. The message
+     * is destroyed. */
+    Result<bool> matches_inbound(MutableBytes message) const {
+        std::size_t result = olm_matches_inbound_session(
+            get(), message.data(), message.size()
+        );
+        if (result == olm_error()) {
+            return Error{last_error()};
+        }
+        return result == 1;
+    }
+
+    MessageType encrypt_message_type() const {
+        return MessageType(olm_encrypt_message_type(get()));
+    }
+    std::size_t encrypt_random_length() const {
+        return olm_encrypt_random_length(get());
+    }
+    std::size_t encrypt_message_length(std::size_t plaintext_length) const {
+        return olm_encrypt_message_length(get(), plaintext_length);
+    }
+    Result<EncryptedMessage> encrypt(
+        Bytes plaintext, MutableBytes random, MutableBytes output
+    ) {
+        MessageType type = encrypt_message_type();
+        std::size_t result = olm_encrypt(
+            get(), plaintext.data(), plaintext.size(),
+            random.data(), random.size(), output.data(), output.size()
+        );
+        if (result == olm_error()) {
+            return Error{last_error()};
+        }
+        return EncryptedMessage{type, result};
+    }
+
+    /** An upper bound on the length of the plain-text of a message, which
+     * isn't changed */
+    Result<std::size_t> peek_max_plaintext_length(
+        MessageType type, Bytes message
+    ) const {
+        return check(olm_peek_max_plaintext_length(
+            get(), std::size_t(type), message.data(), message.size()
+        ));
+    }
+    Result<std::size_t> decrypt(
+        MessageType type, MutableBytes message, MutableBytes plaintext
+    ) {
+        return check(olm_decrypt(
+            get(), std::size_t(type), message.data(), message.size(),
+            plaintext.data(), plaintext.size()
+        ));
+    }
+
+    std::size_t pickle_length() const {
+        return olm_pickle_session_length(get());
+    }
+    Result<std::size_t> pickle(Bytes key, MutableBytes output) const {
+        return check(olm_pickle_session(
+            get(), key.data(), key.size(), output.data(), output.size()
+        ));
+    }
+    Status unpickle(Bytes key, MutableBytes pickled) {
+        return check_status(olm_unpickle_session(
+            get(), key.data(), key.size(), pickled.data(), pickled.size()
+        ));
+    }
+};
+
+inline Status Account::remove_one_time_keys(Session & session) {
+    return check_status(olm_remove_one_time_keys(get(), session.get()));
+}
+
+/** An OlmOutboundGroupSession */
+class OutboundGroupSession : public detail::Handle<
+    OlmOutboundGroupSession, detail::OutboundGroupSessionTraits
+> {
+public:
+    /** A session in memory of its own */
+    OutboundGroupSession() {}
+    /** A session in the caller's memory, of at least size() bytes, which
+     * must outlive the handle */
+    explicit OutboundGroupSession(void * memory) : Handle(memory) {}
+
+    std::size_t init_random_length() const {
+        return olm_init_outbound_group_session_random_length(get());
+    }
+    Status init(MutableBytes random) {
+        return check_status(olm_init_outbound_group_session(
+            get(), random.data(), random.size()
+        ));
+    }
+
+    std::size_t id_length() const {
+        return olm_outbound_group_session_id_length(get());
+    }
+    Result<std::size_t> id(MutableBytes output) const {
+        return check(olm_outbound_group_session_id(
+            get(), output.data(), output.size()
+        ));
+    }
+    std::uint32_t message_index() const {
+        return olm_outbound_group_session_message_index(get());
+    }
+    std::size_t session_key_length() const {
+        return olm_outbound_group_session_key_length(get());
+    }
+    Result<std::size_t> session_key(MutableBytes output) const {
+        return check(olm_outbound_group_session_key(
+            get(), output.data(), output.size()
+        ));
+    }
+
+    std::size_t encrypt_message_length(std::size_t plaintext_length) const {
+        return olm_group_encrypt_message_length(get(), plaintext_length);
+    }
+    Result<std::size_t> encrypt(Bytes plaintext, MutableBytes output) {
+        return check(olm_group_encrypt(
+            get(), plaintext.data(), plaintext.size(),
+            output.data(), output.size()
+        ));
+    }
+
+    std::size_t pickle_length() const {
+        return olm_pickle_outbound_group_session_length(get());
+    }
+    Result<std::size_t> pickle(Bytes key, MutableBytes output) const {
+        return check(olm_pickle_outbound_group_session(
+            get(), key.data(), key.size(), output.data(), output.size()
+        ));
+    }
+    Status unpickle(Bytes key, MutableBytes pickled) {
+        return check_status(olm_unpickle_outbound_group_session(
+            get(), key.data(), key.size(), pickled.data(), pickled.size()
+        ));
+    }
+};
+
+/** An OlmInboundGroupSession. Messages given to decrypt() are destroyed, as
+ * by olm_group_decrypt(); decrypt_raw() leaves them alone. */
+class InboundGroupSession : public detail::Handle<
+    OlmInboundGroupSession, detail::InboundGroupSessionTraits
+> {
+public:
+    /** A session in memory of its own */
+    InboundGroupSession() {}
+    /** A session in the caller's memory, of at least size() bytes, which
+     * must outlive the handle */
+    explicit InboundGroupSession(void * memory) : Handle(memory) {}
+
+    Status init(Bytes session_key) {
+        return check_status(olm_init_inbound_group_session(
+            get(), session_key.data(), session_key.size()
+        ));
+    }
+    Status import_session(Bytes session_key) {
+        return check_status(olm_import_inbound_group_session(
+            get(), session_key.data(), session_key.size()
+        ));
+    }
+
+    std::size_t id_length() const {
+        return olm_inbound_group_session_id_length(get());
+    }
+    Result<std::size_t> id(MutableBytes output) const {
+        return check(olm_inbound_group_session_id(
+            get(), output.data(), output.size()
+        ));
+    }
+    std::uint32_t first_known_index() const {
+        return olm_inbound_group_session_first_known_index(get());
+    }
+    bool is_verified() const {
+        return olm_inbound_group_session_is_verified(get()) != 0;
+    }
+
+    /** An upper bound on the length of the plain-text of a message, which
+     * isn't changed */
+    Result<std::size_t> peek_max_plaintext_length(Bytes message) const {
+        return check(olm_group_peek_max_plaintext_length(
+            get(), message.data(), message.size()
+        ));
+    }
+    Result<GroupPlaintext> decrypt(
+        MutableBytes message, MutableBytes plaintext
+    ) {
+        std::uint32_t message_index = 0;
+        std::size_t result = olm_group_decrypt(
+            get(), message.data(), message.size(),
+            plaintext.data(), plaintext.size(), &message_index
+        );
+        if (result == olm_error()) {
+            return Error{last_error()};
+        }
+        return GroupPlaintext{result, message_index};
+    }
+    Result<GroupPlaintext> decrypt_raw(Bytes message, MutableBytes plaintext) {
+        std::uint32_t message_index = 0;
+        std::size_t result = olm_group_decrypt_raw(
+            get(), message.data(), message.size(),
+            plaintext.data(), plaintext.size(), &message_index
+        );
+        if (result == olm_error()) {
+            return Error{last_error()};
+        }
+        return GroupPlaintext{result, message_index};
+    }
+
+    std::size_t export_length() const {
+        return olm_export_inbound_group_session_length(get());
+    }
+    Result<std::size_t> export_session(
+        std::uint32_t message_index, MutableBytes output
+    ) const {
+        return check(olm_export_inbound_group_session(
+            get(), output.data(), output.size(), message_index
+        ));
+    }
+
+    std::size_t pickle_length() const {
+        return olm_pickle_inbound_group_session_length(get());
+    }
+    Result<std::size_t> pickle(Bytes key, MutableBytes output) const {
+        return check(olm_pickle_inbound_group_session(
+            get(), key.data(), key.size(), output.data(), output.size()
+        ));
+    }
+    Status unpickle(Bytes key, MutableBytes pickled) {
+        return check_status(olm_unpickle_inbound_group_session(
+            get(), key.data(), key.size(), pickled.data(), pickled.size()
+        ));
+    }
+};
+
+} // namespace api
+} // namespace olm
+
+#endif /* OLM_OLM_HH_ */
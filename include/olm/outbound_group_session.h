@@ -18,6 +18,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "olm/executor.h"
+#include "olm/iovec.h"
+#include "olm/memory_stats.h"
+#include "olm/pool.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,6 +53,148 @@ size_t olm_clear_outbound_group_session(
     OlmOutboundGroupSession *session
 );
 
+/** The number of bytes of key stream buffer needed for each prepared message
+ * key */
+size_t olm_outbound_group_session_key_stream_entry_size(void);
+
+/**
+ * Give the session a buffer to keep the ratchet and keys for its next
+ * messages in, so that they can be derived ahead of time by
+ * olm_outbound_group_session_prepare() instead of while encrypting. The
+ * messages are the same either way; only the signature is left to compute
+ * in olm_group_encrypt().
+ *
+ * The buffer must stay valid until it is replaced, or until the session is
+ * cleared; pass NULL to stop using one. It isn't pickled. It holds keys for
+ * messages which haven't been sent yet, so it is wiped when it is replaced
+ * and when the session is initialised, unpickled or cleared, and each entry
+ * is wiped as it is used.
+ *
+ * Returns the number of messages the buffer can hold.
+ */
+size_t olm_outbound_group_session_set_key_stream(
+    OlmOutboundGroupSession *session,
+    void *buffer, size_t buffer_length
+);
+
+/**
+ * Derive the keys for the next count messages, as far as the key stream
+ * buffer has room, so that encrypting them needn't. Call this when the
+ * application is idle. Returns the number of messages now prepared.
+ */
+size_t olm_outbound_group_session_prepare(
+    OlmOutboundGroupSession *session,
+    size_t count
+);
+
+/**
+ * Give back memory when the system is short of it, as far as level, one of
+ * the OLM_TRIM_MEMORY_* levels in olm/memory_stats.h: the prepared message
+ * keys are wiped from OLM_TRIM_MEMORY_PRECOMPUTED, and from
+ * OLM_TRIM_MEMORY_BUFFERS the session stops using its key stream buffer, so
+ * that it can be freed. Messages are the same either way.
+ *
+ * Returns the number of bytes of prepared keys wiped.
+ */
+size_t olm_outbound_group_session_trim_memory(
+    OlmOutboundGroupSession *session, int level
+);
+
+/** Adds the memory the session is using to stats, as described in
+ * olm/memory_stats.h, including its key stream and share ledger buffers */
+void olm_outbound_group_session_memory_stats(
+    const OlmOutboundGroupSession *session,
+    OlmMemoryStats *stats
+);
+
+/**
+ * The number of bytes of share ledger buffer needed to hold device_count
+ * devices.
+ */
+size_t olm_outbound_group_session_ledger_buffer_length(
+    size_t device_count
+);
+
+/**
+ * Give the session a buffer for its share ledger: the devices which have
+ * been sent its session key, and the message index they were sent it at,
+ * kept in a hash set so that finding which of a room's devices still need
+ * the key takes one lookup each. The ledger is pickled with the session,
+ * and emptied when the session is initialised, so that a session and the
+ * devices it has been shared with are always stored together.
+ *
+ * Any devices already in the ledger are moved to the new buffer, which
+ * mustn't overlap the old one, and the old one is wiped. The buffer must stay valid until it is replaced, or
+ * until the session is cleared, and must be set before unpickling a
+ * session which has a ledger.
+ *
+ * Returns the number of devices the buffer can hold, or olm_error() if the
+ * devices already in the ledger don't fit, in which case
+ * olm_outbound_group_session_last_error() will be "STORE_FULL" and the
+ * session keeps its old buffer.
+ */
+size_t olm_outbound_group_session_set_ledger(
+    OlmOutboundGroupSession *session,
+    void *buffer, size_t buffer_length
+);
+
+/**
+ * Record that the session key for the current message index has been sent
+ * to count devices, given by their unpadded base64 Curve25519 identity
+ * keys. Devices already in the ledger keep the index they were first sent,
+ * and a device listed more than once is only added once.
+ *
+ * Returns the number of devices which were new to the ledger, or
+ * olm_error() on failure, in which case none are added. If a key isn't
+ * valid then olm_outbound_group_session_last_error() will be
+ * "INVALID_BASE64", and if the ledger has no room for the new devices it
+ * will be "STORE_FULL".
+ */
+size_t olm_outbound_group_session_ledger_add(
+    OlmOutboundGroupSession *session, size_t count,
+    void const * const * device_keys, size_t const * device_key_lengths
+);
+
+/**
+ * Look a device up in the share ledger. Returns 1 and sets *shared_at, if
+ * shared_at isn't NULL, to the message index the device was sent if it is
+ * in the ledger, 0 if it isn't, or olm_error() if the key isn't valid, in
+ * which case olm_outbound_group_session_last_error() will be
+ * "INVALID_BASE64".
+ */
+size_t olm_outbound_group_session_ledger_lookup(
+    OlmOutboundGroupSession *session,
+    void const * device_key, size_t device_key_length,
+    uint32_t *shared_at
+);
+
+/**
+ * Find which of count devices still need the session key: a device which
+ * was sent the key at any index can decrypt every message since, so these
+ * are the devices which aren't in the ledger. Writes the positions of those
+ * devices in device_keys to missing, which must have room for count, in
+ * order.
+ *
+ * Returns the number of devices missing the key, or olm_error() if a key
+ * isn't valid, in which case olm_outbound_group_session_last_error() will
+ * be "INVALID_BASE64".
+ */
+size_t olm_outbound_group_session_ledger_missing(
+    OlmOutboundGroupSession *session, size_t count,
+    void const * const * device_keys, size_t const * device_key_lengths,
+    size_t *missing
+);
+
+/** The number of devices in the session's share ledger */
+size_t olm_outbound_group_session_ledger_count(
+    const OlmOutboundGroupSession *session
+);
+
+/** Forget every device in the session's share ledger, wiping them */
+void olm_outbound_group_session_ledger_clear(
+    OlmOutboundGroupSession *session
+);
+
 /** Returns the number of bytes needed to store an outbound group session */
 size_t olm_pickle_outbound_group_session_length(
     const OlmOutboundGroupSession *session
@@ -83,6 +230,42 @@ size_t olm_unpickle_outbound_group_session(
     void * pickled, size_t pickled_length
 );
 
+/**
+ * Returns the number of bytes needed to store an outbound group session as a
+ * binary pickle
+ */
+size_t olm_pickle_outbound_group_session_binary_length(
+    const OlmOutboundGroupSession *session
+);
+
+/**
+ * Stores a group session as binary. Like
+ * olm_pickle_outbound_group_session() the session is encrypted and
+ * authenticated using the supplied key, but the result isn't base64 encoded.
+ * Returns the length of the session on success.
+ *
+ * Returns olm_error() on failure. If the pickle output buffer is smaller
+ * than olm_pickle_outbound_group_session_binary_length() then
+ * olm_outbound_group_session_last_error() will be "OUTPUT_BUFFER_TOO_SMALL"
+ */
+size_t olm_pickle_outbound_group_session_binary(
+    OlmOutboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
+/**
+ * Loads a group session from a binary pickle made by
+ * olm_pickle_outbound_group_session_binary(). Fails in the same ways as
+ * olm_unpickle_outbound_group_session(), except that there is no base64 to
+ * decode. The input pickled buffer is destroyed
+ */
+size_t olm_unpickle_outbound_group_session_binary(
+    OlmOutboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+);
+
 
 /** The number of random bytes needed to create an outbound group session */
 size_t olm_init_outbound_group_session_random_length(
@@ -99,6 +282,47 @@ size_t olm_init_outbound_group_session(
     uint8_t *random, size_t random_length
 );
 
+/**
+ * Like olm_init_outbound_group_session(), but taking the random bytes from
+ * the library's generator (see olm/random.h). The last_error will be
+ * RANDOM_UNAVAILABLE if it has none.
+ */
+size_t olm_init_outbound_group_session_auto_random(
+    OlmOutboundGroupSession *session
+);
+
+/**
+ * Make next ready to replace a session when it is rotated, so that none of
+ * the work of starting a session is left for the send path. This starts
+ * next as olm_init_outbound_group_session() does, derives the keys for its
+ * first messages if it has been given a key stream buffer, and writes its
+ * signed session key to session_key, ready to be shared before the
+ * rotation. next can be prepared on any thread, as long as nothing else is
+ * using it.
+ *
+ * session_key must have room for olm_outbound_group_session_key_length()
+ * bytes. Returns the length of the session key, or olm_error() on failure,
+ * with last_error set to NOT_ENOUGH_RANDOM or OUTPUT_BUFFER_TOO_SMALL. On
+ * failure next is left as it was.
+ */
+size_t olm_prepare_next_outbound_group_session(
+    OlmOutboundGroupSession *next,
+    uint8_t *random, size_t random_length,
+    uint8_t *session_key, size_t session_key_length
+);
+
+/**
+ * Swap session with the one prepared in next, which takes a fixed number of
+ * copies and no crypto, so that a session can be replaced where it lives.
+ * Each session takes its key stream buffer and share ledger with it, so
+ * the keys prepared for next are used by session from now on. next is
+ * left holding the old session, to be pickled, cleared or prepared again.
+ */
+void olm_rotate_outbound_group_session(
+    OlmOutboundGroupSession *session,
+    OlmOutboundGroupSession *next
+);
+
 /**
  * The number of bytes that will be created by encrypting a message
  */
@@ -119,6 +343,162 @@ size_t olm_group_encrypt(
     uint8_t * message, size_t message_length
 );
 
+/**
+ * Like olm_group_encrypt(), but with the plain-text and the message in the
+ * same buffer: the first plaintext_length bytes of the buffer are encrypted,
+ * and the message written over them. The buffer must be at least
+ * olm_group_encrypt_message_length() bytes. On failure the buffer is wiped.
+ */
+size_t olm_group_encrypt_inplace(
+    OlmOutboundGroupSession *session,
+    size_t plaintext_length,
+    uint8_t * buffer, size_t buffer_length
+);
+
+/**
+ * Like olm_group_encrypt(), but writing the message into a buffer which
+ * takes memory from the allocator when it hasn't room, so there is no need
+ * to ask olm_group_encrypt_message_length() first. Returns the length of the
+ * message, which is also left in message->length, or olm_error() on
+ * failure, when last_error is ALLOCATION_FAILED if the allocator has no
+ * memory.
+ */
+size_t olm_group_encrypt_to_buffer(
+    OlmOutboundGroupSession *session,
+    uint8_t const * plaintext, size_t plaintext_length,
+    const OlmAllocator *allocator, OlmBuffer *message
+);
+
+/**
+ * The number of bytes that will be created by olm_group_encrypt_raw()
+ */
+size_t olm_group_encrypt_raw_message_length(
+    OlmOutboundGroupSession *session,
+    size_t plaintext_length
+);
+
+/**
+ * Like olm_group_encrypt(), but write the message in binary rather than
+ * base64, for transports that carry binary. The result can be decrypted with
+ * olm_group_decrypt_raw(), or base64-encoded to give what olm_group_encrypt()
+ * would have written.
+ */
+size_t olm_group_encrypt_raw(
+    OlmOutboundGroupSession *session,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * message, size_t message_length
+);
+
+/**
+ * Like olm_group_encrypt_raw(), but reading the plain-text from
+ * plaintext_count segments, one after another, and writing the message
+ * across message_count segments, such as the buffers of a network write.
+ * The message segments must hold at least
+ * olm_group_encrypt_raw_message_length() bytes between them, and mustn't
+ * overlap the plain-text. The plain-text is encrypted straight into the
+ * message segments, with only the blocks which straddle two segments going
+ * through a copy.
+ *
+ * Returns the length of the message, or olm_error() on failure, when the
+ * last_error will be OUTPUT_BUFFER_TOO_SMALL if the segments are too small.
+ */
+size_t olm_group_encrypt_raw_iov(
+    OlmOutboundGroupSession *session,
+    const OlmIovec * plaintext, size_t plaintext_count,
+    const OlmIovec * message, size_t message_count
+);
+
+/**
+ * A group message being encrypted a piece at a time, for plain-texts too big
+ * to want a second copy of. The message is written in binary, as by
+ * olm_group_encrypt_raw(), straight into a buffer supplied by the caller,
+ * such as a memory mapped file, as the plain-text is given to the stream.
+ */
+typedef struct OlmGroupEncryptStream OlmGroupEncryptStream;
+
+/** The size of a group encrypt stream object in bytes */
+size_t olm_group_encrypt_stream_size(void);
+
+/** Initialise a group encrypt stream object using the supplied memory, which
+ * must be at least olm_group_encrypt_stream_size() bytes */
+OlmGroupEncryptStream * olm_group_encrypt_stream(void * memory);
+
+/** A null terminated string describing the most recent error to happen to a
+ * group encrypt stream */
+const char *olm_group_encrypt_stream_last_error(
+    const OlmGroupEncryptStream *stream
+);
+
+/** Clears the memory used to back this stream, including the keys it holds
+ * if it is abandoned part way through */
+size_t olm_clear_group_encrypt_stream(OlmGroupEncryptStream *stream);
+
+/**
+ * Start encrypting plaintext_length bytes of plain-text as the session's
+ * next message, which is written to message as the plain-text arrives.
+ * message must be at least olm_group_encrypt_raw_message_length() bytes,
+ * and stay valid until the stream is ended. The session moves on to its next
+ * message straight away, and may be used again meanwhile.
+ *
+ * Returns olm_error() on failure, when the stream's last error will be
+ * OUTPUT_BUFFER_TOO_SMALL if the buffer is too small.
+ */
+size_t olm_group_encrypt_stream_begin(
+    OlmGroupEncryptStream *stream,
+    OlmOutboundGroupSession *session, size_t plaintext_length,
+    uint8_t * message, size_t message_length
+);
+
+/**
+ * Encrypt the next piece of the plain-text, which may be any length. Returns
+ * olm_error() with the last error BAD_STREAM_STATE if the stream hasn't been
+ * started, or this would be more plain-text than it was started with.
+ */
+size_t olm_group_encrypt_stream_update(
+    OlmGroupEncryptStream *stream,
+    uint8_t const * plaintext, size_t plaintext_length
+);
+
+/**
+ * Finish the message, adding its MAC and signature, and clear the stream.
+ * Returns the length of the message, which is the same as
+ * olm_group_encrypt_raw() would have written for the whole plain-text, or
+ * olm_error() with the last error BAD_STREAM_STATE if the stream wasn't
+ * given all the plain-text it was started with.
+ */
+size_t olm_group_encrypt_stream_end(OlmGroupEncryptStream *stream);
+
+/**
+ * The number of bytes that olm_group_encrypt_batch() will write for count
+ * plain-texts of the given lengths.
+ */
+size_t olm_group_encrypt_batch_length(
+    OlmOutboundGroupSession *session, size_t count,
+    const size_t * plaintext_lengths
+);
+
+/**
+ * Encrypt count plain-texts as the session's next count messages, writing
+ * the messages one after another into the messages buffer, and the length
+ * of each to message_lengths. The messages are the same as
+ * olm_group_encrypt() would give for each plain-text in turn.
+ *
+ * Walking the ratchet and encrypting has to be done in order, but the
+ * signing and encoding is split into independent jobs which are run by the
+ * executor, if given, or one after another on this thread if it is NULL.
+ *
+ * Returns the total length of the messages, or olm_error() on failure. The
+ * last error will be OUTPUT_BUFFER_TOO_SMALL if the buffer is smaller than
+ * olm_group_encrypt_batch_length(), in which case nothing is encrypted.
+ */
+size_t olm_group_encrypt_batch(
+    OlmOutboundGroupSession *session, size_t count,
+    uint8_t const * const * plaintexts, const size_t * plaintext_lengths,
+    uint8_t * messages, size_t messages_length,
+    size_t * message_lengths,
+    OlmBatchExecutor executor, void * executor_context
+);
+
 
 /**
  * Get the number of bytes returned by olm_outbound_group_session_id()
@@ -140,6 +520,21 @@ size_t olm_outbound_group_session_id(
     uint8_t * id, size_t id_length
 );
 
+/**
+ * Get the identifier for this session as 32 bytes, without base64 encoding
+ * it. This is the base64-decoded session ID, the same as
+ * olm_inbound_group_session_id_binary() gives for the inbound session.
+ *
+ * Returns the length of the session id on success or olm_error() on
+ * failure. On failure last_error will be set with an error code. The
+ * last_error will be OUTPUT_BUFFER_TOO_SMALL if the id buffer was too
+ * small.
+ */
+size_t olm_outbound_group_session_id_binary(
+    OlmOutboundGroupSession *session,
+    uint8_t * id, size_t id_length
+);
+
 /**
  * Get the current message index for this session.
  *
@@ -150,6 +545,22 @@ uint32_t olm_outbound_group_session_message_index(
     OlmOutboundGroupSession *session
 );
 
+/**
+ * Whether the session has encrypted anything, been created, or had its
+ * share ledger changed since it was unpickled or since
+ * olm_outbound_group_session_clear_dirty(), so that it needs pickling
+ * again. Pickling doesn't clear it.
+ */
+int olm_outbound_group_session_is_dirty(
+    const OlmOutboundGroupSession *session
+);
+
+/** Note that the session has been saved, for
+ * olm_outbound_group_session_is_dirty() */
+void olm_outbound_group_session_clear_dirty(
+    OlmOutboundGroupSession *session
+);
+
 /**
  * Get the number of bytes returned by olm_outbound_group_session_key()
  */
@@ -161,7 +572,9 @@ size_t olm_outbound_group_session_key_length(
  * Get the base64-encoded current ratchet key for this session.
  *
  * Each message is sent with a different ratchet key. This function returns the
- * ratchet key that will be used for the next message.
+ * ratchet key that will be used for the next message. The signed key is
+ * kept in the session until the next message is encrypted, so asking for it
+ * again at the same index is a copy.
  *
  * Returns the length of the ratchet key on success or olm_error() on
  * failure. On failure last_error will be set with an error code. The
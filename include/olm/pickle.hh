@@ -16,6 +16,7 @@
 #define OLM_PICKLE_HH_
 
 #include "olm/list.hh"
+#include "olm/indexed_list.hh"
 #include "olm/crypto.h"
 
 #include <cstring>
@@ -97,6 +98,89 @@ std::uint8_t const * unpickle(
 }
 
 
+template<typename T>
+std::size_t pickle_length(
+    olm::BufferList<T> const & list
+) {
+    std::size_t length = pickle_length(std::uint32_t(list.size()));
+    for (auto const & value : list) {
+        length += pickle_length(value);
+    }
+    return length;
+}
+
+
+template<typename T>
+std::uint8_t * pickle(
+    std::uint8_t * pos,
+    olm::BufferList<T> const & list
+) {
+    pos = pickle(pos, std::uint32_t(list.size()));
+    for (auto const & value : list) {
+        pos = pickle(pos, value);
+    }
+    return pos;
+}
+
+
+template<typename T>
+std::uint8_t const * unpickle(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::BufferList<T> & list
+) {
+    std::uint32_t size;
+    pos = unpickle(pos, end, size);
+    while (size-- && pos != end) {
+        T * value = list.insert(list.end());
+        pos = unpickle(pos, end, *value);
+    }
+    return pos;
+}
+
+
+/* An IndexedList is pickled in the same way as a List, newest first */
+template<typename T, typename Traits>
+std::size_t pickle_length(
+    olm::IndexedList<T, Traits> const & list
+) {
+    std::size_t length = pickle_length(std::uint32_t(list.size()));
+    for (auto const & value : list) {
+        length += pickle_length(value);
+    }
+    return length;
+}
+
+
+template<typename T, typename Traits>
+std::uint8_t * pickle(
+    std::uint8_t * pos,
+    olm::IndexedList<T, Traits> const & list
+) {
+    pos = pickle(pos, std::uint32_t(list.size()));
+    for (auto const & value : list) {
+        pos = pickle(pos, value);
+    }
+    return pos;
+}
+
+
+template<typename T, typename Traits>
+std::uint8_t const * unpickle(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::IndexedList<T, Traits> & list
+) {
+    std::uint32_t size;
+    pos = unpickle(pos, end, size);
+    while (size-- && pos != end) {
+        T value;
+        pos = unpickle(pos, end, value);
+        list.append(value);
+        olm::unset(value);
+    }
+    return pos;
+}
+
+
 std::uint8_t * pickle_bytes(
     std::uint8_t * pos,
     std::uint8_t const * bytes, std::size_t bytes_length
@@ -21,7 +21,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "olm/cipher.h"
 #include "olm/error.h"
+#include "olm/pickle_key.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -57,7 +59,8 @@ size_t _olm_enc_output(
 );
 
 /**
- * Decode and decrypt the given pickle in-situ.
+ * Decode and decrypt the given pickle in-situ. Pickles encrypted with
+ * AES-GCM by _olm_enc_output_gcm are recognised by their marker.
  *
  * Returns the number of bytes in the decoded pickle, or olm_error() on error,
  * in which case *last_error will be updated, if last_error is non-NULL.
@@ -68,6 +71,371 @@ size_t _olm_enc_input(
     enum OlmErrorCode * last_error
 );
 
+/**
+ * As _olm_enc_input, but leaving the input as it is: the pickle is decoded
+ * into the output, which must have room for
+ * _olm_decode_base64_length(b64_length) bytes, and decrypted there.
+ *
+ * Returns the number of bytes in the decoded pickle, which is at the start of
+ * the output, or olm_error() on error, in which case the output is wiped and
+ * *last_error will be updated, if last_error is non-NULL: to
+ * OLM_OUTPUT_BUFFER_TOO_SMALL if the output is too small.
+ */
+size_t _olm_enc_input_const(
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t b64_length,
+    uint8_t * output, size_t max_output_length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * The keys derived from a pickle key. A context can be used to encrypt and
+ * decrypt many pickles under the same key without repeating the key
+ * derivation for each one.
+ */
+struct _olm_enc_context {
+    struct _olm_cipher_aes_sha_256_context cipher_context;
+    struct _olm_aes_gcm_key gcm_key;
+};
+
+/** Derive the keys for the pickle key given. */
+void _olm_enc_context_init(
+    uint8_t const * key, size_t key_length,
+    struct _olm_enc_context * context
+);
+
+/**
+ * Derive only the AES-SHA-256 keys for the pickle key given, for a context
+ * used once on pickles known not to be AES-GCM, which saves the second key
+ * derivation.
+ */
+void _olm_enc_context_init_aes_sha_256(
+    uint8_t const * key, size_t key_length,
+    struct _olm_enc_context * context
+);
+
+/** Wipe the keys held by the context */
+void _olm_enc_context_clear(struct _olm_enc_context * context);
+
+/** As _olm_enc_output, but using the keys held by the context */
+size_t _olm_enc_output_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t *pickle, size_t raw_length
+);
+
+/** As _olm_enc_input, but using the keys held by the context */
+size_t _olm_enc_input_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t * input, size_t b64_length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * As _olm_enc_input, but only decrypting enough of the pickle to cover its
+ * first prefix_length bytes. The MAC is still checked over the whole pickle,
+ * so the prefix is just as authenticated, but the rest of it is left
+ * encrypted in the buffer.
+ *
+ * Returns the number of bytes decrypted, which is at least prefix_length
+ * unless the whole pickle is shorter than that, or olm_error() on error, in
+ * which case *last_error will be updated, if last_error is non-NULL.
+ */
+size_t _olm_enc_input_prefix(
+    uint8_t const * key, size_t key_length,
+    uint8_t * input, size_t b64_length, size_t prefix_length,
+    enum OlmErrorCode * last_error
+);
+
+/** What an OlmPickleKey points to */
+struct OlmPickleKey {
+    struct _olm_enc_context context;
+};
+
+/**
+ * Get the number of bytes needed for a binary pickle of the length given.
+ * A binary pickle is encrypted and authenticated in the same way as an
+ * encoded one, but isn't base64 encoded.
+ */
+size_t _olm_enc_output_binary_length(size_t raw_length);
+
+/**
+ * Encrypt the given pickle in-situ, without encoding it.
+ *
+ * The raw pickle should have been written to the start of the buffer, which
+ * must have room for _olm_enc_output_binary_length(raw_length) bytes.
+ *
+ * Returns the number of bytes in the binary pickle.
+ */
+size_t _olm_enc_output_binary(
+    uint8_t const * key, size_t key_length,
+    uint8_t *pickle, size_t raw_length
+);
+
+/**
+ * Decrypt the given binary pickle in-situ.
+ *
+ * Returns the number of bytes in the decrypted pickle, or olm_error() on
+ * error, in which case *last_error will be updated, if last_error is non-NULL.
+ */
+size_t _olm_enc_input_binary(
+    uint8_t const * key, size_t key_length,
+    uint8_t * input, size_t length,
+    enum OlmErrorCode * last_error
+);
+
+/** As _olm_enc_output_binary, but using the keys held by the context */
+size_t _olm_enc_output_binary_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t *pickle, size_t raw_length
+);
+
+/** As _olm_enc_input_binary, but using the keys held by the context */
+size_t _olm_enc_input_binary_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t * input, size_t length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * Encrypt the raw pickle of raw_length bytes as a binary pickle, the same as
+ * _olm_enc_output_binary_with_context would write, passing it to write a
+ * piece at a time, so that the binary pickle is never held in memory. The
+ * raw pickle is left as it was.
+ *
+ * Returns the number of bytes written, or olm_error() if write failed, in
+ * which case *last_error will be set to OLM_PICKLE_STREAM_FAILED, if
+ * last_error is non-NULL.
+ */
+size_t _olm_enc_output_binary_stream(
+    const struct _olm_enc_context * context,
+    uint8_t const * raw, size_t raw_length,
+    OlmPickleWriter write, void * write_context,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * Read a binary pickle of input_length bytes, or up to the end of the
+ * input if input_length is olm_error(), a piece at a time from read, and
+ * decrypt it into the max_raw_length bytes at raw, checking the MAC as it
+ * goes. The number of bytes read is written to *read_length, if
+ * read_length is non-NULL.
+ *
+ * Returns the number of bytes in the decrypted pickle, or olm_error() on
+ * error, in which case whatever was decrypted into raw is wiped, and
+ * *last_error will be updated, if last_error is non-NULL: to
+ * OLM_OUTPUT_BUFFER_TOO_SMALL if the pickle doesn't fit in max_raw_length
+ * bytes, and to OLM_PICKLE_STREAM_FAILED if read failed.
+ */
+size_t _olm_enc_input_binary_stream(
+    const struct _olm_enc_context * context,
+    OlmPickleReader read, void * read_context, size_t input_length,
+    uint8_t * raw, size_t max_raw_length, size_t * read_length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * As _olm_enc_input_binary, but decrypting the length bytes of input into
+ * the output, which must have room for length bytes, and leaving the input
+ * as it is.
+ */
+size_t _olm_enc_input_binary_const(
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t length,
+    uint8_t * output, size_t max_output_length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * A pickle with a header is marked by a first character which isn't base64,
+ * followed by the base64 of the header, the encrypted pickle and the MAC. The
+ * header isn't encrypted, so it can be read without the key, but the MAC
+ * covers it. Headers must be a multiple of three bytes long, so that their
+ * base64 ends where the pickle's starts.
+ */
+#define OLM_PICKLE_HEADER_MARKER '!'
+
+/**
+ * Every header starts with a format byte and a byte for the kind of object
+ * pickled, which together give the header's length, so that a pickle can be
+ * re-keyed without loading the object.
+ *
+ * An inbound group session's header goes on with the pickle version, the
+ * first known index and the session ID.
+ */
+#define OLM_PICKLE_HEADER_FORMAT 1
+#define OLM_PICKLE_HEADER_KIND_INBOUND_GROUP_SESSION 1
+#define OLM_PICKLE_HEADER_INBOUND_GROUP_SESSION_LENGTH \
+    (2 + 4 + 4 + ED25519_PUBLIC_KEY_LENGTH)
+
+/**
+ * Get the number of bytes needed to encode a pickle of the length given with
+ * a header of the length given
+ */
+size_t _olm_enc_output_with_header_length(
+    size_t header_length, size_t raw_length
+);
+
+/**
+ * Get the point in the output buffer that the header should be written to,
+ * followed immediately by the raw pickle.
+ */
+uint8_t * _olm_enc_output_with_header_pos(
+    uint8_t * output, size_t header_length, size_t raw_length
+);
+
+/**
+ * Encrypt the pickle and encode it with its header in-situ. The header and
+ * the raw pickle should have been written to _olm_enc_output_with_header_pos.
+ *
+ * Returns the number of bytes in the encoded pickle.
+ */
+size_t _olm_enc_output_with_header(
+    const struct _olm_enc_context * context,
+    uint8_t * output, size_t header_length, size_t raw_length
+);
+
+/** Whether the encoded pickle given has a header */
+int _olm_enc_has_header(uint8_t const * input, size_t b64_length);
+
+/**
+ * Decode and decrypt a pickle with a header in-situ. Afterwards the header is
+ * at the start of the buffer, and the decrypted pickle follows it.
+ *
+ * Returns the number of bytes in the decrypted pickle, not counting the
+ * header, or olm_error() on error, in which case *last_error will be
+ * updated, if last_error is non-NULL.
+ */
+size_t _olm_enc_input_with_header(
+    const struct _olm_enc_context * context,
+    uint8_t * input, size_t b64_length, size_t header_length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * Decode the header of an encoded pickle without decrypting the pickle. The
+ * header isn't authenticated until the pickle is decrypted.
+ *
+ * Returns header_length, or olm_error() if the pickle has no header.
+ */
+size_t _olm_enc_peek_header(
+    uint8_t const * input, size_t b64_length,
+    uint8_t * header, size_t header_length
+);
+
+/**
+ * A pickle encrypted with AES-256-GCM rather than AES-CBC and HMAC-SHA-256
+ * is marked by a first character which is neither base64 nor
+ * OLM_PICKLE_HEADER_MARKER, followed by the base64 of a random nonce, the
+ * encrypted pickle and the tag. Its key is derived from the pickle key
+ * separately from the AES-CBC and HMAC keys.
+ */
+#define OLM_PICKLE_GCM_MARKER '~'
+
+/**
+ * Get the number of bytes needed to encode a pickle of the length given with
+ * AES-GCM
+ */
+size_t _olm_enc_output_gcm_length(size_t raw_length);
+
+/**
+ * Get the point in the output buffer that the raw pickle should be written
+ * to for _olm_enc_output_gcm.
+ */
+uint8_t * _olm_enc_output_gcm_pos(uint8_t * output, size_t raw_length);
+
+/**
+ * Encrypt the pickle with AES-GCM and encode it in-situ, under a nonce from
+ * olm_random_fill(). The raw pickle should have been written to
+ * _olm_enc_output_gcm_pos.
+ *
+ * Returns the number of bytes in the encoded pickle, or olm_error() if there
+ * were no random bytes for the nonce, in which case *last_error will be set
+ * to OLM_RANDOM_UNAVAILABLE, if last_error is non-NULL.
+ */
+size_t _olm_enc_output_gcm(
+    const struct _olm_enc_context * context,
+    uint8_t * output, size_t raw_length,
+    enum OlmErrorCode * last_error
+);
+
+/** Whether the encoded pickle given was encrypted with AES-GCM */
+int _olm_enc_is_gcm(uint8_t const * input, size_t b64_length);
+
+/**
+ * Get the number of bytes needed to encode a pickle of the length given with
+ * the OLM_PICKLE_CIPHER_* given. Any cipher but OLM_PICKLE_CIPHER_AES_GCM is
+ * counted as OLM_PICKLE_CIPHER_AES_SHA_256.
+ */
+size_t _olm_enc_output_with_cipher_length(uint32_t cipher, size_t raw_length);
+
+/**
+ * Get the point in the output buffer that the raw pickle should be written to
+ * for _olm_enc_output_with_cipher.
+ */
+uint8_t * _olm_enc_output_with_cipher_pos(
+    uint32_t cipher, uint8_t * output, size_t raw_length
+);
+
+/**
+ * Encrypt and encode the pickle in-situ with the OLM_PICKLE_CIPHER_* given,
+ * under the keys held by the context.
+ *
+ * Returns the number of bytes in the encoded pickle, or olm_error() on error,
+ * in which case *last_error will be updated, if last_error is non-NULL: to
+ * OLM_UNKNOWN_PICKLE_VERSION if the cipher isn't one we know, and otherwise
+ * as for _olm_enc_output_gcm. The raw pickle is wiped on error.
+ */
+size_t _olm_enc_output_with_cipher(
+    const struct _olm_enc_context * context, uint32_t cipher,
+    uint8_t * output, size_t raw_length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * Get the number of bytes needed for a batch of count binary pickles which
+ * are pickles_length bytes long in all.
+ */
+size_t _olm_batch_length(size_t count, size_t pickles_length);
+
+/**
+ * Write the header of a batch of count pickles. Returns where the first
+ * entry should be written.
+ */
+uint8_t * _olm_batch_write_header(uint8_t * pos, size_t count);
+
+/**
+ * Write the length of the next entry in a batch. Returns where its binary
+ * pickle should be written.
+ */
+uint8_t * _olm_batch_write_entry(uint8_t * pos, size_t pickle_length);
+
+/** Walks the entries of a batch of pickles */
+struct _olm_batch_reader {
+    uint8_t * pos;
+    uint8_t * end;
+    size_t remaining;
+};
+
+/**
+ * Start reading the batch. Returns the number of entries in it, or
+ * olm_error() if it doesn't have a batch header, in which case *last_error
+ * will be updated, if last_error is non-NULL.
+ */
+size_t _olm_batch_reader_init(
+    struct _olm_batch_reader * reader,
+    uint8_t * batch, size_t batch_length,
+    enum OlmErrorCode * last_error
+);
+
+/**
+ * Get the binary pickle in the next entry of the batch and its length.
+ * Returns NULL if there are no more entries or the entry is truncated.
+ */
+uint8_t * _olm_batch_reader_next(
+    struct _olm_batch_reader * reader,
+    size_t * pickle_length
+);
+
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,156 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef OLM_PICKLE_KEY_H_
+#define OLM_PICKLE_KEY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/executor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The keys derived from a pickle key. Pickling or unpickling an object
+ * derives an AES key, an HMAC key and an IV from the pickle key each time;
+ * a pickle key object does that once so that a whole batch of objects can be
+ * pickled or unpickled under it.
+ *
+ * A pickle key isn't changed by the functions it is passed to, so several
+ * threads can use the same one at once.
+ */
+typedef struct OlmPickleKey OlmPickleKey;
+
+/** Writes the next length bytes of a pickle being streamed out, for
+ * instance to a file or a socket. Returns 0 on success, or non-zero if they
+ * couldn't be written, which stops the pickling. */
+typedef int (*OlmPickleWriter)(
+    void * context, void const * data, size_t length
+);
+
+/** Reads up to max_length more bytes of a pickle being streamed in into
+ * data. Returns the number of bytes read, which may be fewer than asked for
+ * and is 0 only at the end of the pickle, or olm_error() if they couldn't be
+ * read, which stops the unpickling. */
+typedef size_t (*OlmPickleReader)(
+    void * context, void * data, size_t max_length
+);
+
+/** The ciphers that the olm_pickle_*_with_key() functions can encrypt a
+ * pickle with. Whichever one was used, the olm_unpickle_*() functions tell
+ * from the pickle itself. */
+
+/** AES-256-CBC and HMAC-SHA-256, as olm_pickle_session() and the others use.
+ * Every version of the library can load these pickles. */
+#define OLM_PICKLE_CIPHER_AES_SHA_256 0
+
+/** AES-256-GCM under a random nonce, which only takes a single pass over
+ * the pickle, and is several times faster where the CPU has AES and
+ * carry-less multiply instructions. Pickling takes the nonce from
+ * olm_random_fill(). Only versions of the library from this one on can load
+ * these pickles, so they should only be used for storage that older ones
+ * won't read. */
+#define OLM_PICKLE_CIPHER_AES_GCM 1
+
+/** The size of a pickle key object in bytes */
+size_t olm_pickle_key_size(void);
+
+/** Initialise a pickle key object using the supplied memory, which must be
+ * at least olm_pickle_key_size() bytes, deriving its keys from the
+ * key_length bytes of key. */
+OlmPickleKey * olm_pickle_key(
+    void * memory,
+    void const * key, size_t key_length
+);
+
+/** Clears the memory used to back this pickle key */
+size_t olm_clear_pickle_key(
+    OlmPickleKey * pickle_key
+);
+
+/**
+ * Check that a pickle written under the key by one of the olm_pickle_*()
+ * functions hasn't been corrupted or altered since, without loading it: only
+ * the pickle's MAC, or its tag if it was pickled with
+ * OLM_PICKLE_CIPHER_AES_GCM, is checked, and nothing is decrypted. The pickle
+ * is left as it is. This is for scanning stored pickles for damage, and
+ * costs a fraction of unpickling them.
+ *
+ * Returns 0 if the pickle is intact, or olm_error() if it isn't.
+ */
+size_t olm_pickle_verify(
+    OlmPickleKey const * pickle_key,
+    void const * pickled, size_t pickled_length
+);
+
+/**
+ * Check count pickles written under the same key, as by
+ * olm_pickle_verify(). If errors is non-NULL, errors[i] is set to "SUCCESS"
+ * for each pickle which is intact, and otherwise to "BAD_ACCOUNT_KEY" if its
+ * MAC or tag doesn't match, or to "INVALID_BASE64" or "CORRUPTED_PICKLE" if
+ * it isn't a pickle at all.
+ *
+ * Returns the number of pickles which aren't intact.
+ */
+size_t olm_pickle_verify_batch(
+    OlmPickleKey const * pickle_key, size_t count,
+    void const * const * pickled, size_t const * pickled_lengths,
+    const char ** errors
+);
+
+/**
+ * Re-encrypt count pickles under new_key, for instance when the pickle key
+ * is changed, without loading the objects: each pickle is decrypted and
+ * encrypted again in place, and keeps its length and its cipher. Pickles
+ * encrypted with OLM_PICKLE_CIPHER_AES_GCM get new nonces from
+ * olm_random_fill().
+ *
+ * errors[i] is set to "SUCCESS" for each pickle which was re-keyed. A pickle
+ * which wasn't is left as it was, and errors[i] says why: as for
+ * olm_pickle_verify_batch(), "UNKNOWN_PICKLE_VERSION" if it has a header
+ * this version doesn't know, or "RANDOM_UNAVAILABLE".
+ *
+ * If executor is non-NULL, the pickles are shared out between jobs run on
+ * it. Returns the number of pickles which weren't re-keyed.
+ */
+size_t olm_pickle_rekey_batch(
+    OlmPickleKey const * old_key, OlmPickleKey const * new_key,
+    size_t count,
+    void * const * pickles, size_t const * pickle_lengths,
+    const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+);
+
+/**
+ * The number of objects in a batch written by one of the
+ * olm_pickle_*_batch() functions. Returns olm_error() if the input isn't a
+ * complete batch.
+ *
+ * A batch is a version number and a count of objects, followed by each
+ * object's binary pickle preceded by its length. Each pickle is encrypted
+ * and authenticated separately, so a batch can be loaded in parts, and only
+ * the parts being loaded are changed by loading them.
+ */
+size_t olm_pickle_batch_count(
+    void const * batch, size_t batch_length
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_PICKLE_KEY_H_ */
@@ -0,0 +1,199 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Pools of memory for olm objects and buffers, so that callers can avoid the
+ * general purpose heap. The pools live in memory supplied by the caller;
+ * the library itself still never allocates. */
+
+#ifndef OLM_POOL_H_
+#define OLM_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/executor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A source of memory. allocate returns length bytes aligned for any olm
+ * object, or NULL if it can't. release gives back memory from allocate,
+ * along with the length it was allocated with. Both are passed context.
+ */
+typedef struct OlmAllocator {
+    void * (*allocate)(void * context, size_t length);
+    void (*release)(void * context, void * memory, size_t length);
+    void * context;
+} OlmAllocator;
+
+typedef struct OlmSlab OlmSlab;
+typedef struct OlmArena OlmArena;
+
+/** The number of bytes needed for a slab of slot_count slots which can each
+ * hold slot_size bytes */
+size_t olm_slab_size(size_t slot_size, size_t slot_count);
+
+/** Initialise a slab of slot_count slots of slot_size bytes in the supplied
+ * memory, which must be at least olm_slab_size(slot_size, slot_count)
+ * bytes. All the slots start out free. */
+OlmSlab * olm_slab(void * memory, size_t slot_size, size_t slot_count);
+
+/** Take a free slot from the slab. The slot is zeroed. Returns NULL if
+ * there are no free slots. */
+void * olm_slab_allocate(OlmSlab * slab);
+
+/** Wipe a slot and give it back to the slab. Returns olm_error() if slot
+ * isn't a slot of the slab that is in use. */
+size_t olm_slab_release(OlmSlab * slab, void * slot);
+
+/** The number of slots in use */
+size_t olm_slab_slots_in_use(const OlmSlab * slab);
+
+/** Fill in an allocator that takes slots from the slab. It can't allocate
+ * more than the slot size. */
+void olm_slab_allocator(OlmSlab * slab, OlmAllocator * allocator);
+
+/** Ask olm_slab_map() for the slab to be backed by huge pages, which are 2
+ * MB on most systems, so that random access across a very large slab
+ * doesn't miss the TLB on nearly every slot. */
+#define OLM_SLAB_HUGE_PAGES 1
+
+/** What the memory of a slab is */
+enum OlmSlabBacking {
+    /** Memory the caller gave to olm_slab() */
+    OLM_SLAB_CALLER_MEMORY = 0,
+    /** Ordinary pages from olm_slab_map() */
+    OLM_SLAB_NORMAL_PAGES = 1,
+    /** Pages from olm_slab_map() which the kernel has been asked to back
+     * with transparent huge pages when it can */
+    OLM_SLAB_TRANSPARENT_HUGE_PAGES = 2,
+    /** Huge pages from the system's reserved pool, such as MAP_HUGETLB */
+    OLM_SLAB_RESERVED_HUGE_PAGES = 3,
+};
+
+/** Map the memory for a slab of slot_count slots of slot_size bytes
+ * straight from the operating system and initialise it, for slabs too big
+ * to want from the heap. flags is 0 or OLM_SLAB_HUGE_PAGES. Huge pages are
+ * taken from the reserved pool if there are enough, and otherwise the
+ * kernel is asked for transparent huge pages; if neither is supported the
+ * slab has ordinary pages. Returns NULL if the memory can't be mapped.
+ * Release the slab with olm_slab_unmap(). */
+OlmSlab * olm_slab_map(size_t slot_size, size_t slot_count, unsigned flags);
+
+/** As olm_slab_map(), but with the slab's pages on NUMA node node where the
+ * system supports it, for slabs used by threads pinned to that node. The
+ * node is a preference: if it is full, or the system won't place memory,
+ * the pages come from wherever the kernel decides. node may be
+ * OLM_ANY_NUMA_NODE. */
+OlmSlab * olm_slab_map_on_node(
+    size_t slot_size, size_t slot_count, unsigned flags, int node
+);
+
+/** Wipe the slots still in use in a slab from olm_slab_map() and give its
+ * memory back to the operating system. Returns the number of bytes that
+ * were mapped, or olm_error() if the slab wasn't made by olm_slab_map(). */
+size_t olm_slab_unmap(OlmSlab * slab);
+
+/** Map length bytes of zeroed memory straight from the operating system,
+ * with its pages on NUMA node node where the system supports it, as for
+ * olm_slab_map_on_node(). This is for the memory of objects that take any
+ * buffer, such as a group session store whose sessions are decrypted by
+ * threads on that node. Returns NULL if the memory can't be mapped. */
+void * olm_map_memory(size_t length, int node);
+
+/** Give back memory from olm_map_memory(), with the length it was mapped
+ * with. It isn't wiped, so clear any olm objects in it first. */
+void olm_unmap_memory(void * memory, size_t length);
+
+/** How full a slab is and has been */
+typedef struct OlmSlabStats {
+    /** The bytes in each slot, after rounding up for alignment */
+    size_t slot_size;
+    size_t slot_count;
+    size_t slots_in_use;
+    /** The most slots that have been in use at once */
+    size_t peak_slots_in_use;
+    /** The number of allocations refused because every slot was in use */
+    size_t failed_allocations;
+    /** The bytes of memory behind the slab: what was mapped, or
+     * olm_slab_size() for caller memory */
+    size_t memory_length;
+    enum OlmSlabBacking backing;
+} OlmSlabStats;
+
+/** Fill in the statistics of a slab */
+void olm_slab_stats(const OlmSlab * slab, OlmSlabStats * stats);
+
+/** The number of bytes needed for an arena which can hand out capacity
+ * bytes */
+size_t olm_arena_size(size_t capacity);
+
+/** Initialise an arena in the supplied memory, which must be at least
+ * olm_arena_size(capacity) bytes. An arena hands out temporary buffers,
+ * such as those for the messages and plaintexts of one call, and takes them
+ * all back at once. */
+OlmArena * olm_arena(void * memory, size_t capacity);
+
+/** Take length bytes from the arena. Returns NULL if there isn't room. */
+void * olm_arena_allocate(OlmArena * arena, size_t length);
+
+/** Wipe everything taken from the arena and make it all available again.
+ * Returns the number of bytes that had been taken. */
+size_t olm_arena_reset(OlmArena * arena);
+
+/** Fill in an allocator that takes memory from the arena. Releasing memory
+ * does nothing until the arena is reset. */
+void olm_arena_allocator(OlmArena * arena, OlmAllocator * allocator);
+
+/**
+ * An output buffer which the *_to_buffer() functions fill with memory from
+ * an allocator, so that the caller needn't ask for the length of the output
+ * first. Start it zeroed, as with OLM_BUFFER_INIT. A buffer can be passed to
+ * any number of calls, each of which overwrites what the last one left and
+ * only takes new memory when it needs more than capacity bytes; release it
+ * with olm_buffer_release() when done.
+ */
+typedef struct OlmBuffer {
+    /** The output of the last call, or NULL if there is no memory yet */
+    uint8_t * data;
+    /** The number of bytes of output in data */
+    size_t length;
+    /** The number of bytes data was allocated with */
+    size_t capacity;
+    /** The allocator data came from */
+    const OlmAllocator * allocator;
+} OlmBuffer;
+
+#define OLM_BUFFER_INIT { NULL, 0, 0, NULL }
+
+/** Make sure the buffer has room for length bytes, taking memory from the
+ * allocator if it hasn't. Memory it had before is wiped and given back to
+ * the allocator it came from. The length of the output is set to 0. Returns
+ * olm_error() if the allocator has no memory, leaving the buffer empty. */
+size_t olm_buffer_reserve(
+    OlmBuffer * buffer, const OlmAllocator * allocator, size_t length
+);
+
+/** Wipe the buffer's memory and give it back to its allocator, leaving the
+ * buffer empty */
+void olm_buffer_release(OlmBuffer * buffer);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_POOL_H_ */
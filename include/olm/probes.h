@@ -0,0 +1,54 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Static probes in the "olm" provider, for following the library with
+ * bpftrace, SystemTap or DTrace. They are only compiled in if the library is
+ * built with OLM_USDT defined (make OLM_USDT=1), which needs <sys/sdt.h>.
+ * A probe which nothing is attached to is a single nop.
+ *
+ * The probes are passed lengths, indices, counts and results, never keys,
+ * messages or anything else the library works on. Without OLM_USDT the
+ * arguments are not evaluated. */
+
+#ifndef OLM_PROBES_H_
+#define OLM_PROBES_H_
+
+#ifdef OLM_USDT
+
+#include <sys/sdt.h>
+
+#define OLM_PROBE1(name, a) DTRACE_PROBE1(olm, name, a)
+#define OLM_PROBE2(name, a, b) DTRACE_PROBE2(olm, name, a, b)
+#define OLM_PROBE3(name, a, b, c) DTRACE_PROBE3(olm, name, a, b, c)
+
+#else
+
+/* sizeof so that variables only passed to probes still count as used */
+#define OLM_PROBE1(name, a) ((void)sizeof(a))
+#define OLM_PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define OLM_PROBE3(name, a, b, c) \
+    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+
+#endif /* OLM_USDT */
+
+/** Which object a pickle or unpickle probe is for */
+enum OlmProbeObject {
+    OLM_PROBE_ACCOUNT = 0,
+    OLM_PROBE_SESSION = 1,
+    OLM_PROBE_INBOUND_GROUP = 2,
+    OLM_PROBE_OUTBOUND_GROUP = 3,
+};
+
+#endif /* OLM_PROBES_H_ */
@@ -0,0 +1,55 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A random generator kept by the library, for the *_auto_random variants of
+ * the functions which take random bytes, so that callers needn't fetch and
+ * copy random bytes for every call.
+ *
+ * The generator is AES-256 in OFB mode, keyed from the operating system
+ * (getrandom, arc4random_buf, getentropy or BCryptGenRandom) and rekeyed
+ * from its own output every time it refills its buffer, so that the state
+ * never reveals what it has already handed out. It goes back to the
+ * operating system for a new key after every megabyte, and after a fork.
+ * Each thread has its own generator. */
+
+#ifndef OLM_RANDOM_H_
+#define OLM_RANDOM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Whether the library has a source of random bytes on this platform: 1 if
+ * it has, 0 if the *_auto_random functions will always fail */
+int olm_random_available(void);
+
+/** Fill the buffer with random bytes from the calling thread's generator.
+ * Returns length, or olm_error() if the operating system couldn't supply a
+ * key, when the buffer is wiped. */
+size_t olm_random_fill(void * buffer, size_t length);
+
+/** Wipe the calling thread's generator, so that it takes a new key from the
+ * operating system the next time it is used. Threads which have used the
+ * generator should call this before they exit. */
+void olm_random_clear(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_RANDOM_H_ */
@@ -12,17 +12,24 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#ifndef OLM_RATCHET_HH_
+#define OLM_RATCHET_HH_
 
 #include <cstdint>
 
+#include "olm/cipher.h"
 #include "olm/crypto.h"
 #include "olm/list.hh"
+#include "olm/indexed_list.hh"
 #include "olm/error.h"
+#include "olm/pool.h"
 
 struct _olm_cipher;
 
 namespace olm {
 
+struct MessageReader;
+
 /** length of a shared key: the root key R(i), chain key C(i,j), and message key
  * M(i,j)). They are all only used to stuff into HMACs, so could be any length
  * for that. The chain key and message key are both derived from SHA256
@@ -48,20 +55,171 @@ struct SenderChain {
 };
 
 
+/** How a receiver chain has changed since the ratchet was last pickled, so
+ * that a delta pickle can carry just the chains that changed. */
+enum struct ChainChange : std::uint8_t {
+    NONE = 0,
+    UPDATED = 1,
+    ADDED = 2,
+};
+
+
 struct ReceiverChain {
     _olm_curve25519_public_key ratchet_key;
     ChainKey chain_key;
+    /** Not pickled. */
+    ChainChange change;
 };
 
 
 struct SkippedMessageKey {
     _olm_curve25519_public_key ratchet_key;
     MessageKey message_key;
+    /** Whether the key was added since the ratchet was last pickled. Keys
+     * are always added as the newest, so the added keys are the newest few.
+     * Not pickled. */
+    bool added;
+};
+
+
+/** A run of messages skipped over on a receiver chain, kept as the chain
+ * key for the first of them so that their message keys are only derived
+ * for the messages that arrive. */
+struct SkippedChainRange {
+    _olm_curve25519_public_key ratchet_key;
+    /** The chain key for the first message of the range. */
+    ChainKey start;
+    /** The index after the last message of the range. */
+    std::uint32_t end;
 };
 
 
+/** The limits a session is given unless it is created with others. */
 static std::size_t const MAX_RECEIVER_CHAINS = 5;
 static std::size_t const MAX_SKIPPED_MESSAGE_KEYS = 40;
+static std::size_t const MAX_MESSAGE_GAP = 2000;
+
+/** The most skipped message keys a ratchet can keep. */
+static std::size_t const SKIPPED_MESSAGE_KEYS_LIMIT = INDEXED_LIST_LIMIT;
+
+/** The most ranges of skipped messages a ratchet keeps. */
+static std::size_t const MAX_SKIPPED_RANGES = 4;
+
+
+struct RatchetLimits {
+    /** The number of receiver chains kept for out of order messages. */
+    std::uint32_t max_receiver_chains;
+    /** The number of skipped message keys kept for out of order messages. */
+    std::uint32_t max_skipped_message_keys;
+    /** The furthest ahead of a chain a message can be. */
+    std::uint32_t max_message_gap;
+};
+
+static RatchetLimits const DEFAULT_RATCHET_LIMITS = {
+    MAX_RECEIVER_CHAINS, MAX_SKIPPED_MESSAGE_KEYS, MAX_MESSAGE_GAP
+};
+
+
+/** Which skipped message keys a ratchet throws away after decrypting a
+ * message, short of its limits. Zero means no bound. Not pickled. */
+struct SkippedKeyEviction {
+    /** How many ratchet steps old a key's chain may be: keys are kept for
+     * the newest max_age receiver chains only. */
+    std::uint32_t max_age;
+    /** The most keys kept, the oldest going first. */
+    std::uint32_t max_count;
+};
+
+
+/** The hash a skipped message key is indexed under. */
+std::uint32_t skipped_message_key_hash(
+    std::uint8_t const * ratchet_key, std::uint32_t index
+);
+
+struct SkippedMessageKeyTraits {
+    static std::uint32_t hash(SkippedMessageKey const & value) {
+        return skipped_message_key_hash(
+            value.ratchet_key.public_key, value.message_key.index
+        );
+    }
+};
+
+/** The message keys we've skipped over, newest first, indexed on the ratchet
+ * key and message index. */
+typedef IndexedList<SkippedMessageKey, SkippedMessageKeyTraits>
+    SkippedMessageKeys;
+
+
+/** The most skipped message keys that were there when a ratchet was last
+ * pickled that it remembers removing. If more are removed the next delta
+ * pickle carries the whole list instead. */
+static std::size_t const MAX_REMOVED_SKIPPED_KEYS = 8;
+
+struct SkippedMessageKeyId {
+    _olm_curve25519_public_key ratchet_key;
+    std::uint32_t index;
+};
+
+/** The changes to a ratchet since it was last pickled, besides those marked
+ * on its receiver chains and skipped message keys. */
+struct RatchetChanges {
+    bool root_key;
+    bool sender_chain;
+    /** Set if more skipped keys were removed than removed can hold. */
+    bool skipped_message_keys;
+    std::uint32_t removed_count;
+    SkippedMessageKeyId removed[MAX_REMOVED_SKIPPED_KEYS];
+    /** Set if the skipped ranges changed. */
+    bool skipped_ranges;
+};
+
+
+/** The chain keys found while checking a message further along a chain, so
+ * that committing the message doesn't have to walk the chain again. */
+struct ChainAdvance {
+    /** The chain key for the oldest skipped message whose key will fit in
+     * the skipped message keys. The keys for any earlier messages would be
+     * pushed straight back out, so they are never derived. */
+    ChainKey first_kept;
+    /** The chain key for the message itself. */
+    ChainKey current;
+};
+
+enum struct DecryptTrialKind : std::uint8_t {
+    /** Nothing has been tried, or it has been committed */
+    NONE = 0,
+    /** The message was decrypted with one of the skipped message keys */
+    SKIPPED_KEY = 1,
+    /** The message is on one of the receiver chains */
+    EXISTING_CHAIN = 2,
+    /** The message starts a new receiver chain */
+    NEW_CHAIN = 3,
+    /** The message is in one of the skipped ranges */
+    SKIPPED_RANGE = 4,
+};
+
+/** What decrypting a message would change in a ratchet, found by
+ * Ratchet::try_decrypt() so that Ratchet::commit_decrypt() can make the
+ * change without deriving the keys or checking the MAC again. */
+struct DecryptTrial {
+    DecryptTrialKind kind;
+    /** Why the message couldn't be decrypted */
+    OlmErrorCode last_error;
+    _olm_curve25519_public_key ratchet_key;
+    std::uint32_t counter;
+    /** The skipped key the message was decrypted with, for SKIPPED_KEY */
+    MessageKey message_key;
+    /** Where the receiver chain was when the message was tried, for
+     * EXISTING_CHAIN, or where its skipped range starts, for
+     * SKIPPED_RANGE */
+    std::uint32_t chain_index;
+    /** The root key the new chain was derived from, and the new root key
+     * and chain, for NEW_CHAIN */
+    SharedKey root_key;
+    SharedKey new_root_key;
+    ChainKey new_chain_key;
+    ChainAdvance advance;
+};
 
 
 struct KdfInfo {
@@ -72,22 +230,83 @@ struct KdfInfo {
 };
 
 
+/** Which protocol a ratchet speaks: the strings fed into its KDFs and the
+ * cipher for its messages. A ratchet keeps this rather than pointers to
+ * them, so that the pointers are looked up when they are needed and a
+ * ratchet's memory holds nothing that only means something in one process.
+ * Pickles don't carry it; there is only Olm's. */
+enum struct RatchetProtocol : std::uint8_t {
+    OLM_V1 = 0,
+};
+
+/** The strings fed into the KDFs of a ratchet speaking the protocol */
+KdfInfo const & protocol_kdf_info(RatchetProtocol protocol);
+
+/** The AEAD cipher messages of a ratchet speaking the protocol use */
+_olm_cipher const * protocol_cipher(RatchetProtocol protocol);
+
+
 struct Ratchet {
 
+    /** Create a ratchet keeping its receiver chains and skipped message keys
+     * in storage, which must be at least storage_length(limits) bytes and
+     * aligned for a std::uint64_t. The limits must have at least one
+     * receiver chain and at most SKIPPED_MESSAGE_KEYS_LIMIT skipped keys. */
+    Ratchet(
+        RatchetProtocol protocol,
+        RatchetLimits const & limits,
+        std::uint8_t * storage
+    );
+
+    /** Create a ratchet keeping its receiver chains in storage, which must
+     * be at least receiver_chain_storage_length(limits) bytes and aligned
+     * for a std::uint64_t, and keeping its skipped message keys out of line,
+     * in memory taken from the allocator passed to the methods that may
+     * need it only while it has some. */
     Ratchet(
-        KdfInfo const & kdf_info,
-        _olm_cipher const *ratchet_cipher
+        RatchetProtocol protocol,
+        RatchetLimits const & limits,
+        std::uint8_t * storage,
+        bool skipped_keys_out_of_line
     );
 
+    /** The number of bytes of storage a ratchet with the given limits
+     * needs. */
+    static std::size_t storage_length(RatchetLimits const & limits);
+
+    /** The number of bytes of storage a ratchet whose skipped message keys
+     * are kept out of line needs. */
+    static std::size_t receiver_chain_storage_length(
+        RatchetLimits const & limits
+    );
+
+    /** The number of bytes a ratchet whose skipped message keys are kept out
+     * of line allocates for them. */
+    static std::size_t skipped_message_key_storage_length(
+        RatchetLimits const & limits
+    );
+
+    /** Which strings to feed into the KDF and which cipher to use for
+     * encrypting messages. */
+    RatchetProtocol protocol;
+
     /** A some strings identifying the application to feed into the KDF. */
-    KdfInfo const & kdf_info;
+    KdfInfo const & kdf_info() const {
+        return protocol_kdf_info(protocol);
+    }
 
     /** The AEAD cipher to use for encrypting messages. */
-    _olm_cipher const *ratchet_cipher;
+    _olm_cipher const * ratchet_cipher() const {
+        return protocol_cipher(protocol);
+    }
 
     /** The last error that happened encrypting or decrypting a message. */
     OlmErrorCode last_error;
 
+    /** How many chains and keys this ratchet keeps for out of order messages
+     * and how far ahead it will look for a message key. */
+    RatchetLimits limits;
+
     /** The root key is used to generate chain keys from the ephemeral keys.
      * A new root_key derived each time a new chain is started. */
     SharedKey root_key;
@@ -100,11 +319,91 @@ struct Ratchet {
     /** The receiver chain is used to decrypt received messages. We store the
      * last few chains so we can decrypt any out of order messages we haven't
      * received yet. */
-    List<ReceiverChain, MAX_RECEIVER_CHAINS> receiver_chains;
-
-    /** List of message keys we've skipped over when advancing the receiver
+    BufferList<ReceiverChain> receiver_chains;
+
+    /** The first eight bytes of the ratchet key of each receiver chain, in the
+     * same order as receiver_chains and kept together at the start of the
+     * ratchet's storage, just before the chains, so that finding the chain
+     * for a message compares a few integers before comparing whole keys. */
+    std::uint64_t * receiver_chain_fingerprints() {
+        return reinterpret_cast<std::uint64_t *>(receiver_chains.begin())
+            - limits.max_receiver_chains;
+    }
+    std::uint64_t const * receiver_chain_fingerprints() const {
+        return reinterpret_cast<std::uint64_t const *>(
+            receiver_chains.begin()
+        ) - limits.max_receiver_chains;
+    }
+
+    /** The message keys we've skipped over when advancing the receiver
      * chain. */
-    List<SkippedMessageKey, MAX_SKIPPED_MESSAGE_KEYS> skipped_message_keys;
+    SkippedMessageKeys skipped_message_keys;
+
+    /** Whether the skipped message keys are kept out of line, in memory from
+     * an allocator, rather than in the ratchet's storage. While there is no
+     * room allocated for them the list has no capacity. The ratchet finds
+     * its storage from offsets rather than pointers, so a ratchet and its
+     * storage can be moved together with memcpy; room allocated for skipped
+     * keys is pointed to, and stays where it is. */
+    bool skipped_keys_out_of_line;
+
+    /** Which skipped message keys to throw away early. */
+    SkippedKeyEviction skipped_key_eviction;
+
+    /** Runs of messages skipped over, newest first, kept as a chain key
+     * rather than as a key per message. Using a message from a range splits
+     * it in two. */
+    List<SkippedChainRange, MAX_SKIPPED_RANGES> skipped_ranges;
+
+    /** Gaps of at least this many messages are kept in skipped_ranges
+     * rather than as skipped message keys. Zero keeps every gap as keys.
+     * Not pickled. */
+    std::uint32_t skipped_range_threshold;
+
+    /** Throw away the skipped message keys and ranges that
+     * skipped_key_eviction says to, noting the keys as removed for the next
+     * delta pickle. */
+    void evict_skipped_message_keys();
+
+    /** The most skipped message keys the ratchet keeps, whether or not it
+     * has room for them yet. */
+    std::size_t skipped_message_key_capacity() const {
+        return limits.max_skipped_message_keys;
+    }
+
+    /** Make sure there is room for the skipped message keys, allocating it
+     * from allocator if they are kept out of line. Returns false if the
+     * allocator is nullptr or has no room. */
+    bool reserve_skipped_message_keys(OlmAllocator const * allocator);
+
+    /** Give back the out of line room for the skipped message keys to
+     * allocator, which must be the one it came from, if there aren't any.
+     * If force is set they are wiped and given back anyway. */
+    void release_skipped_message_keys(
+        OlmAllocator const * allocator, bool force = false
+    );
+
+    /** What has changed since the ratchet was last pickled. A new ratchet
+     * counts as entirely changed. */
+    RatchetChanges changes;
+
+    /** Start tracking changes afresh, after the ratchet has been pickled or
+     * unpickled. */
+    void forget_changes();
+
+    /** Set whenever anything the ratchet pickles changes. Unlike changes it
+     * isn't reset by pickling, only by unpickling or by the caller once the
+     * pickle has been stored. */
+    bool dirty;
+
+    /** Make this ratchet a copy of another with the same limits, keeping its
+     * own storage. If the skipped message keys are kept out of line, room
+     * for them is allocated from allocator if the other ratchet has any.
+     * Returns false, leaving this ratchet as it was, if the allocator has no
+     * room. */
+    bool copy_from(
+        Ratchet const & other, OlmAllocator const * allocator = nullptr
+    );
 
     /** Initialise the session using a shared secret and the public part of the
      * remote's first ratchet key */
@@ -121,9 +420,10 @@ struct Ratchet {
     );
 
     /** The number of bytes of output the encrypt method will write for
-     * a given message length. */
+     * a given message length, or, if ahead is set, for the message that many
+     * messages after the next one. */
     std::size_t encrypt_output_length(
-        std::size_t plaintext_length
+        std::size_t plaintext_length, std::uint32_t ahead = 0
     );
 
     /** The number of bytes of random data the encrypt method will need to
@@ -142,6 +442,51 @@ struct Ratchet {
         std::uint8_t * output, std::size_t max_output_length
     );
 
+    /** As encrypt, but with the new ephemeral key pair already generated
+     * rather than made from random bytes. The key pair is only used if
+     * encrypt_random_length() is non-zero, when the last_error will be
+     * NOT_ENOUGH_RANDOM if ratchet_key is NULL. */
+    std::size_t encrypt(
+        std::uint8_t const * plaintext, std::size_t plaintext_length,
+        _olm_curve25519_key_pair const * ratchet_key,
+        std::uint8_t * output, std::size_t max_output_length
+    );
+
+    /** Start the sending chain now, if encrypt_random_length() is non-zero,
+     * rather than when the next message is encrypted, so that the next
+     * encrypt only needs to derive a message key. Returns 0 or
+     * std::size_t(-1) with last_error NOT_ENOUGH_RANDOM if ratchet_key is
+     * NULL and a key is needed. Does nothing if the chain already exists. */
+    std::size_t prepare_send(
+        _olm_curve25519_key_pair const * ratchet_key
+    );
+
+    /** The keys for the next message on a sending chain, as taken by
+     * take_send_keys() for encrypt_with_keys(). */
+    struct SendKeys {
+        std::uint32_t index;
+        _olm_cipher_aes_sha_256_context cipher_keys;
+    };
+
+    /** Take the keys for the next message of each of count ratchets, moving
+     * their sending chains on, with the chain key HMACs and the cipher key
+     * derivations of the ratchets run side by side. Each sending chain must
+     * have been started, as by prepare_send(), and every ratchet must use
+     * the same aes_sha_256 cipher. The keys should be passed to
+     * encrypt_with_keys() and then wiped. */
+    static void take_send_keys(
+        Ratchet * const * ratchets, std::size_t count,
+        SendKeys * keys
+    );
+
+    /** As encrypt, but with keys from take_send_keys(). The last_error will
+     * be OUTPUT_BUFFER_TOO_SMALL if the output buffer is too small. */
+    std::size_t encrypt_with_keys(
+        std::uint8_t const * plaintext, std::size_t plaintext_length,
+        SendKeys const & keys,
+        std::uint8_t * output, std::size_t max_output_length
+    );
+
     /** An upper bound on the number of bytes of plain-text the decrypt method
      * will write for a given input message length. */
     std::size_t decrypt_max_plaintext_length(
@@ -155,10 +500,46 @@ struct Ratchet {
      * BAD_MESSAGE_VERSION if the message was encrypted with an unsupported
      * version of the protocol. The last_error will be BAD_MESSAGE_FORMAT if
      * the message headers could not be decoded. The last_error will be
-     * BAD_MESSAGE_MAC if the message could not be verified */
+     * BAD_MESSAGE_MAC if the message could not be verified. If the skipped
+     * message keys are kept out of line, room for them is taken from and
+     * given back to allocator. */
     std::size_t decrypt(
         std::uint8_t const * input, std::size_t input_length,
-        std::uint8_t * plaintext, std::size_t max_plaintext_length
+        std::uint8_t * plaintext, std::size_t max_plaintext_length,
+        OlmAllocator const * allocator = nullptr
+    );
+
+    /** As decrypt_max_plaintext_length() for a message whose headers have
+     * already been decoded with decode_message(). */
+    std::size_t decrypt_max_plaintext_length(
+        MessageReader const & reader
+    );
+
+    /** As decrypt() for a message whose headers have already been decoded
+     * with decode_message(). */
+    std::size_t decrypt(
+        MessageReader const & reader,
+        std::uint8_t * plaintext, std::size_t max_plaintext_length,
+        OlmAllocator const * allocator = nullptr
+    );
+
+    /** As decrypt(), but without changing the ratchet: what the message
+     * would change is kept in trial for commit_decrypt(). On failure the
+     * error is left in trial.last_error rather than last_error. */
+    std::size_t try_decrypt(
+        MessageReader const & reader,
+        std::uint8_t * plaintext, std::size_t max_plaintext_length,
+        DecryptTrial & trial
+    ) const;
+
+    /** Make the change a successful try_decrypt() found, wiping the trial.
+     * Returns false, leaving the ratchet as it was, if the ratchet has
+     * changed since in a way that the trial no longer fits, when last_error
+     * will be SESSION_CHANGED, or if there is no room for the skipped
+     * message keys, when it will be ALLOCATION_FAILED. The allocator is as
+     * for decrypt(). */
+    bool commit_decrypt(
+        DecryptTrial & trial, OlmAllocator const * allocator = nullptr
     );
 };
 
@@ -168,17 +549,74 @@ std::size_t pickle_length(
 );
 
 
+/** The longest pickle_length() can be for this ratchet, with its sender
+ * chain and as many receiver chains and skipped message keys as its limits
+ * allow. */
+std::size_t max_pickle_length(
+    Ratchet const & value
+);
+
+
 std::uint8_t * pickle(
     std::uint8_t * pos,
     Ratchet const & value
 );
 
 
+/** Room for skipped message keys kept out of line is taken from and given
+ * back to allocator. */
 std::uint8_t const * unpickle(
     std::uint8_t const * pos, std::uint8_t const * end,
     Ratchet & value,
-    bool includes_chain_index
+    bool includes_chain_index,
+    OlmAllocator const * allocator = nullptr
+);
+
+
+/** The length of the ratchet's skipped ranges when pickled. They are kept
+ * out of pickle() and pickle_delta(), whose formats older versions of the
+ * library can read, and a session only pickles them when it must. */
+std::size_t pickle_skipped_ranges_length(
+    Ratchet const & value
+);
+
+
+std::uint8_t * pickle_skipped_ranges(
+    std::uint8_t * pos,
+    Ratchet const & value
+);
+
+
+/** Replace the ratchet's skipped ranges with those pickled. */
+std::uint8_t const * unpickle_skipped_ranges(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    Ratchet & value
+);
+
+
+/** The length of a delta pickle of the changes to the ratchet since it was
+ * last pickled. */
+std::size_t pickle_delta_length(
+    Ratchet const & value
+);
+
+
+std::uint8_t * pickle_delta(
+    std::uint8_t * pos,
+    Ratchet const & value
+);
+
+
+/** Apply a delta pickle to the ratchet it was taken from, in the state it
+ * was in when the delta's changes began. The allocator is as for
+ * unpickle(). */
+std::uint8_t const * unpickle_delta(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    Ratchet & value,
+    OlmAllocator const * allocator = nullptr
 );
 
 
 } // namespace olm
+
+#endif /* OLM_RATCHET_HH_ */
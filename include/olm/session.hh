@@ -16,6 +16,7 @@
 #define OLM_SESSION_HH_
 
 #include "olm/ratchet.hh"
+#include "olm/message.hh"
 
 namespace olm {
 
@@ -26,19 +27,88 @@ enum struct MessageType {
     MESSAGE = 1,
 };
 
+/** A raw message with its headers decoded by Session::decode_message_view()
+ * so that it can be passed to several Session methods without decoding them
+ * again. It points into the message, which must outlive it. */
+struct MessageView {
+    MessageType type;
+    /** The outer headers of a PRE_KEY message */
+    PreKeyMessageReader pre_key;
+    /** The headers of a MESSAGE, or of the message in a PRE_KEY message */
+    MessageReader message;
+};
+
+/** The length of the hash of a session's state that a delta pickle is
+ * checked against. */
+static std::size_t const SESSION_STATE_HASH_LENGTH = 16;
+
+/** The length of a session's route: the identity key and base key of the
+ * session's creator followed by the one-time key it was created with. */
+static std::size_t const SESSION_ROUTE_LENGTH = 3 * CURVE25519_KEY_LENGTH;
+
 struct Session {
 
-    Session();
+    /** Create a session keeping its receiver chains and skipped message keys
+     * in storage, which must be at least storage_length(limits) bytes. */
+    Session(RatchetLimits const & limits, std::uint8_t * storage);
+
+    /** Create a session keeping its receiver chains in storage, which must
+     * be at least compact_storage_length(limits) bytes, and taking room for
+     * its skipped message keys from skipped_key_allocator only while it has
+     * some. The allocator must outlive the session. */
+    Session(
+        RatchetLimits const & limits, std::uint8_t * storage,
+        OlmAllocator const * skipped_key_allocator
+    );
+
+    /** The number of bytes of storage a session with the given limits
+     * needs. */
+    static std::size_t storage_length(RatchetLimits const & limits);
+
+    /** The number of bytes of storage a session whose skipped message keys
+     * are kept out of line needs. */
+    static std::size_t compact_storage_length(RatchetLimits const & limits);
 
     Ratchet ratchet;
+
+    /** Where the ratchet takes room for its skipped message keys from if
+     * they are kept out of line, or nullptr. This is the caller's, not part
+     * of the session's memory, so it is the one pointer a session holds. */
+    OlmAllocator const * skipped_key_allocator;
+
     OlmErrorCode last_error;
 
     bool received_message;
 
+    /** Whether the keys below have changed since the session was last
+     * pickled. Set for a new session. */
+    bool keys_changed;
+
     _olm_curve25519_public_key alice_identity_key;
     _olm_curve25519_public_key alice_base_key;
     _olm_curve25519_public_key bob_one_time_key;
 
+    /** Whether cached_session_id holds session_id() for the keys above. It
+     * is worked out the first time it is asked for after they are set. */
+    bool session_id_cached;
+    std::uint8_t cached_session_id[SHA256_OUTPUT_LENGTH];
+
+    /** The hash of the session's state when it was last pickled, unpickled
+     * or had a delta applied, which a delta pickle of the changes since then
+     * can only be applied to. */
+    std::uint8_t pickled_state_hash[SESSION_STATE_HASH_LENGTH];
+
+    /** Start tracking changes for delta pickles afresh, after the session
+     * has been pickled, unpickled or had a delta applied. */
+    void forget_changes();
+
+    /** Make this session a copy of another with the same limits, including
+     * what has changed since it was last pickled. Returns false, leaving
+     * this session as it was, if there is no room for the other session's
+     * skipped message keys, in which case last_error will be
+     * ALLOCATION_FAILED. */
+    bool copy_from(Session const & other);
+
     /** The number of random bytes that are needed to create a new outbound
      * session. This will be 64 bytes since two ephemeral keys are needed. */
     std::size_t new_outbound_session_random_length();
@@ -53,6 +123,25 @@ struct Session {
         std::uint8_t const * random, std::size_t random_length
     );
 
+    /** Start count new outbound sessions from the same account, the same as
+     * calling new_outbound_session() for sessions[i], identity_keys[i] and
+     * one_time_keys[i] with new_outbound_session_random_length() bytes each
+     * from random in turn, but sharing the key generation and running the
+     * Diffie-Hellmans of several sessions side by side. Can't fail. */
+    static void new_outbound_sessions(
+        std::size_t count, Session * const * sessions,
+        Account const & local_account,
+        _olm_curve25519_public_key const * identity_keys,
+        _olm_curve25519_public_key const * one_time_keys,
+        std::uint8_t const * random
+    );
+
+    /** The length of the first message sent by a new outbound session, a
+     * pre-key message, for the given number of plain-text bytes. */
+    static std::size_t new_outbound_message_length(
+        std::size_t plaintext_length
+    );
+
     /** Start a new inbound session from a pre-key message.
      * Returns std::size_t(-1) on failure. On failure last_error will be set
      * with an error code. The last_error will be BAD_MESSAGE_FORMAT if
@@ -63,6 +152,14 @@ struct Session {
         std::uint8_t const * pre_key_message, std::size_t message_length
     );
 
+    /** As new_inbound_session() for a message decoded with
+     * decode_message_view(). */
+    std::size_t new_inbound_session(
+        Account & local_account,
+        _olm_curve25519_public_key const * their_identity_key,
+        MessageView const & pre_key_message
+    );
+
     /** The number of bytes written by session_id() */
     std::size_t session_id_length();
 
@@ -86,13 +183,35 @@ struct Session {
         std::uint8_t const * pre_key_message, std::size_t message_length
     );
 
+    /** As matches_inbound_session() for a message decoded with
+     * decode_message_view(). Returns false if it isn't a pre-key message. */
+    bool matches_inbound_session(
+        _olm_curve25519_public_key const * their_identity_key,
+        MessageView const & pre_key_message
+    );
+
+    /** Write the route of the session that a pre-key message belongs to,
+     * SESSION_ROUTE_LENGTH bytes, so that the session can be looked up
+     * without trying the message against each candidate. Returns false if it
+     * isn't a pre-key message or its headers, including the sender's identity
+     * key, couldn't be decoded. */
+    static bool message_route(
+        MessageView const & pre_key_message, std::uint8_t * route
+    );
+
+    /** Write this session's route, SESSION_ROUTE_LENGTH bytes. An inbound
+     * session has the same route as the pre-key messages that match it. */
+    void route(std::uint8_t * route) const;
+
     /** Whether the next message will be a pre-key message or a normal message.
      * An outbound session will send pre-key messages until it receives a
      * message with a ratchet key. */
     MessageType encrypt_message_type();
 
+    /** The length of the next message for the given number of plain-text
+     * bytes, or, if ahead is set, of the message that many after it. */
     std::size_t encrypt_message_length(
-        std::size_t plaintext_length
+        std::size_t plaintext_length, std::uint32_t ahead = 0
     );
 
     /** The number of bytes of random data the encrypt method will need to
@@ -111,6 +230,43 @@ struct Session {
         std::uint8_t * message, std::size_t message_length
     );
 
+    /** As encrypt, but with the new ephemeral key pair already generated,
+      * as for Ratchet::encrypt. */
+    std::size_t encrypt(
+        std::uint8_t const * plaintext, std::size_t plaintext_length,
+        _olm_curve25519_key_pair const * ratchet_key,
+        std::uint8_t * message, std::size_t message_length
+    );
+
+    /** As encrypt, but with keys for the next message already taken from
+      * the ratchet by Ratchet::take_send_keys. */
+    std::size_t encrypt_with_keys(
+        std::uint8_t const * plaintext, std::size_t plaintext_length,
+        Ratchet::SendKeys const & keys,
+        std::uint8_t * message, std::size_t message_length
+    );
+
+    /** Write the header of the next message, a pre-key message until one
+      * has been received, returning where the message_body_length bytes of
+      * the ratchet's message go. */
+    std::uint8_t * encrypt_message_header(
+        std::size_t message_body_length, std::uint8_t * message
+    );
+
+    /** Start the sending chain ahead of the next encrypt, as for
+      * Ratchet::prepare_send, generating the new ephemeral key from
+      * encrypt_random_length() bytes of random. Returns 0 or std::size_t(-1)
+      * with last_error NOT_ENOUGH_RANDOM. */
+    std::size_t prepare_send(
+        std::uint8_t const * random, std::size_t random_length
+    );
+
+    /** As prepare_send, but with the new ephemeral key pair already
+      * generated. */
+    std::size_t prepare_send(
+        _olm_curve25519_key_pair const * ratchet_key
+    );
+
     /** An upper bound on the number of bytes of plain-text the decrypt method
      * will write for a given input message length. */
     std::size_t decrypt_max_plaintext_length(
@@ -118,6 +274,14 @@ struct Session {
         std::uint8_t const * message, std::size_t message_length
     );
 
+    /** The same bound as decrypt_max_plaintext_length() for a base64-encoded
+     * message, found by decoding only the message headers. The message isn't
+     * changed. The length must be a valid length for unpadded base64. */
+    std::size_t peek_max_plaintext_length(
+        MessageType message_type,
+        std::uint8_t const * message, std::size_t message_length
+    );
+
     /** Decrypt a message. Returns the length of the decrypted plain-text or
      * std::size_t(-1) on failure. On failure last_error will be set with an
      * error code. The last_error will be OUTPUT_BUFFER_TOO_SMALL if the
@@ -131,6 +295,39 @@ struct Session {
         std::uint8_t const * message, std::size_t message_length,
         std::uint8_t * plaintext, std::size_t max_plaintext_length
     );
+
+    /** Decode the headers of a raw message into view, ready for passing to
+     * the methods below. This doesn't check the headers: the methods report
+     * any problems with them as they would for the raw message. */
+    static void decode_message_view(
+        MessageView & view, MessageType message_type,
+        std::uint8_t const * message, std::size_t message_length
+    );
+
+    /** As decrypt_max_plaintext_length() for a message decoded with
+     * decode_message_view(). */
+    std::size_t decrypt_max_plaintext_length(
+        MessageView const & message
+    );
+
+    /** As decrypt() for a message decoded with decode_message_view(). */
+    std::size_t decrypt(
+        MessageView const & message,
+        std::uint8_t * plaintext, std::size_t max_plaintext_length
+    );
+
+    /** As decrypt() for a message decoded with decode_message_view(), but
+     * without changing the session, as for Ratchet::try_decrypt(). */
+    std::size_t try_decrypt(
+        MessageView const & message,
+        std::uint8_t * plaintext, std::size_t max_plaintext_length,
+        DecryptTrial & trial
+    ) const;
+
+    /** Make the change a successful try_decrypt() found, as for
+     * Ratchet::commit_decrypt(). Returns false, leaving the session as it
+     * was, on failure. */
+    bool commit_decrypt(DecryptTrial & trial);
 };
 
 
@@ -139,6 +336,13 @@ std::size_t pickle_length(
 );
 
 
+/** The longest pickle_length() can be for this session, which depends only
+ * on its limits. */
+std::size_t max_pickle_length(
+    Session const & value
+);
+
+
 std::uint8_t * pickle(
     std::uint8_t * pos,
     Session const & value
@@ -151,6 +355,28 @@ std::uint8_t const * unpickle(
 );
 
 
+/** The length of a delta pickle of the changes to the session since it was
+ * last pickled, unpickled or had a delta applied. */
+std::size_t pickle_delta_length(
+    Session const & value
+);
+
+
+std::uint8_t * pickle_delta(
+    std::uint8_t * pos,
+    Session const & value
+);
+
+
+/** Apply a delta pickle to the session. Fails with SESSION_DELTA_MISMATCH,
+ * leaving the session unchanged, if the session isn't in the state the
+ * delta was taken from. */
+std::uint8_t const * unpickle_delta(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    Session & value
+);
+
+
 } // namespace olm
 
 #endif /* OLM_SESSION_HH_ */
@@ -0,0 +1,131 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Handles for sessions that are only unpickled when they are used. A client
+ * starting up can make a handle for every stored session without decrypting
+ * any of them; each is unpickled the first time it is asked for, and pickled
+ * back into its buffer once it has been left alone for a while, giving its
+ * memory back. The session a handle gives out is an ordinary OlmSession, so
+ * all the olm_* session functions work on it.
+ *
+ * A handle isn't safe to use from several threads at once. */
+
+#ifndef OLM_SESSION_HANDLE_H_
+#define OLM_SESSION_HANDLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/olm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct OlmSessionHandle OlmSessionHandle;
+
+/** The number of bytes needed for a session handle */
+size_t olm_session_handle_size(void);
+
+/**
+ * Make a handle, in the supplied memory, for the session pickled in the
+ * first pickled_length bytes of pickled by olm_pickle_session() or
+ * olm_pickle_session_with_key(), under the key pickle_key was made from.
+ * Nothing is decrypted until the session is asked for.
+ *
+ * The pickle buffer is kept rather than copied, and must hold
+ * pickled_capacity bytes, so that the session can be pickled back into it
+ * as it grows. Unpickling decrypts it in place, and the session is pickled
+ * back into it with the OLM_PICKLE_CIPHER_* given. The session's memory
+ * comes from the allocator when it is unpickled and goes back to it when it
+ * is sealed again. The pickle key, the pickle buffer and the allocator must
+ * stay valid until the handle is cleared.
+ */
+OlmSessionHandle * olm_session_handle(
+    void * memory,
+    OlmPickleKey const * pickle_key, uint32_t cipher,
+    const OlmAllocator * allocator,
+    void * pickled, size_t pickled_length, size_t pickled_capacity
+);
+
+/**
+ * The session, unpickling it first if it is sealed, to pass to the olm_*
+ * session functions. It stays valid until the handle is sealed again or
+ * cleared. Returns NULL if the session couldn't be unpickled, in which case
+ * olm_session_handle_last_error() will be "ALLOCATION_FAILED", which leaves
+ * the pickle as it was so that it can be tried again, or the error
+ * olm_unpickle_session() would have given, after which the handle has no
+ * session at all.
+ */
+OlmSession * olm_session_handle_get(
+    OlmSessionHandle * handle
+);
+
+/** 1 if the session is sealed in the pickle buffer, 0 if it is unpickled */
+int olm_session_handle_is_sealed(
+    const OlmSessionHandle * handle
+);
+
+/** Seal the session after it has been left alone for milliseconds, by
+ * olm_session_handle_seal_if_idle(). The default is 60 seconds. */
+void olm_session_handle_set_idle_timeout(
+    OlmSessionHandle * handle, uint32_t milliseconds
+);
+
+/**
+ * Pickle the session back into the pickle buffer and give its memory back
+ * to the allocator. Whether the stored copy needs updating can be told from
+ * olm_session_is_dirty() beforehand. Returns the length of the pickle, which
+ * is also that of a handle which is already sealed. Returns olm_error() if
+ * it couldn't be pickled, leaving the session unpickled; the error will be
+ * "OUTPUT_BUFFER_TOO_SMALL" if the session has outgrown the buffer, or as
+ * for olm_pickle_session_with_key().
+ */
+size_t olm_session_handle_seal(
+    OlmSessionHandle * handle
+);
+
+/**
+ * As olm_session_handle_seal(), but only if the session hasn't been asked
+ * for within the idle timeout, for calling from time to time, as from a
+ * timer. Returns 0 if the session was left unpickled.
+ */
+size_t olm_session_handle_seal_if_idle(
+    OlmSessionHandle * handle
+);
+
+/** The length of the pickle in the buffer while the handle is sealed, or 0
+ * while the session is unpickled */
+size_t olm_session_handle_pickle_length(
+    const OlmSessionHandle * handle
+);
+
+/** A null terminated string describing the most recent error to happen to
+ * the handle */
+const char * olm_session_handle_last_error(
+    const OlmSessionHandle * handle
+);
+
+/** Give an unpickled session's memory back to the allocator, without
+ * pickling it, and clear the handle. The pickle buffer is left as it is. */
+size_t olm_clear_session_handle(
+    OlmSessionHandle * handle
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_SESSION_HANDLE_H_ */
@@ -0,0 +1,51 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The SHA-256 compression function using the SHA instructions of the CPU
+ * (the SHA extensions on x86, SHA2 on ARMv8). These functions must only be
+ * called when _olm_sha256_hw_available() returns true; crypto.cpp falls back
+ * to the reference implementation from lib/crypto-algorithms otherwise.
+ */
+
+#ifndef OLM_SHA256_HW_H_
+#define OLM_SHA256_HW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** the SHA-256 round constants K[0..63] */
+extern const uint32_t _olm_sha256_round_constants[64];
+
+/** returns non-zero if this build and this CPU support the hardware path */
+int _olm_sha256_hw_available(void);
+
+/**
+ * Run the compression function over a number of whole 64 byte blocks,
+ * updating the eight state words in place.
+ */
+void _olm_sha256_hw_transform(
+    uint32_t * state,
+    uint8_t const * blocks, size_t block_count
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_SHA256_HW_H_ */
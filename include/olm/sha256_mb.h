@@ -0,0 +1,70 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Multi-buffer SHA-256: the compression function run over several
+ * independent messages at once, one per lane of a SIMD register (SSE2 on
+ * x86, NEON on ARMv8), or eight at once with AVX2. This is how we speed up
+ * independent hashes, such as the parts of the Megolm ratchet, on CPUs
+ * without SHA instructions.
+ */
+
+#ifndef OLM_SHA256_MB_H_
+#define OLM_SHA256_MB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** the number of messages hashed by _olm_sha256_x4_transform */
+#define OLM_SHA256_X4_LANES 4
+
+/** returns non-zero if this build has a vectorised multi-buffer kernel.
+ * Otherwise _olm_sha256_x4_transform works, but one lane at a time. */
+int _olm_sha256_x4_available(void);
+
+/**
+ * Run the compression function over one 64 byte block for each of four
+ * independent hashes, updating each of the four sets of eight state words
+ * in place.
+ */
+void _olm_sha256_x4_transform(
+    uint32_t * const * states,
+    uint8_t const * const * blocks
+);
+
+/** the number of messages hashed by _olm_sha256_x8_transform */
+#define OLM_SHA256_X8_LANES 8
+
+/** returns non-zero if the CPU can run the eight lane kernel (AVX2 on x86).
+ * Otherwise _olm_sha256_x8_transform works, but as two four lane
+ * transforms. */
+int _olm_sha256_x8_available(void);
+
+/**
+ * As _olm_sha256_x4_transform, but for eight independent hashes.
+ */
+void _olm_sha256_x8_transform(
+    uint32_t * const * states,
+    uint8_t const * const * blocks
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_SHA256_MB_H_ */
@@ -0,0 +1,62 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The SHA-512 compression function behind the bundled Ed25519, which hashes
+ * the whole message for every signature and verification. x86 has no
+ * SHA-512 instructions in the CPUs we target, so there the kernel uses AVX2
+ * for the message schedule and BMI2 rotates for the rounds; ARMv8.2 has the
+ * SHA512 instructions. These functions must only be called when
+ * _olm_sha512_hw_available() returns true; the dispatch table falls back to
+ * the implementation from lib/ed25519 otherwise.
+ */
+
+#ifndef OLM_SHA512_HW_H_
+#define OLM_SHA512_HW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** the SHA-512 round constants K[0..79] */
+extern const uint64_t _olm_sha512_round_constants[80];
+
+/** returns non-zero if this build and this CPU support the accelerated
+ * path */
+int _olm_sha512_hw_available(void);
+
+/**
+ * Run the compression function over a number of whole 128 byte blocks,
+ * updating the eight state words in place.
+ */
+void _olm_sha512_hw_transform(
+    uint64_t * state,
+    uint8_t const * blocks, size_t block_count
+);
+
+/** The portable compression function from lib/ed25519, with the same shape
+ * as the accelerated one. */
+void _olm_sha512_transform_portable(
+    uint64_t * state,
+    uint8_t const * blocks, size_t block_count
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_SHA512_HW_H_ */
@@ -0,0 +1,85 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Counters of the work done by the library, such as how many HMACs a call to
+ * olm_group_decrypt() cost, and of the time spent in the main API calls.
+ *
+ * The counters are only kept if the library is built with OLM_STATS defined
+ * (make OLM_STATS=1); otherwise they cost nothing and always read as zero.
+ * Each thread has its own counters. */
+
+#ifndef OLM_STATS_H_
+#define OLM_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The API calls that are timed */
+enum OlmStatsOperation {
+    OLM_STATS_CREATE_OUTBOUND_SESSION = 0,
+    OLM_STATS_CREATE_INBOUND_SESSION = 1,
+    OLM_STATS_ENCRYPT = 2,
+    OLM_STATS_DECRYPT = 3,
+    OLM_STATS_GROUP_ENCRYPT = 4,
+    OLM_STATS_GROUP_DECRYPT = 5,
+    OLM_STATS_PICKLE = 6,
+    OLM_STATS_UNPICKLE = 7,
+    OLM_STATS_OPERATION_COUNT = 8,
+};
+
+typedef struct OlmStats {
+    /** SHA-256 compression function calls, one per 64 byte block */
+    uint64_t sha256_blocks;
+    /** HMAC-SHA-256s, including those inside HKDFs */
+    uint64_t hmac_sha256;
+    uint64_t hkdf_sha256;
+    /** AES-256 blocks encrypted or decrypted */
+    uint64_t aes_blocks;
+    /** X25519 key pairs generated, and shared secrets computed */
+    uint64_t curve25519_keys;
+    uint64_t curve25519_shared_secrets;
+    uint64_t ed25519_signs;
+    /** Ed25519 signatures checked, one at a time or in batches */
+    uint64_t ed25519_verifies;
+    /** Parts of a Megolm ratchet rehashed */
+    uint64_t megolm_rehashes;
+    /** Steps along an Olm ratchet's chain */
+    uint64_t chain_key_advances;
+    /** How many times each OlmStatsOperation was called, and the total
+     * time spent in it in nanoseconds. Pickling and unpickling count the
+     * text and binary forms of accounts, sessions and group sessions. */
+    uint64_t calls[OLM_STATS_OPERATION_COUNT];
+    uint64_t nanoseconds[OLM_STATS_OPERATION_COUNT];
+} OlmStats;
+
+/** Whether the library keeps the counters: 1 if it was built with
+ * OLM_STATS, 0 otherwise */
+int olm_stats_enabled(void);
+
+/** Copy the calling thread's counters into stats */
+void olm_stats_get(OlmStats * stats);
+
+/** Set the calling thread's counters back to zero */
+void olm_stats_reset(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_STATS_H_ */
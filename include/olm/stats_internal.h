@@ -0,0 +1,83 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* How the library updates the counters in olm/stats.h. Without OLM_STATS
+ * all of these expand to nothing. */
+
+#ifndef OLM_STATS_INTERNAL_H_
+#define OLM_STATS_INTERNAL_H_
+
+#include "olm/stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(OLM_STATS) || defined(OLM_TRACE)
+/** A monotonic clock, in nanoseconds, for timing calls */
+uint64_t _olm_stats_now(void);
+#endif
+
+#ifdef OLM_STATS
+
+#if defined(_MSC_VER)
+#define OLM_THREAD_LOCAL __declspec(thread)
+#else
+#define OLM_THREAD_LOCAL __thread
+#endif
+
+extern OLM_THREAD_LOCAL OlmStats _olm_stats;
+
+/** Count a call of operation which started at start */
+void _olm_stats_record_call(enum OlmStatsOperation operation, uint64_t start);
+
+#define OLM_STATS_ADD(counter, n) (_olm_stats.counter += (n))
+#define OLM_STATS_TIMER_START(timer) uint64_t timer = _olm_stats_now()
+#define OLM_STATS_TIMER_STOP(timer, operation) \
+    _olm_stats_record_call((operation), (timer))
+
+#else
+
+#define OLM_STATS_ADD(counter, n) ((void)0)
+#define OLM_STATS_TIMER_START(timer) ((void)0)
+#define OLM_STATS_TIMER_STOP(timer, operation) ((void)0)
+
+#endif /* OLM_STATS */
+
+#ifdef __cplusplus
+} // extern "C"
+
+namespace olm {
+
+/** Times the API call it is scoped to */
+struct StatsTimer {
+#ifdef OLM_STATS
+    explicit StatsTimer(OlmStatsOperation operation)
+        : operation(operation), start(_olm_stats_now()) {}
+    ~StatsTimer() {
+        _olm_stats_record_call(operation, start);
+    }
+    OlmStatsOperation operation;
+    uint64_t start;
+#else
+    explicit StatsTimer(OlmStatsOperation) {}
+#endif
+};
+
+} // namespace olm
+
+#endif /* __cplusplus */
+
+#endif /* OLM_STATS_INTERNAL_H_ */
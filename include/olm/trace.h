@@ -0,0 +1,132 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A hook for following the library's main operations from outside, for
+ * example to feed their timings into a tracing system. The hook is only
+ * called if the library is built with OLM_TRACE defined (make OLM_TRACE=1);
+ * otherwise setting it does nothing.
+ *
+ * The hook is told which operation is starting or finishing and, when it
+ * finishes, how long it took. It is never passed keys, messages or any other
+ * data the operation works on.
+ *
+ * A second hook, the recorder, is told about each call to create a session
+ * or to encrypt or decrypt a message once it returns: which session it was
+ * for, the lengths of the plain-text and message, the message index and
+ * whether it failed. This is the shape of a workload without any of its
+ * secrets, and benchmarks/bench_replay.cpp can replay a log of it against
+ * fresh keys. It is built with OLM_TRACE too. */
+
+#ifndef OLM_TRACE_H_
+#define OLM_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum OlmTraceOperation {
+    OLM_TRACE_CREATE_OUTBOUND_SESSION = 0,
+    OLM_TRACE_CREATE_INBOUND_SESSION = 1,
+    OLM_TRACE_ENCRYPT = 2,
+    OLM_TRACE_DECRYPT = 3,
+    OLM_TRACE_GROUP_ENCRYPT = 4,
+    OLM_TRACE_GROUP_DECRYPT = 5,
+    OLM_TRACE_PICKLE = 6,
+    OLM_TRACE_UNPICKLE = 7,
+    /** A Diffie-Hellman step of an Olm ratchet, starting a new chain */
+    OLM_TRACE_RATCHET_STEP = 8,
+    /** Moving a Megolm ratchet on, one step or many */
+    OLM_TRACE_MEGOLM_ADVANCE = 9,
+    /** Encrypting or decrypting one message with AES-256 and HMAC-SHA-256 */
+    OLM_TRACE_CIPHER_ENCRYPT = 10,
+    OLM_TRACE_CIPHER_DECRYPT = 11,
+    /** Setting up a group session from random data, or from a session key
+     * or export */
+    OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION = 12,
+    OLM_TRACE_INIT_INBOUND_GROUP_SESSION = 13,
+};
+
+enum OlmTraceEvent {
+    OLM_TRACE_ENTER = 0,
+    OLM_TRACE_EXIT = 1,
+};
+
+/**
+ * Called on entry to and exit from each operation. Operations can nest, for
+ * example a group encrypt contains a cipher encrypt and a megolm advance, and
+ * each exit matches the latest unmatched entry on the same thread.
+ * nanoseconds is the time the operation took on exit, and 0 on entry.
+ * context is the pointer passed to olm_trace_set_callback().
+ */
+typedef void (*OlmTraceCallback)(
+    void * context,
+    enum OlmTraceOperation operation, enum OlmTraceEvent event,
+    uint64_t nanoseconds
+);
+
+/** Whether the library calls the hook: 1 if it was built with OLM_TRACE, 0
+ * otherwise */
+int olm_trace_enabled(void);
+
+/** Set the hook for all threads, or clear it if callback is NULL. The hook
+ * must be able to run on any thread that uses the library. It should be set
+ * before the library is used from other threads, and the previous hook may
+ * still be called by calls already in progress. */
+void olm_trace_set_callback(OlmTraceCallback callback, void * context);
+
+/** What the recorder is told about one call */
+struct OlmRecordEvent {
+    /** One of the session creation, encrypt, decrypt and group session
+     * operations */
+    enum OlmTraceOperation operation;
+    /** The session the call was for. This is only for telling sessions
+     * apart, and the same address may be used by another session once the
+     * first is cleared; creating or initialising a session starts a new
+     * one. */
+    const void * session;
+    /** The length of the plain-text encrypted or decrypted, or 0 */
+    size_t plaintext_length;
+    /** The length of the message encrypted, decrypted or a session was
+     * created from, before base64 encoding, or 0 */
+    size_t message_length;
+    /** For group sessions, the index of the message, or of the first known
+     * message when the session is initialised; 0 otherwise */
+    uint32_t message_index;
+    /** For Olm encrypt and decrypt, the message type; 0 otherwise */
+    unsigned message_type;
+    /** Non-zero if the call failed */
+    int failed;
+};
+
+/** Called after each call the recorder is told about returns, on the thread
+ * which made it. context is the pointer passed to
+ * olm_record_set_callback(). */
+typedef void (*OlmRecordCallback)(
+    void * context, const struct OlmRecordEvent * event
+);
+
+/** Set the recorder for all threads, or clear it if callback is NULL, as
+ * with olm_trace_set_callback(). The batch functions may call it from the
+ * threads of their executor. */
+void olm_record_set_callback(OlmRecordCallback callback, void * context);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_TRACE_H_ */
@@ -0,0 +1,147 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* How the library calls the hooks in olm/trace.h. Without OLM_TRACE all of
+ * these expand to nothing. */
+
+#ifndef OLM_TRACE_INTERNAL_H_
+#define OLM_TRACE_INTERNAL_H_
+
+#include "olm/trace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef OLM_TRACE
+
+extern OlmTraceCallback _olm_trace_callback;
+
+/** Call the hook on entry to operation, and return the start time */
+uint64_t _olm_trace_enter(enum OlmTraceOperation operation);
+
+/** Call the hook on exit from an operation entered at start */
+void _olm_trace_exit(enum OlmTraceOperation operation, uint64_t start);
+
+#define OLM_TRACE_BEGIN(scope, operation) \
+    uint64_t scope = _olm_trace_callback ? _olm_trace_enter(operation) : 0
+/* Only calls the hook if it was there on entry, so that entries and exits
+ * still match if the hook is set in between */
+#define OLM_TRACE_END(scope, operation) \
+    ((scope) ? _olm_trace_exit((operation), (scope)) : (void)0)
+
+extern OlmRecordCallback _olm_record_callback;
+
+/** Call the recorder with an event made of the arguments */
+void _olm_record(
+    enum OlmTraceOperation operation, const void * session,
+    size_t plaintext_length, size_t message_length,
+    uint32_t message_index, unsigned message_type, int failed
+);
+
+/* Tell the recorder about a call to operation which returned result */
+#define OLM_RECORD( \
+    operation, session, plaintext_length, message_length, \
+    message_index, message_type, result \
+) \
+    (_olm_record_callback ? _olm_record( \
+        (operation), (session), (plaintext_length), (message_length), \
+        (message_index), (message_type), (result) == (size_t)-1 \
+    ) : (void)0)
+
+#else
+
+#define OLM_TRACE_BEGIN(scope, operation) ((void)0)
+#define OLM_TRACE_END(scope, operation) ((void)0)
+#define OLM_RECORD( \
+    operation, session, plaintext_length, message_length, \
+    message_index, message_type, result \
+) ((void)0)
+
+#endif /* OLM_TRACE */
+
+#ifdef __cplusplus
+} // extern "C"
+
+#include <cstddef>
+
+namespace olm {
+
+/** Traces the operation it is scoped to */
+struct TraceScope {
+#ifdef OLM_TRACE
+    explicit TraceScope(OlmTraceOperation operation)
+        : operation(operation),
+          start(_olm_trace_callback ? _olm_trace_enter(operation) : 0) {}
+    ~TraceScope() {
+        OLM_TRACE_END(start, operation);
+    }
+    OlmTraceOperation operation;
+    uint64_t start;
+#else
+    explicit TraceScope(OlmTraceOperation) {}
+#endif
+};
+
+/**
+ * Tells the recorder about the call it is scoped to. The call is taken to
+ * have failed unless it returns through succeeded(), so only the successful
+ * return needs to mention it.
+ */
+struct RecordScope {
+#ifdef OLM_TRACE
+    RecordScope(OlmTraceOperation operation, void const * session)
+        : operation(operation), session(session), plaintext_length(0),
+          message_length(0), message_type(0), failed(1) {}
+    ~RecordScope() {
+        if (_olm_record_callback) {
+            _olm_record(
+                operation, session, plaintext_length, message_length,
+                0, message_type, failed
+            );
+        }
+    }
+    void message(
+        std::size_t plaintext_length, std::size_t message_length,
+        unsigned message_type
+    ) {
+        this->plaintext_length = plaintext_length;
+        this->message_length = message_length;
+        this->message_type = message_type;
+    }
+    std::size_t succeeded(std::size_t result) {
+        failed = result == std::size_t(-1);
+        return result;
+    }
+    OlmTraceOperation operation;
+    void const * session;
+    std::size_t plaintext_length;
+    std::size_t message_length;
+    unsigned message_type;
+    int failed;
+#else
+    RecordScope(OlmTraceOperation, void const *) {}
+    void message(std::size_t, std::size_t, unsigned) {}
+    std::size_t succeeded(std::size_t result) {
+        return result;
+    }
+#endif
+};
+
+} // namespace olm
+
+#endif /* __cplusplus */
+
+#endif /* OLM_TRACE_INTERNAL_H_ */
@@ -17,12 +17,11 @@
 #define UTILITY_HH_
 
 #include "olm/error.h"
+#include "olm/crypto.h"
 
 #include <cstddef>
 #include <cstdint>
 
-struct _olm_ed25519_public_key;
-
 namespace olm {
 
 struct Utility {
@@ -31,6 +30,14 @@ struct Utility {
 
     OlmErrorCode last_error;
 
+    /** The number of recently used verification keys to keep decoded */
+    static const std::size_t KEY_CACHE_SIZE = 4;
+
+    /** Recently used verification keys, the oldest replaced first */
+    _olm_ed25519_prepared_key key_cache[KEY_CACHE_SIZE];
+    std::size_t key_cache_length;
+    std::size_t key_cache_next;
+
     /** The length of a SHA-256 hash in bytes. */
     std::size_t sha256_length();
 
@@ -53,6 +60,19 @@ struct Utility {
         std::uint8_t const * signature, std::size_t signature_length
     );
 
+    /** Verify a number of ed25519 signatures at once. Sets results[i] to 1 if
+     * the i-th signature was valid and to 0 if it was too short or invalid.
+     * Returns the number of signatures that were invalid. */
+    std::size_t ed25519_verify_batch(
+        std::size_t count,
+        _olm_ed25519_public_key const * keys,
+        std::uint8_t const * const * messages,
+        std::size_t const * message_lengths,
+        std::uint8_t const * const * signatures,
+        std::size_t const * signature_lengths,
+        std::uint8_t * results
+    );
+
 };
 
 
@@ -0,0 +1,52 @@
+/*
+Copyright 2016 OpenMarket Ltd
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* Runs the benchmarks in demo/benchmark.js under node, printing the results
+ * in the same format as the native benchmarks, for comparing them with
+ * benchmarks/bench_bindings.cpp:
+ *
+ *     node benchmark_node.js [iterations] [--wasm]
+ *
+ * Uses the asm.js build from make js, or the WebAssembly build from make
+ * wasm with --wasm.
+ */
+
+"use strict";
+
+var args = process.argv.slice(2);
+var wasm = args.indexOf("--wasm") >= 0;
+var iterations = parseInt(args.filter(function(arg) {
+    return arg !== "--wasm";
+})[0] || "1000");
+
+var Olm = require(wasm ? "./wasm/olm" : "./olm");
+var runAll = require("./demo/benchmark");
+
+function pad(text, width, left) {
+    while (text.length < width) {
+        text = left ? text + " " : " " + text;
+    }
+    return text;
+}
+
+Olm.init().then(function() {
+    runAll(Olm, iterations, function(name, iterations, elapsed) {
+        console.log(
+            pad(name, 40, true)
+            + pad((elapsed * 1e6 / iterations).toFixed(1), 12) + " ns/op"
+        );
+    });
+});
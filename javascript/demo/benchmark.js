@@ -0,0 +1,144 @@
+/* Javascript parts of the benchmark. To use, load benchmark.html in your
+ * browser, or run benchmark_node.js under node.
+ *
+ * These are the calls that benchmarks/bench_bindings.cpp makes straight to
+ * the C API, with the same names and in the same order, so the difference
+ * is what the bindings add to each call, such as converting strings and
+ * copying in and out of the Emscripten heap.
+ */
+
+var now = typeof(performance) !== "undefined"
+    ? function() { return performance.now(); }
+    : function() {
+        var time = process.hrtime();
+        return time[0] * 1e3 + time[1] / 1e6;
+    };
+
+function addResult(name, iterations, elapsed) {
+    var el = document.createElement("div");
+    var text = document.createElement("tt");
+    text.appendChild(document.createTextNode(
+        name + ": " + (elapsed / iterations).toFixed(3) + " ms/op"
+    ));
+    el.appendChild(text);
+    document.getElementById("results").appendChild(el);
+}
+
+function time(report, name, iterations, func) {
+    var start = now();
+    for (var i = 0; i < iterations; ++i) {
+        func(i);
+    }
+    report(name, iterations, now() - start);
+}
+
+function benchmarkGroup(Olm, iterations, report) {
+    var outbound = new Olm.OutboundGroupSession();
+    var inbound = new Olm.InboundGroupSession();
+    try {
+        outbound.create();
+        inbound.create(outbound.session_key());
+
+        var ciphertexts = [];
+        time(report, "group encrypt", iterations, function() {
+            ciphertexts.push(outbound.encrypt("Hello, World"));
+        });
+        time(report, "group decrypt", iterations, function(i) {
+            inbound.decrypt(ciphertexts[i]);
+        });
+        time(report, "group pickle", iterations, function() {
+            inbound.pickle("secret_key");
+        });
+    } finally {
+        outbound.free();
+        inbound.free();
+    }
+}
+
+function benchmarkOneToOne(Olm, iterations, report) {
+    time(report, "account create", iterations, function() {
+        var account = new Olm.Account();
+        try {
+            account.create();
+        } finally {
+            account.free();
+        }
+    });
+
+    var alice = new Olm.Account();
+    var bob = new Olm.Account();
+    var alice_session = new Olm.Session();
+    var bob_session = new Olm.Session();
+    try {
+        alice.create();
+        bob.create();
+        bob.generate_one_time_keys(1);
+
+        var bob_id_key = JSON.parse(bob.identity_keys()).curve25519;
+        var bob_ot_keys = JSON.parse(bob.one_time_keys()).curve25519;
+        var bob_ot_key;
+        for (var key in bob_ot_keys) {
+            bob_ot_key = bob_ot_keys[key];
+        }
+
+        alice_session.create_outbound(alice, bob_id_key, bob_ot_key);
+        var first = alice_session.encrypt("Hello, World");
+        bob_session.create_inbound(bob, first.body);
+        bob_session.decrypt(first.type, first.body);
+
+        /* have bob reply so that alice stops sending pre-key messages */
+        var reply = bob_session.encrypt("Hello, World");
+        alice_session.decrypt(reply.type, reply.body);
+
+        var messages = [];
+        time(report, "one-to-one encrypt", iterations, function() {
+            messages.push(alice_session.encrypt("Hello, World"));
+        });
+        time(report, "one-to-one decrypt", iterations, function(i) {
+            bob_session.decrypt(messages[i].type, messages[i].body);
+        });
+        time(report, "session pickle", iterations, function() {
+            bob_session.pickle("secret_key");
+        });
+        var pickled = bob_session.pickle("secret_key");
+        time(report, "session unpickle", iterations, function() {
+            var session = new Olm.Session();
+            try {
+                session.unpickle("secret_key", pickled);
+            } finally {
+                session.free();
+            }
+        });
+    } finally {
+        alice_session.free();
+        bob_session.free();
+        alice.free();
+        bob.free();
+    }
+}
+
+/** Run all the benchmarks, passing each result to report as its name, the
+ * number of iterations and the milliseconds they took */
+function runAll(Olm, iterations, report) {
+    benchmarkGroup(Olm, iterations, report);
+    benchmarkOneToOne(Olm, iterations, report);
+}
+
+function runBenchmarks() {
+    var iterations = parseInt(document.getElementById("iterations").value);
+    document.getElementById("results").innerHTML = "";
+    runAll(Olm, iterations, addResult);
+}
+
+if (typeof(window) !== "undefined") {
+    window.addEventListener("load", function() {
+        var button = document.getElementById("run");
+        button.disabled = true;
+        Olm.init().then(function() {
+            button.disabled = false;
+            button.addEventListener("click", runBenchmarks, false);
+        });
+    });
+} else {
+    module.exports = runAll;
+}
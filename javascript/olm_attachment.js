@@ -0,0 +1,166 @@
+/* Encrypted attachments, as described in olm/attachment.h: AES-256-CTR with
+ * a SHA-256 of the ciphertext. Large attachments are handed to WebCrypto,
+ * where the browser runs AES and SHA-256 natively and off the calling
+ * thread; small ones, or all of them where there is no WebCrypto, go through
+ * the library, which saves the trips through promises. Either way the
+ * result is the same, so one side can decrypt what the other encrypted.
+ */
+
+/* attachments of at least this many bytes use WebCrypto if there is one */
+var subtle_crypto_threshold = 64 * 1024;
+
+var BASE64_ALPHABET =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* the unpadded base64 of a Uint8Array, as the library writes hashes */
+function encode_base64(bytes) {
+    var result = "";
+    for (var i = 0; i < bytes.length; i += 3) {
+        var n = bytes[i] << 16 | (bytes[i + 1] | 0) << 8 | (bytes[i + 2] | 0);
+        var digits = Math.min(bytes.length - i, 3) + 1;
+        for (var j = 0; j < digits; ++j) {
+            result += BASE64_ALPHABET.charAt((n >> (18 - 6 * j)) & 63);
+        }
+    }
+    return result;
+}
+
+function use_subtle_crypto(length) {
+    return subtle_crypto !== undefined && length >= subtle_crypto_threshold;
+}
+
+/* WebCrypto would reject these too, but with its own errors */
+function check_attachment_key(key, iv) {
+    if (key.length !== Module['_olm_attachment_key_length']()
+            || iv.length !== Module['_olm_attachment_iv_length']()) {
+        throw new Error("OLM.BAD_ATTACHMENT_KEY");
+    }
+}
+
+/* run a whole attachment through the library. Returns the ciphertext and
+ * hash when encrypting, and the plaintext when decrypting. */
+var attachment_sync = restore_stack(function(encrypt, input, key, iv, hash) {
+    var memory = malloc(Module['_olm_attachment_size']());
+    var attachment = Module['_olm_attachment'](memory);
+    var data = malloc(Math.max(input.length, 1));
+    function check(result) {
+        if (result === OLM_ERROR) {
+            throw new Error("OLM." + Pointer_stringify(
+                Module['_olm_attachment_last_error'](attachment)
+            ));
+        }
+    }
+    try {
+        var key_buffer = stack(key);
+        var iv_buffer = stack(iv);
+        check(Module[
+            encrypt ? '_olm_attachment_encrypt_init'
+                    : '_olm_attachment_decrypt_init'
+        ](attachment, key_buffer, key.length, iv_buffer, iv.length));
+        write_bytes(input, data);
+        check(Module['_olm_attachment_update'](
+            attachment, data, input.length, data, input.length
+        ));
+        if (encrypt) {
+            var hash_length = Module['_olm_attachment_hash_length']();
+            var hash_buffer = stack(hash_length + NULL_BYTE_PADDING_LENGTH);
+            check(Module['_olm_attachment_encrypt_final'](
+                attachment, hash_buffer, hash_length
+            ));
+            return {
+                "ciphertext": read_bytes(data, input.length),
+                "sha256": Pointer_stringify(hash_buffer)
+            };
+        }
+        var hash_array = array_from_string(hash);
+        check(Module['_olm_attachment_decrypt_final'](
+            attachment, stack(hash_array), hash_array.length
+        ));
+        return read_bytes(data, input.length);
+    } finally {
+        Module['_olm_clear_attachment'](attachment);
+        free(memory);
+        // don't leave a copy of the plaintext in the heap.
+        bzero(data, input.length);
+        free(data);
+    }
+});
+
+function subtle_counter(iv) {
+    // the counter is the last 64 bits of the IV, as in the library
+    return {"name": "AES-CTR", "counter": iv, "length": 64};
+}
+
+function subtle_import_key(key, usage) {
+    return subtle_crypto.importKey("raw", key, "AES-CTR", false, [usage]);
+}
+
+function subtle_encrypt(plaintext, key, iv) {
+    return subtle_import_key(key, "encrypt").then(function(crypto_key) {
+        return subtle_crypto.encrypt(subtle_counter(iv), crypto_key, plaintext);
+    }).then(function(ciphertext) {
+        ciphertext = new Uint8Array(ciphertext);
+        return subtle_crypto.digest("SHA-256", ciphertext).then(function(hash) {
+            return {
+                "ciphertext": ciphertext,
+                "sha256": encode_base64(new Uint8Array(hash))
+            };
+        });
+    });
+}
+
+/* the hash is checked before anything is decrypted */
+function subtle_decrypt(ciphertext, key, iv, hash) {
+    return subtle_crypto.digest("SHA-256", ciphertext).then(function(digest) {
+        if (encode_base64(new Uint8Array(digest)) !== hash) {
+            throw new Error("OLM.BAD_MESSAGE_MAC");
+        }
+        return subtle_import_key(key, "decrypt");
+    }).then(function(crypto_key) {
+        return subtle_crypto.decrypt(subtle_counter(iv), crypto_key, ciphertext);
+    }).then(function(plaintext) {
+        return new Uint8Array(plaintext);
+    });
+}
+
+/* Encrypt a Uint8Array with a new random key and IV. Returns a promise of
+ * {ciphertext: Uint8Array, key: Uint8Array, iv: Uint8Array, sha256: String},
+ * with the hash in unpadded base64. */
+olm_exports['encrypt_attachment'] = function(plaintext) {
+    return new Promise(function(resolve) {
+        var key = new Uint8Array(Module['_olm_attachment_key_length']());
+        var iv = new Uint8Array(Module['_olm_attachment_iv_length']());
+        get_random_values(key);
+        // leave the low 64 bits zero so that the counter never wraps
+        get_random_values(iv.subarray(0, 8));
+        var result = use_subtle_crypto(plaintext.length) ?
+            subtle_encrypt(plaintext, key, iv) :
+            attachment_sync(true, plaintext, key, iv);
+        resolve(Promise.resolve(result).then(function(encrypted) {
+            encrypted["key"] = key;
+            encrypted["iv"] = iv;
+            return encrypted;
+        }));
+    });
+};
+
+/* Decrypt a Uint8Array given the {key, iv, sha256} it was encrypted with.
+ * Returns a promise of the plaintext, which is rejected with
+ * "OLM.BAD_MESSAGE_MAC" if the hash doesn't match. */
+olm_exports['decrypt_attachment'] = function(ciphertext, info) {
+    return new Promise(function(resolve) {
+        var key = info["key"], iv = info["iv"], hash = info["sha256"];
+        check_attachment_key(key, iv);
+        resolve(use_subtle_crypto(ciphertext.length) ?
+            subtle_decrypt(ciphertext, key, iv, hash) :
+            attachment_sync(false, ciphertext, key, iv, hash));
+    });
+};
+
+/* Set the size from which attachments are passed to WebCrypto: 0 to use it
+ * for everything, or Infinity to never use it. Returns whether there is a
+ * WebCrypto to use. */
+olm_exports['set_subtle_crypto_threshold'] = function(length) {
+    subtle_crypto_threshold = length;
+    return subtle_crypto !== undefined;
+};
@@ -0,0 +1,231 @@
+/* The batch functions, which decrypt or load many group sessions' worth of
+ * work in one call into the library. In the multithreaded WebAssembly build
+ * the work is spread over threads sharing the heap, once start_threads() has
+ * been called; in the other builds, or before then, it runs on the calling
+ * thread with the same results.
+ */
+
+/* the size of a pointer or size_t in the heap */
+var POINTER_SIZE = 4;
+
+/* malloc an array of count pointers or sizes */
+function malloc_array(count) {
+    return malloc(Math.max(count, 1) * POINTER_SIZE);
+}
+
+function set_array(array, i, value) {
+    Module['setValue'](array + i * POINTER_SIZE, value, 'i32');
+}
+
+function get_array(array, i) {
+    return Module['getValue'](array + i * POINTER_SIZE, 'i32');
+}
+
+/* a pickle key object for key, which must be freed with free_pickle_key() */
+function make_pickle_key(key) {
+    var key_array = array_from_string(key);
+    var key_buffer = malloc(Math.max(key_array.length, 1));
+    var memory = malloc(Module['_olm_pickle_key_size']());
+    try {
+        write_bytes(key_array, key_buffer);
+        return Module['_olm_pickle_key'](
+            memory, key_buffer, key_array.length
+        );
+    } finally {
+        bzero(key_buffer, key_array.length);
+        free(key_buffer);
+    }
+}
+
+function free_pickle_key(pickle_key) {
+    Module['_olm_clear_pickle_key'](pickle_key);
+    free(pickle_key);
+}
+
+/* The number of threads start_threads() can start: 0 unless this is the
+ * multithreaded build */
+olm_exports['max_threads'] = function() {
+    return Module['_olm_js_max_threads']();
+};
+
+/* Start up to count threads for the batch functions, or as many as the
+ * build has. Returns the number running. */
+olm_exports['start_threads'] = function(count) {
+    if (count === undefined) {
+        count = Module['_olm_js_max_threads']();
+    }
+    return Module['_olm_js_start_threads'](count);
+};
+
+olm_exports['stop_threads'] = function() {
+    Module['_olm_js_stop_threads']();
+};
+
+/* Pickle an array of InboundGroupSessions into one batch under key, as a
+ * Uint8Array. The keys are only derived once for the whole batch. */
+olm_exports['pickle_inbound_group_sessions'] = function(key, sessions) {
+    var pickle_key = make_pickle_key(key);
+    var pointers = malloc_array(sessions.length);
+    var pickled, pickled_length;
+    try {
+        for (var i = 0; i < sessions.length; ++i) {
+            set_array(pointers, i, sessions[i].ptr);
+        }
+        pickled_length = Module[
+            '_olm_pickle_inbound_group_session_batch_length'
+        ](pointers, sessions.length);
+        pickled = malloc(pickled_length);
+        var result = Module['_olm_pickle_inbound_group_session_batch'](
+            pickle_key, pointers, sessions.length, pickled, pickled_length
+        );
+        if (result === OLM_ERROR) {
+            throw new Error("OLM." + Pointer_stringify(
+                Module['_olm_inbound_group_session_last_error'](sessions[0].ptr)
+            ));
+        }
+        return read_bytes(pickled, pickled_length);
+    } finally {
+        if (pickled !== undefined) {
+            bzero(pickled, pickled_length);
+            free(pickled);
+        }
+        free(pointers);
+        free_pickle_key(pickle_key);
+    }
+};
+
+/* Load every session of a batch from pickle_inbound_group_sessions(). Returns
+ * an array with, for each session, {session: InboundGroupSession} or
+ * {error: String}; one session failing doesn't stop the rest loading. */
+olm_exports['unpickle_inbound_group_sessions'] = function(key, pickled) {
+    var pickle_key = make_pickle_key(key);
+    var pickled_buffer = malloc(Math.max(pickled.length, 1));
+    var sessions = [], pointers, errors, results = [];
+    try {
+        write_bytes(pickled, pickled_buffer);
+        var count = Module['_olm_pickle_batch_count'](
+            pickled_buffer, pickled.length
+        );
+        if (count === OLM_ERROR) {
+            throw new Error("OLM.CORRUPTED_PICKLE");
+        }
+        pointers = malloc_array(count);
+        errors = malloc_array(count);
+        for (var i = 0; i < count; ++i) {
+            sessions.push(new InboundGroupSession());
+            set_array(pointers, i, sessions[i].ptr);
+        }
+        Module['_olm_js_unpickle_inbound_group_session_batch'](
+            pickle_key, pickled_buffer, pickled.length, pointers, count, errors
+        );
+        for (i = 0; i < count; ++i) {
+            var error = Pointer_stringify(get_array(errors, i));
+            if (error === "SUCCESS") {
+                results.push({"session": sessions[i]});
+            } else {
+                sessions[i].free();
+                results.push({"error": "OLM." + error});
+            }
+        }
+        sessions = [];
+        return results;
+    } finally {
+        for (i = 0; i < sessions.length; ++i) {
+            sessions[i].free();
+        }
+        bzero(pickled_buffer, pickled.length);
+        free(pickled_buffer);
+        if (pointers !== undefined) {
+            free(pointers);
+            free(errors);
+        }
+        free_pickle_key(pickle_key);
+    }
+};
+
+/* Decrypt the messages of several InboundGroupSessions at once. batches is
+ * an array of {session: InboundGroupSession, messages: [String]}, with each
+ * session only appearing once. Returns an array of arrays of results, one
+ * for each message of each batch: {plaintext: String, message_index: Number}
+ * or {error: String}. */
+olm_exports['group_decrypt_batches'] = function(batches) {
+    var total = 0, i, j;
+    for (i = 0; i < batches.length; ++i) {
+        total += batches[i]['messages'].length;
+    }
+    var sessions = malloc_array(batches.length);
+    var counts = malloc_array(batches.length);
+    var messages = malloc_array(total);
+    var message_lengths = malloc_array(total);
+    var plaintexts = malloc_array(total);
+    var max_plaintext_lengths = malloc_array(total);
+    var plaintext_lengths = malloc_array(total);
+    var message_indices = malloc_array(total);
+    var errors = malloc_array(total);
+    var buffers = [];
+    try {
+        var n = 0;
+        for (i = 0; i < batches.length; ++i) {
+            var batch_messages = batches[i]['messages'];
+            set_array(sessions, i, batches[i]['session'].ptr);
+            set_array(counts, i, batch_messages.length);
+            for (j = 0; j < batch_messages.length; ++j, ++n) {
+                var message = batch_messages[j];
+                /* the plain-text is shorter than the base64 message, and
+                 * has a NULL added for UTF8ToString */
+                var size = 2 * message.length + NULL_BYTE_PADDING_LENGTH;
+                var buffer = malloc(size);
+                buffers.push({"ptr": buffer, "size": size});
+                Module['writeAsciiToMemory'](message, buffer, true);
+                set_array(messages, n, buffer);
+                set_array(message_lengths, n, message.length);
+                set_array(plaintexts, n, buffer + message.length);
+                set_array(max_plaintext_lengths, n, message.length);
+            }
+        }
+
+        Module['_olm_js_group_decrypt_batches'](
+            sessions, batches.length, counts,
+            messages, message_lengths,
+            plaintexts, max_plaintext_lengths, plaintext_lengths,
+            message_indices, errors
+        );
+
+        var results = [];
+        n = 0;
+        for (i = 0; i < batches.length; ++i) {
+            var batch_results = [];
+            for (j = 0; j < batches[i]['messages'].length; ++j, ++n) {
+                var plaintext_length = get_array(plaintext_lengths, n);
+                if (plaintext_length === OLM_ERROR) {
+                    var error = Pointer_stringify(get_array(errors, n));
+                    batch_results.push({"error": "OLM." + error});
+                    continue;
+                }
+                var plaintext = get_array(plaintexts, n);
+                Module['setValue'](plaintext + plaintext_length, 0, "i8");
+                batch_results.push({
+                    "plaintext": UTF8ToString(plaintext),
+                    "message_index": get_array(message_indices, n)
+                });
+            }
+            results.push(batch_results);
+        }
+        return results;
+    } finally {
+        for (i = 0; i < buffers.length; ++i) {
+            // don't leave a copy of the plaintext in the heap.
+            bzero(buffers[i]["ptr"], buffers[i]["size"]);
+            free(buffers[i]["ptr"]);
+        }
+        free(sessions);
+        free(counts);
+        free(messages);
+        free(message_lengths);
+        free(plaintexts);
+        free(max_plaintext_lengths);
+        free(plaintext_lengths);
+        free(message_indices);
+        free(errors);
+    }
+};
@@ -0,0 +1,54 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm_buffer.h"
+
+#include <stdlib.h>
+
+static void * allocate(void * context, size_t length) {
+    return malloc(length);
+}
+
+static void release(void * context, void * memory, size_t length) {
+    free(memory);
+}
+
+static const OlmAllocator allocator = { allocate, release, NULL };
+
+const OlmAllocator * olm_js_allocator(void) {
+    return &allocator;
+}
+
+OlmBuffer * olm_js_buffer(void) {
+    static const OlmBuffer empty = OLM_BUFFER_INIT;
+    OlmBuffer *buffer = (OlmBuffer *)malloc(sizeof(OlmBuffer));
+    if (buffer) {
+        *buffer = empty;
+    }
+    return buffer;
+}
+
+void olm_js_free_buffer(OlmBuffer * buffer) {
+    olm_buffer_release(buffer);
+    free(buffer);
+}
+
+uint8_t * olm_js_buffer_data(const OlmBuffer * buffer) {
+    return buffer->data;
+}
+
+size_t olm_js_buffer_length(const OlmBuffer * buffer) {
+    return buffer->length;
+}
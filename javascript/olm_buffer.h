@@ -0,0 +1,48 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Output buffers for the *_to_buffer() functions of the JavaScript bindings,
+ * which take their memory from emscripten's malloc. An object keeps one
+ * between calls, so that it only grows for the longest output. */
+
+#ifndef OLM_JS_BUFFER_H_
+#define OLM_JS_BUFFER_H_
+
+#include "olm/pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** An allocator which takes memory from malloc */
+const OlmAllocator * olm_js_allocator(void);
+
+/** malloc an empty buffer, or return NULL if there's no memory */
+OlmBuffer * olm_js_buffer(void);
+
+/** Release a buffer's memory and free the buffer */
+void olm_js_free_buffer(OlmBuffer * buffer);
+
+/** The output in a buffer, or NULL if there's none */
+uint8_t * olm_js_buffer_data(const OlmBuffer * buffer);
+
+/** The number of bytes of output in a buffer */
+size_t olm_js_buffer_length(const OlmBuffer * buffer);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_JS_BUFFER_H_ */
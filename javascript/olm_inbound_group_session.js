@@ -8,6 +8,8 @@ function InboundGroupSession() {
     var size = Module['_olm_inbound_group_session_size']();
     this.buf = malloc(size);
     this.ptr = Module['_olm_inbound_group_session'](this.buf);
+    this.scratch = new ScratchBuffer();
+    this.output = new OutputBuffer();
 }
 
 function inbound_group_session_method(wrapped) {
@@ -26,6 +28,8 @@ function inbound_group_session_method(wrapped) {
 InboundGroupSession.prototype['free'] = function() {
     Module['_olm_clear_inbound_group_session'](this.ptr);
     free(this.ptr);
+    this.scratch.release();
+    this.output.release();
 }
 
 InboundGroupSession.prototype['pickle'] = restore_stack(function(key) {
@@ -121,6 +125,32 @@ InboundGroupSession.prototype['decrypt'] = restore_stack(function(
     }
 });
 
+/* Like decrypt, but takes the message as a Uint8Array and returns the
+ * plaintext as a Uint8Array, reusing the session's heap buffers. */
+InboundGroupSession.prototype['decrypt_bytes'] = function(message) {
+    // the message index comes first, so that it's aligned
+    var size = 4 + message.length;
+    var message_index = this.scratch.reserve(size);
+    var message_buffer = message_index + 4;
+    try {
+        write_bytes(message, message_buffer);
+        inbound_group_session_method(
+            Module['_olm_group_decrypt_to_buffer']
+        )(
+            this.ptr,
+            message_buffer, message.length,
+            Module['_olm_js_allocator'](), this.output.get(),
+            message_index
+        );
+        return {
+            "plaintext": this.output.take(),
+            "message_index": Module['getValue'](message_index, "i32")
+        };
+    } finally {
+        this.scratch.wipe(size);
+    }
+};
+
 InboundGroupSession.prototype['session_id'] = restore_stack(function() {
     var length = inbound_group_session_method(
         Module['_olm_inbound_group_session_id_length']
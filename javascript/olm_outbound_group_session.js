@@ -9,6 +9,7 @@ function OutboundGroupSession() {
     var size = Module['_olm_outbound_group_session_size']();
     this.buf = malloc(size);
     this.ptr = Module['_olm_outbound_group_session'](this.buf);
+    this.scratch = new ScratchBuffer();
 }
 
 function outbound_group_session_method(wrapped) {
@@ -27,6 +28,7 @@ function outbound_group_session_method(wrapped) {
 OutboundGroupSession.prototype['free'] = function() {
     Module['_olm_clear_outbound_group_session'](this.ptr);
     free(this.ptr);
+    this.scratch.release();
 }
 
 OutboundGroupSession.prototype['pickle'] = restore_stack(function(key) {
@@ -104,6 +106,29 @@ OutboundGroupSession.prototype['encrypt'] = function(plaintext) {
     }
 };
 
+/* Like encrypt, but takes the plaintext as a Uint8Array and returns the
+ * message as a Uint8Array, reusing the session's heap buffer. */
+OutboundGroupSession.prototype['encrypt_bytes'] = function(plaintext) {
+    var message_length = outbound_group_session_method(
+        Module['_olm_group_encrypt_message_length']
+    )(this.ptr, plaintext.length);
+
+    var size = plaintext.length + message_length;
+    var plaintext_buffer = this.scratch.reserve(size);
+    var message_buffer = plaintext_buffer + plaintext.length;
+    try {
+        write_bytes(plaintext, plaintext_buffer);
+        outbound_group_session_method(Module['_olm_group_encrypt'])(
+            this.ptr,
+            plaintext_buffer, plaintext.length,
+            message_buffer, message_length
+        );
+        return read_bytes(message_buffer, message_length);
+    } finally {
+        this.scratch.wipe(size);
+    }
+};
+
 OutboundGroupSession.prototype['session_id'] = restore_stack(function() {
     var length = outbound_group_session_method(
         Module['_olm_outbound_group_session_id_length']
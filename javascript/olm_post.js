@@ -1,8 +1,12 @@
-var runtime = Module['Runtime'];
+/* the newer versions of emscripten needed for the WebAssembly build have
+ * dropped Runtime, Pointer_stringify, allocate and writeAsciiToMemory, so
+ * fall back to what replaced them */
+var runtime = Module['Runtime'] || Module;
 var malloc = Module['_malloc'];
 var free = Module['_free'];
-var Pointer_stringify = Module['Pointer_stringify'];
-var OLM_ERROR = Module['_olm_error']();
+var Pointer_stringify = Module['Pointer_stringify'] || Module['UTF8ToString'];
+/* set once the runtime has started */
+var OLM_ERROR;
 
 /* The 'length' argument to Pointer_stringify doesn't work if the input
  * includes characters >= 128, which makes Pointer_stringify unreliable. We
@@ -17,17 +21,47 @@ var NULL_BYTE_PADDING_LENGTH = 1;
  * If size_or_array is a Number, allocates that number of zero-initialised bytes.
  */
 function stack(size_or_array) {
-    return Module['allocate'](size_or_array, 'i8', Module['ALLOC_STACK']);
+    if (Module['allocate']) {
+        return Module['allocate'](size_or_array, 'i8', Module['ALLOC_STACK']);
+    }
+    var is_size = typeof(size_or_array) === 'number';
+    var size = is_size ? size_or_array : size_or_array.length;
+    var ptr = Module['stackAlloc'](size);
+    if (is_size) {
+        bzero(ptr, size);
+    } else {
+        Module['HEAPU8'].set(size_or_array, ptr);
+    }
+    return ptr;
+}
+
+if (!Module['writeAsciiToMemory']) {
+    Module['writeAsciiToMemory'] = function(string, buffer, dontAddNull) {
+        for (var i = 0; i < string.length; ++i) {
+            Module['HEAP8'][buffer++] = string.charCodeAt(i);
+        }
+        if (!dontAddNull) {
+            Module['HEAP8'][buffer] = 0;
+        }
+    };
 }
 
 function array_from_string(string) {
     return Module['intArrayFromString'](string, true);
 }
 
+/* fill size bytes of the heap with random data. getRandomValues won't write
+ * into the shared memory of the multithreaded build, so fill a copy. */
+function random_fill(ptr, size) {
+    var array = new Uint8Array(size);
+    get_random_values(array);
+    write_bytes(array, ptr);
+    array.fill(0);
+}
+
 function random_stack(size) {
     var ptr = stack(size);
-    var array = new Uint8Array(Module['HEAPU8'].buffer, ptr, size);
-    get_random_values(array);
+    random_fill(ptr, size);
     return ptr;
 }
 
@@ -49,6 +83,82 @@ function bzero(ptr, n) {
     }
 }
 
+/* A heap buffer that an object keeps between calls, so that busy sessions
+ * don't malloc and free for every message. It only grows, and is wiped after
+ * each call so that no plaintext is left in the heap. */
+function ScratchBuffer() {
+    this.ptr = 0;
+    this.size = 0;
+}
+
+/* get a buffer of at least size bytes. The contents aren't kept if it has
+ * to grow. */
+ScratchBuffer.prototype.reserve = function(size) {
+    if (size > this.size) {
+        this.release();
+        this.ptr = malloc(size);
+        this.size = size;
+    }
+    return this.ptr;
+};
+
+ScratchBuffer.prototype.wipe = function(length) {
+    bzero(this.ptr, Math.min(length, this.size));
+};
+
+ScratchBuffer.prototype.release = function() {
+    if (this.ptr) {
+        bzero(this.ptr, this.size);
+        free(this.ptr);
+    }
+    this.ptr = 0;
+    this.size = 0;
+};
+
+/* An OlmBuffer for the *_to_buffer functions to write into, which an object
+ * keeps between calls like a ScratchBuffer. The library grows it with
+ * malloc as needed. */
+function OutputBuffer() {
+    this.ptr = 0;
+}
+
+OutputBuffer.prototype.get = function() {
+    if (!this.ptr) {
+        this.ptr = Module['_olm_js_buffer']();
+        if (!this.ptr) {
+            throw new Error("OLM.ALLOCATION_FAILED");
+        }
+    }
+    return this.ptr;
+};
+
+/* copy the output of the last call out of the heap, and wipe it */
+OutputBuffer.prototype.take = function() {
+    var data = Module['_olm_js_buffer_data'](this.ptr);
+    var length = Module['_olm_js_buffer_length'](this.ptr);
+    var result = read_bytes(data, length);
+    bzero(data, length);
+    return result;
+};
+
+OutputBuffer.prototype.release = function() {
+    if (this.ptr) {
+        Module['_olm_js_free_buffer'](this.ptr);
+    }
+    this.ptr = 0;
+};
+
+/* copy a Uint8Array into the heap. The heap may have been replaced if
+ * memory grew, so look it up each time. */
+function write_bytes(array, ptr) {
+    Module['HEAPU8'].set(array, ptr);
+}
+
+/* copy length bytes out of the heap into a new Uint8Array */
+function read_bytes(ptr, length) {
+    return Module['HEAPU8'].slice(ptr, ptr + length);
+}
+
 function Account() {
     var size = Module['_olm_account_size']();
     this.buf = malloc(size);
@@ -176,6 +286,8 @@ function Session() {
     var size = Module['_olm_session_size']();
     this.buf = malloc(size);
     this.ptr = Module['_olm_session'](this.buf);
+    this.scratch = new ScratchBuffer();
+    this.output = new OutputBuffer();
 }
 
 function session_method(wrapped) {
@@ -194,6 +306,8 @@ function session_method(wrapped) {
 Session.prototype['free'] = function() {
     Module['_olm_clear_session'](this.ptr);
     free(this.ptr);
+    this.scratch.release();
+    this.output.release();
 }
 
 Session.prototype['pickle'] = restore_stack(function(key) {
@@ -404,6 +518,59 @@ Session.prototype['decrypt'] = restore_stack(function(
 
 });
 
+/* Like encrypt, but takes the plaintext as a Uint8Array and returns the body
+ * as a Uint8Array, reusing the session's heap buffer. */
+Session.prototype['encrypt_bytes'] = function(plaintext) {
+    var random_length = session_method(
+        Module['_olm_encrypt_random_length']
+    )(this.ptr);
+    var message_type = session_method(
+        Module['_olm_encrypt_message_type']
+    )(this.ptr);
+    var message_length = session_method(
+        Module['_olm_encrypt_message_length']
+    )(this.ptr, plaintext.length);
+
+    var size = random_length + plaintext.length + message_length;
+    var random = this.scratch.reserve(size);
+    var plaintext_buffer = random + random_length;
+    var message_buffer = plaintext_buffer + plaintext.length;
+    try {
+        random_fill(random, random_length);
+        write_bytes(plaintext, plaintext_buffer);
+        session_method(Module['_olm_encrypt'])(
+            this.ptr,
+            plaintext_buffer, plaintext.length,
+            random, random_length,
+            message_buffer, message_length
+        );
+        return {
+            "type": message_type,
+            "body": read_bytes(message_buffer, message_length),
+        };
+    } finally {
+        this.scratch.wipe(size);
+    }
+};
+
+/* Like decrypt, but takes the body as a Uint8Array and returns the plaintext
+ * as a Uint8Array, reusing the session's heap buffers. */
+Session.prototype['decrypt_bytes'] = function(message_type, message) {
+    var size = message.length;
+    var message_buffer = this.scratch.reserve(size);
+    try {
+        write_bytes(message, message_buffer);
+        session_method(Module['_olm_decrypt_to_buffer'])(
+            this.ptr, message_type,
+            message_buffer, message.length,
+            Module['_olm_js_allocator'](), this.output.get()
+        );
+        return this.output.take();
+    } finally {
+        this.scratch.wipe(size);
+    }
+};
+
 function Utility() {
     var size = Module['_olm_utility_size']();
     this.buf = malloc(size);
@@ -458,6 +625,15 @@ Utility.prototype['ed25519_verify'] = restore_stack(function(
     );
 });
 
+olm_exports["init"] = function() {
+    return new Promise(function(resolve) {
+        if (runtime_ready) {
+            resolve();
+        } else {
+            on_runtime_ready.push(resolve);
+        }
+    });
+};
 olm_exports["Account"] = Account;
 olm_exports["Session"] = Session;
 olm_exports["Utility"] = Utility;
@@ -472,6 +648,51 @@ olm_exports["get_library_version"] = restore_stack(function() {
     ];
 });
 
+var STATS_COUNTERS = [
+    "sha256_blocks", "hmac_sha256", "hkdf_sha256", "aes_blocks",
+    "curve25519_keys", "curve25519_shared_secrets", "ed25519_signs",
+    "ed25519_verifies", "megolm_rehashes", "chain_key_advances",
+];
+var STATS_OPERATIONS = [
+    "create_outbound_session", "create_inbound_session", "encrypt",
+    "decrypt", "group_encrypt", "group_decrypt", "pickle", "unpickle",
+];
+
+/* the counters are uint64_ts, read as numbers, which are exact up to 2^53 */
+function stats_value(ptr, index) {
+    var low = getValue(ptr + index * 8, 'i32') >>> 0;
+    var high = getValue(ptr + index * 8 + 4, 'i32') >>> 0;
+    return high * 4294967296 + low;
+}
+
+olm_exports["stats_enabled"] = function() {
+    return Module['_olm_stats_enabled']() != 0;
+};
+
+/* A snapshot of the counters in olm/stats.h, as a plain object. The time
+ * spent in each operation is in nanoseconds. */
+olm_exports["get_stats"] = restore_stack(function() {
+    var count = STATS_COUNTERS.length + 2 * STATS_OPERATIONS.length;
+    var buf = stack(count * 8);
+    Module['_olm_stats_get'](buf);
+    var result = {"calls": {}, "nanoseconds": {}};
+    var index = 0;
+    for (var i = 0; i < STATS_COUNTERS.length; i++) {
+        result[STATS_COUNTERS[i]] = stats_value(buf, index++);
+    }
+    for (i = 0; i < STATS_OPERATIONS.length; i++) {
+        result["calls"][STATS_OPERATIONS[i]] = stats_value(buf, index++);
+    }
+    for (i = 0; i < STATS_OPERATIONS.length; i++) {
+        result["nanoseconds"][STATS_OPERATIONS[i]] = stats_value(buf, index++);
+    }
+    return result;
+});
+
+olm_exports["reset_stats"] = function() {
+    Module['_olm_stats_reset']();
+};
+
 })();
 
 // export the olm functions into the environment.
@@ -489,4 +710,7 @@ if (typeof(window) !== 'undefined') {
     // (we do this even if module.exports was defined, because it's useful to have
     // Olm in the global scope for browserified and webpacked apps.)
     window["Olm"] = olm_exports;
+} else if (typeof(importScripts) === 'function') {
+    // We've been loaded into a Web Worker.
+    self["Olm"] = olm_exports;
 }
@@ -1,5 +1,7 @@
 var olm_exports = {};
 var get_random_values;
+/* WebCrypto's SubtleCrypto, if there is one, for olm_attachment.js */
+var subtle_crypto;
 var process; // Shadow the process object so that emscripten won't get
              // confused by browserify
 
@@ -8,6 +10,13 @@ if (typeof(window) !== 'undefined') {
     get_random_values = function(buf) {
         window.crypto.getRandomValues(buf);
     };
+    subtle_crypto = window.crypto.subtle;
+} else if (typeof(importScripts) === 'function') {
+    // We're in a Web Worker, such as olm_worker.js.
+    get_random_values = function(buf) {
+        self.crypto.getRandomValues(buf);
+    };
+    subtle_crypto = self.crypto.subtle;
 } else if (module["exports"]) {
     // We're running in node.
     var nodeCrypto = require("crypto");
@@ -15,6 +24,8 @@ if (typeof(window) !== 'undefined') {
         var bytes = nodeCrypto.randomBytes(buf.length);
         buf.set(bytes);
     };
+    // node 15 and later
+    subtle_crypto = nodeCrypto.webcrypto && nodeCrypto.webcrypto.subtle;
     process = global["process"];
 } else {
     throw new Error("Cannot find global to attach library to");
@@ -31,3 +42,20 @@ if (typeof(window) !== 'undefined') {
             }
         }
     }
+
+    /* the WebAssembly build is compiled asynchronously, so the library can't
+     * be used until emscripten has started the runtime; olm_exports.init()
+     * returns a promise for that */
+    var runtime_ready = false;
+    var on_runtime_ready = [];
+    var options_on_runtime_initialized = Module['onRuntimeInitialized'];
+    Module['onRuntimeInitialized'] = function() {
+        OLM_ERROR = Module['_olm_error']();
+        runtime_ready = true;
+        if (options_on_runtime_initialized) {
+            options_on_runtime_initialized();
+        }
+        while (on_runtime_ready.length) {
+            on_runtime_ready.shift()();
+        }
+    };
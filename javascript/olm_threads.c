@@ -0,0 +1,216 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm_threads.h"
+
+#include "olm/error.h"
+#include "olm/executor.h"
+
+#include <stdlib.h>
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <pthread.h>
+#endif
+
+/* The threads can only be started without going back to the browser's event
+ * loop while there are Web Workers waiting in emscripten's pool, so the
+ * makefile sets this to the size of the pool. */
+#if !defined(__EMSCRIPTEN_PTHREADS__)
+#undef OLM_JS_MAX_THREADS
+#define OLM_JS_MAX_THREADS 0
+#elif !defined(OLM_JS_MAX_THREADS)
+#define OLM_JS_MAX_THREADS 4
+#endif
+
+/** How many sessions each job of olm_js_unpickle_inbound_group_session_batch
+ * loads */
+#define UNPICKLE_JOB_LENGTH 64
+
+static OlmWorkPool *pool;
+static size_t thread_count;
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+
+static pthread_t threads[OLM_JS_MAX_THREADS];
+
+static void *work(void *context) {
+    olm_work_pool_work((OlmWorkPool *)context);
+    return NULL;
+}
+
+#endif
+
+size_t olm_js_max_threads(void) {
+    return OLM_JS_MAX_THREADS;
+}
+
+size_t olm_js_start_threads(size_t count) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    if (count > OLM_JS_MAX_THREADS) {
+        count = OLM_JS_MAX_THREADS;
+    }
+    if (!pool && count) {
+        void *memory = malloc(olm_work_pool_size());
+        if (!memory) {
+            return 0;
+        }
+        pool = olm_work_pool(memory);
+    }
+    while (thread_count < count) {
+        if (pthread_create(&threads[thread_count], NULL, work, pool) != 0) {
+            break;
+        }
+        thread_count++;
+    }
+#endif
+    return thread_count;
+}
+
+void olm_js_stop_threads(void) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    size_t i;
+    if (!pool) {
+        return;
+    }
+    olm_work_pool_stop(pool);
+    for (i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    thread_count = 0;
+    olm_clear_work_pool(pool);
+    free(pool);
+    pool = NULL;
+#endif
+}
+
+/** Run the jobs on the threads if there are any, or here if not */
+static void run_jobs(OlmBatchJob job, void *context, size_t job_count) {
+    size_t i;
+    if (thread_count) {
+        olm_work_pool_executor(pool, job, context, job_count);
+    } else {
+        for (i = 0; i < job_count; ++i) {
+            job(context, i);
+        }
+    }
+}
+
+
+/** An OlmBatchExecutor which runs the jobs on the threads if there are any */
+static void executor(
+    void *context, OlmBatchJob job, void *job_context, size_t job_count
+) {
+    run_jobs(job, job_context, job_count);
+}
+
+size_t olm_js_group_decrypt_batches(
+    OlmInboundGroupSession * const * sessions, size_t session_count,
+    const size_t * message_counts,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors
+) {
+    OlmInboundGroupSession **message_sessions;
+    size_t *scratch, scratch_length, total = 0, result, i, j, n = 0;
+
+    for (i = 0; i < session_count; ++i) {
+        total += message_counts[i];
+    }
+    scratch_length = olm_group_decrypt_across_sessions_scratch_length(total);
+    message_sessions = (OlmInboundGroupSession **)malloc(
+        (total + 1) * sizeof(OlmInboundGroupSession *)
+    );
+    scratch = (size_t *)malloc(scratch_length * sizeof(size_t));
+    if (!message_sessions || !scratch) {
+        free(message_sessions);
+        free(scratch);
+        return (size_t)-1;
+    }
+    for (i = 0; i < session_count; ++i) {
+        for (j = 0; j < message_counts[i]; ++j) {
+            message_sessions[n++] = sessions[i];
+        }
+    }
+    result = olm_group_decrypt_across_sessions(
+        message_sessions, total, messages, message_lengths,
+        plaintexts, max_plaintext_lengths, plaintext_lengths,
+        message_indices, errors, scratch, scratch_length,
+        executor, NULL
+    );
+    free(message_sessions);
+    free(scratch);
+    return result;
+}
+
+
+struct UnpickleBatch {
+    const OlmPickleKey * pickle_key;
+    void * pickled;
+    size_t pickled_length;
+    OlmInboundGroupSession * const * sessions;
+    size_t count;
+};
+
+static void unpickle_job(void *context, size_t job) {
+    struct UnpickleBatch *batch = (struct UnpickleBatch *)context;
+    size_t first = job * UNPICKLE_JOB_LENGTH;
+    size_t end = first + UNPICKLE_JOB_LENGTH;
+    size_t i;
+
+    if (end > batch->count) {
+        end = batch->count;
+    }
+    /* If a session fails to load, those before it have loaded and those
+     * after it are untouched, so carry on from the one after it. */
+    while (first < end) {
+        olm_unpickle_inbound_group_session_batch(
+            batch->pickle_key, batch->pickled, batch->pickled_length,
+            first, batch->sessions + first, end - first
+        );
+        for (i = first; i < end; ++i) {
+            if (olm_inbound_group_session_last_error_code(batch->sessions[i])
+                    != OLM_SUCCESS) {
+                break;
+            }
+        }
+        first = i + 1;
+    }
+}
+
+size_t olm_js_unpickle_inbound_group_session_batch(
+    const OlmPickleKey * pickle_key,
+    void * pickled, size_t pickled_length,
+    OlmInboundGroupSession * const * sessions, size_t count,
+    const char ** errors
+) {
+    struct UnpickleBatch batch = {
+        pickle_key, pickled, pickled_length, sessions, count
+    };
+    size_t failures = 0, i;
+
+    run_jobs(
+        unpickle_job, &batch,
+        (count + UNPICKLE_JOB_LENGTH - 1) / UNPICKLE_JOB_LENGTH
+    );
+    for (i = 0; i < count; ++i) {
+        errors[i] = olm_inbound_group_session_last_error(sessions[i]);
+        if (olm_inbound_group_session_last_error_code(sessions[i])
+                != OLM_SUCCESS) {
+            failures++;
+        }
+    }
+    return failures;
+}
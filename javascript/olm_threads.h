@@ -0,0 +1,90 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The C side of the batch functions of the JavaScript bindings, which is
+ * only built into olm.js. In the multithreaded WebAssembly build, from
+ * make wasm_threads, the batches are spread over threads running on Web
+ * Workers which share the WebAssembly memory; in the other builds they run
+ * one job after another on the calling thread, with the same results.
+ *
+ * The library itself still starts no threads: these functions start them
+ * for the bindings, with a work pool from olm/executor.h for them to work
+ * for. */
+
+#ifndef OLM_JS_THREADS_H_
+#define OLM_JS_THREADS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "olm/inbound_group_session.h"
+#include "olm/pickle_key.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The most threads olm_js_start_threads() can start, which is the number
+ * of Web Workers emscripten starts with the module; 0 in a build without
+ * threads */
+size_t olm_js_max_threads(void);
+
+/** Start threads working for the batch functions until there are count of
+ * them, or as many as there can be. Returns the number now working. */
+size_t olm_js_start_threads(size_t count);
+
+/** Stop the threads started by olm_js_start_threads() once they have
+ * finished what they are doing, after which the batch functions run on the
+ * calling thread again */
+void olm_js_stop_threads(void);
+
+/**
+ * Decrypt the messages of several group sessions with
+ * olm_group_decrypt_across_sessions(), spreading the work over the threads:
+ * session s has the next message_counts[s] entries of the message and
+ * plain-text arrays, so message_counts holds session_count counts and the
+ * other arrays as many entries as they add up to. A session must only appear
+ * once. Returns the number of messages which couldn't be decrypted.
+ */
+size_t olm_js_group_decrypt_batches(
+    OlmInboundGroupSession * const * sessions, size_t session_count,
+    const size_t * message_counts,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors
+);
+
+/**
+ * Load all count sessions of a batch made by
+ * olm_pickle_inbound_group_session_batch(), spreading them over the threads
+ * in runs of 64. errors[i] is set to the error for session i, as
+ * olm_unpickle_inbound_group_session_batch() would have left in its
+ * last_error, or "SUCCESS"; one session failing to load doesn't stop the
+ * others. The sessions must not have failed before. Returns the number
+ * which couldn't be loaded.
+ */
+size_t olm_js_unpickle_inbound_group_session_batch(
+    const OlmPickleKey * pickle_key,
+    void * pickled, size_t pickled_length,
+    OlmInboundGroupSession * const * sessions, size_t count,
+    const char ** errors
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OLM_JS_THREADS_H_ */
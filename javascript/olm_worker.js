@@ -0,0 +1,177 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The Web Worker side of olm_worker_pool.js. It keeps group sessions in the
+ * worker and runs the requests the pool sends it, so that decrypting doesn't
+ * block the page.
+ *
+ * It loads olm.js from next to itself, or the script given by an "olm"
+ * parameter, e.g. olm_worker.js?olm=wasm/olm.js. The multithreaded build,
+ * wasm_threads/olm.js, needs SharedArrayBuffer, so where the page isn't
+ * cross-origin isolated the worker loads wasm/olm.js instead.
+ */
+
+"use strict";
+
+var olm_script = (function() {
+    var match = /[?&]olm=([^&]*)/.exec(self.location.search);
+    var script = match ? decodeURIComponent(match[1]) : "olm.js";
+    if (!self.crossOriginIsolated) {
+        script = script.replace(/(^|\/)wasm_threads\//, "$1wasm/");
+    }
+    return script;
+})();
+
+/* find olm.wasm next to the script that loads it, rather than next to the
+ * worker */
+var OLM_OPTIONS = {
+    locateFile: function(path) {
+        return new URL(
+            path, new URL(olm_script, self.location.href)
+        ).href;
+    },
+    /* the multithreaded build starts its threads' workers from this */
+    mainScriptUrlOrBlob: new URL(olm_script, self.location.href).href
+};
+
+importScripts(olm_script);
+
+var ready = Olm.init ? Olm.init() : Promise.resolve();
+
+/* the sessions in this worker, by the handle the pool gave them */
+var sessions = {};
+
+function add_session(handle, session, setup) {
+    try {
+        setup(session);
+    } catch (e) {
+        session.free();
+        throw e;
+    }
+    sessions[handle] = session;
+}
+
+function get_session(handle) {
+    var session = sessions[handle];
+    if (session === undefined) {
+        throw new Error("OLM.UNKNOWN_SESSION_HANDLE");
+    }
+    return session;
+}
+
+function from_ascii(string) {
+    var array = new Uint8Array(string.length);
+    for (var i = 0; i < string.length; ++i) {
+        array[i] = string.charCodeAt(i);
+    }
+    return array;
+}
+
+/* Each operation is passed a list to add any ArrayBuffers it returns to, so
+ * that they are transferred rather than copied. */
+var operations = {
+    create_inbound: function(transfer, handle, session_key) {
+        add_session(handle, new Olm.InboundGroupSession(), function(session) {
+            session.create(session_key);
+        });
+    },
+
+    import_inbound: function(transfer, handle, session_key) {
+        add_session(handle, new Olm.InboundGroupSession(), function(session) {
+            session.import_session(session_key);
+        });
+    },
+
+    unpickle_inbound: function(transfer, handle, key, pickle) {
+        add_session(handle, new Olm.InboundGroupSession(), function(session) {
+            session.unpickle(key, pickle);
+        });
+    },
+
+    create_outbound: function(transfer, handle) {
+        add_session(handle, new Olm.OutboundGroupSession(), function(session) {
+            session.create();
+        });
+    },
+
+    unpickle_outbound: function(transfer, handle, key, pickle) {
+        add_session(handle, new Olm.OutboundGroupSession(), function(session) {
+            session.unpickle(key, pickle);
+        });
+    },
+
+    pickle: function(transfer, handle, key) {
+        return get_session(handle).pickle(key);
+    },
+
+    session_id: function(transfer, handle) {
+        return get_session(handle).session_id();
+    },
+
+    session_key: function(transfer, handle) {
+        return get_session(handle).session_key();
+    },
+
+    encrypt: function(transfer, handle, plaintext) {
+        var message = get_session(handle).encrypt_bytes(plaintext);
+        transfer.push(message.buffer);
+        return message;
+    },
+
+    decrypt_batch: function(transfer, handle, messages) {
+        var session = get_session(handle);
+        var results = [];
+        for (var i = 0; i < messages.length; ++i) {
+            var message = messages[i];
+            if (typeof(message) === 'string') {
+                message = from_ascii(message);
+            }
+            try {
+                var result = session.decrypt_bytes(message);
+                transfer.push(result.plaintext.buffer);
+                results.push(result);
+            } catch (e) {
+                results.push({"error": e.message});
+            }
+        }
+        return results;
+    },
+
+    free: function(transfer, handle) {
+        get_session(handle).free();
+        delete sessions[handle];
+    }
+};
+
+self.onmessage = function(event) {
+    var request = event.data;
+    ready.then(function() {
+        var transfer = [];
+        var result;
+        try {
+            var operation = operations[request.op];
+            if (operation === undefined) {
+                throw new Error("OLM.UNKNOWN_OPERATION");
+            }
+            result = operation.apply(
+                null, [transfer].concat(request.args)
+            );
+        } catch (e) {
+            self.postMessage({"id": request.id, "error": e.message});
+            return;
+        }
+        self.postMessage({"id": request.id, "result": result}, transfer);
+    });
+};
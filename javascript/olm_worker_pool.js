@@ -0,0 +1,186 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Keeps group sessions in a pool of Web Workers running olm_worker.js, so
+ * that decrypting a large backlog doesn't block the page. Every method
+ * returns a promise.
+ *
+ * Sessions are referred to by handles, which the create and unpickle methods
+ * resolve to. Each session lives in one worker, so its messages are handled
+ * in order; different sessions are spread over the workers.
+ *
+ *     var pool = new OlmWorkerPool("olm_worker.js", 4);
+ *     pool.create_inbound(session_key).then(function(handle) {
+ *         return pool.decrypt_batch(handle, messages);
+ *     }).then(function(results) {
+ *         // each result is {plaintext: Uint8Array, message_index: Number}
+ *         // or {error: String}
+ *     });
+ *
+ * Messages and plaintexts given as Uint8Arrays have their ArrayBuffers
+ * transferred to the worker rather than copied, so they can't be used again
+ * afterwards. Results are transferred back the same way.
+ */
+
+(function() {
+
+"use strict";
+
+function OlmWorkerPool(worker_url, worker_count) {
+    this.workers = [];
+    for (var i = 0; i < (worker_count || 1); ++i) {
+        var worker = new Worker(worker_url);
+        worker.onmessage = this.on_message.bind(this);
+        this.workers.push(worker);
+    }
+    this.next_worker = 0;
+    this.next_handle = 0;
+    this.next_request = 0;
+    /* the worker each session handle is in */
+    this.session_workers = {};
+    /* the promise callbacks for each request still being run */
+    this.requests = {};
+}
+
+OlmWorkerPool.prototype.on_message = function(event) {
+    var response = event.data;
+    var request = this.requests[response.id];
+    delete this.requests[response.id];
+    if (response.error !== undefined) {
+        request.reject(new Error(response.error));
+    } else {
+        request.resolve(response.result);
+    }
+};
+
+OlmWorkerPool.prototype.send = function(worker, op, args, transfer) {
+    var self = this;
+    return new Promise(function(resolve, reject) {
+        var id = self.next_request++;
+        self.requests[id] = {resolve: resolve, reject: reject};
+        worker.postMessage({"id": id, "op": op, "args": args}, transfer || []);
+    });
+};
+
+/* send a request for a session that already exists */
+OlmWorkerPool.prototype.send_to_session = function(handle, op, args, transfer) {
+    var worker = this.session_workers[handle];
+    if (worker === undefined) {
+        return Promise.reject(new Error("OLM.UNKNOWN_SESSION_HANDLE"));
+    }
+    return this.send(worker, op, [handle].concat(args || []), transfer);
+};
+
+/* make a session in the next worker, resolving to its handle */
+OlmWorkerPool.prototype.add_session = function(op, args) {
+    var self = this;
+    var handle = this.next_handle++;
+    var worker = this.workers[this.next_worker];
+    this.next_worker = (this.next_worker + 1) % this.workers.length;
+    this.session_workers[handle] = worker;
+    return this.send(worker, op, [handle].concat(args)).then(function() {
+        return handle;
+    }, function(e) {
+        delete self.session_workers[handle];
+        throw e;
+    });
+};
+
+/* the ArrayBuffers of the Uint8Arrays in a list, without duplicates */
+function buffers_of(arrays) {
+    var buffers = [];
+    for (var i = 0; i < arrays.length; ++i) {
+        var buffer = arrays[i].buffer;
+        if (buffer !== undefined && buffers.indexOf(buffer) < 0) {
+            buffers.push(buffer);
+        }
+    }
+    return buffers;
+}
+
+OlmWorkerPool.prototype['create_inbound'] = function(session_key) {
+    return this.add_session("create_inbound", [session_key]);
+};
+
+OlmWorkerPool.prototype['import_inbound'] = function(session_key) {
+    return this.add_session("import_inbound", [session_key]);
+};
+
+OlmWorkerPool.prototype['unpickle_inbound'] = function(key, pickle) {
+    return this.add_session("unpickle_inbound", [key, pickle]);
+};
+
+OlmWorkerPool.prototype['create_outbound'] = function() {
+    return this.add_session("create_outbound", []);
+};
+
+OlmWorkerPool.prototype['unpickle_outbound'] = function(key, pickle) {
+    return this.add_session("unpickle_outbound", [key, pickle]);
+};
+
+OlmWorkerPool.prototype['pickle'] = function(handle, key) {
+    return this.send_to_session(handle, "pickle", [key]);
+};
+
+OlmWorkerPool.prototype['session_id'] = function(handle) {
+    return this.send_to_session(handle, "session_id");
+};
+
+/* the session key of an outbound session */
+OlmWorkerPool.prototype['session_key'] = function(handle) {
+    return this.send_to_session(handle, "session_key");
+};
+
+/* encrypt a Uint8Array with an outbound session, resolving to the message as
+ * a Uint8Array */
+OlmWorkerPool.prototype['encrypt'] = function(handle, plaintext) {
+    return this.send_to_session(
+        handle, "encrypt", [plaintext], buffers_of([plaintext])
+    );
+};
+
+/* decrypt a list of messages, given as strings or Uint8Arrays, with an
+ * inbound session. One message failing doesn't stop the others. */
+OlmWorkerPool.prototype['decrypt_batch'] = function(handle, messages) {
+    return this.send_to_session(
+        handle, "decrypt_batch", [messages], buffers_of(messages)
+    );
+};
+
+OlmWorkerPool.prototype['free'] = function(handle) {
+    var self = this;
+    return this.send_to_session(handle, "free").then(function() {
+        delete self.session_workers[handle];
+    });
+};
+
+/* stop the workers, and with them all their sessions */
+OlmWorkerPool.prototype['terminate'] = function() {
+    for (var i = 0; i < this.workers.length; ++i) {
+        this.workers[i].terminate();
+    }
+    this.workers = [];
+    this.session_workers = {};
+};
+
+if (typeof module !== 'undefined' && module.exports) {
+    module.exports = OlmWorkerPool;
+}
+
+if (typeof(window) !== 'undefined') {
+    window["OlmWorkerPool"] = OlmWorkerPool;
+}
+
+})();
@@ -0,0 +1,73 @@
+/*
+Copyright 2016 OpenMarket Ltd
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+"use strict";
+
+var Olm = require('../olm');
+
+describe("attachment", function() {
+    var plaintext = new Uint8Array(100000);
+    for (var i = 0; i < plaintext.length; ++i) {
+        plaintext[i] = i * 7;
+    }
+
+    afterEach(function() {
+        Olm.set_subtle_crypto_threshold(64 * 1024);
+    });
+
+    function round_trip(encrypt_threshold, decrypt_threshold, done) {
+        Olm.set_subtle_crypto_threshold(encrypt_threshold);
+        Olm.encrypt_attachment(plaintext).then(function(encrypted) {
+            expect(encrypted.ciphertext.length).toEqual(plaintext.length);
+            expect(encrypted.sha256.length).toEqual(43);
+            Olm.set_subtle_crypto_threshold(decrypt_threshold);
+            return Olm.decrypt_attachment(encrypted.ciphertext, encrypted);
+        }).then(function(decrypted) {
+            expect(decrypted).toEqual(plaintext);
+        }).then(done, function(error) {
+            expect(error).toBeUndefined();
+            done();
+        });
+    }
+
+    it('should decrypt what the library encrypted', function(done) {
+        round_trip(Infinity, Infinity, done);
+    });
+
+    it('should give the same results with WebCrypto', function(done) {
+        if (!Olm.set_subtle_crypto_threshold(0)) {
+            // no WebCrypto here
+            done();
+            return;
+        }
+        round_trip(0, Infinity, function() {
+            round_trip(Infinity, 0, done);
+        });
+    });
+
+    it('should reject a bad hash', function(done) {
+        Olm.encrypt_attachment(plaintext).then(function(encrypted) {
+            encrypted.ciphertext[0] ^= 1;
+            return Olm.decrypt_attachment(encrypted.ciphertext, encrypted);
+        }).then(function() {
+            expect("decrypted").toEqual("rejected");
+            done();
+        }, function(error) {
+            expect(error.message).toEqual("OLM.BAD_MESSAGE_MAC");
+            done();
+        });
+    });
+});
@@ -65,4 +65,34 @@ describe("megolm", function() {
         expect(decrypted.plaintext).toEqual(TEST_TEXT);
         expect(decrypted.message_index).toEqual(2);
     });
+
+    it("should encrypt and decrypt bytes", function() {
+        aliceSession.create();
+        bobSession.create(aliceSession.session_key());
+
+        var plaintext = new Uint8Array([0, 1, 2, 255, 128]);
+        var encrypted = aliceSession.encrypt_bytes(plaintext);
+        var decrypted = bobSession.decrypt_bytes(encrypted);
+        expect(Array.from(decrypted.plaintext)).toEqual(Array.from(plaintext));
+        expect(decrypted.message_index).toEqual(0);
+
+        // a longer message grows the buffers, then a shorter one reuses them
+        plaintext = new Uint8Array(1000);
+        plaintext.fill(7);
+        decrypted = bobSession.decrypt_bytes(aliceSession.encrypt_bytes(plaintext));
+        expect(Array.from(decrypted.plaintext)).toEqual(Array.from(plaintext));
+        expect(decrypted.message_index).toEqual(1);
+
+        plaintext = new Uint8Array([42]);
+        decrypted = bobSession.decrypt_bytes(aliceSession.encrypt_bytes(plaintext));
+        expect(Array.from(decrypted.plaintext)).toEqual([42]);
+        expect(decrypted.message_index).toEqual(2);
+
+        // the byte and string forms are the same messages
+        encrypted = aliceSession.encrypt("☕");
+        decrypted = bobSession.decrypt_bytes(new Uint8Array(
+            encrypted.split("").map(function(c) { return c.charCodeAt(0); })
+        ));
+        expect(Array.from(decrypted.plaintext)).toEqual([0xe2, 0x98, 0x95]);
+    });
 });
@@ -91,4 +91,34 @@ describe("olm", function() {
         console.log(TEST_TEXT, "->", decrypted);
         expect(decrypted).toEqual(TEST_TEXT);
     });
+
+    it('should encrypt and decrypt bytes', function() {
+        aliceAccount.create();
+        bobAccount.create();
+
+        bobAccount.generate_one_time_keys(1);
+        var bobOneTimeKeys = JSON.parse(bobAccount.one_time_keys()).curve25519;
+        var bobIdKey = JSON.parse(bobAccount.identity_keys()).curve25519;
+        var otk_id = Object.keys(bobOneTimeKeys)[0];
+
+        aliceSession.create_outbound(
+            aliceAccount, bobIdKey, bobOneTimeKeys[otk_id]
+        );
+
+        var plaintext = new Uint8Array([0, 1, 2, 255, 128]);
+        var encrypted = aliceSession.encrypt_bytes(plaintext);
+        expect(encrypted.type).toEqual(0);
+        bobSession.create_inbound(
+            bobAccount, String.fromCharCode.apply(null, encrypted.body)
+        );
+        var decrypted = bobSession.decrypt_bytes(encrypted.type, encrypted.body);
+        expect(Array.from(decrypted)).toEqual(Array.from(plaintext));
+
+        plaintext = new Uint8Array(1000);
+        plaintext.fill(7);
+        encrypted = bobSession.encrypt_bytes(plaintext);
+        expect(encrypted.type).toEqual(1);
+        decrypted = aliceSession.decrypt_bytes(encrypted.type, encrypted.body);
+        expect(Array.from(decrypted)).toEqual(Array.from(plaintext));
+    });
 });
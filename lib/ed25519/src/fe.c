@@ -30,6 +30,10 @@ static uint64_t load_4(const unsigned char *in) {
 
 #endif
 
+#ifdef ED25519_FE51
+#include "fe_51.c"
+#else
+
 /*
     h = 0
 */
@@ -361,6 +365,7 @@ void fe_frombytes(fe h, const unsigned char *s) {
     h[9] = (int32_t) h9;
 }
 
+#endif /* ED25519_FE51 */
 
 
 void fe_invert(fe out, const fe z) {
@@ -523,6 +528,8 @@ int fe_isnonzero(const fe f) {
 
 
 
+#ifndef ED25519_FE51
+
 /*
     h = f * g
     Can overlap h with f or g.
@@ -879,6 +886,8 @@ void fe_neg(fe h, const fe f) {
     h[9] = h9;
 }
 
+#endif /* ED25519_FE51 */
+
 
 void fe_pow22523(fe out, const fe z) {
     fe t0;
@@ -966,6 +975,8 @@ void fe_pow22523(fe out, const fe z) {
 }
 
 
+#ifndef ED25519_FE51
+
 /*
 h = f * f
 Can overlap h with f.
@@ -1491,3 +1502,5 @@ void fe_tobytes(unsigned char *s, const fe h) {
     s[30] = (unsigned char) (h9 >> 10);
     s[31] = (unsigned char) (h9 >> 18);
 }
+
+#endif /* ED25519_FE51 */
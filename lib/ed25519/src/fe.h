@@ -10,10 +10,20 @@
     An element t, entries t[0]...t[9], represents the integer
     t[0]+2^26 t[1]+2^51 t[2]+2^77 t[3]+2^102 t[4]+...+2^230 t[9].
     Bounds on each t[i] vary depending on context.
+
+    On 64-bit targets with a 128-bit integer type fe_51.c is used instead,
+    with five unsigned 51-bit limbs (see there). Define ED25519_NO_FE51 to
+    keep the representation above.
 */
 
 
+#if !defined(ED25519_NO_FE51) && defined(__SIZEOF_INT128__) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define ED25519_FE51
+typedef uint64_t fe[5];
+#else
 typedef int32_t fe[10];
+#endif
 
 
 void fe_0(fe h);
@@ -0,0 +1,414 @@
+/*
+    Field arithmetic for 64-bit targets, included by fe.c when fe.h picks
+    ED25519_FE51.
+
+    An element t, entries t[0]...t[4], represents the integer
+    t[0]+2^51 t[1]+2^102 t[2]+2^153 t[3]+2^204 t[4].
+    The entries are unsigned. Every function leaves each entry below
+    2^51+2^10 and relies on its inputs being so, which means results can be
+    passed straight back in without the caller tracking bounds.
+
+    Products of two entries are at most 104 bits and are accumulated in
+    128-bit integers; the high entries wrap round to the low ones multiplied
+    by 19, since 2^255 = 19 mod q.
+*/
+
+__extension__ typedef unsigned __int128 fe_uint128;
+
+#define FE51_MASK ((((uint64_t) 1) << 51) - 1)
+
+/* 2q, entry by entry, so that subtracting an entry below 2^52 from it
+   never goes negative */
+#define FE51_2Q0 0xfffffffffffdaULL
+#define FE51_2QN 0xffffffffffffeULL
+
+static uint64_t load_8(const unsigned char *in) {
+    uint64_t result;
+
+    result = (uint64_t) in[0];
+    result |= ((uint64_t) in[1]) << 8;
+    result |= ((uint64_t) in[2]) << 16;
+    result |= ((uint64_t) in[3]) << 24;
+    result |= ((uint64_t) in[4]) << 32;
+    result |= ((uint64_t) in[5]) << 40;
+    result |= ((uint64_t) in[6]) << 48;
+    result |= ((uint64_t) in[7]) << 56;
+
+    return result;
+}
+
+static void store_8(unsigned char *out, uint64_t in) {
+    out[0] = (unsigned char) in;
+    out[1] = (unsigned char) (in >> 8);
+    out[2] = (unsigned char) (in >> 16);
+    out[3] = (unsigned char) (in >> 24);
+    out[4] = (unsigned char) (in >> 32);
+    out[5] = (unsigned char) (in >> 40);
+    out[6] = (unsigned char) (in >> 48);
+    out[7] = (unsigned char) (in >> 56);
+}
+
+
+
+/*
+    Propagate the carries out of each entry into the next one, once round.
+
+    Preconditions:
+       entries of h below 2^54.
+
+    Postconditions:
+       entries of h below 2^51+2^10.
+*/
+
+static void fe_carry(fe h) {
+    uint64_t h0 = h[0];
+    uint64_t h1 = h[1];
+    uint64_t h2 = h[2];
+    uint64_t h3 = h[3];
+    uint64_t h4 = h[4];
+
+    h1 += h0 >> 51;
+    h0 &= FE51_MASK;
+    h2 += h1 >> 51;
+    h1 &= FE51_MASK;
+    h3 += h2 >> 51;
+    h2 &= FE51_MASK;
+    h4 += h3 >> 51;
+    h3 &= FE51_MASK;
+    h0 += 19 * (h4 >> 51);
+    h4 &= FE51_MASK;
+
+    h[0] = h0;
+    h[1] = h1;
+    h[2] = h2;
+    h[3] = h3;
+    h[4] = h4;
+}
+
+
+
+/*
+    h = 0
+*/
+
+void fe_0(fe h) {
+    h[0] = 0;
+    h[1] = 0;
+    h[2] = 0;
+    h[3] = 0;
+    h[4] = 0;
+}
+
+
+
+/*
+    h = 1
+*/
+
+void fe_1(fe h) {
+    h[0] = 1;
+    h[1] = 0;
+    h[2] = 0;
+    h[3] = 0;
+    h[4] = 0;
+}
+
+
+
+/*
+    h = f + g
+    Can overlap h with f or g.
+*/
+
+void fe_add(fe h, const fe f, const fe g) {
+    h[0] = f[0] + g[0];
+    h[1] = f[1] + g[1];
+    h[2] = f[2] + g[2];
+    h[3] = f[3] + g[3];
+    h[4] = f[4] + g[4];
+    fe_carry(h);
+}
+
+
+
+/*
+    h = f - g
+    Can overlap h with f or g.
+*/
+
+void fe_sub(fe h, const fe f, const fe g) {
+    h[0] = f[0] + FE51_2Q0 - g[0];
+    h[1] = f[1] + FE51_2QN - g[1];
+    h[2] = f[2] + FE51_2QN - g[2];
+    h[3] = f[3] + FE51_2QN - g[3];
+    h[4] = f[4] + FE51_2QN - g[4];
+    fe_carry(h);
+}
+
+
+
+/*
+    h = -f
+*/
+
+void fe_neg(fe h, const fe f) {
+    h[0] = FE51_2Q0 - f[0];
+    h[1] = FE51_2QN - f[1];
+    h[2] = FE51_2QN - f[2];
+    h[3] = FE51_2QN - f[3];
+    h[4] = FE51_2QN - f[4];
+    fe_carry(h);
+}
+
+
+
+/*
+    h = f
+*/
+
+void fe_copy(fe h, const fe f) {
+    h[0] = f[0];
+    h[1] = f[1];
+    h[2] = f[2];
+    h[3] = f[3];
+    h[4] = f[4];
+}
+
+
+
+/*
+    Replace (f,g) with (g,g) if b == 1;
+    replace (f,g) with (f,g) if b == 0.
+
+    Preconditions: b in {0,1}.
+*/
+
+void fe_cmov(fe f, const fe g, unsigned int b) {
+    uint64_t mask = 0 - (uint64_t) b;
+
+    f[0] ^= mask & (f[0] ^ g[0]);
+    f[1] ^= mask & (f[1] ^ g[1]);
+    f[2] ^= mask & (f[2] ^ g[2]);
+    f[3] ^= mask & (f[3] ^ g[3]);
+    f[4] ^= mask & (f[4] ^ g[4]);
+}
+
+
+
+/*
+    Replace (f,g) with (g,f) if b == 1;
+    replace (f,g) with (f,g) if b == 0.
+
+    Preconditions: b in {0,1}.
+*/
+
+void fe_cswap(fe f, fe g, unsigned int b) {
+    uint64_t mask = 0 - (uint64_t) b;
+    uint64_t x;
+    int i;
+
+    for (i = 0; i < 5; ++i) {
+        x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+
+
+/*
+    Ignores top bit of s.
+*/
+
+void fe_frombytes(fe h, const unsigned char *s) {
+    uint64_t s0 = load_8(s);
+    uint64_t s1 = load_8(s + 8);
+    uint64_t s2 = load_8(s + 16);
+    uint64_t s3 = load_8(s + 24);
+
+    h[0] = s0 & FE51_MASK;
+    h[1] = ((s0 >> 51) | (s1 << 13)) & FE51_MASK;
+    h[2] = ((s1 >> 38) | (s2 << 26)) & FE51_MASK;
+    h[3] = ((s2 >> 25) | (s3 << 39)) & FE51_MASK;
+    h[4] = (s3 >> 12) & FE51_MASK;
+}
+
+
+
+/*
+    Write the value of h reduced mod q, as ref10's fe_tobytes: after
+    carrying, h < 2q, and q = floor(2^(-255)(h + 19)) says whether to
+    subtract q.
+*/
+
+void fe_tobytes(unsigned char *s, const fe h) {
+    uint64_t t[5];
+    uint64_t q;
+
+    fe_copy(t, h);
+    fe_carry(t);
+    fe_carry(t);
+
+    q = (t[0] + 19) >> 51;
+    q = (t[1] + q) >> 51;
+    q = (t[2] + q) >> 51;
+    q = (t[3] + q) >> 51;
+    q = (t[4] + q) >> 51;
+
+    /* add 19q and drop the 2^255 the carries push up into t[4] */
+    t[0] += 19 * q;
+    t[1] += t[0] >> 51;
+    t[0] &= FE51_MASK;
+    t[2] += t[1] >> 51;
+    t[1] &= FE51_MASK;
+    t[3] += t[2] >> 51;
+    t[2] &= FE51_MASK;
+    t[4] += t[3] >> 51;
+    t[3] &= FE51_MASK;
+    t[4] &= FE51_MASK;
+
+    store_8(s, t[0] | (t[1] << 51));
+    store_8(s + 8, (t[1] >> 13) | (t[2] << 38));
+    store_8(s + 16, (t[2] >> 26) | (t[3] << 25));
+    store_8(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+
+
+/*
+    Carry the 128-bit sums of products r0...r4 down into h.
+*/
+
+static void fe_reduce_wide(
+    fe h, fe_uint128 r0, fe_uint128 r1, fe_uint128 r2, fe_uint128 r3,
+    fe_uint128 r4
+) {
+    uint64_t h0, h1, h2, h3, h4;
+
+    r1 += (uint64_t) (r0 >> 51);
+    h0 = (uint64_t) r0 & FE51_MASK;
+    r2 += (uint64_t) (r1 >> 51);
+    h1 = (uint64_t) r1 & FE51_MASK;
+    r3 += (uint64_t) (r2 >> 51);
+    h2 = (uint64_t) r2 & FE51_MASK;
+    r4 += (uint64_t) (r3 >> 51);
+    h3 = (uint64_t) r3 & FE51_MASK;
+    h0 += 19 * (uint64_t) (r4 >> 51);
+    h4 = (uint64_t) r4 & FE51_MASK;
+    h1 += h0 >> 51;
+    h0 &= FE51_MASK;
+
+    h[0] = h0;
+    h[1] = h1;
+    h[2] = h2;
+    h[3] = h3;
+    h[4] = h4;
+}
+
+
+
+/*
+    h = f * g
+    Can overlap h with f or g.
+*/
+
+void fe_mul(fe h, const fe f, const fe g) {
+    uint64_t f0 = f[0];
+    uint64_t f1 = f[1];
+    uint64_t f2 = f[2];
+    uint64_t f3 = f[3];
+    uint64_t f4 = f[4];
+    uint64_t g0 = g[0];
+    uint64_t g1 = g[1];
+    uint64_t g2 = g[2];
+    uint64_t g3 = g[3];
+    uint64_t g4 = g[4];
+    uint64_t g1_19 = 19 * g1;
+    uint64_t g2_19 = 19 * g2;
+    uint64_t g3_19 = 19 * g3;
+    uint64_t g4_19 = 19 * g4;
+    fe_uint128 r0, r1, r2, r3, r4;
+
+    r0 = (fe_uint128) f0 * g0 + (fe_uint128) f1 * g4_19
+        + (fe_uint128) f2 * g3_19 + (fe_uint128) f3 * g2_19
+        + (fe_uint128) f4 * g1_19;
+    r1 = (fe_uint128) f0 * g1 + (fe_uint128) f1 * g0
+        + (fe_uint128) f2 * g4_19 + (fe_uint128) f3 * g3_19
+        + (fe_uint128) f4 * g2_19;
+    r2 = (fe_uint128) f0 * g2 + (fe_uint128) f1 * g1
+        + (fe_uint128) f2 * g0 + (fe_uint128) f3 * g4_19
+        + (fe_uint128) f4 * g3_19;
+    r3 = (fe_uint128) f0 * g3 + (fe_uint128) f1 * g2
+        + (fe_uint128) f2 * g1 + (fe_uint128) f3 * g0
+        + (fe_uint128) f4 * g4_19;
+    r4 = (fe_uint128) f0 * g4 + (fe_uint128) f1 * g3
+        + (fe_uint128) f2 * g2 + (fe_uint128) f3 * g1
+        + (fe_uint128) f4 * g0;
+
+    fe_reduce_wide(h, r0, r1, r2, r3, r4);
+}
+
+
+
+/*
+    h = f * f
+    Can overlap h with f.
+*/
+
+void fe_sq(fe h, const fe f) {
+    uint64_t f0 = f[0];
+    uint64_t f1 = f[1];
+    uint64_t f2 = f[2];
+    uint64_t f3 = f[3];
+    uint64_t f4 = f[4];
+    uint64_t f0_2 = 2 * f0;
+    uint64_t f1_2 = 2 * f1;
+    uint64_t f3_19 = 19 * f3;
+    uint64_t f4_19 = 19 * f4;
+    fe_uint128 r0, r1, r2, r3, r4;
+
+    r0 = (fe_uint128) f0 * f0 + (fe_uint128) f1_2 * f4_19
+        + (fe_uint128) (2 * f2) * f3_19;
+    r1 = (fe_uint128) f0_2 * f1 + (fe_uint128) (2 * f2) * f4_19
+        + (fe_uint128) f3 * f3_19;
+    r2 = (fe_uint128) f0_2 * f2 + (fe_uint128) f1 * f1
+        + (fe_uint128) (2 * f3) * f4_19;
+    r3 = (fe_uint128) f0_2 * f3 + (fe_uint128) f1_2 * f2
+        + (fe_uint128) f4 * f4_19;
+    r4 = (fe_uint128) f0_2 * f4 + (fe_uint128) f1_2 * f3
+        + (fe_uint128) f2 * f2;
+
+    fe_reduce_wide(h, r0, r1, r2, r3, r4);
+}
+
+
+
+/*
+    h = 2 * f * f
+    Can overlap h with f.
+*/
+
+void fe_sq2(fe h, const fe f) {
+    fe_sq(h, f);
+    h[0] *= 2;
+    h[1] *= 2;
+    h[2] *= 2;
+    h[3] *= 2;
+    h[4] *= 2;
+    fe_carry(h);
+}
+
+
+
+/*
+    h = f * 121666
+    Can overlap h with f.
+*/
+
+void fe_mul121666(fe h, fe f) {
+    fe_reduce_wide(
+        h, (fe_uint128) f[0] * 121666, (fe_uint128) f[1] * 121666,
+        (fe_uint128) f[2] * 121666, (fe_uint128) f[3] * 121666,
+        (fe_uint128) f[4] * 121666
+    );
+}
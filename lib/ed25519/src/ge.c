@@ -1,5 +1,25 @@
 #include "ge.h"
+#ifdef ED25519_FE51
+#include "precomp_data_51.h"
+#else
 #include "precomp_data.h"
+#endif
+
+/*
+With ED25519_WIDE_TABLE, Bi holds the odd multiples of B up to 127B rather
+than up to 15B, so that the b * B half of ge_double_scalarmult_vartime needs
+fewer additions, at the cost of 7.5K more read-only data.
+*/
+#ifdef ED25519_WIDE_TABLE
+#ifdef ED25519_FE51
+#include "precomp_data_wide_51.h"
+#else
+#include "precomp_data_wide.h"
+#endif
+#define BI_LIMIT 127
+#else
+#define BI_LIMIT 15
+#endif
 
 
 /*
@@ -22,7 +42,12 @@ void ge_add(ge_p1p1 *r, const ge_p3 *p, const ge_cached *q) {
 }
 
 
-static void slide(signed char *r, const unsigned char *a) {
+/*
+Write a as signed odd digits of magnitude at most limit, each followed by
+enough zeros that they don't overlap. limit is 2^k - 1, for 3 <= k <= 7.
+*/
+
+static void slide_limit(signed char *r, const unsigned char *a, int limit) {
     int i;
     int b;
     int k;
@@ -35,10 +60,10 @@ static void slide(signed char *r, const unsigned char *a) {
         if (r[i]) {
             for (b = 1; b <= 6 && i + b < 256; ++b) {
                 if (r[i + b]) {
-                    if (r[i] + (r[i + b] << b) <= 15) {
+                    if (r[i] + (r[i + b] << b) <= limit) {
                         r[i] += r[i + b] << b;
                         r[i + b] = 0;
-                    } else if (r[i] - (r[i + b] << b) >= -15) {
+                    } else if (r[i] - (r[i + b] << b) >= -limit) {
                         r[i] -= r[i + b] << b;
 
                         for (k = i + b; k < 256; ++k) {
@@ -57,6 +82,10 @@ static void slide(signed char *r, const unsigned char *a) {
         }
 }
 
+static void slide(signed char *r, const unsigned char *a) {
+    slide_limit(r, a, 15);
+}
+
 /*
 r = a * A + b * B
 where a = a[0]+256*a[1]+...+256^31 a[31].
@@ -73,7 +102,7 @@ void ge_double_scalarmult_vartime(ge_p2 *r, const unsigned char *a, const ge_p3
     ge_p3 A2;
     int i;
     slide(aslide, a);
-    slide(bslide, b);
+    slide_limit(bslide, b, BI_LIMIT);
     ge_p3_to_cached(&Ai[0], A);
     ge_p3_dbl(&t, A);
     ge_p1p1_to_p3(&A2, &t);
@@ -130,6 +159,15 @@ void ge_double_scalarmult_vartime(ge_p2 *r, const unsigned char *a, const ge_p3
 }
 
 
+#ifdef ED25519_FE51
+static const fe d = {
+    0x34dca135978a3, 0x1a8283b156ebd, 0x5e7a26001c029, 0x739c663a03cbb, 0x52036cee2b6ff
+};
+
+static const fe sqrtm1 = {
+    0x61b274a0ea0b0, 0x0d5a5fc8f189d, 0x7ef5e9cbd0c60, 0x78595a6804c9e, 0x2b8324804fc1d
+};
+#else
 static const fe d = {
     -10913610, 13857413, -15372611, 6949391, 114729, -8787816, -6275908, -3247719, -18696448, -12055116
 };
@@ -137,6 +175,7 @@ static const fe d = {
 static const fe sqrtm1 = {
     -32595792, -7943725, 9377950, 3500415, 12389472, -272473, -25146209, -2005654, 326686, 11406482
 };
+#endif
 
 int ge_frombytes_negate_vartime(ge_p3 *h, const unsigned char *s) {
     fe u;
@@ -295,9 +334,15 @@ void ge_p3_dbl(ge_p1p1 *r, const ge_p3 *p) {
 r = p
 */
 
+#ifdef ED25519_FE51
+static const fe d2 = {
+    0x69b9426b2f159, 0x35050762add7a, 0x3cf44c0038052, 0x6738cc7407977, 0x2406d9dc56dff
+};
+#else
 static const fe d2 = {
     -21827239, -5839606, -30745221, 13898782, 229458, 15978800, -12551817, -6495438, 29715968, 9444199
 };
+#endif
 
 void ge_p3_to_cached(ge_cached *r, const ge_p3 *p) {
     fe_add(r->YplusX, p->Y, p->X);
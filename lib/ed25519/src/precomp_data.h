@@ -1,3 +1,4 @@
+#ifndef ED25519_WIDE_TABLE
 static ge_precomp Bi[8] = {
     {
         { 25967493, -14356035, 29566456, 3660896, -12694345, 4014787, 27544626, -11754271, -6079156, 2047605 },
@@ -40,6 +41,7 @@ static ge_precomp Bi[8] = {
         { -3099351, 10324967, -2241613, 7453183, -5446979, -2735503, -13812022, -16236442, -32461234, -12290683 },
     },
 };
+#endif
 
 
 /* base[i][j] = (j+1)*256^i*B */
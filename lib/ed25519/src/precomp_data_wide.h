@@ -0,0 +1,325 @@
+/* Bi[i] = (2i+1)B, the wider version of the table in precomp_data.h for
+   ED25519_WIDE_TABLE */
+
+static const ge_precomp Bi[64] = {
+    {
+        { 25967493, -14356035, 29566456, 3660896, -12694345, 4014787, 27544626, -11754271, -6079156, 2047605 },
+        { -12545711, 934262, -2722910, 3049990, -727428, 9406986, 12720692, 5043384, 19500929, -15469378 },
+        { -8738181, 4489570, 9688441, -14785194, 10184609, -12363380, 29287919, 11864899, -24514362, -4438546 },
+    },
+    {
+        { 15636291, -9688557, 24204773, -7912398, 616977, -16685262, 27787600, -14772189, 28944400, -1550024 },
+        { 16568933, 4717097, -11556148, -1102322, 15682896, -11807043, 16354577, -11775962, 7689662, 11199574 },
+        { 30464156, -5976125, -11779434, -15670865, 23220365, 15915852, 7512774, 10017326, -17749093, -9920357 },
+    },
+    {
+        { 10861363, 11473154, 27284546, 1981175, -30064349, 12577861, 32867885, 14515107, -15438304, 10819380 },
+        { 4708026, 6336745, 20377586, 9066809, -11272109, 6594696, -25653668, 12483688, -12668491, 5581306 },
+        { 19563160, 16186464, -29386857, 4097519, 10237984, -4348115, 28542350, 13850243, -23678021, -15815942 },
+    },
+    {
+        { 5153746, 9909285, 1723747, -2777874, 30523605, 5516873, 19480852, 5230134, -23952439, -15175766 },
+        { -30269007, -3463509, 7665486, 10083793, 28475525, 1649722, 20654025, 16520125, 30598449, 7715701 },
+        { 28881845, 14381568, 9657904, 3680757, -20181635, 7843316, -31400660, 1370708, 29794553, -1409300 },
+    },
+    {
+        { -22518993, -6692182, 14201702, -8745502, -23510406, 8844726, 18474211, -1361450, -13062696, 13821877 },
+        { -6455177, -7839871, 3374702, -4740862, -27098617, -10571707, 31655028, -7212327, 18853322, -14220951 },
+        { 4566830, -12963868, -28974889, -12240689, -7602672, -2830569, -8514358, -10431137, 2207753, -3209784 },
+    },
+    {
+        { -25154831, -4185821, 29681144, 7868801, -6854661, -9423865, -12437364, -663000, -31111463, -16132436 },
+        { 25576264, -2703214, 7349804, -11814844, 16472782, 9300885, 3844789, 15725684, 171356, 6466918 },
+        { 23103977, 13316479, 9739013, -16149481, 817875, -15038942, 8965339, -14088058, -30714912, 16193877 },
+    },
+    {
+        { -33521811, 3180713, -2394130, 14003687, -16903474, -16270840, 17238398, 4729455, -18074513, 9256800 },
+        { -25182317, -4174131, 32336398, 5036987, -21236817, 11360617, 22616405, 9761698, -19827198, 630305 },
+        { -13720693, 2639453, -24237460, -7406481, 9494427, -5774029, -6554551, -15960994, -2449256, -14291300 },
+    },
+    {
+        { -3151181, -5046075, 9282714, 6866145, -31907062, -863023, -18940575, 15033784, 25105118, -7894876 },
+        { -24326370, 15950226, -31801215, -14592823, -11662737, -5090925, 1573892, -2625887, 2198790, -15804619 },
+        { -3099351, 10324967, -2241613, 7453183, -5446979, -2735503, -13812022, -16236442, -32461234, -12290683 },
+    },
+    {
+        { 17735060, -6439963, 9040473, 7210680, -23783293, -7400887, 26948152, 12350803, -28451963, -4929179 },
+        { 2154138, 14782993, 28737794, 11906199, -30903360, -7066330, 19338133, -16644289, -16898941, -3760134 },
+        { 29935719, 6336041, 20999566, -3149063, 13628498, -8942324, -5469118, -11194790, -10135057, -14869741 },
+    },
+    {
+        { 29792830, -2175205, -20776337, -12878768, -8656183, -12970314, -24216613, -595795, 31674346, -9279161 },
+        { 7606599, -11423207, 17376913, 15235046, 32822971, 7512882, 30227203, 14344178, 9952094, 8804749 },
+        { 32575098, 3961822, -30703966, -15781181, -34965, 1319544, 30641032, 7823672, -3799006, -14675647 },
+    },
+    {
+        { 10715098, -14175221, 26572933, -14864211, -25074044, -9564636, 12020709, -13782763, -28220153, -11219357 },
+        { -29961848, 554127, -3782803, -12628771, -17903573, 8620616, -13733360, -7615564, 8752613, -2328538 },
+        { 4529906, 12416158, -6720702, -3396531, 15427958, -5925624, -5957936, 12724464, 23658330, -9864377 },
+    },
+    {
+        { -32174442, -12285248, -21298637, -13897126, -12811671, 7413281, -256881, 6164081, 25005049, -15551774 },
+        { 5403481, -8900266, -5253283, 13522653, 14989680, 1879017, -23195795, -7830259, 20315902, 421248 },
+        { -32289917, 1705240, 25347020, 7938434, -15476839, 1720024, -12299138, -898546, -2200877, 5517608 },
+    },
+    {
+        { 21434699, 16557378, 13251023, -3507283, 24494013, -5830483, -4398573, -14401002, 7715738, -5460632 },
+        { 14461051, 6393639, 22681353, 14533514, -14615277, 3544718, -9327866, -8896568, -7217056, -1926306 },
+        { -6243959, -2354478, 18524952, 11247802, -23591219, -12388975, 26204395, -6286011, -3887786, -3575296 },
+    },
+    {
+        { 30382533, 10077556, 27696264, 8918288, 30231380, -15593313, 9092550, 7627898, -25703649, -1756379 },
+        { 13670611, 720327, 7131696, -14193933, -457293, -16606899, 3061925, -10683413, -27294368, -13413095 },
+        { -22261658, -5174863, -28636833, -9857100, -17667145, 3215394, 1669253, -3103398, -4784951, -4185898 },
+    },
+    {
+        { 7814913, 1690062, 27222385, -2838562, -18664668, -5428809, -18165283, -1224282, 25500369, 1818106 },
+        { -27768268, 15199969, -14321149, -14772828, 18787730, 5464578, 11652644, 8722118, -10052243, 5153961 },
+        { 5733861, 14534448, -7628462, 15892911, 30737296, 188529, 491756, -15907699, 33071792, 15771063 },
+    },
+    {
+        { 18130726, -12222858, -14527018, -3382144, -22757904, -11282639, 1149904, 16209407, 20222151, -1415346 },
+        { -14736063, 13847471, -14418019, 3802478, -18721725, 10595590, 13745896, 3112846, -16747401, 2761906 },
+        { -21126168, 12273934, 15897066, 704320, 31367969, 3120352, 11710867, 16405685, 19410991, 10591627 },
+    },
+    {
+        { 14900005, 885327, 22211023, 15569757, -32799648, -3688384, 13199846, -5815912, 4631002, 13354856 },
+        { -30476848, -10253580, -7573621, -6079938, -7183949, -4486727, 17551262, 13583017, -29528297, -2483253 },
+        { 22641789, -12277349, 10843474, 1582748, -29604276, 634915, 15612385, -15415310, -7693613, -10990568 },
+    },
+    {
+        { 9613009, -14294149, -25386494, 1731436, -14086315, 4700745, 26055020, -5926814, 20854229, 175025 },
+        { -5193515, 11733562, -7705372, -2172869, 29521831, -16709023, -12135444, -7497377, -17644163, 796780 },
+        { 3855018, 8248512, 12652406, 88331, 2948262, 971326, 15614761, 9441028, 29507685, 8583792 },
+    },
+    {
+        { 9860025, 14808585, 9600042, -9459145, 23400177, -9477195, -3325726, 3916688, -10358612, -2872627 },
+        { -33399181, 3740345, -14220260, -8495386, -20910867, -10875619, -21901699, 6431244, 21300862, -5908175 },
+        { -17297334, 9216233, 25043921, -14816258, 29145961, 3024227, -1528362, 530150, -298891, -11278931 },
+    },
+    {
+        { 23499385, -8617718, -28753418, 2354156, 15431304, 5726449, -20299450, 7589352, 5421941, 16121767 },
+        { -21946656, -9703034, 9380592, 15192763, -31074002, 15525766, 5277811, -8513803, 33286238, -1861106 },
+        { -4684418, 13336014, -17740282, 1581265, 30884213, 15048226, -285360, 4736578, -13303672, -3946076 },
+    },
+    {
+        { 25190234, -7249684, -8180527, 9111276, -2828521, 5025799, -5809265, -12894927, 30387593, -1035055 },
+        { 14480232, -16496612, 2286693, -573465, 14693158, -11356520, -17860965, 9909860, 236428, -16696997 },
+        { 7877514, -3681565, -21222620, -7651578, -25110101, 6241605, -31413926, 15657880, -10310932, 8609106 },
+    },
+    {
+        { -12863656, -992270, -9221166, -14044698, -21785329, 3918115, 27606728, -7580366, 7290095, 11418745 },
+        { 28964163, -12604339, -22178897, -7408539, -32322056, -15496278, 18187180, -6537946, -24670027, 14869175 },
+        { -11404963, 1222456, -2779464, -9021185, 11330891, 9135834, 3589529, -13999198, -13833310, 1207213 },
+    },
+    {
+        { 33323332, 2048733, 12219722, 6017849, 4177481, -9750224, 19535261, 10453936, -11333785, -1737850 },
+        { -2294127, -6336743, 29891311, 4504619, 8548709, -11568109, -4968207, 12555981, -32731806, -12117608 },
+        { -18039404, 9880213, 33350825, -8978011, 24446078, 15616561, 19302117, 9370836, -11936684, -5028240 },
+    },
+    {
+        { 28296089, -6797223, -10353664, 4572841, 2140330, 10029994, -13549808, 8187615, -25941532, -8911153 },
+        { -32006986, -2595819, -1003567, 3168613, 22836264, 10055966, 22893634, 13045780, 28576558, -2849841 },
+        { -7120972, -12388107, -23812169, 15387893, -27660877, -13558161, 5059184, -13581498, 30207805, -3922766 },
+    },
+    {
+        { 335330, 16132893, 21221549, 4369853, 1038992, -9159445, 24372709, -8665271, -4779141, -16396649 },
+        { -10186356, 1347521, 23300731, -6161061, -24457196, 8512933, 27610931, -9117439, 3998296, 3835244 },
+        { 16327069, -10777476, 14746361, -10954782, 23700921, 11727222, 25900154, -11731214, -32201500, -8448618 },
+    },
+    {
+        { -7300978, 12089758, -18593518, 7922407, 480852, -7192851, 4246899, 10714230, 644198, 13128477 },
+        { 7174904, -6962319, -7216530, 6465479, 4145835, -15880826, -28343911, -11261141, 1360981, -7748495 },
+        { -26929277, 6331650, -24722843, -13348547, 15635074, 6103612, -10717684, 6789943, 7597240, -9459120 },
+    },
+    {
+        { -12332277, 3381501, 18757262, 7875103, 106218, 1145711, 19452113, -5904709, 26496796, -13942303 },
+        { -20407324, -9452987, -17593212, -7607437, -21770707, 9941094, -11599493, -2255488, 1347426, 15381335 },
+        { -13532415, -7418575, 17092786, 3684747, -9279743, -6444915, 2987882, 10987137, -14839768, 15465523 },
+    },
+    {
+        { 12924165, -7290115, 5272133, 10039545, 27497072, -2938938, -6702008, -3153602, -13451878, 11746942 },
+        { -31440802, -9307441, -19320583, -8426133, -29651896, -14035462, -23649193, 10724645, 7294162, 4471290 },
+        { -33294876, 3549110, 101112, -12089983, 4858393, 3029943, -7109424, -12129693, -32794988, 1512800 },
+    },
+    {
+        { 29494960, -5313502, -16015633, -4730753, 25682288, -12312069, 10463026, 4241111, 8656993, 10649532 },
+        { -3572094, 7572552, -4859105, -8351792, 32046233, -1235491, 29315142, 15424555, 24706712, -4696784 },
+        { -19490094, 5819840, 19528172, -12838482, -26453100, -12943384, 4960955, 6496879, 2790858, -5509159 },
+    },
+    {
+        { 18065612, -11264962, -22271043, -2533272, 32797786, 15389833, 11230024, -2409659, 15579138, 4915791 },
+        { -17444159, 3638041, -9220171, -14319500, -27004681, -5410591, 28667143, -15167555, 18584836, 3592929 },
+        { 12065039, -14687038, 6430595, -16447273, 1727095, 13096957, -5588627, -6497827, 27026998, 13543966 },
+    },
+    {
+        { 1404081, 4022847, 27586665, 14209107, 28740330, -3515722, -15290812, -13312955, 1871193, 8696643 },
+        { 17325298, -178257, -1837598, 4931226, 31708266, 6292284, 23064744, -11481640, -23163358, 9236925 },
+        { -15153279, -13286368, -5957025, -7171083, 4766520, -12766399, 21173535, -6523679, 9509141, 7790046 },
+    },
+    {
+        { 24124105, 5364343, 28620391, 10538620, -7675013, -13973421, -6246145, 9945788, 10491858, -1340630 },
+        { 7062127, 13930079, 2259902, 6463144, 32137099, -8805584, -25551520, -4223089, -19763669, 13022815 },
+        { 18921826, 392002, -11290883, 6420687, 8000611, -11138460, 14722963, -7308142, 20604451, 8079345 },
+    },
+    {
+        { 601408, -7296633, -15609472, 12996090, 30228770, -13167877, 9125344, 9807811, 10844834, -12520039 },
+        { 25817729, 8020883, -16974185, -12309626, -20051075, 8766557, 29308546, -11246469, -17658943, -9680178 },
+        { 11081015, 13522660, 12474691, -4294209, -18421232, 9341947, 16850694, -14916827, 6199840, 14303642 },
+    },
+    {
+        { -2590691, -13660396, -17003894, 9477211, 12532855, 5979449, -576929, 7650661, -16482212, 13989684 },
+        { 6921819, 4421166, -7369373, -3043653, -24002508, -2612900, 9363542, 3394240, -16234677, -9681846 },
+        { -12814866, -10087565, -19924616, -12927053, 8313212, 5865878, 5948507, -1264089, -14525723, -10414561 },
+    },
+    {
+        { -22642986, -9419814, -17266421, -10068851, -32264826, 11673996, -5696, -7696022, -28600277, 1542639 },
+        { 19879846, 15259900, 25020018, 14261729, 22075205, -8365129, 787541, -2229399, -4686574, 16131172 },
+        { -27621792, -5660856, -32454687, -7933615, -6899017, -9950512, 8931190, 12275052, -28482395, -115503 },
+    },
+    {
+        { -28801342, 9568749, -4436125, 16130584, -27974732, 4547920, 18403901, 5027306, -6278897, -404109 },
+        { 7950033, -7713399, -19832357, 3884936, -4689981, 2342084, -16839833, 14194016, 27013685, 3320257 },
+        { -31838154, -15477602, -20114592, 4273336, -23512982, -1812134, -8780161, 4594761, -17928013, -15410421 },
+    },
+    {
+        { 30194134, 16514248, -17362532, -6084341, -26680578, -10283380, 3143304, 16153484, -10705847, -5744828 },
+        { 27113485, 6865046, 4512771, -4226690, 29021085, 7405965, 33302911, 9322435, 4307527, -1116192 },
+        { 29337832, -8881086, 10359234, -3206898, -9399380, 9930841, -6501093, -9478298, 20985294, -11073509 },
+    },
+    {
+        { 14579256, -87196, 18637125, 15769998, -32989370, -11904564, 15576593, -8085005, 19066482, -9217330 },
+        { 4472119, 14702190, 10432042, -11094405, 708462, -14770436, -32874489, -2684108, -3312406, 10370851 },
+        { -30151718, -13998794, 16244232, -9186883, -8108982, 13440044, -31961232, 8718975, -24007800, -15067051 },
+    },
+    {
+        { 21818242, 922741, 23913864, -11112469, -4945752, 14842156, -24073844, 9485974, -13289335, -11235444 },
+        { 10874853, 4351765, -856524, -16284995, -2681829, -2819120, 5883786, -4555901, -22705841, -7489830 },
+        { -3091215, 9755551, -29600929, -10801888, 4031639, -3650507, -19841446, -847585, -27960911, -11918530 },
+    },
+    {
+        { 14256156, 11373180, 30286322, 10431160, -866324, 4963068, -14170972, 3820542, 6243620, 4922418 },
+        { -23648082, -9293501, 21493331, -2665463, 23329455, -9008855, -8822008, 12750267, 22391140, -7356307 },
+        { 20477586, -9475719, 1674569, 4102219, 25208396, 13972305, 30389482, -13981806, 1485667, -15874667 },
+    },
+    {
+        { 33402265, -9666825, -17712069, -2677324, -21625089, -8332000, 822477, 3599727, 32618866, -14943647 },
+        { -18461798, 166414, -11654106, 8889514, 21027475, -826251, -24008796, 4690061, 7520989, 16421303 },
+        { 14868391, -12557982, -2272257, 1042491, 27060176, 10253541, -13677588, -14037694, -25299917, 2239539 },
+    },
+    {
+        { -16880448, -3959488, -5078515, 10307369, 3862133, -13261857, -7925253, -15564972, 718319, 15848796 },
+        { 5548720, -15643425, 33137865, -789989, 31146555, -15623336, -3085493, 7290290, 6361313, -693227 },
+        { -3734122, -3234378, 4091668, -2598952, -22289414, 2212056, -14470038, -11162493, -28624264, 7051030 },
+    },
+    {
+        { -16623285, 7033601, -9397439, 10740563, 5238683, 8774308, 7593988, 13396128, 18451858, 8415632 },
+        { -26178194, 3776912, -28000335, 2508078, 19371703, 7626128, 4092943, 15778278, -25064719, -9014328 },
+        { -22980309, 8867577, 8645499, -11332154, 11497131, 4344907, 10788462, -10171729, 3547105, 15368835 },
+    },
+    {
+        { 14677651, -15206078, 7451268, -10801028, -14729141, 7841093, -9113938, 6818021, -9401568, 16352836 },
+        { 21622593, -14972808, -30596912, 1212468, -30178556, 7910193, 20622927, 2438677, -14480102, -4486104 },
+        { 6797450, 2854059, 4269865, 8037366, 32016522, 15223213, -32343080, 15297583, 3559197, -7129178 },
+    },
+    {
+        { -26456070, -5349202, 12126304, 8794360, -18689940, -6997232, 20753348, 58788, 1327619, 6674931 },
+        { -14719920, -673534, -29432606, 8253691, 32826330, 2707379, 25088512, -16371554, 15053908, 11601568 },
+        { -23214773, -8128476, -16146248, -5456783, 30129085, 13258436, -27744275, 8197602, -8927204, 15003423 },
+    },
+    {
+        { 13470760, 14281242, 31012391, -3029397, 22680656, -16395596, -27460827, 13815678, 26919891, -4526762 },
+        { -12630168, 14782830, -10396361, 7094749, -25333036, -4144773, 9084387, -3375369, -3093937, -1035345 },
+        { 6314448, -13535604, 12535892, -13943821, 10074032, -5466469, -16619416, -7240179, 24553877, -808124 },
+    },
+    {
+        { -28449227, 13074994, -30798781, -1319835, 18656493, -5238264, -10809836, -10773593, -11541295, -1178226 },
+        { 5654403, -7129382, -27760928, 963425, 5032477, -13704237, 30011538, 11153401, -3926825, 13343990 },
+        { 1130463, -3739583, -26539437, 8144468, 24179188, 6267924, -3261717, 2912741, -3238160, -4367687 },
+    },
+    {
+        { -17386311, 11073634, -14243601, -16279252, -33187457, 5060288, 32360243, 1910958, -17001813, 11480870 },
+        { 2003590, 2472803, -20206681, 1716407, -8499795, 15922983, -23342742, -6098062, 33468340, -4208150 },
+        { 18834236, 8245144, 29896065, 3490830, -4141371, 7220278, 146130, -15095268, -9575803, -3484009 },
+    },
+    {
+        { 10696643, 4919690, 6350734, -15001091, -26709409, -14403208, -33452989, -6222475, -22610456, 13768351 },
+        { 23652147, -5907141, -23757273, 13262713, -1870810, -7258082, 11902127, 2949002, -32663625, -7952314 },
+        { -11201906, -14508320, 28501159, -5329871, 14495534, 14714956, 32929972, 2643566, 17034893, 11645825 },
+    },
+    {
+        { -28927206, -3802722, 6541610, -15793905, 13644724, -15562173, 5561346, 7659996, 20415289, 4075693 },
+        { 6498441, 12053607, 10375600, 14764370, 24795955, 16159258, -9259443, 16071838, 31008329, 3792564 },
+        { -19178360, 9176957, -12859933, 8732777, -9108606, 10333520, 96092, -4280548, 13051278, -13432939 },
+    },
+    {
+        { -12918353, 16283163, -5826797, 10734598, 817822, 3412985, -18755585, -3215159, -29908178, -3517495 },
+        { 21193633, -13624931, 18841216, -3988878, -3106690, 11123559, 14111648, 6069945, 30307604, -7619329 },
+        { -8569091, 2098686, -28807733, 15844176, -25475210, -16620065, 15145896, 5543861, -3058074, 6595362 },
+    },
+    {
+        { -33000900, 1176922, -15152825, 5614779, 11970187, -3266277, -19648453, -11367701, 30689696, -13925456 },
+        { 25043267, -14330195, -21060766, -1265112, 29339135, 12397721, -29723004, 12978241, -9157233, -2134778 },
+        { -21070425, -5052695, -4542341, 12609284, -31871882, -3096635, -2995254, 14800344, 6412849, 6276813 },
+    },
+    {
+        { -9688935, 5951297, 15941940, 7806759, -18145931, 4291329, -5475382, 4830585, 4146237, -1924943 },
+        { 249426, -16357683, -31673910, 13884217, 11701636, -9001163, -15286877, 12900911, -32264791, 16150119 },
+        { 2520516, 14697628, 15319213, -10869942, -4242200, -3888000, 13872508, 7473319, 12419515, 2958466 },
+    },
+    {
+        { -32700542, -11256125, 31113344, -7637817, -5561418, -16738295, 30002232, 8984620, 14298449, 16319129 },
+        { 19427905, 12004555, 9971383, -5364564, 32306270, -9906162, -32932230, 10760438, -13754584, 5634975 },
+        { 30044338, -9876569, -6835457, 14563840, 9734978, -13746283, 30899065, -2718741, 22828540, -9921084 },
+    },
+    {
+        { 25513045, 3557497, -29995160, -3965198, 10285549, 1191534, 28780583, -5342100, 25767380, 4012132 },
+        { -24968993, 9176397, 16274786, -86979, -14550242, 7190769, 1490604, -2242073, -22341664, -15063359 },
+        { 4272877, -12122949, -21514120, 13027606, -7876223, -9402475, -28718544, 12906719, -21192995, 15503564 },
+    },
+    {
+        { 29874415, 2254304, 25494240, 4422092, -24072856, 3589680, 18198812, 1586820, -13618547, 14188357 },
+        { -7590292, -5033810, -7161992, -4092404, 3630301, -4155843, -6683401, -8965696, -13978916, -5155064 },
+        { 18192774, 12787801, 32021061, 9158184, -18719516, 16385093, 11799402, 9492011, -23954644, 15950103 },
+    },
+    {
+        { 1659378, -12470837, 33464927, -13678655, -1070898, 1805942, 22565156, 5614253, -20503425, -15210909 },
+        { -9448528, -3839112, -2694237, -801093, 16894122, 935644, -13259927, -10870293, 10541714, 14174330 },
+        { 22888141, 12700209, -26807167, 6435659, -10779379, 5524687, -10392903, 6520809, 15754965, 9355803 },
+    },
+    {
+        { 12440975, -6807507, -12176979, 4993446, -17436016, -13845446, -14509439, 12757152, 26219761, 5969896 },
+        { -33220258, 13911611, 18921581, 1162763, -20491963, 13799219, 29525142, -11625146, -7813399, 503509 },
+        { -9243314, -11510854, 17998313, 3038439, -14270493, 9832209, -23797333, 660992, 25265267, -14576708 },
+    },
+    {
+        { -3098576, -9826685, -24831582, 14534882, -31900754, 1392373, -6337150, 4857038, -19401028, 10158316 },
+        { -10249549, -996186, -26091773, -10943673, 13704991, -10339313, 2475038, -1209448, 12799419, 11135856 },
+        { 1867233, -6386730, 19772100, -16629427, 15366694, -7756740, 10829277, 15372827, 26582557, -1911718 },
+    },
+    {
+        { -9843629, -13494634, -26902740, -2966929, -6555051, -7952329, 29690667, 3572665, -31146798, -15336703 },
+        { -10676211, 6329656, -24337889, 4187983, 30677076, 9335071, -7005532, 14755051, 9451294, 574767 },
+        { -14249827, 2867108, -10850499, 15719082, 5959372, 8703738, 29137781, -11978895, 20249841, -1745743 },
+    },
+    {
+        { 7640490, 13680696, 9995911, -14908640, 24960153, 8964516, 33248715, -12352878, -9535718, -1948925 },
+        { -10801790, -9662679, 3613812, -2766490, -18077641, -6886907, 26985479, -1580922, 26785295, -3967005 },
+        { 30891479, 5254655, -19693934, 12769217, -24196082, 11830406, 7411958, 1394027, 18778535, -15345062 },
+    },
+    {
+        { -5880915, -7375081, -9607390, 13585865, -31362053, 6790545, -12974037, -7401098, 7013832, 12256220 },
+        { 5975515, 16302413, 24341148, -5283817, 18786097, -11148931, 28243951, -5226428, -13696574, 4381961 },
+        { 9394667, 8758552, 26189703, 16642536, -31115336, 5117041, 5977877, 13955594, 19244020, -9060697 },
+    },
+    {
+        { -22829328, -15286355, 30193030, 3993472, -23481420, 10460334, -26871028, 14909642, 25722014, -10666352 },
+        { 7236814, -3120775, -3520292, 620818, 11118384, -8575418, -328709, -13676752, 16217591, -7243327 },
+        { -24568051, -11897160, 16455974, -9924233, 3992016, -11660015, -22232811, -14262713, -11679060, -3112042 },
+    },
+    {
+        { 2312988, -6582299, -8249592, -13313519, -14553720, -3910490, 26859594, 960681, -23315236, 11442239 },
+        { 3428687, -5747160, -25968915, -8767537, 4167809, -12131162, -14909241, 8021270, -13936613, -15483623 },
+        { 30631132, -7190776, 21279867, -10278638, 18311407, 466071, -24580896, 7989983, 29641567, -4107738 },
+    },
+};
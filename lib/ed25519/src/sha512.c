@@ -138,6 +138,23 @@ static int sha512_compress(sha512_context *md, unsigned char *buf)
     return 0;
 }
 
+/* Compress whole blocks. Whoever includes this file can supply a faster
+   compression function by defining SHA512_TRANSFORM(md, blocks, count) */
+static int sha512_compress_blocks(sha512_context *md, const unsigned char *blocks, size_t block_count)
+{
+    int err;
+    for (; block_count > 0; --block_count, blocks += 128) {
+        if ((err = sha512_compress(md, (unsigned char *)blocks)) != 0) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+#ifndef SHA512_TRANSFORM
+#define SHA512_TRANSFORM sha512_compress_blocks
+#endif
+
 
 /**
    Initialize the hash state
@@ -180,12 +197,13 @@ int sha512_update (sha512_context * md, const unsigned char *in, size_t inlen)
     }                                                                                       
     while (inlen > 0) {                                                                     
         if (md->curlen == 0 && inlen >= 128) {                           
-           if ((err = sha512_compress (md, (unsigned char *)in)) != 0) {               
+           n = inlen & ~(size_t)127;
+           if ((err = SHA512_TRANSFORM (md, in, n / 128)) != 0) {
               return err;                                                                   
            }                                                                                
-           md->length += 128 * 8;                                        
-           in             += 128;                                                    
-           inlen          -= 128;                                                    
+           md->length += n * 8;
+           in             += n;
+           inlen          -= n;
         } else {                                                                            
            n = MIN(inlen, (128 - md->curlen));
 
@@ -198,7 +216,7 @@ int sha512_update (sha512_context * md, const unsigned char *in, size_t inlen)
            in             += n;                                                             
            inlen          -= n;                                                             
            if (md->curlen == 128) {                                      
-              if ((err = sha512_compress (md, md->buf)) != 0) {            
+              if ((err = SHA512_TRANSFORM (md, md->buf, 1)) != 0) {            
                  return err;                                                                
               }                                                                             
               md->length += 8*128;                                       
@@ -240,7 +258,7 @@ int sha512_update (sha512_context * md, const unsigned char *in, size_t inlen)
         while (md->curlen < 128) {
             md->buf[md->curlen++] = (unsigned char)0;
         }
-        sha512_compress(md, md->buf);
+        SHA512_TRANSFORM(md, md->buf, 1);
         md->curlen = 0;
     }
 
@@ -254,7 +272,7 @@ while (md->curlen < 120) {
 
     /* store length */
 STORE64H(md->length, md->buf+120);
-sha512_compress(md, md->buf);
+SHA512_TRANSFORM(md, md->buf, 1);
 
     /* copy output */
 for (i = 0; i < 8; i++) {
@@ -0,0 +1,90 @@
+#! /usr/bin/env python
+
+"""Time the calls that benchmarks/bench_bindings.cpp makes straight to the C
+API, through these bindings, to show what the bindings add to each call.
+
+    python benchmark.py [iterations]
+
+The compiled bindings from setup.py are used for the calls they cover, such
+as decrypting, if they have been built. Set OLM_PYTHON_NO_COMPILED to time
+ctypes alone.
+"""
+
+from __future__ import print_function
+
+import os
+import sys
+import timeit
+
+import olm
+
+if os.environ.get("OLM_PYTHON_NO_COMPILED"):
+    for module in ("_base", "session", "inbound_group_session"):
+        setattr(sys.modules["olm." + module], "_olm", None)
+
+PLAINTEXT = b"Hello, World"
+PICKLE_KEY = b"secret_key"
+
+
+def time(name, iterations, func):
+    start = timeit.default_timer()
+    for i in range(iterations):
+        func(i)
+    elapsed = timeit.default_timer() - start
+    print("%-40s%12.1f ns/op" % (name, elapsed * 1e9 / iterations))
+
+
+def benchmark_group(iterations):
+    outbound = olm.OutboundGroupSession()
+    inbound = olm.InboundGroupSession()
+    inbound.init(outbound.session_key())
+
+    messages = []
+    time("group encrypt", iterations,
+         lambda i: messages.append(outbound.encrypt(PLAINTEXT)))
+    time("group decrypt", iterations,
+         lambda i: inbound.decrypt(messages[i]))
+    time("group pickle", iterations,
+         lambda i: inbound.pickle(PICKLE_KEY))
+
+
+def benchmark_one_to_one(iterations):
+    time("account create", iterations, lambda i: olm.Account().create())
+
+    alice = olm.Account()
+    bob = olm.Account()
+    alice.create()
+    bob.create()
+    bob.generate_one_time_keys(1)
+    bob_id_key = bob.identity_keys()["curve25519"].encode("ascii")
+    bob_ot_key = list(
+        bob.one_time_keys()["curve25519"].values()
+    )[0].encode("ascii")
+
+    alice_session = olm.Session()
+    bob_session = olm.Session()
+    alice_session.create_outbound(alice, bob_id_key, bob_ot_key)
+    message_type, first = alice_session.encrypt(PLAINTEXT)
+    bob_session.create_inbound(bob, first)
+    bob_session.decrypt(message_type, first)
+
+    # bob replies so that alice stops sending pre-key messages
+    reply_type, reply = bob_session.encrypt(PLAINTEXT)
+    alice_session.decrypt(reply_type, reply)
+
+    messages = []
+    time("one-to-one encrypt", iterations,
+         lambda i: messages.append(alice_session.encrypt(PLAINTEXT)))
+    time("one-to-one decrypt", iterations,
+         lambda i: bob_session.decrypt(*messages[i]))
+    time("session pickle", iterations,
+         lambda i: bob_session.pickle(PICKLE_KEY))
+    pickled = bob_session.pickle(PICKLE_KEY)
+    time("session unpickle", iterations,
+         lambda i: olm.Session().unpickle(PICKLE_KEY, pickled))
+
+
+if __name__ == "__main__":
+    iterations = int(sys.argv[1]) if len(sys.argv) > 1 else 1000
+    benchmark_group(iterations)
+    benchmark_one_to_one(iterations)
@@ -1,4 +1,8 @@
 from .account import Account
-from .session import Session
+from .session import Session, LazySession, decrypt_batch
 from .outbound_group_session import OutboundGroupSession
-from .inbound_group_session import InboundGroupSession
+from .inbound_group_session import (
+    InboundGroupSession, load_inbound_group_sessions
+)
+from .pickle_key import PickleKey
+from .stats import Stats, stats_enabled, get_stats, reset_stats
@@ -15,5 +15,12 @@ lib.olm_error.restypes = c_size_t
 
 ERR = lib.olm_error()
 
-class OlmError(Exception):
-    pass
+try:
+    # the compiled bindings, built by setup.py, for the hot paths
+    from . import _olm
+    OlmError = _olm.OlmError
+except ImportError:
+    _olm = None
+
+    class OlmError(Exception):
+        pass
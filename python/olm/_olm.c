@@ -0,0 +1,939 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A compiled companion to the ctypes bindings for the calls that matter for
+ * throughput. Messages and plain-texts are passed with the buffer protocol,
+ * so bytes, bytearrays and memoryviews are read where they are rather than
+ * copied into ctypes buffers, and the GIL is released while the messages are
+ * decrypted so that threads decrypting for different sessions run at once.
+ *
+ * The objects are passed as the pointers held in the ptr attributes of the
+ * ctypes classes. Nothing here stops two threads using one session at once;
+ * that is left to the caller, as it is for the C library.
+ *
+ * Sessions and inbound group sessions live in slabs and the temporary buffers
+ * of each call come from an arena, from olm/pool.h, rather than from the
+ * general purpose heap. Both are only used with the GIL held, so they need no
+ * locks of their own. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "olm/olm.h"
+#include "olm/inbound_group_session.h"
+#include "olm/pool.h"
+
+#include <string.h>
+
+#if PY_MAJOR_VERSION < 3
+#define PyLong_FromSize_t PyInt_FromSize_t
+#endif
+
+static PyObject *OlmError;
+
+/** a "O&" converter for the ptr attributes of the ctypes classes */
+static int pointer_converter(PyObject *object, void **pointer) {
+    *pointer = PyLong_AsVoidPtr(object);
+    if (*pointer == NULL) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_ValueError, "NULL olm object");
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static PyObject *olm_error_result(const char *function, const char *error) {
+    PyErr_Format(OlmError, "%s: %s", function, error);
+    return NULL;
+}
+
+/** The arena is mapped with room for this much at first, and grows up to
+ * MAX_SCRATCH_CAPACITY */
+#define MIN_SCRATCH_CAPACITY ((size_t)64 * 1024)
+#define MAX_SCRATCH_CAPACITY ((size_t)4 * 1024 * 1024)
+
+/** The arena shared by every call for its temporary buffers. It is reset,
+ * which wipes everything taken from it, when the last call using it gives
+ * its buffers back; until then a call which needs more than is left takes
+ * its buffer from the heap instead. */
+static struct {
+    OlmArena *arena;
+    uint8_t *memory;
+    size_t memory_length;
+    size_t capacity;
+    /* the buffers taken from the arena and not yet given back */
+    size_t users;
+} scratch;
+
+/** Take length bytes for the current call, which must be given back with
+ * scratch_give_back(). Returns NULL on failure, having set the error. */
+static void *scratch_take(size_t length) {
+    void *buffer;
+    size_t capacity;
+
+    if (!length) {
+        length = 1;
+    }
+    /* nothing is using the arena, so it can be swapped for a bigger one */
+    if (scratch.users == 0 && length > scratch.capacity
+            && length <= MAX_SCRATCH_CAPACITY) {
+        capacity = scratch.capacity ? scratch.capacity : MIN_SCRATCH_CAPACITY;
+        while (capacity < length) {
+            capacity *= 2;
+        }
+        if (scratch.memory != NULL) {
+            olm_unmap_memory(scratch.memory, scratch.memory_length);
+        }
+        scratch.memory_length = olm_arena_size(capacity);
+        scratch.memory = olm_map_memory(
+            scratch.memory_length, OLM_ANY_NUMA_NODE
+        );
+        if (scratch.memory == NULL) {
+            scratch.arena = NULL;
+            scratch.memory_length = scratch.capacity = 0;
+        } else {
+            scratch.arena = olm_arena(scratch.memory, capacity);
+            scratch.capacity = capacity;
+        }
+    }
+    if (scratch.arena != NULL
+            && (buffer = olm_arena_allocate(scratch.arena, length)) != NULL) {
+        scratch.users++;
+        return buffer;
+    }
+    if ((buffer = PyMem_Malloc(length)) == NULL) {
+        PyErr_NoMemory();
+    }
+    return buffer;
+}
+
+/** Wipe and give back a buffer from scratch_take() */
+static void scratch_give_back(void *buffer, size_t length) {
+    uint8_t *pos = buffer;
+
+    if (scratch.memory != NULL && pos >= scratch.memory
+            && pos < scratch.memory + scratch.memory_length) {
+        if (--scratch.users == 0) {
+            olm_arena_reset(scratch.arena);
+        } else {
+            memset(buffer, 0, length);
+        }
+    } else {
+        memset(buffer, 0, length);
+        PyMem_Free(buffer);
+    }
+}
+
+/** The number of slots in each slab of sessions */
+#define SLAB_SLOTS 64
+
+/** The slabs holding one kind of object, mapped one at a time as they fill
+ * up. Their allocator is handed to olm_allocate_session() and the like. */
+struct slab_chain {
+    size_t slot_size;
+    OlmSlab **slabs;
+    size_t count;
+    OlmAllocator allocator;
+};
+
+static void *slab_chain_allocate(void *context, size_t length) {
+    struct slab_chain *chain = context;
+    OlmSlab **slabs;
+    size_t i;
+
+    if (length > chain->slot_size) {
+        return NULL;
+    }
+    for (i = 0; i < chain->count; ++i) {
+        if (olm_slab_slots_in_use(chain->slabs[i]) < SLAB_SLOTS) {
+            return olm_slab_allocate(chain->slabs[i]);
+        }
+    }
+    slabs = PyMem_Realloc(chain->slabs, (chain->count + 1) * sizeof(*slabs));
+    if (slabs == NULL) {
+        return NULL;
+    }
+    chain->slabs = slabs;
+    if ((slabs[chain->count] = olm_slab_map(
+            chain->slot_size, SLAB_SLOTS, 0)) == NULL) {
+        return NULL;
+    }
+    return olm_slab_allocate(slabs[chain->count++]);
+}
+
+static void slab_chain_release(void *context, void *memory, size_t length) {
+    struct slab_chain *chain = context;
+    size_t i;
+
+    for (i = 0; i < chain->count; ++i) {
+        if (olm_slab_release(chain->slabs[i], memory) != olm_error()) {
+            return;
+        }
+    }
+}
+
+static struct slab_chain session_slabs;
+static struct slab_chain group_session_slabs;
+
+static void slab_chain_init(struct slab_chain *chain, size_t slot_size) {
+    chain->slot_size = slot_size;
+    chain->allocator.allocate = slab_chain_allocate;
+    chain->allocator.release = slab_chain_release;
+    chain->allocator.context = chain;
+}
+
+/** Shrink a bytes object allocated for the longest plain-text to the length
+ * actually written. Returns NULL on failure, having released it. */
+static PyObject *finish_plaintext(PyObject *plaintext, size_t length) {
+    if (_PyBytes_Resize(&plaintext, (Py_ssize_t)length) < 0) {
+        return NULL;
+    }
+    return plaintext;
+}
+
+/** Copy a message which the library will decode in place. The copy is wiped
+ * and given back with release_message_copy(). */
+static uint8_t *copy_message(Py_buffer const *message) {
+    uint8_t *copy = scratch_take(message->len);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, message->buf, message->len);
+    return copy;
+}
+
+static void release_message_copy(uint8_t *copy, size_t length) {
+    scratch_give_back(copy, length);
+}
+
+
+PyDoc_STRVAR(allocate_session_doc,
+"allocate_session() -> pointer\n\n"
+"Take a session from the slabs of sessions. Give it back with\n"
+"release_session(), which clears it.");
+
+static PyObject *py_allocate_session(PyObject *self, PyObject *args) {
+    OlmSession *session = olm_allocate_session(&session_slabs.allocator);
+    if (session == NULL) {
+        return PyErr_NoMemory();
+    }
+    return PyLong_FromVoidPtr(session);
+}
+
+
+PyDoc_STRVAR(release_session_doc,
+"release_session(session)\n\n"
+"Clear a session from allocate_session() and give it back.");
+
+static PyObject *py_release_session(PyObject *self, PyObject *args) {
+    OlmSession *session;
+
+    if (!PyArg_ParseTuple(
+            args, "O&:release_session", pointer_converter, &session)) {
+        return NULL;
+    }
+    olm_release_session(&session_slabs.allocator, session);
+    Py_RETURN_NONE;
+}
+
+
+PyDoc_STRVAR(allocate_inbound_group_session_doc,
+"allocate_inbound_group_session() -> pointer\n\n"
+"Take an inbound group session from the slabs of group sessions. Give it\n"
+"back with release_inbound_group_session(), which clears it.");
+
+static PyObject *py_allocate_inbound_group_session(
+    PyObject *self, PyObject *args
+) {
+    OlmInboundGroupSession *session = olm_allocate_inbound_group_session(
+        &group_session_slabs.allocator
+    );
+    if (session == NULL) {
+        return PyErr_NoMemory();
+    }
+    return PyLong_FromVoidPtr(session);
+}
+
+
+PyDoc_STRVAR(release_inbound_group_session_doc,
+"release_inbound_group_session(session)\n\n"
+"Clear an inbound group session from allocate_inbound_group_session() and\n"
+"give it back.");
+
+static PyObject *py_release_inbound_group_session(
+    PyObject *self, PyObject *args
+) {
+    OlmInboundGroupSession *session;
+
+    if (!PyArg_ParseTuple(
+            args, "O&:release_inbound_group_session", pointer_converter,
+            &session)) {
+        return NULL;
+    }
+    olm_release_inbound_group_session(&group_session_slabs.allocator, session);
+    Py_RETURN_NONE;
+}
+
+
+PyDoc_STRVAR(decrypt_doc,
+"decrypt(session, message_type, message) -> bytes\n\n"
+"Decrypt a base64 message with the session at the pointer session. The\n"
+"message is left unchanged.");
+
+static PyObject *py_decrypt(PyObject *self, PyObject *args) {
+    OlmSession *session;
+    Py_ssize_t message_type;
+    Py_buffer message;
+    PyObject *plaintext = NULL;
+    uint8_t *copy;
+    size_t max_plaintext_length, result;
+
+    if (!PyArg_ParseTuple(
+            args, "O&ns*:decrypt", pointer_converter, &session,
+            &message_type, &message)) {
+        return NULL;
+    }
+
+    max_plaintext_length = olm_peek_max_plaintext_length(
+        session, message_type, message.buf, message.len
+    );
+    if (max_plaintext_length == olm_error()) {
+        PyBuffer_Release(&message);
+        return olm_error_result(
+            "olm_peek_max_plaintext_length", olm_session_last_error(session)
+        );
+    }
+
+    /* the base64 is decoded in place, so this is the one copy we need */
+    if ((copy = copy_message(&message)) == NULL
+            || (plaintext = PyBytes_FromStringAndSize(
+                NULL, max_plaintext_length)) == NULL) {
+        goto done;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = olm_decrypt(
+        session, message_type, copy, message.len,
+        PyBytes_AS_STRING(plaintext), max_plaintext_length
+    );
+    Py_END_ALLOW_THREADS
+
+    if (result == olm_error()) {
+        Py_CLEAR(plaintext);
+        olm_error_result("olm_decrypt", olm_session_last_error(session));
+    } else {
+        plaintext = finish_plaintext(plaintext, result);
+    }
+
+done:
+    if (copy != NULL) {
+        release_message_copy(copy, message.len);
+    }
+    PyBuffer_Release(&message);
+    return plaintext;
+}
+
+
+PyDoc_STRVAR(decrypt_raw_doc,
+"decrypt_raw(session, message_type, message) -> bytes\n\n"
+"Decrypt a binary message with the session at the pointer session. The\n"
+"message is read where it is, without being copied.");
+
+static PyObject *py_decrypt_raw(PyObject *self, PyObject *args) {
+    OlmSession *session;
+    Py_ssize_t message_type;
+    Py_buffer message;
+    PyObject *plaintext;
+    size_t max_plaintext_length, result;
+
+    if (!PyArg_ParseTuple(
+            args, "O&ns*:decrypt_raw", pointer_converter, &session,
+            &message_type, &message)) {
+        return NULL;
+    }
+
+    max_plaintext_length = olm_decrypt_raw_max_plaintext_length(
+        session, message_type, message.buf, message.len
+    );
+    if (max_plaintext_length == olm_error()) {
+        PyBuffer_Release(&message);
+        return olm_error_result(
+            "olm_decrypt_raw_max_plaintext_length",
+            olm_session_last_error(session)
+        );
+    }
+    if ((plaintext = PyBytes_FromStringAndSize(
+            NULL, max_plaintext_length)) == NULL) {
+        PyBuffer_Release(&message);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = olm_decrypt_raw(
+        session, message_type, message.buf, message.len,
+        PyBytes_AS_STRING(plaintext), max_plaintext_length
+    );
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&message);
+    if (result == olm_error()) {
+        Py_DECREF(plaintext);
+        return olm_error_result(
+            "olm_decrypt_raw", olm_session_last_error(session)
+        );
+    }
+    return finish_plaintext(plaintext, result);
+}
+
+
+PyDoc_STRVAR(group_decrypt_doc,
+"group_decrypt(session, message) -> (bytes, message_index)\n\n"
+"Decrypt a base64 group message with the inbound group session at the\n"
+"pointer session. The message is left unchanged.");
+
+static PyObject *py_group_decrypt(PyObject *self, PyObject *args) {
+    OlmInboundGroupSession *session;
+    Py_buffer message;
+    PyObject *plaintext = NULL, *tuple = NULL;
+    uint8_t *copy;
+    size_t max_plaintext_length, result;
+    uint32_t message_index = 0;
+
+    if (!PyArg_ParseTuple(
+            args, "O&s*:group_decrypt", pointer_converter, &session,
+            &message)) {
+        return NULL;
+    }
+
+    max_plaintext_length = olm_group_peek_max_plaintext_length(
+        session, message.buf, message.len
+    );
+    if (max_plaintext_length == olm_error()) {
+        PyBuffer_Release(&message);
+        return olm_error_result(
+            "olm_group_peek_max_plaintext_length",
+            olm_inbound_group_session_last_error(session)
+        );
+    }
+
+    /* the base64 is decoded in place, so this is the one copy we need */
+    if ((copy = copy_message(&message)) == NULL
+            || (plaintext = PyBytes_FromStringAndSize(
+                NULL, max_plaintext_length)) == NULL) {
+        goto done;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = olm_group_decrypt(
+        session, copy, message.len,
+        (uint8_t *)PyBytes_AS_STRING(plaintext), max_plaintext_length,
+        &message_index
+    );
+    Py_END_ALLOW_THREADS
+
+    if (result == olm_error()) {
+        Py_DECREF(plaintext);
+        olm_error_result(
+            "olm_group_decrypt", olm_inbound_group_session_last_error(session)
+        );
+    } else if ((plaintext = finish_plaintext(plaintext, result)) != NULL) {
+        tuple = Py_BuildValue("(Nk)", plaintext, (unsigned long)message_index);
+    }
+
+done:
+    if (copy != NULL) {
+        release_message_copy(copy, message.len);
+    }
+    PyBuffer_Release(&message);
+    return tuple;
+}
+
+
+PyDoc_STRVAR(group_decrypt_raw_doc,
+"group_decrypt_raw(session, message) -> (bytes, message_index)\n\n"
+"Decrypt a binary group message with the inbound group session at the\n"
+"pointer session. The message is read where it is, without being copied.");
+
+static PyObject *py_group_decrypt_raw(PyObject *self, PyObject *args) {
+    OlmInboundGroupSession *session;
+    Py_buffer message;
+    PyObject *plaintext;
+    size_t max_plaintext_length, result;
+    uint32_t message_index = 0;
+
+    if (!PyArg_ParseTuple(
+            args, "O&s*:group_decrypt_raw", pointer_converter, &session,
+            &message)) {
+        return NULL;
+    }
+
+    max_plaintext_length = olm_group_decrypt_raw_max_plaintext_length(
+        session, message.buf, message.len
+    );
+    if (max_plaintext_length == olm_error()) {
+        PyBuffer_Release(&message);
+        return olm_error_result(
+            "olm_group_decrypt_raw_max_plaintext_length",
+            olm_inbound_group_session_last_error(session)
+        );
+    }
+    if ((plaintext = PyBytes_FromStringAndSize(
+            NULL, max_plaintext_length)) == NULL) {
+        PyBuffer_Release(&message);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = olm_group_decrypt_raw(
+        session, message.buf, message.len,
+        (uint8_t *)PyBytes_AS_STRING(plaintext), max_plaintext_length,
+        &message_index
+    );
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&message);
+    if (result == olm_error()) {
+        Py_DECREF(plaintext);
+        return olm_error_result(
+            "olm_group_decrypt_raw",
+            olm_inbound_group_session_last_error(session)
+        );
+    }
+    if ((plaintext = finish_plaintext(plaintext, result)) == NULL) {
+        return NULL;
+    }
+    return Py_BuildValue("(Nk)", plaintext, (unsigned long)message_index);
+}
+
+
+/** The arrays and buffers of one batch, taken from one scratch buffer. The
+ * messages are copied into it, since they are decoded in place, and each
+ * plain-text is given as much room as its message, which is always
+ * enough. */
+struct batch {
+    size_t count;
+    uint8_t **messages;
+    size_t *message_lengths;
+    uint8_t **plaintexts;
+    size_t *plaintext_lengths;
+    const char **errors;
+    uint8_t *memory;
+    size_t memory_length;
+};
+
+/** Lay out a batch for the messages in the sequence messages, which has
+ * count items, with extra bytes at the end for the caller. */
+static int batch_init(
+    struct batch *batch, PyObject *messages, size_t count, size_t extra
+) {
+    PyObject **items = PySequence_Fast_ITEMS(messages);
+    Py_buffer view;
+    size_t i, total = 0;
+    uint8_t *pos;
+
+    for (i = 0; i < count; ++i) {
+        if (PyObject_GetBuffer(items[i], &view, PyBUF_SIMPLE) < 0) {
+            return -1;
+        }
+        total += view.len;
+        PyBuffer_Release(&view);
+    }
+
+    batch->count = count;
+    batch->memory_length = count * (
+        2 * sizeof(uint8_t *) + 2 * sizeof(size_t) + sizeof(const char *)
+    ) + extra + 2 * total;
+    if ((batch->memory = scratch_take(batch->memory_length)) == NULL) {
+        return -1;
+    }
+
+    pos = batch->memory;
+    batch->messages = (uint8_t **)pos; pos += count * sizeof(uint8_t *);
+    batch->plaintexts = (uint8_t **)pos; pos += count * sizeof(uint8_t *);
+    batch->message_lengths = (size_t *)pos; pos += count * sizeof(size_t);
+    batch->plaintext_lengths = (size_t *)pos; pos += count * sizeof(size_t);
+    batch->errors = (const char **)pos; pos += count * sizeof(const char *);
+    pos += extra;
+
+    for (i = 0; i < count; ++i) {
+        if (PyObject_GetBuffer(items[i], &view, PyBUF_SIMPLE) < 0) {
+            scratch_give_back(batch->memory, batch->memory_length);
+            return -1;
+        }
+        batch->messages[i] = pos;
+        batch->message_lengths[i] = view.len;
+        memcpy(pos, view.buf, view.len);
+        pos += view.len;
+        PyBuffer_Release(&view);
+    }
+    for (i = 0; i < count; ++i) {
+        batch->plaintexts[i] = pos;
+        pos += batch->message_lengths[i];
+    }
+    return 0;
+}
+
+/** The room for the extra bytes of a batch */
+static uint8_t *batch_extra(struct batch const *batch) {
+    return (uint8_t *)(batch->errors + batch->count);
+}
+
+static void batch_release(struct batch *batch) {
+    scratch_give_back(batch->memory, batch->memory_length);
+}
+
+/** The plain-texts of a batch, with None for the messages which couldn't be
+ * decrypted, and the errors */
+static PyObject *batch_results(struct batch const *batch) {
+    PyObject *plaintexts = PyList_New(batch->count);
+    PyObject *errors = PyList_New(batch->count);
+    size_t i;
+
+    if (plaintexts == NULL || errors == NULL) {
+        goto fail;
+    }
+    for (i = 0; i < batch->count; ++i) {
+        PyObject *plaintext, *error;
+        if (batch->plaintext_lengths[i] == olm_error()) {
+            Py_INCREF(Py_None);
+            plaintext = Py_None;
+        } else if ((plaintext = PyBytes_FromStringAndSize(
+                (const char *)batch->plaintexts[i],
+                batch->plaintext_lengths[i])) == NULL) {
+            goto fail;
+        }
+        PyList_SET_ITEM(plaintexts, i, plaintext);
+        if ((error = PyUnicode_FromString(batch->errors[i])) == NULL) {
+            goto fail;
+        }
+        PyList_SET_ITEM(errors, i, error);
+    }
+    return Py_BuildValue("(NN)", plaintexts, errors);
+
+fail:
+    Py_XDECREF(plaintexts);
+    Py_XDECREF(errors);
+    return NULL;
+}
+
+
+PyDoc_STRVAR(decrypt_batch_doc,
+"decrypt_batch(sessions, message_types, messages) -> (plaintexts, errors)\n\n"
+"Decrypt base64 messages, each with the session at the pointer at the same\n"
+"place in sessions, as olm_decrypt_batch() does. plaintexts has None for\n"
+"each message which couldn't be decrypted, and errors has the error for\n"
+"each message, which is \"SUCCESS\" for the others.");
+
+static PyObject *py_decrypt_batch(PyObject *self, PyObject *args) {
+    PyObject *session_list, *type_list, *message_list;
+    PyObject *sessions = NULL, *types = NULL, *messages = NULL;
+    PyObject *result = NULL;
+    struct batch batch;
+    size_t count, i, scratch_length, failures;
+    Py_ssize_t message_type;
+    OlmSession **session_pointers;
+    size_t *message_types, *plaintext_limits, *scratch;
+
+    if (!PyArg_ParseTuple(
+            args, "OOO:decrypt_batch", &session_list, &type_list,
+            &message_list)
+        || !(sessions = PySequence_Fast(session_list, "sessions"))
+        || !(types = PySequence_Fast(type_list, "message_types"))
+        || !(messages = PySequence_Fast(message_list, "messages"))) {
+        goto done;
+    }
+    count = PySequence_Fast_GET_SIZE(messages);
+    if ((size_t)PySequence_Fast_GET_SIZE(sessions) != count
+            || (size_t)PySequence_Fast_GET_SIZE(types) != count) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "sessions, message_types and messages must be the same length"
+        );
+        goto done;
+    }
+
+    scratch_length = olm_decrypt_batch_scratch_length(count);
+    if (batch_init(&batch, messages, count,
+            count * (sizeof(OlmSession *) + 2 * sizeof(size_t))
+            + scratch_length * sizeof(size_t)) < 0) {
+        goto done;
+    }
+    session_pointers = (OlmSession **)batch_extra(&batch);
+    message_types = (size_t *)(session_pointers + count);
+    plaintext_limits = message_types + count;
+    scratch = plaintext_limits + count;
+
+    for (i = 0; i < count; ++i) {
+        if (!pointer_converter(
+                PySequence_Fast_GET_ITEM(sessions, i),
+                (void **)&session_pointers[i])) {
+            goto release;
+        }
+        message_type = PyNumber_AsSsize_t(
+            PySequence_Fast_GET_ITEM(types, i), PyExc_OverflowError
+        );
+        if (message_type == -1 && PyErr_Occurred()) {
+            goto release;
+        }
+        message_types[i] = message_type;
+        plaintext_limits[i] = batch.message_lengths[i];
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    failures = olm_decrypt_batch(
+        session_pointers, count, message_types,
+        (void * const *)batch.messages, batch.message_lengths,
+        (void * const *)batch.plaintexts, plaintext_limits,
+        batch.plaintext_lengths, batch.errors,
+        scratch, scratch_length, NULL, NULL
+    );
+    Py_END_ALLOW_THREADS
+
+    if (failures == olm_error()) {
+        olm_error_result("olm_decrypt_batch", "NOT_ENOUGH_SCRATCH");
+    } else {
+        result = batch_results(&batch);
+    }
+
+release:
+    batch_release(&batch);
+done:
+    Py_XDECREF(sessions);
+    Py_XDECREF(types);
+    Py_XDECREF(messages);
+    return result;
+}
+
+
+PyDoc_STRVAR(group_decrypt_batch_doc,
+"group_decrypt_batch(session, messages) -> (plaintexts, indices, errors)\n\n"
+"Decrypt base64 group messages with the inbound group session at the\n"
+"pointer session, as olm_group_decrypt_batch() does. plaintexts has None\n"
+"for each message which couldn't be decrypted, indices has the message\n"
+"index of each message, or None if its headers couldn't be decoded, and\n"
+"errors has the error for each message, which is \"SUCCESS\" for the\n"
+"others.");
+
+static PyObject *py_group_decrypt_batch(PyObject *self, PyObject *args) {
+    OlmInboundGroupSession *session;
+    PyObject *message_list, *messages = NULL, *result = NULL;
+    PyObject *decrypted, *indices;
+    struct batch batch;
+    size_t count, i;
+    size_t *plaintext_limits;
+    uint32_t *message_indices;
+
+    if (!PyArg_ParseTuple(
+            args, "O&O:group_decrypt_batch", pointer_converter, &session,
+            &message_list)
+        || !(messages = PySequence_Fast(message_list, "messages"))) {
+        goto done;
+    }
+    count = PySequence_Fast_GET_SIZE(messages);
+
+    if (batch_init(&batch, messages, count,
+            count * (sizeof(size_t) + sizeof(uint32_t))) < 0) {
+        goto done;
+    }
+    plaintext_limits = (size_t *)batch_extra(&batch);
+    message_indices = (uint32_t *)(plaintext_limits + count);
+    for (i = 0; i < count; ++i) {
+        plaintext_limits[i] = batch.message_lengths[i];
+        /* left alone for messages whose headers can't be decoded */
+        message_indices[i] = UINT32_MAX;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    olm_group_decrypt_batch(
+        session, count, batch.messages, batch.message_lengths,
+        batch.plaintexts, plaintext_limits, batch.plaintext_lengths,
+        message_indices, batch.errors
+    );
+    Py_END_ALLOW_THREADS
+
+    if ((decrypted = batch_results(&batch)) == NULL) {
+        goto release;
+    }
+    if ((indices = PyList_New(count)) == NULL) {
+        Py_DECREF(decrypted);
+        goto release;
+    }
+    for (i = 0; i < count; ++i) {
+        PyObject *index;
+        if (message_indices[i] == UINT32_MAX) {
+            Py_INCREF(Py_None);
+            index = Py_None;
+        } else if ((index = PyLong_FromUnsignedLong(
+                message_indices[i])) == NULL) {
+            Py_DECREF(indices);
+            Py_DECREF(decrypted);
+            goto release;
+        }
+        PyList_SET_ITEM(indices, i, index);
+    }
+    result = Py_BuildValue(
+        "(ONO)", PyTuple_GET_ITEM(decrypted, 0), indices,
+        PyTuple_GET_ITEM(decrypted, 1)
+    );
+    Py_DECREF(decrypted);
+
+release:
+    batch_release(&batch);
+done:
+    Py_XDECREF(messages);
+    return result;
+}
+
+
+PyDoc_STRVAR(unpickle_inbound_group_sessions_doc,
+"unpickle_inbound_group_sessions(pickle_key, sessions, pickles) -> errors\n\n"
+"Load each pickle into the inbound group session at the pointer at the same\n"
+"place in sessions, using the keys held by the pickle key at the pointer\n"
+"pickle_key. Returns the error for each pickle, which is \"SUCCESS\" for\n"
+"those which were loaded. The pickles are left unchanged.");
+
+static PyObject *py_unpickle_inbound_group_sessions(
+    PyObject *self, PyObject *args
+) {
+    OlmPickleKey *pickle_key;
+    PyObject *session_list, *pickle_list;
+    PyObject *sessions = NULL, *pickles = NULL, *result = NULL;
+    struct batch batch;
+    size_t count, i;
+    OlmInboundGroupSession **session_pointers;
+
+    if (!PyArg_ParseTuple(
+            args, "O&OO:unpickle_inbound_group_sessions", pointer_converter,
+            &pickle_key, &session_list, &pickle_list)
+        || !(sessions = PySequence_Fast(session_list, "sessions"))
+        || !(pickles = PySequence_Fast(pickle_list, "pickles"))) {
+        goto done;
+    }
+    count = PySequence_Fast_GET_SIZE(pickles);
+    if ((size_t)PySequence_Fast_GET_SIZE(sessions) != count) {
+        PyErr_SetString(
+            PyExc_ValueError, "sessions and pickles must be the same length"
+        );
+        goto done;
+    }
+
+    /* the pickles are decoded in place, so they are copied to the batch */
+    if (batch_init(&batch, pickles, count,
+            count * sizeof(OlmInboundGroupSession *)) < 0) {
+        goto done;
+    }
+    session_pointers = (OlmInboundGroupSession **)batch_extra(&batch);
+    for (i = 0; i < count; ++i) {
+        if (!pointer_converter(
+                PySequence_Fast_GET_ITEM(sessions, i),
+                (void **)&session_pointers[i])) {
+            goto release;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < count; ++i) {
+        if (olm_unpickle_inbound_group_session_with_key(
+                session_pointers[i], pickle_key,
+                batch.messages[i], batch.message_lengths[i]) == olm_error()) {
+            batch.errors[i] = olm_inbound_group_session_last_error(
+                session_pointers[i]
+            );
+        } else {
+            batch.errors[i] = "SUCCESS";
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    if ((result = PyList_New(count)) == NULL) {
+        goto release;
+    }
+    for (i = 0; i < count; ++i) {
+        PyObject *error = PyUnicode_FromString(batch.errors[i]);
+        if (error == NULL) {
+            Py_CLEAR(result);
+            goto release;
+        }
+        PyList_SET_ITEM(result, i, error);
+    }
+
+release:
+    batch_release(&batch);
+done:
+    Py_XDECREF(sessions);
+    Py_XDECREF(pickles);
+    return result;
+}
+
+
+static PyMethodDef olm_methods[] = {
+    {"decrypt", py_decrypt, METH_VARARGS, decrypt_doc},
+    {"decrypt_raw", py_decrypt_raw, METH_VARARGS, decrypt_raw_doc},
+    {"group_decrypt", py_group_decrypt, METH_VARARGS, group_decrypt_doc},
+    {"group_decrypt_raw", py_group_decrypt_raw, METH_VARARGS,
+        group_decrypt_raw_doc},
+    {"decrypt_batch", py_decrypt_batch, METH_VARARGS, decrypt_batch_doc},
+    {"group_decrypt_batch", py_group_decrypt_batch, METH_VARARGS,
+        group_decrypt_batch_doc},
+    {"unpickle_inbound_group_sessions", py_unpickle_inbound_group_sessions,
+        METH_VARARGS, unpickle_inbound_group_sessions_doc},
+    {"allocate_session", py_allocate_session, METH_NOARGS,
+        allocate_session_doc},
+    {"release_session", py_release_session, METH_VARARGS,
+        release_session_doc},
+    {"allocate_inbound_group_session", py_allocate_inbound_group_session,
+        METH_NOARGS, allocate_inbound_group_session_doc},
+    {"release_inbound_group_session", py_release_inbound_group_session,
+        METH_VARARGS, release_inbound_group_session_doc},
+    {NULL, NULL, 0, NULL}
+};
+
+PyDoc_STRVAR(module_doc, "Compiled bindings for the hot paths of libolm");
+
+static PyObject *init_module(PyObject *module) {
+    if (module == NULL) {
+        return NULL;
+    }
+    slab_chain_init(&session_slabs, olm_session_size());
+    slab_chain_init(&group_session_slabs, olm_inbound_group_session_size());
+    OlmError = PyErr_NewException("olm._olm.OlmError", NULL, NULL);
+    if (OlmError == NULL) {
+        return NULL;
+    }
+    Py_INCREF(OlmError);
+    if (PyModule_AddObject(module, "OlmError", OlmError) < 0) {
+        return NULL;
+    }
+    return module;
+}
+
+#if PY_MAJOR_VERSION >= 3
+
+static struct PyModuleDef olm_module = {
+    PyModuleDef_HEAD_INIT, "_olm", module_doc, -1, olm_methods
+};
+
+PyMODINIT_FUNC PyInit__olm(void) {
+    return init_module(PyModule_Create(&olm_module));
+}
+
+#else
+
+PyMODINIT_FUNC init_olm(void) {
+    init_module(Py_InitModule3("_olm", olm_methods, module_doc));
+}
+
+#endif
@@ -1,6 +1,14 @@
 import json
+import threading
+
+try:
+    import queue
+except ImportError:
+    import Queue as queue
 
 from ._base import *
+from ._base import _olm
+from .pickle_key import PickleKey
 
 lib.olm_inbound_group_session_size.argtypes = []
 lib.olm_inbound_group_session_size.restype = c_size_t
@@ -25,6 +33,7 @@ def inbound_group_session_function(func, *types):
     func.errcheck = inbound_group_session_errcheck
 
 
+inbound_group_session_function(lib.olm_pickle_inbound_group_session_length)
 inbound_group_session_function(
     lib.olm_pickle_inbound_group_session, c_void_p, c_size_t, c_void_p, c_size_t
 )
@@ -43,6 +52,9 @@ inbound_group_session_function(
 inbound_group_session_function(
     lib.olm_group_decrypt_max_plaintext_length, c_void_p, c_size_t
 )
+inbound_group_session_function(
+    lib.olm_group_peek_max_plaintext_length, c_void_p, c_size_t
+)
 inbound_group_session_function(
     lib.olm_group_decrypt,
     c_void_p, c_size_t, # message
@@ -50,6 +62,10 @@ inbound_group_session_function(
     POINTER(c_uint32), # message_index
 )
 
+inbound_group_session_function(
+    lib.olm_unpickle_inbound_group_session_with_key, c_void_p, c_void_p, c_size_t
+)
+
 inbound_group_session_function(lib.olm_inbound_group_session_id_length)
 inbound_group_session_function(lib.olm_inbound_group_session_id, c_void_p, c_size_t)
 
@@ -62,8 +78,19 @@ inbound_group_session_function(lib.olm_export_inbound_group_session, c_void_p, c
 
 class InboundGroupSession(object):
     def __init__(self):
-        self.buf = create_string_buffer(lib.olm_inbound_group_session_size())
-        self.ptr = lib.olm_inbound_group_session(self.buf)
+        if _olm:
+            # from the compiled bindings' slabs, given back by __del__
+            self.ptr = _olm.allocate_inbound_group_session()
+            self.slot = True
+        else:
+            self.buf = create_string_buffer(
+                lib.olm_inbound_group_session_size()
+            )
+            self.ptr = lib.olm_inbound_group_session(self.buf)
+
+    def __del__(self):
+        if getattr(self, "slot", False) and _olm:
+            _olm.release_inbound_group_session(self.ptr)
 
     def pickle(self, key):
         key_buffer = create_string_buffer(key)
@@ -94,12 +121,13 @@ class InboundGroupSession(object):
         )
 
     def decrypt(self, message):
+        if _olm:
+            return _olm.group_decrypt(self.ptr, message)
         message_buffer = create_string_buffer(message)
-        max_plaintext_length = lib.olm_group_decrypt_max_plaintext_length(
+        max_plaintext_length = lib.olm_group_peek_max_plaintext_length(
             self.ptr, message_buffer, len(message)
         )
         plaintext_buffer = create_string_buffer(max_plaintext_length)
-        message_buffer = create_string_buffer(message)
 
         message_index = c_uint32()
         plaintext_length = lib.olm_group_decrypt(
@@ -107,7 +135,41 @@ class InboundGroupSession(object):
             plaintext_buffer, max_plaintext_length,
             byref(message_index)
         )
-        return plaintext_buffer.raw[:plaintext_length], message_index
+        return plaintext_buffer.raw[:plaintext_length], message_index.value
+
+    def decrypt_raw(self, message):
+        """Decrypt a binary message. The message can be any object with the
+        buffer protocol, and isn't copied. Needs the compiled bindings."""
+        if not _olm:
+            raise OlmError("decrypt_raw needs the compiled bindings")
+        return _olm.group_decrypt_raw(self.ptr, message)
+
+    def decrypt_batch(self, messages):
+        """Decrypt messages, returning the plaintexts, with None for each
+        message which couldn't be decrypted, the message indices, with None
+        for each message whose headers couldn't be decoded, and the error for
+        each message ("SUCCESS" for the others). With the compiled bindings
+        the messages are decrypted without holding the GIL."""
+        if _olm:
+            return _olm.group_decrypt_batch(self.ptr, messages)
+        plaintexts = []
+        indices = []
+        errors = []
+        for message in messages:
+            try:
+                plaintext, index = self.decrypt(message)
+                plaintexts.append(plaintext)
+                indices.append(index)
+                errors.append("SUCCESS")
+            except OlmError:
+                plaintexts.append(None)
+                indices.append(None)
+                errors.append(
+                    lib.olm_inbound_group_session_last_error(
+                        self.ptr
+                    ).decode("ascii")
+                )
+        return plaintexts, indices, errors
 
     def session_id(self):
         id_length = lib.olm_inbound_group_session_id_length(self.ptr)
@@ -124,3 +186,85 @@ class InboundGroupSession(object):
         lib.olm_export_inbound_group_session(self.ptr, buffer, length,
                                              message_index)
         return buffer.raw
+
+
+def _unpickle_chunk(pickle_key, pickles):
+    sessions = [InboundGroupSession() for pickle in pickles]
+    if _olm:
+        errors = _olm.unpickle_inbound_group_sessions(
+            pickle_key.ptr, [session.ptr for session in sessions], pickles
+        )
+    else:
+        errors = []
+        for session, pickle in zip(sessions, pickles):
+            pickle_buffer = create_string_buffer(pickle)
+            try:
+                lib.olm_unpickle_inbound_group_session_with_key(
+                    session.ptr, pickle_key.ptr, pickle_buffer, len(pickle)
+                )
+                errors.append("SUCCESS")
+            except OlmError:
+                errors.append(None)
+    return [
+        session if error == "SUCCESS" else None
+        for session, error in zip(sessions, errors)
+    ]
+
+
+def load_inbound_group_sessions(key, pickles, chunk_size=256):
+    """Unpickle inbound group sessions which were all pickled under key.
+
+    The keys are derived from key once rather than for every pickle, and the
+    pickles are read from the iterable and loaded in chunks on a background
+    thread, which doesn't hold the GIL while it decrypts them if the compiled
+    bindings are there. Yields an InboundGroupSession for each pickle, in
+    order, or None for each pickle which couldn't be loaded.
+
+    Waiting for the next session blocks, so an asyncio event loop should
+    take them through an executor, for instance with
+    loop.run_in_executor(None, next, sessions, None).
+    """
+    results = queue.Queue(4)
+    stopped = threading.Event()
+
+    def put(item):
+        while not stopped.is_set():
+            try:
+                results.put(item, timeout=0.1)
+                return True
+            except queue.Full:
+                pass
+        return False
+
+    def load():
+        pickle_key = PickleKey(key)
+        try:
+            chunk = []
+            for pickle in pickles:
+                chunk.append(pickle)
+                if len(chunk) == chunk_size:
+                    if not put(_unpickle_chunk(pickle_key, chunk)):
+                        return
+                    chunk = []
+            if chunk:
+                put(_unpickle_chunk(pickle_key, chunk))
+        except Exception as e:
+            put(e)
+        finally:
+            pickle_key.clear()
+            put(None)
+
+    thread = threading.Thread(target=load)
+    thread.daemon = True
+    thread.start()
+    try:
+        while True:
+            item = results.get()
+            if item is None:
+                break
+            if isinstance(item, Exception):
+                raise item
+            for session in item:
+                yield session
+    finally:
+        stopped.set()
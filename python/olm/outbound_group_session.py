@@ -25,6 +25,7 @@ def outbound_group_session_function(func, *types):
     func.errcheck = outbound_group_session_errcheck
 
 
+outbound_group_session_function(lib.olm_pickle_outbound_group_session_length)
 outbound_group_session_function(
     lib.olm_pickle_outbound_group_session, c_void_p, c_size_t, c_void_p, c_size_t
 )
@@ -0,0 +1,23 @@
+from ._base import *
+
+lib.olm_pickle_key_size.argtypes = []
+lib.olm_pickle_key_size.restype = c_size_t
+
+lib.olm_pickle_key.argtypes = [c_void_p, c_void_p, c_size_t]
+lib.olm_pickle_key.restype = c_void_p
+
+lib.olm_clear_pickle_key.argtypes = [c_void_p]
+lib.olm_clear_pickle_key.restype = c_size_t
+
+
+class PickleKey(object):
+    """The keys derived from a pickle key, so that many objects pickled
+    under it can be loaded without deriving them again for each one."""
+
+    def __init__(self, key):
+        self.buf = create_string_buffer(lib.olm_pickle_key_size())
+        key_buffer = create_string_buffer(key)
+        self.ptr = lib.olm_pickle_key(self.buf, key_buffer, len(key))
+
+    def clear(self):
+        lib.olm_clear_pickle_key(self.ptr)
@@ -1,4 +1,5 @@
 from ._base import *
+from ._base import _olm
 
 
 lib.olm_session_size.argtypes = []
@@ -68,11 +69,28 @@ session_function(
     c_void_p, c_size_t,  # Random
     c_void_p, c_size_t,  # Message
 );
+session_function(
+    lib.olm_encrypt_batch_message_length,
+    c_size_t, POINTER(c_size_t),  # Plaintext Lengths
+)
+session_function(
+    lib.olm_encrypt_batch,
+    c_size_t,  # Count
+    POINTER(c_void_p), POINTER(c_size_t),  # Plaintexts
+    c_void_p, c_size_t,  # Random
+    c_void_p, c_size_t,  # Messages
+    POINTER(c_size_t),  # Message Lengths
+)
 session_function(
     lib.olm_decrypt_max_plaintext_length,
     c_size_t,  # Message Type
     c_void_p, c_size_t,  # Message
 )
+session_function(
+    lib.olm_peek_max_plaintext_length,
+    c_size_t,  # Message Type
+    c_void_p, c_size_t,  # Message
+)
 session_function(
     lib.olm_decrypt,
     c_size_t,  # Message Type
@@ -82,8 +100,17 @@ session_function(
 
 class Session(object):
     def __init__(self):
-        self.buf = create_string_buffer(lib.olm_session_size())
-        self.ptr = lib.olm_session(self.buf)
+        if _olm:
+            # from the compiled bindings' slabs, given back by __del__
+            self.ptr = _olm.allocate_session()
+            self.slot = True
+        else:
+            self.buf = create_string_buffer(lib.olm_session_size())
+            self.ptr = lib.olm_session(self.buf)
+
+    def __del__(self):
+        if getattr(self, "slot", False) and _olm:
+            _olm.release_session(self.ptr)
 
     def pickle(self, key):
         key_buffer = create_string_buffer(key)
@@ -176,18 +203,205 @@ class Session(object):
         )
         return message_type, message_buffer.raw
 
+    def encrypt_batch(self, plaintexts):
+        """Encrypt several plain-texts at once, in order, as if by calling
+        encrypt() on each. Returns the message type, which is the same for
+        all of them, and the list of messages."""
+        count = len(plaintexts)
+        r_length = lib.olm_encrypt_random_length(self.ptr)
+        random_buffer = create_string_buffer(read_random(r_length))
+
+        message_type = lib.olm_encrypt_message_type(self.ptr)
+        plaintext_buffers = [create_string_buffer(p) for p in plaintexts]
+        plaintext_ptrs = (c_void_p * count)(
+            *[addressof(b) for b in plaintext_buffers]
+        )
+        plaintext_lengths = (c_size_t * count)(*[len(p) for p in plaintexts])
+        messages_length = lib.olm_encrypt_batch_message_length(
+            self.ptr, count, plaintext_lengths
+        )
+        messages_buffer = create_string_buffer(messages_length)
+        message_lengths = (c_size_t * count)()
+
+        lib.olm_encrypt_batch(
+            self.ptr, count, plaintext_ptrs, plaintext_lengths,
+            random_buffer, r_length,
+            messages_buffer, messages_length, message_lengths,
+        )
+        messages = []
+        pos = 0
+        for length in message_lengths:
+            messages.append(messages_buffer.raw[pos:pos + length])
+            pos += length
+        return message_type, messages
+
     def decrypt(self, message_type, message):
+        if _olm:
+            return _olm.decrypt(self.ptr, message_type, message)
         message_buffer = create_string_buffer(message)
-        max_plaintext_length = lib.olm_decrypt_max_plaintext_length(
+        max_plaintext_length = lib.olm_peek_max_plaintext_length(
             self.ptr, message_type, message_buffer, len(message)
         )
         plaintext_buffer = create_string_buffer(max_plaintext_length)
-        message_buffer = create_string_buffer(message)
         plaintext_length = lib.olm_decrypt(
             self.ptr, message_type, message_buffer, len(message),
             plaintext_buffer, max_plaintext_length
         )
         return plaintext_buffer.raw[:plaintext_length]
 
+    def decrypt_raw(self, message_type, message):
+        """Decrypt a binary message. The message can be any object with the
+        buffer protocol, and isn't copied. Needs the compiled bindings."""
+        if not _olm:
+            raise OlmError("decrypt_raw needs the compiled bindings")
+        return _olm.decrypt_raw(self.ptr, message_type, message)
+
     def clear(self):
         pass
+
+
+def decrypt_batch(sessions, message_types, messages):
+    """Decrypt messages, each with the session at the same place in
+    sessions. Returns the plaintexts, with None for each message which
+    couldn't be decrypted, and the error for each message ("SUCCESS" for the
+    others). With the compiled bindings the messages are decrypted without
+    holding the GIL."""
+    if _olm:
+        return _olm.decrypt_batch(
+            [session.ptr for session in sessions], message_types, messages
+        )
+    plaintexts = []
+    errors = []
+    for session, message_type, message in zip(
+            sessions, message_types, messages):
+        try:
+            plaintexts.append(session.decrypt(message_type, message))
+            errors.append("SUCCESS")
+        except OlmError as e:
+            plaintexts.append(None)
+            errors.append(
+                lib.olm_session_last_error(session.ptr).decode("ascii")
+            )
+    return plaintexts, errors
+
+
+OLM_PICKLE_CIPHER_AES_GCM = 1
+
+_allocate_function = CFUNCTYPE(c_void_p, c_void_p, c_size_t)
+_release_function = CFUNCTYPE(None, c_void_p, c_void_p, c_size_t)
+
+
+class _Allocator(Structure):
+    _fields_ = [
+        ("allocate", _allocate_function),
+        ("release", _release_function),
+        ("context", c_void_p),
+    ]
+
+
+lib.olm_session_handle_size.argtypes = []
+lib.olm_session_handle_size.restype = c_size_t
+
+lib.olm_session_handle.argtypes = [
+    c_void_p,
+    c_void_p, c_uint32,  # Pickle Key, Cipher
+    POINTER(_Allocator),
+    c_void_p, c_size_t, c_size_t,  # Pickle
+]
+lib.olm_session_handle.restype = c_void_p
+
+lib.olm_session_handle_get.argtypes = [c_void_p]
+lib.olm_session_handle_get.restype = c_void_p
+
+lib.olm_session_handle_is_sealed.argtypes = [c_void_p]
+lib.olm_session_handle_is_sealed.restype = c_int
+
+lib.olm_session_handle_set_idle_timeout.argtypes = [c_void_p, c_uint32]
+lib.olm_session_handle_set_idle_timeout.restype = None
+
+lib.olm_session_handle_last_error.argtypes = [c_void_p]
+lib.olm_session_handle_last_error.restype = c_char_p
+
+
+def session_handle_errcheck(res, func, args):
+    if res == ERR:
+        raise OlmError("%s: %s" % (
+            func.__name__, lib.olm_session_handle_last_error(args[0])
+        ))
+    return res
+
+
+for func in (
+        lib.olm_session_handle_seal,
+        lib.olm_session_handle_seal_if_idle,
+        lib.olm_session_handle_pickle_length,
+        lib.olm_clear_session_handle):
+    func.argtypes = [c_void_p]
+    func.restype = c_size_t
+    func.errcheck = session_handle_errcheck
+
+
+class LazySession(Session):
+    """A session which is kept pickled until it is used, and can be pickled
+    again once it has been left alone for idle_timeout milliseconds, by
+    calling seal_if_idle() from time to time. The pickle_key is a PickleKey,
+    which must be kept until the session is cleared, and pickle one from
+    Session.pickle() or seal() under the same key. All the Session methods
+    unpickle the session first if they need to."""
+
+    def __init__(self, pickle_key, pickle, capacity=None, idle_timeout=None):
+        if capacity is None:
+            capacity = 2 * len(pickle)
+        self.pickle_key = pickle_key
+        self.pickle_buffer = create_string_buffer(pickle, capacity)
+        self.memory = {}
+        self.allocator = _Allocator(
+            _allocate_function(self._allocate),
+            _release_function(self._release),
+            None,
+        )
+        self.buf = create_string_buffer(lib.olm_session_handle_size())
+        self.handle = lib.olm_session_handle(
+            self.buf, pickle_key.ptr, OLM_PICKLE_CIPHER_AES_GCM,
+            byref(self.allocator), self.pickle_buffer, len(pickle), capacity
+        )
+        if idle_timeout is not None:
+            lib.olm_session_handle_set_idle_timeout(self.handle, idle_timeout)
+
+    def _allocate(self, context, length):
+        memory = create_string_buffer(length)
+        address = addressof(memory)
+        self.memory[address] = memory
+        return address
+
+    def _release(self, context, memory, length):
+        del self.memory[memory]
+
+    @property
+    def ptr(self):
+        session = lib.olm_session_handle_get(self.handle)
+        if not session:
+            raise OlmError("olm_session_handle_get: %s" % (
+                lib.olm_session_handle_last_error(self.handle)
+            ))
+        return session
+
+    def is_sealed(self):
+        return bool(lib.olm_session_handle_is_sealed(self.handle))
+
+    def seal(self):
+        """Pickle the session back into its buffer and free its memory.
+        Returns the pickle, as for Session.pickle()."""
+        length = lib.olm_session_handle_seal(self.handle)
+        return self.pickle_buffer.raw[:length]
+
+    def seal_if_idle(self):
+        """As seal(), but only if the session has been left alone for the
+        idle timeout. Returns None if it wasn't sealed."""
+        length = lib.olm_session_handle_seal_if_idle(self.handle)
+        if not length:
+            return None
+        return self.pickle_buffer.raw[:length]
+
+    def clear(self):
+        lib.olm_clear_session_handle(self.handle)
@@ -0,0 +1,64 @@
+from ._base import *
+
+OPERATIONS = (
+    "create_outbound_session",
+    "create_inbound_session",
+    "encrypt",
+    "decrypt",
+    "group_encrypt",
+    "group_decrypt",
+    "pickle",
+    "unpickle",
+)
+
+
+class Stats(Structure):
+    """A snapshot of the calling thread's counters from olm/stats.h. The
+    counters are only kept if the library was built with OLM_STATS; see
+    stats_enabled()."""
+    _fields_ = [
+        ("sha256_blocks", c_uint64),
+        ("hmac_sha256", c_uint64),
+        ("hkdf_sha256", c_uint64),
+        ("aes_blocks", c_uint64),
+        ("curve25519_keys", c_uint64),
+        ("curve25519_shared_secrets", c_uint64),
+        ("ed25519_signs", c_uint64),
+        ("ed25519_verifies", c_uint64),
+        ("megolm_rehashes", c_uint64),
+        ("chain_key_advances", c_uint64),
+        ("calls", c_uint64 * len(OPERATIONS)),
+        ("nanoseconds", c_uint64 * len(OPERATIONS)),
+    ]
+
+    def operations(self):
+        """The number of calls to, and the total time in nanoseconds spent
+        in, each timed operation, keyed by name"""
+        return dict(
+            (name, (self.calls[i], self.nanoseconds[i]))
+            for i, name in enumerate(OPERATIONS)
+        )
+
+
+lib.olm_stats_enabled.argtypes = []
+lib.olm_stats_enabled.restype = c_int
+
+lib.olm_stats_get.argtypes = [POINTER(Stats)]
+lib.olm_stats_get.restype = None
+
+lib.olm_stats_reset.argtypes = []
+lib.olm_stats_reset.restype = None
+
+
+def stats_enabled():
+    return bool(lib.olm_stats_enabled())
+
+
+def get_stats():
+    stats = Stats()
+    lib.olm_stats_get(byref(stats))
+    return stats
+
+
+def reset_stats():
+    lib.olm_stats_reset()
@@ -0,0 +1,25 @@
+#! /usr/bin/env python
+
+"""Builds olm._olm, the compiled part of the bindings, against the libolm in
+../build. Run "python setup.py build_ext --inplace" after "make" in the
+parent directory. The bindings work without it, more slowly."""
+
+import os.path
+
+from setuptools import setup, Extension
+
+root = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+
+setup(
+    name="olm",
+    version="2.1.0",
+    packages=["olm"],
+    ext_modules=[Extension(
+        "olm._olm",
+        sources=["olm/_olm.c"],
+        include_dirs=[os.path.join(root, "include")],
+        library_dirs=[os.path.join(root, "build")],
+        runtime_library_dirs=[os.path.join(root, "build")],
+        libraries=[":libolm.so.2"],
+    )],
+)
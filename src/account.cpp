@@ -19,32 +19,52 @@
 #include "olm/memory.hh"
 
 olm::Account::Account(
-) : next_one_time_key_id(0),
-    last_error(OlmErrorCode::OLM_SUCCESS) {
+    std::size_t max_one_time_keys, std::uint8_t * storage
+) : one_time_keys(storage, max_one_time_keys),
+    next_one_time_key_id(0),
+    last_error(OlmErrorCode::OLM_SUCCESS),
+    identity_keys_only(false),
+    dirty(false) {
+}
+
+
+std::size_t olm::Account::storage_length(std::size_t max_one_time_keys) {
+    return OneTimeKeys::storage_length(max_one_time_keys);
+}
+
+
+static olm::OneTimeKey * find_key(
+    olm::OneTimeKeys & one_time_keys,
+    _olm_curve25519_public_key const & public_key
+) {
+    std::size_t cursor = 0;
+    return one_time_keys.find(
+        olm::OneTimeKeyTraits::hash(public_key),
+        [&public_key](olm::OneTimeKey const & key) {
+            return olm::array_equal(
+                key.key.public_key.public_key, public_key.public_key
+            );
+        },
+        cursor
+    );
 }
 
 
 olm::OneTimeKey const * olm::Account::lookup_key(
     _olm_curve25519_public_key const & public_key
 ) {
-    for (olm::OneTimeKey const & key : one_time_keys) {
-        if (olm::array_equal(key.key.public_key.public_key, public_key.public_key)) {
-            return &key;
-        }
-    }
-    return 0;
+    return find_key(one_time_keys, public_key);
 }
 
 std::size_t olm::Account::remove_key(
     _olm_curve25519_public_key const & public_key
 ) {
-    OneTimeKey * i;
-    for (i = one_time_keys.begin(); i != one_time_keys.end(); ++i) {
-        if (olm::array_equal(i->key.public_key.public_key, public_key.public_key)) {
-            std::uint32_t id = i->id;
-            one_time_keys.erase(i);
-            return id;
-        }
+    OneTimeKey * key = find_key(one_time_keys, public_key);
+    if (key) {
+        std::uint32_t id = key->id;
+        one_time_keys.erase(key);
+        dirty = true;
+        return id;
     }
     return std::size_t(-1);
 }
@@ -64,6 +84,8 @@ std::size_t olm::Account::new_account(
     _olm_crypto_ed25519_generate_key(random, &identity_keys.ed25519_key);
     random += ED25519_RANDOM_LENGTH;
     _olm_crypto_curve25519_generate_key(random, &identity_keys.curve25519_key);
+    identity_keys_only = false;
+    dirty = true;
 
     return 0;
 }
@@ -157,6 +179,19 @@ std::size_t olm::Account::sign(
 }
 
 
+void olm::Account::sign_batch(
+    std::size_t count,
+    std::uint8_t const * const * messages,
+    std::size_t const * message_lengths,
+    std::uint8_t * signatures
+) {
+    _olm_crypto_ed25519_sign_batch(
+        &identity_keys.ed25519_key, count, messages, message_lengths,
+        signatures
+    );
+}
+
+
 std::size_t olm::Account::get_one_time_keys_json_length(
 ) {
     std::size_t length = 0;
@@ -181,21 +216,59 @@ std::size_t olm::Account::get_one_time_keys_json_length(
 }
 
 
+namespace {
+
+struct BufferWriter {
+    std::uint8_t * pos;
+};
+
+void write_to_buffer(
+    void * context, void const * data, std::size_t length
+) {
+    BufferWriter & writer = *static_cast<BufferWriter *>(context);
+    std::memcpy(writer.pos, data, length);
+    writer.pos += length;
+}
+
+}
+
+
 std::size_t olm::Account::get_one_time_keys_json(
     std::uint8_t * one_time_json, std::size_t one_time_json_length
 ) {
-    std::uint8_t * pos = one_time_json;
     if (one_time_json_length < get_one_time_keys_json_length()) {
         last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
         return std::size_t(-1);
     }
+    BufferWriter writer = {one_time_json};
+    return write_one_time_keys_json(write_to_buffer, &writer);
+}
+
+
+std::size_t olm::Account::write_one_time_keys_json(
+    OutputCallback write, void * context
+) {
+    if (identity_keys_only) {
+        last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+        return std::size_t(-1);
+    }
+    /* Each key is written as one piece: ,"<key id>":"<public key>" */
+    std::uint8_t entry[
+        2 + olm::encode_base64_length(sizeof(std::uint32_t))
+        + 3 + olm::encode_base64_length(CURVE25519_KEY_LENGTH) + 1
+    ];
+    std::size_t length = 0;
+    std::uint8_t * pos = entry;
     *(pos++) = '{';
     pos = write_string(pos, KEY_JSON_CURVE25519);
+    write(context, entry, pos - entry);
+    length += pos - entry;
     std::uint8_t sep = '{';
     for (auto const & key : one_time_keys) {
         if (key.published) {
             continue;
         }
+        pos = entry;
         *(pos++) = sep;
         *(pos++) = '\"';
         std::uint8_t key_id[olm::pickle_length(key.id)];
@@ -206,15 +279,57 @@ std::size_t olm::Account::get_one_time_keys_json(
             key.key.public_key.public_key, sizeof(key.key.public_key.public_key), pos
         );
         *(pos++) = '\"';
+        write(context, entry, pos - entry);
+        length += pos - entry;
         sep = ',';
     }
+    pos = entry;
     if (sep != ',') {
         /* The list was empty */
         *(pos++) = sep;
     }
     *(pos++) = '}';
     *(pos++) = '}';
-    return pos - one_time_json;
+    write(context, entry, pos - entry);
+    length += pos - entry;
+    return length;
+}
+
+
+std::size_t olm::Account::get_one_time_keys_binary_length(
+) {
+    std::size_t length = 0;
+    for (auto const & key : one_time_keys) {
+        if (!key.published) {
+            length += ONE_TIME_KEY_BINARY_LENGTH;
+        }
+    }
+    return length;
+}
+
+
+std::size_t olm::Account::get_one_time_keys_binary(
+    std::uint8_t * output, std::size_t output_length
+) {
+    if (identity_keys_only) {
+        last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+        return std::size_t(-1);
+    }
+    if (output_length < get_one_time_keys_binary_length()) {
+        last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    std::uint8_t * pos = output;
+    for (auto const & key : one_time_keys) {
+        if (key.published) {
+            continue;
+        }
+        pos = olm::pickle(pos, key.id);
+        pos = olm::pickle_bytes(
+            pos, key.key.public_key.public_key, CURVE25519_KEY_LENGTH
+        );
+    }
+    return pos - output;
 }
 
 
@@ -227,13 +342,16 @@ std::size_t olm::Account::mark_keys_as_published(
             count++;
         }
     }
+    if (count) {
+        dirty = true;
+    }
     return count;
 }
 
 
 std::size_t olm::Account::max_number_of_one_time_keys(
 ) {
-    return olm::MAX_ONE_TIME_KEYS;
+    return one_time_keys.capacity();
 }
 
 std::size_t olm::Account::generate_one_time_keys_random_length(
@@ -246,16 +364,32 @@ std::size_t olm::Account::generate_one_time_keys(
     std::size_t number_of_keys,
     std::uint8_t const * random, std::size_t random_length
 ) {
+    if (identity_keys_only) {
+        last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+        return std::size_t(-1);
+    }
     if (random_length < generate_one_time_keys_random_length(number_of_keys)) {
         last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
         return std::size_t(-1);
     }
-    for (unsigned i = 0; i < number_of_keys; ++i) {
-        OneTimeKey & key = *one_time_keys.insert(one_time_keys.begin());
-        key.id = ++next_one_time_key_id;
-        key.published = false;
-        _olm_crypto_curve25519_generate_key(random, &key.key);
-        random += CURVE25519_RANDOM_LENGTH;
+    /* generate the keys in batches so that they can share the work */
+    _olm_curve25519_key_pair key_pairs[32];
+    OneTimeKey key;
+    key.published = false;
+    for (std::size_t i = 0; i < number_of_keys; i += 32) {
+        std::size_t count = number_of_keys - i < 32 ? number_of_keys - i : 32;
+        _olm_crypto_curve25519_generate_keys(count, random, key_pairs);
+        for (std::size_t j = 0; j < count; ++j) {
+            key.id = ++next_one_time_key_id;
+            key.key = key_pairs[j];
+            one_time_keys.insert(key);
+        }
+        random += count * CURVE25519_RANDOM_LENGTH;
+    }
+    olm::unset(key_pairs);
+    olm::unset(key);
+    if (number_of_keys) {
+        dirty = true;
     }
     return number_of_keys;
 }
@@ -330,6 +464,10 @@ namespace {
 // pickle version 1 used only 32 bytes for the ed25519 private key.
 // Any keys thus used should be considered compromised.
 static const std::uint32_t ACCOUNT_PICKLE_VERSION = 2;
+// Version 3 adds the number of one time keys the account has room for after
+// the version. It is only written for accounts that don't have the default
+// room so that their pickles can still be read by older versions.
+static const std::uint32_t ACCOUNT_PICKLE_VERSION_WITH_LIMITS = 3;
 }
 
 
@@ -338,6 +476,11 @@ std::size_t olm::pickle_length(
 ) {
     std::size_t length = 0;
     length += olm::pickle_length(ACCOUNT_PICKLE_VERSION);
+    if (value.one_time_keys.capacity() != olm::MAX_ONE_TIME_KEYS) {
+        length += olm::pickle_length(
+            std::uint32_t(value.one_time_keys.capacity())
+        );
+    }
     length += olm::pickle_length(value.identity_keys);
     length += olm::pickle_length(value.one_time_keys);
     length += olm::pickle_length(value.next_one_time_key_id);
@@ -345,11 +488,33 @@ std::size_t olm::pickle_length(
 }
 
 
+std::size_t olm::max_pickle_length(
+    olm::Account const & value
+) {
+    std::size_t length = 0;
+    length += olm::pickle_length(ACCOUNT_PICKLE_VERSION);
+    length += olm::pickle_length(std::uint32_t(0));
+    length += olm::pickle_length(value.identity_keys);
+    length += olm::pickle_length(std::uint32_t(0));
+    length += value.one_time_keys.capacity()
+        * olm::pickle_length(olm::OneTimeKey());
+    length += olm::pickle_length(value.next_one_time_key_id);
+    return length;
+}
+
+
 std::uint8_t * olm::pickle(
     std::uint8_t * pos,
     olm::Account const & value
 ) {
-    pos = olm::pickle(pos, ACCOUNT_PICKLE_VERSION);
+    if (value.one_time_keys.capacity() == olm::MAX_ONE_TIME_KEYS) {
+        pos = olm::pickle(pos, ACCOUNT_PICKLE_VERSION);
+    } else {
+        pos = olm::pickle(pos, ACCOUNT_PICKLE_VERSION_WITH_LIMITS);
+        pos = olm::pickle(
+            pos, std::uint32_t(value.one_time_keys.capacity())
+        );
+    }
     pos = olm::pickle(pos, value.identity_keys);
     pos = olm::pickle(pos, value.one_time_keys);
     pos = olm::pickle(pos, value.next_one_time_key_id);
@@ -357,15 +522,30 @@ std::uint8_t * olm::pickle(
 }
 
 
-std::uint8_t const * olm::unpickle(
+/** Unpickle the version and, if it has one, the room for one time keys at
+ * the start of an account pickle. The room only has to fit if the one time
+ * keys are going to be unpickled too. */
+static std::uint8_t const * unpickle_version(
     std::uint8_t const * pos, std::uint8_t const * end,
-    olm::Account & value
+    olm::Account & value, bool with_one_time_keys
 ) {
     uint32_t pickle_version;
     pos = olm::unpickle(pos, end, pickle_version);
     switch (pickle_version) {
         case ACCOUNT_PICKLE_VERSION:
             break;
+        case ACCOUNT_PICKLE_VERSION_WITH_LIMITS: {
+            std::uint32_t max_one_time_keys;
+            pos = olm::unpickle(pos, end, max_one_time_keys);
+            /* The account keeps the room it was created with, but it must be
+             * able to hold all the keys the pickled account could. */
+            if (with_one_time_keys
+                    && max_one_time_keys > value.one_time_keys.capacity()) {
+                value.last_error = OlmErrorCode::OLM_ACCOUNT_TOO_SMALL;
+                return end;
+            }
+            break;
+        }
         case 1:
             value.last_error = OlmErrorCode::OLM_BAD_LEGACY_ACCOUNT_PICKLE;
             return end;
@@ -373,8 +553,42 @@ std::uint8_t const * olm::unpickle(
             value.last_error = OlmErrorCode::OLM_UNKNOWN_PICKLE_VERSION;
             return end;
     }
+    return pos;
+}
+
+
+std::uint8_t const * olm::unpickle(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::Account & value
+) {
+    pos = unpickle_version(pos, end, value, true);
     pos = olm::unpickle(pos, end, value.identity_keys);
     pos = olm::unpickle(pos, end, value.one_time_keys);
     pos = olm::unpickle(pos, end, value.next_one_time_key_id);
+    value.identity_keys_only = false;
+    value.dirty = false;
+    return pos;
+}
+
+
+std::size_t olm::identity_keys_pickle_length() {
+    /* the version, the room for one time keys, and the identity keys */
+    return 2 * sizeof(std::uint32_t)
+        + olm::pickle_length(olm::IdentityKeys());
+}
+
+
+std::uint8_t const * olm::unpickle_identity_keys(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::Account & value
+) {
+    pos = unpickle_version(pos, end, value, false);
+    pos = olm::unpickle(pos, end, value.identity_keys);
+    while (olm::OneTimeKey * key = value.one_time_keys.oldest()) {
+        value.one_time_keys.erase(key);
+    }
+    value.next_one_time_key_id = 0;
+    value.identity_keys_only = true;
+    value.dirty = false;
     return pos;
 }
@@ -0,0 +1,672 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/aes_ct.h"
+#include "olm/memory.h"
+
+#include <string.h>
+
+/* This follows the "ct64" implementation in BearSSL by Thomas Pornin. Four
+ * blocks are loaded into eight 64-bit words q[0..7] so that q[i] holds bit i
+ * of every byte of every block. The S-box is then the circuit of Boyar and
+ * Peralta, applied to all 64 bytes at once, and ShiftRows and MixColumns are
+ * shifts and rotations within the words.
+ *
+ * The round keys are kept "compressed", two words per round key, and
+ * expanded to eight words per round key for the duration of each call.
+ */
+
+#define CT_BLOCKS 4
+#define CT_EXPANDED_WORDS (8 * (AES256_ROUNDS + 1))
+
+static uint32_t ct_load_le32(uint8_t const * input) {
+    return (uint32_t) input[0]
+        | ((uint32_t) input[1] << 8)
+        | ((uint32_t) input[2] << 16)
+        | ((uint32_t) input[3] << 24);
+}
+
+static void ct_store_le32(uint32_t value, uint8_t * output) {
+    output[0] = (uint8_t) value;
+    output[1] = (uint8_t) (value >> 8);
+    output[2] = (uint8_t) (value >> 16);
+    output[3] = (uint8_t) (value >> 24);
+}
+
+/* The AES S-box, as the circuit of Boyar and Peralta: 113 logic operations
+ * on the bits of each byte. */
+static void ct_sbox(uint64_t * q) {
+    uint64_t x0, x1, x2, x3, x4, x5, x6, x7;
+    uint64_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+    uint64_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+    uint64_t y20, y21;
+    uint64_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+    uint64_t z10, z11, z12, z13, z14, z15, z16, z17;
+    uint64_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    uint64_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    uint64_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    uint64_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    uint64_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    uint64_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    uint64_t t60, t61, t62, t63, t64, t65, t66, t67;
+    uint64_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = q[7];
+    x1 = q[6];
+    x2 = q[5];
+    x3 = q[4];
+    x4 = q[3];
+    x5 = q[2];
+    x6 = q[1];
+    x7 = q[0];
+
+    /* top linear transformation */
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    /* non-linear section */
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    /* bottom linear transformation */
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+/* The inverse S-box is the S-box between two applications of the inverse of
+ * its affine transformation, which are linear and cheap. */
+static void ct_inverse_affine(uint64_t * q) {
+    uint64_t q0 = ~q[0], q1 = ~q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = ~q[5], q6 = ~q[6], q7 = q[7];
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+
+static void ct_inverse_sbox(uint64_t * q) {
+    ct_inverse_affine(q);
+    ct_sbox(q);
+    ct_inverse_affine(q);
+}
+
+#define CT_SWAPN(low_mask, high_mask, shift, x, y) do { \
+        uint64_t a = (x), b = (y); \
+        (x) = (a & (low_mask)) | ((b & (low_mask)) << (shift)); \
+        (y) = ((a & (high_mask)) >> (shift)) | (b & (high_mask)); \
+    } while (0)
+
+#define CT_SWAP2(x, y) CT_SWAPN( \
+        0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define CT_SWAP4(x, y) CT_SWAPN( \
+        0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define CT_SWAP8(x, y) CT_SWAPN( \
+        0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+/* Transpose the 8x8 bit matrices in q, moving between the interleaved
+ * layout and the bitsliced one. It is its own inverse. */
+static void ct_ortho(uint64_t * q) {
+    CT_SWAP2(q[0], q[1]);
+    CT_SWAP2(q[2], q[3]);
+    CT_SWAP2(q[4], q[5]);
+    CT_SWAP2(q[6], q[7]);
+
+    CT_SWAP4(q[0], q[2]);
+    CT_SWAP4(q[1], q[3]);
+    CT_SWAP4(q[4], q[6]);
+    CT_SWAP4(q[5], q[7]);
+
+    CT_SWAP8(q[0], q[4]);
+    CT_SWAP8(q[1], q[5]);
+    CT_SWAP8(q[2], q[6]);
+    CT_SWAP8(q[3], q[7]);
+}
+
+#undef CT_SWAPN
+#undef CT_SWAP2
+#undef CT_SWAP4
+#undef CT_SWAP8
+
+/* Spread the four 32-bit words of a block over two 64-bit words, so that
+ * ct_ortho can slice them */
+static void ct_interleave_in(
+    uint64_t * q0, uint64_t * q1, uint32_t const * w
+) {
+    uint64_t x0 = w[0], x1 = w[1], x2 = w[2], x3 = w[3];
+    x0 |= x0 << 16;
+    x1 |= x1 << 16;
+    x2 |= x2 << 16;
+    x3 |= x3 << 16;
+    x0 &= 0x0000FFFF0000FFFFULL;
+    x1 &= 0x0000FFFF0000FFFFULL;
+    x2 &= 0x0000FFFF0000FFFFULL;
+    x3 &= 0x0000FFFF0000FFFFULL;
+    x0 |= x0 << 8;
+    x1 |= x1 << 8;
+    x2 |= x2 << 8;
+    x3 |= x3 << 8;
+    x0 &= 0x00FF00FF00FF00FFULL;
+    x1 &= 0x00FF00FF00FF00FFULL;
+    x2 &= 0x00FF00FF00FF00FFULL;
+    x3 &= 0x00FF00FF00FF00FFULL;
+    *q0 = x0 | (x2 << 8);
+    *q1 = x1 | (x3 << 8);
+}
+
+static void ct_interleave_out(uint32_t * w, uint64_t q0, uint64_t q1) {
+    uint64_t x0 = q0 & 0x00FF00FF00FF00FFULL;
+    uint64_t x1 = q1 & 0x00FF00FF00FF00FFULL;
+    uint64_t x2 = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+    uint64_t x3 = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+    x0 |= x0 >> 8;
+    x1 |= x1 >> 8;
+    x2 |= x2 >> 8;
+    x3 |= x3 >> 8;
+    x0 &= 0x0000FFFF0000FFFFULL;
+    x1 &= 0x0000FFFF0000FFFFULL;
+    x2 &= 0x0000FFFF0000FFFFULL;
+    x3 &= 0x0000FFFF0000FFFFULL;
+    w[0] = (uint32_t) x0 | (uint32_t) (x0 >> 16);
+    w[1] = (uint32_t) x1 | (uint32_t) (x1 >> 16);
+    w[2] = (uint32_t) x2 | (uint32_t) (x2 >> 16);
+    w[3] = (uint32_t) x3 | (uint32_t) (x3 >> 16);
+}
+
+/* Load up to CT_BLOCKS blocks into the bitsliced state. Missing blocks are
+ * zero, and are thrown away again by ct_store_blocks. */
+static void ct_load_blocks(
+    uint64_t * q, uint8_t const * input, size_t blocks
+) {
+    uint32_t w[4 * CT_BLOCKS];
+    size_t i;
+    memset(w, 0, sizeof(w));
+    for (i = 0; i < 4 * blocks; ++i) {
+        w[i] = ct_load_le32(input + 4 * i);
+    }
+    for (i = 0; i < CT_BLOCKS; ++i) {
+        ct_interleave_in(&q[i], &q[i + 4], w + 4 * i);
+    }
+    ct_ortho(q);
+    _olm_unset(w, sizeof(w));
+}
+
+static void ct_store_blocks(
+    uint64_t * q, uint8_t * output, size_t blocks
+) {
+    uint32_t w[4 * CT_BLOCKS];
+    size_t i;
+    ct_ortho(q);
+    for (i = 0; i < CT_BLOCKS; ++i) {
+        ct_interleave_out(w + 4 * i, q[i], q[i + 4]);
+    }
+    for (i = 0; i < 4 * blocks; ++i) {
+        ct_store_le32(w[i], output + 4 * i);
+    }
+    _olm_unset(w, sizeof(w));
+}
+
+static void ct_add_round_key(uint64_t * q, uint64_t const * round_key) {
+    int i;
+    for (i = 0; i < 8; ++i) {
+        q[i] ^= round_key[i];
+    }
+}
+
+static void ct_shift_rows(uint64_t * q) {
+    int i;
+    for (i = 0; i < 8; ++i) {
+        uint64_t x = q[i];
+        q[i] = (x & 0x000000000000FFFFULL)
+            | ((x & 0x00000000FFF00000ULL) >> 4)
+            | ((x & 0x00000000000F0000ULL) << 12)
+            | ((x & 0x0000FF0000000000ULL) >> 8)
+            | ((x & 0x000000FF00000000ULL) << 8)
+            | ((x & 0xF000000000000000ULL) >> 12)
+            | ((x & 0x0FFF000000000000ULL) << 4);
+    }
+}
+
+static void ct_inverse_shift_rows(uint64_t * q) {
+    int i;
+    for (i = 0; i < 8; ++i) {
+        uint64_t x = q[i];
+        q[i] = (x & 0x000000000000FFFFULL)
+            | ((x & 0x000000000FFF0000ULL) << 4)
+            | ((x & 0x00000000F0000000ULL) >> 12)
+            | ((x & 0x000000FF00000000ULL) << 8)
+            | ((x & 0x0000FF0000000000ULL) >> 8)
+            | ((x & 0x000F000000000000ULL) << 12)
+            | ((x & 0xFFF0000000000000ULL) >> 4);
+    }
+}
+
+static uint64_t ct_rotr32(uint64_t x) {
+    return (x << 32) | (x >> 32);
+}
+
+static void ct_mix_columns(uint64_t * q) {
+    uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    uint64_t r0 = (q0 >> 16) | (q0 << 48);
+    uint64_t r1 = (q1 >> 16) | (q1 << 48);
+    uint64_t r2 = (q2 >> 16) | (q2 << 48);
+    uint64_t r3 = (q3 >> 16) | (q3 << 48);
+    uint64_t r4 = (q4 >> 16) | (q4 << 48);
+    uint64_t r5 = (q5 >> 16) | (q5 << 48);
+    uint64_t r6 = (q6 >> 16) | (q6 << 48);
+    uint64_t r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q7 ^ r7 ^ r0 ^ ct_rotr32(q0 ^ r0);
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ ct_rotr32(q1 ^ r1);
+    q[2] = q1 ^ r1 ^ r2 ^ ct_rotr32(q2 ^ r2);
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ ct_rotr32(q3 ^ r3);
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ ct_rotr32(q4 ^ r4);
+    q[5] = q4 ^ r4 ^ r5 ^ ct_rotr32(q5 ^ r5);
+    q[6] = q5 ^ r5 ^ r6 ^ ct_rotr32(q6 ^ r6);
+    q[7] = q6 ^ r6 ^ r7 ^ ct_rotr32(q7 ^ r7);
+}
+
+static void ct_inverse_mix_columns(uint64_t * q) {
+    uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    uint64_t r0 = (q0 >> 16) | (q0 << 48);
+    uint64_t r1 = (q1 >> 16) | (q1 << 48);
+    uint64_t r2 = (q2 >> 16) | (q2 << 48);
+    uint64_t r3 = (q3 >> 16) | (q3 << 48);
+    uint64_t r4 = (q4 >> 16) | (q4 << 48);
+    uint64_t r5 = (q5 >> 16) | (q5 << 48);
+    uint64_t r6 = (q6 >> 16) | (q6 << 48);
+    uint64_t r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7
+        ^ ct_rotr32(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+    q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7
+        ^ ct_rotr32(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+    q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7
+        ^ ct_rotr32(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+    q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5
+        ^ ct_rotr32(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+    q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7
+        ^ ct_rotr32(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+    q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7
+        ^ ct_rotr32(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+    q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7
+        ^ ct_rotr32(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+    q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7
+        ^ ct_rotr32(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+static void ct_encrypt(uint64_t const * expanded, uint64_t * q) {
+    int round;
+    ct_add_round_key(q, expanded);
+    for (round = 1; round < AES256_ROUNDS; ++round) {
+        ct_sbox(q);
+        ct_shift_rows(q);
+        ct_mix_columns(q);
+        ct_add_round_key(q, expanded + 8 * round);
+    }
+    ct_sbox(q);
+    ct_shift_rows(q);
+    ct_add_round_key(q, expanded + 8 * AES256_ROUNDS);
+}
+
+static void ct_decrypt(uint64_t const * expanded, uint64_t * q) {
+    int round;
+    ct_add_round_key(q, expanded + 8 * AES256_ROUNDS);
+    for (round = AES256_ROUNDS - 1; round > 0; --round) {
+        ct_inverse_shift_rows(q);
+        ct_inverse_sbox(q);
+        ct_add_round_key(q, expanded + 8 * round);
+        ct_inverse_mix_columns(q);
+    }
+    ct_inverse_shift_rows(q);
+    ct_inverse_sbox(q);
+    ct_add_round_key(q, expanded);
+}
+
+/* SubWord of the key expansion, with the S-box circuit */
+static uint32_t ct_sub_word(uint32_t x) {
+    uint64_t q[8];
+    memset(q, 0, sizeof(q));
+    q[0] = x;
+    ct_ortho(q);
+    ct_sbox(q);
+    ct_ortho(q);
+    x = (uint32_t) q[0];
+    _olm_unset(q, sizeof(q));
+    return x;
+}
+
+void _olm_aes_ct_expand_key(
+    uint8_t const * key,
+    uint64_t * round_keys
+) {
+    static const uint8_t rcon[] = {
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36
+    };
+    uint32_t words[4 * (AES256_ROUNDS + 1)];
+    uint32_t tmp;
+    int i, j, k;
+    int const nk = AES256_KEY_LENGTH / 4;
+
+    for (i = 0; i < nk; ++i) {
+        words[i] = ct_load_le32(key + 4 * i);
+    }
+    tmp = words[nk - 1];
+    for (i = nk, j = 0, k = 0; i < 4 * (AES256_ROUNDS + 1); ++i) {
+        if (j == 0) {
+            tmp = (tmp << 24) | (tmp >> 8);
+            tmp = ct_sub_word(tmp) ^ rcon[k];
+        } else if (j == 4) {
+            tmp = ct_sub_word(tmp);
+        }
+        tmp ^= words[i - nk];
+        words[i] = tmp;
+        if (++j == nk) {
+            j = 0;
+            ++k;
+        }
+    }
+
+    /* slice each round key as if it were a block, and keep the bits which
+     * belong to the first of the four blocks */
+    for (i = 0, j = 0; i < 4 * (AES256_ROUNDS + 1); i += 4, j += 2) {
+        uint64_t q[8];
+        ct_interleave_in(&q[0], &q[4], words + i);
+        q[1] = q[0];
+        q[2] = q[0];
+        q[3] = q[0];
+        q[5] = q[4];
+        q[6] = q[4];
+        q[7] = q[4];
+        ct_ortho(q);
+        round_keys[j] = (q[0] & 0x1111111111111111ULL)
+            | (q[1] & 0x2222222222222222ULL)
+            | (q[2] & 0x4444444444444444ULL)
+            | (q[3] & 0x8888888888888888ULL);
+        round_keys[j + 1] = (q[4] & 0x1111111111111111ULL)
+            | (q[5] & 0x2222222222222222ULL)
+            | (q[6] & 0x4444444444444444ULL)
+            | (q[7] & 0x8888888888888888ULL);
+        _olm_unset(q, sizeof(q));
+    }
+    _olm_unset(words, sizeof(words));
+    _olm_unset(&tmp, sizeof(tmp));
+}
+
+/* Copy each compressed round key to all four blocks */
+static void ct_expand_round_keys(
+    uint64_t const * round_keys, uint64_t * expanded
+) {
+    int i;
+    for (i = 0; i < AES256_CT_ROUND_KEYS_WORDS; ++i) {
+        uint64_t x0 = round_keys[i] & 0x1111111111111111ULL;
+        uint64_t x1 = (round_keys[i] & 0x2222222222222222ULL) >> 1;
+        uint64_t x2 = (round_keys[i] & 0x4444444444444444ULL) >> 2;
+        uint64_t x3 = (round_keys[i] & 0x8888888888888888ULL) >> 3;
+        expanded[4 * i] = (x0 << 4) - x0;
+        expanded[4 * i + 1] = (x1 << 4) - x1;
+        expanded[4 * i + 2] = (x2 << 4) - x2;
+        expanded[4 * i + 3] = (x3 << 4) - x3;
+    }
+}
+
+void _olm_aes_ct_encrypt_blocks(
+    uint64_t const * round_keys,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    uint64_t expanded[CT_EXPANDED_WORDS];
+    uint64_t q[8];
+    ct_expand_round_keys(round_keys, expanded);
+    while (blocks) {
+        size_t count = blocks < CT_BLOCKS ? blocks : CT_BLOCKS;
+        ct_load_blocks(q, input, count);
+        ct_encrypt(expanded, q);
+        ct_store_blocks(q, output, count);
+        blocks -= count;
+        input += 16 * count;
+        output += 16 * count;
+    }
+    _olm_unset(q, sizeof(q));
+    _olm_unset(expanded, sizeof(expanded));
+}
+
+void _olm_aes_ct_encrypt_cbc(
+    uint64_t const * round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    uint64_t expanded[CT_EXPANDED_WORDS];
+    uint64_t q[8];
+    uint8_t chain[16];
+    int i;
+    ct_expand_round_keys(round_keys, expanded);
+    memcpy(chain, iv, sizeof(chain));
+    for (; blocks; --blocks, input += 16, output += 16) {
+        for (i = 0; i < 16; ++i) {
+            chain[i] ^= input[i];
+        }
+        ct_load_blocks(q, chain, 1);
+        ct_encrypt(expanded, q);
+        ct_store_blocks(q, chain, 1);
+        memcpy(output, chain, sizeof(chain));
+    }
+    memcpy(iv, chain, sizeof(chain));
+    _olm_unset(chain, sizeof(chain));
+    _olm_unset(q, sizeof(q));
+    _olm_unset(expanded, sizeof(expanded));
+}
+
+void _olm_aes_ct_decrypt_cbc(
+    uint64_t const * round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    uint64_t expanded[CT_EXPANDED_WORDS];
+    uint64_t q[8];
+    /* the previous ciphertext block followed by this batch's, kept aside
+     * because the output may overwrite the input */
+    uint8_t ciphertext[16 * (CT_BLOCKS + 1)];
+    size_t i;
+    ct_expand_round_keys(round_keys, expanded);
+    memcpy(ciphertext, iv, 16);
+    while (blocks) {
+        size_t count = blocks < CT_BLOCKS ? blocks : CT_BLOCKS;
+        memcpy(ciphertext + 16, input, 16 * count);
+        ct_load_blocks(q, input, count);
+        ct_decrypt(expanded, q);
+        ct_store_blocks(q, output, count);
+        for (i = 0; i < 16 * count; ++i) {
+            output[i] ^= ciphertext[i];
+        }
+        memcpy(ciphertext, ciphertext + 16 * count, 16);
+        blocks -= count;
+        input += 16 * count;
+        output += 16 * count;
+    }
+    memcpy(iv, ciphertext, 16);
+    _olm_unset(q, sizeof(q));
+    _olm_unset(expanded, sizeof(expanded));
+}
+
+void _olm_aes_ct_encrypt_ctr(
+    uint64_t const * round_keys,
+    uint8_t * counter,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    uint64_t expanded[CT_EXPANDED_WORDS];
+    uint64_t q[8];
+    uint8_t stream[16 * CT_BLOCKS];
+    uint64_t count_value = 0;
+    size_t i;
+    for (i = 8; i < 16; ++i) {
+        count_value = (count_value << 8) | counter[i];
+    }
+    ct_expand_round_keys(round_keys, expanded);
+    while (blocks) {
+        size_t count = blocks < CT_BLOCKS ? blocks : CT_BLOCKS;
+        for (i = 0; i < count; ++i, ++count_value) {
+            uint8_t * block = stream + 16 * i;
+            int j;
+            memcpy(block, counter, 8);
+            for (j = 15; j >= 8; --j) {
+                block[j] = (uint8_t) (count_value >> (8 * (15 - j)));
+            }
+        }
+        ct_load_blocks(q, stream, count);
+        ct_encrypt(expanded, q);
+        ct_store_blocks(q, stream, count);
+        for (i = 0; i < 16 * count; ++i) {
+            output[i] = input[i] ^ stream[i];
+        }
+        blocks -= count;
+        input += 16 * count;
+        output += 16 * count;
+    }
+    for (i = 15; i >= 8; --i, count_value >>= 8) {
+        counter[i] = (uint8_t) count_value;
+    }
+    _olm_unset(stream, sizeof(stream));
+    _olm_unset(q, sizeof(q));
+    _olm_unset(expanded, sizeof(expanded));
+}
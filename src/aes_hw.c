@@ -0,0 +1,631 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/aes_hw.h"
+#include "olm/cpu.h"
+#include "olm/memory.h"
+
+#include "crypto-algorithms/aes.h"
+
+#include <string.h>
+
+/* The key expansion isn't performance critical (it is done once per message)
+ * so we share the portable one and only use the CPU for the rounds. That
+ * leaves the inverse round keys, which need InvMixColumns applying to the
+ * middle rounds, to the architecture specific code.
+ */
+static void expand_encrypt_key(
+    uint8_t const * key, uint8_t * round_keys
+) {
+    WORD words[4 * (AES256_ROUNDS + 1)];
+    int i;
+    aes_key_setup(key, words, 256);
+    for (i = 0; i < 4 * (AES256_ROUNDS + 1); ++i) {
+        round_keys[4 * i]     = words[i] >> 24;
+        round_keys[4 * i + 1] = words[i] >> 16;
+        round_keys[4 * i + 2] = words[i] >> 8;
+        round_keys[4 * i + 3] = words[i];
+    }
+    _olm_unset(words, sizeof(words));
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+
+/* The counter of a counter mode block is its last 8 bytes, big-endian */
+static uint64_t load_counter(uint8_t const * counter) {
+    uint64_t value = 0;
+    int i;
+    for (i = 8; i < 16; ++i) {
+        value = (value << 8) | counter[i];
+    }
+    return value;
+}
+
+static void store_counter(uint64_t value, uint8_t * counter) {
+    int i;
+    for (i = 15; i >= 8; --i, value >>= 8) {
+        counter[i] = (uint8_t) value;
+    }
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <wmmintrin.h>
+
+#define OLM_AES_HW 1
+#define TARGET_AES __attribute__((target("aes,sse2")))
+
+TARGET_AES static void invert_key(
+    uint8_t const * encrypt_round_keys, uint8_t * decrypt_round_keys
+) {
+    int i;
+    __m128i const * ek = (__m128i const *) encrypt_round_keys;
+    __m128i * dk = (__m128i *) decrypt_round_keys;
+    _mm_storeu_si128(&dk[0], _mm_loadu_si128(&ek[AES256_ROUNDS]));
+    for (i = 1; i < AES256_ROUNDS; ++i) {
+        _mm_storeu_si128(
+            &dk[i], _mm_aesimc_si128(_mm_loadu_si128(&ek[AES256_ROUNDS - i]))
+        );
+    }
+    _mm_storeu_si128(&dk[AES256_ROUNDS], _mm_loadu_si128(&ek[0]));
+}
+
+TARGET_AES void _olm_aes_hw_encrypt_cbc(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    __m128i const * ek = (__m128i const *) encrypt_round_keys;
+    __m128i rk[AES256_ROUNDS + 1];
+    __m128i state = _mm_loadu_si128((__m128i const *) iv);
+    int r;
+    for (r = 0; r <= AES256_ROUNDS; ++r) {
+        rk[r] = _mm_loadu_si128(&ek[r]);
+    }
+    for (; blocks; --blocks, input += 16, output += 16) {
+        state = _mm_xor_si128(state, _mm_loadu_si128((__m128i const *) input));
+        state = _mm_xor_si128(state, rk[0]);
+        for (r = 1; r < AES256_ROUNDS; ++r) {
+            state = _mm_aesenc_si128(state, rk[r]);
+        }
+        state = _mm_aesenclast_si128(state, rk[AES256_ROUNDS]);
+        _mm_storeu_si128((__m128i *) output, state);
+    }
+    _mm_storeu_si128((__m128i *) iv, state);
+    _olm_unset(rk, sizeof(rk));
+}
+
+/* CBC decryption has no dependency between blocks, so we keep
+ * PARALLEL_BLOCKS blocks in flight at once to hide the latency of the
+ * AESDEC instruction. */
+#define PARALLEL_BLOCKS 8
+
+TARGET_AES void _olm_aes_hw_decrypt_cbc(
+    uint8_t const * decrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    __m128i const * dk = (__m128i const *) decrypt_round_keys;
+    __m128i rk[AES256_ROUNDS + 1];
+    __m128i previous = _mm_loadu_si128((__m128i const *) iv);
+    int r, j;
+    for (r = 0; r <= AES256_ROUNDS; ++r) {
+        rk[r] = _mm_loadu_si128(&dk[r]);
+    }
+    for (; blocks >= PARALLEL_BLOCKS; blocks -= PARALLEL_BLOCKS,
+            input += 16 * PARALLEL_BLOCKS, output += 16 * PARALLEL_BLOCKS) {
+        __m128i ciphertext[PARALLEL_BLOCKS];
+        __m128i state[PARALLEL_BLOCKS];
+        for (j = 0; j < PARALLEL_BLOCKS; ++j) {
+            ciphertext[j] = _mm_loadu_si128((__m128i const *) input + j);
+            state[j] = _mm_xor_si128(ciphertext[j], rk[0]);
+        }
+        for (r = 1; r < AES256_ROUNDS; ++r) {
+            for (j = 0; j < PARALLEL_BLOCKS; ++j) {
+                state[j] = _mm_aesdec_si128(state[j], rk[r]);
+            }
+        }
+        for (j = 0; j < PARALLEL_BLOCKS; ++j) {
+            state[j] = _mm_aesdeclast_si128(state[j], rk[AES256_ROUNDS]);
+        }
+        _mm_storeu_si128((__m128i *) output, _mm_xor_si128(state[0], previous));
+        for (j = 1; j < PARALLEL_BLOCKS; ++j) {
+            _mm_storeu_si128(
+                (__m128i *) output + j, _mm_xor_si128(state[j], ciphertext[j - 1])
+            );
+        }
+        previous = ciphertext[PARALLEL_BLOCKS - 1];
+        _olm_unset(state, sizeof(state));
+    }
+    for (; blocks; --blocks, input += 16, output += 16) {
+        __m128i ciphertext = _mm_loadu_si128((__m128i const *) input);
+        __m128i state = _mm_xor_si128(ciphertext, rk[0]);
+        for (r = 1; r < AES256_ROUNDS; ++r) {
+            state = _mm_aesdec_si128(state, rk[r]);
+        }
+        state = _mm_aesdeclast_si128(state, rk[AES256_ROUNDS]);
+        _mm_storeu_si128((__m128i *) output, _mm_xor_si128(state, previous));
+        previous = ciphertext;
+    }
+    _mm_storeu_si128((__m128i *) iv, previous);
+    _olm_unset(rk, sizeof(rk));
+}
+
+/* The counter blocks are independent too. Each is the first 8 bytes of the
+ * counter block as they are, and the count byte swapped into the last 8. */
+TARGET_AES void _olm_aes_hw_encrypt_ctr(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * counter,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    __m128i const * ek = (__m128i const *) encrypt_round_keys;
+    __m128i rk[AES256_ROUNDS + 1];
+    uint64_t nonce;
+    uint64_t count = load_counter(counter);
+    int r, j;
+    memcpy(&nonce, counter, 8);
+    for (r = 0; r <= AES256_ROUNDS; ++r) {
+        rk[r] = _mm_loadu_si128(&ek[r]);
+    }
+    while (blocks) {
+        int n = blocks < PARALLEL_BLOCKS ? (int) blocks : PARALLEL_BLOCKS;
+        __m128i stream[PARALLEL_BLOCKS];
+        for (j = 0; j < n; ++j, ++count) {
+            stream[j] = _mm_xor_si128(_mm_set_epi64x(
+                (long long) __builtin_bswap64(count), (long long) nonce
+            ), rk[0]);
+        }
+        for (r = 1; r < AES256_ROUNDS; ++r) {
+            for (j = 0; j < n; ++j) {
+                stream[j] = _mm_aesenc_si128(stream[j], rk[r]);
+            }
+        }
+        for (j = 0; j < n; ++j) {
+            stream[j] = _mm_aesenclast_si128(stream[j], rk[AES256_ROUNDS]);
+            _mm_storeu_si128((__m128i *) output + j, _mm_xor_si128(
+                _mm_loadu_si128((__m128i const *) input + j), stream[j]
+            ));
+        }
+        _olm_unset(stream, sizeof(stream));
+        blocks -= n;
+        input += 16 * n;
+        output += 16 * n;
+    }
+    store_counter(count, counter);
+    _olm_unset(rk, sizeof(rk));
+}
+
+/* GHASH is defined on bit-reflected blocks. We byte swap each block on the
+ * way in and out, and multiply as in Intel's white paper "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing the GCM Mode",
+ * whose reduction takes care of the reflection within each byte.
+ */
+
+#include <tmmintrin.h>
+
+#define OLM_AES_GCM_HW 1
+#define TARGET_GCM __attribute__((target("aes,pclmul,ssse3,sse2")))
+
+TARGET_GCM static __m128i byte_swap(__m128i x) {
+    return _mm_shuffle_epi8(
+        x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+    );
+}
+
+/** multiply two byte swapped blocks in GF(2^128) */
+TARGET_GCM static __m128i gf128_mul(__m128i a, __m128i b) {
+    __m128i low = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i middle = _mm_xor_si128(
+        _mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01)
+    );
+    __m128i high = _mm_clmulepi64_si128(a, b, 0x11);
+    __m128i carry_low, carry_high, carry_middle, fold, fold_high;
+
+    low = _mm_xor_si128(low, _mm_slli_si128(middle, 8));
+    high = _mm_xor_si128(high, _mm_srli_si128(middle, 8));
+
+    /* shift the 256 bit product left by one, for the reflection */
+    carry_low = _mm_srli_epi32(low, 31);
+    carry_high = _mm_srli_epi32(high, 31);
+    low = _mm_slli_epi32(low, 1);
+    high = _mm_slli_epi32(high, 1);
+    carry_middle = _mm_srli_si128(carry_low, 12);
+    carry_high = _mm_slli_si128(carry_high, 4);
+    carry_low = _mm_slli_si128(carry_low, 4);
+    low = _mm_or_si128(low, carry_low);
+    high = _mm_or_si128(high, carry_high);
+    high = _mm_or_si128(high, carry_middle);
+
+    /* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+    fold = _mm_xor_si128(
+        _mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)),
+        _mm_slli_epi32(low, 25)
+    );
+    fold_high = _mm_srli_si128(fold, 4);
+    low = _mm_xor_si128(low, _mm_slli_si128(fold, 12));
+    fold = _mm_xor_si128(
+        _mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)),
+        _mm_srli_epi32(low, 7)
+    );
+    fold = _mm_xor_si128(fold, fold_high);
+    low = _mm_xor_si128(low, fold);
+    return _mm_xor_si128(high, low);
+}
+
+TARGET_GCM void _olm_aes_hw_ghash(
+    uint8_t const * hash_key,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks
+) {
+    __m128i h = byte_swap(_mm_loadu_si128((__m128i const *) hash_key));
+    __m128i x = byte_swap(_mm_loadu_si128((__m128i const *) state));
+    for (; blocks; --blocks, input += 16) {
+        __m128i block = _mm_loadu_si128((__m128i const *) input);
+        x = gf128_mul(_mm_xor_si128(x, byte_swap(block)), h);
+    }
+    _mm_storeu_si128((__m128i *) state, byte_swap(x));
+}
+
+/* The counter is kept byte swapped, so that the 32 bit big-endian counter at
+ * the end of the block is the first 32 bit lane, and can be incremented with
+ * a plain add, which wraps round just as GCM's does. The AES of each batch of
+ * PARALLEL_BLOCKS counters has no dependency between the blocks, so they are
+ * kept in flight at once; the GHASH of their ciphertext follows. */
+TARGET_GCM static void gcm_crypt(
+    uint8_t const * encrypt_round_keys,
+    uint8_t const * hash_key,
+    uint8_t * counter,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output,
+    int decrypt
+) {
+    __m128i const * ek = (__m128i const *) encrypt_round_keys;
+    __m128i rk[AES256_ROUNDS + 1];
+    __m128i h = byte_swap(_mm_loadu_si128((__m128i const *) hash_key));
+    __m128i x = byte_swap(_mm_loadu_si128((__m128i const *) state));
+    __m128i ctr = byte_swap(_mm_loadu_si128((__m128i const *) counter));
+    __m128i const one = _mm_set_epi32(0, 0, 0, 1);
+    int r, j;
+    for (r = 0; r <= AES256_ROUNDS; ++r) {
+        rk[r] = _mm_loadu_si128(&ek[r]);
+    }
+    while (blocks) {
+        size_t count = blocks < PARALLEL_BLOCKS ? blocks : PARALLEL_BLOCKS;
+        __m128i stream[PARALLEL_BLOCKS];
+        __m128i text[PARALLEL_BLOCKS];
+        for (j = 0; j < (int) count; ++j) {
+            stream[j] = _mm_xor_si128(byte_swap(ctr), rk[0]);
+            ctr = _mm_add_epi32(ctr, one);
+        }
+        for (r = 1; r < AES256_ROUNDS; ++r) {
+            for (j = 0; j < (int) count; ++j) {
+                stream[j] = _mm_aesenc_si128(stream[j], rk[r]);
+            }
+        }
+        for (j = 0; j < (int) count; ++j) {
+            stream[j] = _mm_aesenclast_si128(stream[j], rk[AES256_ROUNDS]);
+            text[j] = _mm_loadu_si128((__m128i const *) input + j);
+        }
+        for (j = 0; j < (int) count; ++j) {
+            __m128i result = _mm_xor_si128(text[j], stream[j]);
+            __m128i ciphertext = decrypt ? text[j] : result;
+            _mm_storeu_si128((__m128i *) output + j, result);
+            x = gf128_mul(_mm_xor_si128(x, byte_swap(ciphertext)), h);
+        }
+        _olm_unset(stream, sizeof(stream));
+        _olm_unset(text, sizeof(text));
+        blocks -= count;
+        input += 16 * count;
+        output += 16 * count;
+    }
+    _mm_storeu_si128((__m128i *) counter, byte_swap(ctr));
+    _mm_storeu_si128((__m128i *) state, byte_swap(x));
+    _olm_unset(rk, sizeof(rk));
+}
+
+void _olm_aes_hw_gcm_encrypt(
+    uint8_t const * encrypt_round_keys,
+    uint8_t const * hash_key,
+    uint8_t * counter,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    gcm_crypt(
+        encrypt_round_keys, hash_key, counter, state, input, blocks, output, 0
+    );
+}
+
+void _olm_aes_hw_gcm_decrypt(
+    uint8_t const * encrypt_round_keys,
+    uint8_t const * hash_key,
+    uint8_t * counter,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    gcm_crypt(
+        encrypt_round_keys, hash_key, counter, state, input, blocks, output, 1
+    );
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+#define OLM_AES_HW 1
+#if defined(__clang__)
+#define TARGET_AES __attribute__((target("aes")))
+#else
+#define TARGET_AES __attribute__((target("+crypto")))
+#endif
+
+TARGET_AES static void invert_key(
+    uint8_t const * encrypt_round_keys, uint8_t * decrypt_round_keys
+) {
+    int i;
+    vst1q_u8(decrypt_round_keys, vld1q_u8(encrypt_round_keys + 16 * AES256_ROUNDS));
+    for (i = 1; i < AES256_ROUNDS; ++i) {
+        vst1q_u8(
+            decrypt_round_keys + 16 * i,
+            vaesimcq_u8(vld1q_u8(encrypt_round_keys + 16 * (AES256_ROUNDS - i)))
+        );
+    }
+    vst1q_u8(decrypt_round_keys + 16 * AES256_ROUNDS, vld1q_u8(encrypt_round_keys));
+}
+
+/* AESE/AESD do the AddRoundKey before SubBytes/ShiftRows, so compared to the
+ * x86 instructions the round keys are shifted along by one and the last key
+ * is applied with a plain XOR.
+ */
+TARGET_AES void _olm_aes_hw_encrypt_cbc(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    uint8x16_t rk[AES256_ROUNDS + 1];
+    uint8x16_t state = vld1q_u8(iv);
+    int r;
+    for (r = 0; r <= AES256_ROUNDS; ++r) {
+        rk[r] = vld1q_u8(encrypt_round_keys + 16 * r);
+    }
+    for (; blocks; --blocks, input += 16, output += 16) {
+        state = veorq_u8(state, vld1q_u8(input));
+        for (r = 0; r < AES256_ROUNDS - 1; ++r) {
+            state = vaesmcq_u8(vaeseq_u8(state, rk[r]));
+        }
+        state = vaeseq_u8(state, rk[AES256_ROUNDS - 1]);
+        state = veorq_u8(state, rk[AES256_ROUNDS]);
+        vst1q_u8(output, state);
+    }
+    vst1q_u8(iv, state);
+    _olm_unset(rk, sizeof(rk));
+}
+
+/* The ARM cores we care about have two AES pipes with a latency of a few
+ * cycles, so four blocks in flight is enough to keep them busy. */
+#define PARALLEL_BLOCKS 4
+
+TARGET_AES void _olm_aes_hw_decrypt_cbc(
+    uint8_t const * decrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    uint8x16_t rk[AES256_ROUNDS + 1];
+    uint8x16_t previous = vld1q_u8(iv);
+    int r, j;
+    for (r = 0; r <= AES256_ROUNDS; ++r) {
+        rk[r] = vld1q_u8(decrypt_round_keys + 16 * r);
+    }
+    for (; blocks >= PARALLEL_BLOCKS; blocks -= PARALLEL_BLOCKS,
+            input += 16 * PARALLEL_BLOCKS, output += 16 * PARALLEL_BLOCKS) {
+        uint8x16_t ciphertext[PARALLEL_BLOCKS];
+        uint8x16_t state[PARALLEL_BLOCKS];
+        for (j = 0; j < PARALLEL_BLOCKS; ++j) {
+            ciphertext[j] = vld1q_u8(input + 16 * j);
+            state[j] = ciphertext[j];
+        }
+        for (r = 0; r < AES256_ROUNDS - 1; ++r) {
+            for (j = 0; j < PARALLEL_BLOCKS; ++j) {
+                state[j] = vaesimcq_u8(vaesdq_u8(state[j], rk[r]));
+            }
+        }
+        for (j = 0; j < PARALLEL_BLOCKS; ++j) {
+            state[j] = vaesdq_u8(state[j], rk[AES256_ROUNDS - 1]);
+            state[j] = veorq_u8(state[j], rk[AES256_ROUNDS]);
+        }
+        vst1q_u8(output, veorq_u8(state[0], previous));
+        for (j = 1; j < PARALLEL_BLOCKS; ++j) {
+            vst1q_u8(output + 16 * j, veorq_u8(state[j], ciphertext[j - 1]));
+        }
+        previous = ciphertext[PARALLEL_BLOCKS - 1];
+        _olm_unset(state, sizeof(state));
+    }
+    for (; blocks; --blocks, input += 16, output += 16) {
+        uint8x16_t ciphertext = vld1q_u8(input);
+        uint8x16_t state = ciphertext;
+        for (r = 0; r < AES256_ROUNDS - 1; ++r) {
+            state = vaesimcq_u8(vaesdq_u8(state, rk[r]));
+        }
+        state = vaesdq_u8(state, rk[AES256_ROUNDS - 1]);
+        state = veorq_u8(state, rk[AES256_ROUNDS]);
+        vst1q_u8(output, veorq_u8(state, previous));
+        previous = ciphertext;
+    }
+    vst1q_u8(iv, previous);
+    _olm_unset(rk, sizeof(rk));
+}
+
+/* As on x86, the first 8 bytes of the counter block as they are and the
+ * count byte swapped into the last 8. */
+TARGET_AES void _olm_aes_hw_encrypt_ctr(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * counter,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+    uint8x16_t rk[AES256_ROUNDS + 1];
+    uint64_t nonce;
+    uint64_t count = load_counter(counter);
+    int r, j;
+    memcpy(&nonce, counter, 8);
+    for (r = 0; r <= AES256_ROUNDS; ++r) {
+        rk[r] = vld1q_u8(encrypt_round_keys + 16 * r);
+    }
+    while (blocks) {
+        int n = blocks < PARALLEL_BLOCKS ? (int) blocks : PARALLEL_BLOCKS;
+        uint8x16_t stream[PARALLEL_BLOCKS];
+        for (j = 0; j < n; ++j, ++count) {
+            stream[j] = vcombine_u8(
+                vcreate_u8(nonce), vcreate_u8(__builtin_bswap64(count))
+            );
+        }
+        for (r = 0; r < AES256_ROUNDS - 1; ++r) {
+            for (j = 0; j < n; ++j) {
+                stream[j] = vaesmcq_u8(vaeseq_u8(stream[j], rk[r]));
+            }
+        }
+        for (j = 0; j < n; ++j) {
+            stream[j] = vaeseq_u8(stream[j], rk[AES256_ROUNDS - 1]);
+            stream[j] = veorq_u8(stream[j], rk[AES256_ROUNDS]);
+            vst1q_u8(output + 16 * j, veorq_u8(
+                vld1q_u8(input + 16 * j), stream[j]
+            ));
+        }
+        _olm_unset(stream, sizeof(stream));
+        blocks -= n;
+        input += 16 * n;
+        output += 16 * n;
+    }
+    store_counter(count, counter);
+    _olm_unset(rk, sizeof(rk));
+}
+
+#endif
+
+#ifdef OLM_AES_HW
+
+int _olm_aes_hw_available(void) {
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_AES) != 0;
+}
+
+void _olm_aes_hw_expand_key(
+    uint8_t const * key,
+    uint8_t * encrypt_round_keys,
+    uint8_t * decrypt_round_keys
+) {
+    expand_encrypt_key(key, encrypt_round_keys);
+    if (decrypt_round_keys) {
+        invert_key(encrypt_round_keys, decrypt_round_keys);
+    }
+}
+
+#else
+
+/* No AES instructions on this architecture (or we don't know how to use
+ * them): the stubs are never called as _olm_aes_hw_available is false. */
+
+int _olm_aes_hw_available(void) {
+    return 0;
+}
+
+void _olm_aes_hw_expand_key(
+    uint8_t const * key,
+    uint8_t * encrypt_round_keys,
+    uint8_t * decrypt_round_keys
+) {
+    expand_encrypt_key(key, encrypt_round_keys);
+}
+
+void _olm_aes_hw_encrypt_cbc(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+}
+
+void _olm_aes_hw_decrypt_cbc(
+    uint8_t const * decrypt_round_keys,
+    uint8_t * iv,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+}
+
+void _olm_aes_hw_encrypt_ctr(
+    uint8_t const * encrypt_round_keys,
+    uint8_t * counter,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+}
+
+#endif
+
+#ifdef OLM_AES_GCM_HW
+
+int _olm_aes_hw_gcm_available(void) {
+    uint32_t const needed = OLM_CPU_FEATURE_AES | OLM_CPU_FEATURE_CLMUL
+        | OLM_CPU_FEATURE_SIMD128;
+    return (_olm_cpu_features() & needed) == needed;
+}
+
+#else
+
+/* No GCM kernels for this architecture yet (PMULL on ARMv8 would do): the
+ * stubs are never called as _olm_aes_hw_gcm_available is false, and GCM
+ * uses the portable GHASH with whichever AES kernels are available. */
+
+int _olm_aes_hw_gcm_available(void) {
+    return 0;
+}
+
+void _olm_aes_hw_ghash(
+    uint8_t const * hash_key,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks
+) {
+}
+
+void _olm_aes_hw_gcm_encrypt(
+    uint8_t const * encrypt_round_keys,
+    uint8_t const * hash_key,
+    uint8_t * counter,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+}
+
+void _olm_aes_hw_gcm_decrypt(
+    uint8_t const * encrypt_round_keys,
+    uint8_t const * hash_key,
+    uint8_t * counter,
+    uint8_t * state,
+    uint8_t const * input, size_t blocks,
+    uint8_t * output
+) {
+}
+
+#endif
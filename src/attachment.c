@@ -0,0 +1,253 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/attachment.h"
+
+#include <string.h>
+
+#include "olm/base64.h"
+#include "olm/crypto.h"
+#include "olm/error.h"
+#include "olm/memory.h"
+
+/* the unpadded base64 of a SHA-256 */
+#define ATTACHMENT_HASH_LENGTH 43
+
+/* Each piece is hashed and crypted a chunk at a time, so that the second
+ * pass over a chunk finds it still in the cache. */
+#define ATTACHMENT_CHUNK_LENGTH 4096
+
+enum OlmAttachmentState {
+    ATTACHMENT_NOT_STARTED = 0,
+    ATTACHMENT_ENCRYPTING = 1,
+    ATTACHMENT_DECRYPTING = 2,
+};
+
+struct OlmAttachment {
+    struct _olm_aes256_key_schedule schedule;
+
+    /** the counter block for the next block of key stream */
+    uint8_t counter[AES256_IV_LENGTH];
+
+    /** the key stream for the block that the last piece ended in, of which
+     * the first stream_used bytes have been used */
+    uint8_t stream[AES256_IV_LENGTH];
+    size_t stream_used;
+
+    /** the SHA-256 of the ciphertext so far */
+    struct _olm_sha256_context hash;
+
+    enum OlmAttachmentState state;
+    enum OlmErrorCode last_error;
+};
+
+
+size_t olm_attachment_size(void) {
+    return sizeof(OlmAttachment);
+}
+
+OlmAttachment * olm_attachment(
+    void *memory
+) {
+    OlmAttachment *attachment = memory;
+    olm_clear_attachment(attachment);
+    return attachment;
+}
+
+const char *olm_attachment_last_error(
+    const OlmAttachment *attachment
+) {
+    return _olm_error_to_string(attachment->last_error);
+}
+
+size_t olm_clear_attachment(
+    OlmAttachment *attachment
+) {
+    _olm_unset(attachment, sizeof(OlmAttachment));
+    return sizeof(OlmAttachment);
+}
+
+size_t olm_attachment_key_length(void) {
+    return AES256_KEY_LENGTH;
+}
+
+size_t olm_attachment_iv_length(void) {
+    return AES256_IV_LENGTH;
+}
+
+size_t olm_attachment_hash_length(void) {
+    return ATTACHMENT_HASH_LENGTH;
+}
+
+static size_t attachment_init(
+    OlmAttachment *attachment,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * iv, size_t iv_length,
+    enum OlmAttachmentState state
+) {
+    struct _olm_aes256_key aes_key;
+
+    if (key_length != AES256_KEY_LENGTH || iv_length != AES256_IV_LENGTH) {
+        attachment->last_error = OLM_BAD_ATTACHMENT_KEY;
+        return (size_t)-1;
+    }
+
+    memcpy(aes_key.key, key, AES256_KEY_LENGTH);
+    _olm_crypto_aes_key_setup(&aes_key, &attachment->schedule);
+    _olm_unset(&aes_key, sizeof(aes_key));
+
+    memcpy(attachment->counter, iv, AES256_IV_LENGTH);
+    attachment->stream_used = AES256_IV_LENGTH;
+    _olm_crypto_sha256_begin(&attachment->hash);
+    attachment->state = state;
+    return 0;
+}
+
+size_t olm_attachment_encrypt_init(
+    OlmAttachment *attachment,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * iv, size_t iv_length
+) {
+    return attachment_init(
+        attachment, key, key_length, iv, iv_length, ATTACHMENT_ENCRYPTING
+    );
+}
+
+size_t olm_attachment_decrypt_init(
+    OlmAttachment *attachment,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * iv, size_t iv_length
+) {
+    return attachment_init(
+        attachment, key, key_length, iv, iv_length, ATTACHMENT_DECRYPTING
+    );
+}
+
+/** XOR the next length bytes of key stream with the input */
+static void attachment_crypt(
+    OlmAttachment *attachment,
+    uint8_t const * input, size_t length,
+    uint8_t * output
+) {
+    size_t blocks, i;
+
+    /* finish the block that the last piece ended in */
+    while (length && attachment->stream_used < AES256_IV_LENGTH) {
+        *output++ = *input++ ^ attachment->stream[attachment->stream_used++];
+        --length;
+    }
+
+    blocks = length / AES256_IV_LENGTH;
+    _olm_crypto_aes_ctr_blocks(
+        &attachment->schedule, attachment->counter, input, blocks, output
+    );
+    input += blocks * AES256_IV_LENGTH;
+    output += blocks * AES256_IV_LENGTH;
+    length -= blocks * AES256_IV_LENGTH;
+
+    /* and keep the rest of the key stream of a partial last block */
+    if (length) {
+        memset(attachment->stream, 0, AES256_IV_LENGTH);
+        _olm_crypto_aes_ctr_blocks(
+            &attachment->schedule, attachment->counter,
+            attachment->stream, 1, attachment->stream
+        );
+        for (i = 0; i < length; ++i) {
+            output[i] = input[i] ^ attachment->stream[i];
+        }
+        attachment->stream_used = length;
+    }
+}
+
+size_t olm_attachment_update(
+    OlmAttachment *attachment,
+    uint8_t const * input, size_t length,
+    uint8_t * output, size_t output_length
+) {
+    size_t remaining = length;
+
+    if (attachment->state == ATTACHMENT_NOT_STARTED) {
+        attachment->last_error = OLM_BAD_STREAM_STATE;
+        return (size_t)-1;
+    }
+    if (output_length < length) {
+        attachment->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+
+    while (remaining) {
+        size_t chunk = remaining < ATTACHMENT_CHUNK_LENGTH
+            ? remaining : ATTACHMENT_CHUNK_LENGTH;
+        /* the hash is of the ciphertext, which may be about to be
+         * overwritten with the plaintext */
+        if (attachment->state == ATTACHMENT_DECRYPTING) {
+            _olm_crypto_sha256_update(&attachment->hash, input, chunk);
+        }
+        attachment_crypt(attachment, input, chunk, output);
+        if (attachment->state == ATTACHMENT_ENCRYPTING) {
+            _olm_crypto_sha256_update(&attachment->hash, output, chunk);
+        }
+        input += chunk;
+        output += chunk;
+        remaining -= chunk;
+    }
+    return length;
+}
+
+/** Write the hash of the ciphertext, and wipe the attachment's keys */
+static void attachment_final(
+    OlmAttachment *attachment,
+    uint8_t hash[ATTACHMENT_HASH_LENGTH]
+) {
+    uint8_t raw_hash[SHA256_OUTPUT_LENGTH];
+    _olm_crypto_sha256_end(&attachment->hash, raw_hash);
+    _olm_encode_base64(raw_hash, SHA256_OUTPUT_LENGTH, hash);
+    _olm_unset(raw_hash, sizeof(raw_hash));
+    olm_clear_attachment(attachment);
+}
+
+size_t olm_attachment_encrypt_final(
+    OlmAttachment *attachment,
+    uint8_t * hash, size_t hash_length
+) {
+    if (attachment->state != ATTACHMENT_ENCRYPTING) {
+        attachment->last_error = OLM_BAD_STREAM_STATE;
+        return (size_t)-1;
+    }
+    if (hash_length < ATTACHMENT_HASH_LENGTH) {
+        attachment->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+    attachment_final(attachment, hash);
+    return ATTACHMENT_HASH_LENGTH;
+}
+
+size_t olm_attachment_decrypt_final(
+    OlmAttachment *attachment,
+    uint8_t const * hash, size_t hash_length
+) {
+    uint8_t actual_hash[ATTACHMENT_HASH_LENGTH];
+
+    if (attachment->state != ATTACHMENT_DECRYPTING) {
+        attachment->last_error = OLM_BAD_STREAM_STATE;
+        return (size_t)-1;
+    }
+    attachment_final(attachment, actual_hash);
+    if (hash_length != ATTACHMENT_HASH_LENGTH
+            || !_olm_is_equal(hash, actual_hash, ATTACHMENT_HASH_LENGTH)) {
+        attachment->last_error = OLM_BAD_MESSAGE_MAC;
+        return (size_t)-1;
+    }
+    return 0;
+}
@@ -14,6 +14,7 @@
  */
 #include "olm/base64.h"
 #include "olm/base64.hh"
+#include "olm/dispatch.h"
 
 namespace {
 
@@ -42,6 +43,29 @@ static const std::uint8_t DECODE_BASE64[128] = {
     41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,  E,  E,  E,  E,  E,
 };
 
+/** Inputs shorter than this are left to the table loops */
+static const std::size_t SIMD_MIN_LENGTH = 64;
+
+/** Run the vector kernel for the bulk of an encode, if there is one.
+ * Returns the number of bytes it encoded. */
+static std::size_t simd_encode(
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output
+) {
+    auto kernel = _olm_crypto_dispatch()->base64_encode;
+    return kernel ? kernel(input, input_length, output) : 0;
+}
+
+/** Run the vector kernel for the bulk of a decode, if there is one.
+ * Returns the number of characters it decoded. */
+static std::size_t simd_decode(
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output
+) {
+    auto kernel = _olm_crypto_dispatch()->base64_decode;
+    return kernel ? kernel(input, input_length, output) : 0;
+}
+
 } // namespace
 
 
@@ -55,8 +79,14 @@ std::uint8_t * olm::encode_base64(
     std::uint8_t const * input, std::size_t input_length,
     std::uint8_t * output
 ) {
-    std::uint8_t const * end = input + (input_length / 3) * 3;
     std::uint8_t const * pos = input;
+    /* the vector kernels don't pay for themselves on keys and ids */
+    if (input_length >= SIMD_MIN_LENGTH) {
+        std::size_t done = simd_encode(input, input_length, output);
+        pos += done;
+        output += done / 3 * 4;
+    }
+    std::uint8_t const * end = input + (input_length / 3) * 3;
     while (pos != end) {
         unsigned value = pos[0];
         value <<= 8; value |= pos[1];
@@ -105,8 +135,13 @@ std::uint8_t const * olm::decode_base64(
     std::uint8_t const * input, std::size_t input_length,
     std::uint8_t * output
 ) {
-    std::uint8_t const * end = input + (input_length / 4) * 4;
     std::uint8_t const * pos = input;
+    if (input_length >= SIMD_MIN_LENGTH) {
+        std::size_t done = simd_decode(input, input_length, output);
+        pos += done;
+        output += done / 4 * 3;
+    }
+    std::uint8_t const * end = input + (input_length / 4) * 4;
     while (pos != end) {
         unsigned value = DECODE_BASE64[pos[0] & 0x7F];
         value <<= 6; value |= DECODE_BASE64[pos[1] & 0x7F];
@@ -136,6 +171,60 @@ std::uint8_t const * olm::decode_base64(
 }
 
 
+std::size_t olm::decode_base64_strict(
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output, std::size_t & error_position
+) {
+    std::size_t raw_length = decode_base64_length(input_length);
+    if (raw_length == std::size_t(-1)) {
+        error_position = input_length - 1;
+        return std::size_t(-1);
+    }
+    std::uint8_t const * pos = input;
+    /* the vector kernels stop at the first block with a bad character */
+    if (input_length >= SIMD_MIN_LENGTH) {
+        std::size_t done = simd_decode(input, input_length, output);
+        pos += done;
+        output += done / 4 * 3;
+    }
+    std::uint8_t const * end = input + input_length;
+    while (pos != end) {
+        std::size_t chars = end - pos < 4 ? end - pos : 4;
+        /* anything outside the alphabet either has the top bit set or
+         * decodes to E, so a group is good if none of its values reach 64 */
+        unsigned value = 0, bad = 0;
+        for (std::size_t i = 0; i < chars; ++i) {
+            unsigned digit = pos[i] & 0x80 ? E : DECODE_BASE64[pos[i]];
+            bad |= digit;
+            value <<= 6; value |= digit;
+        }
+        if (bad & 0xC0) {
+            for (std::size_t i = 0; ; ++i) {
+                if (pos[i] & 0x80 || DECODE_BASE64[pos[i]] == E) {
+                    error_position = pos + i - input;
+                    return std::size_t(-1);
+                }
+            }
+        }
+        if (chars == 4) {
+            output[2] = value;
+            value >>= 8; output[1] = value;
+            value >>= 8; output[0] = value;
+            output += 3;
+        } else if (chars == 3) {
+            value >>= 2;
+            output[1] = value;
+            value >>= 8; output[0] = value;
+        } else {
+            value >>= 4;
+            output[0] = value;
+        }
+        pos += chars;
+    }
+    return raw_length;
+}
+
+
 // implementations of base64.h
 
 size_t _olm_encode_base64_length(
@@ -162,6 +251,8 @@ size_t _olm_decode_base64(
     uint8_t const * input, size_t input_length,
     uint8_t * output
 ) {
-    olm::decode_base64(input, input_length, output);
-    return olm::decode_base64_length(input_length);
+    std::size_t error_position;
+    return olm::decode_base64_strict(
+        input, input_length, output, error_position
+    );
 }
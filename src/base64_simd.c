@@ -0,0 +1,507 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/base64_simd.h"
+#include "olm/cpu.h"
+
+/* The x86 and WebAssembly kernels follow Muła and Lemire, "Faster Base64
+ * Encoding and Decoding using AVX2 Instructions". Each 16 byte lane takes 12
+ * bytes of input to 16 characters and back. The AVX2 versions do two lanes
+ * at a time, with the same constants in both. */
+
+/* Encoding: spread each 3 bytes over a 32-bit word as b1 b0 b2 b1, so that
+ * two multiplies can move the four 6-bit groups into separate bytes; then
+ * turn each group into its character by adding an offset chosen by range. */
+#define ENCODE_SHUFFLE \
+    1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+#define ENCODE_OFFSETS \
+    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, \
+    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, \
+    '/' - 63, 'A', 0, 0
+
+/* Decoding: the high and low nibbles of each character pick bit masks whose
+ * AND is non-zero for anything outside the alphabet, and the high nibble
+ * (adjusted for '/') picks the offset back to the 6-bit value; two
+ * multiply-adds then pack the four values into 3 bytes. */
+#define DECODE_LOW_NIBBLE_MASKS \
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+    0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A
+#define DECODE_HIGH_NIBBLE_MASKS \
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+#define DECODE_OFFSETS \
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+#define DECODE_SHUFFLE \
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define OLM_BASE64_SIMD 1
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+TARGET_SSSE3 static size_t encode_ssse3(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const __m128i shuffle = _mm_setr_epi8(ENCODE_SHUFFLE);
+    const __m128i offsets = _mm_setr_epi8(ENCODE_OFFSETS);
+    size_t done = 0;
+
+    /* each load reads 16 bytes but only encodes 12 */
+    while (input_length - done >= 16) {
+        __m128i in = _mm_loadu_si128((__m128i const *) (input + done));
+        __m128i t, indices, result;
+
+        in = _mm_shuffle_epi8(in, shuffle);
+        t = _mm_mulhi_epu16(
+            _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+            _mm_set1_epi32(0x04000040)
+        );
+        indices = _mm_or_si128(t, _mm_mullo_epi16(
+            _mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+            _mm_set1_epi32(0x01000010)
+        ));
+
+        result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        result = _mm_or_si128(result, _mm_and_si128(
+            _mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)
+        ));
+        result = _mm_add_epi8(_mm_shuffle_epi8(offsets, result), indices);
+
+        _mm_storeu_si128((__m128i *) output, result);
+        done += 12;
+        output += 16;
+    }
+    return done;
+}
+
+TARGET_AVX2 static size_t encode_avx2(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const __m256i shuffle = _mm256_setr_epi8(ENCODE_SHUFFLE, ENCODE_SHUFFLE);
+    const __m256i offsets = _mm256_setr_epi8(ENCODE_OFFSETS, ENCODE_OFFSETS);
+    size_t done = 0;
+
+    /* the two lanes are loaded from 12 bytes apart, so read 28 bytes */
+    while (input_length - done >= 28) {
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((__m128i const *) (input + done))
+            ),
+            _mm_loadu_si128((__m128i const *) (input + done + 12)), 1
+        );
+        __m256i t, indices, result;
+
+        in = _mm256_shuffle_epi8(in, shuffle);
+        t = _mm256_mulhi_epu16(
+            _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+            _mm256_set1_epi32(0x04000040)
+        );
+        indices = _mm256_or_si256(t, _mm256_mullo_epi16(
+            _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+            _mm256_set1_epi32(0x01000010)
+        ));
+
+        result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        result = _mm256_or_si256(result, _mm256_and_si256(
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+            _mm256_set1_epi8(13)
+        ));
+        result = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, result), indices);
+
+        _mm256_storeu_si256((__m256i *) output, result);
+        done += 24;
+        output += 32;
+    }
+    return done;
+}
+
+TARGET_SSSE3 static size_t decode_ssse3(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const __m128i low_masks = _mm_setr_epi8(DECODE_LOW_NIBBLE_MASKS);
+    const __m128i high_masks = _mm_setr_epi8(DECODE_HIGH_NIBBLE_MASKS);
+    const __m128i offsets = _mm_setr_epi8(DECODE_OFFSETS);
+    const __m128i shuffle = _mm_setr_epi8(DECODE_SHUFFLE);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    size_t done = 0;
+
+    /* each store writes 16 bytes but only decodes 12, so leave room for the
+     * other 4 in the output for the characters after this block */
+    while (input_length - done >= 24) {
+        __m128i in = _mm_loadu_si128((__m128i const *) (input + done));
+        __m128i high = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+        __m128i low = _mm_and_si128(in, nibble);
+        __m128i invalid = _mm_and_si128(
+            _mm_shuffle_epi8(low_masks, low),
+            _mm_shuffle_epi8(high_masks, high)
+        );
+        __m128i values;
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128()))) {
+            break;
+        }
+        values = _mm_add_epi8(in, _mm_shuffle_epi8(offsets, _mm_add_epi8(
+            _mm_cmpeq_epi8(in, _mm_set1_epi8('/')), high
+        )));
+        values = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        values = _mm_madd_epi16(values, _mm_set1_epi32(0x00011000));
+        values = _mm_shuffle_epi8(values, shuffle);
+
+        _mm_storeu_si128((__m128i *) output, values);
+        done += 16;
+        output += 12;
+    }
+    return done;
+}
+
+TARGET_AVX2 static size_t decode_avx2(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const __m256i low_masks = _mm256_setr_epi8(
+        DECODE_LOW_NIBBLE_MASKS, DECODE_LOW_NIBBLE_MASKS
+    );
+    const __m256i high_masks = _mm256_setr_epi8(
+        DECODE_HIGH_NIBBLE_MASKS, DECODE_HIGH_NIBBLE_MASKS
+    );
+    const __m256i offsets = _mm256_setr_epi8(DECODE_OFFSETS, DECODE_OFFSETS);
+    const __m256i shuffle = _mm256_setr_epi8(DECODE_SHUFFLE, DECODE_SHUFFLE);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t done = 0;
+
+    /* the lanes' 12 bytes are stored 16 bytes at a time, the second over the
+     * spare 4 of the first, so leave room for the 4 after it */
+    while (input_length - done >= 40) {
+        __m256i in = _mm256_loadu_si256((__m256i const *) (input + done));
+        __m256i high = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+        __m256i low = _mm256_and_si256(in, nibble);
+        __m256i invalid = _mm256_and_si256(
+            _mm256_shuffle_epi8(low_masks, low),
+            _mm256_shuffle_epi8(high_masks, high)
+        );
+        __m256i values;
+
+        if (_mm256_movemask_epi8(
+            _mm256_cmpgt_epi8(invalid, _mm256_setzero_si256())
+        )) {
+            break;
+        }
+        values = _mm256_add_epi8(in, _mm256_shuffle_epi8(
+            offsets,
+            _mm256_add_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')), high)
+        ));
+        values = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        values = _mm256_madd_epi16(values, _mm256_set1_epi32(0x00011000));
+        values = _mm256_shuffle_epi8(values, shuffle);
+
+        _mm_storeu_si128((__m128i *) output, _mm256_castsi256_si128(values));
+        _mm_storeu_si128(
+            (__m128i *) (output + 12), _mm256_extracti128_si256(values, 1)
+        );
+        done += 32;
+        output += 24;
+    }
+    return done;
+}
+
+size_t _olm_base64_simd_encode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    size_t done = 0;
+    if (_olm_cpu_features() & OLM_CPU_FEATURE_AVX2) {
+        done = encode_avx2(input, input_length, output);
+    }
+    return done + encode_ssse3(
+        input + done, input_length - done, output + done / 3 * 4
+    );
+}
+
+size_t _olm_base64_simd_decode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    size_t done = 0;
+    if (_olm_cpu_features() & OLM_CPU_FEATURE_AVX2) {
+        done = decode_avx2(input, input_length, output);
+    }
+    return done + decode_ssse3(
+        input + done, input_length - done, output + done / 4 * 3
+    );
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+#define OLM_BASE64_SIMD 1
+
+/* NEON can deinterleave the input as it loads it and look up all 64 (or
+ * 128) entries of a table at once, so these work on the same layout as the
+ * table loops, 16 groups at a time. */
+
+static const uint8_t ENCODE_BASE64[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define E 0xFF
+
+static const uint8_t DECODE_BASE64[128] = {
+/*  0x0 0x1 0x2 0x3 0x4 0x5 0x6 0x7 0x8 0x9 0xA 0xB 0xC 0xD 0xE 0xF */
+     E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,
+     E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E,
+     E,  E,  E,  E,  E,  E,  E,  E,  E,  E,  E, 62,  E,  E,  E, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61,  E,  E,  E,  E,  E,  E,
+     E,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,  E,  E,  E,  E,  E,
+     E, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,  E,  E,  E,  E,  E,
+};
+
+#undef E
+
+static uint8x16x4_t load_table(uint8_t const * table) {
+    uint8x16x4_t result;
+    result.val[0] = vld1q_u8(table);
+    result.val[1] = vld1q_u8(table + 16);
+    result.val[2] = vld1q_u8(table + 32);
+    result.val[3] = vld1q_u8(table + 48);
+    return result;
+}
+
+size_t _olm_base64_simd_encode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const uint8x16x4_t table = load_table(ENCODE_BASE64);
+    const uint8x16_t mask = vdupq_n_u8(0x3F);
+    size_t done = 0;
+
+    while (input_length - done >= 48) {
+        uint8x16x3_t in = vld3q_u8(input + done);
+        uint8x16x4_t out;
+
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vandq_u8(vorrq_u8(
+            vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)
+        ), mask);
+        out.val[2] = vandq_u8(vorrq_u8(
+            vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)
+        ), mask);
+        out.val[3] = vandq_u8(in.val[2], mask);
+
+        out.val[0] = vqtbl4q_u8(table, out.val[0]);
+        out.val[1] = vqtbl4q_u8(table, out.val[1]);
+        out.val[2] = vqtbl4q_u8(table, out.val[2]);
+        out.val[3] = vqtbl4q_u8(table, out.val[3]);
+
+        vst4q_u8(output, out);
+        done += 48;
+        output += 64;
+    }
+    return done;
+}
+
+size_t _olm_base64_simd_decode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const uint8x16x4_t low_table = load_table(DECODE_BASE64);
+    const uint8x16x4_t high_table = load_table(DECODE_BASE64 + 64);
+    const uint8x16_t high_offset = vdupq_n_u8(64);
+    const uint8x16_t top_bit = vdupq_n_u8(0x80);
+    size_t done = 0;
+    int i;
+
+    while (input_length - done >= 64) {
+        uint8x16x4_t in = vld4q_u8(input + done);
+        uint8x16x3_t out;
+        /* valid characters give values below 64; anything else either gives
+         * E or has the top bit set */
+        uint8x16_t invalid = vdupq_n_u8(0);
+
+        for (i = 0; i < 4; ++i) {
+            uint8x16_t c = in.val[i];
+            uint8x16_t value = vqtbl4q_u8(low_table, c);
+            value = vqtbx4q_u8(value, high_table, vsubq_u8(c, high_offset));
+            invalid = vorrq_u8(invalid, vorrq_u8(value, vandq_u8(c, top_bit)));
+            in.val[i] = value;
+        }
+        if (vmaxvq_u8(invalid) >= 64) {
+            break;
+        }
+
+        out.val[0] = vorrq_u8(
+            vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4)
+        );
+        out.val[1] = vorrq_u8(
+            vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2)
+        );
+        out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+
+        vst3q_u8(output, out);
+        done += 64;
+        output += 48;
+    }
+    return done;
+}
+
+#elif defined(__wasm_simd128__)
+
+#include <wasm_simd128.h>
+
+#define OLM_BASE64_SIMD 1
+
+/* The same kernels as the SSSE3 ones, with the multiplies that move the
+ * 6-bit groups about done with shifts, as WebAssembly has no instructions
+ * for them. The swizzles give zero for out of range indices as pshufb does
+ * for those with the top bit set, which is all the tables rely on. */
+
+static const uint8_t ENCODE_SHUFFLE_BYTES[16] = { ENCODE_SHUFFLE };
+static const int8_t ENCODE_OFFSET_BYTES[16] = { ENCODE_OFFSETS };
+static const uint8_t DECODE_LOW_NIBBLE_BYTES[16] = { DECODE_LOW_NIBBLE_MASKS };
+static const uint8_t DECODE_HIGH_NIBBLE_BYTES[16] = { DECODE_HIGH_NIBBLE_MASKS };
+static const int8_t DECODE_OFFSET_BYTES[16] = { DECODE_OFFSETS };
+static const int8_t DECODE_SHUFFLE_BYTES[16] = { DECODE_SHUFFLE };
+
+/* the low and high 16 bits of each 32-bit word */
+#define LOW_HALVES wasm_i32x4_splat(0x0000ffff)
+#define HIGH_HALVES wasm_i32x4_splat((int32_t)0xffff0000)
+
+size_t _olm_base64_simd_encode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const v128_t shuffle = wasm_v128_load(ENCODE_SHUFFLE_BYTES);
+    const v128_t offsets = wasm_v128_load(ENCODE_OFFSET_BYTES);
+    size_t done = 0;
+
+    /* each load reads 16 bytes but only encodes 12 */
+    while (input_length - done >= 16) {
+        v128_t in = wasm_v128_load(input + done);
+        v128_t t, u, indices, result;
+
+        in = wasm_i8x16_swizzle(in, shuffle);
+        /* mulhi by 0x0040 and 0x0400 in the two halves */
+        t = wasm_v128_and(in, wasm_i32x4_splat(0x0fc0fc00));
+        t = wasm_v128_or(
+            wasm_v128_and(wasm_u16x8_shr(t, 10), LOW_HALVES),
+            wasm_v128_and(wasm_u16x8_shr(t, 6), HIGH_HALVES)
+        );
+        /* mullo by 0x0010 and 0x0100 in the two halves */
+        u = wasm_v128_and(in, wasm_i32x4_splat(0x003f03f0));
+        u = wasm_v128_or(
+            wasm_v128_and(wasm_i16x8_shl(u, 4), LOW_HALVES),
+            wasm_v128_and(wasm_i16x8_shl(u, 8), HIGH_HALVES)
+        );
+        indices = wasm_v128_or(t, u);
+
+        result = wasm_u8x16_sub_sat(indices, wasm_i8x16_splat(51));
+        result = wasm_v128_or(result, wasm_v128_and(
+            wasm_i8x16_gt(wasm_i8x16_splat(26), indices), wasm_i8x16_splat(13)
+        ));
+        result = wasm_i8x16_add(wasm_i8x16_swizzle(offsets, result), indices);
+
+        wasm_v128_store(output, result);
+        done += 12;
+        output += 16;
+    }
+    return done;
+}
+
+size_t _olm_base64_simd_decode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    const v128_t low_masks = wasm_v128_load(DECODE_LOW_NIBBLE_BYTES);
+    const v128_t high_masks = wasm_v128_load(DECODE_HIGH_NIBBLE_BYTES);
+    const v128_t offsets = wasm_v128_load(DECODE_OFFSET_BYTES);
+    const v128_t shuffle = wasm_v128_load(DECODE_SHUFFLE_BYTES);
+    const v128_t nibble = wasm_i8x16_splat(0x0f);
+    size_t done = 0;
+
+    /* each store writes 16 bytes but only decodes 12, so leave room for the
+     * other 4 in the output for the characters after this block */
+    while (input_length - done >= 24) {
+        v128_t in = wasm_v128_load(input + done);
+        v128_t high = wasm_v128_and(wasm_u32x4_shr(in, 4), nibble);
+        v128_t low = wasm_v128_and(in, nibble);
+        v128_t invalid = wasm_v128_and(
+            wasm_i8x16_swizzle(low_masks, low),
+            wasm_i8x16_swizzle(high_masks, high)
+        );
+        v128_t values;
+
+        if (wasm_v128_any_true(invalid)) {
+            break;
+        }
+        values = wasm_i8x16_add(in, wasm_i8x16_swizzle(offsets, wasm_i8x16_add(
+            wasm_i8x16_eq(in, wasm_i8x16_splat('/')), high
+        )));
+        /* maddubs by 0x40, 0x01: each pair of 6-bit values into 12 bits */
+        values = wasm_v128_or(
+            wasm_i16x8_shl(wasm_v128_and(values, wasm_i16x8_splat(0x00ff)), 6),
+            wasm_u16x8_shr(values, 8)
+        );
+        /* madd by 0x1000, 0x0001: each pair of 12-bit values into 24 bits */
+        values = wasm_v128_or(
+            wasm_i32x4_shl(wasm_v128_and(values, LOW_HALVES), 12),
+            wasm_u32x4_shr(values, 16)
+        );
+        values = wasm_i8x16_swizzle(values, shuffle);
+
+        wasm_v128_store(output, values);
+        done += 16;
+        output += 12;
+    }
+    return done;
+}
+
+#endif
+
+#ifdef OLM_BASE64_SIMD
+
+int _olm_base64_simd_available(void) {
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_SIMD128) != 0;
+}
+
+#else
+
+/* No vector kernels for this architecture: the stubs are never called as
+ * _olm_base64_simd_available is false. */
+
+int _olm_base64_simd_available(void) {
+    return 0;
+}
+
+size_t _olm_base64_simd_encode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    return 0;
+}
+
+size_t _olm_base64_simd_decode(
+    uint8_t const * input, size_t input_length,
+    uint8_t * output
+) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,604 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/canonical_json.hh"
+
+#include <algorithm>
+#include <cstring>
+
+/* The JSON is canonicalised in two passes over the buffer. The first removes
+ * the whitespace and rewrites the strings and numbers, which only ever makes
+ * them shorter, so it can write behind where it reads. The second sorts the
+ * members of each object by moving them around with rotations, so neither
+ * needs any memory beyond the buffer. The second pass and the lookups only
+ * ever see the output of the first, so they needn't check it again. */
+
+namespace {
+
+/** How deeply objects and arrays can be nested */
+static const unsigned MAX_DEPTH = 64;
+
+/** The largest integer canonical JSON allows, 2^53 - 1 */
+static const char MAX_INTEGER[] = "9007199254740991";
+static const std::size_t MAX_INTEGER_DIGITS = sizeof(MAX_INTEGER) - 1;
+
+static const std::uint8_t SIGNATURES[] = "signatures";
+static const std::uint8_t UNSIGNED[] = "unsigned";
+
+struct Compactor {
+    std::uint8_t const * in;
+    std::uint8_t const * end;
+    std::uint8_t * out;
+};
+
+static void skip_whitespace(Compactor & c) {
+    while (c.in != c.end && (
+        *c.in == ' ' || *c.in == '\t' || *c.in == '\n' || *c.in == '\r'
+    )) {
+        ++c.in;
+    }
+}
+
+/** Moves on past the next character if it is the one given, and copies it */
+static bool expect(Compactor & c, std::uint8_t ch) {
+    skip_whitespace(c);
+    if (c.in == c.end || *c.in != ch) {
+        return false;
+    }
+    ++c.in;
+    *c.out++ = ch;
+    return true;
+}
+
+static bool read_hex(Compactor & c, std::uint32_t & value) {
+    if (c.end - c.in < 4) {
+        return false;
+    }
+    value = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        std::uint8_t ch = *c.in++;
+        value <<= 4;
+        if (ch >= '0' && ch <= '9') {
+            value |= ch - '0';
+        } else if (ch >= 'a' && ch <= 'f') {
+            value |= ch - 'a' + 10;
+        } else if (ch >= 'A' && ch <= 'F') {
+            value |= ch - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Writes a code point from an escape the way canonical JSON has it. No
+ * escape is shorter than what is written for it. */
+static void write_code_point(Compactor & c, std::uint32_t code_point) {
+    static const char HEX[] = "0123456789abcdef";
+    if (code_point == '"' || code_point == '\\') {
+        *c.out++ = '\\';
+        *c.out++ = code_point;
+    } else if (code_point < 0x20) {
+        *c.out++ = '\\';
+        switch (code_point) {
+            case '\b': *c.out++ = 'b'; break;
+            case '\t': *c.out++ = 't'; break;
+            case '\n': *c.out++ = 'n'; break;
+            case '\f': *c.out++ = 'f'; break;
+            case '\r': *c.out++ = 'r'; break;
+            default:
+                *c.out++ = 'u';
+                *c.out++ = '0';
+                *c.out++ = '0';
+                *c.out++ = HEX[code_point >> 4];
+                *c.out++ = HEX[code_point & 0xF];
+        }
+    } else if (code_point < 0x80) {
+        *c.out++ = code_point;
+    } else if (code_point < 0x800) {
+        *c.out++ = 0xC0 | (code_point >> 6);
+        *c.out++ = 0x80 | (code_point & 0x3F);
+    } else if (code_point < 0x10000) {
+        *c.out++ = 0xE0 | (code_point >> 12);
+        *c.out++ = 0x80 | ((code_point >> 6) & 0x3F);
+        *c.out++ = 0x80 | (code_point & 0x3F);
+    } else {
+        *c.out++ = 0xF0 | (code_point >> 18);
+        *c.out++ = 0x80 | ((code_point >> 12) & 0x3F);
+        *c.out++ = 0x80 | ((code_point >> 6) & 0x3F);
+        *c.out++ = 0x80 | (code_point & 0x3F);
+    }
+}
+
+static bool compact_escape(Compactor & c) {
+    if (c.in == c.end) {
+        return false;
+    }
+    std::uint32_t code_point;
+    switch (*c.in++) {
+        case '"': code_point = '"'; break;
+        case '\\': code_point = '\\'; break;
+        case '/': code_point = '/'; break;
+        case 'b': code_point = '\b'; break;
+        case 'f': code_point = '\f'; break;
+        case 'n': code_point = '\n'; break;
+        case 'r': code_point = '\r'; break;
+        case 't': code_point = '\t'; break;
+        case 'u': {
+            if (!read_hex(c, code_point)) {
+                return false;
+            }
+            if (code_point >= 0xDC00 && code_point < 0xE000) {
+                return false;
+            }
+            if (code_point >= 0xD800 && code_point < 0xDC00) {
+                /* the first half of a surrogate pair */
+                std::uint32_t low;
+                if (c.end - c.in < 2 || c.in[0] != '\\' || c.in[1] != 'u') {
+                    return false;
+                }
+                c.in += 2;
+                if (!read_hex(c, low) || low < 0xDC00 || low >= 0xE000) {
+                    return false;
+                }
+                code_point = 0x10000
+                    + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+    write_code_point(c, code_point);
+    return true;
+}
+
+/** Copies a UTF-8 sequence of more than one byte, checking that it is the
+ * shortest encoding of a code point that isn't a surrogate */
+static bool compact_utf8(Compactor & c) {
+    std::uint8_t lead = *c.in;
+    std::size_t length;
+    std::uint8_t low = 0x80, high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        if (lead == 0xE0) low = 0xA0;
+        if (lead == 0xED) high = 0x9F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        if (lead == 0xF0) low = 0x90;
+        if (lead == 0xF4) high = 0x8F;
+    } else {
+        return false;
+    }
+    if (std::size_t(c.end - c.in) < length
+            || c.in[1] < low || c.in[1] > high) {
+        return false;
+    }
+    for (std::size_t i = 2; i < length; ++i) {
+        if ((c.in[i] & 0xC0) != 0x80) {
+            return false;
+        }
+    }
+    for (std::size_t i = 0; i < length; ++i) {
+        *c.out++ = *c.in++;
+    }
+    return true;
+}
+
+static bool compact_string(Compactor & c) {
+    if (!expect(c, '"')) {
+        return false;
+    }
+    for (;;) {
+        if (c.in == c.end) {
+            return false;
+        }
+        std::uint8_t ch = *c.in;
+        if (ch == '"') {
+            ++c.in;
+            *c.out++ = '"';
+            return true;
+        } else if (ch < 0x20) {
+            return false;
+        } else if (ch == '\\') {
+            ++c.in;
+            if (!compact_escape(c)) {
+                return false;
+            }
+        } else if (ch < 0x80) {
+            ++c.in;
+            *c.out++ = ch;
+        } else if (!compact_utf8(c)) {
+            return false;
+        }
+    }
+}
+
+static bool compact_number(Compactor & c) {
+    bool negative = false;
+    if (*c.in == '-') {
+        negative = true;
+        ++c.in;
+    }
+    std::uint8_t const * digits = c.in;
+    while (c.in != c.end && *c.in >= '0' && *c.in <= '9') {
+        ++c.in;
+    }
+    std::size_t length = c.in - digits;
+    if (!length || (digits[0] == '0' && length > 1)) {
+        return false;
+    }
+    /* fractions and exponents have no canonical form */
+    if (c.in != c.end && (*c.in == '.' || *c.in == 'e' || *c.in == 'E')) {
+        return false;
+    }
+    if (length > MAX_INTEGER_DIGITS || (length == MAX_INTEGER_DIGITS
+            && std::memcmp(digits, MAX_INTEGER, length) > 0)) {
+        return false;
+    }
+    /* -0 is written as 0 */
+    if (negative && digits[0] != '0') {
+        *c.out++ = '-';
+    }
+    for (std::size_t i = 0; i < length; ++i) {
+        *c.out++ = digits[i];
+    }
+    return true;
+}
+
+static bool compact_literal(Compactor & c, char const * literal) {
+    std::size_t length = std::strlen(literal);
+    if (std::size_t(c.end - c.in) < length
+            || std::memcmp(c.in, literal, length)) {
+        return false;
+    }
+    for (std::size_t i = 0; i < length; ++i) {
+        *c.out++ = *c.in++;
+    }
+    return true;
+}
+
+static bool compact_value(Compactor & c, unsigned depth);
+
+static bool compact_object(Compactor & c, unsigned depth) {
+    if (depth >= MAX_DEPTH || !expect(c, '{')) {
+        return false;
+    }
+    if (expect(c, '}')) {
+        return true;
+    }
+    do {
+        if (!compact_string(c) || !expect(c, ':')
+                || !compact_value(c, depth + 1)) {
+            return false;
+        }
+    } while (expect(c, ','));
+    return expect(c, '}');
+}
+
+static bool compact_array(Compactor & c, unsigned depth) {
+    if (depth >= MAX_DEPTH || !expect(c, '[')) {
+        return false;
+    }
+    if (expect(c, ']')) {
+        return true;
+    }
+    do {
+        if (!compact_value(c, depth + 1)) {
+            return false;
+        }
+    } while (expect(c, ','));
+    return expect(c, ']');
+}
+
+static bool compact_value(Compactor & c, unsigned depth) {
+    skip_whitespace(c);
+    if (c.in == c.end) {
+        return false;
+    }
+    switch (*c.in) {
+        case '{': return compact_object(c, depth);
+        case '[': return compact_array(c, depth);
+        case '"': return compact_string(c);
+        case 't': return compact_literal(c, "true");
+        case 'f': return compact_literal(c, "false");
+        case 'n': return compact_literal(c, "null");
+        default:
+            if (*c.in == '-' || (*c.in >= '0' && *c.in <= '9')) {
+                return compact_number(c);
+            }
+            return false;
+    }
+}
+
+/** Returns the end of the canonical value at pos */
+static std::uint8_t const * skip_value(std::uint8_t const * pos) {
+    if (*pos == '"') {
+        ++pos;
+        while (*pos != '"') {
+            pos += *pos == '\\' ? 2 : 1;
+        }
+        return pos + 1;
+    } else if (*pos == '{' || *pos == '[') {
+        unsigned depth = 0;
+        do {
+            if (*pos == '"') {
+                pos = skip_value(pos);
+                continue;
+            }
+            if (*pos == '{' || *pos == '[') {
+                ++depth;
+            } else if (*pos == '}' || *pos == ']') {
+                --depth;
+            }
+            ++pos;
+        } while (depth);
+        return pos;
+    } else {
+        while (*pos != ',' && *pos != '}' && *pos != ']') {
+            ++pos;
+        }
+        return pos;
+    }
+}
+
+static std::uint8_t * skip_value(std::uint8_t * pos) {
+    return const_cast<std::uint8_t *>(
+        skip_value(static_cast<std::uint8_t const *>(pos))
+    );
+}
+
+/** Returns the end of the canonical "key":value member at pos */
+template<typename T>
+static T * skip_member(T * pos) {
+    return skip_value(skip_value(pos) + 1);
+}
+
+/** Returns the next unescaped byte of a canonical string and moves on past
+ * it, or -1 at the closing quote */
+static int next_string_byte(std::uint8_t const *& pos) {
+    std::uint8_t ch = *pos;
+    if (ch == '"') {
+        return -1;
+    }
+    if (ch != '\\') {
+        ++pos;
+        return ch;
+    }
+    ch = pos[1];
+    pos += 2;
+    switch (ch) {
+        case 'b': return '\b';
+        case 'f': return '\f';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'u': {
+            /* only control characters are written as \u00xx */
+            int value = 0;
+            for (unsigned i = 2; i < 4; ++i) {
+                std::uint8_t hex = pos[i];
+                value = value * 16
+                    + (hex <= '9' ? hex - '0' : hex - 'a' + 10);
+            }
+            pos += 4;
+            return value;
+        }
+        default:
+            return ch;
+    }
+}
+
+/** Compares two canonical strings by their unescaped bytes, which for UTF-8
+ * is the order of their code points */
+static int compare_strings(std::uint8_t const * a, std::uint8_t const * b) {
+    ++a;
+    ++b;
+    for (;;) {
+        int a_byte = next_string_byte(a);
+        int b_byte = next_string_byte(b);
+        if (a_byte != b_byte) {
+            return a_byte < b_byte ? -1 : 1;
+        }
+        if (a_byte == -1) {
+            return 0;
+        }
+    }
+}
+
+static bool string_equals(
+    std::uint8_t const * string,
+    std::uint8_t const * bytes, std::size_t length
+) {
+    ++string;
+    for (std::size_t i = 0; i < length; ++i) {
+        if (next_string_byte(string) != bytes[i]) {
+            return false;
+        }
+    }
+    return next_string_byte(string) == -1;
+}
+
+/** Sorts the members of every object in the canonical value at pos. Returns
+ * the end of the value, or nullptr if an object has two members with the
+ * same key. */
+static std::uint8_t * sort_value(std::uint8_t * pos) {
+    if (*pos == '[') {
+        ++pos;
+        while (*pos != ']') {
+            pos = sort_value(pos);
+            if (!pos) {
+                return nullptr;
+            }
+            if (*pos == ',') {
+                ++pos;
+            }
+        }
+        return pos + 1;
+    } else if (*pos != '{') {
+        return skip_value(pos);
+    }
+
+    std::uint8_t * start = pos + 1;
+    /* sorting the members doesn't change their lengths, so the values can
+     * be sorted first */
+    pos = start;
+    while (*pos != '}') {
+        pos = sort_value(skip_value(pos) + 1);
+        if (!pos) {
+            return nullptr;
+        }
+        if (*pos == ',') {
+            ++pos;
+        }
+    }
+    std::uint8_t * const end = pos;
+    if (start == end) {
+        return end + 1;
+    }
+
+    /* an insertion sort, moving each member in front of the first sorted
+     * one with a larger key */
+    std::uint8_t * sorted_end = skip_member(start);
+    while (sorted_end != end) {
+        std::uint8_t * member = sorted_end + 1;
+        std::uint8_t * member_end = skip_member(member);
+        std::uint8_t * insert = start;
+        while (insert < sorted_end) {
+            int order = compare_strings(member, insert);
+            if (order == 0) {
+                return nullptr;
+            }
+            if (order < 0) {
+                break;
+            }
+            insert = skip_member(insert) + 1;
+        }
+        if (insert < sorted_end) {
+            /* "A,B,C" becomes "CA,B," and then "C,A,B" */
+            std::rotate(insert, member, member_end);
+            std::uint8_t * moved = insert + (member_end - member);
+            std::rotate(moved, member_end - 1, member_end);
+        }
+        sorted_end = member_end;
+    }
+    return end + 1;
+}
+
+/** Returns the value of the member of the canonical object at pos with the
+ * key given, or nullptr if there isn't one */
+static std::uint8_t const * find_member(
+    std::uint8_t const * pos,
+    std::uint8_t const * key, std::size_t key_length
+) {
+    if (*pos != '{') {
+        return nullptr;
+    }
+    ++pos;
+    while (*pos != '}') {
+        std::uint8_t const * value = skip_value(pos) + 1;
+        if (string_equals(pos, key, key_length)) {
+            return value;
+        }
+        pos = skip_value(value);
+        if (*pos == ',') {
+            ++pos;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+
+std::size_t olm::canonical_json(
+    std::uint8_t * json, std::size_t json_length
+) {
+    Compactor c = {json, json + json_length, json};
+    skip_whitespace(c);
+    if (c.in == c.end || *c.in != '{' || !compact_value(c, 0)) {
+        return std::size_t(-1);
+    }
+    skip_whitespace(c);
+    if (c.in != c.end) {
+        return std::size_t(-1);
+    }
+    if (!sort_value(json)) {
+        return std::size_t(-1);
+    }
+    return c.out - json;
+}
+
+
+std::size_t olm::find_json_signature(
+    std::uint8_t const * json, std::size_t json_length,
+    std::uint8_t const * user_id, std::size_t user_id_length,
+    std::uint8_t const * key_id, std::size_t key_id_length,
+    std::uint8_t * output, std::size_t output_length
+) {
+    (void)json_length;
+    std::uint8_t const * value = find_member(
+        json, SIGNATURES, sizeof(SIGNATURES) - 1
+    );
+    if (value) {
+        value = find_member(value, user_id, user_id_length);
+    }
+    if (value) {
+        value = find_member(value, key_id, key_id_length);
+    }
+    if (!value || *value != '"') {
+        return std::size_t(-1);
+    }
+    std::size_t length = 0;
+    ++value;
+    for (int byte; (byte = next_string_byte(value)) != -1; ++length) {
+        if (length == output_length) {
+            return std::size_t(-1);
+        }
+        output[length] = byte;
+    }
+    return length;
+}
+
+
+std::size_t olm::strip_json_signatures(
+    std::uint8_t * json, std::size_t json_length
+) {
+    std::uint8_t * pos = json + 1;
+    std::uint8_t * end = json + json_length;
+    while (*pos != '}') {
+        std::uint8_t * member_end = skip_member(pos);
+        if (!string_equals(pos, SIGNATURES, sizeof(SIGNATURES) - 1)
+                && !string_equals(pos, UNSIGNED, sizeof(UNSIGNED) - 1)) {
+            pos = *member_end == ',' ? member_end + 1 : member_end;
+            continue;
+        }
+        /* take a comma with it, the one after unless it's the last */
+        std::uint8_t * remove = pos;
+        if (*member_end == ',') {
+            ++member_end;
+        } else if (remove != json + 1) {
+            --remove;
+        }
+        std::memmove(remove, member_end, end - member_end);
+        end -= member_end - remove;
+        pos = remove;
+        if (*pos == ',') {
+            ++pos;
+        }
+    }
+    return end - json;
+}
@@ -14,10 +14,12 @@
  */
 #include "olm/cipher.h"
 #include "olm/crypto.h"
+#include "olm/iovec_internal.h"
 #include "olm/memory.hh"
+#include "olm/trace_internal.h"
 #include <cstring>
 
-const std::size_t HMAC_KEY_LENGTH = 32;
+const std::size_t HMAC_KEY_LENGTH = OLM_CIPHER_AES_SHA_256_MAC_KEY_LENGTH;
 
 namespace {
 
@@ -28,37 +30,47 @@ struct DerivedKeys {
 };
 
 
+static const std::size_t DERIVED_SECRETS_LENGTH =
+    AES256_KEY_LENGTH + HMAC_KEY_LENGTH + AES256_IV_LENGTH;
+
+
+static void load_derived_keys(
+    std::uint8_t const * derived_secrets,
+    DerivedKeys & keys
+) {
+    std::uint8_t const * pos = derived_secrets;
+    pos = olm::load_array(keys.aes_key.key, pos);
+    pos = olm::load_array(keys.mac_key, pos);
+    pos = olm::load_array(keys.aes_iv.iv, pos);
+}
+
+
 static void derive_keys(
     std::uint8_t const * kdf_info, std::size_t kdf_info_length,
     std::uint8_t const * key, std::size_t key_length,
     DerivedKeys & keys
 ) {
-    std::uint8_t derived_secrets[
-        AES256_KEY_LENGTH + HMAC_KEY_LENGTH + AES256_IV_LENGTH
-    ];
+    std::uint8_t derived_secrets[DERIVED_SECRETS_LENGTH];
     _olm_crypto_hkdf_sha256(
         key, key_length,
         nullptr, 0,
         kdf_info, kdf_info_length,
         derived_secrets, sizeof(derived_secrets)
     );
-    std::uint8_t const * pos = derived_secrets;
-    pos = olm::load_array(keys.aes_key.key, pos);
-    pos = olm::load_array(keys.mac_key, pos);
-    pos = olm::load_array(keys.aes_iv.iv, pos);
+    load_derived_keys(derived_secrets, keys);
     olm::unset(derived_secrets);
 }
 
-static const std::size_t MAC_LENGTH = 8;
+static const std::size_t MAC_LENGTH = OLM_CIPHER_AES_SHA_256_MAC_LENGTH;
 
 size_t aes_sha_256_cipher_mac_length(const struct _olm_cipher *cipher) {
-    return MAC_LENGTH;
+    return _olm_cipher_aes_sha_256_mac_length();
 }
 
 size_t aes_sha_256_cipher_encrypt_ciphertext_length(
         const struct _olm_cipher *cipher, size_t plaintext_length
 ) {
-    return _olm_crypto_aes_encrypt_cbc_length(plaintext_length);
+    return _olm_cipher_aes_sha_256_ciphertext_length(plaintext_length);
 }
 
 size_t aes_sha_256_cipher_encrypt(
@@ -68,78 +80,425 @@ size_t aes_sha_256_cipher_encrypt(
     uint8_t * ciphertext, size_t ciphertext_length,
     uint8_t * output, size_t output_length
 ) {
-    auto *c = reinterpret_cast<const _olm_cipher_aes_sha_256 *>(cipher);
+    return _olm_cipher_aes_sha_256_encrypt(
+        reinterpret_cast<const _olm_cipher_aes_sha_256 *>(cipher),
+        key, key_length,
+        plaintext, plaintext_length,
+        ciphertext, ciphertext_length,
+        output, output_length
+    );
+}
 
-    if (aes_sha_256_cipher_encrypt_ciphertext_length(cipher, plaintext_length)
-            < ciphertext_length) {
-        return std::size_t(-1);
-    }
 
-    struct DerivedKeys keys;
-    std::uint8_t mac[SHA256_OUTPUT_LENGTH];
+size_t aes_sha_256_cipher_decrypt_max_plaintext_length(
+    const struct _olm_cipher *cipher,
+    size_t ciphertext_length
+) {
+    return _olm_cipher_aes_sha_256_max_plaintext_length(ciphertext_length);
+}
+
+size_t aes_sha_256_cipher_decrypt(
+    const struct _olm_cipher *cipher,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t input_length,
+    uint8_t const * ciphertext, size_t ciphertext_length,
+    uint8_t * plaintext, size_t max_plaintext_length
+) {
+    return _olm_cipher_aes_sha_256_decrypt(
+        reinterpret_cast<const _olm_cipher_aes_sha_256 *>(cipher),
+        key, key_length,
+        input, input_length,
+        ciphertext, ciphertext_length,
+        plaintext, max_plaintext_length
+    );
+}
 
-    derive_keys(c->kdf_info, c->kdf_info_length, key, key_length, keys);
+} // namespace
 
-    _olm_crypto_aes_encrypt_cbc(
-        &keys.aes_key, &keys.aes_iv, plaintext, plaintext_length, ciphertext
+const struct _olm_cipher_ops _olm_cipher_aes_sha_256_ops = {
+  aes_sha_256_cipher_mac_length,
+  aes_sha_256_cipher_encrypt_ciphertext_length,
+  aes_sha_256_cipher_encrypt,
+  aes_sha_256_cipher_decrypt_max_plaintext_length,
+  aes_sha_256_cipher_decrypt,
+};
+
+
+size_t _olm_cipher_aes_sha_256_encrypt(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * ciphertext, size_t ciphertext_length,
+    uint8_t * output, size_t output_length
+) {
+    _olm_cipher_aes_sha_256_context context;
+    _olm_cipher_aes_sha_256_init_context(cipher, key, key_length, &context);
+    std::size_t result = _olm_cipher_aes_sha_256_context_encrypt(
+        &context,
+        plaintext, plaintext_length,
+        ciphertext, ciphertext_length,
+        output, output_length
     );
+    _olm_cipher_aes_sha_256_clear_context(&context);
+    return result;
+}
+
 
-    _olm_crypto_hmac_sha256(
-        keys.mac_key, HMAC_KEY_LENGTH, output, output_length - MAC_LENGTH, mac
+size_t _olm_cipher_aes_sha_256_decrypt(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t input_length,
+    uint8_t const * ciphertext, size_t ciphertext_length,
+    uint8_t * plaintext, size_t max_plaintext_length
+) {
+    _olm_cipher_aes_sha_256_context context;
+    _olm_cipher_aes_sha_256_init_context(cipher, key, key_length, &context);
+    std::size_t result = _olm_cipher_aes_sha_256_context_decrypt(
+        &context,
+        input, input_length,
+        ciphertext, ciphertext_length,
+        plaintext, max_plaintext_length
     );
+    _olm_cipher_aes_sha_256_clear_context(&context);
+    return result;
+}
 
-    std::memcpy(output + output_length - MAC_LENGTH, mac, MAC_LENGTH);
 
+void _olm_cipher_aes_sha_256_init_context(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * key, size_t key_length,
+    struct _olm_cipher_aes_sha_256_context *context
+) {
+    DerivedKeys keys;
+    derive_keys(cipher->kdf_info, cipher->kdf_info_length, key, key_length, keys);
+    _olm_crypto_aes_key_setup(&keys.aes_key, &context->aes_key_schedule);
+    _olm_crypto_hmac_sha256_init_key(
+        &context->mac_key, keys.mac_key, HMAC_KEY_LENGTH
+    );
+    context->aes_iv = keys.aes_iv;
     olm::unset(keys);
-    return output_length;
 }
 
 
-size_t aes_sha_256_cipher_decrypt_max_plaintext_length(
-    const struct _olm_cipher *cipher,
-    size_t ciphertext_length
+void _olm_cipher_aes_sha_256_init_context_multi(
+    const struct _olm_cipher_aes_sha_256 *cipher,
+    uint8_t const * const * keys, size_t key_length,
+    struct _olm_cipher_aes_sha_256_context * const * contexts,
+    size_t count
 ) {
-    return ciphertext_length;
+    std::uint8_t derived[OLM_CRYPTO_SHA256_MAX_LANES][DERIVED_SECRETS_LENGTH];
+    std::uint8_t * derived_ptrs[OLM_CRYPTO_SHA256_MAX_LANES];
+    std::uint8_t const * mac_keys[OLM_CRYPTO_SHA256_MAX_LANES];
+    _olm_hmac_sha256_key * mac_key_ptrs[OLM_CRYPTO_SHA256_MAX_LANES];
+    DerivedKeys lane_keys;
+
+    while (count) {
+        std::size_t n = count < OLM_CRYPTO_SHA256_MAX_LANES
+            ? count : OLM_CRYPTO_SHA256_MAX_LANES;
+        for (std::size_t i = 0; i < n; ++i) {
+            derived_ptrs[i] = derived[i];
+            mac_keys[i] = derived[i] + AES256_KEY_LENGTH;
+            mac_key_ptrs[i] = &contexts[i]->mac_key;
+        }
+        _olm_crypto_hkdf_sha256_multi(
+            keys, key_length,
+            nullptr, 0,
+            cipher->kdf_info, cipher->kdf_info_length,
+            derived_ptrs, DERIVED_SECRETS_LENGTH, n
+        );
+        _olm_crypto_hmac_sha256_init_key_multi(
+            mac_key_ptrs, mac_keys, HMAC_KEY_LENGTH, n
+        );
+        for (std::size_t i = 0; i < n; ++i) {
+            load_derived_keys(derived[i], lane_keys);
+            _olm_crypto_aes_key_setup(
+                &lane_keys.aes_key, &contexts[i]->aes_key_schedule
+            );
+            contexts[i]->aes_iv = lane_keys.aes_iv;
+        }
+        keys += n;
+        contexts += n;
+        count -= n;
+    }
+    olm::unset(derived);
+    olm::unset(lane_keys);
 }
 
-size_t aes_sha_256_cipher_decrypt(
-    const struct _olm_cipher *cipher,
-    uint8_t const * key, size_t key_length,
+
+void _olm_cipher_aes_sha_256_clear_context(
+    struct _olm_cipher_aes_sha_256_context *context
+) {
+    olm::unset(*context);
+}
+
+
+size_t _olm_cipher_aes_sha_256_context_encrypt(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * ciphertext, size_t ciphertext_length,
+    uint8_t * output, size_t output_length
+) {
+    olm::TraceScope trace(OLM_TRACE_CIPHER_ENCRYPT);
+    if (_olm_crypto_aes_encrypt_cbc_length(plaintext_length)
+            < ciphertext_length) {
+        return std::size_t(-1);
+    }
+
+    std::uint8_t mac[SHA256_OUTPUT_LENGTH];
+
+    _olm_crypto_aes_encrypt_cbc_then_hmac_sha256(
+        &context->aes_key_schedule, &context->aes_iv, &context->mac_key,
+        plaintext, plaintext_length,
+        output, output_length - MAC_LENGTH,
+        ciphertext, mac
+    );
+
+    std::memcpy(output + output_length - MAC_LENGTH, mac, MAC_LENGTH);
+    olm::unset(mac);
+
+    return output_length;
+}
+
+
+size_t _olm_cipher_aes_sha_256_context_decrypt(
+    const struct _olm_cipher_aes_sha_256_context *context,
     uint8_t const * input, size_t input_length,
     uint8_t const * ciphertext, size_t ciphertext_length,
     uint8_t * plaintext, size_t max_plaintext_length
 ) {
-    auto *c = reinterpret_cast<const _olm_cipher_aes_sha_256 *>(cipher);
+    olm::TraceScope trace(OLM_TRACE_CIPHER_DECRYPT);
+    return _olm_crypto_hmac_sha256_then_aes_decrypt_cbc(
+        &context->aes_key_schedule, &context->aes_iv, &context->mac_key,
+        input, input_length - MAC_LENGTH,
+        ciphertext, ciphertext_length,
+        input + input_length - MAC_LENGTH, MAC_LENGTH,
+        plaintext
+    );
+}
 
-    DerivedKeys keys;
-    std::uint8_t mac[SHA256_OUTPUT_LENGTH];
 
-    derive_keys(c->kdf_info, c->kdf_info_length, key, key_length, keys);
+void _olm_cipher_aes_sha_256_encrypt_stream_begin(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * mac_prefix, size_t mac_prefix_length
+) {
+    stream->keys = *context;
+    std::memcpy(stream->chain, context->aes_iv.iv, AES256_IV_LENGTH);
+    stream->block_length = 0;
+    _olm_crypto_hmac_sha256_begin(&stream->keys.mac_key, &stream->mac);
+    _olm_crypto_hmac_sha256_update(
+        &stream->mac, mac_prefix, mac_prefix_length
+    );
+}
+
+
+size_t _olm_cipher_aes_sha_256_encrypt_stream_update(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * ciphertext
+) {
+    std::uint8_t * pos = ciphertext;
+
+    /* finish off the block left over from last time */
+    if (stream->block_length) {
+        std::size_t fill = AES256_IV_LENGTH - stream->block_length;
+        if (plaintext_length < fill) {
+            std::memcpy(
+                stream->block + stream->block_length,
+                plaintext, plaintext_length
+            );
+            stream->block_length += plaintext_length;
+            return 0;
+        }
+        std::memcpy(stream->block + stream->block_length, plaintext, fill);
+        _olm_crypto_aes_encrypt_cbc_blocks(
+            &stream->keys.aes_key_schedule, stream->chain,
+            stream->block, 1, pos
+        );
+        pos += AES256_IV_LENGTH;
+        plaintext += fill;
+        plaintext_length -= fill;
+        stream->block_length = 0;
+    }
 
-    _olm_crypto_hmac_sha256(
-        keys.mac_key, HMAC_KEY_LENGTH, input, input_length - MAC_LENGTH, mac
+    std::size_t blocks = plaintext_length / AES256_IV_LENGTH;
+    _olm_crypto_aes_encrypt_cbc_blocks(
+        &stream->keys.aes_key_schedule, stream->chain,
+        plaintext, blocks, pos
+    );
+    pos += blocks * AES256_IV_LENGTH;
+    stream->block_length = plaintext_length % AES256_IV_LENGTH;
+    std::memcpy(
+        stream->block, plaintext + blocks * AES256_IV_LENGTH,
+        stream->block_length
     );
 
-    std::uint8_t const * input_mac = input + input_length - MAC_LENGTH;
-    if (!olm::is_equal(input_mac, mac, MAC_LENGTH)) {
-        olm::unset(keys);
-        return std::size_t(-1);
+    _olm_crypto_hmac_sha256_update(&stream->mac, ciphertext, pos - ciphertext);
+    return pos - ciphertext;
+}
+
+
+size_t _olm_cipher_aes_sha_256_encrypt_stream_end(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t * ciphertext, uint8_t * mac
+) {
+    std::uint8_t full_mac[SHA256_OUTPUT_LENGTH];
+    std::size_t padding = AES256_IV_LENGTH - stream->block_length;
+
+    std::memset(stream->block + stream->block_length, padding, padding);
+    _olm_crypto_aes_encrypt_cbc_blocks(
+        &stream->keys.aes_key_schedule, stream->chain,
+        stream->block, 1, ciphertext
+    );
+    _olm_crypto_hmac_sha256_update(&stream->mac, ciphertext, AES256_IV_LENGTH);
+    _olm_crypto_hmac_sha256_end(&stream->keys.mac_key, &stream->mac, full_mac);
+    std::memcpy(mac, full_mac, MAC_LENGTH);
+
+    olm::unset(full_mac);
+    olm::unset(*stream);
+    return AES256_IV_LENGTH;
+}
+
+
+size_t _olm_cipher_aes_sha_256_context_verify(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    uint8_t const * input, size_t input_length,
+    size_t ciphertext_length
+) {
+    std::uint8_t mac[SHA256_OUTPUT_LENGTH];
+    std::size_t result = std::size_t(-1);
+
+    if (input_length < MAC_LENGTH) {
+        return result;
     }
+    _olm_crypto_hmac_sha256_with_key(
+        &context->mac_key, input, input_length - MAC_LENGTH, mac
+    );
+    if (olm::is_equal(input + input_length - MAC_LENGTH, mac, MAC_LENGTH)
+            && ciphertext_length % AES256_IV_LENGTH == 0
+            && ciphertext_length != 0) {
+        result = 0;
+    }
+    olm::unset(mac);
+    return result;
+}
 
-    std::size_t plaintext_length = _olm_crypto_aes_decrypt_cbc(
-        &keys.aes_key, &keys.aes_iv, ciphertext, ciphertext_length, plaintext
+
+size_t _olm_cipher_aes_sha_256_context_verify_segments(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    const OlmIovec * segments, size_t segment_count, size_t input_length,
+    size_t ciphertext_length
+) {
+    _olm_hmac_sha256_context hmac;
+    _olm_iovec_cursor cursor;
+    std::uint8_t mac[SHA256_OUTPUT_LENGTH];
+    std::uint8_t their_mac[MAC_LENGTH];
+    std::size_t remaining;
+    std::size_t result = std::size_t(-1);
+
+    if (input_length < MAC_LENGTH) {
+        return result;
+    }
+    _olm_iovec_cursor_init(&cursor, segments, segment_count);
+    _olm_crypto_hmac_sha256_begin(&context->mac_key, &hmac);
+    remaining = input_length - MAC_LENGTH;
+    while (remaining) {
+        std::size_t available;
+        std::uint8_t const * pos = _olm_iovec_cursor_peek(&cursor, &available);
+        if (!available) {
+            break;
+        }
+        if (available > remaining) {
+            available = remaining;
+        }
+        _olm_crypto_hmac_sha256_update(&hmac, pos, available);
+        _olm_iovec_cursor_skip(&cursor, available);
+        remaining -= available;
+    }
+    _olm_crypto_hmac_sha256_end(&context->mac_key, &hmac, mac);
+    _olm_iovec_cursor_read(&cursor, their_mac, MAC_LENGTH);
+
+    if (!remaining
+            && olm::is_equal(their_mac, mac, MAC_LENGTH)
+            && ciphertext_length % AES256_IV_LENGTH == 0
+            && ciphertext_length != 0) {
+        result = 0;
+    }
+    olm::unset(mac);
+    olm::unset(hmac);
+    return result;
+}
+
+
+void _olm_cipher_aes_sha_256_decrypt_stream_begin(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    struct _olm_cipher_aes_sha_256_stream *stream
+) {
+    stream->keys = *context;
+    std::memcpy(stream->chain, context->aes_iv.iv, AES256_IV_LENGTH);
+    stream->block_length = 0;
+}
+
+
+void _olm_cipher_aes_sha_256_decrypt_stream_begin_with_mac(
+    const struct _olm_cipher_aes_sha_256_context *context,
+    struct _olm_cipher_aes_sha_256_stream *stream
+) {
+    _olm_cipher_aes_sha_256_decrypt_stream_begin(context, stream);
+    _olm_crypto_hmac_sha256_begin(&stream->keys.mac_key, &stream->mac);
+}
+
+
+void _olm_cipher_aes_sha_256_decrypt_stream_mac(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * ciphertext, size_t ciphertext_length
+) {
+    _olm_crypto_hmac_sha256_update(
+        &stream->mac, ciphertext, ciphertext_length
     );
+}
 
-    olm::unset(keys);
-    return plaintext_length;
+
+size_t _olm_cipher_aes_sha_256_decrypt_stream_verify(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * mac
+) {
+    std::uint8_t full_mac[SHA256_OUTPUT_LENGTH];
+    _olm_crypto_hmac_sha256_end(&stream->keys.mac_key, &stream->mac, full_mac);
+    std::size_t result = olm::is_equal(mac, full_mac, MAC_LENGTH)
+        ? 0 : std::size_t(-1);
+    olm::unset(full_mac);
+    return result;
 }
 
-} // namespace
 
-const struct _olm_cipher_ops _olm_cipher_aes_sha_256_ops = {
-  aes_sha_256_cipher_mac_length,
-  aes_sha_256_cipher_encrypt_ciphertext_length,
-  aes_sha_256_cipher_encrypt,
-  aes_sha_256_cipher_decrypt_max_plaintext_length,
-  aes_sha_256_cipher_decrypt,
-};
+void _olm_cipher_aes_sha_256_decrypt_stream_update(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * ciphertext, size_t block_count,
+    uint8_t * output
+) {
+    _olm_crypto_aes_decrypt_cbc_blocks(
+        &stream->keys.aes_key_schedule, stream->chain,
+        ciphertext, block_count, output
+    );
+}
+
+
+size_t _olm_cipher_aes_sha_256_decrypt_stream_end(
+    struct _olm_cipher_aes_sha_256_stream *stream,
+    uint8_t const * ciphertext, uint8_t * output
+) {
+    _olm_crypto_aes_decrypt_cbc_blocks(
+        &stream->keys.aes_key_schedule, stream->chain, ciphertext, 1, output
+    );
+    olm::unset(*stream);
+    /* as with _olm_crypto_aes_decrypt_cbc, a zero length pad is allowed. A
+     * pad longer than a block would take back plaintext we have already
+     * returned, so isn't */
+    std::size_t padding = output[AES256_IV_LENGTH - 1];
+    if (padding > AES256_IV_LENGTH) {
+        olm::unset(output, AES256_IV_LENGTH);
+        return std::size_t(-1);
+    }
+    return AES256_IV_LENGTH - padding;
+}
@@ -0,0 +1,131 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__aarch64__) && defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__arm__) && defined(__ANDROID__)
+/* getauxval needs API level 18, so use the NDK's cpufeatures library */
+#include <cpu-features.h>
+#elif defined(__arm__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+static uint32_t cpu_features;
+static uint32_t cpu_feature_mask = ~0u;
+static int cpu_features_probed;
+
+static uint32_t probe_cpu_features(void) {
+    uint32_t features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        unsigned int ssse3_sse41 = ecx & (bit_SSSE3 | bit_SSE4_1);
+        /* the OS has to save the YMM registers for us to use AVX2 */
+        int ymm_enabled = 0;
+        if ((ecx & (bit_OSXSAVE | bit_AVX)) == (bit_OSXSAVE | bit_AVX)) {
+            unsigned int xcr0_low, xcr0_high;
+            __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+            ymm_enabled = (xcr0_low & 6) == 6;
+        }
+        if (ecx & bit_AES) {
+            features |= OLM_CPU_FEATURE_AES;
+        }
+        if (ecx & bit_SSSE3) {
+            features |= OLM_CPU_FEATURE_SIMD128;
+        }
+        if (ecx & bit_PCLMUL) {
+            features |= OLM_CPU_FEATURE_CLMUL;
+        }
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            /* the SHA-NI kernel also needs the byte shuffles from SSSE3 and
+             * the blends from SSE4.1 */
+            if (ssse3_sse41 == (bit_SSSE3 | bit_SSE4_1) && (ebx & bit_SHA)) {
+                features |= OLM_CPU_FEATURE_SHA256;
+            }
+            if (ymm_enabled && (ebx & bit_AVX2)) {
+                features |= OLM_CPU_FEATURE_AVX2;
+            }
+        }
+    }
+#elif defined(__aarch64__) && defined(__linux__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    features |= OLM_CPU_FEATURE_SIMD128;
+    if (hwcap & HWCAP_AES) {
+        features |= OLM_CPU_FEATURE_AES;
+    }
+    if (hwcap & HWCAP_SHA2) {
+        features |= OLM_CPU_FEATURE_SHA256;
+    }
+    if (hwcap & HWCAP_PMULL) {
+        features |= OLM_CPU_FEATURE_CLMUL;
+    }
+#ifdef HWCAP_SHA512
+    if (hwcap & HWCAP_SHA512) {
+        features |= OLM_CPU_FEATURE_SHA512;
+    }
+#endif
+#elif defined(__aarch64__) && defined(__APPLE__)
+    /* every 64-bit Apple CPU has the ARMv8 Crypto Extensions */
+    features |= OLM_CPU_FEATURE_AES | OLM_CPU_FEATURE_SHA256
+        | OLM_CPU_FEATURE_SIMD128 | OLM_CPU_FEATURE_CLMUL;
+    /* but only the later ones have the ARMv8.2 SHA-512 instructions */
+    {
+        int sha512 = 0;
+        size_t size = sizeof(sha512);
+        if (sysctlbyname(
+                "hw.optional.armv8_2_sha512", &sha512, &size, NULL, 0
+            ) == 0 && sha512) {
+            features |= OLM_CPU_FEATURE_SHA512;
+        }
+    }
+#elif defined(__arm__) && defined(__ANDROID__)
+    /* NEON is optional on ARMv7 */
+    if (android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM
+            && (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON)) {
+        features |= OLM_CPU_FEATURE_SIMD128;
+    }
+#elif defined(__arm__) && defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+        features |= OLM_CPU_FEATURE_SIMD128;
+    }
+#elif defined(__wasm_simd128__)
+    /* WebAssembly SIMD is chosen when building: a runtime without it
+     * refuses to load the module at all */
+    features |= OLM_CPU_FEATURE_SIMD128;
+#endif
+    return features;
+}
+
+uint32_t _olm_cpu_features(void) {
+    /* probing is idempotent, so it doesn't matter if two threads race to do
+     * it the first time round. */
+    if (!cpu_features_probed) {
+        cpu_features = probe_cpu_features();
+        cpu_features_probed = 1;
+    }
+    return cpu_features & cpu_feature_mask;
+}
+
+void _olm_cpu_set_feature_mask(uint32_t mask) {
+    cpu_feature_mask = mask;
+}
@@ -13,28 +13,44 @@
  * limitations under the License.
  */
 #include "olm/crypto.h"
+#include "olm/aes_ct.h"
+#include "olm/aes_hw.h"
+#include "olm/dispatch.h"
 #include "olm/memory.hh"
+#include "olm/sha256_mb.h"
+#include "olm/stats_internal.h"
 
+#include <cstddef>
 #include <cstring>
 
 extern "C" {
 
-#include "crypto-algorithms/aes.h"
 #include "crypto-algorithms/sha256.h"
 
 }
 
 #include "ed25519/src/ed25519.h"
-#include "curve25519-donna.h"
+#include "olm/curve25519.h"
 
 namespace {
 
-static const std::uint8_t CURVE25519_BASEPOINT[32] = {9};
-static const std::size_t AES_KEY_SCHEDULE_LENGTH = 60;
-static const std::size_t AES_KEY_BITS = 8 * AES256_KEY_LENGTH;
 static const std::size_t AES_BLOCK_LENGTH = 16;
 static const std::size_t SHA256_BLOCK_LENGTH = 64;
-static const std::uint8_t HKDF_DEFAULT_SALT[32] = {};
+
+/** The default HKDF salt of 32 zero bytes, as a prepared HMAC key. Every
+ * aes_sha_256 cipher and the initial Olm ratchet derivation use it, so its
+ * padding is compressed ahead of time. "HDKF Test Case 2" in
+ * tests/test_crypto.cpp checks these values. */
+static const _olm_hmac_sha256_key HKDF_DEFAULT_SALT_KEY = {
+    {
+        0xf454dead, 0x9725214f, 0x90daf2a0, 0xdf1228ea,
+        0x64e5750f, 0xa3924181, 0x824a932b, 0xf8e04e32,
+    },
+    {
+        0xd385480f, 0x7abb6477, 0x37c9c538, 0x5dd82467,
+        0x8e043a72, 0x753434b0, 0xdeb82818, 0x361d45a6,
+    },
+};
 
 
 template<std::size_t block_size>
@@ -48,6 +64,80 @@ inline static void xor_block(
 }
 
 
+/** Run the SHA-256 compression function over whole blocks, using the CPU's
+ * SHA instructions if the dispatch table says it has them */
+static void sha256_blocks(
+    ::SHA256_CTX * context,
+    std::uint8_t const * blocks, std::size_t block_count
+) {
+    OLM_STATS_ADD(sha256_blocks, block_count);
+    _olm_crypto_dispatch()->sha256_transform(
+        context->state, blocks, block_count
+    );
+    context->bitlen += 8 * SHA256_BLOCK_LENGTH * block_count;
+}
+
+
+/** As ::sha256_update, but hashing whole blocks straight from the input
+ * rather than copying it through the context a byte at a time */
+static void sha256_hash_update(
+    ::SHA256_CTX * context,
+    std::uint8_t const * input, std::size_t input_length
+) {
+    if (!input_length) {
+        /* an empty message may come with a null input, which memcpy mustn't
+         * be given */
+        return;
+    }
+    if (context->datalen) {
+        std::size_t fill = SHA256_BLOCK_LENGTH - context->datalen;
+        if (input_length < fill) {
+            std::memcpy(context->data + context->datalen, input, input_length);
+            context->datalen += input_length;
+            return;
+        }
+        std::memcpy(context->data + context->datalen, input, fill);
+        sha256_blocks(context, context->data, 1);
+        context->datalen = 0;
+        input += fill;
+        input_length -= fill;
+    }
+    std::size_t block_count = input_length / SHA256_BLOCK_LENGTH;
+    sha256_blocks(context, input, block_count);
+    input += block_count * SHA256_BLOCK_LENGTH;
+    input_length -= block_count * SHA256_BLOCK_LENGTH;
+    std::memcpy(context->data, input, input_length);
+    context->datalen = input_length;
+}
+
+
+/** As ::sha256_final, but using sha256_blocks for the compression */
+static void sha256_hash_final(
+    ::SHA256_CTX * context,
+    std::uint8_t * output
+) {
+    std::uint64_t bit_length = context->bitlen + 8 * context->datalen;
+    std::size_t i = context->datalen;
+    context->data[i++] = 0x80;
+    if (i > SHA256_BLOCK_LENGTH - 8) {
+        std::memset(context->data + i, 0, SHA256_BLOCK_LENGTH - i);
+        sha256_blocks(context, context->data, 1);
+        i = 0;
+    }
+    std::memset(context->data + i, 0, SHA256_BLOCK_LENGTH - 8 - i);
+    for (i = 0; i < 8; ++i) {
+        context->data[SHA256_BLOCK_LENGTH - 1 - i] = bit_length >> (8 * i);
+    }
+    sha256_blocks(context, context->data, 1);
+    for (i = 0; i < 8; ++i) {
+        output[4 * i]     = context->state[i] >> 24;
+        output[4 * i + 1] = context->state[i] >> 16;
+        output[4 * i + 2] = context->state[i] >> 8;
+        output[4 * i + 3] = context->state[i];
+    }
+}
+
+
 inline static void hmac_sha256_key(
     std::uint8_t const * input_key, std::size_t input_key_length,
     std::uint8_t * hmac_key
@@ -56,72 +146,470 @@ inline static void hmac_sha256_key(
     if (input_key_length > SHA256_BLOCK_LENGTH) {
         ::SHA256_CTX context;
         ::sha256_init(&context);
-        ::sha256_update(&context, input_key, input_key_length);
-        ::sha256_final(&context, hmac_key);
+        sha256_hash_update(&context, input_key, input_key_length);
+        sha256_hash_final(&context, hmac_key);
     } else {
         std::memcpy(hmac_key, input_key, input_key_length);
     }
 }
 
 
-inline static void hmac_sha256_init(
+/** Start an HMAC from a prepared key. The input is added with
+ * sha256_hash_update. */
+inline static void hmac_sha256_start(
     ::SHA256_CTX * context,
-    std::uint8_t const * hmac_key
+    _olm_hmac_sha256_key const * hmac_key
 ) {
-    std::uint8_t i_pad[SHA256_BLOCK_LENGTH];
-    std::memcpy(i_pad, hmac_key, SHA256_BLOCK_LENGTH);
-    for (std::size_t i = 0; i < SHA256_BLOCK_LENGTH; ++i) {
-        i_pad[i] ^= 0x36;
-    }
-    ::sha256_init(context);
-    ::sha256_update(context, i_pad, SHA256_BLOCK_LENGTH);
-    olm::unset(i_pad);
+    context->datalen = 0;
+    context->bitlen = 8 * SHA256_BLOCK_LENGTH;
+    std::memcpy(context->state, hmac_key->inner_state, sizeof(context->state));
 }
 
 
-inline static void hmac_sha256_final(
+/** Finish an HMAC started with hmac_sha256_start */
+static void hmac_sha256_finish(
     ::SHA256_CTX * context,
-    std::uint8_t const * hmac_key,
+    _olm_hmac_sha256_key const * hmac_key,
     std::uint8_t * output
 ) {
-    std::uint8_t o_pad[SHA256_BLOCK_LENGTH + SHA256_OUTPUT_LENGTH];
-    std::memcpy(o_pad, hmac_key, SHA256_BLOCK_LENGTH);
-    for (std::size_t i = 0; i < SHA256_BLOCK_LENGTH; ++i) {
-        o_pad[i] ^= 0x5C;
+    std::uint8_t inner_hash[SHA256_OUTPUT_LENGTH];
+    OLM_STATS_ADD(hmac_sha256, 1);
+    sha256_hash_final(context, inner_hash);
+
+    context->datalen = 0;
+    context->bitlen = 8 * SHA256_BLOCK_LENGTH;
+    std::memcpy(context->state, hmac_key->outer_state, sizeof(context->state));
+    sha256_hash_update(context, inner_hash, sizeof(inner_hash));
+    sha256_hash_final(context, output);
+
+    olm::unset(inner_hash);
+}
+
+
+/** The crypto provider to pass the blocks of a schedule to: NULL unless the
+ * schedule was set up for one and there still is one */
+static OlmCryptoProvider const * aes_provider(
+    _olm_aes256_key_schedule const * schedule
+) {
+    if (!schedule->provider) {
+        return nullptr;
+    }
+    OlmCryptoProvider const * provider = _olm_crypto_dispatch()->provider;
+    return provider && provider->aes256_cbc ? provider : nullptr;
+}
+
+
+/** CBC-encrypt whole blocks. chain holds the IV, and is updated to the last
+ * output block so that further blocks can be chained on. */
+static void aes_encrypt_cbc_blocks(
+    _olm_aes256_key_schedule const * schedule,
+    std::uint8_t * chain,
+    std::uint8_t const * input, std::size_t block_count,
+    std::uint8_t * output
+) {
+    OLM_STATS_ADD(aes_blocks, block_count);
+    if (OlmCryptoProvider const * provider = aes_provider(schedule)) {
+        provider->aes256_cbc(
+            provider->context, schedule->key, chain,
+            input, block_count * AES_BLOCK_LENGTH, output, 1
+        );
+        return;
+    }
+    if (schedule->hardware) {
+        _olm_aes_hw_encrypt_cbc(
+            schedule->encrypt_round_keys, chain, input, block_count, output
+        );
+        return;
+    }
+    _olm_aes_ct_encrypt_cbc(
+        schedule->ct_round_keys, chain, input, block_count, output
+    );
+}
+
+
+/** Pad the last partial block of input with PKCS#7 and CBC-encrypt it */
+static void aes_encrypt_cbc_final(
+    _olm_aes256_key_schedule const * schedule,
+    std::uint8_t * chain,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output
+) {
+    std::uint8_t last_block[AES_BLOCK_LENGTH];
+    if (input_length) {
+        /* the input may be null when the last block is only padding */
+        std::memcpy(last_block, input, input_length);
+    }
+    std::memset(
+        last_block + input_length, AES_BLOCK_LENGTH - input_length,
+        AES_BLOCK_LENGTH - input_length
+    );
+    aes_encrypt_cbc_blocks(schedule, chain, last_block, 1, output);
+    olm::unset(last_block);
+}
+
+
+/** CBC-decrypt whole blocks. chain holds the IV, and is updated to the last
+ * input block so that further blocks can be chained on. The input and output
+ * may be the same buffer. */
+static void aes_decrypt_cbc_blocks(
+    _olm_aes256_key_schedule const * schedule,
+    std::uint8_t * chain,
+    std::uint8_t const * input, std::size_t block_count,
+    std::uint8_t * output
+) {
+    OLM_STATS_ADD(aes_blocks, block_count);
+    if (OlmCryptoProvider const * provider = aes_provider(schedule)) {
+        provider->aes256_cbc(
+            provider->context, schedule->key, chain,
+            input, block_count * AES_BLOCK_LENGTH, output, 0
+        );
+        return;
+    }
+    if (schedule->hardware) {
+        _olm_aes_hw_decrypt_cbc(
+            schedule->decrypt_round_keys, chain, input, block_count, output
+        );
+        return;
+    }
+    _olm_aes_ct_decrypt_cbc(
+        schedule->ct_round_keys, chain, input, block_count, output
+    );
+}
+
+
+/** Strip the PKCS#7 padding from a decrypted message */
+static std::size_t aes_cbc_unpad(
+    std::uint8_t const * output, std::size_t output_length
+) {
+    std::size_t padding = output[output_length - 1];
+    return (padding > output_length) ?
+        std::size_t(-1) : (output_length - padding);
+}
+
+/** Encrypt blocks on their own with whichever kernels the schedule is for */
+static void aes_encrypt_blocks(
+    _olm_aes256_key_schedule const * schedule,
+    std::uint8_t const * input, std::size_t block_count,
+    std::uint8_t * output
+) {
+    OlmCryptoProvider const * provider = aes_provider(schedule);
+    if (provider || schedule->hardware) {
+        /* one block of CBC from a zero IV is the block cipher on its own */
+        for (std::size_t i = 0; i < block_count; ++i) {
+            std::uint8_t chain[AES_BLOCK_LENGTH] = {};
+            if (provider) {
+                provider->aes256_cbc(
+                    provider->context, schedule->key, chain,
+                    input + i * AES_BLOCK_LENGTH, AES_BLOCK_LENGTH,
+                    output + i * AES_BLOCK_LENGTH, 1
+                );
+            } else {
+                _olm_aes_hw_encrypt_cbc(
+                    schedule->encrypt_round_keys, chain,
+                    input + i * AES_BLOCK_LENGTH, 1,
+                    output + i * AES_BLOCK_LENGTH
+                );
+            }
+            olm::unset(chain);
+        }
+    } else {
+        _olm_aes_ct_encrypt_blocks(
+            schedule->ct_round_keys, input, block_count, output
+        );
+    }
+}
+
+
+static std::uint64_t load_big_endian_64(std::uint8_t const * input) {
+    std::uint64_t value = 0;
+    for (unsigned i = 0; i < 8; ++i) {
+        value = (value << 8) | input[i];
+    }
+    return value;
+}
+
+
+static void store_big_endian_64(std::uint64_t value, std::uint8_t * output) {
+    for (unsigned i = 0; i < 8; ++i) {
+        output[i] = std::uint8_t(value >> (56 - 8 * i));
+    }
+}
+
+
+/** Multiply x by y in GF(2^128), one bit of x at a time as in the GCM
+ * specification. Masks rather than branches keep the time the same whatever
+ * the values. */
+static void gf128_mul(std::uint64_t x[2], std::uint64_t const y[2]) {
+    std::uint64_t z_high = 0, z_low = 0;
+    std::uint64_t v_high = y[0], v_low = y[1];
+    for (unsigned i = 0; i < 128; ++i) {
+        std::uint64_t word = i < 64 ? x[0] : x[1];
+        std::uint64_t mask = 0 - ((word >> (63 - i % 64)) & 1);
+        z_high ^= v_high & mask;
+        z_low ^= v_low & mask;
+        std::uint64_t reduce = 0 - (v_low & 1);
+        v_low = (v_low >> 1) | (v_high << 63);
+        v_high = (v_high >> 1) ^ (0xe100000000000000ULL & reduce);
+    }
+    x[0] = z_high;
+    x[1] = z_low;
+}
+
+
+/** GHASH whole blocks into state, as _olm_aes_hw_ghash */
+static void ghash_blocks(
+    _olm_aes_gcm_key const * key,
+    std::uint8_t * state,
+    std::uint8_t const * input, std::size_t block_count
+) {
+    if (key->hardware) {
+        _olm_aes_hw_ghash(key->hash_key, state, input, block_count);
+        return;
+    }
+    std::uint64_t const h[2] = {
+        load_big_endian_64(key->hash_key),
+        load_big_endian_64(key->hash_key + 8),
+    };
+    std::uint64_t x[2] = {
+        load_big_endian_64(state), load_big_endian_64(state + 8),
+    };
+    for (std::size_t i = 0; i < block_count; ++i) {
+        x[0] ^= load_big_endian_64(input);
+        x[1] ^= load_big_endian_64(input + 8);
+        gf128_mul(x, h);
+        input += AES_BLOCK_LENGTH;
+    }
+    store_big_endian_64(x[0], state);
+    store_big_endian_64(x[1], state + 8);
+    olm::unset(x);
+}
+
+
+/** GHASH the input, with its last partial block padded with zeros */
+static void ghash_padded(
+    _olm_aes_gcm_key const * key,
+    std::uint8_t * state,
+    std::uint8_t const * input, std::size_t input_length
+) {
+    std::size_t blocks = input_length / AES_BLOCK_LENGTH;
+    std::size_t remainder = input_length % AES_BLOCK_LENGTH;
+    ghash_blocks(key, state, input, blocks);
+    if (remainder) {
+        std::uint8_t block[AES_BLOCK_LENGTH] = {};
+        std::memcpy(block, input + blocks * AES_BLOCK_LENGTH, remainder);
+        ghash_blocks(key, state, block, 1);
+        olm::unset(block);
+    }
+}
+
+
+/** Add one to the 32 bit big-endian counter at the end of the block */
+static void gcm_increment(std::uint8_t * counter) {
+    for (unsigned i = AES_BLOCK_LENGTH; i-- > AES_BLOCK_LENGTH - 4;) {
+        if (++counter[i]) {
+            break;
+        }
+    }
+}
+
+
+static const std::size_t GCM_PARALLEL_BLOCKS = 4;
+
+/** Encrypt or decrypt whole blocks in counter mode, GHASHing the ciphertext
+ * into state as we go, as the _olm_aes_hw_gcm_* kernels do. */
+static void gcm_crypt_blocks(
+    _olm_aes_gcm_key const * key,
+    std::uint8_t * counter,
+    std::uint8_t * state,
+    std::uint8_t const * input, std::size_t block_count,
+    std::uint8_t * output,
+    bool decrypt
+) {
+    OLM_STATS_ADD(aes_blocks, block_count);
+    if (key->hardware) {
+        (decrypt ? _olm_aes_hw_gcm_decrypt : _olm_aes_hw_gcm_encrypt)(
+            key->schedule.encrypt_round_keys, key->hash_key,
+            counter, state, input, block_count, output
+        );
+        return;
+    }
+    /* the bitsliced kernels do GCM_PARALLEL_BLOCKS blocks for the price of
+     * one, so work out the key stream that many blocks at a time */
+    std::uint8_t counters[GCM_PARALLEL_BLOCKS * AES_BLOCK_LENGTH];
+    std::uint8_t stream[GCM_PARALLEL_BLOCKS * AES_BLOCK_LENGTH];
+    while (block_count) {
+        std::size_t count = block_count < GCM_PARALLEL_BLOCKS ?
+            block_count : GCM_PARALLEL_BLOCKS;
+        for (std::size_t i = 0; i < count; ++i) {
+            std::memcpy(counters + i * AES_BLOCK_LENGTH, counter,
+                        AES_BLOCK_LENGTH);
+            gcm_increment(counter);
+        }
+        aes_encrypt_blocks(&key->schedule, counters, count, stream);
+        if (decrypt) {
+            ghash_blocks(key, state, input, count);
+        }
+        for (std::size_t j = 0; j < count * AES_BLOCK_LENGTH; ++j) {
+            output[j] = input[j] ^ stream[j];
+        }
+        if (!decrypt) {
+            ghash_blocks(key, state, output, count);
+        }
+        block_count -= count;
+        input += count * AES_BLOCK_LENGTH;
+        output += count * AES_BLOCK_LENGTH;
+    }
+    olm::unset(stream);
+}
+
+
+/** The whole of GCM but for checking the tag: encrypt or decrypt the input
+ * and work out the tag over the associated data and the ciphertext. */
+static void gcm_crypt(
+    _olm_aes_gcm_key const * key,
+    std::uint8_t const * nonce,
+    std::uint8_t const * associated_data, std::size_t associated_data_length,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output,
+    std::uint8_t * tag,
+    bool decrypt
+) {
+    /* the first counter block encrypts the tag; the data starts at 2 */
+    std::uint8_t counter[AES_BLOCK_LENGTH] = {};
+    std::uint8_t tag_mask[AES_BLOCK_LENGTH];
+    std::uint8_t state[AES_BLOCK_LENGTH] = {};
+    std::memcpy(counter, nonce, AES_GCM_NONCE_LENGTH);
+    counter[AES_BLOCK_LENGTH - 1] = 1;
+    OLM_STATS_ADD(aes_blocks, 1);
+    aes_encrypt_blocks(&key->schedule, counter, 1, tag_mask);
+    counter[AES_BLOCK_LENGTH - 1] = 2;
+
+    ghash_padded(key, state, associated_data, associated_data_length);
+
+    std::size_t blocks = input_length / AES_BLOCK_LENGTH;
+    std::size_t remainder = input_length % AES_BLOCK_LENGTH;
+    gcm_crypt_blocks(key, counter, state, input, blocks, output, decrypt);
+    if (remainder) {
+        std::uint8_t stream[AES_BLOCK_LENGTH];
+        std::uint8_t ciphertext[AES_BLOCK_LENGTH] = {};
+        input += blocks * AES_BLOCK_LENGTH;
+        output += blocks * AES_BLOCK_LENGTH;
+        OLM_STATS_ADD(aes_blocks, 1);
+        aes_encrypt_blocks(&key->schedule, counter, 1, stream);
+        for (std::size_t j = 0; j < remainder; ++j) {
+            std::uint8_t in = input[j];
+            output[j] = in ^ stream[j];
+            ciphertext[j] = decrypt ? in : output[j];
+        }
+        ghash_blocks(key, state, ciphertext, 1);
+        olm::unset(stream);
+        olm::unset(ciphertext);
+    }
+
+    std::uint8_t lengths[AES_BLOCK_LENGTH];
+    store_big_endian_64(std::uint64_t(associated_data_length) * 8, lengths);
+    store_big_endian_64(std::uint64_t(input_length) * 8, lengths + 8);
+    ghash_blocks(key, state, lengths, 1);
+
+    for (std::size_t j = 0; j < AES_GCM_TAG_LENGTH; ++j) {
+        tag[j] = state[j] ^ tag_mask[j];
     }
-    ::sha256_final(context, o_pad + SHA256_BLOCK_LENGTH);
-    ::SHA256_CTX final_context;
-    ::sha256_init(&final_context);
-    ::sha256_update(&final_context, o_pad, sizeof(o_pad));
-    ::sha256_final(&final_context, output);
-    olm::unset(final_context);
-    olm::unset(o_pad);
+    olm::unset(tag_mask);
+    olm::unset(state);
+    olm::unset(counter);
 }
 
+/** How much data the fused encrypt/decrypt functions process at once: small
+ * enough that each chunk is still in L1 when we come to hash it */
+static const std::size_t FUSED_CHUNK_LENGTH = 4096;
+
+/** How many public keys _olm_crypto_curve25519_generate_keys computes at once */
+static const std::size_t KEY_BATCH_SIZE = 32;
+
 } // namespace
 
 void _olm_crypto_curve25519_generate_key(
     uint8_t const * random_32_bytes,
     struct _olm_curve25519_key_pair *key_pair
 ) {
+    OLM_STATS_ADD(curve25519_keys, 1);
     std::memcpy(
         key_pair->private_key.private_key, random_32_bytes,
         CURVE25519_KEY_LENGTH
     );
-    ::curve25519_donna(
+    _olm_curve25519_scalarmult_base(
         key_pair->public_key.public_key,
-        key_pair->private_key.private_key,
-        CURVE25519_BASEPOINT
+        key_pair->private_key.private_key
     );
 }
 
+void _olm_crypto_curve25519_generate_keys(
+    std::size_t count, uint8_t const * random,
+    struct _olm_curve25519_key_pair *key_pairs
+) {
+    std::uint8_t public_keys[KEY_BATCH_SIZE * CURVE25519_KEY_LENGTH];
+    OLM_STATS_ADD(curve25519_keys, count);
+    while (count) {
+        std::size_t n = count < KEY_BATCH_SIZE ? count : KEY_BATCH_SIZE;
+        _olm_curve25519_scalarmult_base_batch(n, public_keys, random);
+        for (std::size_t i = 0; i < n; ++i) {
+            std::memcpy(
+                key_pairs[i].private_key.private_key,
+                random + i * CURVE25519_RANDOM_LENGTH, CURVE25519_KEY_LENGTH
+            );
+            std::memcpy(
+                key_pairs[i].public_key.public_key,
+                public_keys + i * CURVE25519_KEY_LENGTH, CURVE25519_KEY_LENGTH
+            );
+        }
+        random += n * CURVE25519_RANDOM_LENGTH;
+        key_pairs += n;
+        count -= n;
+    }
+}
+
+
 
 void _olm_crypto_curve25519_shared_secret(
     const struct _olm_curve25519_key_pair *our_key,
     const struct _olm_curve25519_public_key * their_key,
     std::uint8_t * output
 ) {
-    ::curve25519_donna(output, our_key->private_key.private_key, their_key->public_key);
+    OLM_STATS_ADD(curve25519_shared_secrets, 1);
+    _olm_curve25519_scalarmult(
+        output, our_key->private_key.private_key, their_key->public_key
+    );
+}
+
+
+void _olm_crypto_curve25519_shared_secrets(
+    std::size_t count,
+    const struct _olm_curve25519_key_pair * const * our_keys,
+    const struct _olm_curve25519_public_key * const * their_keys,
+    std::uint8_t * outputs
+) {
+    /* enough for the three Diffie-Hellmans of a few sessions at a time */
+    static std::size_t const BATCH_LENGTH = 24;
+    std::uint8_t * output_ptrs[BATCH_LENGTH];
+    std::uint8_t const * secret_ptrs[BATCH_LENGTH];
+    std::uint8_t const * point_ptrs[BATCH_LENGTH];
+
+    OLM_STATS_ADD(curve25519_shared_secrets, count);
+    while (count) {
+        std::size_t n = count < BATCH_LENGTH ? count : BATCH_LENGTH;
+        for (std::size_t i = 0; i < n; ++i) {
+            output_ptrs[i] = outputs + i * CURVE25519_SHARED_SECRET_LENGTH;
+            secret_ptrs[i] = our_keys[i]->private_key.private_key;
+            point_ptrs[i] = their_keys[i]->public_key;
+        }
+        _olm_curve25519_scalarmult_many(
+            n, output_ptrs, secret_ptrs, point_ptrs
+        );
+        our_keys += n;
+        their_keys += n;
+        outputs += n * CURVE25519_SHARED_SECRET_LENGTH;
+        count -= n;
+    }
 }
 
 
@@ -141,6 +629,7 @@ void _olm_crypto_ed25519_sign(
     std::uint8_t const * message, std::size_t message_length,
     std::uint8_t * output
 ) {
+    OLM_STATS_ADD(ed25519_signs, 1);
     ::ed25519_sign(
         output,
         message, message_length,
@@ -155,6 +644,14 @@ int _olm_crypto_ed25519_verify(
     std::uint8_t const * message, std::size_t message_length,
     std::uint8_t const * signature
 ) {
+    OLM_STATS_ADD(ed25519_verifies, 1);
+    OlmCryptoProvider const * provider = _olm_crypto_dispatch()->provider;
+    if (provider && provider->ed25519_verify) {
+        return 0 != provider->ed25519_verify(
+            provider->context, their_key->public_key,
+            message, message_length, signature
+        );
+    }
     return 0 != ::ed25519_verify(
         signature,
         message, message_length,
@@ -170,34 +667,360 @@ std::size_t _olm_crypto_aes_encrypt_cbc_length(
 }
 
 
-void _olm_crypto_aes_encrypt_cbc(
+void _olm_crypto_aes_key_setup(
     _olm_aes256_key const *key,
+    _olm_aes256_key_schedule *schedule
+) {
+    _olm_dispatch_table const * dispatch = _olm_crypto_dispatch();
+    schedule->provider = dispatch->provider && dispatch->provider->aes256_cbc;
+    if (schedule->provider) {
+        std::memcpy(schedule->key, key->key, AES256_KEY_LENGTH);
+    }
+    /* the dispatch table turns the hardware kernels off for a provider, so
+     * the bitsliced round keys are what it falls back to */
+    schedule->hardware = dispatch->aes_hardware;
+    if (schedule->hardware) {
+        _olm_aes_hw_expand_key(
+            key->key,
+            schedule->encrypt_round_keys, schedule->decrypt_round_keys
+        );
+    } else {
+        _olm_aes_ct_expand_key(key->key, schedule->ct_round_keys);
+    }
+}
+
+
+void _olm_crypto_aes_encrypt_cbc_with_schedule(
+    _olm_aes256_key_schedule const *schedule,
     _olm_aes256_iv const *iv,
     std::uint8_t const * input, std::size_t input_length,
     std::uint8_t * output
 ) {
-    std::uint32_t key_schedule[AES_KEY_SCHEDULE_LENGTH];
-    ::aes_key_setup(key->key, key_schedule, AES_KEY_BITS);
-    std::uint8_t input_block[AES_BLOCK_LENGTH];
-    std::memcpy(input_block, iv->iv, AES_BLOCK_LENGTH);
-    while (input_length >= AES_BLOCK_LENGTH) {
-        xor_block<AES_BLOCK_LENGTH>(input_block, input);
-        ::aes_encrypt(input_block, output, key_schedule, AES_KEY_BITS);
-        std::memcpy(input_block, output, AES_BLOCK_LENGTH);
-        input += AES_BLOCK_LENGTH;
-        output += AES_BLOCK_LENGTH;
-        input_length -= AES_BLOCK_LENGTH;
+    std::uint8_t chain[AES_BLOCK_LENGTH];
+    std::size_t blocks = input_length / AES_BLOCK_LENGTH;
+    std::memcpy(chain, iv->iv, AES_BLOCK_LENGTH);
+    aes_encrypt_cbc_blocks(schedule, chain, input, blocks, output);
+    aes_encrypt_cbc_final(
+        schedule, chain,
+        input + blocks * AES_BLOCK_LENGTH, input_length % AES_BLOCK_LENGTH,
+        output + blocks * AES_BLOCK_LENGTH
+    );
+    olm::unset(chain);
+}
+
+
+std::size_t _olm_crypto_aes_decrypt_cbc_with_schedule(
+    _olm_aes256_key_schedule const *schedule,
+    _olm_aes256_iv const *iv,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output
+) {
+    std::uint8_t chain[AES_BLOCK_LENGTH];
+    std::memcpy(chain, iv->iv, AES_BLOCK_LENGTH);
+    aes_decrypt_cbc_blocks(
+        schedule, chain, input, input_length / AES_BLOCK_LENGTH, output
+    );
+    olm::unset(chain);
+    return aes_cbc_unpad(output, input_length);
+}
+
+
+void _olm_crypto_aes_encrypt_cbc_blocks(
+    _olm_aes256_key_schedule const *schedule,
+    std::uint8_t chain[AES256_IV_LENGTH],
+    std::uint8_t const * input, std::size_t block_count,
+    std::uint8_t * output
+) {
+    aes_encrypt_cbc_blocks(schedule, chain, input, block_count, output);
+}
+
+
+void _olm_crypto_aes_decrypt_cbc_blocks(
+    _olm_aes256_key_schedule const *schedule,
+    std::uint8_t chain[AES256_IV_LENGTH],
+    std::uint8_t const * input, std::size_t block_count,
+    std::uint8_t * output
+) {
+    aes_decrypt_cbc_blocks(schedule, chain, input, block_count, output);
+}
+
+
+void _olm_crypto_aes_ctr_blocks(
+    _olm_aes256_key_schedule const *schedule,
+    std::uint8_t counter[AES256_IV_LENGTH],
+    std::uint8_t const * input, std::size_t block_count,
+    std::uint8_t * output
+) {
+    OLM_STATS_ADD(aes_blocks, block_count);
+    if (aes_provider(schedule)) {
+        /* the provider only does CBC, so a block at a time, counting in the
+         * last 8 bytes as the kernels do */
+        std::uint8_t stream[AES_BLOCK_LENGTH];
+        for (std::size_t i = 0; i < block_count; ++i) {
+            aes_encrypt_blocks(schedule, counter, 1, stream);
+            for (std::size_t j = 0; j < AES_BLOCK_LENGTH; ++j) {
+                output[j] = input[j] ^ stream[j];
+            }
+            for (std::size_t j = AES_BLOCK_LENGTH; j-- > 8;) {
+                if (++counter[j]) {
+                    break;
+                }
+            }
+            input += AES_BLOCK_LENGTH;
+            output += AES_BLOCK_LENGTH;
+        }
+        olm::unset(stream);
+        return;
     }
-    std::size_t i = 0;
-    for (; i < input_length; ++i) {
-        input_block[i] ^= input[i];
+    if (schedule->hardware) {
+        _olm_aes_hw_encrypt_ctr(
+            schedule->encrypt_round_keys, counter, input, block_count, output
+        );
+        return;
     }
-    for (; i < AES_BLOCK_LENGTH; ++i) {
-        input_block[i] ^= AES_BLOCK_LENGTH - input_length;
+    _olm_aes_ct_encrypt_ctr(
+        schedule->ct_round_keys, counter, input, block_count, output
+    );
+}
+
+
+void _olm_crypto_aes_gcm_key_setup(
+    _olm_aes256_key const *key,
+    _olm_aes_gcm_key *gcm_key
+) {
+    std::uint8_t const zero[AES_BLOCK_LENGTH] = {};
+    _olm_crypto_aes_key_setup(key, &gcm_key->schedule);
+    gcm_key->hardware = gcm_key->schedule.hardware
+        && _olm_crypto_dispatch()->aes_gcm_hardware;
+    OLM_STATS_ADD(aes_blocks, 1);
+    aes_encrypt_blocks(&gcm_key->schedule, zero, 1, gcm_key->hash_key);
+}
+
+
+void _olm_crypto_aes_gcm_encrypt(
+    _olm_aes_gcm_key const *key,
+    std::uint8_t const nonce[AES_GCM_NONCE_LENGTH],
+    std::uint8_t const * associated_data, std::size_t associated_data_length,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output,
+    std::uint8_t tag[AES_GCM_TAG_LENGTH]
+) {
+    gcm_crypt(
+        key, nonce, associated_data, associated_data_length,
+        input, input_length, output, tag, false
+    );
+}
+
+
+std::size_t _olm_crypto_aes_gcm_decrypt(
+    _olm_aes_gcm_key const *key,
+    std::uint8_t const nonce[AES_GCM_NONCE_LENGTH],
+    std::uint8_t const * associated_data, std::size_t associated_data_length,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t const tag[AES_GCM_TAG_LENGTH],
+    std::uint8_t * output
+) {
+    std::uint8_t actual_tag[AES_GCM_TAG_LENGTH];
+    gcm_crypt(
+        key, nonce, associated_data, associated_data_length,
+        input, input_length, output, actual_tag, true
+    );
+    bool matches = olm::is_equal(tag, actual_tag, AES_GCM_TAG_LENGTH);
+    olm::unset(actual_tag);
+    if (!matches) {
+        olm::unset(output, input_length);
+        return std::size_t(-1);
+    }
+    return input_length;
+}
+
+
+void _olm_crypto_aes_gcm_verify_begin(
+    _olm_aes_gcm_key const *key,
+    _olm_aes_gcm_verify_context *context,
+    std::uint8_t const * associated_data, std::size_t associated_data_length
+) {
+    std::memset(context->state, 0, sizeof(context->state));
+    ghash_padded(key, context->state, associated_data, associated_data_length);
+    context->block_length = 0;
+    context->associated_data_length = associated_data_length;
+    context->ciphertext_length = 0;
+}
+
+
+void _olm_crypto_aes_gcm_verify_update(
+    _olm_aes_gcm_key const *key,
+    _olm_aes_gcm_verify_context *context,
+    std::uint8_t const * ciphertext, std::size_t ciphertext_length
+) {
+    context->ciphertext_length += ciphertext_length;
+    if (context->block_length) {
+        std::size_t count = AES_BLOCK_LENGTH - context->block_length;
+        if (count > ciphertext_length) {
+            count = ciphertext_length;
+        }
+        std::memcpy(context->block + context->block_length, ciphertext, count);
+        context->block_length += count;
+        ciphertext += count;
+        ciphertext_length -= count;
+        if (context->block_length < AES_BLOCK_LENGTH) {
+            return;
+        }
+        ghash_blocks(key, context->state, context->block, 1);
+        context->block_length = 0;
+    }
+    std::size_t blocks = ciphertext_length / AES_BLOCK_LENGTH;
+    ghash_blocks(key, context->state, ciphertext, blocks);
+    ciphertext += blocks * AES_BLOCK_LENGTH;
+    context->block_length = ciphertext_length % AES_BLOCK_LENGTH;
+    std::memcpy(context->block, ciphertext, context->block_length);
+}
+
+
+std::size_t _olm_crypto_aes_gcm_verify_end(
+    _olm_aes_gcm_key const *key,
+    _olm_aes_gcm_verify_context *context,
+    std::uint8_t const nonce[AES_GCM_NONCE_LENGTH],
+    std::uint8_t const tag[AES_GCM_TAG_LENGTH]
+) {
+    /* the first counter block encrypts the tag, as in gcm_crypt */
+    std::uint8_t counter[AES_BLOCK_LENGTH] = {};
+    std::uint8_t tag_mask[AES_BLOCK_LENGTH];
+    std::memcpy(counter, nonce, AES_GCM_NONCE_LENGTH);
+    counter[AES_BLOCK_LENGTH - 1] = 1;
+    OLM_STATS_ADD(aes_blocks, 1);
+    aes_encrypt_blocks(&key->schedule, counter, 1, tag_mask);
+
+    ghash_padded(key, context->state, context->block, context->block_length);
+    std::uint8_t lengths[AES_BLOCK_LENGTH];
+    store_big_endian_64(context->associated_data_length * 8, lengths);
+    store_big_endian_64(context->ciphertext_length * 8, lengths + 8);
+    ghash_blocks(key, context->state, lengths, 1);
+
+    for (std::size_t j = 0; j < AES_GCM_TAG_LENGTH; ++j) {
+        tag_mask[j] ^= context->state[j];
     }
-    ::aes_encrypt(input_block, output, key_schedule, AES_KEY_BITS);
-    olm::unset(key_schedule);
-    olm::unset(input_block);
+    bool matches = olm::is_equal(tag, tag_mask, AES_GCM_TAG_LENGTH);
+    olm::unset(tag_mask);
+    olm::unset(*context);
+    return matches ? 0 : std::size_t(-1);
+}
+
+
+std::size_t _olm_crypto_aes_encrypt_cbc_then_hmac_sha256(
+    _olm_aes256_key_schedule const *schedule,
+    _olm_aes256_iv const *iv,
+    _olm_hmac_sha256_key const *hmac_key,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t const * mac_input, std::size_t mac_input_length,
+    std::uint8_t * ciphertext,
+    std::uint8_t * mac
+) {
+    std::uint8_t chain[AES_BLOCK_LENGTH];
+    ::SHA256_CTX context;
+    std::size_t ciphertext_length = _olm_crypto_aes_encrypt_cbc_length(
+        input_length
+    );
+    std::uint8_t const * suffix = ciphertext + ciphertext_length;
+
+    std::memcpy(chain, iv->iv, AES_BLOCK_LENGTH);
+    hmac_sha256_start(&context, hmac_key);
+    sha256_hash_update(&context, mac_input, ciphertext - mac_input);
+
+    /* encrypt a chunk, then MAC it while it is still in cache */
+    std::size_t blocks = input_length / AES_BLOCK_LENGTH;
+    std::size_t chunk_blocks = FUSED_CHUNK_LENGTH / AES_BLOCK_LENGTH;
+    for (std::size_t i = 0; i < blocks; i += chunk_blocks) {
+        std::size_t n = blocks - i < chunk_blocks ? blocks - i : chunk_blocks;
+        std::uint8_t * chunk = ciphertext + i * AES_BLOCK_LENGTH;
+        aes_encrypt_cbc_blocks(
+            schedule, chain, input + i * AES_BLOCK_LENGTH, n, chunk
+        );
+        sha256_hash_update(&context, chunk, n * AES_BLOCK_LENGTH);
+    }
+    std::uint8_t * last = ciphertext + blocks * AES_BLOCK_LENGTH;
+    aes_encrypt_cbc_final(
+        schedule, chain,
+        input + blocks * AES_BLOCK_LENGTH, input_length % AES_BLOCK_LENGTH,
+        last
+    );
+    sha256_hash_update(&context, last, AES_BLOCK_LENGTH);
+
+    sha256_hash_update(
+        &context, suffix, mac_input + mac_input_length - suffix
+    );
+    hmac_sha256_finish(&context, hmac_key, mac);
+
+    olm::unset(chain);
+    olm::unset(context);
+    return ciphertext_length;
+}
+
+
+std::size_t _olm_crypto_hmac_sha256_then_aes_decrypt_cbc(
+    _olm_aes256_key_schedule const *schedule,
+    _olm_aes256_iv const *iv,
+    _olm_hmac_sha256_key const *hmac_key,
+    std::uint8_t const * mac_input, std::size_t mac_input_length,
+    std::uint8_t const * ciphertext, std::size_t ciphertext_length,
+    std::uint8_t const * expected_mac, std::size_t expected_mac_length,
+    std::uint8_t * output
+) {
+    std::uint8_t chain[AES_BLOCK_LENGTH];
+    std::uint8_t mac[SHA256_OUTPUT_LENGTH];
+    ::SHA256_CTX context;
+    std::size_t blocks = ciphertext_length / AES_BLOCK_LENGTH;
+
+    std::memcpy(chain, iv->iv, AES_BLOCK_LENGTH);
+    hmac_sha256_start(&context, hmac_key);
+    sha256_hash_update(&context, mac_input, ciphertext - mac_input);
+
+    /* MAC a chunk, then decrypt it while it is still in cache. The
+     * plaintext is wiped below if the MAC turns out to be wrong. */
+    std::size_t chunk_blocks = FUSED_CHUNK_LENGTH / AES_BLOCK_LENGTH;
+    for (std::size_t i = 0; i < blocks; i += chunk_blocks) {
+        std::size_t n = blocks - i < chunk_blocks ? blocks - i : chunk_blocks;
+        std::uint8_t const * chunk = ciphertext + i * AES_BLOCK_LENGTH;
+        sha256_hash_update(&context, chunk, n * AES_BLOCK_LENGTH);
+        aes_decrypt_cbc_blocks(
+            schedule, chain, chunk, n, output + i * AES_BLOCK_LENGTH
+        );
+    }
+    sha256_hash_update(
+        &context, ciphertext + blocks * AES_BLOCK_LENGTH,
+        mac_input + mac_input_length - ciphertext - blocks * AES_BLOCK_LENGTH
+    );
+    hmac_sha256_finish(&context, hmac_key, mac);
+
+    std::size_t result = std::size_t(-1);
+    if (olm::is_equal(expected_mac, mac, expected_mac_length)
+            && ciphertext_length % AES_BLOCK_LENGTH == 0
+            && ciphertext_length != 0) {
+        result = aes_cbc_unpad(output, ciphertext_length);
+    }
+    if (result == std::size_t(-1)) {
+        olm::unset(output, blocks * AES_BLOCK_LENGTH);
+    }
+
+    olm::unset(chain);
+    olm::unset(mac);
+    olm::unset(context);
+    return result;
+}
+
+
+void _olm_crypto_aes_encrypt_cbc(
+    _olm_aes256_key const *key,
+    _olm_aes256_iv const *iv,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output
+) {
+    _olm_aes256_key_schedule schedule;
+    _olm_crypto_aes_key_setup(key, &schedule);
+    _olm_crypto_aes_encrypt_cbc_with_schedule(
+        &schedule, iv, input, input_length, output
+    );
+    olm::unset(schedule);
 }
 
 
@@ -207,22 +1030,13 @@ std::size_t _olm_crypto_aes_decrypt_cbc(
     std::uint8_t const * input, std::size_t input_length,
     std::uint8_t * output
 ) {
-    std::uint32_t key_schedule[AES_KEY_SCHEDULE_LENGTH];
-    ::aes_key_setup(key->key, key_schedule, AES_KEY_BITS);
-    std::uint8_t block1[AES_BLOCK_LENGTH];
-    std::uint8_t block2[AES_BLOCK_LENGTH];
-    std::memcpy(block1, iv->iv, AES_BLOCK_LENGTH);
-    for (std::size_t i = 0; i < input_length; i += AES_BLOCK_LENGTH) {
-        std::memcpy(block2, &input[i], AES_BLOCK_LENGTH);
-        ::aes_decrypt(&input[i], &output[i], key_schedule, AES_KEY_BITS);
-        xor_block<AES_BLOCK_LENGTH>(&output[i], block1);
-        std::memcpy(block1, block2, AES_BLOCK_LENGTH);
-    }
-    olm::unset(key_schedule);
-    olm::unset(block1);
-    olm::unset(block2);
-    std::size_t padding = output[input_length - 1];
-    return (padding > input_length) ? std::size_t(-1) : (input_length - padding);
+    _olm_aes256_key_schedule schedule;
+    _olm_crypto_aes_key_setup(key, &schedule);
+    std::size_t result = _olm_crypto_aes_decrypt_cbc_with_schedule(
+        &schedule, iv, input, input_length, output
+    );
+    olm::unset(schedule);
+    return result;
 }
 
 
@@ -232,68 +1046,744 @@ void _olm_crypto_sha256(
 ) {
     ::SHA256_CTX context;
     ::sha256_init(&context);
-    ::sha256_update(&context, input, input_length);
-    ::sha256_final(&context, output);
+    sha256_hash_update(&context, input, input_length);
+    sha256_hash_final(&context, output);
+    olm::unset(context);
+}
+
+
+void _olm_crypto_hmac_sha256_init_key(
+    _olm_hmac_sha256_key * hmac_key,
+    std::uint8_t const * key, std::size_t key_length
+) {
+    std::uint8_t padded_key[SHA256_BLOCK_LENGTH];
+    ::SHA256_CTX context;
+    hmac_sha256_key(key, key_length, padded_key);
+
+    for (std::size_t i = 0; i < SHA256_BLOCK_LENGTH; ++i) {
+        padded_key[i] ^= 0x36;
+    }
+    ::sha256_init(&context);
+    sha256_blocks(&context, padded_key, 1);
+    std::memcpy(hmac_key->inner_state, context.state, sizeof(context.state));
+
+    for (std::size_t i = 0; i < SHA256_BLOCK_LENGTH; ++i) {
+        padded_key[i] ^= 0x36 ^ 0x5C;
+    }
+    ::sha256_init(&context);
+    sha256_blocks(&context, padded_key, 1);
+    std::memcpy(hmac_key->outer_state, context.state, sizeof(context.state));
+
+    olm::unset(padded_key);
+    olm::unset(context);
+}
+
+
+void _olm_crypto_hmac_sha256_with_key(
+    _olm_hmac_sha256_key const * hmac_key,
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t * output
+) {
+    ::SHA256_CTX context;
+    hmac_sha256_start(&context, hmac_key);
+    sha256_hash_update(&context, input, input_length);
+    hmac_sha256_finish(&context, hmac_key, output);
     olm::unset(context);
 }
 
 
+namespace {
+
+static std::uint32_t const SHA256_INITIAL_STATE[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static_assert(
+    OLM_CRYPTO_SHA256_MAX_LANES == OLM_SHA256_X8_LANES,
+    "OLM_CRYPTO_SHA256_MAX_LANES must match the widest kernel"
+);
+
+/** Pad a message of up to 55 bytes, which follows prefix_length bytes
+ * already compressed, into a single final SHA-256 block */
+static void sha256_pad_block(
+    std::uint8_t const * input, std::size_t input_length,
+    std::size_t prefix_length,
+    std::uint8_t * block
+) {
+    std::uint64_t bit_length = 8 * (prefix_length + input_length);
+    std::memcpy(block, input, input_length);
+    block[input_length] = 0x80;
+    std::memset(
+        block + input_length + 1, 0, SHA256_BLOCK_LENGTH - 9 - input_length
+    );
+    for (std::size_t i = 0; i < 8; ++i) {
+        block[SHA256_BLOCK_LENGTH - 1 - i] = bit_length >> (8 * i);
+    }
+}
+
+static void sha256_store_state(
+    std::uint32_t const * state, std::uint8_t * output
+) {
+    for (std::size_t i = 0; i < 8; ++i) {
+        output[4 * i]     = state[i] >> 24;
+        output[4 * i + 1] = state[i] >> 16;
+        output[4 * i + 2] = state[i] >> 8;
+        output[4 * i + 3] = state[i];
+    }
+}
+
+/** The number of lanes to hash count messages in: the eight lane kernel is
+ * only worth it if there are more than four messages to fill it */
+static std::size_t sha256_lanes_for(std::size_t count) {
+    _olm_dispatch_table const * dispatch = _olm_crypto_dispatch();
+    std::size_t lanes = _olm_crypto_hmac_sha256_lanes();
+    if (lanes == OLM_SHA256_X8_LANES && count <= OLM_SHA256_X4_LANES
+            && dispatch->sha256_x4) {
+        return OLM_SHA256_X4_LANES;
+    }
+    return lanes;
+}
+
+/** Compress one block for each of lanes states side by side, where lanes
+ * is OLM_SHA256_X4_LANES or OLM_SHA256_X8_LANES */
+static void sha256_transform_lanes(
+    std::uint32_t * const * states, std::uint8_t const * const * blocks,
+    std::size_t lanes
+) {
+    if (lanes == OLM_SHA256_X8_LANES) {
+        _olm_sha256_x8_transform(states, blocks);
+    } else {
+        _olm_sha256_x4_transform(states, blocks);
+    }
+    OLM_STATS_ADD(sha256_blocks, lanes);
+}
+
+/** HMAC of up to lanes single block messages at once, each with its own
+ * prepared key */
+static void hmac_sha256_lanes(
+    _olm_hmac_sha256_key const * const * hmac_keys,
+    std::uint8_t const * const * inputs, std::size_t input_length,
+    std::uint8_t * const * outputs, std::size_t count, std::size_t lanes
+) {
+    std::uint8_t blocks[OLM_SHA256_X8_LANES][SHA256_BLOCK_LENGTH];
+    std::uint32_t states[OLM_SHA256_X8_LANES][8];
+    std::uint32_t * state_ptrs[OLM_SHA256_X8_LANES] = {};
+    std::uint8_t const * block_ptrs[OLM_SHA256_X8_LANES] = {};
+
+    /* spare lanes just repeat the first message */
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        std::size_t source = lane < count ? lane : 0;
+        sha256_pad_block(
+            inputs[source], input_length, SHA256_BLOCK_LENGTH, blocks[lane]
+        );
+        std::memcpy(
+            states[lane], hmac_keys[source]->inner_state,
+            sizeof(states[lane])
+        );
+        state_ptrs[lane] = states[lane];
+        block_ptrs[lane] = blocks[lane];
+    }
+    sha256_transform_lanes(state_ptrs, block_ptrs, lanes);
+    OLM_STATS_ADD(hmac_sha256, count);
+
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        std::size_t source = lane < count ? lane : 0;
+        std::uint8_t inner_hash[SHA256_OUTPUT_LENGTH];
+        sha256_store_state(states[lane], inner_hash);
+        sha256_pad_block(
+            inner_hash, sizeof(inner_hash), SHA256_BLOCK_LENGTH, blocks[lane]
+        );
+        std::memcpy(
+            states[lane], hmac_keys[source]->outer_state,
+            sizeof(states[lane])
+        );
+        olm::unset(inner_hash);
+    }
+    sha256_transform_lanes(state_ptrs, block_ptrs, lanes);
+
+    for (std::size_t lane = 0; lane < count; ++lane) {
+        sha256_store_state(states[lane], outputs[lane]);
+    }
+    olm::unset(blocks);
+    olm::unset(states);
+}
+
+/** Prepare up to lanes HMAC keys of at most a block at once */
+static void hmac_sha256_init_keys_lanes(
+    _olm_hmac_sha256_key * const * hmac_keys,
+    std::uint8_t const * const * keys, std::size_t key_length,
+    std::size_t count, std::size_t lanes
+) {
+    std::uint8_t blocks[OLM_SHA256_X8_LANES][SHA256_BLOCK_LENGTH];
+    std::uint8_t outer_blocks[OLM_SHA256_X8_LANES][SHA256_BLOCK_LENGTH];
+    std::uint32_t states[OLM_SHA256_X8_LANES][8];
+    std::uint32_t outer_states[OLM_SHA256_X8_LANES][8];
+    std::uint32_t * state_ptrs[OLM_SHA256_X8_LANES] = {};
+    std::uint32_t * outer_state_ptrs[OLM_SHA256_X8_LANES] = {};
+    std::uint8_t const * block_ptrs[OLM_SHA256_X8_LANES] = {};
+    std::uint8_t const * outer_block_ptrs[OLM_SHA256_X8_LANES] = {};
+
+    /* spare lanes just repeat the first key */
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        std::size_t source = lane < count ? lane : 0;
+        std::memcpy(blocks[lane], keys[source], key_length);
+        std::memset(
+            blocks[lane] + key_length, 0, SHA256_BLOCK_LENGTH - key_length
+        );
+        for (std::size_t i = 0; i < SHA256_BLOCK_LENGTH; ++i) {
+            outer_blocks[lane][i] = blocks[lane][i] ^ 0x5C;
+            blocks[lane][i] ^= 0x36;
+        }
+        std::memcpy(states[lane], SHA256_INITIAL_STATE, sizeof(states[lane]));
+        std::memcpy(
+            outer_states[lane], SHA256_INITIAL_STATE, sizeof(states[lane])
+        );
+        state_ptrs[lane] = states[lane];
+        outer_state_ptrs[lane] = outer_states[lane];
+        block_ptrs[lane] = blocks[lane];
+        outer_block_ptrs[lane] = outer_blocks[lane];
+    }
+    sha256_transform_lanes(state_ptrs, block_ptrs, lanes);
+    sha256_transform_lanes(outer_state_ptrs, outer_block_ptrs, lanes);
+
+    for (std::size_t lane = 0; lane < count; ++lane) {
+        std::memcpy(
+            hmac_keys[lane]->inner_state, states[lane], sizeof(states[lane])
+        );
+        std::memcpy(
+            hmac_keys[lane]->outer_state, outer_states[lane],
+            sizeof(states[lane])
+        );
+    }
+    olm::unset(blocks);
+    olm::unset(outer_blocks);
+    olm::unset(states);
+    olm::unset(outer_states);
+}
+
+} // namespace
+
+
+std::size_t _olm_crypto_hmac_sha256_lanes() {
+    /* The vector kernels only pay for themselves if we have no SHA
+     * instructions */
+    _olm_dispatch_table const * dispatch = _olm_crypto_dispatch();
+    if (dispatch->sha256_hardware) {
+        return 1;
+    }
+    if (dispatch->sha256_x8) {
+        return OLM_SHA256_X8_LANES;
+    }
+    if (dispatch->sha256_x4) {
+        return OLM_SHA256_X4_LANES;
+    }
+    return 1;
+}
+
+
+void _olm_crypto_hmac_sha256_with_key_multi(
+    _olm_hmac_sha256_key const * hmac_key,
+    std::uint8_t const * const * inputs, std::size_t input_length,
+    std::uint8_t * const * outputs, std::size_t count
+) {
+    if (input_length <= SHA256_BLOCK_LENGTH - 9
+            && count > 1
+            && _olm_crypto_hmac_sha256_lanes() > 1) {
+        _olm_hmac_sha256_key const * hmac_keys[OLM_SHA256_X8_LANES];
+        for (std::size_t lane = 0; lane < OLM_SHA256_X8_LANES; ++lane) {
+            hmac_keys[lane] = hmac_key;
+        }
+        while (count) {
+            std::size_t lanes = sha256_lanes_for(count);
+            std::size_t n = count < lanes ? count : lanes;
+            hmac_sha256_lanes(
+                hmac_keys, inputs, input_length, outputs, n, lanes
+            );
+            inputs += n;
+            outputs += n;
+            count -= n;
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        _olm_crypto_hmac_sha256_with_key(
+            hmac_key, inputs[i], input_length, outputs[i]
+        );
+    }
+}
+
+
+void _olm_crypto_hmac_sha256_init_key_multi(
+    _olm_hmac_sha256_key * const * hmac_keys,
+    std::uint8_t const * const * keys, std::size_t key_length,
+    std::size_t count
+) {
+    if (key_length <= SHA256_BLOCK_LENGTH
+            && count > 1
+            && _olm_crypto_hmac_sha256_lanes() > 1) {
+        while (count) {
+            std::size_t lanes = sha256_lanes_for(count);
+            std::size_t n = count < lanes ? count : lanes;
+            hmac_sha256_init_keys_lanes(hmac_keys, keys, key_length, n, lanes);
+            hmac_keys += n;
+            keys += n;
+            count -= n;
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        _olm_crypto_hmac_sha256_init_key(hmac_keys[i], keys[i], key_length);
+    }
+}
+
+
+void _olm_crypto_hmac_sha256_with_keys_multi(
+    _olm_hmac_sha256_key const * const * hmac_keys,
+    std::uint8_t const * const * inputs, std::size_t input_length,
+    std::uint8_t * const * outputs, std::size_t count
+) {
+    if (input_length <= SHA256_BLOCK_LENGTH - 9
+            && count > 1
+            && _olm_crypto_hmac_sha256_lanes() > 1) {
+        while (count) {
+            std::size_t lanes = sha256_lanes_for(count);
+            std::size_t n = count < lanes ? count : lanes;
+            hmac_sha256_lanes(
+                hmac_keys, inputs, input_length, outputs, n, lanes
+            );
+            hmac_keys += n;
+            inputs += n;
+            outputs += n;
+            count -= n;
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        _olm_crypto_hmac_sha256_with_key(
+            hmac_keys[i], inputs[i], input_length, outputs[i]
+        );
+    }
+}
+
+
+void _olm_crypto_hmac_sha256_many_keys(
+    std::uint8_t const * const * keys, std::size_t key_length,
+    std::uint8_t const * const * inputs, std::size_t input_length,
+    std::uint8_t * const * outputs, std::size_t count
+) {
+    if (count > 1 && _olm_crypto_hmac_sha256_lanes() > 1) {
+        std::size_t lanes = sha256_lanes_for(count);
+        _olm_hmac_sha256_key hmac_keys[OLM_SHA256_X8_LANES];
+        _olm_hmac_sha256_key * key_ptrs[OLM_SHA256_X8_LANES];
+        for (std::size_t lane = 0; lane < count; ++lane) {
+            key_ptrs[lane] = &hmac_keys[lane];
+        }
+        hmac_sha256_init_keys_lanes(key_ptrs, keys, key_length, count, lanes);
+        hmac_sha256_lanes(
+            key_ptrs, inputs, input_length, outputs, count, lanes
+        );
+        olm::unset(hmac_keys);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        _olm_crypto_hmac_sha256(
+            keys[i], key_length, inputs[i], input_length, outputs[i]
+        );
+    }
+}
+
+
+namespace {
+
+/** One message of a multi-lane SHA-256: its whole blocks come straight from
+ * the input, and the rest, with the padding, from tail */
+struct Sha256Lane {
+    std::uint8_t const * input;
+    std::size_t input_blocks;
+    std::size_t block_count;
+    std::uint8_t tail[2 * SHA256_BLOCK_LENGTH];
+    std::uint32_t state[8];
+};
+
+static void sha256_lane_init(
+    Sha256Lane & lane, std::uint8_t const * input, std::size_t input_length
+) {
+    std::size_t rest = input_length % SHA256_BLOCK_LENGTH;
+    std::uint64_t bit_length = 8 * std::uint64_t(input_length);
+    lane.input = input;
+    lane.input_blocks = input_length / SHA256_BLOCK_LENGTH;
+    /* the padding takes a second block if the rest leaves no room for it */
+    std::size_t tail_blocks = rest > SHA256_BLOCK_LENGTH - 9 ? 2 : 1;
+    std::size_t tail_length = tail_blocks * SHA256_BLOCK_LENGTH;
+    lane.block_count = lane.input_blocks + tail_blocks;
+    if (rest) {
+        std::memcpy(lane.tail, input + input_length - rest, rest);
+    }
+    lane.tail[rest] = 0x80;
+    std::memset(lane.tail + rest + 1, 0, tail_length - 9 - rest);
+    for (std::size_t i = 0; i < 8; ++i) {
+        lane.tail[tail_length - 1 - i] = bit_length >> (8 * i);
+    }
+    std::memcpy(lane.state, SHA256_INITIAL_STATE, sizeof(lane.state));
+}
+
+static std::uint8_t const * sha256_lane_block(
+    Sha256Lane const & lane, std::size_t block
+) {
+    if (block < lane.input_blocks) {
+        return lane.input + block * SHA256_BLOCK_LENGTH;
+    }
+    return lane.tail + (block - lane.input_blocks) * SHA256_BLOCK_LENGTH;
+}
+
+/** SHA-256 of up to lane_count messages at once. The lanes run side by side
+ * while at least two still have blocks; the longest then finishes alone. */
+static void sha256_lanes(
+    std::uint8_t const * const * inputs, std::size_t const * input_lengths,
+    std::uint8_t * const * outputs, std::size_t count, std::size_t lane_count
+) {
+    Sha256Lane lanes[OLM_SHA256_X8_LANES];
+    std::uint32_t spare_state[8];
+    std::uint32_t * state_ptrs[OLM_SHA256_X8_LANES] = {};
+    std::uint8_t const * block_ptrs[OLM_SHA256_X8_LANES] = {};
+    std::size_t lane;
+
+    for (lane = 0; lane < count; ++lane) {
+        sha256_lane_init(lanes[lane], inputs[lane], input_lengths[lane]);
+    }
+    for (std::size_t block = 0;; ++block) {
+        std::size_t active = 0, last = 0;
+        for (lane = 0; lane < count; ++lane) {
+            if (block < lanes[lane].block_count) {
+                active++;
+                last = lane;
+            }
+        }
+        if (active < 2) {
+            if (active) {
+                Sha256Lane & rest = lanes[last];
+                _olm_dispatch_table const * dispatch = _olm_crypto_dispatch();
+                OLM_STATS_ADD(sha256_blocks, rest.block_count - block);
+                if (block < rest.input_blocks) {
+                    dispatch->sha256_transform(
+                        rest.state, sha256_lane_block(rest, block),
+                        rest.input_blocks - block
+                    );
+                    block = rest.input_blocks;
+                }
+                dispatch->sha256_transform(
+                    rest.state, sha256_lane_block(rest, block),
+                    rest.block_count - block
+                );
+            }
+            break;
+        }
+        /* lanes which have finished, or have no message, compress their
+         * first block again into a spare state */
+        for (lane = 0; lane < lane_count; ++lane) {
+            if (lane < count && block < lanes[lane].block_count) {
+                state_ptrs[lane] = lanes[lane].state;
+                block_ptrs[lane] = sha256_lane_block(lanes[lane], block);
+            } else {
+                state_ptrs[lane] = spare_state;
+                block_ptrs[lane] = lanes[0].tail;
+            }
+        }
+        sha256_transform_lanes(state_ptrs, block_ptrs, lane_count);
+    }
+
+    for (lane = 0; lane < count; ++lane) {
+        sha256_store_state(lanes[lane].state, outputs[lane]);
+    }
+    olm::unset(lanes);
+    olm::unset(spare_state);
+}
+
+} // namespace
+
+
+void _olm_crypto_sha256_multi(
+    std::uint8_t const * const * inputs, std::size_t const * input_lengths,
+    std::uint8_t * const * outputs, std::size_t count
+) {
+    /* as for the HMACs, the vector kernels lose to SHA instructions */
+    if (count > 1 && _olm_crypto_hmac_sha256_lanes() > 1) {
+        while (count) {
+            std::size_t lanes = sha256_lanes_for(count);
+            std::size_t n = count < lanes ? count : lanes;
+            sha256_lanes(inputs, input_lengths, outputs, n, lanes);
+            inputs += n;
+            input_lengths += n;
+            outputs += n;
+            count -= n;
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        _olm_crypto_sha256(inputs[i], input_lengths[i], outputs[i]);
+    }
+}
+
+
+static_assert(
+    sizeof(_olm_sha256_context) == sizeof(::SHA256_CTX)
+        && offsetof(_olm_sha256_context, state)
+            == offsetof(::SHA256_CTX, state),
+    "_olm_sha256_context must match SHA256_CTX"
+);
+
+static_assert(
+    sizeof(_olm_hmac_sha256_context) == sizeof(::SHA256_CTX)
+        && offsetof(_olm_hmac_sha256_context, state)
+            == offsetof(::SHA256_CTX, state),
+    "_olm_hmac_sha256_context must match SHA256_CTX"
+);
+
+static ::SHA256_CTX * sha256_context(_olm_hmac_sha256_context * context) {
+    return reinterpret_cast<::SHA256_CTX *>(context);
+}
+
+
+static ::SHA256_CTX * sha256_context(_olm_sha256_context * context) {
+    return reinterpret_cast<::SHA256_CTX *>(context);
+}
+
+
+void _olm_crypto_sha256_begin(
+    _olm_sha256_context * context
+) {
+    ::sha256_init(sha256_context(context));
+}
+
+
+void _olm_crypto_sha256_update(
+    _olm_sha256_context * context,
+    std::uint8_t const * input, std::size_t input_length
+) {
+    sha256_hash_update(sha256_context(context), input, input_length);
+}
+
+
+void _olm_crypto_sha256_end(
+    _olm_sha256_context * context,
+    std::uint8_t * output
+) {
+    sha256_hash_final(sha256_context(context), output);
+    olm::unset(*context);
+}
+
+
+void _olm_crypto_hmac_sha256_begin(
+    _olm_hmac_sha256_key const * hmac_key,
+    _olm_hmac_sha256_context * context
+) {
+    hmac_sha256_start(sha256_context(context), hmac_key);
+}
+
+
+void _olm_crypto_hmac_sha256_update(
+    _olm_hmac_sha256_context * context,
+    std::uint8_t const * input, std::size_t input_length
+) {
+    sha256_hash_update(sha256_context(context), input, input_length);
+}
+
+
+void _olm_crypto_hmac_sha256_end(
+    _olm_hmac_sha256_key const * hmac_key,
+    _olm_hmac_sha256_context * context,
+    std::uint8_t * output
+) {
+    hmac_sha256_finish(sha256_context(context), hmac_key, output);
+    olm::unset(*context);
+}
+
+
 void _olm_crypto_hmac_sha256(
     std::uint8_t const * key, std::size_t key_length,
     std::uint8_t const * input, std::size_t input_length,
     std::uint8_t * output
 ) {
-    std::uint8_t hmac_key[SHA256_BLOCK_LENGTH];
-    ::SHA256_CTX context;
-    hmac_sha256_key(key, key_length, hmac_key);
-    hmac_sha256_init(&context, hmac_key);
-    ::sha256_update(&context, input, input_length);
-    hmac_sha256_final(&context, hmac_key, output);
+    _olm_hmac_sha256_key hmac_key;
+    _olm_crypto_hmac_sha256_init_key(&hmac_key, key, key_length);
+    _olm_crypto_hmac_sha256_with_key(&hmac_key, input, input_length, output);
     olm::unset(hmac_key);
-    olm::unset(context);
 }
 
 
-void _olm_crypto_hkdf_sha256(
+void _olm_crypto_hkdf_sha256_with_salt_key(
+    _olm_hmac_sha256_key const * salt_key,
     std::uint8_t const * input, std::size_t input_length,
-    std::uint8_t const * salt, std::size_t salt_length,
     std::uint8_t const * info, std::size_t info_length,
     std::uint8_t * output, std::size_t output_length
 ) {
     ::SHA256_CTX context;
-    std::uint8_t hmac_key[SHA256_BLOCK_LENGTH];
+    _olm_hmac_sha256_key prk_key;
     std::uint8_t step_result[SHA256_OUTPUT_LENGTH];
     std::size_t bytes_remaining = output_length;
     std::uint8_t iteration = 1;
-    if (!salt) {
-        salt = HKDF_DEFAULT_SALT;
-        salt_length = sizeof(HKDF_DEFAULT_SALT);
-    }
+    OLM_STATS_ADD(hkdf_sha256, 1);
     /* Extract */
-    hmac_sha256_key(salt, salt_length, hmac_key);
-    hmac_sha256_init(&context, hmac_key);
-    ::sha256_update(&context, input, input_length);
-    hmac_sha256_final(&context, hmac_key, step_result);
-    hmac_sha256_key(step_result, SHA256_OUTPUT_LENGTH, hmac_key);
+    hmac_sha256_start(&context, salt_key);
+    sha256_hash_update(&context, input, input_length);
+    hmac_sha256_finish(&context, salt_key, step_result);
+    _olm_crypto_hmac_sha256_init_key(
+        &prk_key, step_result, SHA256_OUTPUT_LENGTH
+    );
 
     /* Expand */
-    hmac_sha256_init(&context, hmac_key);
-    ::sha256_update(&context, info, info_length);
-    ::sha256_update(&context, &iteration, 1);
-    hmac_sha256_final(&context, hmac_key, step_result);
+    hmac_sha256_start(&context, &prk_key);
+    sha256_hash_update(&context, info, info_length);
+    sha256_hash_update(&context, &iteration, 1);
+    hmac_sha256_finish(&context, &prk_key, step_result);
     while (bytes_remaining > SHA256_OUTPUT_LENGTH) {
         std::memcpy(output, step_result, SHA256_OUTPUT_LENGTH);
         output += SHA256_OUTPUT_LENGTH;
         bytes_remaining -= SHA256_OUTPUT_LENGTH;
         iteration ++;
-        hmac_sha256_init(&context, hmac_key);
-        ::sha256_update(&context, step_result, SHA256_OUTPUT_LENGTH);
-        ::sha256_update(&context, info, info_length);
-        ::sha256_update(&context, &iteration, 1);
-        hmac_sha256_final(&context, hmac_key, step_result);
+        hmac_sha256_start(&context, &prk_key);
+        sha256_hash_update(&context, step_result, SHA256_OUTPUT_LENGTH);
+        sha256_hash_update(&context, info, info_length);
+        sha256_hash_update(&context, &iteration, 1);
+        hmac_sha256_finish(&context, &prk_key, step_result);
     }
     std::memcpy(output, step_result, bytes_remaining);
     olm::unset(context);
-    olm::unset(hmac_key);
+    olm::unset(prk_key);
     olm::unset(step_result);
 }
+
+
+void _olm_crypto_hkdf_sha256(
+    std::uint8_t const * input, std::size_t input_length,
+    std::uint8_t const * salt, std::size_t salt_length,
+    std::uint8_t const * info, std::size_t info_length,
+    std::uint8_t * output, std::size_t output_length
+) {
+    if (!salt) {
+        _olm_crypto_hkdf_sha256_with_salt_key(
+            &HKDF_DEFAULT_SALT_KEY, input, input_length,
+            info, info_length, output, output_length
+        );
+        return;
+    }
+    _olm_hmac_sha256_key salt_key;
+    _olm_crypto_hmac_sha256_init_key(&salt_key, salt, salt_length);
+    _olm_crypto_hkdf_sha256_with_salt_key(
+        &salt_key, input, input_length, info, info_length,
+        output, output_length
+    );
+    olm::unset(salt_key);
+}
+
+
+namespace {
+
+/** HKDF-SHA-256 of up to OLM_SHA256_X8_LANES inputs side by side, each at
+ * most 55 bytes, with an info of at most 22 bytes so that every step of
+ * the expansion is a single block */
+static void hkdf_sha256_lanes(
+    _olm_hmac_sha256_key const * salt_key,
+    std::uint8_t const * const * inputs, std::size_t input_length,
+    std::uint8_t const * info, std::size_t info_length,
+    std::uint8_t * const * outputs, std::size_t output_length,
+    std::size_t count
+) {
+    std::uint8_t prks[OLM_SHA256_X8_LANES][SHA256_OUTPUT_LENGTH];
+    std::uint8_t steps[OLM_SHA256_X8_LANES][SHA256_BLOCK_LENGTH];
+    std::uint8_t results[OLM_SHA256_X8_LANES][SHA256_OUTPUT_LENGTH];
+    _olm_hmac_sha256_key prk_keys[OLM_SHA256_X8_LANES];
+    std::uint8_t * prk_ptrs[OLM_SHA256_X8_LANES];
+    std::uint8_t const * step_ptrs[OLM_SHA256_X8_LANES];
+    std::uint8_t * result_ptrs[OLM_SHA256_X8_LANES];
+    _olm_hmac_sha256_key * prk_key_ptrs[OLM_SHA256_X8_LANES];
+    std::size_t done = 0;
+    std::uint8_t iteration = 1;
+    OLM_STATS_ADD(hkdf_sha256, count);
+
+    for (std::size_t lane = 0; lane < count; ++lane) {
+        prk_ptrs[lane] = prks[lane];
+        step_ptrs[lane] = steps[lane];
+        result_ptrs[lane] = results[lane];
+        prk_key_ptrs[lane] = &prk_keys[lane];
+    }
+
+    /* Extract */
+    _olm_crypto_hmac_sha256_with_key_multi(
+        salt_key, inputs, input_length, prk_ptrs, count
+    );
+    _olm_crypto_hmac_sha256_init_key_multi(
+        prk_key_ptrs, prk_ptrs, SHA256_OUTPUT_LENGTH, count
+    );
+
+    /* Expand: T(n) = HMAC(PRK, T(n - 1) || info || n) */
+    while (done < output_length) {
+        std::size_t prefix = done ? SHA256_OUTPUT_LENGTH : 0;
+        std::size_t step_length = prefix + info_length + 1;
+        std::size_t length = output_length - done;
+        if (length > SHA256_OUTPUT_LENGTH) {
+            length = SHA256_OUTPUT_LENGTH;
+        }
+        for (std::size_t lane = 0; lane < count; ++lane) {
+            std::memcpy(steps[lane], results[lane], prefix);
+            std::memcpy(steps[lane] + prefix, info, info_length);
+            steps[lane][prefix + info_length] = iteration;
+        }
+        _olm_crypto_hmac_sha256_with_keys_multi(
+            prk_key_ptrs, step_ptrs, step_length, result_ptrs, count
+        );
+        for (std::size_t lane = 0; lane < count; ++lane) {
+            std::memcpy(outputs[lane] + done, results[lane], length);
+        }
+        done += length;
+        iteration++;
+    }
+    olm::unset(prks);
+    olm::unset(steps);
+    olm::unset(results);
+    olm::unset(prk_keys);
+}
+
+} // namespace
+
+
+void _olm_crypto_hkdf_sha256_multi(
+    std::uint8_t const * const * inputs, std::size_t input_length,
+    std::uint8_t const * salt, std::size_t salt_length,
+    std::uint8_t const * info, std::size_t info_length,
+    std::uint8_t * const * outputs, std::size_t output_length,
+    std::size_t count
+) {
+    if (count < 2
+            || _olm_crypto_hmac_sha256_lanes() < 2
+            || input_length > SHA256_BLOCK_LENGTH - 9
+            || SHA256_OUTPUT_LENGTH + info_length + 1
+                > SHA256_BLOCK_LENGTH - 9) {
+        for (std::size_t i = 0; i < count; ++i) {
+            _olm_crypto_hkdf_sha256(
+                inputs[i], input_length, salt, salt_length,
+                info, info_length, outputs[i], output_length
+            );
+        }
+        return;
+    }
+    _olm_hmac_sha256_key salt_key;
+    _olm_hmac_sha256_key const * salt_key_ptr = &HKDF_DEFAULT_SALT_KEY;
+    if (salt) {
+        _olm_crypto_hmac_sha256_init_key(&salt_key, salt, salt_length);
+        salt_key_ptr = &salt_key;
+    }
+    while (count) {
+        std::size_t n = count < OLM_SHA256_X8_LANES
+            ? count : OLM_SHA256_X8_LANES;
+        hkdf_sha256_lanes(
+            salt_key_ptr, inputs, input_length, info, info_length,
+            outputs, output_length, n
+        );
+        inputs += n;
+        outputs += n;
+        count -= n;
+    }
+    olm::unset(salt_key);
+}
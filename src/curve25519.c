@@ -0,0 +1,254 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/curve25519.h"
+#include "olm/curve25519_mb.h"
+#include "olm/dispatch.h"
+#include "olm/memory.h"
+
+#include <string.h>
+
+#include "curve25519-donna.h"
+#include "ed25519/src/ge.h"
+
+/* The 64-bit implementation needs 64x64->128 bit multiplies, which are only
+ * cheap on 64-bit targets. It exports the same symbol as the 32-bit one
+ * (which is always built, from the Makefile SOURCES) so we give it another
+ * name. */
+#if defined(__SIZEOF_INT128__) && defined(__LP64__)
+#define OLM_CURVE25519_C64 1
+#define curve25519_donna _olm_curve25519_donna_c64
+#include "curve25519-donna/curve25519-donna-c64.c"
+#undef curve25519_donna
+#endif
+
+#ifdef OLM_CURVE25519_C64
+static enum _olm_curve25519_backend backend = OLM_CURVE25519_DONNA_C64;
+#elif defined(__arm__)
+static enum _olm_curve25519_backend backend = OLM_CURVE25519_PAIRED;
+#else
+static enum _olm_curve25519_backend backend = OLM_CURVE25519_DONNA;
+#endif
+
+/* the u-coordinate of the base point */
+static const uint8_t X25519_BASE_POINT[32] = {9};
+
+/** the crypto provider's X25519, or NULL if it has none */
+static const struct OlmCryptoProvider * x25519_provider(void) {
+    const struct OlmCryptoProvider *provider = _olm_crypto_dispatch()->provider;
+    return provider && provider->x25519 ? provider : NULL;
+}
+
+void _olm_curve25519_scalarmult(
+    uint8_t * output, uint8_t const * secret, uint8_t const * point
+) {
+    const struct OlmCryptoProvider *provider = x25519_provider();
+    if (provider) {
+        provider->x25519(provider->context, output, secret, point);
+        return;
+    }
+#ifdef OLM_CURVE25519_C64
+    if (backend == OLM_CURVE25519_DONNA_C64) {
+        _olm_curve25519_donna_c64(output, secret, point);
+        return;
+    }
+#endif
+    if (backend == OLM_CURVE25519_PAIRED
+            && _olm_curve25519_paired_available()) {
+        _olm_curve25519_scalarmult_paired(output, secret, point);
+        return;
+    }
+    curve25519_donna(output, secret, point);
+}
+
+void _olm_curve25519_scalarmult_many(
+    size_t count,
+    uint8_t * const * outputs,
+    uint8_t const * const * secrets,
+    uint8_t const * const * points
+) {
+    const struct _olm_dispatch_table *table = _olm_crypto_dispatch();
+    size_t lanes = table->curve25519_lanes;
+    size_t i;
+
+    if (lanes > 1) {
+        /* a part-filled set of lanes costs as much as a full one, which is
+         * still cheaper than three-quarters of the ladders done one at a
+         * time by donna-c64, and always cheaper than the 32-bit donna */
+        size_t vector_count = count - count % lanes;
+        if (4 * (count % lanes) >= 3 * lanes
+                || table->curve25519 == OLM_CURVE25519_DONNA) {
+            vector_count = count;
+        }
+        _olm_curve25519_scalarmult_mb(vector_count, outputs, secrets, points);
+        outputs += vector_count;
+        secrets += vector_count;
+        points += vector_count;
+        count -= vector_count;
+    }
+    for (i = 0; i < count; ++i) {
+        _olm_curve25519_scalarmult(outputs[i], secrets[i], points[i]);
+    }
+}
+
+void _olm_curve25519_scalarmult_base(
+    uint8_t * output, uint8_t const * secret
+) {
+    const struct OlmCryptoProvider *provider = x25519_provider();
+    uint8_t scalar[32];
+    ge_p3 point;
+    fe z_plus_y, z_minus_y, u;
+
+    if (provider) {
+        provider->x25519(provider->context, output, secret, X25519_BASE_POINT);
+        return;
+    }
+
+    /* clamp the secret in the same way as the Curve25519 function. This also
+     * keeps it below 2^255 as ge_scalarmult_base requires. */
+    memcpy(scalar, secret, sizeof(scalar));
+    scalar[0] &= 248;
+    scalar[31] &= 127;
+    scalar[31] |= 64;
+
+    ge_scalarmult_base(&point, scalar);
+
+    /* the birational map from the Edwards curve to the Montgomery curve is
+     * u = (1 + y) / (1 - y), or in projective coordinates,
+     * u = (Z + Y) / (Z - Y). */
+    fe_add(z_plus_y, point.Z, point.Y);
+    fe_sub(z_minus_y, point.Z, point.Y);
+    fe_invert(z_minus_y, z_minus_y);
+    fe_mul(u, z_plus_y, z_minus_y);
+    fe_tobytes(output, u);
+
+    _olm_unset(scalar, sizeof(scalar));
+    _olm_unset(&point, sizeof(point));
+    _olm_unset(z_plus_y, sizeof(z_plus_y));
+    _olm_unset(z_minus_y, sizeof(z_minus_y));
+    _olm_unset(u, sizeof(u));
+}
+
+/* the number of public keys that share each inversion. Each one needs about
+ * 200 bytes of stack. */
+#define BASE_BATCH_SIZE 32
+
+/* compute outputs[0..count) for secrets[0..count), count <= BASE_BATCH_SIZE.
+ *
+ * Most of the time in _olm_curve25519_scalarmult_base goes on the final
+ * inversion, so here we invert the product of all the denominators once and
+ * recover each inverse with three multiplications (Montgomery's trick). */
+static void scalarmult_base_batch(
+    size_t count, uint8_t * outputs, uint8_t const * secrets
+) {
+    uint8_t scalar[32];
+    ge_p3 point;
+    fe z_plus_y[BASE_BATCH_SIZE];
+    /* products[i] is the product of the denominators before i */
+    fe products[BASE_BATCH_SIZE];
+    fe z_minus_y[BASE_BATCH_SIZE];
+    fe one, inverse, u;
+    size_t i;
+
+    fe_1(one);
+    for (i = 0; i < count; ++i) {
+        memcpy(scalar, secrets + 32 * i, sizeof(scalar));
+        scalar[0] &= 248;
+        scalar[31] &= 127;
+        scalar[31] |= 64;
+
+        ge_scalarmult_base(&point, scalar);
+
+        fe_add(z_plus_y[i], point.Z, point.Y);
+        fe_sub(z_minus_y[i], point.Z, point.Y);
+        /* Z - Y is only zero for the identity, which a clamped scalar, a
+         * multiple of 8 between 2^254 and 2^255, can't give: the nearest
+         * multiples of the group order l are 4l and 8l. So none of the
+         * products below is zero. */
+
+        if (i == 0) {
+            fe_copy(products[0], one);
+        } else {
+            fe_mul(products[i], products[i - 1], z_minus_y[i - 1]);
+        }
+    }
+
+    if (count) {
+        fe_mul(inverse, products[count - 1], z_minus_y[count - 1]);
+        fe_invert(inverse, inverse);
+    }
+    for (i = count; i-- > 0;) {
+        /* inverse is 1 / (z_minus_y[0] ... z_minus_y[i]) */
+        fe_mul(u, inverse, products[i]);
+        fe_mul(inverse, inverse, z_minus_y[i]);
+        fe_mul(u, u, z_plus_y[i]);
+        fe_tobytes(outputs + 32 * i, u);
+    }
+
+    _olm_unset(scalar, sizeof(scalar));
+    _olm_unset(&point, sizeof(point));
+    _olm_unset(z_plus_y, sizeof(z_plus_y));
+    _olm_unset(products, sizeof(products));
+    _olm_unset(z_minus_y, sizeof(z_minus_y));
+    _olm_unset(inverse, sizeof(inverse));
+    _olm_unset(u, sizeof(u));
+}
+
+void _olm_curve25519_scalarmult_base_batch(
+    size_t count, uint8_t * outputs, uint8_t const * secrets
+) {
+    size_t n;
+    if (x25519_provider()) {
+        for (n = 0; n < count; ++n) {
+            _olm_curve25519_scalarmult_base(outputs + 32 * n, secrets + 32 * n);
+        }
+        return;
+    }
+    while (count) {
+        n = count < BASE_BATCH_SIZE ? count : BASE_BATCH_SIZE;
+        scalarmult_base_batch(n, outputs, secrets);
+        outputs += 32 * n;
+        secrets += 32 * n;
+        count -= n;
+    }
+}
+
+enum _olm_curve25519_backend _olm_curve25519_get_backend(void) {
+    if (backend == OLM_CURVE25519_PAIRED
+            && !_olm_curve25519_paired_available()) {
+        return OLM_CURVE25519_DONNA;
+    }
+    return backend;
+}
+
+int _olm_curve25519_set_backend(enum _olm_curve25519_backend new_backend) {
+    switch (new_backend) {
+    case OLM_CURVE25519_DONNA:
+        break;
+#ifdef OLM_CURVE25519_C64
+    case OLM_CURVE25519_DONNA_C64:
+        break;
+#endif
+    case OLM_CURVE25519_PAIRED:
+        if (!_olm_curve25519_paired_available()) {
+            return 0;
+        }
+        break;
+    default:
+        return 0;
+    }
+    backend = new_backend;
+    return 1;
+}
@@ -0,0 +1,685 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/curve25519_mb.h"
+#include "olm/cpu.h"
+#include "olm/memory.h"
+
+#include <string.h>
+
+/* The vector code is written once in terms of these macros. V is a vector
+ * of 64-bit words, one per lane, and each lane runs its own Montgomery
+ * ladder.
+ *
+ *   VADD, VSUB, VAND, VXOR: lane-wise arithmetic
+ *   VMUL(x, y):       the product of the low 32 bits of each lane
+ *   VSHR(x, n), VSHL(x, n): shift by the constant n
+ *   VSET1(x):         broadcast x to all lanes
+ *   VLOAD(p), VSTORE(p, v): to and from VLANES words in memory
+ *   VSWAP(x):         x with lanes 0 and 1 swapped
+ *   VLOW2(x, y):      x with lane 1 replaced by lane 0 of y
+ *   TARGET:           the attribute the functions using them need
+ */
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define OLM_CURVE25519_MB 1
+#define VLANES 4
+#define VNAME "avx2"
+#define TARGET __attribute__((target("avx2")))
+
+typedef __m256i V;
+#define VADD(x, y) _mm256_add_epi64(x, y)
+#define VSUB(x, y) _mm256_sub_epi64(x, y)
+#define VAND(x, y) _mm256_and_si256(x, y)
+#define VXOR(x, y) _mm256_xor_si256(x, y)
+#define VMUL(x, y) _mm256_mul_epu32(x, y)
+#define VSHR(x, n) _mm256_srli_epi64(x, n)
+#define VSHL(x, n) _mm256_slli_epi64(x, n)
+#define VSET1(x) _mm256_set1_epi64x((long long) (x))
+#define VSWAP(x) _mm256_permute4x64_epi64(x, 0xe1)
+#define VLOW2(x, y) \
+    _mm256_blend_epi32(x, _mm256_permute4x64_epi64(y, 0), 0x0c)
+#define VLOAD(p) _mm256_loadu_si256((__m256i const *) (p))
+#define VSTORE(p, v) _mm256_storeu_si256((__m256i *) (p), v)
+
+static int vector_unit_available(void) {
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_AVX2) != 0;
+}
+
+#elif defined(__aarch64__) \
+    || (defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)))
+
+/* on 32-bit ARM NEON is optional, so this is built with it enabled (as
+ * curve25519_mb.c.neon in the Android.mk) and only used if cpu.c finds it */
+#include <arm_neon.h>
+
+#define OLM_CURVE25519_MB 1
+#define VLANES 2
+#define VNAME "neon"
+#define TARGET
+
+typedef uint64x2_t V;
+#define VADD(x, y) vaddq_u64(x, y)
+#define VSUB(x, y) vsubq_u64(x, y)
+#define VAND(x, y) vandq_u64(x, y)
+#define VXOR(x, y) veorq_u64(x, y)
+#define VMUL(x, y) vmull_u32(vmovn_u64(x), vmovn_u64(y))
+#define VSHR(x, n) vshrq_n_u64(x, n)
+#define VSHL(x, n) vshlq_n_u64(x, n)
+#define VSET1(x) vdupq_n_u64(x)
+#define VLOAD(p) vld1q_u64(p)
+#define VSTORE(p, v) vst1q_u64(p, v)
+#define VSWAP(x) vextq_u64(x, x, 1)
+#define VLOW2(x, y) vcombine_u64(vget_low_u64(x), vget_low_u64(y))
+
+static int vector_unit_available(void) {
+    /* NEON is always there on ARMv8, and optional on ARMv7; either way it
+     * can be masked off */
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_SIMD128) != 0;
+}
+
+#endif
+
+#ifdef OLM_CURVE25519_MB
+
+/* Field elements are ten limbs of alternately 26 and 25 bits, as in
+ * curve25519-donna.c, but unsigned, so that the 32x32->64 bit multiplies of
+ * the vector units can be used. A carried element has limbs below 2^26 and
+ * 2^25 (plus a little on limbs 1 and 5); sums and differences of two
+ * carried elements are the most that is ever multiplied, which keeps every
+ * multiplicand below 2^32 and every sum of products below 2^64. */
+typedef V fe_v[10];
+
+#define MASK26 0x3ffffffu
+#define MASK25 0x1ffffffu
+
+/* the ladder step is several independent multiplies, which only overlap in
+ * the pipeline if they are all inlined into it */
+#define INLINE __attribute__((always_inline)) inline
+
+#define MAC(h, x, y) ((h) = VADD((h), VMUL((x), (y))))
+
+/** lane-wise h = f + g */
+TARGET static void fv_add(V * h, V const * f, V const * g) {
+    int i;
+    for (i = 0; i < 10; ++i) {
+        h[i] = VADD(f[i], g[i]);
+    }
+}
+
+/** lane-wise h = f - g, adding 2p to keep every limb positive. g must be
+ * carried. */
+TARGET static void fv_sub(V * h, V const * f, V const * g) {
+    const V two_p0 = VSET1(2 * (MASK26 - 18));
+    const V two_p_even = VSET1(2 * MASK26);
+    const V two_p_odd = VSET1(2 * MASK25);
+    int i;
+    h[0] = VSUB(VADD(f[0], two_p0), g[0]);
+    for (i = 1; i < 10; ++i) {
+        h[i] = VSUB(VADD(f[i], i & 1 ? two_p_odd : two_p_even), g[i]);
+    }
+}
+
+#define CARRY(h, i, bits) do { \
+        V carry = VSHR(h[i], bits); \
+        h[(i) + 1] = VADD(h[(i) + 1], carry); \
+        h[i] = VAND(h[i], bits == 26 ? mask26 : mask25); \
+    } while (0)
+
+/** Carry the 64-bit sums of products in h down to 26 and 25 bit limbs, as
+ * two interleaved chains */
+TARGET INLINE static void fv_carry(V * h) {
+    const V mask26 = VSET1(MASK26);
+    const V mask25 = VSET1(MASK25);
+    V c;
+    CARRY(h, 0, 26); CARRY(h, 4, 26);
+    CARRY(h, 1, 25); CARRY(h, 5, 25);
+    CARRY(h, 2, 26); CARRY(h, 6, 26);
+    CARRY(h, 3, 25); CARRY(h, 7, 25);
+    CARRY(h, 4, 26); CARRY(h, 8, 26);
+    /* 2^255 = 19 (mod p). The carry can be over 32 bits, so multiply by 19
+     * with shifts. */
+    c = VSHR(h[9], 25);
+    h[9] = VAND(h[9], mask25);
+    h[0] = VADD(h[0], VADD(c, VADD(VSHL(c, 1), VSHL(c, 4))));
+    CARRY(h, 0, 26);
+}
+
+/** lane-wise h = f * g, carried */
+TARGET INLINE static void fv_mul(V * out, V const * f, V const * g) {
+    const V nineteen = VSET1(19);
+    V f2[10], g19[10], h[10];
+    int i;
+    for (i = 1; i < 10; ++i) {
+        f2[i] = VADD(f[i], f[i]);
+        g19[i] = VMUL(g[i], nineteen);
+    }
+    h[0] = VMUL(f[0], g[0]);
+    MAC(h[0], f2[1], g19[9]); MAC(h[0], f[2], g19[8]);
+    MAC(h[0], f2[3], g19[7]); MAC(h[0], f[4], g19[6]);
+    MAC(h[0], f2[5], g19[5]); MAC(h[0], f[6], g19[4]);
+    MAC(h[0], f2[7], g19[3]); MAC(h[0], f[8], g19[2]);
+    MAC(h[0], f2[9], g19[1]);
+    h[1] = VMUL(f[0], g[1]);
+    MAC(h[1], f[1], g[0]); MAC(h[1], f[2], g19[9]); MAC(h[1], f[3], g19[8]);
+    MAC(h[1], f[4], g19[7]); MAC(h[1], f[5], g19[6]); MAC(h[1], f[6], g19[5]);
+    MAC(h[1], f[7], g19[4]); MAC(h[1], f[8], g19[3]); MAC(h[1], f[9], g19[2]);
+    h[2] = VMUL(f[0], g[2]);
+    MAC(h[2], f2[1], g[1]); MAC(h[2], f[2], g[0]); MAC(h[2], f2[3], g19[9]);
+    MAC(h[2], f[4], g19[8]); MAC(h[2], f2[5], g19[7]); MAC(h[2], f[6], g19[6]);
+    MAC(h[2], f2[7], g19[5]); MAC(h[2], f[8], g19[4]);
+    MAC(h[2], f2[9], g19[3]);
+    h[3] = VMUL(f[0], g[3]);
+    MAC(h[3], f[1], g[2]); MAC(h[3], f[2], g[1]); MAC(h[3], f[3], g[0]);
+    MAC(h[3], f[4], g19[9]); MAC(h[3], f[5], g19[8]); MAC(h[3], f[6], g19[7]);
+    MAC(h[3], f[7], g19[6]); MAC(h[3], f[8], g19[5]); MAC(h[3], f[9], g19[4]);
+    h[4] = VMUL(f[0], g[4]);
+    MAC(h[4], f2[1], g[3]); MAC(h[4], f[2], g[2]); MAC(h[4], f2[3], g[1]);
+    MAC(h[4], f[4], g[0]); MAC(h[4], f2[5], g19[9]); MAC(h[4], f[6], g19[8]);
+    MAC(h[4], f2[7], g19[7]); MAC(h[4], f[8], g19[6]);
+    MAC(h[4], f2[9], g19[5]);
+    h[5] = VMUL(f[0], g[5]);
+    MAC(h[5], f[1], g[4]); MAC(h[5], f[2], g[3]); MAC(h[5], f[3], g[2]);
+    MAC(h[5], f[4], g[1]); MAC(h[5], f[5], g[0]); MAC(h[5], f[6], g19[9]);
+    MAC(h[5], f[7], g19[8]); MAC(h[5], f[8], g19[7]); MAC(h[5], f[9], g19[6]);
+    h[6] = VMUL(f[0], g[6]);
+    MAC(h[6], f2[1], g[5]); MAC(h[6], f[2], g[4]); MAC(h[6], f2[3], g[3]);
+    MAC(h[6], f[4], g[2]); MAC(h[6], f2[5], g[1]); MAC(h[6], f[6], g[0]);
+    MAC(h[6], f2[7], g19[9]); MAC(h[6], f[8], g19[8]);
+    MAC(h[6], f2[9], g19[7]);
+    h[7] = VMUL(f[0], g[7]);
+    MAC(h[7], f[1], g[6]); MAC(h[7], f[2], g[5]); MAC(h[7], f[3], g[4]);
+    MAC(h[7], f[4], g[3]); MAC(h[7], f[5], g[2]); MAC(h[7], f[6], g[1]);
+    MAC(h[7], f[7], g[0]); MAC(h[7], f[8], g19[9]); MAC(h[7], f[9], g19[8]);
+    h[8] = VMUL(f[0], g[8]);
+    MAC(h[8], f2[1], g[7]); MAC(h[8], f[2], g[6]); MAC(h[8], f2[3], g[5]);
+    MAC(h[8], f[4], g[4]); MAC(h[8], f2[5], g[3]); MAC(h[8], f[6], g[2]);
+    MAC(h[8], f2[7], g[1]); MAC(h[8], f[8], g[0]); MAC(h[8], f2[9], g19[9]);
+    h[9] = VMUL(f[0], g[9]);
+    MAC(h[9], f[1], g[8]); MAC(h[9], f[2], g[7]); MAC(h[9], f[3], g[6]);
+    MAC(h[9], f[4], g[5]); MAC(h[9], f[5], g[4]); MAC(h[9], f[6], g[3]);
+    MAC(h[9], f[7], g[2]); MAC(h[9], f[8], g[1]); MAC(h[9], f[9], g[0]);
+    fv_carry(h);
+    memcpy(out, h, sizeof(h));
+}
+
+/** lane-wise h = f * f, carried */
+TARGET INLINE static void fv_sq(V * out, V const * f) {
+    const V nineteen = VSET1(19);
+    const V thirty_eight = VSET1(38);
+    V f2[10], f19[10], f38[10], h[10];
+    int i;
+    for (i = 0; i < 10; ++i) {
+        f2[i] = VADD(f[i], f[i]);
+    }
+    for (i = 5; i < 10; ++i) {
+        f19[i] = VMUL(f[i], nineteen);
+        f38[i] = VMUL(f[i], thirty_eight);
+    }
+    h[0] = VMUL(f[0], f[0]);
+    MAC(h[0], f2[1], f38[9]); MAC(h[0], f2[2], f19[8]);
+    MAC(h[0], f2[3], f38[7]); MAC(h[0], f2[4], f19[6]);
+    MAC(h[0], f[5], f38[5]);
+    h[1] = VMUL(f2[0], f[1]);
+    MAC(h[1], f2[2], f19[9]); MAC(h[1], f2[3], f19[8]);
+    MAC(h[1], f2[4], f19[7]); MAC(h[1], f2[5], f19[6]);
+    h[2] = VMUL(f2[0], f[2]);
+    MAC(h[2], f2[1], f[1]); MAC(h[2], f2[3], f38[9]); MAC(h[2], f2[4], f19[8]);
+    MAC(h[2], f2[5], f38[7]); MAC(h[2], f[6], f19[6]);
+    h[3] = VMUL(f2[0], f[3]);
+    MAC(h[3], f2[1], f[2]); MAC(h[3], f2[4], f19[9]); MAC(h[3], f2[5], f19[8]);
+    MAC(h[3], f2[6], f19[7]);
+    h[4] = VMUL(f2[0], f[4]);
+    MAC(h[4], f2[1], f2[3]); MAC(h[4], f[2], f[2]); MAC(h[4], f2[5], f38[9]);
+    MAC(h[4], f2[6], f19[8]); MAC(h[4], f[7], f38[7]);
+    h[5] = VMUL(f2[0], f[5]);
+    MAC(h[5], f2[1], f[4]); MAC(h[5], f2[2], f[3]); MAC(h[5], f2[6], f19[9]);
+    MAC(h[5], f2[7], f19[8]);
+    h[6] = VMUL(f2[0], f[6]);
+    MAC(h[6], f2[1], f2[5]); MAC(h[6], f2[2], f[4]); MAC(h[6], f2[3], f[3]);
+    MAC(h[6], f2[7], f38[9]); MAC(h[6], f[8], f19[8]);
+    h[7] = VMUL(f2[0], f[7]);
+    MAC(h[7], f2[1], f[6]); MAC(h[7], f2[2], f[5]); MAC(h[7], f2[3], f[4]);
+    MAC(h[7], f2[8], f19[9]);
+    h[8] = VMUL(f2[0], f[8]);
+    MAC(h[8], f2[1], f2[7]); MAC(h[8], f2[2], f[6]); MAC(h[8], f2[3], f2[5]);
+    MAC(h[8], f[4], f[4]); MAC(h[8], f[9], f38[9]);
+    h[9] = VMUL(f2[0], f[9]);
+    MAC(h[9], f2[1], f[8]); MAC(h[9], f2[2], f[7]); MAC(h[9], f2[3], f[6]);
+    MAC(h[9], f2[4], f[5]);
+    fv_carry(h);
+    memcpy(out, h, sizeof(h));
+}
+
+/** lane-wise h = f squared n times */
+TARGET static void fv_sq_n(V * h, V const * f, int n) {
+    fv_sq(h, f);
+    while (--n) {
+        fv_sq(h, h);
+    }
+}
+
+/** lane-wise h = f * 121665, carried */
+TARGET static void fv_mul_a24(V * h, V const * f) {
+    const V a24 = VSET1(121665);
+    int i;
+    for (i = 0; i < 10; ++i) {
+        h[i] = VMUL(f[i], a24);
+    }
+    fv_carry(h);
+}
+
+/** lane-wise h = 1/z = z^(p-2), with the same chain as ref10 */
+TARGET static void fv_invert(V * out, V const * z) {
+    fe_v t0, t1, t2, t3;
+    fv_sq(t0, z);
+    fv_sq_n(t1, t0, 2);
+    fv_mul(t1, z, t1);
+    fv_mul(t0, t0, t1);
+    fv_sq(t2, t0);
+    fv_mul(t1, t1, t2);
+    fv_sq_n(t2, t1, 5);
+    fv_mul(t1, t2, t1);
+    fv_sq_n(t2, t1, 10);
+    fv_mul(t2, t2, t1);
+    fv_sq_n(t3, t2, 20);
+    fv_mul(t2, t3, t2);
+    fv_sq_n(t2, t2, 10);
+    fv_mul(t1, t2, t1);
+    fv_sq_n(t2, t1, 50);
+    fv_mul(t2, t2, t1);
+    fv_sq_n(t3, t2, 100);
+    fv_mul(t2, t3, t2);
+    fv_sq_n(t2, t2, 50);
+    fv_mul(t1, t2, t1);
+    fv_sq_n(t1, t1, 5);
+    fv_mul(out, t1, t0);
+    _olm_unset(t0, sizeof(t0));
+    _olm_unset(t1, sizeof(t1));
+    _olm_unset(t2, sizeof(t2));
+    _olm_unset(t3, sizeof(t3));
+}
+
+/** swap the lanes of a and b where mask is all ones */
+TARGET static void fv_cswap(V * a, V * b, V mask) {
+    int i;
+    for (i = 0; i < 10; ++i) {
+        V t = VAND(mask, VXOR(a[i], b[i]));
+        a[i] = VXOR(a[i], t);
+        b[i] = VXOR(b[i], t);
+    }
+}
+
+/** h = f with lanes 0 and 1 swapped */
+TARGET static void fv_swap(V * h, V const * f) {
+    int i;
+    for (i = 0; i < 10; ++i) {
+        h[i] = VSWAP(f[i]);
+    }
+}
+
+/** h = f with lane 1 replaced by lane 0 of g */
+TARGET static void fv_low2(V * h, V const * f, V const * g) {
+    int i;
+    for (i = 0; i < 10; ++i) {
+        h[i] = VLOW2(f[i], g[i]);
+    }
+}
+
+/** swap lanes 0 and 1 of h where mask is all ones */
+TARGET static void fv_cswap_lanes(V * h, V mask) {
+    int i;
+    for (i = 0; i < 10; ++i) {
+        h[i] = VXOR(h[i], VAND(mask, VXOR(h[i], VSWAP(h[i]))));
+    }
+}
+
+/** the bit offset of each limb */
+static const int limb_offsets[10] = {0, 26, 51, 77, 102, 128, 153, 179, 204, 230};
+
+/** Unpack the low 255 bits of a 32 byte little-endian number into limbs */
+static void unpack(uint64_t * limbs, size_t stride, uint8_t const * bytes) {
+    int i;
+    for (i = 0; i < 10; ++i) {
+        int offset = limb_offsets[i], bits = i & 1 ? 25 : 26;
+        uint64_t word = 0;
+        int b;
+        /* the limb is within the four bytes from its first byte */
+        for (b = 3; b >= 0; --b) {
+            int pos = offset / 8 + b;
+            word = (word << 8) | (pos < 32 ? bytes[pos] : 0);
+        }
+        limbs[i * stride] = (word >> (offset % 8)) & ((1u << bits) - 1);
+    }
+}
+
+/** Reduce a carried element fully mod p and pack it into 32 bytes, as
+ * ref10's fe_tobytes */
+static void pack(uint8_t * bytes, uint64_t const * limbs, size_t stride) {
+    int64_t h[10];
+    int64_t q, carry;
+    int i;
+    for (i = 0; i < 10; ++i) {
+        h[i] = (int64_t) limbs[i * stride];
+    }
+    /* h is carried, so the limbs are nearly reduced. Carry once more to
+     * bring 1 and 5 down too. */
+    for (i = 0; i < 9; ++i) {
+        int bits = i & 1 ? 25 : 26;
+        h[i + 1] += h[i] >> bits;
+        h[i] &= ((int64_t) 1 << bits) - 1;
+    }
+    carry = h[9] >> 25;
+    h[9] &= MASK25;
+    h[0] += 19 * carry;
+    carry = h[0] >> 26;
+    h[0] &= MASK26;
+    h[1] += carry;
+
+    /* q is 1 if h >= p, and 0 otherwise */
+    q = (19 * h[9] + ((int64_t) 1 << 24)) >> 25;
+    for (i = 0; i < 10; ++i) {
+        q = (h[i] + q) >> (i & 1 ? 25 : 26);
+    }
+    /* h - q * p, computed as h + 19q - q * 2^255 */
+    h[0] += 19 * q;
+    for (i = 0; i < 9; ++i) {
+        int bits = i & 1 ? 25 : 26;
+        h[i + 1] += h[i] >> bits;
+        h[i] &= ((int64_t) 1 << bits) - 1;
+    }
+    h[9] &= MASK25;
+
+    memset(bytes, 0, 32);
+    for (i = 0; i < 10; ++i) {
+        uint64_t value = (uint64_t) h[i] << (limb_offsets[i] % 8);
+        int pos = limb_offsets[i] / 8;
+        for (; value; value >>= 8, ++pos) {
+            bytes[pos] |= (uint8_t) value;
+        }
+    }
+    _olm_unset(h, sizeof(h));
+}
+
+/** the ladder for VLANES secrets and points */
+TARGET static void scalarmult_lanes(
+    uint8_t * const * outputs,
+    uint8_t const * const * secrets,
+    uint8_t const * const * points
+) {
+    uint64_t words[10][VLANES];
+    uint64_t masks[VLANES];
+    uint8_t scalars[VLANES][32];
+    fe_v x1, x2, z2, x3, z3;
+    fe_v a, aa, b, bb, e, c, d, da, cb, t;
+    uint64_t swap[VLANES];
+    int lane, i, pos;
+
+    for (lane = 0; lane < VLANES; ++lane) {
+        memcpy(scalars[lane], secrets[lane], 32);
+        scalars[lane][0] &= 248;
+        scalars[lane][31] &= 127;
+        scalars[lane][31] |= 64;
+        unpack(&words[0][lane], VLANES, points[lane]);
+        swap[lane] = 0;
+    }
+    for (i = 0; i < 10; ++i) {
+        x1[i] = VLOAD(words[i]);
+        x3[i] = x1[i];
+        x2[i] = VSET1(i == 0);
+        z2[i] = VSET1(0);
+        z3[i] = VSET1(i == 0);
+    }
+
+    for (pos = 254; pos >= 0; --pos) {
+        for (lane = 0; lane < VLANES; ++lane) {
+            uint64_t bit = (scalars[lane][pos >> 3] >> (pos & 7)) & 1;
+            masks[lane] = 0 - (swap[lane] ^ bit);
+            swap[lane] = bit;
+        }
+        fv_cswap(x2, x3, VLOAD(masks));
+        fv_cswap(z2, z3, VLOAD(masks));
+
+        fv_add(a, x2, z2);
+        fv_sq(aa, a);
+        fv_sub(b, x2, z2);
+        fv_sq(bb, b);
+        fv_sub(e, aa, bb);
+        fv_add(c, x3, z3);
+        fv_sub(d, x3, z3);
+        fv_mul(da, d, a);
+        fv_mul(cb, c, b);
+        fv_add(t, da, cb);
+        fv_sq(x3, t);
+        fv_sub(t, da, cb);
+        fv_sq(t, t);
+        fv_mul(z3, x1, t);
+        fv_mul(x2, aa, bb);
+        fv_mul_a24(t, e);
+        fv_add(t, aa, t);
+        fv_mul(z2, e, t);
+    }
+    for (lane = 0; lane < VLANES; ++lane) {
+        masks[lane] = 0 - swap[lane];
+    }
+    fv_cswap(x2, x3, VLOAD(masks));
+    fv_cswap(z2, z3, VLOAD(masks));
+
+    fv_invert(z2, z2);
+    fv_mul(x2, x2, z2);
+    for (i = 0; i < 10; ++i) {
+        VSTORE(words[i], x2[i]);
+    }
+    for (lane = 0; lane < VLANES; ++lane) {
+        pack(outputs[lane], &words[0][lane], VLANES);
+    }
+
+    _olm_unset(words, sizeof(words));
+    _olm_unset(masks, sizeof(masks));
+    _olm_unset(scalars, sizeof(scalars));
+    _olm_unset(swap, sizeof(swap));
+    _olm_unset(x2, sizeof(x2));
+    _olm_unset(z2, sizeof(z2));
+    _olm_unset(x3, sizeof(x3));
+    _olm_unset(z3, sizeof(z3));
+    _olm_unset(a, sizeof(a));
+    _olm_unset(aa, sizeof(aa));
+    _olm_unset(b, sizeof(b));
+    _olm_unset(bb, sizeof(bb));
+    _olm_unset(e, sizeof(e));
+    _olm_unset(c, sizeof(c));
+    _olm_unset(d, sizeof(d));
+    _olm_unset(da, sizeof(da));
+    _olm_unset(cb, sizeof(cb));
+    _olm_unset(t, sizeof(t));
+}
+
+/** The ladder for a single secret and point, with the independent halves
+ * of each step side by side: x2 and z2 are lane 0 of xx and zz, and x3 and
+ * z3 lane 1. A step is then five vector multiplies instead of nine scalar
+ * ones; only the last, for z2, leaves lane 1 idle. */
+TARGET static void scalarmult_paired(
+    uint8_t * output, uint8_t const * secret, uint8_t const * point
+) {
+    uint64_t words[10][VLANES];
+    uint8_t scalar[32];
+    fe_v x1, xx, zz, ac, bd, dacb, aabb, x3t, e, f, p, q, t, u;
+    uint64_t swap = 0;
+    int i, pos;
+
+    memcpy(scalar, secret, 32);
+    scalar[0] &= 248;
+    scalar[31] &= 127;
+    scalar[31] |= 64;
+
+    /* (x2, x3) = (1, x1) and (z2, z3) = (0, 1) */
+    memset(words, 0, sizeof(words));
+    unpack(&words[0][1], VLANES, point);
+    words[0][0] = 1;
+    for (i = 0; i < 10; ++i) {
+        xx[i] = VLOAD(words[i]);
+    }
+    memset(words, 0, sizeof(words));
+    words[0][1] = 1;
+    for (i = 0; i < 10; ++i) {
+        zz[i] = VLOAD(words[i]);
+    }
+    fv_swap(x1, xx);
+
+    for (pos = 254; pos >= 0; --pos) {
+        uint64_t bit = (scalar[pos >> 3] >> (pos & 7)) & 1;
+        V mask = VSET1(0 - (swap ^ bit));
+        swap = bit;
+        fv_cswap_lanes(xx, mask);
+        fv_cswap_lanes(zz, mask);
+
+        fv_add(ac, xx, zz);       /* (A, C) */
+        fv_sub(bd, xx, zz);       /* (B, D) */
+        fv_swap(t, bd);
+        fv_mul(dacb, t, ac);      /* (DA, CB) */
+        fv_low2(t, ac, bd);
+        fv_sq(aabb, t);           /* (AA, BB) */
+        fv_swap(t, dacb);
+        fv_add(u, dacb, t);
+        fv_sub(t, dacb, t);
+        fv_low2(t, u, t);
+        fv_sq(x3t, t);            /* (x3, (DA - CB)^2) */
+        fv_swap(t, aabb);
+        fv_sub(e, aabb, t);       /* (E, -E) */
+        fv_low2(q, t, x1);        /* (BB, x1) */
+        fv_mul_a24(f, e);
+        fv_add(f, aabb, f);       /* (AA + a24 E, .) */
+        fv_swap(u, x3t);
+        fv_low2(p, aabb, u);      /* (AA, (DA - CB)^2) */
+        fv_mul(p, p, q);          /* (x2, z3) */
+        fv_mul(f, e, f);          /* (z2, .) */
+        fv_low2(xx, p, x3t);
+        fv_swap(u, p);
+        fv_low2(zz, f, u);
+    }
+    fv_cswap_lanes(xx, VSET1(0 - swap));
+    fv_cswap_lanes(zz, VSET1(0 - swap));
+
+    fv_invert(zz, zz);
+    fv_mul(xx, xx, zz);
+    for (i = 0; i < 10; ++i) {
+        VSTORE(words[i], xx[i]);
+    }
+    pack(output, &words[0][0], VLANES);
+
+    _olm_unset(words, sizeof(words));
+    _olm_unset(scalar, sizeof(scalar));
+    _olm_unset(&swap, sizeof(swap));
+    _olm_unset(xx, sizeof(xx));
+    _olm_unset(zz, sizeof(zz));
+    _olm_unset(ac, sizeof(ac));
+    _olm_unset(bd, sizeof(bd));
+    _olm_unset(dacb, sizeof(dacb));
+    _olm_unset(aabb, sizeof(aabb));
+    _olm_unset(x3t, sizeof(x3t));
+    _olm_unset(e, sizeof(e));
+    _olm_unset(f, sizeof(f));
+    _olm_unset(p, sizeof(p));
+    _olm_unset(q, sizeof(q));
+    _olm_unset(t, sizeof(t));
+    _olm_unset(u, sizeof(u));
+}
+
+size_t _olm_curve25519_mb_lanes(void) {
+    return vector_unit_available() ? VLANES : 1;
+}
+
+int _olm_curve25519_paired_available(void) {
+    return vector_unit_available();
+}
+
+void _olm_curve25519_scalarmult_paired(
+    uint8_t * output, uint8_t const * secret, uint8_t const * point
+) {
+    scalarmult_paired(output, secret, point);
+}
+
+const char * _olm_curve25519_mb_name(void) {
+    return vector_unit_available() ? VNAME : "none";
+}
+
+void _olm_curve25519_scalarmult_mb(
+    size_t count,
+    uint8_t * const * outputs,
+    uint8_t const * const * secrets,
+    uint8_t const * const * points
+) {
+    uint8_t * lane_outputs[VLANES];
+    uint8_t const * lane_secrets[VLANES];
+    uint8_t const * lane_points[VLANES];
+    uint8_t spare[VLANES][32];
+    size_t i;
+
+    while (count) {
+        size_t n = count < VLANES ? count : VLANES;
+        /* unused lanes repeat the first, into a scratch output */
+        for (i = 0; i < VLANES; ++i) {
+            lane_outputs[i] = i < n ? outputs[i] : spare[i];
+            lane_secrets[i] = secrets[i < n ? i : 0];
+            lane_points[i] = points[i < n ? i : 0];
+        }
+        scalarmult_lanes(lane_outputs, lane_secrets, lane_points);
+        outputs += n;
+        secrets += n;
+        points += n;
+        count -= n;
+    }
+    _olm_unset(spare, sizeof(spare));
+}
+
+#else
+
+size_t _olm_curve25519_mb_lanes(void) {
+    return 1;
+}
+
+int _olm_curve25519_paired_available(void) {
+    return 0;
+}
+
+void _olm_curve25519_scalarmult_paired(
+    uint8_t * output, uint8_t const * secret, uint8_t const * point
+) {
+    /* never called: callers check _olm_curve25519_paired_available() */
+    (void) output;
+    (void) secret;
+    (void) point;
+}
+
+const char * _olm_curve25519_mb_name(void) {
+    return "none";
+}
+
+void _olm_curve25519_scalarmult_mb(
+    size_t count,
+    uint8_t * const * outputs,
+    uint8_t const * const * secrets,
+    uint8_t const * const * points
+) {
+    /* never called: callers check _olm_curve25519_mb_lanes() first */
+    (void) count;
+    (void) outputs;
+    (void) secrets;
+    (void) points;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/dispatch.h"
+
+#include "olm/aes_hw.h"
+#include "olm/base64_simd.h"
+#include "olm/cpu.h"
+#include "olm/curve25519_mb.h"
+#include "olm/memory.h"
+#include "olm/sha256_hw.h"
+#include "olm/sha256_mb.h"
+#include "olm/sha512_hw.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "crypto-algorithms/sha256.h"
+
+/* not in the header, but we drive the compression function ourselves */
+void sha256_transform(SHA256_CTX *ctx, const BYTE data[]);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES_HW_NAME "aes-ni"
+#define GCM_HW_NAME "pclmul"
+#define SHA256_HW_NAME "sha-ni"
+#define SHA512_HW_NAME "avx2"
+#define SIMD128_NAME "ssse3"
+#define X4_NAME "sse2"
+#elif defined(__aarch64__)
+#define AES_HW_NAME "armv8-ce"
+#define SHA256_HW_NAME "armv8-ce"
+#define SHA512_HW_NAME "armv8.2-sha512"
+#define SIMD128_NAME "neon"
+#define X4_NAME "neon"
+#elif defined(__wasm_simd128__)
+#define SIMD128_NAME "simd128"
+#define X4_NAME "simd128"
+#endif
+
+#ifndef AES_HW_NAME
+#define AES_HW_NAME "none"
+#define SHA256_HW_NAME "none"
+#endif
+#ifndef SHA512_HW_NAME
+#define SHA512_HW_NAME "none"
+#endif
+#ifndef GCM_HW_NAME
+#define GCM_HW_NAME "none"
+#endif
+#ifndef SIMD128_NAME
+#define SIMD128_NAME "none"
+#define X4_NAME "none"
+#endif
+
+static struct _olm_dispatch_table dispatch_table;
+static const struct _olm_dispatch_table * current_table;
+
+/* a copy of the table given to olm_set_crypto_provider */
+static struct OlmCryptoProvider provider_table;
+static int provider_set;
+static unsigned provider_generation;
+
+/** The portable compression function from lib/crypto-algorithms, with the
+ * same shape as the accelerated one */
+static void sha256_transform_portable(
+    uint32_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+    SHA256_CTX context;
+    size_t i;
+    memcpy(context.state, state, sizeof(context.state));
+    for (i = 0; i < block_count; ++i) {
+        sha256_transform(&context, blocks + 64 * i);
+    }
+    memcpy(state, context.state, sizeof(context.state));
+    _olm_unset(&context, sizeof(context));
+}
+
+/** The provider's compression function, with the same shape as ours */
+static void sha256_transform_provider(
+    uint32_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+    if (block_count) {
+        provider_table.sha256_transform(
+            provider_table.context, state, blocks, block_count
+        );
+    }
+}
+
+static void fill_dispatch(
+    struct _olm_dispatch_table * table,
+    uint32_t features, enum _olm_curve25519_backend curve25519,
+    unsigned generation
+) {
+    const char *base64_name = "portable";
+    const struct OlmCryptoProvider *provider =
+        provider_set ? &provider_table : NULL;
+
+    table->features = features;
+
+    table->sha256_hardware = _olm_sha256_hw_available();
+    if (table->sha256_hardware) {
+        table->sha256_transform = _olm_sha256_hw_transform;
+    } else {
+        table->sha256_transform = sha256_transform_portable;
+    }
+    table->sha256_x4 = _olm_sha256_x4_available();
+    table->sha256_x8 = _olm_sha256_x8_available();
+    table->sha512_hardware = _olm_sha512_hw_available();
+    if (table->sha512_hardware) {
+        table->sha512_transform = _olm_sha512_hw_transform;
+    } else {
+        table->sha512_transform = _olm_sha512_transform_portable;
+    }
+    table->aes_hardware = _olm_aes_hw_available();
+    table->aes_gcm_hardware =
+        table->aes_hardware && _olm_aes_hw_gcm_available();
+
+    if (_olm_base64_simd_available()) {
+        table->base64_encode = _olm_base64_simd_encode;
+        table->base64_decode = _olm_base64_simd_decode;
+        /* the x86 kernels use AVX2 for as much as they can */
+        base64_name = (features & OLM_CPU_FEATURE_AVX2) ? "avx2" : SIMD128_NAME;
+    } else {
+        table->base64_encode = NULL;
+        table->base64_decode = NULL;
+    }
+
+    table->curve25519 = curve25519;
+    table->curve25519_lanes = _olm_curve25519_mb_lanes();
+
+    /* the provider's primitives replace our kernels for the same work,
+     * including the vector ones, which would bypass it */
+    table->provider = provider;
+    table->provider_generation = generation;
+    if (provider && provider->sha256_transform) {
+        table->sha256_transform = sha256_transform_provider;
+        table->sha256_hardware = 0;
+        table->sha256_x4 = 0;
+        table->sha256_x8 = 0;
+    }
+    if (provider && provider->aes256_cbc) {
+        table->aes_hardware = 0;
+        table->aes_gcm_hardware = 0;
+    }
+    if (provider && provider->x25519) {
+        table->curve25519_lanes = 1;
+    }
+
+    snprintf(
+        table->description, sizeof(table->description),
+        "aes=%s gcm=%s sha256=%s sha256x4=%s sha256x8=%s sha512=%s"
+        " base64=%s curve25519=%s curve25519mb=%s%s",
+        provider && provider->aes256_cbc ? "provider"
+            : table->aes_hardware ? AES_HW_NAME : "portable",
+        table->aes_gcm_hardware ? GCM_HW_NAME : "portable",
+        provider && provider->sha256_transform ? "provider"
+            : table->sha256_hardware ? SHA256_HW_NAME : "portable",
+        table->sha256_x4 ? X4_NAME : "portable",
+        table->sha256_x8 ? "avx2" : "portable",
+        table->sha512_hardware ? SHA512_HW_NAME : "portable",
+        base64_name,
+        provider && provider->x25519 ? "provider"
+            : curve25519 == OLM_CURVE25519_DONNA_C64 ? "donna-c64"
+            : curve25519 == OLM_CURVE25519_PAIRED ? "paired" : "donna",
+        table->curve25519_lanes > 1 ? _olm_curve25519_mb_name() : "portable",
+        provider && provider->ed25519_verify ? " ed25519=provider" : ""
+    );
+}
+
+const struct _olm_dispatch_table * _olm_crypto_dispatch(void) {
+    const struct _olm_dispatch_table *table =
+        __atomic_load_n(&current_table, __ATOMIC_ACQUIRE);
+    uint32_t features = _olm_cpu_features();
+    enum _olm_curve25519_backend curve25519 = _olm_curve25519_get_backend();
+    unsigned generation =
+        __atomic_load_n(&provider_generation, __ATOMIC_ACQUIRE);
+
+    /* filling the table is idempotent, so it doesn't matter if two threads
+     * race to do it the first time round; the release makes sure nobody
+     * sees the pointer before the entries. */
+    if (!table || table->features != features
+            || table->curve25519 != curve25519
+            || table->provider_generation != generation) {
+        fill_dispatch(&dispatch_table, features, curve25519, generation);
+        __atomic_store_n(&current_table, &dispatch_table, __ATOMIC_RELEASE);
+        table = &dispatch_table;
+    }
+    return table;
+}
+
+const char * olm_get_crypto_backend(void) {
+    return _olm_crypto_dispatch()->description;
+}
+
+void olm_set_crypto_provider(const struct OlmCryptoProvider * provider) {
+    if (provider) {
+        provider_table = *provider;
+    } else {
+        memset(&provider_table, 0, sizeof(provider_table));
+    }
+    provider_set = provider != NULL;
+    /* the next _olm_crypto_dispatch() fills the table again */
+    __atomic_add_fetch(&provider_generation, 1, __ATOMIC_RELEASE);
+}
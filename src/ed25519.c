@@ -17,6 +17,256 @@
 #include "ed25519/src/sc.c"
 #include "ed25519/src/ge.c"
 #include "ed25519/src/keypair.c"
+
+#include "ed25519/src/sha512.h"
+#include "olm/dispatch.h"
+#include "olm/sha512_hw.h"
+
+/* hash with whichever SHA-512 kernel the dispatch table has picked */
+static int sha512_transform_dispatch(
+    sha512_context *md, const unsigned char *blocks, size_t block_count
+) {
+    _olm_crypto_dispatch()->sha512_transform(md->state, blocks, block_count);
+    return 0;
+}
+
+#define SHA512_TRANSFORM sha512_transform_dispatch
 #include "ed25519/src/sha512.c"
+#undef SHA512_TRANSFORM
 #include "ed25519/src/verify.c"
 #include "ed25519/src/sign.c"
+
+#include "olm/crypto.h"
+#include "olm/iovec_internal.h"
+#include "olm/memory.h"
+#include "olm/stats_internal.h"
+
+#include <string.h>
+
+void _olm_sha512_transform_portable(
+    uint64_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+    sha512_context md;
+    memcpy(md.state, state, sizeof(md.state));
+    sha512_compress_blocks(&md, blocks, block_count);
+    memcpy(state, md.state, sizeof(md.state));
+    _olm_unset(&md, sizeof(md));
+}
+
+/* the prepared key stores its table as plain limbs, so make sure it fits */
+typedef char prepared_key_table_size_check[
+    sizeof(((struct _olm_ed25519_prepared_key *)0)->table)
+        == 8 * sizeof(ge_cached) ? 1 : -1
+];
+
+/* r = a * A + b * B, like ge_double_scalarmult_vartime but taking the odd
+ * multiples A, 3A, ..., 15A already computed. */
+static void double_scalarmult_cached_vartime(
+    ge_p2 *r, const unsigned char *a, const ge_cached *Ai,
+    const unsigned char *b
+) {
+    signed char aslide[256];
+    signed char bslide[256];
+    ge_p1p1 t;
+    ge_p3 u;
+    int i;
+
+    slide(aslide, a);
+    slide_limit(bslide, b, BI_LIMIT);
+    ge_p2_0(r);
+
+    for (i = 255; i >= 0; --i) {
+        if (aslide[i] || bslide[i]) {
+            break;
+        }
+    }
+
+    for (; i >= 0; --i) {
+        ge_p2_dbl(&t, r);
+
+        if (aslide[i] > 0) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_add(&t, &u, &Ai[aslide[i] / 2]);
+        } else if (aslide[i] < 0) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_sub(&t, &u, &Ai[(-aslide[i]) / 2]);
+        }
+
+        if (bslide[i] > 0) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_madd(&t, &u, &Bi[bslide[i] / 2]);
+        } else if (bslide[i] < 0) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_msub(&t, &u, &Bi[(-bslide[i]) / 2]);
+        }
+
+        ge_p1p1_to_p2(r, &t);
+    }
+}
+
+void _olm_crypto_ed25519_prepare_key(
+    const struct _olm_ed25519_public_key *their_key,
+    struct _olm_ed25519_prepared_key *prepared_key
+) {
+    ge_cached Ai[8];
+    ge_p1p1 t;
+    ge_p3 A, A2, u;
+    int i;
+
+    memset(prepared_key, 0, sizeof(*prepared_key));
+    prepared_key->public_key = *their_key;
+    if (ge_frombytes_negate_vartime(&A, their_key->public_key) != 0) {
+        return;
+    }
+
+    ge_p3_to_cached(&Ai[0], &A);
+    ge_p3_dbl(&t, &A);
+    ge_p1p1_to_p3(&A2, &t);
+    for (i = 1; i < 8; ++i) {
+        ge_add(&t, &A2, &Ai[i - 1]);
+        ge_p1p1_to_p3(&u, &t);
+        ge_p3_to_cached(&Ai[i], &u);
+    }
+
+    memcpy(prepared_key->table, Ai, sizeof(prepared_key->table));
+    prepared_key->valid = 1;
+}
+
+int _olm_crypto_ed25519_verify_prepared(
+    const struct _olm_ed25519_prepared_key *their_key,
+    const uint8_t * message, size_t message_length,
+    const uint8_t * signature
+) {
+    const struct OlmCryptoProvider *provider;
+    unsigned char h[64];
+    unsigned char checker[32];
+    sha512_context hash;
+    ge_cached Ai[8];
+    ge_p2 R;
+
+    OLM_STATS_ADD(ed25519_verifies, 1);
+
+    provider = _olm_crypto_dispatch()->provider;
+    if (provider && provider->ed25519_verify) {
+        return 0 != provider->ed25519_verify(
+            provider->context, their_key->public_key.public_key,
+            message, message_length, signature
+        );
+    }
+
+    if (!their_key->valid) {
+        return 0;
+    }
+
+    if (signature[63] & 224) {
+        return 0;
+    }
+
+    sha512_init(&hash);
+    sha512_update(&hash, signature, 32);
+    sha512_update(&hash, their_key->public_key.public_key, 32);
+    sha512_update(&hash, message, message_length);
+    sha512_final(&hash, h);
+
+    sc_reduce(h);
+    memcpy(Ai, their_key->table, sizeof(Ai));
+    double_scalarmult_cached_vartime(&R, h, Ai, signature + 32);
+    ge_tobytes(checker, &R);
+
+    return consttime_equal(checker, signature);
+}
+
+/** hash the first length bytes of the segments */
+static void sha512_update_segments(
+    sha512_context *hash,
+    const OlmIovec * segments, size_t segment_count, size_t length
+) {
+    struct _olm_iovec_cursor cursor;
+    _olm_iovec_cursor_init(&cursor, segments, segment_count);
+    while (length) {
+        size_t available;
+        const uint8_t *pos = _olm_iovec_cursor_peek(&cursor, &available);
+        if (!available) {
+            return;
+        }
+        if (available > length) {
+            available = length;
+        }
+        sha512_update(hash, pos, available);
+        _olm_iovec_cursor_skip(&cursor, available);
+        length -= available;
+    }
+}
+
+void _olm_crypto_ed25519_sign_segments(
+    const struct _olm_ed25519_key_pair *our_key,
+    const OlmIovec * segments, size_t segment_count, size_t message_length,
+    uint8_t * output
+) {
+    const unsigned char *public_key = our_key->public_key.public_key;
+    const unsigned char *private_key = our_key->private_key.private_key;
+    sha512_context hash;
+    unsigned char hram[64];
+    unsigned char r[64];
+    ge_p3 R;
+
+    OLM_STATS_ADD(ed25519_signs, 1);
+
+    /* as ed25519_sign, which has to read the message twice */
+    sha512_init(&hash);
+    sha512_update(&hash, private_key + 32, 32);
+    sha512_update_segments(&hash, segments, segment_count, message_length);
+    sha512_final(&hash, r);
+
+    sc_reduce(r);
+    ge_scalarmult_base(&R, r);
+    ge_p3_tobytes(output, &R);
+
+    sha512_init(&hash);
+    sha512_update(&hash, output, 32);
+    sha512_update(&hash, public_key, 32);
+    sha512_update_segments(&hash, segments, segment_count, message_length);
+    sha512_final(&hash, hram);
+
+    sc_reduce(hram);
+    sc_muladd(output + 32, hram, private_key, r);
+
+    _olm_unset(r, sizeof(r));
+    _olm_unset(&hash, sizeof(hash));
+}
+
+int _olm_crypto_ed25519_verify_prepared_segments(
+    const struct _olm_ed25519_prepared_key *their_key,
+    const OlmIovec * segments, size_t segment_count, size_t message_length,
+    const uint8_t * signature
+) {
+    unsigned char h[64];
+    unsigned char checker[32];
+    sha512_context hash;
+    ge_cached Ai[8];
+    ge_p2 R;
+
+    OLM_STATS_ADD(ed25519_verifies, 1);
+
+    if (!their_key->valid) {
+        return 0;
+    }
+
+    if (signature[63] & 224) {
+        return 0;
+    }
+
+    sha512_init(&hash);
+    sha512_update(&hash, signature, 32);
+    sha512_update(&hash, their_key->public_key.public_key, 32);
+    sha512_update_segments(&hash, segments, segment_count, message_length);
+    sha512_final(&hash, h);
+
+    sc_reduce(h);
+    memcpy(Ai, their_key->table, sizeof(Ai));
+    double_scalarmult_cached_vartime(&R, h, Ai, signature + 32);
+    ge_tobytes(checker, &R);
+
+    return consttime_equal(checker, signature);
+}
@@ -0,0 +1,151 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Batch signing and verification of ed25519 signatures.
+ *
+ * Signing a batch saves the field inversions that encode the R points: each
+ * signature still needs its own scalar multiplication, but a single inversion
+ * is shared between all of them.
+ *
+ * Verification checks each signature as olm_ed25519_verify() does, decoding
+ * a key only once for a run of signatures by it. The usual combined equation
+ *
+ *     (sum z_i S_i) B - sum (z_i h_i) A_i - sum z_i R_i = 0
+ *
+ * can't be used: the single verification in lib/ed25519/src/verify.c doesn't
+ * multiply by the cofactor, and small order components of the A_i and R_i
+ * could cancel out in the sum, so that signatures which each fail on their own
+ * pass together. Ruling those out means multiplying every A_i and R_i by the
+ * group order, which costs more than verifying the signatures one by one.
+ */
+
+#include "olm/crypto.h"
+#include "olm/memory.h"
+#include "olm/stats_internal.h"
+
+#include <string.h>
+
+#include "ed25519/src/ge.h"
+#include "ed25519/src/sc.h"
+#include "ed25519/src/sha512.h"
+
+/* the number of signatures whose R points share an inversion */
+#define BATCH_SIZE 16
+
+size_t _olm_crypto_ed25519_verify_batch(
+    size_t count,
+    const struct _olm_ed25519_public_key *their_keys,
+    const uint8_t * const *messages, const size_t *message_lengths,
+    const uint8_t * const *signatures,
+    uint8_t *results
+) {
+    struct _olm_ed25519_prepared_key prepared_key;
+    size_t failures = 0;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (i == 0 || memcmp(
+            their_keys[i].public_key, their_keys[i - 1].public_key,
+            sizeof(their_keys[i].public_key)
+        )) {
+            _olm_crypto_ed25519_prepare_key(&their_keys[i], &prepared_key);
+        }
+        results[i] = signatures[i] != NULL
+            && _olm_crypto_ed25519_verify_prepared(
+                &prepared_key, messages[i], message_lengths[i], signatures[i]
+            );
+        failures += !results[i];
+    }
+    return failures;
+}
+
+void _olm_crypto_ed25519_sign_batch(
+    const struct _olm_ed25519_key_pair *our_key,
+    size_t count,
+    const uint8_t * const *messages, const size_t *message_lengths,
+    uint8_t *outputs
+) {
+    const unsigned char *public_key = our_key->public_key.public_key;
+    const unsigned char *private_key = our_key->private_key.private_key;
+    sha512_context hash;
+    unsigned char r[BATCH_SIZE][64];
+    unsigned char hram[64];
+    ge_p3 R[BATCH_SIZE];
+    fe products[BATCH_SIZE];
+    fe inverse, z_inverse, x, y;
+    size_t start, i, n;
+    uint8_t *output;
+
+    OLM_STATS_ADD(ed25519_signs, count);
+
+    for (start = 0; start < count; start += BATCH_SIZE) {
+        n = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+
+        /* as ed25519_sign, up to encoding R */
+        for (i = 0; i < n; ++i) {
+            sha512_init(&hash);
+            sha512_update(&hash, private_key + 32, 32);
+            sha512_update(
+                &hash, messages[start + i], message_lengths[start + i]
+            );
+            sha512_final(&hash, r[i]);
+            sc_reduce(r[i]);
+            ge_scalarmult_base(&R[i], r[i]);
+        }
+
+        /* encoding R needs 1/Z. Rather than an inversion for each signature
+         * invert the product of all the Zs and peel the individual inverses
+         * off it (Montgomery's trick). */
+        fe_copy(products[0], R[0].Z);
+        for (i = 1; i < n; ++i) {
+            fe_mul(products[i], products[i - 1], R[i].Z);
+        }
+        fe_invert(inverse, products[n - 1]);
+        for (i = n; i-- > 0;) {
+            if (i) {
+                fe_mul(z_inverse, inverse, products[i - 1]);
+                fe_mul(inverse, inverse, R[i].Z);
+            } else {
+                fe_copy(z_inverse, inverse);
+            }
+            /* as ge_p3_tobytes */
+            output = outputs + (start + i) * 64;
+            fe_mul(x, R[i].X, z_inverse);
+            fe_mul(y, R[i].Y, z_inverse);
+            fe_tobytes(output, y);
+            output[31] ^= fe_isnegative(x) << 7;
+        }
+
+        for (i = 0; i < n; ++i) {
+            output = outputs + (start + i) * 64;
+            sha512_init(&hash);
+            sha512_update(&hash, output, 32);
+            sha512_update(&hash, public_key, 32);
+            sha512_update(
+                &hash, messages[start + i], message_lengths[start + i]
+            );
+            sha512_final(&hash, hram);
+            sc_reduce(hram);
+            sc_muladd(output + 32, hram, private_key, r[i]);
+        }
+    }
+
+    _olm_unset(r, sizeof(r));
+    _olm_unset(R, sizeof(R));
+    _olm_unset(products, sizeof(products));
+    _olm_unset(inverse, sizeof(inverse));
+    _olm_unset(z_inverse, sizeof(z_inverse));
+    _olm_unset(&hash, sizeof(hash));
+}
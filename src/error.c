@@ -31,6 +31,24 @@ static const char * ERRORS[] = {
     "UNKNOWN_MESSAGE_INDEX",
     "BAD_LEGACY_ACCOUNT_PICKLE",
     "BAD_SIGNATURE",
+    "SESSION_TOO_SMALL",
+    "ACCOUNT_TOO_SMALL",
+    "SESSION_DELTA_MISMATCH",
+    "UNKNOWN_SESSION_ID",
+    "STORE_FULL",
+    "ALLOCATION_FAILED",
+    "DUPLICATE_MESSAGE_INDEX",
+    "RATCHET_DISTANCE_EXCEEDED",
+    "BAD_STREAM_STATE",
+    "RANDOM_UNAVAILABLE",
+    "INVALID_JSON",
+    "PARTIAL_ACCOUNT",
+    "SESSION_CHANGED",
+    "BAD_ATTACHMENT_KEY",
+    "JOURNAL_FULL",
+    "JOURNAL_WRITE_FAILED",
+    "DECRYPTION_DEFERRED",
+    "PICKLE_STREAM_FAILED",
 };
 
 const char * _olm_error_to_string(enum OlmErrorCode error)
@@ -0,0 +1,212 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/executor.h"
+#include "olm/memory.hh"
+
+#include <condition_variable>
+#include <mutex>
+#include <new>
+
+namespace {
+
+/** A batch being run on a pool, which lives on the stack of the thread that
+ * started it. Its jobs are handed out in order; it is only touched with the
+ * pool's lock held, and stays in the pool until all its jobs are done. */
+struct Batch {
+    OlmBatchJob job;
+    void * job_context;
+    std::size_t job_count;
+    std::size_t next_job;
+    std::size_t finished_jobs;
+    Batch * next;
+};
+
+/**
+ * The batches with jobs still to hand out, oldest first. The jobs the
+ * batch functions hand to an executor are each a good many operations, so
+ * one lock taken twice per job costs little next to running it.
+ */
+struct WorkPool {
+    std::mutex lock;
+    /** signalled when there are new jobs, or the pool is stopped */
+    std::condition_variable work;
+    /** signalled when a batch's last job finishes */
+    std::condition_variable finished;
+    Batch * batches;
+    bool stopped;
+    /** only changed with the lock held */
+    OlmWorkPoolStats stats;
+};
+
+static WorkPool * from_c(OlmWorkPool * pool) {
+    return reinterpret_cast<WorkPool *>(pool);
+}
+
+/** Take the pool's lock, counting it if another thread has it */
+static void acquire(WorkPool & pool, std::unique_lock<std::mutex> & held) {
+    if (!held.try_lock()) {
+        held.lock();
+        pool.stats.lock_contentions++;
+    }
+}
+
+/** The oldest batch with a job to hand out, or NULL. Called with the lock
+ * held. */
+static Batch * next_batch(WorkPool & pool) {
+    for (Batch * batch = pool.batches; batch; batch = batch->next) {
+        if (batch->next_job < batch->job_count) {
+            return batch;
+        }
+    }
+    return nullptr;
+}
+
+/** Run the next job of the batch, which must have one to hand out. Called
+ * with the lock held, which is let go while the job runs. */
+static void run_job(
+    WorkPool & pool, Batch & batch, std::unique_lock<std::mutex> & held,
+    bool worker
+) {
+    std::size_t job = batch.next_job++;
+    if (worker) {
+        pool.stats.jobs_run_by_workers++;
+    }
+    held.unlock();
+    batch.job(batch.job_context, job);
+    acquire(pool, held);
+    if (++batch.finished_jobs == batch.job_count) {
+        pool.finished.notify_all();
+    }
+}
+
+} // namespace
+
+
+extern "C" {
+
+size_t olm_work_pool_size(void) {
+    return sizeof(WorkPool);
+}
+
+
+OlmWorkPool * olm_work_pool(void * memory) {
+    WorkPool * pool = new(memory) WorkPool;
+    pool->batches = nullptr;
+    pool->stopped = false;
+    olm::unset(pool->stats);
+    return reinterpret_cast<OlmWorkPool *>(pool);
+}
+
+
+size_t olm_clear_work_pool(OlmWorkPool * pool) {
+    from_c(pool)->~WorkPool();
+    olm::unset(pool, sizeof(WorkPool));
+    return sizeof(WorkPool);
+}
+
+
+void olm_work_pool_work(OlmWorkPool * pool) {
+    WorkPool & object = *from_c(pool);
+    std::unique_lock<std::mutex> held(object.lock, std::defer_lock);
+    acquire(object, held);
+    while (!object.stopped) {
+        Batch * batch = next_batch(object);
+        if (batch) {
+            run_job(object, *batch, held, true);
+        } else {
+            object.stats.idle_waits++;
+            object.work.wait(held);
+        }
+    }
+}
+
+
+void olm_work_pool_stop(OlmWorkPool * pool) {
+    WorkPool & object = *from_c(pool);
+    std::lock_guard<std::mutex> held(object.lock);
+    object.stopped = true;
+    object.work.notify_all();
+}
+
+
+void olm_work_pool_executor(
+    void * context,
+    OlmBatchJob job, void * job_context, size_t job_count
+) {
+    if (job_count == 0) {
+        return;
+    }
+    WorkPool & pool = *static_cast<WorkPool *>(context);
+    Batch batch;
+    batch.job = job;
+    batch.job_context = job_context;
+    batch.job_count = job_count;
+    batch.next_job = 0;
+    batch.finished_jobs = 0;
+    batch.next = nullptr;
+
+    std::unique_lock<std::mutex> held(pool.lock, std::defer_lock);
+    acquire(pool, held);
+    pool.stats.batches++;
+    pool.stats.jobs += job_count;
+    Batch ** tail = &pool.batches;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = &batch;
+    if (job_count > 1) {
+        pool.work.notify_all();
+    }
+
+    /* help with our own batch, then wait for the jobs others took */
+    while (batch.next_job < batch.job_count) {
+        run_job(pool, batch, held, false);
+    }
+    if (batch.finished_jobs < batch.job_count) {
+        pool.stats.finish_waits++;
+    }
+    while (batch.finished_jobs < batch.job_count) {
+        pool.finished.wait(held);
+    }
+
+    for (tail = &pool.batches; *tail != &batch; tail = &(*tail)->next) {}
+    *tail = batch.next;
+}
+
+
+void olm_work_pool_node_executor(
+    void * context,
+    OlmBatchJob job, void * job_context,
+    const int * job_nodes, size_t job_count
+) {
+    olm_work_pool_executor(context, job, job_context, job_count);
+}
+
+
+
+void olm_work_pool_stats(OlmWorkPool * pool, OlmWorkPoolStats * stats) {
+    WorkPool & object = *from_c(pool);
+    std::lock_guard<std::mutex> held(object.lock);
+    *stats = object.stats;
+}
+
+
+void olm_work_pool_reset_stats(OlmWorkPool * pool) {
+    WorkPool & object = *from_c(pool);
+    std::lock_guard<std::mutex> held(object.lock);
+    olm::unset(object.stats);
+}
+
+}
@@ -0,0 +1,1442 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/crypto.h"
+#include "olm/error.h"
+#include "olm/memory.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace {
+
+static std::size_t const SESSION_ID_LENGTH = ED25519_PUBLIC_KEY_LENGTH;
+
+/** Entries of the index table hold a slot number plus one, or one of these */
+static std::uint32_t const EMPTY_ENTRY = 0;
+static std::uint32_t const REMOVED_ENTRY = 0xffffffff;
+
+/** How many counters readers are spread over, so that threads reading at
+ * once don't all fight over one cache line */
+static std::size_t const READER_STRIPES = 16;
+
+/** The readers inside olm_group_session_store_read_begin() and _end(), by
+ * the parity of the epoch they began in */
+struct ReaderStripe {
+    std::atomic<std::size_t> active[2];
+    std::uint8_t padding[64 - 2 * sizeof(std::atomic<std::size_t>)];
+};
+
+/** A slot taken out of the index that readers may still be looking at. It
+ * can be reused once the epoch is two past the one it was taken out in. */
+struct RetiredSlot {
+    std::uint32_t slot;
+    std::uint64_t epoch;
+};
+
+/** What each slab slot holds */
+enum struct SlotState : std::uint8_t {
+    FREE = 0,
+    ADDED = 1,   /* handed out by add but not yet in the index */
+    INDEXED = 2,
+    RETIRED = 3, /* out of the index, but not yet safe to reuse */
+};
+
+/**
+ * The index is an open-addressed table of slot numbers, which readers probe
+ * without taking any lock while the one thread changing the store fills and
+ * empties entries. Entries are never moved, so a probe never misses a
+ * session that is there throughout: a removed session leaves a marker that
+ * probes carry on past, which a later session can take, and markers at the
+ * ends of runs are emptied. The table is kept at most a quarter full, so
+ * the runs stay short.
+ *
+ * Readers can still be looking at a session after it is taken out of the
+ * index, so its slot is only cleared and reused once they have finished:
+ * each reader counts itself in under the parity of the current epoch, and
+ * the epoch only moves on once everyone under the other parity has left.
+ */
+struct GroupSessionStore {
+    ReaderStripe readers[READER_STRIPES];
+    std::atomic<std::uint64_t> epoch;
+    std::atomic<std::uint32_t> * table;
+    std::size_t table_mask;
+    /** the ID of the session in each indexed slot */
+    std::uint8_t (* ids)[SESSION_ID_LENGTH];
+    std::size_t count;
+    /** the free slots, used from the end */
+    std::uint32_t * free_slots;
+    std::size_t free_count;
+    RetiredSlot * retired;
+    std::size_t retired_count;
+    SlotState * slot_states;
+    std::uint8_t * slab;
+    std::size_t slot_size;
+    std::size_t capacity;
+    OlmErrorCode last_error;
+};
+
+/** Round a length up so that what follows it is suitably aligned. */
+static constexpr std::size_t aligned(std::size_t length) {
+    return (length + 15) & ~std::size_t(15);
+}
+
+static std::size_t slot_size() {
+    return aligned(olm_inbound_group_session_size());
+}
+
+/** The number of entries in the index table: a power of two at least four
+ * times the capacity */
+static constexpr std::size_t table_length(
+    std::size_t capacity, std::size_t length = 4
+) {
+    return length >= 4 * capacity
+        ? length : table_length(capacity, 2 * length);
+}
+
+/** The IDs are ed25519 public keys, so their first few bytes are already
+ * well mixed. */
+static std::uint32_t id_hash(std::uint8_t const * id) {
+    return std::uint32_t(id[0])
+        | std::uint32_t(id[1]) << 8
+        | std::uint32_t(id[2]) << 16
+        | std::uint32_t(id[3]) << 24;
+}
+
+static OlmGroupSessionStore * to_c(GroupSessionStore * store) {
+    return reinterpret_cast<OlmGroupSessionStore *>(store);
+}
+
+static GroupSessionStore * from_c(OlmGroupSessionStore * store) {
+    return reinterpret_cast<GroupSessionStore *>(store);
+}
+
+static GroupSessionStore const * from_c(OlmGroupSessionStore const * store) {
+    return reinterpret_cast<GroupSessionStore const *>(store);
+}
+
+static OlmInboundGroupSession * slot_session(
+    GroupSessionStore const & store, std::size_t slot
+) {
+    return reinterpret_cast<OlmInboundGroupSession *>(
+        store.slab + slot * store.slot_size
+    );
+}
+
+/** The slot a session is kept in, or capacity if it isn't in the slab. */
+static std::size_t session_slot(
+    GroupSessionStore const & store, OlmInboundGroupSession const * session
+) {
+    std::uint8_t const * pos = reinterpret_cast<std::uint8_t const *>(session);
+    if (pos < store.slab || pos >= store.slab + store.capacity * store.slot_size
+            || (pos - store.slab) % store.slot_size) {
+        return store.capacity;
+    }
+    return (pos - store.slab) / store.slot_size;
+}
+
+/** The position in the table of the session with the ID, or the table
+ * length if there isn't one, and the entry found there. Safe to call while
+ * the table is changed, so the entry is only read once. */
+static std::size_t find_position(
+    GroupSessionStore const & store, std::uint8_t const * id,
+    std::uint32_t & entry
+) {
+    std::size_t pos = id_hash(id) & store.table_mask;
+    for (std::size_t probes = 0; probes <= store.table_mask; ++probes) {
+        entry = store.table[pos].load(std::memory_order_acquire);
+        if (entry == EMPTY_ENTRY) {
+            break;
+        }
+        if (entry != REMOVED_ENTRY
+                && olm::is_equal(store.ids[entry - 1], id, SESSION_ID_LENGTH)) {
+            return pos;
+        }
+        pos = (pos + 1) & store.table_mask;
+    }
+    entry = EMPTY_ENTRY;
+    return store.table_mask + 1;
+}
+
+/** The slot of the session with the ID, or capacity if there isn't one */
+static std::size_t find_slot(
+    GroupSessionStore const & store, std::uint8_t const * id
+) {
+    std::uint32_t entry;
+    find_position(store, id, entry);
+    return entry == EMPTY_ENTRY ? store.capacity : entry - 1;
+}
+
+/** Index a slot whose ID isn't in the table yet */
+static void insert_slot(GroupSessionStore & store, std::size_t slot) {
+    std::size_t pos = id_hash(store.ids[slot]) & store.table_mask;
+    for (;;) {
+        std::uint32_t entry = store.table[pos].load(std::memory_order_relaxed);
+        if (entry == EMPTY_ENTRY || entry == REMOVED_ENTRY) {
+            break;
+        }
+        pos = (pos + 1) & store.table_mask;
+    }
+    /* publishes the session and its ID to readers that find the entry */
+    store.table[pos].store(slot + 1, std::memory_order_release);
+}
+
+/** Take the entry at a position out of the table */
+template<typename Store>
+static void erase_position(Store & store, std::size_t pos) {
+    std::size_t const mask = store.table_mask;
+    store.table[pos].store(REMOVED_ENTRY, std::memory_order_release);
+    /* a probe that gets to the end of a run stops at the gap after it
+     * anyway, so markers there can go */
+    while (store.table[pos].load(std::memory_order_relaxed) == REMOVED_ENTRY
+            && store.table[(pos + 1) & mask].load(std::memory_order_relaxed)
+                == EMPTY_ENTRY) {
+        store.table[pos].store(EMPTY_ENTRY, std::memory_order_release);
+        pos = (pos - 1) & mask;
+    }
+}
+
+static void free_slot(GroupSessionStore & store, std::size_t slot) {
+    olm_clear_inbound_group_session(slot_session(store, slot));
+    store.slot_states[slot] = SlotState::FREE;
+    store.free_slots[store.free_count++] = slot;
+}
+
+/** Move the epoch on if nobody is still reading under the parity it would
+ * reuse. Never waits. */
+static bool advance_epoch(GroupSessionStore & store) {
+    std::uint64_t epoch = store.epoch.load(std::memory_order_relaxed);
+    std::size_t parity = (epoch + 1) & 1;
+    for (std::size_t i = 0; i < READER_STRIPES; ++i) {
+        if (store.readers[i].active[parity].load()) {
+            return false;
+        }
+    }
+    store.epoch.store(epoch + 1);
+    return true;
+}
+
+/** Clear and free the retired slots that no reader can still be using */
+static void reclaim_slots(GroupSessionStore & store) {
+    if (!store.retired_count) {
+        return;
+    }
+    if (advance_epoch(store)) {
+        advance_epoch(store);
+    }
+    std::uint64_t epoch = store.epoch.load(std::memory_order_relaxed);
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < store.retired_count; ++i) {
+        RetiredSlot retired = store.retired[i];
+        if (retired.epoch + 2 <= epoch) {
+            free_slot(store, retired.slot);
+        } else {
+            store.retired[kept++] = retired;
+        }
+    }
+    store.retired_count = kept;
+}
+
+/** Keep a slot that has been taken out of the index from being reused while
+ * a reader could still be looking at it */
+static void retire_slot(GroupSessionStore & store, std::size_t slot) {
+    store.slot_states[slot] = SlotState::RETIRED;
+    store.retired[store.retired_count++] = {
+        std::uint32_t(slot), store.epoch.load()
+    };
+    reclaim_slots(store);
+}
+
+/** Which readers' counters this thread uses. Threads take them in turn. */
+static std::size_t reader_stripe() {
+    static std::atomic<std::size_t> next_stripe(0);
+    static thread_local std::size_t stripe =
+        next_stripe.fetch_add(1, std::memory_order_relaxed) % READER_STRIPES;
+    return stripe;
+}
+
+struct ShardedGroupSessionStore {
+    std::size_t shard_count;
+    GroupSessionStore ** shards;
+    int * nodes;
+    OlmErrorCode last_error;
+};
+
+static OlmShardedGroupSessionStore * to_c(ShardedGroupSessionStore * store) {
+    return reinterpret_cast<OlmShardedGroupSessionStore *>(store);
+}
+
+static ShardedGroupSessionStore * from_c(OlmShardedGroupSessionStore * store) {
+    return reinterpret_cast<ShardedGroupSessionStore *>(store);
+}
+
+static ShardedGroupSessionStore const * from_c(
+    OlmShardedGroupSessionStore const * store
+) {
+    return reinterpret_cast<ShardedGroupSessionStore const *>(store);
+}
+
+/** The shard for a session ID. The shards' own indexes hash the first four
+ * bytes of the ID, so this uses the next four, so that the sessions in a
+ * shard are still spread over all of its index. */
+static std::size_t shard_for(
+    ShardedGroupSessionStore const & store, std::uint8_t const * id
+) {
+    return id_hash(id + 4) % store.shard_count;
+}
+
+/** Where a session of one of the shards is kept: sets the shard and returns
+ * the slot, or sets the shard to the shard count if no shard has it. */
+static std::size_t find_shard_slot(
+    ShardedGroupSessionStore const & store,
+    OlmInboundGroupSession const * session, std::size_t & shard
+) {
+    std::size_t slot = 0;
+    for (shard = 0; shard < store.shard_count; ++shard) {
+        slot = session_slot(*store.shards[shard], session);
+        if (slot != store.shards[shard]->capacity) {
+            break;
+        }
+    }
+    return slot;
+}
+
+/** The arguments to olm_sharded_group_session_store_decrypt_batch(), shared
+ * by its jobs */
+struct ShardedDecryptBatch {
+    ShardedGroupSessionStore * store;
+    std::uint8_t const * const * session_ids;
+    std::size_t const * session_id_lengths;
+    std::uint8_t * const * messages;
+    std::size_t const * message_lengths;
+    std::uint8_t * const * plaintexts;
+    std::size_t const * max_plaintext_lengths;
+    std::size_t * plaintext_lengths;
+    std::uint32_t * message_indices;
+    char const ** errors;
+    /** the messages, grouped by shard and in order within each group */
+    std::size_t const * order;
+    /** where each shard's group starts in order, followed by the message
+     * count */
+    std::size_t const * group_starts;
+};
+
+/** Decrypt the messages for one shard. Jobs only touch their own shard and
+ * the entries for its messages, so they can run at the same time. */
+void sharded_decrypt_batch_job(void * job_context, std::size_t job) {
+    ShardedDecryptBatch const & batch =
+        *static_cast<ShardedDecryptBatch *>(job_context);
+    OlmGroupSessionStore * shard = to_c(batch.store->shards[job]);
+    for (std::size_t j = batch.group_starts[job];
+            j < batch.group_starts[job + 1]; ++j) {
+        std::size_t i = batch.order[j];
+        batch.plaintext_lengths[i] = olm_group_session_store_decrypt(
+            shard, batch.session_ids[i], batch.session_id_lengths[i],
+            batch.messages[i], batch.message_lengths[i],
+            batch.plaintexts[i], batch.max_plaintext_lengths[i],
+            &batch.message_indices[i]
+        );
+        if (batch.errors) {
+            batch.errors[i] = batch.plaintext_lengths[i] == std::size_t(-1)
+                ? olm_group_session_store_last_error(shard)
+                : _olm_error_to_string(OlmErrorCode::OLM_SUCCESS);
+        }
+    }
+}
+
+/* The shared store's memory may be mapped at a different address in each
+ * process using it, so it holds no pointers: everything in it is found from
+ * the capacity. The locks are plain atomics, which work between processes
+ * as long as they are lock free. */
+static_assert(
+    ATOMIC_INT_LOCK_FREE == 2,
+    "the shared group session store needs lock free atomics"
+);
+
+static std::uint8_t const SHARED_STORE_MAGIC[8] = {
+    'O', 'L', 'M', 'S', 'G', 'S', 'S', '1'
+};
+
+/** The start of a shared store's memory */
+struct SharedStoreHeader {
+    std::uint8_t magic[8];
+    std::uint32_t capacity;
+    /** the size of a session in the library that set the store up, so that
+     * a process using an incompatible build can't attach to it */
+    std::uint32_t slot_size;
+    /** held while the index or the free slots are changed */
+    std::atomic<std::uint32_t> lock;
+    std::atomic<std::uint32_t> count;
+    std::uint32_t free_count;
+};
+
+/** Slot states in the shared store. A slot's state only changes with the
+ * store lock held, and only leaves INDEXED with the slot's lock held too. */
+static std::uint32_t const SHARED_SLOT_FREE = 0;
+static std::uint32_t const SHARED_SLOT_ADDED = 1;
+static std::uint32_t const SHARED_SLOT_INDEXED = 2;
+
+struct SharedSlot {
+    /** held while the slot's session is used, once it is indexed */
+    std::atomic<std::uint32_t> lock;
+    std::atomic<std::uint32_t> state;
+    std::uint8_t id[SESSION_ID_LENGTH];
+};
+
+/**
+ * One process's handle on a shared store. The index works as in
+ * GroupSessionStore, but rather than counting readers in and out, whoever
+ * finds a slot through the index takes its lock and then checks that it
+ * still holds the session with the ID it was looking for. Sessions are only
+ * cleared with their slot's lock held, so nobody can be using one when it
+ * is.
+ */
+struct SharedGroupSessionStore {
+    SharedStoreHeader * header;
+    std::atomic<std::uint32_t> * table;
+    std::size_t table_mask;
+    SharedSlot * slots;
+    /** the free slots, used from the end */
+    std::uint32_t * free_slots;
+    std::uint8_t * slab;
+    std::size_t slot_size;
+    std::size_t capacity;
+    OlmErrorCode last_error;
+};
+
+static OlmSharedGroupSessionStore * to_c(SharedGroupSessionStore * store) {
+    return reinterpret_cast<OlmSharedGroupSessionStore *>(store);
+}
+
+static SharedGroupSessionStore * from_c(OlmSharedGroupSessionStore * store) {
+    return reinterpret_cast<SharedGroupSessionStore *>(store);
+}
+
+static SharedGroupSessionStore const * from_c(
+    OlmSharedGroupSessionStore const * store
+) {
+    return reinterpret_cast<SharedGroupSessionStore const *>(store);
+}
+
+/** Point a handle at the parts of a shared store's memory */
+static void attach_shared_store(
+    SharedGroupSessionStore & store, void * shared_memory, std::size_t capacity
+) {
+    std::uint8_t * pos = reinterpret_cast<std::uint8_t *>(shared_memory);
+    std::size_t length = table_length(capacity);
+    store.header = reinterpret_cast<SharedStoreHeader *>(pos);
+    pos += aligned(sizeof(SharedStoreHeader));
+    store.table = reinterpret_cast<std::atomic<std::uint32_t> *>(pos);
+    store.table_mask = length - 1;
+    pos += aligned(length * sizeof(std::uint32_t));
+    store.slots = reinterpret_cast<SharedSlot *>(pos);
+    pos += aligned(capacity * sizeof(SharedSlot));
+    store.free_slots = reinterpret_cast<std::uint32_t *>(pos);
+    pos += aligned(capacity * sizeof(std::uint32_t));
+    store.slab = pos;
+    store.slot_size = slot_size();
+    store.capacity = capacity;
+    store.last_error = OlmErrorCode::OLM_SUCCESS;
+}
+
+static void lock(std::atomic<std::uint32_t> & lock) {
+    while (lock.exchange(1, std::memory_order_acquire)) {
+        while (lock.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void unlock(std::atomic<std::uint32_t> & lock) {
+    lock.store(0, std::memory_order_release);
+}
+
+static OlmInboundGroupSession * shared_slot_session(
+    SharedGroupSessionStore const & store, std::size_t slot
+) {
+    return reinterpret_cast<OlmInboundGroupSession *>(
+        store.slab + slot * store.slot_size
+    );
+}
+
+/** The slot a session is kept in, or capacity if it isn't in the slab */
+static std::size_t shared_session_slot(
+    SharedGroupSessionStore const & store,
+    OlmInboundGroupSession const * session
+) {
+    std::uint8_t const * pos = reinterpret_cast<std::uint8_t const *>(session);
+    if (pos < store.slab || pos >= store.slab + store.capacity * store.slot_size
+            || (pos - store.slab) % store.slot_size) {
+        return store.capacity;
+    }
+    return (pos - store.slab) / store.slot_size;
+}
+
+/** The position in the table of the session with the ID, or the table
+ * length if there isn't one. Only for use with the store lock held, as then
+ * nothing else changes the table or the IDs. */
+static std::size_t shared_find_position(
+    SharedGroupSessionStore const & store, std::uint8_t const * id
+) {
+    std::size_t pos = id_hash(id) & store.table_mask;
+    for (std::size_t probes = 0; probes <= store.table_mask; ++probes) {
+        std::uint32_t entry = store.table[pos].load(std::memory_order_relaxed);
+        if (entry == EMPTY_ENTRY) {
+            break;
+        }
+        if (entry != REMOVED_ENTRY && olm::is_equal(
+                store.slots[entry - 1].id, id, SESSION_ID_LENGTH
+        )) {
+            return pos;
+        }
+        pos = (pos + 1) & store.table_mask;
+    }
+    return store.table_mask + 1;
+}
+
+/** Find the session with the ID and take its slot's lock, without the store
+ * lock. Returns the slot, or capacity if there is no such session. */
+static std::size_t shared_lock_slot(
+    SharedGroupSessionStore const & store, std::uint8_t const * id
+) {
+    std::size_t pos = id_hash(id) & store.table_mask;
+    for (std::size_t probes = 0; probes <= store.table_mask; ++probes) {
+        std::uint32_t entry = store.table[pos].load(std::memory_order_acquire);
+        if (entry == EMPTY_ENTRY) {
+            break;
+        }
+        if (entry != REMOVED_ENTRY) {
+            SharedSlot & slot = store.slots[entry - 1];
+            lock(slot.lock);
+            if (slot.state.load(std::memory_order_relaxed)
+                    == SHARED_SLOT_INDEXED
+                    && olm::is_equal(slot.id, id, SESSION_ID_LENGTH)) {
+                return entry - 1;
+            }
+            unlock(slot.lock);
+            /* a session that replaced this one takes the same entry, so
+             * look at it again if it has changed */
+            if (store.table[pos].load(std::memory_order_acquire) != entry) {
+                continue;
+            }
+        }
+        pos = (pos + 1) & store.table_mask;
+    }
+    return store.capacity;
+}
+
+/** Clear an indexed slot, once nobody is using its session, and free it.
+ * Called with the store lock held, once the slot is out of the index. */
+static void shared_free_slot(
+    SharedGroupSessionStore & store, std::size_t slot
+) {
+    SharedSlot & shared_slot = store.slots[slot];
+    lock(shared_slot.lock);
+    shared_slot.state.store(SHARED_SLOT_FREE, std::memory_order_relaxed);
+    olm_clear_inbound_group_session(shared_slot_session(store, slot));
+    olm::unset(shared_slot.id, SESSION_ID_LENGTH);
+    unlock(shared_slot.lock);
+    store.free_slots[store.header->free_count++] = slot;
+}
+
+} // namespace
+
+
+extern "C" {
+
+size_t olm_group_session_store_size(
+    size_t capacity
+) {
+    return aligned(sizeof(GroupSessionStore))
+        + aligned(table_length(capacity) * sizeof(std::uint32_t))
+        + aligned(capacity * SESSION_ID_LENGTH)
+        + aligned(capacity * sizeof(std::uint32_t))
+        + aligned(capacity * sizeof(RetiredSlot))
+        + aligned(capacity * sizeof(SlotState))
+        + capacity * slot_size();
+}
+
+
+OlmGroupSessionStore * olm_group_session_store(
+    void * memory, size_t capacity
+) {
+    std::uint8_t * pos = reinterpret_cast<std::uint8_t *>(memory);
+    olm::unset(pos, aligned(sizeof(GroupSessionStore)));
+    GroupSessionStore * store = new(pos) GroupSessionStore;
+    pos += aligned(sizeof(GroupSessionStore));
+
+    for (ReaderStripe & stripe : store->readers) {
+        stripe.active[0].store(0, std::memory_order_relaxed);
+        stripe.active[1].store(0, std::memory_order_relaxed);
+    }
+    store->epoch.store(0, std::memory_order_relaxed);
+    std::size_t length = table_length(capacity);
+    store->table = reinterpret_cast<std::atomic<std::uint32_t> *>(pos);
+    for (std::size_t i = 0; i < length; ++i) {
+        new(&store->table[i]) std::atomic<std::uint32_t>(EMPTY_ENTRY);
+    }
+    store->table_mask = length - 1;
+    pos += aligned(length * sizeof(std::uint32_t));
+    store->ids = reinterpret_cast<std::uint8_t (*)[SESSION_ID_LENGTH]>(pos);
+    pos += aligned(capacity * SESSION_ID_LENGTH);
+    store->count = 0;
+    store->free_slots = reinterpret_cast<std::uint32_t *>(pos);
+    pos += aligned(capacity * sizeof(std::uint32_t));
+    store->retired = reinterpret_cast<RetiredSlot *>(pos);
+    store->retired_count = 0;
+    pos += aligned(capacity * sizeof(RetiredSlot));
+    store->slot_states = reinterpret_cast<SlotState *>(pos);
+    pos += aligned(capacity * sizeof(SlotState));
+    store->slab = pos;
+    store->slot_size = slot_size();
+    store->capacity = capacity;
+    store->last_error = OlmErrorCode::OLM_SUCCESS;
+
+    /* hand out the slots from the start of the slab */
+    for (std::size_t i = 0; i < capacity; ++i) {
+        store->free_slots[i] = capacity - 1 - i;
+        store->slot_states[i] = SlotState::FREE;
+    }
+    store->free_count = capacity;
+    return to_c(store);
+}
+
+
+const char * olm_group_session_store_last_error(
+    const OlmGroupSessionStore * store
+) {
+    return _olm_error_to_string(from_c(store)->last_error);
+}
+
+
+size_t olm_clear_group_session_store(
+    OlmGroupSessionStore * store
+) {
+    GroupSessionStore & object = *from_c(store);
+    std::size_t capacity = object.capacity;
+    for (std::size_t i = 0; i < capacity; ++i) {
+        if (object.slot_states[i] != SlotState::FREE) {
+            olm_clear_inbound_group_session(slot_session(object, i));
+        }
+    }
+    std::size_t size = olm_group_session_store_size(capacity);
+    olm::unset(store, size);
+    return size;
+}
+
+
+size_t olm_group_session_store_count(
+    const OlmGroupSessionStore * store
+) {
+    return from_c(store)->count;
+}
+
+
+void olm_group_session_store_memory_stats(
+    const OlmGroupSessionStore * store,
+    OlmMemoryStats * stats
+) {
+    GroupSessionStore const & object = *from_c(store);
+    std::size_t size = olm_group_session_store_size(object.capacity);
+    /* the sessions are in the store's own memory, so only their buffers add
+     * to what is reserved */
+    stats->reserved_bytes += size;
+    stats->live_bytes += size - object.capacity * object.slot_size;
+    for (std::size_t slot = 0; slot < object.capacity; ++slot) {
+        if (object.slot_states[slot] == SlotState::FREE) {
+            continue;
+        }
+        OlmMemoryStats session_stats = {};
+        olm_inbound_group_session_memory_stats(
+            slot_session(object, slot), &session_stats
+        );
+        stats->objects += session_stats.objects;
+        stats->reserved_bytes += session_stats.cache_reserved_bytes;
+        stats->live_bytes += session_stats.live_bytes;
+        stats->cache_reserved_bytes += session_stats.cache_reserved_bytes;
+        stats->cache_live_bytes += session_stats.cache_live_bytes;
+        stats->checkpoints += session_stats.checkpoints;
+        stats->max_checkpoints += session_stats.max_checkpoints;
+        stats->cached_message_keys += session_stats.cached_message_keys;
+        stats->max_cached_message_keys +=
+            session_stats.max_cached_message_keys;
+    }
+}
+
+
+size_t olm_group_session_store_trim_memory(
+    OlmGroupSessionStore * store, int level
+) {
+    GroupSessionStore & object = *from_c(store);
+    std::size_t wiped = 0;
+    reclaim_slots(object);
+    /* retired sessions are trimmed too, as they still hold their buffers
+     * until they are reclaimed */
+    for (std::size_t slot = 0; slot < object.capacity; ++slot) {
+        if (object.slot_states[slot] == SlotState::FREE) {
+            continue;
+        }
+        wiped += olm_inbound_group_session_trim_memory(
+            slot_session(object, slot), level
+        );
+    }
+    return wiped;
+}
+
+
+OlmInboundGroupSession * olm_group_session_store_add(
+    OlmGroupSessionStore * store
+) {
+    GroupSessionStore & object = *from_c(store);
+    if (object.free_count == 0) {
+        reclaim_slots(object);
+    }
+    if (object.free_count == 0) {
+        object.last_error = OlmErrorCode::OLM_STORE_FULL;
+        return nullptr;
+    }
+    std::size_t slot = object.free_slots[--object.free_count];
+    object.slot_states[slot] = SlotState::ADDED;
+    return olm_inbound_group_session(slot_session(object, slot));
+}
+
+
+size_t olm_group_session_store_commit(
+    OlmGroupSessionStore * store,
+    OlmInboundGroupSession * session
+) {
+    GroupSessionStore & object = *from_c(store);
+    std::size_t slot = session_slot(object, session);
+    if (slot == object.capacity
+            || object.slot_states[slot] != SlotState::ADDED) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+
+    olm_inbound_group_session_id_binary(
+        session, object.ids[slot], SESSION_ID_LENGTH
+    );
+    object.slot_states[slot] = SlotState::INDEXED;
+    std::uint32_t entry;
+    std::size_t pos = find_position(object, object.ids[slot], entry);
+    if (pos <= object.table_mask) {
+        /* the new session replaces the one with the same ID */
+        object.table[pos].store(slot + 1, std::memory_order_release);
+        retire_slot(object, entry - 1);
+    } else {
+        insert_slot(object, slot);
+        object.count++;
+    }
+    return 0;
+}
+
+
+size_t olm_group_session_store_remove(
+    OlmGroupSessionStore * store,
+    OlmInboundGroupSession * session
+) {
+    GroupSessionStore & object = *from_c(store);
+    std::size_t slot = session_slot(object, session);
+    if (slot == object.capacity
+            || object.slot_states[slot] == SlotState::FREE
+            || object.slot_states[slot] == SlotState::RETIRED) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    if (object.slot_states[slot] == SlotState::ADDED) {
+        /* nobody else can have found it */
+        free_slot(object, slot);
+        return 0;
+    }
+    std::uint32_t entry;
+    erase_position(object, find_position(object, object.ids[slot], entry));
+    object.count--;
+    retire_slot(object, slot);
+    return 0;
+}
+
+
+OlmInboundGroupSession * olm_group_session_store_find(
+    OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+) {
+    GroupSessionStore & object = *from_c(store);
+    std::size_t slot = object.capacity;
+    if (session_id_length == SESSION_ID_LENGTH) {
+        slot = find_slot(object, session_id);
+    }
+    if (slot == object.capacity) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return nullptr;
+    }
+    return slot_session(object, slot);
+}
+
+
+size_t olm_group_session_store_read_begin(
+    const OlmGroupSessionStore * store
+) {
+    GroupSessionStore & object = *const_cast<GroupSessionStore *>(
+        from_c(store)
+    );
+    std::size_t stripe = reader_stripe();
+    for (;;) {
+        std::uint64_t epoch = object.epoch.load();
+        std::size_t parity = epoch & 1;
+        object.readers[stripe].active[parity].fetch_add(1);
+        /* if the epoch moved on before we were counted, whoever moved it
+         * may not have seen us, so count ourselves in the new one */
+        if (object.epoch.load() == epoch) {
+            return 2 * stripe + parity;
+        }
+        object.readers[stripe].active[parity].fetch_sub(1);
+    }
+}
+
+
+void olm_group_session_store_read_end(
+    const OlmGroupSessionStore * store, size_t ticket
+) {
+    GroupSessionStore & object = *const_cast<GroupSessionStore *>(
+        from_c(store)
+    );
+    object.readers[ticket / 2].active[ticket % 2].fetch_sub(
+        1, std::memory_order_release
+    );
+}
+
+
+const OlmInboundGroupSession * olm_group_session_store_lookup(
+    const OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+) {
+    GroupSessionStore const & object = *from_c(store);
+    if (session_id_length != SESSION_ID_LENGTH) {
+        return nullptr;
+    }
+    std::size_t slot = find_slot(object, session_id);
+    if (slot == object.capacity) {
+        return nullptr;
+    }
+    return slot_session(object, slot);
+}
+
+
+size_t olm_group_session_store_sessions(
+    OlmGroupSessionStore * store,
+    OlmInboundGroupSession ** sessions, size_t max_sessions
+) {
+    GroupSessionStore & object = *from_c(store);
+    if (max_sessions < object.count) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    std::size_t count = 0;
+    for (std::size_t slot = 0; slot < object.capacity; ++slot) {
+        if (object.slot_states[slot] == SlotState::INDEXED) {
+            sessions[count++] = slot_session(object, slot);
+        }
+    }
+    return count;
+}
+
+
+size_t olm_group_session_store_decrypt_max_plaintext_length(
+    OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length,
+    uint8_t * message, size_t message_length
+) {
+    OlmInboundGroupSession * session = olm_group_session_store_find(
+        store, session_id, session_id_length
+    );
+    if (!session) {
+        return std::size_t(-1);
+    }
+    std::size_t result = olm_group_decrypt_max_plaintext_length(
+        session, message, message_length
+    );
+    if (result == std::size_t(-1)) {
+        from_c(store)->last_error = OlmErrorCode(
+            olm_inbound_group_session_last_error_code(session)
+        );
+    }
+    return result;
+}
+
+
+size_t olm_group_session_store_decrypt(
+    OlmGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length,
+    uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+) {
+    OlmInboundGroupSession * session = olm_group_session_store_find(
+        store, session_id, session_id_length
+    );
+    if (!session) {
+        return std::size_t(-1);
+    }
+    std::size_t result = olm_group_decrypt(
+        session, message, message_length,
+        plaintext, max_plaintext_length, message_index
+    );
+    if (result == std::size_t(-1)) {
+        from_c(store)->last_error = OlmErrorCode(
+            olm_inbound_group_session_last_error_code(session)
+        );
+    }
+    return result;
+}
+
+
+
+size_t olm_sharded_group_session_store_size(
+    size_t shard_count
+) {
+    return aligned(sizeof(ShardedGroupSessionStore))
+        + aligned(shard_count * sizeof(GroupSessionStore *))
+        + shard_count * sizeof(int);
+}
+
+
+OlmShardedGroupSessionStore * olm_sharded_group_session_store(
+    void * memory,
+    OlmGroupSessionStore * const * shards, const int * nodes,
+    size_t shard_count
+) {
+    std::uint8_t * pos = reinterpret_cast<std::uint8_t *>(memory);
+    olm::unset(pos, aligned(sizeof(ShardedGroupSessionStore)));
+    ShardedGroupSessionStore * store = new(pos) ShardedGroupSessionStore;
+    pos += aligned(sizeof(ShardedGroupSessionStore));
+
+    store->shard_count = shard_count;
+    store->shards = reinterpret_cast<GroupSessionStore **>(pos);
+    pos += aligned(shard_count * sizeof(GroupSessionStore *));
+    store->nodes = reinterpret_cast<int *>(pos);
+    store->last_error = OlmErrorCode::OLM_SUCCESS;
+    for (std::size_t i = 0; i < shard_count; ++i) {
+        store->shards[i] = from_c(shards[i]);
+        store->nodes[i] = nodes[i];
+    }
+    return to_c(store);
+}
+
+
+const char * olm_sharded_group_session_store_last_error(
+    const OlmShardedGroupSessionStore * store
+) {
+    return _olm_error_to_string(from_c(store)->last_error);
+}
+
+
+size_t olm_clear_sharded_group_session_store(
+    OlmShardedGroupSessionStore * store
+) {
+    std::size_t size = olm_sharded_group_session_store_size(
+        from_c(store)->shard_count
+    );
+    olm::unset(store, size);
+    return size;
+}
+
+
+size_t olm_sharded_group_session_store_count(
+    const OlmShardedGroupSessionStore * store
+) {
+    ShardedGroupSessionStore const & object = *from_c(store);
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < object.shard_count; ++i) {
+        count += object.shards[i]->count;
+    }
+    return count;
+}
+
+
+void olm_sharded_group_session_store_memory_stats(
+    const OlmShardedGroupSessionStore * store,
+    OlmMemoryStats * stats
+) {
+    ShardedGroupSessionStore const & object = *from_c(store);
+    std::size_t size = olm_sharded_group_session_store_size(
+        object.shard_count
+    );
+    stats->reserved_bytes += size;
+    stats->live_bytes += size;
+    for (std::size_t i = 0; i < object.shard_count; ++i) {
+        olm_group_session_store_memory_stats(
+            to_c(object.shards[i]), stats
+        );
+    }
+}
+
+
+size_t olm_sharded_group_session_store_shard_index(
+    const OlmShardedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+) {
+    if (session_id_length != SESSION_ID_LENGTH) {
+        return std::size_t(-1);
+    }
+    return shard_for(*from_c(store), session_id);
+}
+
+
+OlmGroupSessionStore * olm_sharded_group_session_store_shard(
+    OlmShardedGroupSessionStore * store, size_t shard
+) {
+    return to_c(from_c(store)->shards[shard]);
+}
+
+
+OlmInboundGroupSession * olm_sharded_group_session_store_commit(
+    OlmShardedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+) {
+    ShardedGroupSessionStore & object = *from_c(store);
+    std::size_t from;
+    std::size_t slot = find_shard_slot(object, session, from);
+    if (from == object.shard_count
+            || object.shards[from]->slot_states[slot] != SlotState::ADDED) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return nullptr;
+    }
+
+    std::uint8_t id[SESSION_ID_LENGTH];
+    olm_inbound_group_session_id_binary(session, id, sizeof(id));
+    std::size_t to = shard_for(object, id);
+    OlmInboundGroupSession * result = session;
+    if (to != from) {
+        result = olm_group_session_store_add(to_c(object.shards[to]));
+        if (!result) {
+            object.last_error = OlmErrorCode::OLM_STORE_FULL;
+            return nullptr;
+        }
+        /* the move wipes the old slot rather than clearing it, which would
+         * also wipe the checkpoint and key cache buffers the session still
+         * uses */
+        GroupSessionStore & old_shard = *object.shards[from];
+        olm_inbound_group_session_move(result, session);
+        olm::unset(slot_session(old_shard, slot), old_shard.slot_size);
+        old_shard.slot_states[slot] = SlotState::FREE;
+        old_shard.free_slots[old_shard.free_count++] = slot;
+    }
+    olm_group_session_store_commit(to_c(object.shards[to]), result);
+    return result;
+}
+
+
+size_t olm_sharded_group_session_store_remove(
+    OlmShardedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+) {
+    ShardedGroupSessionStore & object = *from_c(store);
+    std::size_t shard;
+    find_shard_slot(object, session, shard);
+    if (shard == object.shard_count
+            || olm_group_session_store_remove(
+                to_c(object.shards[shard]), session
+            ) == std::size_t(-1)) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    return 0;
+}
+
+
+OlmInboundGroupSession * olm_sharded_group_session_store_find(
+    OlmShardedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+) {
+    ShardedGroupSessionStore & object = *from_c(store);
+    std::size_t shard = 0;
+    std::size_t slot = object.shards[0]->capacity;
+    if (session_id_length == SESSION_ID_LENGTH) {
+        shard = shard_for(object, session_id);
+        slot = find_slot(*object.shards[shard], session_id);
+    }
+    if (slot == object.shards[shard]->capacity) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return nullptr;
+    }
+    return slot_session(*object.shards[shard], slot);
+}
+
+
+size_t olm_sharded_group_session_store_decrypt_batch_scratch_length(
+    const OlmShardedGroupSessionStore * store, size_t count
+) {
+    return count + from_c(store)->shard_count + 1;
+}
+
+
+size_t olm_sharded_group_session_store_decrypt_batch(
+    OlmShardedGroupSessionStore * store, size_t count,
+    uint8_t const * const * session_ids, const size_t * session_id_lengths,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors,
+    size_t * scratch, size_t scratch_length,
+    OlmNodeBatchExecutor executor, void * executor_context
+) {
+    ShardedGroupSessionStore & object = *from_c(store);
+    std::size_t shard_count = object.shard_count;
+    if (scratch_length
+            < olm_sharded_group_session_store_decrypt_batch_scratch_length(
+                store, count
+            )) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    std::size_t * order = scratch;
+    std::size_t * group_starts = scratch + count;
+
+    /* a message for an ID of the wrong length goes to the first shard, which
+     * won't find its session */
+    auto message_shard = [&](std::size_t i) -> std::size_t {
+        return session_id_lengths[i] == SESSION_ID_LENGTH
+            ? shard_for(object, session_ids[i]) : 0;
+    };
+
+    /* count the messages for each shard, then place them in order; placing
+     * moves each group's start on to the next group's, so they are moved
+     * back afterwards */
+    std::fill(group_starts, group_starts + shard_count + 1, std::size_t(0));
+    for (std::size_t i = 0; i < count; ++i) {
+        group_starts[message_shard(i) + 1]++;
+    }
+    for (std::size_t k = 1; k <= shard_count; ++k) {
+        group_starts[k] += group_starts[k - 1];
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        order[group_starts[message_shard(i)]++] = i;
+    }
+    for (std::size_t k = shard_count - 1; k > 0; --k) {
+        group_starts[k] = group_starts[k - 1];
+    }
+    group_starts[0] = 0;
+
+    ShardedDecryptBatch batch = {
+        &object, session_ids, session_id_lengths, messages, message_lengths,
+        plaintexts, max_plaintext_lengths, plaintext_lengths, message_indices,
+        errors, order, group_starts,
+    };
+    if (executor) {
+        executor(
+            executor_context, sharded_decrypt_batch_job, &batch,
+            object.nodes, shard_count
+        );
+    } else {
+        for (std::size_t job = 0; job < shard_count; ++job) {
+            sharded_decrypt_batch_job(&batch, job);
+        }
+    }
+
+    std::size_t failures = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (plaintext_lengths[i] == std::size_t(-1)) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+
+
+size_t olm_shared_group_session_store_size() {
+    return sizeof(SharedGroupSessionStore);
+}
+
+
+size_t olm_shared_group_session_store_shared_length(
+    size_t capacity
+) {
+    return aligned(sizeof(SharedStoreHeader))
+        + aligned(table_length(capacity) * sizeof(std::uint32_t))
+        + aligned(capacity * sizeof(SharedSlot))
+        + aligned(capacity * sizeof(std::uint32_t))
+        + capacity * slot_size();
+}
+
+
+OlmSharedGroupSessionStore * olm_shared_group_session_store(
+    void * memory, void * shared_memory, size_t capacity
+) {
+    olm::unset(
+        shared_memory, olm_shared_group_session_store_shared_length(capacity)
+    );
+    SharedGroupSessionStore * store = new(memory) SharedGroupSessionStore;
+    attach_shared_store(*store, shared_memory, capacity);
+
+    SharedStoreHeader * header = new(store->header) SharedStoreHeader;
+    /* held until the store is set up, in case another process attaches
+     * while it is */
+    header->lock.store(1, std::memory_order_relaxed);
+    header->capacity = capacity;
+    header->slot_size = store->slot_size;
+    header->count.store(0, std::memory_order_relaxed);
+    for (std::size_t i = 0; i <= store->table_mask; ++i) {
+        new(&store->table[i]) std::atomic<std::uint32_t>(EMPTY_ENTRY);
+    }
+    for (std::size_t i = 0; i < capacity; ++i) {
+        SharedSlot * slot = new(&store->slots[i]) SharedSlot;
+        slot->lock.store(0, std::memory_order_relaxed);
+        slot->state.store(SHARED_SLOT_FREE, std::memory_order_relaxed);
+        /* hand out the slots from the start of the slab */
+        store->free_slots[i] = capacity - 1 - i;
+    }
+    header->free_count = capacity;
+    std::memcpy(header->magic, SHARED_STORE_MAGIC, sizeof(header->magic));
+    header->lock.store(0, std::memory_order_release);
+    return to_c(store);
+}
+
+
+OlmSharedGroupSessionStore * olm_shared_group_session_store_attach(
+    void * memory, void * shared_memory, size_t shared_length
+) {
+    SharedStoreHeader * header =
+        reinterpret_cast<SharedStoreHeader *>(shared_memory);
+    if (shared_length < sizeof(SharedStoreHeader)) {
+        return nullptr;
+    }
+    lock(header->lock);
+    bool valid = !std::memcmp(
+            header->magic, SHARED_STORE_MAGIC, sizeof(header->magic)
+        ) && header->slot_size == slot_size()
+        && header->capacity <= 32767
+        && shared_length >= olm_shared_group_session_store_shared_length(
+            header->capacity
+        );
+    std::size_t capacity = header->capacity;
+    unlock(header->lock);
+    if (!valid) {
+        return nullptr;
+    }
+    SharedGroupSessionStore * store = new(memory) SharedGroupSessionStore;
+    attach_shared_store(*store, shared_memory, capacity);
+    return to_c(store);
+}
+
+
+const char * olm_shared_group_session_store_last_error(
+    const OlmSharedGroupSessionStore * store
+) {
+    return _olm_error_to_string(from_c(store)->last_error);
+}
+
+
+size_t olm_clear_shared_group_session_store(
+    OlmSharedGroupSessionStore * store
+) {
+    SharedGroupSessionStore & object = *from_c(store);
+    for (std::size_t i = 0; i < object.capacity; ++i) {
+        if (object.slots[i].state.load(std::memory_order_relaxed)
+                != SHARED_SLOT_FREE) {
+            olm_clear_inbound_group_session(shared_slot_session(object, i));
+        }
+    }
+    std::size_t shared_length =
+        olm_shared_group_session_store_shared_length(object.capacity);
+    olm::unset(object.header, shared_length);
+    olm::unset(store, sizeof(SharedGroupSessionStore));
+    return shared_length;
+}
+
+
+size_t olm_shared_group_session_store_count(
+    const OlmSharedGroupSessionStore * store
+) {
+    return from_c(store)->header->count.load(std::memory_order_relaxed);
+}
+
+
+OlmInboundGroupSession * olm_shared_group_session_store_add(
+    OlmSharedGroupSessionStore * store
+) {
+    SharedGroupSessionStore & object = *from_c(store);
+    SharedStoreHeader & header = *object.header;
+    lock(header.lock);
+    if (header.free_count == 0) {
+        unlock(header.lock);
+        object.last_error = OlmErrorCode::OLM_STORE_FULL;
+        return nullptr;
+    }
+    std::size_t slot = object.free_slots[--header.free_count];
+    object.slots[slot].state.store(
+        SHARED_SLOT_ADDED, std::memory_order_relaxed
+    );
+    unlock(header.lock);
+    return olm_inbound_group_session(shared_slot_session(object, slot));
+}
+
+
+size_t olm_shared_group_session_store_commit(
+    OlmSharedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+) {
+    SharedGroupSessionStore & object = *from_c(store);
+    SharedStoreHeader & header = *object.header;
+    std::size_t slot = shared_session_slot(object, session);
+    if (slot == object.capacity) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    SharedSlot & shared_slot = object.slots[slot];
+
+    lock(header.lock);
+    if (shared_slot.state.load(std::memory_order_relaxed)
+            != SHARED_SLOT_ADDED) {
+        unlock(header.lock);
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    lock(shared_slot.lock);
+    olm_inbound_group_session_id_binary(
+        session, shared_slot.id, SESSION_ID_LENGTH
+    );
+    shared_slot.state.store(SHARED_SLOT_INDEXED, std::memory_order_relaxed);
+    unlock(shared_slot.lock);
+
+    std::size_t pos = shared_find_position(object, shared_slot.id);
+    if (pos <= object.table_mask) {
+        /* the new session replaces the one with the same ID */
+        std::uint32_t entry = object.table[pos].load(std::memory_order_relaxed);
+        object.table[pos].store(slot + 1, std::memory_order_release);
+        shared_free_slot(object, entry - 1);
+    } else {
+        pos = id_hash(shared_slot.id) & object.table_mask;
+        for (;;) {
+            std::uint32_t entry =
+                object.table[pos].load(std::memory_order_relaxed);
+            if (entry == EMPTY_ENTRY || entry == REMOVED_ENTRY) {
+                break;
+            }
+            pos = (pos + 1) & object.table_mask;
+        }
+        object.table[pos].store(slot + 1, std::memory_order_release);
+        header.count.fetch_add(1, std::memory_order_relaxed);
+    }
+    unlock(header.lock);
+    return 0;
+}
+
+
+size_t olm_shared_group_session_store_discard(
+    OlmSharedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+) {
+    SharedGroupSessionStore & object = *from_c(store);
+    SharedStoreHeader & header = *object.header;
+    std::size_t slot = shared_session_slot(object, session);
+    if (slot == object.capacity) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    lock(header.lock);
+    if (object.slots[slot].state.load(std::memory_order_relaxed)
+            != SHARED_SLOT_ADDED) {
+        unlock(header.lock);
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    shared_free_slot(object, slot);
+    unlock(header.lock);
+    return 0;
+}
+
+
+size_t olm_shared_group_session_store_remove(
+    OlmSharedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+) {
+    SharedGroupSessionStore & object = *from_c(store);
+    SharedStoreHeader & header = *object.header;
+    std::size_t pos = object.table_mask + 1;
+    lock(header.lock);
+    if (session_id_length == SESSION_ID_LENGTH) {
+        pos = shared_find_position(object, session_id);
+    }
+    if (pos > object.table_mask) {
+        unlock(header.lock);
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    std::uint32_t entry = object.table[pos].load(std::memory_order_relaxed);
+    erase_position(object, pos);
+    header.count.fetch_sub(1, std::memory_order_relaxed);
+    shared_free_slot(object, entry - 1);
+    unlock(header.lock);
+    return 0;
+}
+
+
+OlmInboundGroupSession * olm_shared_group_session_store_lock(
+    OlmSharedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length
+) {
+    SharedGroupSessionStore & object = *from_c(store);
+    std::size_t slot = object.capacity;
+    if (session_id_length == SESSION_ID_LENGTH) {
+        slot = shared_lock_slot(object, session_id);
+    }
+    if (slot == object.capacity) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return nullptr;
+    }
+    return shared_slot_session(object, slot);
+}
+
+
+void olm_shared_group_session_store_unlock(
+    OlmSharedGroupSessionStore * store,
+    OlmInboundGroupSession * session
+) {
+    SharedGroupSessionStore & object = *from_c(store);
+    unlock(object.slots[shared_session_slot(object, session)].lock);
+}
+
+
+size_t olm_shared_group_session_store_decrypt(
+    OlmSharedGroupSessionStore * store,
+    uint8_t const * session_id, size_t session_id_length,
+    uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+) {
+    OlmInboundGroupSession * session = olm_shared_group_session_store_lock(
+        store, session_id, session_id_length
+    );
+    if (!session) {
+        return std::size_t(-1);
+    }
+    std::size_t result = olm_group_decrypt(
+        session, message, message_length,
+        plaintext, max_plaintext_length, message_index
+    );
+    if (result == std::size_t(-1)) {
+        from_c(store)->last_error = OlmErrorCode(
+            olm_inbound_group_session_last_error_code(session)
+        );
+    }
+    olm_shared_group_session_store_unlock(store, session);
+    return result;
+}
+
+}
@@ -21,28 +21,110 @@
 #include "olm/cipher.h"
 #include "olm/crypto.h"
 #include "olm/error.h"
+#include "olm/iovec_internal.h"
 #include "olm/megolm.h"
 #include "olm/memory.h"
 #include "olm/message.h"
 #include "olm/pickle.h"
 #include "olm/pickle_encoding.h"
+#include "olm/probes.h"
+#include "olm/stats_internal.h"
+#include "olm/trace_internal.h"
 
 
 #define OLM_PROTOCOL_VERSION     3
 #define GROUP_SESSION_ID_LENGTH  ED25519_PUBLIC_KEY_LENGTH
-#define PICKLE_VERSION           2
+#define PICKLE_VERSION           3
 #define SESSION_KEY_VERSION      2
 #define SESSION_EXPORT_VERSION   1
 
+/** How many of the most recent message indices replay detection remembers */
+#define REPLAY_WINDOW_BITS 256
+#define REPLAY_WINDOW_WORDS (REPLAY_WINDOW_BITS / 32)
+
+/** How many message indices a history scan holds the ratchet for: those
+ * which only differ in R(3), the last part of the ratchet */
+#define SCAN_BLOCK_LENGTH 256
+
+/** The ratchet at every index of one block of message indices, for a
+ * history scan */
+struct GroupSessionScan {
+    /** Whether the block has been worked out */
+    int valid;
+    /** The ratchet at the first index held: the start of the block, or the
+     * first known index if that is later. The first three parts of the
+     * ratchet are the same for the whole block. */
+    Megolm first;
+    /** The last part of the ratchet at each index of the block, by the
+     * index's bottom eight bits */
+    uint8_t parts[SCAN_BLOCK_LENGTH][MEGOLM_RATCHET_PART_LENGTH];
+};
+
+/** A message we have decrypted before, with the keys derived for it */
+struct MessageKeyCacheEntry {
+    uint32_t message_index;
+    /** when this entry was last used, from message_key_cache_clock. Zero for
+     * an empty entry. */
+    uint32_t last_used;
+    /** SHA-256 of the whole message, including the signature */
+    uint8_t message_hash[SHA256_OUTPUT_LENGTH];
+    struct _olm_cipher_aes_sha_256_context keys;
+};
+
 struct OlmInboundGroupSession {
-    /** our earliest known ratchet value */
-    Megolm initial_ratchet;
+    /* The fields every decrypt reads come first, so that on 64-bit systems
+     * they share the first cache line: the buffers to look in, the limits,
+     * and where the latest ratchet is. */
 
-    /** The most recent ratchet value */
-    Megolm latest_ratchet;
+    /**
+     * Optional caller-supplied memory for copies of the ratchet at earlier
+     * message indices, so that decrypting old messages needn't always start
+     * from initial_ratchet, as an offset for _checkpoints(). None of this is
+     * pickled.
+     */
+    intptr_t checkpoints_offset;
 
-    /** The ed25519 signing key */
-    struct _olm_ed25519_public_key signing_key;
+    /**
+     * Optional caller-supplied memory for the keys of recently decrypted
+     * messages, so that decrypting the same message again can skip the
+     * signature check, the ratchet and the key derivation, as an offset for
+     * _message_key_cache(). Not pickled.
+     */
+    intptr_t message_key_cache_offset;
+
+    size_t checkpoint_capacity;
+    size_t checkpoint_count;
+    size_t message_key_cache_capacity;
+
+    /**
+     * The most ratchet work one decrypt may do, as counted by
+     * megolm_advance_cost, or 0 for no limit. Not pickled.
+     */
+    size_t max_ratchet_distance;
+
+    /**
+     * The most ratchet work for which a decrypt checks the MAC before the
+     * signature, or 0 to always check the signature first. Not pickled.
+     */
+    size_t mac_first_distance;
+
+    /**
+     * For a compact session, the latest ratchet once it has moved on from
+     * initial_ratchet, in memory from the allocator. NULL while the two are
+     * the same, which is all a compact session keeps room for itself. This
+     * is pointed to, like the allocator, since neither means anything
+     * outside the process, and stays where it is when the session moves.
+     */
+    Megolm *latest_out_of_line;
+
+    /**
+     * Whether to reject messages at indices we have already decrypted, and
+     * which of the REPLAY_WINDOW_BITS indices up to and including
+     * replay_window_top those are: bit i of the window is index
+     * replay_window_top - i. The window is empty until replay_window_used is
+     * set. Pickled, from pickle version 3.
+     */
+    int replay_detection;
 
     /**
      * Have we ever seen any evidence that this is a valid session?
@@ -55,9 +137,92 @@ struct OlmInboundGroupSession {
      */
     int signing_key_verified;
 
+    /**
+     * Set whenever anything the session pickles changes, and cleared only
+     * by unpickling or by olm_inbound_group_session_clear_dirty(). Not
+     * pickled.
+     */
+    int dirty;
+
+    int replay_window_used;
+    uint32_t replay_window_top;
+    uint32_t replay_window[REPLAY_WINDOW_WORDS];
+
+    /** the checkpoint slot to replace next once the table is full */
+    size_t checkpoint_next;
+    /** checkpoints are taken at message indices which are multiples of
+     * 2^checkpoint_spacing_log2 */
+    unsigned int checkpoint_spacing_log2;
+
+    /**
+     * Caller-supplied memory for a history scan, between
+     * olm_inbound_group_session_begin_scan() and
+     * olm_inbound_group_session_end_scan(), as an offset for _scan(). Not
+     * pickled.
+     */
+    intptr_t scan_offset;
+
+    uint32_t message_key_cache_clock;
+
     enum OlmErrorCode last_error;
+
+    /** Where a compact session takes latest_out_of_line from, or NULL for a
+     * session with all its fields */
+    const OlmAllocator *allocator;
+
+    /** The ed25519 signing key */
+    struct _olm_ed25519_public_key signing_key;
+
+    /** our earliest known ratchet value */
+    Megolm initial_ratchet;
+
+    /* A compact session stops here, at COMPACT_SESSION_SIZE. */
+
+    /** The most recent ratchet value, for a session that isn't compact */
+    Megolm latest_ratchet;
+
+    /** The signing key decoded for checking message signatures, for a
+     * session that isn't compact. This isn't pickled; it is recomputed from
+     * signing_key when the session is set up. */
+    struct _olm_ed25519_prepared_key prepared_signing_key;
 };
 
+/** The part of a session a compact session has */
+#define COMPACT_SESSION_SIZE \
+    offsetof(OlmInboundGroupSession, latest_ratchet)
+
+/* The buffers a session is given are found from their offsets from the
+ * session, 0 meaning none, rather than pointed to, so that a session and its
+ * buffers in memory shared between processes are found wherever each
+ * process maps them. */
+static void * _buffer_at(
+    const OlmInboundGroupSession *session, intptr_t offset
+) {
+    return offset ? (void *)((intptr_t)session + offset) : NULL;
+}
+
+static intptr_t _buffer_offset(
+    const OlmInboundGroupSession *session, const void *buffer
+) {
+    return buffer ? (intptr_t)buffer - (intptr_t)session : 0;
+}
+
+static Megolm * _checkpoints(const OlmInboundGroupSession *session) {
+    return _buffer_at(session, session->checkpoints_offset);
+}
+
+static struct MessageKeyCacheEntry * _message_key_cache(
+    const OlmInboundGroupSession *session
+) {
+    return _buffer_at(session, session->message_key_cache_offset);
+}
+
+static struct GroupSessionScan * _scan(
+    const OlmInboundGroupSession *session
+) {
+    return _buffer_at(session, session->scan_offset);
+}
+
 size_t olm_inbound_group_session_size() {
     return sizeof(OlmInboundGroupSession);
 }
@@ -66,304 +231,3720 @@ OlmInboundGroupSession * olm_inbound_group_session(
     void *memory
 ) {
     OlmInboundGroupSession *session = memory;
-    olm_clear_inbound_group_session(session);
+    /* don't use olm_clear_inbound_group_session, which would try to wipe
+     * whatever checkpoints the memory happened to say it had */
+    _olm_unset(session, sizeof(OlmInboundGroupSession));
     return session;
 }
 
-const char *olm_inbound_group_session_last_error(
-    const OlmInboundGroupSession *session
-) {
-    return _olm_error_to_string(session->last_error);
+size_t olm_compact_inbound_group_session_size(void) {
+    return COMPACT_SESSION_SIZE;
 }
 
-size_t olm_clear_inbound_group_session(
-    OlmInboundGroupSession *session
+size_t olm_compact_inbound_group_session_ratchet_size(void) {
+    return sizeof(Megolm);
+}
+
+OlmInboundGroupSession * olm_compact_inbound_group_session(
+    void *memory, const OlmAllocator *allocator
 ) {
-    _olm_unset(session, sizeof(OlmInboundGroupSession));
-    return sizeof(OlmInboundGroupSession);
+    OlmInboundGroupSession *session = memory;
+    _olm_unset(session, COMPACT_SESSION_SIZE);
+    session->allocator = allocator;
+    return session;
 }
 
-#define SESSION_EXPORT_RAW_LENGTH \
-    (1 + 4 + MEGOLM_RATCHET_LENGTH + ED25519_PUBLIC_KEY_LENGTH)
+/** The bytes of memory the session itself takes */
+static size_t _session_size(const OlmInboundGroupSession *session) {
+    return session->allocator
+        ? COMPACT_SESSION_SIZE : sizeof(OlmInboundGroupSession);
+}
 
-#define SESSION_KEY_RAW_LENGTH \
-    (1 + 4 + MEGOLM_RATCHET_LENGTH + ED25519_PUBLIC_KEY_LENGTH\
-        + ED25519_SIGNATURE_LENGTH)
+/** The most recent ratchet value */
+static const Megolm * _latest(const OlmInboundGroupSession *session) {
+    if (!session->allocator) {
+        return &session->latest_ratchet;
+    }
+    return session->latest_out_of_line
+        ? session->latest_out_of_line : &session->initial_ratchet;
+}
 
-static size_t _init_group_session_keys(
-    OlmInboundGroupSession *session,
-    const uint8_t *key_buf,
-    int export_format
+/** Give a compact session's out of line ratchet back to its allocator, so
+ * that the latest ratchet is the initial one again */
+static void _release_latest(OlmInboundGroupSession *session) {
+    if (session->latest_out_of_line) {
+        _olm_unset(session->latest_out_of_line, sizeof(Megolm));
+        session->allocator->release(
+            session->allocator->context, session->latest_out_of_line,
+            sizeof(Megolm)
+        );
+        session->latest_out_of_line = NULL;
+    }
+}
+
+/**
+ * The latest ratchet, separate from initial_ratchet so that it can change.
+ * A compact session takes memory for it from its allocator, starting from
+ * initial_ratchet, if it hasn't already. Returns NULL, with last_error
+ * ALLOCATION_FAILED, if the allocator has none.
+ */
+static Megolm * _writable_latest(OlmInboundGroupSession *session) {
+    Megolm *latest;
+
+    if (!session->allocator) {
+        return &session->latest_ratchet;
+    }
+    if (session->latest_out_of_line) {
+        return session->latest_out_of_line;
+    }
+    latest = session->allocator->allocate(
+        session->allocator->context, sizeof(Megolm)
+    );
+    if (!latest) {
+        session->last_error = OLM_ALLOCATION_FAILED;
+        return NULL;
+    }
+    *latest = session->initial_ratchet;
+    session->latest_out_of_line = latest;
+    return latest;
+}
+
+/**
+ * The latest ratchet, for moving on to message_index, which must be no
+ * earlier than it. As _writable_latest(), except that a compact session
+ * whose latest ratchet is still the initial one needn't take any memory to
+ * move it to where it already is.
+ */
+static Megolm * _latest_to_advance(
+    OlmInboundGroupSession *session, uint32_t message_index
 ) {
-    const uint8_t expected_version =
-        (export_format ? SESSION_EXPORT_VERSION : SESSION_KEY_VERSION);
-    const uint8_t *ptr = key_buf;
-    size_t version = *ptr++;
+    if (message_index != _latest(session)->counter) {
+        session->dirty = 1;
+    }
+    if (session->allocator && !session->latest_out_of_line
+            && message_index == session->initial_ratchet.counter) {
+        return &session->initial_ratchet;
+    }
+    return _writable_latest(session);
+}
 
-    if (version != expected_version) {
-        session->last_error = OLM_BAD_SESSION_KEY;
+/** Set the latest ratchet. Returns olm_error() if a compact session has no
+ * room for it. */
+static size_t _set_latest(
+    OlmInboundGroupSession *session, const Megolm *value
+) {
+    Megolm *latest;
+
+    if (memcmp(value, _latest(session), sizeof(Megolm)) != 0) {
+        session->dirty = 1;
+    }
+    if (session->allocator
+            && memcmp(value, &session->initial_ratchet, sizeof(Megolm)) == 0) {
+        _release_latest(session);
+        return 0;
+    }
+    latest = _writable_latest(session);
+    if (!latest) {
         return (size_t)-1;
     }
+    *latest = *value;
+    return 0;
+}
 
-    uint32_t counter = 0;
-    // Decode counter as a big endian 32-bit number.
-    for (unsigned i = 0; i < 4; i++) {
-        counter <<= 8; counter |= *ptr++;
+/** Note that the signing key has been shown to be genuine */
+static void _mark_verified(OlmInboundGroupSession *session) {
+    if (!session->signing_key_verified) {
+        session->signing_key_verified = 1;
+        session->dirty = 1;
     }
+}
 
-    megolm_init(&session->initial_ratchet, ptr, counter);
-    megolm_init(&session->latest_ratchet, ptr, counter);
+/** Decode the signing key ready for checking signatures, if the session has
+ * room for it */
+static void _prepare_signing_key(OlmInboundGroupSession *session) {
+    if (!session->allocator) {
+        _olm_crypto_ed25519_prepare_key(
+            &session->signing_key, &session->prepared_signing_key
+        );
+    }
+}
 
-    ptr += MEGOLM_RATCHET_LENGTH;
-    memcpy(
-        session->signing_key.public_key, ptr, ED25519_PUBLIC_KEY_LENGTH
+/** Check a signature by the session's signing key. A compact session
+ * decodes the key each time. */
+static int _verify_signature(
+    const OlmInboundGroupSession *session,
+    const uint8_t *message, size_t message_length,
+    const uint8_t *signature
+) {
+    if (session->allocator) {
+        return _olm_crypto_ed25519_verify(
+            &session->signing_key, message, message_length, signature
+        );
+    }
+    return _olm_crypto_ed25519_verify_prepared(
+        &session->prepared_signing_key, message, message_length, signature
     );
-    ptr += ED25519_PUBLIC_KEY_LENGTH;
+}
 
-    if (!export_format) {
-        if (!_olm_crypto_ed25519_verify(&session->signing_key, key_buf,
-                                        ptr - key_buf, ptr)) {
-            session->last_error = OLM_BAD_SIGNATURE;
-            return (size_t)-1;
+/** As _verify_signature(), for a message held in segments */
+static int _verify_signature_segments(
+    const OlmInboundGroupSession *session,
+    const OlmIovec *segments, size_t segment_count, size_t message_length,
+    const uint8_t *signature
+) {
+    struct _olm_ed25519_prepared_key prepared_key;
+    const struct _olm_ed25519_prepared_key *key =
+        &session->prepared_signing_key;
+
+    if (session->allocator) {
+        _olm_crypto_ed25519_prepare_key(&session->signing_key, &prepared_key);
+        key = &prepared_key;
+    }
+    return _olm_crypto_ed25519_verify_prepared_segments(
+        key, segments, segment_count, message_length, signature
+    );
+}
+
+OlmInboundGroupSession * olm_inbound_group_session_copy(
+    void *memory, const OlmInboundGroupSession *session
+) {
+    OlmInboundGroupSession *copy = memory;
+    memcpy(copy, session, _session_size(session));
+    if (session->latest_out_of_line) {
+        copy->latest_out_of_line = NULL;
+        if (_set_latest(copy, session->latest_out_of_line) == (size_t)-1) {
+            _olm_unset(copy, COMPACT_SESSION_SIZE);
+            return NULL;
         }
+    }
+    /* the checkpoint and key cache buffers belong to the original; sharing
+     * them would let each session overwrite the other's entries */
+    copy->checkpoints_offset = 0;
+    copy->checkpoint_capacity = 0;
+    copy->checkpoint_count = 0;
+    copy->checkpoint_next = 0;
+    copy->message_key_cache_offset = 0;
+    copy->message_key_cache_capacity = 0;
+    copy->message_key_cache_clock = 0;
+    copy->scan_offset = 0;
+    copy->dirty = session->dirty;
+    return copy;
+}
 
-        /* signed keyshare */
-        session->signing_key_verified = 1;
+OlmInboundGroupSession * olm_inbound_group_session_move(
+    void *memory, OlmInboundGroupSession *session
+) {
+    OlmInboundGroupSession *moved = memory;
+    size_t size = _session_size(session);
+    /* the buffers stay put, so are further from the session by as much as
+     * it moved */
+    intptr_t distance = (intptr_t)moved - (intptr_t)session;
+    memcpy(moved, session, size);
+    if (moved->checkpoints_offset) {
+        moved->checkpoints_offset -= distance;
     }
-    return 0;
+    if (moved->message_key_cache_offset) {
+        moved->message_key_cache_offset -= distance;
+    }
+    if (moved->scan_offset) {
+        moved->scan_offset -= distance;
+    }
+    _olm_unset(session, size);
+    return moved;
 }
 
-size_t olm_init_inbound_group_session(
-    OlmInboundGroupSession *session,
-    const uint8_t * session_key, size_t session_key_length
+const char *olm_inbound_group_session_last_error(
+    const OlmInboundGroupSession *session
 ) {
-    uint8_t key_buf[SESSION_KEY_RAW_LENGTH];
-    size_t raw_length = _olm_decode_base64_length(session_key_length);
-    size_t result;
+    return _olm_error_to_string(session->last_error);
+}
 
-    if (raw_length == (size_t)-1) {
-        session->last_error = OLM_INVALID_BASE64;
-        return (size_t)-1;
+enum OlmErrorCode olm_inbound_group_session_last_error_code(
+    const OlmInboundGroupSession *session
+) {
+    return session->last_error;
+}
+
+/** forget the block a history scan holds, wiping it */
+static void _reset_scan(OlmInboundGroupSession *session) {
+    if (_scan(session)) {
+        _olm_unset(_scan(session), sizeof(struct GroupSessionScan));
     }
+}
 
-    if (raw_length != SESSION_KEY_RAW_LENGTH) {
-        session->last_error = OLM_BAD_SESSION_KEY;
-        return (size_t)-1;
+/** forget all the checkpoints, wiping the ratchet values from the buffer */
+static void _reset_checkpoints(OlmInboundGroupSession *session) {
+    if (_checkpoints(session)) {
+        _olm_unset(
+            _checkpoints(session), session->checkpoint_count * sizeof(Megolm)
+        );
     }
+    session->checkpoint_count = 0;
+    session->checkpoint_next = 0;
+}
 
-    _olm_decode_base64(session_key, session_key_length, key_buf);
-    result = _init_group_session_keys(session, key_buf, 0);
-    _olm_unset(key_buf, SESSION_KEY_RAW_LENGTH);
-    return result;
+/** empty the message key cache, wiping the keys from the buffer */
+static void _reset_message_key_cache(OlmInboundGroupSession *session) {
+    if (_message_key_cache(session)) {
+        _olm_unset(
+            _message_key_cache(session),
+            session->message_key_cache_capacity
+                * sizeof(struct MessageKeyCacheEntry)
+        );
+    }
+    session->message_key_cache_clock = 0;
 }
 
-size_t olm_import_inbound_group_session(
-    OlmInboundGroupSession *session,
-    const uint8_t * session_key, size_t session_key_length
+/** forget which message indices we have seen */
+static void _reset_replay_window(OlmInboundGroupSession *session) {
+    session->replay_window_used = 0;
+    session->replay_window_top = 0;
+    memset(session->replay_window, 0, sizeof(session->replay_window));
+}
+
+/**
+ * Whether we have decrypted a message at message_index. Only the indices in
+ * the window are remembered.
+ */
+static int _replay_window_contains(
+    const OlmInboundGroupSession *session, uint32_t message_index
 ) {
-    uint8_t key_buf[SESSION_EXPORT_RAW_LENGTH];
-    size_t raw_length = _olm_decode_base64_length(session_key_length);
-    size_t result;
+    uint32_t offset = session->replay_window_top - message_index;
+    if (!session->replay_window_used || offset >= REPLAY_WINDOW_BITS) {
+        return 0;
+    }
+    return (session->replay_window[offset / 32] >> (offset % 32)) & 1;
+}
 
-    if (raw_length == (size_t)-1) {
-        session->last_error = OLM_INVALID_BASE64;
-        return (size_t)-1;
+/** Remember that we have decrypted a message at message_index, moving the
+ * window on if it is later than the top of the window */
+static void _replay_window_add(
+    OlmInboundGroupSession *session, uint32_t message_index
+) {
+    uint32_t *window = session->replay_window;
+    uint32_t offset;
+
+    session->dirty = 1;
+    if (!session->replay_window_used) {
+        session->replay_window_used = 1;
+        session->replay_window_top = message_index;
+    } else if ((message_index - session->replay_window_top) < (1U << 31)) {
+        /* later: bit i moves to bit i + shift */
+        uint32_t shift = message_index - session->replay_window_top;
+        int words = shift < REPLAY_WINDOW_BITS ? shift / 32 : REPLAY_WINDOW_WORDS;
+        int bits = shift % 32;
+        int i;
+        for (i = REPLAY_WINDOW_WORDS - 1; i >= 0; i--) {
+            uint32_t value = 0;
+            if (i - words >= 0) {
+                value = window[i - words] << bits;
+                if (bits && i - words > 0) {
+                    value |= window[i - words - 1] >> (32 - bits);
+                }
+            }
+            window[i] = value;
+        }
+        session->replay_window_top = message_index;
     }
 
-    if (raw_length != SESSION_EXPORT_RAW_LENGTH) {
-        session->last_error = OLM_BAD_SESSION_KEY;
-        return (size_t)-1;
+    offset = session->replay_window_top - message_index;
+    if (offset < REPLAY_WINDOW_BITS) {
+        window[offset / 32] |= (uint32_t)1 << (offset % 32);
     }
+}
 
-    _olm_decode_base64(session_key, session_key_length, key_buf);
-    result = _init_group_session_keys(session, key_buf, 1);
-    _olm_unset(key_buf, SESSION_EXPORT_RAW_LENGTH);
-    return result;
+/** Reject the message at message_index if replay detection is on and we have
+ * already decrypted one there */
+static int _is_replay(
+    const OlmInboundGroupSession *session, uint32_t message_index,
+    enum OlmErrorCode *last_error
+) {
+    if (session->replay_detection
+            && _replay_window_contains(session, message_index)) {
+        *last_error = OLM_DUPLICATE_MESSAGE_INDEX;
+        return 1;
+    }
+    return 0;
 }
 
-static size_t raw_pickle_length(
-    const OlmInboundGroupSession *session
+size_t olm_inbound_group_session_set_replay_detection(
+    OlmInboundGroupSession *session, int enabled
 ) {
-    size_t length = 0;
-    length += _olm_pickle_uint32_length(PICKLE_VERSION);
-    length += megolm_pickle_length(&session->initial_ratchet);
-    length += megolm_pickle_length(&session->latest_ratchet);
-    length += _olm_pickle_ed25519_public_key_length(&session->signing_key);
-    length += _olm_pickle_bool_length(session->signing_key_verified);
-    return length;
+    if ((enabled != 0) != session->replay_detection
+            || (!enabled && session->replay_window_used)) {
+        session->dirty = 1;
+    }
+    session->replay_detection = enabled != 0;
+    if (!enabled) {
+        _reset_replay_window(session);
+    }
+    return 0;
 }
 
-size_t olm_pickle_inbound_group_session_length(
-    const OlmInboundGroupSession *session
+int olm_inbound_group_session_index_seen(
+    const OlmInboundGroupSession *session, uint32_t message_index
 ) {
-    return _olm_enc_output_length(raw_pickle_length(session));
+    return _replay_window_contains(session, message_index);
+}
+
+size_t olm_clear_inbound_group_session(
+    OlmInboundGroupSession *session
+) {
+    size_t size = _session_size(session);
+    _reset_checkpoints(session);
+    _reset_scan(session);
+    _reset_message_key_cache(session);
+    _release_latest(session);
+    _olm_unset(session, size);
+    return size;
+}
+
+OlmInboundGroupSession * olm_allocate_inbound_group_session(
+    const OlmAllocator *allocator
+) {
+    void *memory = allocator->allocate(
+        allocator->context, sizeof(OlmInboundGroupSession)
+    );
+    if (!memory) {
+        return NULL;
+    }
+    return olm_inbound_group_session(memory);
+}
+
+void olm_release_inbound_group_session(
+    const OlmAllocator *allocator,
+    OlmInboundGroupSession *session
+) {
+    olm_clear_inbound_group_session(session);
+    allocator->release(
+        allocator->context, session, sizeof(OlmInboundGroupSession)
+    );
+}
+
+size_t olm_inbound_group_session_checkpoint_size(void) {
+    return sizeof(Megolm);
+}
+
+size_t olm_inbound_group_session_set_checkpoints(
+    OlmInboundGroupSession *session,
+    void *buffer, size_t buffer_length,
+    unsigned int spacing_log2
+) {
+    _reset_checkpoints(session);
+    session->checkpoints_offset = _buffer_offset(session, buffer);
+    session->checkpoint_capacity = buffer ? buffer_length / sizeof(Megolm) : 0;
+    session->checkpoint_spacing_log2 = spacing_log2 < 31 ? spacing_log2 : 31;
+    return session->checkpoint_capacity;
+}
+
+size_t olm_inbound_group_session_scan_size(void) {
+    return sizeof(struct GroupSessionScan);
+}
+
+size_t olm_inbound_group_session_begin_scan(
+    OlmInboundGroupSession *session, void *buffer, size_t buffer_length
+) {
+    if (buffer_length < sizeof(struct GroupSessionScan)) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+    olm_inbound_group_session_end_scan(session);
+    session->scan_offset = _buffer_offset(session, buffer);
+    /* the buffer may hold anything, so wipe it to mark it empty */
+    _reset_scan(session);
+    return 0;
+}
+
+size_t olm_inbound_group_session_end_scan(
+    OlmInboundGroupSession *session
+) {
+    _reset_scan(session);
+    session->scan_offset = 0;
+    return 0;
+}
+
+size_t olm_inbound_group_session_message_key_cache_entry_size(void) {
+    return sizeof(struct MessageKeyCacheEntry);
+}
+
+size_t olm_inbound_group_session_set_message_key_cache(
+    OlmInboundGroupSession *session,
+    void *buffer, size_t buffer_length
+) {
+    _reset_message_key_cache(session);
+    session->message_key_cache_offset = _buffer_offset(session, buffer);
+    session->message_key_cache_capacity =
+        buffer ? buffer_length / sizeof(struct MessageKeyCacheEntry) : 0;
+    /* the new buffer may hold anything, so wipe it to mark every entry
+     * empty */
+    _reset_message_key_cache(session);
+    return session->message_key_cache_capacity;
+}
+
+size_t olm_inbound_group_session_flush_message_key_cache(
+    OlmInboundGroupSession *session
+) {
+    _reset_message_key_cache(session);
+    return 0;
+}
+
+size_t olm_inbound_group_session_trim_memory(
+    OlmInboundGroupSession *session, int level
+) {
+    OlmMemoryStats before = {0}, after = {0};
+    olm_inbound_group_session_memory_stats(session, &before);
+    if (level >= OLM_TRIM_MEMORY_BUFFERS) {
+        olm_inbound_group_session_end_scan(session);
+        olm_inbound_group_session_set_message_key_cache(session, NULL, 0);
+        olm_inbound_group_session_set_checkpoints(
+            session, NULL, 0, session->checkpoint_spacing_log2
+        );
+    } else if (level >= OLM_TRIM_MEMORY_PRECOMPUTED) {
+        _reset_message_key_cache(session);
+        _reset_checkpoints(session);
+        _reset_scan(session);
+    } else if (level >= OLM_TRIM_MEMORY_CACHES) {
+        _reset_message_key_cache(session);
+    }
+    olm_inbound_group_session_memory_stats(session, &after);
+    return before.cache_live_bytes - after.cache_live_bytes;
+}
+
+void olm_inbound_group_session_memory_stats(
+    const OlmInboundGroupSession *session,
+    OlmMemoryStats *stats
+) {
+    size_t checkpoint_reserved =
+        session->checkpoint_capacity * sizeof(Megolm);
+    size_t checkpoint_live = session->checkpoint_count * sizeof(Megolm);
+    size_t cached = 0, i;
+    size_t cache_reserved, cache_live;
+    /* with a compact session's out of line ratchet, if it has one */
+    size_t size = _session_size(session)
+        + (session->latest_out_of_line ? sizeof(Megolm) : 0);
+    for (i = 0; i < session->message_key_cache_capacity; i++) {
+        if (_message_key_cache(session)[i].last_used) {
+            cached++;
+        }
+    }
+    cache_reserved = session->message_key_cache_capacity
+        * sizeof(struct MessageKeyCacheEntry);
+    cache_live = cached * sizeof(struct MessageKeyCacheEntry);
+    if (_scan(session)) {
+        cache_reserved += sizeof(struct GroupSessionScan);
+        if (_scan(session)->valid) {
+            cache_live += sizeof(struct GroupSessionScan);
+        }
+    }
+
+    stats->objects += 1;
+    stats->reserved_bytes += size + checkpoint_reserved + cache_reserved;
+    stats->live_bytes += size + checkpoint_live + cache_live;
+    stats->cache_reserved_bytes += checkpoint_reserved + cache_reserved;
+    stats->cache_live_bytes += checkpoint_live + cache_live;
+    stats->checkpoints += session->checkpoint_count;
+    stats->max_checkpoints += session->checkpoint_capacity;
+    stats->cached_message_keys += cached;
+    stats->max_cached_message_keys += session->message_key_cache_capacity;
+}
+
+/** look for a message in the cache, returning NULL if it isn't there */
+static struct MessageKeyCacheEntry * _find_message_keys(
+    OlmInboundGroupSession *session,
+    uint32_t message_index, const uint8_t *message_hash
+) {
+    size_t i;
+    for (i = 0; i < session->message_key_cache_capacity; i++) {
+        struct MessageKeyCacheEntry *entry = &_message_key_cache(session)[i];
+        if (entry->last_used && entry->message_index == message_index
+                && memcmp(entry->message_hash, message_hash,
+                          SHA256_OUTPUT_LENGTH) == 0) {
+            entry->last_used = ++session->message_key_cache_clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/** pick the entry to store a new message's keys in: an empty one if there is
+ * one, or else the least recently used */
+static struct MessageKeyCacheEntry * _new_message_keys_entry(
+    OlmInboundGroupSession *session
+) {
+    struct MessageKeyCacheEntry *result = &_message_key_cache(session)[0];
+    size_t i;
+    if (session->message_key_cache_clock == UINT32_MAX) {
+        /* we've run out of timestamps; start again rather than wrap */
+        _reset_message_key_cache(session);
+    }
+    for (i = 1; i < session->message_key_cache_capacity; i++) {
+        struct MessageKeyCacheEntry *entry = &_message_key_cache(session)[i];
+        if (entry->last_used < result->last_used) {
+            result = entry;
+        }
+    }
+    _olm_cipher_aes_sha_256_clear_context(&result->keys);
+    result->last_used = ++session->message_key_cache_clock;
+    return result;
+}
+
+#define SESSION_EXPORT_RAW_LENGTH \
+    (1 + 4 + MEGOLM_RATCHET_LENGTH + ED25519_PUBLIC_KEY_LENGTH)
+
+#define SESSION_KEY_RAW_LENGTH \
+    (1 + 4 + MEGOLM_RATCHET_LENGTH + ED25519_PUBLIC_KEY_LENGTH\
+        + ED25519_SIGNATURE_LENGTH)
+
+/** Set the session up from a decoded session key or export, leaving the
+ * signature of a session key to be checked by the caller. Returns a pointer
+ * to the signature if there is one. */
+static const uint8_t * _load_group_session_keys(
+    OlmInboundGroupSession *session,
+    const uint8_t *key_buf,
+    int export_format
+) {
+    const uint8_t expected_version =
+        (export_format ? SESSION_EXPORT_VERSION : SESSION_KEY_VERSION);
+    const uint8_t *ptr = key_buf;
+    size_t version = *ptr++;
+
+    if (version != expected_version) {
+        session->last_error = OLM_BAD_SESSION_KEY;
+        return NULL;
+    }
+
+    uint32_t counter = 0;
+    // Decode counter as a big endian 32-bit number.
+    for (unsigned i = 0; i < 4; i++) {
+        counter <<= 8; counter |= *ptr++;
+    }
+
+    megolm_init(&session->initial_ratchet, ptr, counter);
+    if (session->allocator) {
+        _release_latest(session);
+    } else {
+        megolm_init(&session->latest_ratchet, ptr, counter);
+    }
+
+    ptr += MEGOLM_RATCHET_LENGTH;
+    memcpy(
+        session->signing_key.public_key, ptr, ED25519_PUBLIC_KEY_LENGTH
+    );
+    ptr += ED25519_PUBLIC_KEY_LENGTH;
+    _reset_checkpoints(session);
+    _reset_scan(session);
+    _reset_message_key_cache(session);
+    _reset_replay_window(session);
+    _prepare_signing_key(session);
+    session->dirty = 1;
+    return ptr;
+}
+
+static size_t _init_group_session_keys(
+    OlmInboundGroupSession *session,
+    const uint8_t *key_buf,
+    int export_format
+) {
+    const uint8_t *signature;
+    size_t result = 0;
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_INIT_INBOUND_GROUP_SESSION);
+
+    signature = _load_group_session_keys(session, key_buf, export_format);
+    if (!signature) {
+        result = (size_t)-1;
+    } else if (!export_format) {
+        if (!_verify_signature(
+            session,
+            key_buf, signature - key_buf, signature
+        )) {
+            session->last_error = OLM_BAD_SIGNATURE;
+            result = (size_t)-1;
+        } else {
+            /* signed keyshare */
+            _mark_verified(session);
+        }
+    }
+    OLM_TRACE_END(trace, OLM_TRACE_INIT_INBOUND_GROUP_SESSION);
+    OLM_RECORD(
+        OLM_TRACE_INIT_INBOUND_GROUP_SESSION, session, 0, 0,
+        result == (size_t)-1 ? 0 : session->initial_ratchet.counter, 0,
+        result
+    );
+    return result;
+}
+
+/** Decode a base64 session key or export of raw_length bytes into key_buf */
+static size_t _decode_group_session_keys(
+    OlmInboundGroupSession *session,
+    const uint8_t * session_key, size_t session_key_length,
+    uint8_t *key_buf, size_t raw_length
+) {
+    size_t decoded_length = _olm_decode_base64_length(session_key_length);
+
+    if (decoded_length == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        return (size_t)-1;
+    }
+
+    if (decoded_length != raw_length) {
+        session->last_error = OLM_BAD_SESSION_KEY;
+        return (size_t)-1;
+    }
+
+    if (_olm_decode_base64(session_key, session_key_length, key_buf)
+            == (size_t)-1) {
+        _olm_unset(key_buf, raw_length);
+        session->last_error = OLM_INVALID_BASE64;
+        return (size_t)-1;
+    }
+    return 0;
+}
+
+size_t olm_init_inbound_group_session(
+    OlmInboundGroupSession *session,
+    const uint8_t * session_key, size_t session_key_length
+) {
+    uint8_t key_buf[SESSION_KEY_RAW_LENGTH];
+    size_t result;
+
+    if (_decode_group_session_keys(
+            session, session_key, session_key_length,
+            key_buf, SESSION_KEY_RAW_LENGTH
+        ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    result = _init_group_session_keys(session, key_buf, 0);
+    _olm_unset(key_buf, SESSION_KEY_RAW_LENGTH);
+    return result;
+}
+
+size_t olm_import_inbound_group_session(
+    OlmInboundGroupSession *session,
+    const uint8_t * session_key, size_t session_key_length
+) {
+    uint8_t key_buf[SESSION_EXPORT_RAW_LENGTH];
+    size_t result;
+
+    if (_decode_group_session_keys(
+            session, session_key, session_key_length,
+            key_buf, SESSION_EXPORT_RAW_LENGTH
+        ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    result = _init_group_session_keys(session, key_buf, 1);
+    _olm_unset(key_buf, SESSION_EXPORT_RAW_LENGTH);
+    return result;
+}
+
+/** How many sessions each job of a batch init or import sets up: the
+ * signatures of each job's session keys are checked together */
+#define INIT_BATCH_LENGTH 64
+
+struct InitBatch {
+    OlmInboundGroupSession * const * sessions;
+    size_t count;
+    const uint8_t * const * session_keys;
+    const size_t * session_key_lengths;
+    const char ** errors;
+    int export_format;
+};
+
+static void _init_batch_job(void * context, size_t job) {
+    const struct InitBatch *batch = context;
+    size_t raw_length = batch->export_format
+        ? SESSION_EXPORT_RAW_LENGTH : SESSION_KEY_RAW_LENGTH;
+    size_t start = job * INIT_BATCH_LENGTH;
+    size_t count = batch->count - start;
+    uint8_t key_bufs[INIT_BATCH_LENGTH][SESSION_KEY_RAW_LENGTH];
+    struct _olm_ed25519_public_key keys[INIT_BATCH_LENGTH];
+    const uint8_t *messages[INIT_BATCH_LENGTH];
+    size_t message_lengths[INIT_BATCH_LENGTH];
+    const uint8_t *signatures[INIT_BATCH_LENGTH];
+    uint8_t valid[INIT_BATCH_LENGTH];
+    size_t i;
+
+    if (count > INIT_BATCH_LENGTH) {
+        count = INIT_BATCH_LENGTH;
+    }
+
+    for (i = 0; i < count; ++i) {
+        OlmInboundGroupSession *session = batch->sessions[start + i];
+        signatures[i] = NULL;
+        messages[i] = key_bufs[i];
+        message_lengths[i] = 0;
+        memset(&keys[i], 0, sizeof(keys[i]));
+        if (_decode_group_session_keys(
+                session, batch->session_keys[start + i],
+                batch->session_key_lengths[start + i],
+                key_bufs[i], raw_length
+            ) == (size_t)-1) {
+            continue;
+        }
+        signatures[i] = _load_group_session_keys(
+            session, key_bufs[i], batch->export_format
+        );
+        if (signatures[i]) {
+            keys[i] = session->signing_key;
+            message_lengths[i] = signatures[i] - key_bufs[i];
+        }
+    }
+
+    if (batch->export_format) {
+        /* exports aren't signed, so they're done once they've loaded */
+        for (i = 0; i < count; ++i) {
+            valid[i] = signatures[i] != NULL;
+        }
+    } else {
+        _olm_crypto_ed25519_verify_batch(
+            count, keys, messages, message_lengths, signatures, valid
+        );
+    }
+
+    for (i = 0; i < count; ++i) {
+        OlmInboundGroupSession *session = batch->sessions[start + i];
+        if (valid[i]) {
+            if (!batch->export_format) {
+                /* signed keyshare */
+                _mark_verified(session);
+            }
+            session->last_error = OLM_SUCCESS;
+        } else if (signatures[i]) {
+            /* it loaded, so it was the signature that was wrong */
+            session->last_error = OLM_BAD_SIGNATURE;
+        }
+        if (batch->errors) {
+            batch->errors[start + i] = _olm_error_to_string(
+                valid[i] ? OLM_SUCCESS : session->last_error
+            );
+        }
+        OLM_RECORD(
+            OLM_TRACE_INIT_INBOUND_GROUP_SESSION, session, 0, 0,
+            valid[i] ? session->initial_ratchet.counter : 0, 0,
+            valid[i] ? 0 : (size_t)-1
+        );
+    }
+    _olm_unset(key_bufs, sizeof(key_bufs));
+}
+
+static size_t _init_batch(
+    struct InitBatch *batch,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    size_t job_count =
+        (batch->count + INIT_BATCH_LENGTH - 1) / INIT_BATCH_LENGTH;
+    size_t failures = 0;
+    size_t i;
+
+    if (executor) {
+        executor(executor_context, _init_batch_job, batch, job_count);
+    } else {
+        for (i = 0; i < job_count; ++i) {
+            _init_batch_job(batch, i);
+        }
+    }
+    for (i = 0; i < batch->count; ++i) {
+        if (batch->sessions[i]->last_error != OLM_SUCCESS) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+size_t olm_init_inbound_group_session_batch(
+    OlmInboundGroupSession * const * sessions, size_t count,
+    const uint8_t * const * session_keys, const size_t * session_key_lengths,
+    const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    struct InitBatch batch = {
+        sessions, count, session_keys, session_key_lengths, errors, 0
+    };
+    return _init_batch(&batch, executor, executor_context);
+}
+
+size_t olm_import_inbound_group_session_batch(
+    OlmInboundGroupSession * const * sessions, size_t count,
+    const uint8_t * const * session_keys, const size_t * session_key_lengths,
+    const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    struct InitBatch batch = {
+        sessions, count, session_keys, session_key_lengths, errors, 1
+    };
+    return _init_batch(&batch, executor, executor_context);
+}
+
+static size_t raw_pickle_length(
+    const OlmInboundGroupSession *session
+) {
+    size_t length = 0;
+    length += _olm_pickle_uint32_length(PICKLE_VERSION);
+    length += megolm_pickle_length(&session->initial_ratchet);
+    length += megolm_pickle_length(_latest(session));
+    length += _olm_pickle_ed25519_public_key_length(&session->signing_key);
+    length += _olm_pickle_bool_length(session->signing_key_verified);
+    if (session->replay_detection) {
+        length += _olm_pickle_bool_length(session->replay_window_used);
+        length += _olm_pickle_uint32_length(session->replay_window_top);
+        length += REPLAY_WINDOW_WORDS * _olm_pickle_uint32_length(0);
+    }
+    return length;
+}
+
+size_t olm_pickle_inbound_group_session_length(
+    const OlmInboundGroupSession *session
+) {
+    return _olm_enc_output_length(raw_pickle_length(session));
+}
+
+static uint8_t * write_pickle(
+    const OlmInboundGroupSession *session, uint8_t *pos
+) {
+    int i;
+    /* without replay detection, write the version 2 pickle that older
+     * versions of the library can read */
+    pos = _olm_pickle_uint32(
+        pos, session->replay_detection ? PICKLE_VERSION : 2
+    );
+    pos = megolm_pickle(&session->initial_ratchet, pos);
+    pos = megolm_pickle(_latest(session), pos);
+    pos = _olm_pickle_ed25519_public_key(pos, &session->signing_key);
+    pos = _olm_pickle_bool(pos, session->signing_key_verified);
+    if (session->replay_detection) {
+        pos = _olm_pickle_bool(pos, session->replay_window_used);
+        pos = _olm_pickle_uint32(pos, session->replay_window_top);
+        for (i = 0; i < REPLAY_WINDOW_WORDS; i++) {
+            pos = _olm_pickle_uint32(pos, session->replay_window[i]);
+        }
+    }
+    return pos;
+}
+
+/**
+ * Load the session from the raw_length bytes of decrypted pickle at pos.
+ * Returns raw_length, or olm_error() if the pickle couldn't be read.
+ */
+static size_t read_pickle(
+    OlmInboundGroupSession *session, const uint8_t *pos, size_t raw_length
+) {
+    const uint8_t *end = pos + raw_length;
+    uint32_t pickle_version;
+    Megolm latest;
+    size_t set_latest;
+    int i;
+
+    pos = _olm_unpickle_uint32(pos, end, &pickle_version);
+    if (pickle_version < 1 || pickle_version > PICKLE_VERSION) {
+        session->last_error = OLM_UNKNOWN_PICKLE_VERSION;
+        return (size_t)-1;
+    }
+    pos = megolm_unpickle(&session->initial_ratchet, pos, end);
+    pos = megolm_unpickle(&latest, pos, end);
+    pos = _olm_unpickle_ed25519_public_key(pos, end, &session->signing_key);
+
+    if (pickle_version == 1) {
+        /* pickle v1 had no signing_key_verified field (all keyshares were
+         * verified at import time) */
+        session->signing_key_verified = 1;
+    } else {
+        pos = _olm_unpickle_bool(pos, end, &(session->signing_key_verified));
+    }
+
+    _reset_replay_window(session);
+    session->replay_detection = pickle_version >= 3;
+    if (session->replay_detection) {
+        pos = _olm_unpickle_bool(pos, end, &session->replay_window_used);
+        pos = _olm_unpickle_uint32(pos, end, &session->replay_window_top);
+        for (i = 0; i < REPLAY_WINDOW_WORDS; i++) {
+            pos = _olm_unpickle_uint32(pos, end, &session->replay_window[i]);
+        }
+    }
+
+    if (end != pos) {
+        /* We had the wrong number of bytes in the input. */
+        session->last_error = OLM_CORRUPTED_PICKLE;
+        _olm_unset(&latest, sizeof(latest));
+        return (size_t)-1;
+    }
+
+    set_latest = _set_latest(session, &latest);
+    _olm_unset(&latest, sizeof(latest));
+    if (set_latest == (size_t)-1) {
+        return set_latest;
+    }
+    _prepare_signing_key(session);
+    _reset_checkpoints(session);
+    _reset_scan(session);
+    _reset_message_key_cache(session);
+    session->dirty = 0;
+
+    return raw_length;
+}
+
+/* the header of a pickle written by
+ * olm_pickle_inbound_group_session_with_header: a format byte, a kind byte,
+ * the pickle version, the first known index and the session ID */
+#define PICKLE_HEADER_FORMAT     OLM_PICKLE_HEADER_FORMAT
+#define PICKLE_HEADER_KIND       OLM_PICKLE_HEADER_KIND_INBOUND_GROUP_SESSION
+#define PICKLE_HEADER_LENGTH     OLM_PICKLE_HEADER_INBOUND_GROUP_SESSION_LENGTH
+
+static uint8_t * write_pickle_header(
+    const OlmInboundGroupSession *session, uint8_t *pos
+) {
+    *pos++ = PICKLE_HEADER_FORMAT;
+    *pos++ = PICKLE_HEADER_KIND;
+    pos = _olm_pickle_uint32(
+        pos, session->replay_detection ? PICKLE_VERSION : 2
+    );
+    pos = _olm_pickle_uint32(pos, session->initial_ratchet.counter);
+    memcpy(pos, session->signing_key.public_key, GROUP_SESSION_ID_LENGTH);
+    return pos + GROUP_SESSION_ID_LENGTH;
+}
+
+/** Read a pickle header. Returns 0 if it isn't one for a group session. */
+static int read_pickle_header(
+    const uint8_t *pos, uint32_t *pickle_version,
+    uint32_t *first_known_index, const uint8_t **session_id
+) {
+    const uint8_t *end = pos + PICKLE_HEADER_LENGTH;
+    if (pos[0] != PICKLE_HEADER_FORMAT || pos[1] != PICKLE_HEADER_KIND) {
+        return 0;
+    }
+    pos = _olm_unpickle_uint32(pos + 2, end, pickle_version);
+    pos = _olm_unpickle_uint32(pos, end, first_known_index);
+    *session_id = pos;
+    return 1;
+}
+
+/** Load a pickle with a header, checking that the header matches it */
+static size_t unpickle_with_header(
+    OlmInboundGroupSession *session,
+    const struct _olm_enc_context *context,
+    uint8_t *pickled, size_t pickled_length
+) {
+    uint32_t pickle_version, first_known_index;
+    const uint8_t *session_id;
+    size_t raw_length = _olm_enc_input_with_header(
+        context, pickled, pickled_length, PICKLE_HEADER_LENGTH,
+        &session->last_error
+    );
+    if (raw_length == (size_t)-1) {
+        return (size_t)-1;
+    }
+    if (!read_pickle_header(
+            pickled, &pickle_version, &first_known_index, &session_id
+    )) {
+        session->last_error = OLM_CORRUPTED_PICKLE;
+        return (size_t)-1;
+    }
+    if (read_pickle(
+            session, pickled + PICKLE_HEADER_LENGTH, raw_length
+    ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    if (first_known_index != session->initial_ratchet.counter
+            || memcmp(
+                session_id, session->signing_key.public_key,
+                GROUP_SESSION_ID_LENGTH
+            )) {
+        session->last_error = OLM_CORRUPTED_PICKLE;
+        return (size_t)-1;
+    }
+    return pickled_length;
+}
+
+size_t olm_pickle_inbound_group_session(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length = raw_pickle_length(session);
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_PICKLE);
+    OLM_PROBE2(pickle_entry, OLM_PROBE_INBOUND_GROUP, pickled_length);
+
+    if (pickled_length < _olm_enc_output_length(raw_length)) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+        OLM_PROBE2(pickle_return, OLM_PROBE_INBOUND_GROUP, (size_t)-1);
+        OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+        return (size_t)-1;
+    }
+
+    write_pickle(session, _olm_enc_output_pos(pickled, raw_length));
+
+    result = _olm_enc_output(key, key_length, pickled, raw_length);
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+    OLM_PROBE2(pickle_return, OLM_PROBE_INBOUND_GROUP, result);
+    OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+    return result;
+}
+
+size_t olm_unpickle_inbound_group_session(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length, result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_UNPICKLE);
+    OLM_PROBE2(unpickle_entry, OLM_PROBE_INBOUND_GROUP, pickled_length);
+
+    if (_olm_enc_has_header(pickled, pickled_length)) {
+        struct _olm_enc_context context;
+        _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+        result = unpickle_with_header(
+            session, &context, pickled, pickled_length
+        );
+        _olm_enc_context_clear(&context);
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+        OLM_PROBE2(unpickle_return, OLM_PROBE_INBOUND_GROUP, result);
+        OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+        return result;
+    }
+
+    raw_length = _olm_enc_input(
+        key, key_length, pickled, pickled_length, &(session->last_error)
+    );
+    if (raw_length == (size_t)-1
+            || read_pickle(session, pickled, raw_length) == (size_t)-1) {
+        result = (size_t)-1;
+    } else {
+        result = pickled_length;
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+    OLM_PROBE2(unpickle_return, OLM_PROBE_INBOUND_GROUP, result);
+    OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+    return result;
+}
+
+size_t olm_unpickle_inbound_group_session_const(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
+) {
+    size_t raw_length, result;
+
+    if (scratch_length < pickled_length) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+    if (_olm_enc_has_header(pickled, pickled_length)) {
+        /* the header is decoded along with the rest of the pickle, so this
+         * rarer kind is loaded from a copy */
+        memcpy(scratch, pickled, pickled_length);
+        result = olm_unpickle_inbound_group_session(
+            session, key, key_length, scratch, pickled_length
+        );
+        _olm_unset(scratch, pickled_length);
+        return result;
+    }
+
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_UNPICKLE);
+    OLM_PROBE2(unpickle_entry, OLM_PROBE_INBOUND_GROUP, pickled_length);
+    raw_length = _olm_enc_input_const(
+        key, key_length, pickled, pickled_length,
+        scratch, scratch_length, &(session->last_error)
+    );
+    if (raw_length == (size_t)-1) {
+        result = (size_t)-1;
+    } else {
+        result = read_pickle(session, scratch, raw_length) == (size_t)-1
+            ? (size_t)-1 : pickled_length;
+        _olm_unset(scratch, pickled_length);
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+    OLM_PROBE2(unpickle_return, OLM_PROBE_INBOUND_GROUP, result);
+    OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+    return result;
+}
+
+size_t olm_pickle_inbound_group_session_with_key_length(
+    const OlmInboundGroupSession *session, uint32_t cipher
+) {
+    return _olm_enc_output_with_cipher_length(
+        cipher, raw_pickle_length(session)
+    );
+}
+
+size_t olm_pickle_inbound_group_session_with_key(
+    OlmInboundGroupSession *session,
+    const OlmPickleKey * pickle_key, uint32_t cipher,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length = raw_pickle_length(session);
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_PICKLE);
+
+    if (pickled_length
+            < _olm_enc_output_with_cipher_length(cipher, raw_length)) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+        OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+        return (size_t)-1;
+    }
+
+    write_pickle(
+        session, _olm_enc_output_with_cipher_pos(cipher, pickled, raw_length)
+    );
+
+    result = _olm_enc_output_with_cipher(
+        &pickle_key->context, cipher, pickled, raw_length,
+        &(session->last_error)
+    );
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+    OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+    return result;
+}
+
+size_t olm_unpickle_inbound_group_session_with_key(
+    OlmInboundGroupSession *session,
+    const OlmPickleKey * pickle_key,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length, result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_UNPICKLE);
+
+    if (_olm_enc_has_header(pickled, pickled_length)) {
+        result = unpickle_with_header(
+            session, &pickle_key->context, pickled, pickled_length
+        );
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+        OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+        return result;
+    }
+
+    raw_length = _olm_enc_input_with_context(
+        &pickle_key->context, pickled, pickled_length, &(session->last_error)
+    );
+    if (raw_length == (size_t)-1
+            || read_pickle(session, pickled, raw_length) == (size_t)-1) {
+        result = (size_t)-1;
+    } else {
+        result = pickled_length;
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+    OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+    return result;
+}
+
+size_t olm_pickle_inbound_group_session_with_header_length(
+    const OlmInboundGroupSession *session
+) {
+    return _olm_enc_output_with_header_length(
+        PICKLE_HEADER_LENGTH, raw_pickle_length(session)
+    );
+}
+
+size_t olm_pickle_inbound_group_session_with_header(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length = raw_pickle_length(session);
+    struct _olm_enc_context context;
+    uint8_t *pos;
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_PICKLE);
+
+    if (pickled_length < _olm_enc_output_with_header_length(
+            PICKLE_HEADER_LENGTH, raw_length
+    )) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+        OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+        return (size_t)-1;
+    }
+
+    pos = _olm_enc_output_with_header_pos(
+        pickled, PICKLE_HEADER_LENGTH, raw_length
+    );
+    pos = write_pickle_header(session, pos);
+    write_pickle(session, pos);
+
+    _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+    result = _olm_enc_output_with_header(
+        &context, pickled, PICKLE_HEADER_LENGTH, raw_length
+    );
+    _olm_enc_context_clear(&context);
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+    OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+    return result;
+}
+
+size_t olm_pickle_peek_header(
+    void const * pickled, size_t pickled_length,
+    uint32_t * pickle_version, uint32_t * first_known_index,
+    void * session_id, size_t session_id_length
+) {
+    uint8_t header[PICKLE_HEADER_LENGTH];
+    const uint8_t *raw_session_id;
+    if (session_id_length < _olm_encode_base64_length(GROUP_SESSION_ID_LENGTH)
+            || _olm_enc_peek_header(
+                pickled, pickled_length, header, sizeof(header)
+            ) == (size_t)-1
+            || !read_pickle_header(
+                header, pickle_version, first_known_index, &raw_session_id
+            )) {
+        return (size_t)-1;
+    }
+    return _olm_encode_base64(
+        raw_session_id, GROUP_SESSION_ID_LENGTH, session_id
+    );
+}
+
+size_t olm_pickle_inbound_group_session_binary_length(
+    const OlmInboundGroupSession *session
+) {
+    return _olm_enc_output_binary_length(raw_pickle_length(session));
+}
+
+size_t olm_pickle_inbound_group_session_binary(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length = raw_pickle_length(session);
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_PICKLE);
+
+    if (pickled_length < _olm_enc_output_binary_length(raw_length)) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+        OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+        return (size_t)-1;
+    }
+
+    write_pickle(session, pickled);
+
+    result = _olm_enc_output_binary(key, key_length, pickled, raw_length);
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+    OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+    return result;
+}
+
+size_t olm_unpickle_inbound_group_session_binary(
+    OlmInboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length, result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_UNPICKLE);
+
+    raw_length = _olm_enc_input_binary(
+        key, key_length, pickled, pickled_length, &(session->last_error)
+    );
+    if (raw_length == (size_t)-1
+            || read_pickle(session, pickled, raw_length) == (size_t)-1) {
+        result = (size_t)-1;
+    } else {
+        result = pickled_length;
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+    OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+    return result;
+}
+
+size_t olm_pickle_inbound_group_session_batch_length(
+    OlmInboundGroupSession * const * sessions, size_t count
+) {
+    size_t length = 0;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        length += _olm_enc_output_binary_length(raw_pickle_length(sessions[i]));
+    }
+    return _olm_batch_length(count, length);
+}
+
+size_t olm_pickle_inbound_group_session_batch(
+    const OlmPickleKey * pickle_key,
+    OlmInboundGroupSession * const * sessions, size_t count,
+    void * pickled, size_t pickled_length
+) {
+    uint8_t *pos = pickled;
+    size_t i;
+
+    if (pickled_length
+            < olm_pickle_inbound_group_session_batch_length(sessions, count)) {
+        if (count) {
+            sessions[0]->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        }
+        return (size_t)-1;
+    }
+
+    pos = _olm_batch_write_header(pos, count);
+    for (i = 0; i < count; ++i) {
+        size_t raw_length = raw_pickle_length(sessions[i]);
+        pos = _olm_batch_write_entry(
+            pos, _olm_enc_output_binary_length(raw_length)
+        );
+        write_pickle(sessions[i], pos);
+        pos += _olm_enc_output_binary_with_context(
+            &pickle_key->context, pos, raw_length
+        );
+    }
+    return pos - (uint8_t *)pickled;
+}
+
+size_t olm_unpickle_inbound_group_session_batch(
+    const OlmPickleKey * pickle_key,
+    void * pickled, size_t pickled_length,
+    size_t first,
+    OlmInboundGroupSession * const * sessions, size_t count
+) {
+    struct _olm_batch_reader reader;
+    enum OlmErrorCode error = OLM_CORRUPTED_PICKLE;
+    size_t total, length, i;
+    uint8_t *pickle;
+
+    if (count == 0) {
+        return 0;
+    }
+    total = _olm_batch_reader_init(&reader, pickled, pickled_length, &error);
+    if (total == (size_t)-1 || first > total || count > total - first) {
+        sessions[0]->last_error = error;
+        return (size_t)-1;
+    }
+    for (i = 0; i < first; ++i) {
+        if (!_olm_batch_reader_next(&reader, &length)) {
+            sessions[0]->last_error = OLM_CORRUPTED_PICKLE;
+            return (size_t)-1;
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        OlmInboundGroupSession *session = sessions[i];
+        size_t raw_length;
+        pickle = _olm_batch_reader_next(&reader, &length);
+        if (!pickle) {
+            session->last_error = OLM_CORRUPTED_PICKLE;
+            return (size_t)-1;
+        }
+        raw_length = _olm_enc_input_binary_with_context(
+            &pickle_key->context, pickle, length, &(session->last_error)
+        );
+        if (raw_length == (size_t)-1
+                || read_pickle(session, pickle, raw_length) == (size_t)-1) {
+            return (size_t)-1;
+        }
+    }
+    return count;
+}
+
+/* A store is a version and a count, then an index entry for each session
+ * sorted by signing key, then the sessions' binary pickles. Each index entry
+ * is the signing key, the offset of the pickle from the start of the store
+ * as 64 bits, and the length of the pickle. */
+#define STORE_VERSION 1
+#define STORE_HEADER_LENGTH 8
+#define STORE_ENTRY_LENGTH (ED25519_PUBLIC_KEY_LENGTH + 8 + 4)
+/* longer than any pickle written by this version */
+#define STORE_MAX_PICKLE_LENGTH 512
+
+static uint8_t *store_entry(uint8_t *store, size_t i) {
+    return store + STORE_HEADER_LENGTH + i * STORE_ENTRY_LENGTH;
+}
+
+static void store_swap(uint8_t *store, size_t i, size_t j) {
+    uint8_t tmp[STORE_ENTRY_LENGTH];
+    memcpy(tmp, store_entry(store, i), STORE_ENTRY_LENGTH);
+    memcpy(store_entry(store, i), store_entry(store, j), STORE_ENTRY_LENGTH);
+    memcpy(store_entry(store, j), tmp, STORE_ENTRY_LENGTH);
+}
+
+static int store_less(uint8_t *store, size_t i, size_t j) {
+    return memcmp(
+        store_entry(store, i), store_entry(store, j),
+        ED25519_PUBLIC_KEY_LENGTH
+    ) < 0;
+}
+
+/* heapsort the index by signing key, so that writing a store needs no
+ * memory beyond the store itself */
+static void store_sort(uint8_t *store, size_t count) {
+    size_t start = count / 2, end = count;
+    while (end > 1) {
+        size_t root, child;
+        if (start > 0) {
+            root = --start;
+        } else {
+            store_swap(store, 0, --end);
+            root = 0;
+        }
+        while ((child = 2 * root + 1) < end) {
+            if (child + 1 < end && store_less(store, child, child + 1)) {
+                child++;
+            }
+            if (!store_less(store, root, child)) {
+                break;
+            }
+            store_swap(store, root, child);
+            root = child;
+        }
+    }
+}
+
+/* get the count of sessions in a store, or olm_error() if the store is too
+ * short for its index */
+static size_t store_count(
+    const uint8_t *store, size_t store_length, enum OlmErrorCode *last_error
+) {
+    uint32_t version, count;
+    const uint8_t *end = store + store_length;
+
+    if (store_length < STORE_HEADER_LENGTH) {
+        *last_error = OLM_CORRUPTED_PICKLE;
+        return (size_t)-1;
+    }
+    store = _olm_unpickle_uint32(store, end, &version);
+    if (version != STORE_VERSION) {
+        *last_error = OLM_UNKNOWN_PICKLE_VERSION;
+        return (size_t)-1;
+    }
+    _olm_unpickle_uint32(store, end, &count);
+    if (count > (store_length - STORE_HEADER_LENGTH) / STORE_ENTRY_LENGTH) {
+        *last_error = OLM_CORRUPTED_PICKLE;
+        return (size_t)-1;
+    }
+    return count;
+}
+
+size_t olm_inbound_group_session_store_length(
+    OlmInboundGroupSession * const * sessions, size_t count
+) {
+    size_t length = STORE_HEADER_LENGTH + count * STORE_ENTRY_LENGTH;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        length += _olm_enc_output_binary_length(raw_pickle_length(sessions[i]));
+    }
+    return length;
+}
+
+size_t olm_write_inbound_group_session_store(
+    const OlmPickleKey *pickle_key,
+    OlmInboundGroupSession * const * sessions, size_t count,
+    void *store, size_t store_length
+) {
+    uint8_t *pos = store;
+    uint8_t *data = store_entry(store, count);
+    size_t i;
+
+    if (store_length
+            < olm_inbound_group_session_store_length(sessions, count)) {
+        if (count) {
+            sessions[0]->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        }
+        return (size_t)-1;
+    }
+
+    pos = _olm_pickle_uint32(pos, STORE_VERSION);
+    pos = _olm_pickle_uint32(pos, count);
+    for (i = 0; i < count; ++i) {
+        size_t raw_length = raw_pickle_length(sessions[i]);
+        uint64_t offset = data - (uint8_t *)store;
+        size_t length;
+
+        write_pickle(sessions[i], data);
+        length = _olm_enc_output_binary_with_context(
+            &pickle_key->context, data, raw_length
+        );
+        data += length;
+
+        pos = _olm_pickle_bytes(
+            pos, sessions[i]->signing_key.public_key, ED25519_PUBLIC_KEY_LENGTH
+        );
+        pos = _olm_pickle_uint32(pos, (uint32_t)(offset >> 32));
+        pos = _olm_pickle_uint32(pos, (uint32_t)offset);
+        pos = _olm_pickle_uint32(pos, length);
+    }
+    store_sort(store, count);
+    return data - (uint8_t *)store;
+}
+
+size_t olm_inbound_group_session_store_count(
+    const void *store, size_t store_length
+) {
+    enum OlmErrorCode error;
+    return store_count(store, store_length, &error);
+}
+
+size_t olm_load_inbound_group_session_from_store(
+    const OlmPickleKey *pickle_key,
+    const void *store, size_t store_length,
+    const uint8_t *session_id, size_t session_id_length,
+    OlmInboundGroupSession *session
+) {
+    const uint8_t *end = (const uint8_t *)store + store_length;
+    uint8_t key[ED25519_PUBLIC_KEY_LENGTH];
+    uint8_t pickle[STORE_MAX_PICKLE_LENGTH];
+    size_t count, low, high, raw_length;
+    const uint8_t *entry = NULL;
+    uint32_t offset_high, offset_low, length;
+    uint64_t offset;
+
+    count = store_count(store, store_length, &session->last_error);
+    if (count == (size_t)-1) {
+        return (size_t)-1;
+    }
+    if (_olm_decode_base64_length(session_id_length) != sizeof(key)
+            || _olm_decode_base64(session_id, session_id_length, key)
+                == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        return (size_t)-1;
+    }
+
+    /* only the index entries looked at are read, so only the pages they are
+     * on, and the pickle's, need to be in memory */
+    low = 0;
+    high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const uint8_t *candidate = store_entry((uint8_t *)store, mid);
+        int cmp = memcmp(candidate, key, sizeof(key));
+        if (cmp == 0) {
+            entry = candidate;
+            break;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (!entry) {
+        session->last_error = OLM_UNKNOWN_SESSION_ID;
+        return (size_t)-1;
+    }
+
+    entry += ED25519_PUBLIC_KEY_LENGTH;
+    entry = _olm_unpickle_uint32(entry, end, &offset_high);
+    entry = _olm_unpickle_uint32(entry, end, &offset_low);
+    _olm_unpickle_uint32(entry, end, &length);
+    offset = ((uint64_t)offset_high << 32) | offset_low;
+    if (offset > store_length || length > store_length - offset
+            || length > sizeof(pickle)) {
+        session->last_error = OLM_CORRUPTED_PICKLE;
+        return (size_t)-1;
+    }
+
+    /* the store may be mapped read-only, so decrypt a copy */
+    memcpy(pickle, (const uint8_t *)store + offset, length);
+    raw_length = _olm_enc_input_binary_with_context(
+        &pickle_key->context, pickle, length, &(session->last_error)
+    );
+    if (raw_length != (size_t)-1) {
+        raw_length = read_pickle(session, pickle, raw_length);
+    }
+    _olm_unset(pickle, sizeof(pickle));
+    return raw_length == (size_t)-1 ? (size_t)-1 : 0;
+}
+
+/**
+ * get the max plaintext length in an un-base64-ed message
+ */
+static size_t _decrypt_max_plaintext_length(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length
+) {
+    struct _OlmDecodeGroupMessageResults decoded_results;
+
+    _olm_decode_group_message(
+        message, message_length,
+        _olm_cipher_aes_sha_256_mac_length(),
+        ED25519_SIGNATURE_LENGTH,
+        &decoded_results);
+
+    if (decoded_results.version != OLM_PROTOCOL_VERSION) {
+        session->last_error = OLM_BAD_MESSAGE_VERSION;
+        return (size_t)-1;
+    }
+
+    if (!decoded_results.ciphertext) {
+        session->last_error = OLM_BAD_MESSAGE_FORMAT;
+        return (size_t)-1;
+    }
+
+    return _olm_cipher_aes_sha_256_max_plaintext_length(
+        decoded_results.ciphertext_length
+    );
+}
+
+size_t olm_group_decrypt_max_plaintext_length(
+    OlmInboundGroupSession *session,
+    uint8_t * message, size_t message_length
+) {
+    size_t raw_length;
+
+    raw_length = _olm_decode_base64(message, message_length, message);
+    if (raw_length == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        return (size_t)-1;
+    }
+
+    return _decrypt_max_plaintext_length(
+        session, message, raw_length
+    );
+}
+
+size_t olm_group_peek_max_plaintext_length(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length
+) {
+    struct _OlmPeekMessageResults results;
+
+    if (_olm_decode_base64_length(message_length) == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        return (size_t)-1;
+    }
+
+    _olm_peek_group_message(
+        message, message_length,
+        _olm_cipher_aes_sha_256_mac_length(),
+        ED25519_SIGNATURE_LENGTH,
+        &results);
+
+    if (results.version != OLM_PROTOCOL_VERSION) {
+        session->last_error = OLM_BAD_MESSAGE_VERSION;
+        return (size_t)-1;
+    }
+
+    if (!results.has_ciphertext) {
+        session->last_error = OLM_BAD_MESSAGE_FORMAT;
+        return (size_t)-1;
+    }
+
+    return _olm_cipher_aes_sha_256_max_plaintext_length(
+        results.ciphertext_length
+    );
+}
+
+size_t olm_group_message_peek(
+    const uint8_t * message, size_t message_length,
+    uint32_t * message_index, uint8_t * version
+) {
+    struct _OlmPeekMessageResults results;
+
+    if (_olm_decode_base64_length(message_length) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    _olm_peek_group_message(
+        message, message_length,
+        _olm_cipher_aes_sha_256_mac_length(),
+        ED25519_SIGNATURE_LENGTH,
+        &results);
+
+    if (version) {
+        *version = results.version;
+    }
+    if (results.version != OLM_PROTOCOL_VERSION
+            || !results.has_message_index) {
+        return (size_t)-1;
+    }
+    *message_index = results.message_index;
+    return 0;
+}
+
+size_t olm_group_message_peek_raw(
+    const uint8_t * message, size_t message_length,
+    uint32_t * message_index, uint8_t * version
+) {
+    struct _OlmDecodeGroupMessageResults results;
+
+    _olm_decode_group_message(
+        message, message_length,
+        _olm_cipher_aes_sha_256_mac_length(),
+        ED25519_SIGNATURE_LENGTH,
+        &results);
+
+    if (version) {
+        *version = results.version;
+    }
+    if (results.version != OLM_PROTOCOL_VERSION
+            || !results.has_message_index) {
+        return (size_t)-1;
+    }
+    *message_index = results.message_index;
+    return 0;
+}
+
+size_t olm_group_decrypt_raw_max_plaintext_length(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length
+) {
+    return _decrypt_max_plaintext_length(session, message, message_length);
+}
+
+/**
+ * Set result to the ratchet at message_index, which must lie between
+ * initial_ratchet and latest_ratchet, starting from the closest earlier
+ * checkpoint. Records a new checkpoint on the way if there's room.
+ */
+/** The ratchet to start from to get to message_index: initial_ratchet or the
+ * closest earlier checkpoint */
+static const Megolm * _closest_start(
+    const OlmInboundGroupSession *session, uint32_t message_index
+) {
+    const Megolm *start = &session->initial_ratchet;
+    size_t i;
+
+    for (i = 0; i < session->checkpoint_count; i++) {
+        const Megolm *checkpoint = &_checkpoints(session)[i];
+        if ((message_index - checkpoint->counter)
+                < (message_index - start->counter)) {
+            start = checkpoint;
+        }
+    }
+    return start;
+}
+
+/** Whether getting to message_index from start takes a new checkpoint on the
+ * way, and if so where */
+static int _new_checkpoint(
+    const OlmInboundGroupSession *session, const Megolm *start,
+    uint32_t message_index, uint32_t *checkpoint_index
+) {
+    if (!session->checkpoint_capacity) {
+        return 0;
+    }
+    *checkpoint_index = message_index
+        & ((~(uint32_t)0) << session->checkpoint_spacing_log2);
+    /* only if it falls after where we are starting from */
+    return (*checkpoint_index - start->counter) < (1U << 31)
+        && *checkpoint_index != start->counter;
+}
+
+static void _advance_from_checkpoint(
+    OlmInboundGroupSession *session, uint32_t message_index, Megolm *result
+) {
+    uint32_t checkpoint_index;
+
+    *result = *_closest_start(session, message_index);
+
+    if (_new_checkpoint(session, result, message_index, &checkpoint_index)) {
+        Megolm *slot;
+        megolm_advance_to(result, checkpoint_index);
+        if (session->checkpoint_count < session->checkpoint_capacity) {
+            slot = &_checkpoints(session)[session->checkpoint_count++];
+        } else {
+            slot = &_checkpoints(session)[session->checkpoint_next];
+            session->checkpoint_next =
+                (session->checkpoint_next + 1) % session->checkpoint_capacity;
+        }
+        *slot = *result;
+    }
+
+    megolm_advance_to(result, message_index);
+}
+
+/** The first index the block of a history scan holding message_index
+ * starts at: the start of the block, or the first known index if that is
+ * later */
+static uint32_t _scan_first_index(
+    const OlmInboundGroupSession *session, uint32_t message_index
+) {
+    uint32_t block_start = message_index & ~(uint32_t)(SCAN_BLOCK_LENGTH - 1);
+    if ((block_start - session->initial_ratchet.counter) >= (1U << 31)) {
+        return session->initial_ratchet.counter;
+    }
+    return block_start;
+}
+
+/** Whether the session is scanning and holds the ratchet at message_index */
+static int _scan_holds(
+    const OlmInboundGroupSession *session, uint32_t message_index
+) {
+    const struct GroupSessionScan *scan = _scan(session);
+    return scan && scan->valid
+        && (message_index - scan->first.counter) < SCAN_BLOCK_LENGTH
+        && (message_index & ~(uint32_t)(SCAN_BLOCK_LENGTH - 1))
+            == (scan->first.counter & ~(uint32_t)(SCAN_BLOCK_LENGTH - 1));
+}
+
+/**
+ * Work out the ratchet at every index of the block holding message_index,
+ * which must lie between initial_ratchet and latest_ratchet, for a history
+ * scan. Only the last part of the ratchet changes within the block, so this
+ * is one hash per index once the first index is reached.
+ */
+static void _scan_block(
+    OlmInboundGroupSession *session, uint32_t message_index
+) {
+    struct GroupSessionScan *scan = _scan(session);
+    Megolm ratchet;
+    uint32_t i;
+
+    _advance_from_checkpoint(
+        session, _scan_first_index(session, message_index), &ratchet
+    );
+    scan->first = ratchet;
+    for (i = ratchet.counter % SCAN_BLOCK_LENGTH;; i++) {
+        memcpy(scan->parts[i], ratchet.data[3], MEGOLM_RATCHET_PART_LENGTH);
+        if (i == SCAN_BLOCK_LENGTH - 1) {
+            break;
+        }
+        megolm_advance(&ratchet);
+    }
+    scan->valid = 1;
+    _olm_unset(&ratchet, sizeof(ratchet));
+}
+
+/** The ratchet at message_index from the block of a history scan */
+static void _scan_get(
+    const OlmInboundGroupSession *session, uint32_t message_index,
+    Megolm *result
+) {
+    const struct GroupSessionScan *scan = _scan(session);
+    *result = scan->first;
+    memcpy(
+        result->data[3], scan->parts[message_index % SCAN_BLOCK_LENGTH],
+        MEGOLM_RATCHET_PART_LENGTH
+    );
+    result->counter = message_index;
+}
+
+/**
+ * get a copy of the megolm ratchet, advanced
+ * to the relevant index. Returns 0 on success, -1 on error
+ */
+static size_t _get_megolm(
+    OlmInboundGroupSession *session, uint32_t message_index, Megolm *result
+) {
+    /* pick a megolm instance to use. If we're at or beyond the latest ratchet
+     * value, use that */
+    if ((message_index - _latest(session)->counter) < (1U << 31)) {
+        Megolm *latest = _latest_to_advance(session, message_index);
+        if (!latest) {
+            return (size_t)-1;
+        }
+        megolm_advance_to(latest, message_index);
+        *result = *latest;
+        return 0;
+    } else if ((message_index - session->initial_ratchet.counter) >= (1U << 31)) {
+        /* the counter is before our intial ratchet - we can't decode this. */
+        session->last_error = OLM_UNKNOWN_MESSAGE_INDEX;
+        return (size_t)-1;
+    } else if (_scan(session)) {
+        /* during a history scan, work out the message's whole block if it
+         * isn't the one held */
+        if (!_scan_holds(session, message_index)) {
+            _scan_block(session, message_index);
+        }
+        _scan_get(session, message_index, result);
+        return 0;
+    } else {
+        /* otherwise, start from the initial megolm or the nearest checkpoint
+         * before the message. Take a copy so that we don't overwrite it. */
+        _advance_from_checkpoint(session, message_index, result);
+        return 0;
+    }
+}
+
+/** The cost of getting to message_index, which must lie between
+ * initial_ratchet and latest_ratchet, by the same route as
+ * _advance_from_checkpoint */
+static size_t _replay_cost(
+    const OlmInboundGroupSession *session, uint32_t message_index
+) {
+    const Megolm *start = _closest_start(session, message_index);
+    uint32_t checkpoint_index;
+
+    if (_new_checkpoint(session, start, message_index, &checkpoint_index)) {
+        return megolm_advance_cost(start->counter, checkpoint_index)
+            + megolm_advance_cost(checkpoint_index, message_index);
+    }
+    return megolm_advance_cost(start->counter, message_index);
+}
+
+size_t olm_inbound_group_session_seek_cost(
+    OlmInboundGroupSession *session, uint32_t message_index
+) {
+    uint32_t first_index;
+
+    if ((message_index - _latest(session)->counter) < (1U << 31)) {
+        return megolm_advance_cost(_latest(session)->counter, message_index);
+    }
+    if ((message_index - session->initial_ratchet.counter) >= (1U << 31)) {
+        session->last_error = OLM_UNKNOWN_MESSAGE_INDEX;
+        return (size_t)-1;
+    }
+    if (_scan(session)) {
+        /* the same route as _scan_block, which then takes a hash for each
+         * of the rest of the block */
+        if (_scan_holds(session, message_index)) {
+            return 0;
+        }
+        first_index = _scan_first_index(session, message_index);
+        return _replay_cost(session, first_index)
+            + (SCAN_BLOCK_LENGTH - 1 - first_index % SCAN_BLOCK_LENGTH);
+    }
+    return _replay_cost(session, message_index);
+}
+
+size_t olm_inbound_group_session_advance_to(
+    OlmInboundGroupSession *session, uint32_t message_index
+) {
+    Megolm ratchet;
+    if (_get_megolm(session, message_index, &ratchet) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    _olm_unset(&ratchet, sizeof(ratchet));
+    return 0;
+}
+
+size_t olm_inbound_group_session_prune_before(
+    OlmInboundGroupSession *session, uint32_t message_index
+) {
+    Megolm initial;
+    Megolm latest = *_latest(session);
+    size_t result;
+    size_t i, kept = 0;
+
+    if ((message_index - session->initial_ratchet.counter) >= (1U << 31)
+            || message_index == session->initial_ratchet.counter) {
+        /* nothing earlier to forget */
+        _olm_unset(&latest, sizeof(latest));
+        return 0;
+    }
+
+    if ((message_index - latest.counter) < (1U << 31)) {
+        /* past the latest ratchet, which moves on with the initial one */
+        megolm_advance_to(&latest, message_index);
+        initial = latest;
+    } else {
+        initial = *_closest_start(session, message_index);
+        megolm_advance_to(&initial, message_index);
+    }
+    session->initial_ratchet = initial;
+    session->dirty = 1;
+    /* A compact session either already has its latest ratchet out of line,
+     * or has just moved it to the initial one, so this takes no memory. */
+    result = _set_latest(session, &latest);
+    _olm_unset(&initial, sizeof(initial));
+    _olm_unset(&latest, sizeof(latest));
+
+    /* drop the checkpoints, cached keys and scanned block from before the
+     * new first index, which would otherwise still let those messages be
+     * decrypted */
+    _reset_scan(session);
+    for (i = 0; i < session->checkpoint_count; i++) {
+        Megolm *checkpoint = &_checkpoints(session)[i];
+        if ((checkpoint->counter - message_index) < (1U << 31)) {
+            _checkpoints(session)[kept++] = *checkpoint;
+        }
+    }
+    if (kept < session->checkpoint_count) {
+        _olm_unset(
+            &_checkpoints(session)[kept],
+            (session->checkpoint_count - kept) * sizeof(Megolm)
+        );
+        session->checkpoint_count = kept;
+        session->checkpoint_next = 0;
+    }
+    for (i = 0; i < session->message_key_cache_capacity; i++) {
+        struct MessageKeyCacheEntry *entry = &_message_key_cache(session)[i];
+        if (entry->last_used
+                && (entry->message_index - message_index) >= (1U << 31)) {
+            _olm_unset(entry, sizeof(*entry));
+        }
+    }
+    return result;
+}
+
+/**
+ * The ratchet reached by the previous message of a batch. Messages before
+ * latest_ratchet are decrypted in index order, so each can carry on from here
+ * rather than from initial_ratchet.
+ */
+struct BatchRatchet {
+    int valid;
+    Megolm ratchet;
+    /* the keys _batch_derive_keys derived ahead for the next few messages,
+     * and their indices. key_ready is cleared as each is taken. */
+    size_t key_count;
+    uint32_t key_indices[OLM_CRYPTO_SHA256_MAX_LANES];
+    uint8_t key_ready[OLM_CRYPTO_SHA256_MAX_LANES];
+    struct _olm_cipher_aes_sha_256_context keys[OLM_CRYPTO_SHA256_MAX_LANES];
+};
+
+/**
+ * Like _get_megolm, but carry on from the batch's ratchet when that is no
+ * later than message_index.
+ */
+static size_t _get_megolm_for_batch(
+    OlmInboundGroupSession *session, uint32_t message_index,
+    struct BatchRatchet *batch, Megolm *result
+) {
+    size_t r;
+
+    if ((message_index - _latest(session)->counter) < (1U << 31)
+            || _scan_holds(session, message_index)) {
+        return _get_megolm(session, message_index, result);
+    }
+    if (batch->valid
+            && (message_index - batch->ratchet.counter) < (1U << 31)) {
+        megolm_advance_to(&batch->ratchet, message_index);
+        *result = batch->ratchet;
+        return 0;
+    }
+    r = _get_megolm(session, message_index, result);
+    if (r != (size_t)-1) {
+        batch->ratchet = *result;
+        batch->valid = 1;
+    }
+    return r;
+}
+
+/**
+ * Fail with RATCHET_DISTANCE_EXCEEDED if getting the ratchet for
+ * message_index, the way _get_megolm_for_batch would, costs more than the
+ * session allows. batch may be NULL.
+ */
+static size_t _check_ratchet_distance(
+    OlmInboundGroupSession *session, uint32_t message_index,
+    const struct BatchRatchet *batch
+) {
+    size_t cost;
+
+    if (!session->max_ratchet_distance) {
+        return 0;
+    }
+    if (batch && batch->valid
+            && (message_index - _latest(session)->counter) >= (1U << 31)
+            && (message_index - batch->ratchet.counter) < (1U << 31)) {
+        cost = megolm_advance_cost(batch->ratchet.counter, message_index);
+    } else {
+        cost = olm_inbound_group_session_seek_cost(session, message_index);
+        if (cost == (size_t)-1) {
+            return cost;
+        }
+    }
+    if (cost > session->max_ratchet_distance) {
+        session->last_error = OLM_RATCHET_DISTANCE_EXCEEDED;
+        return (size_t)-1;
+    }
+    return 0;
+}
+
+/**
+ * Derive the keys for the next few messages of a batch side by side, ahead
+ * of _decrypt_decoded taking them. message_indices gives up to
+ * OLM_CRYPTO_SHA256_MAX_LANES messages whose signatures are good, in the
+ * order they will be decrypted. Messages whose ratchet can't be had are left
+ * for _decrypt_decoded to fail in the usual way.
+ */
+static void _batch_derive_keys(
+    OlmInboundGroupSession *session, struct BatchRatchet *batch,
+    const uint32_t *message_indices, size_t count
+) {
+    Megolm ratchets[OLM_CRYPTO_SHA256_MAX_LANES];
+    uint8_t const *ratchet_data[OLM_CRYPTO_SHA256_MAX_LANES];
+    struct _olm_cipher_aes_sha_256_context *keys[OLM_CRYPTO_SHA256_MAX_LANES];
+    enum OlmErrorCode last_error = session->last_error;
+    size_t i, n = 0;
+
+    _olm_unset(batch->keys, sizeof(batch->keys));
+    memset(batch->key_ready, 0, sizeof(batch->key_ready));
+    batch->key_count = 0;
+    /* with one lane there is nothing to gain from deriving ahead */
+    if (count < 2 || _olm_crypto_hmac_sha256_lanes() < 2) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (_check_ratchet_distance(session, message_indices[i], batch)
+                == (size_t)-1
+                || _get_megolm_for_batch(
+                    session, message_indices[i], batch, &ratchets[n]
+                ) == (size_t)-1) {
+            continue;
+        }
+        batch->key_indices[n] = message_indices[i];
+        batch->key_ready[n] = 1;
+        ratchet_data[n] = megolm_get_data(&ratchets[n]);
+        keys[n] = &batch->keys[n];
+        n++;
+    }
+    _olm_cipher_aes_sha_256_init_context_multi(
+        megolm_cipher_aes_sha_256,
+        ratchet_data, MEGOLM_RATCHET_LENGTH, keys, n
+    );
+    batch->key_count = n;
+    _olm_unset(ratchets, sizeof(ratchets));
+    session->last_error = last_error;
+}
+
+/**
+ * Take the keys _batch_derive_keys derived for message_index, if it did.
+ * Returns 1 and fills keys if so, otherwise 0.
+ */
+static int _take_batch_keys(
+    struct BatchRatchet *batch, uint32_t message_index,
+    struct _olm_cipher_aes_sha_256_context *keys
+) {
+    size_t i;
+    for (i = 0; i < batch->key_count; i++) {
+        if (batch->key_ready[i] && batch->key_indices[i] == message_index) {
+            *keys = batch->keys[i];
+            _olm_cipher_aes_sha_256_clear_context(&batch->keys[i]);
+            batch->key_ready[i] = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t olm_inbound_group_session_set_max_ratchet_distance(
+    OlmInboundGroupSession *session, size_t max_distance
+) {
+    session->max_ratchet_distance = max_distance;
+    return 0;
+}
+
+size_t olm_inbound_group_session_set_mac_first_distance(
+    OlmInboundGroupSession *session, size_t max_distance
+) {
+    session->mac_first_distance = max_distance;
+    return 0;
+}
+
+/**
+ * Without changing the session, advance a copy of whichever of the latest
+ * ratchet, a checkpoint or the initial ratchet is closest before
+ * message_index. Returns 0 on success, or -1 without setting an error if
+ * the message is before the initial ratchet or the copy would cost more than
+ * max_cost to advance.
+ */
+static size_t _peek_megolm(
+    const OlmInboundGroupSession *session, uint32_t message_index,
+    size_t max_cost, Megolm *result
+) {
+    const Megolm *start;
+
+    if ((message_index - session->initial_ratchet.counter) >= (1U << 31)) {
+        return (size_t)-1;
+    }
+    if ((message_index - _latest(session)->counter) < (1U << 31)) {
+        start = _latest(session);
+    } else {
+        start = _closest_start(session, message_index);
+    }
+    if (megolm_advance_cost(start->counter, message_index) > max_cost) {
+        return (size_t)-1;
+    }
+    *result = *start;
+    megolm_advance_to(result, message_index);
+    return 0;
+}
+
+/**
+ * Whether to check the MAC of the message at message_index before its
+ * signature, and if so the ratchet for it in megolm: only if the session
+ * asks for it and the ratchet is close, so that a flood of forged messages
+ * costs an HMAC each rather than a signature check.
+ */
+static int _mac_first(
+    const OlmInboundGroupSession *session, uint32_t message_index,
+    Megolm *megolm
+) {
+    size_t max_cost = session->mac_first_distance;
+
+    if (!max_cost) {
+        return 0;
+    }
+    if (session->max_ratchet_distance
+            && session->max_ratchet_distance < max_cost) {
+        max_cost = session->max_ratchet_distance;
+    }
+    return _peek_megolm(session, message_index, max_cost, megolm) == 0;
+}
+
+/**
+ * decode the headers of an un-base64-ed message
+ */
+static size_t _decode_message(
+    enum OlmErrorCode *last_error,
+    const uint8_t * message, size_t message_length,
+    struct _OlmDecodeGroupMessageResults *decoded_results
+) {
+    _olm_decode_group_message(
+        message, message_length,
+        _olm_cipher_aes_sha_256_mac_length(),
+        ED25519_SIGNATURE_LENGTH,
+        decoded_results);
+
+    if (decoded_results->version != OLM_PROTOCOL_VERSION) {
+        *last_error = OLM_BAD_MESSAGE_VERSION;
+        return (size_t)-1;
+    }
+
+    if (!decoded_results->has_message_index || !decoded_results->ciphertext) {
+        *last_error = OLM_BAD_MESSAGE_FORMAT;
+        return (size_t)-1;
+    }
+    return 0;
+}
+
+/**
+ * decrypt an un-base64-ed message whose headers have been decoded. If
+ * signature_checked is set the caller has already verified the signature. If
+ * batch is not NULL, it is used to find the ratchet for old messages.
+ */
+static size_t _decrypt_decoded(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length,
+    const struct _OlmDecodeGroupMessageResults *decoded_results,
+    int signature_checked, struct BatchRatchet *batch,
+    uint8_t * plaintext, size_t max_plaintext_length
+) {
+    size_t max_length, r;
+    Megolm megolm;
+    uint8_t message_hash[SHA256_OUTPUT_LENGTH];
+    struct MessageKeyCacheEntry *cached_keys = NULL;
+    int mac_first = 0;
+
+    if (_is_replay(
+            session, decoded_results->message_index, &session->last_error
+        )) {
+        return (size_t)-1;
+    }
+
+    /* if we have decrypted exactly this message before, we already know that
+     * the signature is good, and have the keys */
+    if (session->message_key_cache_capacity) {
+        _olm_crypto_sha256(message, message_length, message_hash);
+        cached_keys = _find_message_keys(
+            session, decoded_results->message_index, message_hash
+        );
+    }
+
+    message_length -= ED25519_SIGNATURE_LENGTH;
+
+    if (!cached_keys && !signature_checked && !batch) {
+        mac_first = _mac_first(
+            session, decoded_results->message_index, &megolm
+        );
+    }
+
+    if (!cached_keys && !signature_checked && !mac_first) {
+        /* verify the signature. We could do this before decoding the message,
+         * but we allow for the possibility of future protocol versions which
+         * use a different signing mechanism; we would rather throw
+         * "BAD_MESSAGE_VERSION" than "BAD_SIGNATURE" in this case.
+         */
+        r = _verify_signature(
+            session,
+            message, message_length,
+            message + message_length
+        );
+        if (!r) {
+            session->last_error = OLM_BAD_SIGNATURE;
+            return (size_t)-1;
+        }
+    }
+
+    max_length = _olm_cipher_aes_sha_256_max_plaintext_length(
+        decoded_results->ciphertext_length
+    );
+    if (max_plaintext_length < max_length) {
+        if (mac_first) {
+            _olm_unset(&megolm, sizeof(megolm));
+        }
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+
+    if (cached_keys) {
+        r = _olm_cipher_aes_sha_256_context_decrypt(
+            &cached_keys->keys,
+            message, message_length,
+            decoded_results->ciphertext, decoded_results->ciphertext_length,
+            plaintext, max_plaintext_length
+        );
+    } else {
+        struct _olm_cipher_aes_sha_256_context keys;
+
+        if (mac_first) {
+            _olm_cipher_aes_sha_256_init_context(
+                megolm_cipher_aes_sha_256,
+                megolm_get_data(&megolm), MEGOLM_RATCHET_LENGTH,
+                &keys
+            );
+        } else if (!batch || !_take_batch_keys(
+                batch, decoded_results->message_index, &keys
+            )) {
+            /* only after the signature check, so that forged messages are
+             * rejected rather than deferred */
+            if (_check_ratchet_distance(
+                    session, decoded_results->message_index, batch
+                ) == (size_t)-1) {
+                return (size_t)-1;
+            }
+            if (batch) {
+                r = _get_megolm_for_batch(
+                    session, decoded_results->message_index, batch, &megolm
+                );
+            } else {
+                r = _get_megolm(
+                    session, decoded_results->message_index, &megolm
+                );
+            }
+            if (r == (size_t)-1) {
+                return r;
+            }
+            _olm_cipher_aes_sha_256_init_context(
+                megolm_cipher_aes_sha_256,
+                megolm_get_data(&megolm), MEGOLM_RATCHET_LENGTH,
+                &keys
+            );
+            _olm_unset(&megolm, sizeof(megolm));
+        }
+
+        /* now try checking the mac, and decrypting */
+        r = _olm_cipher_aes_sha_256_context_decrypt(
+            &keys,
+            message, message_length,
+            decoded_results->ciphertext, decoded_results->ciphertext_length,
+            plaintext, max_plaintext_length
+        );
+        if (r != (size_t)-1 && mac_first) {
+            /* the MAC is good, so the signature is worth checking now. The
+             * session only moves on once both are. */
+            if (!_verify_signature(
+                    session, message, message_length, message + message_length
+                )) {
+                _olm_unset(plaintext, max_length);
+                _olm_cipher_aes_sha_256_clear_context(&keys);
+                _olm_unset(&megolm, sizeof(megolm));
+                session->last_error = OLM_BAD_SIGNATURE;
+                return (size_t)-1;
+            }
+            if ((decoded_results->message_index - _latest(session)->counter)
+                    < (1U << 31)) {
+                /* a compact session with no room for it just doesn't keep
+                 * the ratchet, which costs time but changes no results */
+                _set_latest(session, &megolm);
+            }
+        }
+        if (mac_first) {
+            _olm_unset(&megolm, sizeof(megolm));
+        }
+        if (r != (size_t)-1 && session->message_key_cache_capacity) {
+            /* keep the derived keys for next time */
+            struct MessageKeyCacheEntry *entry =
+                _new_message_keys_entry(session);
+            entry->message_index = decoded_results->message_index;
+            memcpy(entry->message_hash, message_hash, SHA256_OUTPUT_LENGTH);
+            entry->keys = keys;
+        }
+        _olm_cipher_aes_sha_256_clear_context(&keys);
+    }
+
+    if (r == (size_t)-1) {
+        session->last_error = OLM_BAD_MESSAGE_MAC;
+        return r;
+    }
+
+    /* once we have successfully decrypted a message, set a flag to say the
+     * session appears valid. */
+    _mark_verified(session);
+
+    if (session->replay_detection) {
+        _replay_window_add(session, decoded_results->message_index);
+    }
+
+    return r;
+}
+
+/**
+ * decrypt an un-base64-ed message
+ */
+static size_t _decrypt(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+) {
+    struct _OlmDecodeGroupMessageResults decoded_results;
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_GROUP_DECRYPT);
+
+    if (_decode_message(
+        &session->last_error, message, message_length, &decoded_results
+    ) == (size_t)-1) {
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_DECRYPT);
+        OLM_TRACE_END(trace, OLM_TRACE_GROUP_DECRYPT);
+        OLM_RECORD(
+            OLM_TRACE_GROUP_DECRYPT, session, 0, message_length, 0, 0,
+            (size_t)-1
+        );
+        return (size_t)-1;
+    }
+
+    if (message_index != NULL) {
+        *message_index = decoded_results.message_index;
+    }
+
+    result = _decrypt_decoded(
+        session, message, message_length, &decoded_results, 0, NULL,
+        plaintext, max_plaintext_length
+    );
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_DECRYPT);
+    OLM_TRACE_END(trace, OLM_TRACE_GROUP_DECRYPT);
+    OLM_RECORD(
+        OLM_TRACE_GROUP_DECRYPT, session,
+        result == (size_t)-1 ? 0 : result, message_length,
+        decoded_results.message_index, 0, result
+    );
+    return result;
+}
+
+size_t olm_group_decrypt(
+    OlmInboundGroupSession *session,
+    uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+) {
+    size_t raw_message_length, result;
+    /* so that the return probe can report the index */
+    uint32_t index = 0;
+    uint32_t * index_out = message_index != NULL ? message_index : &index;
+
+    OLM_PROBE1(group_decrypt_entry, message_length);
+    raw_message_length = _olm_decode_base64(message, message_length, message);
+    if (raw_message_length == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        result = (size_t)-1;
+    } else {
+        result = _decrypt(
+            session, message, raw_message_length,
+            plaintext, max_plaintext_length,
+            index_out
+        );
+    }
+    OLM_PROBE2(group_decrypt_return, result, *index_out);
+    return result;
+}
+
+#define GROUP_DECRYPT_TOKEN_LENGTH SHA256_OUTPUT_LENGTH
+
+size_t olm_group_decrypt_token_length(void) {
+    return GROUP_DECRYPT_TOKEN_LENGTH;
+}
+
+/** the token olm_group_decrypt_with_token() gives an un-base64-ed message */
+static void _verified_token(
+    const OlmInboundGroupSession *session,
+    const uint8_t * token_key, size_t token_key_length,
+    const uint8_t * message, size_t message_length,
+    uint8_t * token
+) {
+    uint8_t input[ED25519_PUBLIC_KEY_LENGTH + SHA256_OUTPUT_LENGTH];
+    memcpy(
+        input, session->signing_key.public_key, ED25519_PUBLIC_KEY_LENGTH
+    );
+    _olm_crypto_sha256(
+        message, message_length, input + ED25519_PUBLIC_KEY_LENGTH
+    );
+    _olm_crypto_hmac_sha256(
+        token_key, token_key_length, input, sizeof(input), token
+    );
+}
+
+size_t olm_group_decrypt_with_token(
+    OlmInboundGroupSession *session,
+    uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index,
+    const uint8_t * token_key, size_t token_key_length,
+    const uint8_t * token, size_t token_length,
+    uint8_t * token_out, size_t token_out_length
+) {
+    struct _OlmDecodeGroupMessageResults decoded_results;
+    uint8_t expected[GROUP_DECRYPT_TOKEN_LENGTH];
+    size_t raw_message_length, result = (size_t)-1;
+    int signature_checked;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_GROUP_DECRYPT);
+
+    if (token_out && token_out_length < GROUP_DECRYPT_TOKEN_LENGTH) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+    } else if ((raw_message_length = _olm_decode_base64(
+        message, message_length, message
+    )) == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+    } else if (_decode_message(
+        &session->last_error, message, raw_message_length, &decoded_results
+    ) != (size_t)-1) {
+        if (message_index != NULL) {
+            *message_index = decoded_results.message_index;
+        }
+        _verified_token(
+            session, token_key, token_key_length,
+            message, raw_message_length, expected
+        );
+        signature_checked = token != NULL
+            && token_length == GROUP_DECRYPT_TOKEN_LENGTH
+            && _olm_is_equal(token, expected, GROUP_DECRYPT_TOKEN_LENGTH);
+        result = _decrypt_decoded(
+            session, message, raw_message_length, &decoded_results,
+            signature_checked, NULL, plaintext, max_plaintext_length
+        );
+        if (result != (size_t)-1 && token_out) {
+            memcpy(token_out, expected, GROUP_DECRYPT_TOKEN_LENGTH);
+        }
+        _olm_unset(expected, sizeof(expected));
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_DECRYPT);
+    OLM_TRACE_END(trace, OLM_TRACE_GROUP_DECRYPT);
+    return result;
+}
+
+size_t olm_group_decrypt_raw(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length,
+    uint8_t * plaintext, size_t max_plaintext_length,
+    uint32_t * message_index
+) {
+    return _decrypt(
+        session, message, message_length,
+        plaintext, max_plaintext_length,
+        message_index
+    );
+}
+
+size_t olm_group_decrypt_inplace(
+    OlmInboundGroupSession *session,
+    uint8_t * buffer, size_t message_length,
+    uint32_t * message_index
+) {
+    struct _OlmDecodeGroupMessageResults decoded_results;
+    size_t raw_message_length, offset, result;
+    uint8_t *plaintext;
+
+    raw_message_length = _olm_decode_base64(buffer, message_length, buffer);
+    if (raw_message_length == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        return (size_t)-1;
+    }
+
+    if (_decode_message(
+        &session->last_error, buffer, raw_message_length, &decoded_results
+    ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+
+    /* decrypt over the ciphertext, which the cipher allows, then move the
+     * plain-text to the start of the buffer.
+     */
+    offset = decoded_results.ciphertext - buffer;
+    plaintext = buffer + offset;
+    result = _decrypt(
+        session, buffer, raw_message_length,
+        plaintext, raw_message_length - offset,
+        message_index
+    );
+    if (result == (size_t)-1) {
+        return result;
+    }
+
+    memmove(buffer, plaintext, result);
+    _olm_unset(buffer + result, offset);
+    return result;
+}
+
+size_t olm_group_decrypt_to_buffer(
+    OlmInboundGroupSession *session,
+    uint8_t * message, size_t message_length,
+    const OlmAllocator *allocator, OlmBuffer *plaintext,
+    uint32_t * message_index
+) {
+    struct _OlmDecodeGroupMessageResults decoded_results;
+    size_t raw_message_length, result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_GROUP_DECRYPT);
+
+    plaintext->length = 0;
+    raw_message_length = _olm_decode_base64(message, message_length, message);
+    if (raw_message_length == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        result = (size_t)-1;
+    } else if (_decode_message(
+        &session->last_error, message, raw_message_length, &decoded_results
+    ) == (size_t)-1) {
+        result = (size_t)-1;
+    } else if (olm_buffer_reserve(
+        plaintext, allocator,
+        _olm_cipher_aes_sha_256_max_plaintext_length(
+            decoded_results.ciphertext_length
+        )
+    ) == (size_t)-1) {
+        session->last_error = OLM_ALLOCATION_FAILED;
+        result = (size_t)-1;
+    } else {
+        if (message_index != NULL) {
+            *message_index = decoded_results.message_index;
+        }
+        result = _decrypt_decoded(
+            session, message, raw_message_length, &decoded_results, 0, NULL,
+            plaintext->data, plaintext->capacity
+        );
+        if (result != (size_t)-1) {
+            plaintext->length = result;
+        }
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_DECRYPT);
+    OLM_TRACE_END(trace, OLM_TRACE_GROUP_DECRYPT);
+    return result;
+}
+
+/**
+ * decrypt an un-base64-ed message held in segments, checking its signature
+ * and MAC first
+ */
+static size_t _decrypt_segments(
+    OlmInboundGroupSession *session,
+    const OlmIovec * message, size_t message_count,
+    const OlmIovec * plaintext, size_t plaintext_count,
+    uint32_t * message_index
+) {
+    struct _OlmDecodeGroupMessageSegmentsResults decoded_results;
+    struct _olm_cipher_aes_sha_256_context keys;
+    struct _olm_cipher_aes_sha_256_stream cipher;
+    struct _olm_iovec_cursor input, output;
+    uint8_t signature[ED25519_SIGNATURE_LENGTH];
+    uint8_t block[AES256_IV_LENGTH];
+    size_t message_length, signed_length, remaining, written, r;
+    Megolm megolm;
+
+    message_length = _olm_iovec_length(message, message_count);
+    _olm_decode_group_message_segments(
+        message, message_count,
+        _olm_cipher_aes_sha_256_mac_length(),
+        ED25519_SIGNATURE_LENGTH,
+        &decoded_results
+    );
+    if (decoded_results.version != OLM_PROTOCOL_VERSION) {
+        session->last_error = OLM_BAD_MESSAGE_VERSION;
+        return (size_t)-1;
+    }
+    if (!decoded_results.has_message_index
+            || !decoded_results.has_ciphertext) {
+        session->last_error = OLM_BAD_MESSAGE_FORMAT;
+        return (size_t)-1;
+    }
+    if (message_index != NULL) {
+        *message_index = decoded_results.message_index;
+    }
+    if (_is_replay(
+            session, decoded_results.message_index, &session->last_error
+        )) {
+        return (size_t)-1;
+    }
+
+    signed_length = message_length - ED25519_SIGNATURE_LENGTH;
+    _olm_iovec_cursor_init(&input, message, message_count);
+    _olm_iovec_cursor_skip(&input, signed_length);
+    _olm_iovec_cursor_read(&input, signature, ED25519_SIGNATURE_LENGTH);
+    if (!_verify_signature_segments(
+            session, message, message_count, signed_length, signature
+        )) {
+        session->last_error = OLM_BAD_SIGNATURE;
+        return (size_t)-1;
+    }
+
+    if (_olm_iovec_length(plaintext, plaintext_count)
+            < _olm_cipher_aes_sha_256_max_plaintext_length(
+                decoded_results.ciphertext_length
+            )) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+
+    if (_check_ratchet_distance(
+            session, decoded_results.message_index, NULL
+        ) == (size_t)-1
+            || _get_megolm(
+                session, decoded_results.message_index, &megolm
+            ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    _olm_cipher_aes_sha_256_init_context(
+        megolm_cipher_aes_sha_256,
+        megolm_get_data(&megolm), MEGOLM_RATCHET_LENGTH,
+        &keys
+    );
+    _olm_unset(&megolm, sizeof(megolm));
+
+    if (_olm_cipher_aes_sha_256_context_verify_segments(
+            &keys, message, message_count, signed_length,
+            decoded_results.ciphertext_length
+        ) == (size_t)-1) {
+        _olm_cipher_aes_sha_256_clear_context(&keys);
+        session->last_error = OLM_BAD_MESSAGE_MAC;
+        return (size_t)-1;
+    }
+    _olm_cipher_aes_sha_256_decrypt_stream_begin(&keys, &cipher);
+    _olm_cipher_aes_sha_256_clear_context(&keys);
+
+    /* decrypt as many whole blocks as the current segments of both the
+     * message and the plain-text have, keeping back the last block, which
+     * holds the padding. A block which straddles two segments of either goes
+     * through block. */
+    _olm_iovec_cursor_init(&input, message, message_count);
+    _olm_iovec_cursor_skip(&input, decoded_results.ciphertext_offset);
+    _olm_iovec_cursor_init(&output, plaintext, plaintext_count);
+    remaining = decoded_results.ciphertext_length;
+    written = 0;
+    while (remaining > AES256_IV_LENGTH) {
+        size_t input_room, output_room;
+        size_t blocks = remaining / AES256_IV_LENGTH - 1;
+        const uint8_t *input_pos = _olm_iovec_cursor_peek(&input, &input_room);
+        uint8_t *output_pos = _olm_iovec_cursor_peek(&output, &output_room);
+
+        if (blocks > input_room / AES256_IV_LENGTH) {
+            blocks = input_room / AES256_IV_LENGTH;
+        }
+        if (blocks > output_room / AES256_IV_LENGTH) {
+            blocks = output_room / AES256_IV_LENGTH;
+        }
+        if (blocks) {
+            _olm_cipher_aes_sha_256_decrypt_stream_update(
+                &cipher, input_pos, blocks, output_pos
+            );
+            _olm_iovec_cursor_skip(&input, blocks * AES256_IV_LENGTH);
+            _olm_iovec_cursor_skip(&output, blocks * AES256_IV_LENGTH);
+        } else {
+            blocks = 1;
+            _olm_iovec_cursor_read(&input, block, AES256_IV_LENGTH);
+            _olm_cipher_aes_sha_256_decrypt_stream_update(
+                &cipher, block, 1, block
+            );
+            _olm_iovec_cursor_write(&output, block, AES256_IV_LENGTH);
+        }
+        remaining -= blocks * AES256_IV_LENGTH;
+        written += blocks * AES256_IV_LENGTH;
+    }
+
+    _olm_iovec_cursor_read(&input, block, AES256_IV_LENGTH);
+    r = _olm_cipher_aes_sha_256_decrypt_stream_end(&cipher, block, block);
+    if (r == (size_t)-1) {
+        _olm_iovec_unset(plaintext, plaintext_count, written);
+        session->last_error = OLM_BAD_MESSAGE_MAC;
+        return (size_t)-1;
+    }
+    _olm_iovec_cursor_write(&output, block, r);
+    _olm_unset(block, sizeof(block));
+
+    _mark_verified(session);
+    if (session->replay_detection) {
+        _replay_window_add(session, decoded_results.message_index);
+    }
+    return written + r;
+}
+
+size_t olm_group_decrypt_raw_iov(
+    OlmInboundGroupSession *session,
+    const OlmIovec * message, size_t message_count,
+    const OlmIovec * plaintext, size_t plaintext_count,
+    uint32_t * message_index
+) {
+    size_t result;
+    uint32_t index = 0;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_GROUP_DECRYPT);
+
+    result = _decrypt_segments(
+        session, message, message_count, plaintext, plaintext_count,
+        &index
+    );
+    if (message_index != NULL) {
+        *message_index = index;
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_DECRYPT);
+    OLM_TRACE_END(trace, OLM_TRACE_GROUP_DECRYPT);
+    OLM_RECORD(
+        OLM_TRACE_GROUP_DECRYPT, session,
+        result == (size_t)-1 ? 0 : result,
+        _olm_iovec_length(message, message_count), index, 0, result
+    );
+    return result;
+}
+
+struct OlmGroupDecryptStream {
+    struct _olm_cipher_aes_sha_256_stream cipher;
+    /* the ciphertext not yet decrypted */
+    const uint8_t *ciphertext;
+    size_t ciphertext_remaining;
+    /* plaintext decrypted but not yet returned */
+    uint8_t block[AES256_IV_LENGTH];
+    size_t block_start;
+    size_t block_length;
+    int active;
+    enum OlmErrorCode last_error;
+};
+
+size_t olm_group_decrypt_stream_size(void) {
+    return sizeof(OlmGroupDecryptStream);
+}
+
+OlmGroupDecryptStream * olm_group_decrypt_stream(void * memory) {
+    OlmGroupDecryptStream *stream = memory;
+    _olm_unset(stream, sizeof(OlmGroupDecryptStream));
+    return stream;
+}
+
+const char *olm_group_decrypt_stream_last_error(
+    const OlmGroupDecryptStream *stream
+) {
+    return _olm_error_to_string(stream->last_error);
+}
+
+size_t olm_clear_group_decrypt_stream(OlmGroupDecryptStream *stream) {
+    _olm_unset(stream, sizeof(OlmGroupDecryptStream));
+    return sizeof(OlmGroupDecryptStream);
+}
+
+size_t olm_group_decrypt_stream_begin(
+    OlmGroupDecryptStream *stream,
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length,
+    uint32_t * message_index
+) {
+    struct _OlmDecodeGroupMessageResults decoded_results;
+    struct _olm_cipher_aes_sha_256_context keys;
+    size_t signed_length;
+    Megolm megolm;
+
+    olm_clear_group_decrypt_stream(stream);
+
+    if (_decode_message(
+        &stream->last_error, message, message_length, &decoded_results
+    ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    if (message_index != NULL) {
+        *message_index = decoded_results.message_index;
+    }
+    if (_is_replay(
+            session, decoded_results.message_index, &stream->last_error
+        )) {
+        return (size_t)-1;
+    }
+
+    signed_length = message_length - ED25519_SIGNATURE_LENGTH;
+    if (!_verify_signature(
+            session,
+            message, signed_length,
+            message + signed_length
+        )) {
+        stream->last_error = OLM_BAD_SIGNATURE;
+        return (size_t)-1;
+    }
+
+    if (_check_ratchet_distance(
+            session, decoded_results.message_index, NULL
+        ) == (size_t)-1
+            || _get_megolm(
+                session, decoded_results.message_index, &megolm
+            ) == (size_t)-1) {
+        stream->last_error = session->last_error;
+        return (size_t)-1;
+    }
+    _olm_cipher_aes_sha_256_init_context(
+        megolm_cipher_aes_sha_256,
+        megolm_get_data(&megolm), MEGOLM_RATCHET_LENGTH,
+        &keys
+    );
+    _olm_unset(&megolm, sizeof(megolm));
+
+    /* check the MAC over the whole message first, so that no plaintext is
+     * handed out from a message which turns out to be forged */
+    if (_olm_cipher_aes_sha_256_context_verify(
+            &keys, message, signed_length, decoded_results.ciphertext_length
+        ) == (size_t)-1) {
+        _olm_cipher_aes_sha_256_clear_context(&keys);
+        stream->last_error = OLM_BAD_MESSAGE_MAC;
+        return (size_t)-1;
+    }
+    _olm_cipher_aes_sha_256_decrypt_stream_begin(&keys, &stream->cipher);
+    _olm_cipher_aes_sha_256_clear_context(&keys);
+
+    _mark_verified(session);
+    if (session->replay_detection) {
+        _replay_window_add(session, decoded_results.message_index);
+    }
+
+    stream->ciphertext = decoded_results.ciphertext;
+    stream->ciphertext_remaining = decoded_results.ciphertext_length;
+    stream->active = 1;
+    return _olm_cipher_aes_sha_256_max_plaintext_length(
+        decoded_results.ciphertext_length
+    );
+}
+
+size_t olm_group_decrypt_stream_read(
+    OlmGroupDecryptStream *stream,
+    uint8_t * plaintext, size_t max_plaintext_length
+) {
+    size_t written = 0;
+
+    if (!stream->active) {
+        stream->last_error = OLM_BAD_STREAM_STATE;
+        return (size_t)-1;
+    }
+
+    while (written < max_plaintext_length) {
+        size_t room = max_plaintext_length - written;
+
+        if (stream->block_length) {
+            /* hand out what is left of the last block we decrypted */
+            size_t n = room < stream->block_length ? room : stream->block_length;
+            memcpy(plaintext + written, stream->block + stream->block_start, n);
+            _olm_unset(stream->block + stream->block_start, n);
+            stream->block_start += n;
+            stream->block_length -= n;
+            written += n;
+        } else if (stream->ciphertext_remaining > AES256_IV_LENGTH) {
+            /* decrypt as many whole blocks as there is room for, keeping back
+             * the last block, which holds the padding */
+            size_t blocks =
+                stream->ciphertext_remaining / AES256_IV_LENGTH - 1;
+            uint8_t *output = plaintext + written;
+            if (room < AES256_IV_LENGTH) {
+                blocks = 1;
+                output = stream->block;
+            } else if (blocks > room / AES256_IV_LENGTH) {
+                blocks = room / AES256_IV_LENGTH;
+            }
+            _olm_cipher_aes_sha_256_decrypt_stream_update(
+                &stream->cipher, stream->ciphertext, blocks, output
+            );
+            stream->ciphertext += blocks * AES256_IV_LENGTH;
+            stream->ciphertext_remaining -= blocks * AES256_IV_LENGTH;
+            if (output == stream->block) {
+                stream->block_start = 0;
+                stream->block_length = AES256_IV_LENGTH;
+            } else {
+                written += blocks * AES256_IV_LENGTH;
+            }
+        } else if (stream->ciphertext_remaining) {
+            size_t r = _olm_cipher_aes_sha_256_decrypt_stream_end(
+                &stream->cipher, stream->ciphertext, stream->block
+            );
+            stream->ciphertext_remaining = 0;
+            if (r == (size_t)-1) {
+                olm_clear_group_decrypt_stream(stream);
+                stream->last_error = OLM_BAD_MESSAGE_MAC;
+                return (size_t)-1;
+            }
+            stream->block_start = 0;
+            stream->block_length = r;
+        } else {
+            break;
+        }
+    }
+    return written;
+}
+
+/* the number of messages olm_group_decrypt_batch sorts and verifies
+ * together */
+#define DECRYPT_BATCH_SIZE 64
+
+/** record the failure of a message in a batch */
+static void _batch_failed(
+    OlmInboundGroupSession *session, size_t i,
+    size_t * plaintext_lengths, const char ** errors
+) {
+    plaintext_lengths[i] = (size_t)-1;
+    if (errors) {
+        errors[i] = _olm_error_to_string(session->last_error);
+    }
+}
+
+size_t olm_group_decrypt_batch(
+    OlmInboundGroupSession *session, size_t count,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors
+) {
+    struct _OlmDecodeGroupMessageResults decoded[DECRYPT_BATCH_SIZE];
+    size_t raw_lengths[DECRYPT_BATCH_SIZE];
+    /* the messages which decoded, sorted by index */
+    size_t order[DECRYPT_BATCH_SIZE];
+    /* the signatures to check, in the same order */
+    struct _olm_ed25519_public_key keys[DECRYPT_BATCH_SIZE];
+    const uint8_t *signed_parts[DECRYPT_BATCH_SIZE];
+    size_t signed_lengths[DECRYPT_BATCH_SIZE];
+    const uint8_t *signatures[DECRYPT_BATCH_SIZE];
+    uint8_t signature_ok[DECRYPT_BATCH_SIZE];
+    const uint32_t first_index = session->initial_ratchet.counter;
+    struct BatchRatchet batch;
+    size_t failures = 0;
+    size_t start, n, i, j, k;
+
+    batch.valid = 0;
+    batch.key_count = 0;
+
+    for (start = 0; start < count; start += DECRYPT_BATCH_SIZE) {
+        n = count - start < DECRYPT_BATCH_SIZE ?
+            count - start : DECRYPT_BATCH_SIZE;
+
+        /* decode the headers, and sort the messages by how far they are
+         * along the ratchet */
+        k = 0;
+        for (i = 0; i < n; i++) {
+            uint8_t *message = messages[start + i];
+
+            raw_lengths[i] = _olm_decode_base64(
+                message, message_lengths[start + i], message
+            );
+            if (raw_lengths[i] == (size_t)-1) {
+                session->last_error = OLM_INVALID_BASE64;
+                _batch_failed(session, start + i, plaintext_lengths, errors);
+                failures++;
+                continue;
+            }
+            if (_decode_message(
+                &session->last_error, message, raw_lengths[i], &decoded[i]
+            ) == (size_t)-1) {
+                _batch_failed(session, start + i, plaintext_lengths, errors);
+                failures++;
+                continue;
+            }
+            if (message_indices) {
+                message_indices[start + i] = decoded[i].message_index;
+            }
+            /* the window is checked again as each message is decrypted, in
+             * case of repeats within the batch */
+            if (_is_replay(
+                session, decoded[i].message_index, &session->last_error
+            )) {
+                _batch_failed(session, start + i, plaintext_lengths, errors);
+                failures++;
+                continue;
+            }
+
+            for (j = k; j > 0; j--) {
+                uint32_t prev = decoded[order[j - 1]].message_index;
+                if ((prev - first_index)
+                        <= (decoded[i].message_index - first_index)) {
+                    break;
+                }
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+            k++;
+        }
+
+        for (j = 0; j < k; j++) {
+            i = order[j];
+            keys[j] = session->signing_key;
+            signed_parts[j] = messages[start + i];
+            signed_lengths[j] = raw_lengths[i] - ED25519_SIGNATURE_LENGTH;
+            signatures[j] = messages[start + i] + signed_lengths[j];
+        }
+        _olm_crypto_ed25519_verify_batch(
+            k, keys, signed_parts, signed_lengths, signatures, signature_ok
+        );
+
+        for (j = 0; j < k; j++) {
+            size_t r;
+            i = order[j];
+            if (j % OLM_CRYPTO_SHA256_MAX_LANES == 0) {
+                /* derive the keys for the next few good messages at once */
+                uint32_t indices[OLM_CRYPTO_SHA256_MAX_LANES];
+                size_t m, n = 0;
+                for (m = j; m < k && m < j + OLM_CRYPTO_SHA256_MAX_LANES;
+                        m++) {
+                    if (signature_ok[m]) {
+                        indices[n++] = decoded[order[m]].message_index;
+                    }
+                }
+                _batch_derive_keys(session, &batch, indices, n);
+            }
+            if (!signature_ok[j]) {
+                session->last_error = OLM_BAD_SIGNATURE;
+                r = (size_t)-1;
+            } else {
+                r = _decrypt_decoded(
+                    session, messages[start + i], raw_lengths[i],
+                    &decoded[i], 1, &batch,
+                    plaintexts[start + i], max_plaintext_lengths[start + i]
+                );
+            }
+            if (r == (size_t)-1) {
+                _batch_failed(session, start + i, plaintext_lengths, errors);
+                failures++;
+            } else {
+                plaintext_lengths[start + i] = r;
+                if (errors) {
+                    errors[start + i] = _olm_error_to_string(OLM_SUCCESS);
+                }
+            }
+        }
+    }
+
+    _olm_unset(&batch, sizeof(batch));
+    return failures;
+}
+
+/** The cost olm_group_decrypt_batch_within_budget() gives a message, setting
+ * message_index if the message has one */
+static size_t _message_cost(
+    OlmInboundGroupSession *session,
+    const uint8_t * message, size_t message_length,
+    uint32_t * message_index
+) {
+    struct _OlmPeekMessageResults results;
+    size_t cost;
+
+    if (_olm_decode_base64_length(message_length) == (size_t)-1) {
+        return 0;
+    }
+    _olm_peek_group_message(
+        message, message_length,
+        _olm_cipher_aes_sha_256_mac_length(),
+        ED25519_SIGNATURE_LENGTH,
+        &results
+    );
+    if (results.version != OLM_PROTOCOL_VERSION
+            || !results.has_message_index) {
+        return 0;
+    }
+    if (message_index) {
+        *message_index = results.message_index;
+    }
+    cost = olm_inbound_group_session_seek_cost(session, results.message_index);
+    return cost == (size_t)-1 ? 0 : cost;
+}
+
+/** The total cost of the messages which cost no more than limit, or
+ * (size_t)-1 if that doesn't fit in a size_t */
+static size_t _cost_up_to(
+    const size_t * costs, size_t count, size_t limit
+) {
+    size_t total = 0, i;
+    for (i = 0; i < count; i++) {
+        if (costs[i] <= limit) {
+            if (costs[i] > (size_t)-1 - total) {
+                return (size_t)-1;
+            }
+            total += costs[i];
+        }
+    }
+    return total;
+}
+
+size_t olm_group_decrypt_batch_within_budget(
+    OlmInboundGroupSession *session, size_t count,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors,
+    size_t budget, size_t * costs
+) {
+    /* the messages being decrypted, DECRYPT_BATCH_SIZE at a time */
+    size_t chosen[DECRYPT_BATCH_SIZE];
+    uint8_t *chosen_messages[DECRYPT_BATCH_SIZE];
+    size_t chosen_message_lengths[DECRYPT_BATCH_SIZE];
+    uint8_t *chosen_plaintexts[DECRYPT_BATCH_SIZE];
+    size_t chosen_max_plaintext_lengths[DECRYPT_BATCH_SIZE];
+    size_t chosen_plaintext_lengths[DECRYPT_BATCH_SIZE];
+    uint32_t chosen_message_indices[DECRYPT_BATCH_SIZE];
+    const char *chosen_errors[DECRYPT_BATCH_SIZE];
+    size_t low = 0, high = 0, next = (size_t)-1, next_allowed;
+    size_t failures = 0, n = 0, i, j;
+
+    for (i = 0; i < count; i++) {
+        costs[i] = _message_cost(
+            session, messages[i], message_lengths[i],
+            message_indices ? &message_indices[i] : NULL
+        );
+        if (costs[i] > high) {
+            high = costs[i];
+        }
+    }
+
+    /* find the most a message can cost with all the messages which cost no
+     * more than it fitting in the budget */
+    while (low < high) {
+        size_t middle = low + (high - low + 1) / 2;
+        if (_cost_up_to(costs, count, middle) <= budget) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    /* then fit in as many of the next cheapest as there is room for */
+    for (i = 0; i < count; i++) {
+        if (costs[i] > low && costs[i] < next) {
+            next = costs[i];
+        }
+    }
+    next_allowed = next == (size_t)-1 ? 0
+        : (budget - _cost_up_to(costs, count, low)) / next;
+
+    for (i = 0; i <= count; i++) {
+        if (i < count && costs[i] > low) {
+            if (costs[i] == next && next_allowed) {
+                next_allowed--;
+            } else {
+                session->last_error = OLM_DECRYPTION_DEFERRED;
+                _batch_failed(session, i, plaintext_lengths, errors);
+                failures++;
+                continue;
+            }
+        }
+        if (i < count) {
+            chosen[n] = i;
+            chosen_messages[n] = messages[i];
+            chosen_message_lengths[n] = message_lengths[i];
+            chosen_plaintexts[n] = plaintexts[i];
+            chosen_max_plaintext_lengths[n] = max_plaintext_lengths[i];
+            n++;
+        }
+        if (n == DECRYPT_BATCH_SIZE || (i == count && n)) {
+            failures += olm_group_decrypt_batch(
+                session, n, chosen_messages, chosen_message_lengths,
+                chosen_plaintexts, chosen_max_plaintext_lengths,
+                chosen_plaintext_lengths, chosen_message_indices,
+                chosen_errors
+            );
+            for (j = 0; j < n; j++) {
+                plaintext_lengths[chosen[j]] = chosen_plaintext_lengths[j];
+                if (errors) {
+                    errors[chosen[j]] = chosen_errors[j];
+                }
+            }
+            n = 0;
+        }
+    }
+    return failures;
+}
+
+/** The state of a message of olm_group_decrypt_across_sessions(). The scratch
+ * space is split into five arrays of count entries, and one more entry for
+ * the group starts. */
+struct AcrossSessions {
+    OlmInboundGroupSession * const * sessions;
+    size_t count;
+    uint8_t * const * messages;
+    const size_t * message_lengths;
+    uint8_t * const * plaintexts;
+    const size_t * max_plaintext_lengths;
+    size_t * plaintext_lengths;
+    uint32_t * message_indices;
+    const char ** errors;
+    /** the messages, grouped by session and sorted by index */
+    size_t * order;
+    /** where each session's messages start in order, with an extra entry
+     * for the end. Used as the merge buffer while sorting. */
+    size_t * group_starts;
+    /** the length of each message after base64 decoding */
+    size_t * raw_lengths;
+    /** OLM_SUCCESS for each message whose signature is good, or why it
+     * failed */
+    size_t * states;
+    /** each message's index, counted from its session's first index */
+    size_t * positions;
+};
+
+/** decode and check the signatures of DECRYPT_BATCH_SIZE messages */
+static void _across_sessions_verify_job(void * context, size_t job) {
+    struct AcrossSessions *batch = context;
+    struct _OlmDecodeGroupMessageResults decoded;
+    size_t checked[DECRYPT_BATCH_SIZE];
+    struct _olm_ed25519_public_key keys[DECRYPT_BATCH_SIZE];
+    const uint8_t *signed_parts[DECRYPT_BATCH_SIZE];
+    size_t signed_lengths[DECRYPT_BATCH_SIZE];
+    const uint8_t *signatures[DECRYPT_BATCH_SIZE];
+    uint8_t signature_ok[DECRYPT_BATCH_SIZE];
+    size_t start = job * DECRYPT_BATCH_SIZE;
+    size_t end = start + DECRYPT_BATCH_SIZE;
+    size_t i, k = 0;
+
+    if (end > batch->count) {
+        end = batch->count;
+    }
+    /* the sessions' last_errors are left alone, since other jobs may be
+     * checking messages for the same session */
+    for (i = start; i < end; i++) {
+        enum OlmErrorCode error = OLM_SUCCESS;
+        const OlmInboundGroupSession *session = batch->sessions[i];
+        uint8_t *message = batch->messages[i];
+        size_t raw_length = _olm_decode_base64(
+            message, batch->message_lengths[i], message
+        );
+
+        batch->positions[i] = 0;
+        if (raw_length == (size_t)-1) {
+            batch->states[i] = OLM_INVALID_BASE64;
+            continue;
+        }
+        batch->raw_lengths[i] = raw_length;
+        if (_decode_message(&error, message, raw_length, &decoded)
+                == (size_t)-1) {
+            batch->states[i] = error;
+            continue;
+        }
+        batch->positions[i] =
+            decoded.message_index - session->initial_ratchet.counter;
+        if (batch->message_indices) {
+            batch->message_indices[i] = decoded.message_index;
+        }
+        keys[k] = session->signing_key;
+        signed_parts[k] = message;
+        signed_lengths[k] = raw_length - ED25519_SIGNATURE_LENGTH;
+        signatures[k] = message + signed_lengths[k];
+        checked[k++] = i;
+    }
+    if (!k) {
+        return;
+    }
+    _olm_crypto_ed25519_verify_batch(
+        k, keys, signed_parts, signed_lengths, signatures, signature_ok
+    );
+    for (i = 0; i < k; i++) {
+        batch->states[checked[i]] =
+            signature_ok[i] ? OLM_SUCCESS : OLM_BAD_SIGNATURE;
+    }
+}
+
+/** whether message a of olm_group_decrypt_across_sessions() goes before
+ * message b: by session, then by index, then in the order they were given */
+static int _across_sessions_before(
+    const struct AcrossSessions *batch, size_t a, size_t b
+) {
+    uintptr_t session_a = (uintptr_t)batch->sessions[a];
+    uintptr_t session_b = (uintptr_t)batch->sessions[b];
+    if (session_a != session_b) {
+        return session_a < session_b;
+    }
+    if (batch->positions[a] != batch->positions[b]) {
+        return batch->positions[a] < batch->positions[b];
+    }
+    return a < b;
+}
+
+/** sort the messages into batch->order, with a bottom-up merge sort */
+static void _across_sessions_sort(struct AcrossSessions *batch) {
+    size_t *from = batch->order, *to = batch->group_starts, *swap;
+    size_t width, left, i;
+
+    for (i = 0; i < batch->count; i++) {
+        from[i] = i;
+    }
+    for (width = 1; width < batch->count; width *= 2) {
+        for (left = 0; left < batch->count; left += 2 * width) {
+            size_t middle = left + width, right = left + 2 * width;
+            size_t a = left, b, out = left;
+            if (middle > batch->count) {
+                middle = batch->count;
+            }
+            if (right > batch->count) {
+                right = batch->count;
+            }
+            b = middle;
+            while (a < middle || b < right) {
+                if (b == right || (a < middle
+                        && !_across_sessions_before(batch, from[b], from[a]))) {
+                    to[out++] = from[a++];
+                } else {
+                    to[out++] = from[b++];
+                }
+            }
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != batch->order) {
+        memcpy(batch->order, from, batch->count * sizeof(size_t));
+    }
+}
+
+/** decrypt the messages of one session, in order of index */
+static void _across_sessions_decrypt_job(void * context, size_t job) {
+    struct AcrossSessions *batch = context;
+    struct _OlmDecodeGroupMessageResults decoded;
+    struct BatchRatchet ratchet;
+    size_t j;
+
+    ratchet.valid = 0;
+    ratchet.key_count = 0;
+    for (j = batch->group_starts[job]; j < batch->group_starts[job + 1]; j++) {
+        size_t i = batch->order[j];
+        OlmInboundGroupSession *session = batch->sessions[i];
+        size_t r = (size_t)-1;
+
+        if ((j - batch->group_starts[job]) % OLM_CRYPTO_SHA256_MAX_LANES
+                == 0) {
+            /* derive the keys for the next few good messages at once */
+            uint32_t indices[OLM_CRYPTO_SHA256_MAX_LANES];
+            size_t m, n = 0;
+            for (m = j; m < batch->group_starts[job + 1]
+                    && m < j + OLM_CRYPTO_SHA256_MAX_LANES; m++) {
+                size_t message = batch->order[m];
+                if (batch->states[message] == OLM_SUCCESS) {
+                    _decode_message(
+                        &session->last_error, batch->messages[message],
+                        batch->raw_lengths[message], &decoded
+                    );
+                    indices[n++] = decoded.message_index;
+                }
+            }
+            _batch_derive_keys(session, &ratchet, indices, n);
+        }
+
+        if (batch->states[i] != OLM_SUCCESS) {
+            session->last_error = (enum OlmErrorCode)batch->states[i];
+        } else {
+            _decode_message(
+                &session->last_error, batch->messages[i],
+                batch->raw_lengths[i], &decoded
+            );
+            r = _decrypt_decoded(
+                session, batch->messages[i], batch->raw_lengths[i],
+                &decoded, 1, &ratchet,
+                batch->plaintexts[i], batch->max_plaintext_lengths[i]
+            );
+        }
+        if (r == (size_t)-1) {
+            _batch_failed(
+                session, i, batch->plaintext_lengths, batch->errors
+            );
+        } else {
+            batch->plaintext_lengths[i] = r;
+            if (batch->errors) {
+                batch->errors[i] = _olm_error_to_string(OLM_SUCCESS);
+            }
+        }
+    }
+    _olm_unset(&ratchet, sizeof(ratchet));
+}
+
+/** run jobs on the executor, or here if there isn't one */
+static void _run_jobs(
+    OlmBatchExecutor executor, void * executor_context,
+    OlmBatchJob job, void * job_context, size_t job_count
+) {
+    size_t i;
+    if (executor) {
+        executor(executor_context, job, job_context, job_count);
+    } else {
+        for (i = 0; i < job_count; ++i) {
+            job(job_context, i);
+        }
+    }
 }
 
-size_t olm_pickle_inbound_group_session(
-    OlmInboundGroupSession *session,
-    void const * key, size_t key_length,
-    void * pickled, size_t pickled_length
+size_t olm_group_decrypt_across_sessions_scratch_length(size_t count) {
+    return 5 * count + 1;
+}
+
+size_t olm_group_decrypt_across_sessions(
+    OlmInboundGroupSession * const * sessions, size_t count,
+    uint8_t * const * messages, const size_t * message_lengths,
+    uint8_t * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, uint32_t * message_indices,
+    const char ** errors,
+    size_t * scratch, size_t scratch_length,
+    OlmBatchExecutor executor, void * executor_context
 ) {
-    size_t raw_length = raw_pickle_length(session);
-    uint8_t *pos;
+    struct AcrossSessions batch;
+    size_t groups = 0, failures = 0, i;
 
-    if (pickled_length < _olm_enc_output_length(raw_length)) {
-        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+    if (scratch_length < olm_group_decrypt_across_sessions_scratch_length(
+            count
+    )) {
         return (size_t)-1;
     }
+    batch.sessions = sessions;
+    batch.count = count;
+    batch.messages = messages;
+    batch.message_lengths = message_lengths;
+    batch.plaintexts = plaintexts;
+    batch.max_plaintext_lengths = max_plaintext_lengths;
+    batch.plaintext_lengths = plaintext_lengths;
+    batch.message_indices = message_indices;
+    batch.errors = errors;
+    batch.order = scratch;
+    batch.raw_lengths = scratch + count;
+    batch.states = scratch + 2 * count;
+    batch.positions = scratch + 3 * count;
+    batch.group_starts = scratch + 4 * count;
 
-    pos = _olm_enc_output_pos(pickled, raw_length);
-    pos = _olm_pickle_uint32(pos, PICKLE_VERSION);
-    pos = megolm_pickle(&session->initial_ratchet, pos);
-    pos = megolm_pickle(&session->latest_ratchet, pos);
-    pos = _olm_pickle_ed25519_public_key(pos, &session->signing_key);
-    pos = _olm_pickle_bool(pos, session->signing_key_verified);
-
-    return _olm_enc_output(key, key_length, pickled, raw_length);
-}
+    _run_jobs(
+        executor, executor_context, _across_sessions_verify_job, &batch,
+        (count + DECRYPT_BATCH_SIZE - 1) / DECRYPT_BATCH_SIZE
+    );
 
-size_t olm_unpickle_inbound_group_session(
-    OlmInboundGroupSession *session,
-    void const * key, size_t key_length,
-    void * pickled, size_t pickled_length
-) {
-    const uint8_t *pos;
-    const uint8_t *end;
-    uint32_t pickle_version;
+    _across_sessions_sort(&batch);
+    for (i = 0; i < count; i++) {
+        if (i == 0
+                || sessions[batch.order[i]] != sessions[batch.order[i - 1]]) {
+            batch.group_starts[groups++] = i;
+        }
+    }
+    batch.group_starts[groups] = count;
 
-    size_t raw_length = _olm_enc_input(
-        key, key_length, pickled, pickled_length, &(session->last_error)
+    _run_jobs(
+        executor, executor_context, _across_sessions_decrypt_job, &batch,
+        groups
     );
-    if (raw_length == (size_t)-1) {
-        return raw_length;
-    }
 
-    pos = pickled;
-    end = pos + raw_length;
-    pos = _olm_unpickle_uint32(pos, end, &pickle_version);
-    if (pickle_version < 1 || pickle_version > PICKLE_VERSION) {
-        session->last_error = OLM_UNKNOWN_PICKLE_VERSION;
-        return (size_t)-1;
+    for (i = 0; i < count; i++) {
+        if (plaintext_lengths[i] == (size_t)-1) {
+            failures++;
+        }
     }
-    pos = megolm_unpickle(&session->initial_ratchet, pos, end);
-    pos = megolm_unpickle(&session->latest_ratchet, pos, end);
-    pos = _olm_unpickle_ed25519_public_key(pos, end, &session->signing_key);
+    return failures;
+}
 
-    if (pickle_version == 1) {
-        /* pickle v1 had no signing_key_verified field (all keyshares were
-         * verified at import time) */
-        session->signing_key_verified = 1;
-    } else {
-        pos = _olm_unpickle_bool(pos, end, &(session->signing_key_verified));
-    }
+struct OlmGroupDecryptScratch {
+    /** the session this was last used with, identified by its signing key
+     * and initial ratchet */
+    struct _olm_ed25519_public_key signing_key;
+    Megolm initial_ratchet;
+    /** whether ratchet holds a value for that session */
+    int valid;
+    /** the ratchet for the last message decrypted with this scratch space */
+    Megolm ratchet;
+    /** whether we have decrypted a message for the session */
+    int decrypted;
+    enum OlmErrorCode last_error;
+};
 
-    if (end != pos) {
-        /* We had the wrong number of bytes in the input. */
-        session->last_error = OLM_CORRUPTED_PICKLE;
-        return (size_t)-1;
-    }
+size_t olm_group_decrypt_scratch_size(void) {
+    return sizeof(OlmGroupDecryptScratch);
+}
 
-    return pickled_length;
+OlmGroupDecryptScratch * olm_group_decrypt_scratch(
+    void *memory
+) {
+    OlmGroupDecryptScratch *scratch = memory;
+    olm_clear_group_decrypt_scratch(scratch);
+    return scratch;
 }
 
-/**
- * get the max plaintext length in an un-base64-ed message
- */
-static size_t _decrypt_max_plaintext_length(
-    OlmInboundGroupSession *session,
-    uint8_t * message, size_t message_length
+size_t olm_clear_group_decrypt_scratch(
+    OlmGroupDecryptScratch *scratch
 ) {
-    struct _OlmDecodeGroupMessageResults decoded_results;
+    _olm_unset(scratch, sizeof(OlmGroupDecryptScratch));
+    return sizeof(OlmGroupDecryptScratch);
+}
 
-    _olm_decode_group_message(
-        message, message_length,
-        megolm_cipher->ops->mac_length(megolm_cipher),
-        ED25519_SIGNATURE_LENGTH,
-        &decoded_results);
+const char *olm_group_decrypt_scratch_last_error(
+    const OlmGroupDecryptScratch *scratch
+) {
+    return _olm_error_to_string(scratch->last_error);
+}
 
-    if (decoded_results.version != OLM_PROTOCOL_VERSION) {
-        session->last_error = OLM_BAD_MESSAGE_VERSION;
-        return (size_t)-1;
-    }
+/** was the scratch space last used with this session? */
+static int _scratch_matches(
+    const OlmInboundGroupSession *session,
+    const OlmGroupDecryptScratch *scratch
+) {
+    return memcmp(
+        scratch->signing_key.public_key, session->signing_key.public_key,
+        ED25519_PUBLIC_KEY_LENGTH
+    ) == 0 && memcmp(
+        &scratch->initial_ratchet, &session->initial_ratchet, sizeof(Megolm)
+    ) == 0;
+}
 
-    if (!decoded_results.ciphertext) {
-        session->last_error = OLM_BAD_MESSAGE_FORMAT;
-        return (size_t)-1;
+/** point the scratch space at session, forgetting what it held for any other
+ * session */
+static void _bind_scratch(
+    const OlmInboundGroupSession *session, OlmGroupDecryptScratch *scratch
+) {
+    if (!_scratch_matches(session, scratch)) {
+        _olm_unset(scratch, sizeof(OlmGroupDecryptScratch));
+        scratch->signing_key = session->signing_key;
+        scratch->initial_ratchet = session->initial_ratchet;
     }
-
-    return megolm_cipher->ops->decrypt_max_plaintext_length(
-        megolm_cipher, decoded_results.ciphertext_length);
 }
 
-size_t olm_group_decrypt_max_plaintext_length(
-    OlmInboundGroupSession *session,
-    uint8_t * message, size_t message_length
+/**
+ * Like _get_megolm, but without changing the session: advance a copy of the
+ * latest ratchet, the scratch ratchet, a checkpoint or the initial ratchet,
+ * whichever is closest before message_index, and keep it in the scratch
+ * space.
+ */
+static size_t _get_megolm_readonly(
+    const OlmInboundGroupSession *session, OlmGroupDecryptScratch *scratch,
+    uint32_t message_index, Megolm *result
 ) {
-    size_t raw_length;
+    const Megolm *start;
+    size_t i;
 
-    raw_length = _olm_decode_base64(message, message_length, message);
-    if (raw_length == (size_t)-1) {
-        session->last_error = OLM_INVALID_BASE64;
+    if ((message_index - session->initial_ratchet.counter) >= (1U << 31)) {
+        scratch->last_error = OLM_UNKNOWN_MESSAGE_INDEX;
         return (size_t)-1;
     }
 
-    return _decrypt_max_plaintext_length(
-        session, message, raw_length
-    );
-}
+    start = &session->initial_ratchet;
+#define CLOSER(candidate) \
+    ((message_index - (candidate)->counter) < (message_index - start->counter))
+    if (CLOSER(_latest(session))) {
+        start = _latest(session);
+    }
+    for (i = 0; i < session->checkpoint_count; i++) {
+        if (CLOSER(&_checkpoints(session)[i])) {
+            start = &_checkpoints(session)[i];
+        }
+    }
+    if (scratch->valid && CLOSER(&scratch->ratchet)) {
+        start = &scratch->ratchet;
+    }
+#undef CLOSER
 
-/**
- * get a copy of the megolm ratchet, advanced
- * to the relevant index. Returns 0 on success, -1 on error
- */
-static size_t _get_megolm(
-    OlmInboundGroupSession *session, uint32_t message_index, Megolm *result
-) {
-    /* pick a megolm instance to use. If we're at or beyond the latest ratchet
-     * value, use that */
-    if ((message_index - session->latest_ratchet.counter) < (1U << 31)) {
-        megolm_advance_to(&session->latest_ratchet, message_index);
-        *result = session->latest_ratchet;
-        return 0;
-    } else if ((message_index - session->initial_ratchet.counter) >= (1U << 31)) {
-        /* the counter is before our intial ratchet - we can't decode this. */
-        session->last_error = OLM_UNKNOWN_MESSAGE_INDEX;
+    if (session->max_ratchet_distance
+            && megolm_advance_cost(start->counter, message_index)
+                > session->max_ratchet_distance) {
+        scratch->last_error = OLM_RATCHET_DISTANCE_EXCEEDED;
         return (size_t)-1;
-    } else {
-        /* otherwise, start from the initial megolm. Take a copy so that we
-         * don't overwrite the initial megolm */
-        *result = session->initial_ratchet;
-        megolm_advance_to(result, message_index);
-        return 0;
     }
+
+    if (start != &scratch->ratchet) {
+        scratch->ratchet = *start;
+        scratch->valid = 1;
+    }
+    megolm_advance_to(&scratch->ratchet, message_index);
+    *result = scratch->ratchet;
+    return 0;
 }
 
-/**
- * decrypt an un-base64-ed message
- */
-static size_t _decrypt(
-    OlmInboundGroupSession *session,
+size_t olm_group_decrypt_readonly(
+    const OlmInboundGroupSession *session,
+    OlmGroupDecryptScratch *scratch,
     uint8_t * message, size_t message_length,
     uint8_t * plaintext, size_t max_plaintext_length,
     uint32_t * message_index
 ) {
     struct _OlmDecodeGroupMessageResults decoded_results;
-    size_t max_length, r;
+    size_t raw_message_length, max_length, r;
     Megolm megolm;
 
-    _olm_decode_group_message(
-        message, message_length,
-        megolm_cipher->ops->mac_length(megolm_cipher),
-        ED25519_SIGNATURE_LENGTH,
-        &decoded_results);
+    _bind_scratch(session, scratch);
 
-    if (decoded_results.version != OLM_PROTOCOL_VERSION) {
-        session->last_error = OLM_BAD_MESSAGE_VERSION;
+    raw_message_length = _olm_decode_base64(message, message_length, message);
+    if (raw_message_length == (size_t)-1) {
+        scratch->last_error = OLM_INVALID_BASE64;
         return (size_t)-1;
     }
 
-    if (!decoded_results.has_message_index || !decoded_results.ciphertext) {
-        session->last_error = OLM_BAD_MESSAGE_FORMAT;
+    if (_decode_message(
+        &scratch->last_error, message, raw_message_length, &decoded_results
+    ) == (size_t)-1) {
         return (size_t)-1;
     }
 
@@ -371,77 +3952,75 @@ static size_t _decrypt(
         *message_index = decoded_results.message_index;
     }
 
-    /* verify the signature. We could do this before decoding the message, but
-     * we allow for the possibility of future protocol versions which use a
-     * different signing mechanism; we would rather throw "BAD_MESSAGE_VERSION"
-     * than "BAD_SIGNATURE" in this case.
-     */
-    message_length -= ED25519_SIGNATURE_LENGTH;
-    r = _olm_crypto_ed25519_verify(
-        &session->signing_key,
-        message, message_length,
-        message + message_length
-    );
-    if (!r) {
-        session->last_error = OLM_BAD_SIGNATURE;
+    if (_is_replay(
+            session, decoded_results.message_index, &scratch->last_error
+        )) {
         return (size_t)-1;
     }
 
-    max_length = megolm_cipher->ops->decrypt_max_plaintext_length(
-        megolm_cipher,
+    raw_message_length -= ED25519_SIGNATURE_LENGTH;
+
+    if (!_verify_signature(
+        session,
+        message, raw_message_length,
+        message + raw_message_length
+    )) {
+        scratch->last_error = OLM_BAD_SIGNATURE;
+        return (size_t)-1;
+    }
+
+    max_length = _olm_cipher_aes_sha_256_max_plaintext_length(
         decoded_results.ciphertext_length
     );
     if (max_plaintext_length < max_length) {
-        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        scratch->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
         return (size_t)-1;
     }
 
-    r = _get_megolm(session, decoded_results.message_index, &megolm);
+    r = _get_megolm_readonly(
+        session, scratch, decoded_results.message_index, &megolm
+    );
     if (r == (size_t)-1) {
         return r;
     }
 
-    /* now try checking the mac, and decrypting */
-    r = megolm_cipher->ops->decrypt(
-        megolm_cipher,
+    r = _olm_cipher_aes_sha_256_decrypt(
+        megolm_cipher_aes_sha_256,
         megolm_get_data(&megolm), MEGOLM_RATCHET_LENGTH,
-        message, message_length,
+        message, raw_message_length,
         decoded_results.ciphertext, decoded_results.ciphertext_length,
         plaintext, max_plaintext_length
     );
-
     _olm_unset(&megolm, sizeof(megolm));
+
     if (r == (size_t)-1) {
-        session->last_error = OLM_BAD_MESSAGE_MAC;
+        scratch->last_error = OLM_BAD_MESSAGE_MAC;
         return r;
     }
 
-    /* once we have successfully decrypted a message, set a flag to say the
-     * session appears valid. */
-    session->signing_key_verified = 1;
-
+    scratch->decrypted = 1;
     return r;
 }
 
-size_t olm_group_decrypt(
+size_t olm_inbound_group_session_commit_ratchet(
     OlmInboundGroupSession *session,
-    uint8_t * message, size_t message_length,
-    uint8_t * plaintext, size_t max_plaintext_length,
-    uint32_t * message_index
+    const OlmGroupDecryptScratch *scratch
 ) {
-    size_t raw_message_length;
-
-    raw_message_length = _olm_decode_base64(message, message_length, message);
-    if (raw_message_length == (size_t)-1) {
-        session->last_error = OLM_INVALID_BASE64;
-        return (size_t)-1;
+    if (!_scratch_matches(session, scratch)) {
+        return 0;
     }
 
-    return _decrypt(
-        session, message, raw_message_length,
-        plaintext, max_plaintext_length,
-        message_index
-    );
+    if (scratch->valid) {
+        uint32_t ahead = scratch->ratchet.counter - _latest(session)->counter;
+        if (ahead != 0 && ahead < (1U << 31)
+                && _set_latest(session, &scratch->ratchet) == (size_t)-1) {
+            return (size_t)-1;
+        }
+    }
+    if (scratch->decrypted) {
+        _mark_verified(session);
+    }
+    return 0;
 }
 
 size_t olm_inbound_group_session_id_length(
@@ -464,6 +4043,18 @@ size_t olm_inbound_group_session_id(
     );
 }
 
+size_t olm_inbound_group_session_id_binary(
+    OlmInboundGroupSession *session,
+    uint8_t * id, size_t id_length
+) {
+    if (id_length < GROUP_SESSION_ID_LENGTH) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+    memcpy(id, session->signing_key.public_key, GROUP_SESSION_ID_LENGTH);
+    return GROUP_SESSION_ID_LENGTH;
+}
+
 uint32_t olm_inbound_group_session_first_known_index(
     const OlmInboundGroupSession *session
 ) {
@@ -476,18 +4067,58 @@ int olm_inbound_group_session_is_verified(
     return session->signing_key_verified;
 }
 
+int olm_inbound_group_session_is_dirty(
+    const OlmInboundGroupSession *session
+) {
+    return session->dirty;
+}
+
+void olm_inbound_group_session_clear_dirty(
+    OlmInboundGroupSession *session
+) {
+    session->dirty = 0;
+}
+
 size_t olm_export_inbound_group_session_length(
     const OlmInboundGroupSession *session
 ) {
     return _olm_encode_base64_length(SESSION_EXPORT_RAW_LENGTH);
 }
 
+/** Write the export of the session with the ratchet at message_index to the
+ * end of the encoded_length bytes at key, then encode it in place. */
+static size_t _write_export(
+    const OlmInboundGroupSession *session, const Megolm *megolm,
+    uint32_t message_index, uint8_t * key, size_t encoded_length
+) {
+    uint8_t *raw;
+    uint8_t *ptr;
+
+    /* put the raw data at the end of the output buffer. */
+    raw = ptr = key + encoded_length - SESSION_EXPORT_RAW_LENGTH;
+    *ptr++ = SESSION_EXPORT_VERSION;
+
+    // Encode message index as a big endian 32-bit number.
+    for (unsigned i = 0; i < 4; i++) {
+        *ptr++ = 0xFF & (message_index >> 24); message_index <<= 8;
+    }
+
+    memcpy(ptr, megolm_get_data(megolm), MEGOLM_RATCHET_LENGTH);
+    ptr += MEGOLM_RATCHET_LENGTH;
+
+    memcpy(
+        ptr, session->signing_key.public_key,
+        ED25519_PUBLIC_KEY_LENGTH
+    );
+    ptr += ED25519_PUBLIC_KEY_LENGTH;
+
+    return _olm_encode_base64(raw, SESSION_EXPORT_RAW_LENGTH, key);
+}
+
 size_t olm_export_inbound_group_session(
     OlmInboundGroupSession *session,
     uint8_t * key, size_t key_length, uint32_t message_index
 ) {
-    uint8_t *raw;
-    uint8_t *ptr;
     Megolm megolm;
     size_t r;
     size_t encoded_length = olm_export_inbound_group_session_length(session);
@@ -502,23 +4133,143 @@ size_t olm_export_inbound_group_session(
         return r;
     }
 
-    /* put the raw data at the end of the output buffer. */
-    raw = ptr = key + encoded_length - SESSION_EXPORT_RAW_LENGTH;
-    *ptr++ = SESSION_EXPORT_VERSION;
+    r = _write_export(session, &megolm, message_index, key, encoded_length);
+    _olm_unset(&megolm, sizeof(megolm));
+    return r;
+}
 
-    // Encode message index as a big endian 32-bit number.
-    for (unsigned i = 0; i < 4; i++) {
-        *ptr++ = 0xFF & (message_index >> 24); message_index <<= 8;
-    }
+size_t olm_export_inbound_group_session_batch_length(
+    size_t count
+) {
+    return count * _olm_encode_base64_length(SESSION_EXPORT_RAW_LENGTH);
+}
 
-    memcpy(ptr, megolm_get_data(&megolm), MEGOLM_RATCHET_LENGTH);
-    ptr += MEGOLM_RATCHET_LENGTH;
+/* the number of exports olm_export_inbound_group_session_batch advances
+ * together */
+#define EXPORT_BATCH_SIZE 64
 
-    memcpy(
-        ptr, session->signing_key.public_key,
-        ED25519_PUBLIC_KEY_LENGTH
+/** The exports of a batch which only need their sessions' latest ratchets
+ * moving on, waiting to be advanced together */
+struct PendingExports {
+    size_t count;
+    size_t indices[EXPORT_BATCH_SIZE];
+    Megolm *ratchets[EXPORT_BATCH_SIZE];
+    uint32_t message_indices[EXPORT_BATCH_SIZE];
+};
+
+static int _export_pending(
+    const struct PendingExports *pending,
+    const OlmInboundGroupSession *session
+) {
+    size_t i;
+    for (i = 0; i < pending->count; ++i) {
+        if (pending->ratchets[i] == _latest(session)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** Advance the pending ratchets and write their exports */
+static void _flush_exports(
+    struct PendingExports *pending,
+    OlmInboundGroupSession * const * sessions,
+    uint8_t * keys, size_t encoded_length, const char ** errors
+) {
+    size_t i;
+    megolm_advance_to_batch(
+        pending->ratchets, pending->message_indices, pending->count
     );
-    ptr += ED25519_PUBLIC_KEY_LENGTH;
+    for (i = 0; i < pending->count; ++i) {
+        size_t j = pending->indices[i];
+        _write_export(
+            sessions[j], pending->ratchets[i], pending->message_indices[i],
+            keys + j * encoded_length, encoded_length
+        );
+        if (errors) {
+            errors[j] = _olm_error_to_string(OLM_SUCCESS);
+        }
+    }
+    pending->count = 0;
+}
 
-    return _olm_encode_base64(raw, SESSION_EXPORT_RAW_LENGTH, key);
+size_t olm_export_inbound_group_session_batch(
+    OlmInboundGroupSession * const * sessions,
+    const uint32_t * message_indices, size_t count,
+    uint8_t * keys, size_t keys_length,
+    const char ** errors
+) {
+    size_t encoded_length = _olm_encode_base64_length(SESSION_EXPORT_RAW_LENGTH);
+    struct PendingExports pending;
+    struct BatchRatchet batch;
+    Megolm megolm;
+    size_t failures = 0;
+    size_t i;
+
+    if (keys_length < olm_export_inbound_group_session_batch_length(count)) {
+        if (count) {
+            sessions[0]->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        }
+        return (size_t)-1;
+    }
+
+    pending.count = 0;
+    batch.valid = 0;
+    batch.key_count = 0;
+    for (i = 0; i < count; ++i) {
+        OlmInboundGroupSession *session = sessions[i];
+        uint8_t *key = keys + i * encoded_length;
+        int pending_session = _export_pending(&pending, session);
+
+        /* carry on from the previous export of the same session */
+        if (i && session != sessions[i - 1]) {
+            batch.valid = 0;
+        }
+        /* exports at or after the latest ratchet of a session move it on,
+         * just as _get_megolm would, so those of different sessions can be
+         * advanced side by side */
+        if ((message_indices[i] - _latest(session)->counter)
+                < (1U << 31)) {
+            Megolm *latest = _latest_to_advance(session, message_indices[i]);
+            if (!latest) {
+                memset(key, 0, encoded_length);
+                if (errors) {
+                    errors[i] = _olm_error_to_string(session->last_error);
+                }
+                failures++;
+                continue;
+            }
+            if (pending_session || pending.count == EXPORT_BATCH_SIZE) {
+                _flush_exports(
+                    &pending, sessions, keys, encoded_length, errors
+                );
+            }
+            pending.indices[pending.count] = i;
+            pending.ratchets[pending.count] = latest;
+            pending.message_indices[pending.count] = message_indices[i];
+            pending.count++;
+            continue;
+        }
+        if (pending_session) {
+            _flush_exports(&pending, sessions, keys, encoded_length, errors);
+        }
+        if (_get_megolm_for_batch(
+                session, message_indices[i], &batch, &megolm
+            ) == (size_t)-1) {
+            memset(key, 0, encoded_length);
+            if (errors) {
+                errors[i] = _olm_error_to_string(session->last_error);
+            }
+            failures++;
+            continue;
+        }
+        _write_export(session, &megolm, message_indices[i], key, encoded_length);
+        if (errors) {
+            errors[i] = _olm_error_to_string(OLM_SUCCESS);
+        }
+    }
+    _flush_exports(&pending, sessions, keys, encoded_length, errors);
+    _olm_unset(&batch, sizeof(batch));
+    _olm_unset(&megolm, sizeof(megolm));
+    return failures;
 }
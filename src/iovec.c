@@ -0,0 +1,128 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/iovec_internal.h"
+#include "olm/memory.h"
+
+#include <string.h>
+
+size_t _olm_iovec_length(const OlmIovec * segments, size_t count) {
+    size_t length = 0;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        length += segments[i].length;
+    }
+    return length;
+}
+
+void _olm_iovec_cursor_init(
+    struct _olm_iovec_cursor *cursor,
+    const OlmIovec * segments, size_t count
+) {
+    cursor->segments = segments;
+    cursor->count = count;
+    cursor->offset = 0;
+}
+
+uint8_t * _olm_iovec_cursor_peek(
+    struct _olm_iovec_cursor *cursor, size_t *length
+) {
+    while (cursor->count && cursor->offset == cursor->segments->length) {
+        cursor->segments++;
+        cursor->count--;
+        cursor->offset = 0;
+    }
+    if (!cursor->count) {
+        *length = 0;
+        return NULL;
+    }
+    *length = cursor->segments->length - cursor->offset;
+    return (uint8_t *)cursor->segments->base + cursor->offset;
+}
+
+void _olm_iovec_cursor_skip(struct _olm_iovec_cursor *cursor, size_t length) {
+    while (length) {
+        size_t available;
+        _olm_iovec_cursor_peek(cursor, &available);
+        if (!available) {
+            return;
+        }
+        if (available > length) {
+            available = length;
+        }
+        cursor->offset += available;
+        length -= available;
+    }
+}
+
+void _olm_iovec_cursor_read(
+    struct _olm_iovec_cursor *cursor,
+    uint8_t * output, size_t length
+) {
+    while (length) {
+        size_t available;
+        const uint8_t *pos = _olm_iovec_cursor_peek(cursor, &available);
+        if (!available) {
+            return;
+        }
+        if (available > length) {
+            available = length;
+        }
+        memcpy(output, pos, available);
+        cursor->offset += available;
+        output += available;
+        length -= available;
+    }
+}
+
+void _olm_iovec_cursor_write(
+    struct _olm_iovec_cursor *cursor,
+    uint8_t const * input, size_t length
+) {
+    while (length) {
+        size_t available;
+        uint8_t *pos = _olm_iovec_cursor_peek(cursor, &available);
+        if (!available) {
+            return;
+        }
+        if (available > length) {
+            available = length;
+        }
+        memcpy(pos, input, available);
+        cursor->offset += available;
+        input += available;
+        length -= available;
+    }
+}
+
+void _olm_iovec_unset(
+    const OlmIovec * segments, size_t count, size_t length
+) {
+    struct _olm_iovec_cursor cursor;
+    _olm_iovec_cursor_init(&cursor, segments, count);
+    while (length) {
+        size_t available;
+        uint8_t *pos = _olm_iovec_cursor_peek(&cursor, &available);
+        if (!available) {
+            return;
+        }
+        if (available > length) {
+            available = length;
+        }
+        _olm_unset(pos, available);
+        cursor.offset += available;
+        length -= available;
+    }
+}
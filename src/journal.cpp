@@ -0,0 +1,565 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/journal.h"
+#include "olm/crypto.h"
+#include "olm/error.h"
+#include "olm/memory.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <thread>
+
+namespace {
+
+static const std::uint8_t KDF_INFO[] = "Journal";
+
+/**
+ * A record is its length, its type, the length of its session ID, the ID,
+ * the data, then a MAC of the rest of the record along with the generation
+ * of the log and where the record is in it.
+ */
+static const std::size_t LENGTH_LENGTH = 4;
+static const std::size_t RECORD_HEADER_LENGTH = LENGTH_LENGTH + 1 + 4;
+static const std::size_t RECORD_MAC_LENGTH = 16;
+
+/** The top bit of Journal::state says which buffer is taking records */
+static const std::uint64_t STATE_BUFFER = std::uint64_t(1) << 63;
+
+/**
+ * Records are appended to one of two buffers while the other is being
+ * committed. An append reserves its space by moving on the reserved length
+ * in state, writes its record, then adds its length to written, so a commit
+ * switches state to the other buffer and waits until everything reserved
+ * in the old one has been written.
+ */
+struct Journal {
+    std::atomic<std::uint64_t> state;
+    std::atomic<std::size_t> written[2];
+    std::atomic<bool> failed;
+    std::atomic<OlmErrorCode> last_error;
+    /** where in the log each buffer starts. A buffer's is only changed when
+     * nothing is appending to it */
+    std::size_t base[2];
+    std::uint64_t generation;
+    std::size_t buffer_length;
+    std::uint8_t * buffers[2];
+    OlmJournalWriter writer;
+    void * writer_context;
+    _olm_hmac_sha256_key mac_key;
+};
+
+/** One record in a log being compacted */
+struct Entry {
+    std::size_t offset;
+    std::size_t length;
+    std::uint8_t const * id;
+    std::size_t id_length;
+    unsigned type;
+};
+
+/** A record read from a log */
+struct Record {
+    std::size_t length;
+    unsigned type;
+    std::uint8_t const * id;
+    std::size_t id_length;
+    std::uint8_t const * data;
+    std::size_t data_length;
+};
+
+/** Round a length up so that what follows it is suitably aligned. */
+static constexpr std::size_t aligned(std::size_t length) {
+    return (length + 15) & ~std::size_t(15);
+}
+
+static OlmJournal * to_c(Journal * journal) {
+    return reinterpret_cast<OlmJournal *>(journal);
+}
+
+static Journal * from_c(OlmJournal * journal) {
+    return reinterpret_cast<Journal *>(journal);
+}
+
+static Journal const * from_c(OlmJournal const * journal) {
+    return reinterpret_cast<Journal const *>(journal);
+}
+
+static std::uint8_t * encode_uint32(std::uint8_t * pos, std::uint32_t value) {
+    for (unsigned i = 4; i--;) {
+        *pos++ = std::uint8_t(value >> (8 * i));
+    }
+    return pos;
+}
+
+static std::uint32_t decode_uint32(std::uint8_t const * pos) {
+    std::uint32_t value = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        value = (value << 8) | pos[i];
+    }
+    return value;
+}
+
+static void derive_key(
+    void const * key, std::size_t key_length,
+    _olm_hmac_sha256_key & mac_key
+) {
+    std::uint8_t derived[SHA256_OUTPUT_LENGTH];
+    _olm_crypto_hkdf_sha256(
+        reinterpret_cast<std::uint8_t const *>(key), key_length,
+        nullptr, 0,
+        KDF_INFO, sizeof(KDF_INFO) - 1,
+        derived, sizeof(derived)
+    );
+    _olm_crypto_hmac_sha256_init_key(&mac_key, derived, sizeof(derived));
+    olm::unset(derived);
+}
+
+/** The MAC of the length bytes of a record before its MAC, as the record at
+ * position in a log of the given generation */
+static void record_mac(
+    _olm_hmac_sha256_key const & mac_key,
+    std::uint64_t generation, std::size_t position,
+    std::uint8_t const * record, std::size_t length,
+    std::uint8_t * mac
+) {
+    std::uint8_t where[16];
+    std::uint64_t position64 = position;
+    encode_uint32(where, std::uint32_t(generation >> 32));
+    encode_uint32(where + 4, std::uint32_t(generation));
+    encode_uint32(where + 8, std::uint32_t(position64 >> 32));
+    encode_uint32(where + 12, std::uint32_t(position64));
+
+    _olm_hmac_sha256_context context;
+    std::uint8_t full_mac[SHA256_OUTPUT_LENGTH];
+    _olm_crypto_hmac_sha256_begin(&mac_key, &context);
+    _olm_crypto_hmac_sha256_update(&context, where, sizeof(where));
+    _olm_crypto_hmac_sha256_update(&context, record, length);
+    _olm_crypto_hmac_sha256_end(&mac_key, &context, full_mac);
+    std::memcpy(mac, full_mac, RECORD_MAC_LENGTH);
+    olm::unset(full_mac);
+}
+
+/** Sign a record which has been written or copied to position */
+static void stamp_record(
+    _olm_hmac_sha256_key const & mac_key,
+    std::uint64_t generation, std::size_t position,
+    std::uint8_t * record, std::size_t length
+) {
+    record_mac(
+        mac_key, generation, position,
+        record, length - RECORD_MAC_LENGTH,
+        record + length - RECORD_MAC_LENGTH
+    );
+}
+
+/** Split up the record at pos, without checking its MAC. Returns false if
+ * there isn't a whole record before end. */
+static bool parse_record(
+    std::uint8_t const * pos, std::uint8_t const * end, Record & record
+) {
+    std::size_t available = end - pos;
+    if (available < RECORD_HEADER_LENGTH + RECORD_MAC_LENGTH) {
+        return false;
+    }
+    record.length = decode_uint32(pos);
+    record.type = pos[LENGTH_LENGTH];
+    record.id_length = decode_uint32(pos + LENGTH_LENGTH + 1);
+    if (record.length < RECORD_HEADER_LENGTH + RECORD_MAC_LENGTH
+            || record.length > available
+            || record.id_length
+                > record.length - RECORD_HEADER_LENGTH - RECORD_MAC_LENGTH) {
+        return false;
+    }
+    record.id = pos + RECORD_HEADER_LENGTH;
+    record.data = record.id + record.id_length;
+    record.data_length = record.length - RECORD_HEADER_LENGTH
+        - RECORD_MAC_LENGTH - record.id_length;
+    return true;
+}
+
+/** As parse_record, but also checks the record's MAC for position */
+static bool read_record(
+    _olm_hmac_sha256_key const & mac_key,
+    std::uint64_t generation, std::size_t position,
+    std::uint8_t const * pos, std::uint8_t const * end, Record & record
+) {
+    if (!parse_record(pos, end, record)) {
+        return false;
+    }
+    std::uint8_t mac[RECORD_MAC_LENGTH];
+    record_mac(
+        mac_key, generation, position,
+        pos, record.length - RECORD_MAC_LENGTH, mac
+    );
+    return olm::is_equal(
+        mac, pos + record.length - RECORD_MAC_LENGTH, RECORD_MAC_LENGTH
+    );
+}
+
+static std::size_t record_length(
+    std::size_t id_length, std::size_t data_length
+) {
+    return RECORD_HEADER_LENGTH + id_length + data_length
+        + RECORD_MAC_LENGTH;
+}
+
+static bool id_less(Entry const & a, Entry const & b) {
+    int order = std::memcmp(a.id, b.id, std::min(a.id_length, b.id_length));
+    return order < 0 || (order == 0 && a.id_length < b.id_length);
+}
+
+static bool id_equal(Entry const & a, Entry const & b) {
+    return a.id_length == b.id_length
+        && std::memcmp(a.id, b.id, a.id_length) == 0;
+}
+
+} // namespace
+
+
+extern "C" {
+
+size_t olm_journal_record_length(
+    size_t id_length, size_t data_length
+) {
+    return record_length(id_length, data_length);
+}
+
+
+size_t olm_journal_size(
+    size_t buffer_length
+) {
+    return aligned(sizeof(Journal)) + 2 * aligned(buffer_length);
+}
+
+
+OlmJournal * olm_journal(
+    void * memory, size_t buffer_length,
+    void const * key, size_t key_length,
+    uint64_t generation, size_t position,
+    OlmJournalWriter writer, void * writer_context
+) {
+    std::uint8_t * pos = reinterpret_cast<std::uint8_t *>(memory);
+    olm::unset(pos, olm_journal_size(buffer_length));
+    Journal * journal = new(pos) Journal;
+    pos += aligned(sizeof(Journal));
+
+    journal->state.store(0, std::memory_order_relaxed);
+    journal->written[0].store(0, std::memory_order_relaxed);
+    journal->written[1].store(0, std::memory_order_relaxed);
+    journal->failed.store(false, std::memory_order_relaxed);
+    journal->last_error.store(
+        OlmErrorCode::OLM_SUCCESS, std::memory_order_relaxed
+    );
+    journal->base[0] = position;
+    journal->base[1] = position;
+    journal->generation = generation;
+    journal->buffer_length = buffer_length;
+    journal->buffers[0] = pos;
+    journal->buffers[1] = pos + aligned(buffer_length);
+    journal->writer = writer;
+    journal->writer_context = writer_context;
+    derive_key(key, key_length, journal->mac_key);
+    return to_c(journal);
+}
+
+
+const char * olm_journal_last_error(
+    const OlmJournal * journal
+) {
+    return _olm_error_to_string(
+        from_c(journal)->last_error.load(std::memory_order_relaxed)
+    );
+}
+
+
+size_t olm_clear_journal(
+    OlmJournal * journal
+) {
+    std::size_t size = olm_journal_size(from_c(journal)->buffer_length);
+    from_c(journal)->~Journal();
+    olm::unset(journal, size);
+    return size;
+}
+
+
+size_t olm_journal_append(
+    OlmJournal * journal, unsigned type,
+    void const * id, size_t id_length,
+    void const * data, size_t data_length
+) {
+    Journal & object = *from_c(journal);
+    std::size_t length = record_length(id_length, data_length);
+
+    if (object.failed.load(std::memory_order_acquire)) {
+        object.last_error.store(
+            OlmErrorCode::OLM_JOURNAL_WRITE_FAILED, std::memory_order_relaxed
+        );
+        return std::size_t(-1);
+    }
+    if (length > object.buffer_length || length > 0xFFFFFFFF) {
+        object.last_error.store(
+            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL,
+            std::memory_order_relaxed
+        );
+        return std::size_t(-1);
+    }
+
+    /* reserve room in whichever buffer is taking records */
+    std::uint64_t state = object.state.load(std::memory_order_relaxed);
+    std::size_t offset;
+    do {
+        offset = std::size_t(state & ~STATE_BUFFER);
+        if (offset + length > object.buffer_length) {
+            object.last_error.store(
+                OlmErrorCode::OLM_JOURNAL_FULL, std::memory_order_relaxed
+            );
+            return std::size_t(-1);
+        }
+    } while (!object.state.compare_exchange_weak(
+        state, state + length,
+        std::memory_order_acquire, std::memory_order_relaxed
+    ));
+    unsigned buffer = unsigned(state >> 63);
+    std::size_t position = object.base[buffer] + offset;
+
+    std::uint8_t * record = object.buffers[buffer] + offset;
+    std::uint8_t * pos = encode_uint32(record, std::uint32_t(length));
+    *pos++ = std::uint8_t(type);
+    pos = encode_uint32(pos, std::uint32_t(id_length));
+    std::memcpy(pos, id, id_length);
+    pos += id_length;
+    std::memcpy(pos, data, data_length);
+    stamp_record(object.mac_key, object.generation, position, record, length);
+
+    object.written[buffer].fetch_add(length, std::memory_order_release);
+    return position;
+}
+
+
+size_t olm_journal_pending(
+    const OlmJournal * journal
+) {
+    return std::size_t(
+        from_c(journal)->state.load(std::memory_order_relaxed) & ~STATE_BUFFER
+    );
+}
+
+
+size_t olm_journal_commit(
+    OlmJournal * journal
+) {
+    Journal & object = *from_c(journal);
+
+    if (object.failed.load(std::memory_order_acquire)) {
+        object.last_error.store(
+            OlmErrorCode::OLM_JOURNAL_WRITE_FAILED, std::memory_order_relaxed
+        );
+        return std::size_t(-1);
+    }
+
+    /* send new records to the other buffer, which starts where everything
+     * reserved in this one ends */
+    std::uint64_t state = object.state.load(std::memory_order_relaxed);
+    unsigned buffer;
+    std::size_t reserved;
+    do {
+        buffer = unsigned(state >> 63);
+        reserved = std::size_t(state & ~STATE_BUFFER);
+        object.base[buffer ^ 1] = object.base[buffer] + reserved;
+    } while (!object.state.compare_exchange_weak(
+        state, std::uint64_t(buffer ^ 1) << 63,
+        std::memory_order_acq_rel, std::memory_order_relaxed
+    ));
+
+    /* wait for the appends which had already reserved room to finish */
+    while (object.written[buffer].load(std::memory_order_acquire) < reserved) {
+        std::this_thread::yield();
+    }
+
+    if (reserved && object.writer(
+            object.writer_context, object.buffers[buffer], reserved
+        ) != 0) {
+        object.failed.store(true, std::memory_order_release);
+        object.last_error.store(
+            OlmErrorCode::OLM_JOURNAL_WRITE_FAILED, std::memory_order_relaxed
+        );
+        return std::size_t(-1);
+    }
+    olm::unset(object.buffers[buffer], reserved);
+    object.written[buffer].store(0, std::memory_order_relaxed);
+    return object.base[buffer ^ 1];
+}
+
+
+size_t olm_journal_restart(
+    OlmJournal * journal,
+    uint64_t generation, size_t position,
+    OlmJournalWriter writer, void * writer_context
+) {
+    Journal & object = *from_c(journal);
+    std::uint64_t state = object.state.load(std::memory_order_acquire);
+    unsigned buffer = unsigned(state >> 63);
+    std::size_t reserved = std::size_t(state & ~STATE_BUFFER);
+
+    object.generation = generation;
+    object.base[buffer] = position;
+    object.writer = writer;
+    object.writer_context = writer_context;
+    object.failed.store(false, std::memory_order_relaxed);
+
+    /* sign the waiting records again for where they now go */
+    std::uint8_t * pos = object.buffers[buffer];
+    std::uint8_t * end = pos + reserved;
+    Record record;
+    while (parse_record(pos, end, record)) {
+        stamp_record(
+            object.mac_key, generation,
+            position + (pos - object.buffers[buffer]), pos, record.length
+        );
+        pos += record.length;
+    }
+    return reserved;
+}
+
+
+size_t olm_journal_replay(
+    void const * key, size_t key_length,
+    uint64_t generation, size_t position,
+    void const * log, size_t log_length,
+    OlmJournalVisitor visitor, void * context
+) {
+    _olm_hmac_sha256_key mac_key;
+    derive_key(key, key_length, mac_key);
+
+    std::uint8_t const * start = reinterpret_cast<std::uint8_t const *>(log);
+    std::uint8_t const * pos = start;
+    std::uint8_t const * end = start + log_length;
+    Record record;
+    while (read_record(
+        mac_key, generation, position + (pos - start), pos, end, record
+    )) {
+        visitor(
+            context, record.type,
+            record.id, record.id_length, record.data, record.data_length
+        );
+        pos += record.length;
+    }
+    olm::unset(mac_key);
+    return position + (pos - start);
+}
+
+
+size_t olm_journal_compact_scratch_length(
+    void const * log, size_t log_length
+) {
+    std::uint8_t const * pos = reinterpret_cast<std::uint8_t const *>(log);
+    std::uint8_t const * end = pos + log_length;
+    std::size_t count = 0;
+    Record record;
+    while (parse_record(pos, end, record)) {
+        ++count;
+        pos += record.length;
+    }
+    return count * sizeof(Entry) + alignof(Entry) - 1;
+}
+
+
+size_t olm_journal_compact(
+    void const * key, size_t key_length,
+    uint64_t generation, size_t position,
+    void const * log, size_t log_length,
+    uint64_t new_generation, size_t new_position,
+    void * output, size_t output_length,
+    void * scratch, size_t scratch_length
+) {
+    if (output_length < log_length
+            || !std::align(alignof(Entry), 0, scratch, scratch_length)) {
+        return std::size_t(-1);
+    }
+    Entry * entries = reinterpret_cast<Entry *>(scratch);
+    std::size_t capacity = scratch_length / sizeof(Entry);
+
+    _olm_hmac_sha256_key mac_key;
+    derive_key(key, key_length, mac_key);
+
+    /* find the good records */
+    std::uint8_t const * start = reinterpret_cast<std::uint8_t const *>(log);
+    std::uint8_t const * pos = start;
+    std::uint8_t const * end = start + log_length;
+    std::size_t count = 0;
+    Record record;
+    while (read_record(
+        mac_key, generation, position + (pos - start), pos, end, record
+    )) {
+        if (count == capacity) {
+            olm::unset(mac_key);
+            return std::size_t(-1);
+        }
+        Entry & entry = entries[count++];
+        entry.offset = pos - start;
+        entry.length = record.length;
+        entry.id = record.id;
+        entry.id_length = record.id_length;
+        entry.type = record.type;
+        pos += record.length;
+    }
+
+    /* group them by session, keeping each session's in order */
+    std::stable_sort(entries, entries + count, id_less);
+
+    std::uint8_t * out = reinterpret_cast<std::uint8_t *>(output);
+    std::size_t written = 0;
+    std::size_t group = 0;
+    while (group < count) {
+        std::size_t group_end = group + 1;
+        while (group_end < count
+                && id_equal(entries[group], entries[group_end])) {
+            ++group_end;
+        }
+
+        /* everything before the last snapshot or removal can go */
+        std::size_t first = group;
+        for (std::size_t i = group; i < group_end; ++i) {
+            if (entries[i].type == OLM_JOURNAL_SNAPSHOT
+                    || entries[i].type == OLM_JOURNAL_REMOVE) {
+                first = i;
+            }
+        }
+        if (entries[first].type == OLM_JOURNAL_REMOVE && new_position == 0) {
+            ++first;
+        }
+
+        for (std::size_t i = first; i < group_end; ++i) {
+            std::memcpy(
+                out + written, start + entries[i].offset, entries[i].length
+            );
+            stamp_record(
+                mac_key, new_generation, new_position + written,
+                out + written, entries[i].length
+            );
+            written += entries[i].length;
+        }
+        group = group_end;
+    }
+
+    olm::unset(entries, count * sizeof(Entry));
+    olm::unset(mac_key);
+    return written;
+}
+
+}
@@ -20,11 +20,16 @@
 
 #include "olm/cipher.h"
 #include "olm/crypto.h"
+#include "olm/memory.h"
 #include "olm/pickle.h"
+#include "olm/probes.h"
+#include "olm/stats_internal.h"
+#include "olm/trace_internal.h"
 
 static const struct _olm_cipher_aes_sha_256 MEGOLM_CIPHER =
     OLM_CIPHER_INIT_AES_SHA_256("MEGOLM_KEYS");
 const struct _olm_cipher *megolm_cipher = OLM_CIPHER_BASE(&MEGOLM_CIPHER);
+const struct _olm_cipher_aes_sha_256 *megolm_cipher_aes_sha_256 = &MEGOLM_CIPHER;
 
 /* the seeds used in the HMAC-SHA-256 functions for each part of the ratchet.
  */
@@ -40,6 +45,7 @@ static void rehash_part(
     uint8_t data[MEGOLM_RATCHET_PARTS][MEGOLM_RATCHET_PART_LENGTH],
     int rehash_from_part, int rehash_to_part
 ) {
+    OLM_STATS_ADD(megolm_rehashes, 1);
     _olm_crypto_hmac_sha256(
         data[rehash_from_part],
         MEGOLM_RATCHET_PART_LENGTH,
@@ -48,6 +54,34 @@ static void rehash_part(
     );
 }
 
+/* update R(from)...R(to) based on R(from). The HMAC key is the same for each
+ * of them, so we only prepare it once, and the hashes are independent so
+ * can be computed side by side. */
+static void rehash_parts(
+    uint8_t data[MEGOLM_RATCHET_PARTS][MEGOLM_RATCHET_PART_LENGTH],
+    int rehash_from_part, int rehash_to_part
+) {
+    struct _olm_hmac_sha256_key hmac_key;
+    uint8_t const * seeds[MEGOLM_RATCHET_PARTS];
+    uint8_t * parts[MEGOLM_RATCHET_PARTS];
+    int count = 0;
+    int i;
+
+    _olm_crypto_hmac_sha256_init_key(
+        &hmac_key, data[rehash_from_part], MEGOLM_RATCHET_PART_LENGTH
+    );
+    for (i = rehash_from_part; i <= rehash_to_part; i++) {
+        seeds[count] = HASH_KEY_SEEDS[i];
+        parts[count] = data[i];
+        count++;
+    }
+    OLM_STATS_ADD(megolm_rehashes, count);
+    _olm_crypto_hmac_sha256_with_key_multi(
+        &hmac_key, seeds, HASH_KEY_SEED_LENGTH, parts, count
+    );
+    _olm_unset(&hmac_key, sizeof(hmac_key));
+}
+
 
 
 void megolm_init(Megolm *megolm, uint8_t const *random_data, uint32_t counter) {
@@ -81,7 +115,7 @@ const uint8_t * megolm_unpickle(Megolm *megolm, const uint8_t *pos,
 void megolm_advance(Megolm *megolm) {
     uint32_t mask = 0x00FFFFFF;
     int h = 0;
-    int i;
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_MEGOLM_ADVANCE);
 
     megolm->counter++;
 
@@ -94,57 +128,224 @@ void megolm_advance(Megolm *megolm) {
     }
 
     /* now update R(h)...R(3) based on R(h) */
-    for (i = MEGOLM_RATCHET_PARTS-1; i >= h; i--) {
-        rehash_part(megolm->data, h, i);
-    }
+    rehash_parts(megolm->data, h, MEGOLM_RATCHET_PARTS - 1);
+    OLM_TRACE_END(trace, OLM_TRACE_MEGOLM_ADVANCE);
 }
 
-void megolm_advance_to(Megolm *megolm, uint32_t advance_to) {
+/* work out how many times megolm_advance_to needs to update each part of the
+ * ratchet to get from counter to advance_to, starting with R0. Once a part
+ * has been updated, the counter below it is zero, so this only depends on the
+ * counters, not the hashes. Returns the new counter. */
+static uint32_t advance_steps(
+    uint32_t counter, uint32_t advance_to,
+    unsigned int steps[MEGOLM_RATCHET_PARTS]
+) {
     int j;
-
-    /* starting with R0, see if we need to update each part of the hash */
     for (j = 0; j < (int)MEGOLM_RATCHET_PARTS; j++) {
         int shift = (MEGOLM_RATCHET_PARTS-j-1) * 8;
         uint32_t mask = (~(uint32_t)0) << shift;
-        int k;
 
-        /* how many times do we need to rehash this part?
-         *
-         * '& 0xff' ensures we handle integer wraparound correctly
-         */
-        unsigned int steps =
-            ((advance_to >> shift) - (megolm->counter >> shift)) & 0xff;
+        /* '& 0xff' ensures we handle integer wraparound correctly */
+        steps[j] = ((advance_to >> shift) - (counter >> shift)) & 0xff;
 
-        if (steps == 0) {
+        if (steps[j] == 0) {
             /* deal with the edge case where megolm->counter is slightly larger
              * than advance_to. This should only happen for R(0), and implies
              * that advance_to has wrapped around and we need to advance R(0)
              * 256 times.
              */
-            if (advance_to < megolm->counter) {
-                steps = 0x100;
+            if (advance_to < counter) {
+                steps[j] = 0x100;
             } else {
                 continue;
             }
         }
+        counter = advance_to & mask;
+    }
+    return counter;
+}
+
+/* on the last update of R(j) we also need to bump the parts below it, but
+ * only down to the next one which is going to be updated again: the parts
+ * below that will be derived from it instead. Returns the last part to bump.
+ */
+static int last_part_to_bump(
+    unsigned int const steps[MEGOLM_RATCHET_PARTS], int j
+) {
+    int next = j + 1;
+    if (next == (int)MEGOLM_RATCHET_PARTS) {
+        return j;
+    }
+    while (next < (int)MEGOLM_RATCHET_PARTS - 1 && steps[next] == 0) {
+        next++;
+    }
+    return next;
+}
+
+void megolm_advance_to(Megolm *megolm, uint32_t advance_to) {
+    unsigned int steps[MEGOLM_RATCHET_PARTS];
+    uint32_t counter;
+    int j;
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_MEGOLM_ADVANCE);
+    OLM_PROBE2(megolm_advance_entry, megolm->counter, advance_to);
+
+    counter = advance_steps(megolm->counter, advance_to, steps);
+
+    for (j = 0; j < (int)MEGOLM_RATCHET_PARTS; j++) {
+        if (steps[j] == 0) {
+            continue;
+        }
 
         /* for all but the last step, we can just bump R(j) without regard
          * to R(j+1)...R(3).
          */
-        while (steps > 1) {
+        while (steps[j] > 1) {
             rehash_part(megolm->data, j, j);
-            steps --;
+            steps[j]--;
         }
 
-        /* on the last step we also need to bump R(j+1)...R(3).
-         *
-         * (Theoretically, we could skip bumping R(j+2) if we're going to bump
-         * R(j+1) again, but the code to figure that out is a bit baroque and
-         * doesn't save us much).
-         */
-        for (k = 3; k >= j; k--) {
-            rehash_part(megolm->data, j, k);
+        rehash_parts(megolm->data, j, last_part_to_bump(steps, j));
+    }
+    /* the number of messages moved past, as the counter wraps */
+    OLM_PROBE2(megolm_advance_return, counter, counter - megolm->counter);
+    megolm->counter = counter;
+    OLM_TRACE_END(trace, OLM_TRACE_MEGOLM_ADVANCE);
+}
+
+/* the most lanes _olm_crypto_hmac_sha256_many_keys runs at once */
+#define ADVANCE_LANES OLM_CRYPTO_SHA256_MAX_LANES
+
+/* one ratchet of megolm_advance_to_batch, advanced one HMAC at a time */
+struct AdvanceLane {
+    Megolm *megolm;
+    unsigned int steps[MEGOLM_RATCHET_PARTS];
+    uint32_t counter;
+    /* the part being advanced */
+    int part;
+    /* the next part to derive from it on its last step, or -1 */
+    int bump;
+};
+
+static void start_lane(
+    struct AdvanceLane *lane, Megolm *megolm, uint32_t advance_to
+) {
+    lane->megolm = megolm;
+    lane->counter = advance_steps(megolm->counter, advance_to, lane->steps);
+    lane->part = 0;
+    lane->bump = -1;
+}
+
+/* find the next HMAC of the lane, R(to) = HMAC(R(from), seed(to)), in the
+ * order megolm_advance_to does them. The last step of R(j) derives R(j+1)...
+ * from R(j) as it was, so those come first and R(j) itself last. Returns 0
+ * once the lane is done. */
+static int next_rehash(struct AdvanceLane *lane, int *from, int *to) {
+    while (lane->part < (int)MEGOLM_RATCHET_PARTS) {
+        int j = lane->part;
+        if (lane->steps[j] > 1) {
+            lane->steps[j]--;
+            *from = *to = j;
+            return 1;
+        }
+        if (lane->steps[j] == 1) {
+            if (lane->bump < 0) {
+                lane->bump = last_part_to_bump(lane->steps, j);
+            }
+            *from = j;
+            *to = lane->bump;
+            if (lane->bump == j) {
+                lane->steps[j] = 0;
+                lane->bump = -1;
+                lane->part++;
+            } else {
+                lane->bump--;
+            }
+            return 1;
+        }
+        lane->part++;
+    }
+    return 0;
+}
+
+void megolm_advance_to_batch(
+    Megolm * const *megolms, const uint32_t *advance_to, size_t count
+) {
+    struct AdvanceLane lanes[ADVANCE_LANES];
+    int busy[ADVANCE_LANES] = {0};
+    const uint8_t *keys[ADVANCE_LANES];
+    const uint8_t *seeds[ADVANCE_LANES];
+    uint8_t *outputs[ADVANCE_LANES];
+    size_t lane_count = _olm_crypto_hmac_sha256_lanes();
+    size_t next = 0, i;
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_MEGOLM_ADVANCE);
+
+    if (lane_count < 2) {
+        /* nothing to gain from the lanes, and one ratchet at a time can
+         * share each key between the parts it derives */
+        for (i = 0; i < count; ++i) {
+            megolm_advance_to(megolms[i], advance_to[i]);
+        }
+        OLM_TRACE_END(trace, OLM_TRACE_MEGOLM_ADVANCE);
+        return;
+    }
+    if (lane_count > ADVANCE_LANES) {
+        lane_count = ADVANCE_LANES;
+    }
+
+    for (;;) {
+        size_t filled = 0;
+        /* find the next HMAC of each lane, moving a lane on to the next
+         * ratchet as soon as its own is finished */
+        for (i = 0; i < lane_count; ++i) {
+            int from = 0, to = 0;
+            for (;;) {
+                if (!busy[i]) {
+                    if (next == count) {
+                        break;
+                    }
+                    start_lane(&lanes[i], megolms[next], advance_to[next]);
+                    next++;
+                    busy[i] = 1;
+                }
+                if (next_rehash(&lanes[i], &from, &to)) {
+                    break;
+                }
+                lanes[i].megolm->counter = lanes[i].counter;
+                busy[i] = 0;
+            }
+            if (!busy[i]) {
+                continue;
+            }
+            keys[filled] = lanes[i].megolm->data[from];
+            seeds[filled] = HASH_KEY_SEEDS[to];
+            outputs[filled] = lanes[i].megolm->data[to];
+            filled++;
+        }
+        if (!filled) {
+            break;
+        }
+        /* lanes with nothing left to do just repeat another's work */
+        OLM_STATS_ADD(megolm_rehashes, filled);
+        _olm_crypto_hmac_sha256_many_keys(
+            keys, MEGOLM_RATCHET_PART_LENGTH,
+            seeds, HASH_KEY_SEED_LENGTH, outputs, filled
+        );
+    }
+    _olm_unset(lanes, sizeof(lanes));
+    OLM_TRACE_END(trace, OLM_TRACE_MEGOLM_ADVANCE);
+}
+
+size_t megolm_advance_cost(uint32_t counter, uint32_t advance_to) {
+    unsigned int steps[MEGOLM_RATCHET_PARTS];
+    size_t cost = 0;
+    int j;
+
+    advance_steps(counter, advance_to, steps);
+    for (j = 0; j < (int)MEGOLM_RATCHET_PARTS; j++) {
+        if (steps[j]) {
+            cost += steps[j] - 1;
+            cost += last_part_to_bump(steps, j) - j + 1;
         }
-        megolm->counter = advance_to & mask;
     }
+    return cost;
 }
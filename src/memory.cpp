@@ -12,34 +12,140 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+/* memset_s is only declared if this is set before string.h is included */
+#define __STDC_WANT_LIB_EXT1__ 1
+
 #include "olm/memory.hh"
 #include "olm/memory.h"
 
+#include <cstring>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#define OLM_UNSET_SECURE_ZERO_MEMORY
+#elif (defined(__GLIBC__) \
+        && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))) \
+    || defined(__OpenBSD__)
+#define OLM_UNSET_EXPLICIT_BZERO
+#elif defined(__STDC_LIB_EXT1__)
+#define OLM_UNSET_MEMSET_S
+#endif
+
 void _olm_unset(
     void volatile * buffer, size_t buffer_length
 ) {
     olm::unset(buffer, buffer_length);
 }
 
+int _olm_is_equal(
+    void const * buffer_a, void const * buffer_b, size_t length
+) {
+    return olm::is_equal(
+        static_cast<std::uint8_t const *>(buffer_a),
+        static_cast<std::uint8_t const *>(buffer_b),
+        length
+    );
+}
+
+#if !defined(OLM_UNSET_SECURE_ZERO_MEMORY) \
+    && !defined(OLM_UNSET_EXPLICIT_BZERO) && !defined(OLM_UNSET_MEMSET_S) \
+    && !defined(__GNUC__)
+/* Calling memset through a volatile pointer stops the compiler from
+ * knowing what is called, so it can't drop the call as a dead store. */
+static void * (* volatile const wipe_memset)(void *, int, std::size_t)
+    = std::memset;
+#endif
+
+/* The platform's own wipe is used where there is one. Otherwise memset is
+ * followed by an empty asm statement that the compiler must assume reads
+ * the buffer, so the stores can't be dropped. Either way the whole buffer
+ * is cleared a word or vector at a time rather than a byte at a time. */
 void olm::unset(
     void volatile * buffer, std::size_t buffer_length
 ) {
-    char volatile * pos = reinterpret_cast<char volatile *>(buffer);
-    char volatile * end = pos + buffer_length;
-    while (pos != end) {
-        *(pos++) = 0;
+    void * pos = const_cast<void *>(buffer);
+    if (!buffer_length) {
+        return;
     }
+#if defined(OLM_UNSET_SECURE_ZERO_MEMORY)
+    SecureZeroMemory(pos, buffer_length);
+#elif defined(OLM_UNSET_EXPLICIT_BZERO)
+    explicit_bzero(pos, buffer_length);
+#elif defined(OLM_UNSET_MEMSET_S)
+    memset_s(pos, buffer_length, 0, buffer_length);
+#elif defined(__GNUC__)
+    std::memset(pos, 0, buffer_length);
+    __asm__ __volatile__("" : : "r"(pos) : "memory");
+#else
+    wipe_memset(pos, 0, buffer_length);
+#endif
 }
 
 
+/* The differences are ORed together a vector, then a word, then a byte at a
+ * time, with no branches on the data, so the time taken depends only on the
+ * length. The result only leaves the accumulators at the end, through a
+ * volatile so that the compiler can't stop at the first difference. */
 bool olm::is_equal(
     std::uint8_t const * buffer_a,
     std::uint8_t const * buffer_b,
     std::size_t length
 ) {
-    std::uint8_t volatile result = 0;
+    std::uint64_t difference = 0;
+#if defined(__SSE2__)
+    if (length >= 16) {
+        __m128i lanes = _mm_setzero_si128();
+        for (; length >= 16; length -= 16, buffer_a += 16, buffer_b += 16) {
+            lanes = _mm_or_si128(lanes, _mm_xor_si128(
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(buffer_a)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(buffer_b))
+            ));
+        }
+        std::uint64_t words[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(words), lanes);
+        difference = words[0] | words[1];
+    }
+#elif defined(__ARM_NEON)
+    if (length >= 16) {
+        uint8x16_t lanes = vdupq_n_u8(0);
+        for (; length >= 16; length -= 16, buffer_a += 16, buffer_b += 16) {
+            lanes = vorrq_u8(lanes, veorq_u8(
+                vld1q_u8(buffer_a), vld1q_u8(buffer_b)
+            ));
+        }
+        uint64x2_t words = vreinterpretq_u64_u8(lanes);
+        difference = vgetq_lane_u64(words, 0) | vgetq_lane_u64(words, 1);
+    }
+#elif defined(__wasm_simd128__)
+    if (length >= 16) {
+        v128_t lanes = wasm_i64x2_splat(0);
+        for (; length >= 16; length -= 16, buffer_a += 16, buffer_b += 16) {
+            lanes = wasm_v128_or(lanes, wasm_v128_xor(
+                wasm_v128_load(buffer_a), wasm_v128_load(buffer_b)
+            ));
+        }
+        difference = std::uint64_t(wasm_i64x2_extract_lane(lanes, 0))
+            | std::uint64_t(wasm_i64x2_extract_lane(lanes, 1));
+    }
+#endif
+    for (; length >= 8; length -= 8, buffer_a += 8, buffer_b += 8) {
+        std::uint64_t word_a, word_b;
+        std::memcpy(&word_a, buffer_a, 8);
+        std::memcpy(&word_b, buffer_b, 8);
+        difference |= word_a ^ word_b;
+    }
     while (length--) {
-        result |= (*(buffer_a++)) ^ (*(buffer_b++));
+        difference |= (*(buffer_a++)) ^ (*(buffer_b++));
     }
+    std::uint64_t volatile result = difference;
     return result == 0;
 }
@@ -14,6 +14,8 @@
  */
 #include "olm/message.hh"
 
+#include "olm/base64.hh"
+#include "olm/iovec_internal.h"
 #include "olm/memory.hh"
 
 namespace {
@@ -45,20 +47,42 @@ static std::uint8_t * varint_encode(
 }
 
 
+/**
+ * Decode the varint starting at input into value, returning the position
+ * after it. A varint that runs off the end is decoded from the bytes that are
+ * there, and bits beyond the width of T are dropped. Counters and lengths
+ * almost always fit in one or two bytes, so those are checked for first.
+ */
 template<typename T>
-static T varint_decode(
-    std::uint8_t const * varint_start,
-    std::uint8_t const * varint_end
+static std::uint8_t const * varint_decode(
+    std::uint8_t const * input,
+    std::uint8_t const * input_end,
+    T & value
 ) {
-    T value = 0;
-    if (varint_end == varint_start) {
-        return 0;
+    std::size_t available = input_end - input;
+    if (available >= 2) {
+        if (!(input[0] & 0x80)) {
+            value = input[0];
+            return input + 1;
+        }
+        if (!(input[1] & 0x80)) {
+            value = T(input[0] & 0x7F) | T(input[1]) << 7;
+            return input + 2;
+        }
     }
-    do {
-        value <<= 7;
-        value |= 0x7F & *(--varint_end);
-    } while (varint_end != varint_start);
-    return value;
+    value = 0;
+    unsigned shift = 0;
+    while (input != input_end) {
+        std::uint8_t tmp = *(input++);
+        if (shift < 8 * sizeof(T)) {
+            value |= T(tmp & 0x7F) << shift;
+            shift += 7;
+        }
+        if ((tmp & 0x80) == 0) {
+            break;
+        }
+    }
+    return input;
 }
 
 
@@ -113,10 +137,7 @@ static std::uint8_t const * decode(
     std::uint32_t & value, bool & has_value
 ) {
     if (pos != end && *pos == tag) {
-        ++pos;
-        std::uint8_t const * value_start = pos;
-        pos = varint_skip(pos, end);
-        value = varint_decode<std::uint32_t>(value_start, pos);
+        pos = varint_decode(pos + 1, end, value);
         has_value = true;
     }
     return pos;
@@ -129,10 +150,8 @@ static std::uint8_t const * decode(
     std::uint8_t const * & value, std::size_t & value_length
 ) {
     if (pos != end && *pos == tag) {
-        ++pos;
-        std::uint8_t const * len_start = pos;
-        pos = varint_skip(pos, end);
-        std::size_t len = varint_decode<std::size_t>(len_start, pos);
+        std::size_t len;
+        pos = varint_decode(pos + 1, end, len);
         if (len > std::size_t(end - pos)) return end;
         value = pos;
         value_length = len;
@@ -151,9 +170,8 @@ static std::uint8_t const * skip_unknown(
             pos = varint_skip(pos, end);
         } else if ((tag & 0x7) == 2) {
             pos = varint_skip(pos, end);
-            std::uint8_t const * len_start = pos;
-            pos = varint_skip(pos, end);
-            std::size_t len = varint_decode<std::size_t>(len_start, pos);
+            std::size_t len;
+            pos = varint_decode(pos, end, len);
             if (len > std::size_t(end - pos)) return end;
             pos += len;
         } else {
@@ -347,6 +365,22 @@ size_t _olm_encode_group_message_length(
 }
 
 
+size_t _olm_encode_group_message_header(
+    uint8_t version,
+    uint32_t message_index,
+    size_t ciphertext_length,
+    uint8_t *output
+) {
+    std::uint8_t * pos = output;
+
+    *(pos++) = version;
+    pos = encode(pos, GROUP_MESSAGE_INDEX_TAG, message_index);
+    *(pos++) = GROUP_CIPHERTEXT_TAG;
+    pos = varint_encode(pos, ciphertext_length);
+    return pos-output;
+}
+
+
 size_t _olm_encode_group_message(
     uint8_t version,
     uint32_t message_index,
@@ -399,3 +433,313 @@ void _olm_decode_group_message(
 
     results->has_message_index = (int)has_message_index;
 }
+
+
+namespace {
+
+/**
+ * Random access to the raw bytes of unpadded base64, decoding a quantum of
+ * four characters at a time, so that the headers of a message can be read
+ * without decoding, or changing, the rest of it.
+ */
+class Base64Bytes {
+public:
+    Base64Bytes(
+        std::uint8_t const * input, std::size_t input_length
+    ) : input(input), input_length(input_length),
+        length(olm::decode_base64_length(input_length)),
+        quantum(std::size_t(-1)) {
+        if (length == std::size_t(-1)) {
+            length = 0;
+        }
+    }
+
+    ~Base64Bytes() {
+        olm::unset(bytes);
+    }
+
+    std::size_t size() const {
+        return length;
+    }
+
+    std::uint8_t operator[](std::size_t i) {
+        if (i / 3 != quantum) {
+            quantum = i / 3;
+            std::size_t start = quantum * 4;
+            std::size_t chars = input_length - start < 4 ?
+                input_length - start : 4;
+            olm::decode_base64(input + start, chars, bytes);
+        }
+        return bytes[i % 3];
+    }
+
+private:
+    std::uint8_t const * input;
+    std::size_t input_length;
+    std::size_t length;
+    std::size_t quantum;
+    std::uint8_t bytes[3];
+};
+
+
+/**
+ * Random access to the bytes of a buffer held in segments, as for
+ * Base64Bytes. The fields of a message are walked from the front, so this
+ * remembers which segment it was last in.
+ */
+class SegmentBytes {
+public:
+    SegmentBytes(
+        OlmIovec const * segments, std::size_t count
+    ) : segments(segments),
+        length(_olm_iovec_length(segments, count)),
+        segment(0), segment_start(0) {}
+
+    std::size_t size() const {
+        return length;
+    }
+
+    std::uint8_t operator[](std::size_t i) {
+        if (i < segment_start) {
+            segment = 0;
+            segment_start = 0;
+        }
+        while (i - segment_start >= segments[segment].length) {
+            segment_start += segments[segment].length;
+            ++segment;
+        }
+        return static_cast<std::uint8_t const *>(
+            segments[segment].base
+        )[i - segment_start];
+    }
+
+private:
+    OlmIovec const * segments;
+    std::size_t length;
+    std::size_t segment;
+    std::size_t segment_start;
+};
+
+
+template<typename Bytes>
+static std::size_t peek_varint_skip(
+    Bytes & input, std::size_t pos, std::size_t end
+) {
+    while (pos != end) {
+        if ((input[pos++] & 0x80) == 0) {
+            return pos;
+        }
+    }
+    return pos;
+}
+
+
+template<typename Bytes>
+static std::size_t peek_varint_decode(
+    Bytes & input, std::size_t start, std::size_t end
+) {
+    std::size_t value = 0;
+    while (end != start) {
+        value <<= 7;
+        value |= 0x7F & input[--end];
+    }
+    return value;
+}
+
+
+/**
+ * Walk the fields in input[pos, end) as the decode functions above do, and
+ * find the last string field with the given tag. Returns false if there
+ * isn't one. The decode functions treat the fields they know like unknown
+ * fields of the same type, so skip_unknown() is all we need to follow.
+ */
+template<typename Bytes>
+static bool peek_string_field(
+    Bytes & input, std::size_t pos, std::size_t end,
+    std::uint8_t tag,
+    std::size_t & value_start, std::size_t & value_length
+) {
+    bool found = false;
+    while (pos != end) {
+        std::uint8_t field_tag = input[pos];
+        if ((field_tag & 0x7) == 0) {
+            pos = peek_varint_skip(input, pos, end);
+            pos = peek_varint_skip(input, pos, end);
+        } else if ((field_tag & 0x7) == 2) {
+            pos = peek_varint_skip(input, pos, end);
+            std::size_t len_start = pos;
+            pos = peek_varint_skip(input, pos, end);
+            std::size_t len = peek_varint_decode(input, len_start, pos);
+            if (len > end - pos) {
+                break;
+            }
+            if (field_tag == tag) {
+                found = true;
+                value_start = pos;
+                value_length = len;
+            }
+            pos += len;
+        } else {
+            break;
+        }
+    }
+    return found;
+}
+
+
+/**
+ * As peek_string_field(), but for the last varint field with the given tag,
+ * keeping the low bits of its value as the decode functions do.
+ */
+template<typename Bytes>
+static bool peek_varint_field(
+    Bytes & input, std::size_t pos, std::size_t end,
+    std::uint8_t tag, std::uint32_t & value
+) {
+    bool found = false;
+    while (pos != end) {
+        std::uint8_t field_tag = input[pos];
+        if ((field_tag & 0x7) == 0) {
+            pos = peek_varint_skip(input, pos, end);
+            std::size_t value_start = pos;
+            pos = peek_varint_skip(input, pos, end);
+            if (field_tag == tag) {
+                found = true;
+                value = std::uint32_t(
+                    peek_varint_decode(input, value_start, pos)
+                );
+            }
+        } else if ((field_tag & 0x7) == 2) {
+            pos = peek_varint_skip(input, pos, end);
+            std::size_t len_start = pos;
+            pos = peek_varint_skip(input, pos, end);
+            std::size_t len = peek_varint_decode(input, len_start, pos);
+            if (len > end - pos) {
+                break;
+            }
+            pos += len;
+        } else {
+            break;
+        }
+    }
+    return found;
+}
+
+
+/** peek at a message occupying input[start, start + length) */
+template<typename Bytes>
+static void peek_message_at(
+    _OlmPeekMessageResults & results,
+    Bytes & input, std::size_t start, std::size_t length,
+    std::size_t trailer_length, std::uint8_t ciphertext_tag
+) {
+    std::size_t value_start;
+
+    results.version = 0;
+    results.has_ciphertext = 0;
+    results.ciphertext_length = 0;
+    results.has_message_index = 0;
+    results.message_index = 0;
+
+    if (length < trailer_length) return;
+    std::size_t end = start + length - trailer_length;
+
+    if (start == end) return;
+    results.version = input[start];
+
+    results.has_ciphertext = peek_string_field(
+        input, start + 1, end, ciphertext_tag,
+        value_start, results.ciphertext_length
+    );
+}
+
+} // namespace
+
+
+void olm::peek_message(
+    _OlmPeekMessageResults & results,
+    std::uint8_t const * input, std::size_t input_length,
+    std::size_t mac_length
+) {
+    Base64Bytes bytes(input, input_length);
+    peek_message_at(results, bytes, 0, bytes.size(), mac_length, CIPHERTEXT_TAG);
+}
+
+
+void olm::peek_one_time_key_message(
+    _OlmPeekMessageResults & results,
+    std::uint8_t const * input, std::size_t input_length,
+    std::size_t mac_length
+) {
+    Base64Bytes bytes(input, input_length);
+    std::size_t message_start, message_length;
+
+    results.version = 0;
+    results.has_ciphertext = 0;
+    results.ciphertext_length = 0;
+
+    if (bytes.size() == 0) return;
+    if (!peek_string_field(
+        bytes, 1, bytes.size(), MESSAGE_TAG, message_start, message_length
+    )) {
+        return;
+    }
+    peek_message_at(
+        results, bytes, message_start, message_length,
+        mac_length, CIPHERTEXT_TAG
+    );
+}
+
+
+void _olm_peek_group_message(
+    const uint8_t *input, size_t input_length,
+    size_t mac_length, size_t signature_length,
+    struct _OlmPeekMessageResults *results
+) {
+    Base64Bytes bytes(input, input_length);
+    std::size_t trailer_length = mac_length + signature_length;
+    peek_message_at(
+        *results, bytes, 0, bytes.size(), trailer_length, GROUP_CIPHERTEXT_TAG
+    );
+    if (bytes.size() > trailer_length) {
+        std::uint32_t message_index = 0;
+        results->has_message_index = peek_varint_field(
+            bytes, 1, bytes.size() - trailer_length,
+            GROUP_MESSAGE_INDEX_TAG, message_index
+        );
+        results->message_index = message_index;
+    }
+}
+
+
+void _olm_decode_group_message_segments(
+    const OlmIovec *segments, size_t segment_count,
+    size_t mac_length, size_t signature_length,
+    struct _OlmDecodeGroupMessageSegmentsResults *results
+) {
+    SegmentBytes bytes(segments, segment_count);
+    std::size_t trailer_length = mac_length + signature_length;
+    std::uint32_t message_index = 0;
+
+    results->version = 0;
+    results->message_index = 0;
+    results->has_message_index = 0;
+    results->has_ciphertext = 0;
+    results->ciphertext_offset = 0;
+    results->ciphertext_length = 0;
+
+    if (bytes.size() < trailer_length) return;
+    std::size_t end = bytes.size() - trailer_length;
+
+    if (end == 0) return;
+    results->version = bytes[0];
+
+    results->has_message_index = peek_varint_field(
+        bytes, 1, end, GROUP_MESSAGE_INDEX_TAG, message_index
+    );
+    results->message_index = message_index;
+    results->has_ciphertext = peek_string_field(
+        bytes, 1, end, GROUP_CIPHERTEXT_TAG,
+        results->ciphertext_offset, results->ciphertext_length
+    );
+}
@@ -16,11 +16,19 @@
 #include "olm/session.hh"
 #include "olm/account.hh"
 #include "olm/cipher.h"
+#include "olm/pickle.hh"
 #include "olm/pickle_encoding.h"
+#include "olm/random.h"
 #include "olm/utility.hh"
 #include "olm/base64.hh"
+#include "olm/canonical_json.hh"
 #include "olm/memory.hh"
+#include "olm/probes.h"
+#include "olm/stats_internal.h"
+#include "olm/trace_internal.h"
 
+#include <algorithm>
+#include <functional>
 #include <new>
 #include <cstring>
 
@@ -42,14 +50,55 @@ static olm::Account * from_c(OlmAccount * account) {
     return reinterpret_cast<olm::Account *>(account);
 }
 
+static olm::Account const * from_c(OlmAccount const * account) {
+    return reinterpret_cast<olm::Account const *>(account);
+}
+
 static olm::Session * from_c(OlmSession * session) {
     return reinterpret_cast<olm::Session *>(session);
 }
 
+static olm::Session const * from_c(OlmSession const * session) {
+    return reinterpret_cast<olm::Session const *>(session);
+}
+
 static olm::Utility * from_c(OlmUtility * utility) {
     return reinterpret_cast<olm::Utility *>(utility);
 }
 
+/** What an OlmDecryptTrial points to */
+struct DecryptTrialState {
+    olm::DecryptTrial trial;
+    /** The session the trial was made with */
+    olm::Session const * session;
+};
+
+static DecryptTrialState * from_c(OlmDecryptTrial * trial) {
+    return reinterpret_cast<DecryptTrialState *>(trial);
+}
+
+static DecryptTrialState const * from_c(OlmDecryptTrial const * trial) {
+    return reinterpret_cast<DecryptTrialState const *>(trial);
+}
+
+/** What an OlmMessageView points to */
+struct MessageViewState {
+    olm::MessageView view;
+    OlmErrorCode last_error;
+};
+
+static OlmMessageView * to_c(MessageViewState * view) {
+    return reinterpret_cast<OlmMessageView *>(view);
+}
+
+static MessageViewState * from_c(OlmMessageView * view) {
+    return reinterpret_cast<MessageViewState *>(view);
+}
+
+static MessageViewState const * from_c(OlmMessageView const * view) {
+    return reinterpret_cast<MessageViewState const *>(view);
+}
+
 static std::uint8_t * from_c(void * bytes) {
     return reinterpret_cast<std::uint8_t *>(bytes);
 }
@@ -84,15 +133,535 @@ std::size_t b64_input(
     std::uint8_t * input, size_t b64_length,
     OlmErrorCode & last_error
 ) {
-    std::size_t raw_length = olm::decode_base64_length(b64_length);
+    std::size_t error_position;
+    std::size_t raw_length = olm::decode_base64_strict(
+        input, b64_length, input, error_position
+    );
     if (raw_length == std::size_t(-1)) {
         last_error = OlmErrorCode::OLM_INVALID_BASE64;
+    }
+    return raw_length;
+}
+
+/** Fill random from the library's generator for an *_auto_random call. */
+bool auto_random(
+    std::uint8_t * random, std::size_t random_length,
+    OlmErrorCode & last_error
+) {
+    if (::olm_random_fill(random, random_length) == std::size_t(-1)) {
+        last_error = OlmErrorCode::OLM_RANDOM_UNAVAILABLE;
+        return false;
+    }
+    return true;
+}
+
+/** Decode a base64 public key into key, which must be 32 bytes long. */
+bool b64_key_input(
+    std::uint8_t const * input, size_t b64_length,
+    std::uint8_t * key, OlmErrorCode & last_error
+) {
+    std::size_t error_position;
+    if (olm::decode_base64_length(b64_length) != CURVE25519_KEY_LENGTH
+            || olm::decode_base64_strict(
+                input, b64_length, key, error_position
+            ) == std::size_t(-1)) {
+        last_error = OlmErrorCode::OLM_INVALID_BASE64;
+        return false;
+    }
+    return true;
+}
+
+/** Rewrite a signed JSON object in place as the canonical JSON that was
+ * signed, and decode its signature by the key given. Returns the length of
+ * the canonical JSON, or olm_error() if it couldn't be read or had no such
+ * signature. */
+std::size_t signed_json_input(
+    std::uint8_t * json, std::size_t json_length,
+    std::uint8_t const * user_id, std::size_t user_id_length,
+    std::uint8_t const * key_id, std::size_t key_id_length,
+    std::uint8_t * signature, OlmErrorCode & last_error
+) {
+    std::size_t length = olm::canonical_json(json, json_length);
+    if (length == std::size_t(-1)) {
+        last_error = OlmErrorCode::OLM_INVALID_JSON;
+        return std::size_t(-1);
+    }
+    /* the length of the unpadded base64 of a signature */
+    std::uint8_t b64_signature[(ED25519_SIGNATURE_LENGTH * 4 + 2) / 3];
+    std::size_t b64_length = olm::find_json_signature(
+        json, length, user_id, user_id_length, key_id, key_id_length,
+        b64_signature, sizeof(b64_signature)
+    );
+    if (b64_length == std::size_t(-1)) {
+        last_error = OlmErrorCode::OLM_BAD_MESSAGE_MAC;
+        return std::size_t(-1);
+    }
+    std::size_t error_position;
+    if (olm::decode_base64_length(b64_length) != ED25519_SIGNATURE_LENGTH
+            || olm::decode_base64_strict(
+                b64_signature, b64_length, signature, error_position
+            ) == std::size_t(-1)) {
+        last_error = OlmErrorCode::OLM_INVALID_BASE64;
+        return std::size_t(-1);
+    }
+    return olm::strip_json_signatures(json, length);
+}
+
+/** Unpickle an object from the raw_length bytes of decrypted pickle at pos.
+ * Returns raw_length, or olm_error() if the pickle couldn't be read. */
+template<typename T>
+std::size_t unpickle_raw(
+    T & object, std::uint8_t * pos, std::size_t raw_length
+) {
+    std::uint8_t * const end = pos + raw_length;
+    /* On success unpickle will return (pos + raw_length). If unpickling
+     * terminates too soon then it will return a pointer before
+     * (pos + raw_length). On error unpickle will return (pos + raw_length + 1).
+     */
+    if (end != unpickle(pos, end + 1, object)) {
+        if (object.last_error == OlmErrorCode::OLM_SUCCESS) {
+            object.last_error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
+        }
+        return std::size_t(-1);
+    }
+    return raw_length;
+}
+
+template<typename T>
+std::size_t pickle_binary(
+    T & object,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_PICKLE);
+    olm::TraceScope trace(OLM_TRACE_PICKLE);
+    std::size_t raw_length = pickle_length(object);
+    if (pickled_length < _olm_enc_output_binary_length(raw_length)) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return size_t(-1);
+    }
+    pickle(from_c(pickled), object);
+    return _olm_enc_output_binary(
+        from_c(key), key_length, from_c(pickled), raw_length
+    );
+}
+
+template<typename T>
+std::size_t unpickle_binary(
+    T & object,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    std::size_t raw_length = _olm_enc_input_binary(
+        from_c(key), key_length, from_c(pickled), pickled_length,
+        &object.last_error
+    );
+    if (raw_length == std::size_t(-1)
+            || unpickle_raw(object, from_c(pickled), raw_length)
+                == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    return pickled_length;
+}
+
+/** Unpickle the object from a pickle which is left as it is, decoding and
+ * decrypting it into the scratch memory, which is wiped afterwards. */
+template<typename T>
+std::size_t unpickle_const(
+    T & object, void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length, bool binary
+) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    if (scratch_length < pickled_length) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    auto input = binary ? _olm_enc_input_binary_const : _olm_enc_input_const;
+    std::size_t raw_length = input(
+        from_c(key), key_length, from_c(pickled), pickled_length,
+        from_c(scratch), scratch_length, &object.last_error
+    );
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    std::size_t result = unpickle_raw(object, from_c(scratch), raw_length);
+    olm::unset(scratch, std::min(pickled_length, scratch_length));
+    return result == std::size_t(-1) ? result : pickled_length;
+}
+
+/** The scratch memory the streamed picklers need for the object: room to
+ * decrypt the longest pickle it could have. */
+template<typename T>
+std::size_t stream_scratch_length(
+    T const & object
+) {
+    return _olm_cipher_aes_sha_256_ciphertext_length(
+        olm::max_pickle_length(object)
+    );
+}
+
+template<typename T>
+std::size_t pickle_stream(
+    T & object, _olm_enc_context const & context,
+    OlmPickleWriter write, void * write_context,
+    void * scratch, size_t scratch_length
+) {
+    olm::StatsTimer timer(OLM_STATS_PICKLE);
+    olm::TraceScope trace(OLM_TRACE_PICKLE);
+    std::size_t raw_length = pickle_length(object);
+    if (scratch_length < raw_length) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    pickle(from_c(scratch), object);
+    std::size_t result = _olm_enc_output_binary_stream(
+        &context, from_c(scratch), raw_length, write, write_context,
+        &object.last_error
+    );
+    olm::unset(scratch, raw_length);
+    return result;
+}
+
+/** Unpickle the object from input_length bytes of binary pickle from read,
+ * or up to the end of its input if input_length is olm_error(). Returns the
+ * number of bytes read. */
+template<typename T>
+std::size_t unpickle_stream(
+    T & object, _olm_enc_context const & context,
+    OlmPickleReader read, void * read_context, std::size_t input_length,
+    void * scratch, size_t scratch_length
+) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    std::size_t read_length;
+    std::size_t raw_length = _olm_enc_input_binary_stream(
+        &context, read, read_context, input_length,
+        from_c(scratch), scratch_length, &read_length, &object.last_error
+    );
+    if (raw_length == std::size_t(-1)) {
         return std::size_t(-1);
     }
-    olm::decode_base64(input, b64_length, input);
+    std::size_t result = unpickle_raw(object, from_c(scratch), raw_length);
+    olm::unset(scratch, raw_length);
+    return result == std::size_t(-1) ? result : read_length;
+}
+
+/** Read exactly length bytes of a streamed pickle. Returns OLM_SUCCESS, or
+ * what went wrong if read failed or the pickle ended first. */
+OlmErrorCode read_stream(
+    OlmPickleReader read, void * read_context,
+    std::uint8_t * data, std::size_t length
+) {
+    while (length) {
+        std::size_t count = read(read_context, data, length);
+        if (count == std::size_t(-1) || count > length) {
+            return OlmErrorCode::OLM_PICKLE_STREAM_FAILED;
+        }
+        if (count == 0) {
+            return OlmErrorCode::OLM_CORRUPTED_PICKLE;
+        }
+        data += count;
+        length -= count;
+    }
+    return OlmErrorCode::OLM_SUCCESS;
+}
+
+/* A fixed-size pickle is a binary pickle of the object's pickle, preceded by
+ * its length and followed by zeros up to the most the output can hold. */
+static const std::size_t FIXED_PICKLE_HEADER_LENGTH = 4;
+
+template<typename T>
+std::size_t fixed_length(
+    T const & object, std::size_t record_size
+) {
+    std::size_t length = _olm_enc_output_binary_length(
+        FIXED_PICKLE_HEADER_LENGTH + olm::max_pickle_length(object)
+    );
+    if (record_size) {
+        length = (length + record_size - 1) / record_size * record_size;
+    }
+    return length;
+}
+
+/** The most bytes of raw pickle that encrypt to no more than pickled_length
+ * bytes, which must be at least _olm_enc_output_binary_length(0). */
+std::size_t fixed_raw_length(
+    std::size_t pickled_length
+) {
+    std::size_t raw_length = pickled_length - _olm_enc_output_binary_length(0);
+    /* the cipher pads to a whole block, so fill up the last one */
+    while (_olm_enc_output_binary_length(raw_length + 1) <= pickled_length) {
+        raw_length++;
+    }
     return raw_length;
 }
 
+template<typename T>
+std::size_t pickle_fixed(
+    T & object,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_PICKLE);
+    olm::TraceScope trace(OLM_TRACE_PICKLE);
+    if (pickled_length < fixed_length(object, 0)) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return size_t(-1);
+    }
+    std::size_t raw_length = fixed_raw_length(pickled_length);
+    std::size_t length = pickle_length(object);
+    std::uint8_t * pos = olm::pickle(from_c(pickled), std::uint32_t(length));
+    pos = pickle(pos, object);
+    std::memset(pos, 0, raw_length - FIXED_PICKLE_HEADER_LENGTH - length);
+    std::size_t result = _olm_enc_output_binary(
+        from_c(key), key_length, from_c(pickled), raw_length
+    );
+    /* the cipher may leave part of a block at the end */
+    std::memset(from_c(pickled) + result, 0, pickled_length - result);
+    return pickled_length;
+}
+
+template<typename T>
+std::size_t unpickle_fixed(
+    T & object,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    if (pickled_length < _olm_enc_output_binary_length(0)) {
+        object.last_error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
+        return std::size_t(-1);
+    }
+    std::size_t raw_length = _olm_enc_input_binary(
+        from_c(key), key_length, from_c(pickled),
+        _olm_enc_output_binary_length(fixed_raw_length(pickled_length)),
+        &object.last_error
+    );
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    std::uint32_t length = 0;
+    if (raw_length >= FIXED_PICKLE_HEADER_LENGTH) {
+        olm::unpickle(from_c(pickled), from_c(pickled) + raw_length, length);
+    }
+    if (raw_length < FIXED_PICKLE_HEADER_LENGTH
+            || length > raw_length - FIXED_PICKLE_HEADER_LENGTH) {
+        object.last_error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
+        return std::size_t(-1);
+    }
+    if (unpickle_raw(
+            object, from_c(pickled) + FIXED_PICKLE_HEADER_LENGTH, length
+        ) == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    return pickled_length;
+}
+
+template<typename T>
+std::size_t pickle_with_key(
+    T & object,
+    OlmPickleKey const * pickle_key, std::uint32_t cipher,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_PICKLE);
+    olm::TraceScope trace(OLM_TRACE_PICKLE);
+    std::size_t raw_length = pickle_length(object);
+    if (pickled_length
+            < _olm_enc_output_with_cipher_length(cipher, raw_length)) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return size_t(-1);
+    }
+    pickle(
+        _olm_enc_output_with_cipher_pos(cipher, from_c(pickled), raw_length),
+        object
+    );
+    return _olm_enc_output_with_cipher(
+        &pickle_key->context, cipher, from_c(pickled), raw_length,
+        &object.last_error
+    );
+}
+
+template<typename T>
+std::size_t unpickle_with_key(
+    T & object,
+    OlmPickleKey const * pickle_key,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    std::size_t raw_length = _olm_enc_input_with_context(
+        &pickle_key->context, from_c(pickled), pickled_length,
+        &object.last_error
+    );
+    if (raw_length == std::size_t(-1)
+            || unpickle_raw(object, from_c(pickled), raw_length)
+                == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    return pickled_length;
+}
+
+/** The arguments to olm_decrypt_batch(), shared by its jobs */
+struct DecryptBatch {
+    OlmSession * const * sessions;
+    const size_t * message_types;
+    void * const * messages;
+    const size_t * message_lengths;
+    void * const * plaintexts;
+    const size_t * max_plaintext_lengths;
+    size_t * plaintext_lengths;
+    const char ** errors;
+    /** the messages, grouped by session and in order within each group */
+    std::size_t const * order;
+    /** where each group starts in order, followed by the message count */
+    std::size_t const * group_starts;
+};
+
+/** Decrypt the messages for one session. Jobs only touch their own session
+ * and the entries for its messages, so they can run at the same time. */
+void decrypt_batch_job(void * job_context, std::size_t job) {
+    DecryptBatch const & batch = *static_cast<DecryptBatch *>(job_context);
+    for (std::size_t j = batch.group_starts[job];
+            j < batch.group_starts[job + 1]; ++j) {
+        std::size_t i = batch.order[j];
+        batch.plaintext_lengths[i] = olm_decrypt(
+            batch.sessions[i], batch.message_types[i],
+            batch.messages[i], batch.message_lengths[i],
+            batch.plaintexts[i], batch.max_plaintext_lengths[i]
+        );
+        if (batch.errors) {
+            batch.errors[i] = batch.plaintext_lengths[i] == std::size_t(-1)
+                ? olm_session_last_error(batch.sessions[i])
+                : _olm_error_to_string(OlmErrorCode::OLM_SUCCESS);
+        }
+    }
+}
+
+/** How many sessions a batch session setup starts together */
+static std::size_t const SESSION_BATCH_LENGTH = 8;
+
+/** The random bytes each new outbound session needs, for its base key and
+ * its first ratchet key */
+static std::size_t const SESSION_RANDOM_LENGTH = 2 * CURVE25519_RANDOM_LENGTH;
+
+struct OutboundSessionBatch {
+    olm::Account const * account;
+    std::size_t count;
+    void const * const * identity_keys;
+    size_t const * identity_key_lengths;
+    void const * const * one_time_keys;
+    size_t const * one_time_key_lengths;
+    std::uint8_t const * plaintext;
+    std::size_t plaintext_length;
+    std::uint8_t const * random;
+    OlmSession * const * sessions;
+    std::uint8_t * messages;
+    std::size_t message_length;
+    size_t * message_lengths;
+};
+
+/** Start and encrypt with SESSION_BATCH_LENGTH sessions, leaving what went
+ * wrong with each in its last_error. Jobs only touch their own sessions and
+ * entries, so they can run at the same time. */
+void outbound_session_batch_job(void * job_context, std::size_t job) {
+    OutboundSessionBatch const & batch =
+        *static_cast<OutboundSessionBatch *>(job_context);
+    std::size_t first = job * SESSION_BATCH_LENGTH;
+    std::size_t end = std::min(batch.count, first + SESSION_BATCH_LENGTH);
+
+    /* zeroed, as the compiler can't tell that only the first n are read */
+    olm::Session * started[SESSION_BATCH_LENGTH] = {};
+    std::size_t started_index[SESSION_BATCH_LENGTH] = {};
+    _olm_curve25519_public_key identity_keys[SESSION_BATCH_LENGTH] = {};
+    _olm_curve25519_public_key one_time_keys[SESSION_BATCH_LENGTH] = {};
+    std::uint8_t random[SESSION_BATCH_LENGTH * SESSION_RANDOM_LENGTH] = {};
+    std::size_t n = 0;
+
+    for (std::size_t i = first; i < end; ++i) {
+        if (!batch.sessions[i]) {
+            continue;
+        }
+        olm::Session & session = *from_c(batch.sessions[i]);
+        if (!b64_key_input(
+                from_c(batch.identity_keys[i]), batch.identity_key_lengths[i],
+                identity_keys[n].public_key, session.last_error
+            ) || !b64_key_input(
+                from_c(batch.one_time_keys[i]), batch.one_time_key_lengths[i],
+                one_time_keys[n].public_key, session.last_error
+            )) {
+            continue;
+        }
+        std::memcpy(
+            random + n * SESSION_RANDOM_LENGTH,
+            batch.random + i * SESSION_RANDOM_LENGTH, SESSION_RANDOM_LENGTH
+        );
+        started[n] = &session;
+        started_index[n++] = i;
+    }
+    olm::Session::new_outbound_sessions(
+        n, started, *batch.account, identity_keys, one_time_keys, random
+    );
+    olm::unset(random);
+
+    /* a new session's first message needs no random, since its ratchet key
+     * came with the session */
+    std::size_t raw_length = olm::Session::new_outbound_message_length(
+        batch.plaintext_length
+    );
+    for (std::size_t j = 0; j < n; ++j) {
+        std::size_t i = started_index[j];
+        std::uint8_t * message = batch.messages + i * batch.message_length;
+        std::size_t result = started[j]->encrypt(
+            batch.plaintext, batch.plaintext_length, nullptr,
+            b64_output_pos(message, raw_length), raw_length
+        );
+        if (result != std::size_t(-1)) {
+            batch.message_lengths[i] = b64_output(message, raw_length);
+        }
+    }
+}
+
+/** How many signatures a batch signing job makes */
+static std::size_t const SIGN_BATCH_LENGTH = 16;
+
+struct SignBatch {
+    olm::Account * account;
+    std::size_t count;
+    void const * const * messages;
+    size_t const * message_lengths;
+    std::uint8_t * signatures;
+    std::size_t signature_length;
+};
+
+/** Sign SIGN_BATCH_LENGTH messages, base64 encoding the signatures into their
+ * slots. Jobs only write their own slots, so they can run at the same time. */
+void sign_batch_job(void * job_context, std::size_t job) {
+    SignBatch const & batch = *static_cast<SignBatch *>(job_context);
+    std::size_t first = job * SIGN_BATCH_LENGTH;
+    std::size_t n = std::min(batch.count - first, SIGN_BATCH_LENGTH);
+
+    /* zeroed, as the compiler can't tell that only the first n are read */
+    std::uint8_t const * messages[SIGN_BATCH_LENGTH] = {};
+    std::uint8_t raw[SIGN_BATCH_LENGTH * ED25519_SIGNATURE_LENGTH] = {};
+    for (std::size_t j = 0; j < n; ++j) {
+        messages[j] = from_c(batch.messages[first + j]);
+    }
+    batch.account->sign_batch(
+        n, messages, batch.message_lengths + first, raw
+    );
+    for (std::size_t j = 0; j < n; ++j) {
+        olm::encode_base64(
+            raw + j * ED25519_SIGNATURE_LENGTH, ED25519_SIGNATURE_LENGTH,
+            batch.signatures + (first + j) * batch.signature_length
+        );
+    }
+}
+
 } // namespace
 
 
@@ -132,31 +701,166 @@ const char * olm_utility_last_error(
 }
 
 size_t olm_account_size() {
-    return sizeof(olm::Account);
+    return sizeof(olm::Account)
+        + olm::Account::storage_length(olm::MAX_ONE_TIME_KEYS);
+}
+
+size_t olm_account_size_with_limits(
+    size_t max_one_time_keys
+) {
+    if (max_one_time_keys > olm::INDEXED_LIST_LIMIT) {
+        return std::size_t(-1);
+    }
+    return sizeof(olm::Account)
+        + olm::Account::storage_length(max_one_time_keys);
 }
 
 
 size_t olm_session_size() {
-    return sizeof(olm::Session);
+    return sizeof(olm::Session)
+        + olm::Session::storage_length(olm::DEFAULT_RATCHET_LIMITS);
+}
+
+size_t olm_session_size_with_limits(
+    size_t max_receiver_chains, size_t max_skipped_message_keys
+) {
+    if (max_receiver_chains == 0 || max_receiver_chains > UINT32_MAX
+            || max_skipped_message_keys > olm::SKIPPED_MESSAGE_KEYS_LIMIT) {
+        return std::size_t(-1);
+    }
+    olm::RatchetLimits limits = {
+        std::uint32_t(max_receiver_chains),
+        std::uint32_t(max_skipped_message_keys),
+        0
+    };
+    return sizeof(olm::Session) + olm::Session::storage_length(limits);
+}
+
+size_t olm_compact_session_size() {
+    return sizeof(olm::Session)
+        + olm::Session::compact_storage_length(olm::DEFAULT_RATCHET_LIMITS);
+}
+
+size_t olm_compact_session_skipped_key_size() {
+    return olm::Ratchet::skipped_message_key_storage_length(
+        olm::DEFAULT_RATCHET_LIMITS
+    );
 }
 
 size_t olm_utility_size() {
     return sizeof(olm::Utility);
 }
 
+/* The account's one time keys are kept in the memory straight after the
+ * olm::Account */
+static OlmAccount * create_account(
+    void * memory, std::size_t max_one_time_keys
+) {
+    olm::unset(
+        memory,
+        sizeof(olm::Account) + olm::Account::storage_length(max_one_time_keys)
+    );
+    std::uint8_t * storage = from_c(memory) + sizeof(olm::Account);
+    return to_c(new(memory) olm::Account(max_one_time_keys, storage));
+}
+
+
 OlmAccount * olm_account(
     void * memory
 ) {
-    olm::unset(memory, sizeof(olm::Account));
-    return to_c(new(memory) olm::Account());
+    return create_account(memory, olm::MAX_ONE_TIME_KEYS);
+}
+
+
+OlmAccount * olm_account_with_limits(
+    void * memory, size_t max_one_time_keys
+) {
+    return create_account(memory, max_one_time_keys);
+}
+
+
+OlmAccount * olm_account_resize(
+    OlmAccount * account, void * memory, size_t max_one_time_keys
+) {
+    olm::Account & old_account = *from_c(account);
+    OlmAccount * result = create_account(memory, max_one_time_keys);
+    olm::Account & new_account = *from_c(result);
+    new_account.identity_keys = old_account.identity_keys;
+    new_account.next_one_time_key_id = old_account.next_one_time_key_id;
+    new_account.identity_keys_only = old_account.identity_keys_only;
+    /* the room for one time keys is pickled */
+    new_account.dirty = !old_account.identity_keys_only;
+    /* Add the keys oldest last so that if there isn't room for them all the
+     * newest are kept */
+    for (olm::OneTimeKey const & key : old_account.one_time_keys) {
+        if (new_account.one_time_keys.size()
+                == new_account.one_time_keys.capacity()) {
+            break;
+        }
+        new_account.one_time_keys.append(key);
+    }
+    olm_clear_account(account);
+    return result;
+}
+
+
+/* The session's receiver chains and skipped message keys are kept in the
+ * memory straight after the olm::Session */
+static OlmSession * create_session(
+    void * memory, olm::RatchetLimits const & limits
+) {
+    olm::unset(
+        memory, sizeof(olm::Session) + olm::Session::storage_length(limits)
+    );
+    std::uint8_t * storage = from_c(memory) + sizeof(olm::Session);
+    return to_c(new(memory) olm::Session(limits, storage));
 }
 
 
 OlmSession * olm_session(
     void * memory
 ) {
-    olm::unset(memory, sizeof(olm::Session));
-    return to_c(new(memory) olm::Session());
+    return create_session(memory, olm::DEFAULT_RATCHET_LIMITS);
+}
+
+
+OlmSession * olm_session_with_limits(
+    void * memory,
+    size_t max_receiver_chains, size_t max_skipped_message_keys,
+    size_t max_message_gap
+) {
+    olm::RatchetLimits limits = {
+        std::uint32_t(max_receiver_chains),
+        std::uint32_t(max_skipped_message_keys),
+        max_message_gap > UINT32_MAX
+            ? std::uint32_t(UINT32_MAX) : std::uint32_t(max_message_gap)
+    };
+    return create_session(memory, limits);
+}
+
+
+/* A compact session keeps only its receiver chains in the memory after the
+ * olm::Session */
+static OlmSession * create_compact_session(
+    void * memory, olm::RatchetLimits const & limits,
+    OlmAllocator const * allocator
+) {
+    olm::unset(
+        memory,
+        sizeof(olm::Session) + olm::Session::compact_storage_length(limits)
+    );
+    std::uint8_t * storage = from_c(memory) + sizeof(olm::Session);
+    return to_c(new(memory) olm::Session(limits, storage, allocator));
+}
+
+
+OlmSession * olm_compact_session(
+    void * memory,
+    const OlmAllocator * allocator
+) {
+    return create_compact_session(
+        memory, olm::DEFAULT_RATCHET_LIMITS, allocator
+    );
 }
 
 
@@ -171,63 +875,242 @@ OlmUtility * olm_utility(
 size_t olm_clear_account(
     OlmAccount * account
 ) {
-    /* Clear the memory backing the account  */
-    olm::unset(account, sizeof(olm::Account));
-    /* Initialise a fresh account object in case someone tries to use it */
-    new(account) olm::Account();
-    return sizeof(olm::Account);
+    std::size_t max_one_time_keys =
+        from_c(account)->one_time_keys.capacity();
+    /* Clear the memory backing the account, and initialise a fresh account
+     * object with the same room in case someone tries to use it */
+    create_account(account, max_one_time_keys);
+    return sizeof(olm::Account)
+        + olm::Account::storage_length(max_one_time_keys);
 }
 
 
 size_t olm_clear_session(
     OlmSession * session
 ) {
-    /* Clear the memory backing the session */
-    olm::unset(session, sizeof(olm::Session));
-    /* Initialise a fresh session object in case someone tries to use it */
-    new(session) olm::Session();
-    return sizeof(olm::Session);
+    olm::Session & object = *from_c(session);
+    olm::Ratchet & ratchet = object.ratchet;
+    olm::RatchetLimits limits = ratchet.limits;
+    if (ratchet.skipped_keys_out_of_line) {
+        OlmAllocator const * allocator = object.skipped_key_allocator;
+        ratchet.release_skipped_message_keys(allocator, true);
+        create_compact_session(session, limits, allocator);
+        return sizeof(olm::Session)
+            + olm::Session::compact_storage_length(limits);
+    }
+    std::size_t length =
+        sizeof(olm::Session) + olm::Session::storage_length(limits);
+    /* Clear the memory backing the session, and initialise a fresh session
+     * object with the same limits in case someone tries to use it */
+    create_session(session, limits);
+    return length;
 }
 
 
-size_t olm_clear_utility(
-    OlmUtility * utility
+OlmSession * olm_allocate_session(
+    const OlmAllocator * allocator
 ) {
-    /* Clear the memory backing the session */
-    olm::unset(utility, sizeof(olm::Utility));
-    /* Initialise a fresh session object in case someone tries to use it */
-    new(utility) olm::Utility();
-    return sizeof(olm::Utility);
+    void * memory = allocator->allocate(allocator->context, olm_session_size());
+    if (!memory) {
+        return nullptr;
+    }
+    return olm_session(memory);
 }
 
 
-size_t olm_pickle_account_length(
-    OlmAccount * account
+void olm_release_session(
+    const OlmAllocator * allocator,
+    OlmSession * session
 ) {
-    return _olm_enc_output_length(pickle_length(*from_c(account)));
+    olm_clear_session(session);
+    allocator->release(allocator->context, session, olm_session_size());
 }
 
 
-size_t olm_pickle_session_length(
+size_t olm_session_copy_size(
     OlmSession * session
 ) {
-    return _olm_enc_output_length(pickle_length(*from_c(session)));
+    olm::Ratchet const & ratchet = from_c(session)->ratchet;
+    if (ratchet.skipped_keys_out_of_line) {
+        return sizeof(olm::Session)
+            + olm::Session::compact_storage_length(ratchet.limits);
+    }
+    return sizeof(olm::Session)
+        + olm::Session::storage_length(ratchet.limits);
 }
 
 
-size_t olm_pickle_account(
-    OlmAccount * account,
-    void const * key, size_t key_length,
-    void * pickled, size_t pickled_length
+OlmSession * olm_session_copy(
+    void * memory, size_t memory_length,
+    OlmSession * session
 ) {
-    olm::Account & object = *from_c(account);
-    std::size_t raw_length = pickle_length(object);
-    if (pickled_length < _olm_enc_output_length(raw_length)) {
+    olm::Session & object = *from_c(session);
+    if (memory_length < olm_session_copy_size(session)) {
         object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
-        return size_t(-1);
+        return nullptr;
     }
-    pickle(_olm_enc_output_pos(from_c(pickled), raw_length), object);
-    return _olm_enc_output(from_c(key), key_length, from_c(pickled), raw_length);
+    /* the copy gets its own storage, so a plain copy of the object isn't
+     * enough */
+    olm::Ratchet const & ratchet = object.ratchet;
+    OlmSession * copy = ratchet.skipped_keys_out_of_line
+        ? create_compact_session(
+            memory, ratchet.limits, object.skipped_key_allocator
+        )
+        : create_session(memory, ratchet.limits);
+    if (!from_c(copy)->copy_from(object)) {
+        object.last_error = from_c(copy)->last_error;
+        olm::unset(memory, olm_session_copy_size(session));
+        return nullptr;
+    }
+    return copy;
+}
+
+
+/** The share of a list's storage that each of its capacity items takes */
+static std::size_t item_share(
+    std::size_t storage_length, std::size_t capacity
+) {
+    return capacity ? storage_length / capacity : 0;
+}
+
+
+void olm_account_memory_stats(
+    const OlmAccount * account,
+    OlmMemoryStats * stats
+) {
+    olm::Account const & object = *from_c(account);
+    std::size_t capacity = object.one_time_keys.capacity();
+    std::size_t storage_length = olm::Account::storage_length(capacity);
+    stats->objects += 1;
+    stats->reserved_bytes += sizeof(olm::Account) + storage_length;
+    stats->live_bytes += sizeof(olm::Account)
+        + object.one_time_keys.size() * item_share(storage_length, capacity);
+    stats->one_time_keys += object.one_time_keys.size();
+    stats->max_one_time_keys += capacity;
+}
+
+
+void olm_session_memory_stats(
+    const OlmSession * session,
+    OlmMemoryStats * stats
+) {
+    olm::Ratchet const & ratchet = from_c(session)->ratchet;
+    olm::RatchetLimits const & limits = ratchet.limits;
+    std::size_t chain_length =
+        olm::Ratchet::receiver_chain_storage_length(limits);
+    std::size_t key_length =
+        olm::Ratchet::skipped_message_key_storage_length(limits);
+    stats->objects += 1;
+    /* a compact session only has room for skipped keys while it has some */
+    stats->reserved_bytes += sizeof(olm::Session) + chain_length;
+    if (!ratchet.skipped_keys_out_of_line
+            || ratchet.skipped_message_keys.capacity()) {
+        stats->reserved_bytes += key_length;
+    }
+    stats->live_bytes += sizeof(olm::Session)
+        + ratchet.receiver_chains.size()
+            * item_share(chain_length, limits.max_receiver_chains)
+        + ratchet.skipped_message_keys.size()
+            * item_share(key_length, limits.max_skipped_message_keys);
+    stats->receiver_chains += ratchet.receiver_chains.size();
+    stats->max_receiver_chains += limits.max_receiver_chains;
+    stats->skipped_message_keys += ratchet.skipped_message_keys.size();
+    stats->max_skipped_message_keys += limits.max_skipped_message_keys;
+}
+
+
+size_t olm_session_set_skipped_key_eviction(
+    OlmSession * session,
+    size_t max_age, size_t max_count
+) {
+    olm::Session & object = *from_c(session);
+    olm::Ratchet & ratchet = object.ratchet;
+    std::size_t const limit = std::uint32_t(-1);
+    ratchet.skipped_key_eviction.max_age =
+        std::uint32_t(max_age < limit ? max_age : limit);
+    ratchet.skipped_key_eviction.max_count =
+        std::uint32_t(max_count < limit ? max_count : limit);
+    ratchet.evict_skipped_message_keys();
+    ratchet.release_skipped_message_keys(object.skipped_key_allocator);
+    return 0;
+}
+
+
+size_t olm_session_set_skipped_key_ranges(
+    OlmSession * session,
+    size_t min_gap
+) {
+    std::size_t const limit = std::uint32_t(-1);
+    from_c(session)->ratchet.skipped_range_threshold =
+        std::uint32_t(min_gap < limit ? min_gap : limit);
+    return 0;
+}
+
+
+size_t olm_clear_utility(
+    OlmUtility * utility
+) {
+    /* Clear the memory backing the session */
+    olm::unset(utility, sizeof(olm::Utility));
+    /* Initialise a fresh session object in case someone tries to use it */
+    new(utility) olm::Utility();
+    return sizeof(olm::Utility);
+}
+
+
+size_t olm_utility_trim_memory(
+    OlmUtility * utility, int level
+) {
+    olm::Utility & object = *from_c(utility);
+    if (level < OLM_TRIM_MEMORY_CACHES) {
+        return 0;
+    }
+    std::size_t wiped =
+        object.key_cache_length * sizeof(_olm_ed25519_prepared_key);
+    olm::unset(object.key_cache);
+    object.key_cache_length = 0;
+    object.key_cache_next = 0;
+    return wiped;
+}
+
+
+size_t olm_pickle_account_length(
+    OlmAccount * account
+) {
+    return _olm_enc_output_length(pickle_length(*from_c(account)));
+}
+
+
+size_t olm_pickle_session_length(
+    OlmSession * session
+) {
+    return _olm_enc_output_length(pickle_length(*from_c(session)));
+}
+
+
+size_t olm_pickle_account(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_PICKLE);
+    olm::TraceScope trace(OLM_TRACE_PICKLE);
+    OLM_PROBE2(pickle_entry, OLM_PROBE_ACCOUNT, pickled_length);
+    olm::Account & object = *from_c(account);
+    std::size_t raw_length = pickle_length(object);
+    std::size_t result = std::size_t(-1);
+    if (object.identity_keys_only) {
+        object.last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+    } else if (pickled_length < _olm_enc_output_length(raw_length)) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+    } else {
+        pickle(_olm_enc_output_pos(from_c(pickled), raw_length), object);
+        result = _olm_enc_output(
+            from_c(key), key_length, from_c(pickled), raw_length
+        );
+    }
+    OLM_PROBE2(pickle_return, OLM_PROBE_ACCOUNT, result);
+    return result;
 }
 
 
@@ -236,14 +1119,23 @@ size_t olm_pickle_session(
     void const * key, size_t key_length,
     void * pickled, size_t pickled_length
 ) {
+    olm::StatsTimer timer(OLM_STATS_PICKLE);
+    olm::TraceScope trace(OLM_TRACE_PICKLE);
+    OLM_PROBE2(pickle_entry, OLM_PROBE_SESSION, pickled_length);
     olm::Session & object = *from_c(session);
     std::size_t raw_length = pickle_length(object);
     if (pickled_length < _olm_enc_output_length(raw_length)) {
         object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_PROBE2(pickle_return, OLM_PROBE_SESSION, size_t(-1));
         return size_t(-1);
     }
     pickle(_olm_enc_output_pos(from_c(pickled), raw_length), object);
-    return _olm_enc_output(from_c(key), key_length, from_c(pickled), raw_length);
+    std::size_t result = _olm_enc_output(
+        from_c(key), key_length, from_c(pickled), raw_length
+    );
+    object.forget_changes();
+    OLM_PROBE2(pickle_return, OLM_PROBE_SESSION, result);
+    return result;
 }
 
 
@@ -252,20 +1144,45 @@ size_t olm_unpickle_account(
     void const * key, size_t key_length,
     void * pickled, size_t pickled_length
 ) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    OLM_PROBE2(unpickle_entry, OLM_PROBE_ACCOUNT, pickled_length);
     olm::Account & object = *from_c(account);
     std::uint8_t * const pos = from_c(pickled);
-    std::size_t raw_length = _olm_enc_input(
+    std::size_t result = _olm_enc_input(
         from_c(key), key_length, pos, pickled_length, &object.last_error
     );
+    if (result != std::size_t(-1)
+            && unpickle_raw(object, pos, result) != std::size_t(-1)) {
+        result = pickled_length;
+    } else {
+        result = std::size_t(-1);
+    }
+    OLM_PROBE2(unpickle_return, OLM_PROBE_ACCOUNT, result);
+    return result;
+}
+
+
+size_t olm_unpickle_account_identity_keys(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    olm::Account & object = *from_c(account);
+    std::uint8_t * const pos = from_c(pickled);
+    std::size_t raw_length = _olm_enc_input_prefix(
+        from_c(key), key_length, pos, pickled_length,
+        olm::identity_keys_pickle_length(), &object.last_error
+    );
     if (raw_length == std::size_t(-1)) {
         return std::size_t(-1);
     }
+    /* The one time keys follow, so the identity keys must end before the
+     * decrypted part does */
     std::uint8_t * const end = pos + raw_length;
-    /* On success unpickle will return (pos + raw_length). If unpickling
-     * terminates too soon then it will return a pointer before
-     * (pos + raw_length). On error unpickle will return (pos + raw_length + 1).
-     */
-    if (end != unpickle(pos, end + 1, object)) {
+    if (olm::unpickle_identity_keys(pos, end + 1, object) > end) {
         if (object.last_error == OlmErrorCode::OLM_SUCCESS) {
             object.last_error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
         }
@@ -280,404 +1197,2142 @@ size_t olm_unpickle_session(
     void const * key, size_t key_length,
     void * pickled, size_t pickled_length
 ) {
+    olm::StatsTimer timer(OLM_STATS_UNPICKLE);
+    olm::TraceScope trace(OLM_TRACE_UNPICKLE);
+    OLM_PROBE2(unpickle_entry, OLM_PROBE_SESSION, pickled_length);
     olm::Session & object = *from_c(session);
     std::uint8_t * const pos = from_c(pickled);
-    std::size_t raw_length = _olm_enc_input(
+    std::size_t result = _olm_enc_input(
         from_c(key), key_length, pos, pickled_length, &object.last_error
     );
-    if (raw_length == std::size_t(-1)) {
-        return std::size_t(-1);
-    }
-
-    std::uint8_t * const end = pos + raw_length;
-    /* On success unpickle will return (pos + raw_length). If unpickling
-     * terminates too soon then it will return a pointer before
-     * (pos + raw_length). On error unpickle will return (pos + raw_length + 1).
-     */
-    if (end != unpickle(pos, end + 1, object)) {
-        if (object.last_error == OlmErrorCode::OLM_SUCCESS) {
-            object.last_error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
-        }
-        return std::size_t(-1);
+    if (result != std::size_t(-1)
+            && unpickle_raw(object, pos, result) != std::size_t(-1)) {
+        object.forget_changes();
+        result = pickled_length;
+    } else {
+        result = std::size_t(-1);
     }
-    return pickled_length;
+    OLM_PROBE2(unpickle_return, OLM_PROBE_SESSION, result);
+    return result;
 }
 
 
-size_t olm_create_account_random_length(
+size_t olm_pickle_account_binary_length(
     OlmAccount * account
 ) {
-    return from_c(account)->new_account_random_length();
+    return _olm_enc_output_binary_length(pickle_length(*from_c(account)));
 }
 
 
-size_t olm_create_account(
+size_t olm_pickle_session_binary_length(
+    OlmSession * session
+) {
+    return _olm_enc_output_binary_length(pickle_length(*from_c(session)));
+}
+
+
+size_t olm_pickle_account_binary(
     OlmAccount * account,
-    void * random, size_t random_length
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
 ) {
-    size_t result = from_c(account)->new_account(from_c(random), random_length);
-    olm::unset(random, random_length);
-    return result;
+    if (from_c(account)->identity_keys_only) {
+        from_c(account)->last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+        return std::size_t(-1);
+    }
+    return pickle_binary(
+        *from_c(account), key, key_length, pickled, pickled_length
+    );
 }
 
 
-size_t olm_account_identity_keys_length(
-    OlmAccount * account
+size_t olm_pickle_session_binary(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
 ) {
-    return from_c(account)->get_identity_json_length();
+    std::size_t result = pickle_binary(
+        *from_c(session), key, key_length, pickled, pickled_length
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
 }
 
 
-size_t olm_account_identity_keys(
+size_t olm_unpickle_account_binary(
     OlmAccount * account,
-    void * identity_keys, size_t identity_key_length
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
 ) {
-    return from_c(account)->get_identity_json(
-        from_c(identity_keys), identity_key_length
+    return unpickle_binary(
+        *from_c(account), key, key_length, pickled, pickled_length
     );
 }
 
 
-size_t olm_account_signature_length(
-    OlmAccount * account
+size_t olm_unpickle_session_binary(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
 ) {
-    return b64_output_length(from_c(account)->signature_length());
+    std::size_t result = unpickle_binary(
+        *from_c(session), key, key_length, pickled, pickled_length
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
 }
 
 
-size_t olm_account_sign(
+size_t olm_unpickle_account_const(
     OlmAccount * account,
-    void const * message, size_t message_length,
-    void * signature, size_t signature_length
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
 ) {
-    std::size_t raw_length = from_c(account)->signature_length();
-    if (signature_length < b64_output_length(raw_length)) {
-        from_c(account)->last_error =
-            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
-        return std::size_t(-1);
-    }
-    from_c(account)->sign(
-         from_c(message), message_length,
-         b64_output_pos(from_c(signature), raw_length), raw_length
+    return unpickle_const(
+        *from_c(account), key, key_length, pickled, pickled_length,
+        scratch, scratch_length, false
     );
-    return b64_output(from_c(signature), raw_length);
 }
 
 
-size_t olm_account_one_time_keys_length(
-    OlmAccount * account
+size_t olm_unpickle_session_const(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
 ) {
-    return from_c(account)->get_one_time_keys_json_length();
+    std::size_t result = unpickle_const(
+        *from_c(session), key, key_length, pickled, pickled_length,
+        scratch, scratch_length, false
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
 }
 
 
-size_t olm_account_one_time_keys(
+size_t olm_unpickle_account_binary_const(
     OlmAccount * account,
-    void * one_time_keys_json, size_t one_time_key_json_length
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
 ) {
-    return from_c(account)->get_one_time_keys_json(
-        from_c(one_time_keys_json), one_time_key_json_length
+    return unpickle_const(
+        *from_c(account), key, key_length, pickled, pickled_length,
+        scratch, scratch_length, true
     );
 }
 
 
-size_t olm_account_mark_keys_as_published(
-    OlmAccount * account
+size_t olm_unpickle_session_binary_const(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void const * pickled, size_t pickled_length,
+    void * scratch, size_t scratch_length
 ) {
-    return from_c(account)->mark_keys_as_published();
+    std::size_t result = unpickle_const(
+        *from_c(session), key, key_length, pickled, pickled_length,
+        scratch, scratch_length, true
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
 }
 
 
-size_t olm_account_max_number_of_one_time_keys(
+size_t olm_pickle_account_stream_scratch_length(
     OlmAccount * account
 ) {
-    return from_c(account)->max_number_of_one_time_keys();
+    return stream_scratch_length(*from_c(account));
 }
 
 
-size_t olm_account_generate_one_time_keys_random_length(
-    OlmAccount * account,
-    size_t number_of_keys
+size_t olm_pickle_session_stream_scratch_length(
+    OlmSession * session
 ) {
-    return from_c(account)->generate_one_time_keys_random_length(number_of_keys);
+    return stream_scratch_length(*from_c(session));
 }
 
 
-size_t olm_account_generate_one_time_keys(
+size_t olm_pickle_account_stream(
     OlmAccount * account,
-    size_t number_of_keys,
-    void * random, size_t random_length
+    void const * key, size_t key_length,
+    OlmPickleWriter write, void * write_context,
+    void * scratch, size_t scratch_length
 ) {
-    size_t result = from_c(account)->generate_one_time_keys(
-        number_of_keys,
-        from_c(random), random_length
+    if (from_c(account)->identity_keys_only) {
+        from_c(account)->last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+        return std::size_t(-1);
+    }
+    _olm_enc_context context;
+    _olm_enc_context_init_aes_sha_256(from_c(key), key_length, &context);
+    std::size_t result = pickle_stream(
+        *from_c(account), context, write, write_context,
+        scratch, scratch_length
     );
-    olm::unset(random, random_length);
+    _olm_enc_context_clear(&context);
     return result;
 }
 
 
-size_t olm_create_outbound_session_random_length(
-    OlmSession * session
+size_t olm_pickle_session_stream(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    OlmPickleWriter write, void * write_context,
+    void * scratch, size_t scratch_length
 ) {
-    return from_c(session)->new_outbound_session_random_length();
+    _olm_enc_context context;
+    _olm_enc_context_init_aes_sha_256(from_c(key), key_length, &context);
+    std::size_t result = pickle_stream(
+        *from_c(session), context, write, write_context,
+        scratch, scratch_length
+    );
+    _olm_enc_context_clear(&context);
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
 }
 
 
-size_t olm_create_outbound_session(
-    OlmSession * session,
+size_t olm_unpickle_account_stream(
     OlmAccount * account,
-    void const * their_identity_key, size_t their_identity_key_length,
-    void const * their_one_time_key, size_t their_one_time_key_length,
-    void * random, size_t random_length
+    void const * key, size_t key_length,
+    OlmPickleReader read, void * read_context,
+    void * scratch, size_t scratch_length
 ) {
-    std::uint8_t const * id_key = from_c(their_identity_key);
-    std::uint8_t const * ot_key = from_c(their_one_time_key);
-    std::size_t id_key_length = their_identity_key_length;
-    std::size_t ot_key_length = their_one_time_key_length;
-
-    if (olm::decode_base64_length(id_key_length) != CURVE25519_KEY_LENGTH
-            || olm::decode_base64_length(ot_key_length) != CURVE25519_KEY_LENGTH
-    ) {
-        from_c(session)->last_error = OlmErrorCode::OLM_INVALID_BASE64;
-        return std::size_t(-1);
-    }
-    _olm_curve25519_public_key identity_key;
-    _olm_curve25519_public_key one_time_key;
-
-    olm::decode_base64(id_key, id_key_length, identity_key.public_key);
-    olm::decode_base64(ot_key, ot_key_length, one_time_key.public_key);
-
-    size_t result = from_c(session)->new_outbound_session(
-        *from_c(account), identity_key, one_time_key,
-        from_c(random), random_length
+    _olm_enc_context context;
+    _olm_enc_context_init_aes_sha_256(from_c(key), key_length, &context);
+    std::size_t result = unpickle_stream(
+        *from_c(account), context, read, read_context, std::size_t(-1),
+        scratch, scratch_length
     );
-    olm::unset(random, random_length);
+    _olm_enc_context_clear(&context);
     return result;
 }
 
 
-size_t olm_create_inbound_session(
+size_t olm_unpickle_session_stream(
     OlmSession * session,
-    OlmAccount * account,
-    void * one_time_key_message, size_t message_length
+    void const * key, size_t key_length,
+    OlmPickleReader read, void * read_context,
+    void * scratch, size_t scratch_length
 ) {
-    std::size_t raw_length = b64_input(
-        from_c(one_time_key_message), message_length, from_c(session)->last_error
+    _olm_enc_context context;
+    _olm_enc_context_init_aes_sha_256(from_c(key), key_length, &context);
+    std::size_t result = unpickle_stream(
+        *from_c(session), context, read, read_context, std::size_t(-1),
+        scratch, scratch_length
     );
-    if (raw_length == std::size_t(-1)) {
-        return std::size_t(-1);
+    _olm_enc_context_clear(&context);
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
     }
-    return from_c(session)->new_inbound_session(
-        *from_c(account), nullptr, from_c(one_time_key_message), raw_length
-    );
+    return result;
 }
 
 
-size_t olm_create_inbound_session_from(
-    OlmSession * session,
-    OlmAccount * account,
-    void const * their_identity_key, size_t their_identity_key_length,
-    void * one_time_key_message, size_t message_length
+size_t olm_pickle_account_fixed_length(
+    OlmAccount * account, size_t record_size
 ) {
-    std::uint8_t const * id_key = from_c(their_identity_key);
-    std::size_t id_key_length = their_identity_key_length;
+    return fixed_length(*from_c(account), record_size);
+}
 
-    if (olm::decode_base64_length(id_key_length) != CURVE25519_KEY_LENGTH) {
-        from_c(session)->last_error = OlmErrorCode::OLM_INVALID_BASE64;
-        return std::size_t(-1);
-    }
-    _olm_curve25519_public_key identity_key;
-    olm::decode_base64(id_key, id_key_length, identity_key.public_key);
 
+size_t olm_pickle_session_fixed_length(
+    OlmSession * session, size_t record_size
+) {
+    return fixed_length(*from_c(session), record_size);
+}
+
+
+size_t olm_pickle_account_fixed(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    if (from_c(account)->identity_keys_only) {
+        from_c(account)->last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+        return std::size_t(-1);
+    }
+    return pickle_fixed(
+        *from_c(account), key, key_length, pickled, pickled_length
+    );
+}
+
+
+size_t olm_pickle_session_fixed(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    std::size_t result = pickle_fixed(
+        *from_c(session), key, key_length, pickled, pickled_length
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
+}
+
+
+size_t olm_unpickle_account_fixed(
+    OlmAccount * account,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    return unpickle_fixed(
+        *from_c(account), key, key_length, pickled, pickled_length
+    );
+}
+
+
+size_t olm_unpickle_session_fixed(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    std::size_t result = unpickle_fixed(
+        *from_c(session), key, key_length, pickled, pickled_length
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
+}
+
+
+size_t olm_pickle_account_with_key_length(
+    OlmAccount * account, uint32_t cipher
+) {
+    return _olm_enc_output_with_cipher_length(
+        cipher, pickle_length(*from_c(account))
+    );
+}
+
+
+size_t olm_pickle_session_with_key_length(
+    OlmSession * session, uint32_t cipher
+) {
+    return _olm_enc_output_with_cipher_length(
+        cipher, pickle_length(*from_c(session))
+    );
+}
+
+
+size_t olm_pickle_account_with_key(
+    OlmAccount * account,
+    OlmPickleKey const * pickle_key, uint32_t cipher,
+    void * pickled, size_t pickled_length
+) {
+    if (from_c(account)->identity_keys_only) {
+        from_c(account)->last_error = OlmErrorCode::OLM_PARTIAL_ACCOUNT;
+        return std::size_t(-1);
+    }
+    return pickle_with_key(
+        *from_c(account), pickle_key, cipher, pickled, pickled_length
+    );
+}
+
+
+size_t olm_pickle_session_with_key(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key, uint32_t cipher,
+    void * pickled, size_t pickled_length
+) {
+    std::size_t result = pickle_with_key(
+        *from_c(session), pickle_key, cipher, pickled, pickled_length
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
+}
+
+
+size_t olm_unpickle_account_with_key(
+    OlmAccount * account,
+    OlmPickleKey const * pickle_key,
+    void * pickled, size_t pickled_length
+) {
+    return unpickle_with_key(
+        *from_c(account), pickle_key, pickled, pickled_length
+    );
+}
+
+
+size_t olm_unpickle_session_with_key(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key,
+    void * pickled, size_t pickled_length
+) {
+    std::size_t result = unpickle_with_key(
+        *from_c(session), pickle_key, pickled, pickled_length
+    );
+    if (result != std::size_t(-1)) {
+        from_c(session)->forget_changes();
+    }
+    return result;
+}
+
+
+size_t olm_pickle_session_batch_length(
+    OlmSession * const * sessions, size_t count
+) {
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        length += _olm_enc_output_binary_length(
+            pickle_length(*from_c(sessions[i]))
+        );
+    }
+    return _olm_batch_length(count, length);
+}
+
+
+size_t olm_pickle_session_batch(
+    OlmPickleKey const * pickle_key,
+    OlmSession * const * sessions, size_t count,
+    void * pickled, size_t pickled_length
+) {
+    if (pickled_length < olm_pickle_session_batch_length(sessions, count)) {
+        if (count) {
+            from_c(sessions[0])->last_error =
+                OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        }
+        return std::size_t(-1);
+    }
+    std::uint8_t * pos = _olm_batch_write_header(from_c(pickled), count);
+    for (std::size_t i = 0; i < count; ++i) {
+        olm::Session & object = *from_c(sessions[i]);
+        std::size_t raw_length = pickle_length(object);
+        pos = _olm_batch_write_entry(
+            pos, _olm_enc_output_binary_length(raw_length)
+        );
+        pickle(pos, object);
+        pos += _olm_enc_output_binary_with_context(
+            &pickle_key->context, pos, raw_length
+        );
+        object.forget_changes();
+    }
+    return pos - from_c(pickled);
+}
+
+
+size_t olm_unpickle_session_batch(
+    OlmPickleKey const * pickle_key,
+    void * pickled, size_t pickled_length,
+    size_t first,
+    OlmSession * const * sessions, size_t count
+) {
+    if (count == 0) {
+        return 0;
+    }
+    _olm_batch_reader reader;
+    OlmErrorCode error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
+    std::size_t total = _olm_batch_reader_init(
+        &reader, from_c(pickled), pickled_length, &error
+    );
+    if (total == std::size_t(-1) || first > total || count > total - first) {
+        from_c(sessions[0])->last_error = error;
+        return std::size_t(-1);
+    }
+    std::size_t length;
+    for (std::size_t i = 0; i < first; ++i) {
+        if (!_olm_batch_reader_next(&reader, &length)) {
+            from_c(sessions[0])->last_error =
+                OlmErrorCode::OLM_CORRUPTED_PICKLE;
+            return std::size_t(-1);
+        }
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        olm::Session & object = *from_c(sessions[i]);
+        std::uint8_t * pickle = _olm_batch_reader_next(&reader, &length);
+        if (!pickle) {
+            object.last_error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
+            return std::size_t(-1);
+        }
+        std::size_t raw_length = _olm_enc_input_binary_with_context(
+            &pickle_key->context, pickle, length, &object.last_error
+        );
+        if (raw_length == std::size_t(-1)
+                || unpickle_raw(object, pickle, raw_length)
+                    == std::size_t(-1)) {
+            return std::size_t(-1);
+        }
+        object.forget_changes();
+    }
+    return count;
+}
+
+
+size_t olm_pickle_session_batch_stream(
+    OlmPickleKey const * pickle_key,
+    OlmSession * const * sessions, size_t count,
+    OlmPickleWriter write, void * write_context,
+    void * scratch, size_t scratch_length
+) {
+    std::uint8_t header[2 * sizeof(std::uint32_t)];
+    _olm_batch_write_header(header, count);
+    if (write(write_context, header, sizeof(header))) {
+        if (count) {
+            from_c(sessions[0])->last_error =
+                OlmErrorCode::OLM_PICKLE_STREAM_FAILED;
+        }
+        return std::size_t(-1);
+    }
+    std::size_t length = sizeof(header);
+    for (std::size_t i = 0; i < count; ++i) {
+        olm::Session & object = *from_c(sessions[i]);
+        std::size_t raw_length = pickle_length(object);
+        if (scratch_length < raw_length) {
+            object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+            return std::size_t(-1);
+        }
+        std::uint8_t entry[sizeof(std::uint32_t)];
+        _olm_batch_write_entry(
+            entry, _olm_enc_output_binary_length(raw_length)
+        );
+        if (write(write_context, entry, sizeof(entry))) {
+            object.last_error = OlmErrorCode::OLM_PICKLE_STREAM_FAILED;
+            return std::size_t(-1);
+        }
+        std::size_t result = pickle_stream(
+            object, pickle_key->context, write, write_context,
+            scratch, scratch_length
+        );
+        if (result == std::size_t(-1)) {
+            return std::size_t(-1);
+        }
+        object.forget_changes();
+        length += sizeof(entry) + result;
+    }
+    return length;
+}
+
+
+size_t olm_unpickle_session_batch_stream(
+    OlmPickleKey const * pickle_key,
+    OlmPickleReader read, void * read_context,
+    void * scratch, size_t scratch_length,
+    OlmSession * const * sessions, size_t count
+) {
+    if (count == 0) {
+        return 0;
+    }
+    std::uint8_t header[2 * sizeof(std::uint32_t)];
+    OlmErrorCode error = read_stream(
+        read, read_context, header, sizeof(header)
+    );
+    if (error == OlmErrorCode::OLM_SUCCESS) {
+        _olm_batch_reader reader;
+        std::size_t total = _olm_batch_reader_init(
+            &reader, header, sizeof(header), &error
+        );
+        if (total != std::size_t(-1) && total < count) {
+            error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
+        }
+    }
+    if (error != OlmErrorCode::OLM_SUCCESS) {
+        from_c(sessions[0])->last_error = error;
+        return std::size_t(-1);
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        olm::Session & object = *from_c(sessions[i]);
+        std::uint8_t entry[sizeof(std::uint32_t)];
+        error = read_stream(read, read_context, entry, sizeof(entry));
+        if (error != OlmErrorCode::OLM_SUCCESS) {
+            object.last_error = error;
+            return std::size_t(-1);
+        }
+        std::uint32_t length;
+        olm::unpickle(entry, entry + sizeof(entry), length);
+        if (unpickle_stream(
+                object, pickle_key->context, read, read_context, length,
+                scratch, scratch_length
+            ) == std::size_t(-1)) {
+            return std::size_t(-1);
+        }
+        object.forget_changes();
+    }
+    return count;
+}
+
+
+size_t olm_session_hibernate_length(
+    OlmSession * session
+) {
+    return _olm_enc_output_binary_length(pickle_length(*from_c(session)));
+}
+
+
+size_t olm_session_hibernate(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key,
+    void * sealed, size_t sealed_length
+) {
+    olm::Session & object = *from_c(session);
+    std::size_t raw_length = pickle_length(object);
+    if (sealed_length < _olm_enc_output_binary_length(raw_length)) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    pickle(from_c(sealed), object);
+    std::size_t result = _olm_enc_output_binary_with_context(
+        &pickle_key->context, from_c(sealed), raw_length
+    );
+    olm_clear_session(session);
+    return result;
+}
+
+
+size_t olm_session_wake(
+    OlmSession * session,
+    OlmPickleKey const * pickle_key,
+    void * sealed, size_t sealed_length
+) {
+    olm::Session & object = *from_c(session);
+    std::size_t raw_length = _olm_enc_input_binary_with_context(
+        &pickle_key->context, from_c(sealed), sealed_length,
+        &object.last_error
+    );
+    if (raw_length == std::size_t(-1)
+            || unpickle_raw(object, from_c(sealed), raw_length)
+                == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    object.forget_changes();
+    return sealed_length;
+}
+
+
+size_t olm_pickle_session_delta_length(
+    OlmSession * session
+) {
+    return _olm_enc_output_length(pickle_delta_length(*from_c(session)));
+}
+
+
+size_t olm_pickle_session_delta(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::Session & object = *from_c(session);
+    std::size_t raw_length = pickle_delta_length(object);
+    if (pickled_length < _olm_enc_output_length(raw_length)) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return size_t(-1);
+    }
+    pickle_delta(_olm_enc_output_pos(from_c(pickled), raw_length), object);
+    std::size_t result = _olm_enc_output(
+        from_c(key), key_length, from_c(pickled), raw_length
+    );
+    object.forget_changes();
+    return result;
+}
+
+
+size_t olm_unpickle_session_delta(
+    OlmSession * session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    olm::Session & object = *from_c(session);
+    std::uint8_t * const pos = from_c(pickled);
+    std::size_t raw_length = _olm_enc_input(
+        from_c(key), key_length, pos, pickled_length, &object.last_error
+    );
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    std::uint8_t * const end = pos + raw_length;
+    /* As for olm_unpickle_session() */
+    if (end != unpickle_delta(pos, end + 1, object)) {
+        if (object.last_error == OlmErrorCode::OLM_SUCCESS) {
+            object.last_error = OlmErrorCode::OLM_CORRUPTED_PICKLE;
+        }
+        return std::size_t(-1);
+    }
+    object.forget_changes();
+    return pickled_length;
+}
+
+
+size_t olm_create_account_random_length(
+    OlmAccount * account
+) {
+    return from_c(account)->new_account_random_length();
+}
+
+
+size_t olm_create_account(
+    OlmAccount * account,
+    void * random, size_t random_length
+) {
+    size_t result = from_c(account)->new_account(from_c(random), random_length);
+    olm::unset(random, random_length);
+    return result;
+}
+
+
+size_t olm_create_account_auto_random(
+    OlmAccount * account
+) {
+    olm::Account & object = *from_c(account);
+    std::uint8_t random[ED25519_RANDOM_LENGTH + CURVE25519_RANDOM_LENGTH];
+    std::size_t random_length = object.new_account_random_length();
+    if (!auto_random(random, random_length, object.last_error)) {
+        return std::size_t(-1);
+    }
+    return olm_create_account(account, random, random_length);
+}
+
+
+size_t olm_account_identity_keys_length(
+    OlmAccount * account
+) {
+    return from_c(account)->get_identity_json_length();
+}
+
+
+size_t olm_account_identity_keys(
+    OlmAccount * account,
+    void * identity_keys, size_t identity_key_length
+) {
+    return from_c(account)->get_identity_json(
+        from_c(identity_keys), identity_key_length
+    );
+}
+
+
+size_t olm_account_signature_length(
+    OlmAccount * account
+) {
+    return b64_output_length(from_c(account)->signature_length());
+}
+
+
+size_t olm_account_sign(
+    OlmAccount * account,
+    void const * message, size_t message_length,
+    void * signature, size_t signature_length
+) {
+    std::size_t raw_length = from_c(account)->signature_length();
+    if (signature_length < b64_output_length(raw_length)) {
+        from_c(account)->last_error =
+            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    from_c(account)->sign(
+         from_c(message), message_length,
+         b64_output_pos(from_c(signature), raw_length), raw_length
+    );
+    return b64_output(from_c(signature), raw_length);
+}
+
+
+size_t olm_account_sign_batch(
+    OlmAccount * account, size_t count,
+    void const * const * messages, size_t const * message_lengths,
+    void * signatures, size_t signatures_length,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    std::size_t signature_length = olm::encode_base64_length(
+        from_c(account)->signature_length()
+    );
+    if (signatures_length / signature_length < count) {
+        from_c(account)->last_error =
+            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    SignBatch batch = {
+        from_c(account), count, messages, message_lengths,
+        from_c(signatures), signature_length,
+    };
+    std::size_t job_count =
+        (count + SIGN_BATCH_LENGTH - 1) / SIGN_BATCH_LENGTH;
+    if (executor) {
+        executor(executor_context, sign_batch_job, &batch, job_count);
+    } else {
+        for (std::size_t job = 0; job < job_count; ++job) {
+            sign_batch_job(&batch, job);
+        }
+    }
+    return count;
+}
+
+
+size_t olm_account_one_time_keys_length(
+    OlmAccount * account
+) {
+    return from_c(account)->get_one_time_keys_json_length();
+}
+
+
+size_t olm_account_one_time_keys(
+    OlmAccount * account,
+    void * one_time_keys_json, size_t one_time_key_json_length
+) {
+    return from_c(account)->get_one_time_keys_json(
+        from_c(one_time_keys_json), one_time_key_json_length
+    );
+}
+
+
+size_t olm_account_write_one_time_keys(
+    OlmAccount * account,
+    OlmOutputCallback write, void * context
+) {
+    return from_c(account)->write_one_time_keys_json(write, context);
+}
+
+
+size_t olm_account_one_time_keys_binary_length(
+    OlmAccount * account
+) {
+    return from_c(account)->get_one_time_keys_binary_length();
+}
+
+
+size_t olm_account_one_time_keys_binary(
+    OlmAccount * account,
+    void * output, size_t output_length
+) {
+    return from_c(account)->get_one_time_keys_binary(
+        from_c(output), output_length
+    );
+}
+
+
+size_t olm_account_mark_keys_as_published(
+    OlmAccount * account
+) {
+    return from_c(account)->mark_keys_as_published();
+}
+
+
+size_t olm_account_max_number_of_one_time_keys(
+    OlmAccount * account
+) {
+    return from_c(account)->max_number_of_one_time_keys();
+}
+
+
+int olm_account_is_dirty(
+    OlmAccount const * account
+) {
+    return from_c(account)->dirty;
+}
+
+
+void olm_account_clear_dirty(
+    OlmAccount * account
+) {
+    from_c(account)->dirty = false;
+}
+
+
+size_t olm_account_generate_one_time_keys_random_length(
+    OlmAccount * account,
+    size_t number_of_keys
+) {
+    return from_c(account)->generate_one_time_keys_random_length(number_of_keys);
+}
+
+
+size_t olm_account_generate_one_time_keys(
+    OlmAccount * account,
+    size_t number_of_keys,
+    void * random, size_t random_length
+) {
+    size_t result = from_c(account)->generate_one_time_keys(
+        number_of_keys,
+        from_c(random), random_length
+    );
+    olm::unset(random, random_length);
+    return result;
+}
+
+
+size_t olm_account_generate_one_time_keys_auto_random(
+    OlmAccount * account,
+    size_t number_of_keys
+) {
+    olm::Account & object = *from_c(account);
+    /* generating the keys a few at a time is the same as all at once */
+    std::uint8_t random[32 * CURVE25519_RANDOM_LENGTH];
+    for (std::size_t i = 0; i < number_of_keys; i += 32) {
+        std::size_t count = std::min(number_of_keys - i, std::size_t(32));
+        std::size_t random_length =
+            object.generate_one_time_keys_random_length(count);
+        if (!auto_random(random, random_length, object.last_error)) {
+            return std::size_t(-1);
+        }
+        if (olm_account_generate_one_time_keys(
+            account, count, random, random_length
+        ) == std::size_t(-1)) {
+            return std::size_t(-1);
+        }
+    }
+    return number_of_keys;
+}
+
+
+size_t olm_create_outbound_session_random_length(
+    OlmSession * session
+) {
+    return from_c(session)->new_outbound_session_random_length();
+}
+
+
+size_t olm_create_outbound_session(
+    OlmSession * session,
+    OlmAccount * account,
+    void const * their_identity_key, size_t their_identity_key_length,
+    void const * their_one_time_key, size_t their_one_time_key_length,
+    void * random, size_t random_length
+) {
+    olm::StatsTimer timer(OLM_STATS_CREATE_OUTBOUND_SESSION);
+    olm::TraceScope trace(OLM_TRACE_CREATE_OUTBOUND_SESSION);
+    olm::RecordScope record(OLM_TRACE_CREATE_OUTBOUND_SESSION, session);
+    std::uint8_t const * id_key = from_c(their_identity_key);
+    std::uint8_t const * ot_key = from_c(their_one_time_key);
+    std::size_t id_key_length = their_identity_key_length;
+    std::size_t ot_key_length = their_one_time_key_length;
+
+    _olm_curve25519_public_key identity_key;
+    _olm_curve25519_public_key one_time_key;
+
+    if (!b64_key_input(
+            id_key, id_key_length, identity_key.public_key,
+            from_c(session)->last_error
+        ) || !b64_key_input(
+            ot_key, ot_key_length, one_time_key.public_key,
+            from_c(session)->last_error
+        )) {
+        return std::size_t(-1);
+    }
+
+    size_t result = from_c(session)->new_outbound_session(
+        *from_c(account), identity_key, one_time_key,
+        from_c(random), random_length
+    );
+    olm::unset(random, random_length);
+    return record.succeeded(result);
+}
+
+
+size_t olm_create_outbound_sessions(
+    OlmSession * const * sessions, size_t count,
+    OlmAccount * account,
+    void const * const * their_identity_keys,
+    size_t const * their_identity_key_lengths,
+    void const * const * their_one_time_keys,
+    size_t const * their_one_time_key_lengths,
+    void * random, size_t random_length
+) {
+    olm::Session * batch[SESSION_BATCH_LENGTH];
+    _olm_curve25519_public_key identity_keys[SESSION_BATCH_LENGTH];
+    _olm_curve25519_public_key one_time_keys[SESSION_BATCH_LENGTH];
+    std::uint8_t batch_random[SESSION_BATCH_LENGTH * SESSION_RANDOM_LENGTH];
+    std::uint8_t const * random_pos = from_c(random);
+    std::size_t random_left = random_length;
+    std::size_t failures = 0;
+
+    std::size_t i = 0;
+    while (i < count) {
+        std::size_t n = 0;
+        for (; i < count && n < SESSION_BATCH_LENGTH; ++i) {
+            olm::Session & session = *from_c(sessions[i]);
+            /* each session's random bytes stay where the caller put them,
+             * whether or not the session could be created */
+            bool have_random = random_left >= SESSION_RANDOM_LENGTH;
+            if (have_random) {
+                std::memcpy(
+                    batch_random + n * SESSION_RANDOM_LENGTH,
+                    random_pos, SESSION_RANDOM_LENGTH
+                );
+                random_pos += SESSION_RANDOM_LENGTH;
+                random_left -= SESSION_RANDOM_LENGTH;
+            }
+            if (!b64_key_input(
+                    from_c(their_identity_keys[i]),
+                    their_identity_key_lengths[i],
+                    identity_keys[n].public_key, session.last_error
+                ) || !b64_key_input(
+                    from_c(their_one_time_keys[i]),
+                    their_one_time_key_lengths[i],
+                    one_time_keys[n].public_key, session.last_error
+                )) {
+                failures++;
+            } else if (!have_random) {
+                session.last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
+                failures++;
+            } else {
+                batch[n++] = &session;
+            }
+        }
+        olm::Session::new_outbound_sessions(
+            n, batch, *from_c(account), identity_keys, one_time_keys,
+            batch_random
+        );
+    }
+    olm::unset(batch_random);
+    olm::unset(random, random_length);
+    return failures;
+}
+
+
+size_t olm_create_outbound_sessions_and_encrypt_random_length(
+    size_t count
+) {
+    return count * SESSION_RANDOM_LENGTH;
+}
+
+
+size_t olm_create_outbound_sessions_and_encrypt_message_length(
+    size_t plaintext_length
+) {
+    return b64_output_length(
+        olm::Session::new_outbound_message_length(plaintext_length)
+    );
+}
+
+
+size_t olm_create_outbound_sessions_and_encrypt(
+    OlmAccount * account, size_t count,
+    void const * const * their_identity_keys,
+    size_t const * their_identity_key_lengths,
+    void const * const * their_one_time_keys,
+    size_t const * their_one_time_key_lengths,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    const OlmAllocator * allocator,
+    OlmSession ** sessions,
+    void * messages, size_t messages_length,
+    size_t * message_lengths, const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    std::size_t message_length =
+        olm_create_outbound_sessions_and_encrypt_message_length(
+            plaintext_length
+        );
+    if (random_length
+            < olm_create_outbound_sessions_and_encrypt_random_length(count)
+            || messages_length / message_length < count) {
+        return std::size_t(-1);
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        sessions[i] = olm_allocate_session(allocator);
+        message_lengths[i] = std::size_t(-1);
+    }
+
+    OutboundSessionBatch batch = {
+        from_c(account), count,
+        their_identity_keys, their_identity_key_lengths,
+        their_one_time_keys, their_one_time_key_lengths,
+        from_c(plaintext), plaintext_length,
+        from_c(random), sessions, from_c(messages), message_length,
+        message_lengths,
+    };
+    std::size_t job_count =
+        (count + SESSION_BATCH_LENGTH - 1) / SESSION_BATCH_LENGTH;
+    if (executor) {
+        executor(
+            executor_context, outbound_session_batch_job, &batch, job_count
+        );
+    } else {
+        for (std::size_t job = 0; job < job_count; ++job) {
+            outbound_session_batch_job(&batch, job);
+        }
+    }
+    olm::unset(random, random_length);
+
+    std::size_t failures = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        char const * error = _olm_error_to_string(OlmErrorCode::OLM_SUCCESS);
+        if (!sessions[i]) {
+            error = _olm_error_to_string(OlmErrorCode::OLM_ALLOCATION_FAILED);
+        } else if (message_lengths[i] == std::size_t(-1)) {
+            error = olm_session_last_error(sessions[i]);
+            olm_release_session(allocator, sessions[i]);
+            sessions[i] = nullptr;
+        }
+        if (message_lengths[i] == std::size_t(-1)) {
+            failures++;
+        }
+        if (errors) {
+            errors[i] = error;
+        }
+    }
+    return failures;
+}
+
+
+size_t olm_create_outbound_session_auto_random(
+    OlmSession * session,
+    OlmAccount * account,
+    void const * their_identity_key, size_t their_identity_key_length,
+    void const * their_one_time_key, size_t their_one_time_key_length
+) {
+    olm::Session & object = *from_c(session);
+    std::uint8_t random[2 * CURVE25519_RANDOM_LENGTH];
+    std::size_t random_length = object.new_outbound_session_random_length();
+    if (!auto_random(random, random_length, object.last_error)) {
+        return std::size_t(-1);
+    }
+    return olm_create_outbound_session(
+        session, account,
+        their_identity_key, their_identity_key_length,
+        their_one_time_key, their_one_time_key_length,
+        random, random_length
+    );
+}
+
+
+size_t olm_create_inbound_session(
+    OlmSession * session,
+    OlmAccount * account,
+    void * one_time_key_message, size_t message_length
+) {
+    olm::StatsTimer timer(OLM_STATS_CREATE_INBOUND_SESSION);
+    olm::TraceScope trace(OLM_TRACE_CREATE_INBOUND_SESSION);
+    olm::RecordScope record(OLM_TRACE_CREATE_INBOUND_SESSION, session);
+    std::size_t raw_length = b64_input(
+        from_c(one_time_key_message), message_length, from_c(session)->last_error
+    );
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    record.message(0, raw_length, 0);
+    return record.succeeded(from_c(session)->new_inbound_session(
+        *from_c(account), nullptr, from_c(one_time_key_message), raw_length
+    ));
+}
+
+
+size_t olm_create_inbound_session_from(
+    OlmSession * session,
+    OlmAccount * account,
+    void const * their_identity_key, size_t their_identity_key_length,
+    void * one_time_key_message, size_t message_length
+) {
+    olm::StatsTimer timer(OLM_STATS_CREATE_INBOUND_SESSION);
+    olm::TraceScope trace(OLM_TRACE_CREATE_INBOUND_SESSION);
+    olm::RecordScope record(OLM_TRACE_CREATE_INBOUND_SESSION, session);
+    std::uint8_t const * id_key = from_c(their_identity_key);
+    std::size_t id_key_length = their_identity_key_length;
+
+    _olm_curve25519_public_key identity_key;
+    if (!b64_key_input(
+            id_key, id_key_length, identity_key.public_key,
+            from_c(session)->last_error
+    )) {
+        return std::size_t(-1);
+    }
+
+    std::size_t raw_length = b64_input(
+        from_c(one_time_key_message), message_length, from_c(session)->last_error
+    );
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    record.message(0, raw_length, 0);
+    return record.succeeded(from_c(session)->new_inbound_session(
+        *from_c(account), &identity_key,
+        from_c(one_time_key_message), raw_length
+    ));
+}
+
+
+size_t olm_create_inbound_session_and_decrypt(
+    OlmSession * session,
+    OlmAccount * account,
+    void const * their_identity_key, size_t their_identity_key_length,
+    void * one_time_key_message, size_t message_length,
+    void * plaintext, size_t max_plaintext_length
+) {
+    olm::StatsTimer timer(OLM_STATS_CREATE_INBOUND_SESSION);
+    olm::TraceScope trace(OLM_TRACE_CREATE_INBOUND_SESSION);
+    olm::RecordScope record(OLM_TRACE_CREATE_INBOUND_SESSION, session);
+    olm::Session & object = *from_c(session);
+
+    _olm_curve25519_public_key identity_key;
+    if (their_identity_key && !b64_key_input(
+            from_c(their_identity_key), their_identity_key_length,
+            identity_key.public_key, object.last_error
+    )) {
+        return std::size_t(-1);
+    }
+
+    std::uint8_t * raw = from_c(one_time_key_message);
+    std::size_t raw_length = b64_input(raw, message_length, object.last_error);
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    record.message(0, raw_length, unsigned(olm::MessageType::PRE_KEY));
+    olm::MessageView view;
+    olm::Session::decode_message_view(
+        view, olm::MessageType::PRE_KEY, raw, raw_length
+    );
+    if (object.new_inbound_session(
+            *from_c(account), their_identity_key ? &identity_key : nullptr,
+            view
+    ) == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    std::size_t result = object.decrypt(
+        view, from_c(plaintext), max_plaintext_length
+    );
+    if (result == std::size_t(-1)) {
+        return result;
+    }
+    /* the session found the key, so it is there to remove */
+    from_c(account)->remove_key(object.bob_one_time_key);
+    record.message(
+        result, raw_length, unsigned(olm::MessageType::PRE_KEY)
+    );
+    return record.succeeded(result);
+}
+
+
+size_t olm_session_id_length(
+    OlmSession * session
+) {
+    return b64_output_length(from_c(session)->session_id_length());
+}
+
+size_t olm_session_id(
+    OlmSession * session,
+    void * id, size_t id_length
+) {
+    std::size_t raw_length = from_c(session)->session_id_length();
+    if (id_length < b64_output_length(raw_length)) {
+        from_c(session)->last_error =
+                OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    std::size_t result = from_c(session)->session_id(
+       b64_output_pos(from_c(id), raw_length), raw_length
+    );
+    if (result == std::size_t(-1)) {
+        return result;
+    }
+    return b64_output(from_c(id), raw_length);
+}
+
+size_t olm_session_id_binary(
+    OlmSession * session,
+    void * id, size_t id_length
+) {
+    return from_c(session)->session_id(from_c(id), id_length);
+}
+
+
+int olm_session_has_received_message(
+    OlmSession * session
+) {
+    return from_c(session)->received_message;
+}
+
+int olm_session_is_dirty(
+    OlmSession const * session
+) {
+    return from_c(session)->ratchet.dirty;
+}
+
+void olm_session_clear_dirty(
+    OlmSession * session
+) {
+    from_c(session)->ratchet.dirty = false;
+}
+
+size_t olm_matches_inbound_session(
+    OlmSession * session,
+    void * one_time_key_message, size_t message_length
+) {
+    std::size_t raw_length = b64_input(
+        from_c(one_time_key_message), message_length, from_c(session)->last_error
+    );
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    bool matches = from_c(session)->matches_inbound_session(
+        nullptr, from_c(one_time_key_message), raw_length
+    );
+    return matches ? 1 : 0;
+}
+
+
+size_t olm_matches_inbound_session_from(
+    OlmSession * session,
+    void const * their_identity_key, size_t their_identity_key_length,
+    void * one_time_key_message, size_t message_length
+) {
+    std::uint8_t const * id_key = from_c(their_identity_key);
+    std::size_t id_key_length = their_identity_key_length;
+
+    _olm_curve25519_public_key identity_key;
+    if (!b64_key_input(
+            id_key, id_key_length, identity_key.public_key,
+            from_c(session)->last_error
+    )) {
+        return std::size_t(-1);
+    }
+
+    std::size_t raw_length = b64_input(
+        from_c(one_time_key_message), message_length, from_c(session)->last_error
+    );
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    bool matches = from_c(session)->matches_inbound_session(
+        &identity_key, from_c(one_time_key_message), raw_length
+    );
+    return matches ? 1 : 0;
+}
+
+
+size_t olm_remove_one_time_keys(
+    OlmAccount * account,
+    OlmSession * session
+) {
+    size_t result = from_c(account)->remove_key(
+        from_c(session)->bob_one_time_key
+    );
+    if (result == std::size_t(-1)) {
+        from_c(account)->last_error = from_c(account)->identity_keys_only
+            ? OlmErrorCode::OLM_PARTIAL_ACCOUNT
+            : OlmErrorCode::OLM_BAD_MESSAGE_KEY_ID;
+    }
+    return result;
+}
+
+
+size_t olm_encrypt_message_type(
+    OlmSession * session
+) {
+    return size_t(from_c(session)->encrypt_message_type());
+}
+
+
+size_t olm_encrypt_random_length(
+    OlmSession * session
+) {
+    return from_c(session)->encrypt_random_length();
+}
+
+
+size_t olm_encrypt_message_length(
+    OlmSession * session,
+    size_t plaintext_length
+) {
+    return b64_output_length(
+        from_c(session)->encrypt_message_length(plaintext_length)
+    );
+}
+
+
+size_t olm_encrypt(
+    OlmSession * session,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    void * message, size_t message_length
+) {
+    olm::StatsTimer timer(OLM_STATS_ENCRYPT);
+    olm::TraceScope trace(OLM_TRACE_ENCRYPT);
+    olm::RecordScope record(OLM_TRACE_ENCRYPT, session);
+    OLM_PROBE2(encrypt_entry, plaintext_length, message_length);
+    std::size_t raw_length = from_c(session)->encrypt_message_length(
+        plaintext_length
+    );
+    record.message(
+        plaintext_length, raw_length,
+        unsigned(from_c(session)->encrypt_message_type())
+    );
+    if (message_length < b64_output_length(raw_length)) {
+        from_c(session)->last_error =
+            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_PROBE1(encrypt_return, std::size_t(-1));
+        return std::size_t(-1);
+    }
+    std::size_t result = from_c(session)->encrypt(
+        from_c(plaintext), plaintext_length,
+        from_c(random), random_length,
+        b64_output_pos(from_c(message), raw_length), raw_length
+    );
+    olm::unset(random, random_length);
+    if (result != std::size_t(-1)) {
+        result = b64_output(from_c(message), raw_length);
+    }
+    OLM_PROBE1(encrypt_return, result);
+    return record.succeeded(result);
+}
+
+
+size_t olm_session_prepare_send(
+    OlmSession * session,
+    void * random, size_t random_length
+) {
+    std::size_t result = from_c(session)->prepare_send(
+        from_c(random), random_length
+    );
+    olm::unset(random, random_length);
+    return result;
+}
+
+
+size_t olm_encrypt_auto_random(
+    OlmSession * session,
+    void const * plaintext, size_t plaintext_length,
+    void * message, size_t message_length
+) {
+    olm::Session & object = *from_c(session);
+    std::uint8_t random[CURVE25519_RANDOM_LENGTH];
+    std::size_t random_length = object.encrypt_random_length();
+    if (!auto_random(random, random_length, object.last_error)) {
+        return std::size_t(-1);
+    }
+    return olm_encrypt(
+        session, plaintext, plaintext_length,
+        random, random_length,
+        message, message_length
+    );
+}
+
+
+size_t olm_encrypt_inplace(
+    OlmSession * session,
+    size_t plaintext_length,
+    void * random, size_t random_length,
+    void * buffer, size_t buffer_length
+) {
+    olm::StatsTimer timer(OLM_STATS_ENCRYPT);
+    olm::TraceScope trace(OLM_TRACE_ENCRYPT);
+    olm::RecordScope record(OLM_TRACE_ENCRYPT, session);
+    olm::Session & object = *from_c(session);
+    std::size_t raw_length = object.encrypt_message_length(plaintext_length);
+    record.message(
+        plaintext_length, raw_length, unsigned(object.encrypt_message_type())
+    );
+    if (buffer_length < b64_output_length(raw_length)) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    /* The message ends with the ciphertext and then the MAC, so move the
+     * plain-text to where its ciphertext goes and encrypt it there. */
+    _olm_cipher const * cipher = object.ratchet.ratchet_cipher();
+    std::uint8_t * message_pos = b64_output_pos(from_c(buffer), raw_length);
+    std::uint8_t * ciphertext_pos = message_pos + raw_length
+        - _olm_cipher_mac_length(cipher)
+        - _olm_cipher_encrypt_ciphertext_length(cipher, plaintext_length);
+    std::memmove(ciphertext_pos, buffer, plaintext_length);
+    std::size_t result = object.encrypt(
+        ciphertext_pos, plaintext_length,
+        from_c(random), random_length,
+        message_pos, raw_length
+    );
+    olm::unset(random, random_length);
+    if (result == std::size_t(-1)) {
+        olm::unset(buffer, buffer_length);
+        return result;
+    }
+    return record.succeeded(b64_output(from_c(buffer), raw_length));
+}
+
+
+size_t olm_encrypt_to_buffer(
+    OlmSession * session,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    const OlmAllocator * allocator, OlmBuffer * message
+) {
+    std::size_t message_length = olm_encrypt_message_length(
+        session, plaintext_length
+    );
+    if (olm_buffer_reserve(message, allocator, message_length)
+            == std::size_t(-1)) {
+        from_c(session)->last_error = OlmErrorCode::OLM_ALLOCATION_FAILED;
+        olm::unset(random, random_length);
+        return std::size_t(-1);
+    }
+    std::size_t result = olm_encrypt(
+        session, plaintext, plaintext_length,
+        random, random_length,
+        message->data, message_length
+    );
+    if (result != std::size_t(-1)) {
+        message->length = result;
+    }
+    return result;
+}
+
+
+size_t olm_encrypt_many_random_length(
+    OlmSession * const * sessions, size_t count
+) {
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        length += from_c(sessions[i])->encrypt_random_length();
+    }
+    return length;
+}
+
+
+size_t olm_encrypt_many_message_length(
+    OlmSession * const * sessions, size_t count,
+    size_t plaintext_length
+) {
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        length += b64_output_length(
+            from_c(sessions[i])->encrypt_message_length(plaintext_length)
+        );
+    }
+    return length;
+}
+
+
+namespace {
+
+struct EncryptManyBatch {
+    std::size_t count;
+    olm::Session * sessions[OLM_CRYPTO_SHA256_MAX_LANES];
+    olm::Ratchet * ratchets[OLM_CRYPTO_SHA256_MAX_LANES];
+    std::uint8_t * outputs[OLM_CRYPTO_SHA256_MAX_LANES];
+    std::size_t raw_lengths[OLM_CRYPTO_SHA256_MAX_LANES];
+};
+
+/** Move every chain in the batch on at once, then encrypt with the keys. */
+static void encrypt_many_flush(
+    EncryptManyBatch & batch,
+    std::uint8_t const * plaintext, std::size_t plaintext_length
+) {
+    olm::Ratchet::SendKeys keys[OLM_CRYPTO_SHA256_MAX_LANES];
+    olm::Ratchet::take_send_keys(batch.ratchets, batch.count, keys);
+    for (std::size_t j = 0; j < batch.count; ++j) {
+        batch.sessions[j]->encrypt_with_keys(
+            plaintext, plaintext_length, keys[j],
+            b64_output_pos(batch.outputs[j], batch.raw_lengths[j]),
+            batch.raw_lengths[j]
+        );
+        b64_output(batch.outputs[j], batch.raw_lengths[j]);
+    }
+    olm::unset(keys);
+    batch.count = 0;
+}
+
+} // namespace
+
+
+size_t olm_encrypt_many(
+    OlmSession * const * sessions, size_t count,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    void * messages, size_t messages_length,
+    size_t * message_types, size_t * message_lengths
+) {
+    std::uint8_t * random_pos = from_c(random);
+    std::uint8_t * random_end = random_pos + random_length;
+    std::uint8_t * message_pos = from_c(messages);
+    std::uint8_t * message_end = message_pos + messages_length;
+    std::size_t failures = 0;
+    EncryptManyBatch batch;
+    batch.count = 0;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        olm::Session & session = *from_c(sessions[i]);
+        std::size_t session_random_length = session.encrypt_random_length();
+        std::size_t raw_length = session.encrypt_message_length(
+            plaintext_length
+        );
+        bool ok = false;
+
+        /* a session listed twice has to see its first message encrypted
+         * before its chain can be moved on again */
+        for (std::size_t j = 0; j < batch.count; ++j) {
+            if (batch.sessions[j] == &session) {
+                encrypt_many_flush(batch, from_c(plaintext), plaintext_length);
+                break;
+            }
+        }
+
+        message_types[i] = std::size_t(session.encrypt_message_type());
+        if (std::size_t(random_end - random_pos) < session_random_length) {
+            session.last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
+        } else {
+            if (
+                std::size_t(message_end - message_pos)
+                    < b64_output_length(raw_length)
+            ) {
+                session.last_error =
+                    OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+            } else {
+                /* start the sending chain now if it needs a new one, so
+                 * that the batch only has to move the chains on */
+                session.prepare_send(random_pos, session_random_length);
+                ok = true;
+            }
+            /* each session's random bytes stay where the caller put them,
+             * whether or not they were used */
+            olm::unset(random_pos, session_random_length);
+            random_pos += session_random_length;
+        }
+
+        if (!ok) {
+            message_lengths[i] = std::size_t(-1);
+            failures++;
+            continue;
+        }
+        batch.sessions[batch.count] = &session;
+        batch.ratchets[batch.count] = &session.ratchet;
+        batch.outputs[batch.count] = message_pos;
+        batch.raw_lengths[batch.count] = raw_length;
+        batch.count++;
+        message_lengths[i] = b64_output_length(raw_length);
+        message_pos += message_lengths[i];
+        if (batch.count == OLM_CRYPTO_SHA256_MAX_LANES) {
+            encrypt_many_flush(batch, from_c(plaintext), plaintext_length);
+        }
+    }
+    encrypt_many_flush(batch, from_c(plaintext), plaintext_length);
+    return failures;
+}
+
+
+size_t olm_encrypt_batch_message_length(
+    OlmSession * session, size_t count,
+    size_t const * plaintext_lengths
+) {
+    olm::Session & object = *from_c(session);
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        length += b64_output_length(object.encrypt_message_length(
+            plaintext_lengths[i], std::uint32_t(i)
+        ));
+    }
+    return length;
+}
+
+
+size_t olm_encrypt_batch(
+    OlmSession * session, size_t count,
+    void const * const * plaintexts, size_t const * plaintext_lengths,
+    void * random, size_t random_length,
+    void * messages, size_t messages_length,
+    size_t * message_lengths
+) {
+    olm::Session & object = *from_c(session);
+    /* check everything first, so that a failure leaves the session as it
+     * was */
+    if (random_length < object.encrypt_random_length()) {
+        object.last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
+        olm::unset(random, random_length);
+        return std::size_t(-1);
+    }
+    if (messages_length < olm_encrypt_batch_message_length(
+            session, count, plaintext_lengths
+    )) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        olm::unset(random, random_length);
+        return std::size_t(-1);
+    }
+    if (count) {
+        object.prepare_send(from_c(random), random_length);
+    }
+    olm::unset(random, random_length);
+
+    /* the sending chain is there now, so the messages need no more random
+     * bytes and have the room they were measured for */
+    std::uint8_t * message_pos = from_c(messages);
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t raw_length = object.encrypt_message_length(
+            plaintext_lengths[i]
+        );
+        object.encrypt(
+            from_c(plaintexts[i]), plaintext_lengths[i], nullptr, 0,
+            b64_output_pos(message_pos, raw_length), raw_length
+        );
+        message_lengths[i] = b64_output(message_pos, raw_length);
+        message_pos += message_lengths[i];
+    }
+    return count;
+}
+
+
+size_t olm_decrypt_max_plaintext_length(
+    OlmSession * session,
+    size_t message_type,
+    void * message, size_t message_length
+) {
     std::size_t raw_length = b64_input(
-        from_c(one_time_key_message), message_length, from_c(session)->last_error
+        from_c(message), message_length, from_c(session)->last_error
     );
     if (raw_length == std::size_t(-1)) {
         return std::size_t(-1);
     }
-    return from_c(session)->new_inbound_session(
-        *from_c(account), &identity_key,
-        from_c(one_time_key_message), raw_length
+    return from_c(session)->decrypt_max_plaintext_length(
+        olm::MessageType(message_type), from_c(message), raw_length
+    );
+}
+
+
+size_t olm_peek_max_plaintext_length(
+    OlmSession * session,
+    size_t message_type,
+    void const * message, size_t message_length
+) {
+    if (olm::decode_base64_length(message_length) == std::size_t(-1)) {
+        from_c(session)->last_error = OlmErrorCode::OLM_INVALID_BASE64;
+        return std::size_t(-1);
+    }
+    return from_c(session)->peek_max_plaintext_length(
+        olm::MessageType(message_type), from_c(message), message_length
+    );
+}
+
+
+size_t olm_decrypt(
+    OlmSession * session,
+    size_t message_type,
+    void * message, size_t message_length,
+    void * plaintext, size_t max_plaintext_length
+) {
+    olm::StatsTimer timer(OLM_STATS_DECRYPT);
+    olm::TraceScope trace(OLM_TRACE_DECRYPT);
+    olm::RecordScope record(OLM_TRACE_DECRYPT, session);
+    OLM_PROBE2(decrypt_entry, message_type, message_length);
+    std::size_t result = b64_input(
+        from_c(message), message_length, from_c(session)->last_error
+    );
+    if (result != std::size_t(-1)) {
+        std::size_t raw_length = result;
+        result = from_c(session)->decrypt(
+            olm::MessageType(message_type), from_c(message), raw_length,
+            from_c(plaintext), max_plaintext_length
+        );
+        record.message(
+            result != std::size_t(-1) ? result : 0,
+            raw_length, unsigned(message_type)
+        );
+    }
+    OLM_PROBE1(decrypt_return, result);
+    return record.succeeded(result);
+}
+
+
+size_t olm_decrypt_inplace(
+    OlmSession * session,
+    size_t message_type,
+    void * buffer, size_t message_length
+) {
+    olm::StatsTimer timer(OLM_STATS_DECRYPT);
+    olm::TraceScope trace(OLM_TRACE_DECRYPT);
+    olm::RecordScope record(OLM_TRACE_DECRYPT, session);
+    olm::Session & object = *from_c(session);
+    std::uint8_t * raw = from_c(buffer);
+    std::size_t raw_length = b64_input(raw, message_length, object.last_error);
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    record.message(0, raw_length, unsigned(message_type));
+    olm::MessageView view;
+    olm::Session::decode_message_view(
+        view, olm::MessageType(message_type), raw, raw_length
+    );
+    /* Decrypt over the ciphertext, which the cipher allows, then move the
+     * plain-text to the start of the buffer. A message which doesn't decode
+     * is left for decrypt() to reject. */
+    std::uint8_t * plaintext = raw;
+    if (view.message.ciphertext) {
+        plaintext = raw + (view.message.ciphertext - raw);
+    }
+    std::size_t offset = plaintext - raw;
+    std::size_t result = object.decrypt(
+        view, plaintext, raw_length - offset
+    );
+    if (result == std::size_t(-1)) {
+        return result;
+    }
+    std::memmove(raw, plaintext, result);
+    olm::unset(raw + result, offset);
+    record.message(result, raw_length, unsigned(message_type));
+    return record.succeeded(result);
+}
+
+
+size_t olm_decrypt_to_buffer(
+    OlmSession * session,
+    size_t message_type,
+    void * message, size_t message_length,
+    const OlmAllocator * allocator, OlmBuffer * plaintext
+) {
+    olm::StatsTimer timer(OLM_STATS_DECRYPT);
+    olm::TraceScope trace(OLM_TRACE_DECRYPT);
+    olm::RecordScope record(OLM_TRACE_DECRYPT, session);
+    olm::Session & object = *from_c(session);
+    plaintext->length = 0;
+    std::uint8_t * raw = from_c(message);
+    std::size_t raw_length = b64_input(raw, message_length, object.last_error);
+    if (raw_length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    record.message(0, raw_length, unsigned(message_type));
+    olm::MessageView view;
+    olm::Session::decode_message_view(
+        view, olm::MessageType(message_type), raw, raw_length
+    );
+    std::size_t max_length = object.decrypt_max_plaintext_length(view);
+    if (max_length == std::size_t(-1)) {
+        return max_length;
+    }
+    if (olm_buffer_reserve(plaintext, allocator, max_length)
+            == std::size_t(-1)) {
+        object.last_error = OlmErrorCode::OLM_ALLOCATION_FAILED;
+        return std::size_t(-1);
+    }
+    std::size_t result = object.decrypt(
+        view, plaintext->data, plaintext->capacity
+    );
+    if (result == std::size_t(-1)) {
+        return result;
+    }
+    plaintext->length = result;
+    record.message(result, raw_length, unsigned(message_type));
+    return record.succeeded(result);
+}
+
+
+size_t olm_decrypt_batch_scratch_length(
+    size_t count
+) {
+    return 2 * count + 1;
+}
+
+
+size_t olm_decrypt_batch(
+    OlmSession * const * sessions, size_t count,
+    const size_t * message_types,
+    void * const * messages, const size_t * message_lengths,
+    void * const * plaintexts, const size_t * max_plaintext_lengths,
+    size_t * plaintext_lengths, const char ** errors,
+    size_t * scratch, size_t scratch_length,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    if (scratch_length < olm_decrypt_batch_scratch_length(count)) {
+        return std::size_t(-1);
+    }
+    std::size_t * order = scratch;
+    std::size_t * group_starts = scratch + count;
+
+    /* group the messages by session, keeping each session's messages in the
+     * order they were given */
+    for (std::size_t i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+    std::less<OlmSession const *> before;
+    std::sort(order, order + count, [&](std::size_t a, std::size_t b) {
+        if (sessions[a] != sessions[b]) {
+            return before(sessions[a], sessions[b]);
+        }
+        return a < b;
+    });
+    std::size_t group_count = 0;
+    for (std::size_t j = 0; j < count; ++j) {
+        if (j == 0 || sessions[order[j]] != sessions[order[j - 1]]) {
+            group_starts[group_count++] = j;
+        }
+    }
+    group_starts[group_count] = count;
+
+    DecryptBatch batch = {
+        sessions, message_types, messages, message_lengths,
+        plaintexts, max_plaintext_lengths, plaintext_lengths, errors,
+        order, group_starts,
+    };
+    if (executor) {
+        executor(executor_context, decrypt_batch_job, &batch, group_count);
+    } else {
+        for (std::size_t job = 0; job < group_count; ++job) {
+            decrypt_batch_job(&batch, job);
+        }
+    }
+
+    std::size_t failures = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (plaintext_lengths[i] == std::size_t(-1)) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+
+size_t olm_encrypt_raw_message_length(
+    OlmSession * session,
+    size_t plaintext_length
+) {
+    return from_c(session)->encrypt_message_length(plaintext_length);
+}
+
+
+size_t olm_encrypt_raw(
+    OlmSession * session,
+    void const * plaintext, size_t plaintext_length,
+    void * random, size_t random_length,
+    void * message, size_t message_length
+) {
+    std::size_t raw_length = from_c(session)->encrypt_message_length(
+        plaintext_length
+    );
+    if (message_length < raw_length) {
+        from_c(session)->last_error =
+            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    std::size_t result = from_c(session)->encrypt(
+        from_c(plaintext), plaintext_length,
+        from_c(random), random_length,
+        from_c(message), raw_length
+    );
+    olm::unset(random, random_length);
+    if (result == std::size_t(-1)) {
+        return result;
+    }
+    return raw_length;
+}
+
+
+size_t olm_decrypt_raw_max_plaintext_length(
+    OlmSession * session,
+    size_t message_type,
+    void const * message, size_t message_length
+) {
+    return from_c(session)->decrypt_max_plaintext_length(
+        olm::MessageType(message_type), from_c(message), message_length
     );
 }
 
 
-size_t olm_session_id_length(
-    OlmSession * session
+size_t olm_decrypt_raw(
+    OlmSession * session,
+    size_t message_type,
+    void const * message, size_t message_length,
+    void * plaintext, size_t max_plaintext_length
 ) {
-    return b64_output_length(from_c(session)->session_id_length());
+    return from_c(session)->decrypt(
+        olm::MessageType(message_type), from_c(message), message_length,
+        from_c(plaintext), max_plaintext_length
+    );
 }
 
-size_t olm_session_id(
-    OlmSession * session,
-    void * id, size_t id_length
+
+size_t olm_message_view_size(void) {
+    return sizeof(MessageViewState);
+}
+
+
+OlmMessageView * olm_message_view(
+    void * memory
 ) {
-    std::size_t raw_length = from_c(session)->session_id_length();
-    if (id_length < b64_output_length(raw_length)) {
-        from_c(session)->last_error =
-                OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
-        return std::size_t(-1);
-    }
-    std::size_t result = from_c(session)->session_id(
-       b64_output_pos(from_c(id), raw_length), raw_length
+    olm::unset(memory, sizeof(MessageViewState));
+    MessageViewState * state = new(memory) MessageViewState;
+    olm::Session::decode_message_view(
+        state->view, olm::MessageType::MESSAGE, nullptr, 0
     );
-    if (result == std::size_t(-1)) {
-        return result;
-    }
-    return b64_output(from_c(id), raw_length);
+    state->last_error = OlmErrorCode::OLM_SUCCESS;
+    return to_c(state);
 }
 
 
-int olm_session_has_received_message(
-    OlmSession * session
+const char * olm_message_view_last_error(
+    OlmMessageView * view
 ) {
-    return from_c(session)->received_message;
+    return _olm_error_to_string(from_c(view)->last_error);
 }
 
-size_t olm_matches_inbound_session(
-    OlmSession * session,
-    void * one_time_key_message, size_t message_length
+
+size_t olm_message_view_decode(
+    OlmMessageView * view,
+    size_t message_type,
+    void * message, size_t message_length
 ) {
+    MessageViewState & state = *from_c(view);
     std::size_t raw_length = b64_input(
-        from_c(one_time_key_message), message_length, from_c(session)->last_error
+        from_c(message), message_length, state.last_error
     );
     if (raw_length == std::size_t(-1)) {
+        olm::Session::decode_message_view(
+            state.view, olm::MessageType::MESSAGE, nullptr, 0
+        );
         return std::size_t(-1);
     }
-    bool matches = from_c(session)->matches_inbound_session(
-        nullptr, from_c(one_time_key_message), raw_length
+    return olm_message_view_decode_raw(
+        view, message_type, message, raw_length
     );
-    return matches ? 1 : 0;
 }
 
 
-size_t olm_matches_inbound_session_from(
-    OlmSession * session,
-    void const * their_identity_key, size_t their_identity_key_length,
-    void * one_time_key_message, size_t message_length
+size_t olm_message_view_decode_raw(
+    OlmMessageView * view,
+    size_t message_type,
+    void const * message, size_t message_length
 ) {
-    std::uint8_t const * id_key = from_c(their_identity_key);
-    std::size_t id_key_length = their_identity_key_length;
+    olm::Session::decode_message_view(
+        from_c(view)->view, olm::MessageType(message_type),
+        from_c(message), message_length
+    );
+    return 0;
+}
 
-    if (olm::decode_base64_length(id_key_length) != CURVE25519_KEY_LENGTH) {
-        from_c(session)->last_error = OlmErrorCode::OLM_INVALID_BASE64;
-        return std::size_t(-1);
-    }
-    _olm_curve25519_public_key identity_key;
-    olm::decode_base64(id_key, id_key_length, identity_key.public_key);
 
-    std::size_t raw_length = b64_input(
-        from_c(one_time_key_message), message_length, from_c(session)->last_error
+size_t olm_create_inbound_session_with_view(
+    OlmSession * session,
+    OlmAccount * account,
+    OlmMessageView const * view
+) {
+    return from_c(session)->new_inbound_session(
+        *from_c(account), nullptr, from_c(view)->view
     );
-    if (raw_length == std::size_t(-1)) {
-        return std::size_t(-1);
-    }
+}
+
+
+size_t olm_matches_inbound_session_with_view(
+    OlmSession * session,
+    OlmMessageView const * view
+) {
     bool matches = from_c(session)->matches_inbound_session(
-        &identity_key, from_c(one_time_key_message), raw_length
+        nullptr, from_c(view)->view
     );
     return matches ? 1 : 0;
 }
 
 
-size_t olm_remove_one_time_keys(
-    OlmAccount * account,
-    OlmSession * session
+size_t olm_decrypt_max_plaintext_length_with_view(
+    OlmSession * session,
+    OlmMessageView const * view
 ) {
-    size_t result = from_c(account)->remove_key(
-        from_c(session)->bob_one_time_key
+    return from_c(session)->decrypt_max_plaintext_length(from_c(view)->view);
+}
+
+
+size_t olm_decrypt_with_view(
+    OlmSession * session,
+    OlmMessageView const * view,
+    void * plaintext, size_t max_plaintext_length
+) {
+    return from_c(session)->decrypt(
+        from_c(view)->view, from_c(plaintext), max_plaintext_length
     );
-    if (result == std::size_t(-1)) {
-        from_c(account)->last_error = OlmErrorCode::OLM_BAD_MESSAGE_KEY_ID;
-    }
-    return result;
 }
 
 
-size_t olm_encrypt_message_type(
-    OlmSession * session
+size_t olm_decrypt_trial_size(void) {
+    return sizeof(DecryptTrialState);
+}
+
+
+OlmDecryptTrial * olm_decrypt_trial(
+    void * memory
 ) {
-    return size_t(from_c(session)->encrypt_message_type());
+    olm::unset(memory, sizeof(DecryptTrialState));
+    DecryptTrialState * state = new(memory) DecryptTrialState;
+    state->trial.kind = olm::DecryptTrialKind::NONE;
+    state->trial.last_error = OlmErrorCode::OLM_SUCCESS;
+    state->session = nullptr;
+    return reinterpret_cast<OlmDecryptTrial *>(state);
 }
 
 
-size_t olm_encrypt_random_length(
-    OlmSession * session
+const char * olm_decrypt_trial_last_error(
+    OlmDecryptTrial const * trial
 ) {
-    return from_c(session)->encrypt_random_length();
+    return _olm_error_to_string(from_c(trial)->trial.last_error);
 }
 
 
-size_t olm_encrypt_message_length(
-    OlmSession * session,
-    size_t plaintext_length
+size_t olm_clear_decrypt_trial(
+    OlmDecryptTrial * trial
 ) {
-    return b64_output_length(
-        from_c(session)->encrypt_message_length(plaintext_length)
+    olm_decrypt_trial(trial);
+    return sizeof(DecryptTrialState);
+}
+
+
+size_t olm_decrypt_peek(
+    OlmSession const * session,
+    OlmMessageView const * view,
+    OlmDecryptTrial * trial,
+    void * plaintext, size_t max_plaintext_length
+) {
+    DecryptTrialState & state = *from_c(trial);
+    state.session = from_c(session);
+    return from_c(session)->try_decrypt(
+        from_c(view)->view, from_c(plaintext), max_plaintext_length,
+        state.trial
     );
 }
 
 
-size_t olm_encrypt(
+size_t olm_decrypt_commit(
     OlmSession * session,
-    void const * plaintext, size_t plaintext_length,
-    void * random, size_t random_length,
-    void * message, size_t message_length
+    OlmDecryptTrial * trial
 ) {
-    std::size_t raw_length = from_c(session)->encrypt_message_length(
-        plaintext_length
-    );
-    if (message_length < b64_output_length(raw_length)) {
-        from_c(session)->last_error =
-            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+    DecryptTrialState & state = *from_c(trial);
+    olm::Session & object = *from_c(session);
+    if (state.session != &object) {
+        object.last_error = OlmErrorCode::OLM_SESSION_CHANGED;
         return std::size_t(-1);
     }
-    std::size_t result = from_c(session)->encrypt(
-        from_c(plaintext), plaintext_length,
-        from_c(random), random_length,
-        b64_output_pos(from_c(message), raw_length), raw_length
-    );
-    olm::unset(random, random_length);
-    if (result == std::size_t(-1)) {
-        return result;
+    if (!object.commit_decrypt(state.trial)) {
+        return std::size_t(-1);
     }
-    return b64_output(from_c(message), raw_length);
+    state.session = nullptr;
+    return 0;
 }
 
 
-size_t olm_decrypt_max_plaintext_length(
-    OlmSession * session,
-    size_t message_type,
-    void * message, size_t message_length
+size_t olm_session_route_length(void) {
+    return olm::SESSION_ROUTE_LENGTH;
+}
+
+
+size_t olm_message_view_route(
+    OlmMessageView * view,
+    void * route, size_t route_length
 ) {
-    std::size_t raw_length = b64_input(
-        from_c(message), message_length, from_c(session)->last_error
-    );
-    if (raw_length == std::size_t(-1)) {
+    MessageViewState & state = *from_c(view);
+    if (route_length < olm::SESSION_ROUTE_LENGTH) {
+        state.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
         return std::size_t(-1);
     }
-    return from_c(session)->decrypt_max_plaintext_length(
-        olm::MessageType(message_type), from_c(message), raw_length
-    );
+    if (!olm::Session::message_route(state.view, from_c(route))) {
+        state.last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
+        return std::size_t(-1);
+    }
+    return olm::SESSION_ROUTE_LENGTH;
 }
 
 
-size_t olm_decrypt(
+size_t olm_session_route(
     OlmSession * session,
-    size_t message_type,
-    void * message, size_t message_length,
-    void * plaintext, size_t max_plaintext_length
+    void * route, size_t route_length
 ) {
-    std::size_t raw_length = b64_input(
-        from_c(message), message_length, from_c(session)->last_error
-    );
-    if (raw_length == std::size_t(-1)) {
+    if (route_length < olm::SESSION_ROUTE_LENGTH) {
+        from_c(session)->last_error =
+            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
         return std::size_t(-1);
     }
-    return from_c(session)->decrypt(
-        olm::MessageType(message_type), from_c(message), raw_length,
-        from_c(plaintext), max_plaintext_length
-    );
+    from_c(session)->route(from_c(route));
+    return olm::SESSION_ROUTE_LENGTH;
 }
 
 
@@ -710,18 +3365,116 @@ size_t olm_sha256(
 }
 
 
+size_t olm_sha256_raw(
+    OlmUtility * utility,
+    void const * input, size_t input_length,
+    void * output, size_t output_length
+) {
+    return from_c(utility)->sha256(
+        from_c(input), input_length, from_c(output), output_length
+    );
+}
+
+
+size_t olm_sha256_batch(
+    OlmUtility * utility,
+    size_t count,
+    void const * const * inputs, size_t const * input_lengths,
+    void * output, size_t output_length
+) {
+    /* how many hashes are handed to the crypto layer at a time */
+    static std::size_t const BATCH_LENGTH = 16;
+    if (output_length / SHA256_OUTPUT_LENGTH < count) {
+        from_c(utility)->last_error =
+            OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    std::uint8_t const * input_ptrs[BATCH_LENGTH];
+    std::uint8_t * output_ptrs[BATCH_LENGTH];
+    std::uint8_t * output_pos = from_c(output);
+    for (std::size_t i = 0; i < count; i += BATCH_LENGTH) {
+        std::size_t n = std::min(count - i, BATCH_LENGTH);
+        for (std::size_t j = 0; j < n; ++j) {
+            input_ptrs[j] = from_c(inputs[i + j]);
+            output_ptrs[j] = output_pos;
+            output_pos += SHA256_OUTPUT_LENGTH;
+        }
+        _olm_crypto_sha256_multi(
+            input_ptrs, input_lengths + i, output_ptrs, n
+        );
+    }
+    return count * SHA256_OUTPUT_LENGTH;
+}
+
+
+size_t olm_sha256_context_size(void) {
+    return sizeof(_olm_sha256_context);
+}
+
+
+OlmSha256 * olm_sha256_init(
+    void * memory
+) {
+    _olm_sha256_context * context =
+        reinterpret_cast<_olm_sha256_context *>(memory);
+    _olm_crypto_sha256_begin(context);
+    return reinterpret_cast<OlmSha256 *>(context);
+}
+
+
+void olm_sha256_update(
+    OlmSha256 * context,
+    void const * input, size_t input_length
+) {
+    _olm_crypto_sha256_update(
+        reinterpret_cast<_olm_sha256_context *>(context),
+        from_c(input), input_length
+    );
+}
+
+
+size_t olm_sha256_final_raw(
+    OlmSha256 * context,
+    void * output, size_t output_length
+) {
+    if (output_length < SHA256_OUTPUT_LENGTH) {
+        return std::size_t(-1);
+    }
+    _olm_crypto_sha256_end(
+        reinterpret_cast<_olm_sha256_context *>(context), from_c(output)
+    );
+    return SHA256_OUTPUT_LENGTH;
+}
+
+
+size_t olm_sha256_final(
+    OlmSha256 * context,
+    void * output, size_t output_length
+) {
+    if (output_length < b64_output_length(SHA256_OUTPUT_LENGTH)) {
+        return std::size_t(-1);
+    }
+    olm_sha256_final_raw(
+        context, b64_output_pos(from_c(output), SHA256_OUTPUT_LENGTH),
+        SHA256_OUTPUT_LENGTH
+    );
+    return b64_output(from_c(output), SHA256_OUTPUT_LENGTH);
+}
+
+
 size_t olm_ed25519_verify(
     OlmUtility * utility,
     void const * key, size_t key_length,
     void const * message, size_t message_length,
     void * signature, size_t signature_length
 ) {
-    if (olm::decode_base64_length(key_length) != CURVE25519_KEY_LENGTH) {
-        from_c(utility)->last_error = OlmErrorCode::OLM_INVALID_BASE64;
+    _olm_ed25519_public_key verify_key;
+    if (!b64_key_input(
+            from_c(key), key_length, verify_key.public_key,
+            from_c(utility)->last_error
+    )) {
         return std::size_t(-1);
     }
-    _olm_ed25519_public_key verify_key;
-    olm::decode_base64(from_c(key), key_length, verify_key.public_key);
     std::size_t raw_signature_length = b64_input(
         from_c(signature), signature_length, from_c(utility)->last_error
     );
@@ -735,4 +3488,164 @@ size_t olm_ed25519_verify(
     );
 }
 
+
+size_t olm_ed25519_verify_raw(
+    OlmUtility * utility,
+    void const * key,
+    void const * message, size_t message_length,
+    void const * signature
+) {
+    _olm_ed25519_public_key verify_key;
+    std::memcpy(verify_key.public_key, key, ED25519_PUBLIC_KEY_LENGTH);
+    return from_c(utility)->ed25519_verify(
+        verify_key,
+        from_c(message), message_length,
+        from_c(signature), ED25519_SIGNATURE_LENGTH
+    );
+}
+
+
+size_t olm_ed25519_verify_batch(
+    OlmUtility * utility,
+    size_t count,
+    void const * const * keys, size_t const * key_lengths,
+    void const * const * messages, size_t const * message_lengths,
+    void * const * signatures, size_t const * signature_lengths,
+    uint8_t * results
+) {
+    const std::size_t chunk_size = 64;
+    _olm_ed25519_public_key verify_keys[chunk_size];
+    std::uint8_t const * raw_messages[chunk_size];
+    std::uint8_t const * raw_signatures[chunk_size];
+    std::size_t raw_signature_lengths[chunk_size];
+    std::size_t failures = 0;
+    /* bad base64 only fails the signature it belongs to, so don't report it
+     * through last_error */
+    OlmErrorCode ignored_error;
+    for (std::size_t start = 0; start < count; start += chunk_size) {
+        std::size_t n = count - start < chunk_size ? count - start : chunk_size;
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t j = start + i;
+            raw_messages[i] = from_c(messages[j]);
+            raw_signatures[i] = from_c(signatures[j]);
+            /* a raw length of 0 makes the signature fail */
+            raw_signature_lengths[i] = b64_input(
+                from_c(signatures[j]), signature_lengths[j], ignored_error
+            );
+            if (raw_signature_lengths[i] == std::size_t(-1)) {
+                raw_signature_lengths[i] = 0;
+            }
+            if (!b64_key_input(
+                    from_c(keys[j]), key_lengths[j], verify_keys[i].public_key,
+                    ignored_error
+            )) {
+                std::memset(&verify_keys[i], 0, sizeof(verify_keys[i]));
+                raw_signature_lengths[i] = 0;
+            }
+        }
+        failures += from_c(utility)->ed25519_verify_batch(
+            n, verify_keys, raw_messages, message_lengths + start,
+            raw_signatures, raw_signature_lengths, results + start
+        );
+    }
+    return failures;
+}
+
+
+size_t olm_canonical_json(
+    OlmUtility * utility,
+    void * json, size_t json_length
+) {
+    std::size_t length = olm::canonical_json(from_c(json), json_length);
+    if (length == std::size_t(-1)) {
+        from_c(utility)->last_error = OlmErrorCode::OLM_INVALID_JSON;
+        return std::size_t(-1);
+    }
+    return olm::strip_json_signatures(from_c(json), length);
+}
+
+
+size_t olm_ed25519_verify_json(
+    OlmUtility * utility,
+    void const * key, size_t key_length,
+    void const * user_id, size_t user_id_length,
+    void const * key_id, size_t key_id_length,
+    void * json, size_t json_length
+) {
+    _olm_ed25519_public_key verify_key;
+    if (!b64_key_input(
+            from_c(key), key_length, verify_key.public_key,
+            from_c(utility)->last_error
+    )) {
+        return std::size_t(-1);
+    }
+    std::uint8_t signature[ED25519_SIGNATURE_LENGTH];
+    std::size_t length = signed_json_input(
+        from_c(json), json_length,
+        from_c(user_id), user_id_length, from_c(key_id), key_id_length,
+        signature, from_c(utility)->last_error
+    );
+    if (length == std::size_t(-1)) {
+        return std::size_t(-1);
+    }
+    return from_c(utility)->ed25519_verify(
+        verify_key, from_c(json), length, signature, sizeof(signature)
+    );
+}
+
+
+size_t olm_ed25519_verify_json_batch(
+    OlmUtility * utility,
+    size_t count,
+    void const * const * keys, size_t const * key_lengths,
+    void const * const * user_ids, size_t const * user_id_lengths,
+    void const * const * key_ids, size_t const * key_id_lengths,
+    void * const * jsons, size_t const * json_lengths,
+    uint8_t * results
+) {
+    const std::size_t chunk_size = 64;
+    _olm_ed25519_public_key verify_keys[chunk_size];
+    std::uint8_t const * messages[chunk_size];
+    std::size_t message_lengths[chunk_size];
+    std::uint8_t signatures[chunk_size][ED25519_SIGNATURE_LENGTH];
+    std::uint8_t const * signature_ptrs[chunk_size];
+    std::size_t signature_lengths[chunk_size];
+    std::size_t failures = 0;
+    /* a bad object only fails its own signature, so don't report it through
+     * last_error */
+    OlmErrorCode ignored_error;
+    for (std::size_t start = 0; start < count; start += chunk_size) {
+        std::size_t n = count - start < chunk_size ? count - start : chunk_size;
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t j = start + i;
+            messages[i] = from_c(jsons[j]);
+            signature_ptrs[i] = signatures[i];
+            signature_lengths[i] = ED25519_SIGNATURE_LENGTH;
+            message_lengths[i] = signed_json_input(
+                from_c(jsons[j]), json_lengths[j],
+                from_c(user_ids[j]), user_id_lengths[j],
+                from_c(key_ids[j]), key_id_lengths[j],
+                signatures[i], ignored_error
+            );
+            /* a signature length of 0 makes the signature fail */
+            if (message_lengths[i] == std::size_t(-1)) {
+                message_lengths[i] = 0;
+                signature_lengths[i] = 0;
+            }
+            if (!b64_key_input(
+                    from_c(keys[j]), key_lengths[j], verify_keys[i].public_key,
+                    ignored_error
+            )) {
+                std::memset(&verify_keys[i], 0, sizeof(verify_keys[i]));
+                signature_lengths[i] = 0;
+            }
+        }
+        failures += from_c(utility)->ed25519_verify_batch(
+            n, verify_keys, messages, message_lengths,
+            signature_ptrs, signature_lengths, results + start
+        );
+    }
+    return failures;
+}
+
 }
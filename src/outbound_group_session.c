@@ -22,17 +22,52 @@
 #include "olm/cipher.h"
 #include "olm/crypto.h"
 #include "olm/error.h"
+#include "olm/iovec_internal.h"
 #include "olm/megolm.h"
 #include "olm/memory.h"
 #include "olm/message.h"
 #include "olm/pickle.h"
 #include "olm/pickle_encoding.h"
+#include "olm/probes.h"
+#include "olm/random.h"
+#include "olm/stats_internal.h"
+#include "olm/trace_internal.h"
 
 #define OLM_PROTOCOL_VERSION     3
 #define GROUP_SESSION_ID_LENGTH  ED25519_PUBLIC_KEY_LENGTH
 #define PICKLE_VERSION           1
+/* the pickle version written when the share ledger has entries */
+#define PICKLE_VERSION_LEDGER    2
 #define SESSION_KEY_VERSION      2
 
+#define SESSION_KEY_RAW_LENGTH \
+    (1 + 4 + MEGOLM_RATCHET_LENGTH + ED25519_PUBLIC_KEY_LENGTH\
+        + ED25519_SIGNATURE_LENGTH)
+
+/* the unpadded base64 length of SESSION_KEY_RAW_LENGTH bytes */
+#define SESSION_KEY_ENCODED_LENGTH \
+    (4 * (SESSION_KEY_RAW_LENGTH / 3) \
+        + (SESSION_KEY_RAW_LENGTH % 3 ? SESSION_KEY_RAW_LENGTH % 3 + 1 : 0))
+
+/* the unpadded base64 length of a Curve25519 device key */
+#define DEVICE_KEY_ENCODED_LENGTH \
+    (4 * (CURVE25519_KEY_LENGTH / 3) \
+        + (CURVE25519_KEY_LENGTH % 3 ? CURVE25519_KEY_LENGTH % 3 + 1 : 0))
+
+/** A device which has been sent the session key, in the share ledger */
+struct LedgerEntry {
+    uint8_t device_key[CURVE25519_KEY_LENGTH];
+    /** the message index of the session key the device was sent */
+    uint32_t shared_at;
+    uint32_t used;
+};
+
+/** The ratchet and derived keys for one of the next messages */
+struct PreparedMessageKeys {
+    Megolm ratchet;
+    struct _olm_cipher_aes_sha_256_context keys;
+};
+
 struct OlmOutboundGroupSession {
     /** the Megolm ratchet providing the encryption keys */
     Megolm ratchet;
@@ -40,6 +75,42 @@ struct OlmOutboundGroupSession {
     /** The ed25519 keypair used for signing the messages */
     struct _olm_ed25519_key_pair signing_key;
 
+    /**
+     * Optional caller-supplied ring buffer holding the ratchet and keys for
+     * the next key_stream_count messages, starting with the one at
+     * ratchet.counter in slot key_stream_start. None of this is pickled.
+     */
+    struct PreparedMessageKeys *key_stream;
+    size_t key_stream_capacity;
+    size_t key_stream_start;
+    size_t key_stream_count;
+
+    /**
+     * The signed, base64-encoded session key for ratchet.counter, kept so
+     * that sharing the key with many devices at one index signs it only
+     * once. Only valid if session_key_cached is set; wiped whenever the
+     * ratchet moves. Not pickled.
+     */
+    uint8_t session_key[SESSION_KEY_ENCODED_LENGTH];
+    int session_key_cached;
+
+    /**
+     * Set whenever the ratchet, the signing key or the share ledger
+     * changes, and cleared only by unpickling or by
+     * olm_outbound_group_session_clear_dirty(). Not pickled.
+     */
+    int dirty;
+
+    /**
+     * Optional caller-supplied open-addressed hash set of the devices which
+     * have been sent the session key, with ledger_capacity slots of which
+     * ledger_count are used. Pickled, and emptied when the session is
+     * initialised.
+     */
+    struct LedgerEntry *ledger;
+    size_t ledger_capacity;
+    size_t ledger_count;
+
     enum OlmErrorCode last_error;
 };
 
@@ -52,7 +123,9 @@ OlmOutboundGroupSession * olm_outbound_group_session(
     void *memory
 ) {
     OlmOutboundGroupSession *session = memory;
-    olm_clear_outbound_group_session(session);
+    /* don't use olm_clear_outbound_group_session, which would try to wipe
+     * whatever key stream pointer the memory happened to contain */
+    _olm_unset(session, sizeof(OlmOutboundGroupSession));
     return session;
 }
 
@@ -62,13 +135,389 @@ const char *olm_outbound_group_session_last_error(
     return _olm_error_to_string(session->last_error);
 }
 
+/** forget the prepared keys, wiping them from the buffer */
+static void _reset_key_stream(OlmOutboundGroupSession *session) {
+    if (session->key_stream) {
+        _olm_unset(
+            session->key_stream,
+            session->key_stream_capacity * sizeof(struct PreparedMessageKeys)
+        );
+    }
+    session->key_stream_start = 0;
+    session->key_stream_count = 0;
+}
+
+/** forget the cached session key, wiping it */
+static void _forget_session_key(OlmOutboundGroupSession *session) {
+    if (session->session_key_cached) {
+        _olm_unset(session->session_key, sizeof(session->session_key));
+        session->session_key_cached = 0;
+    }
+}
+
+/** forget the devices in the share ledger, wiping them */
+static void _reset_ledger(OlmOutboundGroupSession *session) {
+    if (session->ledger) {
+        _olm_unset(
+            session->ledger,
+            session->ledger_capacity * sizeof(struct LedgerEntry)
+        );
+    }
+    session->ledger_count = 0;
+}
+
 size_t olm_clear_outbound_group_session(
     OlmOutboundGroupSession *session
 ) {
+    _reset_key_stream(session);
+    _reset_ledger(session);
     _olm_unset(session, sizeof(OlmOutboundGroupSession));
     return sizeof(OlmOutboundGroupSession);
 }
 
+size_t olm_outbound_group_session_key_stream_entry_size(void) {
+    return sizeof(struct PreparedMessageKeys);
+}
+
+size_t olm_outbound_group_session_set_key_stream(
+    OlmOutboundGroupSession *session,
+    void *buffer, size_t buffer_length
+) {
+    _reset_key_stream(session);
+    session->key_stream = buffer;
+    session->key_stream_capacity =
+        buffer ? buffer_length / sizeof(struct PreparedMessageKeys) : 0;
+    return session->key_stream_capacity;
+}
+
+size_t olm_outbound_group_session_trim_memory(
+    OlmOutboundGroupSession *session, int level
+) {
+    size_t wiped = session->key_stream_count
+        * sizeof(struct PreparedMessageKeys);
+    if (level >= OLM_TRIM_MEMORY_BUFFERS) {
+        olm_outbound_group_session_set_key_stream(session, NULL, 0);
+    } else if (level >= OLM_TRIM_MEMORY_PRECOMPUTED) {
+        _reset_key_stream(session);
+    } else {
+        wiped = 0;
+    }
+    return wiped;
+}
+
+void olm_outbound_group_session_memory_stats(
+    const OlmOutboundGroupSession *session,
+    OlmMemoryStats *stats
+) {
+    size_t entry_size = sizeof(struct PreparedMessageKeys);
+    stats->objects += 1;
+    stats->reserved_bytes += sizeof(OlmOutboundGroupSession)
+        + session->key_stream_capacity * entry_size
+        + session->ledger_capacity * sizeof(struct LedgerEntry);
+    stats->live_bytes += sizeof(OlmOutboundGroupSession)
+        + session->key_stream_count * entry_size
+        + session->ledger_count * sizeof(struct LedgerEntry);
+    stats->cache_reserved_bytes += session->key_stream_capacity * entry_size;
+    stats->cache_live_bytes += session->key_stream_count * entry_size;
+    stats->prepared_message_keys += session->key_stream_count;
+    stats->max_prepared_message_keys += session->key_stream_capacity;
+}
+
+size_t olm_outbound_group_session_prepare(
+    OlmOutboundGroupSession *session,
+    size_t count
+) {
+    if (count > session->key_stream_capacity) {
+        count = session->key_stream_capacity;
+    }
+    while (session->key_stream_count < count) {
+        /* walk the ratchet for a few entries, then derive their keys side
+         * by side */
+        uint8_t const *ratchets[OLM_CRYPTO_SHA256_MAX_LANES];
+        struct _olm_cipher_aes_sha_256_context *keys[
+            OLM_CRYPTO_SHA256_MAX_LANES
+        ];
+        size_t n = 0;
+
+        while (n < OLM_CRYPTO_SHA256_MAX_LANES
+                && session->key_stream_count < count) {
+            struct PreparedMessageKeys *entry = &session->key_stream[
+                (session->key_stream_start + session->key_stream_count)
+                    % session->key_stream_capacity
+            ];
+            if (session->key_stream_count == 0) {
+                entry->ratchet = session->ratchet;
+            } else {
+                const struct PreparedMessageKeys *previous =
+                    &session->key_stream[
+                        (session->key_stream_start
+                            + session->key_stream_count - 1)
+                            % session->key_stream_capacity
+                    ];
+                entry->ratchet = previous->ratchet;
+                megolm_advance(&entry->ratchet);
+            }
+            ratchets[n] = megolm_get_data(&entry->ratchet);
+            keys[n] = &entry->keys;
+            n++;
+            session->key_stream_count++;
+        }
+        _olm_cipher_aes_sha_256_init_context_multi(
+            megolm_cipher_aes_sha_256,
+            ratchets, MEGOLM_RATCHET_LENGTH, keys, n
+        );
+    }
+    return session->key_stream_count;
+}
+
+/** the number of devices a ledger with the given number of slots holds,
+ * keeping a quarter of them free so that lookups stay short */
+static size_t _ledger_limit(size_t capacity) {
+    return capacity / 4 * 3 + capacity % 4 * 3 / 4;
+}
+
+/** the slot where the device key is, or where it would go */
+static struct LedgerEntry *_ledger_find(
+    const OlmOutboundGroupSession *session, const uint8_t *device_key
+) {
+    /* device keys are random, so their first bytes hash them well enough */
+    uint32_t hash = (uint32_t)device_key[0]
+        | (uint32_t)device_key[1] << 8
+        | (uint32_t)device_key[2] << 16
+        | (uint32_t)device_key[3] << 24;
+    size_t slot = hash % session->ledger_capacity;
+
+    while (session->ledger[slot].used
+            && memcmp(
+                session->ledger[slot].device_key, device_key,
+                CURVE25519_KEY_LENGTH
+            ) != 0) {
+        slot = (slot + 1) % session->ledger_capacity;
+    }
+    return &session->ledger[slot];
+}
+
+/** add the device to the ledger, which must have room for it. Returns 1 if
+ * it is new, or 0 if it was already there, keeping its index. */
+static int _ledger_insert(
+    OlmOutboundGroupSession *session,
+    const uint8_t *device_key, uint32_t shared_at
+) {
+    struct LedgerEntry *entry = _ledger_find(session, device_key);
+    if (entry->used) {
+        return 0;
+    }
+    memcpy(entry->device_key, device_key, CURVE25519_KEY_LENGTH);
+    entry->shared_at = shared_at;
+    entry->used = 1;
+    session->ledger_count++;
+    return 1;
+}
+
+/** decode a base64 device key, setting last_error if it isn't one */
+static size_t _decode_device_key(
+    OlmOutboundGroupSession *session,
+    void const *device_key, size_t device_key_length,
+    uint8_t *output
+) {
+    if (device_key_length != DEVICE_KEY_ENCODED_LENGTH
+            || _olm_decode_base64(
+                device_key, device_key_length, output
+            ) == (size_t)-1) {
+        session->last_error = OLM_INVALID_BASE64;
+        return (size_t)-1;
+    }
+    return CURVE25519_KEY_LENGTH;
+}
+
+size_t olm_outbound_group_session_ledger_buffer_length(
+    size_t device_count
+) {
+    return ((4 * device_count + 2) / 3 + 1) * sizeof(struct LedgerEntry);
+}
+
+size_t olm_outbound_group_session_set_ledger(
+    OlmOutboundGroupSession *session,
+    void *buffer, size_t buffer_length
+) {
+    struct LedgerEntry *old = session->ledger;
+    size_t old_capacity = session->ledger_capacity;
+    size_t capacity = buffer ? buffer_length / sizeof(struct LedgerEntry) : 0;
+    size_t i;
+
+    if (session->ledger_count > _ledger_limit(capacity)) {
+        session->last_error = OLM_STORE_FULL;
+        return (size_t)-1;
+    }
+    session->ledger = buffer;
+    session->ledger_capacity = capacity;
+    session->ledger_count = 0;
+    if (buffer) {
+        _olm_unset(buffer, capacity * sizeof(struct LedgerEntry));
+    }
+    if (old) {
+        for (i = 0; i < old_capacity; ++i) {
+            if (old[i].used) {
+                _ledger_insert(session, old[i].device_key, old[i].shared_at);
+            }
+        }
+        _olm_unset(old, old_capacity * sizeof(struct LedgerEntry));
+    }
+    return _ledger_limit(capacity);
+}
+
+/* ledger entries added by olm_outbound_group_session_ledger_add() which it
+ * may still take out again have this in used, and the position of the key
+ * that added them in shared_at */
+#define LEDGER_ENTRY_PENDING 2
+
+/** take out the pending entries the first count keys added. Going back
+ * through them in reverse leaves the slots as if they were never added,
+ * since no lookup has had to step over an entry added after it. */
+static void _ledger_roll_back(
+    OlmOutboundGroupSession *session, size_t count,
+    void const * const * device_keys, size_t const * device_key_lengths
+) {
+    uint8_t device_key[CURVE25519_KEY_LENGTH];
+    struct LedgerEntry *entry;
+    size_t i;
+
+    for (i = count; i-- > 0;) {
+        _decode_device_key(
+            session, device_keys[i], device_key_lengths[i], device_key
+        );
+        entry = _ledger_find(session, device_key);
+        if (entry->used == LEDGER_ENTRY_PENDING
+                && entry->shared_at == (uint32_t)i) {
+            _olm_unset(entry, sizeof(*entry));
+            session->ledger_count--;
+        }
+    }
+}
+
+size_t olm_outbound_group_session_ledger_add(
+    OlmOutboundGroupSession *session, size_t count,
+    void const * const * device_keys, size_t const * device_key_lengths
+) {
+    uint8_t device_key[CURVE25519_KEY_LENGTH];
+    struct LedgerEntry *entry;
+    size_t added = 0, i;
+
+    /* check all the keys first, and then add the new devices as pending so
+     * that a device listed twice is only counted once, taking them out
+     * again if they don't all fit */
+    for (i = 0; i < count; ++i) {
+        if (_decode_device_key(
+                session, device_keys[i], device_key_lengths[i], device_key
+            ) == (size_t)-1) {
+            return (size_t)-1;
+        }
+    }
+    if (count && !session->ledger_capacity) {
+        session->last_error = OLM_STORE_FULL;
+        return (size_t)-1;
+    }
+    for (i = 0; i < count; ++i) {
+        _decode_device_key(
+            session, device_keys[i], device_key_lengths[i], device_key
+        );
+        entry = _ledger_find(session, device_key);
+        if (entry->used) {
+            continue;
+        }
+        if (session->ledger_count
+                == _ledger_limit(session->ledger_capacity)) {
+            _ledger_roll_back(session, i, device_keys, device_key_lengths);
+            session->last_error = OLM_STORE_FULL;
+            return (size_t)-1;
+        }
+        memcpy(entry->device_key, device_key, CURVE25519_KEY_LENGTH);
+        entry->shared_at = (uint32_t)i;
+        entry->used = LEDGER_ENTRY_PENDING;
+        session->ledger_count++;
+    }
+    for (i = 0; i < count; ++i) {
+        _decode_device_key(
+            session, device_keys[i], device_key_lengths[i], device_key
+        );
+        entry = _ledger_find(session, device_key);
+        if (entry->used == LEDGER_ENTRY_PENDING) {
+            entry->shared_at = session->ratchet.counter;
+            entry->used = 1;
+            added++;
+        }
+    }
+    if (added) {
+        session->dirty = 1;
+    }
+    return added;
+}
+
+size_t olm_outbound_group_session_ledger_lookup(
+    OlmOutboundGroupSession *session,
+    void const * device_key, size_t device_key_length,
+    uint32_t *shared_at
+) {
+    uint8_t key[CURVE25519_KEY_LENGTH];
+    const struct LedgerEntry *entry;
+
+    if (_decode_device_key(
+            session, device_key, device_key_length, key
+        ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    if (!session->ledger_capacity) {
+        return 0;
+    }
+    entry = _ledger_find(session, key);
+    if (!entry->used) {
+        return 0;
+    }
+    if (shared_at) {
+        *shared_at = entry->shared_at;
+    }
+    return 1;
+}
+
+size_t olm_outbound_group_session_ledger_missing(
+    OlmOutboundGroupSession *session, size_t count,
+    void const * const * device_keys, size_t const * device_key_lengths,
+    size_t *missing
+) {
+    uint8_t device_key[CURVE25519_KEY_LENGTH];
+    size_t missing_count = 0, i;
+
+    for (i = 0; i < count; ++i) {
+        if (_decode_device_key(
+                session, device_keys[i], device_key_lengths[i], device_key
+            ) == (size_t)-1) {
+            return (size_t)-1;
+        }
+        /* a device sent the key at an earlier index can decrypt from then
+         * on, so only those not in the ledger at all need it */
+        if (!session->ledger_capacity
+                || !_ledger_find(session, device_key)->used) {
+            missing[missing_count++] = i;
+        }
+    }
+    return missing_count;
+}
+
+size_t olm_outbound_group_session_ledger_count(
+    const OlmOutboundGroupSession *session
+) {
+    return session->ledger_count;
+}
+
+void olm_outbound_group_session_ledger_clear(
+    OlmOutboundGroupSession *session
+) {
+    if (session->ledger_count) {
+        session->dirty = 1;
+    }
+    _reset_ledger(session);
+}
+
 static size_t raw_pickle_length(
     const OlmOutboundGroupSession *session
 ) {
@@ -76,6 +525,13 @@ static size_t raw_pickle_length(
     length += _olm_pickle_uint32_length(PICKLE_VERSION);
     length += megolm_pickle_length(&(session->ratchet));
     length += _olm_pickle_ed25519_key_pair_length(&(session->signing_key));
+    if (session->ledger_count) {
+        length += _olm_pickle_uint32_length(session->ledger_count);
+        length += session->ledger_count * (
+            _olm_pickle_bytes_length(NULL, CURVE25519_KEY_LENGTH)
+                + _olm_pickle_uint32_length(0)
+        );
+    }
     return length;
 }
 
@@ -85,25 +541,112 @@ size_t olm_pickle_outbound_group_session_length(
     return _olm_enc_output_length(raw_pickle_length(session));
 }
 
+static uint8_t * write_pickle(
+    const OlmOutboundGroupSession *session, uint8_t *pos
+) {
+    size_t i;
+
+    /* sessions without a ledger keep to the version older libraries read */
+    pos = _olm_pickle_uint32(
+        pos, session->ledger_count ? PICKLE_VERSION_LEDGER : PICKLE_VERSION
+    );
+    pos = megolm_pickle(&(session->ratchet), pos);
+    pos = _olm_pickle_ed25519_key_pair(pos, &(session->signing_key));
+    if (session->ledger_count) {
+        pos = _olm_pickle_uint32(pos, (uint32_t)session->ledger_count);
+        for (i = 0; i < session->ledger_capacity; ++i) {
+            if (session->ledger[i].used) {
+                pos = _olm_pickle_bytes(
+                    pos, session->ledger[i].device_key, CURVE25519_KEY_LENGTH
+                );
+                pos = _olm_pickle_uint32(pos, session->ledger[i].shared_at);
+            }
+        }
+    }
+    return pos;
+}
+
+/**
+ * Load the session from the raw_length bytes of decrypted pickle at pos.
+ * Returns raw_length, or olm_error() if the pickle couldn't be read.
+ */
+static size_t read_pickle(
+    OlmOutboundGroupSession *session, const uint8_t *pos, size_t raw_length
+) {
+    const uint8_t *end = pos + raw_length;
+    uint32_t pickle_version, ledger_count = 0, i;
+
+    pos = _olm_unpickle_uint32(pos, end, &pickle_version);
+    if (pickle_version != PICKLE_VERSION
+            && pickle_version != PICKLE_VERSION_LEDGER) {
+        session->last_error = OLM_UNKNOWN_PICKLE_VERSION;
+        return (size_t)-1;
+    }
+    _reset_key_stream(session);
+    _forget_session_key(session);
+    _reset_ledger(session);
+    pos = megolm_unpickle(&(session->ratchet), pos, end);
+    pos = _olm_unpickle_ed25519_key_pair(pos, end, &(session->signing_key));
+
+    if (pickle_version >= PICKLE_VERSION_LEDGER) {
+        pos = _olm_unpickle_uint32(pos, end, &ledger_count);
+        if ((size_t)(end - pos) < (size_t)ledger_count * (
+                CURVE25519_KEY_LENGTH + _olm_pickle_uint32_length(0)
+            )) {
+            session->last_error = OLM_CORRUPTED_PICKLE;
+            return (size_t)-1;
+        }
+        if (ledger_count > _ledger_limit(session->ledger_capacity)) {
+            session->last_error = OLM_STORE_FULL;
+            return (size_t)-1;
+        }
+        for (i = 0; i < ledger_count; ++i) {
+            uint8_t device_key[CURVE25519_KEY_LENGTH];
+            uint32_t shared_at;
+            pos = _olm_unpickle_bytes(
+                pos, end, device_key, CURVE25519_KEY_LENGTH
+            );
+            pos = _olm_unpickle_uint32(pos, end, &shared_at);
+            _ledger_insert(session, device_key, shared_at);
+        }
+    }
+
+    if (end != pos) {
+        /* We had the wrong number of bytes in the input. */
+        session->last_error = OLM_CORRUPTED_PICKLE;
+        return (size_t)-1;
+    }
+
+    session->dirty = 0;
+    return raw_length;
+}
+
 size_t olm_pickle_outbound_group_session(
     OlmOutboundGroupSession *session,
     void const * key, size_t key_length,
     void * pickled, size_t pickled_length
 ) {
     size_t raw_length = raw_pickle_length(session);
-    uint8_t *pos;
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_PICKLE);
+    OLM_PROBE2(pickle_entry, OLM_PROBE_OUTBOUND_GROUP, pickled_length);
 
     if (pickled_length < _olm_enc_output_length(raw_length)) {
         session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+        OLM_PROBE2(pickle_return, OLM_PROBE_OUTBOUND_GROUP, (size_t)-1);
+        OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
         return (size_t)-1;
     }
 
-    pos = _olm_enc_output_pos(pickled, raw_length);
-    pos = _olm_pickle_uint32(pos, PICKLE_VERSION);
-    pos = megolm_pickle(&(session->ratchet), pos);
-    pos = _olm_pickle_ed25519_key_pair(pos, &(session->signing_key));
+    write_pickle(session, _olm_enc_output_pos(pickled, raw_length));
 
-    return _olm_enc_output(key, key_length, pickled, raw_length);
+    result = _olm_enc_output(key, key_length, pickled, raw_length);
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+    OLM_PROBE2(pickle_return, OLM_PROBE_OUTBOUND_GROUP, result);
+    OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+    return result;
 }
 
 size_t olm_unpickle_outbound_group_session(
@@ -111,36 +654,79 @@ size_t olm_unpickle_outbound_group_session(
     void const * key, size_t key_length,
     void * pickled, size_t pickled_length
 ) {
-    const uint8_t *pos;
-    const uint8_t *end;
-    uint32_t pickle_version;
+    size_t raw_length, result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_UNPICKLE);
+    OLM_PROBE2(unpickle_entry, OLM_PROBE_OUTBOUND_GROUP, pickled_length);
 
-    size_t raw_length = _olm_enc_input(
+    raw_length = _olm_enc_input(
         key, key_length, pickled, pickled_length, &(session->last_error)
     );
-    if (raw_length == (size_t)-1) {
-        return raw_length;
+    if (raw_length == (size_t)-1
+            || read_pickle(session, pickled, raw_length) == (size_t)-1) {
+        result = (size_t)-1;
+    } else {
+        result = pickled_length;
     }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+    OLM_PROBE2(unpickle_return, OLM_PROBE_OUTBOUND_GROUP, result);
+    OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+    return result;
+}
 
-    pos = pickled;
-    end = pos + raw_length;
-    pos = _olm_unpickle_uint32(pos, end, &pickle_version);
-    if (pickle_version != PICKLE_VERSION) {
-        session->last_error = OLM_UNKNOWN_PICKLE_VERSION;
-        return (size_t)-1;
-    }
-    pos = megolm_unpickle(&(session->ratchet), pos, end);
-    pos = _olm_unpickle_ed25519_key_pair(pos, end, &(session->signing_key));
+size_t olm_pickle_outbound_group_session_binary_length(
+    const OlmOutboundGroupSession *session
+) {
+    return _olm_enc_output_binary_length(raw_pickle_length(session));
+}
 
-    if (end != pos) {
-        /* We had the wrong number of bytes in the input. */
-        session->last_error = OLM_CORRUPTED_PICKLE;
+size_t olm_pickle_outbound_group_session_binary(
+    OlmOutboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length = raw_pickle_length(session);
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_PICKLE);
+
+    if (pickled_length < _olm_enc_output_binary_length(raw_length)) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+        OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
         return (size_t)-1;
     }
 
-    return pickled_length;
+    write_pickle(session, pickled);
+
+    result = _olm_enc_output_binary(key, key_length, pickled, raw_length);
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_PICKLE);
+    OLM_TRACE_END(trace, OLM_TRACE_PICKLE);
+    return result;
 }
 
+size_t olm_unpickle_outbound_group_session_binary(
+    OlmOutboundGroupSession *session,
+    void const * key, size_t key_length,
+    void * pickled, size_t pickled_length
+) {
+    size_t raw_length, result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_UNPICKLE);
+
+    raw_length = _olm_enc_input_binary(
+        key, key_length, pickled, pickled_length, &(session->last_error)
+    );
+    if (raw_length == (size_t)-1
+            || read_pickle(session, pickled, raw_length) == (size_t)-1) {
+        result = (size_t)-1;
+    } else {
+        result = pickled_length;
+    }
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_UNPICKLE);
+    OLM_TRACE_END(trace, OLM_TRACE_UNPICKLE);
+    return result;
+}
 
 size_t olm_init_outbound_group_session_random_length(
     const OlmOutboundGroupSession *session
@@ -157,41 +743,102 @@ size_t olm_init_outbound_group_session(
     uint8_t *random, size_t random_length
 ) {
     const uint8_t *random_ptr = random;
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION);
 
     if (random_length < olm_init_outbound_group_session_random_length(session)) {
         /* Insufficient random data for new session */
         session->last_error = OLM_NOT_ENOUGH_RANDOM;
+        OLM_TRACE_END(trace, OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION);
+        OLM_RECORD(
+            OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION, session, 0, 0, 0, 0,
+            (size_t)-1
+        );
         return (size_t)-1;
     }
 
+    _reset_key_stream(session);
+    _forget_session_key(session);
+    _reset_ledger(session);
     megolm_init(&(session->ratchet), random_ptr, 0);
     random_ptr += MEGOLM_RATCHET_LENGTH;
 
     _olm_crypto_ed25519_generate_key(random_ptr, &(session->signing_key));
     random_ptr += ED25519_RANDOM_LENGTH;
+    session->dirty = 1;
 
     _olm_unset(random, random_length);
+    OLM_TRACE_END(trace, OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION);
+    OLM_RECORD(OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION, session, 0, 0, 0, 0, 0);
     return 0;
 }
 
-static size_t raw_message_length(
+size_t olm_init_outbound_group_session_auto_random(
+    OlmOutboundGroupSession *session
+) {
+    uint8_t random[MEGOLM_RATCHET_LENGTH + ED25519_RANDOM_LENGTH];
+
+    if (olm_random_fill(random, sizeof(random)) == (size_t)-1) {
+        session->last_error = OLM_RANDOM_UNAVAILABLE;
+        return (size_t)-1;
+    }
+    return olm_init_outbound_group_session(session, random, sizeof(random));
+}
+
+size_t olm_prepare_next_outbound_group_session(
+    OlmOutboundGroupSession *next,
+    uint8_t *random, size_t random_length,
+    uint8_t *session_key, size_t session_key_length
+) {
+    if (session_key_length < olm_outbound_group_session_key_length(next)) {
+        next->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+    if (olm_init_outbound_group_session(
+            next, random, random_length
+        ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    olm_outbound_group_session_prepare(next, next->key_stream_capacity);
+    return olm_outbound_group_session_key(
+        next, session_key, session_key_length
+    );
+}
+
+void olm_rotate_outbound_group_session(
     OlmOutboundGroupSession *session,
+    OlmOutboundGroupSession *next
+) {
+    OlmOutboundGroupSession old = *session;
+    *session = *next;
+    *next = old;
+    _olm_unset(&old, sizeof(old));
+}
+
+/** the length of the un-base64-ed message at the given index */
+static size_t raw_message_length_at(
+    uint32_t message_index,
     size_t plaintext_length)
 {
     size_t ciphertext_length, mac_length;
 
-    ciphertext_length = megolm_cipher->ops->encrypt_ciphertext_length(
-        megolm_cipher, plaintext_length
-    );
+    ciphertext_length =
+        _olm_cipher_aes_sha_256_ciphertext_length(plaintext_length);
 
-    mac_length = megolm_cipher->ops->mac_length(megolm_cipher);
+    mac_length = _olm_cipher_aes_sha_256_mac_length();
 
     return _olm_encode_group_message_length(
-        session->ratchet.counter,
+        message_index,
         ciphertext_length, mac_length, ED25519_SIGNATURE_LENGTH
     );
 }
 
+static size_t raw_message_length(
+    OlmOutboundGroupSession *session,
+    size_t plaintext_length)
+{
+    return raw_message_length_at(session->ratchet.counter, plaintext_length);
+}
+
 size_t olm_group_encrypt_message_length(
     OlmOutboundGroupSession *session,
     size_t plaintext_length
@@ -200,48 +847,168 @@ size_t olm_group_encrypt_message_length(
     return _olm_encode_base64_length(message_length);
 }
 
-/** write an un-base64-ed message to the buffer */
-static size_t _encrypt(
-    OlmOutboundGroupSession *session, uint8_t const * plaintext, size_t plaintext_length,
-    uint8_t * buffer
+/**
+ * get the keys for the next message, and move the ratchet on. The keys should
+ * be cleared with _olm_cipher_aes_sha_256_clear_context once used.
+ */
+static void _take_message_keys(
+    OlmOutboundGroupSession *session,
+    struct _olm_cipher_aes_sha_256_context *keys
+) {
+    _forget_session_key(session);
+    session->dirty = 1;
+    if (session->key_stream_count) {
+        /* move on to the next prepared ratchet, wiping the keys we used */
+        *keys = session->key_stream[session->key_stream_start].keys;
+        _olm_unset(
+            &session->key_stream[session->key_stream_start],
+            sizeof(struct PreparedMessageKeys)
+        );
+        session->key_stream_start =
+            (session->key_stream_start + 1) % session->key_stream_capacity;
+        session->key_stream_count--;
+        if (session->key_stream_count) {
+            session->ratchet =
+                session->key_stream[session->key_stream_start].ratchet;
+        } else {
+            megolm_advance(&(session->ratchet));
+        }
+    } else {
+        _olm_cipher_aes_sha_256_init_context(
+            megolm_cipher_aes_sha_256,
+            megolm_get_data(&(session->ratchet)), MEGOLM_RATCHET_LENGTH,
+            keys
+        );
+        megolm_advance(&(session->ratchet));
+    }
+}
+
+/**
+ * As _take_message_keys, for the next count messages, at most
+ * OLM_CRYPTO_SHA256_MAX_LANES. The keys of those which weren't prepared are
+ * derived side by side.
+ */
+static void _take_message_keys_multi(
+    OlmOutboundGroupSession *session,
+    struct _olm_cipher_aes_sha_256_context *keys, size_t count
+) {
+    Megolm ratchets[OLM_CRYPTO_SHA256_MAX_LANES];
+    uint8_t const *ratchet_data[OLM_CRYPTO_SHA256_MAX_LANES];
+    struct _olm_cipher_aes_sha_256_context *contexts[
+        OLM_CRYPTO_SHA256_MAX_LANES
+    ];
+    size_t taken = 0, i;
+
+    while (taken < count && session->key_stream_count) {
+        _take_message_keys(session, &keys[taken]);
+        taken++;
+    }
+    if (taken == count) {
+        return;
+    }
+    _forget_session_key(session);
+    session->dirty = 1;
+    for (i = 0; taken + i < count; ++i) {
+        ratchets[i] = session->ratchet;
+        ratchet_data[i] = megolm_get_data(&ratchets[i]);
+        contexts[i] = &keys[taken + i];
+        megolm_advance(&(session->ratchet));
+    }
+    _olm_cipher_aes_sha_256_init_context_multi(
+        megolm_cipher_aes_sha_256,
+        ratchet_data, MEGOLM_RATCHET_LENGTH, contexts, i
+    );
+    _olm_unset(ratchets, sizeof(ratchets));
+}
+
+/**
+ * write the un-base64-ed message with the given index to the buffer, using
+ * keys, and leaving out the signature. Sets *signed_length to the length of
+ * the part of the message to be signed.
+ */
+static size_t _encrypt_unsigned_with_keys(
+    uint32_t message_index,
+    const struct _olm_cipher_aes_sha_256_context *keys,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * buffer, size_t *signed_length
 ) {
     size_t ciphertext_length, mac_length, message_length;
     size_t result;
     uint8_t *ciphertext_ptr;
 
-    ciphertext_length = megolm_cipher->ops->encrypt_ciphertext_length(
-        megolm_cipher,
-        plaintext_length
-    );
+    ciphertext_length =
+        _olm_cipher_aes_sha_256_ciphertext_length(plaintext_length);
 
-    mac_length = megolm_cipher->ops->mac_length(megolm_cipher);
+    mac_length = _olm_cipher_aes_sha_256_mac_length();
 
     /* first we build the message structure, then we encrypt
      * the plaintext into it.
      */
     message_length = _olm_encode_group_message(
         OLM_PROTOCOL_VERSION,
-        session->ratchet.counter,
+        message_index,
         ciphertext_length,
         buffer,
         &ciphertext_ptr);
 
     message_length += mac_length;
 
-    result = megolm_cipher->ops->encrypt(
-        megolm_cipher,
-        megolm_get_data(&(session->ratchet)), MEGOLM_RATCHET_LENGTH,
+    result = _olm_cipher_aes_sha_256_context_encrypt(
+        keys,
         plaintext, plaintext_length,
         ciphertext_ptr, ciphertext_length,
         buffer, message_length
     );
 
+    *signed_length = message_length;
+    return result;
+}
+
+/**
+ * write an un-base64-ed message to the buffer, leaving out the signature, and
+ * move the ratchet on. Sets *signed_length to the length of the part of the
+ * message to be signed.
+ */
+static size_t _encrypt_unsigned(
+    OlmOutboundGroupSession *session, uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * buffer, size_t *signed_length
+) {
+    uint32_t message_index = session->ratchet.counter;
+    struct _olm_cipher_aes_sha_256_context keys;
+    size_t result;
+
+    _take_message_keys(session, &keys);
+    result = _encrypt_unsigned_with_keys(
+        message_index, &keys, plaintext, plaintext_length,
+        buffer, signed_length
+    );
+    _olm_cipher_aes_sha_256_clear_context(&keys);
+    return result;
+}
+
+/** write an un-base64-ed message to the buffer */
+static size_t _encrypt(
+    OlmOutboundGroupSession *session, uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * buffer
+) {
+    size_t message_length;
+    size_t result;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_GROUP_ENCRYPT);
+
+    result = _encrypt_unsigned(
+        session, plaintext, plaintext_length, buffer, &message_length
+    );
     if (result == (size_t)-1) {
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_ENCRYPT);
+        OLM_TRACE_END(trace, OLM_TRACE_GROUP_ENCRYPT);
+        OLM_RECORD(
+            OLM_TRACE_GROUP_ENCRYPT, session, plaintext_length, 0,
+            session->ratchet.counter, 0, result
+        );
         return result;
     }
 
-    megolm_advance(&(session->ratchet));
-
     /* sign the whole thing with the ed25519 key. */
     _olm_crypto_ed25519_sign(
         &(session->signing_key),
@@ -249,6 +1016,13 @@ static size_t _encrypt(
         buffer + message_length
     );
 
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_ENCRYPT);
+
+    OLM_TRACE_END(trace, OLM_TRACE_GROUP_ENCRYPT);
+    OLM_RECORD(
+        OLM_TRACE_GROUP_ENCRYPT, session, plaintext_length, result,
+        session->ratchet.counter - 1, 0, result
+    );
     return result;
 }
 
@@ -261,10 +1035,14 @@ size_t olm_group_encrypt(
     size_t result;
     uint8_t *message_pos;
 
+    OLM_PROBE2(
+        group_encrypt_entry, plaintext_length, session->ratchet.counter
+    );
     rawmsglen = raw_message_length(session, plaintext_length);
 
     if (max_message_length < _olm_encode_base64_length(rawmsglen)) {
         session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_PROBE1(group_encrypt_return, (size_t)-1);
         return (size_t)-1;
     }
 
@@ -275,16 +1053,476 @@ size_t olm_group_encrypt(
 
     /* write the message, and encrypt it, at message_pos */
     result = _encrypt(session, plaintext, plaintext_length, message_pos);
+    if (result != (size_t)-1) {
+        /* bas64-encode it */
+        result = _olm_encode_base64(
+            message_pos, rawmsglen, message
+        );
+    }
+    OLM_PROBE1(group_encrypt_return, result);
+    return result;
+}
+
+size_t olm_group_encrypt_to_buffer(
+    OlmOutboundGroupSession *session,
+    uint8_t const * plaintext, size_t plaintext_length,
+    const OlmAllocator *allocator, OlmBuffer *message
+) {
+    size_t message_length = olm_group_encrypt_message_length(
+        session, plaintext_length
+    );
+    size_t result;
+
+    if (olm_buffer_reserve(message, allocator, message_length)
+            == (size_t)-1) {
+        session->last_error = OLM_ALLOCATION_FAILED;
+        return (size_t)-1;
+    }
+    result = olm_group_encrypt(
+        session, plaintext, plaintext_length,
+        message->data, message_length
+    );
+    if (result != (size_t)-1) {
+        message->length = result;
+    }
+    return result;
+}
+
+size_t olm_group_encrypt_inplace(
+    OlmOutboundGroupSession *session,
+    size_t plaintext_length,
+    uint8_t * buffer, size_t buffer_length
+) {
+    size_t rawmsglen;
+    size_t result;
+    uint8_t *message_pos, *ciphertext_pos;
+
+    rawmsglen = raw_message_length(session, plaintext_length);
+
+    if (buffer_length < _olm_encode_base64_length(rawmsglen)) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+
+    message_pos = buffer + _olm_encode_base64_length(rawmsglen) - rawmsglen;
+
+    /* the ciphertext is followed only by the MAC and the signature, so move
+     * the plain-text to where its ciphertext goes and encrypt it there.
+     */
+    ciphertext_pos = message_pos + rawmsglen
+        - ED25519_SIGNATURE_LENGTH
+        - _olm_cipher_aes_sha_256_mac_length()
+        - _olm_cipher_aes_sha_256_ciphertext_length(plaintext_length);
+    memmove(ciphertext_pos, buffer, plaintext_length);
+
+    result = _encrypt(session, ciphertext_pos, plaintext_length, message_pos);
     if (result == (size_t)-1) {
+        _olm_unset(buffer, buffer_length);
         return result;
     }
 
-    /* bas64-encode it */
     return _olm_encode_base64(
-        message_pos, rawmsglen, message
+        message_pos, rawmsglen, buffer
     );
 }
 
+size_t olm_group_encrypt_raw_message_length(
+    OlmOutboundGroupSession *session,
+    size_t plaintext_length
+) {
+    return raw_message_length(session, plaintext_length);
+}
+
+size_t olm_group_encrypt_raw(
+    OlmOutboundGroupSession *session,
+    uint8_t const * plaintext, size_t plaintext_length,
+    uint8_t * message, size_t max_message_length
+) {
+    size_t rawmsglen;
+    size_t result;
+
+    rawmsglen = raw_message_length(session, plaintext_length);
+
+    if (max_message_length < rawmsglen) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+
+    result = _encrypt(session, plaintext, plaintext_length, message);
+    if (result == (size_t)-1) {
+        return result;
+    }
+    return rawmsglen;
+}
+
+/**
+ * encrypt the next piece of plain-text into the segments at the cursor. The
+ * cipher writes whole blocks, so as many blocks as fit in the segment are
+ * encrypted straight into it, and a block which would run over into the next
+ * segment is encrypted on the side and copied.
+ */
+static void _encrypt_segment(
+    struct _olm_cipher_aes_sha_256_stream *cipher,
+    uint8_t const * plaintext, size_t plaintext_length,
+    struct _olm_iovec_cursor *output
+) {
+    uint8_t block[AES256_IV_LENGTH];
+
+    while (plaintext_length) {
+        size_t room, length, written;
+        uint8_t *pos = _olm_iovec_cursor_peek(output, &room);
+
+        if (room >= AES256_IV_LENGTH) {
+            /* the cipher is holding back block_length bytes from before */
+            length = room / AES256_IV_LENGTH * AES256_IV_LENGTH
+                - cipher->block_length;
+            if (length > plaintext_length) {
+                length = plaintext_length;
+            }
+            written = _olm_cipher_aes_sha_256_encrypt_stream_update(
+                cipher, plaintext, length, pos
+            );
+            _olm_iovec_cursor_skip(output, written);
+        } else {
+            length = AES256_IV_LENGTH - cipher->block_length;
+            if (length > plaintext_length) {
+                length = plaintext_length;
+            }
+            written = _olm_cipher_aes_sha_256_encrypt_stream_update(
+                cipher, plaintext, length, block
+            );
+            _olm_iovec_cursor_write(output, block, written);
+        }
+        plaintext += length;
+        plaintext_length -= length;
+    }
+}
+
+size_t olm_group_encrypt_raw_iov(
+    OlmOutboundGroupSession *session,
+    const OlmIovec * plaintext, size_t plaintext_count,
+    const OlmIovec * message, size_t message_count
+) {
+    size_t plaintext_length, rawmsglen, ciphertext_length, header_length, i;
+    uint8_t header[OLM_GROUP_MESSAGE_HEADER_MAX_LENGTH];
+    /* the last block of ciphertext, and the MAC */
+    uint8_t trailer[AES256_IV_LENGTH + OLM_CIPHER_AES_SHA_256_MAC_LENGTH];
+    uint8_t signature[ED25519_SIGNATURE_LENGTH];
+    struct _olm_cipher_aes_sha_256_context keys;
+    struct _olm_cipher_aes_sha_256_stream cipher;
+    struct _olm_iovec_cursor output;
+    OLM_STATS_TIMER_START(timer);
+    OLM_TRACE_BEGIN(trace, OLM_TRACE_GROUP_ENCRYPT);
+
+    plaintext_length = _olm_iovec_length(plaintext, plaintext_count);
+    rawmsglen = raw_message_length(session, plaintext_length);
+    if (_olm_iovec_length(message, message_count) < rawmsglen) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_ENCRYPT);
+        OLM_TRACE_END(trace, OLM_TRACE_GROUP_ENCRYPT);
+        OLM_RECORD(
+            OLM_TRACE_GROUP_ENCRYPT, session, plaintext_length, 0,
+            session->ratchet.counter, 0, (size_t)-1
+        );
+        return (size_t)-1;
+    }
+
+    ciphertext_length =
+        _olm_cipher_aes_sha_256_ciphertext_length(plaintext_length);
+    header_length = _olm_encode_group_message_header(
+        OLM_PROTOCOL_VERSION,
+        session->ratchet.counter,
+        ciphertext_length,
+        header
+    );
+    _olm_iovec_cursor_init(&output, message, message_count);
+    _olm_iovec_cursor_write(&output, header, header_length);
+
+    _take_message_keys(session, &keys);
+    _olm_cipher_aes_sha_256_encrypt_stream_begin(
+        &keys, &cipher, header, header_length
+    );
+    _olm_cipher_aes_sha_256_clear_context(&keys);
+
+    for (i = 0; i < plaintext_count; ++i) {
+        _encrypt_segment(
+            &cipher, plaintext[i].base, plaintext[i].length, &output
+        );
+    }
+    _olm_cipher_aes_sha_256_encrypt_stream_end(
+        &cipher, trailer, trailer + AES256_IV_LENGTH
+    );
+    _olm_iovec_cursor_write(&output, trailer, sizeof(trailer));
+
+    _olm_crypto_ed25519_sign_segments(
+        &session->signing_key,
+        message, message_count, rawmsglen - ED25519_SIGNATURE_LENGTH,
+        signature
+    );
+    _olm_iovec_cursor_write(&output, signature, ED25519_SIGNATURE_LENGTH);
+
+    OLM_STATS_TIMER_STOP(timer, OLM_STATS_GROUP_ENCRYPT);
+    OLM_TRACE_END(trace, OLM_TRACE_GROUP_ENCRYPT);
+    OLM_RECORD(
+        OLM_TRACE_GROUP_ENCRYPT, session, plaintext_length, rawmsglen,
+        session->ratchet.counter - 1, 0, rawmsglen
+    );
+    return rawmsglen;
+}
+
+struct OlmGroupEncryptStream {
+    struct _olm_cipher_aes_sha_256_stream cipher;
+    /* a copy of the session's key, so the session can be used meanwhile */
+    struct _olm_ed25519_key_pair signing_key;
+    uint8_t *message;
+    size_t message_length;
+    /* where the rest of the ciphertext goes */
+    uint8_t *ciphertext_pos;
+    size_t plaintext_remaining;
+    int active;
+    enum OlmErrorCode last_error;
+};
+
+size_t olm_group_encrypt_stream_size(void) {
+    return sizeof(OlmGroupEncryptStream);
+}
+
+OlmGroupEncryptStream * olm_group_encrypt_stream(void * memory) {
+    OlmGroupEncryptStream *stream = memory;
+    _olm_unset(stream, sizeof(OlmGroupEncryptStream));
+    return stream;
+}
+
+const char *olm_group_encrypt_stream_last_error(
+    const OlmGroupEncryptStream *stream
+) {
+    return _olm_error_to_string(stream->last_error);
+}
+
+size_t olm_clear_group_encrypt_stream(OlmGroupEncryptStream *stream) {
+    _olm_unset(stream, sizeof(OlmGroupEncryptStream));
+    return sizeof(OlmGroupEncryptStream);
+}
+
+size_t olm_group_encrypt_stream_begin(
+    OlmGroupEncryptStream *stream,
+    OlmOutboundGroupSession *session, size_t plaintext_length,
+    uint8_t * message, size_t message_length
+) {
+    size_t rawmsglen, ciphertext_length, header_length;
+    uint8_t *ciphertext_ptr;
+    struct _olm_cipher_aes_sha_256_context keys;
+
+    rawmsglen = raw_message_length(session, plaintext_length);
+    if (message_length < rawmsglen) {
+        stream->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+
+    ciphertext_length =
+        _olm_cipher_aes_sha_256_ciphertext_length(plaintext_length);
+    _olm_encode_group_message(
+        OLM_PROTOCOL_VERSION,
+        session->ratchet.counter,
+        ciphertext_length,
+        message,
+        &ciphertext_ptr);
+    header_length = ciphertext_ptr - message;
+
+    _take_message_keys(session, &keys);
+    _olm_cipher_aes_sha_256_encrypt_stream_begin(
+        &keys, &stream->cipher, message, header_length
+    );
+    _olm_cipher_aes_sha_256_clear_context(&keys);
+
+    stream->signing_key = session->signing_key;
+    stream->message = message;
+    stream->message_length = rawmsglen;
+    stream->ciphertext_pos = ciphertext_ptr;
+    stream->plaintext_remaining = plaintext_length;
+    stream->active = 1;
+    return 0;
+}
+
+size_t olm_group_encrypt_stream_update(
+    OlmGroupEncryptStream *stream,
+    uint8_t const * plaintext, size_t plaintext_length
+) {
+    if (!stream->active || plaintext_length > stream->plaintext_remaining) {
+        stream->last_error = OLM_BAD_STREAM_STATE;
+        return (size_t)-1;
+    }
+    stream->ciphertext_pos += _olm_cipher_aes_sha_256_encrypt_stream_update(
+        &stream->cipher, plaintext, plaintext_length, stream->ciphertext_pos
+    );
+    stream->plaintext_remaining -= plaintext_length;
+    return 0;
+}
+
+size_t olm_group_encrypt_stream_end(OlmGroupEncryptStream *stream) {
+    size_t signed_length, result;
+    uint8_t *pos;
+
+    if (!stream->active || stream->plaintext_remaining) {
+        stream->last_error = OLM_BAD_STREAM_STATE;
+        return (size_t)-1;
+    }
+    pos = stream->ciphertext_pos;
+    pos += _olm_cipher_aes_sha_256_encrypt_stream_end(
+        &stream->cipher, pos, pos + AES256_IV_LENGTH
+    );
+    pos += _olm_cipher_aes_sha_256_mac_length();
+
+    signed_length = pos - stream->message;
+    _olm_crypto_ed25519_sign(
+        &stream->signing_key, stream->message, signed_length,
+        stream->message + signed_length
+    );
+
+    result = stream->message_length;
+    olm_clear_group_encrypt_stream(stream);
+    return result;
+}
+
+/** the number of messages each job of a batch encrypt signs and encodes */
+#define ENCRYPT_BATCH_LENGTH 16
+/** the number of jobs handed to the executor at once */
+#define ENCRYPT_BATCH_JOBS 64
+
+struct EncryptBatch {
+    const struct _olm_ed25519_key_pair *signing_key;
+    uint8_t *messages;
+    const size_t *message_lengths;
+    /* the messages of this round of jobs */
+    size_t first, end;
+    /* where each job's first message starts in messages */
+    size_t offsets[ENCRYPT_BATCH_JOBS];
+};
+
+/** sign and base64-encode the messages of one job, in place */
+static void _encrypt_batch_job(void * context, size_t job) {
+    const struct EncryptBatch *batch = context;
+    size_t start = batch->first + job * ENCRYPT_BATCH_LENGTH;
+    size_t end = start + ENCRYPT_BATCH_LENGTH;
+    uint8_t *message = batch->messages + batch->offsets[job];
+    size_t i;
+
+    if (end > batch->end) {
+        end = batch->end;
+    }
+    for (i = start; i < end; ++i) {
+        size_t encoded_length = batch->message_lengths[i];
+        size_t raw_length = _olm_decode_base64_length(encoded_length);
+        uint8_t *raw = message + encoded_length - raw_length;
+        size_t signed_length = raw_length - ED25519_SIGNATURE_LENGTH;
+
+        _olm_crypto_ed25519_sign(
+            batch->signing_key, raw, signed_length, raw + signed_length
+        );
+        _olm_encode_base64(raw, raw_length, message);
+        message += encoded_length;
+    }
+}
+
+size_t olm_group_encrypt_batch_length(
+    OlmOutboundGroupSession *session, size_t count,
+    const size_t * plaintext_lengths
+) {
+    size_t length = 0;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        length += _olm_encode_base64_length(raw_message_length_at(
+            session->ratchet.counter + (uint32_t)i, plaintext_lengths[i]
+        ));
+    }
+    return length;
+}
+
+size_t olm_group_encrypt_batch(
+    OlmOutboundGroupSession *session, size_t count,
+    uint8_t const * const * plaintexts, const size_t * plaintext_lengths,
+    uint8_t * messages, size_t messages_length,
+    size_t * message_lengths,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    struct EncryptBatch batch;
+    size_t total, offset, start, i, j, n, job_count;
+
+    total = olm_group_encrypt_batch_length(session, count, plaintext_lengths);
+    if (messages_length < total) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+
+    batch.signing_key = &session->signing_key;
+    batch.messages = messages;
+    batch.message_lengths = message_lengths;
+
+    offset = 0;
+    for (start = 0; start < count;
+            start += ENCRYPT_BATCH_LENGTH * ENCRYPT_BATCH_JOBS) {
+        size_t end = start + ENCRYPT_BATCH_LENGTH * ENCRYPT_BATCH_JOBS;
+        if (end > count) {
+            end = count;
+        }
+
+        /* the ratchet has to be walked in order, so the messages are
+         * encrypted here, with the keys for a few at a time derived side by
+         * side. Each goes at the end of its slot, so that it can be
+         * base64-encoded in place */
+        for (i = start; i < end; i += n) {
+            struct _olm_cipher_aes_sha_256_context keys[
+                OLM_CRYPTO_SHA256_MAX_LANES
+            ];
+            uint32_t message_index = session->ratchet.counter;
+            size_t m, r = 0;
+
+            n = end - i < OLM_CRYPTO_SHA256_MAX_LANES ?
+                end - i : OLM_CRYPTO_SHA256_MAX_LANES;
+            _take_message_keys_multi(session, keys, n);
+            for (m = 0; m < n && r != (size_t)-1; ++m) {
+                size_t raw_length = raw_message_length_at(
+                    message_index + (uint32_t)m, plaintext_lengths[i + m]
+                );
+                size_t encoded_length = _olm_encode_base64_length(raw_length);
+                size_t signed_length;
+
+                /* note where each job's messages start */
+                if ((i + m - start) % ENCRYPT_BATCH_LENGTH == 0) {
+                    batch.offsets[(i + m - start) / ENCRYPT_BATCH_LENGTH] =
+                        offset;
+                }
+                message_lengths[i + m] = encoded_length;
+                r = _encrypt_unsigned_with_keys(
+                    message_index + (uint32_t)m, &keys[m],
+                    plaintexts[i + m], plaintext_lengths[i + m],
+                    messages + offset + encoded_length - raw_length,
+                    &signed_length
+                );
+                offset += encoded_length;
+            }
+            _olm_unset(keys, sizeof(keys));
+            if (r == (size_t)-1) {
+                return (size_t)-1;
+            }
+        }
+
+        /* while the signatures and encoding can be done in parallel */
+        batch.first = start;
+        batch.end = end;
+        job_count = (end - start + ENCRYPT_BATCH_LENGTH - 1)
+            / ENCRYPT_BATCH_LENGTH;
+        if (executor) {
+            executor(executor_context, _encrypt_batch_job, &batch, job_count);
+        } else {
+            for (j = 0; j < job_count; ++j) {
+                _encrypt_batch_job(&batch, j);
+            }
+        }
+    }
+    return total;
+}
+
 
 size_t olm_outbound_group_session_id_length(
     const OlmOutboundGroupSession *session
@@ -306,20 +1544,42 @@ size_t olm_outbound_group_session_id(
     );
 }
 
+size_t olm_outbound_group_session_id_binary(
+    OlmOutboundGroupSession *session,
+    uint8_t * id, size_t id_length
+) {
+    if (id_length < GROUP_SESSION_ID_LENGTH) {
+        session->last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return (size_t)-1;
+    }
+    memcpy(
+        id, session->signing_key.public_key.public_key, GROUP_SESSION_ID_LENGTH
+    );
+    return GROUP_SESSION_ID_LENGTH;
+}
+
 uint32_t olm_outbound_group_session_message_index(
     OlmOutboundGroupSession *session
 ) {
     return session->ratchet.counter;
 }
 
-#define SESSION_KEY_RAW_LENGTH \
-    (1 + 4 + MEGOLM_RATCHET_LENGTH + ED25519_PUBLIC_KEY_LENGTH\
-        + ED25519_SIGNATURE_LENGTH)
+int olm_outbound_group_session_is_dirty(
+    const OlmOutboundGroupSession *session
+) {
+    return session->dirty;
+}
+
+void olm_outbound_group_session_clear_dirty(
+    OlmOutboundGroupSession *session
+) {
+    session->dirty = 0;
+}
 
 size_t olm_outbound_group_session_key_length(
     const OlmOutboundGroupSession *session
 ) {
-    return _olm_encode_base64_length(SESSION_KEY_RAW_LENGTH);
+    return SESSION_KEY_ENCODED_LENGTH;
 }
 
 size_t olm_outbound_group_session_key(
@@ -335,6 +1595,11 @@ size_t olm_outbound_group_session_key(
         return (size_t)-1;
     }
 
+    if (session->session_key_cached) {
+        memcpy(key, session->session_key, SESSION_KEY_ENCODED_LENGTH);
+        return SESSION_KEY_ENCODED_LENGTH;
+    }
+
     /* put the raw data at the end of the output buffer. */
     raw = ptr = key + encoded_length - SESSION_KEY_RAW_LENGTH;
     *ptr++ = SESSION_KEY_VERSION;
@@ -360,5 +1625,8 @@ size_t olm_outbound_group_session_key(
         raw, ptr - raw, ptr
     );
 
-    return _olm_encode_base64(raw, SESSION_KEY_RAW_LENGTH, key);
+    _olm_encode_base64(raw, SESSION_KEY_RAW_LENGTH, key);
+    memcpy(session->session_key, key, SESSION_KEY_ENCODED_LENGTH);
+    session->session_key_cached = 1;
+    return SESSION_KEY_ENCODED_LENGTH;
 }
@@ -17,17 +17,104 @@
 
 #include "olm/base64.h"
 #include "olm/cipher.h"
+#include "olm/crypto.h"
+#include "olm/memory.h"
 #include "olm/olm.h"
+#include "olm/pickle.h"
+#include "olm/random.h"
+
+#include <string.h>
 
 static const struct _olm_cipher_aes_sha_256 PICKLE_CIPHER =
     OLM_CIPHER_INIT_AES_SHA_256("Pickle");
 
+static const char GCM_KDF_INFO[] = "Pickle GCM";
+
+/* derive the AES-GCM key from the pickle key */
+static void gcm_key_init(
+    uint8_t const * key, size_t key_length,
+    struct _olm_aes_gcm_key * gcm_key
+) {
+    struct _olm_aes256_key aes_key;
+    _olm_crypto_hkdf_sha256(
+        key, key_length,
+        NULL, 0,
+        (uint8_t const *) GCM_KDF_INFO, sizeof(GCM_KDF_INFO) - 1,
+        aes_key.key, AES256_KEY_LENGTH
+    );
+    _olm_crypto_aes_gcm_key_setup(&aes_key, gcm_key);
+    _olm_unset(&aes_key, sizeof(aes_key));
+}
+
+/* decrypt the length bytes of a decoded AES-GCM pickle in place, leaving the
+ * raw pickle at the start of the buffer */
+static size_t gcm_decrypt_in_place(
+    const struct _olm_aes_gcm_key * gcm_key,
+    uint8_t * input, size_t length,
+    enum OlmErrorCode * last_error
+) {
+    size_t raw_length;
+    if (length < AES_GCM_NONCE_LENGTH + AES_GCM_TAG_LENGTH) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+    raw_length = length - AES_GCM_NONCE_LENGTH - AES_GCM_TAG_LENGTH;
+    if (_olm_crypto_aes_gcm_decrypt(
+            gcm_key, input, NULL, 0,
+            input + AES_GCM_NONCE_LENGTH, raw_length,
+            input + AES_GCM_NONCE_LENGTH + raw_length,
+            input + AES_GCM_NONCE_LENGTH
+        ) == (size_t)-1) {
+        if (last_error) {
+            *last_error = OLM_BAD_ACCOUNT_KEY;
+        }
+        return (size_t)-1;
+    }
+    memmove(input, input + AES_GCM_NONCE_LENGTH, raw_length);
+    return raw_length;
+}
+
+/* decode and decrypt a pickle written by _olm_enc_output_gcm in place,
+ * leaving the raw pickle at the start of the buffer */
+static size_t gcm_input(
+    const struct _olm_aes_gcm_key * gcm_key,
+    uint8_t * input, size_t b64_length,
+    enum OlmErrorCode * last_error
+) {
+    size_t length;
+    /* move the base64 over the marker, so that it can be decoded in place */
+    memmove(input, input + 1, b64_length - 1);
+    length = _olm_decode_base64(input, b64_length - 1, input);
+    if (length == (size_t)-1) {
+        if (last_error) {
+            *last_error = OLM_INVALID_BASE64;
+        }
+        return (size_t)-1;
+    }
+    return gcm_decrypt_in_place(gcm_key, input, length, last_error);
+}
+
+/* as gcm_input, deriving the key from the pickle key */
+static size_t gcm_input_with_key(
+    uint8_t const * key, size_t key_length,
+    uint8_t * input, size_t b64_length,
+    enum OlmErrorCode * last_error
+) {
+    struct _olm_aes_gcm_key gcm_key;
+    size_t result;
+    gcm_key_init(key, key_length, &gcm_key);
+    result = gcm_input(&gcm_key, input, b64_length, last_error);
+    _olm_unset(&gcm_key, sizeof(gcm_key));
+    return result;
+}
+
 size_t _olm_enc_output_length(
     size_t raw_length
 ) {
-    const struct _olm_cipher *cipher = OLM_CIPHER_BASE(&PICKLE_CIPHER);
-    size_t length = cipher->ops->encrypt_ciphertext_length(cipher, raw_length);
-    length += cipher->ops->mac_length(cipher);
+    size_t length = _olm_cipher_aes_sha_256_ciphertext_length(raw_length);
+    length += _olm_cipher_aes_sha_256_mac_length();
     return _olm_encode_base64_length(length);
 }
 
@@ -35,26 +122,47 @@ uint8_t * _olm_enc_output_pos(
     uint8_t * output,
     size_t raw_length
 ) {
-    const struct _olm_cipher *cipher = OLM_CIPHER_BASE(&PICKLE_CIPHER);
-    size_t length = cipher->ops->encrypt_ciphertext_length(cipher, raw_length);
-    length += cipher->ops->mac_length(cipher);
+    size_t length = _olm_cipher_aes_sha_256_ciphertext_length(raw_length);
+    length += _olm_cipher_aes_sha_256_mac_length();
     return output + _olm_encode_base64_length(length) - length;
 }
 
-size_t _olm_enc_output(
+void _olm_enc_context_init(
     uint8_t const * key, size_t key_length,
-    uint8_t * output, size_t raw_length
+    struct _olm_enc_context * context
+) {
+    _olm_cipher_aes_sha_256_init_context(
+        &PICKLE_CIPHER, key, key_length, &context->cipher_context
+    );
+    gcm_key_init(key, key_length, &context->gcm_key);
+}
+
+void _olm_enc_context_init_aes_sha_256(
+    uint8_t const * key, size_t key_length,
+    struct _olm_enc_context * context
 ) {
-    const struct _olm_cipher *cipher = OLM_CIPHER_BASE(&PICKLE_CIPHER);
-    size_t ciphertext_length = cipher->ops->encrypt_ciphertext_length(
-        cipher, raw_length
+    _olm_cipher_aes_sha_256_init_context(
+        &PICKLE_CIPHER, key, key_length, &context->cipher_context
     );
-    size_t length = ciphertext_length + cipher->ops->mac_length(cipher);
+    memset(&context->gcm_key, 0, sizeof(context->gcm_key));
+}
+
+void _olm_enc_context_clear(struct _olm_enc_context * context) {
+    _olm_cipher_aes_sha_256_clear_context(&context->cipher_context);
+    _olm_unset(&context->gcm_key, sizeof(context->gcm_key));
+}
+
+size_t _olm_enc_output_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t * output, size_t raw_length
+) {
+    size_t ciphertext_length =
+        _olm_cipher_aes_sha_256_ciphertext_length(raw_length);
+    size_t length = ciphertext_length + _olm_cipher_aes_sha_256_mac_length();
     size_t base64_length = _olm_encode_base64_length(length);
     uint8_t * raw_output = output + base64_length - length;
-    cipher->ops->encrypt(
-        cipher,
-        key, key_length,
+    _olm_cipher_aes_sha_256_context_encrypt(
+        &context->cipher_context,
         raw_output, raw_length,
         raw_output, ciphertext_length,
         raw_output, length
@@ -64,29 +172,1081 @@ size_t _olm_enc_output(
 }
 
 
+/* decrypt enc_length bytes of ciphertext and mac in place */
+static size_t decrypt_in_place(
+    const struct _olm_enc_context * context,
+    uint8_t * input, size_t enc_length,
+    enum OlmErrorCode * last_error
+) {
+    size_t mac_length = _olm_cipher_aes_sha_256_mac_length();
+    size_t raw_length;
+    size_t result;
+    if (enc_length < mac_length) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+    raw_length = enc_length - mac_length;
+    result = _olm_cipher_aes_sha_256_context_decrypt(
+        &context->cipher_context,
+        input, enc_length,
+        input, raw_length,
+        input, raw_length
+    );
+    if (result == (size_t)-1 && last_error) {
+        *last_error = OLM_BAD_ACCOUNT_KEY;
+    }
+    return result;
+}
+
+
+size_t _olm_enc_input_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t * input, size_t b64_length,
+    enum OlmErrorCode * last_error
+) {
+    size_t enc_length;
+    if (_olm_enc_is_gcm(input, b64_length)) {
+        return gcm_input(&context->gcm_key, input, b64_length, last_error);
+    }
+    enc_length = _olm_decode_base64(input, b64_length, input);
+    if (enc_length == (size_t)-1) {
+        if (last_error) {
+            *last_error = OLM_INVALID_BASE64;
+        }
+        return (size_t)-1;
+    }
+    return decrypt_in_place(context, input, enc_length, last_error);
+}
+
+
+size_t _olm_enc_input_prefix(
+    uint8_t const * key, size_t key_length,
+    uint8_t * input, size_t b64_length, size_t prefix_length,
+    enum OlmErrorCode * last_error
+) {
+    struct _olm_enc_context context;
+    struct _olm_cipher_aes_sha_256_stream stream;
+    size_t mac_length = _olm_cipher_aes_sha_256_mac_length();
+    size_t enc_length, total_blocks, block_count, last_length;
+    uint8_t * last_block;
+
+    if (_olm_enc_is_gcm(input, b64_length)) {
+        /* the tag covers the whole pickle, so there are no shortcuts */
+        return gcm_input_with_key(
+            key, key_length, input, b64_length, last_error
+        );
+    }
+
+    enc_length = _olm_decode_base64(input, b64_length, input);
+    if (enc_length == (size_t)-1) {
+        if (last_error) {
+            *last_error = OLM_INVALID_BASE64;
+        }
+        return (size_t)-1;
+    }
+    if (enc_length < mac_length + AES256_IV_LENGTH) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+
+    _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+    if (_olm_cipher_aes_sha_256_context_verify(
+            &context.cipher_context, input, enc_length,
+            enc_length - mac_length
+        ) == (size_t)-1) {
+        _olm_enc_context_clear(&context);
+        if (last_error) {
+            *last_error = OLM_BAD_ACCOUNT_KEY;
+        }
+        return (size_t)-1;
+    }
+    _olm_cipher_aes_sha_256_decrypt_stream_begin(
+        &context.cipher_context, &stream
+    );
+    _olm_enc_context_clear(&context);
+
+    total_blocks = (enc_length - mac_length) / AES256_IV_LENGTH;
+    block_count = (prefix_length + AES256_IV_LENGTH - 1) / AES256_IV_LENGTH;
+    if (block_count < total_blocks) {
+        /* the padding is in the last block, so none of this has any */
+        _olm_cipher_aes_sha_256_decrypt_stream_update(
+            &stream, input, block_count, input
+        );
+        _olm_unset(&stream, sizeof(stream));
+        return block_count * AES256_IV_LENGTH;
+    }
+
+    _olm_cipher_aes_sha_256_decrypt_stream_update(
+        &stream, input, total_blocks - 1, input
+    );
+    last_block = input + (total_blocks - 1) * AES256_IV_LENGTH;
+    last_length = _olm_cipher_aes_sha_256_decrypt_stream_end(
+        &stream, last_block, last_block
+    );
+    if (last_length == (size_t)-1) {
+        if (last_error) {
+            *last_error = OLM_BAD_ACCOUNT_KEY;
+        }
+        return (size_t)-1;
+    }
+    return (total_blocks - 1) * AES256_IV_LENGTH + last_length;
+}
+
+
+/* the decoded pickle is checked this many bytes at a time: a whole number of
+ * base64 quanta */
+#define VERIFY_CHUNK_LENGTH 192
+
+/* check the MAC or the tag of an encoded pickle, decoding it a chunk at a
+ * time and without decrypting it, so that the input isn't changed */
+static size_t verify_pickle(
+    const struct _olm_enc_context * context,
+    uint8_t const * input, size_t b64_length,
+    enum OlmErrorCode * last_error
+) {
+    int gcm = _olm_enc_is_gcm(input, b64_length);
+    size_t nonce_length = gcm ? AES_GCM_NONCE_LENGTH : 0;
+    size_t mac_length = gcm ?
+        AES_GCM_TAG_LENGTH : _olm_cipher_aes_sha_256_mac_length();
+    uint8_t nonce[AES_GCM_NONCE_LENGTH];
+    uint8_t their_mac[AES_GCM_TAG_LENGTH];
+    uint8_t mac[SHA256_OUTPUT_LENGTH];
+    uint8_t chunk[VERIFY_CHUNK_LENGTH];
+    struct _olm_hmac_sha256_context hmac;
+    struct _olm_aes_gcm_verify_context gcm_verify;
+    size_t length, end, pos = 0, result = (size_t)-1;
+
+    /* a header is covered by the MAC along with the ciphertext, so only the
+     * marker needs skipping */
+    if (gcm || _olm_enc_has_header(input, b64_length)) {
+        input++;
+        b64_length--;
+    }
+    length = _olm_decode_base64_length(b64_length);
+    if (length == (size_t)-1) {
+        if (last_error) {
+            *last_error = OLM_INVALID_BASE64;
+        }
+        return (size_t)-1;
+    }
+    if (length < nonce_length + mac_length) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+    end = length - mac_length;
+
+    if (gcm) {
+        _olm_crypto_aes_gcm_verify_begin(
+            &context->gcm_key, &gcm_verify, NULL, 0
+        );
+    } else {
+        _olm_crypto_hmac_sha256_begin(
+            &context->cipher_context.mac_key, &hmac
+        );
+    }
+    while (b64_length) {
+        size_t chunk_b64_length = VERIFY_CHUNK_LENGTH / 3 * 4;
+        size_t chunk_length, count;
+        uint8_t const * data = chunk;
+        if (chunk_b64_length > b64_length) {
+            chunk_b64_length = b64_length;
+        }
+        chunk_length = _olm_decode_base64(input, chunk_b64_length, chunk);
+        if (chunk_length == (size_t)-1) {
+            if (last_error) {
+                *last_error = OLM_INVALID_BASE64;
+            }
+            goto done;
+        }
+        input += chunk_b64_length;
+        b64_length -= chunk_b64_length;
+
+        /* split the chunk between the nonce, the ciphertext and the MAC */
+        if (pos < nonce_length) {
+            count = nonce_length - pos;
+            count = count < chunk_length ? count : chunk_length;
+            memcpy(nonce + pos, data, count);
+            pos += count;
+            data += count;
+            chunk_length -= count;
+        }
+        if (pos < end) {
+            count = end - pos;
+            count = count < chunk_length ? count : chunk_length;
+            if (gcm) {
+                _olm_crypto_aes_gcm_verify_update(
+                    &context->gcm_key, &gcm_verify, data, count
+                );
+            } else {
+                _olm_crypto_hmac_sha256_update(&hmac, data, count);
+            }
+            pos += count;
+            data += count;
+            chunk_length -= count;
+        }
+        memcpy(their_mac + pos - end, data, chunk_length);
+        pos += chunk_length;
+    }
+
+    if (gcm) {
+        result = _olm_crypto_aes_gcm_verify_end(
+            &context->gcm_key, &gcm_verify, nonce, their_mac
+        );
+    } else {
+        _olm_crypto_hmac_sha256_end(
+            &context->cipher_context.mac_key, &hmac, mac
+        );
+        result = _olm_is_equal(mac, their_mac, mac_length) ?
+            0 : (size_t)-1;
+    }
+    if (result == (size_t)-1 && last_error) {
+        *last_error = OLM_BAD_ACCOUNT_KEY;
+    }
+
+done:
+    _olm_unset(&hmac, sizeof(hmac));
+    _olm_unset(&gcm_verify, sizeof(gcm_verify));
+    _olm_unset(mac, sizeof(mac));
+    _olm_unset(chunk, sizeof(chunk));
+    return result;
+}
+
+
+size_t _olm_enc_output(
+    uint8_t const * key, size_t key_length,
+    uint8_t * output, size_t raw_length
+) {
+    struct _olm_enc_context context;
+    size_t result;
+    _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+    result = _olm_enc_output_with_context(&context, output, raw_length);
+    _olm_enc_context_clear(&context);
+    return result;
+}
+
+
 size_t _olm_enc_input(uint8_t const * key, size_t key_length,
                       uint8_t * input, size_t b64_length,
                       enum OlmErrorCode * last_error
 ) {
-    size_t enc_length = _olm_decode_base64_length(b64_length);
-    if (enc_length == (size_t)-1) {
+    struct _olm_enc_context context;
+    size_t result;
+    if (_olm_enc_is_gcm(input, b64_length)) {
+        return gcm_input_with_key(
+            key, key_length, input, b64_length, last_error
+        );
+    }
+    _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+    result = _olm_enc_input_with_context(
+        &context, input, b64_length, last_error
+    );
+    _olm_enc_context_clear(&context);
+    return result;
+}
+
+
+size_t _olm_enc_input_const(
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t b64_length,
+    uint8_t * output, size_t max_output_length,
+    enum OlmErrorCode * last_error
+) {
+    struct _olm_enc_context context;
+    size_t length, result;
+    int gcm = _olm_enc_is_gcm(input, b64_length);
+
+    /* decode the pickle into the output, and decrypt it there */
+    if (gcm) {
+        input++;
+        b64_length--;
+    }
+    length = _olm_decode_base64_length(b64_length);
+    if (length == (size_t)-1) {
         if (last_error) {
             *last_error = OLM_INVALID_BASE64;
         }
         return (size_t)-1;
     }
-    _olm_decode_base64(input, b64_length, input);
-    const struct _olm_cipher *cipher = OLM_CIPHER_BASE(&PICKLE_CIPHER);
-    size_t raw_length = enc_length - cipher->ops->mac_length(cipher);
-    size_t result = cipher->ops->decrypt(
-        cipher,
-        key, key_length,
-        input, enc_length,
-        input, raw_length,
-        input, raw_length
+    if (length > max_output_length) {
+        if (last_error) {
+            *last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        }
+        return (size_t)-1;
+    }
+    if (_olm_decode_base64(input, b64_length, output) == (size_t)-1) {
+        _olm_unset(output, length);
+        if (last_error) {
+            *last_error = OLM_INVALID_BASE64;
+        }
+        return (size_t)-1;
+    }
+    if (gcm) {
+        gcm_key_init(key, key_length, &context.gcm_key);
+        result = gcm_decrypt_in_place(
+            &context.gcm_key, output, length, last_error
+        );
+        _olm_unset(&context.gcm_key, sizeof(context.gcm_key));
+    } else {
+        _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+        result = decrypt_in_place(&context, output, length, last_error);
+        _olm_enc_context_clear(&context);
+    }
+    if (result == (size_t)-1) {
+        _olm_unset(output, length);
+    }
+    return result;
+}
+
+
+size_t _olm_enc_output_binary_length(
+    size_t raw_length
+) {
+    size_t length = _olm_cipher_aes_sha_256_ciphertext_length(raw_length);
+    return length + _olm_cipher_aes_sha_256_mac_length();
+}
+
+
+size_t _olm_enc_output_binary_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t * output, size_t raw_length
+) {
+    size_t ciphertext_length =
+        _olm_cipher_aes_sha_256_ciphertext_length(raw_length);
+    size_t length = ciphertext_length + _olm_cipher_aes_sha_256_mac_length();
+    _olm_cipher_aes_sha_256_context_encrypt(
+        &context->cipher_context,
+        output, raw_length,
+        output, ciphertext_length,
+        output, length
+    );
+    return length;
+}
+
+
+size_t _olm_enc_input_binary_with_context(
+    const struct _olm_enc_context * context,
+    uint8_t * input, size_t length,
+    enum OlmErrorCode * last_error
+) {
+    return decrypt_in_place(context, input, length, last_error);
+}
+
+
+size_t _olm_enc_output_binary(
+    uint8_t const * key, size_t key_length,
+    uint8_t * output, size_t raw_length
+) {
+    struct _olm_enc_context context;
+    size_t result;
+    _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+    result = _olm_enc_output_binary_with_context(&context, output, raw_length);
+    _olm_enc_context_clear(&context);
+    return result;
+}
+
+
+size_t _olm_enc_input_binary(
+    uint8_t const * key, size_t key_length,
+    uint8_t * input, size_t length,
+    enum OlmErrorCode * last_error
+) {
+    struct _olm_enc_context context;
+    size_t result;
+    _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+    result = decrypt_in_place(&context, input, length, last_error);
+    _olm_enc_context_clear(&context);
+    return result;
+}
+
+
+/* Streamed pickles are encrypted and decrypted this many bytes at a time */
+#define STREAM_CHUNK_LENGTH 256
+
+/* The last block and the MAC, which a streamed pickle being read holds back
+ * until it gets to the end */
+#define STREAM_TAIL_LENGTH \
+    (AES256_IV_LENGTH + OLM_CIPHER_AES_SHA_256_MAC_LENGTH)
+
+size_t _olm_enc_output_binary_stream(
+    const struct _olm_enc_context * context,
+    uint8_t const * raw, size_t raw_length,
+    OlmPickleWriter write, void * write_context,
+    enum OlmErrorCode * last_error
+) {
+    struct _olm_cipher_aes_sha_256_stream stream;
+    uint8_t buffer[STREAM_CHUNK_LENGTH + STREAM_TAIL_LENGTH];
+    size_t pos = 0, length = 0, chunk_length, output_length;
+    int failed = 0;
+
+    _olm_cipher_aes_sha_256_encrypt_stream_begin(
+        &context->cipher_context, &stream, NULL, 0
+    );
+    while (pos < raw_length && !failed) {
+        chunk_length = raw_length - pos;
+        if (chunk_length > STREAM_CHUNK_LENGTH) {
+            chunk_length = STREAM_CHUNK_LENGTH;
+        }
+        output_length = _olm_cipher_aes_sha_256_encrypt_stream_update(
+            &stream, raw + pos, chunk_length, buffer
+        );
+        pos += chunk_length;
+        length += output_length;
+        failed = output_length
+            && write(write_context, buffer, output_length);
+    }
+    if (failed) {
+        _olm_unset(&stream, sizeof(stream));
+    } else {
+        output_length = _olm_cipher_aes_sha_256_encrypt_stream_end(
+            &stream, buffer, buffer + AES256_IV_LENGTH
+        ) + _olm_cipher_aes_sha_256_mac_length();
+        length += output_length;
+        failed = write(write_context, buffer, output_length);
+    }
+    _olm_unset(buffer, sizeof(buffer));
+    if (failed) {
+        if (last_error) {
+            *last_error = OLM_PICKLE_STREAM_FAILED;
+        }
+        return (size_t)-1;
+    }
+    return length;
+}
+
+
+size_t _olm_enc_input_binary_stream(
+    const struct _olm_enc_context * context,
+    OlmPickleReader read, void * read_context, size_t input_length,
+    uint8_t * raw, size_t max_raw_length, size_t * read_length,
+    enum OlmErrorCode * last_error
+) {
+    struct _olm_cipher_aes_sha_256_stream stream;
+    uint8_t buffer[STREAM_CHUNK_LENGTH + STREAM_TAIL_LENGTH];
+    size_t held = 0, raw_length = 0, total = 0, wanted, count, blocks;
+    enum OlmErrorCode error = OLM_SUCCESS;
+
+    _olm_cipher_aes_sha_256_decrypt_stream_begin_with_mac(
+        &context->cipher_context, &stream
+    );
+    /* keep the last block and the MAC in the buffer until the input runs
+     * out, and decrypt the whole blocks before them as they arrive */
+    while (total != input_length) {
+        wanted = sizeof(buffer) - held;
+        if (input_length != (size_t)-1 && wanted > input_length - total) {
+            wanted = input_length - total;
+        }
+        count = read(read_context, buffer + held, wanted);
+        if (count == (size_t)-1 || count > wanted) {
+            error = OLM_PICKLE_STREAM_FAILED;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        held += count;
+        total += count;
+        if (held <= STREAM_TAIL_LENGTH) {
+            continue;
+        }
+        blocks = (held - STREAM_TAIL_LENGTH) / AES256_IV_LENGTH;
+        if (blocks * AES256_IV_LENGTH > max_raw_length - raw_length) {
+            error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+            break;
+        }
+        _olm_cipher_aes_sha_256_decrypt_stream_mac(
+            &stream, buffer, blocks * AES256_IV_LENGTH
+        );
+        _olm_cipher_aes_sha_256_decrypt_stream_update(
+            &stream, buffer, blocks, raw + raw_length
+        );
+        raw_length += blocks * AES256_IV_LENGTH;
+        held -= blocks * AES256_IV_LENGTH;
+        memmove(buffer, buffer + blocks * AES256_IV_LENGTH, held);
+    }
+
+    if (error == OLM_SUCCESS && (held != STREAM_TAIL_LENGTH
+            || (input_length != (size_t)-1 && total != input_length))) {
+        error = OLM_CORRUPTED_PICKLE;
+    }
+    if (error == OLM_SUCCESS
+            && max_raw_length - raw_length < AES256_IV_LENGTH) {
+        error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+    }
+    if (error == OLM_SUCCESS) {
+        _olm_cipher_aes_sha_256_decrypt_stream_mac(
+            &stream, buffer, AES256_IV_LENGTH
+        );
+        if (_olm_cipher_aes_sha_256_decrypt_stream_verify(
+                &stream, buffer + AES256_IV_LENGTH
+            ) == (size_t)-1) {
+            error = OLM_BAD_ACCOUNT_KEY;
+        }
+    }
+    if (error == OLM_SUCCESS) {
+        count = _olm_cipher_aes_sha_256_decrypt_stream_end(
+            &stream, buffer, raw + raw_length
+        );
+        if (count == (size_t)-1) {
+            error = OLM_BAD_ACCOUNT_KEY;
+        } else {
+            raw_length += count;
+        }
+    }
+
+    _olm_unset(buffer, sizeof(buffer));
+    if (error != OLM_SUCCESS) {
+        _olm_unset(&stream, sizeof(stream));
+        _olm_unset(raw, raw_length);
+        if (last_error) {
+            *last_error = error;
+        }
+        return (size_t)-1;
+    }
+    if (read_length) {
+        *read_length = total;
+    }
+    return raw_length;
+}
+
+
+size_t _olm_enc_input_binary_const(
+    uint8_t const * key, size_t key_length,
+    uint8_t const * input, size_t length,
+    uint8_t * output, size_t max_output_length,
+    enum OlmErrorCode * last_error
+) {
+    struct _olm_enc_context context;
+    size_t mac_length = _olm_cipher_aes_sha_256_mac_length();
+    size_t result;
+    if (length < mac_length) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+    if (length - mac_length > max_output_length) {
+        if (last_error) {
+            *last_error = OLM_OUTPUT_BUFFER_TOO_SMALL;
+        }
+        return (size_t)-1;
+    }
+    _olm_enc_context_init_aes_sha_256(key, key_length, &context);
+    result = _olm_cipher_aes_sha_256_context_decrypt(
+        &context.cipher_context,
+        input, length,
+        input, length - mac_length,
+        output, length - mac_length
     );
+    _olm_enc_context_clear(&context);
     if (result == (size_t)-1 && last_error) {
         *last_error = OLM_BAD_ACCOUNT_KEY;
     }
     return result;
 }
+
+
+size_t _olm_enc_output_with_header_length(
+    size_t header_length, size_t raw_length
+) {
+    size_t length = header_length + _olm_enc_output_binary_length(raw_length);
+    return 1 + _olm_encode_base64_length(length);
+}
+
+
+uint8_t * _olm_enc_output_with_header_pos(
+    uint8_t * output, size_t header_length, size_t raw_length
+) {
+    size_t length = header_length + _olm_enc_output_binary_length(raw_length);
+    return output + 1 + _olm_encode_base64_length(length) - length;
+}
+
+
+size_t _olm_enc_output_with_header(
+    const struct _olm_enc_context * context,
+    uint8_t * output, size_t header_length, size_t raw_length
+) {
+    size_t ciphertext_length =
+        _olm_cipher_aes_sha_256_ciphertext_length(raw_length);
+    size_t length = header_length + ciphertext_length
+        + _olm_cipher_aes_sha_256_mac_length();
+    uint8_t * raw_output = _olm_enc_output_with_header_pos(
+        output, header_length, raw_length
+    );
+    uint8_t * ciphertext = raw_output + header_length;
+    /* the header is the associated data that the MAC covers with the
+     * ciphertext */
+    _olm_cipher_aes_sha_256_context_encrypt(
+        &context->cipher_context,
+        ciphertext, raw_length,
+        ciphertext, ciphertext_length,
+        raw_output, length
+    );
+    output[0] = OLM_PICKLE_HEADER_MARKER;
+    return 1 + _olm_encode_base64(raw_output, length, output + 1);
+}
+
+
+int _olm_enc_has_header(uint8_t const * input, size_t b64_length) {
+    return b64_length && input[0] == OLM_PICKLE_HEADER_MARKER;
+}
+
+
+size_t _olm_enc_input_with_header(
+    const struct _olm_enc_context * context,
+    uint8_t * input, size_t b64_length, size_t header_length,
+    enum OlmErrorCode * last_error
+) {
+    size_t mac_length = _olm_cipher_aes_sha_256_mac_length();
+    size_t length, ciphertext_length, result;
+    if (!_olm_enc_has_header(input, b64_length)) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+    /* move the base64 over the marker, so that it can be decoded in place */
+    memmove(input, input + 1, b64_length - 1);
+    length = _olm_decode_base64(input, b64_length - 1, input);
+    if (length == (size_t)-1) {
+        if (last_error) {
+            *last_error = OLM_INVALID_BASE64;
+        }
+        return (size_t)-1;
+    }
+    if (length < header_length + mac_length) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+    ciphertext_length = length - header_length - mac_length;
+    result = _olm_cipher_aes_sha_256_context_decrypt(
+        &context->cipher_context,
+        input, length,
+        input + header_length, ciphertext_length,
+        input + header_length, ciphertext_length
+    );
+    if (result == (size_t)-1 && last_error) {
+        *last_error = OLM_BAD_ACCOUNT_KEY;
+    }
+    return result;
+}
+
+
+size_t _olm_enc_peek_header(
+    uint8_t const * input, size_t b64_length,
+    uint8_t * header, size_t header_length
+) {
+    size_t header_b64_length = _olm_encode_base64_length(header_length);
+    if (!_olm_enc_has_header(input, b64_length)
+            || b64_length - 1 < header_b64_length
+            || _olm_decode_base64(
+                input + 1, header_b64_length, header
+            ) != header_length) {
+        return (size_t)-1;
+    }
+    return header_length;
+}
+
+
+size_t _olm_enc_output_gcm_length(size_t raw_length) {
+    size_t length = AES_GCM_NONCE_LENGTH + raw_length + AES_GCM_TAG_LENGTH;
+    return 1 + _olm_encode_base64_length(length);
+}
+
+
+uint8_t * _olm_enc_output_gcm_pos(uint8_t * output, size_t raw_length) {
+    size_t length = AES_GCM_NONCE_LENGTH + raw_length + AES_GCM_TAG_LENGTH;
+    return output + 1 + _olm_encode_base64_length(length) - length
+        + AES_GCM_NONCE_LENGTH;
+}
+
+
+/* encrypt and encode a pickle for _olm_enc_output_gcm, once the nonce has
+ * been written in front of the raw pickle */
+static size_t gcm_output(
+    const struct _olm_aes_gcm_key * gcm_key,
+    uint8_t * output, size_t raw_length
+) {
+    size_t length = AES_GCM_NONCE_LENGTH + raw_length + AES_GCM_TAG_LENGTH;
+    uint8_t * pickle = _olm_enc_output_gcm_pos(output, raw_length);
+    uint8_t * nonce = pickle - AES_GCM_NONCE_LENGTH;
+    _olm_crypto_aes_gcm_encrypt(
+        gcm_key, nonce, NULL, 0,
+        pickle, raw_length, pickle, pickle + raw_length
+    );
+    output[0] = OLM_PICKLE_GCM_MARKER;
+    return 1 + _olm_encode_base64(nonce, length, output + 1);
+}
+
+
+size_t _olm_enc_output_gcm(
+    const struct _olm_enc_context * context,
+    uint8_t * output, size_t raw_length,
+    enum OlmErrorCode * last_error
+) {
+    uint8_t * pickle = _olm_enc_output_gcm_pos(output, raw_length);
+    /* even at a pickle for every message, a random 96 bit nonce isn't
+     * expected to repeat under the same key */
+    if (olm_random_fill(
+            pickle - AES_GCM_NONCE_LENGTH, AES_GCM_NONCE_LENGTH
+        ) == (size_t)-1) {
+        _olm_unset(pickle, raw_length);
+        if (last_error) {
+            *last_error = OLM_RANDOM_UNAVAILABLE;
+        }
+        return (size_t)-1;
+    }
+    return gcm_output(&context->gcm_key, output, raw_length);
+}
+
+
+int _olm_enc_is_gcm(uint8_t const * input, size_t b64_length) {
+    return b64_length && input[0] == OLM_PICKLE_GCM_MARKER;
+}
+
+
+size_t _olm_enc_output_with_cipher_length(uint32_t cipher, size_t raw_length) {
+    if (cipher == OLM_PICKLE_CIPHER_AES_GCM) {
+        return _olm_enc_output_gcm_length(raw_length);
+    }
+    return _olm_enc_output_length(raw_length);
+}
+
+
+uint8_t * _olm_enc_output_with_cipher_pos(
+    uint32_t cipher, uint8_t * output, size_t raw_length
+) {
+    if (cipher == OLM_PICKLE_CIPHER_AES_GCM) {
+        return _olm_enc_output_gcm_pos(output, raw_length);
+    }
+    return _olm_enc_output_pos(output, raw_length);
+}
+
+
+size_t _olm_enc_output_with_cipher(
+    const struct _olm_enc_context * context, uint32_t cipher,
+    uint8_t * output, size_t raw_length,
+    enum OlmErrorCode * last_error
+) {
+    switch (cipher) {
+    case OLM_PICKLE_CIPHER_AES_SHA_256:
+        return _olm_enc_output_with_context(context, output, raw_length);
+    case OLM_PICKLE_CIPHER_AES_GCM:
+        return _olm_enc_output_gcm(context, output, raw_length, last_error);
+    default:
+        _olm_unset(_olm_enc_output_pos(output, raw_length), raw_length);
+        if (last_error) {
+            *last_error = OLM_UNKNOWN_PICKLE_VERSION;
+        }
+        return (size_t)-1;
+    }
+}
+
+
+static const uint32_t BATCH_VERSION = 1;
+
+size_t _olm_batch_length(size_t count, size_t pickles_length) {
+    size_t length = _olm_pickle_uint32_length(BATCH_VERSION);
+    length += _olm_pickle_uint32_length(count);
+    length += count * _olm_pickle_uint32_length(0);
+    return length + pickles_length;
+}
+
+
+uint8_t * _olm_batch_write_header(uint8_t * pos, size_t count) {
+    pos = _olm_pickle_uint32(pos, BATCH_VERSION);
+    return _olm_pickle_uint32(pos, count);
+}
+
+
+uint8_t * _olm_batch_write_entry(uint8_t * pos, size_t pickle_length) {
+    return _olm_pickle_uint32(pos, pickle_length);
+}
+
+
+size_t _olm_batch_reader_init(
+    struct _olm_batch_reader * reader,
+    uint8_t * batch, size_t batch_length,
+    enum OlmErrorCode * last_error
+) {
+    const uint8_t * end = batch + batch_length;
+    const uint8_t * pos = batch;
+    uint32_t version, count;
+
+    if (batch_length < _olm_batch_length(0, 0)) {
+        if (last_error) {
+            *last_error = OLM_CORRUPTED_PICKLE;
+        }
+        return (size_t)-1;
+    }
+    pos = _olm_unpickle_uint32(pos, end, &version);
+    if (version != BATCH_VERSION) {
+        if (last_error) {
+            *last_error = OLM_UNKNOWN_PICKLE_VERSION;
+        }
+        return (size_t)-1;
+    }
+    pos = _olm_unpickle_uint32(pos, end, &count);
+
+    reader->pos = batch + (pos - batch);
+    reader->end = batch + batch_length;
+    reader->remaining = count;
+    return count;
+}
+
+
+uint8_t * _olm_batch_reader_next(
+    struct _olm_batch_reader * reader,
+    size_t * pickle_length
+) {
+    uint8_t * pickle;
+    uint32_t length;
+
+    if (reader->remaining == 0
+            || (size_t)(reader->end - reader->pos)
+                < _olm_pickle_uint32_length(0)) {
+        return NULL;
+    }
+    pickle = reader->pos + _olm_pickle_uint32_length(0);
+    _olm_unpickle_uint32(reader->pos, reader->end, &length);
+    if (length > (size_t)(reader->end - pickle)) {
+        return NULL;
+    }
+    reader->pos = pickle + length;
+    reader->remaining--;
+    *pickle_length = length;
+    return pickle;
+}
+
+
+size_t olm_pickle_key_size(void) {
+    return sizeof(OlmPickleKey);
+}
+
+
+OlmPickleKey * olm_pickle_key(
+    void * memory,
+    void const * key, size_t key_length
+) {
+    OlmPickleKey * pickle_key = memory;
+    _olm_enc_context_init(key, key_length, &pickle_key->context);
+    return pickle_key;
+}
+
+
+size_t olm_clear_pickle_key(
+    OlmPickleKey * pickle_key
+) {
+    _olm_enc_context_clear(&pickle_key->context);
+    return sizeof(OlmPickleKey);
+}
+
+
+size_t olm_pickle_verify(
+    OlmPickleKey const * pickle_key,
+    void const * pickled, size_t pickled_length
+) {
+    return verify_pickle(
+        &pickle_key->context, pickled, pickled_length, NULL
+    );
+}
+
+
+size_t olm_pickle_verify_batch(
+    OlmPickleKey const * pickle_key, size_t count,
+    void const * const * pickled, size_t const * pickled_lengths,
+    const char ** errors
+) {
+    size_t failed = 0, i;
+    for (i = 0; i < count; ++i) {
+        enum OlmErrorCode error = OLM_SUCCESS;
+        if (verify_pickle(
+                &pickle_key->context, pickled[i], pickled_lengths[i], &error
+            ) == (size_t)-1) {
+            failed++;
+        }
+        if (errors) {
+            errors[i] = _olm_error_to_string(error);
+        }
+    }
+    return failed;
+}
+
+
+/* the length of the header of a pickle with one, from its first bytes */
+static size_t pickle_header_length(
+    uint8_t const * input, size_t b64_length
+) {
+    uint8_t header[3];
+    if (_olm_enc_peek_header(
+            input, b64_length, header, sizeof(header)
+        ) == (size_t)-1
+            || header[0] != OLM_PICKLE_HEADER_FORMAT
+            || header[1] != OLM_PICKLE_HEADER_KIND_INBOUND_GROUP_SESSION) {
+        return (size_t)-1;
+    }
+    return OLM_PICKLE_HEADER_INBOUND_GROUP_SESSION_LENGTH;
+}
+
+/* re-encrypt an encoded pickle under another key in place, in the same
+ * form. Its MAC is checked first, so that one which can't be re-keyed is
+ * left as it was; one that has the right MAC decrypts. */
+static size_t rekey_pickle(
+    const struct _olm_enc_context * old_context,
+    const struct _olm_enc_context * new_context,
+    uint8_t * pickle, size_t b64_length,
+    enum OlmErrorCode * last_error
+) {
+    uint8_t nonce[AES_GCM_NONCE_LENGTH];
+    size_t raw_length, length;
+    uint8_t * pos;
+
+    if (verify_pickle(
+            old_context, pickle, b64_length, last_error
+        ) == (size_t)-1) {
+        return (size_t)-1;
+    }
+
+    if (_olm_enc_is_gcm(pickle, b64_length)) {
+        if (olm_random_fill(nonce, sizeof(nonce)) == (size_t)-1) {
+            *last_error = OLM_RANDOM_UNAVAILABLE;
+            return (size_t)-1;
+        }
+        raw_length = gcm_input(
+            &old_context->gcm_key, pickle, b64_length, last_error
+        );
+        if (raw_length == (size_t)-1) {
+            return (size_t)-1;
+        }
+        pos = _olm_enc_output_gcm_pos(pickle, raw_length);
+        memmove(pos, pickle, raw_length);
+        memcpy(pos - AES_GCM_NONCE_LENGTH, nonce, sizeof(nonce));
+        return gcm_output(&new_context->gcm_key, pickle, raw_length);
+    }
+
+    if (_olm_enc_has_header(pickle, b64_length)) {
+        length = pickle_header_length(pickle, b64_length);
+        if (length == (size_t)-1) {
+            *last_error = OLM_UNKNOWN_PICKLE_VERSION;
+            return (size_t)-1;
+        }
+        raw_length = _olm_enc_input_with_header(
+            old_context, pickle, b64_length, length, last_error
+        );
+        if (raw_length == (size_t)-1) {
+            return (size_t)-1;
+        }
+        memmove(
+            _olm_enc_output_with_header_pos(pickle, length, raw_length),
+            pickle, length + raw_length
+        );
+        return _olm_enc_output_with_header(
+            new_context, pickle, length, raw_length
+        );
+    }
+
+    raw_length = _olm_enc_input_with_context(
+        old_context, pickle, b64_length, last_error
+    );
+    if (raw_length == (size_t)-1) {
+        return (size_t)-1;
+    }
+    memmove(_olm_enc_output_pos(pickle, raw_length), pickle, raw_length);
+    return _olm_enc_output_with_context(new_context, pickle, raw_length);
+}
+
+/** How many pickles each job of a re-key works through */
+#define REKEY_BATCH_LENGTH 64
+
+struct RekeyBatch {
+    const struct _olm_enc_context * old_context;
+    const struct _olm_enc_context * new_context;
+    size_t count;
+    void * const * pickles;
+    const size_t * pickle_lengths;
+    const char ** errors;
+};
+
+static void rekey_pickle_job(void * context, size_t job) {
+    const struct RekeyBatch * batch = context;
+    size_t start = job * REKEY_BATCH_LENGTH;
+    size_t end = start + REKEY_BATCH_LENGTH;
+    size_t i;
+    if (end > batch->count) {
+        end = batch->count;
+    }
+    for (i = start; i < end; ++i) {
+        enum OlmErrorCode error = OLM_SUCCESS;
+        rekey_pickle(
+            batch->old_context, batch->new_context,
+            batch->pickles[i], batch->pickle_lengths[i], &error
+        );
+        batch->errors[i] = _olm_error_to_string(error);
+    }
+}
+
+
+size_t olm_pickle_rekey_batch(
+    OlmPickleKey const * old_key, OlmPickleKey const * new_key,
+    size_t count,
+    void * const * pickles, size_t const * pickle_lengths,
+    const char ** errors,
+    OlmBatchExecutor executor, void * executor_context
+) {
+    struct RekeyBatch batch;
+    size_t job_count = (count + REKEY_BATCH_LENGTH - 1) / REKEY_BATCH_LENGTH;
+    const char * success = _olm_error_to_string(OLM_SUCCESS);
+    size_t failures = 0, i;
+
+    batch.old_context = &old_key->context;
+    batch.new_context = &new_key->context;
+    batch.count = count;
+    batch.pickles = pickles;
+    batch.pickle_lengths = pickle_lengths;
+    batch.errors = errors;
+    if (executor) {
+        executor(executor_context, rekey_pickle_job, &batch, job_count);
+    } else {
+        for (i = 0; i < job_count; ++i) {
+            rekey_pickle_job(&batch, i);
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        if (errors[i] != success) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+
+size_t olm_pickle_batch_count(
+    void const * batch, size_t batch_length
+) {
+    struct _olm_batch_reader reader;
+    size_t count, length, i;
+
+    /* the reader doesn't change the batch */
+    count = _olm_batch_reader_init(
+        &reader, (uint8_t *)batch, batch_length, NULL
+    );
+    if (count == (size_t)-1) {
+        return (size_t)-1;
+    }
+    for (i = 0; i < count; ++i) {
+        if (!_olm_batch_reader_next(&reader, &length)) {
+            return (size_t)-1;
+        }
+    }
+    if (reader.pos != reader.end) {
+        return (size_t)-1;
+    }
+    return count;
+}
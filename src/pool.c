@@ -0,0 +1,458 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* for MAP_ANONYMOUS and madvise */
+#define _DEFAULT_SOURCE 1
+
+#include "olm/pool.h"
+
+#include "olm/memory.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define HAVE_MMAP
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* everything handed out is aligned to this many bytes, which is enough for
+ * any olm object */
+#define POOL_ALIGNMENT 16
+
+static size_t aligned(size_t length) {
+    return (length + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1);
+}
+
+/* the usual huge page size; the size of the system's reserved huge pages
+ * can differ, but mappings of them only need to be a multiple of it */
+#define HUGE_PAGE_LENGTH ((size_t)2 * 1024 * 1024)
+
+/* ordinary mappings are rounded up to this, which is a whole number of
+ * pages everywhere we map memory */
+#define PAGE_LENGTH ((size_t)64 * 1024)
+
+/* the mbind() policy which prefers a node, but takes pages from the others
+ * when it is full */
+#define NUMA_PREFERRED 1
+
+/* the most nodes a placement can name */
+#define NUMA_MAX_NODES 1024
+#define NUMA_MASK_WORD_BITS (8 * sizeof(unsigned long))
+
+struct OlmSlab {
+    size_t slot_size;
+    size_t slot_count;
+    /* the free slots, used from the end */
+    uint32_t *free_slots;
+    size_t free_count;
+    /* whether each slot is in use */
+    uint8_t *in_use;
+    uint8_t *slots;
+    size_t peak_in_use;
+    size_t failed_allocations;
+    /* the bytes mapped by olm_slab_map(), or 0 for caller memory */
+    size_t mapped_length;
+    enum OlmSlabBacking backing;
+};
+
+size_t olm_slab_size(size_t slot_size, size_t slot_count) {
+    return aligned(sizeof(struct OlmSlab))
+        + aligned(slot_count * sizeof(uint32_t))
+        + aligned(slot_count)
+        + slot_count * aligned(slot_size);
+}
+
+/* set up a slab in memory that is already zero, if zeroed is set */
+static OlmSlab * init_slab(
+    void * memory, size_t slot_size, size_t slot_count, int zeroed
+) {
+    uint8_t *pos = memory;
+    OlmSlab *slab = memory;
+    size_t i;
+
+    pos += aligned(sizeof(struct OlmSlab));
+    slab->slot_size = aligned(slot_size);
+    slab->slot_count = slot_count;
+    slab->free_slots = (uint32_t *)pos;
+    pos += aligned(slot_count * sizeof(uint32_t));
+    slab->in_use = pos;
+    pos += aligned(slot_count);
+    slab->slots = pos;
+
+    /* hand out the slots from the start of the slab */
+    for (i = 0; i < slot_count; ++i) {
+        slab->free_slots[i] = slot_count - 1 - i;
+    }
+    slab->free_count = slot_count;
+    slab->peak_in_use = 0;
+    slab->failed_allocations = 0;
+    slab->mapped_length = 0;
+    slab->backing = OLM_SLAB_CALLER_MEMORY;
+    /* fresh mappings are zero already, and touching them would fault in
+     * every page up front */
+    if (!zeroed) {
+        memset(slab->in_use, 0, slot_count);
+        memset(slab->slots, 0, slot_count * slab->slot_size);
+    }
+    return slab;
+}
+
+OlmSlab * olm_slab(void * memory, size_t slot_size, size_t slot_count) {
+    return init_slab(memory, slot_size, slot_count, 0);
+}
+
+void * olm_slab_allocate(OlmSlab * slab) {
+    uint32_t slot;
+    if (slab->free_count == 0) {
+        slab->failed_allocations++;
+        return NULL;
+    }
+    slot = slab->free_slots[--slab->free_count];
+    slab->in_use[slot] = 1;
+    if (slab->slot_count - slab->free_count > slab->peak_in_use) {
+        slab->peak_in_use = slab->slot_count - slab->free_count;
+    }
+    /* released slots are wiped, so the slot is already zero */
+    return slab->slots + (size_t)slot * slab->slot_size;
+}
+
+size_t olm_slab_release(OlmSlab * slab, void * slot) {
+    uint8_t *pos = slot;
+    size_t offset, index;
+
+    if (pos < slab->slots
+            || pos >= slab->slots + slab->slot_count * slab->slot_size) {
+        return (size_t)-1;
+    }
+    offset = pos - slab->slots;
+    index = offset / slab->slot_size;
+    if (offset % slab->slot_size || !slab->in_use[index]) {
+        return (size_t)-1;
+    }
+    _olm_unset(pos, slab->slot_size);
+    slab->in_use[index] = 0;
+    slab->free_slots[slab->free_count++] = index;
+    return 0;
+}
+
+size_t olm_slab_slots_in_use(const OlmSlab * slab) {
+    return slab->slot_count - slab->free_count;
+}
+
+static void * slab_allocate(void * context, size_t length) {
+    OlmSlab *slab = context;
+    if (length > slab->slot_size) {
+        return NULL;
+    }
+    return olm_slab_allocate(slab);
+}
+
+static void slab_release(void * context, void * memory, size_t length) {
+    olm_slab_release(context, memory);
+}
+
+void olm_slab_allocator(OlmSlab * slab, OlmAllocator * allocator) {
+    allocator->allocate = slab_allocate;
+    allocator->release = slab_release;
+    allocator->context = slab;
+}
+
+
+/* map length bytes of zeroed memory, which is a multiple of
+ * HUGE_PAGE_LENGTH if huge pages are wanted. Returns NULL if it can't. */
+#if defined(_WIN32)
+static void * windows_alloc(size_t length, DWORD type, int node) {
+    if (node >= 0) {
+        return VirtualAllocExNuma(
+            GetCurrentProcess(), NULL, length, type, PAGE_READWRITE,
+            (DWORD)node
+        );
+    }
+    return VirtualAlloc(NULL, length, type, PAGE_READWRITE);
+}
+#endif
+
+/* ask for the pages of a fresh mapping, none of which have been touched
+ * yet, to come from the node */
+static void place_pages(void * memory, size_t length, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask[NUMA_MAX_NODES / NUMA_MASK_WORD_BITS];
+    if (node < 0 || node >= NUMA_MAX_NODES) {
+        return;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / NUMA_MASK_WORD_BITS] = 1UL << (node % NUMA_MASK_WORD_BITS);
+    /* the kernel takes one bit fewer than it is told. If it refuses, for
+     * instance because it has no NUMA support, the pages just come from
+     * the node of the thread that first touches them. */
+    syscall(
+        SYS_mbind, memory, length, NUMA_PREFERRED, mask, NUMA_MAX_NODES + 1, 0
+    );
+#else
+    /* Windows places the pages when they are allocated */
+    (void)memory;
+    (void)length;
+    (void)node;
+#endif
+}
+
+static void * map_pages(
+    size_t length, int huge, int node, enum OlmSlabBacking * backing
+) {
+#if defined(_WIN32)
+    void *memory = NULL;
+    if (huge && GetLargePageMinimum()
+            && length % GetLargePageMinimum() == 0) {
+        /* only works for processes with the lock pages privilege */
+        memory = windows_alloc(
+            length, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, node
+        );
+        if (memory) {
+            *backing = OLM_SLAB_RESERVED_HUGE_PAGES;
+            return memory;
+        }
+    }
+    memory = windows_alloc(length, MEM_COMMIT | MEM_RESERVE, node);
+    *backing = OLM_SLAB_NORMAL_PAGES;
+    return memory;
+#elif defined(HAVE_MMAP)
+    uint8_t *memory;
+#if defined(MAP_HUGETLB)
+    if (huge) {
+        memory = mmap(
+            NULL, length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0
+        );
+        if (memory != MAP_FAILED) {
+            place_pages(memory, length, node);
+            *backing = OLM_SLAB_RESERVED_HUGE_PAGES;
+            return memory;
+        }
+    }
+#endif
+#if defined(MADV_HUGEPAGE)
+    if (huge) {
+        /* transparent huge pages need the mapping to be aligned to them, so
+         * map a huge page more than needed and trim it */
+        size_t head;
+        memory = mmap(
+            NULL, length + HUGE_PAGE_LENGTH, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+        );
+        if (memory == MAP_FAILED) {
+            return NULL;
+        }
+        head = (HUGE_PAGE_LENGTH - (uintptr_t)memory % HUGE_PAGE_LENGTH)
+            % HUGE_PAGE_LENGTH;
+        if (head) {
+            munmap(memory, head);
+        }
+        munmap(memory + head + length, HUGE_PAGE_LENGTH - head);
+        memory += head;
+        place_pages(memory, length, node);
+        *backing = madvise(memory, length, MADV_HUGEPAGE)
+            ? OLM_SLAB_NORMAL_PAGES : OLM_SLAB_TRANSPARENT_HUGE_PAGES;
+        return memory;
+    }
+#endif
+    memory = mmap(
+        NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0
+    );
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    place_pages(memory, length, node);
+    *backing = OLM_SLAB_NORMAL_PAGES;
+    return memory;
+#else
+    (void)length;
+    (void)huge;
+    (void)node;
+    (void)backing;
+    return NULL;
+#endif
+}
+
+static void unmap_pages(void * memory, size_t length) {
+#if defined(_WIN32)
+    (void)length;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(HAVE_MMAP)
+    munmap(memory, length);
+#else
+    (void)memory;
+    (void)length;
+#endif
+}
+
+OlmSlab * olm_slab_map(size_t slot_size, size_t slot_count, unsigned flags) {
+    return olm_slab_map_on_node(
+        slot_size, slot_count, flags, OLM_ANY_NUMA_NODE
+    );
+}
+
+OlmSlab * olm_slab_map_on_node(
+    size_t slot_size, size_t slot_count, unsigned flags, int node
+) {
+    int huge = (flags & OLM_SLAB_HUGE_PAGES) != 0;
+    size_t unit = huge ? HUGE_PAGE_LENGTH : PAGE_LENGTH;
+    size_t length = olm_slab_size(slot_size, slot_count);
+    enum OlmSlabBacking backing;
+    OlmSlab *slab;
+    void *memory;
+
+    length = (length + unit - 1) / unit * unit;
+    memory = map_pages(length, huge, node, &backing);
+    if (!memory) {
+        return NULL;
+    }
+    slab = init_slab(memory, slot_size, slot_count, 1);
+    slab->mapped_length = length;
+    slab->backing = backing;
+    return slab;
+}
+
+size_t olm_slab_unmap(OlmSlab * slab) {
+    size_t length = slab->mapped_length;
+    size_t i;
+    if (!length) {
+        return (size_t)-1;
+    }
+    /* released slots were wiped already, and wiping the rest would fault in
+     * pages that were never used */
+    for (i = 0; i < slab->slot_count; ++i) {
+        if (slab->in_use[i]) {
+            _olm_unset(slab->slots + i * slab->slot_size, slab->slot_size);
+        }
+    }
+    unmap_pages(slab, length);
+    return length;
+}
+
+void * olm_map_memory(size_t length, int node) {
+    enum OlmSlabBacking backing;
+    length = (length + PAGE_LENGTH - 1) / PAGE_LENGTH * PAGE_LENGTH;
+    return map_pages(length, 0, node, &backing);
+}
+
+void olm_unmap_memory(void * memory, size_t length) {
+    length = (length + PAGE_LENGTH - 1) / PAGE_LENGTH * PAGE_LENGTH;
+    unmap_pages(memory, length);
+}
+
+void olm_slab_stats(const OlmSlab * slab, OlmSlabStats * stats) {
+    stats->slot_size = slab->slot_size;
+    stats->slot_count = slab->slot_count;
+    stats->slots_in_use = slab->slot_count - slab->free_count;
+    stats->peak_slots_in_use = slab->peak_in_use;
+    stats->failed_allocations = slab->failed_allocations;
+    stats->memory_length = slab->mapped_length
+        ? slab->mapped_length
+        : olm_slab_size(slab->slot_size, slab->slot_count);
+    stats->backing = slab->backing;
+}
+
+
+struct OlmArena {
+    size_t capacity;
+    size_t used;
+    uint8_t *buffer;
+};
+
+size_t olm_arena_size(size_t capacity) {
+    return aligned(sizeof(struct OlmArena)) + aligned(capacity);
+}
+
+OlmArena * olm_arena(void * memory, size_t capacity) {
+    OlmArena *arena = memory;
+    arena->capacity = aligned(capacity);
+    arena->used = 0;
+    arena->buffer = (uint8_t *)memory + aligned(sizeof(struct OlmArena));
+    return arena;
+}
+
+void * olm_arena_allocate(OlmArena * arena, size_t length) {
+    uint8_t *result;
+    if (length > arena->capacity - arena->used) {
+        return NULL;
+    }
+    result = arena->buffer + arena->used;
+    /* the capacity is aligned, so this can't pass it */
+    arena->used += aligned(length);
+    return result;
+}
+
+size_t olm_arena_reset(OlmArena * arena) {
+    size_t used = arena->used;
+    _olm_unset(arena->buffer, used);
+    arena->used = 0;
+    return used;
+}
+
+static void * arena_allocate(void * context, size_t length) {
+    return olm_arena_allocate(context, length);
+}
+
+static void arena_release(void * context, void * memory, size_t length) {
+    /* everything is given back when the arena is reset */
+}
+
+void olm_arena_allocator(OlmArena * arena, OlmAllocator * allocator) {
+    allocator->allocate = arena_allocate;
+    allocator->release = arena_release;
+    allocator->context = arena;
+}
+
+
+size_t olm_buffer_reserve(
+    OlmBuffer * buffer, const OlmAllocator * allocator, size_t length
+) {
+    buffer->length = 0;
+    if (buffer->data && buffer->allocator == allocator
+            && buffer->capacity >= length) {
+        return 0;
+    }
+    olm_buffer_release(buffer);
+    /* allocators needn't cope with zero lengths */
+    buffer->data = allocator->allocate(
+        allocator->context, length ? length : 1
+    );
+    if (!buffer->data) {
+        return (size_t)-1;
+    }
+    buffer->capacity = length ? length : 1;
+    buffer->allocator = allocator;
+    return 0;
+}
+
+void olm_buffer_release(OlmBuffer * buffer) {
+    if (buffer->data) {
+        _olm_unset(buffer->data, buffer->capacity);
+        buffer->allocator->release(
+            buffer->allocator->context, buffer->data, buffer->capacity
+        );
+    }
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->allocator = NULL;
+}
@@ -0,0 +1,218 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/random.h"
+
+#include "olm/crypto.h"
+#include "olm/memory.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <bcrypt.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "bcrypt")
+#endif
+#elif defined(__ANDROID__)
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__linux__)
+#include <errno.h>
+#include <sys/random.h>
+#include <unistd.h>
+#elif defined(__EMSCRIPTEN__)
+#include <sys/random.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) \
+    || defined(__NetBSD__)
+#include <stdlib.h>
+#include <unistd.h>
+#define HAVE_ARC4RANDOM
+#endif
+
+#if defined(_MSC_VER)
+#define RANDOM_THREAD_LOCAL __declspec(thread)
+#else
+#define RANDOM_THREAD_LOCAL __thread
+#endif
+
+/* how much output is made at a time */
+#define RANDOM_BUFFER_LENGTH 4096
+
+/* the start of each refill becomes the next key and IV, and is never handed
+ * out */
+#define RANDOM_REKEY_LENGTH (AES256_KEY_LENGTH + AES256_IV_LENGTH)
+
+/* how much output there can be before a new key from the operating system */
+#define RANDOM_RESEED_INTERVAL (1024 * 1024)
+
+struct RandomState {
+    int seeded;
+    /* the process the state was keyed in, so that a forked child rekeys
+     * rather than repeating its parent's output */
+    long pid;
+    size_t since_seed;
+    struct _olm_aes256_key_schedule schedule;
+    uint8_t chain[AES256_IV_LENGTH];
+    /* the unused output is at the end of the buffer; everything before it
+     * has been wiped */
+    uint8_t buffer[RANDOM_BUFFER_LENGTH];
+    size_t available;
+};
+
+static RANDOM_THREAD_LOCAL struct RandomState random_state;
+
+static long current_pid(void) {
+#if defined(_WIN32) || defined(__EMSCRIPTEN__)
+    /* no fork */
+    return 0;
+#elif defined(__linux__) || defined(HAVE_ARC4RANDOM)
+    return (long)getpid();
+#else
+    return 0;
+#endif
+}
+
+/** Fill the buffer from the operating system. Returns 0 on success, or -1
+ * if there is no source of random bytes. */
+static int system_random(uint8_t * buffer, size_t length) {
+#if defined(_WIN32)
+    return BCryptGenRandom(
+        NULL, buffer, (ULONG)length, BCRYPT_USE_SYSTEM_PREFERRED_RNG
+    ) == 0 ? 0 : -1;
+#elif defined(__linux__)
+    while (length) {
+#if defined(__ANDROID__)
+        long n = syscall(__NR_getrandom, buffer, length, 0);
+#else
+        ssize_t n = getrandom(buffer, length, 0);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += n;
+        length -= n;
+    }
+    return 0;
+#elif defined(__EMSCRIPTEN__)
+    /* getentropy gives at most 256 bytes at a time */
+    while (length) {
+        size_t n = length < 256 ? length : 256;
+        if (getentropy(buffer, n)) {
+            return -1;
+        }
+        buffer += n;
+        length -= n;
+    }
+    return 0;
+#elif defined(HAVE_ARC4RANDOM)
+    arc4random_buf(buffer, length);
+    return 0;
+#else
+    (void)buffer;
+    (void)length;
+    return -1;
+#endif
+}
+
+/** Key the generator from the start of the buffer, and wipe it */
+static void rekey(struct RandomState * state, uint8_t * key_material) {
+    struct _olm_aes256_key key;
+    memcpy(key.key, key_material, AES256_KEY_LENGTH);
+    _olm_crypto_aes_key_setup(&key, &state->schedule);
+    memcpy(
+        state->chain, key_material + AES256_KEY_LENGTH, AES256_IV_LENGTH
+    );
+    _olm_unset(&key, sizeof(key));
+    _olm_unset(key_material, RANDOM_REKEY_LENGTH);
+}
+
+static int seed(struct RandomState * state) {
+    uint8_t key_material[RANDOM_REKEY_LENGTH];
+    if (system_random(key_material, sizeof(key_material))) {
+        _olm_unset(key_material, sizeof(key_material));
+        return -1;
+    }
+    rekey(state, key_material);
+    state->seeded = 1;
+    state->pid = current_pid();
+    state->since_seed = 0;
+    /* throw away anything made under the old key */
+    _olm_unset(state->buffer, sizeof(state->buffer));
+    state->available = 0;
+    return 0;
+}
+
+static void refill(struct RandomState * state) {
+    /* encrypting zeros in CBC mode gives the OFB key stream. CBC encryption
+     * reads each block before writing it, so it can be done in place. */
+    memset(state->buffer, 0, sizeof(state->buffer));
+    _olm_crypto_aes_encrypt_cbc_blocks(
+        &state->schedule, state->chain,
+        state->buffer, sizeof(state->buffer) / AES256_IV_LENGTH,
+        state->buffer
+    );
+    rekey(state, state->buffer);
+    state->available = sizeof(state->buffer) - RANDOM_REKEY_LENGTH;
+    state->since_seed += sizeof(state->buffer);
+}
+
+int olm_random_available(void) {
+#if defined(_WIN32) || defined(__linux__) || defined(__EMSCRIPTEN__) \
+    || defined(HAVE_ARC4RANDOM)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+size_t olm_random_fill(void * buffer, size_t length) {
+    struct RandomState *state = &random_state;
+    uint8_t *pos = buffer;
+    size_t remaining = length;
+
+    if (!state->seeded || state->pid != current_pid()
+            || state->since_seed >= RANDOM_RESEED_INTERVAL) {
+        if (seed(state)) {
+            _olm_unset(buffer, length);
+            return (size_t)-1;
+        }
+    }
+
+    while (remaining) {
+        uint8_t *start;
+        size_t n;
+        if (!state->available) {
+            refill(state);
+        }
+        n = remaining < state->available ? remaining : state->available;
+        start = state->buffer + sizeof(state->buffer) - state->available;
+        memcpy(pos, start, n);
+        /* wipe what has been handed out */
+        _olm_unset(start, n);
+        state->available -= n;
+        pos += n;
+        remaining -= n;
+    }
+    return length;
+}
+
+void olm_random_clear(void) {
+    _olm_unset(&random_state, sizeof(random_state));
+}
@@ -17,15 +17,30 @@
 #include "olm/memory.hh"
 #include "olm/cipher.h"
 #include "olm/pickle.hh"
+#include "olm/probes.h"
+#include "olm/stats_internal.h"
+#include "olm/trace_internal.h"
 
 #include <cstring>
+#include <new>
 
 namespace {
 
 static const std::uint8_t PROTOCOL_VERSION = 3;
 static const std::uint8_t MESSAGE_KEY_SEED[1] = {0x01};
 static const std::uint8_t CHAIN_KEY_SEED[1] = {0x02};
-static const std::size_t MAX_MESSAGE_GAP = 2000;
+
+static const std::uint8_t OLM_ROOT_KDF_INFO[] = "OLM_ROOT";
+static const std::uint8_t OLM_RATCHET_KDF_INFO[] = "OLM_RATCHET";
+static const std::uint8_t OLM_CIPHER_KDF_INFO[] = "OLM_KEYS";
+
+static const olm::KdfInfo OLM_KDF_INFO = {
+    OLM_ROOT_KDF_INFO, sizeof(OLM_ROOT_KDF_INFO) - 1,
+    OLM_RATCHET_KDF_INFO, sizeof(OLM_RATCHET_KDF_INFO) - 1
+};
+
+static const struct _olm_cipher_aes_sha_256 OLM_CIPHER =
+    OLM_CIPHER_INIT_AES_SHA_256(OLM_CIPHER_KDF_INFO);
 
 
 /**
@@ -47,6 +62,7 @@ static void create_chain_key(
     olm::SharedKey & new_root_key,
     olm::ChainKey & new_chain_key
 ) {
+    olm::TraceScope trace(OLM_TRACE_RATCHET_STEP);
     olm::SharedKey secret;
     _olm_crypto_curve25519_shared_secret(&our_key, &their_key, secret);
     std::uint8_t derived_secrets[2 * olm::OLM_SHARED_KEY_LENGTH];
@@ -69,6 +85,7 @@ static void advance_chain_key(
     olm::ChainKey const & chain_key,
     olm::ChainKey & new_chain_key
 ) {
+    OLM_STATS_ADD(chain_key_advances, 1);
     _olm_crypto_hmac_sha256(
         chain_key.key, sizeof(chain_key.key),
         CHAIN_KEY_SEED, sizeof(CHAIN_KEY_SEED),
@@ -91,13 +108,42 @@ static void create_message_keys(
 }
 
 
+/**
+ * Create the message keys for the chain key and advance the chain key, in
+ * one go. Both are HMACs under the current chain key, so the HMAC key only
+ * needs to be prepared once.
+ */
+static void create_message_keys_and_advance(
+    olm::ChainKey & chain_key,
+    olm::KdfInfo const & info,
+    olm::MessageKey & message_key
+) {
+    _olm_hmac_sha256_key hmac_key;
+    _olm_crypto_hmac_sha256_init_key(
+        &hmac_key, chain_key.key, sizeof(chain_key.key)
+    );
+    _olm_crypto_hmac_sha256_with_key(
+        &hmac_key, MESSAGE_KEY_SEED, sizeof(MESSAGE_KEY_SEED),
+        message_key.key
+    );
+    message_key.index = chain_key.index;
+    OLM_STATS_ADD(chain_key_advances, 1);
+    _olm_crypto_hmac_sha256_with_key(
+        &hmac_key, CHAIN_KEY_SEED, sizeof(CHAIN_KEY_SEED),
+        chain_key.key
+    );
+    chain_key.index++;
+    olm::unset(hmac_key);
+}
+
+
 static std::size_t verify_mac_and_decrypt(
     _olm_cipher const *cipher,
     olm::MessageKey const & message_key,
     olm::MessageReader const & reader,
     std::uint8_t * plaintext, std::size_t max_plaintext_length
 ) {
-    return cipher->ops->decrypt(
+    return _olm_cipher_decrypt(
         cipher,
         message_key.key, sizeof(message_key.key),
         reader.input, reader.input_length,
@@ -107,48 +153,92 @@ static std::size_t verify_mac_and_decrypt(
 }
 
 
+/** The first eight bytes of a ratchet key, for comparing keys quickly. */
+static std::uint64_t fingerprint(std::uint8_t const * ratchet_key) {
+    std::uint64_t result;
+    std::memcpy(&result, ratchet_key, sizeof(result));
+    return result;
+}
+
+
+/** Recompute the fingerprints after the receiver chains have changed. That
+ * only happens when the remote moves to a new ratchet key, so it isn't worth
+ * shuffling them along with the chains. */
+static void update_fingerprints(olm::Ratchet & ratchet) {
+    std::uint64_t * fingerprints = ratchet.receiver_chain_fingerprints();
+    for (std::size_t i = 0; i < ratchet.receiver_chains.size(); ++i) {
+        fingerprints[i] = fingerprint(
+            ratchet.receiver_chains[i].ratchet_key.public_key
+        );
+    }
+}
+
+
+/**
+ * Try to decrypt a message from the chain or further along it. On success
+ * the chain keys needed to commit the message are returned in advance; on
+ * failure they are wiped.
+ */
 static std::size_t verify_mac_and_decrypt_for_existing_chain(
     olm::Ratchet const & session,
     olm::ChainKey const & chain,
     olm::MessageReader const & reader,
-    std::uint8_t * plaintext, std::size_t max_plaintext_length
+    std::uint8_t * plaintext, std::size_t max_plaintext_length,
+    olm::ChainAdvance & advance
 ) {
     if (reader.counter < chain.index) {
         return std::size_t(-1);
     }
 
     /* Limit the number of hashes we're prepared to compute */
-    if (reader.counter - chain.index > MAX_MESSAGE_GAP) {
+    std::uint32_t gap = reader.counter - chain.index;
+    if (gap > session.limits.max_message_gap) {
         return std::size_t(-1);
     }
 
-    olm::ChainKey new_chain = chain;
+    std::size_t kept = session.skipped_message_key_capacity();
+    std::uint32_t first_kept_index = reader.counter
+        - (gap < kept ? gap : std::uint32_t(kept));
 
-    while (new_chain.index < reader.counter) {
-        advance_chain_key(new_chain, new_chain);
+    advance.current = chain;
+    advance.first_kept = chain;
+    while (advance.current.index < reader.counter) {
+        advance_chain_key(advance.current, advance.current);
+        if (advance.current.index == first_kept_index) {
+            advance.first_kept = advance.current;
+        }
     }
 
     olm::MessageKey message_key;
-    create_message_keys(new_chain, session.kdf_info, message_key);
+    create_message_keys(advance.current, session.kdf_info(), message_key);
 
     std::size_t result = verify_mac_and_decrypt(
-        session.ratchet_cipher, message_key, reader,
+        session.ratchet_cipher(), message_key, reader,
         plaintext, max_plaintext_length
     );
 
-    olm::unset(new_chain);
+    olm::unset(message_key);
+    if (result == std::size_t(-1)) {
+        olm::unset(advance);
+    }
     return result;
 }
 
 
+/**
+ * Try to decrypt a message which starts a new chain. On success the new root
+ * key, the start of the new chain and the chain keys along it are returned
+ * so that the caller can commit them without repeating the key exchange; on
+ * failure they are wiped.
+ */
 static std::size_t verify_mac_and_decrypt_for_new_chain(
     olm::Ratchet const & session,
     olm::MessageReader const & reader,
-    std::uint8_t * plaintext, std::size_t max_plaintext_length
+    std::uint8_t * plaintext, std::size_t max_plaintext_length,
+    olm::SharedKey & new_root_key,
+    olm::ReceiverChain & new_chain,
+    olm::ChainAdvance & advance
 ) {
-    olm::SharedKey new_root_key;
-    olm::ReceiverChain new_chain;
-
     /* They shouldn't move to a new chain until we've sent them a message
      * acknowledging the last one */
     if (session.sender_chain.empty()) {
@@ -156,34 +246,300 @@ static std::size_t verify_mac_and_decrypt_for_new_chain(
     }
 
     /* Limit the number of hashes we're prepared to compute */
-    if (reader.counter > MAX_MESSAGE_GAP) {
+    if (reader.counter > session.limits.max_message_gap) {
         return std::size_t(-1);
     }
     olm::load_array(new_chain.ratchet_key.public_key, reader.ratchet_key);
 
     create_chain_key(
         session.root_key, session.sender_chain[0].ratchet_key,
-        new_chain.ratchet_key, session.kdf_info,
+        new_chain.ratchet_key, session.kdf_info(),
         new_root_key, new_chain.chain_key
     );
     std::size_t result = verify_mac_and_decrypt_for_existing_chain(
         session, new_chain.chain_key, reader,
-        plaintext, max_plaintext_length
+        plaintext, max_plaintext_length, advance
     );
-    olm::unset(new_root_key);
-    olm::unset(new_chain);
+    if (result == std::size_t(-1)) {
+        olm::unset(new_root_key);
+        olm::unset(new_chain);
+    }
     return result;
 }
 
+
+/** The receiver chain for a ratchet key, or nullptr if there isn't one. */
+static olm::ReceiverChain const * find_receiver_chain(
+    olm::Ratchet const & ratchet, std::uint8_t const * ratchet_key
+) {
+    std::uint64_t key_fingerprint = fingerprint(ratchet_key);
+    std::uint64_t const * fingerprints = ratchet.receiver_chain_fingerprints();
+    for (std::size_t i = 0; i < ratchet.receiver_chains.size(); ++i) {
+        if (fingerprints[i] == key_fingerprint
+                && 0 == std::memcmp(
+                    ratchet.receiver_chains[i].ratchet_key.public_key,
+                    ratchet_key, CURVE25519_KEY_LENGTH
+        )) {
+            return &ratchet.receiver_chains[i];
+        }
+    }
+    return nullptr;
+}
+
+
+/** Find the next skipped message key for the message index on a chain,
+ * continuing from cursor as for IndexedList::find(). */
+static olm::SkippedMessageKey const * find_skipped_message_key(
+    olm::Ratchet const & ratchet,
+    std::uint8_t const * ratchet_key, std::uint32_t index,
+    std::size_t & cursor
+) {
+    auto matches = [ratchet_key, index](olm::SkippedMessageKey const & key) {
+        return index == key.message_key.index
+            && 0 == std::memcmp(
+                key.ratchet_key.public_key, ratchet_key,
+                CURVE25519_KEY_LENGTH
+            );
+    };
+    return ratchet.skipped_message_keys.find(
+        olm::skipped_message_key_hash(ratchet_key, index), matches, cursor
+    );
+}
+
+
+/** Note that a skipped message key is about to be removed, so that a delta
+ * pickle can remove it too. Keys added since the last pickle needn't be
+ * noted since the delta won't add them. */
+static void note_removed(
+    olm::Ratchet & ratchet, olm::SkippedMessageKey const & key
+) {
+    olm::RatchetChanges & changes = ratchet.changes;
+    if (key.added || changes.skipped_message_keys) {
+        return;
+    }
+    if (changes.removed_count == olm::MAX_REMOVED_SKIPPED_KEYS) {
+        changes.skipped_message_keys = true;
+        return;
+    }
+    olm::SkippedMessageKeyId & id = changes.removed[changes.removed_count++];
+    id.ratchet_key = key.ratchet_key;
+    id.index = key.message_key.index;
+}
+
+
+/** The oldest of the skipped message keys added since the last pickle, or
+ * nullptr if none have been. */
+static olm::SkippedMessageKey const * oldest_added(
+    olm::SkippedMessageKeys const & keys
+) {
+    olm::SkippedMessageKey const * oldest = nullptr;
+    for (auto const & key : keys) {
+        if (!key.added) {
+            break;
+        }
+        oldest = &key;
+    }
+    return oldest;
+}
+
+
+/** The skipped range holding the message index on a chain, or nullptr if
+ * there isn't one. The ranges of a chain never overlap. */
+static olm::SkippedChainRange const * find_skipped_range(
+    olm::Ratchet const & ratchet,
+    std::uint8_t const * ratchet_key, std::uint32_t index
+) {
+    for (auto const & range : ratchet.skipped_ranges) {
+        if (range.start.index <= index && index < range.end
+                && 0 == std::memcmp(
+                    range.ratchet_key.public_key, ratchet_key,
+                    CURVE25519_KEY_LENGTH
+        )) {
+            return &range;
+        }
+    }
+    return nullptr;
+}
+
+
+/** How many ratchet steps old a chain is: the receiver chains are newest
+ * first, and a chain that has been pushed out is older than any of them */
+static std::size_t chain_age(
+    olm::Ratchet const & ratchet, std::uint8_t const * ratchet_key
+) {
+    std::size_t age = 0;
+    for (auto const & chain : ratchet.receiver_chains) {
+        if (0 == std::memcmp(
+                chain.ratchet_key.public_key, ratchet_key,
+                CURVE25519_KEY_LENGTH)) {
+            break;
+        }
+        age++;
+    }
+    return age;
+}
+
+
+/** How many steps along a chain decrypting the message tried takes */
+static std::uint32_t chain_steps(olm::DecryptTrial const & trial) {
+    switch (trial.kind) {
+        case olm::DecryptTrialKind::EXISTING_CHAIN:
+        case olm::DecryptTrialKind::SKIPPED_RANGE:
+            return trial.counter - trial.chain_index;
+        case olm::DecryptTrialKind::NEW_CHAIN:
+            return trial.counter;
+        default:
+            return 0;
+    }
+}
+
 } // namespace
 
 
+std::uint32_t olm::skipped_message_key_hash(
+    std::uint8_t const * ratchet_key, std::uint32_t index
+) {
+    /* The ratchet keys are curve25519 public keys, so their first few bytes
+     * are already well mixed. The multiply spreads the message index so that
+     * consecutive keys on a chain land apart. */
+    std::uint32_t hash = std::uint32_t(ratchet_key[0])
+        | std::uint32_t(ratchet_key[1]) << 8
+        | std::uint32_t(ratchet_key[2]) << 16
+        | std::uint32_t(ratchet_key[3]) << 24;
+    return hash ^ (index * std::uint32_t(0x9E3779B1));
+}
+
+
+olm::KdfInfo const & olm::protocol_kdf_info(olm::RatchetProtocol) {
+    return OLM_KDF_INFO;
+}
+
+
+_olm_cipher const * olm::protocol_cipher(olm::RatchetProtocol) {
+    return OLM_CIPHER_BASE(&OLM_CIPHER);
+}
+
+
 olm::Ratchet::Ratchet(
-    olm::KdfInfo const & kdf_info,
-    _olm_cipher const * ratchet_cipher
-) : kdf_info(kdf_info),
-    ratchet_cipher(ratchet_cipher),
-    last_error(OlmErrorCode::OLM_SUCCESS) {
+    olm::RatchetProtocol protocol,
+    olm::RatchetLimits const & limits,
+    std::uint8_t * storage
+) : protocol(protocol),
+    last_error(OlmErrorCode::OLM_SUCCESS),
+    limits(limits),
+    root_key(),
+    receiver_chains(
+        reinterpret_cast<olm::ReceiverChain *>(
+            storage + limits.max_receiver_chains * sizeof(std::uint64_t)
+        ),
+        limits.max_receiver_chains
+    ),
+    skipped_message_keys(
+        storage + limits.max_receiver_chains
+            * (sizeof(std::uint64_t) + sizeof(olm::ReceiverChain)),
+        limits.max_skipped_message_keys
+    ),
+    skipped_keys_out_of_line(false),
+    skipped_key_eviction(),
+    skipped_ranges(),
+    skipped_range_threshold(0),
+    dirty(false) {
+    changes.root_key = true;
+    changes.sender_chain = true;
+    changes.skipped_message_keys = true;
+    changes.removed_count = 0;
+    changes.skipped_ranges = false;
+}
+
+
+olm::Ratchet::Ratchet(
+    olm::RatchetProtocol protocol,
+    olm::RatchetLimits const & limits,
+    std::uint8_t * storage,
+    bool skipped_keys_out_of_line
+) : protocol(protocol),
+    last_error(OlmErrorCode::OLM_SUCCESS),
+    limits(limits),
+    root_key(),
+    receiver_chains(
+        reinterpret_cast<olm::ReceiverChain *>(
+            storage + limits.max_receiver_chains * sizeof(std::uint64_t)
+        ),
+        limits.max_receiver_chains
+    ),
+    skipped_message_keys(),
+    skipped_keys_out_of_line(skipped_keys_out_of_line),
+    skipped_key_eviction(),
+    skipped_ranges(),
+    skipped_range_threshold(0),
+    dirty(false) {
+    changes.root_key = true;
+    changes.sender_chain = true;
+    changes.skipped_message_keys = true;
+    changes.removed_count = 0;
+    changes.skipped_ranges = false;
+}
+
+
+std::size_t olm::Ratchet::storage_length(
+    olm::RatchetLimits const & limits
+) {
+    return receiver_chain_storage_length(limits)
+        + skipped_message_key_storage_length(limits);
+}
+
+
+std::size_t olm::Ratchet::receiver_chain_storage_length(
+    olm::RatchetLimits const & limits
+) {
+    return limits.max_receiver_chains
+        * (sizeof(std::uint64_t) + sizeof(olm::ReceiverChain));
+}
+
+
+std::size_t olm::Ratchet::skipped_message_key_storage_length(
+    olm::RatchetLimits const & limits
+) {
+    return olm::SkippedMessageKeys::storage_length(
+        limits.max_skipped_message_keys
+    );
+}
+
+
+bool olm::Ratchet::reserve_skipped_message_keys(
+    OlmAllocator const * allocator
+) {
+    if (!skipped_keys_out_of_line || skipped_message_keys.capacity()
+            || !limits.max_skipped_message_keys) {
+        return true;
+    }
+    std::size_t length = skipped_message_key_storage_length(limits);
+    void * memory = allocator
+        ? allocator->allocate(allocator->context, length) : nullptr;
+    if (!memory) {
+        last_error = OlmErrorCode::OLM_ALLOCATION_FAILED;
+        return false;
+    }
+    new(&skipped_message_keys) olm::SkippedMessageKeys(
+        static_cast<std::uint8_t *>(memory), limits.max_skipped_message_keys,
+        false
+    );
+    return true;
+}
+
+
+void olm::Ratchet::release_skipped_message_keys(
+    OlmAllocator const * allocator, bool force
+) {
+    if (!skipped_keys_out_of_line || !skipped_message_keys.capacity()
+            || (!force && skipped_message_keys.size())) {
+        return;
+    }
+    std::size_t length = skipped_message_key_storage_length(limits);
+    std::uint8_t * storage = skipped_message_keys.storage();
+    olm::unset(storage, length);
+    allocator->release(allocator->context, storage, length);
+    new(&skipped_message_keys) olm::SkippedMessageKeys();
 }
 
 
@@ -195,7 +551,7 @@ void olm::Ratchet::initialise_as_bob(
     _olm_crypto_hkdf_sha256(
         shared_secret, shared_secret_length,
         nullptr, 0,
-        kdf_info.root_info, kdf_info.root_info_length,
+        kdf_info().root_info, kdf_info().root_info_length,
         derived_secrets, sizeof(derived_secrets)
     );
     receiver_chains.insert();
@@ -204,6 +560,10 @@ void olm::Ratchet::initialise_as_bob(
     pos = olm::load_array(root_key, pos);
     pos = olm::load_array(receiver_chains[0].chain_key.key, pos);
     receiver_chains[0].ratchet_key = their_ratchet_key;
+    receiver_chains[0].change = olm::ChainChange::ADDED;
+    update_fingerprints(*this);
+    changes.root_key = true;
+    dirty = true;
     olm::unset(derived_secrets);
 }
 
@@ -216,7 +576,7 @@ void olm::Ratchet::initialise_as_alice(
     _olm_crypto_hkdf_sha256(
         shared_secret, shared_secret_length,
         nullptr, 0,
-        kdf_info.root_info, kdf_info.root_info_length,
+        kdf_info().root_info, kdf_info().root_info_length,
         derived_secrets, sizeof(derived_secrets)
     );
     sender_chain.insert();
@@ -225,6 +585,9 @@ void olm::Ratchet::initialise_as_alice(
     pos = olm::load_array(root_key, pos);
     pos = olm::load_array(sender_chain[0].chain_key.key, pos);
     sender_chain[0].ratchet_key = our_ratchet_key;
+    changes.root_key = true;
+    changes.sender_chain = true;
+    dirty = true;
     olm::unset(derived_secrets);
 }
 
@@ -315,6 +678,7 @@ static std::uint8_t const * unpickle(
     pos = olm::unpickle(pos, end, value.ratchet_key);
     pos = olm::unpickle(pos, end, value.chain_key.key);
     pos = olm::unpickle(pos, end, value.chain_key.index);
+    value.change = olm::ChainChange::NONE;
     return pos;
 }
 
@@ -330,6 +694,36 @@ static std::size_t pickle_length(
 }
 
 
+static std::size_t pickle_length(
+    const olm::SkippedMessageKeyId & value
+) {
+    std::size_t length = 0;
+    length += olm::pickle_length(value.ratchet_key);
+    length += olm::pickle_length(value.index);
+    return length;
+}
+
+
+static std::uint8_t * pickle(
+    std::uint8_t * pos,
+    const olm::SkippedMessageKeyId & value
+) {
+    pos = olm::pickle(pos, value.ratchet_key);
+    pos = olm::pickle(pos, value.index);
+    return pos;
+}
+
+
+static std::uint8_t const * unpickle(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::SkippedMessageKeyId & value
+) {
+    pos = olm::unpickle(pos, end, value.ratchet_key);
+    pos = olm::unpickle(pos, end, value.index);
+    return pos;
+}
+
+
 static std::uint8_t * pickle(
     std::uint8_t * pos,
     const olm::SkippedMessageKey & value
@@ -348,6 +742,43 @@ static std::uint8_t const * unpickle(
     pos = olm::unpickle(pos, end, value.ratchet_key);
     pos = olm::unpickle(pos, end, value.message_key.key);
     pos = olm::unpickle(pos, end, value.message_key.index);
+    value.added = false;
+    return pos;
+}
+
+
+static std::size_t pickle_length(
+    const olm::SkippedChainRange & value
+) {
+    std::size_t length = 0;
+    length += olm::pickle_length(value.ratchet_key);
+    length += olm::pickle_length(value.start.key);
+    length += olm::pickle_length(value.start.index);
+    length += olm::pickle_length(value.end);
+    return length;
+}
+
+
+static std::uint8_t * pickle(
+    std::uint8_t * pos,
+    const olm::SkippedChainRange & value
+) {
+    pos = olm::pickle(pos, value.ratchet_key);
+    pos = olm::pickle(pos, value.start.key);
+    pos = olm::pickle(pos, value.start.index);
+    pos = olm::pickle(pos, value.end);
+    return pos;
+}
+
+
+static std::uint8_t const * unpickle(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::SkippedChainRange & value
+) {
+    pos = olm::unpickle(pos, end, value.ratchet_key);
+    pos = olm::unpickle(pos, end, value.start.key);
+    pos = olm::unpickle(pos, end, value.start.index);
+    pos = olm::unpickle(pos, end, value.end);
     return pos;
 }
 
@@ -366,6 +797,23 @@ std::size_t olm::pickle_length(
     return length;
 }
 
+std::size_t olm::max_pickle_length(
+    olm::Ratchet const & value
+) {
+    std::size_t length = 0;
+    length += olm::OLM_SHARED_KEY_LENGTH;
+    length += 3 * olm::pickle_length(std::uint32_t(0));
+    length += olm::pickle_length(olm::SenderChain());
+    length += value.limits.max_receiver_chains
+        * olm::pickle_length(olm::ReceiverChain());
+    length += value.limits.max_skipped_message_keys
+        * olm::pickle_length(olm::SkippedMessageKey());
+    length += olm::pickle_length(std::uint32_t(0));
+    length += olm::MAX_SKIPPED_RANGES
+        * olm::pickle_length(olm::SkippedChainRange());
+    return length;
+}
+
 std::uint8_t * olm::pickle(
     std::uint8_t * pos,
     olm::Ratchet const & value
@@ -381,12 +829,19 @@ std::uint8_t * olm::pickle(
 std::uint8_t const * olm::unpickle(
     std::uint8_t const * pos, std::uint8_t const * end,
     olm::Ratchet & value,
-    bool includes_chain_index
+    bool includes_chain_index,
+    OlmAllocator const * allocator
 ) {
     pos = unpickle(pos, end, value.root_key);
     pos = unpickle(pos, end, value.sender_chain);
     pos = unpickle(pos, end, value.receiver_chains);
+    update_fingerprints(value);
+    if (!value.reserve_skipped_message_keys(allocator)) {
+        return end;
+    }
     pos = unpickle(pos, end, value.skipped_message_keys);
+    value.release_skipped_message_keys(allocator);
+    value.dirty = false;
 
     // pickle v 0x80000001 includes a chain index; pickle v1 does not.
     if (includes_chain_index) {
@@ -397,19 +852,333 @@ std::uint8_t const * olm::unpickle(
 }
 
 
+std::size_t olm::pickle_skipped_ranges_length(
+    olm::Ratchet const & value
+) {
+    return olm::pickle_length(value.skipped_ranges);
+}
+
+
+std::uint8_t * olm::pickle_skipped_ranges(
+    std::uint8_t * pos,
+    olm::Ratchet const & value
+) {
+    return olm::pickle(pos, value.skipped_ranges);
+}
+
+
+std::uint8_t const * olm::unpickle_skipped_ranges(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::Ratchet & value
+) {
+    while (!value.skipped_ranges.empty()) {
+        olm::unset(value.skipped_ranges[0]);
+        value.skipped_ranges.erase(value.skipped_ranges.begin());
+    }
+    return olm::unpickle(pos, end, value.skipped_ranges);
+}
+
+
+void olm::Ratchet::forget_changes() {
+    changes.root_key = false;
+    changes.sender_chain = false;
+    changes.skipped_message_keys = false;
+    changes.removed_count = 0;
+    changes.skipped_ranges = false;
+    for (auto & chain : receiver_chains) {
+        chain.change = olm::ChainChange::NONE;
+    }
+    for (auto & key : skipped_message_keys) {
+        if (!key.added) {
+            break;
+        }
+        key.added = false;
+    }
+}
+
+
+bool olm::Ratchet::copy_from(
+    olm::Ratchet const & other, OlmAllocator const * allocator
+) {
+    if (other.skipped_message_keys.capacity()
+            && !reserve_skipped_message_keys(allocator)) {
+        return false;
+    }
+    protocol = other.protocol;
+    last_error = other.last_error;
+    olm::load_array(root_key, other.root_key);
+    sender_chain = other.sender_chain;
+    receiver_chains.copy_from(other.receiver_chains);
+    std::memcpy(
+        receiver_chain_fingerprints(), other.receiver_chain_fingerprints(),
+        other.receiver_chains.size() * sizeof(std::uint64_t)
+    );
+    if (skipped_message_keys.capacity()) {
+        skipped_message_keys.copy_from(other.skipped_message_keys);
+        release_skipped_message_keys(allocator, false);
+    }
+    changes = other.changes;
+    skipped_key_eviction = other.skipped_key_eviction;
+    skipped_ranges = other.skipped_ranges;
+    skipped_range_threshold = other.skipped_range_threshold;
+    dirty = other.dirty;
+    return true;
+}
+
+
+void olm::Ratchet::evict_skipped_message_keys() {
+    std::size_t max_age = skipped_key_eviction.max_age;
+    std::size_t max_count = skipped_key_eviction.max_count;
+    while (max_count && skipped_message_keys.size() > max_count) {
+        olm::SkippedMessageKey * oldest = skipped_message_keys.oldest();
+        note_removed(*this, *oldest);
+        skipped_message_keys.erase(oldest);
+        dirty = true;
+    }
+    if (!max_age) {
+        return;
+    }
+    for (auto range = skipped_ranges.begin(); range != skipped_ranges.end();) {
+        if (chain_age(*this, range->ratchet_key.public_key) >= max_age) {
+            olm::unset(*range);
+            skipped_ranges.erase(range);
+            changes.skipped_ranges = true;
+            dirty = true;
+        } else {
+            ++range;
+        }
+    }
+    /* erasing a key moves another into its slot, so start again from the
+     * oldest after each; the old keys are mostly the oldest anyway */
+    olm::SkippedMessageKey * key = skipped_message_keys.oldest();
+    while (key) {
+        if (chain_age(*this, key->ratchet_key.public_key) >= max_age) {
+            note_removed(*this, *key);
+            skipped_message_keys.erase(key);
+            dirty = true;
+            key = skipped_message_keys.oldest();
+        } else {
+            key = skipped_message_keys.newer(key);
+        }
+    }
+}
+
+
+/* A delta pickle holds the root key and sender chain if they changed, the
+ * receiver chains that were updated and then those that were added, oldest
+ * first, and then either the whole list of skipped message keys or the keys
+ * that were removed followed by those that were added, oldest first.
+ * Removing the keys before adding any means applying the delta never pushes
+ * a key out of a full list. */
+
+std::size_t olm::pickle_delta_length(
+    olm::Ratchet const & value
+) {
+    olm::RatchetChanges const & changes = value.changes;
+    std::size_t length = 0;
+    length += olm::pickle_length(changes.root_key);
+    if (changes.root_key) {
+        length += olm::OLM_SHARED_KEY_LENGTH;
+    }
+    length += olm::pickle_length(changes.sender_chain);
+    if (changes.sender_chain) {
+        length += olm::pickle_length(value.sender_chain);
+    }
+    length += 2 * olm::pickle_length(std::uint32_t(0));
+    for (auto const & chain : value.receiver_chains) {
+        if (chain.change != olm::ChainChange::NONE) {
+            length += olm::pickle_length(chain);
+        }
+    }
+    length += olm::pickle_length(changes.skipped_message_keys);
+    if (changes.skipped_message_keys) {
+        length += olm::pickle_length(value.skipped_message_keys);
+    } else {
+        length += olm::pickle_length(changes.removed_count);
+        for (std::uint32_t i = 0; i < changes.removed_count; ++i) {
+            length += olm::pickle_length(changes.removed[i]);
+        }
+        length += olm::pickle_length(std::uint32_t(0));
+        for (auto key = oldest_added(value.skipped_message_keys); key;
+                key = value.skipped_message_keys.newer(key)) {
+            length += olm::pickle_length(*key);
+        }
+    }
+    return length;
+}
+
+
+std::uint8_t * olm::pickle_delta(
+    std::uint8_t * pos,
+    olm::Ratchet const & value
+) {
+    olm::RatchetChanges const & changes = value.changes;
+    pos = olm::pickle(pos, changes.root_key);
+    if (changes.root_key) {
+        pos = pickle(pos, value.root_key);
+    }
+    pos = olm::pickle(pos, changes.sender_chain);
+    if (changes.sender_chain) {
+        pos = pickle(pos, value.sender_chain);
+    }
+
+    std::uint32_t updated = 0, added = 0;
+    for (auto const & chain : value.receiver_chains) {
+        if (chain.change == olm::ChainChange::UPDATED) {
+            ++updated;
+        } else if (chain.change == olm::ChainChange::ADDED) {
+            ++added;
+        }
+    }
+    pos = olm::pickle(pos, updated);
+    for (auto const & chain : value.receiver_chains) {
+        if (chain.change == olm::ChainChange::UPDATED) {
+            pos = pickle(pos, chain);
+        }
+    }
+    pos = olm::pickle(pos, added);
+    for (auto chain = value.receiver_chains.end();
+            chain != value.receiver_chains.begin();) {
+        if ((--chain)->change == olm::ChainChange::ADDED) {
+            pos = pickle(pos, *chain);
+        }
+    }
+
+    pos = olm::pickle(pos, changes.skipped_message_keys);
+    if (changes.skipped_message_keys) {
+        return pickle(pos, value.skipped_message_keys);
+    }
+    pos = olm::pickle(pos, changes.removed_count);
+    for (std::uint32_t i = 0; i < changes.removed_count; ++i) {
+        pos = pickle(pos, changes.removed[i]);
+    }
+    olm::SkippedMessageKey const * oldest = oldest_added(
+        value.skipped_message_keys
+    );
+    added = 0;
+    for (auto key = oldest; key; key = value.skipped_message_keys.newer(key)) {
+        ++added;
+    }
+    pos = olm::pickle(pos, added);
+    for (auto key = oldest; key; key = value.skipped_message_keys.newer(key)) {
+        pos = pickle(pos, *key);
+    }
+    return pos;
+}
+
+
+std::uint8_t const * olm::unpickle_delta(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    olm::Ratchet & value,
+    OlmAllocator const * allocator
+) {
+    bool changed;
+    std::uint32_t count;
+
+    pos = olm::unpickle(pos, end, changed);
+    if (changed) {
+        pos = unpickle(pos, end, value.root_key);
+    }
+    pos = olm::unpickle(pos, end, changed);
+    if (changed) {
+        if (!value.sender_chain.empty()) {
+            olm::unset(value.sender_chain[0]);
+            value.sender_chain.erase(value.sender_chain.begin());
+        }
+        pos = unpickle(pos, end, value.sender_chain);
+    }
+
+    pos = olm::unpickle(pos, end, count);
+    while (count-- && pos != end) {
+        olm::ReceiverChain updated;
+        pos = unpickle(pos, end, updated);
+        olm::ReceiverChain * chain = nullptr;
+        for (auto & candidate : value.receiver_chains) {
+            if (0 == std::memcmp(
+                candidate.ratchet_key.public_key,
+                updated.ratchet_key.public_key, CURVE25519_KEY_LENGTH
+            )) {
+                chain = &candidate;
+                break;
+            }
+        }
+        if (chain) {
+            chain->chain_key = updated.chain_key;
+        }
+        olm::unset(updated);
+        if (!chain) {
+            return end;
+        }
+    }
+    pos = olm::unpickle(pos, end, count);
+    while (count-- && pos != end) {
+        pos = unpickle(pos, end, *value.receiver_chains.insert());
+    }
+    update_fingerprints(value);
+
+    pos = olm::unpickle(pos, end, changed);
+    if (changed) {
+        while (olm::SkippedMessageKey * key = value.skipped_message_keys.newest()) {
+            value.skipped_message_keys.erase(key);
+        }
+        if (!value.reserve_skipped_message_keys(allocator)) {
+            return end;
+        }
+        pos = unpickle(pos, end, value.skipped_message_keys);
+        value.release_skipped_message_keys(allocator);
+        return pos;
+    }
+    pos = olm::unpickle(pos, end, count);
+    while (count-- && pos != end) {
+        olm::SkippedMessageKeyId id;
+        pos = unpickle(pos, end, id);
+        auto matches = [&id](olm::SkippedMessageKey const & key) {
+            return id.index == key.message_key.index
+                && 0 == std::memcmp(
+                    key.ratchet_key.public_key, id.ratchet_key.public_key,
+                    CURVE25519_KEY_LENGTH
+                );
+        };
+        std::size_t cursor = 0;
+        olm::SkippedMessageKey * key = value.skipped_message_keys.find(
+            olm::skipped_message_key_hash(id.ratchet_key.public_key, id.index),
+            matches, cursor
+        );
+        if (!key) {
+            return end;
+        }
+        value.skipped_message_keys.erase(key);
+    }
+    pos = olm::unpickle(pos, end, count);
+    if (count && !value.reserve_skipped_message_keys(allocator)) {
+        return end;
+    }
+    while (count-- && pos != end) {
+        olm::SkippedMessageKey key;
+        pos = unpickle(pos, end, key);
+        value.skipped_message_keys.insert(key);
+        olm::unset(key);
+    }
+    value.release_skipped_message_keys(allocator);
+    return pos;
+}
+
+
 std::size_t olm::Ratchet::encrypt_output_length(
-    std::size_t plaintext_length
+    std::size_t plaintext_length, std::uint32_t ahead
 ) {
-    std::size_t counter = 0;
+    /* a new sending chain starts at index 0 */
+    std::uint32_t counter = ahead;
     if (!sender_chain.empty()) {
-        counter = sender_chain[0].chain_key.index;
+        counter += sender_chain[0].chain_key.index;
     }
-    std::size_t padded = ratchet_cipher->ops->encrypt_ciphertext_length(
-        ratchet_cipher,
+    std::size_t padded = _olm_cipher_encrypt_ciphertext_length(
+        ratchet_cipher(),
         plaintext_length
     );
     return olm::encode_message_length(
-        counter, CURVE25519_KEY_LENGTH, padded, ratchet_cipher->ops->mac_length(ratchet_cipher)
+        counter, CURVE25519_KEY_LENGTH, padded,
+        _olm_cipher_mac_length(ratchet_cipher())
     );
 }
 
@@ -423,10 +1192,34 @@ std::size_t olm::Ratchet::encrypt(
     std::uint8_t const * plaintext, std::size_t plaintext_length,
     std::uint8_t const * random, std::size_t random_length,
     std::uint8_t * output, std::size_t max_output_length
+) {
+    if (random_length < encrypt_random_length()) {
+        last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
+        return std::size_t(-1);
+    }
+    if (!sender_chain.empty()) {
+        return encrypt(
+            plaintext, plaintext_length, nullptr, output, max_output_length
+        );
+    }
+    _olm_curve25519_key_pair ratchet_key;
+    _olm_crypto_curve25519_generate_key(random, &ratchet_key);
+    std::size_t result = encrypt(
+        plaintext, plaintext_length, &ratchet_key, output, max_output_length
+    );
+    olm::unset(ratchet_key);
+    return result;
+}
+
+
+std::size_t olm::Ratchet::encrypt(
+    std::uint8_t const * plaintext, std::size_t plaintext_length,
+    _olm_curve25519_key_pair const * ratchet_key,
+    std::uint8_t * output, std::size_t max_output_length
 ) {
     std::size_t output_length = encrypt_output_length(plaintext_length);
 
-    if (random_length < encrypt_random_length()) {
+    if (sender_chain.empty() && !ratchet_key) {
         last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
         return std::size_t(-1);
     }
@@ -435,28 +1228,21 @@ std::size_t olm::Ratchet::encrypt(
         return std::size_t(-1);
     }
 
-    if (sender_chain.empty()) {
-        sender_chain.insert();
-        _olm_crypto_curve25519_generate_key(random, &sender_chain[0].ratchet_key);
-        create_chain_key(
-            root_key,
-            sender_chain[0].ratchet_key,
-            receiver_chains[0].ratchet_key,
-            kdf_info,
-            root_key, sender_chain[0].chain_key
-        );
-    }
+    prepare_send(ratchet_key);
+    changes.sender_chain = true;
+    dirty = true;
 
     MessageKey keys;
-    create_message_keys(sender_chain[0].chain_key, kdf_info, keys);
-    advance_chain_key(sender_chain[0].chain_key, sender_chain[0].chain_key);
+    create_message_keys_and_advance(
+        sender_chain[0].chain_key, kdf_info(), keys
+    );
 
-    std::size_t ciphertext_length = ratchet_cipher->ops->encrypt_ciphertext_length(
-        ratchet_cipher,
+    std::size_t ciphertext_length = _olm_cipher_encrypt_ciphertext_length(
+        ratchet_cipher(),
         plaintext_length
     );
     std::uint32_t counter = keys.index;
-    _olm_curve25519_public_key const & ratchet_key =
+    _olm_curve25519_public_key const & sender_key =
         sender_chain[0].ratchet_key.public_key;
 
     olm::MessageWriter writer;
@@ -467,10 +1253,10 @@ std::size_t olm::Ratchet::encrypt(
         output
     );
 
-    olm::store_array(writer.ratchet_key, ratchet_key.public_key);
+    olm::store_array(writer.ratchet_key, sender_key.public_key);
 
-    ratchet_cipher->ops->encrypt(
-        ratchet_cipher,
+    _olm_cipher_encrypt(
+        ratchet_cipher(),
         keys.key, sizeof(keys.key),
         plaintext, plaintext_length,
         writer.ciphertext, ciphertext_length,
@@ -482,114 +1268,394 @@ std::size_t olm::Ratchet::encrypt(
 }
 
 
+std::size_t olm::Ratchet::prepare_send(
+    _olm_curve25519_key_pair const * ratchet_key
+) {
+    if (!sender_chain.empty()) {
+        return 0;
+    }
+    if (!ratchet_key) {
+        last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
+        return std::size_t(-1);
+    }
+    changes.sender_chain = true;
+    changes.root_key = true;
+    dirty = true;
+    sender_chain.insert();
+    sender_chain[0].ratchet_key = *ratchet_key;
+    create_chain_key(
+        root_key,
+        sender_chain[0].ratchet_key,
+        receiver_chains[0].ratchet_key,
+        kdf_info(),
+        root_key, sender_chain[0].chain_key
+    );
+    return 0;
+}
+
+
+void olm::Ratchet::take_send_keys(
+    Ratchet * const * ratchets, std::size_t count,
+    SendKeys * keys
+) {
+    std::size_t const lanes = OLM_CRYPTO_SHA256_MAX_LANES;
+    _olm_hmac_sha256_key hmac_keys[lanes];
+    _olm_hmac_sha256_key * hmac_key_ptrs[lanes];
+    SharedKey message_keys[lanes];
+    std::uint8_t const * chain_keys[lanes];
+    std::uint8_t * new_chain_keys[lanes];
+    std::uint8_t * message_key_ptrs[lanes];
+    std::uint8_t const * message_seeds[lanes];
+    std::uint8_t const * chain_seeds[lanes];
+    _olm_cipher_aes_sha_256_context * contexts[lanes];
+
+    while (count) {
+        std::size_t n = count < lanes ? count : lanes;
+        for (std::size_t i = 0; i < n; ++i) {
+            ChainKey & chain_key = ratchets[i]->sender_chain[0].chain_key;
+            hmac_key_ptrs[i] = &hmac_keys[i];
+            chain_keys[i] = chain_key.key;
+            new_chain_keys[i] = chain_key.key;
+            message_key_ptrs[i] = message_keys[i];
+            message_seeds[i] = MESSAGE_KEY_SEED;
+            chain_seeds[i] = CHAIN_KEY_SEED;
+            contexts[i] = &keys[i].cipher_keys;
+        }
+        /* as create_message_keys_and_advance, for each ratchet */
+        _olm_crypto_hmac_sha256_init_key_multi(
+            hmac_key_ptrs, chain_keys, sizeof(SharedKey), n
+        );
+        _olm_crypto_hmac_sha256_with_keys_multi(
+            hmac_key_ptrs, message_seeds, sizeof(MESSAGE_KEY_SEED),
+            message_key_ptrs, n
+        );
+        _olm_crypto_hmac_sha256_with_keys_multi(
+            hmac_key_ptrs, chain_seeds, sizeof(CHAIN_KEY_SEED),
+            new_chain_keys, n
+        );
+        OLM_STATS_ADD(chain_key_advances, n);
+        for (std::size_t i = 0; i < n; ++i) {
+            ChainKey & chain_key = ratchets[i]->sender_chain[0].chain_key;
+            keys[i].index = chain_key.index;
+            chain_key.index++;
+            ratchets[i]->changes.sender_chain = true;
+            ratchets[i]->dirty = true;
+        }
+        _olm_cipher_aes_sha_256_init_context_multi(
+            reinterpret_cast<_olm_cipher_aes_sha_256 const *>(
+                ratchets[0]->ratchet_cipher()
+            ),
+            message_key_ptrs, sizeof(SharedKey), contexts, n
+        );
+        ratchets += n;
+        keys += n;
+        count -= n;
+    }
+    olm::unset(hmac_keys);
+    olm::unset(message_keys);
+}
+
+
+std::size_t olm::Ratchet::encrypt_with_keys(
+    std::uint8_t const * plaintext, std::size_t plaintext_length,
+    SendKeys const & keys,
+    std::uint8_t * output, std::size_t max_output_length
+) {
+    std::size_t output_length = encrypt_output_length(plaintext_length);
+
+    if (max_output_length < output_length) {
+        last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+
+    std::size_t ciphertext_length = _olm_cipher_encrypt_ciphertext_length(
+        ratchet_cipher(),
+        plaintext_length
+    );
+    _olm_curve25519_public_key const & sender_key =
+        sender_chain[0].ratchet_key.public_key;
+
+    olm::MessageWriter writer;
+
+    olm::encode_message(
+        writer, PROTOCOL_VERSION, keys.index, CURVE25519_KEY_LENGTH,
+        ciphertext_length,
+        output
+    );
+
+    olm::store_array(writer.ratchet_key, sender_key.public_key);
+
+    _olm_cipher_aes_sha_256_context_encrypt(
+        &keys.cipher_keys,
+        plaintext, plaintext_length,
+        writer.ciphertext, ciphertext_length,
+        output, output_length
+    );
+    return output_length;
+}
+
+
 std::size_t olm::Ratchet::decrypt_max_plaintext_length(
     std::uint8_t const * input, std::size_t input_length
 ) {
     olm::MessageReader reader;
     olm::decode_message(
         reader, input, input_length,
-        ratchet_cipher->ops->mac_length(ratchet_cipher)
+        _olm_cipher_mac_length(ratchet_cipher())
     );
+    return decrypt_max_plaintext_length(reader);
+}
 
+
+std::size_t olm::Ratchet::decrypt_max_plaintext_length(
+    olm::MessageReader const & reader
+) {
     if (!reader.ciphertext) {
         last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
         return std::size_t(-1);
     }
 
-    return ratchet_cipher->ops->decrypt_max_plaintext_length(
-        ratchet_cipher, reader.ciphertext_length);
+    if (reader.version != PROTOCOL_VERSION) {
+        last_error = OlmErrorCode::OLM_BAD_MESSAGE_VERSION;
+        return std::size_t(-1);
+    }
+
+    return _olm_cipher_decrypt_max_plaintext_length(
+        ratchet_cipher(), reader.ciphertext_length);
 }
 
 
 std::size_t olm::Ratchet::decrypt(
     std::uint8_t const * input, std::size_t input_length,
-    std::uint8_t * plaintext, std::size_t max_plaintext_length
+    std::uint8_t * plaintext, std::size_t max_plaintext_length,
+    OlmAllocator const * allocator
 ) {
     olm::MessageReader reader;
     olm::decode_message(
         reader, input, input_length,
-        ratchet_cipher->ops->mac_length(ratchet_cipher)
+        _olm_cipher_mac_length(ratchet_cipher())
     );
+    return decrypt(reader, plaintext, max_plaintext_length, allocator);
+}
+
+
+std::size_t olm::Ratchet::decrypt(
+    olm::MessageReader const & reader,
+    std::uint8_t * plaintext, std::size_t max_plaintext_length,
+    OlmAllocator const * allocator
+) {
+    OLM_PROBE2(ratchet_decrypt_entry, reader.counter, reader.ciphertext_length);
+    olm::DecryptTrial trial;
+    std::size_t result = try_decrypt(
+        reader, plaintext, max_plaintext_length, trial
+    );
+    /* Noted before committing resets the trial */
+    std::uint8_t kind = std::uint8_t(trial.kind);
+    std::uint32_t steps = chain_steps(trial);
+    if (result == std::size_t(-1)) {
+        last_error = trial.last_error;
+    } else if (!commit_decrypt(trial, allocator)) {
+        olm::unset(plaintext, result);
+        result = std::size_t(-1);
+    }
+    olm::unset(trial);
+    OLM_PROBE3(ratchet_decrypt_return, result, kind, steps);
+    return result;
+}
+
+
+std::size_t olm::Ratchet::try_decrypt(
+    olm::MessageReader const & reader,
+    std::uint8_t * plaintext, std::size_t max_plaintext_length,
+    olm::DecryptTrial & trial
+) const {
+    trial.kind = olm::DecryptTrialKind::NONE;
+    trial.last_error = OlmErrorCode::OLM_SUCCESS;
 
     if (reader.version != PROTOCOL_VERSION) {
-        last_error = OlmErrorCode::OLM_BAD_MESSAGE_VERSION;
+        trial.last_error = OlmErrorCode::OLM_BAD_MESSAGE_VERSION;
         return std::size_t(-1);
     }
 
     if (!reader.has_counter || !reader.ratchet_key || !reader.ciphertext) {
-        last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
+        trial.last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
         return std::size_t(-1);
     }
 
-    std::size_t max_length = ratchet_cipher->ops->decrypt_max_plaintext_length(
-        ratchet_cipher,
+    std::size_t max_length = _olm_cipher_decrypt_max_plaintext_length(
+        ratchet_cipher(),
         reader.ciphertext_length
     );
 
     if (max_plaintext_length < max_length) {
-        last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        trial.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
         return std::size_t(-1);
     }
 
     if (reader.ratchet_key_length != CURVE25519_KEY_LENGTH) {
-        last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
+        trial.last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
         return std::size_t(-1);
     }
 
-    ReceiverChain * chain = nullptr;
-
-    for (olm::ReceiverChain & receiver_chain : receiver_chains) {
-        if (0 == std::memcmp(
-                receiver_chain.ratchet_key.public_key, reader.ratchet_key,
-                CURVE25519_KEY_LENGTH
-        )) {
-            chain = &receiver_chain;
-            break;
-        }
-    }
-
+    olm::load_array(trial.ratchet_key.public_key, reader.ratchet_key);
+    trial.counter = reader.counter;
+    olm::ReceiverChain const * chain =
+        find_receiver_chain(*this, reader.ratchet_key);
     std::size_t result = std::size_t(-1);
 
     if (!chain) {
+        olm::ReceiverChain new_chain;
         result = verify_mac_and_decrypt_for_new_chain(
-            *this, reader, plaintext, max_plaintext_length
+            *this, reader, plaintext, max_plaintext_length,
+            trial.new_root_key, new_chain, trial.advance
         );
+        if (result != std::size_t(-1)) {
+            trial.kind = olm::DecryptTrialKind::NEW_CHAIN;
+            olm::load_array(trial.root_key, root_key);
+            trial.new_chain_key = new_chain.chain_key;
+            olm::unset(new_chain);
+        }
     } else if (chain->chain_key.index > reader.counter) {
         /* Chain already advanced beyond the key for this message
          * Check if the message keys are in the skipped key list. */
-        for (olm::SkippedMessageKey & skipped : skipped_message_keys) {
-            if (reader.counter == skipped.message_key.index
-                    && 0 == std::memcmp(
-                        skipped.ratchet_key.public_key, reader.ratchet_key,
-                        CURVE25519_KEY_LENGTH
-                    )
-            ) {
-                /* Found the key for this message. Check the MAC. */
-
-                result = verify_mac_and_decrypt(
-                    ratchet_cipher, skipped.message_key, reader,
-                    plaintext, max_plaintext_length
-                );
-
-                if (result != std::size_t(-1)) {
-                    /* Remove the key from the skipped keys now that we've
-                     * decoded the message it corresponds to. */
-                    olm::unset(skipped);
-                    skipped_message_keys.erase(&skipped);
-                    return result;
-                }
+        std::size_t cursor = 0;
+        olm::SkippedMessageKey const * skipped;
+        while ((skipped = find_skipped_message_key(
+                *this, reader.ratchet_key, reader.counter, cursor))) {
+            /* Found the key for this message. Check the MAC. */
+            result = verify_mac_and_decrypt(
+                ratchet_cipher(), skipped->message_key, reader,
+                plaintext, max_plaintext_length
+            );
+            if (result != std::size_t(-1)) {
+                trial.kind = olm::DecryptTrialKind::SKIPPED_KEY;
+                trial.message_key = skipped->message_key;
+                break;
+            }
+        }
+        /* Otherwise derive its key from the start of a skipped range */
+        olm::SkippedChainRange const * range;
+        if (result == std::size_t(-1) && (range = find_skipped_range(
+                *this, reader.ratchet_key, reader.counter))) {
+            result = verify_mac_and_decrypt_for_existing_chain(
+                *this, range->start,
+                reader, plaintext, max_plaintext_length, trial.advance
+            );
+            if (result != std::size_t(-1)) {
+                trial.kind = olm::DecryptTrialKind::SKIPPED_RANGE;
+                trial.chain_index = range->start.index;
             }
         }
     } else {
         result = verify_mac_and_decrypt_for_existing_chain(
             *this, chain->chain_key,
-            reader, plaintext, max_plaintext_length
+            reader, plaintext, max_plaintext_length, trial.advance
         );
+        if (result != std::size_t(-1)) {
+            trial.kind = olm::DecryptTrialKind::EXISTING_CHAIN;
+            trial.chain_index = chain->chain_key.index;
+        }
     }
 
     if (result == std::size_t(-1)) {
-        last_error = OlmErrorCode::OLM_BAD_MESSAGE_MAC;
-        return std::size_t(-1);
+        olm::unset(trial);
+        trial.last_error = OlmErrorCode::OLM_BAD_MESSAGE_MAC;
+    }
+    return result;
+}
+
+
+bool olm::Ratchet::commit_decrypt(
+    olm::DecryptTrial & trial, OlmAllocator const * allocator
+) {
+    std::uint8_t const * ratchet_key = trial.ratchet_key.public_key;
+    olm::ReceiverChain * chain = const_cast<olm::ReceiverChain *>(
+        find_receiver_chain(*this, ratchet_key)
+    );
+
+    if (trial.kind == olm::DecryptTrialKind::SKIPPED_KEY) {
+        std::size_t cursor = 0;
+        olm::SkippedMessageKey const * skipped;
+        while ((skipped = find_skipped_message_key(
+                *this, ratchet_key, trial.counter, cursor))) {
+            if (olm::array_equal(skipped->message_key.key,
+                    trial.message_key.key)) {
+                break;
+            }
+        }
+        if (!skipped) {
+            last_error = OlmErrorCode::OLM_SESSION_CHANGED;
+            return false;
+        }
+        /* Remove the key from the skipped keys now that we've decoded the
+         * message it corresponds to. */
+        note_removed(*this, *skipped);
+        skipped_message_keys.erase(
+            const_cast<olm::SkippedMessageKey *>(skipped)
+        );
+        evict_skipped_message_keys();
+        release_skipped_message_keys(allocator);
+        dirty = true;
+        olm::unset(trial);
+        return true;
+    }
+
+    if (trial.kind == olm::DecryptTrialKind::SKIPPED_RANGE) {
+        olm::SkippedChainRange * range = const_cast<olm::SkippedChainRange *>(
+            find_skipped_range(*this, ratchet_key, trial.counter)
+        );
+        if (!range || range->start.index != trial.chain_index) {
+            last_error = OlmErrorCode::OLM_SESSION_CHANGED;
+            return false;
+        }
+        /* Split the range around the message so that its key can't be used
+         * again, dropping either part if it is empty. If the ranges are
+         * full the oldest is pushed out. */
+        olm::SkippedChainRange later;
+        later.ratchet_key = range->ratchet_key;
+        advance_chain_key(trial.advance.current, later.start);
+        later.end = range->end;
+        range->end = trial.counter;
+        if (range->start.index == range->end) {
+            olm::unset(*range);
+            skipped_ranges.erase(range);
+        }
+        if (later.start.index < later.end) {
+            skipped_ranges.insert(range, later);
+        }
+        olm::unset(later);
+        changes.skipped_ranges = true;
+        evict_skipped_message_keys();
+        release_skipped_message_keys(allocator);
+        dirty = true;
+        olm::unset(trial);
+        return true;
+    }
+
+    /* Only the message's own chain can have moved on, or the root key if
+     * another chain was started */
+    bool fits = trial.kind == olm::DecryptTrialKind::EXISTING_CHAIN
+        ? chain && chain->chain_key.index == trial.chain_index
+        : trial.kind == olm::DecryptTrialKind::NEW_CHAIN
+            && !chain && !sender_chain.empty()
+            && olm::array_equal(root_key, trial.root_key);
+    if (!fits) {
+        last_error = OlmErrorCode::OLM_SESSION_CHANGED;
+        return false;
+    }
+
+    /* A large enough gap is kept as a range, from where the chain was */
+    std::uint32_t gap = trial.kind == olm::DecryptTrialKind::EXISTING_CHAIN
+        ? trial.counter - trial.chain_index : trial.counter;
+    bool skip_as_range = skipped_range_threshold
+        && gap >= skipped_range_threshold;
+
+    /* Make room for the keys of the messages we skipped over before
+     * changing anything, so that running out leaves the ratchet as it was */
+    olm::ChainAdvance & advance = trial.advance;
+    if (!skip_as_range && advance.first_kept.index < trial.counter
+            && !reserve_skipped_message_keys(allocator)) {
+        return false;
     }
 
     if (!chain) {
@@ -599,27 +1665,51 @@ std::size_t olm::Ratchet::decrypt(
          * We will generate a new key when we send the next message. */
 
         chain = receiver_chains.insert();
-        olm::load_array(chain->ratchet_key.public_key, reader.ratchet_key);
-
-        // TODO: we've already done this once, in
-        // verify_mac_and_decrypt_for_new_chain(). we could reuse the result.
-        create_chain_key(
-            root_key, sender_chain[0].ratchet_key, chain->ratchet_key,
-            kdf_info, root_key, chain->chain_key
-        );
+        chain->ratchet_key = trial.ratchet_key;
+        chain->chain_key = trial.new_chain_key;
+        chain->change = olm::ChainChange::ADDED;
+        update_fingerprints(*this);
+        changes.root_key = true;
+        changes.sender_chain = true;
+        olm::load_array(root_key, trial.new_root_key);
 
         olm::unset(sender_chain[0]);
         sender_chain.erase(sender_chain.begin());
     }
 
-    while (chain->chain_key.index < reader.counter) {
-        olm::SkippedMessageKey & key = *skipped_message_keys.insert();
-        create_message_keys(chain->chain_key, kdf_info, key.message_key);
+    /* Keep the keys for the messages we skipped over, starting from where
+     * the trial decrypt found the first one we have room for. */
+    if (skip_as_range) {
+        olm::SkippedChainRange * range = skipped_ranges.insert();
+        range->ratchet_key = chain->ratchet_key;
+        range->start = chain->chain_key;
+        range->end = trial.counter;
+        changes.skipped_ranges = true;
+    } else if (advance.first_kept.index < trial.counter) {
+        olm::SkippedMessageKey key;
         key.ratchet_key = chain->ratchet_key;
-        advance_chain_key(chain->chain_key, chain->chain_key);
+        key.added = true;
+        while (advance.first_kept.index < trial.counter) {
+            create_message_keys_and_advance(
+                advance.first_kept, kdf_info(), key.message_key
+            );
+            if (skipped_message_keys.capacity()
+                    && skipped_message_keys.size()
+                        == skipped_message_keys.capacity()) {
+                note_removed(*this, *skipped_message_keys.oldest());
+            }
+            skipped_message_keys.insert(key);
+        }
+        olm::unset(key);
     }
 
-    advance_chain_key(chain->chain_key, chain->chain_key);
-
-    return result;
+    advance_chain_key(advance.current, chain->chain_key);
+    if (chain->change == olm::ChainChange::NONE) {
+        chain->change = olm::ChainChange::UPDATED;
+    }
+    evict_skipped_message_keys();
+    release_skipped_message_keys(allocator);
+    dirty = true;
+    olm::unset(trial);
+    return true;
 }
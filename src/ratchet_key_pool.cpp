@@ -0,0 +1,274 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "olm/base64.hh"
+#include "olm/crypto.h"
+#include "olm/error.h"
+#include "olm/memory.hh"
+#include "olm/session.hh"
+#include "olm/stats_internal.h"
+#include "olm/trace_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+namespace {
+
+/** How many keys are generated together, so that they can share the work */
+static std::size_t const FILL_BATCH_LENGTH = 32;
+
+/**
+ * A ring of key pairs. The filling thread only moves tail on, and the
+ * taking thread only moves head on, so one of each can work at once. Both
+ * only ever increase: the slot of a count is the count modulo the capacity.
+ */
+struct RatchetKeyPool {
+    std::atomic<std::size_t> head;
+    std::atomic<std::size_t> tail;
+    std::size_t capacity;
+    OlmErrorCode last_error;
+    _olm_curve25519_key_pair * keys;
+};
+
+/** Round a length up so that what follows it is suitably aligned. */
+static constexpr std::size_t aligned(std::size_t length) {
+    return (length + 15) & ~std::size_t(15);
+}
+
+static OlmRatchetKeyPool * to_c(RatchetKeyPool * pool) {
+    return reinterpret_cast<OlmRatchetKeyPool *>(pool);
+}
+
+static RatchetKeyPool * from_c(OlmRatchetKeyPool * pool) {
+    return reinterpret_cast<RatchetKeyPool *>(pool);
+}
+
+static RatchetKeyPool const * from_c(OlmRatchetKeyPool const * pool) {
+    return reinterpret_cast<RatchetKeyPool const *>(pool);
+}
+
+static olm::Session * from_c(OlmSession * session) {
+    return reinterpret_cast<olm::Session *>(session);
+}
+
+/** The number of keys there is room for, as seen by the filling thread */
+static std::size_t room(RatchetKeyPool const & pool) {
+    std::size_t head = pool.head.load(std::memory_order_acquire);
+    std::size_t tail = pool.tail.load(std::memory_order_relaxed);
+    return pool.capacity - (tail - head);
+}
+
+/** Take the oldest key pair from the pool. Returns false if it is empty. */
+static bool take_key(RatchetKeyPool & pool, _olm_curve25519_key_pair & key) {
+    std::size_t head = pool.head.load(std::memory_order_relaxed);
+    if (head == pool.tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    _olm_curve25519_key_pair & slot = pool.keys[head % pool.capacity];
+    key = slot;
+    olm::unset(slot);
+    pool.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+} // namespace
+
+
+extern "C" {
+
+size_t olm_ratchet_key_pool_size(
+    size_t capacity
+) {
+    return aligned(sizeof(RatchetKeyPool))
+        + capacity * sizeof(_olm_curve25519_key_pair);
+}
+
+
+OlmRatchetKeyPool * olm_ratchet_key_pool(
+    void * memory, size_t capacity
+) {
+    std::uint8_t * pos = reinterpret_cast<std::uint8_t *>(memory);
+    olm::unset(pos, olm_ratchet_key_pool_size(capacity));
+    RatchetKeyPool * pool = new(pos) RatchetKeyPool;
+    pos += aligned(sizeof(RatchetKeyPool));
+
+    pool->head.store(0, std::memory_order_relaxed);
+    pool->tail.store(0, std::memory_order_relaxed);
+    pool->capacity = capacity;
+    pool->last_error = OlmErrorCode::OLM_SUCCESS;
+    pool->keys = reinterpret_cast<_olm_curve25519_key_pair *>(pos);
+    return to_c(pool);
+}
+
+
+const char * olm_ratchet_key_pool_last_error(
+    const OlmRatchetKeyPool * pool
+) {
+    return _olm_error_to_string(from_c(pool)->last_error);
+}
+
+
+size_t olm_clear_ratchet_key_pool(
+    OlmRatchetKeyPool * pool
+) {
+    std::size_t size = olm_ratchet_key_pool_size(from_c(pool)->capacity);
+    from_c(pool)->~RatchetKeyPool();
+    olm::unset(pool, size);
+    return size;
+}
+
+
+size_t olm_ratchet_key_pool_count(
+    const OlmRatchetKeyPool * pool
+) {
+    RatchetKeyPool const & object = *from_c(pool);
+    std::size_t head = object.head.load(std::memory_order_acquire);
+    return object.tail.load(std::memory_order_acquire) - head;
+}
+
+
+size_t olm_ratchet_key_pool_trim_memory(
+    OlmRatchetKeyPool * pool, int level
+) {
+    if (level < OLM_TRIM_MEMORY_PRECOMPUTED) {
+        return 0;
+    }
+    _olm_curve25519_key_pair key;
+    std::size_t wiped = 0;
+    while (take_key(*from_c(pool), key)) {
+        wiped += sizeof(key);
+    }
+    olm::unset(key);
+    return wiped;
+}
+
+
+size_t olm_ratchet_key_pool_fill_random_length(
+    const OlmRatchetKeyPool * pool
+) {
+    return room(*from_c(pool)) * CURVE25519_RANDOM_LENGTH;
+}
+
+
+size_t olm_ratchet_key_pool_fill(
+    OlmRatchetKeyPool * pool,
+    void * random, size_t random_length
+) {
+    RatchetKeyPool & object = *from_c(pool);
+    std::uint8_t const * random_pos = reinterpret_cast<std::uint8_t *>(random);
+    std::size_t count = std::min(
+        room(object), random_length / CURVE25519_RANDOM_LENGTH
+    );
+    std::size_t tail = object.tail.load(std::memory_order_relaxed);
+
+    _olm_curve25519_key_pair key_pairs[FILL_BATCH_LENGTH];
+    for (std::size_t i = 0; i < count; i += FILL_BATCH_LENGTH) {
+        std::size_t batch = std::min(count - i, FILL_BATCH_LENGTH);
+        _olm_crypto_curve25519_generate_keys(batch, random_pos, key_pairs);
+        random_pos += batch * CURVE25519_RANDOM_LENGTH;
+        for (std::size_t j = 0; j < batch; ++j) {
+            object.keys[tail % object.capacity] = key_pairs[j];
+            /* hand each batch over as soon as it is ready */
+            ++tail;
+        }
+        object.tail.store(tail, std::memory_order_release);
+    }
+    olm::unset(key_pairs);
+    olm::unset(random, random_length);
+    return count;
+}
+
+
+size_t olm_ratchet_key_pool_fill_auto_random(
+    OlmRatchetKeyPool * pool
+) {
+    RatchetKeyPool & object = *from_c(pool);
+    std::uint8_t random[FILL_BATCH_LENGTH * CURVE25519_RANDOM_LENGTH];
+    std::size_t total = 0;
+    for (;;) {
+        std::size_t count = std::min(room(object), FILL_BATCH_LENGTH);
+        if (!count) {
+            return total;
+        }
+        std::size_t random_length = count * CURVE25519_RANDOM_LENGTH;
+        if (olm_random_fill(random, random_length) == std::size_t(-1)) {
+            object.last_error = OlmErrorCode::OLM_RANDOM_UNAVAILABLE;
+            return std::size_t(-1);
+        }
+        total += olm_ratchet_key_pool_fill(pool, random, random_length);
+    }
+}
+
+
+size_t olm_encrypt_with_key_pool(
+    OlmSession * session,
+    OlmRatchetKeyPool * pool,
+    void const * plaintext, size_t plaintext_length,
+    void * message, size_t message_length
+) {
+    olm::StatsTimer timer(OLM_STATS_ENCRYPT);
+    olm::TraceScope trace(OLM_TRACE_ENCRYPT);
+    olm::RecordScope record(OLM_TRACE_ENCRYPT, session);
+    olm::Session & object = *from_c(session);
+    std::size_t raw_length = object.encrypt_message_length(plaintext_length);
+    record.message(
+        plaintext_length, raw_length, unsigned(object.encrypt_message_type())
+    );
+    std::size_t b64_length = olm::encode_base64_length(raw_length);
+    if (message_length < b64_length) {
+        object.last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+
+    /* only take a key if the session is going to use it */
+    _olm_curve25519_key_pair key;
+    _olm_curve25519_key_pair const * ratchet_key = nullptr;
+    if (object.encrypt_random_length() && take_key(*from_c(pool), key)) {
+        ratchet_key = &key;
+    }
+
+    std::uint8_t * output = reinterpret_cast<std::uint8_t *>(message);
+    std::uint8_t * raw_output = output + b64_length - raw_length;
+    std::size_t result = object.encrypt(
+        reinterpret_cast<std::uint8_t const *>(plaintext), plaintext_length,
+        ratchet_key,
+        raw_output, raw_length
+    );
+    olm::unset(key);
+    if (result == std::size_t(-1)) {
+        return result;
+    }
+    olm::encode_base64(raw_output, raw_length, output);
+    return record.succeeded(b64_length);
+}
+
+
+size_t olm_session_prepare_send_with_key_pool(
+    OlmSession * session,
+    OlmRatchetKeyPool * pool
+) {
+    olm::Session & object = *from_c(session);
+    _olm_curve25519_key_pair key;
+    _olm_curve25519_key_pair const * ratchet_key = nullptr;
+    if (object.encrypt_random_length() && take_key(*from_c(pool), key)) {
+        ratchet_key = &key;
+    }
+    std::size_t result = object.prepare_send(ratchet_key);
+    olm::unset(key);
+    return result;
+}
+
+}
@@ -20,31 +20,104 @@
 #include "olm/message.hh"
 #include "olm/pickle.hh"
 
+#include <algorithm>
 #include <cstring>
 
 namespace {
 
 static const std::uint8_t PROTOCOL_VERSION = 0x3;
 
-static const std::uint8_t ROOT_KDF_INFO[] = "OLM_ROOT";
-static const std::uint8_t RATCHET_KDF_INFO[] = "OLM_RATCHET";
-static const std::uint8_t CIPHER_KDF_INFO[] = "OLM_KEYS";
+/** Hash everything in the session that a delta pickle can change. The
+ * receiver chains are folded into the hash one at a time so that there can
+ * be any number of them. The skipped message keys are only counted: they
+ * change with the chain keys except when one is used, which shrinks the
+ * list. The skipped ranges are folded in too, if there are any, so that
+ * the hash of a session without them is as it always was. */
+static void state_hash(olm::Session const & session, std::uint8_t * hash) {
+    olm::Ratchet const & ratchet = session.ratchet;
+    std::uint8_t buffer[256];
+    std::uint8_t digest[SHA256_OUTPUT_LENGTH];
+    std::uint8_t * pos = buffer;
+    pos = olm::pickle(pos, session.received_message);
+    pos = olm::pickle(pos, session.alice_identity_key);
+    pos = olm::pickle(pos, session.alice_base_key);
+    pos = olm::pickle(pos, session.bob_one_time_key);
+    pos = olm::pickle_bytes(pos, ratchet.root_key, sizeof(ratchet.root_key));
+    pos = olm::pickle(pos, std::uint32_t(ratchet.sender_chain.size()));
+    for (auto const & chain : ratchet.sender_chain) {
+        pos = olm::pickle(pos, chain.ratchet_key.public_key);
+        pos = olm::pickle_bytes(
+            pos, chain.chain_key.key, sizeof(chain.chain_key.key)
+        );
+        pos = olm::pickle(pos, chain.chain_key.index);
+    }
+    pos = olm::pickle(pos, std::uint32_t(ratchet.receiver_chains.size()));
+    pos = olm::pickle(pos, std::uint32_t(ratchet.skipped_message_keys.size()));
+    _olm_crypto_sha256(buffer, pos - buffer, digest);
+    for (auto const & chain : ratchet.receiver_chains) {
+        pos = olm::store_array(buffer, digest);
+        pos = olm::pickle(pos, chain.ratchet_key);
+        pos = olm::pickle_bytes(
+            pos, chain.chain_key.key, sizeof(chain.chain_key.key)
+        );
+        pos = olm::pickle(pos, chain.chain_key.index);
+        _olm_crypto_sha256(buffer, pos - buffer, digest);
+    }
+    for (auto const & range : ratchet.skipped_ranges) {
+        pos = olm::store_array(buffer, digest);
+        pos = olm::pickle(pos, range.ratchet_key);
+        pos = olm::pickle_bytes(
+            pos, range.start.key, sizeof(range.start.key)
+        );
+        pos = olm::pickle(pos, range.start.index);
+        pos = olm::pickle(pos, range.end);
+        _olm_crypto_sha256(buffer, pos - buffer, digest);
+    }
+    std::memcpy(hash, digest, olm::SESSION_STATE_HASH_LENGTH);
+    olm::unset(buffer);
+    olm::unset(digest);
+}
 
-static const olm::KdfInfo OLM_KDF_INFO = {
-    ROOT_KDF_INFO, sizeof(ROOT_KDF_INFO) - 1,
-    RATCHET_KDF_INFO, sizeof(RATCHET_KDF_INFO) - 1
-};
+} // namespace
 
-static const struct _olm_cipher_aes_sha_256 OLM_CIPHER =
-    OLM_CIPHER_INIT_AES_SHA_256(CIPHER_KDF_INFO);
+olm::Session::Session(
+    olm::RatchetLimits const & limits, std::uint8_t * storage
+) : ratchet(olm::RatchetProtocol::OLM_V1, limits, storage),
+    skipped_key_allocator(nullptr),
+    last_error(OlmErrorCode::OLM_SUCCESS),
+    received_message(false),
+    keys_changed(true),
+    alice_identity_key(), alice_base_key(), bob_one_time_key(),
+    session_id_cached(false) {
+    state_hash(*this, pickled_state_hash);
+}
 
-} // namespace
 
 olm::Session::Session(
-) : ratchet(OLM_KDF_INFO, OLM_CIPHER_BASE(&OLM_CIPHER)),
+    olm::RatchetLimits const & limits, std::uint8_t * storage,
+    OlmAllocator const * skipped_key_allocator
+) : ratchet(olm::RatchetProtocol::OLM_V1, limits, storage, true),
+    skipped_key_allocator(skipped_key_allocator),
     last_error(OlmErrorCode::OLM_SUCCESS),
-    received_message(false) {
+    received_message(false),
+    keys_changed(true),
+    alice_identity_key(), alice_base_key(), bob_one_time_key(),
+    session_id_cached(false) {
+    state_hash(*this, pickled_state_hash);
+}
 
+
+std::size_t olm::Session::storage_length(
+    olm::RatchetLimits const & limits
+) {
+    return olm::Ratchet::storage_length(limits);
+}
+
+
+std::size_t olm::Session::compact_storage_length(
+    olm::RatchetLimits const & limits
+) {
+    return olm::Ratchet::receiver_chain_storage_length(limits);
 }
 
 
@@ -64,44 +137,107 @@ std::size_t olm::Session::new_outbound_session(
         return std::size_t(-1);
     }
 
-    _olm_curve25519_key_pair base_key;
-    _olm_crypto_curve25519_generate_key(random, &base_key);
+    Session * session = this;
+    new_outbound_sessions(
+        1, &session, local_account, &identity_key, &one_time_key, random
+    );
+    return std::size_t(0);
+}
 
-    _olm_curve25519_key_pair ratchet_key;
-    _olm_crypto_curve25519_generate_key(random + CURVE25519_RANDOM_LENGTH, &ratchet_key);
+
+void olm::Session::new_outbound_sessions(
+    std::size_t count, Session * const * sessions,
+    olm::Account const & local_account,
+    _olm_curve25519_public_key const * identity_keys,
+    _olm_curve25519_public_key const * one_time_keys,
+    std::uint8_t const * random
+) {
+    /* sessions per batch: each has two key pairs and three secrets */
+    static std::size_t const BATCH_LENGTH = 8;
+    static std::size_t const DH_COUNT = 3;
 
     _olm_curve25519_key_pair const & alice_identity_key_pair = (
         local_account.identity_keys.curve25519_key
     );
 
-    received_message = false;
-    alice_identity_key = alice_identity_key_pair.public_key;
-    alice_base_key = base_key.public_key;
-    bob_one_time_key = one_time_key;
-
-    // Calculate the shared secret S via triple DH
-    std::uint8_t secret[3 * CURVE25519_SHARED_SECRET_LENGTH];
-    std::uint8_t * pos = secret;
+    /* each session's random bytes are its base key then its ratchet key,
+     * so generating them all at once gives the same keys as one at a time */
+    _olm_curve25519_key_pair keys[2 * BATCH_LENGTH];
+    _olm_curve25519_key_pair const * our_keys[DH_COUNT * BATCH_LENGTH];
+    _olm_curve25519_public_key const * their_keys[DH_COUNT * BATCH_LENGTH];
+    std::uint8_t secrets[
+        BATCH_LENGTH * DH_COUNT * CURVE25519_SHARED_SECRET_LENGTH
+    ];
+
+    while (count) {
+        std::size_t n = std::min(count, BATCH_LENGTH);
+        _olm_crypto_curve25519_generate_keys(2 * n, random, keys);
+
+        // Calculate each shared secret S via triple DH
+        for (std::size_t i = 0; i < n; ++i) {
+            _olm_curve25519_key_pair const & base_key = keys[2 * i];
+            our_keys[DH_COUNT * i] = &alice_identity_key_pair;
+            their_keys[DH_COUNT * i] = &one_time_keys[i];
+            our_keys[DH_COUNT * i + 1] = &base_key;
+            their_keys[DH_COUNT * i + 1] = &identity_keys[i];
+            our_keys[DH_COUNT * i + 2] = &base_key;
+            their_keys[DH_COUNT * i + 2] = &one_time_keys[i];
+        }
+        _olm_crypto_curve25519_shared_secrets(
+            DH_COUNT * n, our_keys, their_keys, secrets
+        );
 
-    _olm_crypto_curve25519_shared_secret(&alice_identity_key_pair, &one_time_key, pos);
-    pos += CURVE25519_SHARED_SECRET_LENGTH;
-    _olm_crypto_curve25519_shared_secret(&base_key, &identity_key, pos);
-    pos += CURVE25519_SHARED_SECRET_LENGTH;
-    _olm_crypto_curve25519_shared_secret(&base_key, &one_time_key, pos);
+        for (std::size_t i = 0; i < n; ++i) {
+            Session & session = *sessions[i];
+            std::uint8_t const * secret = (
+                secrets + i * DH_COUNT * CURVE25519_SHARED_SECRET_LENGTH
+            );
+            session.received_message = false;
+            session.alice_identity_key = alice_identity_key_pair.public_key;
+            session.alice_base_key = keys[2 * i].public_key;
+            session.bob_one_time_key = one_time_keys[i];
+            session.session_id_cached = false;
+            session.keys_changed = true;
+            session.ratchet.initialise_as_alice(
+                secret, DH_COUNT * CURVE25519_SHARED_SECRET_LENGTH,
+                keys[2 * i + 1]
+            );
+        }
 
-    ratchet.initialise_as_alice(secret, sizeof(secret), ratchet_key);
+        sessions += n;
+        identity_keys += n;
+        one_time_keys += n;
+        random += 2 * n * CURVE25519_RANDOM_LENGTH;
+        count -= n;
+    }
 
-    olm::unset(base_key);
-    olm::unset(ratchet_key);
-    olm::unset(secret);
+    olm::unset(keys);
+    olm::unset(secrets);
+}
 
-    return std::size_t(0);
+std::size_t olm::Session::new_outbound_message_length(
+    std::size_t plaintext_length
+) {
+    /* the first chain key and the first message key both have index 0 */
+    _olm_cipher const * cipher =
+        olm::protocol_cipher(olm::RatchetProtocol::OLM_V1);
+    std::size_t message_length = olm::encode_message_length(
+        0, CURVE25519_KEY_LENGTH,
+        _olm_cipher_encrypt_ciphertext_length(cipher, plaintext_length),
+        _olm_cipher_mac_length(cipher)
+    );
+    return encode_one_time_key_message_length(
+        CURVE25519_KEY_LENGTH,
+        CURVE25519_KEY_LENGTH,
+        CURVE25519_KEY_LENGTH,
+        message_length
+    );
 }
 
 namespace {
 
 static bool check_message_fields(
-    olm::PreKeyMessageReader & reader, bool have_their_identity_key
+    olm::PreKeyMessageReader const & reader, bool have_their_identity_key
 ) {
     bool ok = true;
     ok = ok && (have_their_identity_key || reader.identity_key);
@@ -119,15 +255,45 @@ static bool check_message_fields(
 } // namespace
 
 
+void olm::Session::decode_message_view(
+    olm::MessageView & view, olm::MessageType message_type,
+    std::uint8_t const * message, std::size_t message_length
+) {
+    view.type = message_type;
+    if (message_type == olm::MessageType::PRE_KEY) {
+        decode_one_time_key_message(view.pre_key, message, message_length);
+        message = view.pre_key.message;
+        message_length = view.pre_key.message_length;
+    }
+    decode_message(
+        view.message, message, message_length,
+        _olm_cipher_aes_sha_256_mac_length()
+    );
+}
+
+
 std::size_t olm::Session::new_inbound_session(
     olm::Account & local_account,
     _olm_curve25519_public_key const * their_identity_key,
     std::uint8_t const * one_time_key_message, std::size_t message_length
 ) {
-    olm::PreKeyMessageReader reader;
-    decode_one_time_key_message(reader, one_time_key_message, message_length);
+    olm::MessageView view;
+    decode_message_view(
+        view, olm::MessageType::PRE_KEY, one_time_key_message, message_length
+    );
+    return new_inbound_session(local_account, their_identity_key, view);
+}
+
+
+std::size_t olm::Session::new_inbound_session(
+    olm::Account & local_account,
+    _olm_curve25519_public_key const * their_identity_key,
+    olm::MessageView const & view
+) {
+    olm::PreKeyMessageReader const & reader = view.pre_key;
 
-    if (!check_message_fields(reader, their_identity_key)) {
+    if (view.type != olm::MessageType::PRE_KEY
+            || !check_message_fields(reader, their_identity_key)) {
         last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
         return std::size_t(-1);
     }
@@ -145,12 +311,10 @@ std::size_t olm::Session::new_inbound_session(
     olm::load_array(alice_identity_key.public_key, reader.identity_key);
     olm::load_array(alice_base_key.public_key, reader.base_key);
     olm::load_array(bob_one_time_key.public_key, reader.one_time_key);
+    session_id_cached = false;
+    keys_changed = true;
 
-    olm::MessageReader message_reader;
-    decode_message(
-        message_reader, reader.message, reader.message_length,
-        ratchet.ratchet_cipher->ops->mac_length(ratchet.ratchet_cipher)
-    );
+    olm::MessageReader const & message_reader = view.message;
 
     if (!message_reader.ratchet_key
             || message_reader.ratchet_key_length != CURVE25519_KEY_LENGTH) {
@@ -166,7 +330,9 @@ std::size_t olm::Session::new_inbound_session(
     );
 
     if (!our_one_time_key) {
-        last_error = OlmErrorCode::OLM_BAD_MESSAGE_KEY_ID;
+        last_error = local_account.identity_keys_only
+            ? OlmErrorCode::OLM_PARTIAL_ACCOUNT
+            : OlmErrorCode::OLM_BAD_MESSAGE_KEY_ID;
         return std::size_t(-1);
     }
 
@@ -175,14 +341,15 @@ std::size_t olm::Session::new_inbound_session(
     );
     _olm_curve25519_key_pair const & bob_one_time_key = our_one_time_key->key;
 
-    // Calculate the shared secret S via triple DH
+    // Calculate the shared secret S via triple DH, the three side by side
     std::uint8_t secret[CURVE25519_SHARED_SECRET_LENGTH * 3];
-    std::uint8_t * pos = secret;
-    _olm_crypto_curve25519_shared_secret(&bob_one_time_key, &alice_identity_key, pos);
-    pos += CURVE25519_SHARED_SECRET_LENGTH;
-    _olm_crypto_curve25519_shared_secret(&bob_identity_key, &alice_base_key, pos);
-    pos += CURVE25519_SHARED_SECRET_LENGTH;
-    _olm_crypto_curve25519_shared_secret(&bob_one_time_key, &alice_base_key, pos);
+    _olm_curve25519_key_pair const * our_keys[3] = {
+        &bob_one_time_key, &bob_identity_key, &bob_one_time_key
+    };
+    _olm_curve25519_public_key const * their_keys[3] = {
+        &alice_identity_key, &alice_base_key, &alice_base_key
+    };
+    _olm_crypto_curve25519_shared_secrets(3, our_keys, their_keys, secret);
 
     ratchet.initialise_as_bob(secret, sizeof(secret), ratchet_key);
 
@@ -204,12 +371,16 @@ std::size_t olm::Session::session_id(
         last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
         return std::size_t(-1);
     }
-    std::uint8_t tmp[CURVE25519_KEY_LENGTH * 3];
-    std::uint8_t * pos = tmp;
-    pos = olm::store_array(pos, alice_identity_key.public_key);
-    pos = olm::store_array(pos, alice_base_key.public_key);
-    pos = olm::store_array(pos, bob_one_time_key.public_key);
-    _olm_crypto_sha256(tmp, sizeof(tmp), id);
+    if (!session_id_cached) {
+        std::uint8_t tmp[CURVE25519_KEY_LENGTH * 3];
+        std::uint8_t * pos = tmp;
+        pos = olm::store_array(pos, alice_identity_key.public_key);
+        pos = olm::store_array(pos, alice_base_key.public_key);
+        pos = olm::store_array(pos, bob_one_time_key.public_key);
+        _olm_crypto_sha256(tmp, sizeof(tmp), cached_session_id);
+        session_id_cached = true;
+    }
+    olm::store_array(id, cached_session_id);
     return session_id_length();
 }
 
@@ -218,10 +389,23 @@ bool olm::Session::matches_inbound_session(
     _olm_curve25519_public_key const * their_identity_key,
     std::uint8_t const * one_time_key_message, std::size_t message_length
 ) {
-    olm::PreKeyMessageReader reader;
-    decode_one_time_key_message(reader, one_time_key_message, message_length);
+    olm::MessageView view;
+    view.type = olm::MessageType::PRE_KEY;
+    decode_one_time_key_message(
+        view.pre_key, one_time_key_message, message_length
+    );
+    return matches_inbound_session(their_identity_key, view);
+}
 
-    if (!check_message_fields(reader, their_identity_key)) {
+
+bool olm::Session::matches_inbound_session(
+    _olm_curve25519_public_key const * their_identity_key,
+    olm::MessageView const & view
+) {
+    olm::PreKeyMessageReader const & reader = view.pre_key;
+
+    if (view.type != olm::MessageType::PRE_KEY
+            || !check_message_fields(reader, their_identity_key)) {
         return false;
     }
 
@@ -247,6 +431,32 @@ bool olm::Session::matches_inbound_session(
 }
 
 
+bool olm::Session::message_route(
+    olm::MessageView const & view, std::uint8_t * route
+) {
+    olm::PreKeyMessageReader const & reader = view.pre_key;
+    if (view.type != olm::MessageType::PRE_KEY
+            || !check_message_fields(reader, false)) {
+        return false;
+    }
+    std::memcpy(route, reader.identity_key, CURVE25519_KEY_LENGTH);
+    route += CURVE25519_KEY_LENGTH;
+    std::memcpy(route, reader.base_key, CURVE25519_KEY_LENGTH);
+    route += CURVE25519_KEY_LENGTH;
+    std::memcpy(route, reader.one_time_key, CURVE25519_KEY_LENGTH);
+    return true;
+}
+
+
+void olm::Session::route(std::uint8_t * route) const {
+    std::memcpy(route, alice_identity_key.public_key, CURVE25519_KEY_LENGTH);
+    route += CURVE25519_KEY_LENGTH;
+    std::memcpy(route, alice_base_key.public_key, CURVE25519_KEY_LENGTH);
+    route += CURVE25519_KEY_LENGTH;
+    std::memcpy(route, bob_one_time_key.public_key, CURVE25519_KEY_LENGTH);
+}
+
+
 olm::MessageType olm::Session::encrypt_message_type() {
     if (received_message) {
         return olm::MessageType::MESSAGE;
@@ -257,10 +467,10 @@ olm::MessageType olm::Session::encrypt_message_type() {
 
 
 std::size_t olm::Session::encrypt_message_length(
-    std::size_t plaintext_length
+    std::size_t plaintext_length, std::uint32_t ahead
 ) {
     std::size_t message_length = ratchet.encrypt_output_length(
-        plaintext_length
+        plaintext_length, ahead
     );
 
     if (received_message) {
@@ -290,33 +500,44 @@ std::size_t olm::Session::encrypt(
         last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
         return std::size_t(-1);
     }
-    std::uint8_t * message_body;
-    std::size_t message_body_length = ratchet.encrypt_output_length(
-        plaintext_length
+    if (random_length < encrypt_random_length()) {
+        last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
+        return std::size_t(-1);
+    }
+    if (encrypt_random_length() == 0) {
+        return encrypt(
+            plaintext, plaintext_length, nullptr, message, message_length
+        );
+    }
+    _olm_curve25519_key_pair ratchet_key;
+    _olm_crypto_curve25519_generate_key(random, &ratchet_key);
+    std::size_t result = encrypt(
+        plaintext, plaintext_length, &ratchet_key, message, message_length
     );
+    olm::unset(ratchet_key);
+    return result;
+}
 
-    if (received_message) {
-        message_body = message;
-    } else {
-        olm::PreKeyMessageWriter writer;
-        encode_one_time_key_message(
-            writer,
-            PROTOCOL_VERSION,
-            CURVE25519_KEY_LENGTH,
-            CURVE25519_KEY_LENGTH,
-            CURVE25519_KEY_LENGTH,
-            message_body_length,
-            message
-        );
-        olm::store_array(writer.one_time_key, bob_one_time_key.public_key);
-        olm::store_array(writer.identity_key, alice_identity_key.public_key);
-        olm::store_array(writer.base_key, alice_base_key.public_key);
-        message_body = writer.message;
+
+std::size_t olm::Session::encrypt(
+    std::uint8_t const * plaintext, std::size_t plaintext_length,
+    _olm_curve25519_key_pair const * ratchet_key,
+    std::uint8_t * message, std::size_t message_length
+) {
+    if (message_length < encrypt_message_length(plaintext_length)) {
+        last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
     }
+    std::size_t message_body_length = ratchet.encrypt_output_length(
+        plaintext_length
+    );
+    std::uint8_t * message_body = encrypt_message_header(
+        message_body_length, message
+    );
 
     std::size_t result = ratchet.encrypt(
         plaintext, plaintext_length,
-        random, random_length,
+        ratchet_key,
         message_body, message_body_length
     );
 
@@ -330,29 +551,108 @@ std::size_t olm::Session::encrypt(
 }
 
 
+std::size_t olm::Session::encrypt_with_keys(
+    std::uint8_t const * plaintext, std::size_t plaintext_length,
+    olm::Ratchet::SendKeys const & keys,
+    std::uint8_t * message, std::size_t message_length
+) {
+    if (message_length < encrypt_message_length(plaintext_length)) {
+        last_error = OlmErrorCode::OLM_OUTPUT_BUFFER_TOO_SMALL;
+        return std::size_t(-1);
+    }
+    std::size_t message_body_length = ratchet.encrypt_output_length(
+        plaintext_length
+    );
+    std::uint8_t * message_body = encrypt_message_header(
+        message_body_length, message
+    );
+
+    std::size_t result = ratchet.encrypt_with_keys(
+        plaintext, plaintext_length,
+        keys,
+        message_body, message_body_length
+    );
+
+    if (result == std::size_t(-1)) {
+        last_error = ratchet.last_error;
+        ratchet.last_error = OlmErrorCode::OLM_SUCCESS;
+    }
+    return result;
+}
+
+
+std::uint8_t * olm::Session::encrypt_message_header(
+    std::size_t message_body_length, std::uint8_t * message
+) {
+    if (received_message) {
+        return message;
+    }
+    olm::PreKeyMessageWriter writer;
+    encode_one_time_key_message(
+        writer,
+        PROTOCOL_VERSION,
+        CURVE25519_KEY_LENGTH,
+        CURVE25519_KEY_LENGTH,
+        CURVE25519_KEY_LENGTH,
+        message_body_length,
+        message
+    );
+    olm::store_array(writer.one_time_key, bob_one_time_key.public_key);
+    olm::store_array(writer.identity_key, alice_identity_key.public_key);
+    olm::store_array(writer.base_key, alice_base_key.public_key);
+    return writer.message;
+}
+
+
+std::size_t olm::Session::prepare_send(
+    std::uint8_t const * random, std::size_t random_length
+) {
+    if (random_length < encrypt_random_length()) {
+        last_error = OlmErrorCode::OLM_NOT_ENOUGH_RANDOM;
+        return std::size_t(-1);
+    }
+    if (encrypt_random_length() == 0) {
+        return 0;
+    }
+    _olm_curve25519_key_pair ratchet_key;
+    _olm_crypto_curve25519_generate_key(random, &ratchet_key);
+    std::size_t result = prepare_send(&ratchet_key);
+    olm::unset(ratchet_key);
+    return result;
+}
+
+
+std::size_t olm::Session::prepare_send(
+    _olm_curve25519_key_pair const * ratchet_key
+) {
+    std::size_t result = ratchet.prepare_send(ratchet_key);
+    if (result == std::size_t(-1)) {
+        last_error = ratchet.last_error;
+        ratchet.last_error = OlmErrorCode::OLM_SUCCESS;
+    }
+    return result;
+}
+
+
 std::size_t olm::Session::decrypt_max_plaintext_length(
     MessageType message_type,
     std::uint8_t const * message, std::size_t message_length
 ) {
-    std::uint8_t const * message_body;
-    std::size_t message_body_length;
-    if (message_type == olm::MessageType::MESSAGE) {
-        message_body = message;
-        message_body_length = message_length;
-    } else {
-        olm::PreKeyMessageReader reader;
-        decode_one_time_key_message(reader, message, message_length);
-        if (!reader.message) {
-            last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
-            return std::size_t(-1);
-        }
-        message_body = reader.message;
-        message_body_length = reader.message_length;
+    olm::MessageView view;
+    decode_message_view(view, message_type, message, message_length);
+    return decrypt_max_plaintext_length(view);
+}
+
+
+std::size_t olm::Session::decrypt_max_plaintext_length(
+    olm::MessageView const & view
+) {
+    if (view.type != olm::MessageType::MESSAGE && !view.pre_key.message) {
+        last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
+        return std::size_t(-1);
     }
 
-    std::size_t result = ratchet.decrypt_max_plaintext_length(
-        message_body, message_body_length
-    );
+    std::size_t result = ratchet.decrypt_max_plaintext_length(view.message);
 
     if (result == std::size_t(-1)) {
         last_error = ratchet.last_error;
@@ -362,29 +662,60 @@ std::size_t olm::Session::decrypt_max_plaintext_length(
 }
 
 
+std::size_t olm::Session::peek_max_plaintext_length(
+    MessageType message_type,
+    std::uint8_t const * message, std::size_t message_length
+) {
+    _olm_cipher const * cipher = ratchet.ratchet_cipher();
+    _OlmPeekMessageResults results;
+    if (message_type == olm::MessageType::MESSAGE) {
+        olm::peek_message(
+            results, message, message_length, _olm_cipher_mac_length(cipher)
+        );
+    } else {
+        olm::peek_one_time_key_message(
+            results, message, message_length, _olm_cipher_mac_length(cipher)
+        );
+    }
+
+    if (!results.has_ciphertext) {
+        last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
+        return std::size_t(-1);
+    }
+
+    if (results.version != PROTOCOL_VERSION) {
+        last_error = OlmErrorCode::OLM_BAD_MESSAGE_VERSION;
+        return std::size_t(-1);
+    }
+
+    return _olm_cipher_decrypt_max_plaintext_length(
+        cipher, results.ciphertext_length
+    );
+}
+
+
 std::size_t olm::Session::decrypt(
     olm::MessageType message_type,
     std::uint8_t const * message, std::size_t message_length,
     std::uint8_t * plaintext, std::size_t max_plaintext_length
 ) {
-    std::uint8_t const * message_body;
-    std::size_t message_body_length;
-    if (message_type == olm::MessageType::MESSAGE) {
-        message_body = message;
-        message_body_length = message_length;
-    } else {
-        olm::PreKeyMessageReader reader;
-        decode_one_time_key_message(reader, message, message_length);
-        if (!reader.message) {
-            last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
-            return std::size_t(-1);
-        }
-        message_body = reader.message;
-        message_body_length = reader.message_length;
+    olm::MessageView view;
+    decode_message_view(view, message_type, message, message_length);
+    return decrypt(view, plaintext, max_plaintext_length);
+}
+
+
+std::size_t olm::Session::decrypt(
+    olm::MessageView const & view,
+    std::uint8_t * plaintext, std::size_t max_plaintext_length
+) {
+    if (view.type != olm::MessageType::MESSAGE && !view.pre_key.message) {
+        last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
+        return std::size_t(-1);
     }
 
     std::size_t result = ratchet.decrypt(
-        message_body, message_body_length, plaintext, max_plaintext_length
+        view.message, plaintext, max_plaintext_length, skipped_key_allocator
     );
 
     if (result == std::size_t(-1)) {
@@ -397,22 +728,96 @@ std::size_t olm::Session::decrypt(
     return result;
 }
 
+
+std::size_t olm::Session::try_decrypt(
+    olm::MessageView const & view,
+    std::uint8_t * plaintext, std::size_t max_plaintext_length,
+    olm::DecryptTrial & trial
+) const {
+    if (view.type != olm::MessageType::MESSAGE && !view.pre_key.message) {
+        trial.kind = olm::DecryptTrialKind::NONE;
+        trial.last_error = OlmErrorCode::OLM_BAD_MESSAGE_FORMAT;
+        return std::size_t(-1);
+    }
+    return ratchet.try_decrypt(
+        view.message, plaintext, max_plaintext_length, trial
+    );
+}
+
+
+bool olm::Session::commit_decrypt(
+    olm::DecryptTrial & trial
+) {
+    if (!ratchet.commit_decrypt(trial, skipped_key_allocator)) {
+        last_error = ratchet.last_error;
+        ratchet.last_error = OlmErrorCode::OLM_SUCCESS;
+        return false;
+    }
+    received_message = true;
+    return true;
+}
+
 namespace {
 // the master branch writes pickle version 1; the logging_enabled branch writes
-// 0x80000001.
+// 0x80000001. Version 2 adds the ratchet limits after the version, and is
+// only written for sessions that don't use the default limits so that their
+// pickles can still be read by older versions of the library. Version 3 adds
+// the skipped ranges after the ratchet, and is likewise only written for
+// sessions that have some.
 static const std::uint32_t SESSION_PICKLE_VERSION = 1;
+static const std::uint32_t SESSION_PICKLE_VERSION_WITH_LIMITS = 2;
+static const std::uint32_t SESSION_PICKLE_VERSION_WITH_RANGES = 3;
+
+static bool has_default_limits(olm::Session const & value) {
+    olm::RatchetLimits const & limits = value.ratchet.limits;
+    return limits.max_receiver_chains == olm::MAX_RECEIVER_CHAINS
+        && limits.max_skipped_message_keys == olm::MAX_SKIPPED_MESSAGE_KEYS
+        && limits.max_message_gap == olm::MAX_MESSAGE_GAP;
+}
+
+static std::uint32_t pickle_version(olm::Session const & value) {
+    if (!value.ratchet.skipped_ranges.empty()) {
+        return SESSION_PICKLE_VERSION_WITH_RANGES;
+    }
+    return has_default_limits(value)
+        ? SESSION_PICKLE_VERSION : SESSION_PICKLE_VERSION_WITH_LIMITS;
+}
 }
 
 std::size_t olm::pickle_length(
     Session const & value
 ) {
     std::size_t length = 0;
-    length += olm::pickle_length(SESSION_PICKLE_VERSION);
+    std::uint32_t version = pickle_version(value);
+    length += olm::pickle_length(version);
+    if (version != SESSION_PICKLE_VERSION) {
+        length += olm::pickle_length(value.ratchet.limits.max_receiver_chains);
+        length += olm::pickle_length(value.ratchet.limits.max_skipped_message_keys);
+        length += olm::pickle_length(value.ratchet.limits.max_message_gap);
+    }
     length += olm::pickle_length(value.received_message);
     length += olm::pickle_length(value.alice_identity_key);
     length += olm::pickle_length(value.alice_base_key);
     length += olm::pickle_length(value.bob_one_time_key);
     length += olm::pickle_length(value.ratchet);
+    if (version == SESSION_PICKLE_VERSION_WITH_RANGES) {
+        length += olm::pickle_skipped_ranges_length(value.ratchet);
+    }
+    return length;
+}
+
+
+std::size_t olm::max_pickle_length(
+    Session const & value
+) {
+    std::size_t length = 0;
+    length += olm::pickle_length(SESSION_PICKLE_VERSION);
+    length += 3 * olm::pickle_length(std::uint32_t(0));
+    length += olm::pickle_length(value.received_message);
+    length += olm::pickle_length(value.alice_identity_key);
+    length += olm::pickle_length(value.alice_base_key);
+    length += olm::pickle_length(value.bob_one_time_key);
+    length += olm::max_pickle_length(value.ratchet);
     return length;
 }
 
@@ -421,16 +826,50 @@ std::uint8_t * olm::pickle(
     std::uint8_t * pos,
     Session const & value
 ) {
-    pos = olm::pickle(pos, SESSION_PICKLE_VERSION);
+    std::uint32_t version = pickle_version(value);
+    pos = olm::pickle(pos, version);
+    if (version != SESSION_PICKLE_VERSION) {
+        pos = olm::pickle(pos, value.ratchet.limits.max_receiver_chains);
+        pos = olm::pickle(pos, value.ratchet.limits.max_skipped_message_keys);
+        pos = olm::pickle(pos, value.ratchet.limits.max_message_gap);
+    }
     pos = olm::pickle(pos, value.received_message);
     pos = olm::pickle(pos, value.alice_identity_key);
     pos = olm::pickle(pos, value.alice_base_key);
     pos = olm::pickle(pos, value.bob_one_time_key);
     pos = olm::pickle(pos, value.ratchet);
+    if (version == SESSION_PICKLE_VERSION_WITH_RANGES) {
+        pos = olm::pickle_skipped_ranges(pos, value.ratchet);
+    }
     return pos;
 }
 
 
+void olm::Session::forget_changes() {
+    keys_changed = false;
+    ratchet.forget_changes();
+    state_hash(*this, pickled_state_hash);
+}
+
+
+bool olm::Session::copy_from(olm::Session const & other) {
+    if (!ratchet.copy_from(other.ratchet, skipped_key_allocator)) {
+        last_error = ratchet.last_error;
+        return false;
+    }
+    last_error = other.last_error;
+    received_message = other.received_message;
+    keys_changed = other.keys_changed;
+    alice_identity_key = other.alice_identity_key;
+    alice_base_key = other.alice_base_key;
+    bob_one_time_key = other.bob_one_time_key;
+    session_id_cached = other.session_id_cached;
+    olm::load_array(cached_session_id, other.cached_session_id);
+    olm::load_array(pickled_state_hash, other.pickled_state_hash);
+    return true;
+}
+
+
 std::uint8_t const * olm::unpickle(
     std::uint8_t const * pos, std::uint8_t const * end,
     Session & value
@@ -444,6 +883,26 @@ std::uint8_t const * olm::unpickle(
             includes_chain_index = false;
             break;
 
+        case 2:
+        case 3: {
+            includes_chain_index = false;
+            olm::RatchetLimits limits;
+            pos = olm::unpickle(pos, end, limits.max_receiver_chains);
+            pos = olm::unpickle(pos, end, limits.max_skipped_message_keys);
+            pos = olm::unpickle(pos, end, limits.max_message_gap);
+            /* The session keeps the room it was created with, but it must
+             * be able to hold everything the pickled session could. */
+            if (limits.max_receiver_chains
+                    > value.ratchet.receiver_chains.capacity()
+                || limits.max_skipped_message_keys
+                    > value.ratchet.skipped_message_key_capacity()) {
+                value.last_error = OlmErrorCode::OLM_SESSION_TOO_SMALL;
+                return end;
+            }
+            value.ratchet.limits.max_message_gap = limits.max_message_gap;
+            break;
+        }
+
         case 0x80000001UL:
             includes_chain_index = true;
             break;
@@ -457,6 +916,131 @@ std::uint8_t const * olm::unpickle(
     pos = olm::unpickle(pos, end, value.alice_identity_key);
     pos = olm::unpickle(pos, end, value.alice_base_key);
     pos = olm::unpickle(pos, end, value.bob_one_time_key);
-    pos = olm::unpickle(pos, end, value.ratchet, includes_chain_index);
+    value.session_id_cached = false;
+    pos = olm::unpickle(
+        pos, end, value.ratchet, includes_chain_index,
+        value.skipped_key_allocator
+    );
+    if (pickle_version == SESSION_PICKLE_VERSION_WITH_RANGES) {
+        pos = olm::unpickle_skipped_ranges(pos, end, value.ratchet);
+    }
+    if (value.ratchet.last_error != OlmErrorCode::OLM_SUCCESS) {
+        value.last_error = value.ratchet.last_error;
+        value.ratchet.last_error = OlmErrorCode::OLM_SUCCESS;
+    }
+    return pos;
+}
+
+
+namespace {
+// delta pickles have their own version numbers, well away from those of
+// session pickles so that one can't be read as the other. Version 2 ends
+// with the skipped ranges, and is only written when they have changed.
+static const std::uint32_t SESSION_DELTA_VERSION = 0x64000001;
+static const std::uint32_t SESSION_DELTA_VERSION_WITH_RANGES = 0x64000002;
+
+static std::uint32_t delta_version(olm::Session const & value) {
+    return value.ratchet.changes.skipped_ranges
+        ? SESSION_DELTA_VERSION_WITH_RANGES : SESSION_DELTA_VERSION;
+}
+}
+
+std::size_t olm::pickle_delta_length(
+    Session const & value
+) {
+    std::size_t length = 0;
+    length += olm::pickle_length(SESSION_DELTA_VERSION);
+    length += 2 * olm::SESSION_STATE_HASH_LENGTH;
+    length += olm::pickle_length(value.received_message);
+    length += olm::pickle_length(value.keys_changed);
+    if (value.keys_changed) {
+        length += olm::pickle_length(value.alice_identity_key);
+        length += olm::pickle_length(value.alice_base_key);
+        length += olm::pickle_length(value.bob_one_time_key);
+    }
+    length += olm::pickle_delta_length(value.ratchet);
+    if (value.ratchet.changes.skipped_ranges) {
+        length += olm::pickle_skipped_ranges_length(value.ratchet);
+    }
+    return length;
+}
+
+
+std::uint8_t * olm::pickle_delta(
+    std::uint8_t * pos,
+    Session const & value
+) {
+    std::uint8_t current_hash[olm::SESSION_STATE_HASH_LENGTH];
+    state_hash(value, current_hash);
+    pos = olm::pickle(pos, delta_version(value));
+    pos = olm::pickle_bytes(
+        pos, value.pickled_state_hash, sizeof(value.pickled_state_hash)
+    );
+    pos = olm::pickle_bytes(pos, current_hash, sizeof(current_hash));
+    pos = olm::pickle(pos, value.received_message);
+    pos = olm::pickle(pos, value.keys_changed);
+    if (value.keys_changed) {
+        pos = olm::pickle(pos, value.alice_identity_key);
+        pos = olm::pickle(pos, value.alice_base_key);
+        pos = olm::pickle(pos, value.bob_one_time_key);
+    }
+    pos = olm::pickle_delta(pos, value.ratchet);
+    if (value.ratchet.changes.skipped_ranges) {
+        pos = olm::pickle_skipped_ranges(pos, value.ratchet);
+    }
+    return pos;
+}
+
+
+std::uint8_t const * olm::unpickle_delta(
+    std::uint8_t const * pos, std::uint8_t const * end,
+    Session & value
+) {
+    std::uint32_t version;
+    std::uint8_t base_hash[olm::SESSION_STATE_HASH_LENGTH];
+    std::uint8_t result_hash[olm::SESSION_STATE_HASH_LENGTH];
+    std::uint8_t current_hash[olm::SESSION_STATE_HASH_LENGTH];
+
+    pos = olm::unpickle(pos, end, version);
+    if (version != SESSION_DELTA_VERSION
+            && version != SESSION_DELTA_VERSION_WITH_RANGES) {
+        value.last_error = OlmErrorCode::OLM_UNKNOWN_PICKLE_VERSION;
+        return end;
+    }
+    pos = olm::unpickle_bytes(pos, end, base_hash, sizeof(base_hash));
+    pos = olm::unpickle_bytes(pos, end, result_hash, sizeof(result_hash));
+    state_hash(value, current_hash);
+    if (std::memcmp(base_hash, current_hash, sizeof(current_hash))) {
+        value.last_error = OlmErrorCode::OLM_SESSION_DELTA_MISMATCH;
+        return end;
+    }
+
+    bool keys_changed;
+    pos = olm::unpickle(pos, end, value.received_message);
+    pos = olm::unpickle(pos, end, keys_changed);
+    if (keys_changed) {
+        pos = olm::unpickle(pos, end, value.alice_identity_key);
+        pos = olm::unpickle(pos, end, value.alice_base_key);
+        pos = olm::unpickle(pos, end, value.bob_one_time_key);
+        value.session_id_cached = false;
+    }
+    pos = olm::unpickle_delta(
+        pos, end, value.ratchet, value.skipped_key_allocator
+    );
+    if (version == SESSION_DELTA_VERSION_WITH_RANGES) {
+        pos = olm::unpickle_skipped_ranges(pos, end, value.ratchet);
+    }
+    if (value.ratchet.last_error != OlmErrorCode::OLM_SUCCESS) {
+        value.last_error = value.ratchet.last_error;
+        value.ratchet.last_error = OlmErrorCode::OLM_SUCCESS;
+        return end;
+    }
+
+    /* Check that applying the delta got us to the same state */
+    state_hash(value, current_hash);
+    if (std::memcmp(result_hash, current_hash, sizeof(current_hash))) {
+        return end;
+    }
+    value.ratchet.dirty = false;
     return pos;
 }
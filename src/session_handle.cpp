@@ -0,0 +1,194 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/session_handle.h"
+#include "olm/error.h"
+#include "olm/memory.hh"
+#include "olm/session.hh"
+
+#include <chrono>
+
+namespace {
+
+static const std::uint32_t DEFAULT_IDLE_TIMEOUT = 60000;
+
+struct SessionHandle {
+    OlmPickleKey const * pickle_key;
+    std::uint32_t cipher;
+    OlmAllocator const * allocator;
+    std::uint8_t * pickled;
+    /** the length of the pickle while sealed */
+    std::size_t pickled_length;
+    std::size_t pickled_capacity;
+    /** the unpickled session, or NULL while sealed */
+    OlmSession * session;
+    /** when the session was last asked for, in milliseconds */
+    std::uint64_t last_used;
+    std::uint32_t idle_timeout;
+    OlmErrorCode last_error;
+};
+
+static SessionHandle * from_c(OlmSessionHandle * handle) {
+    return reinterpret_cast<SessionHandle *>(handle);
+}
+
+static SessionHandle const * from_c(OlmSessionHandle const * handle) {
+    return reinterpret_cast<SessionHandle const *>(handle);
+}
+
+static OlmErrorCode session_error(OlmSession * session) {
+    return reinterpret_cast<olm::Session *>(session)->last_error;
+}
+
+static std::uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+} // namespace
+
+
+extern "C" {
+
+size_t olm_session_handle_size(void) {
+    return sizeof(SessionHandle);
+}
+
+
+OlmSessionHandle * olm_session_handle(
+    void * memory,
+    OlmPickleKey const * pickle_key, uint32_t cipher,
+    const OlmAllocator * allocator,
+    void * pickled, size_t pickled_length, size_t pickled_capacity
+) {
+    SessionHandle * handle = static_cast<SessionHandle *>(memory);
+    handle->pickle_key = pickle_key;
+    handle->cipher = cipher;
+    handle->allocator = allocator;
+    handle->pickled = static_cast<std::uint8_t *>(pickled);
+    handle->pickled_length = pickled_length;
+    handle->pickled_capacity = pickled_capacity;
+    handle->session = nullptr;
+    handle->last_used = 0;
+    handle->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    handle->last_error = OlmErrorCode::OLM_SUCCESS;
+    return reinterpret_cast<OlmSessionHandle *>(handle);
+}
+
+
+OlmSession * olm_session_handle_get(
+    OlmSessionHandle * handle
+) {
+    SessionHandle & object = *from_c(handle);
+    if (!object.session) {
+        if (!object.pickled_length) {
+            /* an earlier unpickling failed, and took the pickle with it */
+            return nullptr;
+        }
+        OlmSession * session = olm_allocate_session(object.allocator);
+        if (!session) {
+            object.last_error = OlmErrorCode::OLM_ALLOCATION_FAILED;
+            return nullptr;
+        }
+        std::size_t length = object.pickled_length;
+        object.pickled_length = 0;
+        if (olm_unpickle_session_with_key(
+                session, object.pickle_key, object.pickled, length
+            ) == std::size_t(-1)) {
+            object.last_error = session_error(session);
+            olm_release_session(object.allocator, session);
+            return nullptr;
+        }
+        object.session = session;
+    }
+    object.last_used = now();
+    return object.session;
+}
+
+
+int olm_session_handle_is_sealed(
+    const OlmSessionHandle * handle
+) {
+    return from_c(handle)->session == nullptr;
+}
+
+
+void olm_session_handle_set_idle_timeout(
+    OlmSessionHandle * handle, uint32_t milliseconds
+) {
+    from_c(handle)->idle_timeout = milliseconds;
+}
+
+
+size_t olm_session_handle_seal(
+    OlmSessionHandle * handle
+) {
+    SessionHandle & object = *from_c(handle);
+    if (!object.session) {
+        return object.pickled_length;
+    }
+    std::size_t length = olm_pickle_session_with_key(
+        object.session, object.pickle_key, object.cipher,
+        object.pickled, object.pickled_capacity
+    );
+    if (length == std::size_t(-1)) {
+        object.last_error = session_error(object.session);
+        return std::size_t(-1);
+    }
+    olm_release_session(object.allocator, object.session);
+    object.session = nullptr;
+    object.pickled_length = length;
+    return length;
+}
+
+
+size_t olm_session_handle_seal_if_idle(
+    OlmSessionHandle * handle
+) {
+    SessionHandle & object = *from_c(handle);
+    if (object.session && now() - object.last_used < object.idle_timeout) {
+        return 0;
+    }
+    return olm_session_handle_seal(handle);
+}
+
+
+size_t olm_session_handle_pickle_length(
+    const OlmSessionHandle * handle
+) {
+    SessionHandle const & object = *from_c(handle);
+    return object.session ? 0 : object.pickled_length;
+}
+
+
+const char * olm_session_handle_last_error(
+    const OlmSessionHandle * handle
+) {
+    return _olm_error_to_string(from_c(handle)->last_error);
+}
+
+
+size_t olm_clear_session_handle(
+    OlmSessionHandle * handle
+) {
+    SessionHandle & object = *from_c(handle);
+    if (object.session) {
+        olm_release_session(object.allocator, object.session);
+    }
+    olm::unset(object);
+    return sizeof(SessionHandle);
+}
+
+}
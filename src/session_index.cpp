@@ -0,0 +1,198 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "olm/error.h"
+#include "olm/indexed_list.hh"
+#include "olm/memory.hh"
+#include "olm/session.hh"
+
+#include <new>
+
+namespace {
+
+/** A session in the index under its route */
+struct RouteEntry {
+    std::uint8_t route[olm::SESSION_ROUTE_LENGTH];
+    OlmSession * session;
+};
+
+struct RouteEntryTraits {
+    /** Hash the base key, which is a fresh random key for every session,
+     * rather than the identity key, which all of a sender's sessions
+     * share. */
+    static std::uint32_t hash(std::uint8_t const * route) {
+        std::uint8_t const * base_key = route + CURVE25519_KEY_LENGTH;
+        return std::uint32_t(base_key[0])
+            | std::uint32_t(base_key[1]) << 8
+            | std::uint32_t(base_key[2]) << 16
+            | std::uint32_t(base_key[3]) << 24;
+    }
+
+    static std::uint32_t hash(RouteEntry const & value) {
+        return hash(value.route);
+    }
+};
+
+typedef olm::IndexedList<RouteEntry, RouteEntryTraits> RouteIndex;
+
+struct SessionIndex {
+    RouteIndex index;
+    std::size_t capacity;
+    OlmErrorCode last_error;
+};
+
+/** Round a length up so that what follows it is suitably aligned. */
+static constexpr std::size_t aligned(std::size_t length) {
+    return (length + 15) & ~std::size_t(15);
+}
+
+static OlmSessionIndex * to_c(SessionIndex * index) {
+    return reinterpret_cast<OlmSessionIndex *>(index);
+}
+
+static SessionIndex * from_c(OlmSessionIndex * index) {
+    return reinterpret_cast<SessionIndex *>(index);
+}
+
+static SessionIndex const * from_c(OlmSessionIndex const * index) {
+    return reinterpret_cast<SessionIndex const *>(index);
+}
+
+static olm::Session const * from_c(OlmSession const * session) {
+    return reinterpret_cast<olm::Session const *>(session);
+}
+
+static RouteEntry * find_entry(
+    SessionIndex & index, std::uint8_t const * route
+) {
+    std::size_t cursor = 0;
+    return index.index.find(
+        RouteEntryTraits::hash(route),
+        [route](RouteEntry const & entry) {
+            return olm::is_equal(entry.route, route, olm::SESSION_ROUTE_LENGTH);
+        },
+        cursor
+    );
+}
+
+} // namespace
+
+
+extern "C" {
+
+size_t olm_session_index_size(
+    size_t capacity
+) {
+    return aligned(sizeof(SessionIndex))
+        + RouteIndex::storage_length(capacity);
+}
+
+
+OlmSessionIndex * olm_session_index(
+    void * memory, size_t capacity
+) {
+    std::uint8_t * pos = reinterpret_cast<std::uint8_t *>(memory);
+    olm::unset(pos, aligned(sizeof(SessionIndex)));
+    SessionIndex * index = new(pos) SessionIndex;
+    pos += aligned(sizeof(SessionIndex));
+
+    new(&index->index) RouteIndex(pos, capacity);
+    index->capacity = capacity;
+    index->last_error = OlmErrorCode::OLM_SUCCESS;
+    return to_c(index);
+}
+
+
+const char * olm_session_index_last_error(
+    const OlmSessionIndex * index
+) {
+    return _olm_error_to_string(from_c(index)->last_error);
+}
+
+
+size_t olm_clear_session_index(
+    OlmSessionIndex * index
+) {
+    std::size_t size = olm_session_index_size(from_c(index)->capacity);
+    olm::unset(index, size);
+    return size;
+}
+
+
+size_t olm_session_index_count(
+    const OlmSessionIndex * index
+) {
+    return from_c(index)->index.size();
+}
+
+
+size_t olm_session_index_add(
+    OlmSessionIndex * index,
+    OlmSession * session
+) {
+    SessionIndex & object = *from_c(index);
+    RouteEntry entry;
+    from_c(session)->route(entry.route);
+    entry.session = session;
+
+    RouteEntry * existing = find_entry(object, entry.route);
+    if (existing) {
+        existing->session = session;
+    } else if (object.index.size() == object.index.capacity()) {
+        object.last_error = OlmErrorCode::OLM_STORE_FULL;
+        return std::size_t(-1);
+    } else {
+        object.index.insert(entry);
+    }
+    return 0;
+}
+
+
+size_t olm_session_index_remove(
+    OlmSessionIndex * index,
+    OlmSession * session
+) {
+    SessionIndex & object = *from_c(index);
+    std::uint8_t route[olm::SESSION_ROUTE_LENGTH];
+    from_c(session)->route(route);
+    RouteEntry * entry = find_entry(object, route);
+    if (!entry || entry->session != session) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return std::size_t(-1);
+    }
+    object.index.erase(entry);
+    return 0;
+}
+
+
+OlmSession * olm_session_index_find(
+    OlmSessionIndex * index,
+    void const * route, size_t route_length
+) {
+    SessionIndex & object = *from_c(index);
+    RouteEntry * entry = nullptr;
+    if (route_length == olm::SESSION_ROUTE_LENGTH) {
+        entry = find_entry(
+            object, reinterpret_cast<std::uint8_t const *>(route)
+        );
+    }
+    if (!entry) {
+        object.last_error = OlmErrorCode::OLM_UNKNOWN_SESSION_ID;
+        return nullptr;
+    }
+    return entry->session;
+}
+
+}
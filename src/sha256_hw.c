@@ -0,0 +1,206 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/sha256_hw.h"
+#include "olm/cpu.h"
+#include "olm/memory.h"
+
+/* the round constants, shared with the multi-buffer implementation */
+const uint32_t _olm_sha256_round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define K _olm_sha256_round_constants
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define OLM_SHA256_HW 1
+#define TARGET_SHA __attribute__((target("sha,ssse3,sse4.1")))
+
+/* Each QUAD_ROUND does four rounds: two SHA256RNDS2s, each of
+ * which does two rounds. The message schedule is kept in four registers of
+ * four words each, which SHA256MSG1/SHA256MSG2 extend four words at a time,
+ * overlapped with the rounds which use them.
+ */
+TARGET_SHA void _olm_sha256_hw_transform(
+    uint32_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+    const __m128i byte_swap = _mm_set_epi64x(
+        0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL
+    );
+    __m128i abef, cdgh, tmp;
+
+    /* the instructions want the state as ABEF and CDGH */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const *) &state[0]), 0xB1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const *) &state[4]), 0x1B);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (; block_count; --block_count, blocks += 64) {
+        __m128i abef_save = abef;
+        __m128i cdgh_save = cdgh;
+        __m128i msg[4];
+
+        /* i is a constant in each expansion, so the conditions and the
+         * indexes into msg all fold away */
+#define QUAD_ROUND(i) do { \
+            __m128i w; \
+            if (i < 4) { \
+                msg[i] = _mm_shuffle_epi8( \
+                    _mm_loadu_si128((__m128i const *) (blocks + 16 * i)), \
+                    byte_swap \
+                ); \
+            } \
+            w = _mm_add_epi32( \
+                msg[i % 4], _mm_loadu_si128((__m128i const *) &K[4 * i]) \
+            ); \
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, w); \
+            if (i >= 3 && i < 15) { \
+                __m128i next = _mm_add_epi32( \
+                    msg[(i + 1) % 4], \
+                    _mm_alignr_epi8(msg[i % 4], msg[(i + 3) % 4], 4) \
+                ); \
+                msg[(i + 1) % 4] = _mm_sha256msg2_epu32(next, msg[i % 4]); \
+            } \
+            w = _mm_shuffle_epi32(w, 0x0E); \
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, w); \
+            if (i >= 1 && i < 13) { \
+                msg[(i + 3) % 4] = _mm_sha256msg1_epu32( \
+                    msg[(i + 3) % 4], msg[i % 4] \
+                ); \
+            } \
+        } while (0)
+
+        QUAD_ROUND(0);  QUAD_ROUND(1);  QUAD_ROUND(2);  QUAD_ROUND(3);
+        QUAD_ROUND(4);  QUAD_ROUND(5);  QUAD_ROUND(6);  QUAD_ROUND(7);
+        QUAD_ROUND(8);  QUAD_ROUND(9);  QUAD_ROUND(10); QUAD_ROUND(11);
+        QUAD_ROUND(12); QUAD_ROUND(13); QUAD_ROUND(14); QUAD_ROUND(15);
+#undef QUAD_ROUND
+
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+        _olm_unset(msg, sizeof(msg));
+    }
+
+    /* back to ABCD and EFGH */
+    tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *) &state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i *) &state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+#define OLM_SHA256_HW 1
+#if defined(__clang__)
+#define TARGET_SHA __attribute__((target("sha2")))
+#else
+#define TARGET_SHA __attribute__((target("+crypto")))
+#endif
+
+/* Each QUAD_ROUND does four rounds with SHA256H/SHA256H2, while
+ * SHA256SU0/SHA256SU1 extend the message schedule four words at a time.
+ */
+TARGET_SHA void _olm_sha256_hw_transform(
+    uint32_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+    uint32x4_t abcd = vld1q_u32(&state[0]);
+    uint32x4_t efgh = vld1q_u32(&state[4]);
+
+    for (; block_count; --block_count, blocks += 64) {
+        uint32x4_t abcd_save = abcd;
+        uint32x4_t efgh_save = efgh;
+        uint32x4_t msg[4];
+        int i;
+
+        for (i = 0; i < 4; ++i) {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * i)));
+        }
+
+#define QUAD_ROUND(i) do { \
+            uint32x4_t w = vaddq_u32(msg[i % 4], vld1q_u32(&K[4 * i])); \
+            uint32x4_t abcd_prev = abcd; \
+            if (i < 12) { \
+                msg[i % 4] = vsha256su0q_u32(msg[i % 4], msg[(i + 1) % 4]); \
+            } \
+            abcd = vsha256hq_u32(abcd, efgh, w); \
+            efgh = vsha256h2q_u32(efgh, abcd_prev, w); \
+            if (i < 12) { \
+                msg[i % 4] = vsha256su1q_u32( \
+                    msg[i % 4], msg[(i + 2) % 4], msg[(i + 3) % 4] \
+                ); \
+            } \
+        } while (0)
+
+        QUAD_ROUND(0);  QUAD_ROUND(1);  QUAD_ROUND(2);  QUAD_ROUND(3);
+        QUAD_ROUND(4);  QUAD_ROUND(5);  QUAD_ROUND(6);  QUAD_ROUND(7);
+        QUAD_ROUND(8);  QUAD_ROUND(9);  QUAD_ROUND(10); QUAD_ROUND(11);
+        QUAD_ROUND(12); QUAD_ROUND(13); QUAD_ROUND(14); QUAD_ROUND(15);
+#undef QUAD_ROUND
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        efgh = vaddq_u32(efgh, efgh_save);
+        _olm_unset(msg, sizeof(msg));
+    }
+
+    vst1q_u32(&state[0], abcd);
+    vst1q_u32(&state[4], efgh);
+}
+
+#endif
+
+#ifdef OLM_SHA256_HW
+
+int _olm_sha256_hw_available(void) {
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_SHA256) != 0;
+}
+
+#else
+
+/* No SHA instructions on this architecture (or we don't know how to use
+ * them): the stub is never called as _olm_sha256_hw_available is false. */
+
+int _olm_sha256_hw_available(void) {
+    return 0;
+}
+
+void _olm_sha256_hw_transform(
+    uint32_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+}
+
+#endif
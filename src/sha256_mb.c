@@ -0,0 +1,343 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/sha256_mb.h"
+#include "olm/sha256_hw.h"
+#include "olm/memory.h"
+
+#define K _olm_sha256_round_constants
+
+static uint32_t load_be32(uint8_t const * p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+        | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+/* The vector code is written once in terms of these macros. V is a vector
+ * of four 32-bit words, one per lane.
+ *
+ *   VADD, VXOR, VAND: lane-wise arithmetic
+ *   VANDNOT(x, y):    ~x & y
+ *   VROTR(x, n):      rotate right by the constant n
+ *   VSHR(x, n):       shift right by the constant n
+ *   VSET1(x):         broadcast x to all lanes
+ *   VSET4(l0..l3):    one word for each lane
+ *   VGET(v, lane):    extract a lane
+ */
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define OLM_SHA256_X4 1
+
+typedef __m128i V;
+#define VADD(x, y) _mm_add_epi32(x, y)
+#define VXOR(x, y) _mm_xor_si128(x, y)
+#define VAND(x, y) _mm_and_si128(x, y)
+#define VANDNOT(x, y) _mm_andnot_si128(x, y)
+#define VSHR(x, n) _mm_srli_epi32(x, n)
+#define VROTR(x, n) \
+    _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define VSET1(x) _mm_set1_epi32((int) (x))
+#define VSET4(l0, l1, l2, l3) \
+    _mm_set_epi32((int) (l3), (int) (l2), (int) (l1), (int) (l0))
+
+static uint32_t vget(V v, int lane) {
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *) lanes, v);
+    return lanes[lane];
+}
+#define VGET(v, lane) vget(v, lane)
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+
+#include <arm_neon.h>
+
+#define OLM_SHA256_X4 1
+
+typedef uint32x4_t V;
+#define VADD(x, y) vaddq_u32(x, y)
+#define VXOR(x, y) veorq_u32(x, y)
+#define VAND(x, y) vandq_u32(x, y)
+#define VANDNOT(x, y) vbicq_u32(y, x)
+#define VSHR(x, n) vshrq_n_u32(x, n)
+#define VROTR(x, n) vsriq_n_u32(vshlq_n_u32(x, 32 - (n)), x, n)
+#define VSET1(x) vdupq_n_u32(x)
+
+static V vset4(uint32_t l0, uint32_t l1, uint32_t l2, uint32_t l3) {
+    uint32_t lanes[4] = {l0, l1, l2, l3};
+    return vld1q_u32(lanes);
+}
+#define VSET4(l0, l1, l2, l3) vset4(l0, l1, l2, l3)
+#define VGET(v, lane) vgetq_lane_u32(v, lane)
+
+#elif defined(__wasm_simd128__)
+
+#include <wasm_simd128.h>
+
+#define OLM_SHA256_X4 1
+
+typedef v128_t V;
+#define VADD(x, y) wasm_i32x4_add(x, y)
+#define VXOR(x, y) wasm_v128_xor(x, y)
+#define VAND(x, y) wasm_v128_and(x, y)
+#define VANDNOT(x, y) wasm_v128_andnot(y, x)
+#define VSHR(x, n) wasm_u32x4_shr(x, n)
+#define VROTR(x, n) \
+    wasm_v128_or(wasm_u32x4_shr(x, n), wasm_i32x4_shl(x, 32 - (n)))
+#define VSET1(x) wasm_i32x4_splat((int32_t) (x))
+#define VSET4(l0, l1, l2, l3) \
+    wasm_i32x4_make((int32_t) (l0), (int32_t) (l1), (int32_t) (l2), \
+        (int32_t) (l3))
+#define VGET(v, lane) ((uint32_t) wasm_i32x4_extract_lane(v, lane))
+
+#endif
+
+#ifdef OLM_SHA256_X4
+
+#define EP0(x) VXOR(VXOR(VROTR(x, 2), VROTR(x, 13)), VROTR(x, 22))
+#define EP1(x) VXOR(VXOR(VROTR(x, 6), VROTR(x, 11)), VROTR(x, 25))
+#define SIG0(x) VXOR(VXOR(VROTR(x, 7), VROTR(x, 18)), VSHR(x, 3))
+#define SIG1(x) VXOR(VXOR(VROTR(x, 17), VROTR(x, 19)), VSHR(x, 10))
+#define CH(x, y, z) VXOR(VAND(x, y), VANDNOT(x, z))
+#define MAJ(x, y, z) VXOR(VXOR(VAND(x, y), VAND(x, z)), VAND(y, z))
+
+int _olm_sha256_x4_available(void) {
+    return 1;
+}
+
+void _olm_sha256_x4_transform(
+    uint32_t * const * states,
+    uint8_t const * const * blocks
+) {
+    V w[16];
+    V s[8];
+    V a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+        s[i] = VSET4(states[0][i], states[1][i], states[2][i], states[3][i]);
+    }
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+    for (i = 0; i < 64; ++i) {
+        V t1, t2;
+        if (i < 16) {
+            w[i] = VSET4(
+                load_be32(blocks[0] + 4 * i), load_be32(blocks[1] + 4 * i),
+                load_be32(blocks[2] + 4 * i), load_be32(blocks[3] + 4 * i)
+            );
+        } else {
+            /* w only keeps the last sixteen words of the schedule */
+            w[i & 15] = VADD(
+                VADD(SIG1(w[(i - 2) & 15]), w[(i - 7) & 15]),
+                VADD(SIG0(w[(i - 15) & 15]), w[i & 15])
+            );
+        }
+        t1 = VADD(
+            VADD(VADD(h, EP1(e)), VADD(CH(e, f, g), VSET1(K[i]))),
+            w[i & 15]
+        );
+        t2 = VADD(EP0(a), MAJ(a, b, c));
+        h = g; g = f; f = e;
+        e = VADD(d, t1);
+        d = c; c = b; b = a;
+        a = VADD(t1, t2);
+    }
+
+    s[0] = VADD(s[0], a); s[1] = VADD(s[1], b);
+    s[2] = VADD(s[2], c); s[3] = VADD(s[3], d);
+    s[4] = VADD(s[4], e); s[5] = VADD(s[5], f);
+    s[6] = VADD(s[6], g); s[7] = VADD(s[7], h);
+
+    for (i = 0; i < 8; ++i) {
+        states[0][i] = VGET(s[i], 0);
+        states[1][i] = VGET(s[i], 1);
+        states[2][i] = VGET(s[i], 2);
+        states[3][i] = VGET(s[i], 3);
+    }
+    _olm_unset(w, sizeof(w));
+    _olm_unset(s, sizeof(s));
+}
+
+#else
+
+/* No SIMD: hash the lanes one at a time. */
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+int _olm_sha256_x4_available(void) {
+    return 0;
+}
+
+void _olm_sha256_x4_transform(
+    uint32_t * const * states,
+    uint8_t const * const * blocks
+) {
+    int lane;
+    uint32_t w[64];
+    for (lane = 0; lane < OLM_SHA256_X4_LANES; ++lane) {
+        uint32_t * state = states[lane];
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        int i;
+        for (i = 0; i < 16; ++i) {
+            w[i] = load_be32(blocks[lane] + 4 * i);
+        }
+        for (; i < 64; ++i) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18)
+                ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19)
+                ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        for (i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25))
+                + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22))
+                + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+    _olm_unset(w, sizeof(w));
+}
+
+#endif
+
+/* The eight lane kernel needs AVX2, which not every x86 CPU has, so it is
+ * built for AVX2 on its own and only used where cpu.c finds it. Elsewhere
+ * the eight lanes are hashed as two sets of four. */
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#include "olm/cpu.h"
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+#define V8ADD(x, y) _mm256_add_epi32(x, y)
+#define V8XOR(x, y) _mm256_xor_si256(x, y)
+#define V8AND(x, y) _mm256_and_si256(x, y)
+#define V8ANDNOT(x, y) _mm256_andnot_si256(x, y)
+#define V8SHR(x, n) _mm256_srli_epi32(x, n)
+#define V8ROTR(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define V8SET1(x) _mm256_set1_epi32((int) (x))
+
+#define EP0_8(x) V8XOR(V8XOR(V8ROTR(x, 2), V8ROTR(x, 13)), V8ROTR(x, 22))
+#define EP1_8(x) V8XOR(V8XOR(V8ROTR(x, 6), V8ROTR(x, 11)), V8ROTR(x, 25))
+#define SIG0_8(x) V8XOR(V8XOR(V8ROTR(x, 7), V8ROTR(x, 18)), V8SHR(x, 3))
+#define SIG1_8(x) V8XOR(V8XOR(V8ROTR(x, 17), V8ROTR(x, 19)), V8SHR(x, 10))
+#define CH_8(x, y, z) V8XOR(V8AND(x, y), V8ANDNOT(x, z))
+#define MAJ_8(x, y, z) \
+    V8XOR(V8XOR(V8AND(x, y), V8AND(x, z)), V8AND(y, z))
+
+int _olm_sha256_x8_available(void) {
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_AVX2) != 0;
+}
+
+TARGET_AVX2 static void sha256_x8_avx2(
+    uint32_t * const * states,
+    uint8_t const * const * blocks
+) {
+    __m256i w[16];
+    __m256i s[8];
+    __m256i a, b, c, d, e, f, g, h;
+    uint32_t lanes[OLM_SHA256_X8_LANES];
+    int i, lane;
+
+    for (i = 0; i < 8; ++i) {
+        for (lane = 0; lane < OLM_SHA256_X8_LANES; ++lane) {
+            lanes[lane] = states[lane][i];
+        }
+        s[i] = _mm256_loadu_si256((__m256i const *) lanes);
+    }
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+    for (i = 0; i < 64; ++i) {
+        __m256i t1, t2;
+        if (i < 16) {
+            for (lane = 0; lane < OLM_SHA256_X8_LANES; ++lane) {
+                lanes[lane] = load_be32(blocks[lane] + 4 * i);
+            }
+            w[i] = _mm256_loadu_si256((__m256i const *) lanes);
+        } else {
+            w[i & 15] = V8ADD(
+                V8ADD(SIG1_8(w[(i - 2) & 15]), w[(i - 7) & 15]),
+                V8ADD(SIG0_8(w[(i - 15) & 15]), w[i & 15])
+            );
+        }
+        t1 = V8ADD(
+            V8ADD(V8ADD(h, EP1_8(e)), V8ADD(CH_8(e, f, g), V8SET1(K[i]))),
+            w[i & 15]
+        );
+        t2 = V8ADD(EP0_8(a), MAJ_8(a, b, c));
+        h = g; g = f; f = e;
+        e = V8ADD(d, t1);
+        d = c; c = b; b = a;
+        a = V8ADD(t1, t2);
+    }
+
+    s[0] = V8ADD(s[0], a); s[1] = V8ADD(s[1], b);
+    s[2] = V8ADD(s[2], c); s[3] = V8ADD(s[3], d);
+    s[4] = V8ADD(s[4], e); s[5] = V8ADD(s[5], f);
+    s[6] = V8ADD(s[6], g); s[7] = V8ADD(s[7], h);
+
+    for (i = 0; i < 8; ++i) {
+        _mm256_storeu_si256((__m256i *) lanes, s[i]);
+        for (lane = 0; lane < OLM_SHA256_X8_LANES; ++lane) {
+            states[lane][i] = lanes[lane];
+        }
+    }
+    _olm_unset(w, sizeof(w));
+    _olm_unset(s, sizeof(s));
+    _olm_unset(lanes, sizeof(lanes));
+}
+
+void _olm_sha256_x8_transform(
+    uint32_t * const * states,
+    uint8_t const * const * blocks
+) {
+    if (_olm_sha256_x8_available()) {
+        sha256_x8_avx2(states, blocks);
+        return;
+    }
+    _olm_sha256_x4_transform(states, blocks);
+    _olm_sha256_x4_transform(
+        states + OLM_SHA256_X4_LANES, blocks + OLM_SHA256_X4_LANES
+    );
+}
+
+#else
+
+int _olm_sha256_x8_available(void) {
+    return 0;
+}
+
+void _olm_sha256_x8_transform(
+    uint32_t * const * states,
+    uint8_t const * const * blocks
+) {
+    _olm_sha256_x4_transform(states, blocks);
+    _olm_sha256_x4_transform(
+        states + OLM_SHA256_X4_LANES, blocks + OLM_SHA256_X4_LANES
+    );
+}
+
+#endif
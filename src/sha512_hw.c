@@ -0,0 +1,288 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/sha512_hw.h"
+#include "olm/cpu.h"
+#include "olm/memory.h"
+
+const uint64_t _olm_sha512_round_constants[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+    0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+    0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+    0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+    0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+    0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+    0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+    0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+    0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+    0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+    0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+    0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+    0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+    0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+#define K _olm_sha512_round_constants
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+#define OLM_SHA512_HW 1
+#define TARGET_SHA512 __attribute__((target("avx2,bmi2")))
+
+/* x86 has no instructions for the SHA-512 rounds, which are a chain of
+ * 64-bit additions and rotates that BMI2's RORX does without disturbing the
+ * flags. What vectorises is the message schedule: the byte swap and adding
+ * the round constants go four words at a time in the AVX2 registers, and
+ * the expansion two at a time, as each word depends on the one two before.
+ */
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+TARGET_SHA512 static __m128i rotr_128(__m128i x, int n) {
+    return _mm_or_si128(_mm_srli_epi64(x, n), _mm_slli_epi64(x, 64 - n));
+}
+
+TARGET_SHA512 void _olm_sha512_hw_transform(
+    uint64_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+    const __m256i byte_swap = _mm256_set_epi64x(
+        0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL,
+        0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL
+    );
+    uint64_t w[80] __attribute__((aligned(32)));
+    uint64_t wk[80] __attribute__((aligned(32)));
+    int i;
+
+    for (; block_count; --block_count, blocks += 128) {
+        uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (i = 0; i < 16; i += 4) {
+            _mm256_store_si256((__m256i *) &w[i], _mm256_shuffle_epi8(
+                _mm256_loadu_si256((__m256i const *) (blocks + 8 * i)),
+                byte_swap
+            ));
+        }
+        for (i = 16; i < 80; i += 2) {
+            __m128i w2 = _mm_load_si128((__m128i const *) &w[i - 2]);
+            __m128i w15 = _mm_loadu_si128((__m128i const *) &w[i - 15]);
+            __m128i s0 = _mm_xor_si128(
+                _mm_xor_si128(rotr_128(w15, 1), rotr_128(w15, 8)),
+                _mm_srli_epi64(w15, 7)
+            );
+            __m128i s1 = _mm_xor_si128(
+                _mm_xor_si128(rotr_128(w2, 19), rotr_128(w2, 61)),
+                _mm_srli_epi64(w2, 6)
+            );
+            _mm_store_si128((__m128i *) &w[i], _mm_add_epi64(
+                _mm_add_epi64(s0, s1),
+                _mm_add_epi64(
+                    _mm_loadu_si128((__m128i const *) &w[i - 7]),
+                    _mm_load_si128((__m128i const *) &w[i - 16])
+                )
+            ));
+        }
+        for (i = 0; i < 80; i += 4) {
+            _mm256_store_si256((__m256i *) &wk[i], _mm256_add_epi64(
+                _mm256_load_si256((__m256i const *) &w[i]),
+                _mm256_loadu_si256((__m256i const *) &K[i])
+            ));
+        }
+
+        /* the variables rename themselves rather than being shuffled
+         * along each round */
+#define ROUND(a, b, c, d, e, f, g, h, i) do { \
+            uint64_t t1 = h + (ROTR(e, 14) ^ ROTR(e, 18) ^ ROTR(e, 41)) \
+                + (g ^ (e & (f ^ g))) + wk[i]; \
+            uint64_t t2 = (ROTR(a, 28) ^ ROTR(a, 34) ^ ROTR(a, 39)) \
+                + ((a & b) | (c & (a | b))); \
+            d += t1; \
+            h = t1 + t2; \
+        } while (0)
+
+        for (i = 0; i < 80; i += 8) {
+            ROUND(a, b, c, d, e, f, g, h, i);
+            ROUND(h, a, b, c, d, e, f, g, i + 1);
+            ROUND(g, h, a, b, c, d, e, f, i + 2);
+            ROUND(f, g, h, a, b, c, d, e, i + 3);
+            ROUND(e, f, g, h, a, b, c, d, i + 4);
+            ROUND(d, e, f, g, h, a, b, c, i + 5);
+            ROUND(c, d, e, f, g, h, a, b, i + 6);
+            ROUND(b, c, d, e, f, g, h, a, i + 7);
+        }
+#undef ROUND
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    _olm_unset(w, sizeof(w));
+    _olm_unset(wk, sizeof(wk));
+}
+
+#undef ROTR
+
+int _olm_sha512_hw_available(void) {
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_AVX2) != 0;
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+#define OLM_SHA512_HW 1
+#if defined(__clang__)
+#define TARGET_SHA512 __attribute__((target("sha3")))
+#else
+#define TARGET_SHA512 __attribute__((target("+sha3")))
+#endif
+
+/* Each DOUBLE_ROUND does two rounds with SHA512H/SHA512H2, while
+ * SHA512SU0/SHA512SU1 extend the message schedule two words at a time. The
+ * state is in four registers of two words, AB, CD, EF and GH, which move
+ * round five slots of s[] as the rounds go, coming back to where they
+ * started after every five double rounds.
+ */
+TARGET_SHA512 void _olm_sha512_hw_transform(
+    uint64_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+    uint64x2_t s[5];
+    s[0] = vld1q_u64(&state[0]);
+    s[1] = vld1q_u64(&state[2]);
+    s[2] = vld1q_u64(&state[4]);
+    s[3] = vld1q_u64(&state[6]);
+
+    for (; block_count; --block_count, blocks += 128) {
+        uint64x2_t ab_save = s[0], cd_save = s[1];
+        uint64x2_t ef_save = s[2], gh_save = s[3];
+        uint64x2_t msg[8];
+        int i;
+
+        for (i = 0; i < 8; ++i) {
+            msg[i] = vreinterpretq_u64_u8(vrev64q_u8(vld1q_u8(blocks + 16 * i)));
+        }
+
+        /* i is a constant in each expansion, so the conditions and the
+         * indexes into msg and s all fold away. ab, cd, ef and gh are
+         * the slots of s[] holding those pairs of the state. */
+#define DOUBLE_ROUND(i, ab, cd, ef, gh, next) do { \
+            uint64x2_t kw = vaddq_u64( \
+                msg[(i) % 8], vld1q_u64(&K[2 * (i)]) \
+            ); \
+            uint64x2_t fg = vextq_u64(s[ef], s[gh], 1); \
+            uint64x2_t de = vextq_u64(s[cd], s[ef], 1); \
+            s[gh] = vaddq_u64(s[gh], vextq_u64(kw, kw, 1)); \
+            if ((i) < 32) { \
+                uint64x2_t w9 = vextq_u64( \
+                    msg[((i) + 4) % 8], msg[((i) + 5) % 8], 1 \
+                ); \
+                msg[(i) % 8] = vsha512su0q_u64( \
+                    msg[(i) % 8], msg[((i) + 1) % 8] \
+                ); \
+                msg[(i) % 8] = vsha512su1q_u64( \
+                    msg[(i) % 8], msg[((i) + 7) % 8], w9 \
+                ); \
+            } \
+            s[gh] = vsha512hq_u64(s[gh], fg, de); \
+            s[next] = vaddq_u64(s[cd], s[gh]); \
+            s[gh] = vsha512h2q_u64(s[gh], s[cd], s[ab]); \
+        } while (0)
+
+#define FIVE_DOUBLE_ROUNDS(i) do { \
+            DOUBLE_ROUND((i), 0, 1, 2, 3, 4); \
+            DOUBLE_ROUND((i) + 1, 3, 0, 4, 2, 1); \
+            DOUBLE_ROUND((i) + 2, 2, 3, 1, 4, 0); \
+            DOUBLE_ROUND((i) + 3, 4, 2, 0, 1, 3); \
+            DOUBLE_ROUND((i) + 4, 1, 4, 3, 0, 2); \
+        } while (0)
+
+        FIVE_DOUBLE_ROUNDS(0);  FIVE_DOUBLE_ROUNDS(5);
+        FIVE_DOUBLE_ROUNDS(10); FIVE_DOUBLE_ROUNDS(15);
+        FIVE_DOUBLE_ROUNDS(20); FIVE_DOUBLE_ROUNDS(25);
+        FIVE_DOUBLE_ROUNDS(30); FIVE_DOUBLE_ROUNDS(35);
+#undef FIVE_DOUBLE_ROUNDS
+#undef DOUBLE_ROUND
+
+        s[0] = vaddq_u64(s[0], ab_save);
+        s[1] = vaddq_u64(s[1], cd_save);
+        s[2] = vaddq_u64(s[2], ef_save);
+        s[3] = vaddq_u64(s[3], gh_save);
+        _olm_unset(msg, sizeof(msg));
+    }
+
+    vst1q_u64(&state[0], s[0]);
+    vst1q_u64(&state[2], s[1]);
+    vst1q_u64(&state[4], s[2]);
+    vst1q_u64(&state[6], s[3]);
+}
+
+int _olm_sha512_hw_available(void) {
+    return (_olm_cpu_features() & OLM_CPU_FEATURE_SHA512) != 0;
+}
+
+#endif
+
+#ifndef OLM_SHA512_HW
+
+/* Nothing to accelerate SHA-512 with on this architecture: the stub is never
+ * called as _olm_sha512_hw_available is false. */
+
+int _olm_sha512_hw_available(void) {
+    return 0;
+}
+
+void _olm_sha512_hw_transform(
+    uint64_t * state,
+    uint8_t const * blocks, size_t block_count
+) {
+}
+
+#endif
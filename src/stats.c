@@ -0,0 +1,83 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* for clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+
+#include "olm/stats_internal.h"
+
+#include <string.h>
+
+#if defined(OLM_STATS) || defined(OLM_TRACE)
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+uint64_t _olm_stats_now(void) {
+#if defined(_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart * (1e9 / frequency.QuadPart));
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+#endif
+
+#ifdef OLM_STATS
+
+OLM_THREAD_LOCAL OlmStats _olm_stats;
+
+void _olm_stats_record_call(enum OlmStatsOperation operation, uint64_t start) {
+    _olm_stats.calls[operation]++;
+    _olm_stats.nanoseconds[operation] += _olm_stats_now() - start;
+}
+
+int olm_stats_enabled(void) {
+    return 1;
+}
+
+void olm_stats_get(OlmStats * stats) {
+    *stats = _olm_stats;
+}
+
+void olm_stats_reset(void) {
+    memset(&_olm_stats, 0, sizeof(_olm_stats));
+}
+
+#else
+
+int olm_stats_enabled(void) {
+    return 0;
+}
+
+void olm_stats_get(OlmStats * stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+void olm_stats_reset(void) {
+}
+
+#endif /* OLM_STATS */
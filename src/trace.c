@@ -0,0 +1,90 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "olm/trace_internal.h"
+#include "olm/stats_internal.h"
+
+#include <stddef.h>
+
+#ifdef OLM_TRACE
+
+OlmTraceCallback _olm_trace_callback;
+static void * trace_context;
+OlmRecordCallback _olm_record_callback;
+static void * record_context;
+
+uint64_t _olm_trace_enter(enum OlmTraceOperation operation) {
+    OlmTraceCallback callback = _olm_trace_callback;
+    if (callback) {
+        callback(trace_context, operation, OLM_TRACE_ENTER, 0);
+    }
+    return _olm_stats_now();
+}
+
+void _olm_trace_exit(enum OlmTraceOperation operation, uint64_t start) {
+    uint64_t elapsed = _olm_stats_now() - start;
+    OlmTraceCallback callback = _olm_trace_callback;
+    if (callback) {
+        callback(trace_context, operation, OLM_TRACE_EXIT, elapsed);
+    }
+}
+
+int olm_trace_enabled(void) {
+    return 1;
+}
+
+void olm_trace_set_callback(OlmTraceCallback callback, void * context) {
+    trace_context = context;
+    _olm_trace_callback = callback;
+}
+
+void _olm_record(
+    enum OlmTraceOperation operation, const void * session,
+    size_t plaintext_length, size_t message_length,
+    uint32_t message_index, unsigned message_type, int failed
+) {
+    struct OlmRecordEvent event;
+    OlmRecordCallback callback = _olm_record_callback;
+    if (!callback) {
+        return;
+    }
+    event.operation = operation;
+    event.session = session;
+    event.plaintext_length = plaintext_length;
+    event.message_length = message_length;
+    event.message_index = message_index;
+    event.message_type = message_type;
+    event.failed = failed;
+    callback(record_context, &event);
+}
+
+void olm_record_set_callback(OlmRecordCallback callback, void * context) {
+    record_context = context;
+    _olm_record_callback = callback;
+}
+
+#else
+
+int olm_trace_enabled(void) {
+    return 0;
+}
+
+void olm_trace_set_callback(OlmTraceCallback callback, void * context) {
+}
+
+void olm_record_set_callback(OlmRecordCallback callback, void * context) {
+}
+
+#endif /* OLM_TRACE */
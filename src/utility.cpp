@@ -16,11 +16,42 @@
 #include "olm/utility.hh"
 #include "olm/crypto.h"
 
+#include <cstring>
+
 
 olm::Utility::Utility(
-) : last_error(OlmErrorCode::OLM_SUCCESS) {
+) : last_error(OlmErrorCode::OLM_SUCCESS),
+    key_cache_length(0), key_cache_next(0) {
+}
+
+
+namespace {
+
+/** Find the key in the cache, decoding it into the oldest slot if it isn't
+ * there. */
+_olm_ed25519_prepared_key const & prepared_key(
+    olm::Utility & utility, _olm_ed25519_public_key const & key
+) {
+    for (std::size_t i = 0; i < utility.key_cache_length; ++i) {
+        if (0 == std::memcmp(
+            utility.key_cache[i].public_key.public_key, key.public_key,
+            sizeof(key.public_key)
+        )) {
+            return utility.key_cache[i];
+        }
+    }
+    _olm_ed25519_prepared_key & slot = utility.key_cache[utility.key_cache_next];
+    _olm_crypto_ed25519_prepare_key(&key, &slot);
+    utility.key_cache_next =
+        (utility.key_cache_next + 1) % olm::Utility::KEY_CACHE_SIZE;
+    if (utility.key_cache_length < olm::Utility::KEY_CACHE_SIZE) {
+        utility.key_cache_length++;
+    }
+    return slot;
 }
 
+} // namespace
+
 
 size_t olm::Utility::sha256_length() {
     return SHA256_OUTPUT_LENGTH;
@@ -49,9 +80,40 @@ size_t olm::Utility::ed25519_verify(
         last_error = OlmErrorCode::OLM_BAD_MESSAGE_MAC;
         return std::size_t(-1);
     }
-    if (!_olm_crypto_ed25519_verify(&key, message, message_length, signature)) {
+    if (!_olm_crypto_ed25519_verify_prepared(
+        &prepared_key(*this, key), message, message_length, signature
+    )) {
         last_error = OlmErrorCode::OLM_BAD_MESSAGE_MAC;
         return std::size_t(-1);
     }
     return std::size_t(0);
 }
+
+
+size_t olm::Utility::ed25519_verify_batch(
+    std::size_t count,
+    _olm_ed25519_public_key const * keys,
+    std::uint8_t const * const * messages,
+    std::size_t const * message_lengths,
+    std::uint8_t const * const * signatures,
+    std::size_t const * signature_lengths,
+    std::uint8_t * results
+) {
+    const std::size_t chunk_size = 64;
+    std::uint8_t const * checked[chunk_size];
+    std::size_t failures = 0;
+    for (std::size_t start = 0; start < count; start += chunk_size) {
+        std::size_t n = count - start < chunk_size ? count - start : chunk_size;
+        /* signatures that are too short are passed as NULL, which always
+         * fails to verify */
+        for (std::size_t i = 0; i < n; ++i) {
+            checked[i] = signature_lengths[start + i] < ED25519_SIGNATURE_LENGTH
+                ? nullptr : signatures[start + i];
+        }
+        failures += _olm_crypto_ed25519_verify_batch(
+            n, keys + start, messages + start, message_lengths + start,
+            checked, results + start
+        );
+    }
+    return failures;
+}
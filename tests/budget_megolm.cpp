@@ -0,0 +1,139 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/outbound_group_session.h"
+#include "budget.hh"
+
+#include <cstring>
+#include <vector>
+
+int main() {
+
+assert_equals(1, olm_stats_enabled());
+
+{ /** Group session budget test */
+
+TestCase test_case("Group session budget test");
+
+std::vector<std::uint8_t> outbound_buffer(olm_outbound_group_session_size());
+OlmOutboundGroupSession * outbound =
+    olm_outbound_group_session(outbound_buffer.data());
+std::vector<std::uint8_t> random(
+    olm_init_outbound_group_session_random_length(outbound)
+);
+for (std::size_t i = 0; i < random.size(); ++i) {
+    random[i] = std::uint8_t(i);
+}
+std::size_t result;
+assert_within_budget(result = olm_init_outbound_group_session(
+    outbound, random.data(), random.size()
+), {0, 0, 0, 0});
+assert_equals(std::size_t(0), result);
+
+/* the session key is signed */
+std::vector<std::uint8_t> session_key(
+    olm_outbound_group_session_key_length(outbound)
+);
+assert_within_budget(result = olm_outbound_group_session_key(
+    outbound, session_key.data(), session_key.size()
+), {0, 0, 0, 1});
+assert_equals(session_key.size(), result);
+
+std::uint8_t plaintext[] = "Message";
+std::size_t plaintext_length = sizeof(plaintext) - 1;
+std::vector<std::uint8_t> message_0(
+    olm_group_encrypt_message_length(outbound, plaintext_length)
+);
+assert_within_budget(result = olm_group_encrypt(
+    outbound, plaintext, plaintext_length, message_0.data(), message_0.size()
+), {20, 6, 0, 1});
+assert_equals(message_0.size(), result);
+
+/* a thousand messages on, to decrypt after a gap */
+std::vector<std::uint8_t> message_1000;
+for (int i = 0; i < 1000; ++i) {
+    /* the index takes more bytes as it grows */
+    message_1000.resize(
+        olm_group_encrypt_message_length(outbound, plaintext_length)
+    );
+    olm_group_encrypt(
+        outbound, plaintext, plaintext_length,
+        message_1000.data(), message_1000.size()
+    );
+}
+
+/* and the signature on it is checked */
+std::vector<std::uint8_t> inbound_buffer(olm_inbound_group_session_size());
+OlmInboundGroupSession * inbound =
+    olm_inbound_group_session(inbound_buffer.data());
+assert_within_budget(result = olm_init_inbound_group_session(
+    inbound, session_key.data(), session_key.size()
+), {0, 0, 0, 1});
+assert_equals(std::size_t(0), result);
+
+std::vector<std::uint8_t> plaintext_out(plaintext_length + 16);
+std::uint32_t message_index;
+std::vector<std::uint8_t> tmp(message_0);
+assert_within_budget(result = olm_group_decrypt(
+    inbound, tmp.data(), tmp.size(),
+    plaintext_out.data(), plaintext_out.size(), &message_index
+), {16, 5, 0, 1});
+assert_equals(plaintext_length, result);
+assert_equals(std::uint32_t(0), message_index);
+
+tmp = message_1000;
+assert_within_budget(result = olm_group_decrypt(
+    inbound, tmp.data(), tmp.size(),
+    plaintext_out.data(), plaintext_out.size(), &message_index
+), {958, 241, 0, 1});
+assert_equals(plaintext_length, result);
+assert_equals(std::uint32_t(1000), message_index);
+
+/* exporting far ahead only takes the rehashes to get there, 2^24 being
+ * a single rehash of the first part of the ratchet */
+std::vector<std::uint8_t> exported(
+    olm_export_inbound_group_session_length(inbound)
+);
+assert_within_budget(result = olm_export_inbound_group_session(
+    inbound, exported.data(), exported.size(), 1 << 24
+), {10, 4, 0, 0});
+assert_equals(exported.size(), result);
+
+std::vector<std::uint8_t> imported_buffer(olm_inbound_group_session_size());
+OlmInboundGroupSession * imported =
+    olm_inbound_group_session(imported_buffer.data());
+assert_within_budget(result = olm_import_inbound_group_session(
+    imported, exported.data(), exported.size()
+), {0, 0, 0, 0});
+assert_equals(std::size_t(0), result);
+
+std::vector<std::uint8_t> pickle(
+    olm_pickle_inbound_group_session_length(inbound)
+);
+assert_within_budget(result = olm_pickle_inbound_group_session(
+    inbound, "secret_key", 10, pickle.data(), pickle.size()
+), {18, 5, 0, 0});
+assert_equals(pickle.size(), result);
+
+std::vector<std::uint8_t> unpickled_buffer(olm_inbound_group_session_size());
+OlmInboundGroupSession * unpickled =
+    olm_inbound_group_session(unpickled_buffer.data());
+assert_within_budget(result = olm_unpickle_inbound_group_session(
+    unpickled, "secret_key", 10, pickle.data(), pickle.size()
+), {18, 5, 0, 0});
+assert_not_equals(std::size_t(-1), result);
+}
+
+}
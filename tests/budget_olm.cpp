@@ -0,0 +1,265 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "budget.hh"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+struct MockRandom {
+    MockRandom(std::uint8_t tag, std::uint8_t offset = 0)
+        : tag(tag), current(offset) {}
+    void operator()(
+        std::uint8_t * bytes, std::size_t length
+    ) {
+        while (length > 32) {
+            bytes[0] = tag;
+            std::memset(bytes + 1, current, 31);
+            length -= 32;
+            bytes += 32;
+            current += 1;
+        }
+        if (length) {
+            bytes[0] = tag;
+            std::memset(bytes + 1, current, length - 1);
+            current += 1;
+        }
+    }
+    std::uint8_t tag;
+    std::uint8_t current;
+};
+
+std::vector<std::uint8_t> random_bytes(
+    MockRandom & mock_random, std::size_t length
+) {
+    std::vector<std::uint8_t> random(length);
+    mock_random(random.data(), random.size());
+    return random;
+}
+
+} // namespace
+
+int main() {
+
+assert_equals(1, olm_stats_enabled());
+
+{ /** Account budget test */
+
+TestCase test_case("Account budget test");
+MockRandom mock_random('A');
+
+std::vector<std::uint8_t> account_buffer(olm_account_size());
+OlmAccount * account = olm_account(account_buffer.data());
+std::vector<std::uint8_t> random = random_bytes(
+    mock_random, olm_create_account_random_length(account)
+);
+std::size_t result;
+assert_within_budget(result = olm_create_account(
+    account, random.data(), random.size()
+), {0, 0, 1, 0});
+assert_not_equals(std::size_t(-1), result);
+
+/* one X25519 key pair per one-time key */
+random = random_bytes(
+    mock_random, olm_account_generate_one_time_keys_random_length(account, 10)
+);
+assert_within_budget(result = olm_account_generate_one_time_keys(
+    account, 10, random.data(), random.size()
+), {0, 0, 10, 0});
+assert_equals(std::size_t(10), result);
+
+std::vector<std::uint8_t> keys(olm_account_one_time_keys_length(account));
+assert_within_budget(result = olm_account_one_time_keys(
+    account, keys.data(), keys.size()
+), {0, 0, 0, 0});
+assert_equals(keys.size(), result);
+
+std::uint8_t message[] = "Hello, World";
+std::vector<std::uint8_t> signature(olm_account_signature_length(account));
+assert_within_budget(result = olm_account_sign(
+    account, message, sizeof(message) - 1, signature.data(), signature.size()
+), {0, 0, 0, 1});
+assert_equals(signature.size(), result);
+
+std::vector<std::uint8_t> pickle(olm_pickle_account_length(account));
+assert_within_budget(result = olm_pickle_account(
+    account, "secret_key", 10, pickle.data(), pickle.size()
+), {27, 5, 0, 0});
+assert_equals(pickle.size(), result);
+
+std::vector<std::uint8_t> account_buffer2(olm_account_size());
+OlmAccount * account2 = olm_account(account_buffer2.data());
+assert_within_budget(result = olm_unpickle_account(
+    account2, "secret_key", 10, pickle.data(), pickle.size()
+), {27, 5, 0, 0});
+assert_not_equals(std::size_t(-1), result);
+}
+
+{ /** Session budget test */
+
+TestCase test_case("Session budget test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> a_account_buffer(olm_account_size());
+OlmAccount * a_account = olm_account(a_account_buffer.data());
+std::vector<std::uint8_t> random = random_bytes(
+    mock_random_a, olm_create_account_random_length(a_account)
+);
+olm_create_account(a_account, random.data(), random.size());
+
+std::vector<std::uint8_t> b_account_buffer(olm_account_size());
+OlmAccount * b_account = olm_account(b_account_buffer.data());
+random = random_bytes(
+    mock_random_b, olm_create_account_random_length(b_account)
+);
+olm_create_account(b_account, random.data(), random.size());
+random = random_bytes(
+    mock_random_b,
+    olm_account_generate_one_time_keys_random_length(b_account, 1)
+);
+olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(b_account));
+olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+/* a base key and a ratchet key, and the three X25519 agreements */
+std::vector<std::uint8_t> a_session_buffer(olm_session_size());
+OlmSession * a_session = olm_session(a_session_buffer.data());
+random = random_bytes(
+    mock_random_a, olm_create_outbound_session_random_length(a_session)
+);
+std::size_t result;
+assert_within_budget(result = olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+), {9, 3, 5, 0});
+assert_not_equals(std::size_t(-1), result);
+
+std::uint8_t plaintext[] = "Hello, World";
+std::size_t plaintext_length = sizeof(plaintext) - 1;
+std::vector<std::uint8_t> message_1(
+    olm_encrypt_message_length(a_session, plaintext_length)
+);
+assert_within_budget(result = olm_encrypt(
+    a_session, plaintext, plaintext_length, nullptr, 0,
+    message_1.data(), message_1.size()
+), {20, 7, 0, 0});
+assert_equals(message_1.size(), result);
+
+std::vector<std::uint8_t> b_session_buffer(olm_session_size());
+OlmSession * b_session = olm_session(b_session_buffer.data());
+std::vector<std::uint8_t> tmp(message_1);
+assert_within_budget(result = olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+), {9, 3, 3, 0});
+assert_not_equals(std::size_t(-1), result);
+
+std::vector<std::uint8_t> plaintext_out(plaintext_length + 16);
+tmp = message_1;
+assert_within_budget(result = olm_decrypt(
+    b_session, OLM_MESSAGE_TYPE_PRE_KEY, tmp.data(), tmp.size(),
+    plaintext_out.data(), plaintext_out.size()
+), {22, 7, 0, 0});
+assert_equals(plaintext_length, result);
+
+/* the reply starts a new chain, with a new ratchet key */
+random = random_bytes(mock_random_b, olm_encrypt_random_length(b_session));
+std::vector<std::uint8_t> reply(
+    olm_encrypt_message_length(b_session, plaintext_length)
+);
+assert_within_budget(result = olm_encrypt(
+    b_session, plaintext, plaintext_length, random.data(), random.size(),
+    reply.data(), reply.size()
+), {30, 10, 2, 0});
+assert_equals(reply.size(), result);
+
+tmp = reply;
+assert_within_budget(result = olm_decrypt(
+    a_session, OLM_MESSAGE_TYPE_MESSAGE, tmp.data(), tmp.size(),
+    plaintext_out.data(), plaintext_out.size()
+), {32, 10, 1, 0});
+assert_equals(plaintext_length, result);
+
+/* the next message starts another chain, and the one after it goes on
+ * the same chain, with no public key operations */
+random = random_bytes(mock_random_a, olm_encrypt_random_length(a_session));
+std::vector<std::uint8_t> message_2(
+    olm_encrypt_message_length(a_session, plaintext_length)
+);
+olm_encrypt(
+    a_session, plaintext, plaintext_length, random.data(), random.size(),
+    message_2.data(), message_2.size()
+);
+std::vector<std::uint8_t> message_3(
+    olm_encrypt_message_length(a_session, plaintext_length)
+);
+assert_within_budget(result = olm_encrypt(
+    a_session, plaintext, plaintext_length, nullptr, 0,
+    message_3.data(), message_3.size()
+), {20, 7, 0, 0});
+assert_equals(message_3.size(), result);
+
+tmp = message_2;
+assert_within_budget(result = olm_decrypt(
+    b_session, OLM_MESSAGE_TYPE_MESSAGE, tmp.data(), tmp.size(),
+    plaintext_out.data(), plaintext_out.size()
+), {32, 10, 1, 0});
+assert_equals(plaintext_length, result);
+tmp = message_3;
+assert_within_budget(result = olm_decrypt(
+    b_session, OLM_MESSAGE_TYPE_MESSAGE, tmp.data(), tmp.size(),
+    plaintext_out.data(), plaintext_out.size()
+), {22, 7, 0, 0});
+assert_equals(plaintext_length, result);
+
+/* a message after a gap of 100 advances the chain and keeps the keys */
+std::vector<std::uint8_t> message_gap(
+    olm_encrypt_message_length(a_session, plaintext_length)
+);
+for (int i = 0; i < 101; ++i) {
+    olm_encrypt(
+        a_session, plaintext, plaintext_length, nullptr, 0,
+        message_gap.data(), message_gap.size()
+    );
+}
+tmp = message_gap;
+assert_within_budget(result = olm_decrypt(
+    b_session, OLM_MESSAGE_TYPE_MESSAGE, tmp.data(), tmp.size(),
+    plaintext_out.data(), plaintext_out.size()
+), {662, 187, 0, 0});
+assert_equals(plaintext_length, result);
+
+std::vector<std::uint8_t> pickle(olm_pickle_session_length(b_session));
+assert_within_budget(result = olm_pickle_session(
+    b_session, "secret_key", 10, pickle.data(), pickle.size()
+), {68, 5, 0, 0});
+assert_equals(pickle.size(), result);
+
+std::vector<std::uint8_t> session_buffer(olm_session_size());
+OlmSession * session = olm_session(session_buffer.data());
+assert_within_budget(result = olm_unpickle_session(
+    session, "secret_key", 10, pickle.data(), pickle.size()
+), {68, 5, 0, 0});
+assert_not_equals(std::size_t(-1), result);
+}
+
+}
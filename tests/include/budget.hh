@@ -0,0 +1,89 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/stats.h"
+#include "unittest.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+/* Cost budget tests check that an API call does no more than a given amount
+ * of work, as counted by olm/stats.h, so that a change which makes the
+ * protocol code do more hashing or public key operations fails make test
+ * however noisy the machine is. They are linked against a copy of the
+ * library built with OLM_STATS. Set OLM_BUDGET_PRINT to print what each
+ * call actually cost instead of checking it, for updating the budgets after
+ * an improvement. */
+
+/** The most work an API call is allowed to do */
+struct Budget {
+    /** SHA-256 compression function calls, including those for HMACs */
+    std::uint64_t sha256_blocks;
+    std::uint64_t hmac_sha256;
+    /** X25519 key pairs generated and shared secrets computed */
+    std::uint64_t curve25519;
+    /** Ed25519 signatures made and checked */
+    std::uint64_t ed25519;
+};
+
+inline void assert_within_budget(
+    const char *file,
+    unsigned line,
+    const char *call_expr,
+    Budget const & budget
+) {
+    OlmStats stats;
+    olm_stats_get(&stats);
+    Budget actual = {
+        stats.sha256_blocks,
+        stats.hmac_sha256,
+        stats.curve25519_keys + stats.curve25519_shared_secrets,
+        stats.ed25519_signs + stats.ed25519_verifies,
+    };
+    if (std::getenv("OLM_BUDGET_PRINT")) {
+        std::cout << file << ":" << line << ": " << call_expr << ": {"
+            << actual.sha256_blocks << ", " << actual.hmac_sha256 << ", "
+            << actual.curve25519 << ", " << actual.ed25519 << "}"
+            << std::endl;
+        return;
+    }
+    struct { const char * name; std::uint64_t limit, used; } counts[] = {
+        {"sha256_blocks", budget.sha256_blocks, actual.sha256_blocks},
+        {"hmac_sha256", budget.hmac_sha256, actual.hmac_sha256},
+        {"curve25519", budget.curve25519, actual.curve25519},
+        {"ed25519", budget.ed25519, actual.ed25519},
+    };
+    for (auto const & count : counts) {
+        if (count.used > count.limit) {
+            std::cout << "FAILED: " << TEST_CASE << std::endl;
+            std::cout << file << ":" << line << std::endl;
+            std::cout << call_expr << " went over its budget" << std::endl;
+            std::cout << count.name << " budget: " << count.limit
+                << std::endl;
+            std::cout << count.name << " used:   " << count.used
+                << std::endl;
+            std::exit(1);
+        }
+    }
+}
+
+/** Run the call with the counters reset, and fail if it did more work than
+ * the budget, given as {sha256_blocks, hmac_sha256, curve25519, ed25519},
+ * allows. */
+#define assert_within_budget(call, ...) do { \
+    olm_stats_reset(); \
+    call; \
+    assert_within_budget(__FILE__, __LINE__, #call, Budget __VA_ARGS__); \
+} while (0)
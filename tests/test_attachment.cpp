@@ -0,0 +1,210 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/attachment.h"
+#include "olm/cpu.h"
+#include "unittest.hh"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+int main() {
+
+{ /** Attachment encryption test */
+
+TestCase test_case("Attachment encryption test");
+
+/* F.5.5 of NIST SP 800-38A, whose counter doesn't reach the first 8 bytes */
+std::uint8_t const key[32] = {
+    0x60, 0x3D, 0xEB, 0x10, 0x15, 0xCA, 0x71, 0xBE,
+    0x2B, 0x73, 0xAE, 0xF0, 0x85, 0x7D, 0x77, 0x81,
+    0x1F, 0x35, 0x2C, 0x07, 0x3B, 0x61, 0x08, 0xD7,
+    0x2D, 0x98, 0x10, 0xA3, 0x09, 0x14, 0xDF, 0xF4,
+};
+std::uint8_t const iv[16] = {
+    0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7,
+    0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF,
+};
+std::uint8_t const plaintext[64] = {
+    0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96,
+    0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+    0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C,
+    0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+    0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11,
+    0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF,
+    0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17,
+    0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10,
+};
+std::uint8_t const ciphertext[64] = {
+    0x60, 0x1E, 0xC3, 0x13, 0x77, 0x57, 0x89, 0xA5,
+    0xB7, 0xA7, 0xF5, 0x04, 0xBB, 0xF3, 0xD2, 0x28,
+    0xF4, 0x43, 0xE3, 0xCA, 0x4D, 0x62, 0xB5, 0x9A,
+    0xCA, 0x84, 0xE9, 0x90, 0xCA, 0xCA, 0xF5, 0xC5,
+    0x2B, 0x09, 0x30, 0xDA, 0xA2, 0x3D, 0xE9, 0x4C,
+    0xE8, 0x70, 0x17, 0xBA, 0x2D, 0x84, 0x98, 0x8D,
+    0xDF, 0xC9, 0xC5, 0x8D, 0xB6, 0x7A, 0xAD, 0xA6,
+    0x13, 0xC2, 0xDD, 0x08, 0x45, 0x79, 0x41, 0xA6,
+};
+/* the unpadded base64 of the SHA-256 of the ciphertext */
+std::uint8_t const hash[] = "ZjExoH6exWoMfQZrvET9Tu+kuul87rJwH1PSFT6C/6U";
+
+assert_equals(std::size_t(32), ::olm_attachment_key_length());
+assert_equals(std::size_t(16), ::olm_attachment_iv_length());
+assert_equals(sizeof(hash) - 1, ::olm_attachment_hash_length());
+
+std::vector<std::uint8_t> memory(::olm_attachment_size());
+::OlmAttachment *attachment = ::olm_attachment(memory.data());
+
+/* in pieces that don't line up with the blocks */
+assert_equals(std::size_t(0), ::olm_attachment_encrypt_init(
+    attachment, key, sizeof(key), iv, sizeof(iv)
+));
+std::uint8_t output[64];
+std::size_t const pieces[] = {5, 11, 0, 17, 31};
+std::size_t offset = 0;
+for (std::size_t piece : pieces) {
+    assert_equals(piece, ::olm_attachment_update(
+        attachment, plaintext + offset, piece,
+        output + offset, sizeof(output) - offset
+    ));
+    offset += piece;
+}
+assert_equals(ciphertext, output, sizeof(ciphertext));
+std::uint8_t actual_hash[sizeof(hash) - 1];
+assert_equals(sizeof(actual_hash), ::olm_attachment_encrypt_final(
+    attachment, actual_hash, sizeof(actual_hash)
+));
+assert_equals(hash, actual_hash, sizeof(actual_hash));
+
+/* the cipher has to be started again */
+assert_equals(std::size_t(-1), ::olm_attachment_update(
+    attachment, plaintext, 1, output, sizeof(output)
+));
+assert_equals(
+    std::string("BAD_STREAM_STATE"),
+    std::string(::olm_attachment_last_error(attachment))
+);
+
+/* and decrypting in place, all at once */
+assert_equals(std::size_t(0), ::olm_attachment_decrypt_init(
+    attachment, key, sizeof(key), iv, sizeof(iv)
+));
+assert_equals(std::size_t(-1), ::olm_attachment_encrypt_final(
+    attachment, actual_hash, sizeof(actual_hash)
+));
+assert_equals(
+    std::string("BAD_STREAM_STATE"),
+    std::string(::olm_attachment_last_error(attachment))
+);
+assert_equals(sizeof(output), ::olm_attachment_update(
+    attachment, output, sizeof(output), output, sizeof(output)
+));
+assert_equals(plaintext, output, sizeof(plaintext));
+assert_equals(std::size_t(0), ::olm_attachment_decrypt_final(
+    attachment, hash, sizeof(hash) - 1
+));
+
+::olm_clear_attachment(attachment);
+}
+
+{ /** Attachment decryption failure test */
+
+TestCase test_case("Attachment decryption failure test");
+
+std::uint8_t key[32], iv[16];
+for (unsigned i = 0; i < sizeof(key); ++i) key[i] = i;
+for (unsigned i = 0; i < 8; ++i) iv[i] = 0xA0 + i;
+std::memset(iv + 8, 0, 8);
+
+std::vector<std::uint8_t> memory(::olm_attachment_size());
+::OlmAttachment *attachment = ::olm_attachment(memory.data());
+
+assert_equals(std::size_t(-1), ::olm_attachment_encrypt_init(
+    attachment, key, sizeof(key) - 1, iv, sizeof(iv)
+));
+assert_equals(
+    std::string("BAD_ATTACHMENT_KEY"),
+    std::string(::olm_attachment_last_error(attachment))
+);
+assert_equals(std::size_t(-1), ::olm_attachment_decrypt_init(
+    attachment, key, sizeof(key), iv, 12
+));
+assert_equals(
+    std::string("BAD_ATTACHMENT_KEY"),
+    std::string(::olm_attachment_last_error(attachment))
+);
+
+std::vector<std::uint8_t> file(10000);
+for (std::size_t i = 0; i < file.size(); ++i) {
+    file[i] = std::uint8_t(i * 7);
+}
+std::vector<std::uint8_t> encrypted(file.size());
+std::uint8_t hash[43];
+::olm_attachment_encrypt_init(attachment, key, sizeof(key), iv, sizeof(iv));
+assert_equals(std::size_t(-1), ::olm_attachment_update(
+    attachment, file.data(), file.size(), encrypted.data(), file.size() - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_attachment_last_error(attachment))
+);
+::olm_attachment_update(
+    attachment, file.data(), file.size(), encrypted.data(), encrypted.size()
+);
+::olm_attachment_encrypt_final(attachment, hash, sizeof(hash));
+
+/* a changed byte of the ciphertext doesn't match the hash */
+std::vector<std::uint8_t> decrypted(encrypted);
+decrypted[9876] ^= 1;
+::olm_attachment_decrypt_init(attachment, key, sizeof(key), iv, sizeof(iv));
+::olm_attachment_update(
+    attachment, decrypted.data(), decrypted.size(),
+    decrypted.data(), decrypted.size()
+);
+assert_equals(std::size_t(-1), ::olm_attachment_decrypt_final(
+    attachment, hash, sizeof(hash)
+));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"),
+    std::string(::olm_attachment_last_error(attachment))
+);
+
+/* and the accelerated and portable kernels agree on a file longer than the
+ * chunks it is hashed in */
+for (unsigned mask : {~0u, 0u}) {
+    _olm_cpu_set_feature_mask(mask);
+    decrypted = encrypted;
+    ::olm_attachment_decrypt_init(
+        attachment, key, sizeof(key), iv, sizeof(iv)
+    );
+    assert_equals(std::size_t(1), ::olm_attachment_update(
+        attachment, decrypted.data(), 1, decrypted.data(), 1
+    ));
+    assert_equals(decrypted.size() - 1, ::olm_attachment_update(
+        attachment, decrypted.data() + 1, decrypted.size() - 1,
+        decrypted.data() + 1, decrypted.size() - 1
+    ));
+    assert_equals(std::size_t(0), ::olm_attachment_decrypt_final(
+        attachment, hash, sizeof(hash)
+    ));
+    assert_equals(file.data(), decrypted.data(), file.size());
+}
+_olm_cpu_set_feature_mask(~0u);
+
+::olm_clear_attachment(attachment);
+}
+
+}
@@ -1,7 +1,10 @@
 #include "olm/base64.hh"
 #include "olm/base64.h"
+#include "olm/cpu.h"
 #include "unittest.hh"
 
+#include <vector>
+
 int main() {
 
 { /* Base64 encode test */
@@ -67,4 +70,106 @@ assert_equals(expected_output, output, output_length);
 }
 
 
+{
+TestCase test_case("Base64 vector kernels match the table loops");
+
+std::uint32_t const masks[] = {
+    0, OLM_CPU_FEATURE_SIMD128, ~0u
+};
+
+std::vector<std::uint8_t> input(300);
+for (std::size_t i = 0; i < input.size(); ++i) {
+    input[i] = std::uint8_t(i * 7 + (i >> 3) * 13);
+}
+
+for (std::size_t length = 0; length <= input.size(); ++length) {
+    std::vector<std::uint8_t> expected(olm::encode_base64_length(length));
+    _olm_cpu_set_feature_mask(0);
+    olm::encode_base64(input.data(), length, expected.data());
+
+    for (std::uint32_t mask : masks) {
+        _olm_cpu_set_feature_mask(mask);
+        std::vector<std::uint8_t> encoded(expected.size());
+        olm::encode_base64(input.data(), length, encoded.data());
+        assert_equals(true, encoded == expected);
+
+        std::vector<std::uint8_t> decoded(length);
+        olm::decode_base64(encoded.data(), encoded.size(), decoded.data());
+        assert_equals(true, decoded == std::vector<std::uint8_t>(
+            input.begin(), input.begin() + length
+        ));
+    }
+}
+
+/* characters outside the alphabet decode the same as they always have,
+ * wherever they are */
+std::vector<std::uint8_t> encoded(olm::encode_base64_length(input.size()));
+olm::encode_base64(input.data(), input.size(), encoded.data());
+std::uint8_t const bad_characters[] = {'=', '-', '_', ' ', 0x80, 0xEF};
+for (std::uint8_t bad : bad_characters) {
+    for (std::size_t pos = 0; pos < encoded.size(); pos += 9) {
+        std::vector<std::uint8_t> corrupted(encoded);
+        corrupted[pos] = bad;
+        std::vector<std::uint8_t> expected(input.size());
+        _olm_cpu_set_feature_mask(0);
+        olm::decode_base64(corrupted.data(), corrupted.size(), expected.data());
+        for (std::uint32_t mask : masks) {
+            _olm_cpu_set_feature_mask(mask);
+            std::vector<std::uint8_t> decoded(input.size());
+            olm::decode_base64(
+                corrupted.data(), corrupted.size(), decoded.data()
+            );
+            assert_equals(true, decoded == expected);
+        }
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
+}
+
+{
+TestCase test_case("Base64 strict decode test");
+
+std::uint8_t input[] =
+    "SGVsbG8gV29ybGQgSGVsbG8gV29ybGQgSGVsbG8gV29ybGQgSGVsbG8gV29ybGQgSGVsbG8";
+std::size_t input_length = sizeof(input) - 1;
+std::size_t raw_length = olm::decode_base64_length(input_length);
+std::vector<std::uint8_t> expected(raw_length), output(raw_length);
+olm::decode_base64(input, input_length, expected.data());
+
+std::size_t error_position = 0;
+assert_equals(raw_length, olm::decode_base64_strict(
+    input, input_length, output.data(), error_position
+));
+assert_equals(true, output == expected);
+
+/* a bad character is found wherever it is, with or without the vector
+ * kernels */
+std::uint32_t const masks[] = {0, ~0u};
+for (std::uint32_t mask : masks) {
+    _olm_cpu_set_feature_mask(mask);
+    for (std::size_t pos = 0; pos < input_length; ++pos) {
+        std::vector<std::uint8_t> corrupted(input, input + input_length);
+        corrupted[pos] = pos % 2 ? '=' : 0xC3;
+        error_position = 0;
+        assert_equals(std::size_t(-1), olm::decode_base64_strict(
+            corrupted.data(), corrupted.size(), output.data(), error_position
+        ));
+        assert_equals(pos, error_position);
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
+
+/* a length no base64 can have */
+assert_equals(std::size_t(-1), olm::decode_base64_strict(
+    input, 5, output.data(), error_position
+));
+assert_equals(std::size_t(4), error_position);
+
+/* the C binding rejects bad characters too */
+input[3] = '.';
+assert_equals(std::size_t(-1), ::_olm_decode_base64(
+    input, input_length, output.data()
+));
+}
+
 }
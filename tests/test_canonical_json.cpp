@@ -0,0 +1,275 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/canonical_json.hh"
+#include "olm/olm.h"
+#include "unittest.hh"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::string canonical(std::string json) {
+    std::size_t length = olm::canonical_json(
+        (std::uint8_t *)&json[0], json.size()
+    );
+    if (length == std::size_t(-1)) {
+        return "invalid";
+    }
+    return json.substr(0, length);
+}
+
+/** A device's keys, signed by the device, as in a /keys/query response */
+static std::string signed_device_keys(
+    OlmAccount * account, std::string const & device_id,
+    std::string const & ed25519_key
+) {
+    std::string keys =
+        "{ \"user_id\": \"@alice:example.com\", \"device_id\": \"" + device_id
+        + "\", \"algorithms\": [\"m.olm.v1.curve25519-aes-sha2\"],"
+        " \"keys\": {\"ed25519:" + device_id + "\": \"" + ed25519_key + "\"},"
+        " \"unsigned\": {\"device_display_name\": \"Alice's phone\"} }";
+    std::vector<std::uint8_t> utility_buffer(olm_utility_size());
+    OlmUtility * utility = olm_utility(utility_buffer.data());
+    std::string canonical_keys(keys);
+    std::size_t length = olm_canonical_json(
+        utility, &canonical_keys[0], canonical_keys.size()
+    );
+    std::vector<std::uint8_t> signature(olm_account_signature_length(account));
+    olm_account_sign(
+        account, canonical_keys.data(), length,
+        signature.data(), signature.size()
+    );
+    keys.resize(keys.size() - 2);
+    return keys + ", \"signatures\": {\"@alice:example.com\": {\"ed25519:"
+        + device_id + "\": \""
+        + std::string(signature.begin(), signature.end()) + "\"}} }";
+}
+
+int main() {
+
+{ /** Canonical JSON test */
+
+TestCase test_case("Canonical JSON test");
+
+assert_equals(
+    std::string("{\"one\":1,\"two\":\"Two\"}"),
+    canonical("{\"one\": 1, \"two\": \"Two\"}")
+);
+assert_equals(
+    std::string("{\"a\":\"1\",\"b\":\"2\"}"),
+    canonical("{\n  \"b\": \"2\",\n  \"a\": \"1\"\n}")
+);
+assert_equals(
+    std::string(
+        "{\"auth\":{\"mxid\":\"@john.doe:example.com\",\"profile\":"
+        "{\"display_name\":\"John Doe\",\"three_pids\":["
+        "{\"address\":\"john.doe@example.org\",\"medium\":\"email\"},"
+        "{\"address\":\"123456789\",\"medium\":\"msisdn\"}]},"
+        "\"success\":true}}"
+    ),
+    canonical(
+        "{\"auth\": {\"success\": true, \"mxid\": \"@john.doe:example.com\","
+        " \"profile\": {\"display_name\": \"John Doe\", \"three_pids\": ["
+        "{\"medium\": \"email\", \"address\": \"john.doe@example.org\"},"
+        " {\"medium\": \"msisdn\", \"address\": \"123456789\"}]}}}"
+    )
+);
+/* keys are sorted by code point, escaped or not */
+assert_equals(
+    std::string("{\"\xe6\x97\xa5\":1,\"\xe6\x9c\xac\":2}"),
+    canonical("{\"\xe6\x9c\xac\": 2, \"\\u65E5\": 1}")
+);
+assert_equals(
+    std::string("{\"a\":\"\xf0\x9f\x98\x80\",\"b\":\"\\u0001\\n/\\\"\\\\\"}"),
+    canonical(
+        "{\"b\": \"\\u0001\\u000a\\/\\u0022\\\\\", "
+        "\"a\": \"\\ud83d\\ude00\"}"
+    )
+);
+assert_equals(
+    std::string(
+        "{\"a\":[],\"b\":{},\"c\":null,\"d\":0,\"e\":-9007199254740991}"
+    ),
+    canonical(
+        "{\"e\":-9007199254740991,\"d\":-0,\"c\":null,\"b\":{ },\"a\":[ ]}"
+    )
+);
+/* the shorter key comes first */
+assert_equals(
+    std::string("{\"a\":1,\"aa\":2,\"ab\":3}"),
+    canonical("{\"ab\":3,\"aa\":2,\"a\":1}")
+);
+
+char const * invalid[] = {
+    "[1, 2]",
+    "{\"a\": 1,}",
+    "{\"a\": 1, \"a\": 2}",
+    "{\"a\": 1.5}",
+    "{\"a\": 1e3}",
+    "{\"a\": 01}",
+    "{\"a\": 9007199254740992}",
+    "{\"a\": \"\x01\"}",
+    "{\"a\": \"\\ud83d\"}",
+    "{\"a\": \"\\x\"}",
+    "{\"a\": \"\xc0\xaf\"}",
+    "{\"a\": \"\xed\xa0\x80\"}",
+    "{\"a\": tru}",
+    "{\"a\": 1} x",
+    "{\"a\": \"1}",
+};
+for (char const * json : invalid) {
+    assert_equals(std::string("invalid"), canonical(json));
+}
+
+std::string deep(100, '[');
+assert_equals(
+    std::string("invalid"),
+    canonical("{\"a\":" + deep + std::string(100, ']') + "}")
+);
+}
+
+{ /** Signed JSON test */
+
+TestCase test_case("Signed JSON test");
+
+std::vector<std::uint8_t> random(64, 'A');
+std::vector<std::uint8_t> account_buffer(olm_account_size());
+OlmAccount * account = olm_account(account_buffer.data());
+olm_create_account(account, random.data(), random.size());
+std::vector<std::uint8_t> id_keys(olm_account_identity_keys_length(account));
+olm_account_identity_keys(account, id_keys.data(), id_keys.size());
+std::string key((char *)id_keys.data() + 71, 43);
+
+std::vector<std::uint8_t> utility_buffer(olm_utility_size());
+OlmUtility * utility = olm_utility(utility_buffer.data());
+
+std::string const user_id("@alice:example.com");
+std::string const key_id("ed25519:JLAFKJWSCS");
+std::string json = signed_device_keys(account, "JLAFKJWSCS", key);
+std::string copy(json);
+
+assert_equals(std::size_t(0), olm_ed25519_verify_json(
+    utility, key.data(), key.size(), user_id.data(), user_id.size(),
+    key_id.data(), key_id.size(), &copy[0], copy.size()
+));
+
+/* the canonical JSON is what was signed */
+std::string canonical_json(json);
+std::size_t length = olm_canonical_json(
+    utility, &canonical_json[0], canonical_json.size()
+);
+assert_equals(
+    std::string(
+        "{\"algorithms\":[\"m.olm.v1.curve25519-aes-sha2\"],"
+        "\"device_id\":\"JLAFKJWSCS\",\"keys\":{\"ed25519:JLAFKJWSCS\":\""
+    ) + key + "\"},\"user_id\":\"@alice:example.com\"}",
+    canonical_json.substr(0, length)
+);
+
+/* changing what was signed, or asking for a signature that isn't there,
+ * fails */
+copy = json;
+copy.replace(copy.find("Alice's phone"), 5, "Eve's");
+assert_equals(std::size_t(0), olm_ed25519_verify_json(
+    utility, key.data(), key.size(), user_id.data(), user_id.size(),
+    key_id.data(), key_id.size(), &copy[0], copy.size()
+));
+copy = json;
+copy.replace(copy.find("m.olm"), 5, "m.mlo");
+assert_equals(std::size_t(-1), olm_ed25519_verify_json(
+    utility, key.data(), key.size(), user_id.data(), user_id.size(),
+    key_id.data(), key_id.size(), &copy[0], copy.size()
+));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"), std::string(olm_utility_last_error(utility))
+);
+copy = json;
+assert_equals(std::size_t(-1), olm_ed25519_verify_json(
+    utility, key.data(), key.size(), user_id.data(), user_id.size(),
+    "ed25519:OTHER", 13, &copy[0], copy.size()
+));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"), std::string(olm_utility_last_error(utility))
+);
+copy = "{\"signatures\": 1";
+assert_equals(std::size_t(-1), olm_ed25519_verify_json(
+    utility, key.data(), key.size(), user_id.data(), user_id.size(),
+    key_id.data(), key_id.size(), &copy[0], copy.size()
+));
+assert_equals(
+    std::string("INVALID_JSON"), std::string(olm_utility_last_error(utility))
+);
+}
+
+{ /** Signed JSON batch test */
+
+TestCase test_case("Signed JSON batch test");
+
+std::vector<std::uint8_t> utility_buffer(olm_utility_size());
+OlmUtility * utility = olm_utility(utility_buffer.data());
+
+const std::size_t count = 70;
+std::vector<std::vector<std::uint8_t>> accounts(count);
+std::vector<std::string> keys(count), key_ids(count), jsons(count);
+std::string const user_id("@alice:example.com");
+for (std::size_t i = 0; i < count; ++i) {
+    std::vector<std::uint8_t> random(64, 'A' + i % 26);
+    random[0] = i;
+    accounts[i].resize(olm_account_size());
+    OlmAccount * account = olm_account(accounts[i].data());
+    olm_create_account(account, random.data(), random.size());
+    std::vector<std::uint8_t> id_keys(
+        olm_account_identity_keys_length(account)
+    );
+    olm_account_identity_keys(account, id_keys.data(), id_keys.size());
+    keys[i].assign((char *)id_keys.data() + 71, 43);
+    std::string device_id = "DEVICE" + std::to_string(i);
+    key_ids[i] = "ed25519:" + device_id;
+    jsons[i] = signed_device_keys(account, device_id, keys[i]);
+}
+/* one signed by someone else, and one that isn't JSON */
+keys[3] = keys[4];
+jsons[65] = "not json";
+
+void const * key_ptrs[count];
+std::size_t key_lengths[count];
+void const * user_id_ptrs[count];
+std::size_t user_id_lengths[count];
+void const * key_id_ptrs[count];
+std::size_t key_id_lengths[count];
+void * json_ptrs[count];
+std::size_t json_lengths[count];
+std::uint8_t results[count];
+for (std::size_t i = 0; i < count; ++i) {
+    key_ptrs[i] = keys[i].data();
+    key_lengths[i] = keys[i].size();
+    user_id_ptrs[i] = user_id.data();
+    user_id_lengths[i] = user_id.size();
+    key_id_ptrs[i] = key_ids[i].data();
+    key_id_lengths[i] = key_ids[i].size();
+    json_ptrs[i] = &jsons[i][0];
+    json_lengths[i] = jsons[i].size();
+}
+
+assert_equals(std::size_t(2), olm_ed25519_verify_json_batch(
+    utility, count, key_ptrs, key_lengths, user_id_ptrs, user_id_lengths,
+    key_id_ptrs, key_id_lengths, json_ptrs, json_lengths, results
+));
+for (std::size_t i = 0; i < count; ++i) {
+    assert_equals(std::uint8_t(i != 3 && i != 65), results[i]);
+}
+}
+
+}
@@ -13,9 +13,25 @@
  * limitations under the License.
  */
 #include "olm/crypto.h"
+#include "olm/aes_ct.h"
+#include "olm/cpu.h"
+#include "olm/curve25519.h"
+#include "olm/curve25519_mb.h"
+#include "olm/olm.h"
 
 #include "unittest.hh"
 
+extern "C" {
+#include "crypto-algorithms/aes.h"
+#include "ed25519/src/ge.h"
+#include "ed25519/src/sc.h"
+#include "ed25519/src/sha512.h"
+}
+
+#include <cstring>
+#include <string>
+#include <vector>
+
 int main() {
 
 
@@ -80,8 +96,144 @@ _olm_crypto_curve25519_shared_secret(&bob_pair, &alice_pair.public_key, actual_a
 
 assert_equals(expected_agreement, actual_agreement, 32);
 
+/* and again with the 32-bit implementation, if it isn't the default */
+_olm_curve25519_backend backend = _olm_curve25519_get_backend();
+_olm_curve25519_set_backend(OLM_CURVE25519_DONNA);
+
+_olm_crypto_curve25519_generate_key(alice_private, &alice_pair);
+assert_equals(alice_public, alice_pair.public_key.public_key, 32);
+
+std::memset(actual_agreement, 0, sizeof(actual_agreement));
+_olm_crypto_curve25519_shared_secret(&bob_pair, &alice_pair.public_key, actual_agreement);
+assert_equals(expected_agreement, actual_agreement, 32);
+
+/* and with the ladder steps paired up in the vector unit, if there is one */
+if (_olm_curve25519_set_backend(OLM_CURVE25519_PAIRED)) {
+    std::memset(actual_agreement, 0, sizeof(actual_agreement));
+    _olm_crypto_curve25519_shared_secret(
+        &alice_pair, &bob_pair.public_key, actual_agreement
+    );
+    assert_equals(expected_agreement, actual_agreement, 32);
+}
+
+_olm_curve25519_set_backend(backend);
+
 } /* Curve25529 Test Case 1 */
 
+{ /* Curve25519 Test Case 2 */
+
+TestCase test_case("Curve25519 fixed-base matches the ladder");
+
+std::uint8_t const base_point[32] = {9};
+std::uint8_t secret[32];
+std::uint8_t expected[32], actual[32];
+
+for (unsigned i = 0; i < 64; ++i) {
+    for (unsigned j = 0; j < 32; ++j) {
+        secret[j] = std::uint8_t(i * 37 + j * 11 + (i ^ j));
+    }
+    _olm_curve25519_scalarmult(expected, secret, base_point);
+    _olm_curve25519_scalarmult_base(actual, secret);
+    assert_equals(expected, actual, 32);
+}
+
+} /* Curve25519 Test Case 2 */
+
+{ /* Curve25519 Test Case 3 */
+
+TestCase test_case("Curve25519 batch key generation");
+
+/* more than one batch, and a partial one */
+std::uint8_t random[CURVE25519_RANDOM_LENGTH * 70];
+_olm_curve25519_key_pair expected, actual[70];
+
+for (unsigned i = 0; i < sizeof(random); ++i) {
+    random[i] = std::uint8_t(i * 37 + (i >> 5));
+}
+
+_olm_crypto_curve25519_generate_keys(70, random, actual);
+for (unsigned i = 0; i < 70; ++i) {
+    _olm_crypto_curve25519_generate_key(
+        random + i * CURVE25519_RANDOM_LENGTH, &expected
+    );
+    assert_equals(
+        expected.public_key.public_key, actual[i].public_key.public_key, 32
+    );
+    assert_equals(
+        expected.private_key.private_key, actual[i].private_key.private_key, 32
+    );
+}
+
+} /* Curve25519 Test Case 3 */
+
+{ /* Curve25519 Test Case 4 */
+
+TestCase test_case("Curve25519 multi-lane ladder");
+
+/* up to two full sets of lanes and a part-filled one */
+std::uint8_t secrets[9][32], points[9][32], expected[32];
+std::uint8_t actual[9][32], actual_mb[9][32];
+std::uint8_t * outputs[9];
+std::uint8_t * outputs_mb[9];
+std::uint8_t const * secret_ptrs[9];
+std::uint8_t const * point_ptrs[9];
+
+for (unsigned i = 0; i < 9; ++i) {
+    for (unsigned j = 0; j < 32; ++j) {
+        secrets[i][j] = std::uint8_t(i * 53 + j * 13 + (i ^ j));
+        points[i][j] = std::uint8_t(i * 29 + j * 71 + (i | j));
+    }
+    outputs[i] = actual[i];
+    outputs_mb[i] = actual_mb[i];
+    secret_ptrs[i] = secrets[i];
+    point_ptrs[i] = points[i];
+}
+/* the top bit is ignored, and points needn't be reduced mod p */
+std::memset(points[1], 0xff, 32);
+std::memset(points[2], 0, 32);
+points[2][0] = 9;
+points[4][31] |= 0x80;
+
+_olm_curve25519_backend backend = _olm_curve25519_get_backend();
+for (unsigned pass = 0; pass < 4; ++pass) {
+    /* the default backend, the 32-bit one, the paired vector ladder (which
+     * the multi-lane kernel checks) if there is one, then with no vector
+     * kernel */
+    if (pass == 1) {
+        _olm_curve25519_set_backend(OLM_CURVE25519_DONNA);
+    } else if (pass == 2) {
+        if (!_olm_curve25519_set_backend(OLM_CURVE25519_PAIRED)) {
+            continue;
+        }
+    } else if (pass == 3) {
+        _olm_curve25519_set_backend(backend);
+        _olm_cpu_set_feature_mask(0);
+    }
+    for (unsigned count = 1; count <= 9; ++count) {
+        bool vector = _olm_curve25519_mb_lanes() > 1;
+        std::memset(actual, 0, sizeof(actual));
+        std::memset(actual_mb, 0, sizeof(actual_mb));
+        _olm_curve25519_scalarmult_many(
+            count, outputs, secret_ptrs, point_ptrs
+        );
+        if (vector) {
+            _olm_curve25519_scalarmult_mb(
+                count, outputs_mb, secret_ptrs, point_ptrs
+            );
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            _olm_curve25519_scalarmult(expected, secrets[i], points[i]);
+            assert_equals(expected, actual[i], 32);
+            if (vector) {
+                assert_equals(expected, actual_mb[i], 32);
+            }
+        }
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
+
+} /* Curve25519 Test Case 4 */
+
 
 {
 TestCase test_case("Ed25519 Signature Test Case 1");
@@ -110,6 +262,359 @@ result = _olm_crypto_ed25519_verify(
 assert_equals(false, result);
 }
 
+{
+TestCase test_case("Ed25519 Signature Test Case 2");
+
+/* RFC 8032 section 7.1, TEST 2, which pins down the field arithmetic that
+ * Test Case 1 only checks against itself */
+std::uint8_t const seed[32] = {
+    0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda,
+    0x9d, 0xb6, 0xc3, 0x46, 0xec, 0x11, 0x4e, 0x0f,
+    0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab, 0xa6, 0x24,
+    0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb
+};
+std::uint8_t const public_key[32] = {
+    0x3d, 0x40, 0x17, 0xc3, 0xe8, 0x43, 0x89, 0x5a,
+    0x92, 0xb7, 0x0a, 0xa7, 0x4d, 0x1b, 0x7e, 0xbc,
+    0x9c, 0x98, 0x2c, 0xcf, 0x2e, 0xc4, 0x96, 0x8c,
+    0xc0, 0xcd, 0x55, 0xf1, 0x2a, 0xf4, 0x66, 0x0c
+};
+std::uint8_t const message[1] = {0x72};
+std::uint8_t const expected_signature[64] = {
+    0x92, 0xa0, 0x09, 0xa9, 0xf0, 0xd4, 0xca, 0xb8,
+    0x72, 0x0e, 0x82, 0x0b, 0x5f, 0x64, 0x25, 0x40,
+    0xa2, 0xb2, 0x7b, 0x54, 0x16, 0x50, 0x3f, 0x8f,
+    0xb3, 0x76, 0x22, 0x23, 0xeb, 0xdb, 0x69, 0xda,
+    0x08, 0x5a, 0xc1, 0xe4, 0x3e, 0x15, 0x99, 0x6e,
+    0x45, 0x8f, 0x36, 0x13, 0xd0, 0xf1, 0x1d, 0x8c,
+    0x38, 0x7b, 0x2e, 0xae, 0xb4, 0x30, 0x2a, 0xee,
+    0xb0, 0x0d, 0x29, 0x16, 0x12, 0xbb, 0x0c, 0x00
+};
+
+_olm_ed25519_key_pair key_pair;
+_olm_crypto_ed25519_generate_key(seed, &key_pair);
+assert_equals(public_key, key_pair.public_key.public_key, 32);
+
+std::uint8_t signature[64];
+_olm_crypto_ed25519_sign(&key_pair, message, 1, signature);
+assert_equals(expected_signature, signature, 64);
+
+bool result = _olm_crypto_ed25519_verify(
+    &key_pair.public_key, message, 1, signature
+);
+assert_equals(true, result);
+}
+
+{ /* SHA-512 Test Case 1 */
+
+TestCase test_case("SHA-512 Test Case 1");
+
+/* the FIPS 180-2 examples, of one and two blocks, and a long message which
+ * is hashed many blocks at a time, with each kernel */
+std::uint8_t const abc_expected[64] = {
+    0xdd, 0xaf, 0x35, 0xa1, 0x93, 0x61, 0x7a, 0xba,
+    0xcc, 0x41, 0x73, 0x49, 0xae, 0x20, 0x41, 0x31,
+    0x12, 0xe6, 0xfa, 0x4e, 0x89, 0xa9, 0x7e, 0xa2,
+    0x0a, 0x9e, 0xee, 0xe6, 0x4b, 0x55, 0xd3, 0x9a,
+    0x21, 0x92, 0x99, 0x2a, 0x27, 0x4f, 0xc1, 0xa8,
+    0x36, 0xba, 0x3c, 0x23, 0xa3, 0xfe, 0xeb, 0xbd,
+    0x45, 0x4d, 0x44, 0x23, 0x64, 0x3c, 0xe8, 0x0e,
+    0x2a, 0x9a, 0xc9, 0x4f, 0xa5, 0x4c, 0xa4, 0x9f
+};
+char const two_blocks[] =
+    "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+    "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+std::uint8_t const two_blocks_expected[64] = {
+    0x8e, 0x95, 0x9b, 0x75, 0xda, 0xe3, 0x13, 0xda,
+    0x8c, 0xf4, 0xf7, 0x28, 0x14, 0xfc, 0x14, 0x3f,
+    0x8f, 0x77, 0x79, 0xc6, 0xeb, 0x9f, 0x7f, 0xa1,
+    0x72, 0x99, 0xae, 0xad, 0xb6, 0x88, 0x90, 0x18,
+    0x50, 0x1d, 0x28, 0x9e, 0x49, 0x00, 0xf7, 0xe4,
+    0x33, 0x1b, 0x99, 0xde, 0xc4, 0xb5, 0x43, 0x3a,
+    0xc7, 0xd3, 0x29, 0xee, 0xb6, 0xdd, 0x26, 0x54,
+    0x5e, 0x96, 0xe5, 0x5b, 0x87, 0x4b, 0xe9, 0x09
+};
+std::vector<std::uint8_t> long_message(1000);
+for (unsigned i = 0; i < long_message.size(); ++i) {
+    long_message[i] = std::uint8_t(i * 7 + (i >> 8));
+}
+
+std::uint8_t digest[64], long_digest[2][64];
+for (unsigned pass = 0; pass < 2; ++pass) {
+    _olm_cpu_set_feature_mask(pass ? 0 : ~0u);
+    ::sha512(reinterpret_cast<std::uint8_t const *>("abc"), 3, digest);
+    assert_equals(abc_expected, digest, 64);
+    ::sha512(
+        reinterpret_cast<std::uint8_t const *>(two_blocks),
+        sizeof(two_blocks) - 1, digest
+    );
+    assert_equals(two_blocks_expected, digest, 64);
+    ::sha512(long_message.data(), long_message.size(), long_digest[pass]);
+}
+_olm_cpu_set_feature_mask(~0u);
+assert_equals(long_digest[0], long_digest[1], 64);
+
+} /* SHA-512 Test Case 1 */
+
+{ /* Ed25519 Prepared Key Test Case 1 */
+
+TestCase test_case("Ed25519 Prepared Key Verification");
+std::uint8_t private_key[33] = "This key is a string of 32 bytes";
+
+std::uint8_t message[] = "Hello, World";
+std::size_t message_length = sizeof(message) - 1;
+
+_olm_ed25519_key_pair key_pair;
+_olm_crypto_ed25519_generate_key(private_key, &key_pair);
+_olm_ed25519_prepared_key prepared_key;
+_olm_crypto_ed25519_prepare_key(&key_pair.public_key, &prepared_key);
+
+std::uint8_t signature[64];
+_olm_crypto_ed25519_sign(
+    &key_pair, message, message_length, signature
+);
+
+assert_equals(1, _olm_crypto_ed25519_verify_prepared(
+    &prepared_key, message, message_length, signature
+));
+signature[40] ^= 1;
+assert_equals(0, _olm_crypto_ed25519_verify_prepared(
+    &prepared_key, message, message_length, signature
+));
+signature[40] ^= 1;
+message[0] = 'n';
+assert_equals(0, _olm_crypto_ed25519_verify_prepared(
+    &prepared_key, message, message_length, signature
+));
+
+/* keys which aren't points on the curve never verify */
+bool found_invalid = false;
+for (unsigned i = 0; i < 16; ++i) {
+    _olm_ed25519_public_key public_key = {};
+    public_key.public_key[0] = std::uint8_t(i);
+    _olm_crypto_ed25519_prepare_key(&public_key, &prepared_key);
+    found_invalid |= !prepared_key.valid;
+    assert_equals(
+        _olm_crypto_ed25519_verify(
+            &public_key, message, message_length, signature
+        ),
+        _olm_crypto_ed25519_verify_prepared(
+            &prepared_key, message, message_length, signature
+        )
+    );
+}
+assert_equals(true, found_invalid);
+
+} /* Ed25519 Prepared Key Test Case 1 */
+
+{ /* Ed25519 Batch Test Case 1 */
+
+TestCase test_case("Ed25519 Batch Verification");
+
+/* runs of signatures by each of a few keys */
+const std::size_t count = 40;
+_olm_ed25519_key_pair key_pairs[count];
+_olm_ed25519_public_key public_keys[count];
+std::uint8_t messages[count][16];
+std::uint8_t signatures[count][64];
+std::uint8_t const * message_ptrs[count];
+std::size_t message_lengths[count];
+std::uint8_t const * signature_ptrs[count];
+std::uint8_t results[count];
+
+for (std::size_t i = 0; i < count; ++i) {
+    std::uint8_t seed[32];
+    std::memset(seed, int(i + 1), sizeof(seed));
+    /* a few signatures by the same key */
+    if (i % 5 == 0) {
+        _olm_crypto_ed25519_generate_key(seed, &key_pairs[i]);
+    } else {
+        key_pairs[i] = key_pairs[i - 1];
+    }
+    public_keys[i] = key_pairs[i].public_key;
+    std::memset(messages[i], int(i), sizeof(messages[i]));
+    message_ptrs[i] = messages[i];
+    message_lengths[i] = 1 + i % sizeof(messages[i]);
+    _olm_crypto_ed25519_sign(
+        &key_pairs[i], messages[i], message_lengths[i], signatures[i]
+    );
+    signature_ptrs[i] = signatures[i];
+}
+
+assert_equals(std::size_t(0), _olm_crypto_ed25519_verify_batch(
+    count, public_keys, message_ptrs, message_lengths, signature_ptrs, results
+));
+for (std::size_t i = 0; i < count; ++i) {
+    assert_equals(std::uint8_t(1), results[i]);
+}
+
+/* break a few in different ways */
+messages[3][0] ^= 1;
+signatures[17][40] ^= 1;
+signatures[18][5] ^= 1;
+public_keys[30] = public_keys[0];
+signature_ptrs[39] = NULL;
+
+assert_equals(std::size_t(5), _olm_crypto_ed25519_verify_batch(
+    count, public_keys, message_ptrs, message_lengths, signature_ptrs, results
+));
+for (std::size_t i = 0; i < count; ++i) {
+    bool expected = signature_ptrs[i] && _olm_crypto_ed25519_verify(
+        &public_keys[i], messages[i], message_lengths[i], signatures[i]
+    );
+    assert_equals(std::uint8_t(expected), results[i]);
+}
+assert_equals(std::uint8_t(0), results[3]);
+assert_equals(std::uint8_t(0), results[17]);
+assert_equals(std::uint8_t(0), results[18]);
+assert_equals(std::uint8_t(0), results[30]);
+assert_equals(std::uint8_t(0), results[39]);
+
+} /* Ed25519 Batch Test Case 1 */
+
+{ /* Ed25519 Batch Test Case 2 */
+
+TestCase test_case("Ed25519 Batch Verification with small order components");
+
+/* the signer adds the point of order 2, T = (0, -1), to the R of one
+ * signature and subtracts it from another. Neither verifies on its own, and
+ * the batch mustn't let the two cancel out. */
+const std::size_t count = 3;
+std::uint8_t seed[32];
+std::memset(seed, 0x42, sizeof(seed));
+_olm_ed25519_key_pair key_pair;
+_olm_crypto_ed25519_generate_key(seed, &key_pair);
+
+_olm_ed25519_public_key public_keys[count];
+std::uint8_t messages[count][8];
+std::uint8_t signatures[count][64];
+std::uint8_t const * message_ptrs[count];
+std::size_t message_lengths[count];
+std::uint8_t const * signature_ptrs[count];
+std::uint8_t results[count];
+
+std::uint8_t torsion_point[32];
+std::memset(torsion_point, 0xff, sizeof(torsion_point));
+torsion_point[0] = 0xec;
+torsion_point[31] = 0x7f;
+ge_p3 T;
+/* (0, -1) is its own negation */
+ge_frombytes_negate_vartime(&T, torsion_point);
+ge_cached T_cached;
+ge_p3_to_cached(&T_cached, &T);
+
+for (std::size_t i = 0; i < count; ++i) {
+    public_keys[i] = key_pair.public_key;
+    std::memset(messages[i], int('a' + i), sizeof(messages[i]));
+    message_ptrs[i] = messages[i];
+    message_lengths[i] = sizeof(messages[i]);
+    signature_ptrs[i] = signatures[i];
+
+    std::uint8_t r[64];
+    std::memset(r, int(i + 1), sizeof(r));
+    sc_reduce(r);
+    ge_p3 R;
+    ge_scalarmult_base(&R, r);
+    ge_p1p1 sum;
+    if (i == 0) {
+        ge_add(&sum, &R, &T_cached);
+        ge_p1p1_to_p3(&R, &sum);
+    } else if (i == 1) {
+        ge_sub(&sum, &R, &T_cached);
+        ge_p1p1_to_p3(&R, &sum);
+    }
+    ge_p3_tobytes(signatures[i], &R);
+
+    /* S = r + H(R || A || M) a, as ed25519_sign */
+    std::uint8_t hram[64];
+    sha512_context hash;
+    sha512_init(&hash);
+    sha512_update(&hash, signatures[i], 32);
+    sha512_update(&hash, key_pair.public_key.public_key, 32);
+    sha512_update(&hash, messages[i], message_lengths[i]);
+    sha512_final(&hash, hram);
+    sc_reduce(hram);
+    sc_muladd(signatures[i] + 32, hram, key_pair.private_key.private_key, r);
+}
+
+bool result = _olm_crypto_ed25519_verify(
+    &public_keys[0], messages[0], message_lengths[0], signatures[0]
+);
+assert_equals(false, result);
+result = _olm_crypto_ed25519_verify(
+    &public_keys[1], messages[1], message_lengths[1], signatures[1]
+);
+assert_equals(false, result);
+result = _olm_crypto_ed25519_verify(
+    &public_keys[2], messages[2], message_lengths[2], signatures[2]
+);
+assert_equals(true, result);
+
+assert_equals(std::size_t(2), _olm_crypto_ed25519_verify_batch(
+    count, public_keys, message_ptrs, message_lengths, signature_ptrs, results
+));
+assert_equals(std::uint8_t(0), results[0]);
+assert_equals(std::uint8_t(0), results[1]);
+assert_equals(std::uint8_t(1), results[2]);
+
+/* the same with a key A + T. A signature S = r + h a has S B - h (A + T) =
+ * R - h T, so it only verifies on its own when h is even, but any two with
+ * odd h cancel out. */
+ge_p3 A;
+ge_p1p1 sum;
+ge_scalarmult_base(&A, key_pair.private_key.private_key);
+ge_add(&sum, &A, &T_cached);
+ge_p1p1_to_p3(&A, &sum);
+_olm_ed25519_public_key torsion_key;
+ge_p3_tobytes(torsion_key.public_key, &A);
+
+std::size_t odd = 0, even = 0;
+for (std::uint8_t m = 0; odd < 2 || even < 1; ++m) {
+    std::size_t i = odd < 2 ? odd : 2;
+    public_keys[i] = torsion_key;
+    std::memset(messages[i], m, sizeof(messages[i]));
+
+    std::uint8_t r[64];
+    std::memset(r, m, sizeof(r));
+    sc_reduce(r);
+    ge_p3 R;
+    ge_scalarmult_base(&R, r);
+    ge_p3_tobytes(signatures[i], &R);
+
+    std::uint8_t hram[64];
+    sha512_context hash;
+    sha512_init(&hash);
+    sha512_update(&hash, signatures[i], 32);
+    sha512_update(&hash, torsion_key.public_key, 32);
+    sha512_update(&hash, messages[i], message_lengths[i]);
+    sha512_final(&hash, hram);
+    sc_reduce(hram);
+    sc_muladd(signatures[i] + 32, hram, key_pair.private_key.private_key, r);
+
+    if (hram[0] & 1) {
+        if (odd < 2) {
+            odd++;
+        }
+    } else if (odd == 2) {
+        even++;
+    }
+}
+
+assert_equals(std::size_t(2), _olm_crypto_ed25519_verify_batch(
+    count, public_keys, message_ptrs, message_lengths, signature_ptrs, results
+));
+for (std::size_t i = 0; i < count; ++i) {
+    bool expected = _olm_crypto_ed25519_verify(
+        &public_keys[i], messages[i], message_lengths[i], signatures[i]
+    );
+    assert_equals(std::uint8_t(expected), results[i]);
+}
+assert_equals(std::uint8_t(0), results[0]);
+assert_equals(std::uint8_t(0), results[1]);
+assert_equals(std::uint8_t(1), results[2]);
+
+} /* Ed25519 Batch Test Case 2 */
+
 
 { /* AES Test Case 1 */
 
@@ -142,6 +647,341 @@ assert_equals(input, actual, length);
 } /* AES Test Case 1 */
 
 
+{ /* AES Test Case 2 */
+
+TestCase test_case("AES Test Case 2");
+
+/* check the accelerated and portable implementations agree on a message
+ * which isn't a whole number of blocks, and is long enough to use the
+ * multi-block decryption */
+_olm_aes256_key key;
+_olm_aes256_iv iv;
+std::uint8_t input[157];
+for (unsigned i = 0; i < sizeof(key.key); ++i) key.key[i] = i;
+for (unsigned i = 0; i < sizeof(iv.iv); ++i) iv.iv[i] = 0xF0 + i;
+for (unsigned i = 0; i < sizeof(input); ++i) input[i] = 3 * i;
+
+std::size_t length = _olm_crypto_aes_encrypt_cbc_length(sizeof(input));
+assert_equals(std::size_t(160), length);
+
+std::uint8_t accelerated[160], portable[160], decrypted[160];
+_olm_crypto_aes_encrypt_cbc(&key, &iv, input, sizeof(input), accelerated);
+_olm_cpu_set_feature_mask(0);
+_olm_crypto_aes_encrypt_cbc(&key, &iv, input, sizeof(input), portable);
+assert_equals(portable, accelerated, 160);
+
+length = _olm_crypto_aes_decrypt_cbc(&key, &iv, accelerated, 160, decrypted);
+assert_equals(sizeof(input), length);
+assert_equals(input, decrypted, length);
+_olm_cpu_set_feature_mask(~0u);
+
+length = _olm_crypto_aes_decrypt_cbc(&key, &iv, portable, 160, decrypted);
+assert_equals(sizeof(input), length);
+assert_equals(input, decrypted, length);
+
+} /* AES Test Case 2 */
+
+
+{ /* AES Test Case 3 */
+
+TestCase test_case("AES Test Case 3");
+
+/* the bitsliced kernels agree with the reference implementation for every
+ * number of blocks in a batch, and with the output over the input */
+std::uint8_t key[32], iv[16];
+std::uint32_t words[60];
+std::uint64_t round_keys[AES256_CT_ROUND_KEYS_WORDS];
+for (unsigned i = 0; i < sizeof(key); ++i) key[i] = 0x80 ^ (7 * i);
+for (unsigned i = 0; i < sizeof(iv); ++i) iv[i] = 0x55 + i;
+::aes_key_setup(key, words, 256);
+_olm_aes_ct_expand_key(key, round_keys);
+
+for (unsigned blocks = 1; blocks <= 9; ++blocks) {
+    std::uint8_t input[9 * 16], expected[9 * 16], actual[9 * 16];
+    std::uint8_t chain[16], block[16];
+    for (unsigned i = 0; i < 16 * blocks; ++i) input[i] = 11 * i + blocks;
+
+    std::memcpy(chain, iv, 16);
+    for (unsigned b = 0; b < blocks; ++b) {
+        for (unsigned i = 0; i < 16; ++i) block[i] = chain[i] ^ input[16 * b + i];
+        ::aes_encrypt(block, expected + 16 * b, words, 256);
+        std::memcpy(chain, expected + 16 * b, 16);
+    }
+    std::memcpy(chain, iv, 16);
+    _olm_aes_ct_encrypt_cbc(round_keys, chain, input, blocks, actual);
+    assert_equals(expected, actual, 16 * blocks);
+    assert_equals(expected + 16 * (blocks - 1), chain, 16);
+
+    std::memcpy(chain, iv, 16);
+    _olm_aes_ct_decrypt_cbc(round_keys, chain, actual, blocks, actual);
+    assert_equals(input, actual, 16 * blocks);
+    assert_equals(expected + 16 * (blocks - 1), chain, 16);
+
+    std::uint8_t counter[16];
+    std::memcpy(counter, iv, 16);
+    counter[15] = 0xFE;
+    for (unsigned b = 0; b < blocks; ++b) {
+        ::aes_encrypt(counter, block, words, 256);
+        for (unsigned i = 0; i < 16; ++i) {
+            expected[16 * b + i] = input[16 * b + i] ^ block[i];
+        }
+        for (unsigned i = 16; i-- > 8 && !++counter[i];) {}
+    }
+    std::memcpy(chain, iv, 16);
+    chain[15] = 0xFE;
+    _olm_aes_ct_encrypt_ctr(round_keys, chain, input, blocks, actual);
+    assert_equals(expected, actual, 16 * blocks);
+    assert_equals(counter, chain, 16);
+}
+
+} /* AES Test Case 3 */
+
+
+{ /* AES-GCM Test Case 1 */
+
+TestCase test_case("AES-GCM Test Case 1");
+
+/* test cases 14 and 16 of the GCM specification, with the accelerated and
+ * the portable kernels */
+auto from_hex = [](char const * hex) {
+    std::vector<std::uint8_t> bytes;
+    for (; hex[0] && hex[1]; hex += 2) {
+        bytes.push_back(std::stoi(std::string(hex, 2), nullptr, 16));
+    }
+    return bytes;
+};
+struct {
+    char const *key, *nonce, *plaintext, *associated_data;
+    char const *ciphertext, *tag;
+} const vectors[] = {
+    {
+        "0000000000000000000000000000000000000000000000000000000000000000",
+        "000000000000000000000000",
+        "00000000000000000000000000000000",
+        "",
+        "cea7403d4d606b6e074ec5d3baf39d18",
+        "d0d1c8a799996bf0265b98b5d48ab919",
+    },
+    {
+        "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+        "cafebabefacedbaddecaf888",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+        "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+        "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+        "76fc6ece0f4e1768cddf8853bb2d551b",
+    },
+};
+for (unsigned mask : {~0u, 0u}) {
+    _olm_cpu_set_feature_mask(mask);
+    for (auto const & vector : vectors) {
+        _olm_aes256_key key;
+        std::vector<std::uint8_t> key_bytes = from_hex(vector.key);
+        std::memcpy(key.key, key_bytes.data(), sizeof(key.key));
+        std::vector<std::uint8_t> nonce = from_hex(vector.nonce);
+        std::vector<std::uint8_t> plaintext = from_hex(vector.plaintext);
+        std::vector<std::uint8_t> ad = from_hex(vector.associated_data);
+        std::vector<std::uint8_t> expected = from_hex(vector.ciphertext);
+        std::vector<std::uint8_t> expected_tag = from_hex(vector.tag);
+
+        _olm_aes_gcm_key gcm_key;
+        _olm_crypto_aes_gcm_key_setup(&key, &gcm_key);
+        std::vector<std::uint8_t> output(plaintext.size());
+        std::uint8_t tag[AES_GCM_TAG_LENGTH];
+        _olm_crypto_aes_gcm_encrypt(
+            &gcm_key, nonce.data(), ad.data(), ad.size(),
+            plaintext.data(), plaintext.size(), output.data(), tag
+        );
+        assert_equals(expected.data(), output.data(), expected.size());
+        assert_equals(expected_tag.data(), tag, AES_GCM_TAG_LENGTH);
+
+        /* in place */
+        assert_equals(output.size(), _olm_crypto_aes_gcm_decrypt(
+            &gcm_key, nonce.data(), ad.data(), ad.size(),
+            output.data(), output.size(), tag, output.data()
+        ));
+        assert_equals(plaintext.data(), output.data(), plaintext.size());
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
+
+} /* AES-GCM Test Case 1 */
+
+
+{ /* AES-GCM Test Case 2 */
+
+TestCase test_case("AES-GCM Test Case 2");
+
+/* the accelerated and portable kernels agree on a message long enough for
+ * the parallel blocks, and a changed tag, ciphertext or associated data is
+ * rejected */
+_olm_aes256_key key;
+std::uint8_t nonce[AES_GCM_NONCE_LENGTH];
+std::uint8_t ad[21], input[301];
+for (unsigned i = 0; i < sizeof(key.key); ++i) key.key[i] = 5 * i;
+for (unsigned i = 0; i < sizeof(nonce); ++i) nonce[i] = 0xA0 + i;
+for (unsigned i = 0; i < sizeof(ad); ++i) ad[i] = 7 * i;
+for (unsigned i = 0; i < sizeof(input); ++i) input[i] = 3 * i;
+
+_olm_aes_gcm_key gcm_key;
+std::uint8_t accelerated[sizeof(input)], portable[sizeof(input)];
+std::uint8_t accelerated_tag[AES_GCM_TAG_LENGTH];
+std::uint8_t portable_tag[AES_GCM_TAG_LENGTH];
+_olm_crypto_aes_gcm_key_setup(&key, &gcm_key);
+_olm_crypto_aes_gcm_encrypt(
+    &gcm_key, nonce, ad, sizeof(ad), input, sizeof(input),
+    accelerated, accelerated_tag
+);
+_olm_cpu_set_feature_mask(0);
+_olm_crypto_aes_gcm_key_setup(&key, &gcm_key);
+_olm_crypto_aes_gcm_encrypt(
+    &gcm_key, nonce, ad, sizeof(ad), input, sizeof(input),
+    portable, portable_tag
+);
+_olm_cpu_set_feature_mask(~0u);
+assert_equals(portable, accelerated, sizeof(input));
+assert_equals(portable_tag, accelerated_tag, AES_GCM_TAG_LENGTH);
+
+_olm_crypto_aes_gcm_key_setup(&key, &gcm_key);
+std::uint8_t decrypted[sizeof(input)];
+assert_equals(sizeof(input), _olm_crypto_aes_gcm_decrypt(
+    &gcm_key, nonce, ad, sizeof(ad), accelerated, sizeof(input),
+    accelerated_tag, decrypted
+));
+assert_equals(input, decrypted, sizeof(input));
+
+accelerated_tag[3] ^= 1;
+assert_equals(std::size_t(-1), _olm_crypto_aes_gcm_decrypt(
+    &gcm_key, nonce, ad, sizeof(ad), accelerated, sizeof(input),
+    accelerated_tag, decrypted
+));
+accelerated_tag[3] ^= 1;
+accelerated[200] ^= 1;
+assert_equals(std::size_t(-1), _olm_crypto_aes_gcm_decrypt(
+    &gcm_key, nonce, ad, sizeof(ad), accelerated, sizeof(input),
+    accelerated_tag, decrypted
+));
+/* the output is wiped rather than left half decrypted */
+std::uint8_t zeros[sizeof(input)] = {};
+assert_equals(zeros, decrypted, sizeof(input));
+accelerated[200] ^= 1;
+assert_equals(std::size_t(-1), _olm_crypto_aes_gcm_decrypt(
+    &gcm_key, nonce, ad, sizeof(ad) - 1, accelerated, sizeof(input),
+    accelerated_tag, decrypted
+));
+
+} /* AES-GCM Test Case 2 */
+
+
+{ /* AES-CTR Test Case 1 */
+
+TestCase test_case("AES-CTR Test Case 1");
+
+/* F.5.5 of NIST SP 800-38A, with the accelerated and the portable kernels,
+ * and in place */
+_olm_aes256_key key = {{
+    0x60, 0x3D, 0xEB, 0x10, 0x15, 0xCA, 0x71, 0xBE,
+    0x2B, 0x73, 0xAE, 0xF0, 0x85, 0x7D, 0x77, 0x81,
+    0x1F, 0x35, 0x2C, 0x07, 0x3B, 0x61, 0x08, 0xD7,
+    0x2D, 0x98, 0x10, 0xA3, 0x09, 0x14, 0xDF, 0xF4,
+}};
+std::uint8_t const initial_counter[AES256_IV_LENGTH] = {
+    0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7,
+    0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF,
+};
+std::uint8_t const plaintext[64] = {
+    0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96,
+    0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+    0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C,
+    0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+    0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11,
+    0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF,
+    0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17,
+    0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10,
+};
+std::uint8_t const expected[64] = {
+    0x60, 0x1E, 0xC3, 0x13, 0x77, 0x57, 0x89, 0xA5,
+    0xB7, 0xA7, 0xF5, 0x04, 0xBB, 0xF3, 0xD2, 0x28,
+    0xF4, 0x43, 0xE3, 0xCA, 0x4D, 0x62, 0xB5, 0x9A,
+    0xCA, 0x84, 0xE9, 0x90, 0xCA, 0xCA, 0xF5, 0xC5,
+    0x2B, 0x09, 0x30, 0xDA, 0xA2, 0x3D, 0xE9, 0x4C,
+    0xE8, 0x70, 0x17, 0xBA, 0x2D, 0x84, 0x98, 0x8D,
+    0xDF, 0xC9, 0xC5, 0x8D, 0xB6, 0x7A, 0xAD, 0xA6,
+    0x13, 0xC2, 0xDD, 0x08, 0x45, 0x79, 0x41, 0xA6,
+};
+std::uint8_t const expected_counter[AES256_IV_LENGTH] = {
+    0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7,
+    0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFF, 0x03,
+};
+for (unsigned mask : {~0u, 0u}) {
+    _olm_cpu_set_feature_mask(mask);
+    _olm_aes256_key_schedule schedule;
+    _olm_crypto_aes_key_setup(&key, &schedule);
+    std::uint8_t counter[AES256_IV_LENGTH];
+    std::uint8_t output[64];
+    std::memcpy(counter, initial_counter, sizeof(counter));
+    _olm_crypto_aes_ctr_blocks(&schedule, counter, plaintext, 4, output);
+    assert_equals(expected, output, sizeof(expected));
+    assert_equals(expected_counter, counter, sizeof(counter));
+
+    std::memcpy(counter, initial_counter, sizeof(counter));
+    _olm_crypto_aes_ctr_blocks(&schedule, counter, output, 4, output);
+    assert_equals(plaintext, output, sizeof(plaintext));
+}
+_olm_cpu_set_feature_mask(~0u);
+
+} /* AES-CTR Test Case 1 */
+
+
+{ /* AES-CTR Test Case 2 */
+
+TestCase test_case("AES-CTR Test Case 2");
+
+/* the counter is the last 8 bytes, and wraps round without carrying into
+ * the first 8, which the accelerated and portable kernels agree on over
+ * enough blocks for the parallel ones */
+_olm_aes256_key key;
+for (unsigned i = 0; i < sizeof(key.key); ++i) key.key[i] = 3 * i + 1;
+std::uint8_t initial_counter[AES256_IV_LENGTH];
+std::memset(initial_counter, 0x5A, 8);
+std::memset(initial_counter + 8, 0xFF, 8);
+initial_counter[15] = 0xFA;
+std::uint8_t input[16 * 19];
+for (unsigned i = 0; i < sizeof(input); ++i) input[i] = i;
+
+std::uint8_t outputs[2][sizeof(input)];
+std::uint8_t counters[2][AES256_IV_LENGTH];
+unsigned const masks[2] = {~0u, 0u};
+for (unsigned k = 0; k < 2; ++k) {
+    _olm_cpu_set_feature_mask(masks[k]);
+    _olm_aes256_key_schedule schedule;
+    _olm_crypto_aes_key_setup(&key, &schedule);
+    std::memcpy(counters[k], initial_counter, AES256_IV_LENGTH);
+    _olm_crypto_aes_ctr_blocks(&schedule, counters[k], input, 19, outputs[k]);
+}
+_olm_cpu_set_feature_mask(~0u);
+assert_equals(outputs[0], outputs[1], sizeof(input));
+assert_equals(counters[0], counters[1], AES256_IV_LENGTH);
+
+/* 6 blocks to the wrap, and 13 after it */
+std::uint8_t expected_counter[AES256_IV_LENGTH] = {};
+std::memset(expected_counter, 0x5A, 8);
+expected_counter[15] = 13;
+assert_equals(expected_counter, counters[0], AES256_IV_LENGTH);
+
+/* the block after the wrap is the block cipher of the zero count */
+_olm_aes256_key_schedule schedule;
+_olm_crypto_aes_key_setup(&key, &schedule);
+std::uint8_t counter[AES256_IV_LENGTH] = {};
+std::memset(counter, 0x5A, 8);
+std::uint8_t block[AES256_IV_LENGTH];
+_olm_crypto_aes_ctr_blocks(&schedule, counter, input + 16 * 6, 1, block);
+assert_equals(outputs[0] + 16 * 6, block, AES256_IV_LENGTH);
+
+} /* AES-CTR Test Case 2 */
+
+
 { /* SHA 256 Test Case 1 */
 
 TestCase test_case("SHA 256 Test Case 1");
@@ -163,6 +1003,27 @@ assert_equals(expected, actual, 32);
 
 } /* SHA 256 Test Case 1 */
 
+
+{ /* SHA 256 Test Case 2 */
+
+TestCase test_case("SHA 256 Test Case 2");
+
+/* check the accelerated and portable implementations agree for lengths
+ * either side of the block and padding boundaries */
+std::uint8_t input[200];
+for (unsigned i = 0; i < sizeof(input); ++i) input[i] = 7 * i;
+
+for (std::size_t length = 0; length <= sizeof(input); ++length) {
+    std::uint8_t accelerated[32], portable[32];
+    _olm_crypto_sha256(input, length, accelerated);
+    _olm_cpu_set_feature_mask(0);
+    _olm_crypto_sha256(input, length, portable);
+    _olm_cpu_set_feature_mask(~0u);
+    assert_equals(portable, accelerated, 32);
+}
+
+} /* SHA 256 Test Case 2 */
+
 { /* HMAC Test Case 1 */
 
 TestCase test_case("HMAC Test Case 1");
@@ -182,8 +1043,224 @@ _olm_crypto_hmac_sha256(input, sizeof(input), input, sizeof(input), actual);
 
 assert_equals(expected, actual, 32);
 
+_olm_hmac_sha256_key hmac_key;
+_olm_crypto_hmac_sha256_init_key(&hmac_key, input, sizeof(input));
+
+/* a prepared key can be used more than once */
+for (int i = 0; i < 2; ++i) {
+    std::memset(actual, 0, sizeof(actual));
+    _olm_crypto_hmac_sha256_with_key(&hmac_key, input, sizeof(input), actual);
+    assert_equals(expected, actual, 32);
+}
+
 } /* HMAC Test Case 1 */
 
+
+{ /* HMAC Test Case 2 */
+
+TestCase test_case("HMAC Test Case 2");
+
+/* check the multi-buffer HMAC agrees with the one at a time version, with
+ * and without the SHA instructions */
+std::uint8_t key[32];
+std::uint8_t inputs[6][3];
+std::uint8_t expected[6][32];
+std::uint8_t actual[6][32];
+std::uint8_t const * input_ptrs[6];
+std::uint8_t * output_ptrs[6];
+for (unsigned i = 0; i < sizeof(key); ++i) key[i] = 5 * i;
+for (unsigned i = 0; i < 6; ++i) {
+    std::memset(inputs[i], i, sizeof(inputs[i]));
+    input_ptrs[i] = inputs[i];
+    output_ptrs[i] = actual[i];
+    _olm_crypto_hmac_sha256(
+        key, sizeof(key), inputs[i], sizeof(inputs[i]), expected[i]
+    );
+}
+
+_olm_hmac_sha256_key hmac_key;
+_olm_crypto_hmac_sha256_init_key(&hmac_key, key, sizeof(key));
+
+for (int mask = 0; mask < 2; ++mask) {
+    _olm_cpu_set_feature_mask(mask ? ~0u : 0);
+    std::memset(actual, 0, sizeof(actual));
+    _olm_crypto_hmac_sha256_with_key_multi(
+        &hmac_key, input_ptrs, sizeof(inputs[0]), output_ptrs, 6
+    );
+    for (unsigned i = 0; i < 6; ++i) {
+        assert_equals(expected[i], actual[i], 32);
+    }
+}
+
+} /* HMAC Test Case 2 */
+
+
+{ /* HMAC Test Case 3 */
+
+TestCase test_case("HMAC with a key per lane");
+
+/* one key per input, across more inputs than there are lanes, with the SHA
+ * instructions, with the eight lane kernel and with the four lane one */
+unsigned const masks[3] = { ~0u, OLM_CPU_FEATURE_AVX2, 0 };
+std::uint8_t keys[11][32];
+std::uint8_t inputs[11][3];
+std::uint8_t expected[11][32];
+std::uint8_t actual[11][32];
+_olm_hmac_sha256_key hmac_keys[11];
+_olm_hmac_sha256_key * hmac_key_ptrs[11];
+std::uint8_t const * key_ptrs[11];
+std::uint8_t const * input_ptrs[11];
+std::uint8_t * output_ptrs[11];
+for (unsigned i = 0; i < 11; ++i) {
+    for (unsigned j = 0; j < sizeof(keys[i]); ++j) keys[i][j] = i * 7 + j;
+    std::memset(inputs[i], i, sizeof(inputs[i]));
+    hmac_key_ptrs[i] = &hmac_keys[i];
+    key_ptrs[i] = keys[i];
+    input_ptrs[i] = inputs[i];
+    output_ptrs[i] = actual[i];
+    _olm_crypto_hmac_sha256(
+        keys[i], sizeof(keys[i]), inputs[i], sizeof(inputs[i]), expected[i]
+    );
+}
+
+for (unsigned k = 0; k < 3; ++k) {
+    _olm_cpu_set_feature_mask(masks[k]);
+    std::memset(actual, 0, sizeof(actual));
+    _olm_crypto_hmac_sha256_init_key_multi(
+        hmac_key_ptrs, key_ptrs, sizeof(keys[0]), 11
+    );
+    _olm_crypto_hmac_sha256_with_keys_multi(
+        hmac_key_ptrs, input_ptrs, sizeof(inputs[0]), output_ptrs, 11
+    );
+    for (unsigned i = 0; i < 11; ++i) {
+        assert_equals(expected[i], actual[i], 32);
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
+
+} /* HMAC Test Case 3 */
+
+
+{ /* AES-then-HMAC Test Case 1 */
+
+TestCase test_case("Fused AES and HMAC");
+
+/* check the single pass functions against separate AES and HMAC, including
+ * messages spread over more than one chunk */
+_olm_aes256_key key;
+_olm_aes256_iv iv;
+std::uint8_t mac_key_bytes[32];
+for (unsigned i = 0; i < sizeof(key.key); ++i) key.key[i] = i;
+for (unsigned i = 0; i < sizeof(iv.iv); ++i) iv.iv[i] = 0xF0 + i;
+for (unsigned i = 0; i < sizeof(mac_key_bytes); ++i) mac_key_bytes[i] = 5 * i;
+
+_olm_aes256_key_schedule schedule;
+_olm_crypto_aes_key_setup(&key, &schedule);
+_olm_hmac_sha256_key mac_key;
+_olm_crypto_hmac_sha256_init_key(&mac_key, mac_key_bytes, sizeof(mac_key_bytes));
+
+static std::uint8_t input[9000];
+static std::uint8_t message[9100], expected_message[9100];
+static std::uint8_t decrypted[9100];
+for (unsigned i = 0; i < sizeof(input); ++i) input[i] = 3 * i;
+
+std::size_t const lengths[] = {0, 15, 16, 100, 4095, 4096, 4097, 9000};
+std::size_t const prefix = 7, suffix = 3;
+/* each length with the portable and the accelerated code */
+for (std::size_t j = 0; j < 2 * sizeof(lengths) / sizeof(lengths[0]); ++j) {
+    std::size_t length = lengths[j / 2];
+    _olm_cpu_set_feature_mask(j % 2 ? ~0u : 0u);
+    _olm_crypto_aes_key_setup(&key, &schedule);
+
+    std::size_t ciphertext_length = _olm_crypto_aes_encrypt_cbc_length(length);
+    std::size_t message_length = prefix + ciphertext_length + suffix;
+    std::memset(expected_message, 0xAA, message_length);
+    _olm_crypto_aes_encrypt_cbc(
+        &key, &iv, input, length, expected_message + prefix
+    );
+    std::uint8_t expected_mac[32];
+    _olm_crypto_hmac_sha256(
+        mac_key_bytes, sizeof(mac_key_bytes),
+        expected_message, message_length, expected_mac
+    );
+
+    std::uint8_t mac[32];
+    std::memset(message, 0xAA, message_length);
+    assert_equals(ciphertext_length, _olm_crypto_aes_encrypt_cbc_then_hmac_sha256(
+        &schedule, &iv, &mac_key, input, length,
+        message, message_length, message + prefix, mac
+    ));
+    assert_equals(expected_message, message, message_length);
+    assert_equals(expected_mac, mac, 32);
+
+    assert_equals(length, _olm_crypto_hmac_sha256_then_aes_decrypt_cbc(
+        &schedule, &iv, &mac_key, message, message_length,
+        message + prefix, ciphertext_length, mac, 8, decrypted
+    ));
+    assert_equals(input, decrypted, length);
+
+    /* a bad MAC releases no plaintext */
+    mac[0] ^= 1;
+    assert_equals(std::size_t(-1), _olm_crypto_hmac_sha256_then_aes_decrypt_cbc(
+        &schedule, &iv, &mac_key, message, message_length,
+        message + prefix, ciphertext_length, mac, 8, decrypted
+    ));
+    for (std::size_t i = 0; i < ciphertext_length; ++i) {
+        assert_equals(std::uint8_t(0), decrypted[i]);
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
+
+} /* AES-then-HMAC Test Case 1 */
+
+{ /* Streaming AES and HMAC */
+
+TestCase test_case("Streaming AES and HMAC");
+
+_olm_aes256_key key;
+_olm_aes256_iv iv;
+std::uint8_t mac_key_bytes[32];
+for (unsigned i = 0; i < sizeof(key.key); ++i) key.key[i] = i;
+for (unsigned i = 0; i < sizeof(iv.iv); ++i) iv.iv[i] = 0xF0 + i;
+for (unsigned i = 0; i < sizeof(mac_key_bytes); ++i) mac_key_bytes[i] = 5 * i;
+
+_olm_aes256_key_schedule schedule;
+_olm_crypto_aes_key_setup(&key, &schedule);
+_olm_hmac_sha256_key mac_key;
+_olm_crypto_hmac_sha256_init_key(&mac_key, mac_key_bytes, sizeof(mac_key_bytes));
+
+static std::uint8_t input[1000];
+static std::uint8_t expected[1024], output[1024];
+for (unsigned i = 0; i < sizeof(input); ++i) input[i] = 3 * i;
+
+/* an HMAC given its input in pieces is the same as one given it at once */
+std::uint8_t expected_mac[32], mac[32];
+_olm_crypto_hmac_sha256_with_key(&mac_key, input, sizeof(input), expected_mac);
+_olm_hmac_sha256_context context;
+_olm_crypto_hmac_sha256_begin(&mac_key, &context);
+_olm_crypto_hmac_sha256_update(&context, input, 1);
+_olm_crypto_hmac_sha256_update(&context, input + 1, 100);
+_olm_crypto_hmac_sha256_update(&context, input + 101, sizeof(input) - 101);
+_olm_crypto_hmac_sha256_end(&mac_key, &context, mac);
+assert_equals(expected_mac, mac, 32);
+
+/* and so is CBC chained across calls */
+_olm_crypto_aes_encrypt_cbc_with_schedule(&schedule, &iv, input, 992, expected);
+std::uint8_t chain[AES256_IV_LENGTH];
+std::memcpy(chain, iv.iv, sizeof(chain));
+_olm_crypto_aes_encrypt_cbc_blocks(&schedule, chain, input, 2, output);
+_olm_crypto_aes_encrypt_cbc_blocks(&schedule, chain, input + 32, 60, output + 32);
+assert_equals(expected, output, 992);
+
+std::memcpy(chain, iv.iv, sizeof(chain));
+_olm_crypto_aes_decrypt_cbc_blocks(&schedule, chain, output, 3, output);
+_olm_crypto_aes_decrypt_cbc_blocks(
+    &schedule, chain, output + 48, 59, output + 48
+);
+assert_equals(input, output, 992);
+
+} /* Streaming AES and HMAC */
+
 { /* HDKF Test Case 1 */
 
 TestCase test_case("HDKF Test Case 1");
@@ -241,6 +1318,133 @@ _olm_crypto_hkdf_sha256(
 
 assert_equals(hkdf_expected_output, hkdf_actual_output, 42);
 
+/* and with the salt prepared ahead of time */
+_olm_hmac_sha256_key salt_key;
+_olm_crypto_hmac_sha256_init_key(&salt_key, salt, sizeof(salt));
+std::memset(hkdf_actual_output, 0, sizeof(hkdf_actual_output));
+_olm_crypto_hkdf_sha256_with_salt_key(
+    &salt_key,
+    input, sizeof(input),
+    info, sizeof(info),
+    hkdf_actual_output, sizeof(hkdf_actual_output)
+);
+
+assert_equals(hkdf_expected_output, hkdf_actual_output, 42);
+
 } /* HDKF Test Case 1 */
 
+
+{ /* HDKF Test Case 2 */
+
+TestCase test_case("HDKF Test Case 2");
+
+/* RFC 5869 test case 3, with no salt and no info. A missing salt is
+ * HashLen zero bytes, which we have precomputed. */
+std::uint8_t input[22];
+std::memset(input, 0x0b, sizeof(input));
+
+std::uint8_t hkdf_expected_output[42] = {
+    0x8d, 0xa4, 0xe7, 0x75, 0xa5, 0x63, 0xc1, 0x8f,
+    0x71, 0x5f, 0x80, 0x2a, 0x06, 0x3c, 0x5a, 0x31,
+    0xb8, 0xa1, 0x1f, 0x5c, 0x5e, 0xe1, 0x87, 0x9e,
+    0xc3, 0x45, 0x4e, 0x5f, 0x3c, 0x73, 0x8d, 0x2d,
+    0x9d, 0x20, 0x13, 0x95, 0xfa, 0xa4, 0xb6, 0x1a,
+    0x96, 0xc8
+};
+
+std::uint8_t hkdf_actual_output[42] = {};
+
+_olm_crypto_hkdf_sha256(
+    input, sizeof(input),
+    nullptr, 0,
+    nullptr, 0,
+    hkdf_actual_output, sizeof(hkdf_actual_output)
+);
+
+assert_equals(hkdf_expected_output, hkdf_actual_output, 42);
+
+std::uint8_t zero_salt[32] = {};
+std::memset(hkdf_actual_output, 0, sizeof(hkdf_actual_output));
+_olm_crypto_hkdf_sha256(
+    input, sizeof(input),
+    zero_salt, sizeof(zero_salt),
+    nullptr, 0,
+    hkdf_actual_output, sizeof(hkdf_actual_output)
+);
+
+assert_equals(hkdf_expected_output, hkdf_actual_output, 42);
+
+} /* HDKF Test Case 2 */
+
+
+{ /* HDKF Test Case 3 */
+
+TestCase test_case("Multi-buffer HKDF");
+
+/* the multi-buffer HKDF agrees with the one at a time version, with and
+ * without a salt, whichever kernel is used */
+unsigned const masks[3] = { ~0u, OLM_CPU_FEATURE_AVX2, 0 };
+std::uint8_t const salt[] = "a salt";
+std::uint8_t const info[] = "SOME_INFO";
+std::uint8_t inputs[11][32];
+std::uint8_t expected[11][80];
+std::uint8_t actual[11][80];
+std::uint8_t const * input_ptrs[11];
+std::uint8_t * output_ptrs[11];
+for (unsigned i = 0; i < 11; ++i) {
+    for (unsigned j = 0; j < sizeof(inputs[i]); ++j) inputs[i][j] = i + j;
+    input_ptrs[i] = inputs[i];
+    output_ptrs[i] = actual[i];
+}
+
+for (unsigned salted = 0; salted < 2; ++salted) {
+    for (unsigned i = 0; i < 11; ++i) {
+        _olm_crypto_hkdf_sha256(
+            inputs[i], sizeof(inputs[i]),
+            salted ? salt : nullptr, salted ? sizeof(salt) - 1 : 0,
+            info, sizeof(info) - 1,
+            expected[i], sizeof(expected[i])
+        );
+    }
+    for (unsigned k = 0; k < 3; ++k) {
+        _olm_cpu_set_feature_mask(masks[k]);
+        std::memset(actual, 0, sizeof(actual));
+        _olm_crypto_hkdf_sha256_multi(
+            input_ptrs, sizeof(inputs[0]),
+            salted ? salt : nullptr, salted ? sizeof(salt) - 1 : 0,
+            info, sizeof(info) - 1,
+            output_ptrs, sizeof(actual[0]), 11
+        );
+        for (unsigned i = 0; i < 11; ++i) {
+            assert_equals(expected[i], actual[i], 80);
+        }
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
+
+} /* HDKF Test Case 3 */
+
+
+{ /* Crypto backend test */
+
+TestCase test_case("Crypto backend test");
+
+std::string accelerated(olm_get_crypto_backend());
+_olm_cpu_set_feature_mask(0);
+std::string portable(olm_get_crypto_backend());
+_olm_cpu_set_feature_mask(~0u);
+
+/* the vector SHA-256 lanes and curve25519 are chosen when building */
+assert_equals(std::size_t(0), portable.find(
+    "aes=portable gcm=portable sha256=portable sha256x4="
+));
+assert_not_equals(std::string::npos, portable.find(" sha512=portable "));
+assert_not_equals(std::string::npos, portable.find(" base64=portable "));
+assert_equals(
+    _olm_cpu_features() == 0, accelerated == portable
+);
+assert_equals(accelerated, std::string(olm_get_crypto_backend()));
+
+} /* Crypto backend test */
+
 }
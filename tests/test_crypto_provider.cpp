@@ -0,0 +1,229 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/aes_ct.h"
+#include "olm/attachment.h"
+#include "olm/crypto.h"
+#include "olm/crypto_provider.h"
+#include "olm/inbound_group_session.h"
+#include "olm/olm.h"
+#include "olm/outbound_group_session.h"
+#include "unittest.hh"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "crypto-algorithms/sha256.h"
+#include "curve25519-donna.h"
+#include "ed25519/src/ed25519.h"
+
+/* not in the header */
+void sha256_transform(SHA256_CTX *ctx, const BYTE data[]);
+}
+
+namespace {
+
+/** A provider that counts its calls and hands them to the portable code,
+ * standing in for another library */
+struct Calls {
+    std::size_t sha256_blocks = 0;
+    std::size_t aes_bytes = 0;
+    std::size_t x25519 = 0;
+    std::size_t ed25519_verify = 0;
+};
+
+void count_sha256_transform(
+    void * context, std::uint32_t state[8],
+    std::uint8_t const * blocks, std::size_t block_count
+) {
+    static_cast<Calls *>(context)->sha256_blocks += block_count;
+    SHA256_CTX sha;
+    std::memcpy(sha.state, state, sizeof(sha.state));
+    for (std::size_t i = 0; i < block_count; ++i) {
+        sha256_transform(&sha, blocks + 64 * i);
+    }
+    std::memcpy(state, sha.state, sizeof(sha.state));
+}
+
+void count_aes256_cbc(
+    void * context, std::uint8_t const key[32], std::uint8_t iv[16],
+    std::uint8_t const * input, std::size_t length, std::uint8_t * output,
+    int encrypt
+) {
+    static_cast<Calls *>(context)->aes_bytes += length;
+    std::uint64_t round_keys[AES256_CT_ROUND_KEYS_WORDS];
+    _olm_aes_ct_expand_key(key, round_keys);
+    (encrypt ? _olm_aes_ct_encrypt_cbc : _olm_aes_ct_decrypt_cbc)(
+        round_keys, iv, input, length / 16, output
+    );
+}
+
+void count_x25519(
+    void * context, std::uint8_t output[32],
+    std::uint8_t const scalar[32], std::uint8_t const point[32]
+) {
+    static_cast<Calls *>(context)->x25519++;
+    curve25519_donna(output, scalar, point);
+}
+
+int count_ed25519_verify(
+    void * context, std::uint8_t const public_key[32],
+    std::uint8_t const * message, std::size_t message_length,
+    std::uint8_t const signature[64]
+) {
+    static_cast<Calls *>(context)->ed25519_verify++;
+    return ed25519_verify(signature, message, message_length, public_key);
+}
+
+OlmCryptoProvider make_provider(Calls * calls) {
+    OlmCryptoProvider provider = {};
+    provider.context = calls;
+    provider.sha256_transform = count_sha256_transform;
+    provider.aes256_cbc = count_aes256_cbc;
+    provider.x25519 = count_x25519;
+    provider.ed25519_verify = count_ed25519_verify;
+    return provider;
+}
+
+std::vector<std::uint8_t> encrypt_attachment(std::vector<std::uint8_t> data) {
+    std::uint8_t key[32], iv[16] = {};
+    std::memset(key, 0x11, sizeof(key));
+    std::memset(iv, 0x22, 8);
+    iv[15] = 0xfe; // the counter carries within the block
+    std::vector<std::uint8_t> buffer(olm_attachment_size());
+    OlmAttachment * attachment = olm_attachment(buffer.data());
+    olm_attachment_encrypt_init(attachment, key, 32, iv, 16);
+    olm_attachment_update(
+        attachment, data.data(), data.size(), data.data(), data.size()
+    );
+    std::uint8_t hash[64];
+    data.insert(
+        data.end(), hash,
+        hash + olm_attachment_encrypt_final(attachment, hash, sizeof(hash))
+    );
+    return data;
+}
+
+} // namespace
+
+int main() {
+
+{ /** Crypto provider test */
+
+TestCase test_case("Crypto provider test");
+
+Calls calls;
+OlmCryptoProvider provider = make_provider(&calls);
+
+std::string bundled = olm_get_crypto_backend();
+assert_equals(std::string::npos, bundled.find("provider"));
+
+/* the library's own SHA-256 and AES, to check the provider against */
+std::uint8_t const message[] = "The quick brown fox jumps over the lazy dog";
+std::uint8_t expected_hash[32];
+_olm_crypto_sha256(message, sizeof(message), expected_hash);
+std::vector<std::uint8_t> attachment(1000, 0x5a);
+std::vector<std::uint8_t> expected_attachment = encrypt_attachment(attachment);
+
+olm_set_crypto_provider(&provider);
+std::string backend = olm_get_crypto_backend();
+assert_not_equals(std::string::npos, backend.find("aes=provider"));
+assert_not_equals(std::string::npos, backend.find("sha256=provider"));
+assert_not_equals(std::string::npos, backend.find("curve25519=provider"));
+assert_not_equals(std::string::npos, backend.find("ed25519=provider"));
+
+std::uint8_t hash[32];
+_olm_crypto_sha256(message, sizeof(message), hash);
+assert_equals(expected_hash, hash, 32);
+assert_equals(true, calls.sha256_blocks > 0);
+
+assert_equals(true, expected_attachment == encrypt_attachment(attachment));
+assert_equals(true, calls.aes_bytes >= attachment.size());
+
+/* keys are made with the provider's X25519 */
+std::vector<std::uint8_t> account_buffer(olm_account_size());
+OlmAccount * account = olm_account(account_buffer.data());
+std::vector<std::uint8_t> random(olm_create_account_random_length(account));
+for (std::size_t i = 0; i < random.size(); ++i) {
+    random[i] = i;
+}
+olm_create_account(account, random.data(), random.size());
+assert_equals(true, calls.x25519 > 0);
+
+/* a group session started with the provider can be read without it, and
+ * the other way round */
+std::vector<std::uint8_t> outbound_buffer(olm_outbound_group_session_size());
+OlmOutboundGroupSession * outbound = olm_outbound_group_session(
+    outbound_buffer.data()
+);
+std::vector<std::uint8_t> group_random(
+    olm_init_outbound_group_session_random_length(outbound), 0x42
+);
+olm_init_outbound_group_session(
+    outbound, group_random.data(), group_random.size()
+);
+std::vector<std::uint8_t> session_key(
+    olm_outbound_group_session_key_length(outbound)
+);
+olm_outbound_group_session_key(
+    outbound, session_key.data(), session_key.size()
+);
+std::vector<std::uint8_t> inbound_buffer(olm_inbound_group_session_size());
+OlmInboundGroupSession * inbound = olm_inbound_group_session(
+    inbound_buffer.data()
+);
+olm_init_inbound_group_session(
+    inbound, session_key.data(), session_key.size()
+);
+
+std::uint8_t plaintext[] = "Message";
+std::uint8_t output[32];
+std::uint32_t message_index;
+for (int round = 0; round < 2; ++round) {
+    std::size_t aes_bytes = calls.aes_bytes;
+    std::vector<std::uint8_t> group_message(
+        olm_group_encrypt_message_length(outbound, sizeof(plaintext))
+    );
+    std::size_t group_message_length = olm_group_encrypt(
+        outbound, plaintext, sizeof(plaintext),
+        group_message.data(), group_message.size()
+    );
+    assert_not_equals(std::size_t(-1), group_message_length);
+    assert_equals(round == 0, calls.aes_bytes > aes_bytes);
+
+    olm_set_crypto_provider(round == 0 ? NULL : &provider);
+    std::size_t verifies = calls.ed25519_verify;
+    aes_bytes = calls.aes_bytes;
+    assert_equals(sizeof(plaintext), olm_group_decrypt(
+        inbound, group_message.data(), group_message_length,
+        output, sizeof(output), &message_index
+    ));
+    assert_equals(plaintext, output, sizeof(plaintext));
+    assert_equals(round == 1, calls.aes_bytes > aes_bytes);
+    assert_equals(round == 1, calls.ed25519_verify > verifies);
+}
+
+/* the library's own code again, with nothing more going to the provider */
+olm_set_crypto_provider(NULL);
+assert_equals(bundled, std::string(olm_get_crypto_backend()));
+std::size_t sha256_blocks = calls.sha256_blocks;
+_olm_crypto_sha256(message, sizeof(message), hash);
+assert_equals(expected_hash, hash, 32);
+assert_equals(sha256_blocks, calls.sha256_blocks);
+
+}
+
+}
@@ -0,0 +1,179 @@
+#include "olm/executor.h"
+#include "olm/inbound_group_session.h"
+#include "olm/outbound_group_session.h"
+#include "unittest.hh"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Counts {
+    std::vector<std::atomic<unsigned>> runs;
+    std::vector<std::thread::id> threads;
+
+    explicit Counts(size_t count) : runs(count), threads(count) {}
+
+    static void job(void * context, size_t job) {
+        Counts & counts = *static_cast<Counts *>(context);
+        counts.runs[job]++;
+        counts.threads[job] = std::this_thread::get_id();
+    }
+
+    bool all_once() const {
+        for (auto const & runs_of_job : runs) {
+            if (runs_of_job.load() != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+} // namespace
+
+int main() {
+
+{
+    TestCase test_case("Work pool without workers");
+
+    std::vector<uint8_t> memory(olm_work_pool_size());
+    OlmWorkPool * pool = olm_work_pool(memory.data());
+
+    Counts counts(10);
+    olm_work_pool_executor(pool, Counts::job, &counts, 10);
+    assert_equals(true, counts.all_once());
+    bool here = counts.threads[9] == std::this_thread::get_id();
+    assert_equals(true, here);
+
+    /* an empty batch does nothing */
+    olm_work_pool_executor(pool, Counts::job, &counts, 0);
+
+    OlmWorkPoolStats stats;
+    olm_work_pool_stats(pool, &stats);
+    assert_equals((uint64_t)1, stats.batches);
+    assert_equals((uint64_t)10, stats.jobs);
+    assert_equals((uint64_t)0, stats.jobs_run_by_workers);
+    assert_equals((uint64_t)0, stats.lock_contentions);
+    assert_equals((uint64_t)0, stats.finish_waits);
+    olm_work_pool_reset_stats(pool);
+    olm_work_pool_stats(pool, &stats);
+    assert_equals((uint64_t)0, stats.jobs);
+
+    olm_work_pool_stop(pool);
+    olm_clear_work_pool(pool);
+}
+
+{
+    TestCase test_case("Work pool spreads jobs over its workers");
+
+    std::vector<uint8_t> memory(olm_work_pool_size());
+    OlmWorkPool * pool = olm_work_pool(memory.data());
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < 3; ++i) {
+        workers.emplace_back(olm_work_pool_work, pool);
+    }
+
+    /* batches from several threads at once */
+    static const size_t JOBS = 2000;
+    std::vector<Counts *> counts;
+    std::vector<std::thread> submitters;
+    for (unsigned i = 0; i < 4; ++i) {
+        counts.push_back(new Counts(JOBS));
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        Counts * batch_counts = counts[i];
+        submitters.emplace_back([pool, batch_counts]() {
+            olm_work_pool_executor(pool, Counts::job, batch_counts, JOBS);
+        });
+    }
+    for (std::thread & submitter : submitters) {
+        submitter.join();
+    }
+    for (Counts * batch_counts : counts) {
+        assert_equals(true, batch_counts->all_once());
+        delete batch_counts;
+    }
+    OlmWorkPoolStats stats;
+    olm_work_pool_stats(pool, &stats);
+    assert_equals((uint64_t)4, stats.batches);
+    assert_equals((uint64_t)(4 * JOBS), stats.jobs);
+    assert_equals(true, stats.jobs_run_by_workers <= stats.jobs);
+
+    olm_work_pool_stop(pool);
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+
+    /* once stopped, the jobs still run on the calling thread */
+    Counts after(5);
+    olm_work_pool_executor(pool, Counts::job, &after, 5);
+    assert_equals(true, after.all_once());
+
+    olm_clear_work_pool(pool);
+}
+
+{
+    TestCase test_case("Batch functions on a work pool");
+
+    std::vector<uint8_t> memory(olm_work_pool_size());
+    OlmWorkPool * pool = olm_work_pool(memory.data());
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < 2; ++i) {
+        workers.emplace_back(olm_work_pool_work, pool);
+    }
+
+    const size_t count = 200;
+    std::vector<std::vector<uint8_t>> session_keys(count);
+    std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession * outbound =
+        olm_outbound_group_session(outbound_memory.data());
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(outbound)
+    );
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < random.size(); ++j) {
+            random[j] = uint8_t(i + j);
+        }
+        olm_init_outbound_group_session(
+            outbound, random.data(), random.size()
+        );
+        session_keys[i].resize(olm_outbound_group_session_key_length(outbound));
+        olm_outbound_group_session_key(
+            outbound, session_keys[i].data(), session_keys[i].size()
+        );
+    }
+    /* change a character of one signature */
+    uint8_t & changed = session_keys[150][session_keys[150].size() - 5];
+    changed = changed == 'A' ? 'B' : 'A';
+
+    std::vector<std::vector<uint8_t>> sessions_memory(count);
+    std::vector<OlmInboundGroupSession *> sessions(count);
+    std::vector<const uint8_t *> key_ptrs(count);
+    std::vector<size_t> key_lengths(count);
+    for (size_t i = 0; i < count; ++i) {
+        sessions_memory[i].resize(olm_inbound_group_session_size());
+        sessions[i] = olm_inbound_group_session(sessions_memory[i].data());
+        key_ptrs[i] = session_keys[i].data();
+        key_lengths[i] = session_keys[i].size();
+    }
+
+    std::vector<const char *> errors(count);
+    assert_equals((size_t)1, olm_init_inbound_group_session_batch(
+        sessions.data(), count, key_ptrs.data(), key_lengths.data(),
+        errors.data(), olm_work_pool_executor, pool
+    ));
+    assert_equals(std::string("SUCCESS"), std::string(errors[0]));
+    assert_equals(std::string("SUCCESS"), std::string(errors[199]));
+    assert_equals(std::string("BAD_SIGNATURE"), std::string(errors[150]));
+
+    olm_work_pool_stop(pool);
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+    olm_clear_work_pool(pool);
+}
+
+}
@@ -12,10 +12,23 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include "olm/base64.h"
+#include "olm/cpu.h"
+#include "olm/crypto.h"
 #include "olm/inbound_group_session.h"
+#include "olm/megolm.h"
 #include "olm/outbound_group_session.h"
+#include "olm/pool.h"
 #include "unittest.hh"
 
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
 
 int main() {
 
@@ -85,6 +98,1087 @@ int main() {
     assert_equals(pickle1, pickle2, pickle_length);
 }
 
+{
+    TestCase test_case("Group session pickles with headers");
+
+    std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *outbound =
+        olm_outbound_group_session(outbound_memory.data());
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(outbound), 'R'
+    );
+    olm_init_outbound_group_session(outbound, random.data(), random.size());
+    /* move the ratchet on, so that the first known index isn't 0 */
+    for (int i = 0; i < 3; ++i) {
+        std::vector<uint8_t> message(
+            olm_group_encrypt_message_length(outbound, 5)
+        );
+        olm_group_encrypt(
+            outbound, (uint8_t const *)"hello", 5,
+            message.data(), message.size()
+        );
+    }
+    std::vector<uint8_t> session_key(
+        olm_outbound_group_session_key_length(outbound)
+    );
+    olm_outbound_group_session_key(
+        outbound, session_key.data(), session_key.size()
+    );
+
+    std::vector<uint8_t> memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *session =
+        olm_inbound_group_session(memory.data());
+    olm_init_inbound_group_session(
+        session, session_key.data(), session_key.size()
+    );
+    std::vector<uint8_t> id(olm_inbound_group_session_id_length(session));
+    olm_inbound_group_session_id(session, id.data(), id.size());
+
+    size_t pickle_length =
+        olm_pickle_inbound_group_session_with_header_length(session);
+    std::vector<uint8_t> pickle(pickle_length);
+    assert_equals((size_t)-1, olm_pickle_inbound_group_session_with_header(
+        session, "secret_key", 10, pickle.data(), pickle_length - 1
+    ));
+    assert_equals(pickle_length, olm_pickle_inbound_group_session_with_header(
+        session, "secret_key", 10, pickle.data(), pickle_length
+    ));
+    assert_equals((uint8_t)'!', pickle[0]);
+
+    /* the header can be read without the key */
+    uint32_t version = 0, first_known_index = 0;
+    std::vector<uint8_t> peeked_id(id.size());
+    assert_equals((size_t)-1, olm_pickle_peek_header(
+        pickle.data(), pickle.size(), &version, &first_known_index,
+        peeked_id.data(), peeked_id.size() - 1
+    ));
+    assert_equals(id.size(), olm_pickle_peek_header(
+        pickle.data(), pickle.size(), &version, &first_known_index,
+        peeked_id.data(), peeked_id.size()
+    ));
+    assert_equals(id.data(), peeked_id.data(), id.size());
+    assert_equals((uint32_t)3, first_known_index);
+    assert_equals((uint32_t)2, version);
+
+    /* and a pickle without one has no header */
+    std::vector<uint8_t> plain(olm_pickle_inbound_group_session_length(session));
+    olm_pickle_inbound_group_session(
+        session, "secret_key", 10, plain.data(), plain.size()
+    );
+    assert_equals((size_t)-1, olm_pickle_peek_header(
+        plain.data(), plain.size(), &version, &first_known_index,
+        peeked_id.data(), peeked_id.size()
+    ));
+
+    std::vector<uint8_t> memory2(olm_inbound_group_session_size());
+    OlmInboundGroupSession *session2 =
+        olm_inbound_group_session(memory2.data());
+    std::vector<uint8_t> copy(pickle);
+    assert_equals(pickle_length, olm_unpickle_inbound_group_session(
+        session2, "secret_key", 10, copy.data(), copy.size()
+    ));
+    assert_equals((uint32_t)3, olm_inbound_group_session_first_known_index(
+        session2
+    ));
+    std::vector<uint8_t> plain2(plain.size());
+    olm_pickle_inbound_group_session(
+        session2, "secret_key", 10, plain2.data(), plain2.size()
+    );
+    assert_equals(plain.data(), plain2.data(), plain.size());
+
+    /* both kinds load from memory that is left as it was */
+    std::vector<uint8_t> scratch(pickle_length);
+    std::vector<uint8_t> original(pickle);
+    assert_equals(pickle_length, olm_unpickle_inbound_group_session_const(
+        session2, "secret_key", 10, pickle.data(), pickle.size(),
+        scratch.data(), scratch.size()
+    ));
+    assert_equals(original.data(), pickle.data(), pickle_length);
+    original = plain;
+    assert_equals((size_t)-1, olm_unpickle_inbound_group_session_const(
+        session2, "secret_key", 10, plain.data(), plain.size(),
+        scratch.data(), plain.size() - 1
+    ));
+    assert_equals(plain.size(), olm_unpickle_inbound_group_session_const(
+        session2, "secret_key", 10, plain.data(), plain.size(),
+        scratch.data(), plain.size()
+    ));
+    assert_equals(original.data(), plain.data(), plain.size());
+    olm_pickle_inbound_group_session(
+        session2, "secret_key", 10, plain2.data(), plain2.size()
+    );
+    assert_equals(plain.data(), plain2.data(), plain.size());
+
+    std::vector<uint8_t> key_memory(olm_pickle_key_size());
+    OlmPickleKey *key = olm_pickle_key(key_memory.data(), "secret_key", 10);
+    copy = pickle;
+    assert_equals(pickle_length, olm_unpickle_inbound_group_session_with_key(
+        session2, key, copy.data(), copy.size()
+    ));
+
+    /* the header is authenticated with the pickle */
+    copy = pickle;
+    copy[20] = copy[20] == 'A' ? 'B' : 'A';
+    assert_equals((size_t)-1, olm_unpickle_inbound_group_session(
+        session2, "secret_key", 10, copy.data(), copy.size()
+    ));
+    assert_equals(
+        std::string("BAD_ACCOUNT_KEY"),
+        std::string(olm_inbound_group_session_last_error(session2))
+    );
+    olm_clear_pickle_key(key);
+}
+
+{
+    TestCase test_case("Binary group session pickles");
+
+    uint8_t outbound_memory[olm_outbound_group_session_size()];
+    OlmOutboundGroupSession *outbound =
+        olm_outbound_group_session(outbound_memory);
+    uint8_t random[olm_init_outbound_group_session_random_length(outbound)];
+    memset(random, 'R', sizeof(random));
+    olm_init_outbound_group_session(outbound, random, sizeof(random));
+
+    size_t pickle_length = olm_pickle_outbound_group_session_length(outbound);
+    size_t binary_length =
+        olm_pickle_outbound_group_session_binary_length(outbound);
+    assert_equals(true, binary_length < pickle_length);
+
+    uint8_t pickle1[pickle_length];
+    olm_pickle_outbound_group_session(
+        outbound, "secret_key", 10, pickle1, pickle_length
+    );
+    uint8_t binary[binary_length];
+    assert_equals(binary_length, olm_pickle_outbound_group_session_binary(
+        outbound, "secret_key", 10, binary, binary_length
+    ));
+
+    uint8_t outbound_memory2[olm_outbound_group_session_size()];
+    OlmOutboundGroupSession *outbound2 =
+        olm_outbound_group_session(outbound_memory2);
+    assert_equals(binary_length, olm_unpickle_outbound_group_session_binary(
+        outbound2, "secret_key", 10, binary, binary_length
+    ));
+    uint8_t pickle2[pickle_length];
+    olm_pickle_outbound_group_session(
+        outbound2, "secret_key", 10, pickle2, pickle_length
+    );
+    assert_equals(pickle1, pickle2, pickle_length);
+
+    uint8_t session_key[olm_outbound_group_session_key_length(outbound)];
+    size_t session_key_length = olm_outbound_group_session_key(
+        outbound, session_key, sizeof(session_key)
+    );
+    uint8_t inbound_memory[olm_inbound_group_session_size()];
+    OlmInboundGroupSession *inbound =
+        olm_inbound_group_session(inbound_memory);
+    olm_init_inbound_group_session(inbound, session_key, session_key_length);
+
+    pickle_length = olm_pickle_inbound_group_session_length(inbound);
+    binary_length = olm_pickle_inbound_group_session_binary_length(inbound);
+    assert_equals(true, binary_length < pickle_length);
+
+    uint8_t inbound_pickle1[pickle_length];
+    olm_pickle_inbound_group_session(
+        inbound, "secret_key", 10, inbound_pickle1, pickle_length
+    );
+    uint8_t inbound_binary[binary_length];
+    assert_equals(binary_length, olm_pickle_inbound_group_session_binary(
+        inbound, "secret_key", 10, inbound_binary, binary_length
+    ));
+
+    uint8_t inbound_memory2[olm_inbound_group_session_size()];
+    OlmInboundGroupSession *inbound2 =
+        olm_inbound_group_session(inbound_memory2);
+    uint8_t corrupted[binary_length];
+    memcpy(corrupted, inbound_binary, binary_length);
+    corrupted[0] ^= 1;
+    assert_equals((size_t)-1, olm_unpickle_inbound_group_session_binary(
+        inbound2, "secret_key", 10, corrupted, binary_length
+    ));
+    assert_equals(
+        std::string("BAD_ACCOUNT_KEY"),
+        std::string(olm_inbound_group_session_last_error(inbound2))
+    );
+
+    assert_equals(binary_length, olm_unpickle_inbound_group_session_binary(
+        inbound2, "secret_key", 10, inbound_binary, binary_length
+    ));
+    uint8_t inbound_pickle2[pickle_length];
+    olm_pickle_inbound_group_session(
+        inbound2, "secret_key", 10, inbound_pickle2, pickle_length
+    );
+    assert_equals(inbound_pickle1, inbound_pickle2, pickle_length);
+}
+
+{
+    TestCase test_case("Group session pickle batches");
+
+    const size_t count = 5;
+    std::vector<std::vector<uint8_t>> memory(count);
+    std::vector<OlmInboundGroupSession *> sessions(count);
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t outbound_memory[olm_outbound_group_session_size()];
+        OlmOutboundGroupSession *outbound =
+            olm_outbound_group_session(outbound_memory);
+        uint8_t random[olm_init_outbound_group_session_random_length(outbound)];
+        memset(random, 'A' + i, sizeof(random));
+        olm_init_outbound_group_session(outbound, random, sizeof(random));
+        uint8_t session_key[olm_outbound_group_session_key_length(outbound)];
+        size_t session_key_length = olm_outbound_group_session_key(
+            outbound, session_key, sizeof(session_key)
+        );
+        memory[i].resize(olm_inbound_group_session_size());
+        sessions[i] = olm_inbound_group_session(memory[i].data());
+        olm_init_inbound_group_session(
+            sessions[i], session_key, session_key_length
+        );
+    }
+
+    uint8_t key_memory[olm_pickle_key_size()];
+    OlmPickleKey *key = olm_pickle_key(key_memory, "secret_key", 10);
+
+    size_t batch_length = olm_pickle_inbound_group_session_batch_length(
+        sessions.data(), count
+    );
+    std::vector<uint8_t> batch(batch_length);
+    assert_equals((size_t)-1, olm_pickle_inbound_group_session_batch(
+        key, sessions.data(), count, batch.data(), batch_length - 1
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_inbound_group_session_last_error(sessions[0]))
+    );
+    assert_equals(batch_length, olm_pickle_inbound_group_session_batch(
+        key, sessions.data(), count, batch.data(), batch_length
+    ));
+    assert_equals(count, olm_pickle_batch_count(batch.data(), batch_length));
+    assert_equals((size_t)-1, olm_pickle_batch_count(
+        batch.data(), batch_length - 1
+    ));
+
+    /* load the batch in two parts, as two threads might */
+    std::vector<std::vector<uint8_t>> memory2(count);
+    std::vector<OlmInboundGroupSession *> sessions2(count);
+    for (size_t i = 0; i < count; ++i) {
+        memory2[i].resize(olm_inbound_group_session_size());
+        sessions2[i] = olm_inbound_group_session(memory2[i].data());
+    }
+    assert_equals((size_t)3, olm_unpickle_inbound_group_session_batch(
+        key, batch.data(), batch_length, 2, sessions2.data() + 2, 3
+    ));
+    assert_equals((size_t)2, olm_unpickle_inbound_group_session_batch(
+        key, batch.data(), batch_length, 0, sessions2.data(), 2
+    ));
+
+    /* each session comes out as it would from its own pickle */
+    for (size_t i = 0; i < count; ++i) {
+        size_t pickle_length =
+            olm_pickle_inbound_group_session_length(sessions[i]);
+        std::vector<uint8_t> pickle1(pickle_length), pickle2(pickle_length);
+        olm_pickle_inbound_group_session(
+            sessions[i], "secret_key", 10, pickle1.data(), pickle_length
+        );
+        olm_pickle_inbound_group_session(
+            sessions2[i], "secret_key", 10, pickle2.data(), pickle_length
+        );
+        assert_equals(pickle1.data(), pickle2.data(), pickle_length);
+    }
+
+    /* an ordinary pickle can be loaded with the derived keys */
+    {
+        size_t pickle_length =
+            olm_pickle_inbound_group_session_length(sessions[1]);
+        std::vector<uint8_t> pickle1(pickle_length), pickle2(pickle_length);
+        olm_pickle_inbound_group_session(
+            sessions[1], "secret_key", 10, pickle1.data(), pickle_length
+        );
+        std::vector<uint8_t> tmp(pickle1);
+        assert_equals(pickle_length, olm_unpickle_inbound_group_session_with_key(
+            sessions2[0], key, tmp.data(), pickle_length
+        ));
+        olm_pickle_inbound_group_session(
+            sessions2[0], "secret_key", 10, pickle2.data(), pickle_length
+        );
+        assert_equals(pickle1.data(), pickle2.data(), pickle_length);
+
+        tmp = pickle1;
+        uint8_t wrong_key_memory[olm_pickle_key_size()];
+        OlmPickleKey *wrong_key = olm_pickle_key(wrong_key_memory, "wrong", 5);
+        assert_equals((size_t)-1, olm_unpickle_inbound_group_session_with_key(
+            sessions2[0], wrong_key, tmp.data(), pickle_length
+        ));
+        assert_equals(
+            std::string("BAD_ACCOUNT_KEY"),
+            std::string(olm_inbound_group_session_last_error(sessions2[0]))
+        );
+        olm_clear_pickle_key(wrong_key);
+    }
+
+    /* asking for more sessions than there are */
+    olm_pickle_inbound_group_session_batch(
+        key, sessions.data(), count, batch.data(), batch_length
+    );
+    assert_equals((size_t)-1, olm_unpickle_inbound_group_session_batch(
+        key, batch.data(), batch_length, 3, sessions2.data(), 3
+    ));
+    assert_equals(
+        std::string("CORRUPTED_PICKLE"),
+        std::string(olm_inbound_group_session_last_error(sessions2[0]))
+    );
+
+    /* a different key */
+    uint8_t other_key_memory[olm_pickle_key_size()];
+    OlmPickleKey *other_key = olm_pickle_key(other_key_memory, "other_key", 9);
+    assert_equals((size_t)-1, olm_unpickle_inbound_group_session_batch(
+        other_key, batch.data(), batch_length, 0, sessions2.data(), count
+    ));
+    assert_equals(
+        std::string("BAD_ACCOUNT_KEY"),
+        std::string(olm_inbound_group_session_last_error(sessions2[0]))
+    );
+
+    olm_clear_pickle_key(key);
+    olm_clear_pickle_key(other_key);
+}
+
+{
+    TestCase test_case("Group session stores");
+
+    const size_t count = 20;
+    std::vector<std::vector<uint8_t>> memory(count);
+    std::vector<OlmInboundGroupSession *> sessions(count);
+    std::vector<std::vector<uint8_t>> ids(count);
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t outbound_memory[olm_outbound_group_session_size()];
+        OlmOutboundGroupSession *outbound =
+            olm_outbound_group_session(outbound_memory);
+        uint8_t random[olm_init_outbound_group_session_random_length(outbound)];
+        memset(random, 'a' + i, sizeof(random));
+        olm_init_outbound_group_session(outbound, random, sizeof(random));
+        uint8_t session_key[olm_outbound_group_session_key_length(outbound)];
+        size_t session_key_length = olm_outbound_group_session_key(
+            outbound, session_key, sizeof(session_key)
+        );
+        memory[i].resize(olm_inbound_group_session_size());
+        sessions[i] = olm_inbound_group_session(memory[i].data());
+        olm_init_inbound_group_session(
+            sessions[i], session_key, session_key_length
+        );
+        ids[i].resize(olm_inbound_group_session_id_length(sessions[i]));
+        olm_inbound_group_session_id(
+            sessions[i], ids[i].data(), ids[i].size()
+        );
+    }
+
+    uint8_t key_memory[olm_pickle_key_size()];
+    OlmPickleKey *key = olm_pickle_key(key_memory, "secret_key", 10);
+
+    size_t store_length = olm_inbound_group_session_store_length(
+        sessions.data(), count
+    );
+    std::vector<uint8_t> store(store_length);
+    assert_equals((size_t)-1, olm_write_inbound_group_session_store(
+        key, sessions.data(), count, store.data(), store_length - 1
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_inbound_group_session_last_error(sessions[0]))
+    );
+    assert_equals(store_length, olm_write_inbound_group_session_store(
+        key, sessions.data(), count, store.data(), store_length
+    ));
+    assert_equals(count, olm_inbound_group_session_store_count(
+        store.data(), store_length
+    ));
+    std::vector<uint8_t> original = store;
+
+    /* load each session, in a different order to the one they were added */
+    uint8_t loaded_memory[olm_inbound_group_session_size()];
+    for (size_t j = 0; j < count; ++j) {
+        size_t i = (j * 7) % count;
+        OlmInboundGroupSession *loaded =
+            olm_inbound_group_session(loaded_memory);
+        assert_equals((size_t)0, olm_load_inbound_group_session_from_store(
+            key, store.data(), store_length, ids[i].data(), ids[i].size(),
+            loaded
+        ));
+        size_t pickle_length =
+            olm_pickle_inbound_group_session_length(sessions[i]);
+        std::vector<uint8_t> pickle1(pickle_length), pickle2(pickle_length);
+        olm_pickle_inbound_group_session(
+            sessions[i], "secret_key", 10, pickle1.data(), pickle_length
+        );
+        olm_pickle_inbound_group_session(
+            loaded, "secret_key", 10, pickle2.data(), pickle_length
+        );
+        assert_equals(pickle1.data(), pickle2.data(), pickle_length);
+    }
+    /* loading doesn't change the store */
+    assert_equals(original.data(), store.data(), store_length);
+
+    OlmInboundGroupSession *loaded = olm_inbound_group_session(loaded_memory);
+    std::vector<uint8_t> unknown_id = ids[0];
+    unknown_id[0] = unknown_id[0] == 'A' ? 'B' : 'A';
+    assert_equals((size_t)-1, olm_load_inbound_group_session_from_store(
+        key, store.data(), store_length, unknown_id.data(), unknown_id.size(),
+        loaded
+    ));
+    assert_equals(
+        std::string("UNKNOWN_SESSION_ID"),
+        std::string(olm_inbound_group_session_last_error(loaded))
+    );
+
+    uint8_t other_key_memory[olm_pickle_key_size()];
+    OlmPickleKey *other_key = olm_pickle_key(other_key_memory, "other_key", 9);
+    assert_equals((size_t)-1, olm_load_inbound_group_session_from_store(
+        other_key, store.data(), store_length, ids[3].data(), ids[3].size(),
+        loaded
+    ));
+    assert_equals(
+        std::string("BAD_ACCOUNT_KEY"),
+        std::string(olm_inbound_group_session_last_error(loaded))
+    );
+
+    /* a store cut short loses the sessions at its end */
+    assert_equals((size_t)-1, olm_load_inbound_group_session_from_store(
+        key, store.data(), store_length - 1, ids[count - 1].data(),
+        ids[count - 1].size(), loaded
+    ));
+    assert_equals(
+        std::string("CORRUPTED_PICKLE"),
+        std::string(olm_inbound_group_session_last_error(loaded))
+    );
+    assert_equals((size_t)-1, olm_inbound_group_session_store_count(
+        store.data(), 100
+    ));
+
+    olm_clear_pickle_key(key);
+    olm_clear_pickle_key(other_key);
+}
+
+{
+    TestCase test_case("Group sessions looked up by ID");
+
+    const size_t capacity = 3;
+    std::vector<uint8_t> store_memory(olm_group_session_store_size(capacity));
+    OlmGroupSessionStore *store =
+        olm_group_session_store(store_memory.data(), capacity);
+
+    /* three senders, one of which sends its session to us twice */
+    std::vector<std::vector<uint8_t>> outbound_memory(capacity);
+    std::vector<OlmOutboundGroupSession *> outbound(capacity);
+    std::vector<std::vector<uint8_t>> ids(capacity);
+    std::vector<OlmInboundGroupSession *> inbound(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        outbound_memory[i].resize(olm_outbound_group_session_size());
+        outbound[i] = olm_outbound_group_session(outbound_memory[i].data());
+        uint8_t random[olm_init_outbound_group_session_random_length(
+            outbound[i]
+        )];
+        memset(random, 'r' + i, sizeof(random));
+        olm_init_outbound_group_session(outbound[i], random, sizeof(random));
+        uint8_t session_key[olm_outbound_group_session_key_length(
+            outbound[i]
+        )];
+        size_t session_key_length = olm_outbound_group_session_key(
+            outbound[i], session_key, sizeof(session_key)
+        );
+
+        inbound[i] = olm_group_session_store_add(store);
+        assert_not_equals((OlmInboundGroupSession *)NULL, inbound[i]);
+        olm_init_inbound_group_session(
+            inbound[i], session_key, session_key_length
+        );
+        assert_equals((size_t)0, olm_group_session_store_commit(
+            store, inbound[i]
+        ));
+        ids[i].resize(32);
+        assert_equals((size_t)32, olm_inbound_group_session_id_binary(
+            inbound[i], ids[i].data(), ids[i].size()
+        ));
+    }
+    assert_equals(capacity, olm_group_session_store_count(store));
+    assert_equals((OlmInboundGroupSession *)NULL,
+                  olm_group_session_store_add(store));
+    assert_equals(
+        std::string("STORE_FULL"),
+        std::string(olm_group_session_store_last_error(store))
+    );
+
+    /* the binary ID is the base64-decoded session ID */
+    uint8_t id[olm_inbound_group_session_id_length(inbound[0])];
+    size_t id_length = olm_inbound_group_session_id(inbound[0], id, sizeof(id));
+    uint8_t decoded_id[32];
+    _olm_decode_base64(id, id_length, decoded_id);
+    assert_equals(ids[0].data(), decoded_id, 32);
+
+    for (size_t i = 0; i < capacity; ++i) {
+        assert_equals(inbound[i], olm_group_session_store_find(
+            store, ids[i].data(), ids[i].size()
+        ));
+
+        uint8_t plaintext[] = "Message";
+        size_t message_length = olm_group_encrypt_message_length(
+            outbound[i], sizeof(plaintext)
+        );
+        std::vector<uint8_t> message(message_length);
+        olm_group_encrypt(
+            outbound[i], plaintext, sizeof(plaintext),
+            message.data(), message_length
+        );
+        std::vector<uint8_t> copy = message;
+        size_t max_length =
+            olm_group_session_store_decrypt_max_plaintext_length(
+                store, ids[i].data(), ids[i].size(),
+                copy.data(), copy.size()
+            );
+        std::vector<uint8_t> output(max_length);
+        uint32_t message_index;
+        assert_equals(sizeof(plaintext), olm_group_session_store_decrypt(
+            store, ids[i].data(), ids[i].size(),
+            message.data(), message_length,
+            output.data(), max_length, &message_index
+        ));
+        assert_equals(plaintext, output.data(), sizeof(plaintext));
+
+        /* a message from another session fails its signature check */
+        olm_group_encrypt(
+            outbound[(i + 1) % capacity], plaintext, sizeof(plaintext),
+            message.data(), message_length
+        );
+        assert_equals((size_t)-1, olm_group_session_store_decrypt(
+            store, ids[i].data(), ids[i].size(),
+            message.data(), message_length,
+            output.data(), max_length, &message_index
+        ));
+        assert_equals(
+            std::string("BAD_SIGNATURE"),
+            std::string(olm_group_session_store_last_error(store))
+        );
+    }
+
+    std::vector<OlmInboundGroupSession *> all(capacity);
+    assert_equals((size_t)-1, olm_group_session_store_sessions(
+        store, all.data(), capacity - 1
+    ));
+    assert_equals(capacity, olm_group_session_store_sessions(
+        store, all.data(), capacity
+    ));
+
+    /* removing a session makes room for another, which replaces the session
+     * with the same ID */
+    assert_equals((size_t)0, olm_group_session_store_remove(store, inbound[1]));
+    assert_equals((OlmInboundGroupSession *)NULL, olm_group_session_store_find(
+        store, ids[1].data(), ids[1].size()
+    ));
+    assert_equals(
+        std::string("UNKNOWN_SESSION_ID"),
+        std::string(olm_group_session_store_last_error(store))
+    );
+    OlmInboundGroupSession *again = olm_group_session_store_add(store);
+    uint8_t export_buffer[olm_export_inbound_group_session_length(inbound[0])];
+    size_t export_length = olm_export_inbound_group_session(
+        inbound[0], export_buffer, sizeof(export_buffer), 1
+    );
+    assert_not_equals((size_t)-1, olm_import_inbound_group_session(
+        again, export_buffer, export_length
+    ));
+    assert_equals((size_t)0, olm_group_session_store_commit(store, again));
+    assert_equals(again, olm_group_session_store_find(
+        store, ids[0].data(), ids[0].size()
+    ));
+    assert_equals((size_t)2, olm_group_session_store_count(store));
+    assert_equals((size_t)-1, olm_group_session_store_commit(store, again));
+
+    olm_clear_group_session_store(store);
+}
+
+{
+    TestCase test_case("Group session store read while it changes");
+
+    const size_t capacity = 4;
+    std::vector<uint8_t> store_memory(olm_group_session_store_size(capacity));
+    OlmGroupSessionStore *store =
+        olm_group_session_store(store_memory.data(), capacity);
+    std::vector<std::vector<uint8_t>> session_keys(capacity);
+    std::vector<std::vector<uint8_t>> ids(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+        OlmOutboundGroupSession *outbound =
+            olm_outbound_group_session(outbound_memory.data());
+        std::vector<uint8_t> random(
+            olm_init_outbound_group_session_random_length(outbound), 'k' + i
+        );
+        olm_init_outbound_group_session(outbound, random.data(), random.size());
+        session_keys[i].resize(olm_outbound_group_session_key_length(outbound));
+        olm_outbound_group_session_key(
+            outbound, session_keys[i].data(), session_keys[i].size()
+        );
+        OlmInboundGroupSession *session = olm_group_session_store_add(store);
+        olm_init_inbound_group_session(
+            session, session_keys[i].data(), session_keys[i].size()
+        );
+        olm_group_session_store_commit(store, session);
+        ids[i].resize(32);
+        olm_inbound_group_session_id_binary(session, ids[i].data(), 32);
+    }
+
+    /* a session removed during a read stays readable until the read ends,
+     * and its room is only reused after that */
+    size_t ticket = olm_group_session_store_read_begin(store);
+    const OlmInboundGroupSession *found =
+        olm_group_session_store_lookup(store, ids[0].data(), 32);
+    assert_equals(
+        (const OlmInboundGroupSession *)olm_group_session_store_find(
+            store, ids[0].data(), 32
+        ),
+        found
+    );
+    assert_equals((size_t)0, olm_group_session_store_remove(
+        store, olm_group_session_store_find(store, ids[0].data(), 32)
+    ));
+    assert_equals((const OlmInboundGroupSession *)NULL,
+                  olm_group_session_store_lookup(store, ids[0].data(), 32));
+    assert_equals(capacity - 1, olm_group_session_store_count(store));
+    uint8_t found_id[32];
+    olm_inbound_group_session_id_binary(
+        const_cast<OlmInboundGroupSession *>(found), found_id, 32
+    );
+    assert_equals(ids[0].data(), found_id, 32);
+    assert_equals((OlmInboundGroupSession *)NULL,
+                  olm_group_session_store_add(store));
+    olm_group_session_store_read_end(store, ticket);
+    OlmInboundGroupSession *again = olm_group_session_store_add(store);
+    assert_equals((const OlmInboundGroupSession *)again, found);
+    olm_init_inbound_group_session(
+        again, session_keys[0].data(), session_keys[0].size()
+    );
+    olm_group_session_store_commit(store, again);
+
+    /* readers never find a session under the wrong ID, or miss one that is
+     * there throughout, while the other sessions keep being replaced */
+    std::atomic<bool> done(false);
+    std::atomic<size_t> wrong(0), missed(0);
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < 4; ++t) {
+        readers.emplace_back([&, t] {
+            while (!done.load()) {
+                for (size_t i = 0; i < capacity; ++i) {
+                    size_t read = olm_group_session_store_read_begin(store);
+                    const OlmInboundGroupSession *session =
+                        olm_group_session_store_lookup(
+                            store, ids[i].data(), 32
+                        );
+                    uint8_t id[32];
+                    if (session) {
+                        olm_inbound_group_session_id_binary(
+                            const_cast<OlmInboundGroupSession *>(session),
+                            id, 32
+                        );
+                        wrong += memcmp(id, ids[i].data(), 32) != 0;
+                    } else if (i == 0) {
+                        missed++;
+                    }
+                    olm_group_session_store_read_end(store, read);
+                }
+            }
+        });
+    }
+    for (size_t round = 0; round < 2000; ++round) {
+        size_t i = 1 + round % (capacity - 1);
+        OlmInboundGroupSession *session = olm_group_session_store_find(
+            store, ids[i].data(), 32
+        );
+        if (round % 2) {
+            olm_group_session_store_remove(store, session);
+        }
+        OlmInboundGroupSession *replacement =
+            olm_group_session_store_add(store);
+        if (!replacement) {
+            /* the room is still being read */
+            std::this_thread::yield();
+            if (!(round % 2)) {
+                continue;
+            }
+            while (!(replacement = olm_group_session_store_add(store))) {
+                std::this_thread::yield();
+            }
+        }
+        olm_init_inbound_group_session(
+            replacement, session_keys[i].data(), session_keys[i].size()
+        );
+        olm_group_session_store_commit(store, replacement);
+    }
+    done = true;
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    assert_equals((size_t)0, wrong.load());
+    assert_equals((size_t)0, missed.load());
+    assert_equals(capacity, olm_group_session_store_count(store));
+
+    olm_clear_group_session_store(store);
+}
+
+{
+    TestCase test_case("Group sessions shared between processes");
+
+    const size_t capacity = 2;
+    const size_t shared_length =
+        olm_shared_group_session_store_shared_length(capacity);
+    /* with room after the store for a message key cache */
+    const size_t store_length = (shared_length + 15) & ~15;
+    const size_t cache_length =
+        4 * olm_inbound_group_session_message_key_cache_entry_size();
+    std::vector<uint8_t> shared(store_length + cache_length);
+    std::vector<uint8_t> memory(olm_shared_group_session_store_size());
+    std::vector<uint8_t> other_memory(olm_shared_group_session_store_size());
+    OlmSharedGroupSessionStore *store = olm_shared_group_session_store(
+        memory.data(), shared.data(), capacity
+    );
+    /* as another process would, with its own handle */
+    OlmSharedGroupSessionStore *other = olm_shared_group_session_store_attach(
+        other_memory.data(), shared.data(), shared_length
+    );
+    assert_not_equals((OlmSharedGroupSessionStore *)NULL, other);
+    assert_equals(
+        (OlmSharedGroupSessionStore *)NULL,
+        olm_shared_group_session_store_attach(
+            other_memory.data(), shared.data(), shared_length - 1
+        )
+    );
+
+    std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *outbound =
+        olm_outbound_group_session(outbound_memory.data());
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(outbound), 's'
+    );
+    olm_init_outbound_group_session(outbound, random.data(), random.size());
+    std::vector<uint8_t> session_key(
+        olm_outbound_group_session_key_length(outbound)
+    );
+    olm_outbound_group_session_key(
+        outbound, session_key.data(), session_key.size()
+    );
+
+    OlmInboundGroupSession *session = olm_shared_group_session_store_add(store);
+    olm_init_inbound_group_session(
+        session, session_key.data(), session_key.size()
+    );
+    uint8_t id[32];
+    olm_inbound_group_session_id_binary(session, id, sizeof(id));
+    assert_equals((OlmInboundGroupSession *)NULL,
+                  olm_shared_group_session_store_lock(other, id, sizeof(id)));
+    assert_equals((size_t)0, olm_shared_group_session_store_commit(
+        store, session
+    ));
+    assert_equals((size_t)-1, olm_shared_group_session_store_commit(
+        store, session
+    ));
+    assert_equals((size_t)1, olm_shared_group_session_store_count(other));
+
+    session = olm_shared_group_session_store_lock(other, id, sizeof(id));
+    assert_equals((size_t)4, olm_inbound_group_session_set_message_key_cache(
+        session, shared.data() + store_length, cache_length
+    ));
+    olm_shared_group_session_store_unlock(other, session);
+
+    /* a session added but not committed can be given back */
+    OlmInboundGroupSession *spare = olm_shared_group_session_store_add(other);
+    assert_not_equals((OlmInboundGroupSession *)NULL, spare);
+    assert_equals((OlmInboundGroupSession *)NULL,
+                  olm_shared_group_session_store_add(store));
+    assert_equals(
+        std::string("STORE_FULL"),
+        std::string(olm_shared_group_session_store_last_error(store))
+    );
+    assert_equals((size_t)0, olm_shared_group_session_store_discard(
+        other, spare
+    ));
+
+    uint8_t plaintext[] = "Message";
+    size_t message_length = olm_group_encrypt_message_length(
+        outbound, sizeof(plaintext)
+    );
+    std::vector<std::vector<uint8_t>> messages(64);
+    for (auto & message : messages) {
+        message.resize(message_length);
+        olm_group_encrypt(
+            outbound, plaintext, sizeof(plaintext),
+            message.data(), message_length
+        );
+    }
+    std::vector<uint8_t> output(message_length);
+    uint32_t message_index;
+    std::vector<uint8_t> copy = messages[1];
+    assert_equals(sizeof(plaintext), olm_shared_group_session_store_decrypt(
+        other, id, sizeof(id), copy.data(), copy.size(),
+        output.data(), output.size(), &message_index
+    ));
+    assert_equals((uint32_t)1, message_index);
+    assert_equals(plaintext, output.data(), sizeof(plaintext));
+
+    /* the shared memory holds no pointers, so it can be used wherever it is
+     * mapped, and the session's cache is the one in the same mapping */
+    std::vector<uint8_t> moved = shared;
+    std::vector<uint8_t> moved_memory(olm_shared_group_session_store_size());
+    OlmSharedGroupSessionStore *moved_store =
+        olm_shared_group_session_store_attach(
+            moved_memory.data(), moved.data(), moved.size()
+        );
+    assert_not_equals((OlmSharedGroupSessionStore *)NULL, moved_store);
+    copy = messages[2];
+    assert_equals(sizeof(plaintext), olm_shared_group_session_store_decrypt(
+        moved_store, id, sizeof(id), copy.data(), copy.size(),
+        output.data(), output.size(), &message_index
+    ));
+    assert_equals((uint32_t)2, message_index);
+    auto cached_message_keys = [&](OlmSharedGroupSessionStore *handle) {
+        OlmMemoryStats stats = {};
+        OlmInboundGroupSession *locked =
+            olm_shared_group_session_store_lock(handle, id, sizeof(id));
+        olm_inbound_group_session_memory_stats(locked, &stats);
+        olm_shared_group_session_store_unlock(handle, locked);
+        return stats.cached_message_keys;
+    };
+    assert_equals((size_t)2, cached_message_keys(moved_store));
+    assert_equals((size_t)1, cached_message_keys(store));
+
+    /* threads using either handle take turns with the session */
+    std::atomic<size_t> failures(0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < 4; ++t) {
+        workers.emplace_back([&, t] {
+            OlmSharedGroupSessionStore *handle = t % 2 ? other : store;
+            std::vector<uint8_t> buffer;
+            std::vector<uint8_t> result(message_length);
+            uint32_t index;
+            for (size_t i = t; i < messages.size(); i += 4) {
+                buffer = messages[i];
+                if (olm_shared_group_session_store_decrypt(
+                        handle, id, sizeof(id), buffer.data(), buffer.size(),
+                        result.data(), result.size(), &index
+                    ) != sizeof(plaintext) || index != i) {
+                    failures++;
+                }
+            }
+        });
+    }
+    for (auto & worker : workers) {
+        worker.join();
+    }
+    assert_equals((size_t)0, failures.load());
+
+    session = olm_shared_group_session_store_lock(other, id, sizeof(id));
+    assert_not_equals((OlmInboundGroupSession *)NULL, session);
+    assert_equals((uint32_t)0,
+                  olm_inbound_group_session_first_known_index(session));
+    olm_shared_group_session_store_unlock(other, session);
+
+    assert_equals((size_t)0, olm_shared_group_session_store_remove(
+        other, id, sizeof(id)
+    ));
+    assert_equals((size_t)0, olm_shared_group_session_store_count(store));
+    assert_equals((size_t)-1, olm_shared_group_session_store_decrypt(
+        store, id, sizeof(id), copy.data(), copy.size(),
+        output.data(), output.size(), &message_index
+    ));
+    assert_equals(
+        std::string("UNKNOWN_SESSION_ID"),
+        std::string(olm_shared_group_session_store_last_error(store))
+    );
+
+    olm_clear_shared_group_session_store(moved_store);
+    assert_equals(shared_length, olm_clear_shared_group_session_store(store));
+    assert_equals(
+        (OlmSharedGroupSessionStore *)NULL,
+        olm_shared_group_session_store_attach(
+            other_memory.data(), shared.data(), shared_length
+        )
+    );
+}
+
+{
+    TestCase test_case("Group sessions sharded by ID");
+
+    const size_t shard_count = 3, capacity = 8, count = 8;
+    size_t shard_size = olm_group_session_store_size(capacity);
+    std::vector<OlmGroupSessionStore *> shards(shard_count);
+    std::vector<void *> shard_memory(shard_count);
+    std::vector<int> nodes(shard_count);
+    for (size_t i = 0; i < shard_count; ++i) {
+        /* every machine has node 0 */
+        nodes[i] = i ? OLM_ANY_NUMA_NODE : 0;
+        shard_memory[i] = olm_map_memory(shard_size, nodes[i]);
+        assert_not_equals((void *)NULL, shard_memory[i]);
+        shards[i] = olm_group_session_store(shard_memory[i], capacity);
+    }
+    std::vector<uint8_t> store_memory(
+        olm_sharded_group_session_store_size(shard_count)
+    );
+    OlmShardedGroupSessionStore *store = olm_sharded_group_session_store(
+        store_memory.data(), shards.data(), nodes.data(), shard_count
+    );
+
+    /* the sessions are all set up in the first shard, and moved to the
+     * shards for their IDs */
+    std::vector<std::vector<uint8_t>> outbound_memory(count);
+    std::vector<OlmOutboundGroupSession *> outbound(count);
+    std::vector<std::vector<uint8_t>> ids(count);
+    std::vector<OlmInboundGroupSession *> inbound(count);
+    for (size_t i = 0; i < count; ++i) {
+        outbound_memory[i].resize(olm_outbound_group_session_size());
+        outbound[i] = olm_outbound_group_session(outbound_memory[i].data());
+        std::vector<uint8_t> random(
+            olm_init_outbound_group_session_random_length(outbound[i]),
+            'a' + i
+        );
+        olm_init_outbound_group_session(
+            outbound[i], random.data(), random.size()
+        );
+        std::vector<uint8_t> session_key(
+            olm_outbound_group_session_key_length(outbound[i])
+        );
+        olm_outbound_group_session_key(
+            outbound[i], session_key.data(), session_key.size()
+        );
+
+        OlmInboundGroupSession *added = olm_group_session_store_add(shards[0]);
+        olm_init_inbound_group_session(
+            added, session_key.data(), session_key.size()
+        );
+        inbound[i] = olm_sharded_group_session_store_commit(store, added);
+        assert_not_equals((OlmInboundGroupSession *)NULL, inbound[i]);
+        ids[i].resize(32);
+        olm_inbound_group_session_id_binary(
+            inbound[i], ids[i].data(), ids[i].size()
+        );
+        size_t shard = olm_sharded_group_session_store_shard_index(
+            store, ids[i].data(), ids[i].size()
+        );
+        assert_equals(inbound[i], olm_group_session_store_find(
+            shards[shard], ids[i].data(), ids[i].size()
+        ));
+    }
+    assert_equals(count, olm_sharded_group_session_store_count(store));
+    assert_equals(true, olm_group_session_store_count(shards[0]) < count);
+    assert_equals((OlmInboundGroupSession *)NULL,
+                  olm_sharded_group_session_store_commit(store, inbound[0]));
+    assert_equals(
+        std::string("UNKNOWN_SESSION_ID"),
+        std::string(olm_sharded_group_session_store_last_error(store))
+    );
+
+    /* two messages from each session, a message for an ID of the wrong
+     * length and one for a session we don't have */
+    uint8_t plaintext[] = "Message";
+    size_t message_count = 2 * count + 2;
+    std::vector<std::vector<uint8_t>> messages(message_count);
+    std::vector<std::vector<uint8_t>> outputs(message_count);
+    std::vector<uint8_t const *> id_ptrs(message_count);
+    std::vector<size_t> id_lengths(message_count, 32);
+    std::vector<uint8_t *> message_ptrs(message_count);
+    std::vector<size_t> message_lengths(message_count);
+    std::vector<uint8_t *> output_ptrs(message_count);
+    std::vector<size_t> max_lengths(message_count);
+    for (size_t i = 0; i < message_count; ++i) {
+        OlmOutboundGroupSession *sender = outbound[i % count];
+        messages[i].resize(olm_group_encrypt_message_length(
+            sender, sizeof(plaintext)
+        ));
+        olm_group_encrypt(
+            sender, plaintext, sizeof(plaintext),
+            messages[i].data(), messages[i].size()
+        );
+        id_ptrs[i] = ids[i % count].data();
+        message_ptrs[i] = messages[i].data();
+        message_lengths[i] = messages[i].size();
+        outputs[i].resize(messages[i].size());
+        output_ptrs[i] = outputs[i].data();
+        max_lengths[i] = outputs[i].size();
+    }
+    id_lengths[2 * count] = 31;
+    std::vector<uint8_t> unknown_id(32, 'u');
+    id_ptrs[2 * count + 1] = unknown_id.data();
+
+    /* an executor which runs the jobs backwards, and notes their nodes */
+    struct NodeExecutor {
+        static void run(
+            void * context, OlmBatchJob job, void * job_context,
+            const int * job_nodes, size_t job_count
+        ) {
+            std::vector<int> &seen = *static_cast<std::vector<int> *>(
+                context
+            );
+            seen.assign(job_nodes, job_nodes + job_count);
+            while (job_count--) {
+                job(job_context, job_count);
+            }
+        }
+    };
+    std::vector<size_t> scratch(
+        olm_sharded_group_session_store_decrypt_batch_scratch_length(
+            store, message_count
+        )
+    );
+    std::vector<size_t> plaintext_lengths(message_count);
+    std::vector<uint32_t> indices(message_count);
+    std::vector<const char *> errors(message_count);
+    std::vector<int> seen_nodes;
+    assert_equals((size_t)-1, olm_sharded_group_session_store_decrypt_batch(
+        store, message_count, id_ptrs.data(), id_lengths.data(),
+        message_ptrs.data(), message_lengths.data(),
+        output_ptrs.data(), max_lengths.data(),
+        plaintext_lengths.data(), indices.data(), errors.data(),
+        scratch.data(), scratch.size() - 1,
+        NodeExecutor::run, &seen_nodes
+    ));
+    assert_equals((size_t)2, olm_sharded_group_session_store_decrypt_batch(
+        store, message_count, id_ptrs.data(), id_lengths.data(),
+        message_ptrs.data(), message_lengths.data(),
+        output_ptrs.data(), max_lengths.data(),
+        plaintext_lengths.data(), indices.data(), errors.data(),
+        scratch.data(), scratch.size(),
+        NodeExecutor::run, &seen_nodes
+    ));
+    assert_equals(true, seen_nodes == nodes);
+    for (size_t i = 0; i < 2 * count; ++i) {
+        assert_equals(sizeof(plaintext), plaintext_lengths[i]);
+        assert_equals(plaintext, outputs[i].data(), sizeof(plaintext));
+        assert_equals((uint32_t)(i / count), indices[i]);
+        assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+    }
+    for (size_t i = 2 * count; i < message_count; ++i) {
+        assert_equals((size_t)-1, plaintext_lengths[i]);
+        assert_equals(
+            std::string("UNKNOWN_SESSION_ID"), std::string(errors[i])
+        );
+    }
+
+    assert_equals((size_t)0, olm_sharded_group_session_store_remove(
+        store, inbound[1]
+    ));
+    assert_equals(
+        (OlmInboundGroupSession *)NULL,
+        olm_sharded_group_session_store_find(store, ids[1].data(), 32)
+    );
+    assert_equals(inbound[2], olm_sharded_group_session_store_find(
+        store, ids[2].data(), 32
+    ));
+    assert_equals((size_t)-1, olm_sharded_group_session_store_remove(
+        store, inbound[1]
+    ));
+    assert_equals(count - 1, olm_sharded_group_session_store_count(store));
+
+    olm_clear_sharded_group_session_store(store);
+    for (size_t i = 0; i < shard_count; ++i) {
+        olm_clear_group_session_store(shards[i]);
+        olm_unmap_memory(shard_memory[i], shard_size);
+    }
+}
+
 {
     TestCase test_case("Group message send/receive");
 
@@ -159,6 +1253,16 @@ int main() {
     assert_equals(in_session_id_len, out_session_id_len);
     assert_equals(out_session_id, in_session_id, in_session_id_len);
 
+    uint8_t out_binary_id[32], in_binary_id[32];
+    assert_equals((size_t)-1, olm_outbound_group_session_id_binary(
+        session, out_binary_id, 31
+    ));
+    assert_equals((size_t)32, olm_outbound_group_session_id_binary(
+        session, out_binary_id, 32
+    ));
+    olm_inbound_group_session_id_binary(inbound_session, in_binary_id, 32);
+    assert_equals(in_binary_id, out_binary_id, 32);
+
     /* decode the message */
 
     /* olm_group_decrypt_max_plaintext_length destroys the input so we have to
@@ -166,6 +1270,12 @@ int main() {
     uint8_t msgcopy[msglen];
     memcpy(msgcopy, msg, msglen);
     size = olm_group_decrypt_max_plaintext_length(inbound_session, msgcopy, msglen);
+
+    /* olm_group_peek_max_plaintext_length gives the same answer without
+       changing its input */
+    assert_equals(size, olm_group_peek_max_plaintext_length(
+        inbound_session, msg, msglen
+    ));
     uint8_t plaintext_buf[size];
     uint32_t message_index;
     res = olm_group_decrypt(inbound_session, msg, msglen,
@@ -176,154 +1286,3576 @@ int main() {
 }
 
 {
-    TestCase test_case("Inbound group session export/import");
+    TestCase test_case("Out of order decryption with checkpoints");
 
-    uint8_t session_key[] =
-        "AgAAAAAwMTIzNDU2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMzQ1Njc4OUFCREVGM"
-        "DEyMzQ1Njc4OUFCQ0RFRjAxMjM0NTY3ODlBQkRFRjAxMjM0NTY3ODlBQkNERUYwMTIzND"
-        "U2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMw0bdg1BDq4Px/slBow06q8n/B9WBfw"
-        "WYyNOB8DlUmXGGwrFmaSb9bR/eY8xgERrxmP07hFmD9uqA2p8PMHdnV5ysmgufE6oLZ5+"
-        "8/mWQOW3VVTnDIlnwd8oHUYRuk8TCQ";
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
 
-    const uint8_t message[] =
-        "AwgAEhAcbh6UpbByoyZxufQ+h2B+8XHMjhR69G8F4+qjMaFlnIXusJZX3r8LnRORG9T3D"
-        "XFdbVuvIWrLyRfm4i8QRbe8VPwGRFG57B1CtmxanuP8bHtnnYqlwPsD";
-    const std::size_t msglen = sizeof(message)-1;
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
 
-    /* init first inbound group session, and decrypt */
-    std::size_t size = olm_inbound_group_session_size();
-    uint8_t session_memory1[size];
-    OlmInboundGroupSession *session1 =
-        olm_inbound_group_session(session_memory1);
-    assert_equals(0, olm_inbound_group_session_is_verified(session1));
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
 
-    std::size_t res = olm_init_inbound_group_session(
-        session1, session_key, sizeof(session_key)-1
+    /* enough messages to cross a few checkpoints */
+    const unsigned count = 700;
+    std::vector<std::vector<uint8_t>> messages(count);
+    for (unsigned i = 0; i < count; ++i) {
+        char plaintext[32];
+        size_t plaintext_length = std::snprintf(
+            plaintext, sizeof(plaintext), "Message %u", i
+        );
+        messages[i].resize(olm_group_encrypt_message_length(
+            session, plaintext_length
+        ));
+        assert_equals(messages[i].size(), olm_group_encrypt(
+            session, (uint8_t *)plaintext, plaintext_length,
+            messages[i].data(), messages[i].size()
+        ));
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    ));
+
+    /* room for two checkpoints, every 256 messages */
+    std::vector<uint8_t> checkpoints(
+        2 * olm_inbound_group_session_checkpoint_size()
     );
-    assert_equals((size_t)0, res);
-    assert_equals(1, olm_inbound_group_session_is_verified(session1));
+    assert_equals((size_t)2, olm_inbound_group_session_set_checkpoints(
+        inbound_session, checkpoints.data(), checkpoints.size(), 8
+    ));
 
-    /* olm_group_decrypt_max_plaintext_length destroys the input so we have to
-       copy it. */
-    uint8_t msgcopy[msglen];
-    memcpy(msgcopy, message, msglen);
-    size = olm_group_decrypt_max_plaintext_length(session1, msgcopy, msglen);
-    uint8_t plaintext_buf[size];
-    uint32_t message_index;
-    memcpy(msgcopy, message, msglen);
-    res = olm_group_decrypt(
-        session1, msgcopy, msglen, plaintext_buf, size, &message_index
+    auto check_decrypt_with = [&](
+        OlmInboundGroupSession *decrypting_session, unsigned index
+    ) {
+        std::vector<uint8_t> message(messages[index]);
+        std::vector<uint8_t> plaintext(message.size());
+        uint32_t message_index;
+        size_t res = olm_group_decrypt(
+            decrypting_session, message.data(), message.size(),
+            plaintext.data(), plaintext.size(), &message_index
+        );
+        char expected[32];
+        size_t expected_length = std::snprintf(
+            expected, sizeof(expected), "Message %u", index
+        );
+        assert_equals(expected_length, res);
+        assert_equals((uint8_t *)expected, plaintext.data(), expected_length);
+        assert_equals(index, message_index);
+    };
+    auto check_decrypt = [&](unsigned index) {
+        check_decrypt_with(inbound_session, index);
+    };
+
+    /* the newest first, then back through the history, coming back to
+     * indices whose checkpoints have been replaced */
+    const unsigned order[] = {
+        699, 600, 300, 310, 520, 10, 601, 256, 0, 150, 520, 699,
+    };
+    for (unsigned index : order) {
+        check_decrypt(index);
+    }
+
+    /* a copy starts without checkpoints, and clearing it leaves the
+     * original's alone */
+    std::vector<uint8_t> checkpoints_before(checkpoints);
+    std::vector<uint8_t> copy_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *copy = olm_inbound_group_session_copy(
+        copy_memory.data(), inbound_session
     );
-    assert_equals((std::size_t)7, res);
-    assert_equals((const uint8_t *)"Message", plaintext_buf, res);
-    assert_equals(uint32_t(0), message_index);
+    check_decrypt_with(copy, 550);
+    check_decrypt_with(copy, 20);
+    olm_clear_inbound_group_session(copy);
+    assert_equals(
+        checkpoints_before.data(), checkpoints.data(), checkpoints.size()
+    );
+    check_decrypt(300);
 
-    /* export the keys */
-    size = olm_export_inbound_group_session_length(session1);
-    uint8_t export_memory[size];
-    res = olm_export_inbound_group_session(
-        session1, export_memory, size, 0
+    /* moving the session takes its checkpoints along, and wipes the memory
+     * it was in */
+    std::vector<uint8_t> moved_memory(olm_inbound_group_session_size());
+    inbound_session = olm_inbound_group_session_move(
+        moved_memory.data(), inbound_session
     );
-    assert_equals(size, res);
+    for (size_t j = 0; j < inbound_memory.size(); ++j) {
+        assert_equals((uint8_t)0, inbound_memory[j]);
+    }
+    check_decrypt(530);
+    check_decrypt(5);
 
-    /* free the old session to check there is no shared data */
-    olm_clear_inbound_group_session(session1);
+    /* and without the checkpoints, which get wiped */
+    olm_inbound_group_session_set_checkpoints(inbound_session, NULL, 0, 0);
+    for (size_t j = 0; j < checkpoints.size(); ++j) {
+        assert_equals((uint8_t)0, checkpoints[j]);
+    }
+    check_decrypt(400);
 
-    /* import the keys into another inbound group session */
-    size = olm_inbound_group_session_size();
-    uint8_t session_memory2[size];
-    OlmInboundGroupSession *session2 =
-        olm_inbound_group_session(session_memory2);
-    res = olm_import_inbound_group_session(
-        session2, export_memory, sizeof(export_memory)
+    olm_clear_inbound_group_session(inbound_session);
+}
+
+{
+    TestCase test_case("Seeking the group session ratchet");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    ));
+
+    assert_equals((size_t)0, olm_inbound_group_session_seek_cost(
+        inbound_session, 0
+    ));
+    assert_equals(
+        megolm_advance_cost(0, 600),
+        olm_inbound_group_session_seek_cost(inbound_session, 600)
     );
-    assert_equals((size_t)0, res);
-    assert_equals(0, olm_inbound_group_session_is_verified(session2));
 
-    /* decrypt the message with the new session */
-    memcpy(msgcopy, message, msglen);
-    size = olm_group_decrypt_max_plaintext_length(session2, msgcopy, msglen);
-    uint8_t plaintext_buf2[size];
-    memcpy(msgcopy, message, msglen);
-    res = olm_group_decrypt(
-        session2, msgcopy, msglen, plaintext_buf2, size, &message_index
+    assert_equals((size_t)0, olm_inbound_group_session_advance_to(
+        inbound_session, 600
+    ));
+    assert_equals((size_t)0, olm_inbound_group_session_seek_cost(
+        inbound_session, 600
+    ));
+    assert_equals((size_t)1, olm_inbound_group_session_seek_cost(
+        inbound_session, 601
+    ));
+    /* earlier indices are replayed from the start */
+    assert_equals(
+        megolm_advance_cost(0, 300),
+        olm_inbound_group_session_seek_cost(inbound_session, 300)
     );
-    assert_equals((std::size_t)7, res);
-    assert_equals((const uint8_t *)"Message", plaintext_buf2, res);
-    assert_equals(uint32_t(0), message_index);
-    assert_equals(1, olm_inbound_group_session_is_verified(session2));
+
+    /* or from a checkpoint, once one has been taken on the way */
+    std::vector<uint8_t> checkpoints(
+        2 * olm_inbound_group_session_checkpoint_size()
+    );
+    olm_inbound_group_session_set_checkpoints(
+        inbound_session, checkpoints.data(), checkpoints.size(), 8
+    );
+    assert_equals(
+        megolm_advance_cost(0, 256) + megolm_advance_cost(256, 300),
+        olm_inbound_group_session_seek_cost(inbound_session, 300)
+    );
+    assert_equals((size_t)0, olm_inbound_group_session_advance_to(
+        inbound_session, 300
+    ));
+    assert_equals(
+        megolm_advance_cost(256, 300),
+        olm_inbound_group_session_seek_cost(inbound_session, 300)
+    );
+
+    /* a session imported at 600 knows nothing earlier */
+    std::vector<uint8_t> exported(
+        olm_export_inbound_group_session_length(inbound_session)
+    );
+    olm_export_inbound_group_session(
+        inbound_session, exported.data(), exported.size(), 600
+    );
+    std::vector<uint8_t> imported_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *imported =
+        olm_inbound_group_session(imported_memory.data());
+    assert_equals((size_t)0, olm_import_inbound_group_session(
+        imported, exported.data(), exported.size()
+    ));
+    assert_equals((size_t)-1, olm_inbound_group_session_seek_cost(
+        imported, 599
+    ));
+    assert_equals(
+        std::string("UNKNOWN_MESSAGE_INDEX"),
+        std::string(olm_inbound_group_session_last_error(imported))
+    );
+    assert_equals((size_t)-1, olm_inbound_group_session_advance_to(
+        imported, 599
+    ));
+
+    olm_clear_inbound_group_session(imported);
+    olm_clear_inbound_group_session(inbound_session);
 }
 
 {
-    TestCase test_case("Invalid signature group message");
+    TestCase test_case("Repeated decryption with the message key cache");
 
-    uint8_t plaintext[] = "Message";
-    size_t plaintext_length = sizeof(plaintext) - 1;
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
 
-    uint8_t session_key[] =
-        "AgAAAAAwMTIzNDU2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMzQ1Njc4OUFCREVGM"
-        "DEyMzQ1Njc4OUFCQ0RFRjAxMjM0NTY3ODlBQkRFRjAxMjM0NTY3ODlBQkNERUYwMTIzND"
-        "U2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMztqJ7zOtqQtYqOo0CpvDXNlMhV3HeJ"
-        "DpjrASKGLWdop4lx1cSN3Xv1TgfLPW8rhGiW+hHiMxd36nRuxscNv9k4oJA/KP+o0mi1w"
-        "v44StrEJ1wwx9WZHBUIWkQbaBSuBDw";
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
 
-    uint8_t message[] =
-        "AwgAEhAcbh6UpbByoyZxufQ+h2B+8XHMjhR69G8nP4pNZGl/3QMgrzCZPmP+F2aPLyKPz"
-        "xRPBMUkeXRJ6Iqm5NeOdx2eERgTW7P20CM+lL3Xpk+ZUOOPvsSQNaAL";
-    size_t msglen = sizeof(message)-1;
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
 
-    /* build the inbound session */
-    size_t size = olm_inbound_group_session_size();
-    uint8_t inbound_session_memory[size];
+    const unsigned count = 4;
+    std::vector<std::vector<uint8_t>> messages(count);
+    for (unsigned i = 0; i < count; ++i) {
+        char plaintext[32];
+        size_t plaintext_length = std::snprintf(
+            plaintext, sizeof(plaintext), "Message %u", i
+        );
+        messages[i].resize(olm_group_encrypt_message_length(
+            session, plaintext_length
+        ));
+        olm_group_encrypt(
+            session, (uint8_t *)plaintext, plaintext_length,
+            messages[i].data(), messages[i].size()
+        );
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
     OlmInboundGroupSession *inbound_session =
-        olm_inbound_group_session(inbound_session_memory);
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    ));
 
-    size_t res = olm_init_inbound_group_session(
-        inbound_session, session_key, sizeof(session_key)-1
+    std::vector<uint8_t> cache(
+        2 * olm_inbound_group_session_message_key_cache_entry_size()
     );
-    assert_equals((size_t)0, res);
+    assert_equals((size_t)2, olm_inbound_group_session_set_message_key_cache(
+        inbound_session, cache.data(), cache.size()
+    ));
 
-    /* decode the message */
+    auto decrypt = [&](std::vector<uint8_t> message, unsigned index) {
+        std::vector<uint8_t> plaintext(message.size());
+        uint32_t message_index;
+        size_t res = olm_group_decrypt(
+            inbound_session, message.data(), message.size(),
+            plaintext.data(), plaintext.size(), &message_index
+        );
+        if (res == (size_t)-1) {
+            return false;
+        }
+        char expected[32];
+        size_t expected_length = std::snprintf(
+            expected, sizeof(expected), "Message %u", index
+        );
+        assert_equals(expected_length, res);
+        assert_equals((uint8_t *)expected, plaintext.data(), expected_length);
+        assert_equals(index, message_index);
+        return true;
+    };
 
-    /* olm_group_decrypt_max_plaintext_length destroys the input so we have to
-       copy it. */
-    uint8_t msgcopy[msglen];
-    memcpy(msgcopy, message, msglen);
-    size = olm_group_decrypt_max_plaintext_length(
-        inbound_session, msgcopy, msglen
+    /* the second time round each of these comes from the cache, apart from
+     * message 0, which message 3 pushes out */
+    const unsigned order[] = {0, 0, 1, 0, 2, 1, 3, 1, 0};
+    for (unsigned index : order) {
+        assert_equals(true, decrypt(messages[index], index));
+    }
+
+    /* a message which differs from a cached one still has its signature
+     * checked. Flip a bit in the base64 of the signature. */
+    std::vector<uint8_t> tampered(messages[1]);
+    tampered[tampered.size() - 2] ^= 1;
+    assert_equals(false, decrypt(tampered, 1));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
     );
 
-    memcpy(msgcopy, message, msglen);
-    uint8_t plaintext_buf[size];
-    uint32_t message_index;
-    res = olm_group_decrypt(
-        inbound_session, msgcopy, msglen, plaintext_buf, size, &message_index
+    olm_inbound_group_session_flush_message_key_cache(inbound_session);
+    for (size_t j = 0; j < cache.size(); ++j) {
+        assert_equals((uint8_t)0, cache[j]);
+    }
+    assert_equals(true, decrypt(messages[1], 1));
+
+    olm_clear_inbound_group_session(inbound_session);
+    for (size_t j = 0; j < cache.size(); ++j) {
+        assert_equals((uint8_t)0, cache[j]);
+    }
+}
+
+{
+    TestCase test_case("Decryption with a verified token");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+    size_t key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(key_len);
+    olm_outbound_group_session_key(session, session_key.data(), key_len);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    std::vector<uint8_t> key_copy(session_key);
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, key_copy.data(), key_copy.size()
+    ));
+
+    uint8_t plaintext[] = "Message";
+    std::vector<uint8_t> message(olm_group_encrypt_message_length(
+        session, sizeof(plaintext)
+    ));
+    olm_group_encrypt(
+        session, plaintext, sizeof(plaintext), message.data(), message.size()
     );
-    assert_equals(message_index, uint32_t(0));
-    assert_equals(plaintext_length, res);
-    assert_equals(plaintext, plaintext_buf, res);
 
-    /* now twiddle the signature */
-    message[msglen-1] = 'E';
-    memcpy(msgcopy, message, msglen);
+    const uint8_t token_key[] = "a secret kept with the pickle key";
+    size_t token_length = olm_group_decrypt_token_length();
+    std::vector<uint8_t> token(token_length), again(token_length);
+    std::vector<uint8_t> output(message.size());
+    uint32_t message_index = 99;
+
+    std::vector<uint8_t> tmp(message);
+    assert_equals((size_t)-1, olm_group_decrypt_with_token(
+        inbound_session, tmp.data(), tmp.size(),
+        output.data(), output.size(), &message_index,
+        token_key, sizeof(token_key), NULL, 0,
+        token.data(), token_length - 1
+    ));
     assert_equals(
-        size,
-        olm_group_decrypt_max_plaintext_length(
-            inbound_session, msgcopy, msglen
-        )
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
     );
 
-    memcpy(msgcopy, message, msglen);
-    res = olm_group_decrypt(
-        inbound_session, msgcopy, msglen,
-        plaintext_buf, size, &message_index
+    /* the first time the signature is checked, and a token given back */
+    assert_equals(sizeof(plaintext), olm_group_decrypt_with_token(
+        inbound_session, tmp.data(), tmp.size(),
+        output.data(), output.size(), &message_index,
+        token_key, sizeof(token_key), NULL, 0,
+        token.data(), token.size()
+    ));
+    assert_equals(plaintext, output.data(), sizeof(plaintext));
+    assert_equals((uint32_t)0, message_index);
+
+    /* which gives the same plain-text and token again */
+    tmp = message;
+    assert_equals(sizeof(plaintext), olm_group_decrypt_with_token(
+        inbound_session, tmp.data(), tmp.size(),
+        output.data(), output.size(), NULL,
+        token_key, sizeof(token_key), token.data(), token.size(),
+        again.data(), again.size()
+    ));
+    assert_equals(plaintext, output.data(), sizeof(plaintext));
+    assert_equals(token.data(), again.data(), token_length);
+
+    /* a token doesn't vouch for a forged message */
+    tmp = message;
+    tmp[tmp.size() / 2] = tmp[tmp.size() / 2] == 'A' ? 'B' : 'A';
+    assert_equals((size_t)-1, olm_group_decrypt_with_token(
+        inbound_session, tmp.data(), tmp.size(),
+        output.data(), output.size(), NULL,
+        token_key, sizeof(token_key), token.data(), token.size(),
+        NULL, 0
+    ));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
     );
-    assert_equals((size_t)-1, res);
+
+    /* but with a good token the signature isn't checked at all, so a
+     * message with a broken signature gets through */
+    std::vector<uint8_t> raw(_olm_decode_base64_length(message.size()));
+    _olm_decode_base64(message.data(), message.size(), raw.data());
+    raw.back() ^= 1;
+    std::vector<uint8_t> broken(_olm_encode_base64_length(raw.size()));
+    _olm_encode_base64(raw.data(), raw.size(), broken.data());
+
+    std::vector<uint8_t> raw_key(_olm_decode_base64_length(key_len));
+    _olm_decode_base64(session_key.data(), key_len, raw_key.data());
+    uint8_t input[ED25519_PUBLIC_KEY_LENGTH + SHA256_OUTPUT_LENGTH];
+    memcpy(
+        input, raw_key.data() + 1 + 4 + MEGOLM_RATCHET_LENGTH,
+        ED25519_PUBLIC_KEY_LENGTH
+    );
+    _olm_crypto_sha256(
+        raw.data(), raw.size(), input + ED25519_PUBLIC_KEY_LENGTH
+    );
+    std::vector<uint8_t> broken_token(token_length);
+    _olm_crypto_hmac_sha256(
+        token_key, sizeof(token_key), input, sizeof(input),
+        broken_token.data()
+    );
+
+    tmp = broken;
+    assert_equals((size_t)-1, olm_group_decrypt_with_token(
+        inbound_session, tmp.data(), tmp.size(),
+        output.data(), output.size(), NULL,
+        token_key, sizeof(token_key), token.data(), token.size(),
+        NULL, 0
+    ));
     assert_equals(
         std::string("BAD_SIGNATURE"),
         std::string(olm_inbound_group_session_last_error(inbound_session))
     );
+    tmp = broken;
+    assert_equals(sizeof(plaintext), olm_group_decrypt_with_token(
+        inbound_session, tmp.data(), tmp.size(),
+        output.data(), output.size(), NULL,
+        token_key, sizeof(token_key),
+        broken_token.data(), broken_token.size(),
+        NULL, 0
+    ));
+    assert_equals(plaintext, output.data(), sizeof(plaintext));
+}
+
+{
+    TestCase test_case("Batch decryption");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    const unsigned count = 150;
+    std::vector<std::vector<uint8_t>> messages(count);
+    std::vector<uint8_t> exported;
+    for (unsigned i = 0; i < count; ++i) {
+        if (i == 5) {
+            /* the receiver only gets the key from here on */
+            size_t key_len = olm_outbound_group_session_key_length(session);
+            std::vector<uint8_t> session_key(key_len);
+            olm_outbound_group_session_key(session, session_key.data(), key_len);
+            exported = session_key;
+        }
+        char plaintext[32];
+        size_t plaintext_length = std::snprintf(
+            plaintext, sizeof(plaintext), "Message %u", i
+        );
+        messages[i].resize(olm_group_encrypt_message_length(
+            session, plaintext_length
+        ));
+        olm_group_encrypt(
+            session, (uint8_t *)plaintext, plaintext_length,
+            messages[i].data(), messages[i].size()
+        );
+    }
+
+    /* deliver them out of order, with a few bad ones */
+    std::vector<unsigned> indices(count);
+    for (unsigned i = 0; i < count; ++i) {
+        indices[i] = (i * 67) % count;
+    }
+    std::vector<std::vector<uint8_t>> inputs(count);
+    for (unsigned i = 0; i < count; ++i) {
+        inputs[i] = messages[indices[i]];
+    }
+    inputs[10][inputs[10].size() - 2] ^= 1;
+    inputs[100].resize(inputs[100].size() / 4 * 4 + 1);
+
+    std::vector<uint8_t *> input_ptrs(count), plaintext_ptrs(count);
+    std::vector<size_t> input_lengths(count), max_lengths(count);
+    std::vector<std::vector<uint8_t>> plaintexts(count);
+    for (unsigned i = 0; i < count; ++i) {
+        input_ptrs[i] = inputs[i].data();
+        input_lengths[i] = inputs[i].size();
+        plaintexts[i].resize(inputs[i].size());
+        plaintext_ptrs[i] = plaintexts[i].data();
+        max_lengths[i] = plaintexts[i].size();
+    }
+    std::vector<size_t> plaintext_lengths(count);
+    std::vector<uint32_t> message_indices(count);
+    std::vector<const char *> errors(count);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, exported.data(), exported.size()
+    ));
+
+    /* without the SHA instructions the message keys are derived several
+     * lanes at a time */
+    _olm_cpu_set_feature_mask(~OLM_CPU_FEATURE_SHA256);
+    size_t failures = olm_group_decrypt_batch(
+        inbound_session, count, input_ptrs.data(), input_lengths.data(),
+        plaintext_ptrs.data(), max_lengths.data(),
+        plaintext_lengths.data(), message_indices.data(), errors.data()
+    );
+    _olm_cpu_set_feature_mask(~0u);
+    assert_equals((size_t)7, failures);
+
+    for (unsigned i = 0; i < count; ++i) {
+        std::string error(errors[i]);
+        if (i == 10) {
+            assert_equals(std::string("BAD_SIGNATURE"), error);
+        } else if (i == 100) {
+            assert_equals(std::string("INVALID_BASE64"), error);
+        } else if (indices[i] < 5) {
+            assert_equals(std::string("UNKNOWN_MESSAGE_INDEX"), error);
+            assert_equals(indices[i], message_indices[i]);
+        } else {
+            assert_equals(std::string("SUCCESS"), error);
+            char expected[32];
+            size_t expected_length = std::snprintf(
+                expected, sizeof(expected), "Message %u", indices[i]
+            );
+            assert_equals(expected_length, plaintext_lengths[i]);
+            assert_equals(
+                (uint8_t *)expected, plaintexts[i].data(), expected_length
+            );
+            assert_equals(indices[i], message_indices[i]);
+            continue;
+        }
+        assert_equals((size_t)-1, plaintext_lengths[i]);
+    }
+}
+
+{
+    TestCase test_case("Batch decryption within a budget");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+    size_t key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(key_len);
+    olm_outbound_group_session_key(session, session_key.data(), key_len);
+
+    /* the latest messages, and some far behind and far ahead of them */
+    const uint32_t wanted[] = {1001, 1002, 1003, 3, 999, 2900, 1004};
+    const unsigned count = sizeof(wanted) / sizeof(wanted[0]);
+    std::vector<std::vector<uint8_t>> messages(count);
+    std::vector<uint8_t> latest;
+    for (uint32_t index = 0; index <= 2900; ++index) {
+        uint8_t plaintext[] = "Message";
+        std::vector<uint8_t> message(olm_group_encrypt_message_length(
+            session, sizeof(plaintext)
+        ));
+        olm_group_encrypt(
+            session, plaintext, sizeof(plaintext),
+            message.data(), message.size()
+        );
+        if (index == 1000) {
+            latest = message;
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            if (wanted[i] == index) {
+                messages[i] = message;
+            }
+        }
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, session_key.data(), key_len
+    ));
+    std::vector<uint8_t> plaintext(latest.size());
+    uint32_t message_index;
+    assert_equals((size_t)8, olm_group_decrypt(
+        inbound_session, latest.data(), latest.size(),
+        plaintext.data(), plaintext.size(), &message_index
+    ));
+
+    std::vector<size_t> expected_costs(count);
+    size_t budget = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        expected_costs[i] = olm_inbound_group_session_seek_cost(
+            inbound_session, wanted[i]
+        );
+        if (wanted[i] > 1000 && wanted[i] < 2000) {
+            budget += expected_costs[i];
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> inputs(messages);
+    std::vector<uint8_t *> input_ptrs(count), plaintext_ptrs(count);
+    std::vector<size_t> input_lengths(count), max_lengths(count);
+    std::vector<std::vector<uint8_t>> plaintexts(count);
+    for (unsigned i = 0; i < count; ++i) {
+        input_ptrs[i] = inputs[i].data();
+        input_lengths[i] = inputs[i].size();
+        plaintexts[i].resize(inputs[i].size());
+        plaintext_ptrs[i] = plaintexts[i].data();
+        max_lengths[i] = plaintexts[i].size();
+    }
+    std::vector<size_t> plaintext_lengths(count), costs(count);
+    std::vector<uint32_t> message_indices(count);
+    std::vector<const char *> errors(count);
+
+    /* the cheapest messages are decrypted, up to the budget, and the rest
+     * left for later untouched */
+    size_t deferred = olm_group_decrypt_batch_within_budget(
+        inbound_session, count, input_ptrs.data(), input_lengths.data(),
+        plaintext_ptrs.data(), max_lengths.data(),
+        plaintext_lengths.data(), message_indices.data(), errors.data(),
+        budget, costs.data()
+    );
+    std::vector<uint8_t *> later_ptrs;
+    std::vector<size_t> later_lengths;
+    size_t spent = 0, most_decrypted = 0, least_deferred = (size_t)-1;
+    for (unsigned i = 0; i < count; ++i) {
+        assert_equals(expected_costs[i], costs[i]);
+        assert_equals(wanted[i], message_indices[i]);
+        if (plaintext_lengths[i] != (size_t)-1) {
+            assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+            assert_equals((size_t)8, plaintext_lengths[i]);
+            spent += costs[i];
+            most_decrypted = std::max(most_decrypted, costs[i]);
+        } else {
+            assert_equals(
+                std::string("DECRYPTION_DEFERRED"), std::string(errors[i])
+            );
+            assert_equals(
+                messages[i].data(), inputs[i].data(), inputs[i].size()
+            );
+            least_deferred = std::min(least_deferred, costs[i]);
+            later_ptrs.push_back(input_ptrs[i]);
+            later_lengths.push_back(input_lengths[i]);
+        }
+    }
+    assert_equals(later_ptrs.size(), deferred);
+    assert_equals(true, spent <= budget);
+    assert_equals(true, most_decrypted <= least_deferred);
+    /* the messages just after the latest fit, those far from any ratchet
+     * the session has don't */
+    for (unsigned i = 0; i < count; ++i) {
+        if (wanted[i] == 1001 || wanted[i] == 1002) {
+            assert_equals((size_t)8, plaintext_lengths[i]);
+        } else if (wanted[i] == 999 || wanted[i] == 2900) {
+            assert_equals((size_t)-1, plaintext_lengths[i]);
+        }
+    }
+
+    /* then drained with no limit */
+    std::vector<size_t> later_plaintext_lengths(later_ptrs.size());
+    assert_equals((size_t)0, olm_group_decrypt_batch_within_budget(
+        inbound_session, later_ptrs.size(),
+        later_ptrs.data(), later_lengths.data(),
+        plaintext_ptrs.data(), max_lengths.data(),
+        later_plaintext_lengths.data(), NULL, NULL,
+        (size_t)-1, costs.data()
+    ));
+
+    /* a message at the latest index costs nothing, so is never deferred */
+    assert_equals((size_t)0, olm_inbound_group_session_seek_cost(
+        inbound_session, 2900
+    ));
+    inputs[0] = messages[5];
+    input_ptrs[0] = inputs[0].data();
+    input_lengths[0] = inputs[0].size();
+    inputs[1] = messages[4];
+    input_ptrs[1] = inputs[1].data();
+    input_lengths[1] = inputs[1].size();
+    assert_equals((size_t)1, olm_group_decrypt_batch_within_budget(
+        inbound_session, 2, input_ptrs.data(), input_lengths.data(),
+        plaintext_ptrs.data(), max_lengths.data(),
+        plaintext_lengths.data(), NULL, errors.data(),
+        0, costs.data()
+    ));
+    assert_equals(std::string("SUCCESS"), std::string(errors[0]));
+    assert_equals(std::string("DECRYPTION_DEFERRED"), std::string(errors[1]));
+}
+
+{
+    TestCase test_case("Batch decryption across sessions");
+
+    const size_t session_count = 4, per_session = 40;
+    const size_t count = session_count * per_session;
+    std::vector<std::vector<uint8_t>> outbound_memory(session_count);
+    std::vector<std::vector<uint8_t>> inbound_memory(session_count);
+    std::vector<OlmOutboundGroupSession *> outbound(session_count);
+    std::vector<OlmInboundGroupSession *> inbound(session_count);
+    for (size_t s = 0; s < session_count; ++s) {
+        outbound_memory[s].resize(olm_outbound_group_session_size());
+        outbound[s] = olm_outbound_group_session(outbound_memory[s].data());
+        std::vector<uint8_t> random(
+            olm_init_outbound_group_session_random_length(outbound[s]),
+            uint8_t('a' + s)
+        );
+        olm_init_outbound_group_session(
+            outbound[s], random.data(), random.size()
+        );
+        std::vector<uint8_t> session_key(
+            olm_outbound_group_session_key_length(outbound[s])
+        );
+        olm_outbound_group_session_key(
+            outbound[s], session_key.data(), session_key.size()
+        );
+        inbound_memory[s].resize(olm_inbound_group_session_size());
+        inbound[s] = olm_inbound_group_session(inbound_memory[s].data());
+        olm_init_inbound_group_session(
+            inbound[s], session_key.data(), session_key.size()
+        );
+    }
+
+    /* the messages of every session, shuffled together */
+    std::vector<std::string> plaintexts(count);
+    std::vector<std::vector<uint8_t>> messages(count);
+    std::vector<OlmInboundGroupSession *> sessions(count);
+    std::vector<uint32_t> expected_indices(count);
+    for (size_t k = 0; k < per_session; ++k) {
+        for (size_t s = 0; s < session_count; ++s) {
+            size_t i = (k * session_count + s) * 37 % count;
+            plaintexts[i] = "Message " + std::to_string(k)
+                + " of session " + std::to_string(s);
+            messages[i].resize(olm_group_encrypt_message_length(
+                outbound[s], plaintexts[i].size()
+            ));
+            olm_group_encrypt(
+                outbound[s], (const uint8_t *)plaintexts[i].data(),
+                plaintexts[i].size(), messages[i].data(), messages[i].size()
+            );
+            sessions[i] = inbound[s];
+            expected_indices[i] = k;
+        }
+    }
+    /* a forged message, one for the wrong session, and bad base64 */
+    messages[5][messages[5].size() / 2] ^= 1;
+    sessions[6] = sessions[6] == inbound[0] ? inbound[1] : inbound[0];
+    messages[7][0] = '!';
+
+    std::vector<uint8_t *> message_ptrs(count), plaintext_ptrs(count);
+    std::vector<size_t> message_lengths(count), max_lengths(count);
+    std::vector<std::vector<uint8_t>> outputs(count);
+    for (size_t i = 0; i < count; ++i) {
+        message_ptrs[i] = messages[i].data();
+        message_lengths[i] = messages[i].size();
+        outputs[i].resize(messages[i].size());
+        plaintext_ptrs[i] = outputs[i].data();
+        max_lengths[i] = outputs[i].size();
+    }
+    std::vector<size_t> plaintext_lengths(count);
+    std::vector<uint32_t> message_indices(count);
+    std::vector<const char *> errors(count);
+    std::vector<size_t> scratch(
+        olm_group_decrypt_across_sessions_scratch_length(count)
+    );
+
+    assert_equals((size_t)-1, olm_group_decrypt_across_sessions(
+        sessions.data(), count, message_ptrs.data(), message_lengths.data(),
+        plaintext_ptrs.data(), max_lengths.data(),
+        plaintext_lengths.data(), message_indices.data(), errors.data(),
+        scratch.data(), scratch.size() - 1, NULL, NULL
+    ));
+
+    /* an executor which runs the jobs backwards, and counts them */
+    struct ReverseExecutor {
+        static void run(
+            void * context, OlmBatchJob job, void * job_context,
+            size_t job_count
+        ) {
+            *static_cast<size_t *>(context) += job_count;
+            while (job_count--) {
+                job(job_context, job_count);
+            }
+        }
+    };
+    size_t job_count = 0;
+    assert_equals((size_t)3, olm_group_decrypt_across_sessions(
+        sessions.data(), count, message_ptrs.data(), message_lengths.data(),
+        plaintext_ptrs.data(), max_lengths.data(),
+        plaintext_lengths.data(), message_indices.data(), errors.data(),
+        scratch.data(), scratch.size(), ReverseExecutor::run, &job_count
+    ));
+    /* three jobs of signatures, then one for each session */
+    assert_equals((size_t)3 + session_count, job_count);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 5 || i == 6) {
+            assert_equals(std::string("BAD_SIGNATURE"), std::string(errors[i]));
+            assert_equals((size_t)-1, plaintext_lengths[i]);
+            continue;
+        }
+        if (i == 7) {
+            assert_equals(
+                std::string("INVALID_BASE64"), std::string(errors[i])
+            );
+            assert_equals((size_t)-1, plaintext_lengths[i]);
+            continue;
+        }
+        assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+        assert_equals(expected_indices[i], message_indices[i]);
+        assert_equals(plaintexts[i].size(), plaintext_lengths[i]);
+        assert_equals(
+            (const uint8_t *)plaintexts[i].data(), outputs[i].data(),
+            plaintext_lengths[i]
+        );
+    }
 }
 
+{
+    TestCase test_case("Read-only decryption");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    const unsigned count = 10;
+    std::vector<std::vector<uint8_t>> messages(count);
+    for (unsigned i = 0; i < count; ++i) {
+        char plaintext[32];
+        size_t plaintext_length = std::snprintf(
+            plaintext, sizeof(plaintext), "Message %u", i
+        );
+        messages[i].resize(olm_group_encrypt_message_length(
+            session, plaintext_length
+        ));
+        olm_group_encrypt(
+            session, (uint8_t *)plaintext, plaintext_length,
+            messages[i].data(), messages[i].size()
+        );
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    ));
+    std::vector<uint8_t> checkpoints(
+        4 * olm_inbound_group_session_checkpoint_size()
+    );
+    olm_inbound_group_session_set_checkpoints(
+        inbound_session, checkpoints.data(), checkpoints.size(), 2
+    );
+
+    uint8_t pickle_key[] = "secret_key";
+    auto pickle = [&]() {
+        std::vector<uint8_t> pickled(
+            olm_pickle_inbound_group_session_length(inbound_session)
+        );
+        olm_pickle_inbound_group_session(
+            inbound_session, pickle_key, sizeof(pickle_key),
+            pickled.data(), pickled.size()
+        );
+        return pickled;
+    };
+    std::vector<uint8_t> original_pickle = pickle();
+    std::vector<uint8_t> original_memory(inbound_memory);
+    std::vector<uint8_t> original_checkpoints(checkpoints);
+
+    std::vector<uint8_t> scratch_memory(olm_group_decrypt_scratch_size());
+    OlmGroupDecryptScratch *scratch =
+        olm_group_decrypt_scratch(scratch_memory.data());
+
+    auto decrypt = [&](std::vector<uint8_t> message, unsigned index) {
+        std::vector<uint8_t> plaintext(message.size());
+        uint32_t message_index;
+        size_t res = olm_group_decrypt_readonly(
+            inbound_session, scratch, message.data(), message.size(),
+            plaintext.data(), plaintext.size(), &message_index
+        );
+        if (res == (size_t)-1) {
+            return false;
+        }
+        char expected[32];
+        size_t expected_length = std::snprintf(
+            expected, sizeof(expected), "Message %u", index
+        );
+        assert_equals(expected_length, res);
+        assert_equals((uint8_t *)expected, plaintext.data(), expected_length);
+        assert_equals(index, message_index);
+        return true;
+    };
+
+    const unsigned order[] = {6, 2, 3, 9, 0, 9, 5};
+    for (unsigned index : order) {
+        assert_equals(true, decrypt(messages[index], index));
+    }
+
+    std::vector<uint8_t> tampered(messages[4]);
+    tampered[tampered.size() - 2] ^= 1;
+    assert_equals(false, decrypt(tampered, 4));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_group_decrypt_scratch_last_error(scratch))
+    );
+
+    /* none of that touched the session */
+    assert_equals(true, original_memory == inbound_memory);
+    assert_equals(true, original_checkpoints == checkpoints);
+
+    /* the last message was 5, which is ahead of the latest ratchet */
+    olm_inbound_group_session_commit_ratchet(inbound_session, scratch);
+    std::vector<uint8_t> committed_pickle = pickle();
+    assert_equals(false, original_pickle == committed_pickle);
+
+    /* but 2 isn't */
+    assert_equals(true, decrypt(messages[2], 2));
+    olm_inbound_group_session_commit_ratchet(inbound_session, scratch);
+    assert_equals(true, committed_pickle == pickle());
+
+    /* the session still decrypts everything afterwards */
+    for (unsigned i = 0; i < count; ++i) {
+        std::vector<uint8_t> message(messages[i]);
+        std::vector<uint8_t> plaintext(message.size());
+        assert_not_equals((size_t)-1, olm_group_decrypt(
+            inbound_session, message.data(), message.size(),
+            plaintext.data(), plaintext.size(), nullptr
+        ));
+    }
+
+    /* a scratch space used with another session is reset, not trusted */
+    std::vector<uint8_t> later_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *later_session =
+        olm_inbound_group_session(later_memory.data());
+    std::vector<uint8_t> exported(
+        olm_export_inbound_group_session_length(inbound_session)
+    );
+    olm_export_inbound_group_session(
+        inbound_session, exported.data(), exported.size(), 5
+    );
+    assert_equals((size_t)0, olm_import_inbound_group_session(
+        later_session, exported.data(), exported.size()
+    ));
+    inbound_session = later_session;
+    assert_equals(false, decrypt(messages[3], 3));
+    assert_equals(
+        std::string("UNKNOWN_MESSAGE_INDEX"),
+        std::string(olm_group_decrypt_scratch_last_error(scratch))
+    );
+    assert_equals(true, decrypt(messages[7], 7));
+
+    olm_clear_group_decrypt_scratch(scratch);
+}
+
+{
+    TestCase test_case("Raw group messages");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    ));
+
+    uint8_t plaintext[] = "Message";
+    size_t raw_length = olm_group_encrypt_raw_message_length(session, 7);
+    assert_equals(
+        _olm_encode_base64_length(raw_length),
+        olm_group_encrypt_message_length(session, 7)
+    );
+    std::vector<uint8_t> message(raw_length);
+    assert_equals((size_t)-1, olm_group_encrypt_raw(
+        session, plaintext, 7, message.data(), raw_length - 1
+    ));
+    assert_equals(raw_length, olm_group_encrypt_raw(
+        session, plaintext, 7, message.data(), message.size()
+    ));
+
+    std::vector<uint8_t> original(message);
+    size_t max_length = olm_group_decrypt_raw_max_plaintext_length(
+        inbound_session, message.data(), message.size()
+    );
+    std::vector<uint8_t> output(max_length);
+    uint32_t message_index = 1;
+    assert_equals((size_t)7, olm_group_decrypt_raw(
+        inbound_session, message.data(), message.size(),
+        output.data(), output.size(), &message_index
+    ));
+    assert_equals(plaintext, output.data(), 7);
+    assert_equals((uint32_t)0, message_index);
+    assert_equals(true, original == message);
+
+    /* and the base64 form decrypts as normal */
+    std::vector<uint8_t> encoded(_olm_encode_base64_length(raw_length));
+    _olm_encode_base64(message.data(), raw_length, encoded.data());
+    assert_equals((size_t)7, olm_group_decrypt(
+        inbound_session, encoded.data(), encoded.size(),
+        output.data(), output.size(), &message_index
+    ));
+    assert_equals(plaintext, output.data(), 7);
+}
+
+{
+    TestCase test_case("Peeking at group message headers");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    uint8_t plaintext[] = "Message";
+    for (uint32_t index = 0; index < 200; ++index) {
+        std::vector<uint8_t> message(
+            olm_group_encrypt_message_length(session, 7)
+        );
+        olm_group_encrypt(
+            session, plaintext, 7, message.data(), message.size()
+        );
+        if (index % 50 != 0 && index != 199) {
+            continue;
+        }
+
+        std::vector<uint8_t> original(message);
+        uint32_t message_index = 9999;
+        uint8_t version = 0;
+        assert_equals((size_t)0, olm_group_message_peek(
+            message.data(), message.size(), &message_index, &version
+        ));
+        assert_equals(index, message_index);
+        assert_equals((uint8_t)3, version);
+        assert_equals(true, original == message);
+
+        std::vector<uint8_t> raw(_olm_decode_base64_length(message.size()));
+        _olm_decode_base64(message.data(), message.size(), raw.data());
+        message_index = 9999;
+        assert_equals((size_t)0, olm_group_message_peek_raw(
+            raw.data(), raw.size(), &message_index, NULL
+        ));
+        assert_equals(index, message_index);
+
+        /* the index is read however the rest of the message looks */
+        raw[raw.size() - 1] ^= 1;
+        assert_equals((size_t)0, olm_group_message_peek_raw(
+            raw.data(), raw.size(), &message_index, NULL
+        ));
+        assert_equals(index, message_index);
+
+        /* but not from an unknown version */
+        raw[0] = 4;
+        version = 0;
+        assert_equals((size_t)-1, olm_group_message_peek_raw(
+            raw.data(), raw.size(), &message_index, &version
+        ));
+        assert_equals((uint8_t)4, version);
+    }
+
+    uint8_t bad_length[] = "AAAAA";
+    uint32_t message_index;
+    assert_equals((size_t)-1, olm_group_message_peek(
+        bad_length, 5, &message_index, NULL
+    ));
+    uint8_t empty[] = "";
+    assert_equals((size_t)-1, olm_group_message_peek_raw(
+        empty, 0, &message_index, NULL
+    ));
+}
+
+{
+    TestCase test_case("Outbound group session key stream");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    /* two copies of the same session, one using a key stream */
+    std::vector<uint8_t> memory1(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session1 = olm_outbound_group_session(memory1.data());
+    std::vector<uint8_t> random1(random_bytes, random_bytes + sizeof(random_bytes));
+    olm_init_outbound_group_session(session1, random1.data(), random1.size());
+
+    std::vector<uint8_t> memory2(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session2 = olm_outbound_group_session(memory2.data());
+    std::vector<uint8_t> random2(random_bytes, random_bytes + sizeof(random_bytes));
+    olm_init_outbound_group_session(session2, random2.data(), random2.size());
+
+    std::vector<uint8_t> key_stream(
+        4 * olm_outbound_group_session_key_stream_entry_size()
+    );
+    assert_equals((size_t)4, olm_outbound_group_session_set_key_stream(
+        session2, key_stream.data(), key_stream.size()
+    ));
+    assert_equals((size_t)3, olm_outbound_group_session_prepare(session2, 3));
+    assert_equals((size_t)4, olm_outbound_group_session_prepare(session2, 10));
+
+    uint8_t plaintext[] = "Message";
+    for (unsigned i = 0; i < 12; ++i) {
+        if (i == 6) {
+            assert_equals((size_t)2, olm_outbound_group_session_prepare(session2, 2));
+        }
+        size_t length = olm_group_encrypt_message_length(session1, 7);
+        assert_equals(length, olm_group_encrypt_message_length(session2, 7));
+        std::vector<uint8_t> message1(length), message2(length);
+        assert_equals(length, olm_group_encrypt(
+            session1, plaintext, 7, message1.data(), length
+        ));
+        assert_equals(length, olm_group_encrypt(
+            session2, plaintext, 7, message2.data(), length
+        ));
+        assert_equals(true, message1 == message2);
+    }
+
+    /* the prepared keys aren't pickled */
+    olm_outbound_group_session_prepare(session2, 3);
+    uint8_t pickle_key[] = "secret_key";
+    size_t pickle_length = olm_pickle_outbound_group_session_length(session1);
+    assert_equals(pickle_length, olm_pickle_outbound_group_session_length(session2));
+    std::vector<uint8_t> pickle1(pickle_length), pickle2(pickle_length);
+    olm_pickle_outbound_group_session(
+        session1, pickle_key, sizeof(pickle_key), pickle1.data(), pickle_length
+    );
+    olm_pickle_outbound_group_session(
+        session2, pickle_key, sizeof(pickle_key), pickle2.data(), pickle_length
+    );
+    assert_equals(true, pickle1 == pickle2);
+
+    olm_clear_outbound_group_session(session2);
+    for (size_t j = 0; j < key_stream.size(); ++j) {
+        assert_equals((uint8_t)0, key_stream[j]);
+    }
+}
+
+{
+    TestCase test_case("Inbound group session export/import");
+
+    uint8_t session_key[] =
+        "AgAAAAAwMTIzNDU2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMzQ1Njc4OUFCREVGM"
+        "DEyMzQ1Njc4OUFCQ0RFRjAxMjM0NTY3ODlBQkRFRjAxMjM0NTY3ODlBQkNERUYwMTIzND"
+        "U2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMw0bdg1BDq4Px/slBow06q8n/B9WBfw"
+        "WYyNOB8DlUmXGGwrFmaSb9bR/eY8xgERrxmP07hFmD9uqA2p8PMHdnV5ysmgufE6oLZ5+"
+        "8/mWQOW3VVTnDIlnwd8oHUYRuk8TCQ";
+
+    const uint8_t message[] =
+        "AwgAEhAcbh6UpbByoyZxufQ+h2B+8XHMjhR69G8F4+qjMaFlnIXusJZX3r8LnRORG9T3D"
+        "XFdbVuvIWrLyRfm4i8QRbe8VPwGRFG57B1CtmxanuP8bHtnnYqlwPsD";
+    const std::size_t msglen = sizeof(message)-1;
+
+    /* init first inbound group session, and decrypt */
+    std::size_t size = olm_inbound_group_session_size();
+    uint8_t session_memory1[size];
+    OlmInboundGroupSession *session1 =
+        olm_inbound_group_session(session_memory1);
+    assert_equals(0, olm_inbound_group_session_is_verified(session1));
+
+    std::size_t res = olm_init_inbound_group_session(
+        session1, session_key, sizeof(session_key)-1
+    );
+    assert_equals((size_t)0, res);
+    assert_equals(1, olm_inbound_group_session_is_verified(session1));
+
+    /* olm_group_decrypt_max_plaintext_length destroys the input so we have to
+       copy it. */
+    uint8_t msgcopy[msglen];
+    memcpy(msgcopy, message, msglen);
+    size = olm_group_decrypt_max_plaintext_length(session1, msgcopy, msglen);
+    uint8_t plaintext_buf[size];
+    uint32_t message_index;
+    memcpy(msgcopy, message, msglen);
+    res = olm_group_decrypt(
+        session1, msgcopy, msglen, plaintext_buf, size, &message_index
+    );
+    assert_equals((std::size_t)7, res);
+    assert_equals((const uint8_t *)"Message", plaintext_buf, res);
+    assert_equals(uint32_t(0), message_index);
+
+    /* export the keys */
+    size = olm_export_inbound_group_session_length(session1);
+    uint8_t export_memory[size];
+    res = olm_export_inbound_group_session(
+        session1, export_memory, size, 0
+    );
+    assert_equals(size, res);
+
+    /* free the old session to check there is no shared data */
+    olm_clear_inbound_group_session(session1);
+
+    /* import the keys into another inbound group session */
+    size = olm_inbound_group_session_size();
+    uint8_t session_memory2[size];
+    OlmInboundGroupSession *session2 =
+        olm_inbound_group_session(session_memory2);
+    res = olm_import_inbound_group_session(
+        session2, export_memory, sizeof(export_memory)
+    );
+    assert_equals((size_t)0, res);
+    assert_equals(0, olm_inbound_group_session_is_verified(session2));
+
+    /* decrypt the message with the new session */
+    memcpy(msgcopy, message, msglen);
+    size = olm_group_decrypt_max_plaintext_length(session2, msgcopy, msglen);
+    uint8_t plaintext_buf2[size];
+    memcpy(msgcopy, message, msglen);
+    res = olm_group_decrypt(
+        session2, msgcopy, msglen, plaintext_buf2, size, &message_index
+    );
+    assert_equals((std::size_t)7, res);
+    assert_equals((const uint8_t *)"Message", plaintext_buf2, res);
+    assert_equals(uint32_t(0), message_index);
+    assert_equals(1, olm_inbound_group_session_is_verified(session2));
+}
+
+{
+    TestCase test_case("Inbound group session batch export");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    /* three sessions, the last only known from index 20 */
+    std::vector<std::vector<uint8_t>> memory(3);
+    OlmInboundGroupSession *inbound[3];
+    for (unsigned i = 0; i < 3; ++i) {
+        std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+        OlmOutboundGroupSession *outbound =
+            olm_outbound_group_session(outbound_memory.data());
+        random_bytes[0] = 'a' + i;
+        olm_init_outbound_group_session(
+            outbound, random_bytes, sizeof(random_bytes)
+        );
+        std::vector<uint8_t> session_key(
+            olm_outbound_group_session_key_length(outbound)
+        );
+        olm_outbound_group_session_key(
+            outbound, session_key.data(), session_key.size()
+        );
+        memory[i].resize(olm_inbound_group_session_size());
+        inbound[i] = olm_inbound_group_session(memory[i].data());
+        assert_equals((size_t)0, olm_init_inbound_group_session(
+            inbound[i], session_key.data(), session_key.size()
+        ));
+    }
+    olm_inbound_group_session_advance_to(inbound[2], 20);
+    size_t export_length = olm_export_inbound_group_session_length(inbound[2]);
+    std::vector<uint8_t> exported(export_length);
+    olm_export_inbound_group_session(
+        inbound[2], exported.data(), exported.size(), 20
+    );
+    olm_import_inbound_group_session(
+        inbound[2], exported.data(), exported.size()
+    );
+
+    OlmInboundGroupSession * const sessions[] = {
+        inbound[0], inbound[0], inbound[0], inbound[1], inbound[2], inbound[2],
+    };
+    const uint32_t indices[] = { 0, 5, 300, 7, 10, 25 };
+    const size_t count = 6;
+
+    std::vector<uint8_t> keys(olm_export_inbound_group_session_batch_length(
+        count
+    ));
+    assert_equals(count * export_length, keys.size());
+    assert_equals((size_t)-1, olm_export_inbound_group_session_batch(
+        sessions, indices, count, keys.data(), keys.size() - 1, NULL
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_inbound_group_session_last_error(inbound[0]))
+    );
+
+    const char * errors[count];
+    assert_equals((size_t)1, olm_export_inbound_group_session_batch(
+        sessions, indices, count, keys.data(), keys.size(), errors
+    ));
+
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t * key = keys.data() + i * export_length;
+        if (i == 4) {
+            /* index 10 is before the third session's first known index */
+            assert_equals(
+                std::string("UNKNOWN_MESSAGE_INDEX"), std::string(errors[i])
+            );
+            std::vector<uint8_t> zeroes(export_length, 0);
+            assert_equals(zeroes.data(), key, export_length);
+            continue;
+        }
+        assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+        assert_equals(export_length, olm_export_inbound_group_session(
+            sessions[i], exported.data(), exported.size(), indices[i]
+        ));
+        assert_equals(exported.data(), key, export_length);
+    }
+
+    for (unsigned i = 0; i < 3; ++i) {
+        olm_clear_inbound_group_session(inbound[i]);
+    }
+}
+
+{
+    TestCase test_case("Inbound group session export batch of many sessions");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    /* more than are advanced together, each twice over, along with a copy
+     * of each to export one at a time */
+    const size_t session_count = 70;
+    std::vector<std::vector<uint8_t>> memory(2 * session_count);
+    std::vector<OlmInboundGroupSession *> inbound(2 * session_count);
+    for (size_t i = 0; i < session_count; ++i) {
+        std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+        OlmOutboundGroupSession *outbound =
+            olm_outbound_group_session(outbound_memory.data());
+        random_bytes[0] = 'a' + i;
+        olm_init_outbound_group_session(
+            outbound, random_bytes, sizeof(random_bytes)
+        );
+        std::vector<uint8_t> session_key(
+            olm_outbound_group_session_key_length(outbound)
+        );
+        olm_outbound_group_session_key(
+            outbound, session_key.data(), session_key.size()
+        );
+        for (size_t copy = 0; copy < 2; ++copy) {
+            size_t j = copy * session_count + i;
+            memory[j].resize(olm_inbound_group_session_size());
+            inbound[j] = olm_inbound_group_session(memory[j].data());
+            olm_init_inbound_group_session(
+                inbound[j], session_key.data(), session_key.size()
+            );
+        }
+    }
+
+    std::vector<OlmInboundGroupSession *> sessions;
+    std::vector<uint32_t> indices;
+    for (size_t round = 0; round < 2; ++round) {
+        for (size_t i = 0; i < session_count; ++i) {
+            sessions.push_back(inbound[i]);
+            indices.push_back((i * 997 + round * 5000) % 70000);
+        }
+    }
+    /* and one which has to go back to the start */
+    sessions.push_back(inbound[3]);
+    indices.push_back(1);
+
+    size_t export_length = olm_export_inbound_group_session_length(inbound[0]);
+    std::vector<uint8_t> keys(
+        olm_export_inbound_group_session_batch_length(sessions.size())
+    );
+    _olm_cpu_set_feature_mask(~OLM_CPU_FEATURE_SHA256);
+    assert_equals((size_t)0, olm_export_inbound_group_session_batch(
+        sessions.data(), indices.data(), sessions.size(),
+        keys.data(), keys.size(), NULL
+    ));
+    _olm_cpu_set_feature_mask(~0u);
+
+    std::vector<uint8_t> exported(export_length);
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        size_t copy = 0;
+        for (size_t j = 0; j < session_count; ++j) {
+            if (sessions[i] == inbound[j]) {
+                copy = session_count + j;
+            }
+        }
+        assert_equals(export_length, olm_export_inbound_group_session(
+            inbound[copy], exported.data(), exported.size(), indices[i]
+        ));
+        assert_equals(
+            exported.data(), keys.data() + i * export_length, export_length
+        );
+    }
+}
+
+{
+    TestCase test_case("Inbound group session batch init and import");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    /* enough for two jobs */
+    const size_t count = 70;
+    std::vector<std::vector<uint8_t>> session_keys(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+        OlmOutboundGroupSession *outbound =
+            olm_outbound_group_session(outbound_memory.data());
+        random_bytes[0] = i;
+        olm_init_outbound_group_session(
+            outbound, random_bytes, sizeof(random_bytes)
+        );
+        session_keys[i].resize(olm_outbound_group_session_key_length(outbound));
+        olm_outbound_group_session_key(
+            outbound, session_keys[i].data(), session_keys[i].size()
+        );
+    }
+    /* a bad signature, and a key that is too short */
+    session_keys[3][session_keys[3].size() - 5] ^= 1;
+    session_keys[66].resize(session_keys[66].size() - 4);
+
+    std::vector<std::vector<uint8_t>> memory(count);
+    std::vector<OlmInboundGroupSession *> sessions(count);
+    std::vector<const uint8_t *> key_ptrs(count);
+    std::vector<size_t> key_lengths(count);
+    for (size_t i = 0; i < count; ++i) {
+        memory[i].resize(olm_inbound_group_session_size());
+        sessions[i] = olm_inbound_group_session(memory[i].data());
+        key_ptrs[i] = session_keys[i].data();
+        key_lengths[i] = session_keys[i].size();
+    }
+
+    /* an executor which runs the jobs backwards, and counts them */
+    struct ReverseExecutor {
+        static void run(
+            void * context, OlmBatchJob job, void * job_context,
+            size_t job_count
+        ) {
+            *static_cast<size_t *>(context) = job_count;
+            while (job_count--) {
+                job(job_context, job_count);
+            }
+        }
+    };
+    size_t job_count = 0;
+    std::vector<const char *> errors(count);
+    assert_equals((size_t)2, olm_init_inbound_group_session_batch(
+        sessions.data(), count, key_ptrs.data(), key_lengths.data(),
+        errors.data(), ReverseExecutor::run, &job_count
+    ));
+    assert_equals((size_t)2, job_count);
+
+    std::vector<uint8_t> single_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *single =
+        olm_inbound_group_session(single_memory.data());
+    size_t export_length = olm_export_inbound_group_session_length(single);
+    std::vector<std::vector<uint8_t>> exports(count);
+    std::vector<uint8_t> expected(export_length);
+    for (size_t i = 0; i < count; ++i) {
+        size_t res = olm_init_inbound_group_session(
+            single, key_ptrs[i], key_lengths[i]
+        );
+        if (res == (size_t)-1) {
+            assert_equals(true, i == 3 || i == 66);
+            assert_equals(
+                std::string(olm_inbound_group_session_last_error(single)),
+                std::string(errors[i])
+            );
+            continue;
+        }
+        assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+        assert_equals(1, olm_inbound_group_session_is_verified(sessions[i]));
+        olm_export_inbound_group_session(
+            single, expected.data(), export_length, 0
+        );
+        exports[i].resize(export_length);
+        olm_export_inbound_group_session(
+            sessions[i], exports[i].data(), export_length, 0
+        );
+        assert_equals(expected.data(), exports[i].data(), export_length);
+    }
+    assert_equals(
+        std::string("BAD_SIGNATURE"), std::string(errors[3])
+    );
+    assert_equals(
+        std::string("BAD_SESSION_KEY"), std::string(errors[66])
+    );
+
+    /* import the exports into fresh sessions, on the calling thread */
+    exports[3] = exports[0];
+    exports[3][0] = '!';
+    exports[66] = exports[0];
+    for (size_t i = 0; i < count; ++i) {
+        sessions[i] = olm_inbound_group_session(memory[i].data());
+        key_ptrs[i] = exports[i].data();
+        key_lengths[i] = exports[i].size();
+    }
+    assert_equals((size_t)1, olm_import_inbound_group_session_batch(
+        sessions.data(), count, key_ptrs.data(), key_lengths.data(),
+        errors.data(), NULL, NULL
+    ));
+    assert_equals(std::string("INVALID_BASE64"), std::string(errors[3]));
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 3) {
+            continue;
+        }
+        assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+        assert_equals(0, olm_inbound_group_session_is_verified(sessions[i]));
+        olm_export_inbound_group_session(
+            sessions[i], expected.data(), export_length, 0
+        );
+        assert_equals(exports[i].data(), expected.data(), export_length);
+    }
+
+    olm_clear_inbound_group_session(single);
+    for (size_t i = 0; i < count; ++i) {
+        olm_clear_inbound_group_session(sessions[i]);
+    }
+}
+
+{
+    TestCase test_case("Invalid signature group message");
+
+    uint8_t plaintext[] = "Message";
+    size_t plaintext_length = sizeof(plaintext) - 1;
+
+    uint8_t session_key[] =
+        "AgAAAAAwMTIzNDU2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMzQ1Njc4OUFCREVGM"
+        "DEyMzQ1Njc4OUFCQ0RFRjAxMjM0NTY3ODlBQkRFRjAxMjM0NTY3ODlBQkNERUYwMTIzND"
+        "U2Nzg5QUJERUYwMTIzNDU2Nzg5QUJDREVGMDEyMztqJ7zOtqQtYqOo0CpvDXNlMhV3HeJ"
+        "DpjrASKGLWdop4lx1cSN3Xv1TgfLPW8rhGiW+hHiMxd36nRuxscNv9k4oJA/KP+o0mi1w"
+        "v44StrEJ1wwx9WZHBUIWkQbaBSuBDw";
+
+    uint8_t message[] =
+        "AwgAEhAcbh6UpbByoyZxufQ+h2B+8XHMjhR69G8nP4pNZGl/3QMgrzCZPmP+F2aPLyKPz"
+        "xRPBMUkeXRJ6Iqm5NeOdx2eERgTW7P20CM+lL3Xpk+ZUOOPvsSQNaAL";
+    size_t msglen = sizeof(message)-1;
+
+    /* build the inbound session */
+    size_t size = olm_inbound_group_session_size();
+    uint8_t inbound_session_memory[size];
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_session_memory);
+
+    size_t res = olm_init_inbound_group_session(
+        inbound_session, session_key, sizeof(session_key)-1
+    );
+    assert_equals((size_t)0, res);
+
+    /* decode the message */
+
+    /* olm_group_decrypt_max_plaintext_length destroys the input so we have to
+       copy it. */
+    uint8_t msgcopy[msglen];
+    memcpy(msgcopy, message, msglen);
+    size = olm_group_decrypt_max_plaintext_length(
+        inbound_session, msgcopy, msglen
+    );
+
+    memcpy(msgcopy, message, msglen);
+    uint8_t plaintext_buf[size];
+    uint32_t message_index;
+    res = olm_group_decrypt(
+        inbound_session, msgcopy, msglen, plaintext_buf, size, &message_index
+    );
+    assert_equals(message_index, uint32_t(0));
+    assert_equals(plaintext_length, res);
+    assert_equals(plaintext, plaintext_buf, res);
+
+    /* now twiddle the signature */
+    message[msglen-1] = 'E';
+    memcpy(msgcopy, message, msglen);
+    assert_equals(
+        size,
+        olm_group_decrypt_max_plaintext_length(
+            inbound_session, msgcopy, msglen
+        )
+    );
+
+    memcpy(msgcopy, message, msglen);
+    res = olm_group_decrypt(
+        inbound_session, msgcopy, msglen,
+        plaintext_buf, size, &message_index
+    );
+    assert_equals((size_t)-1, res);
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+}
+
+
+{
+    TestCase test_case("Group session replay detection");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    uint8_t plaintext[] = "Message";
+    /* the message index is a varint, so the messages get longer */
+    std::vector<std::vector<uint8_t>> messages(300);
+    for (auto & message : messages) {
+        size_t message_length = olm_group_encrypt_message_length(
+            session, sizeof(plaintext)
+        );
+        message.resize(message_length);
+        olm_group_encrypt(
+            session, plaintext, sizeof(plaintext),
+            message.data(), message_length
+        );
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    );
+
+    std::vector<uint8_t> output(sizeof(plaintext) + 16);
+    uint32_t message_index;
+    auto decrypt = [&](OlmInboundGroupSession *inbound, size_t i) {
+        std::vector<uint8_t> copy(messages[i]);
+        return olm_group_decrypt(
+            inbound, copy.data(), copy.size(),
+            output.data(), output.size(), &message_index
+        );
+    };
+
+    /* without replay detection, a message decrypts as often as it's sent */
+    assert_equals(sizeof(plaintext), decrypt(inbound_session, 3));
+    assert_equals(sizeof(plaintext), decrypt(inbound_session, 3));
+
+    olm_inbound_group_session_set_replay_detection(inbound_session, 1);
+    assert_equals(0, olm_inbound_group_session_index_seen(inbound_session, 3));
+    assert_equals(sizeof(plaintext), decrypt(inbound_session, 3));
+    assert_equals(1, olm_inbound_group_session_index_seen(inbound_session, 3));
+    assert_equals((size_t)-1, decrypt(inbound_session, 3));
+    assert_equals(
+        std::string("DUPLICATE_MESSAGE_INDEX"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+    assert_equals(3U, message_index);
+
+    /* earlier and later messages are still fine, and so is the window
+     * moving on */
+    assert_equals(sizeof(plaintext), decrypt(inbound_session, 1));
+    assert_equals(sizeof(plaintext), decrypt(inbound_session, 40));
+    assert_equals(sizeof(plaintext), decrypt(inbound_session, 35));
+    assert_equals(1, olm_inbound_group_session_index_seen(inbound_session, 1));
+    assert_equals(1, olm_inbound_group_session_index_seen(inbound_session, 3));
+    assert_equals(0, olm_inbound_group_session_index_seen(inbound_session, 2));
+    assert_equals(sizeof(plaintext), decrypt(inbound_session, 290));
+    assert_equals(1, olm_inbound_group_session_index_seen(inbound_session, 40));
+    assert_equals(1, olm_inbound_group_session_index_seen(inbound_session, 35));
+    assert_equals(0, olm_inbound_group_session_index_seen(inbound_session, 36));
+    /* too far back to be remembered */
+    assert_equals(0, olm_inbound_group_session_index_seen(inbound_session, 3));
+    assert_equals(0, olm_inbound_group_session_index_seen(inbound_session, 291));
+
+    /* a forged message at a new index doesn't stop the real one */
+    std::vector<uint8_t> forged(messages[100]);
+    uint8_t & forged_byte = forged[forged.size() - 70];
+    forged_byte = forged_byte == 'A' ? 'B' : 'A';
+    std::vector<uint8_t> forged_copy(forged);
+    assert_equals((size_t)-1, olm_group_decrypt(
+        inbound_session, forged_copy.data(), forged_copy.size(),
+        output.data(), output.size(), &message_index
+    ));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+    assert_equals(0, olm_inbound_group_session_index_seen(inbound_session, 100));
+
+    /* the remembered indices survive pickling */
+    size_t pickle_length = olm_pickle_inbound_group_session_length(
+        inbound_session
+    );
+    std::vector<uint8_t> pickle(pickle_length);
+    assert_equals(pickle_length, olm_pickle_inbound_group_session(
+        inbound_session, "secret_key", 10, pickle.data(), pickle_length
+    ));
+    std::vector<uint8_t> unpickled_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *unpickled =
+        olm_inbound_group_session(unpickled_memory.data());
+    assert_equals(pickle_length, olm_unpickle_inbound_group_session(
+        unpickled, "secret_key", 10, pickle.data(), pickle_length
+    ));
+    assert_equals(1, olm_inbound_group_session_index_seen(unpickled, 290));
+    assert_equals(1, olm_inbound_group_session_index_seen(unpickled, 40));
+    assert_equals((size_t)-1, decrypt(unpickled, 40));
+    assert_equals(sizeof(plaintext), decrypt(unpickled, 100));
+
+    /* including through the batch decrypt, and within a batch */
+    size_t indices[] = {100, 101, 101, 200};
+    std::vector<std::vector<uint8_t>> copies(4);
+    std::vector<std::vector<uint8_t>> outputs(4);
+    uint8_t *message_ptrs[4], *plaintext_ptrs[4];
+    size_t lengths[4], max_lengths[4], plaintext_lengths[4];
+    uint32_t indices_out[4];
+    const char *errors[4];
+    for (size_t i = 0; i < 4; ++i) {
+        copies[i] = messages[indices[i]];
+        outputs[i].resize(output.size());
+        message_ptrs[i] = copies[i].data();
+        lengths[i] = copies[i].size();
+        plaintext_ptrs[i] = outputs[i].data();
+        max_lengths[i] = outputs[i].size();
+    }
+    assert_equals((size_t)2, olm_group_decrypt_batch(
+        unpickled, 4, message_ptrs, lengths, plaintext_ptrs, max_lengths,
+        plaintext_lengths, indices_out, errors
+    ));
+    assert_equals(std::string("DUPLICATE_MESSAGE_INDEX"), std::string(errors[0]));
+    assert_equals(std::string("SUCCESS"), std::string(errors[1]));
+    assert_equals(std::string("DUPLICATE_MESSAGE_INDEX"), std::string(errors[2]));
+    assert_equals(std::string("SUCCESS"), std::string(errors[3]));
+    assert_equals(101U, indices_out[2]);
+
+    /* without replay detection, the pickle is the one older versions read */
+    olm_inbound_group_session_set_replay_detection(unpickled, 0);
+    assert_equals(0, olm_inbound_group_session_index_seen(unpickled, 290));
+    assert_equals(sizeof(plaintext), decrypt(unpickled, 290));
+    std::vector<uint8_t> old_pickle(
+        olm_pickle_inbound_group_session_length(unpickled)
+    );
+    assert_equals(true, old_pickle.size() < pickle_length);
+}
+
+{
+    TestCase test_case("Group session ratchet distance limit");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    uint8_t plaintext[] = "Message";
+    std::vector<std::vector<uint8_t>> messages(300);
+    for (auto & message : messages) {
+        message.resize(olm_group_encrypt_message_length(
+            session, sizeof(plaintext)
+        ));
+        olm_group_encrypt(
+            session, plaintext, sizeof(plaintext),
+            message.data(), message.size()
+        );
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    );
+    olm_inbound_group_session_set_max_ratchet_distance(inbound_session, 30);
+
+    std::vector<uint8_t> output(sizeof(plaintext) + 16);
+    auto decrypt = [&](size_t i) {
+        std::vector<uint8_t> copy(messages[i]);
+        return olm_group_decrypt(
+            inbound_session, copy.data(), copy.size(),
+            output.data(), output.size(), NULL
+        );
+    };
+
+    assert_equals(sizeof(plaintext), decrypt(10));
+    assert_equals((size_t)-1, decrypt(250));
+    assert_equals(
+        std::string("RATCHET_DISTANCE_EXCEEDED"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+    /* a deferred message hasn't moved the ratchet */
+    assert_equals(
+        megolm_advance_cost(10, 250),
+        olm_inbound_group_session_seek_cost(inbound_session, 250)
+    );
+
+    /* a forged message is rejected, not deferred */
+    std::vector<uint8_t> forged(messages[250]);
+    uint8_t & forged_byte = forged[forged.size() - 70];
+    forged_byte = forged_byte == 'A' ? 'B' : 'A';
+    assert_equals((size_t)-1, olm_group_decrypt(
+        inbound_session, forged.data(), forged.size(),
+        output.data(), output.size(), NULL
+    ));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+
+    /* the read-only decrypt has the same limit */
+    std::vector<uint8_t> scratch_memory(olm_group_decrypt_scratch_size());
+    OlmGroupDecryptScratch *scratch =
+        olm_group_decrypt_scratch(scratch_memory.data());
+    std::vector<uint8_t> copy(messages[250]);
+    assert_equals((size_t)-1, olm_group_decrypt_readonly(
+        inbound_session, scratch, copy.data(), copy.size(),
+        output.data(), output.size(), NULL
+    ));
+    assert_equals(
+        std::string("RATCHET_DISTANCE_EXCEEDED"),
+        std::string(olm_group_decrypt_scratch_last_error(scratch))
+    );
+
+    /* in a batch, messages are counted from where the batch has got to */
+    size_t indices[] = {100, 20, 45, 35};
+    std::vector<std::vector<uint8_t>> copies(4);
+    std::vector<std::vector<uint8_t>> outputs(4);
+    uint8_t *message_ptrs[4], *plaintext_ptrs[4];
+    size_t lengths[4], max_lengths[4], plaintext_lengths[4];
+    const char *errors[4];
+    for (size_t i = 0; i < 4; ++i) {
+        copies[i] = messages[indices[i]];
+        outputs[i].resize(output.size());
+        message_ptrs[i] = copies[i].data();
+        lengths[i] = copies[i].size();
+        plaintext_ptrs[i] = outputs[i].data();
+        max_lengths[i] = outputs[i].size();
+    }
+    assert_equals((size_t)1, olm_group_decrypt_batch(
+        inbound_session, 4, message_ptrs, lengths, plaintext_ptrs, max_lengths,
+        plaintext_lengths, NULL, errors
+    ));
+    assert_equals(
+        std::string("RATCHET_DISTANCE_EXCEEDED"), std::string(errors[0])
+    );
+    assert_equals(std::string("SUCCESS"), std::string(errors[1]));
+    assert_equals(std::string("SUCCESS"), std::string(errors[2]));
+    assert_equals(std::string("SUCCESS"), std::string(errors[3]));
+
+    /* going back to the start can also be too far */
+    assert_equals((size_t)-1, decrypt(40));
+    assert_equals(
+        std::string("RATCHET_DISTANCE_EXCEEDED"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+    assert_equals(sizeof(plaintext), decrypt(5));
+
+    /* without a limit, the background queue can decrypt it */
+    olm_inbound_group_session_set_max_ratchet_distance(inbound_session, 0);
+    assert_equals(sizeof(plaintext), decrypt(250));
+}
+
+{
+    TestCase test_case("Group session MAC checked before the signature");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    uint8_t plaintext[] = "Message";
+    std::vector<std::vector<uint8_t>> messages(300);
+    for (auto & message : messages) {
+        message.resize(olm_group_encrypt_message_length(
+            session, sizeof(plaintext)
+        ));
+        olm_group_encrypt(
+            session, plaintext, sizeof(plaintext),
+            message.data(), message.size()
+        );
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    );
+    olm_inbound_group_session_set_mac_first_distance(inbound_session, 30);
+
+    std::vector<uint8_t> output(sizeof(plaintext) + 16);
+    auto decrypt = [&](std::vector<uint8_t> const & message) {
+        std::vector<uint8_t> copy(message);
+        return olm_group_decrypt(
+            inbound_session, copy.data(), copy.size(),
+            output.data(), output.size(), NULL
+        );
+    };
+    auto last_error = [&]() {
+        return std::string(
+            olm_inbound_group_session_last_error(inbound_session)
+        );
+    };
+    /* change a byte of the ciphertext, or of the signature */
+    auto tamper = [](std::vector<uint8_t> message, size_t from_end) {
+        uint8_t & byte = message[message.size() - from_end];
+        byte = byte == 'A' ? 'B' : 'A';
+        return message;
+    };
+    size_t const CIPHERTEXT = 110, SIGNATURE = 70;
+
+    assert_equals(sizeof(plaintext), decrypt(messages[10]));
+
+    /* garbage near the latest ratchet fails on its MAC */
+    assert_equals((size_t)-1, decrypt(tamper(messages[12], CIPHERTEXT)));
+    assert_equals(std::string("BAD_MESSAGE_MAC"), last_error());
+    assert_equals(
+        megolm_advance_cost(10, 12),
+        olm_inbound_group_session_seek_cost(inbound_session, 12)
+    );
+
+    /* a good MAC with a bad signature is still turned away, without leaving
+     * the plain-text or moving the ratchet */
+    assert_equals((size_t)-1, decrypt(tamper(messages[12], SIGNATURE)));
+    assert_equals(std::string("BAD_SIGNATURE"), last_error());
+    assert_equals(true, std::vector<uint8_t>(output.size()) == output);
+    assert_equals(
+        megolm_advance_cost(10, 12),
+        olm_inbound_group_session_seek_cost(inbound_session, 12)
+    );
+
+    assert_equals(sizeof(plaintext), decrypt(messages[12]));
+    assert_equals(plaintext, output.data(), sizeof(plaintext));
+    assert_equals(
+        megolm_advance_cost(12, 13),
+        olm_inbound_group_session_seek_cost(inbound_session, 13)
+    );
+
+    /* earlier messages are checked the same way from the initial ratchet */
+    assert_equals((size_t)-1, decrypt(tamper(messages[5], CIPHERTEXT)));
+    assert_equals(std::string("BAD_MESSAGE_MAC"), last_error());
+    assert_equals(sizeof(plaintext), decrypt(messages[5]));
+
+    /* further away, the signature is checked first as usual */
+    assert_equals((size_t)-1, decrypt(tamper(messages[250], CIPHERTEXT)));
+    assert_equals(std::string("BAD_SIGNATURE"), last_error());
+    assert_equals(sizeof(plaintext), decrypt(messages[250]));
+}
+
+{
+    TestCase test_case("Group session batch encrypt");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    /* two copies of the same session, one to encrypt each way. The random
+     * bytes are wiped by using them, so take a copy first */
+    std::vector<uint8_t> random(random_bytes, random_bytes + sizeof(random_bytes));
+    std::vector<uint8_t> single_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *single =
+        olm_outbound_group_session(single_memory.data());
+    olm_init_outbound_group_session(single, random_bytes, sizeof(random_bytes));
+    std::vector<uint8_t> batch_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *batch =
+        olm_outbound_group_session(batch_memory.data());
+    olm_init_outbound_group_session(batch, random.data(), random.size());
+
+    /* enough messages for more than one round of jobs, and for the message
+     * index to get longer part way through */
+    size_t const count = 1030;
+    std::vector<std::vector<uint8_t>> plaintexts(count);
+    std::vector<const uint8_t *> plaintext_ptrs(count);
+    std::vector<size_t> plaintext_lengths(count);
+    for (size_t i = 0; i < count; ++i) {
+        plaintexts[i].assign(i % 40, uint8_t('a' + i % 26));
+        plaintext_ptrs[i] = plaintexts[i].data();
+        plaintext_lengths[i] = plaintexts[i].size();
+    }
+
+    size_t total = olm_group_encrypt_batch_length(
+        batch, count, plaintext_lengths.data()
+    );
+    std::vector<uint8_t> messages(total);
+    std::vector<size_t> message_lengths(count);
+
+    assert_equals((size_t)-1, olm_group_encrypt_batch(
+        batch, count, plaintext_ptrs.data(), plaintext_lengths.data(),
+        messages.data(), total - 1, message_lengths.data(), NULL, NULL
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_outbound_group_session_last_error(batch))
+    );
+    assert_equals(0U, olm_outbound_group_session_message_index(batch));
+
+    /* an executor which runs the jobs backwards, and counts them */
+    struct ReverseExecutor {
+        static void run(
+            void * context, OlmBatchJob job, void * job_context,
+            size_t job_count
+        ) {
+            *static_cast<size_t *>(context) += job_count;
+            while (job_count--) {
+                job(job_context, job_count);
+            }
+        }
+    };
+    size_t job_count = 0;
+    _olm_cpu_set_feature_mask(~OLM_CPU_FEATURE_SHA256);
+    assert_equals(total, olm_group_encrypt_batch(
+        batch, count, plaintext_ptrs.data(), plaintext_lengths.data(),
+        messages.data(), total, message_lengths.data(),
+        ReverseExecutor::run, &job_count
+    ));
+    _olm_cpu_set_feature_mask(~0u);
+    assert_equals((size_t)65, job_count);
+    assert_equals(
+        olm_outbound_group_session_message_index(batch), (uint32_t)count
+    );
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        std::vector<uint8_t> expected(olm_group_encrypt_message_length(
+            single, plaintext_lengths[i]
+        ));
+        assert_equals(expected.size(), olm_group_encrypt(
+            single, plaintext_ptrs[i], plaintext_lengths[i],
+            expected.data(), expected.size()
+        ));
+        assert_equals(expected.size(), message_lengths[i]);
+        assert_equals(expected.data(), messages.data() + offset, expected.size());
+        offset += message_lengths[i];
+    }
+    assert_equals(total, offset);
+
+    /* without an executor, the jobs run on this thread */
+    std::vector<uint8_t> more(olm_group_encrypt_batch_length(
+        batch, 3, plaintext_lengths.data()
+    ));
+    assert_equals(more.size(), olm_group_encrypt_batch(
+        batch, 3, plaintext_ptrs.data(), plaintext_lengths.data(),
+        more.data(), more.size(), message_lengths.data(), NULL, NULL
+    ));
+    std::vector<uint8_t> expected(message_lengths[0]);
+    olm_group_encrypt(
+        single, plaintext_ptrs[0], plaintext_lengths[0],
+        expected.data(), expected.size()
+    );
+    assert_equals(expected.data(), more.data(), expected.size());
+}
+
+{
+    TestCase test_case("Group session streaming encrypt and decrypt");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> random(random_bytes, random_bytes + sizeof(random_bytes));
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+    std::vector<uint8_t> copy_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *copy =
+        olm_outbound_group_session(copy_memory.data());
+    olm_init_outbound_group_session(copy, random.data(), random.size());
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    std::vector<uint8_t> plaintext(10007);
+    for (size_t i = 0; i < plaintext.size(); ++i) {
+        plaintext[i] = uint8_t(i * 7 + i / 256);
+    }
+
+    std::vector<uint8_t> stream_memory(olm_group_encrypt_stream_size());
+    OlmGroupEncryptStream *stream =
+        olm_group_encrypt_stream(stream_memory.data());
+    std::vector<uint8_t> message(olm_group_encrypt_raw_message_length(
+        session, plaintext.size()
+    ));
+
+    assert_equals((size_t)-1, olm_group_encrypt_stream_update(
+        stream, plaintext.data(), 1
+    ));
+    assert_equals(
+        std::string("BAD_STREAM_STATE"),
+        std::string(olm_group_encrypt_stream_last_error(stream))
+    );
+    assert_equals((size_t)-1, olm_group_encrypt_stream_begin(
+        stream, session, plaintext.size(), message.data(), message.size() - 1
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_group_encrypt_stream_last_error(stream))
+    );
+
+    assert_equals((size_t)0, olm_group_encrypt_stream_begin(
+        stream, session, plaintext.size(), message.data(), message.size()
+    ));
+    /* feed it the plain-text in awkward pieces */
+    size_t chunks[] = {1, 15, 16, 17, 3000, 0, 33};
+    size_t pos = 0;
+    for (size_t i = 0; pos < plaintext.size(); ++i) {
+        size_t n = chunks[i % 7];
+        if (n > plaintext.size() - pos) {
+            n = plaintext.size() - pos;
+        }
+        if (pos + n == plaintext.size()) {
+            assert_equals((size_t)-1, olm_group_encrypt_stream_end(stream));
+            assert_equals((size_t)-1, olm_group_encrypt_stream_update(
+                stream, plaintext.data() + pos, n + 1
+            ));
+        }
+        assert_equals((size_t)0, olm_group_encrypt_stream_update(
+            stream, plaintext.data() + pos, n
+        ));
+        pos += n;
+    }
+    assert_equals(message.size(), olm_group_encrypt_stream_end(stream));
+
+    /* the message is the same as encrypting it in one go */
+    std::vector<uint8_t> expected(message.size());
+    assert_equals(expected.size(), olm_group_encrypt_raw(
+        copy, plaintext.data(), plaintext.size(),
+        expected.data(), expected.size()
+    ));
+    assert_equals(expected.data(), message.data(), message.size());
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    );
+
+    std::vector<uint8_t> decrypt_memory(olm_group_decrypt_stream_size());
+    OlmGroupDecryptStream *decrypt =
+        olm_group_decrypt_stream(decrypt_memory.data());
+    uint8_t piece[50];
+    assert_equals((size_t)-1, olm_group_decrypt_stream_read(
+        decrypt, piece, sizeof(piece)
+    ));
+
+    /* a forged message is caught before any plain-text is handed out */
+    std::vector<uint8_t> forged(message);
+    /* the last byte of the MAC, before the 64 byte signature */
+    forged[forged.size() - 65] ^= 1;
+    assert_equals((size_t)-1, olm_group_decrypt_stream_begin(
+        decrypt, inbound_session, forged.data(), forged.size(), NULL
+    ));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_group_decrypt_stream_last_error(decrypt))
+    );
+
+    uint32_t message_index = 99;
+    size_t max_length = olm_group_decrypt_stream_begin(
+        decrypt, inbound_session, message.data(), message.size(),
+        &message_index
+    );
+    assert_equals(0U, message_index);
+    assert_equals(true, max_length >= plaintext.size());
+
+    size_t reads[] = {1, 7, 16, 33, 4096, 50};
+    std::vector<uint8_t> output;
+    for (size_t i = 0;; ++i) {
+        std::vector<uint8_t> buffer(reads[i % 6]);
+        size_t n = olm_group_decrypt_stream_read(
+            decrypt, buffer.data(), buffer.size()
+        );
+        assert_not_equals((size_t)-1, n);
+        output.insert(output.end(), buffer.begin(), buffer.begin() + n);
+        if (n < buffer.size()) {
+            break;
+        }
+    }
+    assert_equals(plaintext.size(), output.size());
+    assert_equals(plaintext.data(), output.data(), plaintext.size());
+    assert_equals((size_t)0, olm_group_decrypt_stream_read(
+        decrypt, piece, sizeof(piece)
+    ));
+}
+
+
+{
+    TestCase test_case("Group session scatter-gather encrypt and decrypt");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> random(random_bytes, random_bytes + sizeof(random_bytes));
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+    std::vector<uint8_t> copy_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *copy =
+        olm_outbound_group_session(copy_memory.data());
+    olm_init_outbound_group_session(copy, random.data(), random.size());
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    std::vector<uint8_t> plaintext(3001);
+    for (size_t i = 0; i < plaintext.size(); ++i) {
+        plaintext[i] = uint8_t(i * 7 + i / 256);
+    }
+
+    /* cut a buffer into awkward segments, including empty ones */
+    static const size_t cuts[] = {1, 15, 0, 16, 17, 3, 1000, 33};
+    struct Segments {
+        std::vector<OlmIovec> iov;
+        Segments(uint8_t *buffer, size_t length, size_t skip) {
+            for (size_t i = skip; length; ++i) {
+                size_t n = cuts[i % 8] < length ? cuts[i % 8] : length;
+                OlmIovec segment = {buffer, n};
+                iov.push_back(segment);
+                buffer += n;
+                length -= n;
+            }
+        }
+    };
+
+    size_t message_length = olm_group_encrypt_raw_message_length(
+        session, plaintext.size()
+    );
+    std::vector<uint8_t> message(message_length);
+    Segments plaintext_segments(plaintext.data(), plaintext.size(), 0);
+    Segments short_segments(message.data(), message.size() - 1, 3);
+    assert_equals((size_t)-1, olm_group_encrypt_raw_iov(
+        session,
+        plaintext_segments.iov.data(), plaintext_segments.iov.size(),
+        short_segments.iov.data(), short_segments.iov.size()
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_outbound_group_session_last_error(session))
+    );
+
+    Segments message_segments(message.data(), message.size(), 3);
+    assert_equals(message_length, olm_group_encrypt_raw_iov(
+        session,
+        plaintext_segments.iov.data(), plaintext_segments.iov.size(),
+        message_segments.iov.data(), message_segments.iov.size()
+    ));
+
+    /* the message is the same as encrypting it in one go */
+    std::vector<uint8_t> expected(message_length);
+    assert_equals(message_length, olm_group_encrypt_raw(
+        copy, plaintext.data(), plaintext.size(),
+        expected.data(), expected.size()
+    ));
+    assert_equals(expected.data(), message.data(), message_length);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    );
+
+    std::vector<uint8_t> output(plaintext.size() + 16);
+    Segments input_segments(message.data(), message.size(), 5);
+
+    Segments small_segments(output.data(), plaintext.size() - 1, 1);
+    assert_equals((size_t)-1, olm_group_decrypt_raw_iov(
+        inbound_session,
+        input_segments.iov.data(), input_segments.iov.size(),
+        small_segments.iov.data(), small_segments.iov.size(),
+        NULL
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+
+    Segments output_segments(output.data(), output.size(), 1);
+
+    /* a forged message is caught before any plain-text is written */
+    std::vector<uint8_t> forged(message);
+    forged[forged.size() - 65] ^= 1;
+    Segments forged_segments(forged.data(), forged.size(), 5);
+    assert_equals((size_t)-1, olm_group_decrypt_raw_iov(
+        inbound_session,
+        forged_segments.iov.data(), forged_segments.iov.size(),
+        output_segments.iov.data(), output_segments.iov.size(),
+        NULL
+    ));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+
+    uint32_t message_index = 99;
+    assert_equals(plaintext.size(), olm_group_decrypt_raw_iov(
+        inbound_session,
+        input_segments.iov.data(), input_segments.iov.size(),
+        output_segments.iov.data(), output_segments.iov.size(),
+        &message_index
+    ));
+    assert_equals(0U, message_index);
+    assert_equals(plaintext.data(), output.data(), plaintext.size());
+}
+
+
+{
+    TestCase test_case("Group session in-place encrypt and decrypt");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> random(random_bytes, random_bytes + sizeof(random_bytes));
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+    std::vector<uint8_t> copy_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *copy =
+        olm_outbound_group_session(copy_memory.data());
+    olm_init_outbound_group_session(copy, random.data(), random.size());
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    );
+
+    std::vector<uint8_t> plaintext(1000);
+    for (size_t i = 0; i < plaintext.size(); ++i) {
+        plaintext[i] = uint8_t(i * 7 + i / 256);
+    }
+
+    std::vector<uint8_t> buffer(plaintext);
+    assert_equals((size_t)-1, olm_group_encrypt_inplace(
+        session, plaintext.size(), buffer.data(), buffer.size()
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_outbound_group_session_last_error(session))
+    );
+
+    /* each message is the same as olm_group_encrypt() would make */
+    for (size_t length : {size_t(0), size_t(15), size_t(16), size_t(1000)}) {
+        size_t message_length =
+            olm_group_encrypt_message_length(session, length);
+        std::vector<uint8_t> expected(message_length);
+        assert_equals(message_length, olm_group_encrypt(
+            copy, plaintext.data(), length, expected.data(), expected.size()
+        ));
+
+        buffer.assign(plaintext.begin(), plaintext.begin() + length);
+        buffer.resize(message_length);
+        assert_equals(message_length, olm_group_encrypt_inplace(
+            session, length, buffer.data(), buffer.size()
+        ));
+        assert_equals(expected.data(), buffer.data(), message_length);
+
+        uint32_t message_index = 99;
+        assert_equals(length, olm_group_decrypt_inplace(
+            inbound_session, buffer.data(), buffer.size(), &message_index
+        ));
+        assert_equals(plaintext.data(), buffer.data(), length);
+        assert_equals(
+            olm_outbound_group_session_message_index(session) - 1,
+            message_index
+        );
+    }
+
+    /* a forged message is rejected */
+    buffer.assign(plaintext.begin(), plaintext.end());
+    buffer.resize(olm_group_encrypt_message_length(session, plaintext.size()));
+    olm_group_encrypt_inplace(
+        session, plaintext.size(), buffer.data(), buffer.size()
+    );
+    buffer[buffer.size() / 2] = buffer[buffer.size() / 2] == 'A' ? 'B' : 'A';
+    assert_equals((size_t)-1, olm_group_decrypt_inplace(
+        inbound_session, buffer.data(), buffer.size(), NULL
+    ));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+}
+
+
+{
+    TestCase test_case("Group session encrypt and decrypt to a buffer");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key_len
+    );
+
+    std::vector<uint8_t> slab_memory(olm_slab_size(2048, 2));
+    OlmSlab *slab = olm_slab(slab_memory.data(), 2048, 2);
+    OlmAllocator allocator;
+    olm_slab_allocator(slab, &allocator);
+
+    std::vector<uint8_t> plaintext(1000);
+    for (size_t i = 0; i < plaintext.size(); ++i) {
+        plaintext[i] = uint8_t(i * 7 + i / 256);
+    }
+
+    OlmBuffer message = OLM_BUFFER_INIT;
+    OlmBuffer decrypted = OLM_BUFFER_INIT;
+    /* the buffers keep their memory from one message to the next */
+    for (size_t length : {size_t(1000), size_t(0), size_t(15), size_t(16)}) {
+        size_t message_length =
+            olm_group_encrypt_message_length(session, length);
+        assert_equals(message_length, olm_group_encrypt_to_buffer(
+            session, plaintext.data(), length, &allocator, &message
+        ));
+        assert_equals(message_length, message.length);
+
+        uint32_t message_index = 99;
+        assert_equals(length, olm_group_decrypt_to_buffer(
+            inbound_session, message.data, message.length,
+            &allocator, &decrypted, &message_index
+        ));
+        assert_equals(length, decrypted.length);
+        assert_equals(plaintext.data(), decrypted.data, length);
+        assert_equals(
+            olm_outbound_group_session_message_index(session) - 1,
+            message_index
+        );
+        assert_equals((size_t)2, olm_slab_slots_in_use(slab));
+    }
+
+    /* a forged message is rejected */
+    olm_group_encrypt_to_buffer(
+        session, plaintext.data(), plaintext.size(), &allocator, &message
+    );
+    message.data[message.length / 2] =
+        message.data[message.length / 2] == 'A' ? 'B' : 'A';
+    assert_equals((size_t)-1, olm_group_decrypt_to_buffer(
+        inbound_session, message.data, message.length,
+        &allocator, &decrypted, NULL
+    ));
+    assert_equals(
+        std::string("BAD_SIGNATURE"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+    assert_equals((size_t)0, decrypted.length);
+
+    /* and a message too long for a slot can't be encrypted */
+    plaintext.resize(2000);
+    assert_equals((size_t)-1, olm_group_encrypt_to_buffer(
+        session, plaintext.data(), plaintext.size(), &allocator, &message
+    ));
+    assert_equals(
+        std::string("ALLOCATION_FAILED"),
+        std::string(olm_outbound_group_session_last_error(session))
+    );
+    assert_equals((uint8_t *)NULL, message.data);
+
+    olm_buffer_release(&message);
+    olm_buffer_release(&decrypted);
+    assert_equals((size_t)0, olm_slab_slots_in_use(slab));
+}
+
+
+{
+    TestCase test_case("Group session memory stats");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+    size_t entry_size = olm_outbound_group_session_key_stream_entry_size();
+    std::vector<uint8_t> key_stream(4 * entry_size);
+    olm_outbound_group_session_set_key_stream(
+        session, key_stream.data(), key_stream.size()
+    );
+    olm_outbound_group_session_prepare(session, 3);
+
+    OlmMemoryStats stats = {};
+    olm_outbound_group_session_memory_stats(session, &stats);
+    assert_equals((size_t)1, stats.objects);
+    assert_equals(memory.size() + key_stream.size(), stats.reserved_bytes);
+    assert_equals(memory.size() + 3 * entry_size, stats.live_bytes);
+    assert_equals(key_stream.size(), stats.cache_reserved_bytes);
+    assert_equals(3 * entry_size, stats.cache_live_bytes);
+    assert_equals((size_t)3, stats.prepared_message_keys);
+    assert_equals((size_t)4, stats.max_prepared_message_keys);
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+    uint8_t plaintext[] = "Message";
+    std::vector<uint8_t> message(olm_group_encrypt_message_length(session, 7));
+    olm_group_encrypt(session, plaintext, 7, message.data(), message.size());
+
+    /* the store counts its sessions, and the buffers given to them */
+    const size_t capacity = 3;
+    std::vector<uint8_t> store_memory(olm_group_session_store_size(capacity));
+    OlmGroupSessionStore *store =
+        olm_group_session_store(store_memory.data(), capacity);
+    stats = {};
+    olm_group_session_store_memory_stats(store, &stats);
+    assert_equals((size_t)0, stats.objects);
+    assert_equals(store_memory.size(), stats.reserved_bytes);
+    size_t empty_live = stats.live_bytes;
+    assert_equals(true, empty_live < store_memory.size());
+
+    std::vector<uint8_t> checkpoints(
+        2 * olm_inbound_group_session_checkpoint_size()
+    );
+    std::vector<uint8_t> cache(
+        2 * olm_inbound_group_session_message_key_cache_entry_size()
+    );
+    /* the session IDs have to differ */
+    std::vector<uint8_t> other_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *other =
+        olm_outbound_group_session(other_memory.data());
+    std::vector<uint8_t> other_random(sizeof(random_bytes), 'o');
+    olm_init_outbound_group_session(
+        other, other_random.data(), other_random.size()
+    );
+    std::vector<uint8_t> other_key(session_key_len);
+    olm_outbound_group_session_key(other, other_key.data(), session_key_len);
+
+    for (size_t i = 0; i < 2; ++i) {
+        OlmInboundGroupSession *inbound = olm_group_session_store_add(store);
+        olm_init_inbound_group_session(
+            inbound, i ? session_key.data() : other_key.data(), session_key_len
+        );
+        if (i == 1) {
+            olm_inbound_group_session_set_checkpoints(
+                inbound, checkpoints.data(), checkpoints.size(), 8
+            );
+            olm_inbound_group_session_set_message_key_cache(
+                inbound, cache.data(), cache.size()
+            );
+            std::vector<uint8_t> tmp(message);
+            std::vector<uint8_t> output(message.size());
+            uint32_t message_index;
+            assert_equals((size_t)7, olm_group_decrypt(
+                inbound, tmp.data(), tmp.size(),
+                output.data(), output.size(), &message_index
+            ));
+
+            stats = {};
+            olm_inbound_group_session_memory_stats(inbound, &stats);
+            assert_equals((size_t)1, stats.objects);
+            assert_equals(
+                olm_inbound_group_session_size()
+                    + checkpoints.size() + cache.size(),
+                stats.reserved_bytes
+            );
+            assert_equals(
+                checkpoints.size() + cache.size(), stats.cache_reserved_bytes
+            );
+            assert_equals((size_t)2, stats.max_checkpoints);
+            assert_equals((size_t)1, stats.cached_message_keys);
+            assert_equals((size_t)2, stats.max_cached_message_keys);
+            assert_equals(
+                olm_inbound_group_session_size() + stats.cache_live_bytes,
+                stats.live_bytes
+            );
+        }
+        olm_group_session_store_commit(store, inbound);
+    }
+
+    stats = {};
+    olm_group_session_store_memory_stats(store, &stats);
+    assert_equals((size_t)2, stats.objects);
+    assert_equals(
+        store_memory.size() + checkpoints.size() + cache.size(),
+        stats.reserved_bytes
+    );
+    assert_equals(
+        empty_live + 2 * olm_inbound_group_session_size()
+            + stats.cache_live_bytes,
+        stats.live_bytes
+    );
+    assert_equals((size_t)1, stats.cached_message_keys);
+    assert_equals((size_t)2, stats.max_cached_message_keys);
+
+    /* and a sharded store adds up its shards */
+    std::vector<OlmGroupSessionStore *> shards = {store, store};
+    std::vector<int> nodes = {OLM_ANY_NUMA_NODE, OLM_ANY_NUMA_NODE};
+    std::vector<uint8_t> sharded_memory(
+        olm_sharded_group_session_store_size(1)
+    );
+    OlmShardedGroupSessionStore *sharded = olm_sharded_group_session_store(
+        sharded_memory.data(), shards.data(), nodes.data(), 1
+    );
+    OlmMemoryStats sharded_stats = {};
+    olm_sharded_group_session_store_memory_stats(sharded, &sharded_stats);
+    assert_equals(stats.objects, sharded_stats.objects);
+    assert_equals(
+        stats.reserved_bytes + sharded_memory.size(),
+        sharded_stats.reserved_bytes
+    );
+    assert_equals(
+        stats.live_bytes + sharded_memory.size(), sharded_stats.live_bytes
+    );
+
+    olm_clear_sharded_group_session_store(sharded);
+    olm_clear_group_session_store(store);
+    olm_clear_outbound_group_session(other);
+    olm_clear_outbound_group_session(session);
+}
+
+
+{
+    TestCase test_case("Group session memory trim");
+
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(NULL), 'r'
+    );
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random.data(), random.size());
+    size_t entry_size = olm_outbound_group_session_key_stream_entry_size();
+    std::vector<uint8_t> key_stream(4 * entry_size);
+    olm_outbound_group_session_set_key_stream(
+        session, key_stream.data(), key_stream.size()
+    );
+    olm_outbound_group_session_prepare(session, 3);
+
+    /* an outbound session has no caches, only prepared keys */
+    assert_equals((size_t)0, olm_outbound_group_session_trim_memory(
+        session, OLM_TRIM_MEMORY_CACHES
+    ));
+    assert_equals(3 * entry_size, olm_outbound_group_session_trim_memory(
+        session, OLM_TRIM_MEMORY_PRECOMPUTED
+    ));
+    OlmMemoryStats stats = {};
+    olm_outbound_group_session_memory_stats(session, &stats);
+    assert_equals((size_t)0, stats.prepared_message_keys);
+    assert_equals(key_stream.size(), stats.cache_reserved_bytes);
+    assert_equals((size_t)2, olm_outbound_group_session_prepare(session, 2));
+    assert_equals(2 * entry_size, olm_outbound_group_session_trim_memory(
+        session, OLM_TRIM_MEMORY_BUFFERS
+    ));
+    stats = {};
+    olm_outbound_group_session_memory_stats(session, &stats);
+    assert_equals((size_t)0, stats.cache_reserved_bytes);
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+    uint8_t plaintext[] = "Message";
+    std::vector<uint8_t> message(olm_group_encrypt_message_length(session, 7));
+    olm_group_encrypt(session, plaintext, 7, message.data(), message.size());
+
+    const size_t capacity = 2;
+    std::vector<uint8_t> store_memory(olm_group_session_store_size(capacity));
+    OlmGroupSessionStore *store =
+        olm_group_session_store(store_memory.data(), capacity);
+    OlmInboundGroupSession *inbound = olm_group_session_store_add(store);
+    olm_init_inbound_group_session(
+        inbound, session_key.data(), session_key_len
+    );
+    std::vector<uint8_t> checkpoints(
+        2 * olm_inbound_group_session_checkpoint_size()
+    );
+    size_t cache_entry_size =
+        olm_inbound_group_session_message_key_cache_entry_size();
+    std::vector<uint8_t> cache(2 * cache_entry_size);
+    olm_inbound_group_session_set_checkpoints(
+        inbound, checkpoints.data(), checkpoints.size(), 8
+    );
+    olm_inbound_group_session_set_message_key_cache(
+        inbound, cache.data(), cache.size()
+    );
+    olm_group_session_store_commit(store, inbound);
+
+    std::vector<uint8_t> output(message.size());
+    uint32_t message_index;
+    for (int i = 0; i < 2; ++i) {
+        std::vector<uint8_t> tmp(message);
+        assert_equals((size_t)7, olm_group_decrypt(
+            inbound, tmp.data(), tmp.size(),
+            output.data(), output.size(), &message_index
+        ));
+        stats = {};
+        olm_inbound_group_session_memory_stats(inbound, &stats);
+        assert_equals((size_t)1, stats.cached_message_keys);
+
+        /* the message still decrypts with its keys wiped */
+        assert_equals(cache_entry_size, olm_group_session_store_trim_memory(
+            store, OLM_TRIM_MEMORY_CACHES
+        ));
+        stats = {};
+        olm_inbound_group_session_memory_stats(inbound, &stats);
+        assert_equals((size_t)0, stats.cached_message_keys);
+        assert_equals((size_t)2, stats.max_cached_message_keys);
+    }
+
+    /* from OLM_TRIM_MEMORY_BUFFERS the buffers could be freed */
+    olm_group_session_store_trim_memory(store, OLM_TRIM_MEMORY_BUFFERS);
+    stats = {};
+    olm_group_session_store_memory_stats(store, &stats);
+    assert_equals((size_t)0, stats.cache_reserved_bytes);
+    assert_equals((size_t)0, stats.max_checkpoints);
+    assert_equals((size_t)0, stats.max_cached_message_keys);
+    std::vector<uint8_t> tmp(message);
+    assert_equals((size_t)7, olm_group_decrypt(
+        inbound, tmp.data(), tmp.size(),
+        output.data(), output.size(), &message_index
+    ));
+
+    olm_clear_group_session_store(store);
+    olm_clear_outbound_group_session(session);
+}
+
+
+
+{
+    TestCase test_case("Group session rotation");
+
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(NULL), 'r'
+    );
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random.data(), random.size());
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    size_t id_len = olm_outbound_group_session_id_length(session);
+    std::vector<uint8_t> old_id(id_len);
+    olm_outbound_group_session_id(session, old_id.data(), id_len);
+    uint8_t plaintext[] = "Message";
+    std::vector<uint8_t> message(olm_group_encrypt_message_length(session, 7));
+    olm_group_encrypt(session, plaintext, 7, message.data(), message.size());
+
+    std::vector<uint8_t> next_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *next =
+        olm_outbound_group_session(next_memory.data());
+    size_t entry_size = olm_outbound_group_session_key_stream_entry_size();
+    std::vector<uint8_t> key_stream(4 * entry_size);
+    olm_outbound_group_session_set_key_stream(
+        next, key_stream.data(), key_stream.size()
+    );
+
+    std::vector<uint8_t> next_key(session_key_len);
+    assert_equals((size_t)-1, olm_prepare_next_outbound_group_session(
+        next, random.data(), random.size() - 1,
+        next_key.data(), next_key.size()
+    ));
+    assert_equals(
+        std::string("NOT_ENOUGH_RANDOM"),
+        std::string(olm_outbound_group_session_last_error(next))
+    );
+    assert_equals((size_t)-1, olm_prepare_next_outbound_group_session(
+        next, random.data(), random.size(),
+        next_key.data(), next_key.size() - 1
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_outbound_group_session_last_error(next))
+    );
+
+    random.assign(random.size(), 'n');
+    assert_equals(session_key_len, olm_prepare_next_outbound_group_session(
+        next, random.data(), random.size(), next_key.data(), next_key.size()
+    ));
+
+    /* the key is the one the session itself gives, and its first messages'
+     * keys are prepared */
+    std::vector<uint8_t> expected_key(session_key_len);
+    olm_outbound_group_session_key(
+        next, expected_key.data(), expected_key.size()
+    );
+    assert_equals(expected_key.data(), next_key.data(), session_key_len);
+    OlmMemoryStats stats = {};
+    olm_outbound_group_session_memory_stats(next, &stats);
+    assert_equals((size_t)4, stats.prepared_message_keys);
+
+    std::vector<uint8_t> next_id(id_len);
+    olm_outbound_group_session_id(next, next_id.data(), id_len);
+
+    /* rotating swaps the sessions, key streams and all */
+    olm_rotate_outbound_group_session(session, next);
+    std::vector<uint8_t> id(id_len);
+    olm_outbound_group_session_id(session, id.data(), id_len);
+    assert_equals(next_id.data(), id.data(), id_len);
+    olm_outbound_group_session_id(next, id.data(), id_len);
+    assert_equals(old_id.data(), id.data(), id_len);
+    assert_equals(
+        (uint32_t)0, olm_outbound_group_session_message_index(session)
+    );
+    assert_equals((uint32_t)1, olm_outbound_group_session_message_index(next));
+    stats = {};
+    olm_outbound_group_session_memory_stats(session, &stats);
+    assert_equals((size_t)4, stats.prepared_message_keys);
+    stats = {};
+    olm_outbound_group_session_memory_stats(next, &stats);
+    assert_equals((size_t)0, stats.max_prepared_message_keys);
+
+    /* and the shared key decrypts what the rotated session sends */
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound, next_key.data(), next_key.size()
+    ));
+    message.resize(olm_group_encrypt_message_length(session, 7));
+    olm_group_encrypt(session, plaintext, 7, message.data(), message.size());
+    std::vector<uint8_t> output(message.size());
+    uint32_t message_index = 99;
+    assert_equals((size_t)7, olm_group_decrypt(
+        inbound, message.data(), message.size(),
+        output.data(), output.size(), &message_index
+    ));
+    assert_equals(plaintext, output.data(), 7);
+    assert_equals((uint32_t)0, message_index);
+
+    olm_clear_inbound_group_session(inbound);
+    olm_clear_outbound_group_session(next);
+    olm_clear_outbound_group_session(session);
+}
+
+
+{
+    TestCase test_case("Group session pruning");
+
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(NULL), 'p'
+    );
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random.data(), random.size());
+
+    size_t session_key_len = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> session_key(session_key_len);
+    olm_outbound_group_session_key(session, session_key.data(), session_key_len);
+
+    const unsigned count = 700;
+    std::vector<std::vector<uint8_t>> messages(count);
+    uint8_t plaintext[] = "Message";
+    for (unsigned i = 0; i < count; ++i) {
+        messages[i].resize(olm_group_encrypt_message_length(session, 7));
+        olm_group_encrypt(
+            session, plaintext, 7, messages[i].data(), messages[i].size()
+        );
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound, session_key.data(), session_key_len
+    ));
+    std::vector<uint8_t> checkpoints(
+        2 * olm_inbound_group_session_checkpoint_size()
+    );
+    olm_inbound_group_session_set_checkpoints(
+        inbound, checkpoints.data(), checkpoints.size(), 8
+    );
+    std::vector<uint8_t> cache(
+        2 * olm_inbound_group_session_message_key_cache_entry_size()
+    );
+    olm_inbound_group_session_set_message_key_cache(
+        inbound, cache.data(), cache.size()
+    );
+
+    auto decrypt = [&](unsigned index) {
+        std::vector<uint8_t> message(messages[index]);
+        std::vector<uint8_t> output(message.size());
+        uint32_t message_index;
+        return olm_group_decrypt(
+            inbound, message.data(), message.size(),
+            output.data(), output.size(), &message_index
+        );
+    };
+    auto last_error = [&] {
+        return std::string(olm_inbound_group_session_last_error(inbound));
+    };
+
+    /* the latest at 600, a checkpoint at 256 and the keys for 10 cached */
+    assert_equals((size_t)7, decrypt(600));
+    assert_equals((size_t)7, decrypt(300));
+    assert_equals((size_t)7, decrypt(10));
+    OlmMemoryStats stats = {};
+    olm_inbound_group_session_memory_stats(inbound, &stats);
+    assert_equals((size_t)1, stats.checkpoints);
+    assert_equals((size_t)2, stats.cached_message_keys);
+
+    /* pruning back to where the session already starts does nothing */
+    assert_equals((size_t)0, olm_inbound_group_session_prune_before(
+        inbound, 0
+    ));
+    assert_equals((uint32_t)0, olm_inbound_group_session_first_known_index(
+        inbound
+    ));
+
+    /* between the first known index and the latest: the earlier checkpoint
+     * and cached keys go, and so does decrypting anything before */
+    assert_equals((size_t)0, olm_inbound_group_session_prune_before(
+        inbound, 280
+    ));
+    assert_equals((uint32_t)280, olm_inbound_group_session_first_known_index(
+        inbound
+    ));
+    stats = {};
+    olm_inbound_group_session_memory_stats(inbound, &stats);
+    assert_equals((size_t)0, stats.checkpoints);
+    assert_equals((size_t)1, stats.cached_message_keys);
+    assert_equals((size_t)-1, decrypt(10));
+    assert_equals(std::string("UNKNOWN_MESSAGE_INDEX"), last_error());
+    assert_equals((size_t)-1, decrypt(279));
+    assert_equals((size_t)0, olm_inbound_group_session_seek_cost(
+        inbound, 280
+    ));
+    assert_equals((size_t)7, decrypt(280));
+    assert_equals((size_t)7, decrypt(300));
+    assert_equals((size_t)7, decrypt(650));
+
+    /* the pickle starts from the new first index */
+    std::vector<uint8_t> pickle(
+        olm_pickle_inbound_group_session_length(inbound)
+    );
+    olm_pickle_inbound_group_session(
+        inbound, "key", 3, pickle.data(), pickle.size()
+    );
+    std::vector<uint8_t> unpickled_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *unpickled =
+        olm_inbound_group_session(unpickled_memory.data());
+    assert_equals(pickle.size(), olm_unpickle_inbound_group_session(
+        unpickled, "key", 3, pickle.data(), pickle.size()
+    ));
+    assert_equals(
+        (uint32_t)280, olm_inbound_group_session_first_known_index(unpickled)
+    );
+
+    /* past the latest, which moves on too */
+    assert_equals((size_t)0, olm_inbound_group_session_prune_before(
+        inbound, 690
+    ));
+    assert_equals((uint32_t)690, olm_inbound_group_session_first_known_index(
+        inbound
+    ));
+    assert_equals((size_t)0, olm_inbound_group_session_seek_cost(
+        inbound, 690
+    ));
+    assert_equals((size_t)-1, decrypt(650));
+    assert_equals(std::string("UNKNOWN_MESSAGE_INDEX"), last_error());
+    assert_equals((size_t)7, decrypt(699));
+    assert_equals((size_t)7, decrypt(690));
+
+    olm_clear_inbound_group_session(unpickled);
+    olm_clear_inbound_group_session(inbound);
+    olm_clear_outbound_group_session(session);
+}
+{
+    TestCase test_case("Group session key at one index");
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session =
+        olm_outbound_group_session(memory.data());
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(session), 'r'
+    );
+    olm_init_outbound_group_session(session, random.data(), random.size());
+
+    size_t key_length = olm_outbound_group_session_key_length(session);
+    std::vector<uint8_t> first(key_length), again(key_length, 0);
+    assert_equals(key_length, olm_outbound_group_session_key(
+        session, first.data(), first.size()
+    ));
+    assert_equals(key_length, olm_outbound_group_session_key(
+        session, again.data(), again.size()
+    ));
+    assert_equals(first.data(), again.data(), key_length);
+
+    /* encrypting moves the ratchet on, and the key with it */
+    uint8_t plaintext[] = "Message";
+    std::vector<uint8_t> message(
+        olm_group_encrypt_message_length(session, sizeof(plaintext))
+    );
+    olm_group_encrypt(
+        session, plaintext, sizeof(plaintext), message.data(), message.size()
+    );
+    std::vector<uint8_t> next(key_length);
+    assert_equals(key_length, olm_outbound_group_session_key(
+        session, next.data(), next.size()
+    ));
+    bool changed = memcmp(first.data(), next.data(), key_length) != 0;
+    assert_equals(true, changed);
+
+    /* and matches the key of a copy which hasn't been asked for it yet */
+    std::vector<uint8_t> pickle(
+        olm_pickle_outbound_group_session_length(session)
+    );
+    olm_pickle_outbound_group_session(
+        session, "key", 3, pickle.data(), pickle.size()
+    );
+    std::vector<uint8_t> copy_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *copy =
+        olm_outbound_group_session(copy_memory.data());
+    olm_unpickle_outbound_group_session(
+        copy, "key", 3, pickle.data(), pickle.size()
+    );
+    assert_equals(key_length, olm_outbound_group_session_key(
+        copy, again.data(), again.size()
+    ));
+    assert_equals(next.data(), again.data(), key_length);
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound, next.data(), next.size()
+    ));
+    assert_equals(
+        (uint32_t)1, olm_inbound_group_session_first_known_index(inbound)
+    );
+
+    olm_clear_inbound_group_session(inbound);
+    olm_clear_outbound_group_session(copy);
+    olm_clear_outbound_group_session(session);
+}
+
+
+{
+    TestCase test_case("Group session dirty state");
+
+    std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *outbound =
+        olm_outbound_group_session(outbound_memory.data());
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(outbound), 0x5d
+    );
+    assert_equals(0, olm_outbound_group_session_is_dirty(outbound));
+    olm_init_outbound_group_session(outbound, random.data(), random.size());
+    assert_equals(1, olm_outbound_group_session_is_dirty(outbound));
+
+    /* sharing the key changes nothing that is pickled */
+    std::vector<uint8_t> pickle(
+        olm_pickle_outbound_group_session_length(outbound)
+    );
+    olm_pickle_outbound_group_session(
+        outbound, "", 0, pickle.data(), pickle.size()
+    );
+    olm_unpickle_outbound_group_session(
+        outbound, "", 0, pickle.data(), pickle.size()
+    );
+    assert_equals(0, olm_outbound_group_session_is_dirty(outbound));
+    std::vector<uint8_t> session_key(
+        olm_outbound_group_session_key_length(outbound)
+    );
+    olm_outbound_group_session_key(
+        outbound, session_key.data(), session_key.size()
+    );
+    assert_equals(0, olm_outbound_group_session_is_dirty(outbound));
+
+    uint8_t plaintext[] = "Message";
+    std::vector<std::vector<uint8_t>> messages;
+    for (int i = 0; i < 2; ++i) {
+        messages.emplace_back(olm_group_encrypt_message_length(
+            outbound, sizeof(plaintext)
+        ));
+        olm_group_encrypt(
+            outbound, plaintext, sizeof(plaintext),
+            messages.back().data(), messages.back().size()
+        );
+    }
+    assert_equals(1, olm_outbound_group_session_is_dirty(outbound));
+    olm_outbound_group_session_clear_dirty(outbound);
+    assert_equals(0, olm_outbound_group_session_is_dirty(outbound));
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound =
+        olm_inbound_group_session(inbound_memory.data());
+    olm_init_inbound_group_session(
+        inbound, session_key.data(), session_key.size()
+    );
+    assert_equals(1, olm_inbound_group_session_is_dirty(inbound));
+    pickle.resize(olm_pickle_inbound_group_session_length(inbound));
+    olm_pickle_inbound_group_session(
+        inbound, "", 0, pickle.data(), pickle.size()
+    );
+    assert_equals(1, olm_inbound_group_session_is_dirty(inbound));
+    olm_unpickle_inbound_group_session(
+        inbound, "", 0, pickle.data(), pickle.size()
+    );
+    assert_equals(0, olm_inbound_group_session_is_dirty(inbound));
+
+    auto decrypt = [&](int i) {
+        std::vector<uint8_t> message(messages[i]);
+        std::vector<uint8_t> output(message.size());
+        uint32_t message_index;
+        assert_equals(sizeof(plaintext), olm_group_decrypt(
+            inbound, message.data(), message.size(),
+            output.data(), output.size(), &message_index
+        ));
+    };
+
+    /* moving the latest ratchet on dirties it; messages at or before it
+     * don't */
+    decrypt(1);
+    assert_equals(1, olm_inbound_group_session_is_dirty(inbound));
+    olm_inbound_group_session_clear_dirty(inbound);
+    decrypt(1);
+    decrypt(0);
+    assert_equals(0, olm_inbound_group_session_is_dirty(inbound));
+
+    /* but anything remembered for replay detection does */
+    olm_inbound_group_session_set_replay_detection(inbound, 1);
+    assert_equals(1, olm_inbound_group_session_is_dirty(inbound));
+    olm_inbound_group_session_clear_dirty(inbound);
+    decrypt(0);
+    assert_equals(1, olm_inbound_group_session_is_dirty(inbound));
+}
+
+
+{
+    TestCase test_case("Group session history scan");
+
+    uint8_t random_bytes[] =
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF"
+        "0123456789ABDEF0123456789ABCDEF";
+
+    std::vector<uint8_t> memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *session = olm_outbound_group_session(memory.data());
+    olm_init_outbound_group_session(session, random_bytes, sizeof(random_bytes));
+
+    /* start the inbound session part way through a block */
+    const unsigned first = 100, count = 600;
+    std::vector<std::vector<uint8_t>> messages(count);
+    std::vector<uint8_t> session_key;
+    for (unsigned i = 0; i < count; ++i) {
+        if (i == first) {
+            session_key.resize(olm_outbound_group_session_key_length(session));
+            olm_outbound_group_session_key(
+                session, session_key.data(), session_key.size()
+            );
+        }
+        char plaintext[32];
+        size_t plaintext_length = std::snprintf(
+            plaintext, sizeof(plaintext), "Message %u", i
+        );
+        messages[i].resize(olm_group_encrypt_message_length(
+            session, plaintext_length
+        ));
+        olm_group_encrypt(
+            session, (uint8_t *)plaintext, plaintext_length,
+            messages[i].data(), messages[i].size()
+        );
+    }
+
+    std::vector<uint8_t> inbound_memory(olm_inbound_group_session_size());
+    OlmInboundGroupSession *inbound_session =
+        olm_inbound_group_session(inbound_memory.data());
+    assert_equals((size_t)0, olm_init_inbound_group_session(
+        inbound_session, session_key.data(), session_key.size()
+    ));
+
+    auto check_decrypt = [&](unsigned index) {
+        std::vector<uint8_t> message(messages[index]);
+        std::vector<uint8_t> plaintext(message.size());
+        uint32_t message_index;
+        size_t res = olm_group_decrypt(
+            inbound_session, message.data(), message.size(),
+            plaintext.data(), plaintext.size(), &message_index
+        );
+        char expected[32];
+        size_t expected_length = std::snprintf(
+            expected, sizeof(expected), "Message %u", index
+        );
+        assert_equals(expected_length, res);
+        assert_equals((uint8_t *)expected, plaintext.data(), expected_length);
+        assert_equals(index, message_index);
+    };
+
+    std::vector<uint8_t> scan(olm_inbound_group_session_scan_size() - 1);
+    assert_equals((size_t)-1, olm_inbound_group_session_begin_scan(
+        inbound_session, scan.data(), scan.size()
+    ));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_inbound_group_session_last_error(inbound_session))
+    );
+    scan.resize(olm_inbound_group_session_scan_size(), 0xff);
+
+    check_decrypt(count - 1);
+    assert_equals((size_t)0, olm_inbound_group_session_begin_scan(
+        inbound_session, scan.data(), scan.size()
+    ));
+
+    /* the first message of a block works out the rest of it */
+    assert_equals(
+        megolm_advance_cost(first, 512) + 255,
+        olm_inbound_group_session_seek_cost(inbound_session, 590)
+    );
+    check_decrypt(count - 2);
+    for (unsigned i = count - 3; i >= 512; --i) {
+        assert_equals((size_t)0, olm_inbound_group_session_seek_cost(
+            inbound_session, i
+        ));
+        check_decrypt(i);
+    }
+
+    /* going back through the history, a block at a time, down to a first
+     * index part way through its block */
+    for (unsigned i = 511; i + 1 > first; --i) {
+        check_decrypt(i);
+    }
+    assert_equals((size_t)0, olm_inbound_group_session_seek_cost(
+        inbound_session, first
+    ));
+    check_decrypt(300);
+    check_decrypt(count - 1);
+
+    /* moving the first index on forgets the block */
+    olm_inbound_group_session_prune_before(inbound_session, 150);
+    assert_equals(
+        (size_t)(255 - 150),
+        olm_inbound_group_session_seek_cost(inbound_session, 200)
+    );
+    check_decrypt(200);
+    check_decrypt(150);
+
+    /* ending the scan wipes its buffer */
+    olm_inbound_group_session_end_scan(inbound_session);
+    for (size_t j = 0; j < scan.size(); ++j) {
+        assert_equals((uint8_t)0, scan[j]);
+    }
+    check_decrypt(160);
+    assert_equals(
+        megolm_advance_cost(150, 170),
+        olm_inbound_group_session_seek_cost(inbound_session, 170)
+    );
+
+    olm_clear_inbound_group_session(inbound_session);
+}
+
+
+{
+    TestCase test_case("Group session share ledger");
+
+    std::vector<uint8_t> outbound_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *outbound =
+        olm_outbound_group_session(outbound_memory.data());
+    std::vector<uint8_t> random(
+        olm_init_outbound_group_session_random_length(outbound), 0x3c
+    );
+    olm_init_outbound_group_session(outbound, random.data(), random.size());
+
+    /* a room's devices, by their base64 curve25519 keys */
+    std::vector<std::string> devices;
+    for (int i = 0; i < 10; ++i) {
+        uint8_t raw[CURVE25519_KEY_LENGTH];
+        uint8_t encoded[43];
+        for (size_t j = 0; j < sizeof(raw); ++j) {
+            raw[j] = uint8_t(i * 37 + j * 11);
+        }
+        _olm_encode_base64(raw, sizeof(raw), encoded);
+        devices.emplace_back((char *)encoded, sizeof(encoded));
+    }
+    std::vector<void const *> keys;
+    std::vector<size_t> key_lengths;
+    for (auto const & device : devices) {
+        keys.push_back(device.data());
+        key_lengths.push_back(device.size());
+    }
+
+    /* without a buffer there is no room for anyone */
+    assert_equals(std::size_t(-1), olm_outbound_group_session_ledger_add(
+        outbound, 1, keys.data(), key_lengths.data()
+    ));
+    assert_equals(
+        std::string("STORE_FULL"),
+        std::string(olm_outbound_group_session_last_error(outbound))
+    );
+
+    std::vector<uint8_t> ledger(
+        olm_outbound_group_session_ledger_buffer_length(6)
+    );
+    assert_equals(std::size_t(6), olm_outbound_group_session_set_ledger(
+        outbound, ledger.data(), ledger.size()
+    ));
+
+    uint8_t plaintext[] = "Message";
+    std::vector<uint8_t> message(
+        olm_group_encrypt_message_length(outbound, sizeof(plaintext))
+    );
+    olm_group_encrypt(
+        outbound, plaintext, sizeof(plaintext), message.data(), message.size()
+    );
+    olm_outbound_group_session_clear_dirty(outbound);
+    assert_equals(std::size_t(4), olm_outbound_group_session_ledger_add(
+        outbound, 4, keys.data(), key_lengths.data()
+    ));
+    assert_equals(1, olm_outbound_group_session_is_dirty(outbound));
+    olm_group_encrypt(
+        outbound, plaintext, sizeof(plaintext), message.data(), message.size()
+    );
+
+    /* devices already sent the key keep their index */
+    assert_equals(std::size_t(1), olm_outbound_group_session_ledger_add(
+        outbound, 2, keys.data() + 3, key_lengths.data() + 3
+    ));
+    assert_equals(std::size_t(5), olm_outbound_group_session_ledger_count(
+        outbound
+    ));
+    uint32_t shared_at = 0;
+    assert_equals(std::size_t(1), olm_outbound_group_session_ledger_lookup(
+        outbound, keys[3], key_lengths[3], &shared_at
+    ));
+    assert_equals(uint32_t(1), shared_at);
+    assert_equals(std::size_t(1), olm_outbound_group_session_ledger_lookup(
+        outbound, keys[4], key_lengths[4], &shared_at
+    ));
+    assert_equals(uint32_t(2), shared_at);
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_lookup(
+        outbound, keys[5], key_lengths[5], &shared_at
+    ));
+    assert_equals(std::size_t(-1), olm_outbound_group_session_ledger_lookup(
+        outbound, "not a key", 9, &shared_at
+    ));
+    assert_equals(
+        std::string("INVALID_BASE64"),
+        std::string(olm_outbound_group_session_last_error(outbound))
+    );
+
+    std::vector<size_t> missing(devices.size());
+    assert_equals(std::size_t(5), olm_outbound_group_session_ledger_missing(
+        outbound, devices.size(), keys.data(), key_lengths.data(),
+        missing.data()
+    ));
+    assert_equals(true, std::vector<size_t>({5, 6, 7, 8, 9}) ==
+        std::vector<size_t>(missing.begin(), missing.begin() + 5));
+
+    /* adding is all or nothing */
+    assert_equals(std::size_t(-1), olm_outbound_group_session_ledger_add(
+        outbound, 2, keys.data() + 5, key_lengths.data() + 5
+    ));
+    assert_equals(
+        std::string("STORE_FULL"),
+        std::string(olm_outbound_group_session_last_error(outbound))
+    );
+    assert_equals(std::size_t(5), olm_outbound_group_session_ledger_count(
+        outbound
+    ));
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_lookup(
+        outbound, keys[5], key_lengths[5], &shared_at
+    ));
+
+    /* a device listed twice only takes one place */
+    void const * twice[] = {keys[5], keys[5]};
+    size_t twice_lengths[] = {key_lengths[5], key_lengths[5]};
+    assert_equals(std::size_t(1), olm_outbound_group_session_ledger_add(
+        outbound, 2, twice, twice_lengths
+    ));
+    assert_equals(std::size_t(6), olm_outbound_group_session_ledger_count(
+        outbound
+    ));
+    assert_equals(std::size_t(1), olm_outbound_group_session_ledger_lookup(
+        outbound, keys[5], key_lengths[5], &shared_at
+    ));
+    assert_equals(uint32_t(2), shared_at);
+
+    /* a smaller buffer can't take the devices; a bigger one can */
+    std::vector<uint8_t> small_ledger(
+        olm_outbound_group_session_ledger_buffer_length(3)
+    );
+    assert_equals(std::size_t(-1), olm_outbound_group_session_set_ledger(
+        outbound, small_ledger.data(), small_ledger.size()
+    ));
+    std::vector<uint8_t> big_ledger(
+        olm_outbound_group_session_ledger_buffer_length(devices.size())
+    );
+    assert_equals(true, olm_outbound_group_session_set_ledger(
+        outbound, big_ledger.data(), big_ledger.size()
+    ) >= devices.size());
+    assert_equals(true, std::vector<uint8_t>(ledger.size()) == ledger);
+    assert_equals(std::size_t(4), olm_outbound_group_session_ledger_add(
+        outbound, 5, keys.data() + 5, key_lengths.data() + 5
+    ));
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_missing(
+        outbound, devices.size(), keys.data(), key_lengths.data(),
+        missing.data()
+    ));
+
+    /* the ledger is pickled with the session */
+    std::vector<uint8_t> pickle(
+        olm_pickle_outbound_group_session_length(outbound)
+    );
+    olm_pickle_outbound_group_session(
+        outbound, "", 0, pickle.data(), pickle.size()
+    );
+    std::vector<uint8_t> loaded_memory(olm_outbound_group_session_size());
+    OlmOutboundGroupSession *loaded =
+        olm_outbound_group_session(loaded_memory.data());
+    std::vector<uint8_t> copy(pickle);
+    assert_equals(std::size_t(-1), olm_unpickle_outbound_group_session(
+        loaded, "", 0, copy.data(), copy.size()
+    ));
+    assert_equals(
+        std::string("STORE_FULL"),
+        std::string(olm_outbound_group_session_last_error(loaded))
+    );
+    std::vector<uint8_t> loaded_ledger(
+        olm_outbound_group_session_ledger_buffer_length(devices.size())
+    );
+    olm_outbound_group_session_set_ledger(
+        loaded, loaded_ledger.data(), loaded_ledger.size()
+    );
+    copy = pickle;
+    assert_equals(pickle.size(), olm_unpickle_outbound_group_session(
+        loaded, "", 0, copy.data(), copy.size()
+    ));
+    assert_equals(devices.size(), olm_outbound_group_session_ledger_count(
+        loaded
+    ));
+    assert_equals(std::size_t(1), olm_outbound_group_session_ledger_lookup(
+        loaded, keys[4], key_lengths[4], &shared_at
+    ));
+    assert_equals(uint32_t(2), shared_at);
+
+    /* a new session hasn't been shared with anyone, and nor has one
+     * without a ledger pickled */
+    olm_init_outbound_group_session(loaded, random.data(), random.size());
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_count(
+        loaded
+    ));
+    pickle.resize(olm_pickle_outbound_group_session_length(loaded));
+    olm_pickle_outbound_group_session(
+        loaded, "", 0, pickle.data(), pickle.size()
+    );
+    olm_outbound_group_session_ledger_add(
+        outbound, 1, keys.data(), key_lengths.data()
+    );
+    assert_equals(pickle.size(), olm_unpickle_outbound_group_session(
+        outbound, "", 0, pickle.data(), pickle.size()
+    ));
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_count(
+        outbound
+    ));
+
+    /* rotation takes each session's ledger with it */
+    olm_outbound_group_session_ledger_add(
+        loaded, 3, keys.data(), key_lengths.data()
+    );
+    olm_rotate_outbound_group_session(outbound, loaded);
+    assert_equals(std::size_t(3), olm_outbound_group_session_ledger_count(
+        outbound
+    ));
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_count(
+        loaded
+    ));
+    olm_outbound_group_session_ledger_clear(outbound);
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_count(
+        outbound
+    ));
+    assert_equals(std::size_t(0), olm_outbound_group_session_ledger_lookup(
+        outbound, keys[0], key_lengths[0], nullptr
+    ));
+}
 
 }
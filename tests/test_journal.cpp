@@ -0,0 +1,416 @@
+#include "olm/journal.h"
+#include "olm/olm.h"
+#include "unittest.hh"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Log {
+    std::vector<uint8_t> bytes;
+    unsigned writes = 0;
+    bool fail = false;
+};
+
+int write_log(void * context, void const * data, size_t length) {
+    Log & log = *static_cast<Log *>(context);
+    if (log.fail) {
+        return 1;
+    }
+    uint8_t const * bytes = static_cast<uint8_t const *>(data);
+    log.bytes.insert(log.bytes.end(), bytes, bytes + length);
+    log.writes++;
+    return 0;
+}
+
+struct Replayed {
+    std::vector<unsigned> types;
+    std::vector<std::string> ids;
+    std::vector<std::string> data;
+};
+
+void visit(
+    void * context, unsigned type,
+    void const * id, size_t id_length,
+    void const * data, size_t data_length
+) {
+    Replayed & replayed = *static_cast<Replayed *>(context);
+    replayed.types.push_back(type);
+    replayed.ids.push_back(
+        std::string(static_cast<char const *>(id), id_length)
+    );
+    replayed.data.push_back(
+        std::string(static_cast<char const *>(data), data_length)
+    );
+}
+
+size_t append(
+    OlmJournal * journal, unsigned type,
+    std::string const & id, std::string const & data
+) {
+    return olm_journal_append(
+        journal, type, id.data(), id.size(), data.data(), data.size()
+    );
+}
+
+size_t replay(
+    uint64_t generation, Log const & log, Replayed & replayed,
+    char const * key = "key"
+) {
+    return olm_journal_replay(
+        key, std::strlen(key), generation, 0,
+        log.bytes.data(), log.bytes.size(), visit, &replayed
+    );
+}
+
+} // namespace
+
+int main() {
+
+{
+    TestCase test_case("Journal group commit");
+
+    Log log;
+    std::vector<uint8_t> memory(olm_journal_size(4096));
+    OlmJournal * journal = olm_journal(
+        memory.data(), 4096, "key", 3, 1, 0, write_log, &log
+    );
+
+    size_t first_length = olm_journal_record_length(1, 5);
+    assert_equals((size_t)0, append(
+        journal, OLM_JOURNAL_SNAPSHOT, "a", "full1"
+    ));
+    assert_equals(first_length, append(journal, OLM_JOURNAL_DELTA, "b", "d1"));
+    assert_equals(
+        first_length + olm_journal_record_length(1, 2),
+        append(journal, OLM_JOURNAL_DELTA, "a", "d2")
+    );
+    size_t length = first_length + 2 * olm_journal_record_length(1, 2);
+    assert_equals(length, olm_journal_pending(journal));
+    assert_equals(0U, log.writes);
+
+    /* the whole batch goes in one write */
+    assert_equals(length, olm_journal_commit(journal));
+    assert_equals(1U, log.writes);
+    assert_equals(length, log.bytes.size());
+    assert_equals((size_t)0, olm_journal_pending(journal));
+
+    /* a commit with nothing to write doesn't write */
+    assert_equals(length, olm_journal_commit(journal));
+    assert_equals(1U, log.writes);
+
+    assert_equals(length, append(journal, OLM_JOURNAL_REMOVE, "b", ""));
+    length += olm_journal_record_length(1, 0);
+    assert_equals(length, olm_journal_commit(journal));
+    assert_equals(2U, log.writes);
+
+    Replayed replayed;
+    assert_equals(length, replay(1, log, replayed));
+    assert_equals((size_t)4, replayed.ids.size());
+    assert_equals(std::string("a"), replayed.ids[0]);
+    assert_equals(std::string("full1"), replayed.data[0]);
+    assert_equals((unsigned)OLM_JOURNAL_SNAPSHOT, replayed.types[0]);
+    assert_equals(std::string("b"), replayed.ids[1]);
+    assert_equals(std::string("d1"), replayed.data[1]);
+    assert_equals(std::string("d2"), replayed.data[2]);
+    assert_equals((unsigned)OLM_JOURNAL_REMOVE, replayed.types[3]);
+    assert_equals(std::string(""), replayed.data[3]);
+
+    olm_clear_journal(journal);
+}
+
+{
+    TestCase test_case("Journal replay stops at a bad record");
+
+    Log log;
+    std::vector<uint8_t> memory(olm_journal_size(1024));
+    OlmJournal * journal = olm_journal(
+        memory.data(), 1024, "key", 3, 7, 0, write_log, &log
+    );
+    append(journal, OLM_JOURNAL_DELTA, "a", "first");
+    size_t second = append(journal, OLM_JOURNAL_DELTA, "a", "second");
+    append(journal, OLM_JOURNAL_DELTA, "a", "third");
+    size_t length = olm_journal_commit(journal);
+    olm_clear_journal(journal);
+
+    Replayed replayed;
+    assert_equals(length, replay(7, log, replayed));
+    assert_equals((size_t)3, replayed.ids.size());
+
+    /* under the wrong key or generation, nothing is good */
+    replayed = Replayed();
+    assert_equals((size_t)0, replay(7, log, replayed, "other"));
+    assert_equals((size_t)0, replay(8, log, replayed));
+    assert_equals((size_t)0, replayed.ids.size());
+
+    /* a record cut short by a crash */
+    Log torn = log;
+    torn.bytes.resize(length - 1);
+    replayed = Replayed();
+    assert_equals(second + olm_journal_record_length(1, 6), replay(
+        7, torn, replayed
+    ));
+    assert_equals((size_t)2, replayed.ids.size());
+
+    /* a changed record, and so everything after it */
+    Log changed = log;
+    changed.bytes[second + 12] ^= 1;
+    replayed = Replayed();
+    assert_equals(second, replay(7, changed, replayed));
+    assert_equals((size_t)1, replayed.ids.size());
+
+    /* records swapped round */
+    Log swapped;
+    size_t third = second + olm_journal_record_length(1, 6);
+    swapped.bytes.assign(
+        log.bytes.begin() + second, log.bytes.begin() + third
+    );
+    swapped.bytes.insert(
+        swapped.bytes.end(), log.bytes.begin(), log.bytes.begin() + second
+    );
+    replayed = Replayed();
+    assert_equals((size_t)0, replay(7, swapped, replayed));
+
+    /* replaying from part way through */
+    replayed = Replayed();
+    assert_equals(length, olm_journal_replay(
+        "key", 3, 7, second, log.bytes.data() + second,
+        log.bytes.size() - second, visit, &replayed
+    ));
+    assert_equals((size_t)2, replayed.ids.size());
+    assert_equals(std::string("second"), replayed.data[0]);
+}
+
+{
+    TestCase test_case("Journal full and failed writes");
+
+    Log log;
+    size_t record = olm_journal_record_length(4, 10);
+    size_t buffer_length = 3 * record;
+    std::vector<uint8_t> memory(olm_journal_size(buffer_length));
+    OlmJournal * journal = olm_journal(
+        memory.data(), buffer_length, "key", 3, 1, 0, write_log, &log
+    );
+
+    std::string big(buffer_length, 'x');
+    assert_equals((size_t)-1, append(journal, OLM_JOURNAL_DELTA, "id", big));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_journal_last_error(journal))
+    );
+
+    for (unsigned i = 0; i < 3; ++i) {
+        assert_equals(i * record, append(
+            journal, OLM_JOURNAL_DELTA, "id00", "0123456789"
+        ));
+    }
+    assert_equals((size_t)-1, append(
+        journal, OLM_JOURNAL_DELTA, "id00", "0123456789"
+    ));
+    assert_equals(
+        std::string("JOURNAL_FULL"),
+        std::string(olm_journal_last_error(journal))
+    );
+    assert_equals(3 * record, olm_journal_commit(journal));
+    assert_equals(3 * record, append(
+        journal, OLM_JOURNAL_DELTA, "id00", "0123456789"
+    ));
+
+    /* a failed write stops the journal until it is restarted */
+    log.fail = true;
+    assert_equals((size_t)-1, olm_journal_commit(journal));
+    assert_equals(
+        std::string("JOURNAL_WRITE_FAILED"),
+        std::string(olm_journal_last_error(journal))
+    );
+    assert_equals((size_t)-1, append(
+        journal, OLM_JOURNAL_DELTA, "id00", "0123456789"
+    ));
+    assert_equals((size_t)-1, olm_journal_commit(journal));
+
+    log.fail = false;
+    Replayed replayed;
+    size_t end = replay(1, log, replayed);
+    assert_equals(3 * record, end);
+    assert_equals((size_t)0, olm_journal_restart(
+        journal, 1, end, write_log, &log
+    ));
+    assert_equals(end, append(
+        journal, OLM_JOURNAL_DELTA, "id00", "0123456789"
+    ));
+    assert_equals(end + record, olm_journal_commit(journal));
+
+    replayed = Replayed();
+    assert_equals(end + record, replay(1, log, replayed));
+    assert_equals((size_t)4, replayed.ids.size());
+
+    olm_clear_journal(journal);
+}
+
+{
+    TestCase test_case("Journal compaction");
+
+    Log log;
+    std::vector<uint8_t> memory(olm_journal_size(4096));
+    OlmJournal * journal = olm_journal(
+        memory.data(), 4096, "key", 3, 1, 0, write_log, &log
+    );
+    append(journal, OLM_JOURNAL_DELTA, "b", "b1");
+    append(journal, OLM_JOURNAL_SNAPSHOT, "a", "A1");
+    append(journal, OLM_JOURNAL_SNAPSHOT, "c", "C1");
+    append(journal, OLM_JOURNAL_DELTA, "a", "a1");
+    append(journal, OLM_JOURNAL_SNAPSHOT, "a", "A2");
+    append(journal, OLM_JOURNAL_DELTA, "b", "b2");
+    append(journal, OLM_JOURNAL_REMOVE, "c", "");
+    append(journal, OLM_JOURNAL_DELTA, "a", "a2");
+    size_t committed = olm_journal_commit(journal);
+
+    /* the journal carries on while the log is compacted */
+    append(journal, OLM_JOURNAL_DELTA, "b", "b3");
+    append(journal, OLM_JOURNAL_SNAPSHOT, "d", "D1");
+    append(journal, OLM_JOURNAL_REMOVE, "a", "");
+
+    std::vector<uint8_t> scratch(olm_journal_compact_scratch_length(
+        log.bytes.data(), committed
+    ));
+    Log compacted;
+    compacted.bytes.resize(committed);
+    size_t compacted_length = olm_journal_compact(
+        "key", 3, 1, 0, log.bytes.data(), committed,
+        2, 0, compacted.bytes.data(), compacted.bytes.size(),
+        scratch.data(), scratch.size()
+    );
+    assert_equals(4 * olm_journal_record_length(1, 2), compacted_length);
+    compacted.bytes.resize(compacted_length);
+
+    Replayed replayed;
+    assert_equals(compacted_length, replay(2, compacted, replayed));
+    assert_equals((size_t)4, replayed.ids.size());
+    assert_equals(std::string("A2"), replayed.data[0]);
+    assert_equals(std::string("a2"), replayed.data[1]);
+    assert_equals(std::string("b1"), replayed.data[2]);
+    assert_equals(std::string("b2"), replayed.data[3]);
+
+    /* too small a scratch buffer */
+    assert_equals((size_t)-1, olm_journal_compact(
+        "key", 3, 1, 0, log.bytes.data(), committed,
+        2, 0, compacted.bytes.data(), committed,
+        scratch.data(), sizeof(size_t)
+    ));
+
+    /* then what was committed since goes on the end, and the journal moves
+     * over to the new log */
+    size_t end = olm_journal_commit(journal);
+    std::vector<uint8_t> tail(end - committed);
+    scratch.resize(olm_journal_compact_scratch_length(
+        log.bytes.data() + committed, end - committed
+    ));
+    size_t tail_length = olm_journal_compact(
+        "key", 3, 1, committed, log.bytes.data() + committed, end - committed,
+        2, compacted_length, tail.data(), tail.size(),
+        scratch.data(), scratch.size()
+    );
+    assert_equals(end - committed, tail_length);
+    compacted.bytes.insert(
+        compacted.bytes.end(), tail.begin(), tail.begin() + tail_length
+    );
+
+    append(journal, OLM_JOURNAL_DELTA, "d", "d1");
+    assert_equals(olm_journal_record_length(1, 2), olm_journal_restart(
+        journal, 2, compacted.bytes.size(), write_log, &compacted
+    ));
+    size_t final_length = olm_journal_commit(journal);
+    assert_equals(compacted.bytes.size(), final_length);
+
+    replayed = Replayed();
+    assert_equals(final_length, replay(2, compacted, replayed));
+    assert_equals((size_t)8, replayed.ids.size());
+    /* a's removal is kept, since it came after the compacted records */
+    assert_equals(std::string("a"), replayed.ids[4]);
+    assert_equals((unsigned)OLM_JOURNAL_REMOVE, replayed.types[4]);
+    assert_equals(std::string("d1"), replayed.data[7]);
+
+    /* and compacting the lot from the start drops a altogether */
+    std::vector<uint8_t> again(compacted.bytes.size());
+    scratch.resize(olm_journal_compact_scratch_length(
+        compacted.bytes.data(), compacted.bytes.size()
+    ));
+    Log twice;
+    twice.bytes.resize(olm_journal_compact(
+        "key", 3, 2, 0, compacted.bytes.data(), compacted.bytes.size(),
+        3, 0, again.data(), again.size(), scratch.data(), scratch.size()
+    ));
+    std::memcpy(twice.bytes.data(), again.data(), twice.bytes.size());
+    replayed = Replayed();
+    assert_equals(twice.bytes.size(), replay(3, twice, replayed));
+    assert_equals((size_t)5, replayed.ids.size());
+    assert_equals(std::string("b"), replayed.ids[0]);
+    assert_equals(std::string("D1"), replayed.data[3]);
+    assert_equals(std::string("d1"), replayed.data[4]);
+
+    olm_clear_journal(journal);
+}
+
+{
+    TestCase test_case("Journal appends from many threads");
+
+    static const unsigned THREADS = 4;
+    static const unsigned RECORDS = 500;
+
+    Log log;
+    size_t buffer_length = 16 * olm_journal_record_length(1, 8);
+    std::vector<uint8_t> memory(olm_journal_size(buffer_length));
+    OlmJournal * journal = olm_journal(
+        memory.data(), buffer_length, "key", 3, 1, 0, write_log, &log
+    );
+
+    std::atomic<unsigned> finished(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < THREADS; ++t) {
+        threads.emplace_back([journal, t, &finished]() {
+            std::string id(1, char('a' + t));
+            for (unsigned i = 0; i < RECORDS; ++i) {
+                char data[9];
+                std::snprintf(data, sizeof(data), "%08u", i);
+                while (append(
+                    journal, OLM_JOURNAL_DELTA, id, std::string(data, 8)
+                ) == (size_t)-1) {
+                    std::this_thread::yield();
+                }
+            }
+            finished++;
+        });
+    }
+    while (finished.load() < THREADS) {
+        olm_journal_commit(journal);
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    size_t length = olm_journal_commit(journal);
+    assert_equals(
+        THREADS * RECORDS * olm_journal_record_length(1, 8), length
+    );
+
+    Replayed replayed;
+    assert_equals(length, replay(1, log, replayed));
+    assert_equals((size_t)(THREADS * RECORDS), replayed.ids.size());
+    std::vector<unsigned> next(THREADS, 0);
+    bool in_order = true;
+    for (size_t i = 0; i < replayed.ids.size(); ++i) {
+        unsigned t = replayed.ids[i][0] - 'a';
+        char data[9];
+        std::snprintf(data, sizeof(data), "%08u", next[t]++);
+        in_order = in_order && replayed.data[i] == data;
+    }
+    assert_equals(true, in_order);
+
+    olm_clear_journal(journal);
+}
+
+}
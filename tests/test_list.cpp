@@ -13,8 +13,25 @@
  * limitations under the License.
  */
 #include "olm/list.hh"
+#include "olm/indexed_list.hh"
 #include "unittest.hh"
 
+/* a poor hash, so that the index has plenty of collisions */
+struct ModThreeTraits {
+    static std::uint32_t hash(int value) { return value % 3; }
+};
+
+typedef olm::IndexedList<int, ModThreeTraits> TestIndexedList;
+
+static int * find(TestIndexedList & list, int value) {
+    std::size_t cursor = 0;
+    return list.find(
+        ModThreeTraits::hash(value),
+        [value](int item) { return item == value; },
+        cursor
+    );
+}
+
 int main() {
 
 { /** List insert test **/
@@ -89,4 +106,62 @@ assert_equals(3, i);
 
 }
 
+{ /** Indexed list test **/
+TestCase test_case("Indexed list");
+
+alignas(int) std::uint8_t storage[TestIndexedList::storage_length(8)];
+TestIndexedList test_list(storage, 8);
+assert_equals(std::size_t(0), test_list.size());
+assert_equals(true, find(test_list, 0) == nullptr);
+
+/* the oldest items are pushed out when the list is full */
+for (int i = 0; i < 12; ++i) {
+    test_list.insert(i);
+}
+assert_equals(std::size_t(8), test_list.size());
+
+int i = 12;
+for (auto item : test_list) {
+    assert_equals(--i, item);
+}
+assert_equals(4, i);
+
+for (int i = 0; i < 12; ++i) {
+    int * item = find(test_list, i);
+    assert_equals(i >= 4, item != nullptr);
+    if (item) {
+        assert_equals(i, *item);
+    }
+}
+
+/* removing items leaves the rest in order and still findable */
+test_list.erase(find(test_list, 5));
+test_list.erase(find(test_list, 11));
+test_list.erase(find(test_list, 8));
+assert_equals(std::size_t(5), test_list.size());
+
+int const expected[] = {10, 9, 7, 6, 4};
+i = 0;
+for (auto item : test_list) {
+    assert_equals(expected[i++], item);
+}
+assert_equals(5, i);
+
+for (int value : expected) {
+    assert_equals(value, *find(test_list, value));
+}
+assert_equals(true, find(test_list, 8) == nullptr);
+
+test_list.append(100);
+i = 0;
+for (auto const & item : test_list) {
+    i++;
+    if (i == 6) {
+        assert_equals(100, item);
+    }
+}
+assert_equals(6, i);
+
+} /** Indexed list test **/
+
 }
@@ -12,11 +12,14 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include "olm/cpu.h"
 #include "olm/megolm.h"
 #include "olm/memory.hh"
 
 #include "unittest.hh"
 
+#include <vector>
+
 
 int main() {
 
@@ -131,4 +134,111 @@ std::uint8_t random_bytes[] =
     assert_equals(megolm_get_data(&mr2), megolm_get_data(&mr1), MEGOLM_RATCHET_LENGTH);
 }
 
+{
+    TestCase test_case("Megolm::advance_to matches advance");
+
+    /* a fixed xorshift generator, so that any failure can be reproduced */
+    std::uint32_t state = 0x2545F491;
+    auto next_random = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+
+    for (int i = 0; i < 40; ++i) {
+        std::uint32_t start = next_random();
+        /* start just below a carry into R(3 - carry) so that the jumps
+         * cross part boundaries, sometimes wrapping round */
+        int carry = next_random() % 4;
+        if (carry) {
+            start |= ((std::uint32_t(1) << (8 * carry)) - 1) & ~0xFFU;
+        }
+        std::uint32_t distance = next_random() % 1024;
+
+        Megolm mr1, mr2;
+        megolm_init(&mr1, random_bytes, start);
+        megolm_init(&mr2, random_bytes, start);
+
+        megolm_advance_to(&mr1, start + distance);
+        for (std::uint32_t step = 0; step < distance; ++step) {
+            megolm_advance(&mr2);
+        }
+
+        assert_equals(mr2.counter, mr1.counter);
+        assert_equals(
+            megolm_get_data(&mr2), megolm_get_data(&mr1), MEGOLM_RATCHET_LENGTH
+        );
+    }
+}
+
+{
+    TestCase test_case("Megolm::advance cost");
+
+    assert_equals(std::size_t(0), megolm_advance_cost(5, 5));
+    assert_equals(std::size_t(1), megolm_advance_cost(0, 1));
+    /* the last step of R(0) rehashes R(0)...R(3) */
+    assert_equals(std::size_t(4), megolm_advance_cost(0, 0x1000000));
+    /* 4 steps of R(1), the last bumping R(2) as well; 0x15 of R(2), the last
+     * bumping R(3); then 6 of R(3) */
+    assert_equals(
+        std::size_t(3 + 2 + 0x14 + 2 + 6),
+        megolm_advance_cost(0x1000000, 0x1041506)
+    );
+    /* going backwards wraps all the way round, stepping R(0) 256 times */
+    assert_equals(
+        std::size_t(0xFF + 4), megolm_advance_cost(0x1000001, 0x1000000)
+    );
+}
+
+
+{
+    TestCase test_case("Megolm::advance_to_batch matches advance_to");
+
+    std::uint32_t state = 0x1BADB002;
+    auto next_random = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+
+    /* distances from none to a wrap round, so that the lanes finish at very
+     * different times */
+    static const std::size_t COUNT = 37;
+    std::vector<Megolm> initial(COUNT), expected(COUNT), batch(COUNT);
+    std::vector<Megolm *> pointers(COUNT);
+    std::vector<std::uint32_t> targets(COUNT);
+    for (std::size_t i = 0; i < COUNT; ++i) {
+        std::uint32_t start = next_random();
+        switch (i % 4) {
+            case 0: targets[i] = start; break;
+            case 1: targets[i] = start + next_random() % 300; break;
+            case 2: targets[i] = start + next_random() % 0x30000; break;
+            default: targets[i] = start - 1 - next_random() % 0x100; break;
+        }
+        random_bytes[0] = std::uint8_t(i);
+        megolm_init(&initial[i], random_bytes, start);
+        expected[i] = initial[i];
+        megolm_advance_to(&expected[i], targets[i]);
+        pointers[i] = &batch[i];
+    }
+
+    /* with the vector kernel, if there is one, and without */
+    static const std::uint32_t masks[] = {~OLM_CPU_FEATURE_SHA256, ~0u};
+    for (std::uint32_t mask : masks) {
+        _olm_cpu_set_feature_mask(mask);
+        batch = initial;
+        megolm_advance_to_batch(pointers.data(), targets.data(), COUNT);
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            assert_equals(expected[i].counter, batch[i].counter);
+            assert_equals(
+                megolm_get_data(&expected[i]), megolm_get_data(&batch[i]),
+                MEGOLM_RATCHET_LENGTH
+            );
+        }
+    }
+    _olm_cpu_set_feature_mask(~0u);
+}
+
 }
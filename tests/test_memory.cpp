@@ -0,0 +1,64 @@
+/* Copyright 2015 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/memory.hh"
+#include "unittest.hh"
+
+int main() {
+
+{ /** is_equal test **/
+
+TestCase test_case("is_equal");
+
+/* lengths that use the vector, the word and the byte loops, with a
+ * difference in each position */
+std::uint8_t a[40], b[40];
+for (std::size_t i = 0; i < sizeof(a); ++i) {
+    a[i] = b[i] = std::uint8_t(i * 7);
+}
+for (std::size_t length = 0; length <= sizeof(a); ++length) {
+    assert_equals(true, olm::is_equal(a, b, length));
+    for (std::size_t i = 0; i < length; ++i) {
+        b[i] ^= 0x80;
+        assert_equals(false, olm::is_equal(a, b, length));
+        b[i] ^= 0x80;
+    }
+}
+/* unaligned buffers */
+assert_equals(true, olm::is_equal(a + 1, b + 1, 33));
+b[33] = 0;
+assert_equals(false, olm::is_equal(a + 1, b + 1, 33));
+
+}
+
+{ /** unset test **/
+
+TestCase test_case("unset");
+
+std::uint8_t buffer[37];
+for (std::size_t i = 0; i < sizeof(buffer); ++i) {
+    buffer[i] = 0xff;
+}
+olm::unset(buffer + 1, 35);
+assert_equals(std::uint8_t(0xff), buffer[0]);
+assert_equals(std::uint8_t(0xff), buffer[36]);
+for (std::size_t i = 1; i < 36; ++i) {
+    assert_equals(std::uint8_t(0), buffer[i]);
+}
+olm::unset(buffer, 0);
+assert_equals(std::uint8_t(0xff), buffer[0]);
+
+}
+
+}
@@ -13,8 +13,11 @@
  * limitations under the License.
  */
 #include "olm/message.hh"
+#include "olm/base64.hh"
 #include "unittest.hh"
 
+#include <vector>
+
 int main() {
 
 std::uint8_t message1[36] = "\x03\x10\x01\n\nratchetkey\"\nciphertexthmacsha2";
@@ -109,4 +112,106 @@ assert_equals(message2, output, 35);
     assert_equals(std::size_t(10), results.ciphertext_length);
     assert_equals(ciphertext, results.ciphertext, 10);
 } /* group message decode test */
+
+{ /* Message peek test */
+
+TestCase test_case("Message peek test");
+
+/* the same message, in either order, with an unknown varint field, and with
+ * a ciphertext that runs past the end */
+std::uint8_t message3[] = "\x03\x18\x85\x01\x10\x01\n\nratchetkey\"\nciphertexthmacsha2";
+std::uint8_t message4[] = "\x03\x10\x01\n\nratchetkey\"\x7f" "ciphertexthmacsha2";
+std::uint8_t * messages[] = {message1, message2, message3, message4};
+std::size_t lengths[] = {35, 35, sizeof(message3) - 1, sizeof(message4) - 1};
+
+for (unsigned i = 0; i < 4; ++i) {
+    std::vector<std::uint8_t> encoded(olm::encode_base64_length(lengths[i]));
+    olm::encode_base64(messages[i], lengths[i], encoded.data());
+    std::vector<std::uint8_t> copy(encoded);
+
+    olm::MessageReader reader;
+    olm::decode_message(reader, messages[i], lengths[i], 8);
+    _OlmPeekMessageResults results;
+    olm::peek_message(results, encoded.data(), encoded.size(), 8);
+
+    assert_equals(reader.version, results.version);
+    assert_equals(reader.ciphertext != nullptr, bool(results.has_ciphertext));
+    assert_equals(reader.ciphertext_length, results.ciphertext_length);
+    assert_equals(true, copy == encoded);
+}
+
+/* a pre-key message wrapping message1 */
+std::uint8_t pre_key_message[] =
+    "\x03\n\x03key\x42\x01x\"\x23"
+    "\x03\x10\x01\n\nratchetkey\"\nciphertexthmacsha2";
+std::vector<std::uint8_t> encoded(
+    olm::encode_base64_length(sizeof(pre_key_message) - 1)
+);
+olm::encode_base64(pre_key_message, sizeof(pre_key_message) - 1, encoded.data());
+_OlmPeekMessageResults results;
+olm::peek_one_time_key_message(results, encoded.data(), encoded.size(), 8);
+assert_equals(std::uint8_t(3), results.version);
+assert_equals(1, results.has_ciphertext);
+assert_equals(std::size_t(10), results.ciphertext_length);
+
+} /* Message peek test */
+
+{
+    TestCase test_case("Group message peek test");
+
+    std::uint8_t message[] =
+        "\x03"
+        "\x08\xC8\x01"
+        "\x12\x0A" "ciphertext"
+        "hmacsha2"
+        "ed25519signature";
+    std::vector<std::uint8_t> encoded(
+        olm::encode_base64_length(sizeof(message) - 1)
+    );
+    olm::encode_base64(message, sizeof(message) - 1, encoded.data());
+
+    struct _OlmPeekMessageResults results;
+    _olm_peek_group_message(encoded.data(), encoded.size(), 8, 16, &results);
+    assert_equals(std::uint8_t(3), results.version);
+    assert_equals(1, results.has_ciphertext);
+    assert_equals(std::size_t(10), results.ciphertext_length);
+
+    /* too short to hold the mac and signature */
+    _olm_peek_group_message(encoded.data(), 20, 8, 16, &results);
+    assert_equals(0, results.has_ciphertext);
+} /* group message peek test */
+
+{ /* Message varint decode test */
+
+TestCase test_case("Message varint decode test");
+
+std::uint32_t counters[] = {0, 127, 128, 300, 16383, 16384, 0xFFFFFFFF};
+for (std::uint32_t counter : counters) {
+    std::size_t length = olm::encode_message_length(counter, 10, 200, 8);
+    std::uint8_t output[length];
+    olm::MessageWriter writer;
+    olm::encode_message(writer, 3, counter, 10, 200, output);
+
+    olm::MessageReader reader;
+    olm::decode_message(reader, output, length, 8);
+    assert_equals(true, reader.has_counter);
+    assert_equals(counter, reader.counter);
+    assert_equals(std::size_t(10), reader.ratchet_key_length);
+    assert_equals(std::size_t(200), reader.ciphertext_length);
+}
+
+/* bits beyond 32 are dropped from an over-long counter */
+std::uint8_t overlong[] = "\x03\x10\x81\x80\x80\x80\x80\x01";
+olm::MessageReader reader;
+olm::decode_message(reader, overlong, sizeof(overlong) - 1, 0);
+assert_equals(true, reader.has_counter);
+assert_equals(std::uint32_t(1), reader.counter);
+
+/* a counter that runs off the end is decoded from what is there */
+std::uint8_t truncated[] = "\x03\x10\x81\x81";
+olm::decode_message(reader, truncated, sizeof(truncated) - 1, 0);
+assert_equals(true, reader.has_counter);
+assert_equals(std::uint32_t(129), reader.counter);
+
+} /* Message varint decode test */
 }
@@ -1,9 +1,16 @@
 #include "olm/olm.h"
+#include "olm/base64.hh"
+#include "olm/cpu.h"
+#include "olm/pickle_encoding.h"
+#include "olm/pool.h"
 #include "unittest.hh"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <string>
+#include <vector>
 
 struct MockRandom {
     MockRandom(std::uint8_t tag, std::uint8_t offset = 0)
@@ -28,6 +35,39 @@ struct MockRandom {
     std::uint8_t current;
 };
 
+/* Collects a streamed pickle, or fails once it has been given limit bytes */
+struct VectorWriter {
+    std::vector<std::uint8_t> data;
+    std::size_t limit;
+};
+
+int write_to_vector(void * context, void const * data, std::size_t length) {
+    VectorWriter & writer = *static_cast<VectorWriter *>(context);
+    if (writer.data.size() + length > writer.limit) {
+        return 1;
+    }
+    std::uint8_t const * bytes = static_cast<std::uint8_t const *>(data);
+    writer.data.insert(writer.data.end(), bytes, bytes + length);
+    return 0;
+}
+
+/* Hands out a pickle a few bytes at a time */
+struct ChunkReader {
+    std::uint8_t const * data;
+    std::size_t length;
+    std::size_t chunk;
+};
+
+std::size_t read_chunks(void * context, void * data, std::size_t max_length) {
+    ChunkReader & reader = *static_cast<ChunkReader *>(context);
+    std::size_t length = std::min(reader.chunk, max_length);
+    length = std::min(length, reader.length);
+    std::memcpy(data, reader.data, length);
+    reader.data += length;
+    reader.length -= length;
+    return length;
+}
+
 int main() {
 
 { /** Pickle account test */
@@ -132,6 +172,9 @@ std::memcpy(pickle2, pickle1, pickle_length);
 
 std::uint8_t session_buffer2[::olm_session_size()];
 ::OlmSession *session2 = ::olm_session(session_buffer2);
+// the remembered ID of the empty session is forgotten when it is unpickled
+std::uint8_t id[32], id2[32];
+::olm_session_id_binary(session2, id2, sizeof(id2));
 assert_not_equals(std::size_t(-1), ::olm_unpickle_session(
     session2, "secret_key", 10, pickle2, pickle_length
 ));
@@ -140,266 +183,4194 @@ res = ::olm_pickle_session(session2, "secret_key", 10, pickle2, pickle_length);
 assert_equals(pickle_length, res);
 
 assert_equals(pickle1, pickle2, pickle_length);
+::olm_session_id_binary(session, id, sizeof(id));
+::olm_session_id_binary(session2, id2, sizeof(id2));
+assert_equals(id, id2, sizeof(id));
 }
 
-{ /** Loopback test */
-
-TestCase test_case("Loopback test");
-MockRandom mock_random_a('A', 0x00);
-MockRandom mock_random_b('B', 0x80);
+{ /** Binary pickle test */
 
-std::uint8_t a_account_buffer[::olm_account_size()];
-::OlmAccount *a_account = ::olm_account(a_account_buffer);
-std::uint8_t a_random[::olm_create_account_random_length(a_account)];
-mock_random_a(a_random, sizeof(a_random));
-::olm_create_account(a_account, a_random, sizeof(a_random));
+TestCase test_case("Binary pickle test");
+MockRandom mock_random('P');
 
-std::uint8_t b_account_buffer[::olm_account_size()];
-::OlmAccount *b_account = ::olm_account(b_account_buffer);
-std::uint8_t b_random[::olm_create_account_random_length(b_account)];
-mock_random_b(b_random, sizeof(b_random));
-::olm_create_account(b_account, b_random, sizeof(b_random));
-std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
-        b_account, 42
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
+std::uint8_t ot_random[::olm_account_generate_one_time_keys_random_length(
+    account, 42
 )];
-mock_random_b(o_random, sizeof(o_random));
-::olm_account_generate_one_time_keys(b_account, 42, o_random, sizeof(o_random));
+mock_random(ot_random, sizeof(ot_random));
+::olm_account_generate_one_time_keys(account, 42, ot_random, sizeof(ot_random));
 
-std::uint8_t a_id_keys[::olm_account_identity_keys_length(a_account)];
-::olm_account_identity_keys(a_account, a_id_keys, sizeof(a_id_keys));
+std::size_t pickle_length = ::olm_pickle_account_length(account);
+std::size_t binary_length = ::olm_pickle_account_binary_length(account);
+assert_equals(true, binary_length < pickle_length);
 
-std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
-std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
-::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
-::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+std::uint8_t pickle1[pickle_length];
+::olm_pickle_account(account, "secret_key", 10, pickle1, pickle_length);
 
-std::uint8_t a_session_buffer[::olm_session_size()];
-::OlmSession *a_session = ::olm_session(a_session_buffer);
-std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
-mock_random_a(a_rand, sizeof(a_rand));
-assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
-    a_session, a_account,
-    b_id_keys + 15, 43, // B's curve25519 identity key
-    b_ot_keys + 25, 43, // B's curve25519 one time key
-    a_rand, sizeof(a_rand)
+std::uint8_t binary[binary_length];
+assert_equals(std::size_t(-1), ::olm_pickle_account_binary(
+    account, "secret_key", 10, binary, binary_length - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_account_last_error(account))
+);
+assert_equals(binary_length, ::olm_pickle_account_binary(
+    account, "secret_key", 10, binary, binary_length
 ));
 
-std::uint8_t plaintext[] = "Hello, World";
-std::uint8_t message_1[::olm_encrypt_message_length(a_session, 12)];
-std::uint8_t a_message_random[::olm_encrypt_random_length(a_session)];
-mock_random_a(a_message_random, sizeof(a_message_random));
-assert_equals(std::size_t(0), ::olm_encrypt_message_type(a_session));
-assert_not_equals(std::size_t(-1), ::olm_encrypt(
-    a_session,
-    plaintext, 12,
-    a_message_random, sizeof(a_message_random),
-    message_1, sizeof(message_1)
+std::uint8_t binary2[binary_length];
+std::memcpy(binary2, binary, binary_length);
+std::uint8_t account_buffer2[::olm_account_size()];
+::OlmAccount *account2 = ::olm_account(account_buffer2);
+assert_equals(std::size_t(-1), ::olm_unpickle_account_binary(
+    account2, "wrong_key!", 10, binary2, binary_length
 ));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_account_last_error(account2))
+);
 
+std::memcpy(binary2, binary, binary_length);
+account2 = ::olm_account(account_buffer2);
+assert_equals(binary_length, ::olm_unpickle_account_binary(
+    account2, "secret_key", 10, binary2, binary_length
+));
 
-std::uint8_t tmp_message_1[sizeof(message_1)];
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-std::uint8_t b_session_buffer[::olm_account_size()];
-::OlmSession *b_session = ::olm_session(b_session_buffer);
-::olm_create_inbound_session(
-    b_session, b_account, tmp_message_1, sizeof(message_1)
+/* the account loaded from the binary pickle is the same account */
+std::uint8_t pickle2[pickle_length];
+::olm_pickle_account(account2, "secret_key", 10, pickle2, pickle_length);
+assert_equals(pickle1, pickle2, pickle_length);
+
+std::uint8_t session_buffer[::olm_session_size()];
+::OlmSession *session = ::olm_session(session_buffer);
+std::uint8_t identity_key[32];
+std::uint8_t one_time_key[32];
+mock_random(identity_key, sizeof(identity_key));
+mock_random(one_time_key, sizeof(one_time_key));
+std::uint8_t random2[::olm_create_outbound_session_random_length(session)];
+mock_random(random2, sizeof(random2));
+::olm_create_outbound_session(
+    session, account,
+    identity_key, sizeof(identity_key),
+    one_time_key, sizeof(one_time_key),
+    random2, sizeof(random2)
 );
 
-// Check that the inbound session matches the message it was created from.
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-assert_equals(std::size_t(1), ::olm_matches_inbound_session(
-    b_session,
-    tmp_message_1, sizeof(message_1)
-));
+std::size_t session_pickle_length = ::olm_pickle_session_length(session);
+std::size_t session_binary_length = ::olm_pickle_session_binary_length(session);
+assert_equals(true, session_binary_length < session_pickle_length);
 
-// Check that the inbound session matches the key this message is supposed
-// to be from.
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-assert_equals(std::size_t(1), ::olm_matches_inbound_session_from(
-    b_session,
-    a_id_keys + 15, 43, // A's curve125519 identity key.
-    tmp_message_1, sizeof(message_1)
+std::uint8_t session_pickle1[session_pickle_length];
+::olm_pickle_session(
+    session, "secret_key", 10, session_pickle1, session_pickle_length
+);
+std::uint8_t session_binary[session_binary_length];
+assert_equals(session_binary_length, ::olm_pickle_session_binary(
+    session, "secret_key", 10, session_binary, session_binary_length
 ));
 
-// Check that the inbound session isn't from a different user.
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-assert_equals(std::size_t(0), ::olm_matches_inbound_session_from(
-    b_session,
-    b_id_keys + 15, 43, // B's curve25519 identity key.
-    tmp_message_1, sizeof(message_1)
+std::uint8_t session_buffer2[::olm_session_size()];
+::OlmSession *session2 = ::olm_session(session_buffer2);
+assert_equals(session_binary_length, ::olm_unpickle_session_binary(
+    session2, "secret_key", 10, session_binary, session_binary_length
 ));
+std::uint8_t session_pickle2[session_pickle_length];
+::olm_pickle_session(
+    session2, "secret_key", 10, session_pickle2, session_pickle_length
+);
+assert_equals(session_pickle1, session_pickle2, session_pickle_length);
+}
 
-// Check that we can decrypt the message.
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-std::uint8_t plaintext_1[::olm_decrypt_max_plaintext_length(
-    b_session, 0, tmp_message_1, sizeof(message_1)
-)];
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-assert_equals(std::size_t(12), ::olm_decrypt(
-    b_session, 0,
-    tmp_message_1, sizeof(message_1),
-    plaintext_1, sizeof(plaintext_1)
-));
+{ /** Session pickle batch test */
 
-assert_equals(plaintext, plaintext_1, 12);
+TestCase test_case("Session pickle batch test");
+MockRandom mock_random('Q');
 
-std::uint8_t message_2[::olm_encrypt_message_length(b_session, 12)];
-std::uint8_t b_message_random[::olm_encrypt_random_length(b_session)];
-mock_random_b(b_message_random, sizeof(b_message_random));
-assert_equals(std::size_t(1), ::olm_encrypt_message_type(b_session));
-assert_not_equals(std::size_t(-1), ::olm_encrypt(
-    b_session,
-    plaintext, 12,
-    b_message_random, sizeof(b_message_random),
-    message_2, sizeof(message_2)
-));
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
 
-std::uint8_t tmp_message_2[sizeof(message_2)];
-std::memcpy(tmp_message_2, message_2, sizeof(message_2));
-std::uint8_t plaintext_2[::olm_decrypt_max_plaintext_length(
-    a_session, 1, tmp_message_2, sizeof(message_2)
-)];
-std::memcpy(tmp_message_2, message_2, sizeof(message_2));
-assert_equals(std::size_t(12), ::olm_decrypt(
-    a_session, 1,
-    tmp_message_2, sizeof(message_2),
-    plaintext_2, sizeof(plaintext_2)
-));
+std::uint8_t session_buffers[3][::olm_session_size()];
+::OlmSession *sessions[3];
+for (unsigned i = 0; i < 3; ++i) {
+    sessions[i] = ::olm_session(session_buffers[i]);
+    std::uint8_t identity_key[32];
+    std::uint8_t one_time_key[32];
+    mock_random(identity_key, sizeof(identity_key));
+    mock_random(one_time_key, sizeof(one_time_key));
+    std::uint8_t random2[::olm_create_outbound_session_random_length(
+        sessions[i]
+    )];
+    mock_random(random2, sizeof(random2));
+    ::olm_create_outbound_session(
+        sessions[i], account,
+        identity_key, sizeof(identity_key),
+        one_time_key, sizeof(one_time_key),
+        random2, sizeof(random2)
+    );
+}
 
-assert_equals(plaintext, plaintext_2, 12);
+std::uint8_t key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *key = ::olm_pickle_key(key_buffer, "secret_key", 10);
 
-std::memcpy(tmp_message_2, message_2, sizeof(message_2));
-assert_equals(std::size_t(-1), ::olm_decrypt(
-    a_session, 1,
-    tmp_message_2, sizeof(message_2),
-    plaintext_2, sizeof(plaintext_2)
+std::size_t batch_length = ::olm_pickle_session_batch_length(sessions, 3);
+std::uint8_t batch[batch_length];
+assert_equals(batch_length, ::olm_pickle_session_batch(
+    key, sessions, 3, batch, batch_length
 ));
+assert_equals(std::size_t(3), ::olm_pickle_batch_count(batch, batch_length));
 
-std::uint8_t a_session_id[::olm_session_id_length(a_session)];
-assert_not_equals(std::size_t(-1), ::olm_session_id(
-    a_session, a_session_id, sizeof(a_session_id)
+std::uint8_t session_buffers2[3][::olm_session_size()];
+::OlmSession *sessions2[3];
+for (unsigned i = 0; i < 3; ++i) {
+    sessions2[i] = ::olm_session(session_buffers2[i]);
+}
+assert_equals(std::size_t(1), ::olm_unpickle_session_batch(
+    key, batch, batch_length, 2, sessions2 + 2, 1
 ));
-
-std::uint8_t b_session_id[::olm_session_id_length(b_session)];
-assert_not_equals(std::size_t(-1), ::olm_session_id(
-    b_session, b_session_id, sizeof(b_session_id)
+assert_equals(std::size_t(2), ::olm_unpickle_session_batch(
+    key, batch, batch_length, 0, sessions2, 2
 ));
 
-assert_equals(sizeof(a_session_id), sizeof(b_session_id));
-assert_equals(a_session_id, b_session_id, sizeof(b_session_id));
-
+/* the sessions loaded from the batch are the same sessions */
+for (unsigned i = 0; i < 3; ++i) {
+    std::size_t pickle_length = ::olm_pickle_session_length(sessions[i]);
+    std::uint8_t pickle1[pickle_length];
+    std::uint8_t pickle2[pickle_length];
+    ::olm_pickle_session(sessions[i], "secret_key", 10, pickle1, pickle_length);
+    ::olm_pickle_session(sessions2[i], "secret_key", 10, pickle2, pickle_length);
+    assert_equals(pickle1, pickle2, pickle_length);
 }
 
-{ /** More messages test */
+/* a batch isn't a session pickle */
+::olm_pickle_session_batch(key, sessions, 3, batch, batch_length);
+assert_equals(std::size_t(-1), ::olm_unpickle_session_binary(
+    sessions2[0], "secret_key", 10, batch, batch_length
+));
+::olm_clear_pickle_key(key);
+}
 
-TestCase test_case("More messages test");
-MockRandom mock_random_a('A', 0x00);
-MockRandom mock_random_b('B', 0x80);
+{ /** Streamed pickle test */
 
-std::uint8_t a_account_buffer[::olm_account_size()];
-::OlmAccount *a_account = ::olm_account(a_account_buffer);
-std::uint8_t a_random[::olm_create_account_random_length(a_account)];
-mock_random_a(a_random, sizeof(a_random));
-::olm_create_account(a_account, a_random, sizeof(a_random));
+TestCase test_case("Streamed pickle test");
+MockRandom mock_random('S');
 
-std::uint8_t b_account_buffer[::olm_account_size()];
-::OlmAccount *b_account = ::olm_account(b_account_buffer);
-std::uint8_t b_random[::olm_create_account_random_length(b_account)];
-mock_random_b(b_random, sizeof(b_random));
-::olm_create_account(b_account, b_random, sizeof(b_random));
-std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
-        b_account, 42
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
+std::uint8_t ot_random[::olm_account_generate_one_time_keys_random_length(
+    account, 42
 )];
-mock_random_b(o_random, sizeof(o_random));
-::olm_account_generate_one_time_keys(b_account, 42, o_random, sizeof(o_random));
+mock_random(ot_random, sizeof(ot_random));
+::olm_account_generate_one_time_keys(account, 42, ot_random, sizeof(ot_random));
 
-std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
-std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
-::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
-::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+std::size_t scratch_length = ::olm_pickle_account_stream_scratch_length(
+    account
+);
+std::size_t binary_length = ::olm_pickle_account_binary_length(account);
+std::vector<std::uint8_t> scratch(scratch_length);
 
-std::uint8_t a_session_buffer[::olm_session_size()];
-::OlmSession *a_session = ::olm_session(a_session_buffer);
-std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
-mock_random_a(a_rand, sizeof(a_rand));
-assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
-    a_session, a_account,
-    b_id_keys + 15, 43,
-    b_ot_keys + 25, 43,
-    a_rand, sizeof(a_rand)
+/* the streamed pickle is the binary pickle */
+std::vector<std::uint8_t> binary(binary_length);
+::olm_pickle_account_binary(
+    account, "secret_key", 10, binary.data(), binary_length
+);
+VectorWriter writer = {{}, std::size_t(-1)};
+assert_equals(binary_length, ::olm_pickle_account_stream(
+    account, "secret_key", 10, write_to_vector, &writer,
+    scratch.data(), scratch_length
 ));
+assert_equals(binary_length, writer.data.size());
+assert_equals(binary.data(), writer.data.data(), binary_length);
 
-std::uint8_t plaintext[] = "Hello, World";
-std::uint8_t message_1[::olm_encrypt_message_length(a_session, 12)];
-std::uint8_t a_message_random[::olm_encrypt_random_length(a_session)];
-mock_random_a(a_message_random, sizeof(a_message_random));
-assert_equals(std::size_t(0), ::olm_encrypt_message_type(a_session));
-assert_not_equals(std::size_t(-1), ::olm_encrypt(
-    a_session,
-    plaintext, 12,
-    a_message_random, sizeof(a_message_random),
-    message_1, sizeof(message_1)
+VectorWriter failing_writer = {{}, 100};
+assert_equals(std::size_t(-1), ::olm_pickle_account_stream(
+    account, "secret_key", 10, write_to_vector, &failing_writer,
+    scratch.data(), scratch_length
 ));
+assert_equals(
+    std::string("PICKLE_STREAM_FAILED"),
+    std::string(::olm_account_last_error(account))
+);
 
-std::uint8_t tmp_message_1[sizeof(message_1)];
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-std::uint8_t b_session_buffer[::olm_account_size()];
-::OlmSession *b_session = ::olm_session(b_session_buffer);
-::olm_create_inbound_session(
-    b_session, b_account, tmp_message_1, sizeof(message_1)
+std::uint8_t account_buffer2[::olm_account_size()];
+::OlmAccount *account2 = ::olm_account(account_buffer2);
+ChunkReader reader = {binary.data(), binary_length, 7};
+assert_equals(std::size_t(-1), ::olm_unpickle_account_stream(
+    account2, "wrong_key!", 10, read_chunks, &reader,
+    scratch.data(), scratch_length
+));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_account_last_error(account2))
 );
 
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-std::uint8_t plaintext_1[::olm_decrypt_max_plaintext_length(
-    b_session, 0, tmp_message_1, sizeof(message_1)
-)];
-std::memcpy(tmp_message_1, message_1, sizeof(message_1));
-assert_equals(std::size_t(12), ::olm_decrypt(
-    b_session, 0,
-    tmp_message_1, sizeof(message_1),
-    plaintext_1, sizeof(plaintext_1)
+reader = {binary.data(), binary_length, 7};
+assert_equals(std::size_t(-1), ::olm_unpickle_account_stream(
+    account2, "secret_key", 10, read_chunks, &reader,
+    scratch.data(), binary_length / 2
 ));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_account_last_error(account2))
+);
 
-for (unsigned i = 0; i < 8; ++i) {
-    {
-    std::uint8_t msg_a[::olm_encrypt_message_length(a_session, 12)];
-    std::uint8_t rnd_a[::olm_encrypt_random_length(a_session)];
-    mock_random_a(rnd_a, sizeof(rnd_a));
-    std::size_t type_a = ::olm_encrypt_message_type(a_session);
-    assert_not_equals(std::size_t(-1), ::olm_encrypt(
+reader = {binary.data(), binary_length - 1, 7};
+assert_equals(std::size_t(-1), ::olm_unpickle_account_stream(
+    account2, "secret_key", 10, read_chunks, &reader,
+    scratch.data(), scratch_length
+));
+assert_equals(
+    std::string("CORRUPTED_PICKLE"),
+    std::string(::olm_account_last_error(account2))
+);
+
+account2 = ::olm_account(account_buffer2);
+reader = {writer.data.data(), writer.data.size(), 7};
+assert_equals(binary_length, ::olm_unpickle_account_stream(
+    account2, "secret_key", 10, read_chunks, &reader,
+    scratch.data(), scratch_length
+));
+std::size_t pickle_length = ::olm_pickle_account_length(account);
+std::vector<std::uint8_t> pickle1(pickle_length), pickle2(pickle_length);
+::olm_pickle_account(account, "secret_key", 10, pickle1.data(), pickle_length);
+::olm_pickle_account(account2, "secret_key", 10, pickle2.data(), pickle_length);
+assert_equals(pickle1.data(), pickle2.data(), pickle_length);
+
+/* a batch of sessions is streamed through scratch memory for one session */
+std::uint8_t session_buffers[3][::olm_session_size()];
+::OlmSession *sessions[3];
+for (unsigned i = 0; i < 3; ++i) {
+    sessions[i] = ::olm_session(session_buffers[i]);
+    std::uint8_t identity_key[32];
+    std::uint8_t one_time_key[32];
+    mock_random(identity_key, sizeof(identity_key));
+    mock_random(one_time_key, sizeof(one_time_key));
+    std::uint8_t random2[::olm_create_outbound_session_random_length(
+        sessions[i]
+    )];
+    mock_random(random2, sizeof(random2));
+    ::olm_create_outbound_session(
+        sessions[i], account,
+        identity_key, sizeof(identity_key),
+        one_time_key, sizeof(one_time_key),
+        random2, sizeof(random2)
+    );
+}
+
+std::uint8_t key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *key = ::olm_pickle_key(key_buffer, "secret_key", 10);
+
+std::size_t batch_length = ::olm_pickle_session_batch_length(sessions, 3);
+std::vector<std::uint8_t> batch(batch_length);
+::olm_pickle_session_batch(key, sessions, 3, batch.data(), batch_length);
+
+std::size_t session_scratch_length =
+    ::olm_pickle_session_stream_scratch_length(sessions[0]);
+std::vector<std::uint8_t> session_scratch(session_scratch_length);
+VectorWriter batch_writer = {{}, std::size_t(-1)};
+assert_equals(batch_length, ::olm_pickle_session_batch_stream(
+    key, sessions, 3, write_to_vector, &batch_writer,
+    session_scratch.data(), session_scratch_length
+));
+assert_equals(batch.data(), batch_writer.data.data(), batch_length);
+
+std::uint8_t session_buffers2[2][::olm_session_size()];
+::OlmSession *sessions2[2];
+for (unsigned i = 0; i < 2; ++i) {
+    sessions2[i] = ::olm_session(session_buffers2[i]);
+}
+reader = {batch.data(), batch_length, 5};
+assert_equals(std::size_t(2), ::olm_unpickle_session_batch_stream(
+    key, read_chunks, &reader,
+    session_scratch.data(), session_scratch_length, sessions2, 2
+));
+/* nothing after the last session asked for is read */
+assert_equals(
+    ::olm_pickle_session_binary_length(sessions[2]) + 4, reader.length
+);
+for (unsigned i = 0; i < 2; ++i) {
+    std::size_t length = ::olm_pickle_session_length(sessions[i]);
+    std::vector<std::uint8_t> session_pickle1(length), session_pickle2(length);
+    ::olm_pickle_session(
+        sessions[i], "secret_key", 10, session_pickle1.data(), length
+    );
+    ::olm_pickle_session(
+        sessions2[i], "secret_key", 10, session_pickle2.data(), length
+    );
+    assert_equals(session_pickle1.data(), session_pickle2.data(), length);
+}
+
+std::uint8_t session_buffer3[::olm_session_size()];
+::OlmSession *session3 = ::olm_session(session_buffer3);
+reader = {batch.data(), 8, 5};
+::OlmSession *too_many[4] = {session3, session3, session3, session3};
+assert_equals(std::size_t(-1), ::olm_unpickle_session_batch_stream(
+    key, read_chunks, &reader,
+    session_scratch.data(), session_scratch_length, too_many, 4
+));
+assert_equals(
+    std::string("CORRUPTED_PICKLE"),
+    std::string(::olm_session_last_error(session3))
+);
+::olm_clear_pickle_key(key);
+}
+
+{ /** Const unpickle test */
+
+TestCase test_case("Const unpickle test");
+MockRandom mock_random('K');
+
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
+std::uint8_t ot_random[::olm_account_generate_one_time_keys_random_length(
+    account, 5
+)];
+mock_random(ot_random, sizeof(ot_random));
+::olm_account_generate_one_time_keys(account, 5, ot_random, sizeof(ot_random));
+
+std::size_t pickle_length = ::olm_pickle_account_length(account);
+std::vector<std::uint8_t> pickle(pickle_length), pickle2(pickle_length);
+::olm_pickle_account(account, "secret_key", 10, pickle.data(), pickle_length);
+std::vector<std::uint8_t> original(pickle);
+std::vector<std::uint8_t> scratch(pickle_length);
+
+std::uint8_t account_buffer2[::olm_account_size()];
+::OlmAccount *account2 = ::olm_account(account_buffer2);
+assert_equals(std::size_t(-1), ::olm_unpickle_account_const(
+    account2, "secret_key", 10, pickle.data(), pickle_length,
+    scratch.data(), pickle_length - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_account_last_error(account2))
+);
+assert_equals(std::size_t(-1), ::olm_unpickle_account_const(
+    account2, "wrong_key!", 10, pickle.data(), pickle_length,
+    scratch.data(), pickle_length
+));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_account_last_error(account2))
+);
+
+/* the pickle is left as it was, and can be loaded again */
+for (unsigned i = 0; i < 2; ++i) {
+    account2 = ::olm_account(account_buffer2);
+    assert_equals(pickle_length, ::olm_unpickle_account_const(
+        account2, "secret_key", 10, pickle.data(), pickle_length,
+        scratch.data(), pickle_length
+    ));
+    assert_equals(original.data(), pickle.data(), pickle_length);
+    ::olm_pickle_account(
+        account2, "secret_key", 10, pickle2.data(), pickle_length
+    );
+    assert_equals(pickle.data(), pickle2.data(), pickle_length);
+}
+
+std::size_t binary_length = ::olm_pickle_account_binary_length(account);
+std::vector<std::uint8_t> binary(binary_length);
+::olm_pickle_account_binary(
+    account, "secret_key", 10, binary.data(), binary_length
+);
+std::vector<std::uint8_t> binary_original(binary);
+account2 = ::olm_account(account_buffer2);
+assert_equals(binary_length, ::olm_unpickle_account_binary_const(
+    account2, "secret_key", 10, binary.data(), binary_length,
+    scratch.data(), binary_length
+));
+assert_equals(binary_original.data(), binary.data(), binary_length);
+::olm_pickle_account(account2, "secret_key", 10, pickle2.data(), pickle_length);
+assert_equals(pickle.data(), pickle2.data(), pickle_length);
+
+/* AES-GCM pickles are decoded into the scratch memory too */
+std::uint8_t session_buffer[::olm_session_size()];
+::OlmSession *session = ::olm_session(session_buffer);
+std::uint8_t identity_key[32];
+std::uint8_t one_time_key[32];
+mock_random(identity_key, sizeof(identity_key));
+mock_random(one_time_key, sizeof(one_time_key));
+std::uint8_t random2[::olm_create_outbound_session_random_length(session)];
+mock_random(random2, sizeof(random2));
+::olm_create_outbound_session(
+    session, account,
+    identity_key, sizeof(identity_key),
+    one_time_key, sizeof(one_time_key),
+    random2, sizeof(random2)
+);
+std::uint8_t key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *key = ::olm_pickle_key(key_buffer, "secret_key", 10);
+std::size_t gcm_length = ::olm_pickle_session_with_key_length(
+    session, OLM_PICKLE_CIPHER_AES_GCM
+);
+std::vector<std::uint8_t> gcm_pickle(gcm_length);
+::olm_pickle_session_with_key(
+    session, key, OLM_PICKLE_CIPHER_AES_GCM, gcm_pickle.data(), gcm_length
+);
+std::vector<std::uint8_t> gcm_original(gcm_pickle);
+std::vector<std::uint8_t> session_scratch(gcm_length);
+std::uint8_t session_buffer2[::olm_session_size()];
+::OlmSession *session2 = ::olm_session(session_buffer2);
+assert_equals(gcm_length, ::olm_unpickle_session_const(
+    session2, "secret_key", 10, gcm_pickle.data(), gcm_length,
+    session_scratch.data(), gcm_length
+));
+assert_equals(gcm_original.data(), gcm_pickle.data(), gcm_length);
+std::size_t session_pickle_length = ::olm_pickle_session_length(session);
+std::vector<std::uint8_t> session_pickle1(session_pickle_length);
+std::vector<std::uint8_t> session_pickle2(session_pickle_length);
+::olm_pickle_session(
+    session, "secret_key", 10, session_pickle1.data(), session_pickle_length
+);
+::olm_pickle_session(
+    session2, "secret_key", 10, session_pickle2.data(), session_pickle_length
+);
+assert_equals(
+    session_pickle1.data(), session_pickle2.data(), session_pickle_length
+);
+::olm_clear_pickle_key(key);
+}
+
+{ /** Hibernate session test */
+
+TestCase test_case("Hibernate session test");
+MockRandom mock_random('H');
+
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
+
+std::uint8_t session_buffer[::olm_session_size()];
+::OlmSession *session = ::olm_session(session_buffer);
+std::uint8_t raw_keys[64];
+mock_random(raw_keys, sizeof(raw_keys));
+std::uint8_t identity_key[43];
+std::uint8_t one_time_key[43];
+olm::encode_base64(raw_keys, 32, identity_key);
+olm::encode_base64(raw_keys + 32, 32, one_time_key);
+std::uint8_t random2[::olm_create_outbound_session_random_length(session)];
+mock_random(random2, sizeof(random2));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    session, account,
+    identity_key, sizeof(identity_key),
+    one_time_key, sizeof(one_time_key),
+    random2, sizeof(random2)
+));
+
+std::size_t pickle_length = ::olm_pickle_session_length(session);
+std::uint8_t pickle1[pickle_length];
+::olm_pickle_session(session, "secret_key", 10, pickle1, pickle_length);
+
+std::uint8_t key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *key = ::olm_pickle_key(key_buffer, "secret_key", 10);
+std::uint8_t other_key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *other_key = ::olm_pickle_key(other_key_buffer, "other_key", 9);
+
+/* a failed hibernate leaves the session alone */
+std::size_t sealed_length = ::olm_session_hibernate_length(session);
+assert_equals(
+    sealed_length, ::olm_pickle_session_binary_length(session)
+);
+std::uint8_t sealed[sealed_length];
+assert_equals(std::size_t(0), ::olm_encrypt_random_length(session));
+assert_equals(std::size_t(-1), ::olm_session_hibernate(
+    session, key, sealed, sealed_length - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_session_last_error(session))
+);
+
+assert_equals(sealed_length, ::olm_session_hibernate(
+    session, key, sealed, sealed_length
+));
+/* the session was cleared, so it would need a new ratchet key to send */
+assert_equals(std::size_t(32), ::olm_encrypt_random_length(session));
+
+std::uint8_t copy[sealed_length];
+std::memcpy(copy, sealed, sealed_length);
+assert_equals(std::size_t(-1), ::olm_session_wake(
+    session, other_key, copy, sealed_length
+));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_session_last_error(session))
+);
+
+assert_equals(sealed_length, ::olm_session_wake(
+    session, key, sealed, sealed_length
+));
+std::uint8_t pickle2[pickle_length];
+::olm_pickle_session(session, "secret_key", 10, pickle2, pickle_length);
+assert_equals(pickle1, pickle2, pickle_length);
+
+::olm_clear_pickle_key(key);
+::olm_clear_pickle_key(other_key);
+}
+
+{ /** Fixed-size pickle test */
+
+TestCase test_case("Fixed-size pickle test");
+MockRandom mock_random('F');
+
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
+
+/* the length only depends on the room for one time keys */
+std::size_t fixed_length = ::olm_pickle_account_fixed_length(account, 0);
+assert_equals(
+    true, fixed_length > ::olm_pickle_account_binary_length(account)
+);
+std::uint8_t ot_random[::olm_account_generate_one_time_keys_random_length(
+    account, 42
+)];
+mock_random(ot_random, sizeof(ot_random));
+::olm_account_generate_one_time_keys(account, 42, ot_random, sizeof(ot_random));
+assert_equals(fixed_length, ::olm_pickle_account_fixed_length(account, 0));
+std::size_t record_length = ::olm_pickle_account_fixed_length(account, 4096);
+assert_equals(std::size_t(0), record_length % 4096);
+assert_equals(true, record_length >= fixed_length);
+
+std::vector<std::uint8_t> record(record_length);
+assert_equals(std::size_t(-1), ::olm_pickle_account_fixed(
+    account, "secret_key", 10, record.data(), fixed_length - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_account_last_error(account))
+);
+assert_equals(record_length, ::olm_pickle_account_fixed(
+    account, "secret_key", 10, record.data(), record_length
+));
+
+std::size_t pickle_length = ::olm_pickle_account_length(account);
+std::vector<std::uint8_t> pickle1(pickle_length), pickle2(pickle_length);
+::olm_pickle_account(account, "secret_key", 10, pickle1.data(), pickle_length);
+
+std::vector<std::uint8_t> copy(record);
+std::uint8_t account_buffer2[::olm_account_size()];
+::OlmAccount *account2 = ::olm_account(account_buffer2);
+assert_equals(std::size_t(-1), ::olm_unpickle_account_fixed(
+    account2, "wrong_key!", 10, copy.data(), record_length
+));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_account_last_error(account2))
+);
+account2 = ::olm_account(account_buffer2);
+assert_equals(record_length, ::olm_unpickle_account_fixed(
+    account2, "secret_key", 10, record.data(), record_length
+));
+::olm_pickle_account(account2, "secret_key", 10, pickle2.data(), pickle_length);
+assert_equals(pickle1.data(), pickle2.data(), pickle_length);
+
+std::uint8_t session_buffer[::olm_session_size()];
+::OlmSession *session = ::olm_session(session_buffer);
+std::uint8_t raw_keys[64];
+mock_random(raw_keys, sizeof(raw_keys));
+std::uint8_t identity_key[43];
+std::uint8_t one_time_key[43];
+olm::encode_base64(raw_keys, 32, identity_key);
+olm::encode_base64(raw_keys + 32, 32, one_time_key);
+std::uint8_t random2[::olm_create_outbound_session_random_length(session)];
+mock_random(random2, sizeof(random2));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    session, account,
+    identity_key, sizeof(identity_key),
+    one_time_key, sizeof(one_time_key),
+    random2, sizeof(random2)
+));
+
+/* smaller limits make for a smaller pickle */
+std::size_t session_length = ::olm_pickle_session_fixed_length(session, 0);
+std::uint8_t small_buffer[::olm_session_size_with_limits(2, 8)];
+::OlmSession *small_session = ::olm_session_with_limits(small_buffer, 2, 8, 100);
+assert_equals(
+    true, ::olm_pickle_session_fixed_length(small_session, 0) < session_length
+);
+
+/* pickling into the same record again gives a pickle as long as the last */
+std::size_t session_record_length = session_length + 100;
+std::vector<std::uint8_t> session_record(session_record_length);
+assert_equals(session_record_length, ::olm_pickle_session_fixed(
+    session, "secret_key", 10, session_record.data(), session_record_length
+));
+std::size_t session_pickle_length = ::olm_pickle_session_length(session);
+std::vector<std::uint8_t> session_pickle1(session_pickle_length);
+std::vector<std::uint8_t> session_pickle2(session_pickle_length);
+::olm_pickle_session(
+    session, "secret_key", 10, session_pickle1.data(), session_pickle_length
+);
+
+std::uint8_t session_buffer2[::olm_session_size()];
+::OlmSession *session2 = ::olm_session(session_buffer2);
+assert_equals(session_record_length, ::olm_unpickle_session_fixed(
+    session2, "secret_key", 10, session_record.data(), session_record_length
+));
+::olm_pickle_session(
+    session2, "secret_key", 10, session_pickle2.data(), session_pickle_length
+);
+assert_equals(
+    session_pickle1.data(), session_pickle2.data(), session_pickle_length
+);
+}
+
+{ /** Pickle cipher test */
+
+TestCase test_case("Pickle cipher test");
+MockRandom mock_random('C');
+
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
+
+std::uint8_t session_buffer[::olm_session_size()];
+::OlmSession *session = ::olm_session(session_buffer);
+std::uint8_t raw_keys[64];
+mock_random(raw_keys, sizeof(raw_keys));
+std::uint8_t identity_key[43];
+std::uint8_t one_time_key[43];
+olm::encode_base64(raw_keys, 32, identity_key);
+olm::encode_base64(raw_keys + 32, 32, one_time_key);
+std::uint8_t random2[::olm_create_outbound_session_random_length(session)];
+mock_random(random2, sizeof(random2));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    session, account,
+    identity_key, sizeof(identity_key),
+    one_time_key, sizeof(one_time_key),
+    random2, sizeof(random2)
+));
+
+std::uint8_t key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *key = ::olm_pickle_key(key_buffer, "secret_key", 10);
+std::uint8_t other_key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *other_key = ::olm_pickle_key(other_key_buffer, "other_key", 9);
+
+/* the default cipher gives the same pickle as the raw key */
+std::size_t pickle_length = ::olm_pickle_session_length(session);
+assert_equals(pickle_length, ::olm_pickle_session_with_key_length(
+    session, OLM_PICKLE_CIPHER_AES_SHA_256
+));
+std::uint8_t pickle1[pickle_length];
+std::uint8_t pickle2[pickle_length];
+::olm_pickle_session(session, "secret_key", 10, pickle1, pickle_length);
+assert_equals(pickle_length, ::olm_pickle_session_with_key(
+    session, key, OLM_PICKLE_CIPHER_AES_SHA_256, pickle2, pickle_length
+));
+assert_equals(pickle1, pickle2, pickle_length);
+
+/* an unknown cipher is only an error when pickling */
+assert_equals(std::size_t(-1), ::olm_pickle_session_with_key(
+    session, key, 7, pickle2, pickle_length
+));
+assert_equals(
+    std::string("UNKNOWN_PICKLE_VERSION"),
+    std::string(::olm_session_last_error(session))
+);
+
+std::size_t gcm_length = ::olm_pickle_session_with_key_length(
+    session, OLM_PICKLE_CIPHER_AES_GCM
+);
+std::uint8_t gcm_pickle[gcm_length];
+assert_equals(std::size_t(-1), ::olm_pickle_session_with_key(
+    session, key, OLM_PICKLE_CIPHER_AES_GCM, gcm_pickle, gcm_length - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_session_last_error(session))
+);
+assert_equals(gcm_length, ::olm_pickle_session_with_key(
+    session, key, OLM_PICKLE_CIPHER_AES_GCM, gcm_pickle, gcm_length
+));
+assert_equals(std::uint8_t(OLM_PICKLE_GCM_MARKER), gcm_pickle[0]);
+
+/* a GCM pickle loads with either form of the key, but not another key */
+std::uint8_t copy[gcm_length];
+std::uint8_t session_buffer2[::olm_session_size()];
+::OlmSession *session2 = ::olm_session(session_buffer2);
+std::memcpy(copy, gcm_pickle, gcm_length);
+assert_equals(std::size_t(-1), ::olm_unpickle_session_with_key(
+    session2, other_key, copy, gcm_length
+));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_session_last_error(session2))
+);
+
+std::memcpy(copy, gcm_pickle, gcm_length);
+copy[gcm_length / 2] ^= 1;
+assert_equals(std::size_t(-1), ::olm_unpickle_session_with_key(
+    session2, key, copy, gcm_length
+));
+
+std::memcpy(copy, gcm_pickle, gcm_length);
+assert_not_equals(std::size_t(-1), ::olm_unpickle_session_with_key(
+    session2, key, copy, gcm_length
+));
+::olm_pickle_session(session2, "secret_key", 10, pickle2, pickle_length);
+assert_equals(pickle1, pickle2, pickle_length);
+
+std::memcpy(copy, gcm_pickle, gcm_length);
+::olm_clear_session(session2);
+assert_not_equals(std::size_t(-1), ::olm_unpickle_session(
+    session2, "secret_key", 10, copy, gcm_length
+));
+::olm_pickle_session(session2, "secret_key", 10, pickle2, pickle_length);
+assert_equals(pickle1, pickle2, pickle_length);
+
+/* each GCM pickle has its own nonce */
+std::uint8_t gcm_pickle2[gcm_length];
+::olm_pickle_session_with_key(
+    session, key, OLM_PICKLE_CIPHER_AES_GCM, gcm_pickle2, gcm_length
+);
+assert_not_equals(0, std::memcmp(gcm_pickle, gcm_pickle2, gcm_length));
+
+/* and accounts */
+std::size_t account_length = ::olm_pickle_account_with_key_length(
+    account, OLM_PICKLE_CIPHER_AES_GCM
+);
+std::uint8_t account_pickle[account_length];
+assert_equals(account_length, ::olm_pickle_account_with_key(
+    account, key, OLM_PICKLE_CIPHER_AES_GCM, account_pickle, account_length
+));
+std::uint8_t account_buffer2[::olm_account_size()];
+::OlmAccount *account2 = ::olm_account(account_buffer2);
+assert_not_equals(std::size_t(-1), ::olm_unpickle_account_with_key(
+    account2, key, account_pickle, account_length
+));
+std::size_t expected_length = ::olm_pickle_account_length(account);
+std::uint8_t expected[expected_length];
+std::uint8_t actual[expected_length];
+::olm_pickle_account(account, "secret_key", 10, expected, expected_length);
+::olm_pickle_account(account2, "secret_key", 10, actual, expected_length);
+assert_equals(expected, actual, expected_length);
+
+::olm_clear_pickle_key(key);
+::olm_clear_pickle_key(other_key);
+}
+
+{ /** Loopback test */
+
+TestCase test_case("Loopback test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+std::uint8_t b_account_buffer[::olm_account_size()];
+::OlmAccount *b_account = ::olm_account(b_account_buffer);
+std::uint8_t b_random[::olm_create_account_random_length(b_account)];
+mock_random_b(b_random, sizeof(b_random));
+::olm_create_account(b_account, b_random, sizeof(b_random));
+std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
+        b_account, 42
+)];
+mock_random_b(o_random, sizeof(o_random));
+::olm_account_generate_one_time_keys(b_account, 42, o_random, sizeof(o_random));
+
+std::uint8_t a_id_keys[::olm_account_identity_keys_length(a_account)];
+::olm_account_identity_keys(a_account, a_id_keys, sizeof(a_id_keys));
+
+std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
+std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
+::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+std::uint8_t a_session_buffer[::olm_session_size()];
+::OlmSession *a_session = ::olm_session(a_session_buffer);
+std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
+mock_random_a(a_rand, sizeof(a_rand));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys + 15, 43, // B's curve25519 identity key
+    b_ot_keys + 25, 43, // B's curve25519 one time key
+    a_rand, sizeof(a_rand)
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::uint8_t message_1[::olm_encrypt_message_length(a_session, 12)];
+std::uint8_t a_message_random[::olm_encrypt_random_length(a_session)];
+mock_random_a(a_message_random, sizeof(a_message_random));
+assert_equals(std::size_t(0), ::olm_encrypt_message_type(a_session));
+assert_not_equals(std::size_t(-1), ::olm_encrypt(
+    a_session,
+    plaintext, 12,
+    a_message_random, sizeof(a_message_random),
+    message_1, sizeof(message_1)
+));
+
+
+std::uint8_t tmp_message_1[sizeof(message_1)];
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+std::uint8_t b_session_buffer[::olm_account_size()];
+::OlmSession *b_session = ::olm_session(b_session_buffer);
+::olm_create_inbound_session(
+    b_session, b_account, tmp_message_1, sizeof(message_1)
+);
+
+// Check that the inbound session matches the message it was created from.
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+assert_equals(std::size_t(1), ::olm_matches_inbound_session(
+    b_session,
+    tmp_message_1, sizeof(message_1)
+));
+
+// Check that the inbound session matches the key this message is supposed
+// to be from.
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+assert_equals(std::size_t(1), ::olm_matches_inbound_session_from(
+    b_session,
+    a_id_keys + 15, 43, // A's curve125519 identity key.
+    tmp_message_1, sizeof(message_1)
+));
+
+// Check that the inbound session isn't from a different user.
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+assert_equals(std::size_t(0), ::olm_matches_inbound_session_from(
+    b_session,
+    b_id_keys + 15, 43, // B's curve25519 identity key.
+    tmp_message_1, sizeof(message_1)
+));
+
+// Check that we can decrypt the message.
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+std::uint8_t plaintext_1[::olm_decrypt_max_plaintext_length(
+    b_session, 0, tmp_message_1, sizeof(message_1)
+)];
+assert_equals(sizeof(plaintext_1), ::olm_peek_max_plaintext_length(
+    b_session, 0, message_1, sizeof(message_1)
+));
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, 0,
+    tmp_message_1, sizeof(message_1),
+    plaintext_1, sizeof(plaintext_1)
+));
+
+assert_equals(plaintext, plaintext_1, 12);
+
+std::uint8_t message_2[::olm_encrypt_message_length(b_session, 12)];
+std::uint8_t b_message_random[::olm_encrypt_random_length(b_session)];
+mock_random_b(b_message_random, sizeof(b_message_random));
+assert_equals(std::size_t(1), ::olm_encrypt_message_type(b_session));
+assert_not_equals(std::size_t(-1), ::olm_encrypt(
+    b_session,
+    plaintext, 12,
+    b_message_random, sizeof(b_message_random),
+    message_2, sizeof(message_2)
+));
+
+std::uint8_t tmp_message_2[sizeof(message_2)];
+std::memcpy(tmp_message_2, message_2, sizeof(message_2));
+std::uint8_t plaintext_2[::olm_decrypt_max_plaintext_length(
+    a_session, 1, tmp_message_2, sizeof(message_2)
+)];
+assert_equals(sizeof(plaintext_2), ::olm_peek_max_plaintext_length(
+    a_session, 1, message_2, sizeof(message_2)
+));
+std::memcpy(tmp_message_2, message_2, sizeof(message_2));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    a_session, 1,
+    tmp_message_2, sizeof(message_2),
+    plaintext_2, sizeof(plaintext_2)
+));
+
+assert_equals(plaintext, plaintext_2, 12);
+
+// A message for another version of the protocol is rejected by the peek too.
+std::memcpy(tmp_message_2, message_2, sizeof(message_2));
+tmp_message_2[0] = 'B'; // Version 7 rather than 3.
+assert_equals(std::size_t(-1), ::olm_peek_max_plaintext_length(
+    a_session, 1, tmp_message_2, sizeof(message_2)
+));
+assert_equals(
+    std::string("BAD_MESSAGE_VERSION"),
+    std::string(::olm_session_last_error(a_session))
+);
+assert_equals(std::size_t(-1), ::olm_decrypt_max_plaintext_length(
+    a_session, 1, tmp_message_2, sizeof(message_2)
+));
+assert_equals(
+    std::string("BAD_MESSAGE_VERSION"),
+    std::string(::olm_session_last_error(a_session))
+);
+
+std::memcpy(tmp_message_2, message_2, sizeof(message_2));
+assert_equals(std::size_t(-1), ::olm_decrypt(
+    a_session, 1,
+    tmp_message_2, sizeof(message_2),
+    plaintext_2, sizeof(plaintext_2)
+));
+
+std::uint8_t a_session_id[::olm_session_id_length(a_session)];
+assert_not_equals(std::size_t(-1), ::olm_session_id(
+    a_session, a_session_id, sizeof(a_session_id)
+));
+
+std::uint8_t b_session_id[::olm_session_id_length(b_session)];
+assert_not_equals(std::size_t(-1), ::olm_session_id(
+    b_session, b_session_id, sizeof(b_session_id)
+));
+
+assert_equals(sizeof(a_session_id), sizeof(b_session_id));
+assert_equals(a_session_id, b_session_id, sizeof(b_session_id));
+
+// The binary ID is the base64-decoded one, and asking again gives the same
+std::uint8_t a_binary_id[32], b_binary_id[32], decoded_id[32];
+assert_equals(std::size_t(-1), ::olm_session_id_binary(
+    a_session, a_binary_id, 31
+));
+assert_equals(std::size_t(32), ::olm_session_id_binary(
+    a_session, a_binary_id, 32
+));
+assert_equals(std::size_t(32), ::olm_session_id_binary(
+    b_session, b_binary_id, 32
+));
+olm::decode_base64(a_session_id, sizeof(a_session_id), decoded_id);
+assert_equals(decoded_id, a_binary_id, 32);
+assert_equals(a_binary_id, b_binary_id, 32);
+assert_not_equals(std::size_t(-1), ::olm_session_id(
+    a_session, a_session_id, sizeof(a_session_id)
+));
+assert_equals(b_session_id, a_session_id, sizeof(b_session_id));
+
+}
+
+{ /** Raw messages test */
+
+TestCase test_case("Raw messages test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+std::uint8_t b_account_buffer[::olm_account_size()];
+::OlmAccount *b_account = ::olm_account(b_account_buffer);
+std::uint8_t b_random[::olm_create_account_random_length(b_account)];
+mock_random_b(b_random, sizeof(b_random));
+::olm_create_account(b_account, b_random, sizeof(b_random));
+std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
+        b_account, 1
+)];
+mock_random_b(o_random, sizeof(o_random));
+::olm_account_generate_one_time_keys(b_account, 1, o_random, sizeof(o_random));
+
+std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
+std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
+::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+std::uint8_t a_session_buffer[::olm_session_size()];
+::OlmSession *a_session = ::olm_session(a_session_buffer);
+std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
+mock_random_a(a_rand, sizeof(a_rand));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys + 15, 43,
+    b_ot_keys + 25, 43,
+    a_rand, sizeof(a_rand)
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::size_t raw_length = ::olm_encrypt_raw_message_length(a_session, 12);
+assert_equals(
+    olm::encode_base64_length(raw_length),
+    ::olm_encrypt_message_length(a_session, 12)
+);
+std::uint8_t message_1[raw_length];
+std::uint8_t a_message_random[::olm_encrypt_random_length(a_session)];
+mock_random_a(a_message_random, sizeof(a_message_random));
+assert_equals(std::size_t(-1), ::olm_encrypt_raw(
+    a_session,
+    plaintext, 12,
+    a_message_random, sizeof(a_message_random),
+    message_1, raw_length - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_session_last_error(a_session))
+);
+mock_random_a(a_message_random, sizeof(a_message_random));
+assert_equals(raw_length, ::olm_encrypt_raw(
+    a_session,
+    plaintext, 12,
+    a_message_random, sizeof(a_message_random),
+    message_1, sizeof(message_1)
+));
+
+// The inbound session is created from the base64 form.
+std::uint8_t encoded_1[olm::encode_base64_length(raw_length)];
+olm::encode_base64(message_1, raw_length, encoded_1);
+std::uint8_t b_session_buffer[::olm_account_size()];
+::OlmSession *b_session = ::olm_session(b_session_buffer);
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, encoded_1, sizeof(encoded_1)
+));
+
+// Decrypting the raw message leaves it alone, so no copies are needed.
+std::uint8_t copy_1[sizeof(message_1)];
+std::memcpy(copy_1, message_1, sizeof(message_1));
+std::uint8_t plaintext_1[::olm_decrypt_raw_max_plaintext_length(
+    b_session, 0, message_1, sizeof(message_1)
+)];
+assert_equals(std::size_t(12), ::olm_decrypt_raw(
+    b_session, 0,
+    message_1, sizeof(message_1),
+    plaintext_1, sizeof(plaintext_1)
+));
+assert_equals(plaintext, plaintext_1, 12);
+assert_equals(copy_1, message_1, sizeof(message_1));
+
+std::uint8_t message_2[::olm_encrypt_raw_message_length(b_session, 12)];
+std::uint8_t b_message_random[::olm_encrypt_random_length(b_session)];
+mock_random_b(b_message_random, sizeof(b_message_random));
+assert_equals(sizeof(message_2), ::olm_encrypt_raw(
+    b_session,
+    plaintext, 12,
+    b_message_random, sizeof(b_message_random),
+    message_2, sizeof(message_2)
+));
+
+std::uint8_t plaintext_2[::olm_decrypt_raw_max_plaintext_length(
+    a_session, 1, message_2, sizeof(message_2)
+)];
+assert_equals(std::size_t(12), ::olm_decrypt_raw(
+    a_session, 1,
+    message_2, sizeof(message_2),
+    plaintext_2, sizeof(plaintext_2)
+));
+assert_equals(plaintext, plaintext_2, 12);
+
+// A message can only be decrypted once.
+assert_equals(std::size_t(-1), ::olm_decrypt_raw(
+    a_session, 1,
+    message_2, sizeof(message_2),
+    plaintext_2, sizeof(plaintext_2)
+));
+
+}
+
+{ /** Message view test */
+
+TestCase test_case("Message view test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+std::vector<std::uint8_t> a_random(::olm_create_account_random_length(a_account));
+mock_random_a(a_random.data(), a_random.size());
+::olm_create_account(a_account, a_random.data(), a_random.size());
+
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+std::vector<std::uint8_t> b_random(::olm_create_account_random_length(b_account));
+mock_random_b(b_random.data(), b_random.size());
+::olm_create_account(b_account, b_random.data(), b_random.size());
+b_random.resize(::olm_account_generate_one_time_keys_random_length(b_account, 1));
+mock_random_b(b_random.data(), b_random.size());
+::olm_account_generate_one_time_keys(b_account, 1, b_random.data(), b_random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+a_random.resize(::olm_create_outbound_session_random_length(a_session));
+mock_random_a(a_random.data(), a_random.size());
+::olm_create_outbound_session(
+    a_session, a_account, b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+    a_random.data(), a_random.size()
+);
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::uint8_t> message(::olm_encrypt_message_length(a_session, 12));
+a_random.resize(::olm_encrypt_random_length(a_session));
+mock_random_a(a_random.data(), a_random.size());
+::olm_encrypt(
+    a_session, plaintext, 12, a_random.data(), a_random.size(),
+    message.data(), message.size()
+);
+
+std::vector<std::uint8_t> view_buffer(::olm_message_view_size());
+::OlmMessageView *view = ::olm_message_view(view_buffer.data());
+
+/* bad base64 is caught when decoding the view */
+std::vector<std::uint8_t> bad(message);
+bad[10] = '!';
+assert_equals(std::size_t(-1), ::olm_message_view_decode(
+    view, OLM_MESSAGE_TYPE_PRE_KEY, bad.data(), bad.size()
+));
+assert_equals(
+    std::string("INVALID_BASE64"),
+    std::string(::olm_message_view_last_error(view))
+);
+
+/* one decode serves every step of receiving the pre-key message */
+assert_equals(std::size_t(0), ::olm_message_view_decode(
+    view, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size()
+));
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+assert_equals(std::size_t(0), ::olm_create_inbound_session_with_view(
+    b_session, b_account, view
+));
+assert_equals(std::size_t(1), ::olm_matches_inbound_session_with_view(
+    b_session, view
+));
+std::size_t max_length = ::olm_decrypt_max_plaintext_length_with_view(
+    b_session, view
+);
+assert_not_equals(std::size_t(-1), max_length);
+std::vector<std::uint8_t> output(max_length);
+assert_equals(std::size_t(12), ::olm_decrypt_with_view(
+    b_session, view, output.data(), output.size()
+));
+assert_equals(plaintext, output.data(), 12);
+
+/* and the reply, as a normal message, which isn't a pre-key message */
+message.resize(::olm_encrypt_message_length(b_session, 12));
+std::vector<std::uint8_t> b_message_random(::olm_encrypt_random_length(b_session));
+mock_random_b(b_message_random.data(), b_message_random.size());
+::olm_encrypt(
+    b_session, plaintext, 12, b_message_random.data(), b_message_random.size(),
+    message.data(), message.size()
+);
+assert_equals(std::size_t(0), ::olm_message_view_decode(
+    view, OLM_MESSAGE_TYPE_MESSAGE, message.data(), message.size()
+));
+assert_equals(std::size_t(0), ::olm_matches_inbound_session_with_view(
+    a_session, view
+));
+output.resize(::olm_decrypt_max_plaintext_length_with_view(a_session, view));
+assert_equals(std::size_t(12), ::olm_decrypt_with_view(
+    a_session, view, output.data(), output.size()
+));
+assert_equals(plaintext, output.data(), 12);
+
+/* the message is left alone, so decrypting it again fails on the MAC rather
+ * than on the headers */
+assert_equals(std::size_t(-1), ::olm_decrypt_with_view(
+    a_session, view, output.data(), output.size()
+));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"),
+    std::string(::olm_session_last_error(a_session))
+);
+
+}
+
+{ /** Create inbound session and decrypt test */
+
+TestCase test_case("Create inbound session and decrypt test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+std::vector<std::uint8_t> a_random(::olm_create_account_random_length(a_account));
+mock_random_a(a_random.data(), a_random.size());
+::olm_create_account(a_account, a_random.data(), a_random.size());
+std::vector<std::uint8_t> a_id_keys(::olm_account_identity_keys_length(a_account));
+::olm_account_identity_keys(a_account, a_id_keys.data(), a_id_keys.size());
+
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+std::vector<std::uint8_t> b_random(::olm_create_account_random_length(b_account));
+mock_random_b(b_random.data(), b_random.size());
+::olm_create_account(b_account, b_random.data(), b_random.size());
+b_random.resize(::olm_account_generate_one_time_keys_random_length(b_account, 1));
+mock_random_b(b_random.data(), b_random.size());
+::olm_account_generate_one_time_keys(b_account, 1, b_random.data(), b_random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+a_random.resize(::olm_create_outbound_session_random_length(a_session));
+mock_random_a(a_random.data(), a_random.size());
+::olm_create_outbound_session(
+    a_session, a_account, b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+    a_random.data(), a_random.size()
+);
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::uint8_t> message(::olm_encrypt_message_length(a_session, 12));
+a_random.resize(::olm_encrypt_random_length(a_session));
+mock_random_a(a_random.data(), a_random.size());
+::olm_encrypt(
+    a_session, plaintext, 12, a_random.data(), a_random.size(),
+    message.data(), message.size()
+);
+
+/* a message with a bad MAC creates no session, and leaves the key */
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+std::vector<std::uint8_t> output(message.size());
+std::vector<std::uint8_t> tmp(message);
+std::uint8_t & mac_char = tmp[tmp.size() - 5];
+mac_char = mac_char == 'A' ? 'B' : 'A';
+assert_equals(std::size_t(-1), ::olm_create_inbound_session_and_decrypt(
+    b_session, b_account, a_id_keys.data() + 15, 43,
+    tmp.data(), tmp.size(), output.data(), output.size()
+));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"),
+    std::string(::olm_session_last_error(b_session))
+);
+
+/* the real message, checked against the sender's identity key */
+b_session = ::olm_session(b_session_buffer.data());
+tmp = message;
+assert_equals(std::size_t(12), ::olm_create_inbound_session_and_decrypt(
+    b_session, b_account, a_id_keys.data() + 15, 43,
+    tmp.data(), tmp.size(), output.data(), output.size()
+));
+assert_equals(plaintext, output.data(), 12);
+assert_equals(1, ::olm_session_has_received_message(b_session));
+
+/* the one time key has been used up */
+assert_equals(std::size_t(-1), ::olm_remove_one_time_keys(b_account, b_session));
+std::vector<std::uint8_t> c_session_buffer(::olm_session_size());
+::OlmSession *c_session = ::olm_session(c_session_buffer.data());
+tmp = message;
+assert_equals(std::size_t(-1), ::olm_create_inbound_session_and_decrypt(
+    c_session, b_account, nullptr, 0,
+    tmp.data(), tmp.size(), output.data(), output.size()
+));
+assert_equals(
+    std::string("BAD_MESSAGE_KEY_ID"),
+    std::string(::olm_session_last_error(c_session))
+);
+
+/* and the reply decrypts as usual */
+message.resize(::olm_encrypt_message_length(b_session, 12));
+b_random.resize(::olm_encrypt_random_length(b_session));
+mock_random_b(b_random.data(), b_random.size());
+::olm_encrypt(
+    b_session, plaintext, 12, b_random.data(), b_random.size(),
+    message.data(), message.size()
+);
+output.resize(message.size());
+assert_equals(std::size_t(12), ::olm_decrypt(
+    a_session, OLM_MESSAGE_TYPE_MESSAGE, message.data(), message.size(),
+    output.data(), output.size()
+));
+assert_equals(plaintext, output.data(), 12);
+
+}
+
+{ /** Decrypt peek test */
+
+TestCase test_case("Decrypt peek test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+std::vector<std::uint8_t> a_random(::olm_create_account_random_length(a_account));
+mock_random_a(a_random.data(), a_random.size());
+::olm_create_account(a_account, a_random.data(), a_random.size());
+
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+std::vector<std::uint8_t> b_random(::olm_create_account_random_length(b_account));
+mock_random_b(b_random.data(), b_random.size());
+::olm_create_account(b_account, b_random.data(), b_random.size());
+b_random.resize(::olm_account_generate_one_time_keys_random_length(b_account, 2));
+mock_random_b(b_random.data(), b_random.size());
+::olm_account_generate_one_time_keys(b_account, 2, b_random.data(), b_random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+/* Alice has two sessions with Bob, only one of which he's talking on */
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+a_random.resize(::olm_create_outbound_session_random_length(a_session));
+mock_random_a(a_random.data(), a_random.size());
+::olm_create_outbound_session(
+    a_session, a_account, b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+    a_random.data(), a_random.size()
+);
+std::vector<std::uint8_t> c_session_buffer(::olm_session_size());
+::OlmSession *c_session = ::olm_session(c_session_buffer.data());
+mock_random_a(a_random.data(), a_random.size());
+::olm_create_outbound_session(
+    c_session, a_account, b_id_keys.data() + 15, 43, b_ot_keys.data() + 80, 43,
+    a_random.data(), a_random.size()
+);
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::uint8_t> message(::olm_encrypt_message_length(a_session, 12));
+a_random.resize(::olm_encrypt_random_length(a_session));
+::olm_encrypt(
+    a_session, plaintext, 12, a_random.data(), a_random.size(),
+    message.data(), message.size()
+);
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+std::vector<std::uint8_t> tmp(message);
+assert_equals(std::size_t(0), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+std::uint8_t output[64];
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size(),
+    output, sizeof(output)
+));
+
+/* Bob's replies, as normal messages, each with its own view */
+const std::size_t reply_count = 4;
+std::vector<std::vector<std::uint8_t>> replies(reply_count);
+std::vector<std::vector<std::uint8_t>> view_buffers(reply_count);
+std::vector<::OlmMessageView *> views(reply_count);
+for (std::size_t i = 0; i < reply_count; ++i) {
+    replies[i].resize(::olm_encrypt_message_length(b_session, 12));
+    b_random.resize(::olm_encrypt_random_length(b_session));
+    mock_random_b(b_random.data(), b_random.size());
+    ::olm_encrypt(
+        b_session, plaintext, 12, b_random.data(), b_random.size(),
+        replies[i].data(), replies[i].size()
+    );
+    view_buffers[i].resize(::olm_message_view_size());
+    views[i] = ::olm_message_view(view_buffers[i].data());
+    assert_equals(std::size_t(0), ::olm_message_view_decode(
+        views[i], OLM_MESSAGE_TYPE_MESSAGE,
+        replies[i].data(), replies[i].size()
+    ));
+}
+
+auto pickle = [](::OlmSession * session) {
+    std::vector<std::uint8_t> pickled(::olm_pickle_session_length(session));
+    ::olm_pickle_session(
+        session, "secret_key", 10, pickled.data(), pickled.size()
+    );
+    return pickled;
+};
+
+std::vector<std::uint8_t> trial_buffer(::olm_decrypt_trial_size());
+::OlmDecryptTrial *trial = ::olm_decrypt_trial(trial_buffer.data());
+
+/* the wrong session can't decrypt the first reply, and the right one can,
+ * without either changing */
+std::vector<std::uint8_t> a_pickled(pickle(a_session));
+std::vector<std::uint8_t> c_pickled(pickle(c_session));
+assert_equals(std::size_t(-1), ::olm_decrypt_peek(
+    c_session, views[0], trial, output, sizeof(output)
+));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"),
+    std::string(::olm_decrypt_trial_last_error(trial))
+);
+assert_equals(std::size_t(12), ::olm_decrypt_peek(
+    a_session, views[0], trial, output, sizeof(output)
+));
+assert_equals(plaintext, output, 12);
+assert_equals(a_pickled.data(), pickle(a_session).data(), a_pickled.size());
+assert_equals(c_pickled.data(), pickle(c_session).data(), c_pickled.size());
+
+/* the trial is only for the session it was made with */
+assert_equals(std::size_t(-1), ::olm_decrypt_commit(c_session, trial));
+assert_equals(
+    std::string("SESSION_CHANGED"),
+    std::string(::olm_session_last_error(c_session))
+);
+assert_equals(std::size_t(0), ::olm_decrypt_commit(a_session, trial));
+assert_equals(std::size_t(-1), ::olm_decrypt_commit(a_session, trial));
+assert_equals(
+    std::string("SESSION_CHANGED"),
+    std::string(::olm_session_last_error(a_session))
+);
+assert_equals(std::size_t(-1), ::olm_decrypt_peek(
+    a_session, views[0], trial, output, sizeof(output)
+));
+
+/* a copy decrypting the same messages in the usual way ends up the same */
+std::vector<std::uint8_t> d_session_buffer(::olm_session_copy_size(a_session));
+::OlmSession *d_session = ::olm_session_copy(
+    d_session_buffer.data(), d_session_buffer.size(), a_session
+);
+for (std::size_t i : {1, 3, 2}) {
+    assert_equals(std::size_t(12), ::olm_decrypt_with_view(
+        d_session, views[i], output, sizeof(output)
+    ));
+}
+
+/* a trial no longer fits once its chain has moved on */
+assert_equals(std::size_t(12), ::olm_decrypt_peek(
+    a_session, views[3], trial, output, sizeof(output)
+));
+assert_equals(std::size_t(12), ::olm_decrypt_with_view(
+    a_session, views[1], output, sizeof(output)
+));
+assert_equals(std::size_t(-1), ::olm_decrypt_commit(a_session, trial));
+assert_equals(
+    std::string("SESSION_CHANGED"),
+    std::string(::olm_session_last_error(a_session))
+);
+assert_equals(std::size_t(12), ::olm_decrypt_peek(
+    a_session, views[3], trial, output, sizeof(output)
+));
+assert_equals(std::size_t(0), ::olm_decrypt_commit(a_session, trial));
+
+/* or once the skipped key it found has been used */
+std::vector<std::uint8_t> other_trial_buffer(::olm_decrypt_trial_size());
+::OlmDecryptTrial *other_trial =
+    ::olm_decrypt_trial(other_trial_buffer.data());
+assert_equals(std::size_t(12), ::olm_decrypt_peek(
+    a_session, views[2], trial, output, sizeof(output)
+));
+assert_equals(std::size_t(12), ::olm_decrypt_peek(
+    a_session, views[2], other_trial, output, sizeof(output)
+));
+assert_equals(std::size_t(0), ::olm_decrypt_commit(a_session, trial));
+assert_equals(std::size_t(-1), ::olm_decrypt_commit(a_session, other_trial));
+
+a_pickled = pickle(a_session);
+std::vector<std::uint8_t> d_pickled(pickle(d_session));
+assert_equals(a_pickled.size(), d_pickled.size());
+assert_equals(a_pickled.data(), d_pickled.data(), a_pickled.size());
+
+assert_equals(trial_buffer.size(), ::olm_clear_decrypt_trial(trial));
+::olm_clear_decrypt_trial(other_trial);
+}
+
+{ /** Encrypt many test */
+
+TestCase test_case("Encrypt many test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+const std::size_t count = 3;
+std::vector<std::vector<std::uint8_t>> b_account_buffers(count);
+std::vector<std::vector<std::uint8_t>> a_session_buffers(count);
+std::vector<::OlmAccount *> b_accounts(count);
+std::vector<::OlmSession *> a_sessions(count);
+for (std::size_t i = 0; i < count; ++i) {
+    b_account_buffers[i].resize(::olm_account_size());
+    b_accounts[i] = ::olm_account(b_account_buffers[i].data());
+    std::vector<std::uint8_t> b_random(
+        ::olm_create_account_random_length(b_accounts[i])
+    );
+    mock_random_b(b_random.data(), b_random.size());
+    ::olm_create_account(b_accounts[i], b_random.data(), b_random.size());
+    std::vector<std::uint8_t> o_random(
+        ::olm_account_generate_one_time_keys_random_length(b_accounts[i], 1)
+    );
+    mock_random_b(o_random.data(), o_random.size());
+    ::olm_account_generate_one_time_keys(
+        b_accounts[i], 1, o_random.data(), o_random.size()
+    );
+
+    std::vector<std::uint8_t> b_id_keys(
+        ::olm_account_identity_keys_length(b_accounts[i])
+    );
+    std::vector<std::uint8_t> b_ot_keys(
+        ::olm_account_one_time_keys_length(b_accounts[i])
+    );
+    ::olm_account_identity_keys(b_accounts[i], b_id_keys.data(), b_id_keys.size());
+    ::olm_account_one_time_keys(b_accounts[i], b_ot_keys.data(), b_ot_keys.size());
+
+    a_session_buffers[i].resize(::olm_session_size());
+    a_sessions[i] = ::olm_session(a_session_buffers[i].data());
+    std::vector<std::uint8_t> a_rand(
+        ::olm_create_outbound_session_random_length(a_sessions[i])
+    );
+    mock_random_a(a_rand.data(), a_rand.size());
+    assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+        a_sessions[i], a_account,
+        b_id_keys.data() + 15, 43,
+        b_ot_keys.data() + 25, 43,
+        a_rand.data(), a_rand.size()
+    ));
+}
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::uint8_t> random(
+    ::olm_encrypt_many_random_length(a_sessions.data(), count)
+);
+mock_random_a(random.data(), random.size());
+std::size_t total_length = ::olm_encrypt_many_message_length(
+    a_sessions.data(), count, 12
+);
+std::vector<std::uint8_t> messages(total_length);
+std::size_t message_types[count], message_lengths[count];
+
+/* leave room for only the first two messages, and move their chains on
+ * together as there are no SHA instructions */
+std::size_t last_length = ::olm_encrypt_message_length(a_sessions[2], 12);
+_olm_cpu_set_feature_mask(~OLM_CPU_FEATURE_SHA256);
+assert_equals(std::size_t(1), ::olm_encrypt_many(
+    a_sessions.data(), count, plaintext, 12,
+    random.data(), random.size(),
+    messages.data(), total_length - last_length,
+    message_types, message_lengths
+));
+_olm_cpu_set_feature_mask(~0u);
+assert_equals(std::size_t(-1), message_lengths[2]);
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_session_last_error(a_sessions[2]))
+);
+
+std::size_t offset = 0;
+for (std::size_t i = 0; i < count; ++i) {
+    if (i == 2) {
+        /* try again for the last one on its own */
+        std::vector<std::uint8_t> last_random(
+            ::olm_encrypt_random_length(a_sessions[2])
+        );
+        mock_random_a(last_random.data(), last_random.size());
+        assert_equals(std::size_t(0), ::olm_encrypt_many(
+            &a_sessions[2], 1, plaintext, 12,
+            last_random.data(), last_random.size(),
+            messages.data() + offset, total_length - offset,
+            &message_types[2], &message_lengths[2]
+        ));
+    }
+    assert_equals(std::size_t(OLM_MESSAGE_TYPE_PRE_KEY), message_types[i]);
+
+    std::vector<std::uint8_t> message(
+        messages.begin() + offset,
+        messages.begin() + offset + message_lengths[i]
+    );
+    offset += message_lengths[i];
+
+    std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+    ::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+    std::vector<std::uint8_t> tmp(message);
+    assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+        b_session, b_accounts[i], tmp.data(), tmp.size()
+    ));
+    std::vector<std::uint8_t> output(::olm_peek_max_plaintext_length(
+        b_session, 0, message.data(), message.size()
+    ));
+    assert_equals(std::size_t(12), ::olm_decrypt(
+        b_session, 0, message.data(), message.size(),
+        output.data(), output.size()
+    ));
+    assert_equals(plaintext, output.data(), 12);
+}
+assert_equals(total_length, offset);
+
+}
+
+{ /** Decrypt batch test */
+
+TestCase test_case("Decrypt batch test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+/* two pairs of sessions, each with three messages from a to b */
+const std::size_t pairs = 2, per_pair = 3;
+std::vector<std::vector<std::uint8_t>> buffers;
+std::vector<::OlmSession *> b_sessions(pairs);
+std::vector<std::vector<std::uint8_t>> encrypted(pairs * per_pair);
+std::uint8_t plaintext[] = "Hello, World";
+for (std::size_t p = 0; p < pairs; ++p) {
+    buffers.emplace_back(::olm_account_size());
+    ::OlmAccount *b_account = ::olm_account(buffers.back().data());
+    std::vector<std::uint8_t> b_random(
+        ::olm_create_account_random_length(b_account)
+    );
+    mock_random_b(b_random.data(), b_random.size());
+    ::olm_create_account(b_account, b_random.data(), b_random.size());
+    std::vector<std::uint8_t> o_random(
+        ::olm_account_generate_one_time_keys_random_length(b_account, 1)
+    );
+    mock_random_b(o_random.data(), o_random.size());
+    ::olm_account_generate_one_time_keys(
+        b_account, 1, o_random.data(), o_random.size()
+    );
+    std::vector<std::uint8_t> b_id_keys(
+        ::olm_account_identity_keys_length(b_account)
+    );
+    std::vector<std::uint8_t> b_ot_keys(
+        ::olm_account_one_time_keys_length(b_account)
+    );
+    ::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+    ::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+    buffers.emplace_back(::olm_session_size());
+    ::OlmSession *a_session = ::olm_session(buffers.back().data());
+    std::vector<std::uint8_t> a_rand(
+        ::olm_create_outbound_session_random_length(a_session)
+    );
+    mock_random_a(a_rand.data(), a_rand.size());
+    assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+        a_session, a_account,
+        b_id_keys.data() + 15, 43,
+        b_ot_keys.data() + 25, 43,
+        a_rand.data(), a_rand.size()
+    ));
+
+    for (std::size_t m = 0; m < per_pair; ++m) {
+        std::vector<std::uint8_t> & message = encrypted[p * per_pair + m];
+        message.resize(::olm_encrypt_message_length(a_session, 12));
+        std::vector<std::uint8_t> e_random(
+            ::olm_encrypt_random_length(a_session)
+        );
+        mock_random_a(e_random.data(), e_random.size());
+        assert_not_equals(std::size_t(-1), ::olm_encrypt(
+            a_session, plaintext, 12, e_random.data(), e_random.size(),
+            message.data(), message.size()
+        ));
+    }
+
+    buffers.emplace_back(::olm_session_size());
+    b_sessions[p] = ::olm_session(buffers.back().data());
+    std::vector<std::uint8_t> tmp(encrypted[p * per_pair]);
+    assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+        b_sessions[p], b_account, tmp.data(), tmp.size()
+    ));
+}
+
+/* the sessions' messages interleaved, with the first message for the
+ * second session repeated at the end, after its message key has been used */
+std::vector<std::size_t> picks = {0, 3, 1, 4, 2, 5, 3};
+const std::size_t count = picks.size();
+std::vector<std::vector<std::uint8_t>> messages(count), outputs(count);
+std::vector<::OlmSession *> sessions(count);
+std::vector<void *> message_ptrs(count), output_ptrs(count);
+std::vector<std::size_t> message_types(count, OLM_MESSAGE_TYPE_PRE_KEY);
+std::vector<std::size_t> message_lengths(count), max_lengths(count);
+for (std::size_t i = 0; i < count; ++i) {
+    messages[i] = encrypted[picks[i]];
+    sessions[i] = b_sessions[picks[i] / per_pair];
+    message_ptrs[i] = messages[i].data();
+    message_lengths[i] = messages[i].size();
+    outputs[i].resize(::olm_peek_max_plaintext_length(
+        sessions[i], 0, messages[i].data(), messages[i].size()
+    ));
+    output_ptrs[i] = outputs[i].data();
+    max_lengths[i] = outputs[i].size();
+}
+
+std::vector<std::size_t> scratch(::olm_decrypt_batch_scratch_length(count));
+std::vector<std::size_t> plaintext_lengths(count);
+std::vector<const char *> errors(count);
+assert_equals(std::size_t(-1), ::olm_decrypt_batch(
+    sessions.data(), count, message_types.data(),
+    message_ptrs.data(), message_lengths.data(),
+    output_ptrs.data(), max_lengths.data(),
+    plaintext_lengths.data(), errors.data(),
+    scratch.data(), scratch.size() - 1, NULL, NULL
+));
+
+/* an executor which runs the jobs backwards, and counts them */
+struct ReverseExecutor {
+    static void run(
+        void * context, ::OlmBatchJob job, void * job_context,
+        std::size_t job_count
+    ) {
+        *static_cast<std::size_t *>(context) = job_count;
+        while (job_count--) {
+            job(job_context, job_count);
+        }
+    }
+};
+std::size_t job_count = 0;
+assert_equals(std::size_t(1), ::olm_decrypt_batch(
+    sessions.data(), count, message_types.data(),
+    message_ptrs.data(), message_lengths.data(),
+    output_ptrs.data(), max_lengths.data(),
+    plaintext_lengths.data(), errors.data(),
+    scratch.data(), scratch.size(), ReverseExecutor::run, &job_count
+));
+assert_equals(pairs, job_count);
+for (std::size_t i = 0; i < count - 1; ++i) {
+    assert_equals(std::size_t(12), plaintext_lengths[i]);
+    assert_equals(plaintext, outputs[i].data(), 12);
+    assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+}
+assert_equals(std::size_t(-1), plaintext_lengths[count - 1]);
+assert_equals(
+    std::string(::olm_session_last_error(sessions[count - 1])),
+    std::string(errors[count - 1])
+);
+assert_not_equals(std::string("SUCCESS"), std::string(errors[count - 1]));
+}
+
+{ /** Session index test */
+
+TestCase test_case("Session index test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+std::uint8_t b_account_buffer[::olm_account_size()];
+::OlmAccount *b_account = ::olm_account(b_account_buffer);
+std::uint8_t b_random[::olm_create_account_random_length(b_account)];
+mock_random_b(b_random, sizeof(b_random));
+::olm_create_account(b_account, b_random, sizeof(b_random));
+std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
+    b_account, 1
+)];
+mock_random_b(o_random, sizeof(o_random));
+::olm_account_generate_one_time_keys(b_account, 1, o_random, sizeof(o_random));
+
+std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
+std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
+::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+/* two sessions from a to b, with the same one-time key */
+const std::size_t count = 2;
+std::vector<std::vector<std::uint8_t>> buffers;
+std::vector<::OlmSession *> a_sessions(count), b_sessions(count);
+std::uint8_t plaintext[] = "Hello, World";
+auto encrypt = [&](::OlmSession * session) {
+    std::vector<std::uint8_t> message(::olm_encrypt_message_length(session, 12));
+    std::vector<std::uint8_t> random(::olm_encrypt_random_length(session));
+    mock_random_a(random.data(), random.size());
+    ::olm_encrypt(
+        session, plaintext, 12, random.data(), random.size(),
+        message.data(), message.size()
+    );
+    return message;
+};
+for (std::size_t i = 0; i < count; ++i) {
+    buffers.emplace_back(::olm_session_size());
+    a_sessions[i] = ::olm_session(buffers.back().data());
+    std::vector<std::uint8_t> rand(
+        ::olm_create_outbound_session_random_length(a_sessions[i])
+    );
+    mock_random_a(rand.data(), rand.size());
+    assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+        a_sessions[i], a_account,
+        b_id_keys + 15, 43, b_ot_keys + 25, 43,
+        rand.data(), rand.size()
+    ));
+    std::vector<std::uint8_t> message(encrypt(a_sessions[i]));
+    buffers.emplace_back(::olm_session_size());
+    b_sessions[i] = ::olm_session(buffers.back().data());
+    assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+        b_sessions[i], b_account, message.data(), message.size()
+    ));
+}
+
+std::vector<std::uint8_t> one_buffer(::olm_session_index_size(1));
+::OlmSessionIndex *small = ::olm_session_index(one_buffer.data(), 1);
+assert_equals(std::size_t(0), ::olm_session_index_add(small, b_sessions[0]));
+assert_equals(std::size_t(-1), ::olm_session_index_add(small, b_sessions[1]));
+assert_equals(
+    std::string("STORE_FULL"),
+    std::string(::olm_session_index_last_error(small))
+);
+
+std::vector<std::uint8_t> index_buffer(::olm_session_index_size(8));
+::OlmSessionIndex *index = ::olm_session_index(index_buffer.data(), 8);
+for (std::size_t i = 0; i < count; ++i) {
+    assert_equals(std::size_t(0), ::olm_session_index_add(index, b_sessions[i]));
+}
+/* adding a session again leaves it there once */
+assert_equals(std::size_t(0), ::olm_session_index_add(index, b_sessions[1]));
+assert_equals(count, ::olm_session_index_count(index));
+
+/* a later pre-key message from each of a's sessions finds b's session */
+std::uint8_t view_buffer[::olm_message_view_size()];
+::OlmMessageView *view = ::olm_message_view(view_buffer);
+std::uint8_t route[::olm_session_route_length()];
+std::uint8_t session_route[::olm_session_route_length()];
+for (std::size_t i = 0; i < count; ++i) {
+    std::vector<std::uint8_t> message(encrypt(a_sessions[i]));
+    assert_equals(std::size_t(0), ::olm_message_view_decode(
+        view, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size()
+    ));
+    assert_equals(sizeof(route), ::olm_message_view_route(
+        view, route, sizeof(route)
+    ));
+    assert_equals(b_sessions[i], ::olm_session_index_find(
+        index, route, sizeof(route)
+    ));
+    assert_equals(sizeof(session_route), ::olm_session_route(
+        b_sessions[i], session_route, sizeof(session_route)
+    ));
+    assert_equals(session_route, route, sizeof(route));
+}
+
+assert_equals(std::size_t(-1), ::olm_message_view_route(
+    view, route, sizeof(route) - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_message_view_last_error(view))
+);
+
+/* once the session is removed the message has nowhere to go */
+assert_equals(std::size_t(0), ::olm_session_index_remove(index, b_sessions[1]));
+assert_equals(std::size_t(-1), ::olm_session_index_remove(index, b_sessions[1]));
+assert_equals((::OlmSession *)nullptr, ::olm_session_index_find(
+    index, route, sizeof(route)
+));
+assert_equals(
+    std::string("UNKNOWN_SESSION_ID"),
+    std::string(::olm_session_index_last_error(index))
+);
+assert_equals(std::size_t(1), ::olm_session_index_count(index));
+}
+
+{ /** Session limits test */
+
+TestCase test_case("Session limits test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+assert_equals(
+    ::olm_session_size(), ::olm_session_size_with_limits(5, 40)
+);
+assert_equals(true, ::olm_session_size_with_limits(1, 4) < ::olm_session_size());
+assert_equals(::olm_error(), ::olm_session_size_with_limits(0, 4));
+assert_equals(::olm_error(), ::olm_session_size_with_limits(1, 40000));
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+std::uint8_t b_account_buffer[::olm_account_size()];
+::OlmAccount *b_account = ::olm_account(b_account_buffer);
+std::uint8_t b_random[::olm_create_account_random_length(b_account)];
+mock_random_b(b_random, sizeof(b_random));
+::olm_create_account(b_account, b_random, sizeof(b_random));
+std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
+        b_account, 1
+)];
+mock_random_b(o_random, sizeof(o_random));
+::olm_account_generate_one_time_keys(b_account, 1, o_random, sizeof(o_random));
+
+std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
+std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
+::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+std::uint8_t a_session_buffer[::olm_session_size()];
+::OlmSession *a_session = ::olm_session(a_session_buffer);
+std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
+mock_random_a(a_rand, sizeof(a_rand));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys + 15, 43,
+    b_ot_keys + 25, 43,
+    a_rand, sizeof(a_rand)
+));
+
+/* Alice's messages all use the same chain since Bob never replies */
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::vector<std::uint8_t>> messages(21);
+for (auto & message : messages) {
+    message.resize(::olm_encrypt_message_length(a_session, 12));
+    assert_not_equals(std::size_t(-1), ::olm_encrypt(
+        a_session, plaintext, 12, NULL, 0, message.data(), message.size()
+    ));
+}
+
+/* Bob keeps one chain, four skipped keys and looks at most ten ahead */
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size_with_limits(1, 4));
+::OlmSession *b_session = ::olm_session_with_limits(
+    b_session_buffer.data(), 1, 4, 10
+);
+std::vector<std::uint8_t> tmp(messages[0]);
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+
+std::uint8_t output[64];
+auto decrypt = [&](::OlmSession * session, std::size_t i) {
+    std::vector<std::uint8_t> message(messages[i]);
+    return ::olm_decrypt(
+        session, 0, message.data(), message.size(), output, sizeof(output)
+    );
+};
+
+assert_equals(std::size_t(12), decrypt(b_session, 0));
+/* skips 1 to 7, keeping the keys for 4 to 7 */
+assert_equals(std::size_t(12), decrypt(b_session, 8));
+assert_equals(std::size_t(-1), decrypt(b_session, 3));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"),
+    std::string(::olm_session_last_error(b_session))
+);
+assert_equals(std::size_t(12), decrypt(b_session, 5));
+/* 20 is eleven ahead of the chain, 19 only ten */
+assert_equals(std::size_t(-1), decrypt(b_session, 20));
+assert_equals(std::size_t(12), decrypt(b_session, 19));
+
+/* the pickle fits in a default session, but not in a smaller one */
+std::vector<std::uint8_t> pickled(::olm_pickle_session_length(b_session));
+::olm_pickle_session(b_session, "secret_key", 10, pickled.data(), pickled.size());
+
+std::vector<std::uint8_t> c_session_buffer(::olm_session_size());
+::OlmSession *c_session = ::olm_session(c_session_buffer.data());
+tmp = pickled;
+assert_equals(tmp.size(), ::olm_unpickle_session(
+    c_session, "secret_key", 10, tmp.data(), tmp.size()
+));
+assert_equals(std::size_t(12), decrypt(c_session, 18));
+assert_equals(std::size_t(-1), decrypt(c_session, 14));
+
+std::vector<std::uint8_t> d_session_buffer(::olm_session_size_with_limits(1, 2));
+::OlmSession *d_session = ::olm_session_with_limits(
+    d_session_buffer.data(), 1, 2, 10
+);
+tmp = pickled;
+assert_equals(std::size_t(-1), ::olm_unpickle_session(
+    d_session, "secret_key", 10, tmp.data(), tmp.size()
+));
+assert_equals(
+    std::string("SESSION_TOO_SMALL"),
+    std::string(::olm_session_last_error(d_session))
+);
+
+/* evicting skipped keys shrinks the pickle straight away */
+std::size_t pickled_length = ::olm_pickle_session_length(c_session);
+assert_equals(std::size_t(0), ::olm_session_set_skipped_key_eviction(
+    c_session, 0, 1
+));
+assert_equals(
+    true, ::olm_pickle_session_length(c_session) < pickled_length
+);
+assert_equals(std::size_t(-1), decrypt(c_session, 16));
+assert_equals(std::size_t(12), decrypt(c_session, 17));
+
+assert_equals(
+    b_session_buffer.size(), ::olm_clear_session(b_session)
+);
+}
+
+{ /** Session copy test */
+
+TestCase test_case("Session copy test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+std::uint8_t b_account_buffer[::olm_account_size()];
+::OlmAccount *b_account = ::olm_account(b_account_buffer);
+std::uint8_t b_random[::olm_create_account_random_length(b_account)];
+mock_random_b(b_random, sizeof(b_random));
+::olm_create_account(b_account, b_random, sizeof(b_random));
+std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
+        b_account, 1
+)];
+mock_random_b(o_random, sizeof(o_random));
+::olm_account_generate_one_time_keys(b_account, 1, o_random, sizeof(o_random));
+
+std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
+std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
+::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+std::uint8_t a_session_buffer[::olm_session_size()];
+::OlmSession *a_session = ::olm_session(a_session_buffer);
+std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
+mock_random_a(a_rand, sizeof(a_rand));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys + 15, 43,
+    b_ot_keys + 25, 43,
+    a_rand, sizeof(a_rand)
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::vector<std::uint8_t>> messages(6);
+for (auto & message : messages) {
+    message.resize(::olm_encrypt_message_length(a_session, 12));
+    assert_not_equals(std::size_t(-1), ::olm_encrypt(
+        a_session, plaintext, 12, NULL, 0, message.data(), message.size()
+    ));
+}
+
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size_with_limits(2, 8));
+::OlmSession *b_session = ::olm_session_with_limits(
+    b_session_buffer.data(), 2, 8, 100
+);
+std::vector<std::uint8_t> tmp(messages[0]);
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+
+std::uint8_t output[64];
+auto decrypt = [&](::OlmSession * session, std::size_t i) {
+    std::vector<std::uint8_t> message(messages[i]);
+    return ::olm_decrypt(
+        session, 0, message.data(), message.size(), output, sizeof(output)
+    );
+};
+auto pickle = [](::OlmSession * session) {
+    std::vector<std::uint8_t> pickled(::olm_pickle_session_length(session));
+    ::olm_pickle_session(
+        session, "secret_key", 10, pickled.data(), pickled.size()
+    );
+    return pickled;
+};
+
+/* skips 1 to 3, keeping their keys */
+assert_equals(std::size_t(12), decrypt(b_session, 4));
+assert_equals(b_session_buffer.size(), ::olm_session_copy_size(b_session));
+
+std::vector<std::uint8_t> c_session_buffer(b_session_buffer.size());
+assert_equals(
+    static_cast<::OlmSession *>(nullptr),
+    ::olm_session_copy(
+        c_session_buffer.data(), c_session_buffer.size() - 1, b_session
+    )
+);
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_session_last_error(b_session))
+);
+
+::OlmSession *c_session = ::olm_session_copy(
+    c_session_buffer.data(), c_session_buffer.size(), b_session
+);
+assert_not_equals(static_cast<::OlmSession *>(nullptr), c_session);
+std::vector<std::uint8_t> b_pickled(pickle(b_session));
+std::vector<std::uint8_t> c_pickled(pickle(c_session));
+assert_equals(b_pickled.size(), c_pickled.size());
+assert_equals(b_pickled.data(), c_pickled.data(), b_pickled.size());
+
+/* the copy uses its own skipped keys and chains, leaving the original
+ * as it was */
+assert_equals(std::size_t(12), decrypt(c_session, 2));
+assert_equals(std::size_t(-1), decrypt(c_session, 2));
+assert_equals(std::size_t(12), decrypt(c_session, 5));
+c_pickled = pickle(b_session);
+assert_equals(b_pickled.data(), c_pickled.data(), b_pickled.size());
+assert_equals(std::size_t(12), decrypt(b_session, 2));
+assert_equals(std::size_t(12), decrypt(b_session, 1));
+
+/* a reply from the copy is something Alice can read, and so is one from
+ * the original; each ratchets on from the same state */
+std::uint8_t reply_random[32];
+mock_random_b(reply_random, sizeof(reply_random));
+std::vector<std::uint8_t> reply(::olm_encrypt_message_length(c_session, 12));
+assert_equals(reply.size(), ::olm_encrypt(
+    c_session, plaintext, 12, reply_random, sizeof(reply_random),
+    reply.data(), reply.size()
+));
+std::vector<std::uint8_t> a_copy_buffer(::olm_session_copy_size(a_session));
+::OlmSession *a_copy = ::olm_session_copy(
+    a_copy_buffer.data(), a_copy_buffer.size(), a_session
+);
+assert_equals(std::size_t(12), ::olm_decrypt(
+    a_copy, 1, reply.data(), reply.size(), output, sizeof(output)
+));
+assert_equals(plaintext, output, 12);
+
+mock_random_b(reply_random, sizeof(reply_random));
+reply.resize(::olm_encrypt_message_length(b_session, 12));
+assert_equals(reply.size(), ::olm_encrypt(
+    b_session, plaintext, 12, reply_random, sizeof(reply_random),
+    reply.data(), reply.size()
+));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    a_session, 1, reply.data(), reply.size(), output, sizeof(output)
+));
+assert_equals(plaintext, output, 12);
+
+assert_equals(c_session_buffer.size(), ::olm_clear_session(c_session));
+assert_equals(b_session_buffer.size(), ::olm_clear_session(b_session));
+}
+
+{ /** Move session test */
+
+TestCase test_case("Move session test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+std::uint8_t b_account_buffer[::olm_account_size()];
+::OlmAccount *b_account = ::olm_account(b_account_buffer);
+std::uint8_t b_random[::olm_create_account_random_length(b_account)];
+mock_random_b(b_random, sizeof(b_random));
+::olm_create_account(b_account, b_random, sizeof(b_random));
+std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
+        b_account, 1
+)];
+mock_random_b(o_random, sizeof(o_random));
+::olm_account_generate_one_time_keys(b_account, 1, o_random, sizeof(o_random));
+
+std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
+std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
+::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+std::uint8_t a_session_buffer[::olm_session_size()];
+::OlmSession *a_session = ::olm_session(a_session_buffer);
+std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
+mock_random_a(a_rand, sizeof(a_rand));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys + 15, 43,
+    b_ot_keys + 25, 43,
+    a_rand, sizeof(a_rand)
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::vector<std::uint8_t>> messages(6);
+for (auto & message : messages) {
+    message.resize(::olm_encrypt_message_length(a_session, 12));
+    assert_not_equals(std::size_t(-1), ::olm_encrypt(
+        a_session, plaintext, 12, NULL, 0, message.data(), message.size()
+    ));
+}
+
+std::uint8_t output[64];
+auto decrypt = [&](::OlmSession * session, std::size_t i) {
+    std::vector<std::uint8_t> message(messages[i]);
+    std::size_t result = ::olm_decrypt(
+        session, 0, message.data(), message.size(), output, sizeof(output)
+    );
+    if (result == 12) {
+        assert_equals(plaintext, output, 12);
+    }
+    return result;
+};
+auto move = [](std::vector<std::uint8_t> & from) {
+    std::vector<std::uint8_t> to(from.size());
+    std::memcpy(to.data(), from.data(), from.size());
+    std::memset(from.data(), 0xff, from.size());
+    return to;
+};
+
+/* a session finds its chains and skipped keys from offsets, so it still
+ * works once moved with memcpy and the old memory wiped */
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+std::vector<std::uint8_t> tmp(messages[0]);
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+/* skips 0 to 3, keeping their keys */
+assert_equals(std::size_t(12), decrypt(b_session, 4));
+
+std::vector<std::uint8_t> b_moved_buffer(move(b_session_buffer));
+::OlmSession *b_moved =
+    reinterpret_cast<::OlmSession *>(b_moved_buffer.data());
+assert_equals(std::size_t(12), decrypt(b_moved, 2));
+assert_equals(std::size_t(-1), decrypt(b_moved, 2));
+assert_equals(std::size_t(12), decrypt(b_moved, 1));
+assert_equals(std::size_t(12), decrypt(b_moved, 5));
+assert_equals(std::size_t(12), decrypt(b_moved, 3));
+
+/* a compact session's skipped keys stay where its allocator put them */
+std::size_t slot_size = ::olm_compact_session_skipped_key_size();
+std::vector<std::uint8_t> slab_memory(::olm_slab_size(slot_size, 1));
+::OlmSlab *slab = ::olm_slab(slab_memory.data(), slot_size, 1);
+::OlmAllocator allocator;
+::olm_slab_allocator(slab, &allocator);
+std::vector<std::uint8_t> c_session_buffer(::olm_compact_session_size());
+::OlmSession *c_session = ::olm_compact_session(
+    c_session_buffer.data(), &allocator
+);
+tmp = messages[0];
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    c_session, b_account, tmp.data(), tmp.size()
+));
+assert_equals(std::size_t(12), decrypt(c_session, 3));
+assert_equals(std::size_t(1), ::olm_slab_slots_in_use(slab));
+
+std::vector<std::uint8_t> c_moved_buffer(move(c_session_buffer));
+::OlmSession *c_moved =
+    reinterpret_cast<::OlmSession *>(c_moved_buffer.data());
+assert_equals(std::size_t(12), decrypt(c_moved, 1));
+assert_equals(std::size_t(12), decrypt(c_moved, 4));
+assert_equals(std::size_t(12), decrypt(c_moved, 2));
+assert_equals(std::size_t(1), ::olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(12), decrypt(c_moved, 0));
+assert_equals(std::size_t(0), ::olm_slab_slots_in_use(slab));
+
+assert_equals(b_moved_buffer.size(), ::olm_clear_session(b_moved));
+assert_equals(c_moved_buffer.size(), ::olm_clear_session(c_moved));
+}
+
+{ /** Account limits test */
+
+TestCase test_case("Account limits test");
+MockRandom mock_random('A', 0x00);
+
+assert_equals(::olm_account_size(), ::olm_account_size_with_limits(100));
+assert_equals(::olm_error(), ::olm_account_size_with_limits(40000));
+
+std::vector<std::uint8_t> account_buffer(::olm_account_size_with_limits(10));
+::OlmAccount *account = ::olm_account_with_limits(account_buffer.data(), 10);
+std::vector<std::uint8_t> random(::olm_create_account_random_length(account));
+mock_random(random.data(), random.size());
+::olm_create_account(account, random.data(), random.size());
+assert_equals(std::size_t(10), ::olm_account_max_number_of_one_time_keys(account));
+
+random.resize(::olm_account_generate_one_time_keys_random_length(account, 10));
+mock_random(random.data(), random.size());
+::olm_account_generate_one_time_keys(account, 10, random.data(), random.size());
+std::vector<std::uint8_t> ot_keys(::olm_account_one_time_keys_length(account));
+::olm_account_one_time_keys(account, ot_keys.data(), ot_keys.size());
+
+std::vector<std::uint8_t> id_keys(::olm_account_identity_keys_length(account));
+::olm_account_identity_keys(account, id_keys.data(), id_keys.size());
+
+/* grow it, keeping the keys we have */
+std::vector<std::uint8_t> bigger_buffer(::olm_account_size_with_limits(1000));
+account = ::olm_account_resize(account, bigger_buffer.data(), 1000);
+assert_equals(std::size_t(1000), ::olm_account_max_number_of_one_time_keys(account));
+
+std::vector<std::uint8_t> id_keys_2(::olm_account_identity_keys_length(account));
+::olm_account_identity_keys(account, id_keys_2.data(), id_keys_2.size());
+assert_equals(true, id_keys == id_keys_2);
+
+std::vector<std::uint8_t> ot_keys_2(::olm_account_one_time_keys_length(account));
+::olm_account_one_time_keys(account, ot_keys_2.data(), ot_keys_2.size());
+assert_equals(true, ot_keys == ot_keys_2);
+
+random.resize(::olm_account_generate_one_time_keys_random_length(account, 990));
+mock_random(random.data(), random.size());
+::olm_account_generate_one_time_keys(account, 990, random.data(), random.size());
+
+/* the first keys are still there after adding enough to fill a default
+ * account many times over */
+std::string first_json(ot_keys.begin(), ot_keys.end());
+std::size_t key_start = first_json.find("\":\"") + 3;
+std::string first_key = first_json.substr(key_start, 43);
+std::vector<std::uint8_t> all_keys(::olm_account_one_time_keys_length(account));
+::olm_account_one_time_keys(account, all_keys.data(), all_keys.size());
+std::string all_json(all_keys.begin(), all_keys.end());
+assert_not_equals(std::string::npos, all_json.find(first_key));
+
+/* the pickle only fits in an account with enough room */
+std::vector<std::uint8_t> pickled(::olm_pickle_account_length(account));
+::olm_pickle_account(account, "secret_key", 10, pickled.data(), pickled.size());
+
+std::vector<std::uint8_t> small_buffer(::olm_account_size());
+::OlmAccount *small_account = ::olm_account(small_buffer.data());
+std::vector<std::uint8_t> tmp(pickled);
+assert_equals(std::size_t(-1), ::olm_unpickle_account(
+    small_account, "secret_key", 10, tmp.data(), tmp.size()
+));
+assert_equals(
+    std::string("ACCOUNT_TOO_SMALL"),
+    std::string(::olm_account_last_error(small_account))
+);
+
+std::vector<std::uint8_t> copy_buffer(::olm_account_size_with_limits(1000));
+::OlmAccount *copy = ::olm_account_with_limits(copy_buffer.data(), 1000);
+tmp = pickled;
+assert_equals(tmp.size(), ::olm_unpickle_account(
+    copy, "secret_key", 10, tmp.data(), tmp.size()
+));
+std::vector<std::uint8_t> repickled(::olm_pickle_account_length(copy));
+::olm_pickle_account(copy, "secret_key", 10, repickled.data(), repickled.size());
+assert_equals(true, pickled == repickled);
+
+}
+
+{ /** Identity keys unpickle test */
+
+TestCase test_case("Identity keys unpickle test");
+
+MockRandom mock_random('P');
+std::vector<std::uint8_t> account_buffer(::olm_account_size());
+::OlmAccount *account = ::olm_account(account_buffer.data());
+std::vector<std::uint8_t> random(::olm_create_account_random_length(account));
+mock_random(random.data(), random.size());
+::olm_create_account(account, random.data(), random.size());
+
+/* an account with no one time keys has a pickle of a single block */
+std::vector<std::uint8_t> id_keys(::olm_account_identity_keys_length(account));
+::olm_account_identity_keys(account, id_keys.data(), id_keys.size());
+std::vector<std::uint8_t> pickled(::olm_pickle_account_length(account));
+::olm_pickle_account(account, "secret_key", 10, pickled.data(), pickled.size());
+
+std::vector<std::uint8_t> partial_buffer(::olm_account_size_with_limits(0));
+::OlmAccount *partial = ::olm_account_with_limits(partial_buffer.data(), 0);
+std::vector<std::uint8_t> tmp(pickled);
+assert_equals(tmp.size(), ::olm_unpickle_account_identity_keys(
+    partial, "secret_key", 10, tmp.data(), tmp.size()
+));
+std::vector<std::uint8_t> partial_id_keys(id_keys.size());
+::olm_account_identity_keys(
+    partial, partial_id_keys.data(), partial_id_keys.size()
+);
+assert_equals(true, id_keys == partial_id_keys);
+
+random.resize(::olm_account_generate_one_time_keys_random_length(account, 50));
+mock_random(random.data(), random.size());
+::olm_account_generate_one_time_keys(account, 50, random.data(), random.size());
+pickled.resize(::olm_pickle_account_length(account));
+::olm_pickle_account(account, "secret_key", 10, pickled.data(), pickled.size());
+
+tmp = pickled;
+assert_equals(tmp.size(), ::olm_unpickle_account_identity_keys(
+    partial, "secret_key", 10, tmp.data(), tmp.size()
+));
+::olm_account_identity_keys(
+    partial, partial_id_keys.data(), partial_id_keys.size()
+);
+assert_equals(true, id_keys == partial_id_keys);
+
+/* it signs just as the whole account does */
+std::uint8_t message[] = "Hello, World";
+std::vector<std::uint8_t> signature(::olm_account_signature_length(account));
+std::vector<std::uint8_t> partial_signature(signature.size());
+::olm_account_sign(account, message, 12, signature.data(), signature.size());
+::olm_account_sign(
+    partial, message, 12, partial_signature.data(), partial_signature.size()
+);
+assert_equals(true, signature == partial_signature);
+
+/* but it has no one time keys to give out, make more of, or pickle */
+std::vector<std::uint8_t> ot_keys(1024);
+assert_equals(std::size_t(-1), ::olm_account_one_time_keys(
+    partial, ot_keys.data(), ot_keys.size()
+));
+assert_equals(
+    std::string("PARTIAL_ACCOUNT"),
+    std::string(::olm_account_last_error(partial))
+);
+assert_equals(std::size_t(-1), ::olm_account_generate_one_time_keys(
+    partial, 0, nullptr, 0
+));
+std::vector<std::uint8_t> repickled(::olm_pickle_account_length(partial));
+assert_equals(std::size_t(-1), ::olm_pickle_account(
+    partial, "secret_key", 10, repickled.data(), repickled.size()
+));
+assert_equals(
+    std::string("PARTIAL_ACCOUNT"),
+    std::string(::olm_account_last_error(partial))
+);
+
+/* the one time keys aren't decrypted, but are still authenticated */
+tmp = pickled;
+tmp[tmp.size() - 50] ^= 1;
+assert_equals(std::size_t(-1), ::olm_unpickle_account_identity_keys(
+    partial, "secret_key", 10, tmp.data(), tmp.size()
+));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_account_last_error(partial))
+);
+tmp = pickled;
+assert_equals(std::size_t(-1), ::olm_unpickle_account_identity_keys(
+    partial, "wrong_key!", 10, tmp.data(), tmp.size()
+));
+assert_equals(
+    std::string("BAD_ACCOUNT_KEY"),
+    std::string(::olm_account_last_error(partial))
+);
+
+/* a full unpickle brings the one time keys back */
+std::vector<std::uint8_t> copy_buffer(::olm_account_size());
+::OlmAccount *copy = ::olm_account(copy_buffer.data());
+tmp = pickled;
+assert_equals(tmp.size(), ::olm_unpickle_account_identity_keys(
+    copy, "secret_key", 10, tmp.data(), tmp.size()
+));
+tmp = pickled;
+assert_equals(tmp.size(), ::olm_unpickle_account(
+    copy, "secret_key", 10, tmp.data(), tmp.size()
+));
+repickled.resize(::olm_pickle_account_length(copy));
+::olm_pickle_account(copy, "secret_key", 10, repickled.data(), repickled.size());
+assert_equals(true, pickled == repickled);
+
+}
+
+{ /** Invalid base64 test */
+
+TestCase test_case("Invalid base64 test");
+
+std::vector<std::uint8_t> utility_buffer(::olm_utility_size());
+::OlmUtility *utility = ::olm_utility(utility_buffer.data());
+
+/* right length for a key, but not base64 */
+std::string key("wo76WcYtb0Vk/pBOdmduiGJ0wIEjW4IBMbbQn7aS-To");
+std::string signature(86, 'A');
+assert_equals(std::size_t(-1), ::olm_ed25519_verify(
+    utility, key.data(), key.size(), "hello", 5,
+    &signature[0], signature.size()
+));
+assert_equals(
+    std::string("INVALID_BASE64"),
+    std::string(::olm_utility_last_error(utility))
+);
+
+std::vector<std::uint8_t> session_buffer(::olm_session_size());
+::OlmSession *session = ::olm_session(session_buffer.data());
+std::string message("AwogI1JyYdRE=ZmOmUpt3L1mC1v0qY3WnvGKAHe4ah1RzzUSIAz");
+std::uint8_t plaintext[64];
+assert_equals(std::size_t(-1), ::olm_decrypt(
+    session, 0, &message[0], message.size(), plaintext, sizeof(plaintext)
+));
+assert_equals(
+    std::string("INVALID_BASE64"),
+    std::string(::olm_session_last_error(session))
+);
+
+}
+
+{ /** One time keys output test */
+
+TestCase test_case("One time keys output test");
+MockRandom mock_random('A', 0x00);
+
+std::vector<std::uint8_t> account_buffer(::olm_account_size());
+::OlmAccount *account = ::olm_account(account_buffer.data());
+std::vector<std::uint8_t> random(::olm_create_account_random_length(account));
+mock_random(random.data(), random.size());
+::olm_create_account(account, random.data(), random.size());
+
+auto append = [](void * context, void const * data, std::size_t length) {
+    std::string & output = *static_cast<std::string *>(context);
+    output.append(static_cast<char const *>(data), length);
+};
+
+/* with no keys */
+std::string streamed;
+assert_equals(std::size_t(17), ::olm_account_write_one_time_keys(
+    account, append, &streamed
+));
+assert_equals(std::string("{\"curve25519\":{}}"), streamed);
+assert_equals(std::size_t(0), ::olm_account_one_time_keys_binary_length(account));
+
+random.resize(::olm_account_generate_one_time_keys_random_length(account, 5));
+mock_random(random.data(), random.size());
+::olm_account_generate_one_time_keys(account, 5, random.data(), random.size());
+
+std::vector<std::uint8_t> json(::olm_account_one_time_keys_length(account));
+::olm_account_one_time_keys(account, json.data(), json.size());
+streamed.clear();
+assert_equals(json.size(), ::olm_account_write_one_time_keys(
+    account, append, &streamed
+));
+assert_equals(std::string(json.begin(), json.end()), streamed);
+
+std::vector<std::uint8_t> binary(::olm_account_one_time_keys_binary_length(account));
+assert_equals(std::size_t(5 * 36), binary.size());
+assert_equals(std::size_t(-1), ::olm_account_one_time_keys_binary(
+    account, binary.data(), binary.size() - 1
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_account_last_error(account))
+);
+assert_equals(binary.size(), ::olm_account_one_time_keys_binary(
+    account, binary.data(), binary.size()
+));
+
+/* each tuple is the same id and key as the JSON, in the same order */
+std::size_t json_pos = 0;
+for (std::size_t i = 0; i < 5; ++i) {
+    std::uint8_t const * tuple = binary.data() + 36 * i;
+    std::uint8_t expected[6 + 3 + 43];
+    std::uint8_t * pos = olm::encode_base64(tuple, 4, expected);
+    std::memcpy(pos, "\":\"", 3);
+    olm::encode_base64(tuple + 4, 32, pos + 3);
+    std::string entry(expected, expected + sizeof(expected));
+    std::size_t found = streamed.find(entry);
+    assert_not_equals(std::string::npos, found);
+    assert_equals(true, found > json_pos);
+    json_pos = found;
+}
+
+/* published keys are left out of both */
+::olm_account_mark_keys_as_published(account);
+assert_equals(std::size_t(0), ::olm_account_one_time_keys_binary_length(account));
+streamed.clear();
+::olm_account_write_one_time_keys(account, append, &streamed);
+assert_equals(std::string("{\"curve25519\":{}}"), streamed);
+
+}
+
+{ /** More messages test */
+
+TestCase test_case("More messages test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::uint8_t a_account_buffer[::olm_account_size()];
+::OlmAccount *a_account = ::olm_account(a_account_buffer);
+std::uint8_t a_random[::olm_create_account_random_length(a_account)];
+mock_random_a(a_random, sizeof(a_random));
+::olm_create_account(a_account, a_random, sizeof(a_random));
+
+std::uint8_t b_account_buffer[::olm_account_size()];
+::OlmAccount *b_account = ::olm_account(b_account_buffer);
+std::uint8_t b_random[::olm_create_account_random_length(b_account)];
+mock_random_b(b_random, sizeof(b_random));
+::olm_create_account(b_account, b_random, sizeof(b_random));
+std::uint8_t o_random[::olm_account_generate_one_time_keys_random_length(
+        b_account, 42
+)];
+mock_random_b(o_random, sizeof(o_random));
+::olm_account_generate_one_time_keys(b_account, 42, o_random, sizeof(o_random));
+
+std::uint8_t b_id_keys[::olm_account_identity_keys_length(b_account)];
+std::uint8_t b_ot_keys[::olm_account_one_time_keys_length(b_account)];
+::olm_account_identity_keys(b_account, b_id_keys, sizeof(b_id_keys));
+::olm_account_one_time_keys(b_account, b_ot_keys, sizeof(b_ot_keys));
+
+std::uint8_t a_session_buffer[::olm_session_size()];
+::OlmSession *a_session = ::olm_session(a_session_buffer);
+std::uint8_t a_rand[::olm_create_outbound_session_random_length(a_session)];
+mock_random_a(a_rand, sizeof(a_rand));
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys + 15, 43,
+    b_ot_keys + 25, 43,
+    a_rand, sizeof(a_rand)
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::uint8_t message_1[::olm_encrypt_message_length(a_session, 12)];
+std::uint8_t a_message_random[::olm_encrypt_random_length(a_session)];
+mock_random_a(a_message_random, sizeof(a_message_random));
+assert_equals(std::size_t(0), ::olm_encrypt_message_type(a_session));
+assert_not_equals(std::size_t(-1), ::olm_encrypt(
+    a_session,
+    plaintext, 12,
+    a_message_random, sizeof(a_message_random),
+    message_1, sizeof(message_1)
+));
+
+std::uint8_t tmp_message_1[sizeof(message_1)];
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+std::uint8_t b_session_buffer[::olm_account_size()];
+::OlmSession *b_session = ::olm_session(b_session_buffer);
+::olm_create_inbound_session(
+    b_session, b_account, tmp_message_1, sizeof(message_1)
+);
+
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+std::uint8_t plaintext_1[::olm_decrypt_max_plaintext_length(
+    b_session, 0, tmp_message_1, sizeof(message_1)
+)];
+std::memcpy(tmp_message_1, message_1, sizeof(message_1));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, 0,
+    tmp_message_1, sizeof(message_1),
+    plaintext_1, sizeof(plaintext_1)
+));
+
+for (unsigned i = 0; i < 8; ++i) {
+    {
+    std::uint8_t msg_a[::olm_encrypt_message_length(a_session, 12)];
+    std::uint8_t rnd_a[::olm_encrypt_random_length(a_session)];
+    mock_random_a(rnd_a, sizeof(rnd_a));
+    std::size_t type_a = ::olm_encrypt_message_type(a_session);
+    assert_not_equals(std::size_t(-1), ::olm_encrypt(
         a_session, plaintext, 12, rnd_a, sizeof(rnd_a), msg_a, sizeof(msg_a)
     ));
 
-    std::uint8_t tmp_a[sizeof(msg_a)];
-    std::memcpy(tmp_a, msg_a, sizeof(msg_a));
-    std::uint8_t out_a[::olm_decrypt_max_plaintext_length(
-        b_session, type_a, tmp_a, sizeof(tmp_a)
-    )];
-    std::memcpy(tmp_a, msg_a, sizeof(msg_a));
+    std::uint8_t tmp_a[sizeof(msg_a)];
+    std::memcpy(tmp_a, msg_a, sizeof(msg_a));
+    std::uint8_t out_a[::olm_decrypt_max_plaintext_length(
+        b_session, type_a, tmp_a, sizeof(tmp_a)
+    )];
+    std::memcpy(tmp_a, msg_a, sizeof(msg_a));
+    assert_equals(std::size_t(12), ::olm_decrypt(
+        b_session, type_a, msg_a, sizeof(msg_a), out_a, sizeof(out_a)
+    ));
+    }
+    {
+    std::uint8_t msg_b[::olm_encrypt_message_length(b_session, 12)];
+    std::uint8_t rnd_b[::olm_encrypt_random_length(b_session)];
+    mock_random_b(rnd_b, sizeof(rnd_b));
+    std::size_t type_b = ::olm_encrypt_message_type(b_session);
+    assert_not_equals(std::size_t(-1), ::olm_encrypt(
+        b_session, plaintext, 12, rnd_b, sizeof(rnd_b), msg_b, sizeof(msg_b)
+    ));
+
+    std::uint8_t tmp_b[sizeof(msg_b)];
+    std::memcpy(tmp_b, msg_b, sizeof(msg_b));
+    std::uint8_t out_b[::olm_decrypt_max_plaintext_length(
+        a_session, type_b, tmp_b, sizeof(tmp_b)
+    )];
+    std::memcpy(tmp_b, msg_b, sizeof(msg_b));
+    assert_equals(std::size_t(12), ::olm_decrypt(
+        a_session, type_b, msg_b, sizeof(msg_b), out_b, sizeof(out_b)
+    ));
+    }
+}
+}
+
+
+{ /** In-place encrypt and decrypt test */
+
+TestCase test_case("In-place encrypt and decrypt test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> random(256);
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+mock_random_a(random.data(), random.size());
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+));
+
+/* a copy of Alice's session, to check the message is the same as
+ * olm_encrypt() would make */
+std::vector<std::uint8_t> pickled(::olm_pickle_session_length(a_session));
+::olm_pickle_session(a_session, "", 0, pickled.data(), pickled.size());
+std::vector<std::uint8_t> c_session_buffer(::olm_session_size());
+::OlmSession *c_session = ::olm_session(c_session_buffer.data());
+::olm_unpickle_session(c_session, "", 0, pickled.data(), pickled.size());
+
+std::uint8_t plaintext[] = "Hello, World, from a buffer of its own";
+std::size_t plaintext_length = sizeof(plaintext) - 1;
+std::size_t message_length =
+    ::olm_encrypt_message_length(a_session, plaintext_length);
+std::vector<std::uint8_t> message_random(::olm_encrypt_random_length(a_session));
+mock_random_a(message_random.data(), message_random.size());
+std::vector<std::uint8_t> tmp_random(message_random);
+
+std::vector<std::uint8_t> expected(message_length);
+assert_equals(message_length, ::olm_encrypt(
+    c_session, plaintext, plaintext_length,
+    tmp_random.data(), tmp_random.size(),
+    expected.data(), expected.size()
+));
+
+std::vector<std::uint8_t> buffer(plaintext, plaintext + plaintext_length);
+buffer.resize(message_length - 1);
+tmp_random = message_random;
+assert_equals(std::size_t(-1), ::olm_encrypt_inplace(
+    a_session, plaintext_length,
+    tmp_random.data(), tmp_random.size(),
+    buffer.data(), buffer.size()
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_session_last_error(a_session))
+);
+
+buffer.resize(message_length);
+tmp_random = message_random;
+assert_equals(message_length, ::olm_encrypt_inplace(
+    a_session, plaintext_length,
+    tmp_random.data(), tmp_random.size(),
+    buffer.data(), buffer.size()
+));
+assert_equals(expected.data(), buffer.data(), message_length);
+
+std::vector<std::uint8_t> tmp(buffer);
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+
+/* a corrupted message is rejected */
+tmp = buffer;
+tmp[tmp.size() - 2] ^= 1;
+assert_equals(std::size_t(-1), ::olm_decrypt_inplace(
+    b_session, 0, tmp.data(), tmp.size()
+));
+
+assert_equals(plaintext_length, ::olm_decrypt_inplace(
+    b_session, 0, buffer.data(), buffer.size()
+));
+assert_equals(plaintext, buffer.data(), plaintext_length);
+
+/* and a reply using the ratchet */
+buffer.assign(plaintext, plaintext + plaintext_length);
+buffer.resize(::olm_encrypt_message_length(b_session, plaintext_length));
+message_random.resize(::olm_encrypt_random_length(b_session));
+mock_random_b(message_random.data(), message_random.size());
+assert_equals(std::size_t(1), ::olm_encrypt_message_type(b_session));
+assert_equals(buffer.size(), ::olm_encrypt_inplace(
+    b_session, plaintext_length,
+    message_random.data(), message_random.size(),
+    buffer.data(), buffer.size()
+));
+assert_equals(plaintext_length, ::olm_decrypt_inplace(
+    a_session, 1, buffer.data(), buffer.size()
+));
+assert_equals(plaintext, buffer.data(), plaintext_length);
+}
+
+
+{ /** Encrypt and decrypt to a buffer test */
+
+TestCase test_case("Encrypt and decrypt to a buffer test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> random(256);
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+mock_random_a(random.data(), random.size());
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+));
+
+std::vector<std::uint8_t> slab_memory(::olm_slab_size(1024, 2));
+::OlmSlab *slab = ::olm_slab(slab_memory.data(), 1024, 2);
+::OlmAllocator allocator;
+::olm_slab_allocator(slab, &allocator);
+
+std::uint8_t plaintext[] = "Hello, World, from a buffer of the library's";
+std::size_t plaintext_length = sizeof(plaintext) - 1;
+std::vector<std::uint8_t> message_random(::olm_encrypt_random_length(a_session));
+mock_random_a(message_random.data(), message_random.size());
+
+::OlmBuffer message = OLM_BUFFER_INIT;
+std::size_t message_length =
+    ::olm_encrypt_message_length(a_session, plaintext_length);
+assert_equals(message_length, ::olm_encrypt_to_buffer(
+    a_session, plaintext, plaintext_length,
+    message_random.data(), message_random.size(),
+    &allocator, &message
+));
+assert_equals(message_length, message.length);
+
+std::vector<std::uint8_t> tmp(message.data, message.data + message.length);
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+
+::OlmBuffer decrypted = OLM_BUFFER_INIT;
+assert_equals(plaintext_length, ::olm_decrypt_to_buffer(
+    b_session, 0, message.data, message.length, &allocator, &decrypted
+));
+assert_equals(plaintext_length, decrypted.length);
+assert_equals(plaintext, decrypted.data, plaintext_length);
+
+/* and a reply using the ratchet, in the same buffers */
+message_random.resize(::olm_encrypt_random_length(b_session));
+mock_random_b(message_random.data(), message_random.size());
+assert_equals(std::size_t(1), ::olm_encrypt_message_type(b_session));
+assert_not_equals(std::size_t(-1), ::olm_encrypt_to_buffer(
+    b_session, plaintext, plaintext_length,
+    message_random.data(), message_random.size(),
+    &allocator, &message
+));
+tmp.assign(message.data, message.data + message.length);
+tmp[tmp.size() - 2] ^= 1;
+assert_equals(std::size_t(-1), ::olm_decrypt_to_buffer(
+    a_session, 1, tmp.data(), tmp.size(), &allocator, &decrypted
+));
+assert_equals(std::size_t(0), decrypted.length);
+assert_equals(plaintext_length, ::olm_decrypt_to_buffer(
+    a_session, 1, message.data, message.length, &allocator, &decrypted
+));
+assert_equals(plaintext, decrypted.data, plaintext_length);
+assert_equals(std::size_t(2), ::olm_slab_slots_in_use(slab));
+
+/* a message too long for a slot can't be encrypted */
+std::vector<std::uint8_t> long_plaintext(1024);
+mock_random_b(message_random.data(), message_random.size());
+assert_equals(std::size_t(-1), ::olm_encrypt_to_buffer(
+    b_session, long_plaintext.data(), long_plaintext.size(),
+    message_random.data(), message_random.size(),
+    &allocator, &message
+));
+assert_equals(
+    std::string("ALLOCATION_FAILED"),
+    std::string(::olm_session_last_error(b_session))
+);
+
+::olm_buffer_release(&message);
+::olm_buffer_release(&decrypted);
+assert_equals(std::size_t(0), ::olm_slab_slots_in_use(slab));
+}
+
+
+{ /** Ratchet key pool test */
+
+TestCase test_case("Ratchet key pool test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> random(256);
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+mock_random_a(random.data(), random.size());
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::uint8_t output[64];
+std::vector<std::uint8_t> message(::olm_encrypt_message_length(a_session, 12));
+::olm_encrypt(a_session, plaintext, 12, NULL, 0, message.data(), message.size());
+std::vector<std::uint8_t> tmp(message);
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+::olm_create_inbound_session(b_session, b_account, tmp.data(), tmp.size());
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, 0, message.data(), message.size(), output, sizeof(output)
+));
+
+std::vector<std::uint8_t> pool_buffer(::olm_ratchet_key_pool_size(3));
+::OlmRatchetKeyPool *pool = ::olm_ratchet_key_pool(pool_buffer.data(), 3);
+assert_equals(std::size_t(0), ::olm_ratchet_key_pool_count(pool));
+assert_equals(std::size_t(96), ::olm_ratchet_key_pool_fill_random_length(pool));
+
+/* only whole keys' worth of random are used, and only as many as fit */
+std::vector<std::uint8_t> first_random(32);
+mock_random_b(first_random.data(), first_random.size());
+std::vector<std::uint8_t> key_random(first_random);
+assert_equals(std::size_t(1), ::olm_ratchet_key_pool_fill(
+    pool, key_random.data(), key_random.size()
+));
+key_random.resize(100);
+mock_random_b(key_random.data(), key_random.size());
+assert_equals(std::size_t(2), ::olm_ratchet_key_pool_fill(
+    pool, key_random.data(), key_random.size()
+));
+assert_equals(std::size_t(3), ::olm_ratchet_key_pool_count(pool));
+assert_equals(std::size_t(0), ::olm_ratchet_key_pool_fill_random_length(pool));
+
+/* Bob's reply takes the oldest key, so it is the same as olm_encrypt()
+ * would make with the random it came from */
+std::vector<std::uint8_t> pickled(::olm_pickle_session_length(b_session));
+::olm_pickle_session(b_session, "", 0, pickled.data(), pickled.size());
+std::vector<std::uint8_t> c_session_buffer(::olm_session_size());
+::OlmSession *c_session = ::olm_session(c_session_buffer.data());
+::olm_unpickle_session(c_session, "", 0, pickled.data(), pickled.size());
+
+std::vector<std::uint8_t> expected(::olm_encrypt_message_length(c_session, 12));
+assert_equals(expected.size(), ::olm_encrypt(
+    c_session, plaintext, 12, first_random.data(), first_random.size(),
+    expected.data(), expected.size()
+));
+message.resize(::olm_encrypt_message_length(b_session, 12));
+assert_equals(message.size(), ::olm_encrypt_with_key_pool(
+    b_session, pool, plaintext, 12, message.data(), message.size()
+));
+assert_equals(expected.data(), message.data(), message.size());
+assert_equals(std::size_t(2), ::olm_ratchet_key_pool_count(pool));
+
+/* a key is only taken when the session needs one */
+assert_equals(message.size(), ::olm_encrypt_with_key_pool(
+    b_session, pool, plaintext, 12, message.data(), message.size()
+));
+assert_equals(std::size_t(2), ::olm_ratchet_key_pool_count(pool));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    a_session, 1, message.data(), message.size(), output, sizeof(output)
+));
+
+/* Alice uses the pool too, and once it is empty gets NOT_ENOUGH_RANDOM */
+for (std::size_t i = 0; i < 3; ++i) {
+    ::OlmSession * sender = i % 2 ? b_session : a_session;
+    ::OlmSession * receiver = i % 2 ? a_session : b_session;
+    message.resize(::olm_encrypt_message_length(sender, 12));
+    std::size_t result = ::olm_encrypt_with_key_pool(
+        sender, pool, plaintext, 12, message.data(), message.size()
+    );
+    if (i == 2) {
+        assert_equals(std::size_t(-1), result);
+        assert_equals(
+            std::string("NOT_ENOUGH_RANDOM"),
+            std::string(::olm_session_last_error(sender))
+        );
+        break;
+    }
+    assert_equals(message.size(), result);
+    assert_equals(std::size_t(12), ::olm_decrypt(
+        receiver, 1, message.data(), message.size(), output, sizeof(output)
+    ));
+}
+assert_equals(std::size_t(0), ::olm_ratchet_key_pool_count(pool));
+
+assert_equals(std::size_t(3), ::olm_ratchet_key_pool_fill_auto_random(pool));
+assert_equals(message.size(), ::olm_encrypt_with_key_pool(
+    a_session, pool, plaintext, 12, message.data(), message.size()
+));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, 1, message.data(), message.size(), output, sizeof(output)
+));
+assert_equals(std::size_t(2), ::olm_ratchet_key_pool_count(pool));
+
+/* the keys are only wiped from OLM_TRIM_MEMORY_PRECOMPUTED */
+assert_equals(std::size_t(0), ::olm_ratchet_key_pool_trim_memory(
+    pool, OLM_TRIM_MEMORY_CACHES
+));
+assert_equals(std::size_t(2), ::olm_ratchet_key_pool_count(pool));
+assert_not_equals(std::size_t(0), ::olm_ratchet_key_pool_trim_memory(
+    pool, OLM_TRIM_MEMORY_PRECOMPUTED
+));
+assert_equals(std::size_t(0), ::olm_ratchet_key_pool_count(pool));
+assert_equals(std::size_t(96), ::olm_ratchet_key_pool_fill_random_length(pool));
+
+assert_equals(::olm_ratchet_key_pool_size(3), ::olm_clear_ratchet_key_pool(pool));
+}
+
+{ /** Prepare send test */
+
+TestCase test_case("Prepare send test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> random(256);
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+mock_random_a(random.data(), random.size());
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::uint8_t output[64];
+std::vector<std::uint8_t> message(::olm_encrypt_message_length(a_session, 12));
+::olm_encrypt(a_session, plaintext, 12, NULL, 0, message.data(), message.size());
+std::vector<std::uint8_t> tmp(message);
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+::olm_create_inbound_session(b_session, b_account, tmp.data(), tmp.size());
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, 0, message.data(), message.size(), output, sizeof(output)
+));
+
+/* Bob's reply after preparing is the same as olm_encrypt() would make with
+ * the random used to prepare */
+std::vector<std::uint8_t> pickled(::olm_pickle_session_length(b_session));
+::olm_pickle_session(b_session, "", 0, pickled.data(), pickled.size());
+std::vector<std::uint8_t> c_session_buffer(::olm_session_size());
+::OlmSession *c_session = ::olm_session(c_session_buffer.data());
+::olm_unpickle_session(c_session, "", 0, pickled.data(), pickled.size());
+
+std::vector<std::uint8_t> send_random(32);
+mock_random_b(send_random.data(), send_random.size());
+std::vector<std::uint8_t> expected(::olm_encrypt_message_length(c_session, 12));
+std::vector<std::uint8_t> key_random(send_random);
+assert_equals(expected.size(), ::olm_encrypt(
+    c_session, plaintext, 12, key_random.data(), key_random.size(),
+    expected.data(), expected.size()
+));
+
+assert_equals(std::size_t(32), ::olm_encrypt_random_length(b_session));
+key_random = send_random;
+assert_equals(std::size_t(-1), ::olm_session_prepare_send(
+    b_session, key_random.data(), 31
+));
+assert_equals(
+    std::string("NOT_ENOUGH_RANDOM"),
+    std::string(::olm_session_last_error(b_session))
+);
+key_random = send_random;
+assert_equals(std::size_t(0), ::olm_session_prepare_send(
+    b_session, key_random.data(), key_random.size()
+));
+assert_equals(std::size_t(0), ::olm_encrypt_random_length(b_session));
+/* preparing again does nothing */
+assert_equals(std::size_t(0), ::olm_session_prepare_send(b_session, NULL, 0));
+
+message.resize(::olm_encrypt_message_length(b_session, 12));
+assert_equals(message.size(), ::olm_encrypt(
+    b_session, plaintext, 12, NULL, 0, message.data(), message.size()
+));
+assert_equals(expected.data(), message.data(), message.size());
+assert_equals(std::size_t(12), ::olm_decrypt(
+    a_session, 1, message.data(), message.size(), output, sizeof(output)
+));
+
+/* Alice turns her ratchet with a key from a pool */
+std::vector<std::uint8_t> pool_buffer(::olm_ratchet_key_pool_size(1));
+::OlmRatchetKeyPool *pool = ::olm_ratchet_key_pool(pool_buffer.data(), 1);
+mock_random_a(key_random.data(), key_random.size());
+assert_equals(std::size_t(1), ::olm_ratchet_key_pool_fill(
+    pool, key_random.data(), key_random.size()
+));
+assert_equals(std::size_t(32), ::olm_encrypt_random_length(a_session));
+assert_equals(std::size_t(0), ::olm_session_prepare_send_with_key_pool(
+    a_session, pool
+));
+assert_equals(std::size_t(0), ::olm_ratchet_key_pool_count(pool));
+assert_equals(std::size_t(0), ::olm_encrypt_random_length(a_session));
+
+message.resize(::olm_encrypt_message_length(a_session, 12));
+assert_equals(message.size(), ::olm_encrypt(
+    a_session, plaintext, 12, NULL, 0, message.data(), message.size()
+));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, 1, message.data(), message.size(), output, sizeof(output)
+));
+
+/* and once the pool is empty gets NOT_ENOUGH_RANDOM */
+assert_equals(std::size_t(-1), ::olm_session_prepare_send_with_key_pool(
+    b_session, pool
+));
+assert_equals(
+    std::string("NOT_ENOUGH_RANDOM"),
+    std::string(::olm_session_last_error(b_session))
+);
+assert_equals(std::size_t(32), ::olm_encrypt_random_length(b_session));
+}
+
+{ /** Batch outbound sessions test */
+
+TestCase test_case("Batch outbound sessions test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> random(256);
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+
+/* more sessions than are started together */
+std::size_t const count = 11;
+random.resize(::olm_account_generate_one_time_keys_random_length(
+    b_account, count
+));
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(
+    b_account, count, random.data(), random.size()
+);
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<::OlmSession *> sessions(count);
+std::vector<std::vector<std::uint8_t>> session_buffers(count);
+std::vector<void const *> id_keys(count), ot_keys(count);
+std::vector<std::size_t> id_key_lengths(count, 43), ot_key_lengths(count, 43);
+std::string ot_keys_json(b_ot_keys.begin(), b_ot_keys.end());
+std::size_t pos = 0;
+for (std::size_t i = 0; i < count; ++i) {
+    session_buffers[i].resize(::olm_session_size());
+    sessions[i] = ::olm_session(session_buffers[i].data());
+    id_keys[i] = b_id_keys.data() + 15;
+    pos = ot_keys_json.find("\":\"", pos) + 3;
+    ot_keys[i] = b_ot_keys.data() + pos;
+}
+/* a key that can't be decoded, and not enough random for the last */
+ot_key_lengths[3] = 42;
+std::size_t session_random_length =
+    ::olm_create_outbound_session_random_length(sessions[0]);
+std::vector<std::uint8_t> batch_random((count - 1) * session_random_length);
+mock_random_a(batch_random.data(), batch_random.size());
+std::vector<std::uint8_t> saved_random(batch_random);
+
+assert_equals(std::size_t(2), ::olm_create_outbound_sessions(
+    sessions.data(), count, a_account,
+    id_keys.data(), id_key_lengths.data(),
+    ot_keys.data(), ot_key_lengths.data(),
+    batch_random.data(), batch_random.size()
+));
+assert_equals(
+    std::string("INVALID_BASE64"),
+    std::string(::olm_session_last_error(sessions[3]))
+);
+assert_equals(
+    std::string("NOT_ENOUGH_RANDOM"),
+    std::string(::olm_session_last_error(sessions[count - 1]))
+);
+std::vector<std::uint8_t> zeros(batch_random.size());
+assert_equals(zeros.data(), batch_random.data(), batch_random.size());
+
+/* each session is the same as one made alone from its part of the random */
+for (std::size_t i = 0; i < count - 1; ++i) {
+    if (i == 3) {
+        continue;
+    }
+    std::vector<std::uint8_t> expected_buffer(::olm_session_size());
+    ::OlmSession *expected = ::olm_session(expected_buffer.data());
+    std::vector<std::uint8_t> session_random(
+        saved_random.begin() + i * session_random_length,
+        saved_random.begin() + (i + 1) * session_random_length
+    );
+    assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+        expected, a_account,
+        id_keys[i], id_key_lengths[i],
+        ot_keys[i], ot_key_lengths[i],
+        session_random.data(), session_random.size()
+    ));
+    std::vector<std::uint8_t> expected_pickle(::olm_pickle_session_length(expected));
+    ::olm_pickle_session(
+        expected, "", 0, expected_pickle.data(), expected_pickle.size()
+    );
+    std::vector<std::uint8_t> pickled(::olm_pickle_session_length(sessions[i]));
+    assert_equals(expected_pickle.size(), pickled.size());
+    ::olm_pickle_session(sessions[i], "", 0, pickled.data(), pickled.size());
+    assert_equals(expected_pickle.data(), pickled.data(), pickled.size());
+}
+
+/* and Bob can open the last session of the second batch */
+std::uint8_t plaintext[] = "Hello, World";
+std::uint8_t output[64];
+::OlmSession *a_session = sessions[count - 2];
+std::vector<std::uint8_t> message(::olm_encrypt_message_length(a_session, 12));
+::olm_encrypt(a_session, plaintext, 12, NULL, 0, message.data(), message.size());
+std::vector<std::uint8_t> tmp(message);
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, 0, message.data(), message.size(), output, sizeof(output)
+));
+assert_equals(plaintext, output, 12);
+}
+
+{ /** Batch outbound sessions and encrypt test */
+
+TestCase test_case("Batch outbound sessions and encrypt test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> random(256);
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+
+std::size_t const count = 12;
+random.resize(::olm_account_generate_one_time_keys_random_length(
+    b_account, count
+));
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(
+    b_account, count, random.data(), random.size()
+);
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<void const *> id_keys(count), ot_keys(count);
+std::vector<std::size_t> id_key_lengths(count, 43), ot_key_lengths(count, 43);
+std::string ot_keys_json(b_ot_keys.begin(), b_ot_keys.end());
+std::size_t pos = 0;
+for (std::size_t i = 0; i < count; ++i) {
+    id_keys[i] = b_id_keys.data() + 15;
+    pos = ot_keys_json.find("\":\"", pos) + 3;
+    ot_keys[i] = b_ot_keys.data() + pos;
+}
+ot_key_lengths[5] = 42;
+
+/* room for all but one of the sessions */
+std::vector<std::uint8_t> slab_memory(::olm_slab_size(::olm_session_size(), count - 1));
+::OlmSlab *slab = ::olm_slab(slab_memory.data(), ::olm_session_size(), count - 1);
+::OlmAllocator allocator;
+::olm_slab_allocator(slab, &allocator);
+
+std::uint8_t plaintext[] = "Hello, World";
+std::size_t message_length =
+    ::olm_create_outbound_sessions_and_encrypt_message_length(12);
+std::vector<std::uint8_t> messages(count * message_length);
+std::vector<std::size_t> message_lengths(count);
+std::vector<const char *> errors(count);
+std::vector<::OlmSession *> sessions(count);
+std::vector<std::uint8_t> batch_random(
+    ::olm_create_outbound_sessions_and_encrypt_random_length(count)
+);
+mock_random_a(batch_random.data(), batch_random.size());
+std::vector<std::uint8_t> saved_random(batch_random);
+
+/* the buffers have to be big enough for all the sessions */
+assert_equals(std::size_t(-1), ::olm_create_outbound_sessions_and_encrypt(
+    a_account, count, id_keys.data(), id_key_lengths.data(),
+    ot_keys.data(), ot_key_lengths.data(), plaintext, 12,
+    batch_random.data(), batch_random.size() - 1, &allocator, sessions.data(),
+    messages.data(), messages.size(), message_lengths.data(), errors.data(),
+    NULL, NULL
+));
+assert_equals(std::size_t(-1), ::olm_create_outbound_sessions_and_encrypt(
+    a_account, count, id_keys.data(), id_key_lengths.data(),
+    ot_keys.data(), ot_key_lengths.data(), plaintext, 12,
+    batch_random.data(), batch_random.size(), &allocator, sessions.data(),
+    messages.data(), messages.size() - 1, message_lengths.data(), errors.data(),
+    NULL, NULL
+));
+assert_equals(std::size_t(0), ::olm_slab_slots_in_use(slab));
+
+/* an executor which runs the jobs backwards, and counts them */
+struct ReverseExecutor {
+    static void run(
+        void * context, ::OlmBatchJob job, void * job_context,
+        std::size_t job_count
+    ) {
+        *static_cast<std::size_t *>(context) = job_count;
+        while (job_count--) {
+            job(job_context, job_count);
+        }
+    }
+};
+std::size_t job_count = 0;
+assert_equals(std::size_t(2), ::olm_create_outbound_sessions_and_encrypt(
+    a_account, count, id_keys.data(), id_key_lengths.data(),
+    ot_keys.data(), ot_key_lengths.data(), plaintext, 12,
+    batch_random.data(), batch_random.size(), &allocator, sessions.data(),
+    messages.data(), messages.size(), message_lengths.data(), errors.data(),
+    ReverseExecutor::run, &job_count
+));
+assert_equals(std::size_t(2), job_count);
+assert_equals(std::string("INVALID_BASE64"), std::string(errors[5]));
+assert_equals((::OlmSession *)NULL, sessions[5]);
+assert_equals(std::string("ALLOCATION_FAILED"), std::string(errors[count - 1]));
+assert_equals((::OlmSession *)NULL, sessions[count - 1]);
+assert_equals(std::size_t(-1), message_lengths[count - 1]);
+/* the session which failed gave its slot back */
+assert_equals(count - 2, ::olm_slab_slots_in_use(slab));
+std::vector<std::uint8_t> zeros(batch_random.size());
+assert_equals(zeros.data(), batch_random.data(), batch_random.size());
+
+/* each message is the one the session would have made alone */
+std::size_t session_random_length = batch_random.size() / count;
+for (std::size_t i = 0; i < count - 1; ++i) {
+    if (i == 5) {
+        continue;
+    }
+    assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+    std::vector<std::uint8_t> expected_buffer(::olm_session_size());
+    ::OlmSession *expected = ::olm_session(expected_buffer.data());
+    std::vector<std::uint8_t> session_random(
+        saved_random.begin() + i * session_random_length,
+        saved_random.begin() + (i + 1) * session_random_length
+    );
+    ::olm_create_outbound_session(
+        expected, a_account,
+        id_keys[i], id_key_lengths[i], ot_keys[i], ot_key_lengths[i],
+        session_random.data(), session_random.size()
+    );
+    std::vector<std::uint8_t> expected_message(
+        ::olm_encrypt_message_length(expected, 12)
+    );
+    assert_equals(message_length, expected_message.size());
+    ::olm_encrypt(
+        expected, plaintext, 12, NULL, 0,
+        expected_message.data(), expected_message.size()
+    );
+    assert_equals(message_length, message_lengths[i]);
+    assert_equals(
+        expected_message.data(), messages.data() + i * message_length,
+        message_length
+    );
+    /* the messages are all pre-key messages */
+    assert_equals(
+        std::size_t(OLM_MESSAGE_TYPE_PRE_KEY),
+        ::olm_encrypt_message_type(sessions[i])
+    );
+}
+
+/* Bob opens one of the sessions and reads its message */
+std::vector<std::uint8_t> message(
+    messages.begin() + 7 * message_length,
+    messages.begin() + 8 * message_length
+);
+std::vector<std::uint8_t> tmp(message);
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+std::uint8_t output[64];
+assert_equals(std::size_t(12), ::olm_decrypt(
+    b_session, OLM_MESSAGE_TYPE_PRE_KEY, message.data(), message.size(),
+    output, sizeof(output)
+));
+assert_equals(plaintext, output, 12);
+
+for (::OlmSession * session : sessions) {
+    if (session) {
+        ::olm_release_session(&allocator, session);
+    }
+}
+assert_equals(std::size_t(0), ::olm_slab_slots_in_use(slab));
+}
+
+
+{ /** Memory stats test */
+
+TestCase test_case("Memory stats test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+std::vector<std::uint8_t> random(::olm_create_account_random_length(a_account));
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size_with_limits(10));
+::OlmAccount *b_account = ::olm_account_with_limits(b_account_buffer.data(), 10);
+random.resize(::olm_create_account_random_length(b_account));
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+random.resize(::olm_account_generate_one_time_keys_random_length(b_account, 2));
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(b_account, 2, random.data(), random.size());
+
+/* the stats of any number of objects add up */
+::OlmMemoryStats stats = {};
+::olm_account_memory_stats(b_account, &stats);
+assert_equals(std::size_t(1), stats.objects);
+assert_equals(b_account_buffer.size(), stats.reserved_bytes);
+assert_equals(std::size_t(2), stats.one_time_keys);
+assert_equals(std::size_t(10), stats.max_one_time_keys);
+assert_equals(true, stats.live_bytes < stats.reserved_bytes);
+std::size_t b_live = stats.live_bytes;
+
+::olm_account_memory_stats(a_account, &stats);
+assert_equals(std::size_t(2), stats.objects);
+assert_equals(
+    b_account_buffer.size() + a_account_buffer.size(), stats.reserved_bytes
+);
+assert_equals(std::size_t(2), stats.one_time_keys);
+assert_equals(std::size_t(110), stats.max_one_time_keys);
+assert_equals(true, stats.live_bytes > b_live);
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+random.resize(::olm_create_outbound_session_random_length(a_session));
+mock_random_a(random.data(), random.size());
+assert_not_equals(std::size_t(-1), ::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::vector<std::uint8_t>> messages(4);
+for (auto & message : messages) {
+    message.resize(::olm_encrypt_message_length(a_session, 12));
+    ::olm_encrypt(
+        a_session, plaintext, 12, NULL, 0, message.data(), message.size()
+    );
+}
+
+stats = {};
+::olm_session_memory_stats(a_session, &stats);
+assert_equals(std::size_t(1), stats.objects);
+assert_equals(a_session_buffer.size(), stats.reserved_bytes);
+assert_equals(std::size_t(0), stats.receiver_chains);
+assert_equals(std::size_t(0), stats.skipped_message_keys);
+
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size_with_limits(2, 8));
+::OlmSession *b_session = ::olm_session_with_limits(
+    b_session_buffer.data(), 2, 8, 100
+);
+std::vector<std::uint8_t> tmp(messages[0]);
+::olm_create_inbound_session(b_session, b_account, tmp.data(), tmp.size());
+
+/* a compact session only has room for skipped keys while it has some */
+std::size_t slot_size = ::olm_compact_session_skipped_key_size();
+std::vector<std::uint8_t> slab_memory(::olm_slab_size(slot_size, 1));
+::OlmSlab *slab = ::olm_slab(slab_memory.data(), slot_size, 1);
+::OlmAllocator allocator;
+::olm_slab_allocator(slab, &allocator);
+std::vector<std::uint8_t> c_session_buffer(::olm_compact_session_size());
+::OlmSession *c_session = ::olm_compact_session(
+    c_session_buffer.data(), &allocator
+);
+tmp = messages[0];
+::olm_create_inbound_session(c_session, b_account, tmp.data(), tmp.size());
+
+std::uint8_t output[64];
+for (::OlmSession * session : {b_session, c_session}) {
+    stats = {};
+    ::olm_session_memory_stats(session, &stats);
+    std::size_t live = stats.live_bytes;
+    std::size_t reserved = stats.reserved_bytes;
+    assert_equals(std::size_t(1), stats.receiver_chains);
+    assert_equals(std::size_t(0), stats.skipped_message_keys);
+
+    /* skips 0 to 2, keeping their keys */
+    tmp = messages[3];
     assert_equals(std::size_t(12), ::olm_decrypt(
-        b_session, type_a, msg_a, sizeof(msg_a), out_a, sizeof(out_a)
+        session, 0, tmp.data(), tmp.size(), output, sizeof(output)
     ));
+    stats = {};
+    ::olm_session_memory_stats(session, &stats);
+    assert_equals(std::size_t(3), stats.skipped_message_keys);
+    assert_equals(true, stats.live_bytes > live);
+    assert_equals(true, stats.live_bytes <= stats.reserved_bytes);
+    if (session == b_session) {
+        assert_equals(b_session_buffer.size(), stats.reserved_bytes);
+        assert_equals(b_session_buffer.size(), reserved);
+        assert_equals(std::size_t(2), stats.max_receiver_chains);
+        assert_equals(std::size_t(8), stats.max_skipped_message_keys);
+    } else {
+        assert_equals(c_session_buffer.size(), reserved);
+        assert_equals(
+            c_session_buffer.size() + slot_size, stats.reserved_bytes
+        );
     }
-    {
-    std::uint8_t msg_b[::olm_encrypt_message_length(b_session, 12)];
-    std::uint8_t rnd_b[::olm_encrypt_random_length(b_session)];
-    mock_random_b(rnd_b, sizeof(rnd_b));
-    std::size_t type_b = ::olm_encrypt_message_type(b_session);
-    assert_not_equals(std::size_t(-1), ::olm_encrypt(
-        b_session, plaintext, 12, rnd_b, sizeof(rnd_b), msg_b, sizeof(msg_b)
+}
+
+::olm_clear_session(c_session);
+assert_equals(std::size_t(0), ::olm_slab_slots_in_use(slab));
+}
+
+{ /** Batch signing test */
+
+TestCase test_case("Batch signing test");
+MockRandom mock_random('S');
+
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::uint8_t random[::olm_create_account_random_length(account)];
+mock_random(random, sizeof(random));
+::olm_create_account(account, random, sizeof(random));
+
+/* enough for a partly filled job after two full ones */
+std::size_t const count = 37;
+std::size_t signature_length = ::olm_account_signature_length(account);
+std::vector<std::vector<std::uint8_t>> messages(count);
+std::vector<void const *> message_ptrs(count);
+std::vector<std::size_t> message_lengths(count);
+std::vector<std::uint8_t> expected(count * signature_length);
+for (std::size_t i = 0; i < count; ++i) {
+    messages[i].assign(i * 7, std::uint8_t('a' + i % 26));
+    message_ptrs[i] = messages[i].data();
+    message_lengths[i] = messages[i].size();
+    ::olm_account_sign(
+        account, messages[i].data(), messages[i].size(),
+        expected.data() + i * signature_length, signature_length
+    );
+}
+
+std::vector<std::uint8_t> signatures(count * signature_length);
+assert_equals(count, ::olm_account_sign_batch(
+    account, count, message_ptrs.data(), message_lengths.data(),
+    signatures.data(), signatures.size(), NULL, NULL
+));
+assert_equals(true, expected == signatures);
+
+/* an executor which runs the jobs backwards, and counts them */
+struct ReverseExecutor {
+    static void run(
+        void * context, ::OlmBatchJob job, void * job_context,
+        std::size_t job_count
+    ) {
+        *static_cast<std::size_t *>(context) = job_count;
+        while (job_count--) {
+            job(job_context, job_count);
+        }
+    }
+};
+std::size_t job_count = 0;
+std::fill(signatures.begin(), signatures.end(), 0);
+assert_equals(count, ::olm_account_sign_batch(
+    account, count, message_ptrs.data(), message_lengths.data(),
+    signatures.data(), signatures.size(), ReverseExecutor::run, &job_count
+));
+assert_equals(std::size_t(3), job_count);
+assert_equals(true, expected == signatures);
+
+/* a buffer too small for every signature signs nothing */
+std::fill(signatures.begin(), signatures.end(), 0);
+assert_equals(std::size_t(-1), ::olm_account_sign_batch(
+    account, count, message_ptrs.data(), message_lengths.data(),
+    signatures.data(), signatures.size() - 1, NULL, NULL
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_account_last_error(account))
+);
+assert_equals(std::uint8_t(0), signatures[0]);
+
+assert_equals(std::size_t(0), ::olm_account_sign_batch(
+    account, 0, NULL, NULL, NULL, 0, NULL, NULL
+));
+}
+
+
+{ /** Dirty state test */
+
+TestCase test_case("Dirty state test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+std::vector<std::uint8_t> a_random(::olm_create_account_random_length(a_account));
+mock_random_a(a_random.data(), a_random.size());
+assert_equals(0, ::olm_account_is_dirty(a_account));
+::olm_create_account(a_account, a_random.data(), a_random.size());
+assert_equals(1, ::olm_account_is_dirty(a_account));
+
+/* pickling doesn't clean it, unpickling does */
+std::vector<std::uint8_t> pickle(::olm_pickle_account_length(a_account));
+::olm_pickle_account(a_account, "", 0, pickle.data(), pickle.size());
+assert_equals(1, ::olm_account_is_dirty(a_account));
+::olm_unpickle_account(a_account, "", 0, pickle.data(), pickle.size());
+assert_equals(0, ::olm_account_is_dirty(a_account));
+
+/* reading the keys changes nothing, publishing them does */
+std::vector<std::uint8_t> ot_random(
+    ::olm_account_generate_one_time_keys_random_length(a_account, 1)
+);
+mock_random_a(ot_random.data(), ot_random.size());
+::olm_account_generate_one_time_keys(
+    a_account, 1, ot_random.data(), ot_random.size()
+);
+assert_equals(1, ::olm_account_is_dirty(a_account));
+::olm_account_clear_dirty(a_account);
+std::vector<std::uint8_t> a_id_keys(::olm_account_identity_keys_length(a_account));
+std::vector<std::uint8_t> a_ot_keys(::olm_account_one_time_keys_length(a_account));
+::olm_account_identity_keys(a_account, a_id_keys.data(), a_id_keys.size());
+::olm_account_one_time_keys(a_account, a_ot_keys.data(), a_ot_keys.size());
+assert_equals(0, ::olm_account_is_dirty(a_account));
+::olm_account_mark_keys_as_published(a_account);
+assert_equals(1, ::olm_account_is_dirty(a_account));
+::olm_account_clear_dirty(a_account);
+::olm_account_mark_keys_as_published(a_account);
+assert_equals(0, ::olm_account_is_dirty(a_account));
+
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+std::vector<std::uint8_t> b_random(::olm_create_account_random_length(b_account));
+mock_random_b(b_random.data(), b_random.size());
+::olm_create_account(b_account, b_random.data(), b_random.size());
+
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+b_random.resize(::olm_create_outbound_session_random_length(b_session));
+mock_random_b(b_random.data(), b_random.size());
+::olm_create_outbound_session(
+    b_session, b_account, a_id_keys.data() + 15, 43, a_ot_keys.data() + 25, 43,
+    b_random.data(), b_random.size()
+);
+assert_equals(1, ::olm_session_is_dirty(b_session));
+::olm_session_clear_dirty(b_session);
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::uint8_t> message(::olm_encrypt_message_length(b_session, 12));
+b_random.resize(::olm_encrypt_random_length(b_session));
+mock_random_b(b_random.data(), b_random.size());
+::olm_encrypt(
+    b_session, plaintext, 12, b_random.data(), b_random.size(),
+    message.data(), message.size()
+);
+assert_equals(1, ::olm_session_is_dirty(b_session));
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+std::vector<std::uint8_t> tmp(message);
+::olm_create_inbound_session(a_session, a_account, tmp.data(), tmp.size());
+assert_equals(1, ::olm_session_is_dirty(a_session));
+::olm_remove_one_time_keys(a_account, a_session);
+assert_equals(1, ::olm_account_is_dirty(a_account));
+
+pickle.resize(::olm_pickle_session_length(a_session));
+::olm_pickle_session(a_session, "", 0, pickle.data(), pickle.size());
+tmp = pickle;
+::olm_unpickle_session(a_session, "", 0, tmp.data(), tmp.size());
+assert_equals(0, ::olm_session_is_dirty(a_session));
+
+/* a message that fails to decrypt leaves the session clean */
+std::vector<std::uint8_t> output(message.size());
+tmp = message;
+std::uint8_t & mac_char = tmp[tmp.size() - 5];
+mac_char = mac_char == 'A' ? 'B' : 'A';
+assert_equals(std::size_t(-1), ::olm_decrypt(
+    a_session, OLM_MESSAGE_TYPE_PRE_KEY, tmp.data(), tmp.size(),
+    output.data(), output.size()
+));
+assert_equals(0, ::olm_session_is_dirty(a_session));
+
+tmp = message;
+assert_equals(std::size_t(12), ::olm_decrypt(
+    a_session, OLM_MESSAGE_TYPE_PRE_KEY, tmp.data(), tmp.size(),
+    output.data(), output.size()
+));
+assert_equals(1, ::olm_session_is_dirty(a_session));
+}
+
+
+{ /** Encrypt batch test */
+
+TestCase test_case("Encrypt batch test");
+MockRandom mock_random_a('A', 0x00);
+MockRandom mock_random_b('B', 0x80);
+
+std::vector<std::uint8_t> random(256);
+std::vector<std::uint8_t> a_account_buffer(::olm_account_size());
+::OlmAccount *a_account = ::olm_account(a_account_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(::olm_account_size());
+::OlmAccount *b_account = ::olm_account(b_account_buffer.data());
+mock_random_b(random.data(), random.size());
+::olm_create_account(b_account, random.data(), random.size());
+mock_random_b(random.data(), random.size());
+::olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+std::vector<std::uint8_t> b_id_keys(::olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(::olm_account_one_time_keys_length(b_account));
+::olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+::olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(::olm_session_size());
+::OlmSession *a_session = ::olm_session(a_session_buffer.data());
+mock_random_a(random.data(), random.size());
+::olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43, b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+);
+
+/* a new outbound session's pre-key messages need no random bytes */
+char const * plaintexts[] = {"First", "Second message", "Third"};
+void const * plaintext_ptrs[3];
+std::size_t plaintext_lengths[3];
+for (int i = 0; i < 3; ++i) {
+    plaintext_ptrs[i] = plaintexts[i];
+    plaintext_lengths[i] = std::strlen(plaintexts[i]);
+}
+std::size_t messages_length = ::olm_encrypt_batch_message_length(
+    a_session, 3, plaintext_lengths
+);
+std::vector<std::uint8_t> messages(messages_length);
+std::size_t message_lengths[3];
+assert_equals(std::size_t(3), ::olm_encrypt_batch(
+    a_session, 3, plaintext_ptrs, plaintext_lengths, nullptr, 0,
+    messages.data(), messages.size(), message_lengths
+));
+assert_equals(
+    messages_length,
+    message_lengths[0] + message_lengths[1] + message_lengths[2]
+);
+
+std::vector<std::uint8_t> b_session_buffer(::olm_session_size());
+::OlmSession *b_session = ::olm_session(b_session_buffer.data());
+std::vector<std::uint8_t> tmp(
+    messages.begin(), messages.begin() + message_lengths[0]
+);
+assert_not_equals(std::size_t(-1), ::olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+auto decrypt = [&](
+    ::OlmSession *session, std::size_t type, std::uint8_t const * message,
+    std::size_t length
+) {
+    std::vector<std::uint8_t> copy(message, message + length);
+    std::vector<std::uint8_t> plaintext(::olm_decrypt_max_plaintext_length(
+        session, type, copy.data(), copy.size()
     ));
+    copy.assign(message, message + length);
+    std::size_t plaintext_length = ::olm_decrypt(
+        session, type, copy.data(), copy.size(),
+        plaintext.data(), plaintext.size()
+    );
+    assert_not_equals(std::size_t(-1), plaintext_length);
+    return std::string(plaintext.begin(), plaintext.begin() + plaintext_length);
+};
+std::uint8_t const * pos = messages.data();
+for (int i = 0; i < 3; ++i) {
+    assert_equals(
+        std::string(plaintexts[i]),
+        decrypt(b_session, 0, pos, message_lengths[i])
+    );
+    pos += message_lengths[i];
+}
 
-    std::uint8_t tmp_b[sizeof(msg_b)];
-    std::memcpy(tmp_b, msg_b, sizeof(msg_b));
-    std::uint8_t out_b[::olm_decrypt_max_plaintext_length(
-        a_session, type_b, tmp_b, sizeof(tmp_b)
-    )];
-    std::memcpy(tmp_b, msg_b, sizeof(msg_b));
-    assert_equals(std::size_t(12), ::olm_decrypt(
-        a_session, type_b, msg_b, sizeof(msg_b), out_b, sizeof(out_b)
+/* the reply turns the ratchet once for the whole batch, and fails without
+ * the random bytes for it or the room for every message, leaving the
+ * session as it was */
+assert_equals(std::size_t(32), ::olm_encrypt_random_length(b_session));
+assert_equals(std::size_t(-1), ::olm_encrypt_batch(
+    b_session, 3, plaintext_ptrs, plaintext_lengths, random.data(), 31,
+    messages.data(), messages.size(), message_lengths
+));
+assert_equals(
+    std::string("NOT_ENOUGH_RANDOM"),
+    std::string(::olm_session_last_error(b_session))
+);
+messages_length = ::olm_encrypt_batch_message_length(
+    b_session, 3, plaintext_lengths
+);
+messages.resize(messages_length);
+mock_random_b(random.data(), 32);
+assert_equals(std::size_t(-1), ::olm_encrypt_batch(
+    b_session, 3, plaintext_ptrs, plaintext_lengths, random.data(), 32,
+    messages.data(), messages.size() - 1, message_lengths
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_session_last_error(b_session))
+);
+assert_equals(std::size_t(32), ::olm_encrypt_random_length(b_session));
+mock_random_b(random.data(), 32);
+assert_equals(std::size_t(3), ::olm_encrypt_batch(
+    b_session, 3, plaintext_ptrs, plaintext_lengths, random.data(), 32,
+    messages.data(), messages.size(), message_lengths
+));
+assert_equals(std::size_t(0), ::olm_encrypt_random_length(b_session));
+pos = messages.data();
+for (int i = 0; i < 3; ++i) {
+    assert_equals(
+        std::string(plaintexts[i]),
+        decrypt(a_session, 1, pos, message_lengths[i])
+    );
+    pos += message_lengths[i];
+}
+
+/* the counter grows a byte part way through a long batch */
+std::vector<void const *> many_ptrs(200, plaintexts[0]);
+std::vector<std::size_t> many_lengths(200, plaintext_lengths[0]);
+std::vector<std::size_t> many_message_lengths(200);
+messages.resize(::olm_encrypt_batch_message_length(
+    b_session, 200, many_lengths.data()
+));
+assert_equals(std::size_t(200), ::olm_encrypt_batch(
+    b_session, 200, many_ptrs.data(), many_lengths.data(), nullptr, 0,
+    messages.data(), messages.size(), many_message_lengths.data()
+));
+assert_not_equals(many_message_lengths[0], many_message_lengths[199]);
+pos = messages.data();
+for (std::size_t i = 0; i < 200; ++i) {
+    assert_equals(
+        std::string(plaintexts[0]),
+        decrypt(a_session, 1, pos, many_message_lengths[i])
+    );
+    pos += many_message_lengths[i];
+}
+assert_equals(messages.size(), std::size_t(pos - messages.data()));
+}
+
+
+{ /** Pickle verify test */
+
+TestCase test_case("Pickle verify test");
+MockRandom mock_random('V');
+
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::vector<std::uint8_t> random(::olm_create_account_random_length(account));
+mock_random(random.data(), random.size());
+::olm_create_account(account, random.data(), random.size());
+
+std::uint8_t session_buffer[::olm_session_size()];
+::OlmSession *session = ::olm_session(session_buffer);
+std::uint8_t raw_keys[64];
+mock_random(raw_keys, sizeof(raw_keys));
+std::uint8_t identity_key[43];
+std::uint8_t one_time_key[43];
+olm::encode_base64(raw_keys, 32, identity_key);
+olm::encode_base64(raw_keys + 32, 32, one_time_key);
+random.resize(::olm_create_outbound_session_random_length(session));
+mock_random(random.data(), random.size());
+::olm_create_outbound_session(
+    session, account,
+    identity_key, sizeof(identity_key),
+    one_time_key, sizeof(one_time_key),
+    random.data(), random.size()
+);
+
+std::uint8_t key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *key = ::olm_pickle_key(key_buffer, "secret_key", 10);
+std::uint8_t other_key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *other_key = ::olm_pickle_key(other_key_buffer, "other_key", 9);
+
+std::vector<std::uint8_t> sha_pickle(::olm_pickle_session_with_key_length(
+    session, OLM_PICKLE_CIPHER_AES_SHA_256
+));
+::olm_pickle_session_with_key(
+    session, key, OLM_PICKLE_CIPHER_AES_SHA_256,
+    sha_pickle.data(), sha_pickle.size()
+);
+std::vector<std::uint8_t> gcm_pickle(::olm_pickle_session_with_key_length(
+    session, OLM_PICKLE_CIPHER_AES_GCM
+));
+::olm_pickle_session_with_key(
+    session, key, OLM_PICKLE_CIPHER_AES_GCM,
+    gcm_pickle.data(), gcm_pickle.size()
+);
+
+/* a pickle with a header, whose MAC covers the header too */
+std::uint8_t raw[100];
+mock_random(raw, sizeof(raw));
+std::vector<std::uint8_t> header_pickle(
+    _olm_enc_output_with_header_length(6, sizeof(raw) - 6)
+);
+std::memcpy(_olm_enc_output_with_header_pos(
+    header_pickle.data(), 6, sizeof(raw) - 6
+), raw, sizeof(raw));
+header_pickle.resize(_olm_enc_output_with_header(
+    &key->context, header_pickle.data(), 6, sizeof(raw) - 6
+));
+
+/* intact pickles are left as they are */
+std::vector<std::uint8_t> copy(sha_pickle);
+assert_equals(std::size_t(0), ::olm_pickle_verify(
+    key, sha_pickle.data(), sha_pickle.size()
+));
+assert_equals(true, copy == sha_pickle);
+copy = gcm_pickle;
+assert_equals(std::size_t(0), ::olm_pickle_verify(
+    key, gcm_pickle.data(), gcm_pickle.size()
+));
+assert_equals(true, copy == gcm_pickle);
+assert_equals(std::size_t(0), ::olm_pickle_verify(
+    key, header_pickle.data(), header_pickle.size()
+));
+
+assert_equals(std::size_t(-1), ::olm_pickle_verify(
+    other_key, sha_pickle.data(), sha_pickle.size()
+));
+assert_equals(std::size_t(-1), ::olm_pickle_verify(
+    other_key, gcm_pickle.data(), gcm_pickle.size()
+));
+
+/* damage anywhere in the pickle is found, as unpickling would find it */
+std::vector<std::vector<std::uint8_t>> pickles;
+for (std::size_t i = 0; i < gcm_pickle.size(); i += 37) {
+    copy = gcm_pickle;
+    copy[i] = copy[i] == 'A' ? 'B' : 'A';
+    pickles.push_back(copy);
+}
+for (std::size_t i = 0; i < header_pickle.size(); i += 37) {
+    copy = header_pickle;
+    copy[i] = copy[i] == 'A' ? 'B' : 'A';
+    pickles.push_back(copy);
+}
+copy = sha_pickle;
+copy[copy.size() - 1] = copy[copy.size() - 1] == 'A' ? 'B' : 'A';
+pickles.push_back(copy);
+copy = sha_pickle;
+copy[10] = '*';
+pickles.push_back(copy);
+pickles.push_back(std::vector<std::uint8_t>(sha_pickle.begin(),
+                                            sha_pickle.begin() + 8));
+pickles.push_back(sha_pickle);
+
+std::vector<void const *> pointers;
+std::vector<std::size_t> lengths;
+for (auto const & pickle : pickles) {
+    pointers.push_back(pickle.data());
+    lengths.push_back(pickle.size());
+}
+std::vector<const char *> errors(pickles.size());
+assert_equals(pickles.size() - 1, ::olm_pickle_verify_batch(
+    key, pickles.size(), pointers.data(), lengths.data(), errors.data()
+));
+for (std::size_t i = 0; i < pickles.size() - 3; ++i) {
+    assert_equals(std::size_t(-1), ::olm_pickle_verify(
+        key, pickles[i].data(), pickles[i].size()
+    ));
+    assert_not_equals(std::string("SUCCESS"), std::string(errors[i]));
+}
+std::size_t last = pickles.size() - 1;
+assert_equals(std::string("INVALID_BASE64"), std::string(errors[last - 2]));
+assert_equals(std::string("CORRUPTED_PICKLE"), std::string(errors[last - 1]));
+assert_equals(std::string("SUCCESS"), std::string(errors[last]));
+
+::olm_clear_pickle_key(key);
+::olm_clear_pickle_key(other_key);
+}
+
+
+{ /** Pickle rekey test */
+
+TestCase test_case("Pickle rekey test");
+MockRandom mock_random('R');
+
+std::uint8_t account_buffer[::olm_account_size()];
+::OlmAccount *account = ::olm_account(account_buffer);
+std::vector<std::uint8_t> random(::olm_create_account_random_length(account));
+mock_random(random.data(), random.size());
+::olm_create_account(account, random.data(), random.size());
+
+std::uint8_t session_buffer[::olm_session_size()];
+::OlmSession *session = ::olm_session(session_buffer);
+std::uint8_t raw_keys[64];
+mock_random(raw_keys, sizeof(raw_keys));
+std::uint8_t identity_key[43];
+std::uint8_t one_time_key[43];
+olm::encode_base64(raw_keys, 32, identity_key);
+olm::encode_base64(raw_keys + 32, 32, one_time_key);
+random.resize(::olm_create_outbound_session_random_length(session));
+mock_random(random.data(), random.size());
+::olm_create_outbound_session(
+    session, account,
+    identity_key, sizeof(identity_key),
+    one_time_key, sizeof(one_time_key),
+    random.data(), random.size()
+);
+
+std::uint8_t key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *key = ::olm_pickle_key(key_buffer, "secret_key", 10);
+std::uint8_t new_key_buffer[::olm_pickle_key_size()];
+::OlmPickleKey *new_key = ::olm_pickle_key(new_key_buffer, "new_key", 7);
+
+std::vector<std::uint8_t> expected(::olm_pickle_session_length(session));
+::olm_pickle_session(
+    session, "secret_key", 10, expected.data(), expected.size()
+);
+
+/* enough pickles for several jobs, in each of the ciphers */
+std::vector<std::vector<std::uint8_t>> pickles;
+for (std::size_t i = 0; i < 100; ++i) {
+    std::uint32_t cipher = i % 2 ?
+        OLM_PICKLE_CIPHER_AES_GCM : OLM_PICKLE_CIPHER_AES_SHA_256;
+    std::vector<std::uint8_t> pickle(
+        ::olm_pickle_session_with_key_length(session, cipher)
+    );
+    ::olm_pickle_session_with_key(
+        session, key, cipher, pickle.data(), pickle.size()
+    );
+    pickles.push_back(pickle);
+}
+
+/* pickles with headers, of a kind that is known and one that isn't */
+std::size_t header_length = OLM_PICKLE_HEADER_INBOUND_GROUP_SESSION_LENGTH;
+std::uint8_t raw[100];
+mock_random(raw, sizeof(raw));
+raw[0] = OLM_PICKLE_HEADER_FORMAT;
+raw[1] = OLM_PICKLE_HEADER_KIND_INBOUND_GROUP_SESSION;
+for (std::uint8_t kind : {raw[1], std::uint8_t(0x7f)}) {
+    raw[1] = kind;
+    std::vector<std::uint8_t> pickle(_olm_enc_output_with_header_length(
+        header_length, sizeof(raw) - header_length
     ));
+    std::memcpy(_olm_enc_output_with_header_pos(
+        pickle.data(), header_length, sizeof(raw) - header_length
+    ), raw, sizeof(raw));
+    _olm_enc_output_with_header(
+        &key->context, pickle.data(), header_length,
+        sizeof(raw) - header_length
+    );
+    pickles.push_back(pickle);
+}
+raw[1] = OLM_PICKLE_HEADER_KIND_INBOUND_GROUP_SESSION;
+
+/* and a damaged one */
+std::vector<std::uint8_t> damaged(pickles[0]);
+damaged[20] = damaged[20] == 'A' ? 'B' : 'A';
+pickles.push_back(damaged);
+
+std::vector<std::vector<std::uint8_t>> originals(pickles);
+std::vector<void *> pointers;
+std::vector<std::size_t> lengths;
+for (auto & pickle : pickles) {
+    pointers.push_back(pickle.data());
+    lengths.push_back(pickle.size());
+}
+std::vector<const char *> errors(pickles.size());
+
+struct ReverseExecutor {
+    static void run(
+        void * context, ::OlmBatchJob job, void * job_context,
+        std::size_t job_count
+    ) {
+        *static_cast<std::size_t *>(context) = job_count;
+        while (job_count--) {
+            job(job_context, job_count);
+        }
     }
+};
+std::size_t job_count = 0;
+assert_equals(std::size_t(2), ::olm_pickle_rekey_batch(
+    key, new_key, pickles.size(), pointers.data(), lengths.data(),
+    errors.data(), ReverseExecutor::run, &job_count
+));
+assert_equals(std::size_t(2), job_count);
+
+std::size_t last = pickles.size() - 1;
+assert_equals(
+    std::string("UNKNOWN_PICKLE_VERSION"), std::string(errors[last - 1])
+);
+assert_equals(std::string("BAD_ACCOUNT_KEY"), std::string(errors[last]));
+assert_equals(true, originals[last - 1] == pickles[last - 1]);
+assert_equals(true, originals[last] == pickles[last]);
+
+/* the sessions load under the new key and not the old one */
+std::uint8_t session_buffer2[::olm_session_size()];
+std::vector<std::uint8_t> actual(expected.size());
+for (std::size_t i = 0; i < 100; ++i) {
+    assert_equals(std::string("SUCCESS"), std::string(errors[i]));
+    assert_equals(std::size_t(0), ::olm_pickle_verify(
+        new_key, pickles[i].data(), pickles[i].size()
+    ));
+    assert_equals(std::size_t(-1), ::olm_pickle_verify(
+        key, pickles[i].data(), pickles[i].size()
+    ));
+    ::OlmSession *session2 = ::olm_session(session_buffer2);
+    std::vector<std::uint8_t> copy(pickles[i]);
+    assert_equals(copy.size(), ::olm_unpickle_session_with_key(
+        session2, new_key, copy.data(), copy.size()
+    ));
+    ::olm_pickle_session(
+        session2, "secret_key", 10, actual.data(), actual.size()
+    );
+    assert_equals(true, expected == actual);
 }
+
+/* the header is kept as it was */
+std::size_t header_index = last - 2;
+assert_equals(std::string("SUCCESS"), std::string(errors[header_index]));
+std::uint8_t header[OLM_PICKLE_HEADER_INBOUND_GROUP_SESSION_LENGTH];
+_olm_enc_peek_header(
+    pickles[header_index].data(), pickles[header_index].size(),
+    header, sizeof(header)
+);
+assert_equals(raw, header, sizeof(header));
+std::size_t raw_length = _olm_enc_input_with_header(
+    &new_key->context,
+    pickles[header_index].data(), pickles[header_index].size(),
+    header_length, nullptr
+);
+assert_equals(sizeof(raw) - header_length, raw_length);
+assert_equals(
+    raw + header_length, pickles[header_index].data() + header_length,
+    raw_length
+);
+
+::olm_clear_pickle_key(key);
+::olm_clear_pickle_key(new_key);
 }
 
 }
@@ -8,9 +8,14 @@ struct test_case {
 
 const test_case test_cases[] = {
     { "41776f", "BAD_MESSAGE_FORMAT" },
-    { "7fff6f0101346d671201", "BAD_MESSAGE_FORMAT" },
-    { "ee776f41496f674177804177778041776f6716670a677d6f670a67c2677d", "BAD_MESSAGE_FORMAT" },
-    { "e9e9c9c1e9e9c9e9c9c1e9e9c9c1", "BAD_MESSAGE_FORMAT" },
+    { "7fff6f0101346d671201", "INVALID_BASE64" },
+    { "ee776f41496f674177804177778041776f6716670a677d6f670a67c2677d", "INVALID_BASE64" },
+    { "e9e9c9c1e9e9c9e9c9c1e9e9c9c1", "INVALID_BASE64" },
+    /* the bytes the three above used to decode to, as valid base64, so that
+     * they still reach the message parser */
+    { "2f2f722f2f346d672f77", "BAD_MESSAGE_FORMAT" },
+    { "6e776f41496f67417a2f41777a2f41776f6a2f672f6a2f6f6a2f67426a77", "BAD_MESSAGE_FORMAT" },
+    { "6969494169694969494169694941", "BAD_MESSAGE_FORMAT" },
 };
 
 
@@ -0,0 +1,182 @@
+#include "olm/olm.hh"
+#include "unittest.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using olm::api::Account;
+using olm::api::Bytes;
+using olm::api::InboundGroupSession;
+using olm::api::MessageType;
+using olm::api::MutableBytes;
+using olm::api::OutboundGroupSession;
+using olm::api::Session;
+
+static void fill_random(std::vector<std::uint8_t> & buffer, std::uint8_t tag) {
+    for (std::size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = std::uint8_t(tag + i * 13);
+    }
+}
+
+int main() {
+
+{
+    TestCase test_case("C++ Olm session loopback");
+
+    Account a_account, b_account;
+    std::vector<std::uint8_t> random(a_account.create_random_length());
+    fill_random(random, 'A');
+    assert_equals(true, bool(a_account.create(random)));
+    random.assign(b_account.create_random_length(), 0);
+    fill_random(random, 'B');
+    assert_equals(true, bool(b_account.create(random)));
+    random.assign(b_account.generate_one_time_keys_random_length(1), 0);
+    fill_random(random, 'O');
+    assert_equals(true, bool(b_account.generate_one_time_keys(1, random)));
+
+    std::vector<std::uint8_t> b_id_keys(b_account.identity_keys_length());
+    std::vector<std::uint8_t> b_ot_keys(b_account.one_time_keys_length());
+    assert_equals(
+        b_id_keys.size(), b_account.identity_keys(b_id_keys).value()
+    );
+    assert_equals(
+        b_ot_keys.size(), b_account.one_time_keys(b_ot_keys).value()
+    );
+
+    /* a failure carries the error string rather than a value */
+    std::uint8_t too_small[4];
+    olm::api::Result<std::size_t> failed = b_account.identity_keys(too_small);
+    assert_equals(false, failed.has_value());
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"), std::string(failed.error())
+    );
+    assert_equals(std::size_t(7), failed.value_or(7));
+
+    Session a_session;
+    random.assign(a_session.create_outbound_random_length(), 0);
+    fill_random(random, 'S');
+    MutableBytes b_id(b_id_keys);
+    MutableBytes b_ot(b_ot_keys);
+    assert_equals(true, bool(a_session.create_outbound(
+        a_account, b_id.subspan(15, 43), b_ot.subspan(25, 43), random
+    )));
+
+    std::string plaintext("Hello, World");
+    std::vector<std::uint8_t> message(
+        a_session.encrypt_message_length(plaintext.size())
+    );
+    random.assign(a_session.encrypt_random_length(), 0);
+    fill_random(random, 'E');
+    olm::api::Result<olm::api::EncryptedMessage> encrypted =
+        a_session.encrypt(plaintext, random, message);
+    assert_equals(true, encrypted.has_value());
+    bool pre_key = encrypted->type == MessageType::PreKey;
+    assert_equals(true, pre_key);
+    assert_equals(message.size(), encrypted->length);
+
+    std::vector<std::uint8_t> copy(message);
+    Session b_session;
+    assert_equals(true, bool(b_session.create_inbound(b_account, copy)));
+    assert_equals(true, bool(b_account.remove_one_time_keys(b_session)));
+
+    copy = message;
+    assert_equals(true, b_session.matches_inbound(copy).value());
+
+    std::vector<std::uint8_t> output(
+        b_session.peek_max_plaintext_length(MessageType::PreKey, message)
+            .value()
+    );
+    copy = message;
+    assert_equals(plaintext.size(), b_session.decrypt(
+        MessageType::PreKey, copy, output
+    ).value());
+    assert_equals(
+        reinterpret_cast<const std::uint8_t *>(plaintext.data()),
+        output.data(), plaintext.size()
+    );
+    assert_equals(true, b_session.has_received_message());
+
+    std::vector<std::uint8_t> a_id(a_session.id_length());
+    std::vector<std::uint8_t> b_id_out(b_session.id_length());
+    a_session.id(a_id);
+    b_session.id(b_id_out);
+    assert_equals(a_id.data(), b_id_out.data(), a_id.size());
+
+    /* a handle moves, leaving the old one empty */
+    Session moved(std::move(b_session));
+    assert_equals(false, bool(b_session));
+    assert_equals(true, bool(moved));
+
+    /* and round trips through a pickle */
+    std::vector<std::uint8_t> pickled(moved.pickle_length());
+    assert_equals(pickled.size(), moved.pickle(
+        Bytes(reinterpret_cast<const std::uint8_t *>("key"), 3), pickled
+    ).value());
+    std::vector<std::uint8_t> memory(Session::size());
+    {
+        Session unpickled(memory.data());
+        assert_equals(true, bool(unpickled.unpickle(
+            Bytes(reinterpret_cast<const std::uint8_t *>("key"), 3), pickled
+        )));
+        std::vector<std::uint8_t> id(unpickled.id_length());
+        unpickled.id(id);
+        assert_equals(a_id.data(), id.data(), id.size());
+    }
+}
+
+{
+    TestCase test_case("C++ group session loopback");
+
+    std::vector<std::uint8_t> memory(InboundGroupSession::size());
+    OutboundGroupSession outbound;
+    std::vector<std::uint8_t> random(outbound.init_random_length());
+    fill_random(random, 'G');
+    assert_equals(true, bool(outbound.init(random)));
+
+    std::vector<std::uint8_t> session_key(outbound.session_key_length());
+    assert_equals(
+        session_key.size(), outbound.session_key(session_key).value()
+    );
+
+    InboundGroupSession inbound(memory.data());
+    assert_equals(true, bool(inbound.init(session_key)));
+
+    std::string plaintext("Message");
+    std::vector<std::uint8_t> message(
+        outbound.encrypt_message_length(plaintext.size())
+    );
+    assert_equals(
+        message.size(), outbound.encrypt(plaintext, message).value()
+    );
+    assert_equals(1U, outbound.message_index());
+
+    std::vector<std::uint8_t> output(
+        inbound.peek_max_plaintext_length(message).value()
+    );
+    olm::api::Result<olm::api::GroupPlaintext> decrypted =
+        inbound.decrypt(message, output);
+    assert_equals(true, decrypted.has_value());
+    assert_equals(plaintext.size(), decrypted->length);
+    assert_equals(0U, decrypted->message_index);
+    assert_equals(
+        reinterpret_cast<const std::uint8_t *>(plaintext.data()),
+        output.data(), plaintext.size()
+    );
+    assert_equals(true, inbound.is_verified());
+
+    /* the message was destroyed by decrypting it */
+    decrypted = inbound.decrypt(message, output);
+    assert_equals(false, decrypted.has_value());
+
+    std::vector<std::uint8_t> outbound_id(outbound.id_length());
+    std::vector<std::uint8_t> inbound_id(inbound.id_length());
+    outbound.id(outbound_id);
+    inbound.id(inbound_id);
+    assert_equals(outbound_id.data(), inbound_id.data(), inbound_id.size());
+}
+
+}
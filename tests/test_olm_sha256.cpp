@@ -1,6 +1,9 @@
 #include "olm/olm.h"
+#include "olm/cpu.h"
 #include "unittest.hh"
 
+#include <vector>
+
 int main() {
 {
 TestCase("Olm sha256 test");
@@ -16,5 +19,106 @@ std::uint8_t output[43];
 std::uint8_t expected_output[] = "A2daxT/5zRU1zMffzfosRYxSGDcfQY3BNvLRmsH76KU";
 assert_equals(output, expected_output, 43);
 
+}
+
+{
+TestCase test_case("Olm sha256 raw and streaming test");
+
+std::uint8_t utility_buffer[::olm_utility_size()];
+::OlmUtility * utility = ::olm_utility(utility_buffer);
+
+/* SHA-256("Hello, World") */
+std::uint8_t const expected_raw[32] = {
+    0x03, 0x67, 0x5a, 0xc5, 0x3f, 0xf9, 0xcd, 0x15,
+    0x35, 0xcc, 0xc7, 0xdf, 0xcd, 0xfa, 0x2c, 0x45,
+    0x8c, 0x52, 0x18, 0x37, 0x1f, 0x41, 0x8d, 0xc1,
+    0x36, 0xf2, 0xd1, 0x9a, 0xc1, 0xfb, 0xe8, 0xa5,
+};
+std::uint8_t raw[32];
+assert_equals(std::size_t(-1), ::olm_sha256_raw(
+    utility, "Hello, World", 12, raw, 31
+));
+assert_equals(
+    std::string("OUTPUT_BUFFER_TOO_SMALL"),
+    std::string(::olm_utility_last_error(utility))
+);
+assert_equals(std::size_t(32), ::olm_sha256_raw(
+    utility, "Hello, World", 12, raw, sizeof(raw)
+));
+assert_equals(expected_raw, raw, 32);
+
+/* the same a piece at a time, with pieces across the block boundaries */
+std::vector<std::uint8_t> input(1000);
+for (std::size_t i = 0; i < input.size(); ++i) {
+    input[i] = std::uint8_t(i * 7 + (i >> 3));
+}
+std::uint8_t expected[32], actual[32];
+::olm_sha256_raw(utility, input.data(), input.size(), expected, 32);
+
+std::vector<std::uint8_t> context_buffer(::olm_sha256_context_size());
+::OlmSha256 * context = ::olm_sha256_init(context_buffer.data());
+std::size_t pos = 0;
+for (std::size_t piece = 1; pos < input.size(); piece = piece * 3 + 1) {
+    std::size_t n = std::min(piece, input.size() - pos);
+    ::olm_sha256_update(context, input.data() + pos, n);
+    pos += n;
+}
+assert_equals(std::size_t(-1), ::olm_sha256_final_raw(context, actual, 31));
+assert_equals(std::size_t(32), ::olm_sha256_final_raw(context, actual, 32));
+assert_equals(expected, actual, 32);
+
+context = ::olm_sha256_init(context_buffer.data());
+::olm_sha256_update(context, "Hello, ", 7);
+::olm_sha256_update(context, "World", 5);
+std::uint8_t b64[43];
+assert_equals(std::size_t(-1), ::olm_sha256_final(context, b64, 42));
+assert_equals(std::size_t(43), ::olm_sha256_final(context, b64, 43));
+std::uint8_t expected_output[] = "A2daxT/5zRU1zMffzfosRYxSGDcfQY3BNvLRmsH76KU";
+assert_equals(expected_output, b64, 43);
+}
+
+{
+TestCase test_case("Olm sha256 batch test");
+
+std::uint8_t utility_buffer[::olm_utility_size()];
+::OlmUtility * utility = ::olm_utility(utility_buffer);
+
+/* lengths either side of the padding and block boundaries, in more than
+ * one batch, including an empty input */
+std::size_t const count = 40;
+std::vector<std::vector<std::uint8_t>> inputs(count);
+std::vector<void const *> input_ptrs(count);
+std::vector<std::size_t> input_lengths(count);
+for (std::size_t i = 0; i < count; ++i) {
+    inputs[i].resize(i * 5 + (i % 3) * 50);
+    for (std::size_t j = 0; j < inputs[i].size(); ++j) {
+        inputs[i][j] = std::uint8_t(i * 31 + j);
+    }
+    input_ptrs[i] = inputs[i].data();
+    input_lengths[i] = inputs[i].size();
+}
+
+/* with SHA instructions, without them and with no vector units at all */
+unsigned const masks[] = {~0u, ~OLM_CPU_FEATURE_SHA256, 0u};
+for (unsigned mask : masks) {
+    _olm_cpu_set_feature_mask(mask);
+    std::vector<std::uint8_t> output(32 * count);
+    assert_equals(std::size_t(-1), ::olm_sha256_batch(
+        utility, count, input_ptrs.data(), input_lengths.data(),
+        output.data(), output.size() - 1
+    ));
+    assert_equals(output.size(), ::olm_sha256_batch(
+        utility, count, input_ptrs.data(), input_lengths.data(),
+        output.data(), output.size()
+    ));
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint8_t expected[32];
+        ::olm_sha256_raw(
+            utility, inputs[i].data(), inputs[i].size(), expected, 32
+        );
+        assert_equals(expected, output.data() + 32 * i, 32);
+    }
+}
+_olm_cpu_set_feature_mask(~0u);
 }
 }
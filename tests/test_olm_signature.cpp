@@ -1,9 +1,11 @@
 #include "olm/olm.h"
+#include "olm/base64.hh"
 #include "unittest.hh"
 
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <string>
 
 struct MockRandom {
     MockRandom(std::uint8_t tag, std::uint8_t offset = 0)
@@ -78,4 +80,185 @@ assert_not_equals(std::size_t(-1), ::olm_ed25519_verify(
 
 }
 
+{ /** Repeated Verification Test */
+TestCase test_case("Repeated verification test");
+
+void * utility_buffer = check_malloc(::olm_utility_size());
+::OlmUtility * utility = ::olm_utility(utility_buffer);
+
+/* more accounts than the utility keeps keys for, so that they get evicted */
+const std::size_t count = 6;
+void * accounts[count];
+std::uint8_t * id_keys[count];
+for (std::size_t i = 0; i < count; ++i) {
+    MockRandom mock_random('A' + i, 0x00);
+    accounts[i] = check_malloc(::olm_account_size());
+    ::OlmAccount * account = ::olm_account(accounts[i]);
+    std::size_t random_size = ::olm_create_account_random_length(account);
+    void * random = check_malloc(random_size);
+    mock_random(random, random_size);
+    ::olm_create_account(account, random, random_size);
+    ::free(random);
+    std::size_t id_keys_size = ::olm_account_identity_keys_length(account);
+    id_keys[i] = check_malloc(id_keys_size);
+    assert_not_equals(std::size_t(-1), ::olm_account_identity_keys(
+        account, id_keys[i], id_keys_size
+    ));
+}
+
+std::size_t signature_size =
+    ::olm_account_signature_length((::OlmAccount *) accounts[0]);
+void * signature = check_malloc(signature_size);
+for (unsigned round = 0; round < 3; ++round) {
+    for (std::size_t i = 0; i < count; ++i) {
+        ::OlmAccount * account = (::OlmAccount *) accounts[i];
+        assert_not_equals(std::size_t(-1), ::olm_account_sign(
+            account, "Hello, World", 12, signature, signature_size
+        ));
+        assert_equals(std::size_t(0), ::olm_ed25519_verify(
+            utility, id_keys[i] + 71, 43, "Hello, World", 12,
+            signature, signature_size
+        ));
+        /* and against a different key */
+        assert_not_equals(std::size_t(-1), ::olm_account_sign(
+            account, "Hello, World", 12, signature, signature_size
+        ));
+        assert_equals(std::size_t(-1), ::olm_ed25519_verify(
+            utility, id_keys[(i + 1) % count] + 71, 43, "Hello, World", 12,
+            signature, signature_size
+        ));
+    }
+}
+
+::free(signature);
+for (std::size_t i = 0; i < count; ++i) {
+    ::free(id_keys[i]);
+    ::free(accounts[i]);
+}
+::free(utility_buffer);
+
+}
+
+{ /** Batch Verification Test */
+TestCase test_case("Batch verification test");
+
+MockRandom mock_random_a('A', 0x00);
+
+void * account_buffer = check_malloc(::olm_account_size());
+::OlmAccount * account = ::olm_account(account_buffer);
+
+std::size_t random_size = ::olm_create_account_random_length(account);
+void * random = check_malloc(random_size);
+mock_random_a(random, random_size);
+::olm_create_account(account, random, random_size);
+::free(random);
+
+std::size_t id_keys_size = ::olm_account_identity_keys_length(account);
+std::uint8_t * id_keys = (std::uint8_t *) check_malloc(id_keys_size);
+assert_not_equals(std::size_t(-1), ::olm_account_identity_keys(
+    account, id_keys, id_keys_size
+));
+
+const std::size_t count = 3;
+char const * message_text[count] = {"Hello", "World", "Hello, World"};
+std::size_t signature_size = ::olm_account_signature_length(account);
+void const * keys[count];
+std::size_t key_lengths[count];
+void const * messages[count];
+std::size_t message_lengths[count];
+void * signatures[count];
+std::size_t signature_lengths[count];
+std::uint8_t results[count];
+
+for (std::size_t i = 0; i < count; ++i) {
+    keys[i] = id_keys + 71;
+    key_lengths[i] = 43;
+    messages[i] = message_text[i];
+    message_lengths[i] = std::strlen(message_text[i]);
+    signatures[i] = check_malloc(signature_size);
+    signature_lengths[i] = signature_size;
+    assert_not_equals(std::size_t(-1), ::olm_account_sign(
+        account, messages[i], message_lengths[i], signatures[i], signature_size
+    ));
+}
+/* the second signature is checked against the wrong message */
+messages[1] = message_text[0];
+message_lengths[1] = std::strlen(message_text[0]);
+
+void * utility_buffer = check_malloc(::olm_utility_size());
+::OlmUtility * utility = ::olm_utility(utility_buffer);
+
+assert_equals(std::size_t(1), ::olm_ed25519_verify_batch(
+    utility, count, keys, key_lengths, messages, message_lengths,
+    signatures, signature_lengths, results
+));
+assert_equals(std::uint8_t(1), results[0]);
+assert_equals(std::uint8_t(0), results[1]);
+assert_equals(std::uint8_t(1), results[2]);
+
+for (std::size_t i = 0; i < count; ++i) {
+    ::free(signatures[i]);
+}
+::free(utility_buffer);
+::free(id_keys);
+::free(account_buffer);
+
+}
+
+{ /** Raw Verification Test */
+TestCase test_case("Raw verification test");
+
+MockRandom mock_random_a('A', 0x00);
+
+void * account_buffer = check_malloc(::olm_account_size());
+::OlmAccount * account = ::olm_account(account_buffer);
+
+std::size_t random_size = ::olm_create_account_random_length(account);
+void * random = check_malloc(random_size);
+mock_random_a(random, random_size);
+::olm_create_account(account, random, random_size);
+::free(random);
+
+std::size_t id_keys_size = ::olm_account_identity_keys_length(account);
+std::uint8_t * id_keys = (std::uint8_t *) check_malloc(id_keys_size);
+::olm_account_identity_keys(account, id_keys, id_keys_size);
+std::size_t signature_size = ::olm_account_signature_length(account);
+std::uint8_t * signature = check_malloc(signature_size);
+::olm_account_sign(account, "Hello, World", 12, signature, signature_size);
+
+std::uint8_t key[32];
+std::uint8_t raw_signature[64];
+olm::decode_base64(id_keys + 71, 43, key);
+olm::decode_base64(signature, signature_size, raw_signature);
+
+void * utility_buffer = check_malloc(::olm_utility_size());
+::OlmUtility * utility = ::olm_utility(utility_buffer);
+
+/* the inputs are left as they were, so they can be checked again */
+std::uint8_t const * const_signature = raw_signature;
+for (unsigned round = 0; round < 2; ++round) {
+    assert_equals(std::size_t(0), ::olm_ed25519_verify_raw(
+        utility, key, "Hello, World", 12, const_signature
+    ));
+}
+assert_equals(std::size_t(-1), ::olm_ed25519_verify_raw(
+    utility, key, "Hello, world", 12, const_signature
+));
+assert_equals(
+    std::string("BAD_MESSAGE_MAC"),
+    std::string(::olm_utility_last_error(utility))
+);
+
+/* and the base64 form gives the same answer */
+assert_equals(std::size_t(0), ::olm_ed25519_verify(
+    utility, id_keys + 71, 43, "Hello, World", 12, signature, signature_size
+));
+
+::free(utility_buffer);
+::free(signature);
+::free(id_keys);
+::free(account_buffer);
+
+}
+
 }
@@ -0,0 +1,473 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/olm.h"
+#include "olm/outbound_group_session.h"
+#include "olm/pool.h"
+#include "unittest.hh"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+static bool all_zero(std::uint8_t const * buffer, std::size_t length) {
+    for (std::size_t i = 0; i < length; ++i) {
+        if (buffer[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+
+{ /** Slab test */
+
+TestCase test_case("Slab test");
+
+std::vector<std::uint8_t> memory(olm_slab_size(40, 3));
+OlmSlab * slab = olm_slab(memory.data(), 40, 3);
+
+std::uint8_t * a = (std::uint8_t *)olm_slab_allocate(slab);
+std::uint8_t * b = (std::uint8_t *)olm_slab_allocate(slab);
+std::uint8_t * c = (std::uint8_t *)olm_slab_allocate(slab);
+assert_equals((void *)nullptr, olm_slab_allocate(slab));
+assert_equals(std::size_t(3), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(0), std::size_t(a) % 16);
+assert_equals(true, a + 40 <= b && b + 40 <= c);
+
+/* released slots are wiped, and can only be released once */
+std::memset(b, 'x', 40);
+assert_equals(std::size_t(0), olm_slab_release(slab, b));
+assert_equals(true, all_zero(b, 40));
+assert_equals(std::size_t(-1), olm_slab_release(slab, b));
+assert_equals(std::size_t(-1), olm_slab_release(slab, a + 1));
+assert_equals(std::size_t(2), olm_slab_slots_in_use(slab));
+
+assert_equals((void *)b, olm_slab_allocate(slab));
+}
+
+{ /** Mapped slab test */
+
+TestCase test_case("Mapped slab test");
+
+/* caller memory can't be unmapped */
+std::vector<std::uint8_t> memory(olm_slab_size(40, 3));
+OlmSlab * caller_slab = olm_slab(memory.data(), 40, 3);
+assert_equals(std::size_t(-1), olm_slab_unmap(caller_slab));
+OlmSlabStats stats;
+olm_slab_stats(caller_slab, &stats);
+assert_equals(OLM_SLAB_CALLER_MEMORY, stats.backing);
+assert_equals(olm_slab_size(40, 3), stats.memory_length);
+
+std::size_t size = olm_inbound_group_session_size();
+OlmSlab * slab = olm_slab_map(size, 10000, OLM_SLAB_HUGE_PAGES);
+assert_not_equals((OlmSlab *)nullptr, slab);
+olm_slab_stats(slab, &stats);
+assert_not_equals(OLM_SLAB_NORMAL_PAGES, stats.backing);
+assert_not_equals(OLM_SLAB_CALLER_MEMORY, stats.backing);
+assert_equals(true, stats.memory_length >= olm_slab_size(size, 10000));
+assert_equals(std::size_t(0), stats.memory_length % (2 * 1024 * 1024));
+assert_equals(std::size_t(10000), stats.slot_count);
+
+OlmAllocator allocator;
+olm_slab_allocator(slab, &allocator);
+std::vector<OlmInboundGroupSession *> sessions;
+for (int i = 0; i < 100; ++i) {
+    sessions.push_back(olm_allocate_inbound_group_session(&allocator));
+    assert_not_equals((OlmInboundGroupSession *)nullptr, sessions.back());
+}
+for (int i = 0; i < 60; ++i) {
+    olm_release_inbound_group_session(&allocator, sessions[i]);
+}
+olm_slab_stats(slab, &stats);
+assert_equals(std::size_t(40), stats.slots_in_use);
+assert_equals(std::size_t(100), stats.peak_slots_in_use);
+assert_equals(std::size_t(0), stats.failed_allocations);
+assert_equals(stats.memory_length, olm_slab_unmap(slab));
+
+/* ordinary pages, and allocations that don't fit */
+slab = olm_slab_map(40, 2, 0);
+assert_not_equals((OlmSlab *)nullptr, slab);
+std::uint8_t * a = (std::uint8_t *)olm_slab_allocate(slab);
+assert_equals(true, all_zero(a, 40));
+olm_slab_allocate(slab);
+assert_equals((void *)nullptr, olm_slab_allocate(slab));
+olm_slab_stats(slab, &stats);
+assert_equals(OLM_SLAB_NORMAL_PAGES, stats.backing);
+assert_equals(std::size_t(2), stats.peak_slots_in_use);
+assert_equals(std::size_t(1), stats.failed_allocations);
+assert_not_equals(std::size_t(-1), olm_slab_unmap(slab));
+}
+
+{ /** Arena test */
+
+TestCase test_case("Arena test");
+
+std::vector<std::uint8_t> memory(olm_arena_size(100));
+OlmArena * arena = olm_arena(memory.data(), 100);
+
+std::uint8_t * a = (std::uint8_t *)olm_arena_allocate(arena, 10);
+std::uint8_t * b = (std::uint8_t *)olm_arena_allocate(arena, 50);
+assert_equals(std::size_t(0), std::size_t(b) % 16);
+assert_equals((void *)nullptr, olm_arena_allocate(arena, 60));
+std::memset(a, 'x', 10);
+std::memset(b, 'y', 50);
+
+assert_equals(std::size_t(16 + 64), olm_arena_reset(arena));
+assert_equals(true, all_zero(a, 10));
+assert_equals(true, all_zero(b, 50));
+assert_equals((void *)a, olm_arena_allocate(arena, 100));
+}
+
+{ /** Sessions from a slab test */
+
+TestCase test_case("Sessions from a slab");
+
+std::vector<std::uint8_t> slab_memory(olm_slab_size(olm_session_size(), 2));
+OlmSlab * slab = olm_slab(slab_memory.data(), olm_session_size(), 2);
+OlmAllocator allocator;
+olm_slab_allocator(slab, &allocator);
+
+OlmSession * a = olm_allocate_session(&allocator);
+OlmSession * b = olm_allocate_session(&allocator);
+assert_not_equals((OlmSession *)nullptr, a);
+assert_not_equals((OlmSession *)nullptr, b);
+assert_equals((OlmSession *)nullptr, olm_allocate_session(&allocator));
+assert_equals(std::string("SUCCESS"), std::string(olm_session_last_error(a)));
+
+olm_release_session(&allocator, a);
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+assert_equals(a, olm_allocate_session(&allocator));
+
+/* a slab allocator can't hand out more than a slot */
+std::vector<std::uint8_t> small_memory(olm_slab_size(64, 2));
+OlmSlab * small = olm_slab(small_memory.data(), 64, 2);
+olm_slab_allocator(small, &allocator);
+assert_equals((OlmSession *)nullptr, olm_allocate_session(&allocator));
+}
+
+{ /** Group sessions from an arena test */
+
+TestCase test_case("Group sessions from an arena");
+
+std::size_t size = olm_inbound_group_session_size();
+std::vector<std::uint8_t> memory(olm_arena_size(2 * size));
+OlmArena * arena = olm_arena(memory.data(), 2 * size);
+OlmAllocator allocator;
+olm_arena_allocator(arena, &allocator);
+
+OlmInboundGroupSession * a = olm_allocate_inbound_group_session(&allocator);
+assert_not_equals((OlmInboundGroupSession *)nullptr, a);
+olm_release_inbound_group_session(&allocator, a);
+/* releasing to an arena gives nothing back until it's reset */
+olm_allocate_inbound_group_session(&allocator);
+assert_equals(
+    (OlmInboundGroupSession *)nullptr,
+    olm_allocate_inbound_group_session(&allocator)
+);
+olm_arena_reset(arena);
+assert_equals(a, olm_allocate_inbound_group_session(&allocator));
+}
+
+{ /** Compact sessions test */
+
+TestCase test_case("Compact sessions test");
+
+assert_equals(true, olm_compact_session_size() < olm_session_size() / 3);
+
+std::vector<std::uint8_t> random(256, 'r');
+std::vector<std::uint8_t> a_account_buffer(olm_account_size());
+OlmAccount * a_account = olm_account(a_account_buffer.data());
+olm_create_account(a_account, random.data(), random.size());
+std::vector<std::uint8_t> b_account_buffer(olm_account_size());
+OlmAccount * b_account = olm_account(b_account_buffer.data());
+random.assign(256, 'b');
+olm_create_account(b_account, random.data(), random.size());
+olm_account_generate_one_time_keys(b_account, 1, random.data(), random.size());
+
+std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(b_account));
+olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+std::vector<std::uint8_t> a_session_buffer(olm_session_size());
+OlmSession * a_session = olm_session(a_session_buffer.data());
+random.assign(256, 'a');
+assert_not_equals(std::size_t(-1), olm_create_outbound_session(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43,
+    random.data(), random.size()
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::vector<std::uint8_t>> messages(4);
+for (auto & message : messages) {
+    message.resize(olm_encrypt_message_length(a_session, 12));
+    assert_not_equals(std::size_t(-1), olm_encrypt(
+        a_session, plaintext, 12, NULL, 0, message.data(), message.size()
+    ));
+}
+
+/* Bob's sessions take room for their skipped keys from a slab of one slot */
+std::size_t slot_size = olm_compact_session_skipped_key_size();
+std::vector<std::uint8_t> slab_memory(olm_slab_size(slot_size, 1));
+OlmSlab * slab = olm_slab(slab_memory.data(), slot_size, 1);
+OlmAllocator allocator;
+olm_slab_allocator(slab, &allocator);
+
+std::vector<std::uint8_t> b_session_buffer(olm_compact_session_size());
+OlmSession * b_session = olm_compact_session(
+    b_session_buffer.data(), &allocator
+);
+std::vector<std::uint8_t> tmp(messages[0]);
+assert_not_equals(std::size_t(-1), olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+
+std::uint8_t output[64];
+auto decrypt = [&](OlmSession * session, std::size_t i) {
+    std::vector<std::uint8_t> message(messages[i]);
+    return olm_decrypt(
+        session, 0, message.data(), message.size(), output, sizeof(output)
+    );
+};
+
+assert_equals(std::size_t(12), decrypt(b_session, 0));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+
+/* skipping keys fails while the slab is full, leaving the session as it
+ * was */
+void * slot = olm_slab_allocate(slab);
+assert_equals(std::size_t(-1), decrypt(b_session, 3));
+assert_equals(
+    std::string("ALLOCATION_FAILED"),
+    std::string(olm_session_last_error(b_session))
+);
+olm_slab_release(slab, slot);
+
+assert_equals(std::size_t(12), decrypt(b_session, 3));
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+
+std::vector<std::uint8_t> pickled(olm_pickle_session_length(b_session));
+olm_pickle_session(b_session, "secret_key", 10, pickled.data(), pickled.size());
+
+/* the room is given back once the skipped keys have been used */
+assert_equals(std::size_t(12), decrypt(b_session, 1));
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(12), decrypt(b_session, 2));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+
+/* a compact session's pickle is the same as any other session's */
+std::vector<std::uint8_t> c_session_buffer(olm_session_size());
+OlmSession * c_session = olm_session(c_session_buffer.data());
+tmp = pickled;
+assert_equals(tmp.size(), olm_unpickle_session(
+    c_session, "secret_key", 10, tmp.data(), tmp.size()
+));
+std::vector<std::uint8_t> c_pickled(olm_pickle_session_length(c_session));
+olm_pickle_session(
+    c_session, "secret_key", 10, c_pickled.data(), c_pickled.size()
+);
+assert_equals(pickled.size(), c_pickled.size());
+assert_equals(pickled.data(), c_pickled.data(), pickled.size());
+
+tmp = pickled;
+assert_equals(tmp.size(), olm_unpickle_session(
+    b_session, "secret_key", 10, tmp.data(), tmp.size()
+));
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(12), decrypt(b_session, 2));
+
+/* a copy of a compact session needs room of its own for the skipped key */
+std::vector<std::uint8_t> d_session_buffer(olm_session_copy_size(b_session));
+assert_equals(olm_compact_session_size(), d_session_buffer.size());
+assert_equals(
+    static_cast<OlmSession *>(nullptr),
+    olm_session_copy(d_session_buffer.data(), d_session_buffer.size(), b_session)
+);
+assert_equals(
+    std::string("ALLOCATION_FAILED"),
+    std::string(olm_session_last_error(b_session))
+);
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(12), decrypt(b_session, 1));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+OlmSession * d_session = olm_session_copy(
+    d_session_buffer.data(), d_session_buffer.size(), b_session
+);
+assert_not_equals(static_cast<OlmSession *>(nullptr), d_session);
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(-1), decrypt(d_session, 1));
+assert_equals(olm_compact_session_size(), olm_clear_session(d_session));
+
+/* clearing the session gives back its room */
+assert_equals(olm_compact_session_size(), olm_clear_session(b_session));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+}
+
+
+{ /** Compact group sessions test */
+
+TestCase test_case("Compact group sessions test");
+
+/* the signing key isn't decoded ahead of time, and there is one ratchet */
+assert_equals(
+    true,
+    3 * olm_compact_inbound_group_session_size()
+        < olm_inbound_group_session_size()
+);
+
+std::vector<std::uint8_t> outbound_memory(olm_outbound_group_session_size());
+OlmOutboundGroupSession * outbound =
+    olm_outbound_group_session(outbound_memory.data());
+std::vector<std::uint8_t> random(
+    olm_init_outbound_group_session_random_length(outbound), 'r'
+);
+olm_init_outbound_group_session(outbound, random.data(), random.size());
+std::vector<std::uint8_t> session_key(
+    olm_outbound_group_session_key_length(outbound)
+);
+olm_outbound_group_session_key(
+    outbound, session_key.data(), session_key.size()
+);
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::vector<std::uint8_t>> messages(3);
+for (auto & message : messages) {
+    message.resize(olm_group_encrypt_message_length(outbound, 12));
+    olm_group_encrypt(outbound, plaintext, 12, message.data(), message.size());
+}
+
+std::size_t slot_size = olm_compact_inbound_group_session_ratchet_size();
+std::vector<std::uint8_t> slab_memory(olm_slab_size(slot_size, 1));
+OlmSlab * slab = olm_slab(slab_memory.data(), slot_size, 1);
+OlmAllocator allocator;
+olm_slab_allocator(slab, &allocator);
+
+std::vector<std::uint8_t> full_memory(olm_inbound_group_session_size());
+OlmInboundGroupSession * full =
+    olm_inbound_group_session(full_memory.data());
+std::vector<std::uint8_t> a_memory(olm_compact_inbound_group_session_size());
+OlmInboundGroupSession * a =
+    olm_compact_inbound_group_session(a_memory.data(), &allocator);
+std::vector<std::uint8_t> b_memory(olm_compact_inbound_group_session_size());
+OlmInboundGroupSession * b =
+    olm_compact_inbound_group_session(b_memory.data(), &allocator);
+for (OlmInboundGroupSession * session : {full, a, b}) {
+    std::vector<std::uint8_t> key(session_key);
+    assert_equals(std::size_t(0), olm_init_inbound_group_session(
+        session, key.data(), key.size()
+    ));
+}
+
+std::uint8_t output[64];
+auto decrypt = [&](OlmInboundGroupSession * session, std::size_t i) {
+    std::vector<std::uint8_t> tmp(messages[i]);
+    std::uint32_t message_index;
+    return olm_group_decrypt(
+        session, tmp.data(), tmp.size(), output, sizeof(output),
+        &message_index
+    );
+};
+auto pickle = [](OlmInboundGroupSession * session) {
+    std::vector<std::uint8_t> pickled(
+        olm_pickle_inbound_group_session_length(session)
+    );
+    olm_pickle_inbound_group_session(
+        session, "key", 3, pickled.data(), pickled.size()
+    );
+    return pickled;
+};
+
+/* the first message needs no more room */
+assert_equals(std::size_t(12), decrypt(a, 0));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+std::vector<std::uint8_t> first_pickle(pickle(a));
+
+/* a later one takes the slot for the latest ratchet */
+assert_equals(std::size_t(12), decrypt(full, 2));
+assert_equals(std::size_t(12), decrypt(a, 2));
+assert_equals(plaintext, output, 12);
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+OlmMemoryStats stats = {};
+olm_inbound_group_session_memory_stats(a, &stats);
+assert_equals(
+    olm_compact_inbound_group_session_size() + slot_size, stats.reserved_bytes
+);
+
+/* the pickles are the same as a full session's */
+std::vector<std::uint8_t> full_pickle(pickle(full));
+std::vector<std::uint8_t> a_pickle(pickle(a));
+assert_equals(full_pickle.size(), a_pickle.size());
+assert_equals(full_pickle.data(), a_pickle.data(), a_pickle.size());
+
+/* with no room left another compact session can still decrypt its first
+ * message and earlier ones, but not move on */
+assert_equals(std::size_t(-1), decrypt(b, 1));
+assert_equals(
+    std::string("ALLOCATION_FAILED"),
+    std::string(olm_inbound_group_session_last_error(b))
+);
+assert_equals(std::size_t(12), decrypt(b, 0));
+assert_equals(std::size_t(12), decrypt(a, 1));
+
+/* and a copy needs a slot of its own */
+std::vector<std::uint8_t> c_memory(olm_compact_inbound_group_session_size());
+assert_equals(
+    (OlmInboundGroupSession *)nullptr,
+    olm_inbound_group_session_copy(c_memory.data(), a)
+);
+
+/* signatures are still checked */
+std::vector<std::uint8_t> forged(messages[1]);
+std::uint8_t & byte = forged[forged.size() / 2];
+byte = byte == 'A' ? 'B' : 'A';
+std::uint32_t message_index;
+assert_equals(std::size_t(-1), olm_group_decrypt(
+    b, forged.data(), forged.size(), output, sizeof(output), &message_index
+));
+assert_equals(
+    std::string("BAD_SIGNATURE"),
+    std::string(olm_inbound_group_session_last_error(b))
+);
+
+/* unpickling a session that hasn't moved on gives back the slot */
+assert_equals(first_pickle.size(), olm_unpickle_inbound_group_session(
+    a, "key", 3, first_pickle.data(), first_pickle.size()
+));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(12), decrypt(b, 1));
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+
+/* and so does pruning up to the latest ratchet, after which only later
+ * messages take it again */
+assert_equals(std::size_t(0), olm_inbound_group_session_prune_before(b, 1));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(12), decrypt(b, 1));
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+assert_equals(std::size_t(12), decrypt(b, 2));
+assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+assert_equals(
+    olm_compact_inbound_group_session_size(),
+    olm_clear_inbound_group_session(b)
+);
+assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+olm_clear_inbound_group_session(a);
+olm_clear_inbound_group_session(full);
+olm_clear_outbound_group_session(outbound);
+}
+
+}
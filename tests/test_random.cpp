@@ -0,0 +1,150 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "olm/random.h"
+#include "unittest.hh"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+int main() {
+
+{ /** Random generator test */
+
+TestCase test_case("Random generator test");
+
+assert_equals(1, olm_random_available());
+
+/* enough to go through a few refills and rekeys */
+std::vector<std::uint8_t> a(10000), b(10000);
+assert_equals(a.size(), olm_random_fill(a.data(), a.size()));
+assert_equals(b.size(), olm_random_fill(b.data(), b.size()));
+assert_equals(true, std::memcmp(a.data(), b.data(), a.size()) != 0);
+
+/* no 16 byte block repeats, as it would if a refill came round again */
+bool repeated = false;
+for (std::size_t i = 0; i + 16 <= a.size(); i += 16) {
+    for (std::size_t j = i + 16; j + 16 <= a.size(); j += 16) {
+        repeated |= !std::memcmp(&a[i], &a[j], 16);
+    }
+}
+assert_equals(false, repeated);
+
+/* every byte value turns up */
+std::vector<std::size_t> counts(256);
+for (std::uint8_t byte : a) {
+    counts[byte]++;
+}
+std::size_t missing = 0;
+for (std::size_t count : counts) {
+    missing += !count;
+}
+assert_equals(std::size_t(0), missing);
+
+/* a cleared generator takes a new key */
+olm_random_clear();
+std::uint8_t c[32], d[32];
+assert_equals(sizeof(c), olm_random_fill(c, sizeof(c)));
+olm_random_clear();
+assert_equals(sizeof(d), olm_random_fill(d, sizeof(d)));
+assert_equals(true, std::memcmp(c, d, sizeof(c)) != 0);
+
+assert_equals(std::size_t(0), olm_random_fill(c, 0));
+}
+
+{ /** Auto random test */
+
+TestCase test_case("Auto random test");
+
+std::vector<std::uint8_t> a_account_buffer(olm_account_size());
+OlmAccount * a_account = olm_account(a_account_buffer.data());
+assert_not_equals(std::size_t(-1), olm_create_account_auto_random(a_account));
+std::vector<std::uint8_t> b_account_buffer(olm_account_size());
+OlmAccount * b_account = olm_account(b_account_buffer.data());
+assert_not_equals(std::size_t(-1), olm_create_account_auto_random(b_account));
+
+/* more keys than are made in one go */
+assert_equals(std::size_t(50), olm_account_generate_one_time_keys_auto_random(
+    b_account, 50
+));
+std::vector<std::uint8_t> b_id_keys(olm_account_identity_keys_length(b_account));
+std::vector<std::uint8_t> b_ot_keys(olm_account_one_time_keys_length(b_account));
+olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+/* each key is {"AAAAAA":"<43 characters>"}, so fifty of them */
+std::string ot_keys(b_ot_keys.begin(), b_ot_keys.end());
+std::size_t key_count = 0;
+for (std::size_t pos = 0; (pos = ot_keys.find("\":\"", pos)) != std::string::npos; ++pos) {
+    key_count++;
+}
+assert_equals(std::size_t(50), key_count);
+
+std::vector<std::uint8_t> a_session_buffer(olm_session_size());
+OlmSession * a_session = olm_session(a_session_buffer.data());
+assert_not_equals(std::size_t(-1), olm_create_outbound_session_auto_random(
+    a_session, a_account,
+    b_id_keys.data() + 15, 43,
+    b_ot_keys.data() + 25, 43
+));
+
+std::uint8_t plaintext[] = "Hello, World";
+std::vector<std::uint8_t> message(olm_encrypt_message_length(a_session, 12));
+assert_equals(message.size(), olm_encrypt_auto_random(
+    a_session, plaintext, 12, message.data(), message.size()
+));
+
+std::vector<std::uint8_t> tmp(message);
+std::vector<std::uint8_t> b_session_buffer(olm_session_size());
+OlmSession * b_session = olm_session(b_session_buffer.data());
+assert_not_equals(std::size_t(-1), olm_create_inbound_session(
+    b_session, b_account, tmp.data(), tmp.size()
+));
+std::uint8_t output[64];
+assert_equals(std::size_t(12), olm_decrypt(
+    b_session, 0, message.data(), message.size(), output, sizeof(output)
+));
+assert_equals(plaintext, output, 12);
+
+/* a reply which needs a new ratchet key */
+assert_equals(std::size_t(32), olm_encrypt_random_length(b_session));
+message.resize(olm_encrypt_message_length(b_session, 12));
+assert_equals(message.size(), olm_encrypt_auto_random(
+    b_session, plaintext, 12, message.data(), message.size()
+));
+assert_equals(std::size_t(12), olm_decrypt(
+    a_session, 1, message.data(), message.size(), output, sizeof(output)
+));
+assert_equals(plaintext, output, 12);
+
+std::vector<std::uint8_t> group_buffer(olm_outbound_group_session_size());
+OlmOutboundGroupSession * group_session =
+    olm_outbound_group_session(group_buffer.data());
+assert_not_equals(
+    std::size_t(-1),
+    olm_init_outbound_group_session_auto_random(group_session)
+);
+std::vector<std::uint8_t> other_buffer(olm_outbound_group_session_size());
+OlmOutboundGroupSession * other_session =
+    olm_outbound_group_session(other_buffer.data());
+olm_init_outbound_group_session_auto_random(other_session);
+std::vector<std::uint8_t> id(olm_outbound_group_session_id_length(group_session));
+std::vector<std::uint8_t> other_id(id.size());
+olm_outbound_group_session_id(group_session, id.data(), id.size());
+olm_outbound_group_session_id(other_session, other_id.data(), other_id.size());
+assert_equals(true, id != other_id);
+}
+
+}
@@ -16,20 +16,10 @@
 #include "olm/cipher.h"
 #include "unittest.hh"
 
+#include <vector>
 
-int main() {
-
-std::uint8_t root_info[] = "Olm";
-std::uint8_t ratchet_info[] = "OlmRatchet";
-std::uint8_t message_info[] = "OlmMessageKeys";
-
-olm::KdfInfo kdf_info = {
-    root_info, sizeof(root_info) - 1,
-    ratchet_info, sizeof(ratchet_info) - 1
-};
 
-_olm_cipher_aes_sha_256 cipher0 = OLM_CIPHER_INIT_AES_SHA_256(message_info);
-_olm_cipher *cipher = OLM_CIPHER_BASE(&cipher0);
+int main() {
 
 std::uint8_t random_bytes[] = "0123456789ABDEF0123456789ABCDEF";
 _olm_curve25519_key_pair alice_key;
@@ -37,11 +27,16 @@ _olm_crypto_curve25519_generate_key(random_bytes, &alice_key);
 
 std::uint8_t shared_secret[] = "A secret";
 
+olm::RatchetLimits const & limits = olm::DEFAULT_RATCHET_LIMITS;
+std::size_t const storage_length = olm::Ratchet::storage_length(limits);
+
 { /* Send/Receive test case */
 TestCase test_case("Olm Send/Receive");
 
-olm::Ratchet alice(kdf_info, cipher);
-olm::Ratchet bob(kdf_info, cipher);
+std::vector<std::uint8_t> alice_storage(storage_length);
+olm::Ratchet alice(olm::RatchetProtocol::OLM_V1, limits, alice_storage.data());
+std::vector<std::uint8_t> bob_storage(storage_length);
+olm::Ratchet bob(olm::RatchetProtocol::OLM_V1, limits, bob_storage.data());
 
 alice.initialise_as_alice(shared_secret, sizeof(shared_secret) - 1, alice_key);
 bob.initialise_as_bob(shared_secret, sizeof(shared_secret) - 1, alice_key.public_key);
@@ -109,8 +104,10 @@ std::size_t encrypt_length, decrypt_length;
 
 TestCase test_case("Olm Out of Order");
 
-olm::Ratchet alice(kdf_info, cipher);
-olm::Ratchet bob(kdf_info, cipher);
+std::vector<std::uint8_t> alice_storage(storage_length);
+olm::Ratchet alice(olm::RatchetProtocol::OLM_V1, limits, alice_storage.data());
+std::vector<std::uint8_t> bob_storage(storage_length);
+olm::Ratchet bob(olm::RatchetProtocol::OLM_V1, limits, bob_storage.data());
 
 alice.initialise_as_alice(shared_secret, sizeof(shared_secret) - 1, alice_key);
 bob.initialise_as_bob(shared_secret, sizeof(shared_secret) - 1, alice_key.public_key);
@@ -177,12 +174,257 @@ std::size_t encrypt_length, decrypt_length;
 
 } /* Out of order test case */
 
+{ /* Skipped message keys */
+
+TestCase test_case("Olm Skipped Message Keys");
+
+std::vector<std::uint8_t> alice_storage(storage_length);
+olm::Ratchet alice(olm::RatchetProtocol::OLM_V1, limits, alice_storage.data());
+std::vector<std::uint8_t> bob_storage(storage_length);
+olm::Ratchet bob(olm::RatchetProtocol::OLM_V1, limits, bob_storage.data());
+
+alice.initialise_as_alice(shared_secret, sizeof(shared_secret) - 1, alice_key);
+bob.initialise_as_bob(shared_secret, sizeof(shared_secret) - 1, alice_key.public_key);
+
+std::uint8_t plaintext[] = "These 15 bytes";
+std::size_t const count = olm::MAX_SKIPPED_MESSAGE_KEYS + 10;
+std::size_t const message_length = alice.encrypt_output_length(15);
+std::uint8_t messages[count][message_length];
+
+for (unsigned i = 0; i < count; ++i) {
+    assert_equals(message_length, alice.encrypt(
+        plaintext, 15, NULL, 0, messages[i], message_length
+    ));
+}
+
+std::uint8_t output[message_length];
+
+/* Bob gets the last message first, so skips the keys for all the others but
+ * only keeps the newest of them. */
+assert_equals(std::size_t(15), bob.decrypt(
+    messages[count - 1], message_length, output, sizeof(output)
+));
+assert_equals(
+    olm::MAX_SKIPPED_MESSAGE_KEYS, bob.skipped_message_keys.size()
+);
+
+/* Use a few of the keys, then check the rest survive a pickle */
+for (unsigned i = count - 2; i > count - 6; --i) {
+    assert_equals(std::size_t(15), bob.decrypt(
+        messages[i], message_length, output, sizeof(output)
+    ));
+}
+
+std::vector<std::uint8_t> bob_copy_storage(storage_length);
+olm::Ratchet bob_copy(
+    olm::RatchetProtocol::OLM_V1, limits, bob_copy_storage.data()
+);
+std::uint8_t pickled[olm::pickle_length(bob)];
+assert_equals(pickled + sizeof(pickled), olm::pickle(pickled, bob));
+std::uint8_t const * pickled_end = pickled + sizeof(pickled);
+assert_equals(
+    pickled_end, olm::unpickle(pickled, pickled_end, bob_copy, false)
+);
+assert_equals(bob.skipped_message_keys.size(), bob_copy.skipped_message_keys.size());
+
+std::uint8_t repickled[sizeof(pickled)];
+olm::pickle(repickled, bob_copy);
+assert_equals(pickled, repickled, sizeof(pickled));
+
+/* Decrypt what's left in a scrambled order. Each kept key works exactly once
+ * and the discarded ones not at all. */
+std::size_t const first_kept = count - 1 - olm::MAX_SKIPPED_MESSAGE_KEYS;
+for (unsigned j = 0; j < count - 5; ++j) {
+    unsigned i = (j * 7) % (count - 5);
+    std::size_t result = bob_copy.decrypt(
+        messages[i], message_length, output, sizeof(output)
+    );
+    if (i < first_kept) {
+        assert_equals(std::size_t(-1), result);
+        assert_equals(OLM_BAD_MESSAGE_MAC, bob_copy.last_error);
+    } else {
+        assert_equals(std::size_t(15), result);
+        assert_equals(plaintext, output, 15);
+        assert_equals(std::size_t(-1), bob_copy.decrypt(
+            messages[i], message_length, output, sizeof(output)
+        ));
+    }
+}
+assert_equals(std::size_t(0), bob_copy.skipped_message_keys.size());
+
+} /* Skipped message keys */
+
+{ /* Skipped key eviction */
+
+TestCase test_case("Olm Skipped Key Eviction");
+
+std::vector<std::uint8_t> alice_storage(storage_length);
+olm::Ratchet alice(olm::RatchetProtocol::OLM_V1, limits, alice_storage.data());
+std::vector<std::uint8_t> bob_storage(storage_length);
+olm::Ratchet bob(olm::RatchetProtocol::OLM_V1, limits, bob_storage.data());
+
+alice.initialise_as_alice(shared_secret, sizeof(shared_secret) - 1, alice_key);
+bob.initialise_as_bob(shared_secret, sizeof(shared_secret) - 1, alice_key.public_key);
+
+std::uint8_t plaintext[] = "These 15 bytes";
+std::size_t const count = 10;
+std::size_t const message_length = alice.encrypt_output_length(15);
+std::uint8_t messages[count][message_length];
+std::uint8_t output[message_length];
+
+for (unsigned i = 0; i < count; ++i) {
+    assert_equals(message_length, alice.encrypt(
+        plaintext, 15, NULL, 0, messages[i], message_length
+    ));
+}
+
+/* the count bound pushes out the oldest keys once a message is decrypted */
+assert_equals(std::size_t(15), bob.decrypt(
+    messages[count - 1], message_length, output, sizeof(output)
+));
+assert_equals(count - 1, bob.skipped_message_keys.size());
+bob.skipped_key_eviction.max_count = 5;
+assert_equals(std::size_t(15), bob.decrypt(
+    messages[count - 2], message_length, output, sizeof(output)
+));
+assert_equals(std::size_t(5), bob.skipped_message_keys.size());
+assert_equals(std::size_t(-1), bob.decrypt(
+    messages[2], message_length, output, sizeof(output)
+));
+assert_equals(std::size_t(15), bob.decrypt(
+    messages[3], message_length, output, sizeof(output)
+));
+assert_equals(std::size_t(4), bob.skipped_message_keys.size());
+
+/* the age bound drops the rest once Alice moves to a new ratchet key */
+bob.skipped_key_eviction.max_count = 0;
+bob.skipped_key_eviction.max_age = 1;
+std::uint8_t reply[bob.encrypt_output_length(15)];
+assert_equals(sizeof(reply), bob.encrypt(
+    plaintext, 15, random_bytes, sizeof(random_bytes), reply, sizeof(reply)
+));
+assert_equals(std::size_t(15), alice.decrypt(
+    reply, sizeof(reply), output, sizeof(output)
+));
+std::uint8_t next_random[] = "Another 32 bytes of randomness.";
+std::uint8_t next[alice.encrypt_output_length(15)];
+assert_equals(sizeof(next), alice.encrypt(
+    plaintext, 15, next_random, sizeof(next_random), next, sizeof(next)
+));
+assert_equals(std::size_t(4), bob.skipped_message_keys.size());
+assert_equals(std::size_t(15), bob.decrypt(
+    next, sizeof(next), output, sizeof(output)
+));
+assert_equals(std::size_t(0), bob.skipped_message_keys.size());
+assert_equals(std::size_t(-1), bob.decrypt(
+    messages[4], message_length, output, sizeof(output)
+));
+
+} /* Skipped key eviction */
+
+{ /* Skipped ranges */
+
+TestCase test_case("Olm Skipped Ranges");
+
+std::vector<std::uint8_t> alice_storage(storage_length);
+olm::Ratchet alice(olm::RatchetProtocol::OLM_V1, limits, alice_storage.data());
+std::vector<std::uint8_t> bob_storage(storage_length);
+olm::Ratchet bob(olm::RatchetProtocol::OLM_V1, limits, bob_storage.data());
+
+alice.initialise_as_alice(shared_secret, sizeof(shared_secret) - 1, alice_key);
+bob.initialise_as_bob(shared_secret, sizeof(shared_secret) - 1, alice_key.public_key);
+bob.skipped_range_threshold = 10;
+
+std::uint8_t plaintext[] = "These 15 bytes";
+std::size_t const count = 500;
+std::vector<std::vector<std::uint8_t>> messages(count);
+for (auto & message : messages) {
+    message.resize(alice.encrypt_output_length(15));
+    assert_equals(message.size(), alice.encrypt(
+        plaintext, 15, NULL, 0, message.data(), message.size()
+    ));
+}
+std::uint8_t output[messages[count - 1].size()];
+auto decrypt = [&](olm::Ratchet & ratchet, std::size_t i) {
+    return ratchet.decrypt(
+        messages[i].data(), messages[i].size(), output, sizeof(output)
+    );
+};
+
+/* The gap is kept as one range rather than as keys */
+assert_equals(std::size_t(15), decrypt(bob, count - 1));
+assert_equals(std::size_t(0), bob.skipped_message_keys.size());
+assert_equals(std::size_t(1), bob.skipped_ranges.size());
+assert_equals(std::uint32_t(0), bob.skipped_ranges[0].start.index);
+assert_equals(std::uint32_t(count - 1), bob.skipped_ranges[0].end);
+
+/* A message from the middle splits it, and can't be decrypted again */
+assert_equals(std::size_t(15), decrypt(bob, 250));
+assert_equals(plaintext, output, 15);
+assert_equals(std::size_t(-1), decrypt(bob, 250));
+assert_equals(OLM_BAD_MESSAGE_MAC, bob.last_error);
+assert_equals(std::size_t(2), bob.skipped_ranges.size());
+
+/* The ranges survive a pickle */
+std::vector<std::uint8_t> bob_copy_storage(storage_length);
+olm::Ratchet bob_copy(
+    olm::RatchetProtocol::OLM_V1, limits, bob_copy_storage.data()
+);
+std::vector<std::uint8_t> pickled(
+    olm::pickle_length(bob) + olm::pickle_skipped_ranges_length(bob)
+);
+std::uint8_t * pickled_end = pickled.data() + pickled.size();
+assert_equals(
+    pickled_end,
+    olm::pickle_skipped_ranges(olm::pickle(pickled.data(), bob), bob)
+);
+assert_equals(
+    (std::uint8_t const *)pickled_end,
+    olm::unpickle_skipped_ranges(
+        olm::unpickle(pickled.data(), pickled_end, bob_copy, false),
+        pickled_end, bob_copy
+    )
+);
+assert_equals(std::size_t(2), bob_copy.skipped_ranges.size());
+bob_copy.skipped_range_threshold = 10;
+
+/* The rest of the messages decrypt exactly once */
+for (unsigned i = 0; i < count - 1; ++i) {
+    std::size_t result = decrypt(bob_copy, i);
+    if (i == 250) {
+        assert_equals(std::size_t(-1), result);
+        continue;
+    }
+    assert_equals(std::size_t(15), result);
+    assert_equals(plaintext, output, 15);
+    assert_equals(std::size_t(-1), decrypt(bob_copy, i));
+}
+assert_equals(std::size_t(0), bob_copy.skipped_ranges.size());
+
+/* Smaller gaps are still kept as keys */
+std::vector<std::uint8_t> more;
+for (unsigned i = 0; i < 5; ++i) {
+    more.resize(alice.encrypt_output_length(15));
+    assert_equals(more.size(), alice.encrypt(
+        plaintext, 15, NULL, 0, more.data(), more.size()
+    ));
+}
+assert_equals(std::size_t(15), bob_copy.decrypt(
+    more.data(), more.size(), output, sizeof(output)
+));
+assert_equals(std::size_t(4), bob_copy.skipped_message_keys.size());
+assert_equals(std::size_t(0), bob_copy.skipped_ranges.size());
+
+} /* Skipped ranges */
+
 { /* More messages */
 
 TestCase test_case("Olm More Messages");
 
-olm::Ratchet alice(kdf_info, cipher);
-olm::Ratchet bob(kdf_info, cipher);
+std::vector<std::uint8_t> alice_storage(storage_length);
+olm::Ratchet alice(olm::RatchetProtocol::OLM_V1, limits, alice_storage.data());
+std::vector<std::uint8_t> bob_storage(storage_length);
+olm::Ratchet bob(olm::RatchetProtocol::OLM_V1, limits, bob_storage.data());
 
 alice.initialise_as_alice(shared_secret, sizeof(shared_secret) - 1, alice_key);
 bob.initialise_as_bob(shared_secret, sizeof(shared_secret) - 1, alice_key.public_key);
@@ -3,6 +3,8 @@
 
 #include "unittest.hh"
 
+#include <vector>
+
 /* decode into a buffer, which is returned */
 std::uint8_t *decode_hex(
     const char * input
@@ -93,7 +95,10 @@ int main() {
         pickled, strlen((char *)pickled), NULL
     );
 
-    olm::Session session;
+    std::vector<std::uint8_t> storage(
+        olm::Session::storage_length(olm::DEFAULT_RATCHET_LIMITS)
+    );
+    olm::Session session(olm::DEFAULT_RATCHET_LIMITS, storage.data());
     const uint8_t *unpickle_res = olm::unpickle(pickled, pickled+sizeof(pickled), session);
     assert_equals(
         pickle_len, (size_t)(unpickle_res - pickled)
@@ -129,7 +134,10 @@ int main() {
         pickled, strlen((char *)pickled), NULL
     );
 
-    olm::Session session;
+    std::vector<std::uint8_t> storage(
+        olm::Session::storage_length(olm::DEFAULT_RATCHET_LIMITS)
+    );
+    olm::Session session(olm::DEFAULT_RATCHET_LIMITS, storage.data());
     const uint8_t *unpickle_res = olm::unpickle(pickled, pickled+sizeof(pickled), session);
     assert_equals(
         pickle_len, (size_t)(unpickle_res - pickled)
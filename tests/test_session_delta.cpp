@@ -0,0 +1,356 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "olm/session.hh"
+#include "unittest.hh"
+
+#include <string>
+#include <vector>
+
+typedef std::vector<std::uint8_t> Bytes;
+
+static std::uint32_t random_state = 1;
+
+/* Not random, but doesn't repeat within a test, so every ratchet key is new */
+static Bytes random_bytes(std::size_t length) {
+    Bytes result(length);
+    for (auto & byte : result) {
+        random_state = random_state * 1664525 + 1013904223;
+        byte = random_state >> 24;
+    }
+    return result;
+}
+
+/** What a store holds for a session: a full pickle and the deltas since */
+struct Stored {
+    Bytes base;
+    std::vector<Bytes> deltas;
+};
+
+struct Limits {
+    std::size_t max_receiver_chains;
+    std::size_t max_skipped_message_keys;
+};
+
+static Bytes session_memory(Limits const & limits) {
+    return Bytes(olm_session_size_with_limits(
+        limits.max_receiver_chains, limits.max_skipped_message_keys
+    ));
+}
+
+static OlmSession * new_session(Bytes & memory, Limits const & limits) {
+    return olm_session_with_limits(
+        memory.data(), limits.max_receiver_chains,
+        limits.max_skipped_message_keys, 2000
+    );
+}
+
+/** The unencrypted pickle, which doesn't count as pickling the session */
+static Bytes raw_pickle(OlmSession * session) {
+    olm::Session & object = *reinterpret_cast<olm::Session *>(session);
+    Bytes result(olm::pickle_length(object));
+    olm::pickle(result.data(), object);
+    return result;
+}
+
+static void store_full(OlmSession * session, Stored & stored) {
+    stored.base.resize(olm_pickle_session_length(session));
+    assert_equals(stored.base.size(), olm_pickle_session(
+        session, "key", 3, stored.base.data(), stored.base.size()
+    ));
+    stored.deltas.clear();
+}
+
+static std::size_t store_delta(OlmSession * session, Stored & stored) {
+    Bytes delta(olm_pickle_session_delta_length(session));
+    assert_equals(delta.size(), olm_pickle_session_delta(
+        session, "key", 3, delta.data(), delta.size()
+    ));
+    stored.deltas.push_back(delta);
+    return delta.size();
+}
+
+/** Load the stored session into memory, as a fresh session if there is no
+ * full pickle */
+static OlmSession * load(
+    Stored const & stored, Bytes & memory, Limits const & limits
+) {
+    OlmSession * session = new_session(memory, limits);
+    if (!stored.base.empty()) {
+        Bytes pickle = stored.base;
+        assert_equals(pickle.size(), olm_unpickle_session(
+            session, "key", 3, pickle.data(), pickle.size()
+        ));
+    }
+    for (Bytes delta : stored.deltas) {
+        assert_equals(delta.size(), olm_unpickle_session_delta(
+            session, "key", 3, delta.data(), delta.size()
+        ));
+    }
+    return session;
+}
+
+static void check_stored(
+    OlmSession * session, Stored const & stored, Limits const & limits
+) {
+    Bytes memory = session_memory(limits);
+    OlmSession * loaded = load(stored, memory, limits);
+    Bytes expected = raw_pickle(session);
+    Bytes actual = raw_pickle(loaded);
+    assert_equals(expected.size(), actual.size());
+    assert_equals(expected.data(), actual.data(), expected.size());
+}
+
+struct Message {
+    std::size_t type;
+    Bytes body;
+};
+
+static Message encrypt(OlmSession * session, char const * plaintext) {
+    std::size_t length = std::strlen(plaintext);
+    Message message;
+    message.type = olm_encrypt_message_type(session);
+    message.body.resize(olm_encrypt_message_length(session, length));
+    Bytes random = random_bytes(olm_encrypt_random_length(session));
+    assert_equals(message.body.size(), olm_encrypt(
+        session, plaintext, length, random.data(), random.size(),
+        message.body.data(), message.body.size()
+    ));
+    return message;
+}
+
+static std::size_t try_decrypt(OlmSession * session, Message const & message) {
+    Bytes body = message.body;
+    std::size_t max_length = olm_decrypt_max_plaintext_length(
+        session, message.type, body.data(), body.size()
+    );
+    Bytes plaintext(max_length);
+    body = message.body;
+    return olm_decrypt(
+        session, message.type, body.data(), body.size(),
+        plaintext.data(), plaintext.size()
+    );
+}
+
+static void decrypt(OlmSession * session, Message const & message) {
+    assert_not_equals(std::size_t(-1), try_decrypt(session, message));
+}
+
+static void run_conversation(Limits const & limits) {
+    Bytes a_account_memory(olm_account_size());
+    OlmAccount * a_account = olm_account(a_account_memory.data());
+    Bytes random = random_bytes(olm_create_account_random_length(a_account));
+    olm_create_account(a_account, random.data(), random.size());
+
+    Bytes b_account_memory(olm_account_size());
+    OlmAccount * b_account = olm_account(b_account_memory.data());
+    random = random_bytes(olm_create_account_random_length(b_account));
+    olm_create_account(b_account, random.data(), random.size());
+    random = random_bytes(
+        olm_account_generate_one_time_keys_random_length(b_account, 1)
+    );
+    olm_account_generate_one_time_keys(
+        b_account, 1, random.data(), random.size()
+    );
+
+    Bytes b_id_keys(olm_account_identity_keys_length(b_account));
+    olm_account_identity_keys(b_account, b_id_keys.data(), b_id_keys.size());
+    Bytes b_ot_keys(olm_account_one_time_keys_length(b_account));
+    olm_account_one_time_keys(b_account, b_ot_keys.data(), b_ot_keys.size());
+
+    Bytes a_memory = session_memory(limits);
+    OlmSession * a = new_session(a_memory, limits);
+    random = random_bytes(olm_create_outbound_session_random_length(a));
+    assert_not_equals(std::size_t(-1), olm_create_outbound_session(
+        a, a_account,
+        b_id_keys.data() + 15, 43,
+        b_ot_keys.data() + 25, 43,
+        random.data(), random.size()
+    ));
+
+    Message first = encrypt(a, "first");
+    Bytes b_memory = session_memory(limits);
+    OlmSession * b = new_session(b_memory, limits);
+    Bytes body = first.body;
+    assert_not_equals(std::size_t(-1), olm_create_inbound_session(
+        b, b_account, body.data(), body.size()
+    ));
+    decrypt(b, first);
+
+    /* Neither session has been pickled, so the first deltas hold all of
+     * them and are loaded into new sessions */
+    Stored a_stored, b_stored;
+    store_delta(a, a_stored);
+    store_delta(b, b_stored);
+    check_stored(a, a_stored, limits);
+    check_stored(b, b_stored, limits);
+
+    /* A message along an existing chain changes little */
+    decrypt(b, encrypt(a, "in order"));
+    std::size_t delta_length = store_delta(b, b_stored);
+    assert_equals(true, delta_length < olm_pickle_session_length(b));
+    store_delta(a, a_stored);
+
+    /* Out of order messages add skipped keys and then use them */
+    std::vector<Message> messages;
+    for (int i = 0; i < 3; ++i) {
+        messages.push_back(encrypt(a, "out of order"));
+    }
+    decrypt(b, messages[2]);
+    store_delta(b, b_stored);
+    decrypt(b, messages[0]);
+    store_delta(b, b_stored);
+    store_delta(a, a_stored);
+    check_stored(b, b_stored, limits);
+
+    /* Replies move both sides onto new chains */
+    for (int i = 0; i < 3; ++i) {
+        decrypt(a, encrypt(b, "reply"));
+        store_delta(a, a_stored);
+        store_delta(b, b_stored);
+        decrypt(b, encrypt(a, "reply to the reply"));
+        store_delta(a, a_stored);
+        store_delta(b, b_stored);
+    }
+    check_stored(a, a_stored, limits);
+    check_stored(b, b_stored, limits);
+
+    /* A full pickle compacts what is stored */
+    store_full(b, b_stored);
+
+    /* Removing more skipped keys than the session keeps track of makes the
+     * delta carry the whole list */
+    messages.clear();
+    for (int i = 0; i < 12; ++i) {
+        messages.push_back(encrypt(a, "gap"));
+    }
+    decrypt(b, messages[11]);
+    store_delta(b, b_stored);
+    for (std::size_t i = 0; i < 10; ++i) {
+        /* Only the newest skipped keys are kept */
+        if (i + limits.max_skipped_message_keys >= 11) {
+            decrypt(b, messages[i]);
+        } else {
+            assert_equals(std::size_t(-1), try_decrypt(b, messages[i]));
+        }
+    }
+    store_delta(b, b_stored);
+    check_stored(b, b_stored, limits);
+
+    /* New chains and skipped keys beyond the limits push old ones out */
+    for (int i = 0; i < 4; ++i) {
+        messages.clear();
+        for (int j = 0; j < 5; ++j) {
+            messages.push_back(encrypt(a, "lossy"));
+        }
+        decrypt(b, messages[4]);
+        decrypt(a, encrypt(b, "ack"));
+        decrypt(b, messages[1]);
+        store_delta(b, b_stored);
+        store_delta(a, a_stored);
+    }
+    decrypt(b, messages[3]);
+    store_delta(b, b_stored);
+    check_stored(a, a_stored, limits);
+    check_stored(b, b_stored, limits);
+
+    /* Gaps kept as ranges go in the deltas and full pickles too */
+    olm_session_set_skipped_key_ranges(b, 20);
+    messages.clear();
+    for (int i = 0; i < 50; ++i) {
+        messages.push_back(encrypt(a, "range"));
+    }
+    decrypt(b, messages[49]);
+    store_delta(b, b_stored);
+    decrypt(b, messages[10]);
+    store_delta(b, b_stored);
+    check_stored(b, b_stored, limits);
+    store_full(b, b_stored);
+    decrypt(b, messages[0]);
+    store_delta(b, b_stored);
+    check_stored(b, b_stored, limits);
+
+    /* A delta can't be applied twice, and is refused without changing the
+     * session */
+    Bytes loaded_memory = session_memory(limits);
+    OlmSession * loaded = load(b_stored, loaded_memory, limits);
+    Bytes before = raw_pickle(loaded);
+    Bytes delta = b_stored.deltas.back();
+    assert_equals(std::size_t(-1), olm_unpickle_session_delta(
+        loaded, "key", 3, delta.data(), delta.size()
+    ));
+    assert_equals(
+        std::string("SESSION_DELTA_MISMATCH"),
+        std::string(olm_session_last_error(loaded))
+    );
+    Bytes after = raw_pickle(loaded);
+    assert_equals(before.data(), after.data(), before.size());
+
+    /* or with the wrong key */
+    delta = b_stored.deltas.back();
+    assert_equals(std::size_t(-1), olm_unpickle_session_delta(
+        loaded, "yek", 3, delta.data(), delta.size()
+    ));
+    assert_equals(
+        std::string("BAD_ACCOUNT_KEY"),
+        std::string(olm_session_last_error(loaded))
+    );
+}
+
+int main() {
+
+{
+    TestCase test_case("Session delta pickles");
+    Limits limits = {5, 40};
+    run_conversation(limits);
+}
+
+{
+    TestCase test_case("Session delta pickles with small limits");
+    Limits limits = {2, 4};
+    run_conversation(limits);
+}
+
+{
+    TestCase test_case("Session delta pickle is not a session pickle");
+
+    Bytes memory(olm_session_size());
+    OlmSession * session = olm_session(memory.data());
+    Bytes delta(olm_pickle_session_delta_length(session));
+    olm_pickle_session_delta(session, "key", 3, delta.data(), delta.size());
+
+    Bytes other_memory(olm_session_size());
+    OlmSession * other = olm_session(other_memory.data());
+    assert_equals(std::size_t(-1), olm_unpickle_session(
+        other, "key", 3, delta.data(), delta.size()
+    ));
+    assert_equals(
+        std::string("UNKNOWN_PICKLE_VERSION"),
+        std::string(olm_session_last_error(other))
+    );
+
+    Bytes pickle(olm_pickle_session_length(session));
+    olm_pickle_session(session, "key", 3, pickle.data(), pickle.size());
+    other = olm_session(other_memory.data());
+    assert_equals(std::size_t(-1), olm_unpickle_session_delta(
+        other, "key", 3, pickle.data(), pickle.size()
+    ));
+    assert_equals(
+        std::string("UNKNOWN_PICKLE_VERSION"),
+        std::string(olm_session_last_error(other))
+    );
+}
+
+}
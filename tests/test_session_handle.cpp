@@ -0,0 +1,295 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/olm.h"
+#include "olm/pool.h"
+#include "olm/session_handle.h"
+#include "unittest.hh"
+
+#include <string>
+#include <vector>
+
+typedef std::vector<std::uint8_t> Bytes;
+
+static std::uint32_t random_state = 1;
+
+static Bytes random_bytes(std::size_t length) {
+    Bytes result(length);
+    for (auto & byte : result) {
+        random_state = random_state * 1664525 + 1013904223;
+        byte = random_state >> 24;
+    }
+    return result;
+}
+
+struct Device {
+    Bytes account_memory;
+    OlmAccount * account;
+    Bytes session_memory;
+    OlmSession * session;
+
+    Device()
+        : account_memory(olm_account_size()),
+          account(olm_account(account_memory.data())),
+          session_memory(olm_session_size()),
+          session(olm_session(session_memory.data())) {
+        Bytes random = random_bytes(olm_create_account_random_length(account));
+        olm_create_account(account, random.data(), random.size());
+    }
+};
+
+static Bytes encrypt(OlmSession * session, std::string const & plaintext) {
+    Bytes random = random_bytes(olm_encrypt_random_length(session));
+    Bytes message(olm_encrypt_message_length(session, plaintext.size()));
+    message.resize(olm_encrypt(
+        session, plaintext.data(), plaintext.size(),
+        random.data(), random.size(), message.data(), message.size()
+    ));
+    return message;
+}
+
+static std::string decrypt(OlmSession * session, Bytes message) {
+    Bytes copy(message);
+    std::size_t max_length = olm_decrypt_max_plaintext_length(
+        session, 1, copy.data(), copy.size()
+    );
+    if (max_length == std::size_t(-1)) {
+        return "";
+    }
+    Bytes plaintext(max_length);
+    std::size_t length = olm_decrypt(
+        session, 1, message.data(), message.size(),
+        plaintext.data(), plaintext.size()
+    );
+    if (length == std::size_t(-1)) {
+        return "";
+    }
+    return std::string(plaintext.begin(), plaintext.begin() + length);
+}
+
+/* Sets up a conversation between alice and bob which has gone past the
+ * pre-key messages */
+static void start_conversation(Device & alice, Device & bob) {
+    Bytes random = random_bytes(
+        olm_account_generate_one_time_keys_random_length(bob.account, 1)
+    );
+    olm_account_generate_one_time_keys(
+        bob.account, 1, random.data(), random.size()
+    );
+    Bytes identity_keys(olm_account_identity_keys_length(bob.account));
+    olm_account_identity_keys(
+        bob.account, identity_keys.data(), identity_keys.size()
+    );
+    Bytes one_time_keys(olm_account_one_time_keys_length(bob.account));
+    olm_account_one_time_keys(
+        bob.account, one_time_keys.data(), one_time_keys.size()
+    );
+    random = random_bytes(
+        olm_create_outbound_session_random_length(alice.session)
+    );
+    olm_create_outbound_session(
+        alice.session, alice.account,
+        identity_keys.data() + 15, 43, one_time_keys.data() + 25, 43,
+        random.data(), random.size()
+    );
+
+    Bytes message = encrypt(alice.session, "Hello");
+    Bytes copy(message);
+    olm_create_inbound_session(
+        bob.session, bob.account, copy.data(), copy.size()
+    );
+    copy = message;
+    Bytes plaintext(olm_decrypt_max_plaintext_length(
+        bob.session, 0, copy.data(), copy.size()
+    ));
+    olm_decrypt(
+        bob.session, 0, message.data(), message.size(),
+        plaintext.data(), plaintext.size()
+    );
+    assert_equals(std::string("Hi"), decrypt(
+        alice.session, encrypt(bob.session, "Hi")
+    ));
+}
+
+static void *fail_allocate(void *, std::size_t) {
+    return nullptr;
+}
+
+static void fail_release(void *, void *, std::size_t) {}
+
+int main() {
+
+{
+    TestCase test_case("Session handle unpickles on first use");
+
+    Device alice, bob;
+    start_conversation(alice, bob);
+
+    Bytes key_memory(olm_pickle_key_size());
+    OlmPickleKey * key = olm_pickle_key(key_memory.data(), "key", 3);
+    Bytes pickled(2 * olm_pickle_session_with_key_length(
+        bob.session, OLM_PICKLE_CIPHER_AES_GCM
+    ));
+    std::size_t length = olm_pickle_session_with_key(
+        bob.session, key, OLM_PICKLE_CIPHER_AES_GCM,
+        pickled.data(), pickled.size()
+    );
+
+    Bytes slab_memory(olm_slab_size(olm_session_size(), 1));
+    OlmSlab * slab = olm_slab(slab_memory.data(), olm_session_size(), 1);
+    OlmAllocator allocator;
+    olm_slab_allocator(slab, &allocator);
+
+    Bytes handle_memory(olm_session_handle_size());
+    OlmSessionHandle * handle = olm_session_handle(
+        handle_memory.data(), key, OLM_PICKLE_CIPHER_AES_GCM, &allocator,
+        pickled.data(), length, pickled.size()
+    );
+    assert_equals(1, olm_session_handle_is_sealed(handle));
+    assert_equals(length, olm_session_handle_pickle_length(handle));
+    assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+
+    OlmSession * session = olm_session_handle_get(handle);
+    assert_not_equals((OlmSession *)nullptr, session);
+    assert_equals(0, olm_session_handle_is_sealed(handle));
+    assert_equals(std::size_t(0), olm_session_handle_pickle_length(handle));
+    assert_equals(std::size_t(1), olm_slab_slots_in_use(slab));
+    assert_equals(session, olm_session_handle_get(handle));
+    assert_equals(std::string("One"), decrypt(
+        session, encrypt(alice.session, "One")
+    ));
+
+    /* sealing gives the memory back, and the next use picks up where the
+     * session left off */
+    length = olm_session_handle_seal(handle);
+    assert_not_equals(std::size_t(-1), length);
+    assert_equals(1, olm_session_handle_is_sealed(handle));
+    assert_equals(length, olm_session_handle_pickle_length(handle));
+    assert_equals(length, olm_session_handle_seal(handle));
+    assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+
+    Bytes message = encrypt(alice.session, "Two");
+    session = olm_session_handle_get(handle);
+    assert_equals(std::string("Two"), decrypt(session, message));
+    assert_equals(std::string("Three"), decrypt(
+        alice.session, encrypt(session, "Three")
+    ));
+
+    /* the session has only just been used */
+    assert_equals(std::size_t(0), olm_session_handle_seal_if_idle(handle));
+    assert_equals(0, olm_session_handle_is_sealed(handle));
+    olm_session_handle_set_idle_timeout(handle, 0);
+    length = olm_session_handle_seal_if_idle(handle);
+    assert_not_equals(std::size_t(0), length);
+    assert_not_equals(std::size_t(-1), length);
+    assert_equals(1, olm_session_handle_is_sealed(handle));
+
+    /* the buffer holds an ordinary pickle */
+    Bytes loaded_memory(olm_session_size());
+    OlmSession * loaded = olm_session(loaded_memory.data());
+    Bytes copy(pickled.begin(), pickled.begin() + length);
+    assert_equals(length, olm_unpickle_session_with_key(
+        loaded, key, copy.data(), copy.size()
+    ));
+    assert_equals(std::string("Four"), decrypt(
+        loaded, encrypt(alice.session, "Four")
+    ));
+
+    olm_session_handle_get(handle);
+    olm_clear_session_handle(handle);
+    assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+    olm_clear_pickle_key(key);
+}
+
+{
+    TestCase test_case("Session handle errors");
+
+    Device alice, bob;
+    start_conversation(alice, bob);
+
+    Bytes key_memory(olm_pickle_key_size());
+    OlmPickleKey * key = olm_pickle_key(key_memory.data(), "key", 3);
+    std::size_t length = olm_pickle_session_with_key_length(
+        bob.session, OLM_PICKLE_CIPHER_AES_GCM
+    );
+    Bytes pickled(length);
+    olm_pickle_session_with_key(
+        bob.session, key, OLM_PICKLE_CIPHER_AES_GCM,
+        pickled.data(), pickled.size()
+    );
+    Bytes original(pickled);
+
+    /* running out of memory leaves the pickle to try again */
+    OlmAllocator failing = {fail_allocate, fail_release, nullptr};
+    Bytes handle_memory(olm_session_handle_size());
+    OlmSessionHandle * handle = olm_session_handle(
+        handle_memory.data(), key, OLM_PICKLE_CIPHER_AES_GCM, &failing,
+        pickled.data(), length, pickled.size()
+    );
+    assert_equals((OlmSession *)nullptr, olm_session_handle_get(handle));
+    assert_equals(
+        std::string("ALLOCATION_FAILED"),
+        std::string(olm_session_handle_last_error(handle))
+    );
+    assert_equals(length, olm_session_handle_pickle_length(handle));
+    assert_equals(true, original == pickled);
+
+    /* a session that has outgrown its buffer stays unpickled */
+    Bytes slab_memory(olm_slab_size(olm_session_size(), 1));
+    OlmSlab * slab = olm_slab(slab_memory.data(), olm_session_size(), 1);
+    OlmAllocator allocator;
+    olm_slab_allocator(slab, &allocator);
+    handle = olm_session_handle(
+        handle_memory.data(), key, OLM_PICKLE_CIPHER_AES_GCM, &allocator,
+        pickled.data(), length, length - 1
+    );
+    OlmSession * session = olm_session_handle_get(handle);
+    assert_not_equals((OlmSession *)nullptr, session);
+    assert_equals(std::size_t(-1), olm_session_handle_seal(handle));
+    assert_equals(
+        std::string("OUTPUT_BUFFER_TOO_SMALL"),
+        std::string(olm_session_handle_last_error(handle))
+    );
+    assert_equals(0, olm_session_handle_is_sealed(handle));
+    assert_equals(std::string("Still here"), decrypt(
+        session, encrypt(alice.session, "Still here")
+    ));
+    olm_clear_session_handle(handle);
+    assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+
+    /* the wrong key loses the pickle, as unpickling it would */
+    Bytes other_key_memory(olm_pickle_key_size());
+    OlmPickleKey * other_key = olm_pickle_key(
+        other_key_memory.data(), "other", 5
+    );
+    pickled = original;
+    handle = olm_session_handle(
+        handle_memory.data(), other_key, OLM_PICKLE_CIPHER_AES_GCM,
+        &allocator, pickled.data(), length, pickled.size()
+    );
+    assert_equals((OlmSession *)nullptr, olm_session_handle_get(handle));
+    assert_equals(
+        std::string("BAD_ACCOUNT_KEY"),
+        std::string(olm_session_handle_last_error(handle))
+    );
+    assert_equals(std::size_t(0), olm_slab_slots_in_use(slab));
+    assert_equals((OlmSession *)nullptr, olm_session_handle_get(handle));
+    assert_equals(std::size_t(0), olm_session_handle_pickle_length(handle));
+    olm_clear_session_handle(handle);
+
+    olm_clear_pickle_key(key);
+    olm_clear_pickle_key(other_key);
+}
+
+}
@@ -0,0 +1,101 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/outbound_group_session.h"
+#include "olm/stats.h"
+#include "unittest.hh"
+
+#include <vector>
+
+int main() {
+
+{ /** Group session stats test */
+
+TestCase test_case("Group session stats");
+
+std::vector<std::uint8_t> outbound_buffer(olm_outbound_group_session_size());
+OlmOutboundGroupSession * outbound = olm_outbound_group_session(
+    outbound_buffer.data()
+);
+std::vector<std::uint8_t> random(
+    olm_init_outbound_group_session_random_length(outbound), 0x42
+);
+olm_init_outbound_group_session(outbound, random.data(), random.size());
+std::vector<std::uint8_t> session_key(
+    olm_outbound_group_session_key_length(outbound)
+);
+olm_outbound_group_session_key(
+    outbound, session_key.data(), session_key.size()
+);
+std::vector<std::uint8_t> inbound_buffer(olm_inbound_group_session_size());
+OlmInboundGroupSession * inbound = olm_inbound_group_session(
+    inbound_buffer.data()
+);
+olm_init_inbound_group_session(
+    inbound, session_key.data(), session_key.size()
+);
+
+std::uint8_t plaintext[] = "Message";
+std::vector<std::uint8_t> message(
+    olm_group_encrypt_message_length(outbound, sizeof(plaintext))
+);
+olm_stats_reset();
+std::size_t message_length = olm_group_encrypt(
+    outbound, plaintext, sizeof(plaintext), message.data(), message.size()
+);
+assert_not_equals(std::size_t(-1), message_length);
+
+OlmStats stats;
+olm_stats_get(&stats);
+if (olm_stats_enabled()) {
+    assert_equals(std::uint64_t(1), stats.calls[OLM_STATS_GROUP_ENCRYPT]);
+    assert_equals(std::uint64_t(1), stats.ed25519_signs);
+    /* moving on from the first message rehashes the last part */
+    assert_equals(std::uint64_t(1), stats.megolm_rehashes);
+    assert_equals(std::uint64_t(1), stats.hkdf_sha256);
+    /* the message is one AES block, encrypted under a MAC */
+    assert_equals(std::uint64_t(1), stats.aes_blocks);
+    assert_not_equals(std::uint64_t(0), stats.hmac_sha256);
+    assert_not_equals(std::uint64_t(0), stats.sha256_blocks);
+} else {
+    assert_equals(std::uint64_t(0), stats.calls[OLM_STATS_GROUP_ENCRYPT]);
+    assert_equals(std::uint64_t(0), stats.sha256_blocks);
+}
+
+/* the counters go on adding up until they are reset */
+std::uint8_t output[32];
+std::uint32_t message_index;
+assert_equals(sizeof(plaintext), olm_group_decrypt(
+    inbound, message.data(), message_length,
+    output, sizeof(output), &message_index
+));
+OlmStats after;
+olm_stats_get(&after);
+if (olm_stats_enabled()) {
+    assert_equals(std::uint64_t(1), after.calls[OLM_STATS_GROUP_ENCRYPT]);
+    assert_equals(std::uint64_t(1), after.calls[OLM_STATS_GROUP_DECRYPT]);
+    assert_equals(std::uint64_t(1), after.ed25519_verifies);
+    assert_equals(true, after.hmac_sha256 > stats.hmac_sha256);
+} else {
+    assert_equals(std::uint64_t(0), after.calls[OLM_STATS_GROUP_DECRYPT]);
+}
+
+olm_stats_reset();
+olm_stats_get(&stats);
+assert_equals(std::uint64_t(0), stats.calls[OLM_STATS_GROUP_DECRYPT]);
+assert_equals(std::uint64_t(0), stats.hmac_sha256);
+}
+
+}
@@ -0,0 +1,233 @@
+/* Copyright 2016 OpenMarket Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "olm/inbound_group_session.h"
+#include "olm/outbound_group_session.h"
+#include "olm/trace.h"
+#include "unittest.hh"
+
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    OlmTraceOperation operation;
+    OlmTraceEvent event;
+};
+
+void record_event(
+    void * context,
+    OlmTraceOperation operation, OlmTraceEvent event,
+    std::uint64_t nanoseconds
+) {
+    static_cast<std::vector<TraceEvent> *>(context)->push_back(
+        {operation, event}
+    );
+}
+
+/** Whether every exit matches the latest unmatched entry */
+bool events_nest(std::vector<TraceEvent> const & events) {
+    std::vector<OlmTraceOperation> entered;
+    for (TraceEvent const & event : events) {
+        if (event.event == OLM_TRACE_ENTER) {
+            entered.push_back(event.operation);
+        } else if (entered.empty() || entered.back() != event.operation) {
+            return false;
+        } else {
+            entered.pop_back();
+        }
+    }
+    return entered.empty();
+}
+
+bool has_operation(
+    std::vector<TraceEvent> const & events, OlmTraceOperation operation
+) {
+    for (TraceEvent const & event : events) {
+        if (event.operation == operation) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void record_call(void * context, OlmRecordEvent const * event) {
+    static_cast<std::vector<OlmRecordEvent> *>(context)->push_back(*event);
+}
+
+} // namespace
+
+int main() {
+
+{ /** Group session trace test */
+
+TestCase test_case("Group session trace");
+
+std::vector<std::uint8_t> outbound_buffer(olm_outbound_group_session_size());
+OlmOutboundGroupSession * outbound = olm_outbound_group_session(
+    outbound_buffer.data()
+);
+std::vector<std::uint8_t> random(
+    olm_init_outbound_group_session_random_length(outbound), 0x42
+);
+olm_init_outbound_group_session(outbound, random.data(), random.size());
+std::vector<std::uint8_t> session_key(
+    olm_outbound_group_session_key_length(outbound)
+);
+olm_outbound_group_session_key(
+    outbound, session_key.data(), session_key.size()
+);
+std::vector<std::uint8_t> inbound_buffer(olm_inbound_group_session_size());
+OlmInboundGroupSession * inbound = olm_inbound_group_session(
+    inbound_buffer.data()
+);
+olm_init_inbound_group_session(
+    inbound, session_key.data(), session_key.size()
+);
+
+std::vector<TraceEvent> events;
+olm_trace_set_callback(record_event, &events);
+
+std::uint8_t plaintext[] = "Message";
+std::vector<std::uint8_t> message(
+    olm_group_encrypt_message_length(outbound, sizeof(plaintext))
+);
+std::size_t message_length = olm_group_encrypt(
+    outbound, plaintext, sizeof(plaintext), message.data(), message.size()
+);
+assert_not_equals(std::size_t(-1), message_length);
+
+if (olm_trace_enabled()) {
+    assert_equals(false, events.empty());
+    assert_equals(OLM_TRACE_GROUP_ENCRYPT, events.front().operation);
+    assert_equals(OLM_TRACE_ENTER, events.front().event);
+    assert_equals(OLM_TRACE_GROUP_ENCRYPT, events.back().operation);
+    assert_equals(OLM_TRACE_EXIT, events.back().event);
+    assert_equals(true, events_nest(events));
+    assert_equals(true, has_operation(events, OLM_TRACE_CIPHER_ENCRYPT));
+    assert_equals(true, has_operation(events, OLM_TRACE_MEGOLM_ADVANCE));
+} else {
+    assert_equals(true, events.empty());
+}
+
+events.clear();
+std::uint8_t output[32];
+std::uint32_t message_index;
+assert_equals(sizeof(plaintext), olm_group_decrypt(
+    inbound, message.data(), message_length,
+    output, sizeof(output), &message_index
+));
+if (olm_trace_enabled()) {
+    assert_equals(OLM_TRACE_GROUP_DECRYPT, events.front().operation);
+    assert_equals(true, events_nest(events));
+    assert_equals(true, has_operation(events, OLM_TRACE_CIPHER_DECRYPT));
+} else {
+    assert_equals(true, events.empty());
+}
+
+/* nothing is called once the hook is cleared */
+olm_trace_set_callback(NULL, NULL);
+events.clear();
+message.resize(olm_group_encrypt_message_length(outbound, sizeof(plaintext)));
+assert_not_equals(std::size_t(-1), olm_group_encrypt(
+    outbound, plaintext, sizeof(plaintext), message.data(), message.size()
+));
+assert_equals(true, events.empty());
+}
+
+{ /** Group session record test */
+
+TestCase test_case("Group session record");
+
+std::vector<OlmRecordEvent> calls;
+olm_record_set_callback(record_call, &calls);
+
+std::vector<std::uint8_t> outbound_buffer(olm_outbound_group_session_size());
+OlmOutboundGroupSession * outbound = olm_outbound_group_session(
+    outbound_buffer.data()
+);
+std::vector<std::uint8_t> random(
+    olm_init_outbound_group_session_random_length(outbound), 0x42
+);
+olm_init_outbound_group_session(outbound, random.data(), random.size());
+std::vector<std::uint8_t> session_key(
+    olm_outbound_group_session_key_length(outbound)
+);
+olm_outbound_group_session_key(
+    outbound, session_key.data(), session_key.size()
+);
+std::vector<std::uint8_t> inbound_buffer(olm_inbound_group_session_size());
+OlmInboundGroupSession * inbound = olm_inbound_group_session(
+    inbound_buffer.data()
+);
+olm_init_inbound_group_session(
+    inbound, session_key.data(), session_key.size()
+);
+
+std::uint8_t plaintext[] = "Message";
+std::vector<std::vector<std::uint8_t>> messages(3);
+for (auto & message : messages) {
+    message.resize(
+        olm_group_encrypt_message_length(outbound, sizeof(plaintext))
+    );
+    olm_group_encrypt(
+        outbound, plaintext, sizeof(plaintext), message.data(), message.size()
+    );
+}
+
+/* out of order, then with a character of the message changed */
+std::uint8_t output[32];
+std::uint32_t message_index;
+for (std::size_t i : {2, 0}) {
+    std::vector<std::uint8_t> tmp(messages[i]);
+    olm_group_decrypt(
+        inbound, tmp.data(), tmp.size(), output, sizeof(output), &message_index
+    );
+}
+std::vector<std::uint8_t> changed(messages[1]);
+changed[20] = changed[20] == 'A' ? 'B' : 'A';
+assert_equals(std::size_t(-1), olm_group_decrypt(
+    inbound, changed.data(), changed.size(),
+    output, sizeof(output), &message_index
+));
+olm_record_set_callback(NULL, NULL);
+
+if (olm_trace_enabled()) {
+    assert_equals(std::size_t(8), calls.size());
+    assert_equals(OLM_TRACE_INIT_OUTBOUND_GROUP_SESSION, calls[0].operation);
+    assert_equals(OLM_TRACE_INIT_INBOUND_GROUP_SESSION, calls[1].operation);
+    bool same = calls[1].session == inbound;
+    assert_equals(true, same);
+    for (std::uint32_t i = 0; i < 3; ++i) {
+        OlmRecordEvent const & encrypt = calls[2 + i];
+        assert_equals(OLM_TRACE_GROUP_ENCRYPT, encrypt.operation);
+        same = encrypt.session == outbound;
+        assert_equals(true, same);
+        assert_equals(i, encrypt.message_index);
+        assert_equals(sizeof(plaintext), encrypt.plaintext_length);
+        assert_equals(0, encrypt.failed);
+    }
+    assert_equals(OLM_TRACE_GROUP_DECRYPT, calls[5].operation);
+    assert_equals(std::uint32_t(2), calls[5].message_index);
+    assert_equals(sizeof(plaintext), calls[5].plaintext_length);
+    assert_equals(std::uint32_t(0), calls[6].message_index);
+    assert_equals(0, calls[6].failed);
+    assert_equals(std::uint32_t(1), calls[7].message_index);
+    assert_equals(1, calls[7].failed);
+} else {
+    assert_equals(true, calls.empty());
+}
+}
+
+}
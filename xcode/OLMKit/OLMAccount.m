@@ -221,6 +221,51 @@
     return pickleString;
 }
 
+/** Initializes from an encrypted binary pickle. Will throw error if invalid key. */
+- (instancetype) initWithSerializedBinaryData:(NSData*)serializedData key:(NSData*)key error:(NSError**)error {
+    self = [self init];
+    if (!self) {
+        return nil;
+    }
+    NSParameterAssert(key.length > 0);
+    NSParameterAssert(serializedData.length > 0);
+    if (key.length == 0 || serializedData.length == 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: @"Bad length."}];
+        }
+        return nil;
+    }
+    NSMutableData *pickle = serializedData.mutableCopy;
+    size_t result = olm_unpickle_account_binary(_account, key.bytes, key.length, pickle.mutableBytes, pickle.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_account_last_error(_account);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    return self;
+}
+
+/** Serializes and encrypts object data, outputs a binary pickle */
+- (NSData*) serializeBinaryDataWithKey:(NSData*)key error:(NSError**)error {
+    NSParameterAssert(key.length > 0);
+    size_t length = olm_pickle_account_binary_length(_account);
+    NSMutableData *pickled = [NSMutableData dataWithLength:length];
+    size_t result = olm_pickle_account_binary(_account, key.bytes, key.length, pickled.mutableBytes, pickled.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_account_last_error(_account);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    pickled.length = result;
+    return pickled;
+}
+
 #pragma mark NSSecureCoding
 
 + (BOOL) supportsSecureCoding {
@@ -239,6 +284,12 @@
         NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
 
         self = [self initWithSerializedData:pickle key:key error:&error];
+    } else if ([version isEqualToString:@"2"]) {
+        // version 2 archives hold a binary pickle, with no base64 to decode
+        NSData *pickle = [decoder decodeObjectOfClass:[NSData class] forKey:@"pickle"];
+        NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
+
+        self = [self initWithSerializedBinaryData:pickle key:key error:&error];
     }
     
     NSParameterAssert(error == nil);
@@ -253,12 +304,12 @@
 - (void)encodeWithCoder:(NSCoder *)encoder {
     NSData *key = [OLMUtility randomBytesOfLength:32];
     NSError *error = nil;
-    NSString *pickle = [self serializeDataWithKey:key error:&error];
+    NSData *pickle = [self serializeBinaryDataWithKey:key error:&error];
     NSParameterAssert(pickle.length > 0 && error == nil);
     
     [encoder encodeObject:pickle forKey:@"pickle"];
     [encoder encodeObject:key forKey:@"key"];
-    [encoder encodeObject:@"1" forKey:@"version"];
+    [encoder encodeObject:@"2" forKey:@"version"];
 }
 
 
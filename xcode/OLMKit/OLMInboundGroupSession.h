@@ -18,6 +18,16 @@
 #import <Foundation/Foundation.h>
 #import "OLMSerializable.h"
 
+/** The result of decrypting one message of a batch */
+@interface OLMGroupDecryptionResult : NSObject
+
+/** the UTF-8 plaintext, or nil if the message couldn't be decrypted */
+@property (nonatomic, copy, readonly, nullable) NSString *plaintext;
+@property (readonly) NSUInteger messageIndex;
+@property (nonatomic, readonly, nullable) NSError *error;
+
+@end
+
 @interface OLMInboundGroupSession : NSObject <OLMSerializable, NSSecureCoding>
 
 - (instancetype) initInboundGroupSessionWithSessionKey:(NSString*)sessionKey error:(NSError**)error;
@@ -27,4 +37,19 @@
 /** base64 ciphertext -> UTF-8 plaintext */
 - (NSString*)decryptMessage:(NSString*)message messageIndex:(NSUInteger*)messageIndex error:(NSError**)error;
 
+/** binary ciphertext, as from -[OLMOutboundGroupSession encryptRawMessage:error:] -> plaintext.
+ The message isn't copied, and the plaintext is wiped when it is released. */
+- (NSData*)decryptRawMessage:(NSData*)message messageIndex:(NSUInteger*)messageIndex error:(NSError**)error;
+
+/**
+ Decrypt a batch of base64 ciphertexts off the main thread, giving a result
+ for each in the same order. Batches for different sessions run at once on a
+ concurrent queue; those for the same session run one after another. Don't
+ use the session's other methods until completion has been called.
+
+ @param messages the base64 ciphertexts.
+ @param completion called on the main queue with the results.
+ */
+- (void)decryptMessages:(NSArray<NSString*>*)messages completion:(void (^)(NSArray<OLMGroupDecryptionResult*> *results))completion;
+
 @end
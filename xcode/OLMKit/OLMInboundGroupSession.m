@@ -20,12 +20,45 @@
 #import "OLMUtility.h"
 #include "olm/olm.h"
 
+@interface OLMGroupDecryptionResult ()
+
+- (instancetype)initWithPlaintext:(NSString*)plaintext messageIndex:(NSUInteger)messageIndex error:(NSError*)error;
+
+@end
+
+@implementation OLMGroupDecryptionResult
+
+- (instancetype)initWithPlaintext:(NSString*)plaintext messageIndex:(NSUInteger)messageIndex error:(NSError*)error {
+    self = [super init];
+    if (self) {
+        _plaintext = [plaintext copy];
+        _messageIndex = messageIndex;
+        _error = error;
+    }
+    return self;
+}
+
+@end
+
+
 @interface OLMInboundGroupSession ()
 {
     OlmInboundGroupSession *session;
+    /** serialises the batches for this session */
+    dispatch_queue_t queue;
 }
 @end
 
+/** the queue that batches for all sessions run on */
+static dispatch_queue_t decryptionQueue(void) {
+    static dispatch_queue_t queue;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        queue = dispatch_queue_create("org.matrix.olm.decrypt", DISPATCH_QUEUE_CONCURRENT);
+    });
+    return queue;
+}
+
 
 @implementation OLMInboundGroupSession
 
@@ -46,6 +79,9 @@
         if (!session) {
             return nil;
         }
+
+        queue = dispatch_queue_create("org.matrix.olm.inbound_group_session", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(queue, decryptionQueue());
     }
     return self;
 }
@@ -100,26 +136,24 @@
         return nil;
     }
     NSMutableData *mutMessage = messageData.mutableCopy;
-    size_t maxPlaintextLength = olm_group_decrypt_max_plaintext_length(session, mutMessage.mutableBytes, mutMessage.length);
+    size_t maxPlaintextLength = olm_group_peek_max_plaintext_length(session, mutMessage.mutableBytes, mutMessage.length);
     if (maxPlaintextLength == olm_error()) {
         const char *olm_error = olm_inbound_group_session_last_error(session);
 
         NSString *errorString = [NSString stringWithUTF8String:olm_error];
-        NSLog(@"olm_group_decrypt_max_plaintext_length error: %@", errorString);
+        NSLog(@"olm_group_peek_max_plaintext_length error: %@", errorString);
 
         if (error && olm_error && errorString) {
             *error = [NSError errorWithDomain:OLMErrorDomain
                                          code:0
                                      userInfo:@{
                                                 NSLocalizedDescriptionKey: errorString,
-                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_group_decrypt_max_plaintext_length error: %@", errorString]
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_group_peek_max_plaintext_length error: %@", errorString]
                                                 }];
         }
         
         return nil;
     }
-    // message buffer is destroyed by olm_group_decrypt_max_plaintext_length
-    mutMessage = messageData.mutableCopy;
     NSMutableData *plaintextData = [NSMutableData dataWithLength:maxPlaintextLength];
 
     uint32_t message_index;
@@ -153,6 +187,139 @@
     return plaintext;
 }
 
+- (NSData *)decryptRawMessage:(NSData *)message messageIndex:(NSUInteger*)messageIndex error:(NSError**)error
+{
+    NSParameterAssert(message != nil);
+    size_t maxPlaintextLength = olm_group_decrypt_raw_max_plaintext_length(session, message.bytes, message.length);
+    if (maxPlaintextLength == olm_error()) {
+        const char *olm_error = olm_inbound_group_session_last_error(session);
+
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        NSLog(@"olm_group_decrypt_raw_max_plaintext_length error: %@", errorString);
+
+        if (error && olm_error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain
+                                         code:0
+                                     userInfo:@{
+                                                NSLocalizedDescriptionKey: errorString,
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_group_decrypt_raw_max_plaintext_length error: %@", errorString]
+                                                }];
+        }
+
+        return nil;
+    }
+    uint8_t *plaintext = malloc(maxPlaintextLength ? maxPlaintextLength : 1);
+    if (!plaintext) {
+        return nil;
+    }
+
+    uint32_t message_index;
+    size_t plaintextLength = olm_group_decrypt_raw(session, message.bytes, message.length, plaintext, maxPlaintextLength, &message_index);
+    if (plaintextLength == olm_error()) {
+        memset_s(plaintext, maxPlaintextLength, 0, maxPlaintextLength);
+        free(plaintext);
+        const char *olm_error = olm_inbound_group_session_last_error(session);
+
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        NSLog(@"olm_group_decrypt_raw error: %@", errorString);
+
+        if (error && olm_error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain
+                                         code:0
+                                     userInfo:@{
+                                                NSLocalizedDescriptionKey: errorString,
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_group_decrypt_raw error: %@", errorString]
+                                                }];
+        }
+
+        return nil;
+    }
+    // only the plaintext is wiped when the data is released
+    memset_s(plaintext + plaintextLength, maxPlaintextLength - plaintextLength, 0, maxPlaintextLength - plaintextLength);
+
+    if (messageIndex)
+    {
+        *messageIndex = message_index;
+    }
+
+    return [OLMUtility dataWithWipedBytesNoCopy:plaintext length:plaintextLength];
+}
+
+- (void)decryptMessages:(NSArray<NSString*>*)messages completion:(void (^)(NSArray<OLMGroupDecryptionResult*> *results))completion
+{
+    NSParameterAssert(messages != nil);
+    NSParameterAssert(completion != nil);
+    NSArray<NSString*> *batch = [messages copy];
+    dispatch_async(queue, ^{
+        NSArray<OLMGroupDecryptionResult*> *results = [self decryptMessageBatch:batch];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completion(results);
+        });
+    });
+}
+
+- (NSArray<OLMGroupDecryptionResult*>*)decryptMessageBatch:(NSArray<NSString*>*)messages
+{
+    NSUInteger count = messages.count;
+    if (count == 0) {
+        return @[];
+    }
+
+    // copies of the messages, which are decoded in place, and room for each
+    // plaintext, which is never longer than its message
+    NSMutableArray<NSMutableData*> *messageBuffers = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray<NSMutableData*> *plaintextBuffers = [NSMutableArray arrayWithCapacity:count];
+    NSMutableData *messagePointers = [NSMutableData dataWithLength:count * sizeof(uint8_t*)];
+    NSMutableData *messageLengths = [NSMutableData dataWithLength:count * sizeof(size_t)];
+    NSMutableData *plaintextPointers = [NSMutableData dataWithLength:count * sizeof(uint8_t*)];
+    NSMutableData *maxPlaintextLengths = [NSMutableData dataWithLength:count * sizeof(size_t)];
+    NSMutableData *plaintextLengths = [NSMutableData dataWithLength:count * sizeof(size_t)];
+    NSMutableData *messageIndices = [NSMutableData dataWithLength:count * sizeof(uint32_t)];
+    NSMutableData *errors = [NSMutableData dataWithLength:count * sizeof(const char*)];
+
+    for (NSUInteger i = 0; i < count; i++) {
+        NSMutableData *messageData = [[messages[i] dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+        NSMutableData *plaintextData = [NSMutableData dataWithLength:messageData.length];
+        [messageBuffers addObject:messageData];
+        [plaintextBuffers addObject:plaintextData];
+        ((uint8_t**)messagePointers.mutableBytes)[i] = messageData.mutableBytes;
+        ((size_t*)messageLengths.mutableBytes)[i] = messageData.length;
+        ((uint8_t**)plaintextPointers.mutableBytes)[i] = plaintextData.mutableBytes;
+        ((size_t*)maxPlaintextLengths.mutableBytes)[i] = plaintextData.length;
+    }
+
+    olm_group_decrypt_batch(
+        session, count,
+        messagePointers.mutableBytes, messageLengths.bytes,
+        plaintextPointers.mutableBytes, maxPlaintextLengths.bytes,
+        plaintextLengths.mutableBytes, messageIndices.mutableBytes,
+        errors.mutableBytes
+    );
+
+    NSMutableArray<OLMGroupDecryptionResult*> *results = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        size_t plaintextLength = ((size_t*)plaintextLengths.bytes)[i];
+        uint32_t messageIndex = ((uint32_t*)messageIndices.bytes)[i];
+        NSString *plaintext = nil;
+        NSError *error = nil;
+        if (plaintextLength == olm_error()) {
+            NSString *errorString = [NSString stringWithUTF8String:((const char**)errors.bytes)[i]];
+            NSLog(@"olm_group_decrypt_batch error: %@", errorString);
+            error = [NSError errorWithDomain:OLMErrorDomain
+                                        code:0
+                                    userInfo:@{
+                                               NSLocalizedDescriptionKey: errorString,
+                                               NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_group_decrypt_batch error: %@", errorString]
+                                               }];
+        } else {
+            plaintext = [[NSString alloc] initWithBytes:plaintextBuffers[i].bytes length:plaintextLength encoding:NSUTF8StringEncoding];
+        }
+        [plaintextBuffers[i] resetBytesInRange:NSMakeRange(0, plaintextBuffers[i].length)];
+        [results addObject:[[OLMGroupDecryptionResult alloc] initWithPlaintext:plaintext messageIndex:messageIndex error:error]];
+    }
+    return results;
+}
+
 
 #pragma mark OLMSerializable
 
@@ -201,6 +368,51 @@
     return pickleString;
 }
 
+/** Initializes from an encrypted binary pickle. Will throw error if invalid key. */
+- (instancetype) initWithSerializedBinaryData:(NSData*)serializedData key:(NSData*)key error:(NSError**)error {
+    self = [self init];
+    if (!self) {
+        return nil;
+    }
+    NSParameterAssert(key.length > 0);
+    NSParameterAssert(serializedData.length > 0);
+    if (key.length == 0 || serializedData.length == 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: @"Bad length."}];
+        }
+        return nil;
+    }
+    NSMutableData *pickle = serializedData.mutableCopy;
+    size_t result = olm_unpickle_inbound_group_session_binary(session, key.bytes, key.length, pickle.mutableBytes, pickle.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_inbound_group_session_last_error(session);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    return self;
+}
+
+/** Serializes and encrypts object data, outputs a binary pickle */
+- (NSData*) serializeBinaryDataWithKey:(NSData*)key error:(NSError**)error {
+    NSParameterAssert(key.length > 0);
+    size_t length = olm_pickle_inbound_group_session_binary_length(session);
+    NSMutableData *pickled = [NSMutableData dataWithLength:length];
+    size_t result = olm_pickle_inbound_group_session_binary(session, key.bytes, key.length, pickled.mutableBytes, pickled.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_inbound_group_session_last_error(session);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    pickled.length = result;
+    return pickled;
+}
+
 #pragma mark NSSecureCoding
 
 + (BOOL) supportsSecureCoding {
@@ -219,6 +431,12 @@
         NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
 
         self = [self initWithSerializedData:pickle key:key error:&error];
+    } else if ([version isEqualToString:@"2"]) {
+        // version 2 archives hold a binary pickle, with no base64 to decode
+        NSData *pickle = [decoder decodeObjectOfClass:[NSData class] forKey:@"pickle"];
+        NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
+
+        self = [self initWithSerializedBinaryData:pickle key:key error:&error];
     }
 
     NSParameterAssert(error == nil);
@@ -233,12 +451,12 @@
 - (void)encodeWithCoder:(NSCoder *)encoder {
     NSData *key = [OLMUtility randomBytesOfLength:32];
     NSError *error = nil;
-    NSString *pickle = [self serializeDataWithKey:key error:&error];
+    NSData *pickle = [self serializeBinaryDataWithKey:key error:&error];
     NSParameterAssert(pickle.length > 0 && error == nil);
 
     [encoder encodeObject:pickle forKey:@"pickle"];
     [encoder encodeObject:key forKey:@"key"];
-    [encoder encodeObject:@"1" forKey:@"version"];
+    [encoder encodeObject:@"2" forKey:@"version"];
 }
 
 @end
@@ -30,3 +30,4 @@ NSString *OLMKitVersionString();
 #import <OLMKit/OLMUtility.h>
 #import <OLMKit/OLMInboundGroupSession.h>
 #import <OLMKit/OLMOutboundGroupSession.h>
+#import <OLMKit/OLMStats.h>
@@ -29,4 +29,7 @@
 /** UTF-8 plaintext -> base64 ciphertext */
 - (NSString*)encryptMessage:(NSString*)message error:(NSError**)error;
 
+/** plaintext -> binary ciphertext, for -[OLMInboundGroupSession decryptRawMessage:messageIndex:error:] */
+- (NSData*)encryptRawMessage:(NSData*)plaintext error:(NSError**)error;
+
 @end
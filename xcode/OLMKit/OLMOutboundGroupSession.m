@@ -130,6 +130,35 @@
     return [[NSString alloc] initWithData:ciphertext encoding:NSUTF8StringEncoding];
 }
 
+- (NSData *)encryptRawMessage:(NSData *)plaintext error:(NSError**)error {
+    NSParameterAssert(plaintext != nil);
+    size_t ciphertextLength = olm_group_encrypt_raw_message_length(session, plaintext.length);
+    NSMutableData *ciphertext = [NSMutableData dataWithLength:ciphertextLength];
+    if (!ciphertext) {
+        return nil;
+    }
+    size_t result = olm_group_encrypt_raw(session, plaintext.bytes, plaintext.length, ciphertext.mutableBytes, ciphertext.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_outbound_group_session_last_error(session);
+
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        NSLog(@"olm_group_encrypt_raw error: %@", errorString);
+
+        if (error && olm_error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain
+                                         code:0
+                                     userInfo:@{
+                                                NSLocalizedDescriptionKey: errorString,
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_group_encrypt_raw error: %@", errorString]
+                                                }];
+        }
+
+        return nil;
+    }
+    ciphertext.length = result;
+    return ciphertext;
+}
+
 #pragma mark OLMSerializable
 
 /** Initializes from encrypted serialized data. Will throw error if invalid key or invalid base64. */
@@ -177,6 +206,51 @@
     return pickleString;
 }
 
+/** Initializes from an encrypted binary pickle. Will throw error if invalid key. */
+- (instancetype) initWithSerializedBinaryData:(NSData*)serializedData key:(NSData*)key error:(NSError**)error {
+    self = [self init];
+    if (!self) {
+        return nil;
+    }
+    NSParameterAssert(key.length > 0);
+    NSParameterAssert(serializedData.length > 0);
+    if (key.length == 0 || serializedData.length == 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: @"Bad length."}];
+        }
+        return nil;
+    }
+    NSMutableData *pickle = serializedData.mutableCopy;
+    size_t result = olm_unpickle_outbound_group_session_binary(session, key.bytes, key.length, pickle.mutableBytes, pickle.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_outbound_group_session_last_error(session);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    return self;
+}
+
+/** Serializes and encrypts object data, outputs a binary pickle */
+- (NSData*) serializeBinaryDataWithKey:(NSData*)key error:(NSError**)error {
+    NSParameterAssert(key.length > 0);
+    size_t length = olm_pickle_outbound_group_session_binary_length(session);
+    NSMutableData *pickled = [NSMutableData dataWithLength:length];
+    size_t result = olm_pickle_outbound_group_session_binary(session, key.bytes, key.length, pickled.mutableBytes, pickled.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_outbound_group_session_last_error(session);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    pickled.length = result;
+    return pickled;
+}
+
 #pragma mark NSSecureCoding
 
 + (BOOL) supportsSecureCoding {
@@ -195,6 +269,12 @@
         NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
 
         self = [self initWithSerializedData:pickle key:key error:&error];
+    } else if ([version isEqualToString:@"2"]) {
+        // version 2 archives hold a binary pickle, with no base64 to decode
+        NSData *pickle = [decoder decodeObjectOfClass:[NSData class] forKey:@"pickle"];
+        NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
+
+        self = [self initWithSerializedBinaryData:pickle key:key error:&error];
     }
 
     NSParameterAssert(error == nil);
@@ -209,12 +289,12 @@
 - (void)encodeWithCoder:(NSCoder *)encoder {
     NSData *key = [OLMUtility randomBytesOfLength:32];
     NSError *error = nil;
-    NSString *pickle = [self serializeDataWithKey:key error:&error];
+    NSData *pickle = [self serializeBinaryDataWithKey:key error:&error];
     NSParameterAssert(pickle.length > 0 && error == nil);
 
     [encoder encodeObject:pickle forKey:@"pickle"];
     [encoder encodeObject:key forKey:@"key"];
-    [encoder encodeObject:@"1" forKey:@"version"];
+    [encoder encodeObject:@"2" forKey:@"version"];
 }
 
 @end
@@ -26,4 +26,10 @@
 /** Serializes and encrypts object data, outputs base64 blob */
 - (NSString*) serializeDataWithKey:(NSData*)key error:(NSError**)error;
 
+/** Initializes from an encrypted binary pickle, as made by serializeBinaryDataWithKey:error:. Will throw error if invalid key. */
+- (instancetype) initWithSerializedBinaryData:(NSData*)serializedData key:(NSData*)key error:(NSError**)error;
+
+/** Serializes and encrypts object data, outputs a binary pickle, which is smaller than the base64 blob and quicker to load */
+- (NSData*) serializeBinaryDataWithKey:(NSData*)key error:(NSError**)error;
+
 @end
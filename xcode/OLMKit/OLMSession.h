@@ -41,4 +41,11 @@
 /** base64 ciphertext -> UTF-8 plaintext */
 - (NSString*) decryptMessage:(OLMMessage*)message error:(NSError**)error;
 
+/** plaintext -> binary ciphertext, for decryptRawMessage:messageType:error: */
+- (NSData*) encryptRawMessage:(NSData*)plaintext messageType:(OLMMessageType*)messageType error:(NSError**)error;
+
+/** binary ciphertext -> plaintext. The message isn't copied, and the plaintext
+ is wiped when it is released. */
+- (NSData*) decryptRawMessage:(NSData*)message messageType:(OLMMessageType)messageType error:(NSError**)error;
+
 @end
@@ -246,26 +246,24 @@
         return nil;
     }
     NSMutableData *mutMessage = messageData.mutableCopy;
-    size_t maxPlaintextLength = olm_decrypt_max_plaintext_length(_session, message.type, mutMessage.mutableBytes, mutMessage.length);
+    size_t maxPlaintextLength = olm_peek_max_plaintext_length(_session, message.type, mutMessage.mutableBytes, mutMessage.length);
     if (maxPlaintextLength == olm_error()) {
         const char *olm_error = olm_session_last_error(_session);
 
         NSString *errorString = [NSString stringWithUTF8String:olm_error];
-        NSLog(@"olm_decrypt_max_plaintext_length error: %@", errorString);
+        NSLog(@"olm_peek_max_plaintext_length error: %@", errorString);
 
         if (error && olm_error && errorString) {
             *error = [NSError errorWithDomain:OLMErrorDomain
                                          code:0
                                      userInfo:@{
                                                 NSLocalizedDescriptionKey: errorString,
-                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_decrypt_max_plaintext_length error: %@", errorString]
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_peek_max_plaintext_length error: %@", errorString]
                                                 }];
         }
 
         return nil;
     }
-    // message buffer is destroyed by olm_decrypt_max_plaintext_length
-    mutMessage = messageData.mutableCopy;
     NSMutableData *plaintextData = [NSMutableData dataWithLength:maxPlaintextLength];
     size_t plaintextLength = olm_decrypt(_session, message.type, mutMessage.mutableBytes, mutMessage.length, plaintextData.mutableBytes, plaintextData.length);
     if (plaintextLength == olm_error()) {
@@ -291,6 +289,91 @@
     return plaintext;
 }
 
+- (NSData*) encryptRawMessage:(NSData*)plaintext messageType:(OLMMessageType*)messageType error:(NSError**)error {
+    NSParameterAssert(plaintext != nil);
+    size_t type = olm_encrypt_message_type(_session);
+    size_t randomLength = olm_encrypt_random_length(_session);
+    NSMutableData *random = [OLMUtility randomBytesOfLength:randomLength];
+    size_t ciphertextLength = olm_encrypt_raw_message_length(_session, plaintext.length);
+    NSMutableData *ciphertext = [NSMutableData dataWithLength:ciphertextLength];
+    if (!random || !ciphertext) {
+        return nil;
+    }
+    size_t result = olm_encrypt_raw(_session, plaintext.bytes, plaintext.length, random.mutableBytes, random.length, ciphertext.mutableBytes, ciphertext.length);
+    [random resetBytesInRange:NSMakeRange(0, random.length)];
+    if (result == olm_error()) {
+        const char *olm_error = olm_session_last_error(_session);
+
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        NSLog(@"olm_encrypt_raw error: %@", errorString);
+
+        if (error && olm_error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain
+                                         code:0
+                                     userInfo:@{
+                                                NSLocalizedDescriptionKey: errorString,
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_encrypt_raw error: %@", errorString]
+                                                }];
+        }
+
+        return nil;
+    }
+    ciphertext.length = result;
+    if (messageType) {
+        *messageType = type;
+    }
+    return ciphertext;
+}
+
+- (NSData*) decryptRawMessage:(NSData*)message messageType:(OLMMessageType)messageType error:(NSError**)error {
+    NSParameterAssert(message != nil);
+    size_t maxPlaintextLength = olm_decrypt_raw_max_plaintext_length(_session, messageType, message.bytes, message.length);
+    if (maxPlaintextLength == olm_error()) {
+        const char *olm_error = olm_session_last_error(_session);
+
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        NSLog(@"olm_decrypt_raw_max_plaintext_length error: %@", errorString);
+
+        if (error && olm_error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain
+                                         code:0
+                                     userInfo:@{
+                                                NSLocalizedDescriptionKey: errorString,
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_decrypt_raw_max_plaintext_length error: %@", errorString]
+                                                }];
+        }
+
+        return nil;
+    }
+    uint8_t *plaintext = malloc(maxPlaintextLength ? maxPlaintextLength : 1);
+    if (!plaintext) {
+        return nil;
+    }
+    size_t plaintextLength = olm_decrypt_raw(_session, messageType, message.bytes, message.length, plaintext, maxPlaintextLength);
+    if (plaintextLength == olm_error()) {
+        memset_s(plaintext, maxPlaintextLength, 0, maxPlaintextLength);
+        free(plaintext);
+        const char *olm_error = olm_session_last_error(_session);
+
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        NSLog(@"olm_decrypt_raw error: %@", errorString);
+
+        if (error && olm_error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain
+                                         code:0
+                                     userInfo:@{
+                                                NSLocalizedDescriptionKey: errorString,
+                                                NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"olm_decrypt_raw error: %@", errorString]
+                                                }];
+        }
+
+        return nil;
+    }
+    // only the plaintext is wiped when the data is released
+    memset_s(plaintext + plaintextLength, maxPlaintextLength - plaintextLength, 0, maxPlaintextLength - plaintextLength);
+    return [OLMUtility dataWithWipedBytesNoCopy:plaintext length:plaintextLength];
+}
+
 #pragma mark OLMSerializable
 
 /** Initializes from encrypted serialized data. Will throw error if invalid key or invalid base64. */
@@ -338,6 +421,51 @@
     return pickleString;
 }
 
+/** Initializes from an encrypted binary pickle. Will throw error if invalid key. */
+- (instancetype) initWithSerializedBinaryData:(NSData*)serializedData key:(NSData*)key error:(NSError**)error {
+    self = [self init];
+    if (!self) {
+        return nil;
+    }
+    NSParameterAssert(key.length > 0);
+    NSParameterAssert(serializedData.length > 0);
+    if (key.length == 0 || serializedData.length == 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: @"Bad length."}];
+        }
+        return nil;
+    }
+    NSMutableData *pickle = serializedData.mutableCopy;
+    size_t result = olm_unpickle_session_binary(_session, key.bytes, key.length, pickle.mutableBytes, pickle.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_session_last_error(_session);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    return self;
+}
+
+/** Serializes and encrypts object data, outputs a binary pickle */
+- (NSData*) serializeBinaryDataWithKey:(NSData*)key error:(NSError**)error {
+    NSParameterAssert(key.length > 0);
+    size_t length = olm_pickle_session_binary_length(_session);
+    NSMutableData *pickled = [NSMutableData dataWithLength:length];
+    size_t result = olm_pickle_session_binary(_session, key.bytes, key.length, pickled.mutableBytes, pickled.length);
+    if (result == olm_error()) {
+        const char *olm_error = olm_session_last_error(_session);
+        NSString *errorString = [NSString stringWithUTF8String:olm_error];
+        if (error && errorString) {
+            *error = [NSError errorWithDomain:OLMErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey: errorString}];
+        }
+        return nil;
+    }
+    pickled.length = result;
+    return pickled;
+}
+
 #pragma mark NSSecureCoding
 
 + (BOOL) supportsSecureCoding {
@@ -356,6 +484,12 @@
         NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
         
         self = [self initWithSerializedData:pickle key:key error:&error];
+    } else if ([version isEqualToString:@"2"]) {
+        // version 2 archives hold a binary pickle, with no base64 to decode
+        NSData *pickle = [decoder decodeObjectOfClass:[NSData class] forKey:@"pickle"];
+        NSData *key = [decoder decodeObjectOfClass:[NSData class] forKey:@"key"];
+
+        self = [self initWithSerializedBinaryData:pickle key:key error:&error];
     }
     
     NSParameterAssert(error == nil);
@@ -370,12 +504,12 @@
 - (void)encodeWithCoder:(NSCoder *)encoder {
     NSData *key = [OLMUtility randomBytesOfLength:32];
     NSError *error = nil;
-    NSString *pickle = [self serializeDataWithKey:key error:&error];
+    NSData *pickle = [self serializeBinaryDataWithKey:key error:&error];
     NSParameterAssert(pickle.length > 0 && error == nil);
     
     [encoder encodeObject:pickle forKey:@"pickle"];
     [encoder encodeObject:key forKey:@"key"];
-    [encoder encodeObject:@"1" forKey:@"version"];
+    [encoder encodeObject:@"2" forKey:@"version"];
 }
 
 @end
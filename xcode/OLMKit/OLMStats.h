@@ -0,0 +1,73 @@
+/*
+ Copyright 2016 OpenMarket Ltd
+ Copyright 2016 Vector Creations Ltd
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#import <Foundation/Foundation.h>
+
+/*
+ from olm/stats.h
+ */
+typedef NS_ENUM(NSInteger, OLMStatsOperation) {
+    OLMStatsOperationCreateOutboundSession = 0,
+    OLMStatsOperationCreateInboundSession = 1,
+    OLMStatsOperationEncrypt = 2,
+    OLMStatsOperationDecrypt = 3,
+    OLMStatsOperationGroupEncrypt = 4,
+    OLMStatsOperationGroupDecrypt = 5,
+    OLMStatsOperationPickle = 6,
+    OLMStatsOperationUnpickle = 7
+};
+
+/**
+ A snapshot of libolm's counters of the work it has done, and of the time
+ spent in its main calls, on the calling thread. The counters are only kept
+ if libolm was built with OLM_STATS; otherwise they are all zero.
+ */
+@interface OLMStats : NSObject
+
+/** SHA-256 compression function calls, one per 64 byte block */
+@property (readonly) uint64_t sha256Blocks;
+/** HMAC-SHA-256s, including those inside HKDFs */
+@property (readonly) uint64_t hmacSha256;
+@property (readonly) uint64_t hkdfSha256;
+/** AES-256 blocks encrypted or decrypted */
+@property (readonly) uint64_t aesBlocks;
+/** X25519 key pairs generated, and shared secrets computed */
+@property (readonly) uint64_t curve25519Keys;
+@property (readonly) uint64_t curve25519SharedSecrets;
+@property (readonly) uint64_t ed25519Signs;
+@property (readonly) uint64_t ed25519Verifies;
+/** Parts of a Megolm ratchet rehashed */
+@property (readonly) uint64_t megolmRehashes;
+/** Steps along an Olm ratchet's chain */
+@property (readonly) uint64_t chainKeyAdvances;
+
+/** How many times the operation was called */
+- (uint64_t)callsForOperation:(OLMStatsOperation)operation;
+
+/** The total time spent in the operation, in nanoseconds */
+- (uint64_t)nanosecondsForOperation:(OLMStatsOperation)operation;
+
+/** Whether libolm keeps the counters: YES if it was built with OLM_STATS */
++ (BOOL)isEnabled;
+
+/** Take a snapshot of the calling thread's counters */
++ (nonnull instancetype)snapshot;
+
+/** Set the calling thread's counters back to zero */
++ (void)reset;
+
+@end
@@ -0,0 +1,76 @@
+/*
+ Copyright 2016 OpenMarket Ltd
+ Copyright 2016 Vector Creations Ltd
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#import "OLMStats.h"
+
+#include "olm/stats.h"
+
+@interface OLMStats ()
+{
+    OlmStats stats;
+}
+@end
+
+@implementation OLMStats
+
+- (uint64_t)sha256Blocks { return stats.sha256_blocks; }
+- (uint64_t)hmacSha256 { return stats.hmac_sha256; }
+- (uint64_t)hkdfSha256 { return stats.hkdf_sha256; }
+- (uint64_t)aesBlocks { return stats.aes_blocks; }
+- (uint64_t)curve25519Keys { return stats.curve25519_keys; }
+- (uint64_t)curve25519SharedSecrets { return stats.curve25519_shared_secrets; }
+- (uint64_t)ed25519Signs { return stats.ed25519_signs; }
+- (uint64_t)ed25519Verifies { return stats.ed25519_verifies; }
+- (uint64_t)megolmRehashes { return stats.megolm_rehashes; }
+- (uint64_t)chainKeyAdvances { return stats.chain_key_advances; }
+
+- (uint64_t)callsForOperation:(OLMStatsOperation)operation
+{
+    if (operation < 0 || operation >= OLM_STATS_OPERATION_COUNT)
+    {
+        return 0;
+    }
+    return stats.calls[operation];
+}
+
+- (uint64_t)nanosecondsForOperation:(OLMStatsOperation)operation
+{
+    if (operation < 0 || operation >= OLM_STATS_OPERATION_COUNT)
+    {
+        return 0;
+    }
+    return stats.nanoseconds[operation];
+}
+
++ (BOOL)isEnabled
+{
+    return olm_stats_enabled() != 0;
+}
+
++ (instancetype)snapshot
+{
+    OLMStats *snapshot = [[OLMStats alloc] init];
+    olm_stats_get(&snapshot->stats);
+    return snapshot;
+}
+
++ (void)reset
+{
+    olm_stats_reset();
+}
+
+@end
@@ -44,6 +44,24 @@ FOUNDATION_EXPORT NSString *const OLMErrorDomain;
  */
 - (BOOL)verifyEd25519Signature:(NSString*)signature key:(NSString*)key message:(NSData*)message error:(NSError**)error;
 
+/**
+ Give back memory when the system is short of it, by wiping the signing
+ keys kept decoded for verifyEd25519Signature. Call it from
+ didReceiveMemoryWarning, but not while the utility is in use on another
+ thread.
+ */
+- (void)trimMemory;
+
 + (NSMutableData*) randomBytesOfLength:(NSUInteger)length;
 
+/**
+ Wrap malloc'd bytes in an NSData without copying them. The bytes are wiped
+ and freed when the data is released, so this is suitable for plaintext.
+
+ @param bytes the bytes, allocated with malloc.
+ @param length the number of bytes.
+ @return the data, which owns the bytes.
+ */
++ (NSData*) dataWithWipedBytesNoCopy:(void*)bytes length:(NSUInteger)length;
+
 @end
@@ -62,6 +62,10 @@ NSString *const OLMErrorDomain = @"org.matrix.olm";
     return self;
 }
 
+- (void)trimMemory {
+    olm_utility_trim_memory(_utility, OLM_TRIM_MEMORY_CACHES);
+}
+
 - (NSString *)sha256:(NSData *)message {
     size_t length = olm_sha256_length(_utility);
 
@@ -118,4 +122,11 @@ NSString *const OLMErrorDomain = @"org.matrix.olm";
     return randomData;
 }
 
++ (NSData*) dataWithWipedBytesNoCopy:(void*)bytes length:(NSUInteger)length {
+    return [[NSData alloc] initWithBytesNoCopy:bytes length:length deallocator:^(void *bytes, NSUInteger length) {
+        memset_s(bytes, length, 0, length);
+        free(bytes);
+    }];
+}
+
 @end
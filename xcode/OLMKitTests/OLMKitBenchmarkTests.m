@@ -0,0 +1,113 @@
+/*
+ Copyright 2016 OpenMarket Ltd
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#import <XCTest/XCTest.h>
+
+#import <OLMKit/OLMKit.h>
+
+/*
+ Times the calls that benchmarks/bench_bindings.cpp makes straight to the C API, with the same
+ names and in the same order, so that the difference is what OLMKit adds to each call: NSString
+ and NSData conversions, JSON parsing and Objective-C messaging. Each result is logged as a line
+ in the same format as the native benchmarks.
+ */
+
+static const NSUInteger kIterations = 1000;
+
+@interface OLMKitBenchmarkTests : XCTestCase
+
+@end
+
+@implementation OLMKitBenchmarkTests
+
+- (void)time:(NSString *)name block:(void (^)(NSUInteger i))block {
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < kIterations; i++) {
+        block(i);
+    }
+    double nsPerOp = (CFAbsoluteTimeGetCurrent() - start) * 1e9 / kIterations;
+    NSLog(@"%-40s%12.1f ns/op", name.UTF8String, nsPerOp);
+}
+
+- (void)testGroup {
+    OLMOutboundGroupSession *outbound = [[OLMOutboundGroupSession alloc] initOutboundGroupSession];
+    OLMInboundGroupSession *inbound = [[OLMInboundGroupSession alloc] initInboundGroupSessionWithSessionKey:outbound.sessionKey error:nil];
+    NSData *key = [@"secret_key" dataUsingEncoding:NSUTF8StringEncoding];
+
+    NSMutableArray<NSString *> *messages = [NSMutableArray arrayWithCapacity:kIterations];
+    [self time:@"group encrypt" block:^(NSUInteger i) {
+        [messages addObject:[outbound encryptMessage:@"Hello, World" error:nil]];
+    }];
+    [self time:@"group decrypt" block:^(NSUInteger i) {
+        NSUInteger messageIndex;
+        [inbound decryptMessage:messages[i] messageIndex:&messageIndex error:nil];
+    }];
+    [self time:@"group pickle" block:^(NSUInteger i) {
+        [inbound serializeDataWithKey:key error:nil];
+    }];
+}
+
+- (void)testOneToOne {
+    [self time:@"account create" block:^(NSUInteger i) {
+        (void)[[OLMAccount alloc] initNewAccount];
+    }];
+
+    OLMAccount *alice = [[OLMAccount alloc] initNewAccount];
+    OLMAccount *bob = [[OLMAccount alloc] initNewAccount];
+    [bob generateOneTimeKeys:1];
+    NSString *bobIdKey = bob.identityKeys[@"curve25519"];
+    __block NSString *bobOneTimeKey = nil;
+    NSDictionary *bobOtkCurve25519 = bob.oneTimeKeys[@"curve25519"];
+    [bobOtkCurve25519 enumerateKeysAndObjectsUsingBlock:^(id  _Nonnull key, id  _Nonnull obj, BOOL * _Nonnull stop) {
+        bobOneTimeKey = obj;
+    }];
+
+    OLMSession *aliceSession = [[OLMSession alloc] initOutboundSessionWithAccount:alice theirIdentityKey:bobIdKey theirOneTimeKey:bobOneTimeKey error:nil];
+    OLMMessage *first = [aliceSession encryptMessage:@"Hello, World" error:nil];
+    OLMSession *bobSession = [[OLMSession alloc] initInboundSessionWithAccount:bob oneTimeKeyMessage:first.ciphertext error:nil];
+    [bobSession decryptMessage:first error:nil];
+
+    // bob replies so that alice stops sending pre-key messages
+    OLMMessage *reply = [bobSession encryptMessage:@"Hello, World" error:nil];
+    [aliceSession decryptMessage:reply error:nil];
+
+    NSMutableArray<OLMMessage *> *messages = [NSMutableArray arrayWithCapacity:kIterations];
+    [self time:@"one-to-one encrypt" block:^(NSUInteger i) {
+        [messages addObject:[aliceSession encryptMessage:@"Hello, World" error:nil]];
+    }];
+    [self time:@"one-to-one decrypt" block:^(NSUInteger i) {
+        [bobSession decryptMessage:messages[i] error:nil];
+    }];
+
+    NSData *key = [@"secret_key" dataUsingEncoding:NSUTF8StringEncoding];
+    [self time:@"session pickle" block:^(NSUInteger i) {
+        [bobSession serializeDataWithKey:key error:nil];
+    }];
+    NSString *pickled = [bobSession serializeDataWithKey:key error:nil];
+    [self time:@"session unpickle" block:^(NSUInteger i) {
+        (void)[[OLMSession alloc] initWithSerializedData:pickled key:key error:nil];
+    }];
+    NSData *binary = [bobSession serializeBinaryDataWithKey:key error:nil];
+    [self time:@"session unpickle binary" block:^(NSUInteger i) {
+        (void)[[OLMSession alloc] initWithSerializedBinaryData:binary key:key error:nil];
+    }];
+
+    NSError *error;
+    XCTAssertNotNil([[OLMSession alloc] initWithSerializedData:pickled key:key error:&error]);
+    XCTAssertNil(error);
+}
+
+@end
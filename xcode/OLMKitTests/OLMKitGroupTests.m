@@ -68,6 +68,59 @@
     XCTAssertNil(error);
 }
 
+- (void)testRawMessages {
+    NSError *error;
+
+    OLMOutboundGroupSession *aliceSession = [[OLMOutboundGroupSession alloc] initOutboundGroupSession];
+    OLMInboundGroupSession *bobSession = [[OLMInboundGroupSession alloc] initInboundGroupSessionWithSessionKey:aliceSession.sessionKey error:&error];
+    XCTAssertNil(error);
+
+    NSData *message = [@"Hello!" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *aliceToBobMsg = [aliceSession encryptRawMessage:message error:&error];
+    XCTAssertGreaterThan(aliceToBobMsg.length, 0);
+    XCTAssertNil(error);
+
+    NSUInteger messageIndex;
+    NSData *plaintext = [bobSession decryptRawMessage:aliceToBobMsg messageIndex:&messageIndex error:&error];
+    XCTAssertEqualObjects(message, plaintext);
+    XCTAssertEqual(messageIndex, 0);
+    XCTAssertNil(error);
+
+    // the raw messages are the same as the base64 ones
+    NSString *base64Msg = [aliceSession encryptMessage:@"Hello!" error:&error];
+    NSString *padding = [@"==" substringToIndex:(4 - base64Msg.length % 4) % 4];
+    NSData *rawMsg = [[NSData alloc] initWithBase64EncodedString:[base64Msg stringByAppendingString:padding] options:0];
+    plaintext = [bobSession decryptRawMessage:rawMsg messageIndex:&messageIndex error:&error];
+    XCTAssertEqualObjects(message, plaintext);
+    XCTAssertEqual(messageIndex, 1);
+}
+
+- (void)testDecryptMessages {
+    OLMOutboundGroupSession *aliceSession = [[OLMOutboundGroupSession alloc] initOutboundGroupSession];
+    OLMInboundGroupSession *bobSession = [[OLMInboundGroupSession alloc] initInboundGroupSessionWithSessionKey:aliceSession.sessionKey error:nil];
+
+    NSMutableArray<NSString*> *messages = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 10; i++) {
+        [messages addObject:[aliceSession encryptMessage:[NSString stringWithFormat:@"Hello %lu", (unsigned long)i] error:nil]];
+    }
+    [messages addObject:@"ARandomMessage"];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"decrypted"];
+    [bobSession decryptMessages:messages completion:^(NSArray<OLMGroupDecryptionResult *> *results) {
+        XCTAssert([NSThread isMainThread]);
+        XCTAssertEqual(results.count, 11);
+        for (NSUInteger i = 0; i < 10; i++) {
+            XCTAssertEqualObjects(results[i].plaintext, ([NSString stringWithFormat:@"Hello %lu", (unsigned long)i]));
+            XCTAssertEqual(results[i].messageIndex, i);
+            XCTAssertNil(results[i].error);
+        }
+        XCTAssertNil(results[10].plaintext);
+        XCTAssertNotNil(results[10].error);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
 - (void)testOutboundGroupSessionSerialization {
 
     OLMOutboundGroupSession *aliceSession = [[OLMOutboundGroupSession alloc] initOutboundGroupSession];
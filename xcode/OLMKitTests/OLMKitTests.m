@@ -133,6 +133,33 @@ limitations under the License.
     XCTAssertEqualObjects(bobOneTimeKeys, bobOneTimeKeys2);
 }
 
+- (void) testAccountBinarySerialization {
+    OLMAccount *bob = [[OLMAccount alloc] initNewAccount];
+    [bob generateOneTimeKeys:5];
+    NSData *key = [OLMUtility randomBytesOfLength:32];
+
+    NSError *error;
+    NSData *binary = [bob serializeBinaryDataWithKey:key error:&error];
+    XCTAssertNil(error);
+    NSString *base64 = [bob serializeDataWithKey:key error:&error];
+    XCTAssertNil(error);
+    XCTAssertLessThan(binary.length, base64.length);
+
+    OLMAccount *bob2 = [[OLMAccount alloc] initWithSerializedBinaryData:binary key:key error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(bob.identityKeys, bob2.identityKeys);
+    XCTAssertEqualObjects(bob.oneTimeKeys, bob2.oneTimeKeys);
+
+    // the base64 pickle still loads, for data saved before the binary format
+    OLMAccount *bob3 = [[OLMAccount alloc] initWithSerializedData:base64 key:key error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(bob.identityKeys, bob3.identityKeys);
+
+    NSData *wrongKey = [OLMUtility randomBytesOfLength:32];
+    XCTAssertNil([[OLMAccount alloc] initWithSerializedBinaryData:binary key:wrongKey error:&error]);
+    XCTAssertNotNil(error);
+}
+
 - (void) testSessionSerialization {
     NSError *error;
 